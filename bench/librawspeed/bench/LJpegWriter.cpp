@@ -0,0 +1,131 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "bench/LJpegWriter.h"
+#include "common/Common.h" // for uchar8, ushort16
+#include <cstdlib>         // for abs
+#include <vector>          // for vector
+
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace {
+
+class BitWriter final {
+public:
+  explicit BitWriter(std::vector<uchar8>* out_) : out(out_) {}
+
+  void put(unsigned v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+      bits = (bits << 1) | ((v >> i) & 1);
+      if (++fillLevel != 8)
+        continue;
+      out->emplace_back(bits);
+      if (bits == 0xFF)
+        out->emplace_back(0x00); // byte stuffing
+      bits = 0;
+      fillLevel = 0;
+    }
+  }
+
+  void putDiff(int diff) {
+    int cat = 0;
+    while ((std::abs(diff) >> cat) != 0)
+      cat++;
+    put(cat, 4);
+    if (cat)
+      put(diff < 0 ? diff + (1 << cat) - 1 : diff, cat);
+  }
+
+  void flush() {
+    while (fillLevel != 0)
+      put(1, 1);
+  }
+
+private:
+  std::vector<uchar8>* out;
+  unsigned bits = 0;
+  int fillLevel = 0;
+};
+
+} // namespace
+
+std::vector<uchar8> __attribute__((visibility("default")))
+writeLJpeg(const std::vector<ushort16>& samples, int cps, int frameW,
+           int height, int prec) {
+  std::vector<uchar8> out;
+  const auto put8 = [&out](int v) { out.emplace_back(v); };
+  const auto put16 = [&put8](int v) {
+    put8(v >> 8);
+    put8(v & 0xFF);
+  };
+
+  put16(0xFFD8); // SOI
+
+  put16(0xFFC4); // DHT
+  put16(2 + 1 + 16 + 16);
+  put8(0x00);
+  for (int i = 0; i < 16; i++)
+    put8(i == 3 ? 16 : 0);
+  for (int i = 0; i < 16; i++)
+    put8(i);
+
+  put16(0xFFC3); // SOF3
+  put16(8 + 3 * cps);
+  put8(prec);
+  put16(height);
+  put16(frameW);
+  put8(cps);
+  for (int c = 0; c < cps; c++) {
+    put8(c + 1);
+    put8(0x11);
+    put8(0);
+  }
+
+  put16(0xFFDA); // SOS
+  put16(6 + 2 * cps);
+  put8(cps);
+  for (int c = 0; c < cps; c++) {
+    put8(c + 1);
+    put8(0x00);
+  }
+  put8(1); // predictor
+  put8(0);
+  put8(0); // point transform
+
+  BitWriter bits(&out);
+  const int pitch = frameW * cps;
+  std::vector<int> pred(cps, 1 << (prec - 1));
+  for (int row = 0; row < height; row++) {
+    for (int g = 0; g < frameW; g++) {
+      for (int c = 0; c < cps; c++) {
+        if (row > 0 && g == 0)
+          pred[c] = samples[(row - 1) * pitch + c];
+        const int v = samples[row * pitch + cps * g + c];
+        bits.putDiff(v - pred[c]);
+        pred[c] = v;
+      }
+    }
+  }
+  bits.flush();
+
+  put16(0xFFD9); // EOI
+  return out;
+}
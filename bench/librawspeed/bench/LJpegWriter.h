@@ -0,0 +1,32 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uchar8, ushort16
+#include <vector>          // for vector
+
+// A minimal lossless JPEG encoder, of the DNG layout: one frame row of cps
+// components per image row, with the predictor 1. Every difference category
+// gets a 4-bit code, so the differences are to stay within 15 bits.
+// The samples are frameW * cps per row.
+std::vector<rawspeed::uchar8>
+writeLJpeg(const std::vector<rawspeed::ushort16>& samples, int cps, int frameW,
+           int height, int prec);
@@ -0,0 +1,219 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/DngOpcodes.h"   // for DngOpcodes
+#include "bench/Common.h"        // for areaToRectangle
+#include "common/Common.h"       // for uchar8, uint32, ushort16
+#include "common/Executor.h"     // for setExecutor, ThreadPoolExecutor
+#include "common/Mutex.h"        // for MutexLocker
+#include "common/Point.h"        // for iPoint2D
+#include "common/RawImage.h"     // for RawImage, RawImageData
+#include "io/Buffer.h"           // for Buffer, DataBuffer
+#include "io/ByteStream.h"       // for ByteStream
+#include "io/Endianness.h"       // for Endianness
+#include "tiff/TiffEntry.h"      // for TiffEntry, TIFF_UNDEFINED
+#include "tiff/TiffTag.h"        // for OPCODELIST2
+#include <benchmark/benchmark.h> // for State, Benchmark, BENCHMARK_MAIN
+#include <cstdint>               // for uint64_t
+#include <cstring>               // for memcpy
+#include <memory>                // for make_shared
+#include <vector>                // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::DngOpcodes;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::MutexLocker;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::TiffEntry;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace {
+
+enum Opcode {
+  FixBadPixelsConstant = 4,
+  FixBadPixelsList = 5,
+  MapTable = 7,
+  MapPolynomial = 8,
+  GainMap = 9,
+  DeltaPerRow = 10,
+  DeltaPerColumn = 11,
+  ScalePerRow = 12,
+  ScalePerColumn = 13,
+};
+
+// The opcodes are always big-endian.
+void putU32(std::vector<uchar8>* data, uint32 v) {
+  for (int i = 3; i >= 0; i--)
+    data->emplace_back(v >> (8 * i));
+}
+
+void putFloat(std::vector<uchar8>* data, float f) {
+  uint32 v;
+  memcpy(&v, &f, sizeof(v));
+  putU32(data, v);
+}
+
+void putDouble(std::vector<uchar8>* data, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  putU32(data, v >> 32);
+  putU32(data, v);
+}
+
+// The parameters of the opcode, of the kind that the DNGs of the cameras
+// have, for the whole image.
+std::vector<uchar8> makeParameters(Opcode code, const iPoint2D& dim) {
+  std::vector<uchar8> p;
+
+  switch (code) {
+  case FixBadPixelsConstant:
+    putU32(&p, 0); // the value
+    putU32(&p, 0); // the phase
+    return p;
+  case FixBadPixelsList: {
+    const uint32 count = 1000;
+    putU32(&p, 0); // the phase
+    putU32(&p, count);
+    putU32(&p, 0); // no rectangles
+    for (uint32 i = 0; i < count; i++) {
+      putU32(&p, (i * 7919) % dim.y);
+      putU32(&p, (i * 104729) % dim.x);
+    }
+    return p;
+  }
+  default:
+    break;
+  }
+
+  // The area, the planes, and the pitches, of all of the pixel opcodes.
+  for (uint32 v : {0U, 0U, static_cast<uint32>(dim.y),
+                   static_cast<uint32>(dim.x), 0U, 1U, 1U, 1U})
+    putU32(&p, v);
+
+  switch (code) {
+  case MapTable:
+    putU32(&p, 65536);
+    for (uint32 i = 0; i < 65536; i++) {
+      p.emplace_back(static_cast<uchar8>(i >> 7));
+      p.emplace_back(static_cast<uchar8>(i << 1));
+    }
+    break;
+  case MapPolynomial:
+    putU32(&p, 2); // the degree
+    for (double c : {0.01, 0.9, 0.1})
+      putDouble(&p, c);
+    break;
+  case GainMap: {
+    const uint32 points = 17;
+    putU32(&p, points);
+    putU32(&p, points);
+    putDouble(&p, 1.0 / (points - 1));
+    putDouble(&p, 1.0 / (points - 1));
+    putDouble(&p, 0.0);
+    putDouble(&p, 0.0);
+    putU32(&p, 1); // the planes of the map
+    for (uint32 i = 0; i < points * points; i++)
+      putFloat(&p, 1.0F + (i % 5) * 0.01F);
+    break;
+  }
+  default: {
+    const bool perColumn = code == DeltaPerColumn || code == ScalePerColumn;
+    const bool scale = code == ScalePerRow || code == ScalePerColumn;
+    const int count = perColumn ? dim.x : dim.y;
+    putU32(&p, count);
+    for (int i = 0; i < count; i++)
+      putFloat(&p, scale ? 1.0F + (i % 7) * 0.01F : (i % 7) * 0.001F);
+    break;
+  }
+  }
+  return p;
+}
+
+// The opcode is state.range(0), the area is state.range(1), the threads
+// are state.range(2).
+void BM_DngOpcodes(benchmark::State& state) {
+  const auto code = static_cast<Opcode>(state.range(0));
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+
+  const std::vector<uchar8> parameters = makeParameters(code, dim);
+  std::vector<uchar8> data;
+  putU32(&data, 1); // the number of opcodes
+  putU32(&data, code);
+  putU32(&data, 0); // version
+  putU32(&data, 0); // flags
+  putU32(&data, parameters.size());
+  data.insert(data.end(), parameters.begin(), parameters.end());
+  TiffEntry entry(
+      nullptr, rawspeed::OPCODELIST2, rawspeed::TIFF_UNDEFINED, data.size(),
+      ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                            Endianness::little)));
+
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      row[x] = ((x * 13 + y * 7) & 16383) + 1;
+  }
+  DngOpcodes opcodes(mRaw, &entry);
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(2)));
+  for (auto _ : state) {
+    opcodes.applyOpCodes(mRaw);
+
+    // The bad pixels ones only collect them, for fixBadPixels().
+    state.PauseTiming();
+    {
+      MutexLocker guard(&mRaw->mBadPixelMutex);
+      mRaw->mBadPixelPositions.clear();
+    }
+    state.ResumeTiming();
+  }
+  setExecutor(nullptr);
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void CustomArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"opcode", "area", "threads"});
+  for (Opcode code :
+       {FixBadPixelsConstant, FixBadPixelsList, MapTable, MapPolynomial,
+        GainMap, DeltaPerRow, DeltaPerColumn, ScalePerRow, ScalePerColumn}) {
+    for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+      b->Args({code, 24 << 20, threads});
+  }
+  // The other threads do not count into the CPU time of this one.
+  b->UseRealTime();
+  b->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_DngOpcodes)->Apply(CustomArgs);
+
+BENCHMARK_MAIN();
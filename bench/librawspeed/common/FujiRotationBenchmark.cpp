@@ -0,0 +1,74 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/FujiRotation.h" // for FujiRotation
+#include "bench/Common.h"        // for areaToRectangle
+#include "common/Executor.h"     // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"        // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"     // for RawImage, RawImageData
+#include <benchmark/benchmark.h> // for State, Benchmark, BENCHMARK_MAIN
+#include <memory>                // for make_shared
+
+using rawspeed::FujiRotation;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+
+namespace {
+
+// Whether it is the alternate layout is state.range(0), the area of the
+// unrotated image is state.range(1), the threads are state.range(2).
+void BM_FujiRotation(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {4, 3});
+  const FujiRotation rotation(dim, state.range(0) != 0);
+
+  RawImage src = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  src->clearArea(iRectangle2D({0, 0}, dim), 1);
+  RawImage dst =
+      RawImage::create(rotation.rotatedSize, rawspeed::TYPE_USHORT16, 1);
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(2)));
+  for (auto _ : state)
+    rotation.rotate(src, {0, 0}, dst);
+  setExecutor(nullptr);
+
+  state.SetComplexityN(rotation.rotatedSize.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void CustomArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"alt", "area", "threads"});
+  for (int alt : {0, 1}) {
+    for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+      b->Args({alt, 12 << 20, threads});
+  }
+  // The other threads do not count into the CPU time of this one.
+  b->UseRealTime();
+  b->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_FujiRotation)->Apply(CustomArgs);
+
+BENCHMARK_MAIN();
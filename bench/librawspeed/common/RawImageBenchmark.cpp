@@ -0,0 +1,240 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h" // for WITH_SSE2, WITH_AVX2, WITH_AVX512
+#include "common/RawImage.h"     // for RawImage, RawImageData, RawImageType
+#include "bench/Common.h"        // for areaToRectangle
+#include "common/Common.h"       // for ushort16, uint32
+#include "common/Cpuid.h"        // for Cpuid
+#include "common/Executor.h"     // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"        // for iPoint2D, iRectangle2D
+#include "metadata/BlackArea.h"  // for BlackArea
+#include <benchmark/benchmark.h> // for State, Benchmark, BENCHMARK_MAIN
+#include <memory>                // for make_shared
+#include <vector>                // for vector
+
+using rawspeed::Cpuid;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace {
+
+// The values of a 14-bit sensor, with some noise.
+RawImage makeImage(const iPoint2D& dim) {
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  uint32 random = 1;
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = 512 + ((x * 3 + y * 5) & 8191) + ((random >> 16) & 255);
+    }
+  }
+  mRaw->isCFA = true;
+  mRaw->cfa.setCFA(iPoint2D(2, 2), rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                   rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+  return mRaw;
+}
+
+// The variants of the kernels of scaleValues(), by the instruction set that
+// each one is dispatched on, 0 being the plain one.
+constexpr Cpuid::Feature variants[] = {
+    static_cast<Cpuid::Feature>(0), Cpuid::FEATURE_SSE2,
+    Cpuid::FEATURE_AVX2, Cpuid::FEATURE_AVX512BW, Cpuid::FEATURE_NEON};
+
+bool isBuilt(Cpuid::Feature feature) {
+  switch (feature) {
+#ifdef WITH_SSE2
+  case Cpuid::FEATURE_SSE2:
+    return true;
+#endif
+#ifdef WITH_AVX2
+  case Cpuid::FEATURE_AVX2:
+    return true;
+#endif
+#ifdef WITH_AVX512
+  case Cpuid::FEATURE_AVX512BW:
+    return true;
+#endif
+#ifdef WITH_NEON
+  case Cpuid::FEATURE_NEON:
+    return true;
+#endif
+  default:
+    return feature == 0;
+  }
+}
+
+// The variant is state.range(0), whether to dither is state.range(1), the
+// area is state.range(2), the threads are state.range(3).
+void BM_scaleBlackWhite(benchmark::State& state) {
+  const Cpuid::Feature feature = variants[state.range(0)];
+  if (!isBuilt(feature) || (feature && !(Cpuid::getDetected() & feature))) {
+    state.SkipWithError("The variant is not available");
+    return;
+  }
+
+  const auto dim = areaToRectangle(state.range(2), {2, 2});
+  RawImage mRaw = makeImage(dim);
+  mRaw->blackLevelSeparate = {{512, 513, 514, 515}};
+  mRaw->whitePoint = 16383;
+  mRaw->mDitherScale = state.range(1) != 0;
+
+  // The dispatch picks the widest enabled one.
+  Cpuid::setEnabled(feature);
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(3)));
+  for (auto _ : state)
+    mRaw->scaleBlackWhite();
+  setExecutor(nullptr);
+  Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void ScaleArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"variant", "dither", "area", "threads"});
+  for (int variant = 0; variant < 5; variant++) {
+    for (int dither : {0, 1}) {
+      for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+        b->Args({variant, dither, 24 << 20, threads});
+    }
+  }
+  // The other threads do not count into the CPU time of this one.
+  b->UseRealTime();
+  b->Unit(benchmark::kMillisecond);
+}
+
+// The width of the black areas, at the left and at the top, is
+// state.range(0), the area is state.range(1), the threads are
+// state.range(2).
+void BM_calculateBlackAreas(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  RawImage mRaw = makeImage(dim);
+  mRaw->blackAreas.emplace_back(0, state.range(0), true);
+  mRaw->blackAreas.emplace_back(0, state.range(0), false);
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(2)));
+  for (auto _ : state)
+    mRaw->calculateBlackAreas();
+  setExecutor(nullptr);
+
+  const int64_t pixels =
+      static_cast<int64_t>(state.range(0)) * (dim.x + dim.y);
+  state.SetComplexityN(pixels);
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void BlackAreasArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"width", "area", "threads"});
+  for (int width : {64, 256}) {
+    for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+      b->Args({width, 24 << 20, threads});
+  }
+  b->UseRealTime();
+  b->Unit(benchmark::kMicrosecond);
+}
+
+// One in state.range(0) of the pixels is bad, the area is state.range(1),
+// the threads are state.range(2). The few bad pixels stay in the sorted
+// list, the many of them go into the map.
+void BM_fixBadPixels(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  RawImage mRaw = makeImage(dim);
+
+  std::vector<rawspeed::BadPixelPosition> positions;
+  uint32 random = 1;
+  const int64_t count = dim.area() / state.range(0);
+  for (int64_t i = 0; i < count; i++) {
+    random = random * 1103515245U + 12345U;
+    const uint32 x = (random >> 8) % dim.x;
+    random = random * 1103515245U + 12345U;
+    const uint32 y = (random >> 8) % dim.y;
+    positions.emplace_back(rawspeed::getBadPixelPosition(x, y));
+  }
+  mRaw->addBadPixels(positions);
+  mRaw->transferBadPixelsToMap();
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(2)));
+  for (auto _ : state) {
+    mRaw->mBadPixelsFixed = false;
+    mRaw->fixBadPixels();
+  }
+  setExecutor(nullptr);
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void BadPixelsArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"every", "area", "threads"});
+  for (int every : {100000, 1000, 10}) {
+    for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+      b->Args({every, 24 << 20, threads});
+  }
+  b->UseRealTime();
+  b->Unit(benchmark::kMillisecond);
+}
+
+// The border of the width state.range(0) all around, the area is
+// state.range(1), the threads are state.range(2).
+void BM_expandBorder(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  RawImage mRaw = makeImage(dim);
+  const int border = state.range(0);
+  const iRectangle2D valid(border, border, dim.x - 2 * border,
+                           dim.y - 2 * border);
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(2)));
+  for (auto _ : state)
+    mRaw->expandBorder(valid);
+  setExecutor(nullptr);
+
+  state.SetComplexityN(dim.area() - valid.dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void BorderArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"border", "area", "threads"});
+  for (int border : {8, 64}) {
+    for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+      b->Args({border, 24 << 20, threads});
+  }
+  b->UseRealTime();
+  b->Unit(benchmark::kMicrosecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_scaleBlackWhite)->Apply(ScaleArgs);
+BENCHMARK(BM_calculateBlackAreas)->Apply(BlackAreasArgs);
+BENCHMARK(BM_fixBadPixels)->Apply(BadPixelsArgs);
+BENCHMARK(BM_expandBorder)->Apply(BorderArgs);
+
+BENCHMARK_MAIN();
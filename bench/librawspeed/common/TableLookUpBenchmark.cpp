@@ -0,0 +1,117 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/TableLookUp.h"  // for TableLookUp
+#include "bench/Common.h"        // for areaToRectangle
+#include "common/Common.h"       // for ushort16, uint32
+#include "common/Executor.h"     // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"        // for iPoint2D
+#include "common/RawImage.h"     // for RawImage, RawImageData
+#include <benchmark/benchmark.h> // for State, Benchmark, BENCHMARK_MAIN
+#include <memory>                // for make_shared
+#include <vector>                // for vector
+
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace {
+
+// Whether to dither is state.range(0), the area is state.range(1), the
+// threads are state.range(2).
+void BM_sixteenBitLookup(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  // Some garbage, the values of a 14-bit sensor, and a curve for them.
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      row[x] = (x * 13 + y * 7) & 16383;
+  }
+  std::vector<ushort16> curve(16384);
+  for (size_t i = 0; i < curve.size(); i++)
+    curve[i] = i * i / 4096;
+  mRaw->setTable(curve, state.range(0) != 0);
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(2)));
+  for (auto _ : state)
+    mRaw->sixteenBitLookup();
+  setExecutor(nullptr);
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void CustomArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"dither", "area", "threads"});
+  for (int dither : {0, 1}) {
+    for (int threads : {1, rawspeed_get_number_of_processor_cores()})
+      b->Args({dither, 24 << 20, threads});
+  }
+  // The other threads do not count into the CPU time of this one.
+  b->UseRealTime();
+  b->Unit(benchmark::kMillisecond);
+}
+
+// As the decompressors store the pixels one by one, through the table, while
+// decoding. Whether to dither is state.range(0), the area is state.range(1).
+void BM_setWithLookUp(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  std::vector<ushort16> curve(16384);
+  for (size_t i = 0; i < curve.size(); i++)
+    curve[i] = i * i / 4096;
+  mRaw->setTable(curve, state.range(0) != 0);
+
+  for (auto _ : state) {
+    for (int y = 0; y < dim.y; y++) {
+      auto* row = mRaw->getData(0, y);
+      uint32 random = y;
+      for (int x = 0; x < dim.x; x++) {
+        mRaw->setWithLookUp((x * 13 + y * 7) & 16383,
+                            row + sizeof(ushort16) * x, &random);
+      }
+    }
+    benchmark::ClobberMemory();
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void SetArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"dither", "area"});
+  b->Args({0, 24 << 20});
+  b->Args({1, 24 << 20});
+  b->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_sixteenBitLookup)->Apply(CustomArgs);
+BENCHMARK(BM_setWithLookUp)->Apply(SetArgs);
+
+BENCHMARK_MAIN();
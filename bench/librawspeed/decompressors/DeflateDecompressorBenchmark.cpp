@@ -58,9 +58,15 @@ compressChunk(const rawspeed::RawImage& mRaw, uLong* bufSize) {
   assert(*bufSize > 0);
   assert(*bufSize <= std::numeric_limits<Buffer::size_type>::max());
 
-  // will contain some random garbage
+  // Random bytes, so that the values are mostly the normal numbers, as they
+  // are in the real images, and so that the inflate does not dominate.
   auto uBuf = Buffer::Create(uncompressedLength);
   assert(uBuf != nullptr);
+  rawspeed::uint32 random = 1;
+  for (uLong i = 0; i < uncompressedLength; i++) {
+    random = random * 1103515245U + 12345U;
+    uBuf.get()[i] = random >> 16;
+  }
 
   auto cBuf = Buffer::Create(*bufSize);
   assert(cBuf != nullptr);
@@ -109,26 +115,32 @@ static inline void BM_DeflateDecompressor(benchmark::State& state) {
     break;
   }
 
-  std::unique_ptr<unsigned char[]> uBuffer; // NOLINT
+  DeflateDecompressor::ThreadState threadState;
 
   const rawspeed::ByteStream bs(buf, 0, buf.getSize());
 
   for (auto _ : state) {
     DeflateDecompressor d(bs, mRaw, predictor, BPS::value);
 
-    d.decode(&uBuffer, mRaw->dim.x, mRaw->dim.y, mRaw->dim.x, mRaw->dim.y, 0,
-             0);
+    d.decode(&threadState, mRaw->dim.x, mRaw->dim.y, mRaw->dim.x, mRaw->dim.y,
+             0, 0);
   }
 
   state.SetComplexityN(dim.area());
   state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
   state.SetBytesProcessed(BPS::value * state.items_processed() / 8);
+  state.counters["Rows"] = benchmark::Counter(
+      static_cast<double>(dim.y) * state.iterations(),
+      benchmark::Counter::kIsRate);
 }
 
 static inline void CustomArgs(benchmark::internal::Benchmark* b) {
   b->RangeMultiplier(2);
 // FIXME: appears to not like 1GPix+ buffers
 #if 1
+  // A typical tile of a tiled float DNG, where the setup of each tile counts,
+  // and the whole image as a single tile.
+  b->Arg(256 * 256);
   b->Arg(128 << 20);
 #else
   b->Range(1, 1023 << 20)->Complexity(benchmark::oN);
@@ -0,0 +1,298 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Common.h"                      // for uchar8, uint64
+#include "decompressors/HuffmanTableLUT.h"      // for BasicHuffmanTableLUT
+#include "decompressors/HuffmanTableLookup.h"   // for HuffmanTableLookup
+#include "decompressors/HuffmanTableMultiLUT.h" // for HuffmanTableMultiLUT
+#include "decompressors/HuffmanTableTree.h"     // for HuffmanTableTree
+#include "decompressors/HuffmanTableVector.h"   // for HuffmanTableVector
+#include "io/BitPumpMSB.h"                      // for BitPumpMSB
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, Endianne...
+#include <array>                                // for array
+#include <benchmark/benchmark.h>                // for State, Benchmark, ...
+#include <cassert>                              // for assert
+#include <cstddef>                              // for size_t
+#include <utility>                              // for pair
+#include <vector>                               // for vector
+
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::uchar8;
+using rawspeed::uint64;
+
+namespace {
+
+struct Table final {
+  const char* name;
+  std::array<uchar8, 16> nCodesPerLength;
+  std::vector<uchar8> codeValues;
+};
+
+// The shapes of the tables of the real files. The CR2 and the DNG encoders
+// compute theirs per file, from the same kind of the exponential
+// distribution of the differences, as the fixed ones of the NEF and PEF.
+// The first one is the JPEG luminance DC table (ITU T.81, table K.3): the
+// code values are the indexes of the codes, which are in the order of
+// increasing length.
+const std::array<Table, 5> tables = {{
+    {"JPEG K.3",
+     {{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0}},
+     {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}},
+    {"NEF 12-bit lossy",
+     {{0, 1, 5, 1, 1, 1, 1, 1, 1, 2, 0, 0, 0, 0, 0, 0}},
+     {5, 4, 3, 6, 2, 7, 1, 0, 8, 9, 11, 10, 12}},
+    {"NEF 12-bit lossless",
+     {{0, 1, 4, 2, 3, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0}},
+     {5, 4, 6, 3, 7, 2, 8, 1, 9, 0, 10, 11, 12}},
+    {"NEF 14-bit lossless",
+     {{0, 1, 4, 2, 2, 3, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0}},
+     {7, 6, 8, 5, 9, 4, 10, 3, 11, 12, 2, 0, 1, 13, 14}},
+    {"PEF legacy",
+     {{0, 2, 3, 1, 1, 1, 1, 1, 1, 2, 0, 0, 0, 0, 0, 0}},
+     {3, 4, 2, 5, 1, 6, 0, 7, 8, 9, 10, 11, 12}},
+}};
+
+template <typename HT> HT createTable(const Table& table = tables[0]) {
+  HT ht;
+  const auto count =
+      ht.setNCodesPerLength(Buffer(table.nCodesPerLength.data(), 16));
+  ht.setCodeValues(Buffer(table.codeValues.data(), count));
+  ht.setup(true, false);
+  return ht;
+}
+
+constexpr int BatchSize = 256;
+
+// The canonical codes of the table, in the order of its code values.
+struct Code final {
+  unsigned code;
+  unsigned length;
+  unsigned category;
+};
+
+std::vector<Code> getCodes(const Table& table) {
+  std::vector<Code> codes;
+  unsigned code = 0;
+  for (unsigned l = 1; l <= table.nCodesPerLength.size(); l++, code <<= 1) {
+    for (unsigned i = 0; i < table.nCodesPerLength[l - 1]; i++) {
+      codes.push_back({code, l, table.codeValues[codes.size()]});
+      code++;
+    }
+  }
+  return codes;
+}
+
+// The codes, each followed by the diff bits of its category.
+struct Input final {
+  std::vector<uchar8> data;
+  ByteStream bs;
+
+  // state.range(0) differences, whose lengths (categories) are uniformly
+  // distributed in [0, state.range(1)]. The smaller the differences, the
+  // more of them fit in one lookup of the HuffmanTableMultiLUT.
+  explicit Input(const benchmark::State& state) {
+    assert(state.range(1) >= 0);
+    assert(state.range(1) < static_cast<int>(tables[0].codeValues.size()));
+
+    const auto codes = getCodes(tables[0]);
+    unsigned random = 1;
+    for (int i = 0; i < state.range(0); i++) {
+      random = random * 1103515245U + 12345U;
+      const unsigned category = (random >> 16) % (state.range(1) + 1);
+      put(codes[category], random);
+    }
+    finish();
+  }
+
+  // count differences, each code with the probability of 2^-length, which
+  // is the distribution that the table was made for.
+  Input(const Table& table, int count) {
+    const auto codes = getCodes(table);
+    unsigned random = 1;
+    for (int i = 0; i < count;) {
+      random = random * 1103515245U + 12345U;
+      const unsigned r = random >> 16;
+      for (const Code& c : codes) {
+        if ((r >> (16 - c.length)) != c.code)
+          continue;
+        random = random * 1103515245U + 12345U;
+        put(c, random);
+        i++;
+        break;
+      }
+      // Otherwise, it is the part of the code space that is not used.
+    }
+    finish();
+  }
+
+private:
+  uint64 cache = 0;
+  unsigned fillLevel = 0;
+
+  void putBits(unsigned bits, unsigned len) {
+    cache = (cache << len) | bits;
+    fillLevel += len;
+    for (; fillLevel >= 8; fillLevel -= 8)
+      data.emplace_back(cache >> (fillLevel - 8));
+  }
+
+  // Any diff bits will do.
+  void put(const Code& c, unsigned random) {
+    putBits(c.code, c.length);
+    if (c.category)
+      putBits(random & ((1U << c.category) - 1U), c.category);
+  }
+
+  void finish() {
+    putBits(0, 64 - fillLevel % 8);
+    bs = ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                               Endianness::little));
+  }
+};
+
+template <typename HT>
+void BM_HuffmanTable_decodeNext(benchmark::State& state) {
+  const Input input(state);
+  const auto ht = createTable<HT>();
+
+  for (auto _ : state) {
+    BitPumpMSB bits(input.bs);
+    int sum = 0;
+    for (int i = 0; i < state.range(0); i++)
+      sum += ht.decodeNext(bits);
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.range(0) * state.iterations());
+}
+
+void BM_HuffmanTableMultiLUT_decodeDifferences(benchmark::State& state) {
+  const Input input(state);
+  const auto ht = createTable<rawspeed::HuffmanTableMultiLUT>();
+
+  assert(state.range(0) % BatchSize == 0);
+
+  std::array<int, BatchSize> diffs;
+  for (auto _ : state) {
+    BitPumpMSB bits(input.bs);
+    int sum = 0;
+    for (int i = 0; i < state.range(0); i += BatchSize) {
+      ht.decodeDifferences(bits, diffs.data(), BatchSize);
+      for (int diff : diffs)
+        sum += diff;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.range(0) * state.iterations());
+}
+
+// The table is state.range(0). As when decoding a slice or a tile.
+template <typename HT> void BM_HuffmanTable_setup(benchmark::State& state) {
+  const Table& table = tables[state.range(0)];
+  state.SetLabel(table.name);
+
+  for (auto _ : state) {
+    auto ht = createTable<HT>(table);
+    benchmark::DoNotOptimize(ht);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// The table is state.range(0), the count of the differences state.range(1).
+template <typename HT>
+void BM_HuffmanTable_decodeTable(benchmark::State& state) {
+  const Table& table = tables[state.range(0)];
+  state.SetLabel(table.name);
+  const Input input(table, state.range(1));
+  const auto ht = createTable<HT>(table);
+
+  for (auto _ : state) {
+    BitPumpMSB bits(input.bs);
+    int sum = 0;
+    for (int i = 0; i < state.range(1); i++)
+      sum += ht.decodeNext(bits);
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.range(1) * state.iterations());
+}
+
+void TableArguments(benchmark::internal::Benchmark* b) {
+  b->ArgName("table");
+  for (size_t t = 0; t < tables.size(); t++)
+    b->Arg(t);
+  b->Unit(benchmark::kMicrosecond);
+}
+
+void DecodeTableArguments(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"table", "count"});
+  for (size_t t = 0; t < tables.size(); t++)
+    b->Args({static_cast<int>(t), 1 << 20});
+  b->Unit(benchmark::kMillisecond);
+}
+
+void CustomArguments(benchmark::internal::Benchmark* b) {
+  for (int maxCategory : {3, 5, 8, 11})
+    b->Args({1 << 20, maxCategory});
+  b->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext,
+                   rawspeed::BasicHuffmanTableLUT<9>)
+    ->Apply(CustomArguments);
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext, rawspeed::HuffmanTableLUT)
+    ->Apply(CustomArguments);
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext,
+                   rawspeed::BasicHuffmanTableLUT<13>)
+    ->Apply(CustomArguments);
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext, rawspeed::HuffmanTableLookup)
+    ->Apply(CustomArguments);
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext, rawspeed::HuffmanTableTree)
+    ->Apply(CustomArguments);
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext, rawspeed::HuffmanTableVector)
+    ->Apply(CustomArguments);
+BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeNext, rawspeed::HuffmanTableMultiLUT)
+    ->Apply(CustomArguments);
+BENCHMARK(BM_HuffmanTableMultiLUT_decodeDifferences)->Apply(CustomArguments);
+
+#define GEN_T(HT)                                                              \
+  BENCHMARK_TEMPLATE(BM_HuffmanTable_setup, HT)->Apply(TableArguments);        \
+  BENCHMARK_TEMPLATE(BM_HuffmanTable_decodeTable, HT)                          \
+      ->Apply(DecodeTableArguments);
+
+GEN_T(rawspeed::BasicHuffmanTableLUT<9>)
+GEN_T(rawspeed::HuffmanTableLUT)
+GEN_T(rawspeed::BasicHuffmanTableLUT<13>)
+GEN_T(rawspeed::HuffmanTableLookup)
+GEN_T(rawspeed::HuffmanTableTree)
+GEN_T(rawspeed::HuffmanTableVector)
+GEN_T(rawspeed::HuffmanTableMultiLUT)
+
+BENCHMARK_MAIN();
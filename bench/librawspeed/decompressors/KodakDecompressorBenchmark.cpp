@@ -0,0 +1,105 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/KodakDecompressor.h" // for KodakDecompressor
+#include "bench/Common.h"                    // for areaToRectangle
+#include "common/Common.h"                   // for uchar8, uint32, roundUp
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness
+#include <array>                             // for array
+#include <benchmark/benchmark.h>             // for State, Benchmark
+#include <vector>                            // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::KodakDecompressor;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+constexpr int segmentSize = 256;
+
+// A random walk, of the 4-bit differences of 8 to 15. Each segment is its
+// 4-bit lengths, then the differences, which are read in the 32-bit words
+// of the byte order 1, 0, 3, 2.
+std::vector<uchar8> createInput(const iPoint2D& dim) {
+  std::vector<uchar8> data;
+  uint32 random = 1;
+  for (int y = 0; y < dim.y; y++) {
+    for (int x = 0; x < dim.x; x += segmentSize) {
+      data.insert(data.end(), segmentSize / 2, 0x44);
+
+      std::array<int, 2> pred{{}};
+      std::array<uchar8, segmentSize> nibbles;
+      for (int i = 0; i < segmentSize; i++) {
+        random = random * 1103515245U + 12345U;
+        int diff = 8 + (random >> 29);
+        if (pred[i & 1] + diff > 4095 ||
+            (pred[i & 1] >= diff && (random >> 28) % 2 == 0))
+          diff = -diff;
+        pred[i & 1] += diff;
+        // The negative ones are stored minus 15.
+        nibbles[i] = diff > 0 ? diff : diff + 15;
+      }
+
+      for (int i = 0; i < segmentSize; i += 8) {
+        for (int b : {1, 0, 3, 2})
+          data.emplace_back(nibbles[i + 2 * b] | (nibbles[i + 2 * b + 1] << 4));
+      }
+    }
+  }
+  return data;
+}
+
+void BM_KodakDecompressor(benchmark::State& state) {
+  auto dim = areaToRectangle(state.range(0), {4, 3});
+  dim.x = rawspeed::roundUp(dim.x, segmentSize);
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    KodakDecompressor k(mRaw, bs, 12, true);
+    k.decompress();
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(state.items_processed());
+}
+
+} // namespace
+
+// The decoder does not take more than 4516 x 3012 pixels.
+BENCHMARK(BM_KodakDecompressor)
+    ->ArgName("area")
+    ->Arg(10 << 20)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,88 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/LJpegDecompressor.h" // for LJpegDecompressor
+#include "bench/Common.h"                    // for areaToRectangle
+#include "bench/LJpegWriter.h"               // for writeLJpeg
+#include "common/Common.h"                   // for uchar8, ushort16, uint32
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness
+#include <benchmark/benchmark.h>             // for State, Benchmark
+#include <vector>                            // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::LJpegDecompressor;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace {
+
+constexpr int prec = 14;
+
+// Around the middle of the range, so that the differences stay below 256.
+std::vector<uchar8> createInput(const iPoint2D& dim, int cps) {
+  std::vector<ushort16> samples(dim.area());
+  uint32 random = 1;
+  for (auto& v : samples) {
+    random = random * 1103515245U + 12345U;
+    v = (1 << (prec - 1)) - 100 + (random >> 16) % 200;
+  }
+  return writeLJpeg(samples, cps, dim.x / cps, dim.y, prec);
+}
+
+// The whole image is one tile, of state.range(0) components per sample
+// of the frame.
+void BM_LJpegDecompressor(benchmark::State& state) {
+  const int cps = state.range(0);
+  const auto dim = areaToRectangle(state.range(1), {4, 3});
+  const auto in = createInput(dim, cps);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::big));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    LJpegDecompressor d(bs, mRaw);
+    d.decode(0, 0, dim.x, dim.y, false);
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+} // namespace
+
+BENCHMARK(BM_LJpegDecompressor)
+    ->ArgNames({"cps", "area"})
+    ->Args({1, 20 << 20})
+    ->Args({2, 20 << 20})
+    ->Args({4, 20 << 20})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
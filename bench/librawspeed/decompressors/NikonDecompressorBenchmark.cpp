@@ -0,0 +1,126 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/NikonDecompressor.h" // for NikonDecompressor
+#include "bench/Common.h"                    // for areaToRectangle
+#include "common/Common.h"                   // for uchar8, uint32
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness
+#include <benchmark/benchmark.h>             // for State, Benchmark
+#include <vector>                            // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::NikonDecompressor;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+// 12-bit lossless, no split, no curve.
+std::vector<uchar8> createMetadata() {
+  std::vector<uchar8> metadata = {70, 0};
+  for (int v : {2048, 2048, 2048, 2048, 0}) {
+    metadata.emplace_back(v >> 8);
+    metadata.emplace_back(v & 0xFF);
+  }
+  return metadata;
+}
+
+// All the Huffman codes are complete, so any data decodes. No pixel takes
+// more than 4 bytes.
+std::vector<uchar8> createInput(const iPoint2D& dim) {
+  std::vector<uchar8> data(4 * static_cast<size_t>(dim.area()));
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  return data;
+}
+
+void setCounters(benchmark::State& state, const iPoint2D& dim) {
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void BM_NikonDecompressor(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {4, 3});
+  const auto metadata = createMetadata();
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::big));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    NikonDecompressor n(
+        mRaw,
+        ByteStream(DataBuffer(Buffer(metadata.data(), metadata.size()),
+                              Endianness::big)),
+        12);
+    n.decompress(bs, true);
+  }
+
+  setCounters(state, dim);
+}
+
+// The two passes: the scan for the checkpoints, then the bands in parallel.
+void BM_NikonDecompressorTwoPass(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {4, 3});
+  const auto metadata = createMetadata();
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::big));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    NikonDecompressor n(
+        mRaw,
+        ByteStream(DataBuffer(Buffer(metadata.data(), metadata.size()),
+                              Endianness::big)),
+        12);
+    n.decompress(bs, true, n.scan(bs, state.range(1)));
+  }
+
+  setCounters(state, dim);
+}
+
+} // namespace
+
+BENCHMARK(BM_NikonDecompressor)
+    ->ArgName("area")
+    ->Arg(20 << 20)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_NikonDecompressorTwoPass)
+    ->ArgNames({"area", "rowsPerCheckpoint"})
+    ->Args({20 << 20, 64})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
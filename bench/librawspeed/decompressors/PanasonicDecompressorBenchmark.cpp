@@ -0,0 +1,83 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/PanasonicDecompressor.h" // for PanasonicDecompressor
+#include "bench/Common.h"                        // for areaToRectangle
+#include "common/Common.h"                       // for uchar8, uint32
+#include "common/Point.h"                        // for iPoint2D
+#include "common/RawImage.h"                     // for RawImage, RawImageData
+#include "io/Buffer.h"                           // for Buffer, DataBuffer
+#include "io/ByteStream.h"                       // for ByteStream
+#include "io/Endianness.h"                       // for Endianness
+#include <benchmark/benchmark.h>                 // for State, Benchmark
+#include <vector>                                // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::PanasonicDecompressor;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+// Any data is a valid stream: 16 bytes per 14 pixels, and the last block
+// rounded up.
+std::vector<uchar8> createInput(const iPoint2D& dim) {
+  std::vector<uchar8> data(16 * (dim.area() / 14) + 0x4000);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  return data;
+}
+
+// The section split offset is state.range(1).
+void BM_PanasonicDecompressor(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {14, 9});
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    PanasonicDecompressor p(mRaw, bs, false, state.range(1));
+    p.decompress();
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(16 * state.items_processed() / 14);
+}
+
+} // namespace
+
+BENCHMARK(BM_PanasonicDecompressor)
+    ->ArgNames({"area", "split"})
+    ->Args({20 << 20, 0})
+    ->Args({20 << 20, 0x1FF8})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,91 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/PanasonicDecompressorV5.h" // for PanasonicDecompr...
+#include "bench/Common.h"                          // for areaToRectangle
+#include "common/Common.h"                         // for uchar8, uint32
+#include "common/Point.h"                          // for iPoint2D
+#include "common/RawImage.h"                       // for RawImage, RawIma...
+#include "io/Buffer.h"                             // for Buffer, DataBuffer
+#include "io/ByteStream.h"                         // for ByteStream
+#include "io/Endianness.h"                         // for Endianness
+#include <benchmark/benchmark.h>                   // for State, Benchmark
+#include <type_traits>                             // for integral_constant
+#include <vector>                                  // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::PanasonicDecompressorV5;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+template <int N> using BPS = std::integral_constant<int, N>;
+
+// Any data is a valid stream: 16 bytes per packet of 128 / bps pixels, and
+// the last block rounded up.
+std::vector<uchar8> createInput(const iPoint2D& dim, int pixelsPerPacket) {
+  std::vector<uchar8> data(16 * (dim.area() / pixelsPerPacket) + 0x4000);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  return data;
+}
+
+template <typename BPS>
+void BM_PanasonicDecompressorV5(benchmark::State& state) {
+  constexpr int pixelsPerPacket = 128 / BPS::value;
+
+  const auto dim = areaToRectangle(state.range(0), {pixelsPerPacket, 3});
+  const auto in = createInput(dim, pixelsPerPacket);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    PanasonicDecompressorV5 p(mRaw, bs, BPS::value);
+    p.decompress();
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(16 * state.items_processed() / pixelsPerPacket);
+}
+
+} // namespace
+
+#define GEN(b)                                                                 \
+  BENCHMARK_TEMPLATE(BM_PanasonicDecompressorV5, BPS<b>)                       \
+      ->ArgName("area")                                                        \
+      ->Arg(20 << 20)                                                          \
+      ->UseRealTime()                                                          \
+      ->Unit(benchmark::kMillisecond);
+
+GEN(12)
+GEN(14)
+
+BENCHMARK_MAIN();
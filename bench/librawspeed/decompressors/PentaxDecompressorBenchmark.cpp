@@ -0,0 +1,152 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/PentaxDecompressor.h" // for PentaxDecompressor
+#include "bench/Common.h"                     // for areaToRectangle
+#include "common/Common.h"                    // for uchar8, uint32
+#include "common/Point.h"                     // for iPoint2D
+#include "common/RawImage.h"                  // for RawImage, RawImageData
+#include "io/Buffer.h"                        // for Buffer, DataBuffer
+#include "io/ByteStream.h"                    // for ByteStream
+#include "io/Endianness.h"                    // for Endianness
+#include <array>                              // for array
+#include <benchmark/benchmark.h>              // for State, Benchmark
+#include <cstdlib>                            // for abs
+#include <vector>                             // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::PentaxDecompressor;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+// The legacy table, which is used without the metadata.
+const std::array<uchar8, 16> nCodesPerLength = {
+    {0, 2, 3, 1, 1, 1, 1, 1, 1, 2, 0, 0, 0, 0, 0, 0}};
+const std::array<uchar8, 13> codeValues = {
+    {3, 4, 2, 5, 1, 6, 0, 7, 8, 9, 10, 11, 12}};
+
+class HuffmanWriter {
+public:
+  // The canonical codes, in the order of the increasing length.
+  HuffmanWriter() {
+    uint32 code = 0;
+    int i = 0;
+    for (int len = 1; len <= 16; len++) {
+      for (int n = 0; n < nCodesPerLength[len - 1]; n++, i++) {
+        codes[codeValues[i]] = code++;
+        lengths[codeValues[i]] = len;
+      }
+      code <<= 1;
+    }
+  }
+
+  // The code of the length of the difference, then the difference.
+  void putDiff(int diff) {
+    int len = 0;
+    while ((std::abs(diff) >> len) != 0)
+      len++;
+    put(codes[len], lengths[len]);
+    if (len != 0)
+      put(diff < 0 ? diff + (1 << len) - 1 : diff, len);
+  }
+
+  // With some slack for the bit pump.
+  std::vector<uchar8> finish() {
+    data.resize(data.size() + 8);
+    return data;
+  }
+
+private:
+  void put(uint32 value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+      if (pos % 8 == 0)
+        data.emplace_back(0);
+      data.back() |= ((value >> i) & 1) << (7 - pos % 8);
+      pos++;
+    }
+  }
+
+  std::array<uint32, 13> codes;
+  std::array<int, 13> lengths;
+  std::vector<uchar8> data;
+  int pos = 0;
+};
+
+// A random walk, with the differences of up to 8 bits, in the order of the
+// decoder: the first pixels of the rows are predicted from the ones of the
+// row before of the same color, the others from the one to their left of
+// the same color.
+std::vector<uchar8> createInput(const iPoint2D& dim) {
+  HuffmanWriter w;
+  uint32 random = 1;
+  const auto step = [&random, &w](int* pred) {
+    random = random * 1103515245U + 12345U;
+    int diff = static_cast<int>((random >> 16) % 401) - 200;
+    if (*pred + diff < 0 || *pred + diff > 65535)
+      diff = -diff;
+    *pred += diff;
+    w.putDiff(diff);
+  };
+
+  std::array<std::array<int, 2>, 2> up{{}};
+  for (int y = 0; y < dim.y; y++) {
+    std::array<int, 2> left = up[y & 1];
+    for (int x = 0; x < dim.x; x += 2) {
+      for (int c = 0; c < 2; c++)
+        step(&left[c]);
+      if (x == 0)
+        up[y & 1] = left;
+    }
+  }
+  return w.finish();
+}
+
+void BM_PentaxDecompressor(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {4, 3});
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::big));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    PentaxDecompressor p(mRaw, nullptr);
+    p.decompress(bs);
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+} // namespace
+
+BENCHMARK(BM_PentaxDecompressor)
+    ->ArgName("area")
+    ->Arg(20 << 20)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,124 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/SonyArw1Decompressor.h" // for SonyArw1Decompressor
+#include "bench/Common.h"                       // for areaToRectangle
+#include "common/Common.h"                      // for uchar8, uint32
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RawImage.h"                    // for RawImage, RawImageData
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness
+#include <benchmark/benchmark.h>                // for State, Benchmark
+#include <vector>                               // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::SonyArw1Decompressor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+class BitWriterMSB {
+public:
+  void put(uint32 value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+      if (pos % 8 == 0)
+        data.emplace_back(0);
+      data.back() |= ((value >> i) & 1) << (7 - pos % 8);
+      pos++;
+    }
+  }
+
+  std::vector<uchar8> data;
+
+private:
+  int pos = 0;
+};
+
+// The length of the difference, as a prefix code, then the difference.
+void encodeDiff(BitWriterMSB* bits, int diff) {
+  int len = 0;
+  for (int a = diff < 0 ? -diff : diff; a != 0; a >>= 1)
+    len++;
+
+  if (len == 0)
+    bits->put(0b011, 3);
+  else if (len <= 3)
+    bits->put(len == 3 ? 0b010 : (4 - len), len == 3 ? 3 : 2);
+  else {
+    bits->put(0, 2);
+    bits->put(1, len - 4 + 1);
+  }
+
+  if (len != 0)
+    bits->put(diff > 0 ? diff : diff + (1 << len) - 1, len);
+}
+
+// A random walk, with the differences of up to 8 bits. The order of the
+// pixels does not matter to the decoder, only their count does.
+std::vector<uchar8> createInput(const iPoint2D& dim) {
+  BitWriterMSB bits;
+  uint32 random = 1;
+  int sum = 0;
+  for (auto i = dim.area(); i > 0; i--) {
+    random = random * 1103515245U + 12345U;
+    int diff = static_cast<int>((random >> 16) % 401) - 200;
+    if (sum + diff < 0 || sum + diff > 4095)
+      diff = -diff;
+    sum += diff;
+    encodeDiff(&bits, diff);
+  }
+  // Some slack for the bit pump.
+  bits.data.resize(bits.data.size() + 8);
+  return bits.data;
+}
+
+void BM_SonyArw1Decompressor(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {4, 3});
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    SonyArw1Decompressor a(mRaw);
+    a.decompress(bs);
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+} // namespace
+
+// The decoder does not take more than 4600 x 3072 pixels.
+BENCHMARK(BM_SonyArw1Decompressor)
+    ->ArgName("area")
+    ->Arg(12 << 20)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,88 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/SonyArw2Decompressor.h" // for SonyArw2Decompressor
+#include "bench/Common.h"                       // for areaToRectangle
+#include "common/Common.h"                      // for uchar8, uint32
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RawImage.h"                    // for RawImage, RawImageData
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, getLE
+#include <benchmark/benchmark.h>                // for State, Benchmark
+#include <vector>                               // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::SonyArw2Decompressor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+// Random packets, with the maximum and the minimum in different places.
+std::vector<uchar8> createInput(const iPoint2D& dim) {
+  std::vector<uchar8> data(dim.area());
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  for (size_t i = 0; i < data.size(); i += 16) {
+    uint32 v = rawspeed::getLE<uint32>(&data[i]);
+    const uint32 imax = (v >> 22) & 0xf;
+    const uint32 imin = (imax + 1 + (v >> 26) % 15) & 0xf;
+    v = (v & ~(0xfU << 26)) | (imin << 26);
+    for (int b = 0; b < 4; b++)
+      data[i + b] = v >> (8 * b);
+  }
+  return data;
+}
+
+void BM_SonyArw2Decompressor(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {32, 21});
+  const auto in = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    SonyArw2Decompressor a(mRaw, bs);
+    a.decompress();
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(state.items_processed());
+}
+
+} // namespace
+
+BENCHMARK(BM_SonyArw2Decompressor)
+    ->ArgName("area")
+    ->Arg(20 << 20)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
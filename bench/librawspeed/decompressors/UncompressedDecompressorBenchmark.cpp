@@ -0,0 +1,169 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/UncompressedDecompressor.h" // for UncompressedDeco...
+#include "bench/Common.h"                           // for areaToRectangle
+#include "common/Common.h"                          // for uchar8, BitOrder
+#include "common/Point.h"                           // for iPoint2D
+#include "common/RawImage.h"                        // for RawImage, RawIma...
+#include "decompressors/UncompressedUnpacker.h"     // for UnpackKernel
+#include "io/Buffer.h"                              // for Buffer, DataBuffer
+#include "io/ByteStream.h"                          // for ByteStream
+#include "io/Endianness.h"                          // for Endianness
+#include <benchmark/benchmark.h>                    // for State, Benchmark
+#include <cstring>                                  // for memcpy
+#include <type_traits>                              // for integral_constant
+#include <vector>                                   // for vector
+
+using rawspeed::BitOrder;
+using rawspeed::BitOrder_LSB;
+using rawspeed::BitOrder_MSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::UncompressedDecompressor;
+using rawspeed::UnpackKernel;
+
+namespace {
+
+template <int N> using Bits = std::integral_constant<int, N>;
+template <BitOrder O> using Order = std::integral_constant<BitOrder, O>;
+template <Endianness E> using Endian = std::integral_constant<Endianness, E>;
+
+// Will contain some garbage, which is as good as any other data here.
+std::vector<uchar8> createInput(const iPoint2D& dim, int bits) {
+  return std::vector<uchar8>(static_cast<size_t>(dim.area()) * bits / 8);
+}
+
+// The kernel is state.range(0), the area is state.range(1).
+bool setKernel(benchmark::State& state) {
+  const auto kernel = static_cast<UnpackKernel>(state.range(0));
+  if (!rawspeed::isUnpackKernelSupported(kernel)) {
+    state.SkipWithError("The kernel is not supported");
+    return false;
+  }
+
+  state.SetLabel(rawspeed::getUnpackKernelName(kernel));
+  rawspeed::setUnpackKernel(kernel);
+  return true;
+}
+
+void setCounters(benchmark::State& state, const iPoint2D& dim, int bits) {
+  rawspeed::setUnpackKernel(UnpackKernel::Auto);
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(bits * state.items_processed() / 8);
+}
+
+template <typename Bits, typename Order>
+void BM_Packed(benchmark::State& state) {
+  if (!setKernel(state))
+    return;
+
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  const auto in = createInput(dim, Bits::value);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    UncompressedDecompressor u(bs, mRaw);
+    u.readUncompressedRaw(dim, {0, 0}, dim.x * Bits::value / 8, Bits::value,
+                          Order::value);
+  }
+
+  setCounters(state, dim, Bits::value);
+}
+
+template <typename Bits, typename Endian>
+void BM_Unpacked(benchmark::State& state) {
+  if (!setKernel(state))
+    return;
+
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  const auto in = createInput(dim, 16);
+  const ByteStream bs(
+      DataBuffer(Buffer(in.data(), in.size()), Endianness::little));
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    UncompressedDecompressor u(bs, mRaw);
+    u.decodeRawUnpacked<Bits::value, Endian::value>(dim.x, dim.y);
+  }
+
+  setCounters(state, dim, 16);
+}
+
+// What the unpacking is aiming at: copying the same number of output bytes.
+void BM_Memcpy(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(1), {3, 2});
+  const auto in = createInput(dim, 16);
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  for (auto _ : state) {
+    for (int y = 0; y < dim.y; y++) {
+      memcpy(mRaw->getData(0, y), &in[static_cast<size_t>(y) * dim.x * 2],
+             dim.x * 2);
+    }
+    benchmark::ClobberMemory();
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(2 * state.items_processed());
+}
+
+void CustomArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"kernel", "area"});
+  for (auto kernel : {UnpackKernel::Scalar, UnpackKernel::SSSE3,
+                      UnpackKernel::AVX2, UnpackKernel::NEON})
+    b->Args({static_cast<int>(kernel), 24 << 20});
+  b->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+#define GEN_P(b, o)                                                            \
+  BENCHMARK_TEMPLATE(BM_Packed, Bits<b>, Order<BitOrder_##o>)                  \
+      ->Apply(CustomArgs);
+#define GEN_U(b, e)                                                            \
+  BENCHMARK_TEMPLATE(BM_Unpacked, Bits<b>, Endian<Endianness::e>)              \
+      ->Apply(CustomArgs);
+
+GEN_P(10, LSB)
+GEN_P(10, MSB)
+GEN_P(12, LSB)
+GEN_P(12, MSB)
+GEN_P(14, LSB)
+GEN_P(14, MSB)
+
+GEN_U(12, little)
+GEN_U(12, big)
+GEN_U(14, big)
+GEN_U(16, big)
+
+BENCHMARK(BM_Memcpy)->Args({0, 24 << 20})->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,152 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/VC5Decompressor.h" // for VC5Decompressor
+#include "bench/Common.h"                  // for areaToRectangle
+#include "common/Common.h"                 // for uchar8, ushort16, uint32
+#include "common/Point.h"                  // for iPoint2D
+#include "common/RawImage.h"               // for RawImage, RawImageData
+#include "io/Buffer.h"                     // for Buffer, DataBuffer
+#include "io/ByteStream.h"                 // for ByteStream
+#include "io/Endianness.h"                 // for Endianness
+#include <array>                           // for array
+#include <benchmark/benchmark.h>           // for State, Benchmark
+#include <vector>                          // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+using rawspeed::VC5Decompressor;
+
+namespace {
+
+// A VC-5 stream of a flat image: every channel is just its low-pass value,
+// and all the high-pass bands are zero. So it is the decoding of the bands
+// of zeros, and all of the wavelet reconstruction.
+class FlatVC5Stream {
+public:
+  FlatVC5Stream(const iPoint2D& dim, const std::array<ushort16, 4>& lowpass) {
+    for (uchar8 b : {0x56, 0x43, 0x2d, 0x35})
+      data.emplace_back(b);
+
+    // The smallest wavelet, and the number of pixels of all of them.
+    iPoint2D waveletDim(dim.x / 2, dim.y / 2);
+    std::array<int, 3> areas;
+    for (int& area : areas) {
+      waveletDim = {(waveletDim.x + 1) / 2, (waveletDim.y + 1) / 2};
+      area = waveletDim.area();
+    }
+
+    for (int c = 0; c < 4; c++) {
+      tag(0x003e, c); // ChannelNumber
+      // No descaling of the largest wavelet, the others undo their halving.
+      tag(0x006d, 0x2800); // PrescaleShift
+
+      tag(0x0030, 0);  // SubbandNumber
+      tag(0x0023, 16); // LowpassPrecision
+      std::vector<uchar8> band;
+      for (int i = 0; i < areas.back(); i++) {
+        band.emplace_back(lowpass[c] >> 8);
+        band.emplace_back(lowpass[c]);
+      }
+      codeblock(band);
+
+      // The subbands go from the smallest wavelet to the largest one.
+      for (int subband = 1; subband < 10; subband++) {
+        tag(0x0030, subband);
+        tag(0x0035, 1); // Quantization
+        codeblock(zeroBand(areas[2 - (subband - 1) / 3]));
+      }
+    }
+  }
+
+  ByteStream getByteStream() const {
+    return ByteStream(
+        DataBuffer(Buffer(data.data(), data.size()), Endianness::big));
+  }
+
+  size_t size() const { return data.size(); }
+
+private:
+  void put16(ushort16 v) {
+    data.emplace_back(v >> 8);
+    data.emplace_back(v);
+  }
+
+  void tag(ushort16 t, ushort16 v) {
+    put16(t);
+    put16(v);
+  }
+
+  // The size of the chunk is in the 4-byte units.
+  void codeblock(std::vector<uchar8> band) {
+    band.resize((band.size() + 3) / 4 * 4);
+    const uint32 size = band.size() / 4;
+    tag(0x6000 | (size >> 16), size & 0xffff);
+    data.insert(data.end(), band.begin(), band.end());
+  }
+
+  // Each zero is a single 0 bit, followed by the band end marker.
+  static std::vector<uchar8> zeroBand(int pixels) {
+    std::vector<bool> bits(pixels, false);
+    for (int i = 25; i >= 0; i--)
+      bits.emplace_back((0x03114BA3U >> i) & 1U);
+
+    // And some slack for the bit pump.
+    std::vector<uchar8> band((bits.size() + 7) / 8 + 8);
+    for (size_t i = 0; i < bits.size(); i++)
+      band[i / 8] |= bits[i] << (7 - i % 8);
+    return band;
+  }
+
+  std::vector<uchar8> data;
+};
+
+void BM_VC5Decompressor(benchmark::State& state) {
+  const auto dim = areaToRectangle(state.range(0), {16, 12});
+  const FlatVC5Stream stream(dim, {{4 * 1000, 4 * 2148, 4 * 1998, 4 * 2068}});
+  auto mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  mRaw->whitePoint = 65535;
+
+  for (auto _ : state) {
+    VC5Decompressor v(stream.getByteStream(), mRaw);
+    v.decode(0, 0, dim.x, dim.y);
+  }
+
+  state.SetComplexityN(dim.area());
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(stream.size() * state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_VC5Decompressor)
+    ->ArgName("area")
+    ->Arg(20 << 20)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -21,15 +21,19 @@
 #include "interpolators/Cr2sRawInterpolator.h" // for Cr2sRawInterpolator
 #include "bench/Common.h"                      // for areaToRectangle
 #include "common/Common.h"                     // for roundUp, ushort16
+#include "common/Executor.h"                   // for setExecutor, ThreadP...
 #include "common/Point.h"                      // for iPoint2D
 #include "common/RawImage.h"                   // for RawImage, ImageMetaData
 #include <array>                               // for array
 #include <benchmark/benchmark.h>               // for Benchmark, State, BEN...
+#include <memory>                              // for make_shared
 #include <type_traits>                         // for integral_constant
 
 using rawspeed::Cr2sRawInterpolator;
 using rawspeed::iPoint2D;
 using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
 using rawspeed::TYPE_USHORT16;
 using rawspeed::ushort16;
 using std::array;
@@ -48,20 +52,25 @@ static inline void BM_Cr2sRawInterpolator(benchmark::State& state) {
 
   Cr2sRawInterpolator i(mRaw, sraw_coeffs, hue);
 
+  setExecutor(std::make_shared<ThreadPoolExecutor>(state.range(1)));
   for (auto _ : state)
     i.interpolate(version::value);
+  setExecutor(nullptr);
 
   state.SetComplexityN(dim.area());
   state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
   state.SetBytesProcessed(3UL * sizeof(ushort16) * state.items_processed());
 }
 
+// The area, and the number of threads.
 static inline void CustomArguments(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"area", "threads"});
   b->RangeMultiplier(2);
 #if 1
-  b->Arg(256 << 20);
+  b->Ranges({{256 << 20, 256 << 20},
+             {1, rawspeed_get_number_of_processor_cores()}});
 #else
-  b->Range(1, 1024 << 20)->Complexity(benchmark::oN);
+  b->Ranges({{1, 1024 << 20}, {1, 1}})->Complexity(benchmark::oN);
 #endif
   b->Unit(benchmark::kMillisecond);
 }
@@ -20,8 +20,8 @@
 
 #include "common/Common.h"       // for roundUp
 #include "io/BitPumpJPEG.h"      // for BitPumpJPEG
-#include "io/BitPumpLSB.h"       // for BitPumpLSB, BitStream<>::fillCache
-#include "io/BitPumpMSB.h"       // for BitPumpMSB
+#include "io/BitPumpLSB.h"       // for BitPumpLSB, BitPumpLSBWide
+#include "io/BitPumpMSB.h"       // for BitPumpMSB, BitPumpMSBWide
 #include "io/BitPumpMSB16.h"     // for BitPumpMSB16
 #include "io/BitPumpMSB32.h"     // for BitPumpMSB32
 #include "io/Buffer.h"           // for Buffer, Buffer::size_type, Data...
@@ -39,6 +39,10 @@ using rawspeed::BitPumpLSB;
 using rawspeed::BitPumpMSB;
 using rawspeed::BitPumpMSB16;
 using rawspeed::BitPumpMSB32;
+#ifdef __SIZEOF_INT128__
+using rawspeed::BitPumpLSBWide;
+using rawspeed::BitPumpMSBWide;
+#endif
 using rawspeed::Endianness;
 
 static constexpr const size_t STEP_MAX = 32;
@@ -141,6 +145,10 @@ int main(int argc, char** argv) {
   REGISTER_PUMP(BitPumpMSB16);
   REGISTER_PUMP(BitPumpMSB32);
   REGISTER_PUMP(BitPumpJPEG);
+#ifdef __SIZEOF_INT128__
+  REGISTER_PUMP(BitPumpLSBWide);
+  REGISTER_PUMP(BitPumpMSBWide);
+#endif
 
   benchmark::Initialize(&argc, argv);
   benchmark::RunSpecifiedBenchmarks();
@@ -19,6 +19,7 @@
 */
 
 #include "rawspeedconfig.h"          // for HAVE_PUGIXML
+#include "io/Buffer.h"               // for Buffer
 #include "metadata/CameraMetaData.h" // for CameraMetaData
 #include <benchmark/benchmark.h>     // for Benchmark, State, BENCHMARK_MAIN
 #include <pugixml.hpp>               // for xml_document
@@ -55,4 +56,17 @@ static void BM_CameraMetaData(benchmark::State& state) {
 }
 BENCHMARK(BM_CameraMetaData)->Unit(benchmark::kMicrosecond);
 
+// Loading the binary database, and looking up one camera in it.
+static void BM_CameraMetaDataBinary(benchmark::State& state) {
+  const auto database = rawspeed::CameraMetaData(CAMERASXML).serialize();
+
+  for (auto _ : state) {
+    rawspeed::CameraMetaData metadata(
+        rawspeed::Buffer(database.data(), database.size()));
+    benchmark::DoNotOptimize(metadata.getCamera(
+        "NIKON CORPORATION", "NIKON D3", "14bit-compressed"));
+  }
+}
+BENCHMARK(BM_CameraMetaDataBinary)->Unit(benchmark::kMicrosecond);
+
 BENCHMARK_MAIN();
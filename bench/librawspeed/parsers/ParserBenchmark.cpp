@@ -0,0 +1,360 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Common.h"            // for uchar8, uint32
+#include "common/RawImage.h"          // for RawImage, RawImageData
+#include "common/RawspeedException.h" // for RawspeedException
+#include "decoders/RawDecoder.h"      // for RawDecoder
+#include "encoders/DngWriter.h"       // for DngWriter
+#include "io/Buffer.h"                // for Buffer
+#include "parsers/RawParser.h"        // for RawParser
+#include "parsers/TiffParser.h"       // for TiffParser
+#include "tiff/TiffIFD.h"             // for TiffRootIFD, TiffRootIFDOwner
+#include "tiff/TiffTag.h"             // for TiffTag, SUBIFDS, MAKE, MODEL
+#include <atomic>                     // for atomic
+#include <benchmark/benchmark.h>      // for State, Benchmark, BENCHMARK_MAIN
+#include <cstdlib>                    // for malloc, free
+#include <new>                        // for bad_alloc
+#include <string>                     // for string
+#include <utility>                    // for make_pair
+#include <vector>                     // for vector
+
+// The metadata-only uses of the library, e.g. the thumbnails or the
+// indexing, only ever parse the headers, so that is all of their cost. These
+// are the parsers of each of the containers, on the synthetic headers, and
+// the IFD trees of any shape. Besides the files per second, each one
+// reports the heap allocations per parse.
+
+// Of the whole process, for the allocations per parse.
+static std::atomic<size_t> numAllocations{0};
+
+void* operator new(size_t size) {
+  numAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t /*size*/) noexcept { free(p); }
+
+using rawspeed::Buffer;
+using rawspeed::RawParser;
+using rawspeed::TiffParser;
+using rawspeed::TiffTag;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace {
+
+void putLE(std::vector<uchar8>* out, uint32 v, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    out->emplace_back(static_cast<uchar8>(v >> (8 * i)));
+}
+
+void setLE32(std::vector<uchar8>* out, size_t pos, uint32 v) {
+  for (int i = 0; i < 4; i++)
+    (*out)[pos + i] = static_cast<uchar8>(v >> (8 * i));
+}
+
+// Where the tag that getEntryRecursive() looks for is, if at all.
+constexpr TiffTag needleTag = static_cast<TiffTag>(0x6fff);
+
+// A little-endian TIFF of the tree of the IFDs, each of which has width
+// entries, half of them with their values out of line, and, but for the
+// deepest ones, the two sub-IFDs. The last IFD also has the needle.
+class IfdTreeWriter final {
+  const int width;
+  const int depth;
+  std::vector<uchar8> out;
+
+  // Returns where it is.
+  uint32 writeIFD(int level, bool last) {
+    const bool hasSubIFDs = level + 1 < depth;
+    const bool hasNeedle = last && !hasSubIFDs;
+
+    // The children first, so that their offsets are known.
+    std::vector<uint32> children;
+    if (hasSubIFDs) {
+      children.emplace_back(writeIFD(level + 1, false));
+      children.emplace_back(writeIFD(level + 1, last));
+    }
+
+    // The out of line values.
+    std::vector<uint32> values;
+    for (int i = 0; i < width; i += 2) {
+      values.emplace_back(out.size());
+      for (int j = 0; j < 4; j++)
+        putLE(&out, level * 1000 + i + j, 4);
+    }
+    uint32 subIFDs = 0;
+    if (hasSubIFDs) {
+      subIFDs = out.size();
+      for (uint32 c : children)
+        putLE(&out, c, 4);
+    }
+
+    const uint32 pos = out.size();
+    const int entries = width + (hasSubIFDs ? 1 : 0) + (hasNeedle ? 1 : 0);
+    putLE(&out, entries, 2);
+    for (int i = 0; i < width; i++) {
+      putLE(&out, 0x7000 + i, 2);
+      if (i % 2 == 0) {
+        putLE(&out, rawspeed::TIFF_LONG, 2);
+        putLE(&out, 4, 4);
+        putLE(&out, values[i / 2], 4);
+      } else {
+        putLE(&out, rawspeed::TIFF_SHORT, 2);
+        putLE(&out, 1, 4);
+        putLE(&out, i, 4);
+      }
+    }
+    if (hasSubIFDs) {
+      putLE(&out, rawspeed::SUBIFDS, 2);
+      putLE(&out, rawspeed::TIFF_LONG, 2);
+      putLE(&out, children.size(), 4);
+      putLE(&out, subIFDs, 4);
+    }
+    if (hasNeedle) {
+      putLE(&out, needleTag, 2);
+      putLE(&out, rawspeed::TIFF_SHORT, 2);
+      putLE(&out, 1, 4);
+      putLE(&out, 42, 4);
+    }
+    putLE(&out, 0, 4); // no next IFD
+    return pos;
+  }
+
+public:
+  IfdTreeWriter(int width_, int depth_) : width(width_), depth(depth_) {}
+
+  std::vector<uchar8> write() {
+    out.clear();
+    out.insert(out.end(), {'I', 'I', 42, 0, 0, 0, 0, 0});
+    setLE32(&out, 4, writeIFD(0, true));
+    return out;
+  }
+};
+
+// The entries, per IFD, are state.range(0), the depth of the tree is
+// state.range(1).
+void BM_TiffParser_parse(benchmark::State& state) {
+  const std::vector<uchar8> file =
+      IfdTreeWriter(state.range(0), state.range(1)).write();
+  const Buffer buffer(file.data(), file.size());
+
+  const size_t before = numAllocations;
+  for (auto _ : state) {
+    auto root = TiffParser::parse(nullptr, buffer);
+    benchmark::DoNotOptimize(root);
+  }
+
+  state.counters["allocations"] = benchmark::Counter(
+      numAllocations - before, benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(file.size() * state.iterations());
+}
+
+// The same, the needle being in the last IFD of the tree, or, if
+// state.range(2) is 0, nowhere.
+void BM_TiffIFD_getEntryRecursive(benchmark::State& state) {
+  const std::vector<uchar8> file =
+      IfdTreeWriter(state.range(0), state.range(1)).write();
+  const Buffer buffer(file.data(), file.size());
+  const auto root = TiffParser::parse(nullptr, buffer);
+  const TiffTag tag =
+      state.range(2) ? needleTag : static_cast<TiffTag>(0x6ffe);
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(root->getEntryRecursive(tag));
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+void TreeArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"width", "depth"});
+  for (int width : {8, 64, 256}) {
+    // Up to TiffIFD::Limits, which are at 2 * 14 of the sub-IFDs.
+    for (int depth : {1, 2, 4})
+      b->Args({width, depth});
+  }
+  b->Unit(benchmark::kMicrosecond);
+}
+
+void LookupArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"width", "depth", "found"});
+  for (int width : {8, 256}) {
+    for (int depth : {1, 4}) {
+      for (int found : {0, 1})
+        b->Args({width, depth, found});
+    }
+  }
+  b->Unit(benchmark::kNanosecond);
+}
+
+// The headers of the files of each of the containers, as short as the
+// parsers take, for RawParser::getDecoder().
+enum class Container { DNG, RAF, CRW, JPEG, Garbage };
+
+std::vector<uchar8> makeDNG() {
+  const rawspeed::RawImage img =
+      rawspeed::RawImage::create({16, 16}, rawspeed::TYPE_USHORT16, 1);
+  img->metadata.make = "Make";
+  img->metadata.model = "Model";
+  const Buffer file = rawspeed::DngWriter(img, 16).write();
+  return std::vector<uchar8>(file.begin(), file.end());
+}
+
+// The FUJIFILM header, with the offset of the TIFF of the Make at 0x54,
+// that being 12 bytes into a JPEG, and no other IFDs.
+std::vector<uchar8> makeRAF() {
+  const std::string magic = "FUJIFILMCCD-RAW ";
+  std::vector<uchar8> out(magic.begin(), magic.end());
+  out.resize(0x54);
+  const uint32 tiff = 0x80;
+  for (uint32 v : {tiff - 12, 0U, ~0U, 0U, ~0U})
+    out.insert(out.end(), {uchar8(v >> 24), uchar8(v >> 16), uchar8(v >> 8),
+                           uchar8(v)});
+  out.resize(tiff);
+
+  // The Make and the Model, their values after the IFD.
+  const std::string make("FUJIFILM\0", 9);
+  const std::string model("X-T3\0", 5);
+  out.insert(out.end(), {'I', 'I', 42, 0, 8, 0, 0, 0});
+  putLE(&out, 2, 2);
+  uint32 value = 8 + 2 + 2 * 12 + 4;
+  for (const auto& e : {std::make_pair(rawspeed::MAKE, make),
+                        std::make_pair(rawspeed::MODEL, model)}) {
+    putLE(&out, e.first, 2);
+    putLE(&out, rawspeed::TIFF_ASCII, 2);
+    putLE(&out, e.second.size(), 4);
+    putLE(&out, value, 4);
+    value += e.second.size();
+  }
+  putLE(&out, 0, 4);
+  out.insert(out.end(), make.begin(), make.end());
+  out.insert(out.end(), model.begin(), model.end());
+  return out;
+}
+
+// The heap, with the make and the model in a sub-directory, as the CRWs
+// have it.
+std::vector<uchar8> makeCRW() {
+  const std::string makeModel("Canon\0Canon EOS D60\0", 20);
+
+  // The sub-directory: its value data, one entry, and the size of the data.
+  std::vector<uchar8> subDir(makeModel.begin(), makeModel.end());
+  putLE(&subDir, 1, 2);
+  putLE(&subDir, 0x080a, 2); // CIFF_MAKEMODEL
+  putLE(&subDir, makeModel.size(), 4);
+  putLE(&subDir, 0, 4);
+  putLE(&subDir, makeModel.size(), 4);
+
+  std::vector<uchar8> out = {'I', 'I'};
+  putLE(&out, 26, 4); // the length of the header
+  const std::string magic = "HEAPCCDR";
+  out.insert(out.end(), magic.begin(), magic.end());
+  out.resize(26);
+
+  // The root directory, of the sub-directory, after some other data, as
+  // the RawParser wants more than 104 bytes.
+  const uint32 otherData = 64;
+  out.resize(out.size() + otherData);
+  out.insert(out.end(), subDir.begin(), subDir.end());
+  putLE(&out, 1, 2);
+  putLE(&out, 0x300a, 2); // CIFF_SUBIFD
+  putLE(&out, subDir.size(), 4);
+  putLE(&out, otherData, 4);
+  putLE(&out, otherData + subDir.size(), 4);
+  return out;
+}
+
+// Not raws, and rejected as such.
+std::vector<uchar8> makeJPEG() {
+  std::vector<uchar8> out = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F',
+                             'I',  'F',  0x00, 0x01, 0x01, 0x00};
+  out.resize(4096);
+  return out;
+}
+
+std::vector<uchar8> makeGarbage() {
+  std::vector<uchar8> out(4096);
+  uint32 random = 1;
+  for (auto& b : out) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 24;
+  }
+  return out;
+}
+
+// The container is state.range(0).
+void BM_RawParser_getDecoder(benchmark::State& state) {
+  std::vector<uchar8> file;
+  switch (static_cast<Container>(state.range(0))) {
+  case Container::DNG:
+    file = makeDNG();
+    break;
+  case Container::RAF:
+    file = makeRAF();
+    break;
+  case Container::CRW:
+    file = makeCRW();
+    break;
+  case Container::JPEG:
+    file = makeJPEG();
+    break;
+  case Container::Garbage:
+    file = makeGarbage();
+    break;
+  }
+  const Buffer buffer(file.data(), file.size());
+
+  size_t failures = 0;
+  const size_t before = numAllocations;
+  for (auto _ : state) {
+    try {
+      RawParser parser(&buffer);
+      auto decoder = parser.getDecoder();
+      benchmark::DoNotOptimize(decoder);
+    } catch (rawspeed::RawspeedException&) {
+      failures++;
+    }
+  }
+
+  state.counters["allocations"] = benchmark::Counter(
+      numAllocations - before, benchmark::Counter::kAvgIterations);
+  state.counters["rejected"] =
+      benchmark::Counter(failures, benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void ContainerArgs(benchmark::internal::Benchmark* b) {
+  b->ArgName("container");
+  b->DenseRange(0, static_cast<int>(Container::Garbage));
+  b->Unit(benchmark::kNanosecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_TiffParser_parse)->Apply(TreeArgs);
+BENCHMARK(BM_TiffIFD_getEntryRecursive)->Apply(LookupArgs);
+BENCHMARK(BM_RawParser_getDecoder)->Apply(ContainerArgs);
+
+BENCHMARK_MAIN();
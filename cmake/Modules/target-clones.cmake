@@ -0,0 +1,14 @@
+include(CheckCXXSourceCompiles)
+
+# The kernels are templates, and not every compiler can clone those.
+CHECK_CXX_SOURCE_COMPILES("
+template <int N>
+__attribute__((target_clones(\"arch=x86-64-v4\", \"arch=x86-64-v3\", \"default\")))
+int f(int x)
+{
+  return x >> N;
+}
+int main(void)
+{
+  return f<1>(0);
+}" HAVE_TARGET_CLONES)
@@ -19,6 +19,11 @@ if(BUILD_BENCHMARKING)
   add_dependencies(dependencies benchmark)
 endif()
 
+# The default executor, and Mutex, use std::thread et al. when there is no OpenMP.
+set(THREADS_PREFER_PTHREAD_FLAG ON)
+find_package(Threads REQUIRED)
+target_link_libraries(rawspeed PUBLIC Threads::Threads)
+
 unset(HAVE_OPENMP)
 if(WITH_OPENMP)
   message(STATUS "Looking for OpenMP")
@@ -0,0 +1,121 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Unlike the other fuzzers, this one is not after the crashes, but after the
+// inputs that take far more work to decode than their size warrants, e.g.
+// the huge dimensions with a few bytes of data, which the bit pumps happily
+// pad with the zeros, or the deep chains of IFDs. As the parser fuzzer, it
+// decodes the whole file, and then compares what that took, whether or not
+// the decoding failed, to a budget that is linear in the size of the input.
+// If it is over, the input is reported as a crash, so that the fuzzer keeps
+// it, and it can be reproduced as any other one.
+
+#include "RawSpeed-API.h"          // for RawDecoder, RawParser, Buffer, Camer...
+#include "common/ImageAllocator.h" // for BudgetImageAllocator
+#include <cstdint>                 // for uint8_t, uint64_t
+#include <cstdio>                  // for fprintf, stderr
+#include <cstdlib>                 // for abort
+#include <ctime>                   // for clock_gettime, timespec
+#include <memory>                  // for make_shared, unique_ptr
+
+// What the pixels, and all of the other allocations of the images, may
+// take per byte of the input. A 16-bit pixel in a quarter of a bit, which is
+// well below what any of the entropy coders get even for a flat image.
+#ifndef WORK_PER_INPUT_BYTE
+#define WORK_PER_INPUT_BYTE 64
+#endif
+
+// Any input may take that much, e.g. for the smallest valid images.
+#ifndef MIN_WORK
+#define MIN_WORK (4 << 20)
+#endif
+
+// Each allocation of an image counts as that many bytes of the work.
+#ifndef ALLOCATION_WORK
+#define ALLOCATION_WORK (64 << 10)
+#endif
+
+// And the time, which is what the above does not see, e.g. for the parsing,
+// or for the tables of the decompressors. The decoding is faster than that
+// by a factor of a hundred or so, even with the sanitizers.
+#ifndef SECONDS_PER_INPUT_MIB
+#define SECONDS_PER_INPUT_MIB 2.0
+#endif
+
+#ifndef MIN_SECONDS
+#define MIN_SECONDS 0.25
+#endif
+
+static const rawspeed::CameraMetaData metadata{};
+
+// Of this thread, as the fuzzers do not use any other ones.
+static double getThreadCpuSeconds() {
+  timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size);
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size) {
+  // Without a limit, just to measure.
+  const auto allocator = std::make_shared<rawspeed::BudgetImageAllocator>(0);
+  const double start = getThreadCpuSeconds();
+
+  try {
+    const rawspeed::Buffer buffer(Data, Size);
+    rawspeed::RawParser parser(&buffer);
+    auto decoder = parser.getDecoder(/*&metadata*/);
+
+    decoder->applyCrop = false;
+    decoder->interpolateBadPixels = false;
+    decoder->failOnUnknown = false;
+    decoder->imageAllocator = allocator;
+
+    decoder->decodeRaw();
+    decoder->decodeMetaData(&metadata);
+  } catch (rawspeed::RawspeedException&) {
+    // Failing late is no cheaper than succeeding, so it is checked as well.
+  }
+
+  const double seconds = getThreadCpuSeconds() - start;
+  const uint64_t work =
+      allocator->getPeakBytes() +
+      static_cast<uint64_t>(allocator->getNumAllocations()) * ALLOCATION_WORK;
+
+  const uint64_t workBudget =
+      MIN_WORK + static_cast<uint64_t>(WORK_PER_INPUT_BYTE) * Size;
+  const double timeBudget =
+      MIN_SECONDS + SECONDS_PER_INPUT_MIB * Size / (1024.0 * 1024.0);
+
+  if (work > workBudget || seconds > timeBudget) {
+    fprintf(stderr,
+            "Super-linear decoding: %zu bytes of input took %llu bytes of "
+            "work (budget %llu; peak %zu bytes in %zu allocations), and "
+            "%.3f s (budget %.3f s)\n",
+            Size, static_cast<unsigned long long>(work),
+            static_cast<unsigned long long>(workBudget),
+            allocator->getPeakBytes(), allocator->getNumAllocations(),
+            seconds, timeBudget);
+    abort();
+  }
+
+  return 0;
+}
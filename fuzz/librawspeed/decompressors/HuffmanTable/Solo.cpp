@@ -28,24 +28,25 @@
 #error FULLDECODE must be defined as bool
 #endif
 
-#include "common/RawspeedException.h"          // for RawspeedException
-#include "decompressors/HuffmanTable.h"        // IWYU pragma: keep
-#include "decompressors/HuffmanTable/Common.h" // for createHuffmanTable
-#include "decompressors/HuffmanTableLUT.h"     // IWYU pragma: keep
-#include "decompressors/HuffmanTableLookup.h"  // IWYU pragma: keep
-#include "decompressors/HuffmanTableTree.h"    // IWYU pragma: keep
-#include "decompressors/HuffmanTableVector.h"  // IWYU pragma: keep
-#include "io/BitPumpJPEG.h"                    // IWYU pragma: keep
-#include "io/BitPumpMSB.h"                     // IWYU pragma: keep
-#include "io/BitPumpMSB32.h"                   // IWYU pragma: keep
-#include "io/BitStream.h"                      // for BitStream
-#include "io/Buffer.h"                         // for Buffer, DataBuffer
-#include "io/ByteStream.h"                     // for ByteStream
-#include "io/Endianness.h"                     // for Endianness, Endiannes...
-#include <cassert>                             // for assert
-#include <cstdint>                             // for uint8_t
-#include <cstdio>                              // for size_t
-#include <initializer_list>                    // IWYU pragma: keep
+#include "common/RawspeedException.h"           // for RawspeedException
+#include "decompressors/HuffmanTable.h"         // IWYU pragma: keep
+#include "decompressors/HuffmanTable/Common.h"  // for createHuffmanTable
+#include "decompressors/HuffmanTableLUT.h"      // IWYU pragma: keep
+#include "decompressors/HuffmanTableLookup.h"   // IWYU pragma: keep
+#include "decompressors/HuffmanTableMultiLUT.h" // IWYU pragma: keep
+#include "decompressors/HuffmanTableTree.h"     // IWYU pragma: keep
+#include "decompressors/HuffmanTableVector.h"   // IWYU pragma: keep
+#include "io/BitPumpJPEG.h"                     // IWYU pragma: keep
+#include "io/BitPumpMSB.h"                      // IWYU pragma: keep
+#include "io/BitPumpMSB32.h"                    // IWYU pragma: keep
+#include "io/BitStream.h"                       // for BitStream
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, Endiannes...
+#include <cassert>                              // for assert
+#include <cstdint>                              // for uint8_t
+#include <cstdio>                               // for size_t
+#include <initializer_list>                     // IWYU pragma: keep
 
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size);
 
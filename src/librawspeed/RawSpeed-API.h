@@ -25,18 +25,28 @@
 
 #include "rawspeedconfig.h"
 
+#include "common/Cancellation.h"
 #include "common/Common.h"
+#include "common/Executor.h"
 #include "common/Mutex.h"
 #include "common/Point.h"
 #include "common/RawImage.h"
 #include "common/RawspeedException.h"
+#include "common/Trace.h"
+#include "decoders/AsyncDecoder.h"
+#include "decoders/BatchDecoder.h"
+#include "decoders/DecoderSession.h"
+#include "decoders/Prewarm.h"
 #include "decoders/RawDecoder.h"
+#include "encoders/DngWriter.h"
 #include "io/Buffer.h"
+#include "io/BufferLoader.h"
 #include "io/Endianness.h"
 #include "io/FileReader.h"
 #include "metadata/BlackArea.h"
 #include "metadata/Camera.h"
 #include "metadata/CameraMetaData.h"
+#include "metadata/CameraMetaDataStore.h"
 #include "metadata/ColorFilterArray.h"
 #include "parsers/RawParser.h"
 
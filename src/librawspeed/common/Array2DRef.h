@@ -22,6 +22,7 @@
 #pragma once
 
 #include <cassert> // for assert
+#include <cstddef> // for ptrdiff_t
 #include <type_traits>
 #include <vector> // for vector
 
@@ -63,6 +64,13 @@ public:
   }
 
   inline T& operator()(int x, int y) const;
+
+  // The first element of the row y, for the loops over a whole row, which
+  // then index it directly.
+  inline T* operator[](int y) const;
+
+  // Of the elements, between the starts of the consecutive rows.
+  int getPitch() const { return _pitch; }
 };
 
 template <class T>
@@ -81,7 +89,14 @@ T& Array2DRef<T>::operator()(const int x, const int y) const {
   assert(y >= 0);
   assert(x < width);
   assert(y < height);
-  return _data[y * _pitch + x];
+  return _data[static_cast<ptrdiff_t>(y) * _pitch + x];
+}
+
+template <class T> T* Array2DRef<T>::operator[](const int y) const {
+  assert(_data);
+  assert(y >= 0);
+  assert(y < height);
+  return &_data[static_cast<ptrdiff_t>(y) * _pitch];
 }
 
 } // namespace rawspeed
@@ -0,0 +1,175 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/BadPixelFixer.h"
+#include "common/Common.h" // for clampBits, ushort16
+#include "common/Point.h"  // for iPoint2D
+
+namespace rawspeed {
+
+BadPixelFixer::BadPixelFixer(RawImageData* img_)
+    : img(img_), step(img->isCFA ? 2 : 1),
+      data(img->getDataUncropped(0, 0)), pitch(img->pitch),
+      columnRuns(makeScratchVector<Run>(img->scratch.get())) {}
+
+int BadPixelFixer::find(int x, int y, int dx, int dy) const {
+  const iPoint2D dim = img->getUncroppedDim();
+  for (x += dx * step, y += dy * step;
+       x >= 0 && x < dim.x && y >= 0 && y < dim.y;
+       x += dx * step, y += dy * step) {
+    if (!img->isBadPixel(x, y))
+      return dx ? x : y;
+  }
+  return -1;
+}
+
+const BadPixelFixer::Run& BadPixelFixer::getRowRun(int x, int y) {
+  if (y != row) {
+    rowRuns.fill(Run::none());
+    row = y;
+  }
+  Run& run = rowRuns[x % step];
+  if (!run.contains(x)) {
+    run.from = x;
+    run.before = find(x, y, -1, 0);
+    run.after = find(x, y, 1, 0);
+  }
+  return run;
+}
+
+const BadPixelFixer::Run& BadPixelFixer::getColumnRun(int x, int y) {
+  // Only if there are bad pixels.
+  if (columnRuns.empty())
+    columnRuns.assign(static_cast<size_t>(img->getUncroppedDim().x) * step,
+                      Run::none());
+  Run& run = columnRuns[static_cast<size_t>(x) * step + y % step];
+  if (!run.contains(y)) {
+    run.from = y;
+    run.before = find(x, y, 0, -1);
+    run.after = find(x, y, 0, 1);
+  }
+  return run;
+}
+
+std::pair<int, int> BadPixelFixer::getRows(uint32 x, uint32 y) {
+  const Run& run = getColumnRun(x, y);
+  return {run.before >= 0 ? run.before : y, run.after >= 0 ? run.after : y};
+}
+
+// The closer one of the two of a direction weighs more, but if there is
+// only one, it weighs nothing at all, as it always did.
+void BadPixelFixer::fixU16(uint32 x, uint32 y) {
+  const Run& h = getRowRun(x, y);
+  const Run& v = getColumnRun(x, y);
+
+  std::array<const ushort16*, 4> values = {{}};
+  std::array<int, 4> dist = {{}};
+  std::array<int, 4> weight = {{}};
+  if (h.before >= 0) {
+    values[0] = getPixel<ushort16>(h.before, y);
+    dist[0] = x - h.before;
+  }
+  if (h.after >= 0) {
+    values[1] = getPixel<ushort16>(h.after, y);
+    dist[1] = h.after - x;
+  }
+  if (v.before >= 0) {
+    values[2] = getPixel<ushort16>(x, v.before);
+    dist[2] = y - v.before;
+  }
+  if (v.after >= 0) {
+    values[3] = getPixel<ushort16>(x, v.after);
+    dist[3] = v.after - y;
+  }
+
+  int total_shifts = 7;
+  for (int i : {0, 2}) {
+    const int total_dist = dist[i] + dist[i + 1];
+    if (!total_dist)
+      continue;
+    weight[i] = dist[i] ? (total_dist - dist[i]) * 256 / total_dist : 0;
+    weight[i + 1] = 256 - weight[i];
+    total_shifts++;
+  }
+
+  auto* pix = getPixel<ushort16>(x, y);
+  for (int c = 0; c < static_cast<int>(img->getCpp()); c++) {
+    int total_pixel = 0;
+    for (int i = 0; i < 4; i++)
+      if (values[i])
+        total_pixel += values[i][c] * weight[i];
+    total_pixel >>= total_shifts;
+    pix[c] = clampBits(total_pixel, 16);
+  }
+}
+
+// The float values may be negative, so it is the distance that tells
+// whether there is one. One alone gets all of the weight.
+void BadPixelFixer::fixFloat(uint32 x, uint32 y) {
+  const Run& h = getRowRun(x, y);
+  const Run& v = getColumnRun(x, y);
+
+  std::array<const float*, 4> values = {{}};
+  std::array<int, 4> dist = {{}};
+  std::array<float, 4> weight = {{}};
+  if (h.before >= 0) {
+    values[0] = getPixel<float>(h.before, y);
+    dist[0] = x - h.before;
+  }
+  if (h.after >= 0) {
+    values[1] = getPixel<float>(h.after, y);
+    dist[1] = h.after - x;
+  }
+  if (v.before >= 0) {
+    values[2] = getPixel<float>(x, v.before);
+    dist[2] = y - v.before;
+  }
+  if (v.after >= 0) {
+    values[3] = getPixel<float>(x, v.after);
+    dist[3] = v.after - y;
+  }
+
+  float total_div = 0.000001F;
+  for (int first : {0, 2}) {
+    const int second = first + 1;
+    const int total_dist = dist[first] + dist[second];
+    if (!total_dist)
+      continue;
+    for (int i : {first, second}) {
+      if (dist[i])
+        weight[i] = dist[first + second - i]
+                        ? static_cast<float>(total_dist - dist[i]) /
+                              static_cast<float>(total_dist)
+                        : 1.0F;
+    }
+    total_div += 1;
+  }
+
+  auto* pix = getPixel<float>(x, y);
+  for (int c = 0; c < static_cast<int>(img->getCpp()); c++) {
+    float total_pixel = 0;
+    for (int i = 0; i < 4; i++)
+      if (dist[i])
+        total_pixel += values[i][c] * weight[i];
+    pix[c] = total_pixel / total_div;
+  }
+}
+
+} // namespace rawspeed
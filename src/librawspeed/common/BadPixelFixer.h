@@ -0,0 +1,97 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"       // for uint32, uchar8
+#include "common/RawImage.h"     // for RawImageData, TYPE_USHORT16
+#include "common/ScratchArena.h" // for ScratchVector
+#include <array>                 // for array
+#include <climits>               // for INT_MAX
+#include <utility>               // for pair
+
+namespace rawspeed {
+
+// Interpolates the bad pixels of an image, each from the closest good pixels
+// to the left, right, up and down, 2 apart for the CFA images, else 1.
+//
+// The searches for those are shared by the runs of the bad pixels: all of a
+// run of a row have the same good pixels to the left and to the right, and
+// all of a run of a column, e.g. of a dead one, have the same ones up and
+// down, so each of those is only searched for once, rather than once per
+// pixel of the run. They are the fastest if the pixels go in the order of
+// the rows, and within them, of the columns, as forEachBadPixel() does.
+//
+// Only the good pixels are read, so the pixels may be fixed in any order,
+// and by several of them at once, each with its own BadPixelFixer, as long
+// as the rows that they read (getRows()) are not being written to.
+class BadPixelFixer final {
+  // Of the search from a bad pixel, the good one before and after it, or -1.
+  // All of the ones of the same step between 'from' and 'after' are bad, so
+  // it is also that of them.
+  struct Run {
+    int from;
+    int before;
+    int after;
+
+    static Run none() { return {INT_MAX, -1, -1}; }
+
+    bool contains(int pos) const {
+      return from < pos && (after < 0 || pos < after);
+    }
+  };
+
+  RawImageData* const img;
+  const int step;
+  uchar8* const data;
+  const uint32 pitch;
+
+  int row = -1;
+  std::array<Run, 2> rowRuns; // of the current row, of x % step
+  ScratchVector<Run> columnRuns; // of x * step + y % step
+
+  int find(int x, int y, int dx, int dy) const;
+  const Run& getRowRun(int x, int y);
+  const Run& getColumnRun(int x, int y);
+
+  template <typename T> T* getPixel(int x, int y) const {
+    return reinterpret_cast<T*>(data + static_cast<size_t>(y) * pitch) +
+           static_cast<size_t>(x) * img->getCpp();
+  }
+
+  void fixU16(uint32 x, uint32 y);
+  void fixFloat(uint32 x, uint32 y);
+
+public:
+  explicit BadPixelFixer(RawImageData* img);
+
+  // The first and the last row that fix() of it reads.
+  std::pair<int, int> getRows(uint32 x, uint32 y);
+
+  // All of the components of it.
+  void fix(uint32 x, uint32 y) {
+    if (img->getDataType() == TYPE_USHORT16)
+      fixU16(x, y);
+    else
+      fixFloat(x, y);
+  }
+};
+
+} // namespace rawspeed
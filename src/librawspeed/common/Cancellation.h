@@ -0,0 +1,60 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <atomic> // for atomic, memory_order_relaxed
+#include <chrono> // for steady_clock
+#include <limits> // for numeric_limits
+
+namespace rawspeed {
+
+// Lets the host application stop a decode in progress, e.g. once its result
+// is not wanted anymore, or once it takes too long. The decoding does not
+// stop right away, but at the next point where the decompressor checks it,
+// e.g. between the tiles, or between the rows of a serial one, and then fails
+// with a RawDecoderException. See RawImageData::cancellation.
+class Cancellation final {
+  using Clock = std::chrono::steady_clock;
+
+  std::atomic<bool> cancelled{false};
+  // Of Clock::time_point, in Clock::duration since its epoch.
+  std::atomic<Clock::rep> deadline{std::numeric_limits<Clock::rep>::max()};
+
+public:
+  // May be called from any thread, at any time.
+  void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+  // Once it is reached, it is as if cancel() was called.
+  void setDeadline(Clock::time_point t) {
+    deadline.store(t.time_since_epoch().count(), std::memory_order_relaxed);
+  }
+  void setTimeout(Clock::duration d) { setDeadline(Clock::now() + d); }
+
+  bool isCancelled() const {
+    if (cancelled.load(std::memory_order_relaxed))
+      return true;
+    const Clock::rep d = deadline.load(std::memory_order_relaxed);
+    return d != std::numeric_limits<Clock::rep>::max() &&
+           Clock::now().time_since_epoch().count() >= d;
+  }
+};
+
+} // namespace rawspeed
@@ -158,6 +158,38 @@ clampBits(T value, unsigned int nBits,
   return clampBits<UnsignedT>(value, nBits);
 }
 
+// The IEEE half float of the value, rounded to the nearest even, as F16C
+// does. Those too large become infinities, and NaNs stay NaNs.
+inline ushort16 __attribute__((const)) floatToHalf(float value) {
+  uint32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint32 sign = (bits >> 16U) & 0x8000U;
+  bits &= 0x7FFFFFFFU;
+
+  constexpr uint32 Infinity = 255U << 23U;
+  constexpr uint32 HalfOverflow = (127U + 16U) << 23U;
+  constexpr uint32 HalfNormal = (127U - 14U) << 23U;
+  if (bits >= HalfOverflow)
+    return sign | (bits > Infinity ? 0x7E00U : 0x7C00U);
+
+  if (bits < HalfNormal) {
+    // The addition shifts the subnormal into the low bits, rounding it.
+    constexpr uint32 Magic = ((127U - 15U) + (23U - 10U) + 1U) << 23U;
+    float magic;
+    memcpy(&magic, &Magic, sizeof(magic));
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    f += magic;
+    memcpy(&bits, &f, sizeof(bits));
+    return sign | (bits - Magic);
+  }
+
+  // Rebias the exponent, and round the 13 dropped bits to the nearest even.
+  const uint32 odd = (bits >> 13U) & 1U;
+  bits += ((15U - 127U) << 23U) + 0xFFFU + odd;
+  return sign | (bits >> 13U);
+}
+
 // Trim both leading and trailing spaces from the string
 inline std::string trimSpaces(const std::string& str)
 {
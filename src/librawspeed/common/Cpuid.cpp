@@ -19,31 +19,210 @@
 */
 
 #include "common/Cpuid.h"
+#include <atomic>  // for atomic, memory_order_relaxed
+#include <cstdlib> // for getenv
+#include <cstring> // for memcmp
 
 #if defined(__i386__) || defined(__x86_64__)
-#include <cpuid.h> // for __get_cpuid, bit_SSE2
+#include <cpuid.h> // for __get_cpuid, bit_SSE2, bit_AVX2, ...
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h> // for getauxval, AT_HWCAP
+#endif
+
+// Older cpuid.h do not know these yet.
+#ifndef bit_SSSE3
+#define bit_SSSE3 (1 << 9)
+#endif
+#ifndef bit_SSE4_1
+#define bit_SSE4_1 (1 << 19)
+#endif
+#ifndef bit_OSXSAVE
+#define bit_OSXSAVE (1 << 27)
+#endif
+#ifndef bit_F16C
+#define bit_F16C (1 << 29)
+#endif
+#ifndef bit_AVX2
+#define bit_AVX2 (1 << 5)
+#endif
+#ifndef bit_BMI2
+#define bit_BMI2 (1 << 8)
+#endif
+#ifndef bit_AVX512F
+#define bit_AVX512F (1 << 16)
+#endif
+#ifndef bit_AVX512BW
+#define bit_AVX512BW (1 << 30)
 #endif
 
 namespace rawspeed {
 
+namespace {
+
 #if defined(__i386__) || defined(__x86_64__)
 
-bool Cpuid::SSE2() {
+// XCR0 bits: the SSE, AVX, and the three AVX-512 states.
+constexpr unsigned long long XCR0_AVX = 0x6;
+constexpr unsigned long long XCR0_AVX512 = 0xE6;
+
+// Whether the OS saves all of these register states on the context switches.
+// Without that, the instructions can not be used even if the CPU has them.
+bool OSSupports(unsigned int ecx1, unsigned long long xcr0Mask) {
+  if (!(ecx1 & bit_OSXSAVE))
+    return false;
+
+  // xgetbv, as a byte sequence for the older assemblers.
+  unsigned int xcr0Low;
+  unsigned int xcr0High;
+  __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0"
+                       : "=a"(xcr0Low), "=d"(xcr0High)
+                       : "c"(0));
+  const auto xcr0 = (static_cast<unsigned long long>(xcr0High) << 32) | xcr0Low;
+
+  return (xcr0 & xcr0Mask) == xcr0Mask;
+}
+
+// pext and pdep are microcoded on AMD before Zen 3, family 0x19.
+bool hasSlowBMI2() {
   unsigned int eax;
   unsigned int ebx;
   unsigned int ecx;
   unsigned int edx;
 
-  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+  __cpuid(0, eax, ebx, ecx, edx);
+  const bool amd = !memcmp(&ebx, "Auth", 4) && !memcmp(&edx, "enti", 4) &&
+                   !memcmp(&ecx, "cAMD", 4);
+  if (!amd)
     return false;
 
-  return edx & bit_SSE2;
+  __cpuid(1, eax, ebx, ecx, edx);
+  unsigned int family = (eax >> 8) & 0xF;
+  if (family == 0xF)
+    family += (eax >> 20) & 0xFF;
+  return family < 0x19;
+}
+
+unsigned detect() {
+  unsigned int eax;
+  unsigned int ebx;
+  unsigned int ecx;
+  unsigned int edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+
+  unsigned features = 0;
+  if (edx & bit_SSE2)
+    features |= Cpuid::FEATURE_SSE2;
+  if (ecx & bit_SSSE3)
+    features |= Cpuid::FEATURE_SSSE3;
+  if (ecx & bit_SSE4_1)
+    features |= Cpuid::FEATURE_SSE41;
+
+  // The instructions are VEX encoded, they need the AVX state.
+  const bool avx = OSSupports(ecx, XCR0_AVX);
+  if ((ecx & bit_F16C) && avx)
+    features |= Cpuid::FEATURE_F16C;
+  const bool avx512 = OSSupports(ecx, XCR0_AVX512);
+
+  // The extended features, EBX of leaf 7.
+  if (__get_cpuid_max(0, nullptr) < 7)
+    return features;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+  if ((ebx & bit_AVX2) && avx)
+    features |= Cpuid::FEATURE_AVX2;
+  if ((ebx & bit_BMI2) && !hasSlowBMI2())
+    features |= Cpuid::FEATURE_BMI2;
+  if ((ebx & bit_AVX512F) && (ebx & bit_AVX512BW) && avx512)
+    features |= Cpuid::FEATURE_AVX512BW;
+
+  return features;
 }
 
 #else
 
-bool Cpuid::SSE2() { return false; }
+unsigned detect() {
+  unsigned features = 0;
+#if defined(__ARM_NEON)
+  features |= Cpuid::FEATURE_NEON;
+#endif
+#if defined(__aarch64__) && defined(__linux__)
+  // HWCAP_SVE, which the older headers do not know yet.
+  if (getauxval(AT_HWCAP) & (1UL << 22))
+    features |= Cpuid::FEATURE_SVE;
+#endif
+  return features;
+}
 
 #endif
 
+struct FeatureName {
+  Cpuid::Feature feature;
+  const char* name;
+};
+
+constexpr FeatureName featureNames[] = {
+    {Cpuid::FEATURE_SSE2, "sse2"},         {Cpuid::FEATURE_SSSE3, "ssse3"},
+    {Cpuid::FEATURE_SSE41, "sse4.1"},      {Cpuid::FEATURE_AVX2, "avx2"},
+    {Cpuid::FEATURE_BMI2, "bmi2"},         {Cpuid::FEATURE_F16C, "f16c"},
+    {Cpuid::FEATURE_AVX512BW, "avx512bw"}, {Cpuid::FEATURE_NEON, "neon"},
+    {Cpuid::FEATURE_SVE, "sve"},           {Cpuid::FEATURE_ALL, "all"},
+};
+
+std::atomic<unsigned>& getEnabledFeatures() {
+  static std::atomic<unsigned> enabled([]() {
+    const char* disabled = getenv("RAWSPEED_CPU_DISABLE");
+    return Cpuid::getDetected() & ~(disabled ? Cpuid::parse(disabled) : 0U);
+  }());
+  return enabled;
+}
+
+} // namespace
+
+bool Cpuid::has(Feature feature) {
+  return getEnabledFeatures().load(std::memory_order_relaxed) & feature;
+}
+
+unsigned Cpuid::getDetected() {
+  static const unsigned detected = detect();
+  return detected;
+}
+
+void Cpuid::setEnabled(unsigned features) {
+  getEnabledFeatures().store(getDetected() & features,
+                             std::memory_order_relaxed);
+}
+
+unsigned Cpuid::getEnabled() {
+  return getEnabledFeatures().load(std::memory_order_relaxed);
+}
+
+const char* Cpuid::getName(Feature feature) {
+  for (const auto& f : featureNames) {
+    if (f.feature == feature)
+      return f.name;
+  }
+  return "unknown";
+}
+
+unsigned Cpuid::parse(const std::string& names) {
+  unsigned features = 0;
+  std::string::size_type begin = 0;
+  while (begin <= names.size()) {
+    auto end = names.find(',', begin);
+    if (end == std::string::npos)
+      end = names.size();
+    const std::string name = names.substr(begin, end - begin);
+    for (const auto& f : featureNames) {
+      if (name == f.name)
+        features |= f.feature;
+    }
+    begin = end + 1;
+  }
+  return features;
+}
+
 } // namespace rawspeed
@@ -20,11 +20,66 @@
 
 #pragma once
 
+#include <string> // for string
+
 namespace rawspeed {
 
+// The instruction set extensions that the kernels are dispatched on. They
+// are detected once, and then only those that are enabled are reported,
+// which are all of them, unless some were disabled by the environment,
+// RAWSPEED_CPU_DISABLE, as a comma-separated list of the names, e.g.
+// "avx512bw,avx2", or "all" to force the scalar code; or by setEnabled().
 class Cpuid final {
 public:
-  static bool __attribute__((const)) SSE2();
+  enum Feature : unsigned {
+    FEATURE_SSE2 = 1U << 0,
+    FEATURE_SSSE3 = 1U << 1,
+    FEATURE_SSE41 = 1U << 2,
+    FEATURE_AVX2 = 1U << 3,
+    FEATURE_BMI2 = 1U << 4,
+    FEATURE_F16C = 1U << 5,
+    FEATURE_AVX512BW = 1U << 6,
+    FEATURE_NEON = 1U << 7,
+    FEATURE_SVE = 1U << 8,
+    FEATURE_ALL = (1U << 9) - 1,
+  };
+
+  // Whether the CPU has it, and it is enabled.
+  static bool __attribute__((pure)) has(Feature feature);
+
+  // What the CPU has, whether enabled or not.
+  static unsigned __attribute__((const)) getDetected();
+
+  // Of the detected ones, only these are enabled from now on, e.g. for the
+  // tests and the benchmarks of each of the variants of a kernel on the same
+  // machine. Not while anything is being decoded.
+  static void setEnabled(unsigned features);
+  static unsigned __attribute__((pure)) getEnabled();
+
+  // E.g. "avx2". And the features of a comma-separated list of the names,
+  // the unknown ones being ignored; "all" is FEATURE_ALL.
+  static const char* getName(Feature feature);
+  static unsigned parse(const std::string& names);
+
+  static bool __attribute__((pure)) SSE2() { return has(FEATURE_SSE2); }
+  static bool __attribute__((pure)) SSSE3() { return has(FEATURE_SSSE3); }
+  static bool __attribute__((pure)) SSE41() { return has(FEATURE_SSE41); }
+
+  // These also check that the OS preserves the wider registers.
+  static bool __attribute__((pure)) AVX2() { return has(FEATURE_AVX2); }
+  static bool __attribute__((pure)) F16C() { return has(FEATURE_F16C); }
+  static bool __attribute__((pure)) AVX512BW() {
+    return has(FEATURE_AVX512BW);
+  }
+
+  // For pext and pdep. Which are microcoded, and slow, on AMD before Zen 3,
+  // so that is not reported as BMI2.
+  static bool __attribute__((pure)) BMI2() { return has(FEATURE_BMI2); }
+
+  // NEON is mandatory on AArch64, so this is known at compile time, but it
+  // can still be disabled.
+  static bool __attribute__((pure)) NEON() { return has(FEATURE_NEON); }
+  static bool __attribute__((pure)) SVE() { return has(FEATURE_SVE); }
 };
 
 } // namespace rawspeed
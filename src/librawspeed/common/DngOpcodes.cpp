@@ -22,22 +22,25 @@
 
 #include "common/DngOpcodes.h"
 #include "common/Common.h"                // for uint32, ushort16, clampBits
+#include "common/Executor.h"              // for parallelFor, getExecutor, pa...
 #include "common/Mutex.h"                 // for MutexLocker
 #include "common/Point.h"                 // for iRectangle2D, iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
+#include "common/Simd.h"                  // for RAWSPEED_SIMD_DISPATCH
+#include "common/Trace.h"                 // for RAWSPEED_TRACE_SCOPE
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/ByteStream.h"                // for ByteStream
 #include "io/Endianness.h"                // for Endianness, Endianness::big
 #include "tiff/TiffEntry.h"               // for TiffEntry
 #include <algorithm>                      // for generate_n, fill_n
 #include <cassert>                        // for assert
-#include <cmath>                          // for pow
+#include <cmath>                          // for pow, isfinite
 #include <iterator>                       // for back_insert_iterator
 #include <limits>                         // for numeric_limits
 #include <stdexcept>                      // for out_of_range
 #include <tuple>                          // for tie, tuple
+#include <type_traits>                    // for is_same
 // IWYU pragma: no_include <ext/alloc_traits.h>
-// IWYU pragma: no_include <type_traits>
 
 using std::vector;
 using std::fill_n;
@@ -45,6 +48,55 @@ using std::make_pair;
 
 namespace rawspeed {
 
+namespace {
+
+// The offset and the scale opcodes, on a row of width ushort16 pixels with
+// one component each. delta has one value per pixel if perColumn, else just
+// the one for the whole row. They all produce the same result.
+using DeltaRowFunction = void (*)(ushort16* row, uint32 width,
+                                  const int* delta, bool perColumn);
+
+template <bool Scale> inline ushort16 applyDelta(ushort16 v, int delta) {
+  if (Scale)
+    return clampBits((delta * v + 512) >> 10, 16);
+  return clampBits(delta + v, 16);
+}
+
+template <bool Scale>
+void deltaRow_plain(ushort16* row, uint32 width, const int* delta,
+                    bool perColumn) {
+  for (uint32 x = 0; x < width; x++)
+    row[x] = applyDelta<Scale>(row[x], delta[perColumn ? x : 0]);
+}
+
+// The GainMap opcode, on n ushort16 values of a row, which are stride apart,
+// each one with its own gain. Again, they all produce the same result.
+using GainRowFunction = void (*)(ushort16* row, uint32 n, uint32 stride,
+                                 const float* gains);
+
+inline ushort16 applyGain(ushort16 v, float gain) {
+  const float f = static_cast<float>(v) * gain + 0.5F;
+  return static_cast<ushort16>(std::min(std::max(f, 0.0F), 65535.0F));
+}
+
+void gainRow_plain(ushort16* row, uint32 n, uint32 stride, const float* gains) {
+  for (uint32 i = 0; i < n; i++)
+    row[i * stride] = applyGain(row[i * stride], gains[i]);
+}
+
+#define RAWSPEED_SIMD_KERNELS "common/DngOpcodesKernels.h"
+#include "common/SimdForEachTarget.h" // IWYU pragma: keep
+
+GainRowFunction getGainRowFunction() {
+  return RAWSPEED_SIMD_DISPATCH(gainRow);
+}
+
+template <bool Scale> DeltaRowFunction getDeltaRowFunction() {
+  return RAWSPEED_SIMD_DISPATCH(deltaRow<Scale>);
+}
+
+} // namespace
+
 class DngOpcodes::DngOpcode {
 public:
   virtual ~DngOpcode() = default;
@@ -57,6 +109,9 @@ public:
 
   // Will be called for actual processing.
   virtual void apply(const RawImage& ri) = 0;
+
+  // As in the Map.
+  const char* name = "";
 };
 
 // ****************************************************************************
@@ -80,16 +135,27 @@ public:
   }
 
   void apply(const RawImage& ri) override {
-    MutexLocker guard(&ri->mBadPixelMutex);
-    iPoint2D crop = ri->getCropOffset();
-    uint32 offset = crop.x | (crop.y << 16);
-    for (auto y = 0; y < ri->dim.y; ++y) {
-      auto* src = reinterpret_cast<ushort16*>(ri->getData(0, y));
-      for (auto x = 0; x < ri->dim.x; ++x) {
-        if (src[x] == value)
-          ri->mBadPixelPositions.push_back(offset + (y << 16 | x));
+    const iPoint2D crop = ri->getCropOffset();
+
+    // Each band of the rows collects its own ones, and they are added
+    // afterwards, in the order of the rows, as if it was done serially.
+    const int numBands =
+        std::min(ri->dim.y, getExecutor()->getConcurrency());
+    std::vector<std::vector<BadPixelPosition>> found(numBands);
+    parallelFor(0, numBands, [&ri, crop, numBands, &found, this](int band) {
+      const int begin = ri->dim.y * band / numBands;
+      const int end = ri->dim.y * (band + 1) / numBands;
+      for (auto y = begin; y < end; ++y) {
+        const auto* src = reinterpret_cast<const ushort16*>(ri->getData(0, y));
+        for (auto x = 0; x < ri->dim.x; ++x) {
+          if (src[x] == value)
+            found[band].push_back(getBadPixelPosition(crop.x + x, crop.y + y));
+        }
       }
-    }
+    });
+
+    for (const auto& positions : found)
+      ri->addBadPixels(positions);
   }
 };
 
@@ -149,7 +215,7 @@ public:
 // ****************************************************************************
 
 class DngOpcodes::FixBadPixelsList final : public DngOpcodes::DngOpcode {
-  std::vector<uint32> badPixels;
+  std::vector<BadPixelPosition> badPixels;
 
 public:
   explicit FixBadPixelsList(const RawImage& ri, ByteStream* bs) {
@@ -161,22 +227,20 @@ public:
     auto badRectCount = bs->getU32();
 
     // first, check that we indeed have much enough data
-    const auto origPos = bs->getPosition();
-    bs->skipBytes(badPointCount, 2 * 4);
-    bs->skipBytes(badRectCount, 4 * 4);
-    bs->setPosition(origPos);
+    ByteStreamCursor points = bs->reserve(badPointCount, 2 * 4);
+    bs->check(badRectCount, 4 * 4);
 
     // Read points
     badPixels.reserve(badPixels.size() + badPointCount);
     for (auto i = 0U; i < badPointCount; ++i) {
-      auto y = bs->getU32();
-      auto x = bs->getU32();
+      auto y = points.getU32();
+      auto x = points.getU32();
 
       const iPoint2D badPoint(x, y);
       if (!fullImage.isPointInsideInclusive(badPoint))
         ThrowRDE("Bad point not inside image.");
 
-      badPixels.emplace_back(y << 16 | x);
+      badPixels.emplace_back(getBadPixelPosition(x, y));
     }
 
     // Read rects
@@ -190,7 +254,7 @@ public:
       badPixels.reserve(badPixels.size() + area);
       for (auto y = badRect.getTop(); y <= badRect.getBottom(); ++y) {
         for (auto x = badRect.getLeft(); x <= badRect.getRight(); ++x) {
-          badPixels.emplace_back(y << 16 | x);
+          badPixels.emplace_back(getBadPixelPosition(x, y));
         }
       }
     }
@@ -216,12 +280,12 @@ public:
 // ****************************************************************************
 
 class DngOpcodes::PixelOpcode : public ROIOpcode {
+protected:
   uint32 firstPlane;
   uint32 planes;
   uint32 rowPitch;
   uint32 colPitch;
 
-protected:
   explicit PixelOpcode(const RawImage& ri, ByteStream* bs)
       : ROIOpcode(ri, bs, false) {
     firstPlane = bs->getU32();
@@ -243,23 +307,40 @@ protected:
       ThrowRDE("Invalid pitch");
   }
 
+  // Whether the ROI rows are runs of adjacent values, of just one plane.
+  bool __attribute__((pure)) isContiguous(const RawImage& ri) const {
+    return ri->getCpp() == 1 && colPitch == 1;
+  }
+
+  // traverses the rows of the current ROI, in parallel, and calls
+  // op(y, src) for each one, where src points to the first plane of the
+  // pixel at (0, y).
+  template <typename T, typename OP>
+  void applyRowOP(const RawImage& ri, OP op) {
+    const iRectangle2D& ROI = getRoi();
+    const int numRows = (ROI.getHeight() + rowPitch - 1) / rowPitch;
+    parallelFor(0, numRows, [&](int row) {
+      const int y = ROI.getTop() + row * rowPitch;
+      auto* src = reinterpret_cast<T*>(ri->getData(0, y));
+      // Add offset, so this is always first plane
+      op(y, src + firstPlane);
+    });
+  }
+
   // traverses the current ROI and applies the operation OP to each pixel,
   // i.e. each pixel value v is replaced by op(x, y, v), where x/y are the
   // coordinates of the pixel value v.
   template <typename T, typename OP> void applyOP(const RawImage& ri, OP op) {
     int cpp = ri->getCpp();
     const iRectangle2D& ROI = getRoi();
-    for (auto y = ROI.getTop(); y < ROI.getBottom(); y += rowPitch) {
-      auto* src = reinterpret_cast<T*>(ri->getData(0, y));
-      // Add offset, so this is always first plane
-      src += firstPlane;
+    applyRowOP<T>(ri, [this, cpp, &ROI, &op](int y, T* src) {
       // FIXME: is op() really supposed to receive global image coordinates,
       // and not [0..ROI.getHeight()-1][0..ROI.getWidth()-1] ?
       for (auto x = ROI.getLeft(); x < ROI.getRight(); x += colPitch) {
         for (auto p = 0U; p < planes; ++p)
           src[x * cpp + p] = op(x, y, src[x * cpp + p]);
       }
-    }
+    });
   }
 };
 
@@ -294,8 +375,7 @@ public:
     if (count == 0 || count > 65536)
       ThrowRDE("Invalid size of lookup table");
 
-    for (auto i = 0U; i < count; ++i)
-      lookup[i] = bs->getU16();
+    bs->getArray(lookup.data(), count);
 
     if (count < lookup.size())
       fill_n(&lookup[count], lookup.size() - count, lookup[count - 1]);
@@ -311,13 +391,13 @@ public:
     vector<double> polynomial;
 
     const auto polynomial_size = bs->getU32() + 1UL;
-    bs->check(8UL * polynomial_size);
+    ByteStreamCursor in = bs->reserve(polynomial_size, 8);
     if (polynomial_size > 9)
       ThrowRDE("A polynomial with more than 8 degrees not allowed");
 
     polynomial.reserve(polynomial_size);
     std::generate_n(std::back_inserter(polynomial), polynomial_size,
-                    [&bs]() { return bs->get<double>(); });
+                    [&in]() { return in.getDouble(); });
 
     // Create lookup
     lookup.resize(65536);
@@ -369,13 +449,24 @@ protected:
   vector<float> deltaF;
   vector<int> deltaI;
 
+  // The common case of the ushort16 images, with a fast path.
+  template <bool Scale> void applyDeltaRows(const RawImage& ri) {
+    const bool perColumn = std::is_same<S, SelectX>::value;
+    const iRectangle2D& ROI = this->getRoi();
+    const DeltaRowFunction deltaRow = getDeltaRowFunction<Scale>();
+    this->template applyRowOP<ushort16>(ri, [&](int y, ushort16* src) {
+      deltaRow(src + ROI.getLeft(), ROI.getWidth(),
+               &deltaI[perColumn ? ROI.getLeft() : y], perColumn);
+    });
+  }
+
   // only meaningful for ushort16 images!
   virtual bool valueIsOk(float value) = 0;
 
   DeltaRowOrCol(const RawImage& ri, ByteStream* bs, float f2iScale_)
       : DeltaRowOrColBase(ri, bs), f2iScale(f2iScale_) {
     const auto deltaF_count = bs->getU32();
-    bs->check(deltaF_count, 4);
+    ByteStreamCursor in = bs->reserve(deltaF_count, 4);
 
     // See PixelOpcode::applyOP(). We will access deltaF/deltaI up to (excl.)
     // either ROI.getRight() or ROI.getBottom() index. Thus, we need to have
@@ -389,8 +480,8 @@ protected:
     }
 
     deltaF.reserve(deltaF_count);
-    std::generate_n(std::back_inserter(deltaF), deltaF_count, [&bs]() {
-      const auto F = bs->get<float>();
+    std::generate_n(std::back_inserter(deltaF), deltaF_count, [&in]() {
+      const auto F = in.getFloat();
       if (!std::isfinite(F))
         ThrowRDE("Got bad float %f.", F);
       return F;
@@ -417,7 +508,9 @@ public:
                  this->f2iScale) {}
 
   void apply(const RawImage& ri) override {
-    if (ri->getDataType() == TYPE_USHORT16) {
+    if (ri->getDataType() == TYPE_USHORT16 && this->isContiguous(ri)) {
+      this->template applyDeltaRows<false>(ri);
+    } else if (ri->getDataType() == TYPE_USHORT16) {
       this->template applyOP<ushort16>(
           ri, [this](uint32 x, uint32 y, ushort16 v) {
             return clampBits(this->deltaI[S::select(x, y)] + v, 16);
@@ -454,7 +547,9 @@ public:
                  this->f2iScale) {}
 
   void apply(const RawImage& ri) override {
-    if (ri->getDataType() == TYPE_USHORT16) {
+    if (ri->getDataType() == TYPE_USHORT16 && this->isContiguous(ri)) {
+      this->template applyDeltaRows<true>(ri);
+    } else if (ri->getDataType() == TYPE_USHORT16) {
       this->template applyOP<ushort16>(ri, [this](uint32 x, uint32 y,
                                                   ushort16 v) {
         return clampBits((this->deltaI[S::select(x, y)] * v + 512) >> 10, 16);
@@ -469,6 +564,150 @@ public:
 
 // ****************************************************************************
 
+class DngOpcodes::GainMap final : public PixelOpcode {
+  // Where a pixel is on one of the axes of the map: between the points
+  // index and index + 1, at the fraction weight of the way.
+  struct Position {
+    uint32 index;
+    float weight;
+  };
+
+  struct Axis {
+    uint32 points;
+    double spacing;
+    double origin;
+
+    // The map coordinates are relative to the size of the image, and outside
+    // of the map, the nearest points are used.
+    Position getPosition(int pixel, int size) const {
+      if (points == 1)
+        return {0, 0.0F};
+      const double pos = (static_cast<double>(pixel) / size - origin) / spacing;
+      if (pos <= 0)
+        return {0, 0.0F};
+      if (pos >= points - 1)
+        return {points - 2, 1.0F};
+      const auto index = static_cast<uint32>(pos);
+      return {index, static_cast<float>(pos - index)};
+    }
+  };
+
+  Axis vertical;
+  Axis horizontal;
+  uint32 mapPlanes;
+  // [row][column][plane]
+  vector<float> gains;
+
+  static Axis readAxis(ByteStream* bs, uint32 points, double spacing) {
+    const auto origin = bs->get<double>();
+    if (!std::isfinite(origin) || !std::isfinite(spacing) ||
+        (points > 1 && !(spacing > 0)))
+      ThrowRDE("Bad map spacing %f or origin %f.", spacing, origin);
+    return {points, spacing, origin};
+  }
+
+public:
+  explicit GainMap(const RawImage& ri, ByteStream* bs) : PixelOpcode(ri, bs) {
+    const auto pointsV = bs->getU32();
+    const auto pointsH = bs->getU32();
+    const auto spacingV = bs->get<double>();
+    const auto spacingH = bs->get<double>();
+    vertical = readAxis(bs, pointsV, spacingV);
+    horizontal = readAxis(bs, pointsH, spacingH);
+    mapPlanes = bs->getU32();
+
+    if (pointsV == 0 || pointsH == 0 || mapPlanes == 0)
+      ThrowRDE("Empty gain map (%u x %u x %u)", pointsV, pointsH, mapPlanes);
+
+    const uint64 count = uint64(pointsV) * pointsH * mapPlanes;
+    if (count > std::numeric_limits<uint32>::max())
+      ThrowRDE("Gain map is too large");
+    ByteStreamCursor in = bs->reserve(count, 4);
+
+    gains.reserve(count);
+    std::generate_n(std::back_inserter(gains), count, [&in]() {
+      const auto F = in.getFloat();
+      if (!std::isfinite(F))
+        ThrowRDE("Got bad float %f.", F);
+      return F;
+    });
+  }
+
+  void apply(const RawImage& ri) override {
+    if (ri->getDataType() == TYPE_USHORT16)
+      applyGains<ushort16>(ri);
+    else
+      applyGains<float>(ri);
+  }
+
+private:
+  // The gain map is interpolated separably: once per row of the map columns,
+  // then once per pixel, between the two nearest of those.
+  template <typename T> void applyGains(const RawImage& ri) {
+    const iRectangle2D& ROI = getRoi();
+    const int cpp = ri->getCpp();
+    const uint32 n = (ROI.getWidth() + colPitch - 1) / colPitch;
+
+    vector<Position> columns;
+    columns.reserve(n);
+    for (uint32 i = 0; i < n; i++) {
+      columns.emplace_back(
+          horizontal.getPosition(ROI.getLeft() + i * colPitch, ri->dim.x));
+    }
+
+    const GainRowFunction gainRow = getGainRowFunction();
+    const int numRows = (ROI.getHeight() + rowPitch - 1) / rowPitch;
+    parallelForRange(0, numRows, [&](int chunkBegin, int chunkEnd) {
+      vector<float> mapRow(horizontal.points);
+      vector<float> rowGains(n);
+
+      for (int row = chunkBegin; row < chunkEnd; row++) {
+        const int y = ROI.getTop() + row * rowPitch;
+        const Position r = vertical.getPosition(y, ri->dim.y);
+        auto* src = reinterpret_cast<T*>(ri->getData(ROI.getLeft(), y));
+
+        for (uint32 p = 0; p < planes; p++) {
+          const uint32 mapPlane = std::min(p, mapPlanes - 1);
+          const auto gain = [this, mapPlane](uint32 mapY, uint32 mapX) {
+            return gains[(mapY * horizontal.points + mapX) * mapPlanes +
+                         mapPlane];
+          };
+
+          const uint32 nextRow = std::min(r.index + 1, vertical.points - 1);
+          for (uint32 x = 0; x < horizontal.points; x++) {
+            const float top = gain(r.index, x);
+            mapRow[x] = top + r.weight * (gain(nextRow, x) - top);
+          }
+
+          for (uint32 i = 0; i < n; i++) {
+            const Position& c = columns[i];
+            const float left = mapRow[c.index];
+            const float right =
+                mapRow[std::min(c.index + 1, horizontal.points - 1)];
+            rowGains[i] = left + c.weight * (right - left);
+          }
+
+          applyRow(gainRow, src + firstPlane + p, n, colPitch * cpp,
+                   rowGains.data());
+        }
+      }
+    });
+  }
+
+  static void applyRow(GainRowFunction gainRow, ushort16* row, uint32 n,
+                       uint32 stride, const float* rowGains) {
+    gainRow(row, n, stride, rowGains);
+  }
+
+  static void applyRow(GainRowFunction /*gainRow*/, float* row, uint32 n,
+                       uint32 stride, const float* rowGains) {
+    for (uint32 i = 0; i < n; i++)
+      row[i * stride] *= rowGains[i];
+  }
+};
+
+// ****************************************************************************
+
 DngOpcodes::DngOpcodes(const RawImage& ri, TiffEntry* entry) {
   ByteStream bs = entry->getData();
 
@@ -511,9 +750,10 @@ DngOpcodes::DngOpcodes(const RawImage& ri, TiffEntry* entry) {
       ThrowRDE("Unknown unhandled Opcode: %d", code);
     }
 
-    if (opConstructor != nullptr)
+    if (opConstructor != nullptr) {
       opcodes.emplace_back(opConstructor(ri, &opcode_bs));
-    else {
+      opcodes.back()->name = opName;
+    } else {
 #ifndef DEBUG
       // Throw Error if not marked as optional
       if (!(flags & 1))
@@ -535,7 +775,11 @@ DngOpcodes::DngOpcodes(const RawImage& ri, TiffEntry* entry) {
 DngOpcodes::~DngOpcodes() = default;
 
 void DngOpcodes::applyOpCodes(const RawImage& ri) {
+  if (!opcodes.empty())
+    ri->makeWritable();
+
   for (const auto& code : opcodes) {
+    RAWSPEED_TRACE_SCOPE("opcode", code->name);
     code->setup(ri);
     code->apply(ri);
   }
@@ -565,7 +809,8 @@ const std::map<uint32, std::pair<const char*, DngOpcodes::constructor_t>>
          make_pair("MapTable", &DngOpcodes::constructor<DngOpcodes::TableMap>)},
         {8U, make_pair("MapPolynomial",
                        &DngOpcodes::constructor<DngOpcodes::PolynomialMap>)},
-        {9U, make_pair("GainMap", nullptr)},
+        {9U,
+         make_pair("GainMap", &DngOpcodes::constructor<DngOpcodes::GainMap>)},
         {10U,
          make_pair(
              "DeltaPerRow",
@@ -60,6 +60,7 @@ protected:
   template <typename S> class DeltaRowOrCol;
   template <typename S> class OffsetPerRowOrCol;
   template <typename S> class ScalePerRowOrCol;
+  class GainMap;
 
   template <class Opcode>
   static std::unique_ptr<DngOpcode> constructor(const RawImage& ri,
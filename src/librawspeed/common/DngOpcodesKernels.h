@@ -0,0 +1,71 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// No include guard: the kernels of DngOpcodes, once for each of the targets,
+// see common/Simd.h. The same as deltaRow_plain() and gainRow_plain(), which
+// do the rest of the row.
+
+// Lanes pixels at a time, in 32 bits. The saturating pack does the clamping.
+template <bool Scale>
+void deltaRow(ushort16* row, uint32 width, const int* delta, bool perColumn) {
+  const VI32 rowDelta = setI32(delta[0]);
+  const VI32 rounding = setI32(512);
+  const auto apply = [&rounding](VI32 v, VI32 d) {
+    if (Scale)
+      return shiftRight<10>(v * d + rounding);
+    return v + d;
+  };
+
+  uint32 x = 0;
+  for (; x + Lanes <= width; x += Lanes) {
+    const VU16 pix = loadU16(row + x);
+    const VI32 lower =
+        apply(lowerI32(pix), perColumn ? loadI32(delta + x) : rowDelta);
+    const VI32 upper = apply(
+        upperI32(pix), perColumn ? loadI32(delta + x + Lanes / 2) : rowDelta);
+    storeU16(row + x, packU16(lower, upper));
+  }
+
+  deltaRow_plain<Scale>(row + x, width - x, delta + (perColumn ? x : 0),
+                        perColumn);
+}
+
+// Lanes adjacent values at a time.
+inline void gainRow(ushort16* row, uint32 n, uint32 stride,
+                    const float* gains) {
+  if (stride != 1)
+    return gainRow_plain(row, n, stride, gains);
+
+  const VF32 zero = setF32(0.0F);
+  const VF32 white = setF32(65535.0F);
+  const VF32 half = setF32(0.5F);
+  const auto apply = [&](VI32 v, const float* g) {
+    return truncI32(min(max(toF32(v) * loadF32(g) + half, zero), white));
+  };
+
+  uint32 i = 0;
+  for (; i + Lanes <= n; i += Lanes) {
+    const VU16 pix = loadU16(row + i);
+    storeU16(row + i, packU16(apply(lowerI32(pix), gains + i),
+                              apply(upperI32(pix), gains + i + Lanes / 2)));
+  }
+
+  gainRow_plain(row + i, n - i, 1, gains + i);
+}
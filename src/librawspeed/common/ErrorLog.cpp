@@ -19,32 +19,58 @@
 */
 
 #include "ErrorLog.h"
-#include "common/Mutex.h" // for MutexLocker
-#include <utility>        // for move
+#include <algorithm> // for min
+#include <atomic>    // for memory_order_acquire, memory_order_relaxed
+#include <string>    // for string, to_string
+#include <thread>    // for yield
+#include <utility>   // for move
 
 namespace rawspeed {
 
+constexpr unsigned ErrorLog::maxErrors;
+
 void ErrorLog::setError(const std::string& err) {
-  MutexLocker guard(&mutex);
-  errors.push_back(err);
+  const unsigned i = numErrors.fetch_add(1, std::memory_order_relaxed);
+  if (i >= maxErrors)
+    return;
+
+  slots[i].message = err;
+  slots[i].ready.store(true, std::memory_order_release);
 }
 
 bool ErrorLog::isTooManyErrors(unsigned many, std::string* firstErr) {
-  MutexLocker guard(&mutex);
-
-  if (errors.size() < many)
+  const unsigned num = numErrors.load(std::memory_order_relaxed);
+  if (num < many)
     return false;
 
-  if (!firstErr)
+  if (!firstErr || num == 0)
     return true;
 
-  *firstErr = errors[0];
+  // It may still be being copied in, by the thread that set it.
+  while (!slots[0].ready.load(std::memory_order_acquire))
+    std::this_thread::yield();
+  *firstErr = slots[0].message;
   return true;
 }
 
-std::vector<std::string>&& ErrorLog::getErrors() {
-  MutexLocker guard(&mutex);
-  return std::move(errors);
+std::vector<std::string> ErrorLog::getErrors() {
+  const unsigned num = numErrors.exchange(0, std::memory_order_acquire);
+
+  std::vector<std::string> errors;
+  errors.reserve(std::min(num, maxErrors) + 1);
+  for (unsigned i = 0; i < std::min(num, maxErrors); i++) {
+    while (!slots[i].ready.load(std::memory_order_acquire))
+      std::this_thread::yield();
+    errors.emplace_back(std::move(slots[i].message));
+    slots[i].message.clear();
+    slots[i].ready.store(false, std::memory_order_relaxed);
+  }
+
+  if (num > maxErrors)
+    errors.emplace_back("... and " + std::to_string(num - maxErrors) +
+                        " more errors");
+
+  return errors;
 }
 
 } // namespace rawspeed
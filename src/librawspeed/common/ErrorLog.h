@@ -20,22 +20,36 @@
 
 #pragma once
 
-#include "ThreadSafetyAnalysis.h" // for REQUIRES, GUARDED_BY
-#include "common/Mutex.h"         // for Mutex
-#include <string>                 // for string
-#include <vector>                 // for vector
+#include <array>  // for array
+#include <atomic> // for atomic
+#include <string> // for string
+#include <vector> // for vector
 
 namespace rawspeed {
 
+// The errors of the (parallel) decoding. Setting one does not lock, since
+// a corrupt file may have an error in every one of its thousands of tiles.
+// Only the first maxErrors messages are kept, the rest are just counted.
 class ErrorLog {
-  Mutex mutex;
-  std::vector<std::string> errors GUARDED_BY(mutex);
+public:
+  static constexpr unsigned maxErrors = 64;
+
+private:
+  struct Slot {
+    std::atomic<bool> ready{false};
+    std::string message;
+  };
+
+  // How many were set, including the ones that did not fit.
+  std::atomic<unsigned> numErrors{0};
+  std::array<Slot, maxErrors> slots;
 
 public:
-  void setError(const std::string& err) REQUIRES(!mutex);
-  bool isTooManyErrors(unsigned many, std::string* firstErr = nullptr)
-      REQUIRES(!mutex);
-  std::vector<std::string>&& getErrors() REQUIRES(!mutex);
+  void setError(const std::string& err);
+  bool isTooManyErrors(unsigned many, std::string* firstErr = nullptr);
+  // Takes all the kept ones, and a note of how many more there were.
+  // Must not be called while the errors are still being set.
+  std::vector<std::string> getErrors();
 };
 
 } // namespace rawspeed
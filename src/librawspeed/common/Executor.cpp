@@ -0,0 +1,417 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h"
+#include "common/Executor.h"
+#include "common/Common.h" // for rawspeed_get_number_of_processor_cores
+#include "common/Trace.h"  // for RAWSPEED_TRACE_SCOPE
+#include <algorithm>       // for find, max, min
+#include <atomic>          // for atomic
+#include <cassert>         // for assert
+#include <chrono>          // for duration, steady_clock
+#include <exception>       // for exception_ptr, current_exception, rethro...
+#include <thread>          // for thread
+#include <utility>         // for move
+#include <vector>          // for vector
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+namespace rawspeed {
+
+namespace {
+
+// Of the innermost PriorityScope, or task, of the thread.
+thread_local Priority currentPriority = Priority::Normal;
+
+// The pool of the task that the thread runs, if any, and its priority.
+thread_local ThreadPoolExecutor* runningPool = nullptr;
+thread_local Priority runningPriority = Priority::Normal;
+
+} // namespace
+
+void Executor::post(std::function<void()> work) {
+  std::thread([w = std::move(work)]() {
+    try {
+      w();
+    } catch (...) {
+    }
+  }).detach();
+}
+
+void SerialExecutor::post(std::function<void()> work) {
+  try {
+    work();
+  } catch (...) {
+  }
+}
+
+void SerialExecutor::run(int numTasks, const Task& task) {
+  std::exception_ptr firstException;
+
+  for (int i = 0; i < numTasks; ++i) {
+    try {
+      task(i);
+    } catch (...) {
+      if (!firstException)
+        firstException = std::current_exception();
+    }
+  }
+
+  if (firstException)
+    std::rethrow_exception(firstException);
+}
+
+#ifdef HAVE_OPENMP
+int OpenMPExecutor::getConcurrency() const {
+  return std::max(1, rawspeed_get_number_of_processor_cores());
+}
+
+void OpenMPExecutor::run(int numTasks, const Task& task) {
+  if (numTasks <= 1) {
+    SerialExecutor().run(numTasks, task);
+    return;
+  }
+
+  std::exception_ptr firstException;
+  const Task* taskPtr = &task;
+  int threads = std::min(numTasks, getConcurrency());
+
+#pragma omp parallel for default(none) shared(firstException, taskPtr,        \
+                                              numTasks) num_threads(threads)   \
+    schedule(dynamic, 1)
+  for (int i = 0; i < numTasks; ++i) {
+    try {
+      (*taskPtr)(i);
+    } catch (...) {
+#pragma omp critical(rawspeed_executor_exception)
+      if (!firstException)
+        firstException = std::current_exception();
+    }
+  }
+
+  if (firstException)
+    std::rethrow_exception(firstException);
+}
+#endif
+
+struct ThreadPoolExecutor::Job final {
+  const Task* task;
+  int numTasks;
+  const Priority priority;
+
+  // All of these are guarded by ThreadPoolExecutor::mutex.
+  int nextTask = 0;
+  int unfinishedTasks;
+  std::exception_ptr firstException;
+  std::condition_variable finished;
+
+  // Of a posted job, which nobody waits for, and which deletes itself.
+  Task ownTask;
+  bool detached = false;
+
+  Job(const Task* task_, int numTasks_, Priority priority_)
+      : task(task_), numTasks(numTasks_), priority(priority_),
+        unfinishedTasks(numTasks_) {}
+};
+
+ThreadPoolExecutor::ThreadPoolExecutor(int numThreads) {
+  workers.reserve(std::max(0, numThreads - 1));
+  for (int i = 1; i < numThreads; ++i)
+    workers.emplace_back(&ThreadPoolExecutor::workerMain, this);
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+  {
+    // Any posted jobs that are still queued are run by the workers first.
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+
+  for (auto& worker : workers)
+    worker.join();
+}
+
+// The front one of the highest priority that is above the given one.
+ThreadPoolExecutor::Job* ThreadPoolExecutor::getNextJob(int abovePriority) {
+  for (int p = numPriorities - 1; p > abovePriority; --p) {
+    if (!jobs[p].empty())
+      return jobs[p].front();
+  }
+  return nullptr;
+}
+
+void ThreadPoolExecutor::updateHighestQueued() {
+  int highest = -1;
+  for (int p = 0; p < numPriorities; ++p) {
+    if (!jobs[p].empty())
+      highest = p;
+  }
+  highestQueued.store(highest, std::memory_order_relaxed);
+}
+
+void ThreadPoolExecutor::runOneTask(Job* job,
+                                    std::unique_lock<std::mutex>* lock) {
+  assert(lock->owns_lock());
+  assert(job->nextTask < job->numTasks);
+
+  const int taskIndex = job->nextTask++;
+
+  // Once all the tasks of the job are claimed, nobody else needs to see it.
+  if (job->nextTask == job->numTasks) {
+    auto& queue = jobs[static_cast<int>(job->priority)];
+    queue.erase(std::find(queue.begin(), queue.end(), job));
+    updateHighestQueued();
+  }
+
+  // This may be nested in a task of another job, e.g. via runWorkAbove().
+  ThreadPoolExecutor* const outerPool = runningPool;
+  const Priority outerRunning = runningPriority;
+  const Priority outerCurrent = currentPriority;
+  runningPool = this;
+  runningPriority = job->priority;
+  currentPriority = job->priority;
+
+  std::exception_ptr exception;
+  lock->unlock();
+  try {
+    RAWSPEED_TRACE_SCOPE("executor", "task");
+    (*job->task)(taskIndex);
+  } catch (...) {
+    exception = std::current_exception();
+  }
+  lock->lock();
+
+  runningPool = outerPool;
+  runningPriority = outerRunning;
+  currentPriority = outerCurrent;
+
+  if (exception && !job->firstException)
+    job->firstException = std::move(exception);
+
+  if (--job->unfinishedTasks == 0) {
+    if (job->detached)
+      delete job;
+    else
+      job->finished.notify_all();
+  }
+}
+
+void ThreadPoolExecutor::workerMain() {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (true) {
+    workAvailable.wait(lock,
+                       [this]() { return stopping || getNextJob() != nullptr; });
+
+    Job* job = getNextJob();
+    if (!job)
+      return;
+
+    runOneTask(job, &lock);
+  }
+}
+
+void ThreadPoolExecutor::run(int numTasks, const Task& task) {
+  if (numTasks <= 1 || workers.empty()) {
+    SerialExecutor().run(numTasks, task);
+    return;
+  }
+
+  Job job(&task, numTasks, getPriority());
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  jobs[static_cast<int>(job.priority)].push_back(&job);
+  updateHighestQueued();
+  workAvailable.notify_all();
+
+  // Instead of just waiting, help with our own job. This is what guarantees
+  // the forward progress of the nested jobs.
+  while (job.nextTask < job.numTasks)
+    runOneTask(&job, &lock);
+
+  {
+    // For the other threads to finish, i.e. the tail of the job.
+    RAWSPEED_TRACE_SCOPE("executor", "wait");
+    job.finished.wait(lock, [&job]() { return job.unfinishedTasks == 0; });
+  }
+
+  if (job.firstException)
+    std::rethrow_exception(job.firstException);
+}
+
+void ThreadPoolExecutor::post(std::function<void()> work) {
+  if (workers.empty()) {
+    Executor::post(std::move(work));
+    return;
+  }
+
+  auto* job = new Job(nullptr, 1, getPriority());
+  job->ownTask = [w = std::move(work)](int /*taskIndex*/) { w(); };
+  job->task = &job->ownTask;
+  job->detached = true;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  jobs[static_cast<int>(job->priority)].push_back(job);
+  updateHighestQueued();
+  workAvailable.notify_one();
+}
+
+// The tasks run here are of strictly higher priorities than the one that
+// yields, and so are the ones that they yield to in turn, so the threads
+// can not end up waiting for each other in a cycle.
+void ThreadPoolExecutor::runWorkAbove(Priority priority) {
+  RAWSPEED_TRACE_SCOPE("executor", "yield");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (Job* job = getNextJob(static_cast<int>(priority)))
+    runOneTask(job, &lock);
+}
+
+namespace {
+
+std::shared_ptr<Executor> createDefaultExecutor() {
+#ifdef HAVE_OPENMP
+  return std::make_shared<OpenMPExecutor>();
+#else
+  return std::make_shared<ThreadPoolExecutor>(
+      std::max(1, rawspeed_get_number_of_processor_cores()));
+#endif
+}
+
+const std::shared_ptr<Executor>& getDefaultExecutor() {
+  static const std::shared_ptr<Executor> executor = createDefaultExecutor();
+  return executor;
+}
+
+std::shared_ptr<Executor>& getCurrentExecutor() {
+  static std::shared_ptr<Executor> executor = getDefaultExecutor();
+  return executor;
+}
+
+// Of the innermost ExecutorScope of the thread.
+thread_local const std::shared_ptr<Executor>* scopedExecutor = nullptr;
+
+} // namespace
+
+std::shared_ptr<Executor> getExecutor() {
+  if (scopedExecutor)
+    return *scopedExecutor;
+  return std::atomic_load(&getCurrentExecutor());
+}
+
+void setExecutor(std::shared_ptr<Executor> executor) {
+  if (!executor)
+    executor = getDefaultExecutor();
+
+  std::atomic_store(&getCurrentExecutor(), std::move(executor));
+}
+
+ExecutorScope::ExecutorScope(std::shared_ptr<Executor> executor_)
+    : executor(std::move(executor_)), previous(scopedExecutor) {
+  if (executor)
+    scopedExecutor = &executor;
+}
+
+ExecutorScope::~ExecutorScope() { scopedExecutor = previous; }
+
+Priority getPriority() { return currentPriority; }
+
+PriorityScope::PriorityScope(Priority priority) : previous(currentPriority) {
+  currentPriority = priority;
+}
+
+PriorityScope::~PriorityScope() { currentPriority = previous; }
+
+void yieldToUrgentWork() {
+  ThreadPoolExecutor* const pool = runningPool;
+  if (pool && pool->hasWorkAbove(runningPriority))
+    pool->runWorkAbove(runningPriority);
+}
+
+void runTasks(const std::shared_ptr<Executor>& executor, int numTasks,
+              const Executor::Task& task) {
+  const Priority priority = getPriority();
+  executor->run(numTasks, [&executor, &task, priority](int taskIndex) {
+    const ExecutorScope scope(executor);
+    const PriorityScope priorityScope(priority);
+    task(taskIndex);
+  });
+}
+
+namespace {
+
+// Until calibrated, the startup of a thread pool task is some microseconds,
+// in which a thread goes through some tens of KiB.
+std::atomic<int64_t> minTaskWork(256 << 10);
+
+} // namespace
+
+int64_t getMinTaskWork() { return minTaskWork.load(std::memory_order_relaxed); }
+
+void setMinTaskWork(int64_t bytes) {
+  minTaskWork.store(std::max<int64_t>(0, bytes), std::memory_order_relaxed);
+}
+
+int64_t calibrateMinTaskWork(const std::shared_ptr<Executor>& executor) {
+  using Clock = std::chrono::steady_clock;
+  using Seconds = std::chrono::duration<double>;
+
+  // The time it takes to start empty tasks, and to wait for them.
+  const int numTasks = std::max(1, executor->getConcurrency());
+  constexpr int runs = 64;
+  const auto startTasks = Clock::now();
+  for (int i = 0; i < runs; i++)
+    executor->run(numTasks, [](int /*task*/) {});
+  const double overhead = Seconds(Clock::now() - startTasks).count() / runs;
+
+  // Larger than the caches, but not by much.
+  std::vector<unsigned char> buffer(8 << 20, 1);
+  constexpr int passes = 4;
+  unsigned sum = 0;
+  const auto startPasses = Clock::now();
+  for (int pass = 0; pass < passes; pass++) {
+    for (const auto b : buffer)
+      sum += b;
+    buffer[sum % buffer.size()] = static_cast<unsigned char>(sum);
+  }
+  const double bytesPerSecond =
+      passes * buffer.size() /
+      std::max(Seconds(Clock::now() - startPasses).count(), 1e-9);
+
+  // The decoders go through their bytes much slower than that, so the
+  // startup is a small part of their tasks even at a few times the bytes.
+  constexpr double factor = 4;
+  const auto work = static_cast<int64_t>(factor * overhead * bytesPerSecond);
+  setMinTaskWork(std::min<int64_t>(std::max<int64_t>(work, 4 << 10), 64 << 20));
+  return getMinTaskWork();
+}
+
+int getNumTasks(int maxTasks, int64_t work) {
+  const int64_t min = getMinTaskWork();
+  if (work < 0 || min <= 0 || maxTasks <= 1)
+    return maxTasks;
+  return static_cast<int>(std::max<int64_t>(
+      1, std::min<int64_t>(maxTasks, work / min)));
+}
+
+} // namespace rawspeed
@@ -0,0 +1,362 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "rawspeedconfig.h"
+#include <algorithm>          // for min
+#include <array>              // for array
+#include <atomic>             // for atomic, memory_order_relaxed
+#include <condition_variable> // for condition_variable
+#include <cstdint>            // for int64_t
+#include <deque>              // for deque
+#include <functional>         // for function
+#include <memory>             // for shared_ptr
+#include <mutex>              // for mutex
+#include <thread>             // for thread
+#include <vector>             // for vector
+
+namespace rawspeed {
+
+// Of the work that is submitted to the executors, e.g. Interactive for the
+// decode that the user waits for, and Batch for the ones in the background,
+// on the same executor. Only the ThreadPoolExecutor tells them apart, see
+// there; the others run all of the work as it comes.
+enum class Priority { Batch, Normal, Interactive };
+constexpr int numPriorities = 3;
+
+// All of the parallel work of the library is submitted to an Executor.
+// The host application can replace the executor with its own one
+// (e.g. backed by its existing thread pool) via setExecutor(), so that
+// decoding several files at once does not oversubscribe the machine.
+class Executor {
+public:
+  using Task = std::function<void(int taskIndex)>;
+
+  virtual ~Executor() = default;
+
+  // How many tasks can run at the same time. Only used to decide how finely
+  // the work gets split, so it does not need to be exact.
+  virtual int getConcurrency() const = 0;
+
+  // Runs task(0), ..., task(numTasks - 1), possibly concurrently, and only
+  // returns once all of them have finished. Must be safe to call from within
+  // a task that is already being run by this executor (nested parallelism).
+  // If some of the tasks throw, the first exception is rethrown,
+  // after all the tasks have finished.
+  virtual void run(int numTasks, const Task& task) = 0;
+
+  // Starts running work, and returns without waiting for it to finish,
+  // e.g. for a whole decode that the caller does not want to block on.
+  // The work should not throw, its exceptions are ignored.
+  // By default, it is run by a new detached thread.
+  virtual void post(std::function<void()> work);
+};
+
+// Runs all the tasks sequentially, in the calling thread.
+class SerialExecutor final : public Executor {
+public:
+  int getConcurrency() const override { return 1; }
+
+  void run(int numTasks, const Task& task) override;
+
+  // Just runs the work, in the calling thread.
+  void post(std::function<void()> work) override;
+};
+
+#ifdef HAVE_OPENMP
+// Runs the tasks in an OpenMP parallel region with
+// rawspeed_get_number_of_processor_cores() threads.
+class OpenMPExecutor final : public Executor {
+public:
+  int getConcurrency() const override;
+
+  void run(int numTasks, const Task& task) override;
+};
+#endif
+
+// A persistent pool of worker threads. The thread calling run() also
+// participates in running the tasks, so any nesting depth is deadlock-free.
+// The posted work is run by the workers, after the tasks queued before it,
+// or as by Executor::post() if there are no workers.
+//
+// The jobs are queued by the getPriority() of the thread that submits them,
+// and the workers take the tasks of the higher priorities first. A task
+// that is already running is not interrupted, but the long ones call
+// yieldToUrgentWork() between their slices, tiles or row bands, as
+// DynamicSchedule::getNext() does, and then run the queued tasks of the
+// higher priority before their own next one. So a decode of Interactive
+// priority waits for at most one slice of each of the Batch ones that
+// occupy the threads.
+class ThreadPoolExecutor final : public Executor {
+  struct Job;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  // By the priority.
+  std::array<std::deque<Job*>, numPriorities> jobs;
+  // The highest one of the non-empty queues, or -1.
+  std::atomic<int> highestQueued{-1};
+  bool stopping = false;
+
+  std::vector<std::thread> workers;
+
+  void workerMain();
+  Job* getNextJob(int abovePriority = -1);
+  void updateHighestQueued();
+  void runOneTask(Job* job, std::unique_lock<std::mutex>* lock);
+
+public:
+  // numThreads is the total concurrency, including the calling thread.
+  explicit ThreadPoolExecutor(int numThreads);
+
+  ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+  ThreadPoolExecutor(ThreadPoolExecutor&&) = delete;
+  ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+  ThreadPoolExecutor& operator=(ThreadPoolExecutor&&) = delete;
+
+  ~ThreadPoolExecutor() override;
+
+  int getConcurrency() const override { return 1 + int(workers.size()); }
+
+  void run(int numTasks, const Task& task) override;
+
+  void post(std::function<void()> work) override;
+
+  // See yieldToUrgentWork().
+  bool hasWorkAbove(Priority priority) const {
+    return highestQueued.load(std::memory_order_relaxed) >
+           static_cast<int>(priority);
+  }
+  void runWorkAbove(Priority priority);
+};
+
+// The executor that is currently used by the library: the one of the
+// innermost ExecutorScope of the calling thread, if there is one, or else
+// the global one. By default, that is an OpenMPExecutor if OpenMP is
+// available, or a ThreadPoolExecutor with
+// rawspeed_get_number_of_processor_cores() threads otherwise.
+std::shared_ptr<Executor> getExecutor();
+
+// Replaces the global executor used by the library. Passing nullptr restores
+// the default one. Decodes already in progress keep using the previous one.
+void setExecutor(std::shared_ptr<Executor> executor);
+
+// While it exists, getExecutor() returns the executor in the calling thread,
+// and in the tasks that are run via runTasks(), e.g. so that one decode can
+// use all of the cores, while the others run serially. A nullptr executor
+// keeps the current one. The scope keeps the executor alive.
+class ExecutorScope final {
+  const std::shared_ptr<Executor> executor;
+  const std::shared_ptr<Executor>* previous;
+
+public:
+  explicit ExecutorScope(std::shared_ptr<Executor> executor_);
+  ~ExecutorScope();
+
+  ExecutorScope(const ExecutorScope&) = delete;
+  ExecutorScope& operator=(const ExecutorScope&) = delete;
+};
+
+// The priority of the work that the calling thread submits, and of the
+// parallel work nested in it, whichever thread runs that: the one of the
+// innermost PriorityScope, or of the task that the thread runs, or else
+// Normal.
+Priority getPriority();
+
+// While it exists, the calling thread submits its work with that priority,
+// e.g. around a decode, see RawDecoder::priority.
+class PriorityScope final {
+  const Priority previous;
+
+public:
+  explicit PriorityScope(Priority priority);
+  ~PriorityScope();
+
+  PriorityScope(const PriorityScope&) = delete;
+  PriorityScope& operator=(const PriorityScope&) = delete;
+};
+
+// If the calling thread runs a task of a ThreadPoolExecutor, and there are
+// tasks of a higher priority queued there, runs those first. Otherwise, it
+// is just a check of a thread-local and of an atomic.
+void yieldToUrgentWork();
+
+// executor->run(numTasks, task), but with each of the tasks in an
+// ExecutorScope of the executor, so that the parallel work nested within them
+// runs on it too, whichever thread they are run by.
+void runTasks(const std::shared_ptr<Executor>& executor, int numTasks,
+              const Executor::Task& task);
+
+// The cost model of the parallel regions. The work of a region is in bytes,
+// of its input or of its output, whichever it goes through more of, and it
+// is split into at most work / getMinTaskWork() tasks. Below that, starting
+// the tasks, and sharing the cache lines at their boundaries, costs more
+// than running them in parallel saves, e.g. for the small previews.
+int64_t getMinTaskWork();
+
+// 0 splits all of the regions as finely as the executor allows.
+void setMinTaskWork(int64_t bytes);
+
+// Measures how long starting the tasks on the executor takes, and how fast
+// one thread goes through memory, and sets getMinTaskWork() to a few times
+// what it goes through in that time, e.g. in rsbench, or when the host
+// starts. Returns that.
+int64_t calibrateMinTaskWork(const std::shared_ptr<Executor>& executor);
+
+// The number of tasks for a region of work bytes, that can be split into at
+// most maxTasks ones. A negative work is one that is not known, which gets
+// all of maxTasks.
+int getNumTasks(int maxTasks, int64_t work);
+
+// Splits [begin, end) into at most getConcurrency() contiguous chunks of
+// roughly equal size, which is what '#pragma omp for schedule(static)' would
+// do, and calls body(chunkBegin, chunkEnd) for each of them. Useful when
+// there is per-thread state to be set up once per chunk.
+// All of the helpers optionally take the work of the whole region, for
+// getNumTasks().
+template <typename Body>
+inline void parallelForRange(int begin, int end, int64_t work,
+                             const Body& body) {
+  if (begin >= end)
+    return;
+
+  const int numIterations = end - begin;
+  const auto executor = getExecutor();
+  const int numTasks = getNumTasks(
+      std::min(numIterations, executor->getConcurrency()), work);
+
+  if (numTasks <= 1) {
+    body(begin, end);
+    return;
+  }
+
+  runTasks(executor, numTasks,
+           [begin, numIterations, numTasks, &body](int task) {
+             const int taskBegin =
+                 int(int64_t(numIterations) * task / numTasks);
+             const int taskEnd =
+                 int(int64_t(numIterations) * (task + 1) / numTasks);
+             body(begin + taskBegin, begin + taskEnd);
+           });
+}
+
+template <typename Body>
+inline void parallelForRange(int begin, int end, const Body& body) {
+  parallelForRange(begin, end, -1, body);
+}
+
+// Calls body(i) for each i in [begin, end), split as in parallelForRange().
+template <typename Body>
+inline void parallelFor(int begin, int end, int64_t work, const Body& body) {
+  parallelForRange(begin, end, work, [&body](int chunkBegin, int chunkEnd) {
+    for (int i = chunkBegin; i < chunkEnd; ++i)
+      body(i);
+  });
+}
+
+template <typename Body>
+inline void parallelFor(int begin, int end, const Body& body) {
+  parallelFor(begin, end, -1, body);
+}
+
+// Hands out the iterations of [begin, end) one at a time, to whichever task
+// asks first, which is what '#pragma omp for schedule(dynamic, 1)' would do.
+class DynamicSchedule final {
+  std::atomic<int> next;
+  const int end;
+
+public:
+  DynamicSchedule(int begin, int end_) : next(begin), end(end_) {}
+
+  // Returns false once all the iterations have been handed out. Each
+  // iteration first gives way to the work of a higher priority, see
+  // yieldToUrgentWork().
+  bool getNext(int* i) {
+    yieldToUrgentWork();
+    *i = next.fetch_add(1, std::memory_order_relaxed);
+    return *i < end;
+  }
+};
+
+// Calls body(&schedule) from each of at most getConcurrency() tasks, with
+// all of them sharing one DynamicSchedule over [begin, end). Unlike with
+// parallelForEach(), each task can keep its own state between iterations.
+template <typename Body>
+inline void parallelForDynamic(int begin, int end, int64_t work,
+                               const Body& body) {
+  if (begin >= end)
+    return;
+
+  DynamicSchedule schedule(begin, end);
+
+  const auto executor = getExecutor();
+  const int numTasks =
+      getNumTasks(std::min(end - begin, executor->getConcurrency()), work);
+
+  if (numTasks <= 1) {
+    body(&schedule);
+    return;
+  }
+
+  runTasks(executor, numTasks,
+           [&schedule, &body](int /*task*/) { body(&schedule); });
+}
+
+template <typename Body>
+inline void parallelForDynamic(int begin, int end, const Body& body) {
+  parallelForDynamic(begin, end, -1, body);
+}
+
+// Calls body(i) for each i in [begin, end), with each iteration being a
+// separate task, which is what '#pragma omp for schedule(dynamic, 1)' would
+// do. Only useful when there are few iterations of uneven cost. If the work
+// is too little for that many tasks, fewer ones share the iterations, as in
+// parallelForDynamic().
+template <typename Body>
+inline void parallelForEach(int begin, int end, int64_t work,
+                            const Body& body) {
+  if (begin >= end)
+    return;
+
+  if (end - begin == 1) {
+    body(begin);
+    return;
+  }
+
+  const auto executor = getExecutor();
+  if (getNumTasks(end - begin, work) < end - begin) {
+    parallelForDynamic(begin, end, work, [&body](DynamicSchedule* schedule) {
+      for (int i; schedule->getNext(&i);)
+        body(i);
+    });
+    return;
+  }
+
+  runTasks(executor, end - begin,
+           [begin, &body](int task) { body(begin + task); });
+}
+
+template <typename Body>
+inline void parallelForEach(int begin, int end, const Body& body) {
+  parallelForEach(begin, end, -1, body);
+}
+
+} // namespace rawspeed
@@ -0,0 +1,117 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/FujiRotation.h"
+#include "common/Array2DRef.h"            // for Array2DRef
+#include "common/Executor.h"              // for parallelFor
+#include "common/RawImage.h"              // for RawImage, RawImageData
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include <algorithm>                      // for min
+#include <cassert>                        // for assert
+
+namespace rawspeed {
+
+static bool isInside(const iPoint2D& pos, const iPoint2D& size) {
+  return pos.x >= 0 && pos.y >= 0 && pos.x < size.x && pos.y < size.y;
+}
+
+// Small enough for the source pixels of a tile to stay in the cache: they are
+// on the diagonals through it, twice as many rows and half as many columns.
+static constexpr int tileSize = 64;
+
+FujiRotation::FujiRotation(const iPoint2D& size_, bool altLayout_)
+    : size(size_), altLayout(altLayout_) {
+  // Calculate the 45 degree rotated size;
+  uint32 rotatedsize;
+  if (altLayout) {
+    rotatedsize = size.y + size.x / 2;
+    rotationPos = size.x / 2 - 1;
+  } else {
+    rotatedsize = size.x + size.y / 2;
+    rotationPos = size.x - 1;
+  }
+  rotatedSize = iPoint2D(rotatedsize, rotatedsize - 1);
+
+  // Both of the coordinates only ever grow, or shrink, with each of x and y,
+  // so the corners are as far as any of the pixels go.
+  if (!size.hasPositiveArea())
+    ThrowRDE("Trying to write out of bounds");
+  for (const iPoint2D& corner :
+       {iPoint2D(0, 0), iPoint2D(size.x - 1, 0), iPoint2D(0, size.y - 1),
+        iPoint2D(size.x - 1, size.y - 1)}) {
+    if (!isInside(getRotatedPos(corner), rotatedSize))
+      ThrowRDE("Trying to write out of bounds");
+  }
+}
+
+iPoint2D FujiRotation::getRotatedPos(const iPoint2D& pos) const {
+  const int x = pos.x;
+  const int y = pos.y;
+  if (altLayout) { // Swapped x and y
+    return {((x + 1) >> 1) + y, rotatedSize.x - (size.y + 1 - y + (x >> 1))};
+  }
+  return {((y + 1) >> 1) + x, size.x - 1 - x + (y >> 1)};
+}
+
+iPoint2D FujiRotation::getUnrotatedPos(const iPoint2D& pos) const {
+  const int w = pos.x;
+  const int h = pos.y;
+  // In both of the layouts, one of the coordinates is the sum of the halves
+  // of the other one, rounded down and up.
+  if (altLayout) {
+    const int x = w - h + rotatedSize.x - size.y - 1;
+    return {x, w - ((x + 1) >> 1)};
+  }
+  const int y = w + h - (size.x - 1);
+  return {w - ((y + 1) >> 1), y};
+}
+
+void FujiRotation::rotate(const RawImage& src, const iPoint2D& offset,
+                          const RawImage& dst) const {
+  assert(dst->dim == rotatedSize);
+  assert(src->getDataType() == TYPE_USHORT16 && src->getCpp() == 1);
+  assert(dst->getDataType() == TYPE_USHORT16 && dst->getCpp() == 1);
+
+  if (offset.x < 0 || offset.y < 0 || !(offset + size).isThisInside(src->dim))
+    ThrowRDE("Trying to read out of bounds");
+
+  const Array2DRef<const ushort16> in(
+      reinterpret_cast<const ushort16*>(src->getData(offset.x, offset.y)),
+      size.x, size.y, src->pitch / sizeof(ushort16));
+  const Array2DRef<ushort16> out(reinterpret_cast<ushort16*>(dst->getData()),
+                                 rotatedSize.x, rotatedSize.y,
+                                 dst->pitch / sizeof(ushort16));
+
+  const int bands = (rotatedSize.y + tileSize - 1) / tileSize;
+  parallelFor(0, bands, [&](int band) {
+    const int rowEnd = std::min((band + 1) * tileSize, rotatedSize.y);
+    for (int col = 0; col < rotatedSize.x; col += tileSize) {
+      const int colEnd = std::min(col + tileSize, rotatedSize.x);
+      for (int h = band * tileSize; h < rowEnd; h++) {
+        for (int w = col; w < colEnd; w++) {
+          const iPoint2D pos = getUnrotatedPos({w, h});
+          out(w, h) = isInside(pos, size) ? in(pos.x, pos.y) : 0;
+        }
+      }
+    }
+  });
+}
+
+} // namespace rawspeed
@@ -0,0 +1,68 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uint32
+#include "common/Point.h"  // for iPoint2D
+
+namespace rawspeed {
+
+class RawImage;
+
+// The 45 degree rotation of the images of the Fuji SuperCCD sensors, from the
+// layout of the sensor into an upright image. The pixel (x, y) of the
+// unrotated image of the size (W, H) goes to
+//   (x + (y + 1) / 2, W - 1 - x + y / 2),
+// or in the alternate layout, with the x and y swapped, to
+//   (y + (x + 1) / 2, W / 2 - 1 + y - x / 2),
+// all of the divisions rounding down. The rest of the rotated image is 0.
+class FujiRotation final {
+public:
+  FujiRotation() = default;
+
+  // Of the unrotated image of the given size.
+  // Throws if it would not fit into the rotated one.
+  FujiRotation(const iPoint2D& size, bool altLayout);
+
+  iPoint2D size;
+  bool altLayout = false;
+
+  iPoint2D rotatedSize;
+
+  // As ImageMetaData::fujiRotationPos.
+  uint32 rotationPos = 0;
+
+  // Where the pixel of the unrotated image is in the rotated one.
+  iPoint2D getRotatedPos(const iPoint2D& pos) const;
+
+  // Which pixel of the unrotated image is at the position in the rotated one.
+  // Unless none is, then it is outside of the size.
+  iPoint2D getUnrotatedPos(const iPoint2D& pos) const;
+
+  // Rotates the area of the size, at the offset in src, into dst, which must
+  // be of the rotatedSize. In parallel, and tile by tile, each of the pixels
+  // of dst being read from wherever it comes from, so that the writes stay
+  // sequential.
+  void rotate(const RawImage& src, const iPoint2D& offset,
+              const RawImage& dst) const;
+};
+
+} // namespace rawspeed
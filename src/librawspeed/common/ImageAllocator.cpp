@@ -0,0 +1,325 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/ImageAllocator.h"
+#include "AddressSanitizer.h" // for ASan
+#include "common/Common.h"    // for roundUp
+#include "common/Memory.h"    // for alignedFree, alignedMalloc, hugePageSize
+#include <algorithm>          // for find_if, min
+#include <atomic>             // for atomic_load, atomic_store, memory...
+#include <cassert>            // for assert
+#include <cstdint>            // for uintptr_t, SIZE_MAX
+#include <iterator>           // for next
+#include <memory>             // for shared_ptr, make_shared
+#include <mutex>              // for lock_guard
+#include <utility>            // for move, pair
+
+#ifdef __linux__
+#include <linux/mempolicy.h> // for MPOL_F_MEMS_ALLOWED, MPOL_INTERLEAVE
+#include <sys/mman.h>        // for mmap, munmap, MAP_FAILED, MAP_HUGETLB
+#include <sys/syscall.h>     // for SYS_get_mempolicy, SYS_mbind
+#include <unistd.h>          // for syscall, sysconf, _SC_PAGESIZE
+#endif
+
+namespace rawspeed {
+
+uchar8* DefaultImageAllocator::allocate(size_t size) {
+  return alignedMalloc<uchar8, alignment>(size);
+}
+
+void DefaultImageAllocator::deallocate(uchar8* ptr,
+                                       size_t /*size*/) noexcept {
+  alignedFree(ptr);
+}
+
+HugePageImageAllocator::HugePageImageAllocator(bool useHugeTLB_)
+    : useHugeTLB(useHugeTLB_) {}
+
+#ifdef __linux__
+uchar8* HugePageImageAllocator::allocate(size_t size) {
+  if (size < hugePageSize)
+    return alignedMalloc<uchar8, alignment>(size);
+
+  if (size > SIZE_MAX - 2 * hugePageSize)
+    return nullptr;
+  const size_t mapped = roundUp(size, hugePageSize);
+
+#ifdef MAP_HUGETLB
+  if (useHugeTLB) {
+    void* ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+      return static_cast<uchar8*>(ptr);
+  }
+#endif
+
+  // Only the whole aligned huge pages can be transparent huge pages, so map
+  // one more, and give back the unaligned ends.
+  void* ptr = mmap(nullptr, mapped + hugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED)
+    return nullptr;
+
+  auto* const begin = static_cast<uchar8*>(ptr);
+  auto* const aligned = reinterpret_cast<uchar8*>(
+      roundUp(reinterpret_cast<uintptr_t>(begin), hugePageSize));
+  if (aligned != begin)
+    munmap(begin, aligned - begin);
+  if (const size_t tail = hugePageSize - (aligned - begin))
+    munmap(aligned + mapped, tail);
+
+  adviseHugePages(aligned, mapped);
+  return aligned;
+}
+
+void HugePageImageAllocator::deallocate(uchar8* ptr, size_t size) noexcept {
+  if (size < hugePageSize) {
+    alignedFree(ptr);
+    return;
+  }
+
+  if (ptr)
+    munmap(ptr, roundUp(size, hugePageSize));
+}
+#else
+uchar8* HugePageImageAllocator::allocate(size_t size) {
+  return alignedMalloc<uchar8, alignment>(size);
+}
+
+void HugePageImageAllocator::deallocate(uchar8* ptr,
+                                        size_t /*size*/) noexcept {
+  alignedFree(ptr);
+}
+#endif
+
+NumaInterleaveImageAllocator::NumaInterleaveImageAllocator(
+    std::shared_ptr<ImageAllocator> upstream_)
+    : upstream(std::move(upstream_)) {
+  assert(upstream);
+
+#ifdef __linux__
+  // Enough for any kernel, the ones above nr_node_ids are left cleared.
+  std::vector<unsigned long> mask(1024 / (8 * sizeof(unsigned long)));
+  const unsigned long maxNode = 8 * sizeof(unsigned long) * mask.size() + 1;
+  if (syscall(SYS_get_mempolicy, nullptr, mask.data(), maxNode, nullptr,
+              MPOL_F_MEMS_ALLOWED) != 0)
+    return;
+
+  int nodes = 0;
+  for (const unsigned long m : mask)
+    nodes += __builtin_popcountl(m);
+  if (nodes < 2)
+    return;
+
+  nodeMask = std::move(mask);
+  numNodes = nodes;
+#endif
+}
+
+uchar8* NumaInterleaveImageAllocator::allocate(size_t size) {
+  uchar8* const ptr = upstream->allocate(size);
+
+#ifdef __linux__
+  if (!ptr || !numNodes || size < hugePageSize)
+    return ptr;
+
+  // Only the whole pages, the ends may be shared with the other allocations.
+  const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const auto begin = roundUp(reinterpret_cast<uintptr_t>(ptr), page);
+  const auto end = roundDown(reinterpret_cast<uintptr_t>(ptr) + size, page);
+  if (begin >= end)
+    return ptr;
+
+  // May fail, e.g. under a seccomp filter, which is fine, it is just slower.
+  const unsigned long maxNode = 8 * sizeof(unsigned long) * nodeMask.size() + 1;
+  (void)syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE,
+                nodeMask.data(), maxNode, 0U);
+#endif
+
+  return ptr;
+}
+
+void NumaInterleaveImageAllocator::deallocate(uchar8* ptr,
+                                              size_t size) noexcept {
+  upstream->deallocate(ptr, size);
+}
+
+PooledImageAllocator::PooledImageAllocator(
+    size_t maxCachedBytes_, std::shared_ptr<ImageAllocator> upstream_)
+    : maxCachedBytes(maxCachedBytes_), upstream(std::move(upstream_)) {
+  assert(upstream);
+}
+
+// Not while holding the lock, freeing that much memory can take a while.
+void PooledImageAllocator::freeAll(
+    const std::vector<std::pair<uchar8*, size_t>>& entries) {
+  for (const auto& e : entries) {
+    // The allocator must not see it as poisoned whenever it reuses it.
+    ASan::UnPoisonMemoryRegion(e.first, e.second);
+    upstream->deallocate(e.first, e.second);
+  }
+}
+
+PooledImageAllocator::~PooledImageAllocator() { trim(); }
+
+uchar8* PooledImageAllocator::allocate(size_t size) {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    // The most recently deallocated one is the most likely to be still
+    // in the caches.
+    const auto it = std::find_if(cache.rbegin(), cache.rend(),
+                                 [size](const std::pair<uchar8*, size_t>& e) {
+                                   return e.second == size;
+                                 });
+    if (it != cache.rend()) {
+      uchar8* ptr = it->first;
+      cache.erase(std::next(it).base());
+      cachedBytes -= size;
+
+      ASan::UnPoisonMemoryRegion(ptr, size);
+      return ptr;
+    }
+  }
+
+  return upstream->allocate(size);
+}
+
+void PooledImageAllocator::deallocate(uchar8* ptr, size_t size) noexcept {
+  if (!ptr)
+    return;
+
+  if (size > maxCachedBytes) {
+    upstream->deallocate(ptr, size);
+    return;
+  }
+
+  std::vector<std::pair<uchar8*, size_t>> evicted;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto first = cache.begin();
+    for (; cachedBytes + size > maxCachedBytes; ++first) {
+      assert(first != cache.end());
+      cachedBytes -= first->second;
+    }
+    evicted.assign(cache.begin(), first);
+    cache.erase(cache.begin(), first);
+
+    ASan::PoisonMemoryRegion(ptr, size);
+    cache.emplace_back(ptr, size);
+    cachedBytes += size;
+  }
+
+  freeAll(evicted);
+}
+
+size_t PooledImageAllocator::getCachedBytes() {
+  std::lock_guard<std::mutex> guard(mutex);
+  return cachedBytes;
+}
+
+void PooledImageAllocator::trim() {
+  std::vector<std::pair<uchar8*, size_t>> evicted;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    evicted.swap(cache);
+    cachedBytes = 0;
+  }
+
+  freeAll(evicted);
+}
+
+BudgetImageAllocator::BudgetImageAllocator(
+    size_t maxBytes_, std::shared_ptr<ImageAllocator> upstream_)
+    : maxBytes(maxBytes_), upstream(std::move(upstream_)) {
+  assert(upstream);
+}
+
+uchar8* BudgetImageAllocator::allocate(size_t size) {
+  size_t used = usedBytes.load(std::memory_order_relaxed);
+  do {
+    if (maxBytes && size > maxBytes - std::min(used, maxBytes))
+      return nullptr;
+  } while (!usedBytes.compare_exchange_weak(used, used + size,
+                                            std::memory_order_relaxed));
+
+  uchar8* const ptr = upstream->allocate(size);
+  if (!ptr) {
+    usedBytes.fetch_sub(size, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  const size_t now = used + size;
+  size_t peak = peakBytes.load(std::memory_order_relaxed);
+  while (now > peak && !peakBytes.compare_exchange_weak(
+                           peak, now, std::memory_order_relaxed)) {
+  }
+  numAllocations.fetch_add(1, std::memory_order_relaxed);
+
+  return ptr;
+}
+
+void BudgetImageAllocator::deallocate(uchar8* ptr, size_t size) noexcept {
+  if (!ptr)
+    return;
+
+  upstream->deallocate(ptr, size);
+  usedBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+size_t BudgetImageAllocator::getUsedBytes() const {
+  return usedBytes.load(std::memory_order_relaxed);
+}
+
+size_t BudgetImageAllocator::getPeakBytes() const {
+  return peakBytes.load(std::memory_order_relaxed);
+}
+
+void BudgetImageAllocator::resetPeak() {
+  peakBytes.store(getUsedBytes(), std::memory_order_relaxed);
+}
+
+size_t BudgetImageAllocator::getNumAllocations() const {
+  return numAllocations.load(std::memory_order_relaxed);
+}
+
+namespace {
+
+std::shared_ptr<ImageAllocator>& getCurrentImageAllocator() {
+  static std::shared_ptr<ImageAllocator> allocator =
+      std::make_shared<DefaultImageAllocator>();
+  return allocator;
+}
+
+} // namespace
+
+std::shared_ptr<ImageAllocator> getImageAllocator() {
+  return std::atomic_load(&getCurrentImageAllocator());
+}
+
+void setImageAllocator(std::shared_ptr<ImageAllocator> allocator) {
+  if (!allocator)
+    allocator = std::make_shared<DefaultImageAllocator>();
+
+  std::atomic_store(&getCurrentImageAllocator(), std::move(allocator));
+}
+
+} // namespace rawspeed
@@ -0,0 +1,186 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uchar8
+#include <atomic>          // for atomic
+#include <cstddef>         // for size_t
+#include <memory>          // for shared_ptr, make_shared
+#include <mutex>           // for mutex
+#include <utility>         // for pair
+#include <vector>          // for vector
+
+namespace rawspeed {
+
+// The pixels of all the images come from an ImageAllocator. The host
+// application can replace it via setImageAllocator(), e.g. with a
+// PooledImageAllocator so that a batch of decodes of the same camera does
+// not have to fault in a fresh allocation of tens of megabytes each time.
+class ImageAllocator {
+public:
+  // Of all the allocations, and so of each row of the images.
+  static constexpr size_t alignment = 16;
+
+  virtual ~ImageAllocator() = default;
+
+  // Returns size bytes, a multiple of the alignment, or nullptr.
+  // The contents are unspecified.
+  virtual uchar8* allocate(size_t size) = 0;
+
+  // Takes back what allocate(size) returned.
+  virtual void deallocate(uchar8* ptr, size_t size) noexcept = 0;
+};
+
+// Just alignedMalloc() and alignedFree().
+class DefaultImageAllocator final : public ImageAllocator {
+public:
+  uchar8* allocate(size_t size) override;
+
+  void deallocate(uchar8* ptr, size_t size) noexcept override;
+};
+
+// Maps the large allocations, of at least hugePageSize, directly, aligned to
+// and in the whole huge pages. With useHugeTLB, they are explicit huge pages
+// (MAP_HUGETLB), which need to be reserved by the system administrator, and
+// if there are not enough of them, or otherwise, transparent huge pages.
+// The smaller allocations are as with the DefaultImageAllocator.
+// Only does anything on Linux.
+class HugePageImageAllocator final : public ImageAllocator {
+  const bool useHugeTLB;
+
+public:
+  explicit HugePageImageAllocator(bool useHugeTLB = false);
+
+  uchar8* allocate(size_t size) override;
+
+  void deallocate(uchar8* ptr, size_t size) noexcept override;
+};
+
+// Interleaves the pages of the large allocations, of at least hugePageSize,
+// across all the NUMA nodes that the process may use (mbind(MPOL_INTERLEAVE)),
+// so that the threads decoding the rows of an image share the bandwidth of
+// all of the nodes, instead of all of them reaching into the node of the
+// thread that happened to touch the memory first. The memory itself comes
+// from the upstream allocator, and only the pages of it that are not yet
+// touched get placed so; put it below a PooledImageAllocator, not above.
+// Only does anything on Linux, with more than one node.
+class NumaInterleaveImageAllocator final : public ImageAllocator {
+  const std::shared_ptr<ImageAllocator> upstream;
+  // Of the nodes, as for mbind(2).
+  std::vector<unsigned long> nodeMask;
+  int numNodes = 0;
+
+public:
+  explicit NumaInterleaveImageAllocator(
+      std::shared_ptr<ImageAllocator> upstream =
+          std::make_shared<HugePageImageAllocator>());
+
+  uchar8* allocate(size_t size) override;
+
+  void deallocate(uchar8* ptr, size_t size) noexcept override;
+
+  // Across how many nodes the pages are interleaved, or 0 if they are not.
+  int getNumNodes() const { return numNodes; }
+};
+
+// Keeps up to maxCachedBytes of the deallocated memory, and hands it out
+// again for the allocations of exactly the same size, which
+// is what the images of the same dimensions and format need. When the cache
+// is full, the least recently deallocated memory is freed first.
+// The memory itself comes from the upstream allocator.
+// Under ASan, the cached memory is poisoned.
+class PooledImageAllocator final : public ImageAllocator {
+  std::mutex mutex;
+  // In the order they were deallocated.
+  std::vector<std::pair<uchar8*, size_t>> cache;
+  size_t cachedBytes = 0;
+  const size_t maxCachedBytes;
+  const std::shared_ptr<ImageAllocator> upstream;
+
+  void freeAll(const std::vector<std::pair<uchar8*, size_t>>& entries);
+
+public:
+  explicit PooledImageAllocator(
+      size_t maxCachedBytes,
+      std::shared_ptr<ImageAllocator> upstream =
+          std::make_shared<DefaultImageAllocator>());
+
+  PooledImageAllocator(const PooledImageAllocator&) = delete;
+  PooledImageAllocator(PooledImageAllocator&&) = delete;
+  PooledImageAllocator& operator=(const PooledImageAllocator&) = delete;
+  PooledImageAllocator& operator=(PooledImageAllocator&&) = delete;
+
+  ~PooledImageAllocator() override;
+
+  uchar8* allocate(size_t size) override;
+
+  void deallocate(uchar8* ptr, size_t size) noexcept override;
+
+  // How much memory is kept for reuse now.
+  size_t getCachedBytes();
+
+  // Frees all the cached memory.
+  void trim();
+};
+
+// Keeps the total size of the allocations that are live at the same time,
+// e.g. of all the concurrent decodes, within maxBytes: the ones that would
+// exceed it fail, as if the memory was not there, and so do the decodes
+// that make them. Also tracks the peak of that total, which is what the
+// budget can be sized from. A maxBytes of 0 is no limit.
+// The memory itself comes from the upstream allocator.
+class BudgetImageAllocator final : public ImageAllocator {
+  const size_t maxBytes;
+  const std::shared_ptr<ImageAllocator> upstream;
+  std::atomic<size_t> usedBytes{0};
+  std::atomic<size_t> peakBytes{0};
+  std::atomic<size_t> numAllocations{0};
+
+public:
+  explicit BudgetImageAllocator(
+      size_t maxBytes, std::shared_ptr<ImageAllocator> upstream =
+                           std::make_shared<DefaultImageAllocator>());
+
+  uchar8* allocate(size_t size) override;
+
+  void deallocate(uchar8* ptr, size_t size) noexcept override;
+
+  // Of the live allocations now.
+  size_t getUsedBytes() const;
+
+  // The most there were since the construction, or the last resetPeak().
+  size_t getPeakBytes() const;
+  void resetPeak();
+
+  // Of the ones that succeeded, since the construction.
+  size_t getNumAllocations() const;
+};
+
+// The allocator that is currently used by the library, by default a
+// DefaultImageAllocator.
+std::shared_ptr<ImageAllocator> getImageAllocator();
+
+// Replaces the allocator used for the new images. Passing nullptr restores
+// the default one. Each image gives its memory back to the allocator that it
+// was allocated from.
+void setImageAllocator(std::shared_ptr<ImageAllocator> allocator);
+
+} // namespace rawspeed
@@ -0,0 +1,55 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/InternedString.h"
+#include <mutex>         // for mutex, lock_guard
+#include <string>        // for string
+#include <unordered_set> // for unordered_set
+
+namespace rawspeed {
+
+namespace {
+
+// The elements of an unordered_set stay where they are as it grows. Never
+// destroyed, so that the strings outlive anything that is destroyed at exit.
+struct Pool final {
+  std::mutex mutex;
+  std::unordered_set<std::string> strings;
+  const std::string* const empty = &*strings.emplace().first;
+};
+
+Pool& getPool() {
+  static auto* pool = new Pool();
+  return *pool;
+}
+
+} // namespace
+
+InternedString::InternedString() : str(getPool().empty) {}
+
+const std::string* InternedString::intern(const std::string& s) {
+  Pool& pool = getPool();
+  if (s.empty())
+    return pool.empty;
+  std::lock_guard<std::mutex> guard(pool.mutex);
+  return &*pool.strings.emplace(s).first;
+}
+
+} // namespace rawspeed
@@ -0,0 +1,77 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <cstddef> // for size_t
+#include <string>  // for string
+
+namespace rawspeed {
+
+// A string of the process-wide pool, which is never freed, e.g. the make and
+// the model of the cameras. Copying one is copying a pointer, and the equal
+// strings are the same one, so that comparing them is comparing pointers.
+// Constructing one from a std::string looks it up in the pool, under a lock,
+// and only allocates the first time.
+class InternedString final {
+  const std::string* str;
+
+  static const std::string* intern(const std::string& s);
+
+public:
+  InternedString();
+  InternedString(const std::string& s) : str(intern(s)) {} // NOLINT
+  InternedString(const char* s) : InternedString(std::string(s)) {} // NOLINT
+
+  const std::string& get() const { return *str; }
+  operator const std::string&() const { return *str; } // NOLINT
+
+  const char* c_str() const { return str->c_str(); }
+  bool empty() const { return str->empty(); }
+  size_t size() const { return str->size(); }
+
+  friend bool operator==(const InternedString& a, const InternedString& b) {
+    return a.str == b.str;
+  }
+  friend bool operator!=(const InternedString& a, const InternedString& b) {
+    return !(a == b);
+  }
+};
+
+inline bool operator==(const InternedString& a, const std::string& b) {
+  return a.get() == b;
+}
+inline bool operator==(const std::string& a, const InternedString& b) {
+  return a == b.get();
+}
+inline bool operator==(const InternedString& a, const char* b) {
+  return a.get() == b;
+}
+inline bool operator!=(const InternedString& a, const std::string& b) {
+  return !(a == b);
+}
+inline bool operator!=(const std::string& a, const InternedString& b) {
+  return !(a == b);
+}
+inline bool operator!=(const InternedString& a, const char* b) {
+  return !(a == b);
+}
+
+} // namespace rawspeed
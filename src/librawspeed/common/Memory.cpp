@@ -22,12 +22,23 @@
 
 #include "common/Memory.h"
 
-#ifndef NDEBUG
-#include "common/Common.h" // for isPowerOfTwo, isAligned
+#include "common/Common.h" // for roundUp, roundDown, isPowerOfTwo, isAligned
+
+#include <algorithm> // for min
+#include <atomic>    // for atomic, memory_order_relaxed
+#include <cassert>   // for assert
+#include <cstddef>   // for size_t, uintptr_t
+#include <cstdint>   // for uintptr_t
+#include <cstring>   // for memcpy, memset
+
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for _mm_stream_si128, _mm_loadu_si128, _mm_sfence
 #endif
 
-#include <cassert> // for assert
-#include <cstddef> // for size_t, uintptr_t
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> // for madvise, MADV_HUGEPAGE, MADV_WILLNEED
+#include <unistd.h>   // for sysconf, _SC_PAGESIZE, _SC_LEVEL3_CACHE_SIZE
+#endif
 
 #if defined(HAVE_MM_MALLOC)
 // for _mm_malloc, _mm_free
@@ -104,4 +115,150 @@ void alignedFreeConstPtr(const void* ptr) {
 #endif
 }
 
+void adviseHugePages(void* ptr, size_t size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  const auto begin = roundUp(reinterpret_cast<uintptr_t>(ptr), hugePageSize);
+  const auto end =
+      roundDown(reinterpret_cast<uintptr_t>(ptr) + size, hugePageSize);
+  if (begin >= end)
+    return;
+
+  // May fail if THP are disabled, which is fine.
+  (void)madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+#endif
+}
+
+void adviseWillNeed(const void* ptr, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+  const auto pageSize = sysconf(_SC_PAGESIZE);
+  const auto begin = roundDown(reinterpret_cast<uintptr_t>(ptr), pageSize);
+  const auto end = roundUp(reinterpret_cast<uintptr_t>(ptr) + size, pageSize);
+  if (begin >= end)
+    return;
+
+  (void)madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#endif
+}
+
+void adviseDontNeed(const void* ptr, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+  // Only the whole pages, the partial ones at the ends may still be in use.
+  const auto pageSize = sysconf(_SC_PAGESIZE);
+  const auto begin = roundUp(reinterpret_cast<uintptr_t>(ptr), pageSize);
+  const auto end = roundDown(reinterpret_cast<uintptr_t>(ptr) + size, pageSize);
+  if (begin >= end)
+    return;
+
+  (void)madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+#endif
+}
+
+namespace {
+
+std::atomic<bool> hugePagesForBuffers{false};
+
+std::atomic<NonTemporalStores> nonTemporalStores{NonTemporalStores::Auto};
+
+} // namespace
+
+void setHugePagesForBuffers(bool enable) {
+  hugePagesForBuffers.store(enable, std::memory_order_relaxed);
+}
+
+bool getHugePagesForBuffers() {
+  return hugePagesForBuffers.load(std::memory_order_relaxed);
+}
+
+size_t getLastLevelCacheSize() {
+  static const size_t size = []() -> size_t {
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+    for (int level : {_SC_LEVEL3_CACHE_SIZE, _SC_LEVEL2_CACHE_SIZE}) {
+      const long bytes = sysconf(level);
+      if (bytes > 0)
+        return bytes;
+    }
+#endif
+    return 8UL << 20UL;
+  }();
+  return size;
+}
+
+bool useNonTemporalStores(size_t bytes) {
+  switch (getNonTemporalStores()) {
+  case NonTemporalStores::Never:
+    return false;
+  case NonTemporalStores::Always:
+    return true;
+  default:
+    return bytes > getLastLevelCacheSize();
+  }
+}
+
+void setNonTemporalStores(NonTemporalStores mode) {
+  nonTemporalStores.store(mode, std::memory_order_relaxed);
+}
+
+NonTemporalStores getNonTemporalStores() {
+  return nonTemporalStores.load(std::memory_order_relaxed);
+}
+
+#ifdef WITH_SSE2
+namespace {
+
+// The bytes before the first 16-byte aligned one of dest.
+size_t headOf(const void* dest, size_t size) {
+  const auto p = reinterpret_cast<uintptr_t>(dest);
+  return std::min<size_t>(roundUp(p, sizeof(__m128i)) - p, size);
+}
+
+} // namespace
+#endif
+
+void copyNonTemporal(void* dest, const void* src, size_t size) {
+#ifdef WITH_SSE2
+  auto* out = static_cast<uchar8*>(dest);
+  const auto* in = static_cast<const uchar8*>(src);
+
+  const size_t head = headOf(out, size);
+  memcpy(out, in, head);
+  out += head;
+  in += head;
+  size -= head;
+
+  for (; size >= sizeof(__m128i); size -= sizeof(__m128i)) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(out),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+    out += sizeof(__m128i);
+    in += sizeof(__m128i);
+  }
+  memcpy(out, in, size);
+
+  _mm_sfence();
+#else
+  memcpy(dest, src, size);
+#endif
+}
+
+void fillNonTemporal(void* dest, uchar8 value, size_t size) {
+#ifdef WITH_SSE2
+  auto* out = static_cast<uchar8*>(dest);
+
+  const size_t head = headOf(out, size);
+  memset(out, value, head);
+  out += head;
+  size -= head;
+
+  const __m128i v = _mm_set1_epi8(static_cast<char>(value));
+  for (; size >= sizeof(__m128i); size -= sizeof(__m128i)) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(out), v);
+    out += sizeof(__m128i);
+  }
+  memset(out, value, size);
+
+  _mm_sfence();
+#else
+  memset(dest, value, size);
+#endif
+}
+
 } // namespace rawspeed
@@ -97,4 +97,50 @@ void alignedFree(void* ptr);
 // coverity[+free : arg-0]
 void alignedFreeConstPtr(const void* ptr);
 
+// The huge pages that adviseHugePages() and HugePageImageAllocator use.
+static constexpr const size_t hugePageSize = 2UL << 20UL;
+
+// Asks the kernel to back the whole huge pages within [ptr, ptr + size) with
+// transparent huge pages. Just a hint, and a no-op where it is not supported.
+void adviseHugePages(void* ptr, size_t size);
+
+// Asks the kernel to start reading the pages of [ptr, ptr + size) of a file
+// mapping in the background, ahead of their use. Just a hint, and a no-op
+// where it is not supported.
+void adviseWillNeed(const void* ptr, size_t size);
+
+// Tells the kernel that the whole pages within [ptr, ptr + size) of a file
+// mapping are no longer needed, so that they are dropped from the mapping.
+// They are read from the file again if accessed. NOTE: only for the file
+// mappings, on any other memory this would drop the contents!
+void adviseDontNeed(const void* ptr, size_t size);
+
+// Whether Buffer::Create() calls adviseHugePages() for the buffers of
+// the files. Off by default, since it is a trade of the memory for the TLB
+// misses, which is only worth it for the large files.
+void setHugePagesForBuffers(bool enable);
+bool getHugePagesForBuffers();
+
+// The size of the last level cache, as reported by the OS, or a guess, if it
+// does not. Detected once.
+size_t __attribute__((const)) getLastLevelCacheSize();
+
+// Whether writing the given bytes, e.g. of a whole frame, is better done with
+// the non-temporal stores below: if they do not fit into the last level cache
+// anyway, they would only evict what the other threads are working on, and
+// each of the lines would be read for ownership, just to be overwritten.
+bool __attribute__((pure)) useNonTemporalStores(size_t bytes);
+
+// By default, useNonTemporalStores() is decided by the size, as above. But it
+// can be forced either way, e.g. for the tests, or to compare the two.
+enum class NonTemporalStores { Auto, Never, Always };
+void setNonTemporalStores(NonTemporalStores mode);
+NonTemporalStores getNonTemporalStores();
+
+// memcpy() and memset(), but with the non-temporal stores, that bypass the
+// caches, where available. The stores are fenced before they return, so the
+// results are visible to the other threads as with the plain ones.
+void copyNonTemporal(void* dest, const void* src, size_t size);
+void fillNonTemporal(void* dest, uchar8 value, size_t size);
+
 } // namespace rawspeed
@@ -25,6 +25,8 @@
 
 #ifdef HAVE_OPENMP
 #include <omp.h>
+#else
+#include <mutex> // for mutex
 #endif
 
 namespace rawspeed {
@@ -63,7 +65,11 @@ public:
 
 #else
 
+// Without OpenMP the library may still be run in parallel, by a
+// ThreadPoolExecutor or by the executor of the host application.
 class CAPABILITY("mutex") Mutex final {
+  std::mutex mutex;
+
 public:
   explicit Mutex() = default;
 
@@ -77,20 +83,13 @@ public:
   // Acquire/lock this mutex exclusively.  Only one thread can have exclusive
   // access at any one time.  Write operations to guarded data require an
   // exclusive lock.
-  void __attribute__((const)) Lock() const ACQUIRE() {
-    // NOP, since there is no mutex. only here to still check for proper locking
-  }
+  void Lock() ACQUIRE() { mutex.lock(); }
 
   // Release/unlock an exclusive mutex.
-  void __attribute__((const)) Unlock() const RELEASE() {
-    // NOP, since there is no mutex. only here to still check for proper locking
-  }
+  void Unlock() RELEASE() { mutex.unlock(); }
 
   // Try to acquire the mutex.  Returns true on success, and false on failure.
-  bool __attribute__((const)) TryLock() const TRY_ACQUIRE(true) {
-    // NOP, since there is no mutex. only here to still check for proper locking
-    return true;
-  }
+  bool TryLock() TRY_ACQUIRE(true) { return mutex.try_lock(); }
 
   // For negative capabilities.
   const Mutex& operator!() const { return *this; }
@@ -21,8 +21,13 @@
 #pragma once
 
 #include "common/Range.h" // for RangesOverlap
-#include <set>            // IWYU pragma: export
-// IWYU pragma: no_include <bits/stl_set.h>
+#include <algorithm>      // for lower_bound, move
+#include <array>          // for array
+#include <cassert>        // for assert
+#include <cstddef>        // for size_t
+#include <iterator>       // for next, prev
+#include <utility>        // for declval, pair
+#include <vector>         // for vector
 
 namespace rawspeed {
 
@@ -32,6 +37,78 @@ template <typename T> struct RangesOverlapCmp final {
   }
 };
 
-template <typename T> using NORangesSet = std::set<T, RangesOverlapCmp<T>>;
+// A set of the ranges that do not overlap, as per RangesOverlap(). Only the
+// bounds are kept, sorted by the begin, in a flat array. The first few are
+// stored inline, which covers the IFDs of almost all of the real files
+// without any allocation; a lookup is a binary search over contiguous memory.
+template <typename T> class NORangesSet final {
+  using Bound = decltype(std::declval<const T&>().begin());
+
+  struct Interval final {
+    Bound begin;
+    Bound end;
+  };
+
+  static constexpr size_t InlineCapacity = 16;
+
+  std::array<Interval, InlineCapacity> inlineStorage;
+  std::vector<Interval> heapStorage;
+  size_t count = 0;
+
+  Interval* data() {
+    return heapStorage.empty() ? inlineStorage.data() : heapStorage.data();
+  }
+  const Interval* data() const {
+    return heapStorage.empty() ? inlineStorage.data() : heapStorage.data();
+  }
+
+public:
+  using size_type = size_t;
+
+  size_type size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  void reserve(size_type n) {
+    if (n > InlineCapacity)
+      heapStorage.reserve(n);
+  }
+
+  // Inserts the range, unless it overlaps one of those already in the set.
+  // As with std::set, the second is whether it was inserted, and the first
+  // is the position of the range among those of the set, by the begin.
+  std::pair<size_type, bool> emplace(const T& r) {
+    const Interval* first = data();
+    const Interval* last = first + count;
+    const Interval* next =
+        std::lower_bound(first, last, r.begin(),
+                         [](const Interval& i, Bound b) { return i.begin < b; });
+    const auto pos = static_cast<size_type>(next - first);
+
+    // Same as RangesOverlap(), with the neighbours by the begin. The ones
+    // past the next one can only overlap if the next one does too.
+    if (next != last && (next->begin == r.begin() || r.end() > next->begin))
+      return {pos, false};
+    if (next != first && std::prev(next)->end > r.begin())
+      return {pos, false};
+
+    if (heapStorage.empty() && count == InlineCapacity) {
+      heapStorage.reserve(2 * InlineCapacity);
+      heapStorage.assign(inlineStorage.begin(), inlineStorage.end());
+    }
+
+    const Interval i = {r.begin(), r.end()};
+    if (!heapStorage.empty()) {
+      heapStorage.insert(std::next(heapStorage.begin(), pos), i);
+    } else {
+      Interval* storage = inlineStorage.data();
+      std::move_backward(storage + pos, storage + count, storage + count + 1);
+      storage[pos] = i;
+    }
+    count++;
+    assert(heapStorage.empty() || heapStorage.size() == count);
+
+    return {pos, true};
+  }
+};
 
 } // namespace rawspeed
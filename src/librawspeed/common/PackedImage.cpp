@@ -0,0 +1,129 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "common/PackedImage.h"
+#include "common/Executor.h"              // for parallelFor
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "io/Endianness.h"                // for getLE
+#include <algorithm>                      // for any_of
+#include <atomic>                         // for atomic, memory_order_relaxed
+#include <cstdint>                        // for int64_t
+
+namespace rawspeed {
+
+namespace {
+
+// The unpacking reads a whole uint32 at the byte of each value, which may
+// run past the last row.
+constexpr size_t Slack = sizeof(uint32);
+
+void packRow(const ushort16* in, int n, int bits, uchar8* out) {
+  uint64 cache = 0;
+  int fill = 0;
+  for (int i = 0; i < n; i++) {
+    cache |= static_cast<uint64>(in[i]) << fill;
+    fill += bits;
+    for (; fill >= 8; fill -= 8) {
+      *out++ = static_cast<uchar8>(cache);
+      cache >>= 8U;
+    }
+  }
+  if (fill)
+    *out = static_cast<uchar8>(cache);
+}
+
+// A value spans at most 7 + 16 bits from its byte, so one load is enough, and
+// none of them depends on the previous one.
+void unpackRow(const uchar8* in, int n, int bits, ushort16* out) {
+  const uint32 mask = (1U << bits) - 1U;
+  for (int i = 0; i < n; i++) {
+    const uint32 bit = static_cast<uint32>(i) * bits;
+    out[i] = (getLE<uint32>(in + bit / 8) >> (bit % 8)) & mask;
+  }
+}
+
+// Two of them in three bytes, the most common one.
+void unpackRow12(const uchar8* in, int n, ushort16* out) {
+  int i = 0;
+  for (; i + 2 <= n; i += 2, in += 3) {
+    out[i] = in[0] | ((in[1] & 0xFU) << 8U);
+    out[i + 1] = (in[1] >> 4U) | (in[2] << 4U);
+  }
+  if (i < n)
+    out[i] = in[0] | ((in[1] & 0xFU) << 8U);
+}
+
+} // namespace
+
+PackedImage::PackedImage(const RawImage& img, int bits_)
+    : dim(img->dim), cpp(img->getCpp()), bits(bits_) {
+  if (img->getDataType() != TYPE_USHORT16)
+    ThrowRDE("Only the 16-bit images can be packed.");
+  if (bits < 1 || bits > 16)
+    ThrowRDE("Invalid bit depth %i", bits);
+
+  const Array2DRef<const ushort16> in = img->getU16DataAsCroppedArray2DRef();
+  pitch = roundUpDivision(static_cast<size_t>(in.width) * bits, 8);
+  data.resize(getSize() + Slack);
+
+  const uint32 maxValue = (1U << bits) - 1U;
+  std::atomic<bool> tooWide{false};
+  parallelFor(0, dim.y, int64_t(dim.y) * img->pitch,
+              [this, in, maxValue, &tooWide](int y) {
+                const ushort16* row = &in(0, y);
+                const auto wide = [maxValue](ushort16 v) {
+                  return v > maxValue;
+                };
+                if (std::any_of(row, row + in.width, wide))
+                  tooWide.store(true, std::memory_order_relaxed);
+                packRow(row, in.width, bits, &data[size_t(y) * pitch]);
+              });
+  if (tooWide)
+    ThrowRDE("Some of the values do not fit in %i bits", bits);
+}
+
+void PackedImage::unpackRows(int y, const Array2DRef<ushort16>& out) const {
+  if (y < 0 || out.height > dim.y - y ||
+      out.width != dim.x * static_cast<int>(cpp))
+    ThrowRDE("The rows %i to %i of %i values are not in the image", y,
+             y + out.height, out.width);
+
+  for (int r = 0; r < out.height; r++) {
+    const uchar8* in = &data[size_t(y + r) * pitch];
+    if (bits == 12)
+      unpackRow12(in, out.width, &out(0, r));
+    else
+      unpackRow(in, out.width, bits, &out(0, r));
+  }
+}
+
+RawImage PackedImage::unpack() const {
+  RawImage img = RawImage::create(dim, TYPE_USHORT16, cpp);
+  const int width = dim.x * cpp;
+  parallelFor(0, dim.y, int64_t(dim.y) * img->pitch,
+              [this, &img, width](int y) {
+                auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+                unpackRows(y, Array2DRef<ushort16>(row, width, 1));
+              });
+  return img;
+}
+
+} // namespace rawspeed
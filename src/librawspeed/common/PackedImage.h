@@ -0,0 +1,69 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#pragma once
+
+#include "common/Array2DRef.h" // for Array2DRef
+#include "common/Common.h"     // for uchar8, ushort16, uint32
+#include "common/Point.h"      // for iPoint2D
+#include "common/RawImage.h"   // for RawImage
+#include <cstddef>             // for size_t
+#include <vector>              // for vector
+
+namespace rawspeed {
+
+// The pixels of a 16-bit image bit-packed at the bit depth of the sensor,
+// e.g. 1.5 bytes for each of the 12-bit ones instead of 2, for keeping many
+// frames in memory or sending them elsewhere. Unlike storeRawImage(), it is
+// not compressed, so unpacking it is just a few shifts per pixel, and any of
+// the rows can be unpacked on its own, e.g. into the image of the consumer.
+//
+// Each row of the crop starts at a byte, with its values, all cpp of each
+// pixel, packed low bits first. Only the pixels are kept.
+class PackedImage final {
+  iPoint2D dim;
+  uint32 cpp = 1;
+  int bits = 16;
+  uint32 pitch = 0;
+  std::vector<uchar8> data;
+
+public:
+  PackedImage() = default;
+
+  // Of the cropped area of the image. Throws if any value is wider than bits.
+  PackedImage(const RawImage& img, int bits);
+
+  const iPoint2D& getDim() const { return dim; }
+  uint32 getCpp() const { return cpp; }
+  int getBits() const { return bits; }
+  // Of each of the rows, and of all of the packed data.
+  uint32 getPitch() const { return pitch; }
+  size_t getSize() const { return static_cast<size_t>(dim.y) * pitch; }
+  const uchar8* getData() const { return data.data(); }
+
+  // The rows from y on, as many as out has, each one of dim.x * cpp values.
+  void unpackRows(int y, const Array2DRef<ushort16>& out) const;
+
+  // A new image of all of the rows.
+  RawImage unpack() const;
+};
+
+} // namespace rawspeed
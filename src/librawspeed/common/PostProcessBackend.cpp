@@ -0,0 +1,44 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/PostProcessBackend.h"
+#include <atomic>  // for atomic_load, atomic_store
+#include <utility> // for move
+
+namespace rawspeed {
+
+namespace {
+
+std::shared_ptr<PostProcessBackend>& getCurrentPostProcessBackend() {
+  static std::shared_ptr<PostProcessBackend> backend;
+  return backend;
+}
+
+} // namespace
+
+std::shared_ptr<PostProcessBackend> getPostProcessBackend() {
+  return std::atomic_load(&getCurrentPostProcessBackend());
+}
+
+void setPostProcessBackend(std::shared_ptr<PostProcessBackend> backend) {
+  std::atomic_store(&getCurrentPostProcessBackend(), std::move(backend));
+}
+
+} // namespace rawspeed
@@ -0,0 +1,58 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <memory> // for shared_ptr
+
+namespace rawspeed {
+
+class RawImageData;
+
+// Runs the passes of RawImageData::postProcess() elsewhere, e.g. on a GPU,
+// where the host application sends the image next anyway. It is implemented
+// by the host application, on top of CUDA, Vulkan or OpenCL, and selected
+// at run time by setPostProcessBackend(). The images that it declines are
+// post-processed on the CPU as usual.
+class PostProcessBackend {
+public:
+  virtual ~PostProcessBackend() = default;
+
+  // With the RawImageData::PostProcessStage's that are left to do, at least
+  // one, once they are set up: the levels are final, in blackLevelSeparate
+  // and whitePoint, the bad pixels are in the mBadPixelMap or the
+  // mBadPixelList, and the table is getTable(). Returns false to leave them
+  // to the CPU, without having changed the image. Otherwise they are done,
+  // e.g. with the pixels uploaded once, and the result attached to the image
+  // as its deviceImage, the pixels of the image being left as decoded.
+  virtual bool postProcess(RawImageData* img, int stages) = 0;
+};
+
+// The image on the device, as the backend attached it.
+class DeviceImage {
+public:
+  virtual ~DeviceImage() = default;
+};
+
+// Of all the images, or nullptr, which is the default, for the CPU.
+std::shared_ptr<PostProcessBackend> getPostProcessBackend();
+void setPostProcessBackend(std::shared_ptr<PostProcessBackend> backend);
+
+} // namespace rawspeed
@@ -21,18 +21,28 @@
 #include "rawspeedconfig.h"
 #include "common/RawImage.h"
 #include "MemorySanitizer.h"              // for MSan
+#include "common/BadPixelFixer.h"         // for BadPixelFixer
+#include "common/Executor.h"              // for getExecutor, Executor
+#include "common/ImageAllocator.h"        // for ImageAllocator, getImageAl...
 #include "common/Memory.h"                // for alignedFree, alignedMalloc...
+#include "common/PostProcessBackend.h"    // for getPostProcessBackend, Pos...
+#include "common/Trace.h"                 // for RAWSPEED_TRACE_SCOPE
+#include "common/XXH64.h"                 // for xxh64_hash
 #include "decoders/RawDecoderException.h" // for ThrowRDE, RawDecoderException
 #include "io/IOException.h"               // for IOException
 #include "parsers/TiffParserException.h"  // for TiffParserException
-#include <algorithm>                      // for fill_n, min
+#include <algorithm>                      // for fill_n, max, min, sort, all_of
+#include <array>                          // for array
+#include <atomic>                         // for memory_order_acq_rel, memo...
 #include <cassert>                        // for assert
 #include <cmath>                          // for NAN
+#include <cstdint>                        // for SIZE_MAX, int64_t
 #include <cstdlib>                        // for size_t
 #include <cstring>                        // for memcpy, memset
 #include <limits>                         // for numeric_limits
 #include <memory>                         // for unique_ptr, make_unique
-#include <utility>                        // for move, swap
+#include <type_traits>                    // for is_same
+#include <utility>                        // for move, swap, pair
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
 #include "AddressSanitizer.h" // for ASan::...
@@ -42,6 +52,32 @@ using std::string;
 
 namespace rawspeed {
 
+namespace {
+
+// For the operations on the whole frame: the rows [begin, end), each of
+// rowBytes, are done in parallel, in bands, and if they do not fit into the
+// last level cache anyway, with the non-temporal stores, so that they do not
+// evict what the other decodes are working on. body(y, nonTemporal).
+template <typename Body>
+void forEachRow(int begin, int end, size_t rowBytes, const Body& body) {
+  const size_t bytes = rowBytes * (end - begin);
+  const bool nonTemporal = useNonTemporalStores(bytes);
+  parallelForRange(begin, end, bytes,
+                   [&body, nonTemporal](int first, int last) {
+                     for (int y = first; y < last; ++y)
+                       body(y, nonTemporal);
+                   });
+}
+
+void copyRow(uchar8* dest, const uchar8* src, size_t size, bool nonTemporal) {
+  if (nonTemporal)
+    copyNonTemporal(dest, src, size);
+  else
+    memcpy(dest, src, size);
+}
+
+} // namespace
+
 RawImageData::RawImageData() : cfa(iPoint2D(0, 0)) {
   blackLevelSeparate.fill(-1);
 }
@@ -74,38 +110,76 @@ RawImageData::~RawImageData() {
 }
 
 
+void RawImageData::expectInput(uint64 inputBytes, uint32 minBitsPerPixel) {
+  expectedInputBytes = inputBytes;
+  expectedMinBitsPerPixel = minBitsPerPixel;
+}
+
 void RawImageData::createData() {
-  static constexpr const auto alignment = 16;
+  static constexpr const auto alignment = ImageAllocator::alignment;
 
-  if (dim.x > 65535 || dim.y > 65535)
-    ThrowRDE("Dimensions too large for allocation.");
   if (dim.x <= 0 || dim.y <= 0)
     ThrowRDE("Dimension of one sides is less than 1 - cannot allocate image.");
   if (data)
     ThrowRDE("Duplicate data allocation in createData.");
 
-  // want each line to start at 16-byte aligned address
-  pitch = roundUp(static_cast<size_t>(dim.x) * bpp, alignment);
-  assert(isAligned(pitch, alignment));
+  // Before anything is allocated, or touched.
+  const uint64 pixels = static_cast<uint64>(dim.x) * dim.y;
+  if (maxPixels && pixels > maxPixels)
+    ThrowRDE("Image of (%u; %u) has more than the %llu pixels allowed", dim.x,
+             dim.y, maxPixels);
+  if (maxBytes && pixels * bpp > maxBytes)
+    ThrowRDE("Image of (%u; %u) takes more than the %llu bytes allowed",
+             dim.x, dim.y, maxBytes);
+  if (expectedMinBitsPerPixel &&
+      pixels > expectedInputBytes * 8 / expectedMinBitsPerPixel) {
+    ThrowRDE("Image of (%u; %u) needs at least %u bits per pixel of the "
+             "input, but there are only %llu bytes",
+             dim.x, dim.y, expectedMinBitsPerPixel, expectedInputBytes);
+  }
+
+  if (externalData && externalData.pitch) {
+    if (externalData.pitch < static_cast<size_t>(dim.x) * bpp ||
+        !isAligned(externalData.pitch, alignment))
+      ThrowRDE("Pitch %u of the external data does not fit the rows of %u "
+               "bytes, or is not a multiple of %zu.",
+               externalData.pitch, dim.x * bpp, alignment);
+    pitch = externalData.pitch;
+  } else {
+    // want each line to start at 16-byte aligned address
+    pitch = roundUp(static_cast<size_t>(dim.x) * bpp, alignment);
+    assert(isAligned(pitch, alignment));
 
 #if defined(DEBUG) || __has_feature(address_sanitizer) ||                      \
     defined(__SANITIZE_ADDRESS__)
-  // want to ensure that we have some padding
-  pitch += alignment * alignment;
-  assert(isAligned(pitch, alignment));
+    // want to ensure that we have some padding
+    pitch += alignment * alignment;
+    assert(isAligned(pitch, alignment));
+    assert(pitch - dim.x * bpp > 0);
 #endif
+  }
 
   padding = pitch - dim.x * bpp;
 
-#if defined(DEBUG) || __has_feature(address_sanitizer) ||                      \
-    defined(__SANITIZE_ADDRESS__)
-  assert(padding > 0);
-#endif
+  if (pitch > SIZE_MAX / dim.y)
+    ThrowRDE("Memory Allocation failed.");
 
-  data = alignedMallocArray<uchar8, alignment>(dim.y, pitch);
+  mAllocationSize = static_cast<size_t>(dim.y) * pitch;
+  if (externalData) {
+    if (!isAligned(externalData.data, alignment))
+      ThrowRDE("The external data is not aligned to %zu bytes.", alignment);
+    if (externalData.size < mAllocationSize)
+      ThrowRDE("The external data of %zu bytes is too small for the image of "
+               "%zu bytes.",
+               externalData.size, mAllocationSize);
+    data = externalData.data;
+  } else {
+    mAllocator = allocator ? allocator : getImageAllocator();
+    data = mAllocator->allocate(mAllocationSize);
+  }
 
   if (!data)
-    ThrowRDE("Memory Allocation failed.");
+    ThrowRDE("Memory Allocation of %zu bytes failed.", mAllocationSize);
 
   uncropped_dim = dim;
 
@@ -128,7 +202,9 @@ void RawImageData::createData() {
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
 void RawImageData::poisonPadding() {
-  if (padding <= 0)
+  // The padding of a view is the pixels of its parent, and that of the
+  // aliased input is not ours either.
+  if (padding <= 0 || isView() || mReadOnly)
     return;
 
   for (int j = 0; j < uncropped_dim.y; j++) {
@@ -149,7 +225,7 @@ void RawImageData::poisonPadding() {
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
 void RawImageData::unpoisonPadding() {
-  if (padding <= 0)
+  if (padding <= 0 || isView() || mReadOnly)
     return;
 
   for (int j = 0; j < uncropped_dim.y; j++) {
@@ -191,13 +267,72 @@ void RawImageData::checkMemIsInitialized() {
 }
 #endif
 
+void RawImageData::checkCancelled() const {
+  if (isCancelled())
+    ThrowRDE("The decoding was cancelled.");
+}
+
 void RawImageData::destroyData() {
-  if (data)
-    alignedFree(data);
+  if (data && !isView()) {
+    // The memory may be reused for an image of another layout.
+    unpoisonPadding();
+    // Unless it is the external data, which is not ours.
+    if (mAllocator) {
+      mAllocator->deallocate(data, mAllocationSize);
+      mAllocator.reset();
+    }
+  }
   if (mBadPixelMap)
     alignedFree(mBadPixelMap);
   data = nullptr;
+  mReadOnly = false;
   mBadPixelMap = nullptr;
+  mBadPixelList.clear();
+}
+
+bool RawImageData::aliasData(const uchar8* in, uint32 inPitch) {
+  static constexpr const auto alignment = ImageAllocator::alignment;
+
+  if (!aliasInput || !data || isView() || externalData || mReadOnly)
+    return false;
+  if (mOffset != iPoint2D(0, 0) || dim != uncropped_dim)
+    return false;
+  if (inPitch < static_cast<size_t>(dim.x) * bpp ||
+      !isAligned(inPitch, alignment) || !isAligned(in, alignment))
+    return false;
+
+  unpoisonPadding();
+  mAllocator->deallocate(data, mAllocationSize);
+  mAllocator.reset();
+
+  // The pixels are never written to through it, see makeWritable().
+  data = const_cast<uchar8*>(in); // NOLINT
+  pitch = inPitch;
+  padding = pitch - dim.x * bpp;
+  mAllocationSize = static_cast<size_t>(dim.y) * pitch;
+  mReadOnly = true;
+  return true;
+}
+
+void RawImageData::makeWritable() {
+  if (!mReadOnly)
+    return;
+
+  RAWSPEED_TRACE_SCOPE("image", "makeWritable");
+
+  mAllocator = allocator ? allocator : getImageAllocator();
+  auto* copy = mAllocator->allocate(mAllocationSize);
+  if (!copy)
+    ThrowRDE("Memory Allocation of %zu bytes failed.", mAllocationSize);
+  assert(mAllocationSize == static_cast<size_t>(dim.y) * pitch);
+  forEachRow(0, dim.y, pitch, [this, copy](int y, bool nonTemporal) {
+    copyRow(copy + static_cast<size_t>(y) * pitch,
+            data + static_cast<size_t>(y) * pitch, pitch, nonTemporal);
+  });
+
+  data = copy;
+  mReadOnly = false;
+  poisonPadding();
 }
 
 void RawImageData::setCpp(uint32 val) {
@@ -214,10 +349,43 @@ void RawImageData::setCpp(uint32 val) {
   bpp *= val;
 }
 
+template <typename T>
+Array2DRef<T> RawImageData::getDataAsArray2DRef(bool cropped) const {
+  if (!data)
+    ThrowRDE("Data not yet allocated.");
+  if ((dataType == TYPE_USHORT16) != std::is_same<T, ushort16>::value)
+    ThrowRDE("The pixels are not of the requested type.");
+
+  uchar8* first = data;
+  iPoint2D size = uncropped_dim;
+  if (cropped) {
+    first = getData();
+    size = dim;
+  }
+  return {reinterpret_cast<T*>(first), size.x * static_cast<int>(cpp), size.y,
+          static_cast<int>(pitch / sizeof(T))};
+}
+
+Array2DRef<ushort16> RawImageData::getU16DataAsUncroppedArray2DRef() const {
+  return getDataAsArray2DRef<ushort16>(false);
+}
+
+Array2DRef<ushort16> RawImageData::getU16DataAsCroppedArray2DRef() const {
+  return getDataAsArray2DRef<ushort16>(true);
+}
+
+Array2DRef<float> RawImageData::getF32DataAsUncroppedArray2DRef() const {
+  return getDataAsArray2DRef<float>(false);
+}
+
+Array2DRef<float> RawImageData::getF32DataAsCroppedArray2DRef() const {
+  return getDataAsArray2DRef<float>(true);
+}
+
 uchar8* RawImageData::getData() const {
   if (!data)
     ThrowRDE("Data not yet allocated.");
-  return &data[mOffset.y*pitch+mOffset.x*bpp];
+  return &data[static_cast<size_t>(mOffset.y) * pitch + mOffset.x * bpp];
 }
 
 uchar8* RawImageData::getData(uint32 x, uint32 y) {
@@ -289,30 +457,80 @@ void RawImageData::createBadPixelMap()
          static_cast<size_t>(mBadPixelMapPitch) * uncropped_dim.y);
   if (!mBadPixelMap)
     ThrowRDE("Memory Allocation failed.");
+
+  // From now on, the map is the only place where the bad pixels are.
+  for (BadPixelPosition pos : mBadPixelList) {
+    const uint32 pos_x = getBadPixelX(pos);
+    const uint32 pos_y = getBadPixelY(pos);
+    mBadPixelMap[static_cast<size_t>(mBadPixelMapPitch) * pos_y +
+                 (pos_x >> 3)] |= 1 << (pos_x & 7);
+  }
+  mBadPixelList.clear();
+  mBadPixelList.shrink_to_fit();
+}
+
+RawImage RawImage::createView(const RawImage& parent,
+                              const iRectangle2D& area) {
+  const RawImageData& p = *parent;
+  if (!p.data)
+    ThrowRDE("Data not yet allocated.");
+  // The view could not copy them on its own.
+  parent->makeWritable();
+  if (!area.hasPositiveArea() || !area.isThisInside({{0, 0}, p.dim}))
+    ThrowRDE("View (%i, %i, %i, %i) not inside the image (%i, %i).",
+             area.pos.x, area.pos.y, area.dim.x, area.dim.y, p.dim.x, p.dim.y);
+
+  RawImage view = create(p.dataType);
+  RawImageData& v = *view;
+  v.mParent = std::make_unique<RawImage>(parent);
+
+  v.cpp = p.cpp;
+  v.bpp = p.bpp;
+  v.dim = area.dim;
+  v.uncropped_dim = area.dim;
+  v.pitch = p.pitch;
+  v.padding = p.pitch - area.dim.x * p.bpp;
+  v.data = p.getData() + static_cast<size_t>(area.pos.y) * p.pitch +
+           static_cast<size_t>(area.pos.x) * p.bpp;
+
+  v.isCFA = p.isCFA;
+  v.cfa = p.cfa;
+  // Same as in subFrame().
+  if (v.isCFA && v.cfa.getDcrawFilter() != 1 && v.cfa.getDcrawFilter() != 9) {
+    v.cfa.shiftLeft(area.pos.x);
+    v.cfa.shiftDown(area.pos.y);
+  }
+  v.blackLevel = p.blackLevel;
+  v.blackLevelSeparate = p.blackLevelSeparate;
+  v.whitePoint = p.whitePoint;
+  v.mDitherScale = p.mDitherScale;
+  v.metadata = p.metadata;
+
+  return view;
 }
 
 RawImage::RawImage(RawImageData* p) : p_(p) {
-  MutexLocker guard(&p_->mymutex);
-  ++p_->dataRefCount;
+  p_->dataRefCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 RawImage::RawImage(const RawImage& p) : p_(p.p_) {
-  MutexLocker guard(&p_->mymutex);
-  ++p_->dataRefCount;
+  p_->dataRefCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 RawImage::~RawImage() {
-  p_->mymutex.Lock();
-
-  --p_->dataRefCount;
-
-  if (p_->dataRefCount == 0) {
-    p_->mymutex.Unlock();
+  // Whatever the other handles wrote must be visible to the deletion.
+  if (p_->dataRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
     delete p_;
+}
+
+void RawImageData::addBadPixels(
+    const std::vector<BadPixelPosition>& positions) {
+  if (positions.empty())
     return;
-  }
 
-  p_->mymutex.Unlock();
+  MutexLocker guard(&mBadPixelMutex);
+  mBadPixelPositions.insert(mBadPixelPositions.end(), positions.begin(),
+                            positions.end());
 }
 
 void RawImageData::transferBadPixelsToMap()
@@ -321,28 +539,49 @@ void RawImageData::transferBadPixelsToMap()
   if (mBadPixelPositions.empty())
     return;
 
-  if (!mBadPixelMap)
-    createBadPixelMap();
+  if (!mBadPixelMap) {
+    assert(std::all_of(mBadPixelPositions.begin(), mBadPixelPositions.end(),
+                       [this](BadPixelPosition pos) {
+                         return getBadPixelX(pos) <
+                                    static_cast<uint32>(uncropped_dim.x) &&
+                                getBadPixelY(pos) <
+                                    static_cast<uint32>(uncropped_dim.y);
+                       }));
+
+    mBadPixelList.insert(mBadPixelList.end(), mBadPixelPositions.begin(),
+                         mBadPixelPositions.end());
+    mBadPixelPositions.clear();
+    mBadPixelsFixed = false;
+    std::sort(mBadPixelList.begin(), mBadPixelList.end());
+    mBadPixelList.erase(std::unique(mBadPixelList.begin(), mBadPixelList.end()),
+                        mBadPixelList.end());
+
+    // A lookup in the list costs a binary search, a whole map costs a scan of
+    // every row. Roughly, the list wins up to one bad pixel in every 4096.
+    const uint64 area = static_cast<uint64>(uncropped_dim.area());
+    if (mBadPixelList.size() > std::max<uint64>(256, area / 4096))
+      createBadPixelMap();
+    return;
+  }
 
-  for (unsigned int pos : mBadPixelPositions) {
-    ushort16 pos_x = pos & 0xffff;
-    ushort16 pos_y = pos >> 16;
+  for (BadPixelPosition pos : mBadPixelPositions) {
+    const uint32 pos_x = getBadPixelX(pos);
+    const uint32 pos_y = getBadPixelY(pos);
 
-    assert(pos_x < static_cast<ushort16>(uncropped_dim.x));
-    assert(pos_y < static_cast<ushort16>(uncropped_dim.y));
+    assert(pos_x < static_cast<uint32>(uncropped_dim.x));
+    assert(pos_y < static_cast<uint32>(uncropped_dim.y));
 
-    mBadPixelMap[mBadPixelMapPitch * pos_y + (pos_x >> 3)] |= 1 << (pos_x&7);
+    mBadPixelMap[static_cast<size_t>(mBadPixelMapPitch) * pos_y +
+                 (pos_x >> 3)] |= 1 << (pos_x & 7);
   }
   mBadPixelPositions.clear();
+  mBadPixelsFixed = false;
 }
 
 void RawImageData::fixBadPixels()
 {
 #if !defined (EMULATE_DCRAW_BAD_PIXELS)
 
-  /* Transfer if not already done */
-  transferBadPixelsToMap();
-
 #if 0 // For testing purposes
   if (!mBadPixelMap)
     createBadPixelMap();
@@ -353,16 +592,15 @@ void RawImageData::fixBadPixels()
   }
 #endif
 
-  /* Process bad pixels, if any */
-  if (mBadPixelMap)
-    startWorker(RawImageWorker::FIX_BAD_PIXELS, false);
+  /* Transfer if not already done, and process bad pixels, if any */
+  postProcess(STAGE_FIX_BAD_PIXELS);
 
 #else  // EMULATE_DCRAW_BAD_PIXELS - not recommended, testing purposes only
 
-  for (vector<uint32>::iterator i=mBadPixelPositions.begin(); i != mBadPixelPositions.end(); ++i) {
-    uint32 pos = *i;
-    uint32 pos_x = pos&0xffff;
-    uint32 pos_y = pos>>16;
+  for (vector<BadPixelPosition>::iterator i=mBadPixelPositions.begin(); i != mBadPixelPositions.end(); ++i) {
+    BadPixelPosition pos = *i;
+    uint32 pos_x = getBadPixelX(pos);
+    uint32 pos_y = getBadPixelY(pos);
     uint32 total = 0;
     uint32 div = 0;
     // 0 side covered by unsignedness.
@@ -394,26 +632,50 @@ void RawImageData::startWorker(const RawImageWorker::RawImageWorkerTask task,
     return h;
   }();
 
-  const int threads = rawspeed_get_number_of_processor_cores();
-  const int y_per_thread = (height + threads - 1) / threads;
-
-#ifdef HAVE_OPENMP
-#pragma omp parallel for default(none) num_threads(threads) schedule(static)
-#endif
-  for (int i = 0; i < threads; i++) {
-    int y_offset = std::min(i * y_per_thread, height);
-    int y_end = std::min((i + 1) * y_per_thread, height);
+  // The rows go in chunks of about the size of the L2 cache, handed out to
+  // whichever task is free, so the tasks that start late or run on slower
+  // cores do not hold up the rest. A chunk is a whole number of the 4 rows
+  // that the dithered lookup does at once, and so, with the pitch being a
+  // multiple of 16 bytes, of 64-byte cache lines: unless the data itself is
+  // not aligned to those, no two tasks write to the same line.
+  const int rowsPerChunk = [this]() {
+    const int rows = std::max(1, static_cast<int>((256U << 10U) / pitch));
+    return roundUp(rows, 4);
+  }();
+  const int numChunks = roundUpDivision(height, rowsPerChunk);
+
+  parallelForDynamic(
+      0, numChunks, int64_t(height) * pitch,
+      [this, task, height, rowsPerChunk](DynamicSchedule* schedule) {
+        for (int chunk; schedule->getNext(&chunk);) {
+          const int y_offset = chunk * rowsPerChunk;
+          const int y_end = std::min(y_offset + rowsPerChunk, height);
+          RawImageWorker worker(this, task, y_offset, y_end);
+        }
+      });
+}
 
-    RawImageWorker worker(this, task, y_offset, y_end);
+template <typename F>
+void RawImageData::forEachBadPixel(int start_y, int end_y, F f) const {
+  if (!mBadPixelMap) {
+    // Only the rows that do have bad pixels, and nothing else in them.
+    const auto rowBegin = [this](int y) {
+      return std::lower_bound(mBadPixelList.begin(), mBadPixelList.end(),
+                              getBadPixelPosition(0, y));
+    };
+    const auto end = rowBegin(end_y);
+    for (auto pos = rowBegin(start_y); pos != end; ++pos)
+      f(getBadPixelX(*pos), getBadPixelY(*pos));
+    return;
   }
-}
 
-void RawImageData::fixBadPixelsThread(int start_y, int end_y) {
-  int gw = (uncropped_dim.x + 15) / 32;
+  // The map rows are padded to 16 bytes, so the last word is there too.
+  int gw = (uncropped_dim.x + 31) / 32;
 
   for (int y = start_y; y < end_y; y++) {
-    auto* bad_map =
-        reinterpret_cast<const uint32*>(&mBadPixelMap[y * mBadPixelMapPitch]);
+    const uchar8* map_row =
+        &mBadPixelMap[static_cast<size_t>(y) * mBadPixelMapPitch];
+    auto* bad_map = reinterpret_cast<const uint32*>(map_row);
     for (int x = 0; x < gw; x++) {
       // Test if there is a bad pixel within these 32 pixels
       if (bad_map[x] == 0)
@@ -425,11 +687,662 @@ void RawImageData::fixBadPixelsThread(int start_y, int end_y) {
           if (1 != ((bad[i] >> j) & 1))
             continue;
 
-          fixBadPixel(x * 32 + i * 8 + j, y, 0);
+          f(x * 32 + i * 8 + j, y);
+        }
+      }
+    }
+  }
+}
+
+void RawImageData::fixBadPixelsThread(int start_y, int end_y) {
+  BadPixelFixer fixer(this);
+  forEachBadPixel(start_y, end_y,
+                  [&fixer](uint32 x, uint32 y) { fixer.fix(x, y); });
+}
+
+void RawImageData::scaleBlackWhite() { postProcess(STAGE_SCALE_BLACK_WHITE); }
+
+PixelStore RawImageData::getPixelStore() {
+  makeWritable();
+
+  PixelStore store;
+  store.table = table.get();
+  if (!scaleOnWrite.hasValue() || dataType != TYPE_USHORT16)
+    return store;
+
+  // As in scaleValues_plain(), but of the uncropped positions.
+  const Levels levels = scaleOnWrite.getValue();
+  for (int i = 0; i < 4; i++) {
+    if (levels.white <= levels.black[i])
+      ThrowRDE("The white level %i is not above the black level %i",
+               levels.white, levels.black[i]);
+    store.sub[i] = levels.black[i];
+    store.mul[i] = static_cast<int>(
+        16384.0F * 65535.0F /
+        static_cast<float>(levels.white - levels.black[i]));
+  }
+  const float appScale = 65535.0F / (levels.white - levels.black[0]);
+  store.fullScale = static_cast<int>(appScale * 4.0F);
+  store.halfScale = static_cast<int>(appScale * 4095.0F);
+  store.dither = mDitherScale;
+  store.scale = true;
+
+  mScaledOnWrite.store(true, std::memory_order_relaxed);
+  return store;
+}
+
+void RawImageData::finishScaleOnWrite() {
+  if (!isScaledOnWrite())
+    return;
+  blackLevel = 0;
+  blackLevelSeparate.fill(0);
+  whitePoint = 65535;
+  blackAreas.clear();
+}
+
+RawImage RawImageData::binHalfSize() {
+  if (dataType != TYPE_USHORT16 || cpp != 1 || !isCFA)
+    ThrowRDE("Only the 16-bit CFA images can be binned.");
+  if (!data)
+    ThrowRDE("Data not yet allocated.");
+  if (cfa.getSize() != iPoint2D(2, 2))
+    ThrowRDE("Not a 2x2 CFA: %s", cfa.asString().c_str());
+
+  // The color of each of the pixels of the quad, and how many of each color.
+  std::array<int, 4> colors;
+  std::array<int, 3> count = {{0, 0, 0}};
+  for (int i = 0; i < 4; i++) {
+    const CFAColor c = cfa.getColorAt(i & 1, i >> 1);
+    if (c != CFA_RED && c != CFA_GREEN && c != CFA_BLUE)
+      ThrowRDE("Not an RGB CFA: %s", cfa.asString().c_str());
+    colors[i] = c;
+    count[c]++;
+  }
+  if (std::find(count.begin(), count.end(), 0) != count.end())
+    ThrowRDE("Not all of R, G and B are in the CFA: %s",
+             cfa.asString().c_str());
+
+  // As in scaleValues(), but in one multiplier with the averaging.
+  int white = 65535;
+  std::array<int, 4> sub = {{0, 0, 0, 0}};
+  if (setUpScaleBlackWhite()) {
+    white = whitePoint;
+    for (int i = 0; i < 4; i++)
+      sub[i] = blackLevelSeparate[((mOffset.x + i) & 1) |
+                                  (((mOffset.y + (i >> 1)) & 1) << 1)];
+  }
+  std::array<int64_t, 4> mul;
+  for (int i = 0; i < 4; i++) {
+    if (white <= sub[i])
+      ThrowRDE("The white level %i is not above the black level %i", white,
+               sub[i]);
+    mul[i] = static_cast<int64_t>(
+        16384.0 * 65535.0 / (static_cast<double>(white - sub[i]) *
+                             count[colors[i]]));
+  }
+
+  RawImage img = RawImage::create({dim.x / 2, dim.y / 2}, TYPE_USHORT16, 3);
+  img->blackLevel = 0;
+  img->blackLevelSeparate.fill(0);
+  img->whitePoint = 65535;
+  img->metadata = metadata;
+
+  const Array2DRef<const ushort16> in = getU16DataAsCroppedArray2DRef();
+  const Array2DRef<ushort16> out = img->getU16DataAsCroppedArray2DRef();
+  parallelFor(0, img->dim.y, [in, out, &colors, &sub, &mul](int y) {
+    for (int x = 0; x < out.width / 3; x++) {
+      std::array<int64_t, 3> sum = {{8192, 8192, 8192}};
+      for (int i = 0; i < 4; i++) {
+        const int v = in(2 * x + (i & 1), 2 * y + (i >> 1));
+        sum[colors[i]] += (v - sub[i]) * mul[i];
+      }
+      for (int c = 0; c < 3; c++)
+        out(3 * x + c, y) = clampBits(static_cast<int>(sum[c] >> 14), 16);
+    }
+  });
+
+  return img;
+}
+
+RawImage RawImageData::splitCFAPlanes(bool scale) {
+  if (dataType != TYPE_USHORT16 || cpp != 1 || !isCFA)
+    ThrowRDE("Only the 16-bit CFA images can be split into planes.");
+  if (!data)
+    ThrowRDE("Data not yet allocated.");
+  if (cfa.getSize() != iPoint2D(2, 2))
+    ThrowRDE("Not a 2x2 CFA: %s", cfa.asString().c_str());
+
+  // Which pixel of the quad goes to each of the planes.
+  std::array<int, 4> quad = {{-1, -1, -1, -1}};
+  for (int i = 0; i < 4; i++) {
+    const CFAColor c = cfa.getColorAt(i & 1, i >> 1);
+    int plane = -1;
+    if (c == CFA_RED)
+      plane = 0;
+    else if (c == CFA_GREEN)
+      plane = quad[1] < 0 ? 1 : 2;
+    else if (c == CFA_BLUE)
+      plane = 3;
+    if (plane < 0 || quad[plane] >= 0)
+      ThrowRDE("Not an R, G, G, B CFA: %s", cfa.asString().c_str());
+    quad[plane] = i;
+  }
+
+  // The black level of each plane, once they are known, and as in
+  // binHalfSize(), the multiplier.
+  if (scale)
+    scale = setUpScaleBlackWhite();
+  std::array<int, 4> sub;
+  for (int p = 0; p < 4; p++)
+    sub[p] = blackLevelSeparate[((mOffset.x + quad[p]) & 1) |
+                                (((mOffset.y + (quad[p] >> 1)) & 1) << 1)];
+  std::array<int64_t, 4> mul;
+  if (scale) {
+    for (int p = 0; p < 4; p++) {
+      if (whitePoint <= sub[p])
+        ThrowRDE("The white level %i is not above the black level %i",
+                 whitePoint, sub[p]);
+      mul[p] = static_cast<int64_t>(16384.0 * 65535.0 /
+                                    static_cast<double>(whitePoint - sub[p]));
+    }
+  }
+
+  const int planeHeight = dim.y / 2;
+  RawImage img = RawImage::create({dim.x / 2, 4 * planeHeight}, TYPE_USHORT16,
+                                  1);
+  img->isCFA = false;
+  img->metadata = metadata;
+  if (scale) {
+    img->blackLevel = 0;
+    img->blackLevelSeparate.fill(0);
+    img->whitePoint = 65535;
+  } else {
+    img->blackLevel = blackLevel;
+    img->blackLevelSeparate = sub;
+    img->whitePoint = whitePoint;
+  }
+
+  const Array2DRef<const ushort16> in = getU16DataAsCroppedArray2DRef();
+  const Array2DRef<ushort16> out = img->getU16DataAsCroppedArray2DRef();
+  parallelFor(
+      0, planeHeight, int64_t(dim.y) * pitch,
+      [in, out, planeHeight, scale, &quad, &sub, &mul](int y) {
+        for (int p = 0; p < 4; p++) {
+          const int dx = quad[p] & 1;
+          const int sy = 2 * y + (quad[p] >> 1);
+          ushort16* dst = &out(0, p * planeHeight + y);
+          if (!scale) {
+            for (int x = 0; x < out.width; x++)
+              dst[x] = in(2 * x + dx, sy);
+            continue;
+          }
+          // One level and one multiplier for the whole row.
+          const int s = sub[p];
+          const int64_t m = mul[p];
+          for (int x = 0; x < out.width; x++) {
+            const int64_t v = (in(2 * x + dx, sy) - s) * m + 8192;
+            dst[x] = clampBits(static_cast<int>(v >> 14), 16);
+          }
+        }
+      });
+
+  return img;
+}
+
+void RawImageData::postProcess(int stages) {
+  bool lookup = (stages & STAGE_LOOKUP) && table != nullptr;
+  bool scale = (stages & STAGE_SCALE_BLACK_WHITE) && !isScaledOnWrite();
+  bool fix = stages & STAGE_FIX_BAD_PIXELS;
+
+  // If the levels are estimated or computed from the pixels, they must be
+  // looked up by then. And there are no float tables, so that just fails.
+  const bool levelsFromPixels =
+      whitePoint >= 65536 ||
+      (blackLevelSeparate[0] < 0 && (blackLevel < 0 || !blackAreas.empty()));
+  if (lookup && ((scale && levelsFromPixels) || dataType == TYPE_FLOAT32)) {
+    sixteenBitLookup();
+    lookup = false;
+  }
+
+  if (scale)
+    scale = setUpScaleBlackWhite();
+
+  if (fix) {
+    transferBadPixelsToMap();
+    fix = !mBadPixelsFixed && (mBadPixelMap || !mBadPixelList.empty());
+    mBadPixelsFixed = true;
+  }
+
+  const int remaining = (lookup ? STAGE_LOOKUP : 0) |
+                        (scale ? STAGE_SCALE_BLACK_WHITE : 0) |
+                        (fix ? STAGE_FIX_BAD_PIXELS : 0);
+
+  // If there is nothing to go through the rows for, they still are for the
+  // contentStats and the pyramid.
+  const bool byProducts = contentStats || pyramid;
+
+  if (!remaining) {
+    if (byProducts)
+      postProcessFused(0);
+    return;
+  }
+
+  makeWritable();
+
+  if (const auto backend = getPostProcessBackend()) {
+    if (backend->postProcess(this, remaining)) {
+      if (byProducts)
+        postProcessFused(0);
+      return;
+    }
+  }
+
+  const int numStages = static_cast<int>(lookup) + static_cast<int>(scale) +
+                        static_cast<int>(fix);
+  if (numStages < 2 && !byProducts) {
+    if (lookup)
+      startWorker(RawImageWorker::APPLY_LOOKUP, true);
+    if (scale)
+      startWorker(RawImageWorker::SCALE_VALUES, true);
+    if (fix)
+      startWorker(RawImageWorker::FIX_BAD_PIXELS, false);
+    return;
+  }
+
+  postProcessFused(remaining);
+}
+
+namespace {
+
+// Of n pixels, of the blocks of 2 * s of them, and then of the rest.
+int getBinnedSize(int n, int s) {
+  return s * (n / (2 * s)) + std::min(n % (2 * s), s);
+}
+
+template <typename Sum> Sum averageOf4(Sum sum);
+template <> int averageOf4(int sum) { return (sum + 2) >> 2; }
+template <> float averageOf4(float sum) { return sum * 0.25F; }
+
+} // namespace
+
+// Of the rows of a level of the pyramid, from the level above.
+class RawImageData::PyramidBinner final {
+  RawImageData* const src;
+  RawImageData* const dst;
+  const iPoint2D s;
+  // Of each pixel of a row, the two of the row above that it is of, or the
+  // same one twice if there is only one, in the elements of the rows.
+  std::vector<std::pair<int, int>> columns;
+
+  template <typename T, typename Sum> void binRowsOf(int start, int end) const {
+    const int cpp = src->getCpp();
+    const int height = src->getUncroppedDim().y;
+    for (int y = start; y < end; y++) {
+      const int y0 = 2 * s.y * (y / s.y) + y % s.y;
+      const int y1 = y0 + s.y < height ? y0 + s.y : y0;
+      const auto* r0 = reinterpret_cast<const T*>(src->getDataUncropped(0, y0));
+      const auto* r1 = reinterpret_cast<const T*>(src->getDataUncropped(0, y1));
+      auto* out = reinterpret_cast<T*>(dst->getDataUncropped(0, y));
+      for (const auto& c : columns) {
+        for (int i = 0; i < cpp; i++) {
+          const Sum sum = Sum(r0[c.first + i]) + r0[c.second + i] +
+                          r1[c.first + i] + r1[c.second + i];
+          *out++ = averageOf4(sum);
         }
       }
     }
   }
+
+public:
+  PyramidBinner(RawImageData* src_, RawImageData* dst_, const iPoint2D& s_)
+      : src(src_), dst(dst_), s(s_) {
+    const int width = src->getUncroppedDim().x;
+    const int cpp = src->getCpp();
+    columns.resize(dst->getUncroppedDim().x);
+    for (int x = 0; x < static_cast<int>(columns.size()); x++) {
+      const int x0 = 2 * s.x * (x / s.x) + x % s.x;
+      const int x1 = x0 + s.x < width ? x0 + s.x : x0;
+      columns[x] = {x0 * cpp, x1 * cpp};
+    }
+  }
+
+  // Of the rows of the level above, that each block of the rows of this one
+  // is of.
+  int getBlockRows() const { return 2 * s.y; }
+
+  void binRows(int start, int end) const {
+    if (src->getDataType() == TYPE_USHORT16)
+      binRowsOf<ushort16, int>(start, end);
+    else
+      binRowsOf<float, float>(start, end);
+  }
+
+  void binBlock(int block) const {
+    binRows(s.y * block, std::min(s.y * (block + 1), dst->getUncroppedDim().y));
+  }
+};
+
+void RawImageData::postProcessFused(int stages) {
+  if (contentStats)
+    startContentStats();
+
+  std::unique_ptr<PyramidBinner> binner;
+  if (pyramid) {
+    const iPoint2D s = cpp == 1 ? pyramid->cfaSize : iPoint2D(1, 1);
+    if (s.x < 1 || s.y < 1 || pyramid->levels < 1)
+      ThrowRDE("Invalid pyramid of %i levels, of the CFA of %ix%i",
+               pyramid->levels, s.x, s.y);
+    pyramid->images.clear();
+    iPoint2D levelDim = uncropped_dim;
+    for (int level = 0; level < pyramid->levels; level++) {
+      levelDim = {getBinnedSize(levelDim.x, s.x),
+                  getBinnedSize(levelDim.y, s.y)};
+      RawImage img = RawImage::create(dataType);
+      img->dim = levelDim;
+      img->setCpp(cpp);
+      img->isCFA = isCFA;
+      img->allocator = allocator;
+      img->createData();
+      pyramid->images.emplace_back(img);
+    }
+    binner = std::make_unique<PyramidBinner>(
+        this, pyramid->images.front().get(), s);
+  }
+  struct BinnerGuard final {
+    const PyramidBinner** const binner;
+    ~BinnerGuard() { *binner = nullptr; }
+  } binnerGuard{&mPyramidBinner};
+  mPyramidBinner = binner.get();
+
+  mPostProcessStages = stages;
+  startWorker(RawImageWorker::POST_PROCESS, false);
+
+  {
+    MutexLocker guard(&mBadPixelMutex);
+    if (!mDeferredBadPixels.empty()) {
+      // In the order of the rows, as the fixer likes them.
+      std::sort(mDeferredBadPixels.begin(), mDeferredBadPixels.end());
+      BadPixelFixer fixer(this);
+      for (BadPixelPosition pos : mDeferredBadPixels)
+        fixer.fix(getBadPixelX(pos), getBadPixelY(pos));
+    }
+    mDeferredBadPixels.clear();
+  }
+
+  if (contentStats)
+    finishContentStats();
+  if (pyramid)
+    finishPyramid();
+}
+
+void RawImageData::finishPyramid() {
+  {
+    // The blocks of the other threads' rows, and of the deferred bad pixels,
+    // which are fixed by now.
+    MutexLocker guard(&mBadPixelMutex);
+    std::sort(mPyramidBlocks.begin(), mPyramidBlocks.end());
+    mPyramidBlocks.erase(
+        std::unique(mPyramidBlocks.begin(), mPyramidBlocks.end()),
+        mPyramidBlocks.end());
+    for (int block : mPyramidBlocks)
+      mPyramidBinner->binBlock(block);
+    mPyramidBlocks.clear();
+  }
+
+  // Each of the rest of them of the one above, which is only a quarter of
+  // the size of that.
+  const iPoint2D s = cpp == 1 ? pyramid->cfaSize : iPoint2D(1, 1);
+  for (size_t level = 1; level < pyramid->images.size(); level++) {
+    RawImageData* src = pyramid->images[level - 1].get();
+    RawImageData* dst = pyramid->images[level].get();
+    const PyramidBinner binner(src, dst, s);
+    parallelForRange(0, dst->getUncroppedDim().y,
+                     int64_t(src->getUncroppedDim().y) * src->pitch,
+                     [&binner](int start, int end) {
+                       binner.binRows(start, end);
+                     });
+  }
+}
+
+struct RawImageData::ContentStatsPartial final {
+  struct Channel {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double sum = 0;
+    uint64 count = 0;
+    std::vector<uint64> histogram;
+  };
+  std::array<Channel, 4> channels;
+
+  explicit ContentStatsPartial(int bins) {
+    for (auto& c : channels)
+      c.histogram.resize(bins);
+  }
+};
+
+void RawImageData::startContentStats() {
+  if (contentStats->histogramBits < 1 || contentStats->histogramBits > 16)
+    ThrowRDE("Invalid histogram bits %i", contentStats->histogramBits);
+
+  ContentStats::Channel channel;
+  channel.histogram.resize(1UL << contentStats->histogramBits);
+  contentStats->channels.assign(cpp == 1 ? 4 : cpp, channel);
+  contentStats->lineHashes.assign(uncropped_dim.y, 0);
+  contentStats->hash = 0;
+
+  MutexLocker guard(&mBadPixelMutex);
+  mContentStatsRows.clear();
+}
+
+void RawImageData::accumulateContentStats(int y,
+                                          ContentStatsPartial* partial) {
+  const uchar8* row = getDataUncropped(0, y);
+  contentStats->lineHashes[y] =
+      xxh64::xxh64_hash(row, static_cast<size_t>(uncropped_dim.x) * bpp);
+
+  // The values of each of the channels of the row at a time, so the bins of
+  // the values are the only thing that is not in the registers.
+  const int bits = contentStats->histogramBits;
+  const int n = uncropped_dim.x * cpp;
+  const int step = cpp == 1 ? 2 : cpp;
+  const int firstChannel = cpp == 1 ? (y % 2) * 2 : 0;
+  const auto accumulate = [n, step, firstChannel, partial](const auto* values,
+                                                           const auto& bin) {
+    for (int k = 0; k < step && k < n; k++) {
+      auto& c = partial->channels[firstChannel + k];
+      auto min = values[k];
+      auto max = values[k];
+      double sum = 0;
+      for (int i = k; i < n; i += step) {
+        const auto v = values[i];
+        min = std::min(min, v);
+        max = std::max(max, v);
+        sum += v;
+        c.histogram[bin(v)]++;
+      }
+      c.min = std::min<double>(c.min, min);
+      c.max = std::max<double>(c.max, max);
+      c.sum += sum;
+      c.count += (n - k + step - 1) / step;
+    }
+  };
+
+  if (dataType == TYPE_USHORT16) {
+    const int shift = 16 - bits;
+    accumulate(reinterpret_cast<const ushort16*>(row),
+               [shift](ushort16 v) { return v >> shift; });
+  } else {
+    const int bins = 1 << bits;
+    accumulate(reinterpret_cast<const float*>(row), [bins](float v) {
+      return std::min(bins - 1,
+                      static_cast<int>(std::max(v, 0.0F) * bins));
+    });
+  }
+}
+
+void RawImageData::mergeContentStats(const ContentStatsPartial& partial) {
+  for (size_t i = 0; i < contentStats->channels.size(); i++) {
+    ContentStats::Channel& c = contentStats->channels[i];
+    const ContentStatsPartial::Channel& p = partial.channels[i];
+    if (!p.count)
+      continue;
+    c.min = c.count ? std::min(c.min, p.min) : p.min;
+    c.max = c.count ? std::max(c.max, p.max) : p.max;
+    c.sum += p.sum;
+    c.count += p.count;
+    for (size_t b = 0; b < c.histogram.size(); b++)
+      c.histogram[b] += p.histogram[b];
+  }
+}
+
+void RawImageData::finishContentStats() {
+  {
+    // The rows of the deferred bad pixels, which are fixed by now.
+    MutexLocker guard(&mBadPixelMutex);
+    std::sort(mContentStatsRows.begin(), mContentStatsRows.end());
+    mContentStatsRows.erase(
+        std::unique(mContentStatsRows.begin(), mContentStatsRows.end()),
+        mContentStatsRows.end());
+    if (!mContentStatsRows.empty()) {
+      ContentStatsPartial partial(1 << contentStats->histogramBits);
+      for (int y : mContentStatsRows)
+        accumulateContentStats(y, &partial);
+      mergeContentStats(partial);
+    }
+    mContentStatsRows.clear();
+  }
+
+  std::vector<uchar8> serialized(sizeof(uint64) *
+                                 contentStats->lineHashes.size());
+  for (size_t y = 0; y < contentStats->lineHashes.size(); y++) {
+    uint64 h = contentStats->lineHashes[y];
+    for (size_t k = 0; k < sizeof(h); k++, h >>= 8U)
+      serialized[sizeof(h) * y + k] = h & 0xFFU;
+  }
+  contentStats->hash = xxh64::xxh64_hash(serialized.data(), serialized.size());
+}
+
+void RawImageData::postProcessThread(int start_y, int end_y) {
+  const bool lookup = mPostProcessStages & STAGE_LOOKUP;
+  const bool scale = mPostProcessStages & STAGE_SCALE_BLACK_WHITE;
+  const bool fix = mPostProcessStages & STAGE_FIX_BAD_PIXELS;
+
+  // About the size of the L2 cache.
+  const int bandRows = std::max(1, static_cast<int>((128U << 10U) / pitch));
+
+  // The bad pixels go in row order, those that read the rows of the next
+  // bands wait for them, and those that read the rows of some other thread
+  // are left for after the pass.
+  std::vector<BadPixelPosition> pending;
+  std::vector<BadPixelPosition> deferred;
+  std::unique_ptr<BadPixelFixer> fixer;
+  if (fix)
+    fixer = std::make_unique<BadPixelFixer>(this);
+
+  // The rows go into the contentStats, and the blocks of them into the
+  // pyramid, once they are final: up to the first pending bad pixel, and
+  // except for those of the deferred ones. The blocks that are partly of
+  // another thread are left for after the pass too.
+  const bool trackRows = contentStats || mPyramidBinner;
+  std::unique_ptr<ContentStatsPartial> partial;
+  if (contentStats)
+    partial = std::make_unique<ContentStatsPartial>(
+        1 << contentStats->histogramBits);
+  int finalRow = start_y;
+  std::vector<int> deferredRows;
+  const int blockRows = mPyramidBinner ? mPyramidBinner->getBlockRows() : 1;
+  int block = roundUpDivision(start_y, blockRows);
+  std::vector<int> deferredBlocks;
+  if (mPyramidBinner && start_y % blockRows)
+    deferredBlocks.emplace_back(start_y / blockRows);
+  const auto finalUpTo = [this, end_y, &partial, &finalRow, &deferredRows,
+                          blockRows, &block, &deferredBlocks](int end) {
+    const auto isDeferred = [&deferredRows](int first, int last) {
+      return std::any_of(
+          deferredRows.begin(), deferredRows.end(),
+          [first, last](int y) { return y >= first && y < last; });
+    };
+    for (; finalRow < end; finalRow++) {
+      if (partial && !isDeferred(finalRow, finalRow + 1))
+        accumulateContentStats(finalRow, partial.get());
+    }
+    if (!mPyramidBinner)
+      return;
+    for (;; block++) {
+      const int first = block * blockRows;
+      const int last = std::min(first + blockRows, uncropped_dim.y);
+      if (first >= end_y || last > finalRow)
+        break;
+      if (isDeferred(first, last))
+        deferredBlocks.emplace_back(block);
+      else
+        mPyramidBinner->binBlock(block);
+    }
+  };
+
+  for (int band = start_y; band < end_y; band += bandRows) {
+    const int band_end = std::min(band + bandRows, end_y);
+
+    if (lookup)
+      doLookup(band, band_end);
+    if (scale) {
+      const int top = std::max(band - mOffset.y, 0);
+      const int bottom = std::min(band_end - mOffset.y, dim.y);
+      if (top < bottom)
+        scaleValues(top, bottom);
+    }
+
+    if (!fix) {
+      if (trackRows)
+        finalUpTo(band_end);
+      continue;
+    }
+
+    forEachBadPixel(band, band_end, [&pending](uint32 x, uint32 y) {
+      pending.emplace_back(getBadPixelPosition(x, y));
+    });
+
+    size_t kept = 0;
+    for (BadPixelPosition pos : pending) {
+      const uint32 x = getBadPixelX(pos);
+      const uint32 y = getBadPixelY(pos);
+      const auto rows = fixer->getRows(x, y);
+      if (rows.first < start_y || rows.second >= end_y) {
+        deferred.emplace_back(pos);
+        if (trackRows)
+          deferredRows.emplace_back(y);
+      } else if (rows.second >= band_end)
+        pending[kept++] = pos;
+      else
+        fixer->fix(x, y);
+    }
+    pending.resize(kept);
+
+    if (trackRows) {
+      int end = band_end;
+      for (BadPixelPosition pos : pending)
+        end = std::min(end, static_cast<int>(getBadPixelY(pos)));
+      finalUpTo(end);
+    }
+  }
+  assert(pending.empty());
+  // The one that is partly of the next thread.
+  if (mPyramidBinner && block * blockRows < end_y)
+    deferredBlocks.emplace_back(block);
+
+  if (!trackRows && deferred.empty())
+    return;
+
+  MutexLocker guard(&mBadPixelMutex);
+  mDeferredBadPixels.insert(mDeferredBadPixels.end(), deferred.begin(),
+                            deferred.end());
+  if (partial) {
+    mergeContentStats(*partial);
+    mContentStatsRows.insert(mContentStatsRows.end(), deferredRows.begin(),
+                             deferredRows.end());
+  }
+  mPyramidBlocks.insert(mPyramidBlocks.end(), deferredBlocks.begin(),
+                        deferredBlocks.end());
 }
 
 void RawImageData::blitFrom(const RawImage& src, const iPoint2D& srcPos,
@@ -443,55 +1356,73 @@ void RawImageData::blitFrom(const RawImage& src, const iPoint2D& srcPos,
   if (blitsize.area() <= 0)
     return;
 
+  makeWritable();
+
   // TODO: Move offsets after crop.
-  copyPixels(getData(dest_rect.pos.x, dest_rect.pos.y), pitch,
-             src->getData(src_rect.pos.x, src_rect.pos.y), src->pitch,
-             blitsize.x * bpp, blitsize.y);
+  uchar8* dest = getData(dest_rect.pos.x, dest_rect.pos.y);
+  const uchar8* in = src->getData(src_rect.pos.x, src_rect.pos.y);
+  const size_t rowSize = static_cast<size_t>(blitsize.x) * bpp;
+  forEachRow(0, blitsize.y, rowSize,
+             [this, dest, in, &src, rowSize](int y, bool nonTemporal) {
+               copyRow(dest + static_cast<size_t>(y) * pitch,
+                       in + static_cast<size_t>(y) * src->pitch, rowSize,
+                       nonTemporal);
+             });
 }
 
 /* Does not take cfa into consideration */
 void RawImageData::expandBorder(iRectangle2D validData)
 {
   validData = validData.getOverlap(iRectangle2D(0,0,dim.x, dim.y));
+  makeWritable();
+
+  // The left and the right of the rows of the valid data first, then whole
+  // rows above and below it are copies of its first and last ones.
+  const size_t rowSize = static_cast<size_t>(dim.x) * bpp;
+  if (validData.pos.x > 0 || validData.getRight() < dim.x) {
+    forEachRow(validData.getTop(), validData.getBottom(), rowSize,
+               [this, &validData](int y, bool /*nonTemporal*/) {
+                 expandBorderOfRow(validData, y);
+               });
+  }
+
+  if (validData.pos.y > 0) {
+    const uchar8* src_pos = getData(0, validData.pos.y);
+    forEachRow(0, validData.pos.y, rowSize,
+               [this, src_pos, rowSize](int y, bool nonTemporal) {
+                 copyRow(getData(0, y), src_pos, rowSize, nonTemporal);
+               });
+  }
+  if (validData.getBottom() < dim.y) {
+    const uchar8* src_pos = getData(0, validData.getBottom() - 1);
+    forEachRow(validData.getBottom(), dim.y, rowSize,
+               [this, src_pos, rowSize](int y, bool nonTemporal) {
+                 copyRow(getData(0, y), src_pos, rowSize, nonTemporal);
+               });
+  }
+}
+
+void RawImageData::expandBorderOfRow(const iRectangle2D& validData, int y) {
   if (validData.pos.x > 0) {
-    for (int y = 0; y < dim.y; y++ ) {
-      uchar8* src_pos = getData(validData.pos.x, y);
-      uchar8* dst_pos = getData(validData.pos.x-1, y);
-      for (int x = validData.pos.x; x >= 0; x--) {
-        for (uint32 i = 0; i < bpp; i++) {
-          dst_pos[i] = src_pos[i];
-        }
-        dst_pos -= bpp;
+    uchar8* src_pos = getData(validData.pos.x, y);
+    uchar8* dst_pos = getData(validData.pos.x - 1, y);
+    for (int x = validData.pos.x; x > 0; x--) {
+      for (uint32 i = 0; i < bpp; i++) {
+        dst_pos[i] = src_pos[i];
       }
+      dst_pos -= bpp;
     }
   }
 
   if (validData.getRight() < dim.x) {
     int pos = validData.getRight();
-    for (int y = 0; y < dim.y; y++ ) {
-      uchar8* src_pos = getData(pos-1, y);
-      uchar8* dst_pos = getData(pos, y);
-      for (int x = pos; x < dim.x; x++) {
-        for (uint32 i = 0; i < bpp; i++) {
-          dst_pos[i] = src_pos[i];
-        }
-        dst_pos += bpp;
+    uchar8* src_pos = getData(pos - 1, y);
+    uchar8* dst_pos = getData(pos, y);
+    for (int x = pos; x < dim.x; x++) {
+      for (uint32 i = 0; i < bpp; i++) {
+        dst_pos[i] = src_pos[i];
       }
-    }
-  }
-
-  if (validData.pos.y > 0) {
-    uchar8* src_pos = getData(0, validData.pos.y);
-    for (int y = 0; y < validData.pos.y; y++ ) {
-      uchar8* dst_pos = getData(0, y);
-      memcpy(dst_pos, src_pos, static_cast<size_t>(dim.x) * bpp);
-    }
-  }
-  if (validData.getBottom() < dim.y) {
-    uchar8* src_pos = getData(0, validData.getBottom()-1);
-    for (int y = validData.getBottom(); y < dim.y; y++ ) {
-      uchar8* dst_pos = getData(0, y);
-      memcpy(dst_pos, src_pos, static_cast<size_t>(dim.x) * bpp);
+      dst_pos += bpp;
     }
   }
 }
@@ -503,9 +1434,17 @@ void RawImageData::clearArea( iRectangle2D area, uchar8 val /*= 0*/ )
   if (area.area() <= 0)
     return;
 
-  for (int y = area.getTop(); y < area.getBottom(); y++)
-    memset(getData(area.getLeft(), y), val,
-           static_cast<size_t>(area.getWidth()) * bpp);
+  makeWritable();
+
+  const size_t rowSize = static_cast<size_t>(area.getWidth()) * bpp;
+  forEachRow(area.getTop(), area.getBottom(), rowSize,
+             [this, &area, val, rowSize](int y, bool nonTemporal) {
+               uchar8* dest = getData(area.getLeft(), y);
+               if (nonTemporal)
+                 fillNonTemporal(dest, val, rowSize);
+               else
+                 memset(dest, val, rowSize);
+             });
 }
 
 RawImage& RawImage::operator=(RawImage&& rhs) noexcept {
@@ -537,15 +1476,26 @@ void RawImageWorker::performTask() noexcept {
   try {
     switch(task)
     {
-    case SCALE_VALUES:
+    case SCALE_VALUES: {
+      RAWSPEED_TRACE_SCOPE("image", "scaleValues");
       data->scaleValues(start_y, end_y);
       break;
-    case FIX_BAD_PIXELS:
+    }
+    case FIX_BAD_PIXELS: {
+      RAWSPEED_TRACE_SCOPE("image", "fixBadPixels");
       data->fixBadPixelsThread(start_y, end_y);
       break;
-    case APPLY_LOOKUP:
+    }
+    case APPLY_LOOKUP: {
+      RAWSPEED_TRACE_SCOPE("image", "lookup");
       data->doLookup(start_y, end_y);
       break;
+    }
+    case POST_PROCESS: {
+      RAWSPEED_TRACE_SCOPE("image", "postProcess");
+      data->postProcessThread(start_y, end_y);
+      break;
+    }
     default:
       assert(false);
     }
@@ -562,6 +1512,7 @@ void RawImageData::sixteenBitLookup() {
   if (table == nullptr) {
     return;
   }
+  makeWritable();
   startWorker(RawImageWorker::APPLY_LOOKUP, true);
 }
 
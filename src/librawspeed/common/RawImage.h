@@ -22,30 +22,101 @@
 
 #include "rawspeedconfig.h"
 #include "ThreadSafetyAnalysis.h"      // for GUARDED_BY, REQUIRES
+#include "common/Array2DRef.h"         // for Array2DRef
+#include "common/Cancellation.h"       // for Cancellation
 #include "common/Common.h"             // for uint32, uchar8, ushort16, wri...
 #include "common/ErrorLog.h"           // for ErrorLog
+#include "common/FujiRotation.h"       // for FujiRotation
+#include "common/InternedString.h"     // for InternedString
 #include "common/Mutex.h"              // for Mutex
+#include "common/Optional.h"           // for Optional
 #include "common/Point.h"              // for iPoint2D, iRectangle2D (ptr o...
 #include "common/TableLookUp.h"        // for TableLookUp
 #include "metadata/BlackArea.h"        // for BlackArea
 #include "metadata/ColorFilterArray.h" // for ColorFilterArray
+#include <algorithm>                   // for binary_search
 #include <array>                       // for array
-#include <memory>                      // for unique_ptr, operator==
+#include <atomic>                      // for atomic
+#include <cstddef>                     // for size_t
+#include <functional>                  // for function
+#include <memory>                      // for unique_ptr, shared_ptr, ope...
 #include <string>                      // for string
 #include <vector>                      // for vector
 
 namespace rawspeed {
 
+class DeviceImage;
+
+class ImageAllocator;
+
+struct ImagePyramid;
+
 class RawImage;
 
+class ScratchArena;
+
 class RawImageData;
 
 enum RawImageType { TYPE_USHORT16, TYPE_FLOAT32 };
 
+// How the decompressors store the values that they decode, see
+// RawImageData::getPixelStore(): through the lookup table, if there is one,
+// as setWithLookUp() does, and then, if the levels were known before the
+// decoding, with them applied, as scaleBlackWhite() would do afterwards.
+class PixelStore final {
+  const TableLookUp* table = nullptr;
+  bool scale = false;
+  bool dither = false;
+  // Of the CFA positions of the uncropped image, as in scaleValues_plain().
+  std::array<int, 4> sub{{}};
+  std::array<int, 4> mul{{}};
+  int fullScale = 0;
+  int halfScale = 0;
+
+  friend class RawImageData;
+
+public:
+  // Whether get() applies the levels, and not just the table, if any.
+  bool isScaled() const { return scale; }
+
+  // Of the pixel (x, y) of the uncropped image. random is the state of the
+  // dithering, as for setWithLookUp().
+  ushort16 get(uint32 x, uint32 y, ushort16 value, uint32* random) const {
+    if (table)
+      value = table->dither ? table->lookUpDithered(value, random)
+                            : table->tables[value];
+    if (!scale)
+      return value;
+
+    const int i = (x & 1) | ((y & 1) << 1);
+    int rand = 0;
+    if (dither) {
+      *random = TableLookUp::nextRandom(*random);
+      rand = halfScale - fullScale * static_cast<int>(*random & 2047);
+    }
+    return clampBits(((value - sub[i]) * mul[i] + 8192 + rand) >> 14, 16);
+  }
+};
+
+// The position of a bad pixel: the row in the upper 32 bits, and the column
+// in the lower ones, so that the positions sort row by row.
+using BadPixelPosition = uint64;
+
+inline BadPixelPosition getBadPixelPosition(uint32 x, uint32 y) {
+  return static_cast<uint64>(y) << 32 | x;
+}
+
+inline uint32 getBadPixelX(BadPixelPosition pos) {
+  return static_cast<uint32>(pos);
+}
+
+inline uint32 getBadPixelY(BadPixelPosition pos) { return pos >> 32; }
+
 class RawImageWorker {
 public:
   enum RawImageWorkerTask {
-    SCALE_VALUES = 1, FIX_BAD_PIXELS = 2, APPLY_LOOKUP = 3 | 0x1000, FULL_IMAGE = 0x1000
+    SCALE_VALUES = 1, FIX_BAD_PIXELS = 2, APPLY_LOOKUP = 3 | 0x1000,
+    POST_PROCESS = 4 | 0x1000, FULL_IMAGE = 0x1000
   };
 
 private:
@@ -77,15 +148,21 @@ public:
   // corners are when the image is rotated 45 degrees in Fuji rotated sensors.
   uint32 fujiRotationPos;
 
+  // If the rotation was deferred, see RawDecoder::deferFujiRotation, the
+  // image is still the unrotated one, and this is how to rotate it.
+  Optional<FujiRotation> fujiRotation;
+
   iPoint2D subsampling;
-  std::string make;
-  std::string model;
-  std::string mode;
+  // Of the pool, see InternedString, so that setting them from those of the
+  // Camera does not allocate.
+  InternedString make;
+  InternedString model;
+  InternedString mode;
 
-  std::string canonical_make;
-  std::string canonical_model;
-  std::string canonical_alias;
-  std::string canonical_id;
+  InternedString canonical_make;
+  InternedString canonical_model;
+  InternedString canonical_alias;
+  InternedString canonical_id;
 
   // ISO speed. If known the value is set, otherwise it will be '0'.
   int isoSpeed;
@@ -98,6 +175,7 @@ public:
   uint32 getCpp() const { return cpp; }
   uint32 getBpp() const { return bpp; }
   void setCpp(uint32 val);
+  // Allocates the pixels for the dim, or uses the externalData, if set.
   void createData();
   void poisonPadding();
   void unpoisonPadding();
@@ -107,6 +185,13 @@ public:
   void blitFrom(const RawImage& src, const iPoint2D& srcPos,
                 const iPoint2D& size, const iPoint2D& destPos);
   rawspeed::RawImageType getDataType() const { return dataType; }
+  // The pixels, cpp elements each, of the whole allocation or of the crop.
+  Array2DRef<ushort16> getU16DataAsUncroppedArray2DRef() const;
+  Array2DRef<ushort16> getU16DataAsCroppedArray2DRef() const;
+  Array2DRef<float> getF32DataAsUncroppedArray2DRef() const;
+  Array2DRef<float> getF32DataAsCroppedArray2DRef() const;
+  // Whether the pixels are those of another image, see RawImage::createView().
+  bool isView() const { return mParent != nullptr; }
   uchar8* getData() const;
   uchar8* getData(uint32 x, uint32 y);    // Not super fast, but safe. Don't use per pixel.
   uchar8* getDataUncropped(uint32 x, uint32 y);
@@ -114,18 +199,208 @@ public:
   void clearArea(iRectangle2D area, uchar8 value = 0);
   iPoint2D __attribute__((pure)) getUncroppedDim() const;
   iPoint2D __attribute__((pure)) getCropOffset() const;
-  virtual void scaleBlackWhite() = 0;
+  void scaleBlackWhite();
+  // Instead of scaleBlackWhite(), for the thumbnails: a new image of half of
+  // the size, each 2x2 CFA quad of this one being averaged, per color, into
+  // one R, G, B pixel, with the black and the white levels applied in the
+  // same pass. Only for the 16-bit images with a 2x2 R, G, B CFA.
+  RawImage binHalfSize();
+  // The 2x2 CFA quads of this image split into its planes, R, G1, G2 and B,
+  // the two greens in the order of the quad: one image of half of the width
+  // and twice the height, one plane of a half of the height under the other,
+  // so each one can be processed with one black level. If scale, the black
+  // and the white levels are applied in the same pass, as scaleBlackWhite()
+  // would, but without the dither. Only for the 16-bit images with a 2x2
+  // R, G, G, B CFA.
+  RawImage splitCFAPlanes(bool scale = true);
+  // Instead of scaleBlackWhite(), for the pipelines that take floats: the
+  // pixels of the crop with the black and the white levels applied, as the
+  // IEEE half floats of 0 to 1, into out, of dim.x * cpp of them per row.
+  // This image is not changed. There is no dither, the floats do not band.
+  virtual void scaleToHalfFloat(const Array2DRef<ushort16>& out) = 0;
   virtual void calculateBlackAreas() = 0;
   virtual void setWithLookUp(ushort16 value, uchar8* dst, uint32* random) = 0;
   void sixteenBitLookup();
+  // Adds the positions, in the format of mBadPixelPositions, all at once,
+  // e.g. the ones that a thread has collected while decoding.
+  void addBadPixels(const std::vector<BadPixelPosition>& positions)
+      REQUIRES(!mBadPixelMutex);
   void transferBadPixelsToMap() REQUIRES(!mBadPixelMutex);
   void fixBadPixels() REQUIRES(!mBadPixelMutex);
+
+  // The stages that may follow the decoding, see postProcess().
+  enum PostProcessStage {
+    STAGE_LOOKUP = 1,            // sixteenBitLookup()
+    STAGE_SCALE_BLACK_WHITE = 2, // scaleBlackWhite()
+    STAGE_FIX_BAD_PIXELS = 4,    // fixBadPixels()
+  };
+  // Same as calling the functions of the given stages, in the order above,
+  // but instead of a pass over the whole image for each one of them, every
+  // band of rows goes through all of them while it is still in the cache.
+  void postProcess(int stages) REQUIRES(!mBadPixelMutex);
   void expandBorder(iRectangle2D validData);
   void setTable(const std::vector<ushort16>& table_, bool dither);
   void setTable(std::unique_ptr<TableLookUp> t);
+  const TableLookUp* getTable() const { return table.get(); }
+
+  // The black and the white levels, in the layout of blackLevelSeparate and
+  // whitePoint, if they are known before the decoding, e.g. from the
+  // CameraSensorInfo. The decompressors that store their pixels with
+  // getPixelStore() then apply them right away, and there is no pass of
+  // scaleBlackWhite() after the decoding.
+  struct Levels {
+    std::array<int, 4> black;
+    int white;
+  };
+  Optional<Levels> scaleOnWrite;
+
+  // For a decompressor to store the pixels of the image with. If it applies
+  // the scaleOnWrite levels, the whole image is taken to have them, so a
+  // decoder must not mix such decompressors with others.
+  PixelStore getPixelStore();
+
+  // Whether the pixels got the scaleOnWrite levels. Then the levels of the
+  // image are reset to those of the scaled pixels, by finishScaleOnWrite(),
+  // after the decoding, and again after the metadata, which sets them too.
+  bool isScaledOnWrite() const {
+    return mScaledOnWrite.load(std::memory_order_relaxed);
+  }
+  void finishScaleOnWrite();
+
+  // If a PostProcessBackend did the postProcess(), its result.
+  std::shared_ptr<DeviceImage> deviceImage;
+
+  // Called by the decompressors as soon as an area of the image has its final
+  // decoded values, e.g. for a tile, or for a row of an in-order stream, so
+  // that it can be consumed before the whole image is done. In the uncropped
+  // coordinates, before any of the post-processing. It may be called from
+  // several threads at once and in any order, and it is never called for the
+  // areas that failed to decode, so it is not guaranteed to cover the image.
+  using AreaReadyCallback = std::function<void(const iRectangle2D& area)>;
+  AreaReadyCallback areaReady;
+  void notifyAreaReady(const iRectangle2D& area) const {
+    if (decodeCounters)
+      decodeCounters->areas.fetch_add(1, std::memory_order_relaxed);
+    if (areaReady)
+      areaReady(area);
+  }
+
+  // What the decompressors count while decoding, if it is set, for the
+  // RawDecoder::DecodeStats. From any of the threads.
+  struct DecodeCounters {
+    std::atomic<uint32> areas{0}; // As reported to areaReady.
+    // Set up for this decode, or found in the cache of the set up ones.
+    std::atomic<uint32> huffmanTables{0};
+    std::atomic<uint32> huffmanTablesBuilt{0}; // Of those, the set up ones.
+  };
+  DecodeCounters* decodeCounters = nullptr;
+
+  // Of the pixels of the uncropped image, e.g. for the auto-exposure, and
+  // for telling the duplicates apart, see RawDecoder::contentStats. If it is
+  // set, postProcess() computes them as it goes through the bands of rows,
+  // while they are in the cache, or in a pass of its own if it has nothing
+  // else to do.
+  struct ContentStats {
+    // The histograms are of the values >> (16 - histogramBits), or of the
+    // float ones, in [0, 1], in as many bins. Set before the decoding.
+    int histogramBits = 10;
+
+    // For the images of one component, the four positions of the 2x2 CFA,
+    // (y % 2) * 2 + x % 2, in the uncropped coordinates, as the colors of
+    // the CFA are not known until the metadata is. Otherwise, the
+    // components.
+    struct Channel {
+      double min = 0;
+      double max = 0;
+      double sum = 0;
+      uint64 count = 0;
+      std::vector<uint64> histogram;
+
+      double getMean() const { return count ? sum / count : 0; }
+    };
+    std::vector<Channel> channels;
+
+    // The XXH64 of each of the rows, and of all of them, little-endian,
+    // which is rstest's "xxh64 of per-line xxh64s".
+    std::vector<uint64> lineHashes;
+    uint64 hash = 0;
+  };
+  ContentStats* contentStats = nullptr;
+
+  // If set, postProcess() bins the first level of it of each band of rows as
+  // it goes through them, while they are in the cache, and the rest of the
+  // levels from that one, see ImagePyramid.
+  ImagePyramid* pyramid = nullptr;
+
+  // If set and cancelled, the decompressors stop between their slices, tiles
+  // or strips, and the decoding fails.
+  std::shared_ptr<const Cancellation> cancellation;
+  bool isCancelled() const { return cancellation && cancellation->isCancelled(); }
+  // Throws if isCancelled().
+  void checkCancelled() const;
+
+  // The memory to decode into instead of the allocated one, e.g. pinned or
+  // shared memory, or a part of a larger buffer, so that the pixels do not
+  // have to be copied out of the image afterwards. It has to be aligned, and
+  // large enough for all the rows of the image. It is not owned by the image,
+  // and must outlive its data. With a pitch of 0, the default one is used.
+  struct ExternalData {
+    uchar8* data = nullptr;
+    size_t size = 0;
+    uint32 pitch = 0;
+
+    explicit operator bool() const { return data != nullptr; }
+  };
+  ExternalData externalData;
+
+  // If set, the pixels are allocated from it instead of getImageAllocator(),
+  // e.g. a BudgetImageAllocator of just this decode.
+  std::shared_ptr<ImageAllocator> allocator;
+
+  // If set, the temporary buffers of the decompressors, and of the
+  // post-processing, come from it, see RawDecoder::scratchArena. Otherwise,
+  // from the heap.
+  std::shared_ptr<ScratchArena> scratch;
+
+  // What createData() may allocate, see RawDecoder::maxPixels and
+  // RawDecoder::maxImageBytes. Zero is no limit.
+  uint64 maxPixels = 0;
+  uint64 maxBytes = 0;
+
+  // For the decoders, before the createData(): the image is to be decoded
+  // from at most inputBytes of the compressed data, of which the
+  // decompressor needs at least minBitsPerPixel for each of the pixels. If
+  // there are not enough of them for the dimensions, which then must be
+  // bogus, createData() fails right away, instead of allocating the image,
+  // and decoding the few bytes into it, with the rest being the padding.
+  // E.g. the MinBitsPerPixel of the decompressor, or the bits per sample of
+  // the uncompressed data.
+  void expectInput(uint64 inputBytes, uint32 minBitsPerPixel);
+
+  // If set, the uncompressed pixels that are already in the layout of the
+  // image, e.g. the 16-bit little-endian ones of a single strip, are not
+  // copied: the image just points at the input, see aliasData(). The input,
+  // e.g. the mapped file, must then outlive the pixels, or makeWritable()
+  // be called before it goes.
+  bool aliasInput = false;
+
+  // For the decompressors: if aliasInput is set, makes the pixels of the
+  // image, which must be allocated and not cropped yet, those of the input,
+  // every row of which starts inPitch bytes after the previous one. They
+  // have to be aligned as the image would have them. Returns whether it did,
+  // else the pixels are to be copied as usual.
+  bool aliasData(const uchar8* in, uint32 inPitch);
+  // Whether the pixels are still those of the input, see aliasData(). They
+  // must not be written to then. All of the passes of the library that do,
+  // e.g. scaleBlackWhite() or the DNG opcodes, call makeWritable() first,
+  // and so must anyone else who writes to them.
+  bool isReadOnly() const { return mReadOnly; }
+  // If isReadOnly(), copies the pixels into an allocation of the image.
+  void makeWritable();
 
   bool isAllocated() {return !!data;}
   void createBadPixelMap();
+  bool __attribute__((pure)) isBadPixel(uint32 x, uint32 y) const;
   iPoint2D dim;
   uint32 pitch = 0;
 
@@ -141,11 +416,16 @@ public:
   std::vector<BlackArea> blackAreas;
 
   /* Vector containing the positions of bad pixels */
-  /* Format is x | (y << 16), so maximum pixel position is 65535 */
   // Positions of zeroes that must be interpolated
-  std::vector<uint32> mBadPixelPositions GUARDED_BY(mBadPixelMutex);
+  std::vector<BadPixelPosition> mBadPixelPositions GUARDED_BY(mBadPixelMutex);
+  // The transferred ones. While there are only a few of them, they are kept
+  // sorted (thus row by row) and unique, and there is no mBadPixelMap.
+  // Once there are too many, they all move into it.
+  std::vector<BadPixelPosition> mBadPixelList;
   uchar8* mBadPixelMap = nullptr;
   uint32 mBadPixelMapPitch = 0;
+  // Whether all the transferred ones were fixed already.
+  bool mBadPixelsFixed = false;
   bool mDitherScale =
       true; // Should upscaling be done with dither to minimize banding?
   ImageMetaData metadata;
@@ -154,7 +434,51 @@ public:
                         // than 1 thread is accessing vector
 
 private:
-  uint32 dataRefCount GUARDED_BY(mymutex) = 0;
+  // Of the handles, which get copied between the threads all the time.
+  std::atomic<uint32> dataRefCount{0};
+  // See getPixelStore().
+  std::atomic<bool> mScaledOnWrite{false};
+
+  // The image that owns the pixels, if this is just a view of them.
+  std::unique_ptr<RawImage> mParent;
+
+  // Where the pixels came from, and how many bytes of them there are.
+  std::shared_ptr<ImageAllocator> mAllocator;
+  size_t mAllocationSize = 0;
+  // As given to expectInput().
+  uint64 expectedInputBytes = 0;
+  uint32 expectedMinBitsPerPixel = 0;
+  // See aliasData().
+  bool mReadOnly = false;
+
+  template <typename T> Array2DRef<T> getDataAsArray2DRef(bool cropped) const;
+
+  // The bad pixels that postProcessThread() left for after the pass, because
+  // fixing them reads the rows of another thread.
+  std::vector<BadPixelPosition> mDeferredBadPixels GUARDED_BY(mBadPixelMutex);
+  int mPostProcessStages = 0;
+
+  // The per-thread ones of the contentStats, and the rows of those bad
+  // pixels, that are only final after the pass.
+  struct ContentStatsPartial;
+  std::vector<int> mContentStatsRows GUARDED_BY(mBadPixelMutex);
+  void startContentStats();
+  void accumulateContentStats(int y, ContentStatsPartial* partial);
+  void mergeContentStats(const ContentStatsPartial& partial)
+      REQUIRES(mBadPixelMutex);
+  void finishContentStats() REQUIRES(!mBadPixelMutex);
+
+  // The binning of the first level of the pyramid, and the blocks of rows of
+  // it that postProcessThread() left for after the pass, e.g. as they are
+  // partly of another thread.
+  class PyramidBinner;
+  const PyramidBinner* mPyramidBinner = nullptr;
+  std::vector<int> mPyramidBlocks GUARDED_BY(mBadPixelMutex);
+  void finishPyramid() REQUIRES(!mBadPixelMutex);
+
+  // The pass of postProcessThread(), of these stages, and of the
+  // contentStats and the pyramid.
+  void postProcessFused(int stages) REQUIRES(!mBadPixelMutex);
 
 protected:
   RawImageType dataType;
@@ -162,8 +486,14 @@ protected:
   RawImageData(const iPoint2D &dim, uint32 bpp, uint32 cpp = 1);
   virtual void scaleValues(int start_y, int end_y) = 0;
   virtual void doLookup(int start_y, int end_y) = 0;
-  virtual void fixBadPixel( uint32 x, uint32 y, int component = 0) = 0;
+  // Computes the black and the white levels, if they are not known yet.
+  // Returns whether the values need scaling at all.
+  virtual bool setUpScaleBlackWhite() = 0;
+  template <typename F>
+  void forEachBadPixel(int start_y, int end_y, F f) const;
   void fixBadPixelsThread(int start_y, int end_y);
+  void postProcessThread(int start_y, int end_y) REQUIRES(!mBadPixelMutex);
+  void expandBorderOfRow(const iRectangle2D& validData, int y);
   void startWorker(RawImageWorker::RawImageWorkerTask task, bool cropped );
   uchar8* data = nullptr;
   uint32 cpp = 1; // Components per pixel
@@ -172,22 +502,30 @@ protected:
   iPoint2D mOffset;
   iPoint2D uncropped_dim;
   std::unique_ptr<TableLookUp> table;
-  Mutex mymutex;
 };
 
 class RawImageDataU16 final : public RawImageData {
 public:
-  void scaleBlackWhite() override;
   void calculateBlackAreas() override;
   void setWithLookUp(ushort16 value, uchar8* dst, uint32* random) override;
+  void scaleToHalfFloat(const Array2DRef<ushort16>& out) override;
 
 protected:
   void scaleValues_plain(int start_y, int end_y);
-#ifdef WITH_SSE2
-  void scaleValues_SSE2(int start_y, int end_y);
+#if defined(WITH_SSE2) || defined(WITH_NEON)
+  // Scales one whole row, including the padding, in blocks of 8 pixels.
+  // random is the initial state of the dithering, or nullptr for none.
+  using ScaleRowFunction = void (*)(ushort16* row, uint32 numBlocks,
+                                    uint32 sub, uint32 mul,
+                                    const std::array<uint32, 4>* random,
+                                    int full_scale_fp, int half_scale_fp);
+
+  // The SIMD versions only differ in the function that does the rows,
+  // and all produce the same result.
+  void scaleValues_SIMD(int start_y, int end_y, ScaleRowFunction scaleRow);
 #endif
+  bool setUpScaleBlackWhite() override;
   void scaleValues(int start_y, int end_y) override;
-  void fixBadPixel(uint32 x, uint32 y, int component = 0) override;
   void doLookup(int start_y, int end_y) override;
 
   RawImageDataU16();
@@ -197,13 +535,13 @@ protected:
 
 class RawImageDataFloat final : public RawImageData {
 public:
-  void scaleBlackWhite() override;
   void calculateBlackAreas() override;
   void setWithLookUp(ushort16 value, uchar8 *dst, uint32 *random) override;
+  void scaleToHalfFloat(const Array2DRef<ushort16>& out) override;
 
 protected:
+  bool setUpScaleBlackWhite() override;
   void scaleValues(int start_y, int end_y) override;
-  void fixBadPixel(uint32 x, uint32 y, int component = 0) override;
   [[noreturn]] void doLookup(int start_y, int end_y) override;
   RawImageDataFloat();
   explicit RawImageDataFloat(const iPoint2D& dim_, uint32 cpp_ = 1);
@@ -216,6 +554,16 @@ protected:
    static RawImage create(const iPoint2D &dim,
                           RawImageType type = TYPE_USHORT16,
                           uint32 componentsPerPixel = 1);
+   // Same, but the pixels are those of the external data.
+   static RawImage create(const iPoint2D& dim, RawImageType type,
+                          uint32 componentsPerPixel,
+                          const RawImageData::ExternalData& externalData);
+   // An image of just the area of the (cropped) parent, without a copy: the
+   // pixels are shared, and the parent is kept alive as long as the view is.
+   // The CFA, the levels and the metadata are those of the parent. If the
+   // parent isReadOnly(), it is made writable first.
+   static RawImage createView(const RawImage& parent,
+                              const iRectangle2D& area);
    RawImageData* operator->() const { return p_; }
    RawImageData& operator*() const { return *p_; }
    explicit RawImage(RawImageData* p); // p must not be NULL
@@ -229,6 +577,24 @@ protected:
    RawImageData* p_;    // p_ is never NULL
  };
 
+// The levels of 1/2, 1/4, ... of the size of an image, e.g. for the tiles of
+// the zoomed out views. Each pixel of a level is the average of the 2x2
+// pixels of the same position in the CFA of the level above, so the levels
+// are mosaics of the same CFA, at the same origin. They are of the uncropped
+// image: the crop of a level is that of the image, divided by its scale.
+struct ImagePyramid final {
+  int levels = 3;
+
+  // The CFA is usually only known once the metadata is, so it is given
+  // here: 2x2 for Bayer, 6x6 for X-Trans, 1x1 if there is none. Always 1x1
+  // for the images of more than one component.
+  iPoint2D cfaSize{2, 2};
+
+  // Of the 1/2, 1/4, ... of the size, and of the type and the components of
+  // the image.
+  std::vector<RawImage> images;
+};
+
 inline RawImage RawImage::create(RawImageType type)  {
   switch (type)
   {
@@ -255,9 +621,32 @@ inline RawImage RawImage::create(const iPoint2D& dim, RawImageType type, uint32
   }
 }
 
+inline RawImage
+RawImage::create(const iPoint2D& dim, RawImageType type,
+                 uint32 componentsPerPixel,
+                 const RawImageData::ExternalData& externalData) {
+  RawImage img = create(type);
+  img->dim = dim;
+  img->setCpp(componentsPerPixel);
+  img->isCFA = componentsPerPixel == 1;
+  img->externalData = externalData;
+  img->createData();
+  return img;
+}
+
 // setWithLookUp will set a single pixel by using the lookup table if supplied,
 // You must supply the destination where the value should be written, and a pointer to
 // a value that will be used to store a random counter that can be reused between calls.
+inline bool RawImageData::isBadPixel(uint32 x, uint32 y) const {
+  if (mBadPixelMap)
+    return (mBadPixelMap[static_cast<size_t>(y) * mBadPixelMapPitch +
+                         (x >> 3)] >>
+            (x & 7)) &
+           1;
+  return std::binary_search(mBadPixelList.begin(), mBadPixelList.end(),
+                            getBadPixelPosition(x, y));
+}
+
 // this needs to be inline to speed up tight decompressor loops
 inline void RawImageDataU16::setWithLookUp(ushort16 value, uchar8* dst, uint32* random) {
   auto* dest = reinterpret_cast<ushort16*>(dst);
@@ -266,15 +655,7 @@ inline void RawImageDataU16::setWithLookUp(ushort16 value, uchar8* dst, uint32*
     return;
   }
   if (table->dither) {
-    auto* t = reinterpret_cast<const uint32*>(table->tables.data());
-    uint32 lookup = t[value];
-    uint32 base = lookup & 0xffff;
-    uint32 delta = lookup >> 16;
-    uint32 r = *random;
-
-    uint32 pix = base + ((delta * (r&2047) + 1024) >> 12);
-    *random = 15700 *(r & 65535) + (r >> 16);
-    *dest = pix;
+    *dest = table->lookUpDithered(value, random);
     return;
   }
   *dest = table->tables[value];
@@ -0,0 +1,415 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/RawImageCache.h"
+#include "common/Common.h"                // for uint32, uchar8, ushort16
+#include "common/Executor.h"              // for parallelFor
+#include "common/FujiRotation.h"          // for FujiRotation
+#include "common/Mutex.h"                 // for MutexLocker
+#include "common/Point.h"                 // for iPoint2D, iRectangle2D
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "io/Buffer.h"                    // for Buffer, DataBuffer
+#include "io/ByteStream.h"                // for ByteStream
+#include "io/Endianness.h"                // for Endianness
+#include "io/IOException.h"               // for IOException
+#include "metadata/BlackArea.h"           // for BlackArea
+#include "metadata/ColorFilterArray.h"    // for ColorFilterArray, CFAColor
+#include <algorithm>                      // for min
+#include <array>                          // for array
+#include <cstring>                        // for memcpy
+#include <limits>                         // for numeric_limits
+#include <string>                         // for string
+#include <vector>                         // for vector
+
+namespace rawspeed {
+
+namespace {
+
+// "RSRC", and the version of the layout.
+constexpr uint32 Magic = 0x43525352;
+constexpr uint32 Format = 1;
+
+// Of the residuals, that are bit-packed with the same width.
+constexpr int GroupSize = 16;
+// Of a difference of two 16-bit values, zigzagged.
+constexpr uint32 MaxWidth = 17;
+
+// All of it little-endian, as a ByteStream reads it back.
+class Writer final {
+  std::vector<uchar8>* out;
+
+public:
+  explicit Writer(std::vector<uchar8>* out_) : out(out_) {}
+
+  void put(uint64 value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+      out->emplace_back(static_cast<uchar8>(value >> (8 * i)));
+  }
+
+  void putFloat(float value) {
+    uint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(bits, 4);
+  }
+
+  void putPoint(const iPoint2D& p) {
+    put(static_cast<uint32>(p.x), 4);
+    put(static_cast<uint32>(p.y), 4);
+  }
+
+  void putString(const std::string& s) {
+    put(s.size(), 4);
+    out->insert(out->end(), s.begin(), s.end());
+  }
+};
+
+iPoint2D getPoint(ByteStream* bs) {
+  const int x = bs->getI32();
+  const int y = bs->getI32();
+  return {x, y};
+}
+
+std::string getString(ByteStream* bs) {
+  const uint32 size = bs->getU32();
+  const uchar8* s = bs->getData(size);
+  return std::string(reinterpret_cast<const char*>(s), size);
+}
+
+// Only the elements of the same color are good predictors of each other.
+int getPredictorDistance(const RawImageData& img) {
+  return img.isCFA ? 2 * img.getCpp() : img.getCpp();
+}
+
+void encodeRow(const ushort16* row, int n, int step, std::vector<uchar8>* out) {
+  for (int g = 0; g < n; g += GroupSize) {
+    const int count = std::min(GroupSize, n - g);
+
+    std::array<uint32, GroupSize> residuals{{}};
+    uint32 all = 0;
+    for (int k = 0; k < count; k++) {
+      const int i = g + k;
+      const int pred = i >= step ? row[i - step] : 0;
+      const int r = row[i] - pred;
+      residuals[k] = (static_cast<uint32>(r) << 1U) ^ static_cast<uint32>(r >> 31);
+      all |= residuals[k];
+    }
+
+    uint32 width = 0;
+    while (all >> width)
+      width++;
+    out->emplace_back(width);
+
+    // 16 of them take exactly 2 * width bytes.
+    uint64 cache = 0;
+    uint32 fill = 0;
+    for (const uint32 r : residuals) {
+      cache |= static_cast<uint64>(r) << fill;
+      fill += width;
+      for (; fill >= 8; fill -= 8) {
+        out->emplace_back(static_cast<uchar8>(cache));
+        cache >>= 8U;
+      }
+    }
+  }
+}
+
+void decodeRow(ByteStream bs, ushort16* row, int n, int step) {
+  for (int g = 0; g < n; g += GroupSize) {
+    const int count = std::min(GroupSize, n - g);
+
+    const uint32 width = bs.getByte();
+    if (width > MaxWidth)
+      ThrowRDE("Invalid width of the residuals: %u", width);
+    const uchar8* in = bs.getData(2 * width);
+    const uint32 mask = (1U << width) - 1U;
+
+    uint64 cache = 0;
+    uint32 fill = 0;
+    for (int k = 0; k < count; k++) {
+      for (; fill < width; fill += 8)
+        cache |= static_cast<uint64>(*in++) << fill;
+      const uint32 z = cache & mask;
+      cache >>= width;
+      fill -= width;
+
+      const int i = g + k;
+      const int pred = i >= step ? row[i - step] : 0;
+      const int value = pred + static_cast<int>((z >> 1U) ^ (0U - (z & 1U)));
+      if (value < 0 || value > 65535)
+        ThrowRDE("The value at %i is out of range", i);
+      row[i] = value;
+    }
+  }
+
+  if (bs.getRemainSize())
+    ThrowRDE("The row has bytes left over");
+}
+
+void encodeRowF32(const float* row, int n, std::vector<uchar8>* out) {
+  Writer w(out);
+  for (int i = 0; i < n; i++)
+    w.putFloat(row[i]);
+}
+
+void decodeRowF32(ByteStream bs, float* row, int n) {
+  if (bs.getRemainSize() != 4U * n)
+    ThrowRDE("The row is not of %i floats", n);
+  for (int i = 0; i < n; i++)
+    row[i] = bs.getFloat();
+}
+
+void writeMetaData(Writer* w, const RawImageData& img) {
+  w->put(img.isCFA, 1);
+  const iPoint2D cfaSize = img.cfa.getSize();
+  w->putPoint(cfaSize);
+  for (int y = 0; y < cfaSize.y; y++) {
+    for (int x = 0; x < cfaSize.x; x++)
+      w->put(img.cfa.getColorAt(x, y), 1);
+  }
+
+  w->put(static_cast<uint32>(img.blackLevel), 4);
+  for (const int b : img.blackLevelSeparate)
+    w->put(static_cast<uint32>(b), 4);
+  w->put(static_cast<uint32>(img.whitePoint), 4);
+  w->put(img.blackAreas.size(), 4);
+  for (const BlackArea& a : img.blackAreas) {
+    w->put(a.offset, 4);
+    w->put(a.size, 4);
+    w->put(a.isVertical, 1);
+  }
+  w->put(img.mDitherScale, 1);
+
+  const ImageMetaData& m = img.metadata;
+  uint64 aspect;
+  memcpy(&aspect, &m.pixelAspectRatio, sizeof(aspect));
+  w->put(aspect, 8);
+  for (const float c : m.wbCoeffs)
+    w->putFloat(c);
+  w->put(m.fujiRotationPos, 4);
+  w->put(m.fujiRotation.hasValue(), 1);
+  if (m.fujiRotation.hasValue()) {
+    const FujiRotation r = m.fujiRotation.getValue();
+    w->putPoint(r.size);
+    w->put(r.altLayout, 1);
+    w->put(r.rotationPos, 4);
+  }
+  w->putPoint(m.subsampling);
+  for (const auto* s : {&m.make, &m.model, &m.mode, &m.canonical_make,
+                        &m.canonical_model, &m.canonical_alias,
+                        &m.canonical_id})
+    w->putString(*s);
+  w->put(static_cast<uint32>(m.isoSpeed), 4);
+}
+
+void readMetaData(ByteStream* bs, RawImageData* img) {
+  img->isCFA = bs->getByte() != 0;
+  const iPoint2D cfaSize = getPoint(bs);
+  if (cfaSize.x < 0 || cfaSize.y < 0 || cfaSize.x > 16 || cfaSize.y > 16)
+    ThrowRDE("Invalid size of the CFA: %i x %i", cfaSize.x, cfaSize.y);
+  img->cfa.setSize(cfaSize);
+  for (int y = 0; y < cfaSize.y; y++) {
+    for (int x = 0; x < cfaSize.x; x++) {
+      const uchar8 c = bs->getByte();
+      if (c > CFA_FUJI_GREEN && c != CFA_UNKNOWN)
+        ThrowRDE("Invalid color of the CFA: %u", c);
+      img->cfa.setColorAt({x, y}, static_cast<CFAColor>(c));
+    }
+  }
+
+  img->blackLevel = bs->getI32();
+  for (int& b : img->blackLevelSeparate)
+    b = bs->getI32();
+  img->whitePoint = bs->getI32();
+  const uint32 numAreas = bs->getU32();
+  // Each one takes 9 bytes, so that bounds the allocation.
+  if (numAreas > bs->getRemainSize() / 9)
+    ThrowRDE("Invalid number of the black areas: %u", numAreas);
+  img->blackAreas.clear();
+  img->blackAreas.reserve(numAreas);
+  for (uint32 i = 0; i < numAreas; i++) {
+    const uint32 offset = bs->getU32();
+    const uint32 size = bs->getU32();
+    const bool isVertical = bs->getByte() != 0;
+    img->blackAreas.emplace_back(offset, size, isVertical);
+  }
+  img->mDitherScale = bs->getByte() != 0;
+
+  ImageMetaData& m = img->metadata;
+  const uint64 aspect = bs->get<uint64>();
+  memcpy(&m.pixelAspectRatio, &aspect, sizeof(aspect));
+  for (float& c : m.wbCoeffs)
+    c = bs->getFloat();
+  m.fujiRotationPos = bs->getU32();
+  m.fujiRotation.reset();
+  if (bs->getByte()) {
+    const iPoint2D size = getPoint(bs);
+    const bool altLayout = bs->getByte() != 0;
+    FujiRotation r(size, altLayout);
+    r.rotationPos = bs->getU32();
+    m.fujiRotation = r;
+  }
+  m.subsampling = getPoint(bs);
+  for (auto* s : {&m.make, &m.model, &m.mode, &m.canonical_make,
+                  &m.canonical_model, &m.canonical_alias, &m.canonical_id})
+    *s = getString(bs);
+  m.isoSpeed = bs->getI32();
+}
+
+} // namespace
+
+std::vector<uchar8> storeRawImage(const RawImage& img) {
+  const RawImageType type = img->getDataType();
+  const uint32 cpp = img->getCpp();
+  const iPoint2D uncropped = img->getUncroppedDim();
+  const int n = uncropped.x * cpp;
+  const int step = getPredictorDistance(*img);
+
+  // Each row on its own, so that they can be loaded in parallel too.
+  std::vector<std::vector<uchar8>> rows(uncropped.y);
+  parallelFor(0, uncropped.y, [&img, &rows, type, n, step](int y) {
+    const uchar8* row = img->getDataUncropped(0, y);
+    if (type == TYPE_USHORT16)
+      encodeRow(reinterpret_cast<const ushort16*>(row), n, step, &rows[y]);
+    else
+      encodeRowF32(reinterpret_cast<const float*>(row), n, &rows[y]);
+  });
+
+  std::vector<uchar8> out;
+  Writer w(&out);
+  w.put(Magic, 4);
+  w.put(Format, 4);
+  w.put(type, 4);
+  w.put(cpp, 4);
+  w.putPoint(uncropped);
+  w.putPoint(img->getCropOffset());
+  w.putPoint(img->dim);
+  writeMetaData(&w, *img);
+
+  {
+    MutexLocker guard(&img->mBadPixelMutex);
+    w.put(img->mBadPixelPositions.size(), 4);
+    for (const BadPixelPosition p : img->mBadPixelPositions)
+      w.put(p, 8);
+  }
+
+  // The end of each row, relative to the start of the first one.
+  uint64 end = 0;
+  for (const auto& row : rows) {
+    end += row.size();
+    w.put(end, 8);
+  }
+  out.reserve(out.size() + end);
+  for (const auto& row : rows)
+    out.insert(out.end(), row.begin(), row.end());
+
+  return out;
+}
+
+RawImage loadRawImage(const Buffer& data) {
+  try {
+    ByteStream bs(DataBuffer(data, Endianness::little));
+    if (bs.getU32() != Magic)
+      ThrowRDE("Not a stored image.");
+    const uint32 format = bs.getU32();
+    if (format != Format)
+      ThrowRDE("Unsupported format of the stored image: %u", format);
+
+    const uint32 type = bs.getU32();
+    if (type != TYPE_USHORT16 && type != TYPE_FLOAT32)
+      ThrowRDE("Unknown type of the stored image: %u", type);
+    const uint32 cpp = bs.getU32();
+    if (cpp < 1 || cpp > 4)
+      ThrowRDE("Unsupported number of the components: %u", cpp);
+    const iPoint2D uncropped = getPoint(&bs);
+    const iPoint2D cropOffset = getPoint(&bs);
+    const iPoint2D cropped = getPoint(&bs);
+    if (!uncropped.hasPositiveArea() ||
+        uncropped.x > std::numeric_limits<int>::max() / 4 / static_cast<int>(cpp))
+      ThrowRDE("Invalid size of the stored image: %i x %i", uncropped.x,
+               uncropped.y);
+
+    // Not into the image yet, that is allocated once the size is known to be
+    // consistent with the data.
+    RawImage img = RawImage::create(static_cast<RawImageType>(type));
+    readMetaData(&bs, img.get());
+
+    const uint32 numBadPixels = bs.getU32();
+    if (numBadPixels > bs.getRemainSize() / 8)
+      ThrowRDE("Invalid number of the bad pixels: %u", numBadPixels);
+    std::vector<BadPixelPosition> badPixels(numBadPixels);
+    for (auto& p : badPixels)
+      p = bs.get<uint64>();
+
+    if (static_cast<uint32>(uncropped.y) > bs.getRemainSize() / 8)
+      ThrowRDE("The row table is truncated");
+    std::vector<uint64> ends(uncropped.y);
+    uint64 previous = 0;
+    for (auto& e : ends) {
+      e = bs.get<uint64>();
+      if (e < previous)
+        ThrowRDE("The rows are not in order");
+      previous = e;
+    }
+    const ByteStream pixels = bs.getStream(bs.getRemainSize());
+    if (previous != pixels.getRemainSize())
+      ThrowRDE("The rows are not of the size of the rest of the data");
+
+    // A row being at least a byte per group, this bounds the allocation.
+    const int n = uncropped.x * cpp;
+    const uint64 minRowSize =
+        type == TYPE_USHORT16 ? (n + GroupSize - 1) / GroupSize : 4ULL * n;
+    if (previous < minRowSize * uncropped.y)
+      ThrowRDE("The rows are too short for the size of the image");
+
+    // The CFA is already of the crop, and subFrame() would shift it again.
+    const ColorFilterArray cfa = img->cfa;
+    img->dim = uncropped;
+    img->setCpp(cpp);
+    img->createData();
+
+    const int step = getPredictorDistance(*img);
+    parallelFor(0, uncropped.y, [&img, &ends, &pixels, type, n, step](int y) {
+      const uint64 begin = y ? ends[y - 1] : 0;
+      ByteStream row(pixels);
+      row.skipBytes(begin);
+      row = row.getStream(ends[y] - begin);
+      uchar8* dst = img->getDataUncropped(0, y);
+      if (type == TYPE_USHORT16)
+        decodeRow(row, reinterpret_cast<ushort16*>(dst), n, step);
+      else
+        decodeRowF32(row, reinterpret_cast<float*>(dst), n);
+    });
+
+    if (cropOffset != iPoint2D(0, 0) || cropped != uncropped) {
+      if (cropOffset.x < 0 || cropOffset.y < 0 || !cropped.hasPositiveArea() ||
+          !cropped.isThisInside(uncropped - cropOffset))
+        ThrowRDE("Invalid crop of the stored image");
+      img->subFrame(iRectangle2D(cropOffset, cropped));
+    }
+    img->cfa = cfa;
+
+    img->addBadPixels(badPixels);
+    return img;
+  } catch (IOException& e) {
+    ThrowRDE("%s", e.what());
+  }
+}
+
+} // namespace rawspeed
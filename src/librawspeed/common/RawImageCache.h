@@ -0,0 +1,50 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"   // for uchar8
+#include "common/RawImage.h" // for RawImage
+#include <vector>            // for vector
+
+namespace rawspeed {
+
+class Buffer;
+
+// A lossless serialization of a decoded image, with its metadata, that is
+// much faster to load again than most of the raw formats are to decode, e.g.
+// to keep the images of the recently opened files on the disk.
+//
+// The pixels are stored row by row, each one being predicted by the previous
+// one of the same color, and the residuals being bit-packed in groups of 16,
+// just as wide as the largest one of the group, so usually at or below the
+// bit depth of the sensor. The rows are independent, so both the storing and
+// the loading are done in parallel. The float images are stored as they are.
+//
+// Everything of RawImageData that the decoders set is kept, including the
+// crop and the bad pixels that are still to be fixed, but not the lookup
+// table, the error log, nor the callbacks.
+std::vector<uchar8> storeRawImage(const RawImage& img);
+
+// The data can just as well be a memory-mapped file, it is only read.
+// Throws if it is not one of storeRawImage(), or if it is corrupt.
+RawImage loadRawImage(const Buffer& data);
+
+} // namespace rawspeed
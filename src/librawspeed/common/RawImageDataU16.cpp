@@ -18,26 +18,40 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
-#include "rawspeedconfig.h"               // for WITH_SSE2
+#include "rawspeedconfig.h"               // for WITH_SSE2, RAWSPEED_TARGE...
 #include "common/RawImage.h"              // for RawImageDataU16, TableLookUp
-#include "common/Common.h"                // for ushort16, uint32, uchar8
-#include "common/Memory.h"                // for alignedFree, alignedMalloc...
-#include "common/Point.h"                 // for iPoint2D
+#include "common/Common.h"                // for ushort16, uint32, floatToHalf
+#include "common/Cpuid.h"                 // for Cpuid
+#include "common/Executor.h"              // for getExecutor, parallelFor
+#include "common/Point.h"                 // for iPoint2D, iRectangle2D
+#include "common/ScratchArena.h"          // for ScratchAllocator
 #include "common/TableLookUp.h"           // for TableLookUp
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "metadata/BlackArea.h"           // for BlackArea
-#include <algorithm>                      // for fill, max, min
+#include <algorithm>                      // for max, min
 #include <array>                          // for array
 #include <cassert>                        // for assert
 #include <memory>                         // for operator==, unique_ptr
 #include <vector>                         // for vector
 
 #ifdef WITH_SSE2
-#include "common/Cpuid.h" // for Cpuid
 #include <emmintrin.h> // for __m128i, _mm_load_si128
 #include <xmmintrin.h> // for _MM_HINT_T0, _mm_prefetch
 #endif
 
+#if defined(WITH_AVX2) || defined(WITH_AVX512)
+// GCC 12 warns about the _mm512_undefined_epi32() inside of the intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h> // for __m256i, __m512i, _mm256_loadu_si256
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef WITH_NEON
+#include <arm_neon.h> // for uint16x8_t, vld1q_u16, vst1q_u16
+#endif
+
 using std::vector;
 using std::min;
 using std::max;
@@ -45,6 +59,376 @@ using std::array;
 
 namespace rawspeed {
 
+namespace {
+
+#ifdef WITH_SSE2
+// The state of the dithering, for the 8 pixels of the next block.
+inline __m128i nextRandom_SSE2(__m128i random, __m128i rand_mul) {
+  return _mm_xor_si128(_mm_mulhi_epi16(random, rand_mul),
+                       _mm_mullo_epi16(random, rand_mul));
+}
+
+inline __m128i initRandom_SSE2(const std::array<uint32, 4>* random) {
+  if (!random)
+    return _mm_setzero_si128();
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(random->data()));
+}
+
+// The 8 pixels of the block, with the random state of that block.
+inline __m128i scaleBlock_SSE2(__m128i pix_low, __m128i sserandom,
+                               __m128i ssesub, __m128i ssescale,
+                               __m128i sse_full_scale_fp,
+                               __m128i sse_half_scale_fp) {
+  const __m128i sseround = _mm_set1_epi32(512);
+  const __m128i ssesub2 = _mm_set1_epi32(32768);
+  const __m128i ssesign = _mm_set1_epi32(0x80008000);
+  const __m128i rand_mask = _mm_set1_epi32(0x00ff00ff); // 8 random bits
+
+  __m128i pix_high;
+  __m128i temp;
+  // Subtract black
+  pix_low = _mm_subs_epu16(pix_low, ssesub);
+  // Multiply the two unsigned shorts and combine it to 32 bit result
+  pix_high = _mm_mulhi_epu16(pix_low, ssescale);
+  temp = _mm_mullo_epi16(pix_low, ssescale);
+  pix_low = _mm_unpacklo_epi16(temp, pix_high);
+  pix_high = _mm_unpackhi_epi16(temp, pix_high);
+  // Add rounder
+  pix_low = _mm_add_epi32(pix_low, sseround);
+  pix_high = _mm_add_epi32(pix_high, sseround);
+
+  __m128i rand_masked =
+      _mm_and_si128(sserandom, rand_mask); // Get 8 random bits
+  rand_masked = _mm_mullo_epi16(rand_masked, sse_full_scale_fp);
+
+  __m128i zero = _mm_setzero_si128();
+  __m128i rand_lo =
+      _mm_sub_epi32(sse_half_scale_fp, _mm_unpacklo_epi16(rand_masked, zero));
+  __m128i rand_hi =
+      _mm_sub_epi32(sse_half_scale_fp, _mm_unpackhi_epi16(rand_masked, zero));
+
+  pix_low = _mm_add_epi32(pix_low, rand_lo);
+  pix_high = _mm_add_epi32(pix_high, rand_hi);
+
+  // Shift down
+  pix_low = _mm_srai_epi32(pix_low, 10);
+  pix_high = _mm_srai_epi32(pix_high, 10);
+  // Subtract to avoid clipping
+  pix_low = _mm_sub_epi32(pix_low, ssesub2);
+  pix_high = _mm_sub_epi32(pix_high, ssesub2);
+  // Pack
+  pix_low = _mm_packs_epi32(pix_low, pix_high);
+  // Shift sign off
+  return _mm_xor_si128(pix_low, ssesign);
+}
+
+void scaleRow_SSE2(ushort16* row, uint32 numBlocks, uint32 sub, uint32 mul,
+                   const std::array<uint32, 4>* random, int full_scale_fp,
+                   int half_scale_fp) {
+  const __m128i ssesub = _mm_set1_epi32(sub);
+  const __m128i ssescale = _mm_set1_epi32(mul);
+  const __m128i sse_full_scale_fp =
+      _mm_set1_epi32(full_scale_fp | (full_scale_fp << 16));
+  const __m128i sse_half_scale_fp = _mm_set1_epi32(half_scale_fp >> 4);
+  const __m128i rand_mul = _mm_set1_epi32(random ? 0x4d9f1d32 : 0);
+
+  __m128i sserandom = initRandom_SSE2(random);
+  auto* pixel = reinterpret_cast<__m128i*>(row);
+  for (uint32 x = 0; x < numBlocks; x++) {
+    _mm_prefetch(reinterpret_cast<char*>(pixel + 1), _MM_HINT_T0);
+    if (random)
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+    _mm_store_si128(pixel,
+                    scaleBlock_SSE2(_mm_load_si128(pixel), sserandom, ssesub,
+                                    ssescale, sse_full_scale_fp,
+                                    sse_half_scale_fp));
+    pixel++;
+  }
+}
+#endif
+
+#ifdef WITH_AVX2
+// Same as scaleRow_SSE2(), two blocks at a time. The dithering is still
+// advanced block by block, so that the result is exactly the same.
+__attribute__((target("avx2"))) void
+scaleRow_AVX2(ushort16* row, uint32 numBlocks, uint32 sub, uint32 mul,
+              const std::array<uint32, 4>* random, int full_scale_fp,
+              int half_scale_fp) {
+  const __m256i sub_ = _mm256_set1_epi32(sub);
+  const __m256i scale = _mm256_set1_epi32(mul);
+  const __m256i full_scale =
+      _mm256_set1_epi32(full_scale_fp | (full_scale_fp << 16));
+  const __m256i half_scale = _mm256_set1_epi32(half_scale_fp >> 4);
+  const __m256i round = _mm256_set1_epi32(512);
+  const __m256i sub2 = _mm256_set1_epi32(32768);
+  const __m256i sign = _mm256_set1_epi32(0x80008000);
+  const __m256i rand_mask = _mm256_set1_epi32(0x00ff00ff);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m128i rand_mul = _mm_set1_epi32(random ? 0x4d9f1d32 : 0);
+
+  __m128i sserandom = initRandom_SSE2(random);
+  auto* pixel = reinterpret_cast<__m256i*>(row);
+  uint32 x = 0;
+  for (; x + 2 <= numBlocks; x += 2) {
+    __m256i rand = _mm256_setzero_si256();
+    if (random) {
+      const __m128i random0 = nextRandom_SSE2(sserandom, rand_mul);
+      sserandom = nextRandom_SSE2(random0, rand_mul);
+      rand = _mm256_inserti128_si256(_mm256_castsi128_si256(random0),
+                                     sserandom, 1);
+    }
+
+    // All of these work on the two 128-bit lanes separately,
+    // exactly as scaleBlock_SSE2() does.
+    __m256i pix_low = _mm256_loadu_si256(pixel);
+    pix_low = _mm256_subs_epu16(pix_low, sub_);
+    __m256i pix_high = _mm256_mulhi_epu16(pix_low, scale);
+    const __m256i temp = _mm256_mullo_epi16(pix_low, scale);
+    pix_low = _mm256_unpacklo_epi16(temp, pix_high);
+    pix_high = _mm256_unpackhi_epi16(temp, pix_high);
+    pix_low = _mm256_add_epi32(pix_low, round);
+    pix_high = _mm256_add_epi32(pix_high, round);
+
+    __m256i rand_masked = _mm256_and_si256(rand, rand_mask);
+    rand_masked = _mm256_mullo_epi16(rand_masked, full_scale);
+    pix_low = _mm256_add_epi32(
+        pix_low,
+        _mm256_sub_epi32(half_scale, _mm256_unpacklo_epi16(rand_masked, zero)));
+    pix_high = _mm256_add_epi32(
+        pix_high,
+        _mm256_sub_epi32(half_scale, _mm256_unpackhi_epi16(rand_masked, zero)));
+
+    pix_low = _mm256_sub_epi32(_mm256_srai_epi32(pix_low, 10), sub2);
+    pix_high = _mm256_sub_epi32(_mm256_srai_epi32(pix_high, 10), sub2);
+    pix_low = _mm256_xor_si256(_mm256_packs_epi32(pix_low, pix_high), sign);
+    _mm256_storeu_si256(pixel, pix_low);
+    pixel++;
+  }
+
+  // The row is only aligned to one block.
+  if (x < numBlocks) {
+    auto* last = reinterpret_cast<__m128i*>(pixel);
+    if (random)
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+    _mm_store_si128(
+        last, scaleBlock_SSE2(_mm_load_si128(last), sserandom,
+                              _mm256_castsi256_si128(sub_),
+                              _mm256_castsi256_si128(scale),
+                              _mm256_castsi256_si128(full_scale),
+                              _mm256_castsi256_si128(half_scale)));
+  }
+}
+#endif
+
+#ifdef WITH_AVX512
+// Same as scaleRow_AVX2(), four blocks at a time.
+__attribute__((target("avx512f,avx512bw"))) void
+scaleRow_AVX512(ushort16* row, uint32 numBlocks, uint32 sub, uint32 mul,
+                const std::array<uint32, 4>* random, int full_scale_fp,
+                int half_scale_fp) {
+  const __m512i sub_ = _mm512_set1_epi32(sub);
+  const __m512i scale = _mm512_set1_epi32(mul);
+  const __m512i full_scale =
+      _mm512_set1_epi32(full_scale_fp | (full_scale_fp << 16));
+  const __m512i half_scale = _mm512_set1_epi32(half_scale_fp >> 4);
+  const __m512i round = _mm512_set1_epi32(512);
+  const __m512i sub2 = _mm512_set1_epi32(32768);
+  const __m512i sign = _mm512_set1_epi32(0x80008000);
+  const __m512i rand_mask = _mm512_set1_epi32(0x00ff00ff);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m128i rand_mul = _mm_set1_epi32(random ? 0x4d9f1d32 : 0);
+
+  __m128i sserandom = initRandom_SSE2(random);
+  auto* pixel = reinterpret_cast<__m512i*>(row);
+  uint32 x = 0;
+  for (; x + 4 <= numBlocks; x += 4) {
+    __m512i rand = _mm512_setzero_si512();
+    if (random) {
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+      rand = _mm512_inserti32x4(rand, sserandom, 0);
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+      rand = _mm512_inserti32x4(rand, sserandom, 1);
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+      rand = _mm512_inserti32x4(rand, sserandom, 2);
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+      rand = _mm512_inserti32x4(rand, sserandom, 3);
+    }
+
+    __m512i pix_low = _mm512_loadu_si512(pixel);
+    pix_low = _mm512_subs_epu16(pix_low, sub_);
+    __m512i pix_high = _mm512_mulhi_epu16(pix_low, scale);
+    const __m512i temp = _mm512_mullo_epi16(pix_low, scale);
+    pix_low = _mm512_unpacklo_epi16(temp, pix_high);
+    pix_high = _mm512_unpackhi_epi16(temp, pix_high);
+    pix_low = _mm512_add_epi32(pix_low, round);
+    pix_high = _mm512_add_epi32(pix_high, round);
+
+    __m512i rand_masked = _mm512_and_si512(rand, rand_mask);
+    rand_masked = _mm512_mullo_epi16(rand_masked, full_scale);
+    pix_low = _mm512_add_epi32(
+        pix_low,
+        _mm512_sub_epi32(half_scale, _mm512_unpacklo_epi16(rand_masked, zero)));
+    pix_high = _mm512_add_epi32(
+        pix_high,
+        _mm512_sub_epi32(half_scale, _mm512_unpackhi_epi16(rand_masked, zero)));
+
+    pix_low = _mm512_sub_epi32(_mm512_srai_epi32(pix_low, 10), sub2);
+    pix_high = _mm512_sub_epi32(_mm512_srai_epi32(pix_high, 10), sub2);
+    pix_low = _mm512_xor_si512(_mm512_packs_epi32(pix_low, pix_high), sign);
+    _mm512_storeu_si512(pixel, pix_low);
+    pixel++;
+  }
+
+  auto* last = reinterpret_cast<__m128i*>(pixel);
+  for (; x < numBlocks; x++) {
+    if (random)
+      sserandom = nextRandom_SSE2(sserandom, rand_mul);
+    _mm_store_si128(
+        last, scaleBlock_SSE2(_mm_load_si128(last), sserandom,
+                              _mm512_castsi512_si128(sub_),
+                              _mm512_castsi512_si128(scale),
+                              _mm512_castsi512_si128(full_scale),
+                              _mm512_castsi512_si128(half_scale)));
+    last++;
+  }
+}
+#endif
+
+#ifdef WITH_NEON
+// The same math as scaleRow_SSE2(), one block at a time.
+void scaleRow_NEON(ushort16* row, uint32 numBlocks, uint32 sub, uint32 mul,
+                   const std::array<uint32, 4>* random, int full_scale_fp,
+                   int half_scale_fp) {
+  const uint16x8_t sub_ = vreinterpretq_u16_u32(vdupq_n_u32(sub));
+  const uint16x8_t scale = vreinterpretq_u16_u32(vdupq_n_u32(mul));
+  const uint16x8_t full_scale = vdupq_n_u16(full_scale_fp);
+  const int32x4_t half_scale = vdupq_n_s32(half_scale_fp >> 4);
+  const uint32x4_t round = vdupq_n_u32(512);
+  const int32x4_t sub2 = vdupq_n_s32(32768);
+  const uint16x8_t sign = vdupq_n_u16(0x8000);
+  const uint16x8_t rand_mask = vdupq_n_u16(0x00ff);
+  const int16x8_t rand_mul =
+      vreinterpretq_s16_u32(vdupq_n_u32(random ? 0x4d9f1d32 : 0));
+
+  int16x8_t rand = random ? vreinterpretq_s16_u32(vld1q_u32(random->data()))
+                          : vdupq_n_s16(0);
+  for (uint32 x = 0; x < numBlocks; x++, row += 8) {
+    if (random) {
+      // _mm_mulhi_epi16() ^ _mm_mullo_epi16()
+      const int16x8_t rand_high = vcombine_s16(
+          vshrn_n_s32(vmull_s16(vget_low_s16(rand), vget_low_s16(rand_mul)),
+                      16),
+          vshrn_n_s32(vmull_s16(vget_high_s16(rand), vget_high_s16(rand_mul)),
+                      16));
+      rand = veorq_s16(rand_high, vmulq_s16(rand, rand_mul));
+    }
+
+    uint16x8_t pix = vqsubq_u16(vld1q_u16(row), sub_);
+
+    // The full 32 bit products, no need to combine the halves.
+    uint32x4_t pix_low =
+        vaddq_u32(vmull_u16(vget_low_u16(pix), vget_low_u16(scale)), round);
+    uint32x4_t pix_high =
+        vaddq_u32(vmull_u16(vget_high_u16(pix), vget_high_u16(scale)), round);
+
+    const uint16x8_t rand_masked =
+        vmulq_u16(vandq_u16(vreinterpretq_u16_s16(rand), rand_mask),
+                  full_scale);
+    const int32x4_t rand_lo = vsubq_s32(
+        half_scale,
+        vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(rand_masked))));
+    const int32x4_t rand_hi = vsubq_s32(
+        half_scale,
+        vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(rand_masked))));
+
+    int32x4_t low = vaddq_s32(vreinterpretq_s32_u32(pix_low), rand_lo);
+    int32x4_t high = vaddq_s32(vreinterpretq_s32_u32(pix_high), rand_hi);
+
+    low = vsubq_s32(vshrq_n_s32(low, 10), sub2);
+    high = vsubq_s32(vshrq_n_s32(high, 10), sub2);
+
+    pix = vreinterpretq_u16_s16(
+        vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+    vst1q_u16(row, veorq_u16(pix, sign));
+  }
+}
+#endif
+
+// Of the even and the odd pixels of a row, for scaleToHalfFloat().
+using HalfRowFunction = void (*)(const ushort16* in, ushort16* out, int n,
+                                 const float* sub, const float* mul);
+
+void halfRow_plain(const ushort16* in, ushort16* out, int n, const float* sub,
+                   const float* mul) {
+  for (int x = 0; x < n; x++) {
+    const float v = (static_cast<float>(in[x]) - sub[x & 1]) * mul[x & 1];
+    out[x] = floatToHalf(std::min(std::max(v, 0.0F), 1.0F));
+  }
+}
+
+#ifdef WITH_AVX2
+// The same operations, so the same result, 8 pixels at a time.
+__attribute__((target("avx2,f16c"))) void
+halfRow_F16C(const ushort16* in, ushort16* out, int n, const float* sub,
+             const float* mul) {
+  const __m256 sub_ = _mm256_setr_ps(sub[0], sub[1], sub[0], sub[1], sub[0],
+                                     sub[1], sub[0], sub[1]);
+  const __m256 mul_ = _mm256_setr_ps(mul[0], mul[1], mul[0], mul[1], mul[0],
+                                     mul[1], mul[0], mul[1]);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0F);
+
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+    __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v));
+    f = _mm256_mul_ps(_mm256_sub_ps(f, sub_), mul_);
+    f = _mm256_min_ps(_mm256_max_ps(f, zero), one);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x),
+                     _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+  }
+  halfRow_plain(in + x, out + x, n - x, sub, mul);
+}
+#endif
+
+#if defined(WITH_NEON) && defined(__aarch64__)
+void halfRow_NEON(const ushort16* in, ushort16* out, int n, const float* sub,
+                  const float* mul) {
+  const float32x4_t sub_ = {sub[0], sub[1], sub[0], sub[1]};
+  const float32x4_t mul_ = {mul[0], mul[1], mul[0], mul[1]};
+  const float32x4_t zero = vdupq_n_f32(0.0F);
+  const float32x4_t one = vdupq_n_f32(1.0F);
+
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    const uint16x8_t v = vld1q_u16(in + x);
+    float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+    float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)));
+    lo = vminq_f32(vmaxq_f32(vmulq_f32(vsubq_f32(lo, sub_), mul_), zero), one);
+    hi = vminq_f32(vmaxq_f32(vmulq_f32(vsubq_f32(hi, sub_), mul_), zero), one);
+    vst1q_u16(out + x,
+              vcombine_u16(vreinterpret_u16_f16(vcvt_f16_f32(lo)),
+                           vreinterpret_u16_f16(vcvt_f16_f32(hi))));
+  }
+  halfRow_plain(in + x, out + x, n - x, sub, mul);
+}
+#endif
+
+HalfRowFunction getHalfRowFunction() {
+#ifdef WITH_AVX2
+  if (Cpuid::AVX2() && Cpuid::F16C())
+    return halfRow_F16C;
+#endif
+#if defined(WITH_NEON) && defined(__aarch64__)
+  if (Cpuid::NEON())
+    return halfRow_NEON;
+#endif
+  return halfRow_plain;
+}
+
+} // namespace
+
 RawImageDataU16::RawImageDataU16() {
   dataType = TYPE_USHORT16;
   bpp = 2;
@@ -57,10 +441,10 @@ RawImageDataU16::RawImageDataU16(const iPoint2D &_dim, uint32 _cpp)
 
 
 void RawImageDataU16::calculateBlackAreas() {
-  vector<unsigned int> histogram(4 * 65536);
-  fill(histogram.begin(), histogram.end(), 0);
-
+  // The areas, within the image.
+  std::vector<iRectangle2D> rects;
   int totalpixels = 0;
+  int totalRows = 0;
 
   for (auto area : blackAreas) {
     /* Make sure area sizes are multiple of two,
@@ -72,15 +456,7 @@ void RawImageDataU16::calculateBlackAreas() {
       if (static_cast<int>(area.offset) + static_cast<int>(area.size) >
           uncropped_dim.y)
         ThrowRDE("Offset + size is larger than height of image");
-      for (uint32 y = area.offset; y < area.offset+area.size; y++) {
-        auto* pixel =
-            reinterpret_cast<ushort16*>(getDataUncropped(mOffset.x, y));
-        auto* localhist = &histogram[(y & 1) * (65536UL * 2UL)];
-        for (int x = mOffset.x; x < dim.x+mOffset.x; x++) {
-          const auto hBin = ((x & 1) << 16) + *pixel;
-          localhist[hBin]++;
-        }
-      }
+      rects.emplace_back(mOffset.x, area.offset, dim.x, area.size);
       totalpixels += area.size * dim.x;
     }
 
@@ -89,17 +465,11 @@ void RawImageDataU16::calculateBlackAreas() {
       if (static_cast<int>(area.offset) + static_cast<int>(area.size) >
           uncropped_dim.x)
         ThrowRDE("Offset + size is larger than width of image");
-      for (int y = mOffset.y; y < dim.y+mOffset.y; y++) {
-        auto* pixel =
-            reinterpret_cast<ushort16*>(getDataUncropped(area.offset, y));
-        auto* localhist = &histogram[(y & 1) * (65536UL * 2UL)];
-        for (uint32 x = area.offset; x < area.size+area.offset; x++) {
-          const auto hBin = ((x & 1) << 16) + *pixel;
-          localhist[hBin]++;
-        }
-      }
+      rects.emplace_back(area.offset, mOffset.y, area.size, dim.y);
       totalpixels += area.size * dim.y;
     }
+
+    totalRows += rects.back().dim.y;
   }
 
   if (!totalpixels) {
@@ -108,15 +478,62 @@ void RawImageDataU16::calculateBlackAreas() {
     return;
   }
 
+  // One histogram for each of the 2x2 CFA positions. The values at or above
+  // the white point all go into the last bin, which does not change the
+  // median, unless it is that high itself.
+  const int numBins = std::min(std::max(whitePoint, 1), 65535) + 1;
+
+  // Each band of the rows of all the areas has its own histograms, and they
+  // are merged afterwards.
+  const auto countRows = [this, &rects, numBins](int begin, int end,
+                                                 uint32* histogram) {
+    int first = 0;
+    for (const auto& rect : rects) {
+      const int rowBegin = std::max(begin - first, 0);
+      const int rowEnd = std::min(end - first, rect.dim.y);
+      first += rect.dim.y;
+
+      for (int row = rowBegin; row < rowEnd; row++) {
+        const int y = rect.pos.y + row;
+        const auto* pixel = reinterpret_cast<const ushort16*>(
+            getDataUncropped(rect.pos.x, y));
+        uint32* localhist = &histogram[(y & 1) * 2 * numBins];
+        // Alternating between the two histograms of the row, so that the
+        // consecutive increments are not of the same counter.
+        for (int x = rect.pos.x; x < rect.pos.x + rect.dim.x; x++, pixel++) {
+          const int value = std::min<int>(*pixel, numBins - 1);
+          localhist[(x & 1) * numBins + value]++;
+        }
+      }
+    }
+  };
+
+  const int numBands = std::min(totalRows, getExecutor()->getConcurrency());
+  using Histogram = std::vector<uint32, ScratchAllocator<uint32>>;
+  std::vector<Histogram> histograms(
+      numBands, Histogram(ScratchAllocator<uint32>(scratch.get())));
+  parallelFor(0, numBands, [&histograms, &countRows, totalRows, numBins,
+                            numBands](int band) {
+    histograms[band].resize(4 * numBins);
+    countRows(totalRows * band / numBands, totalRows * (band + 1) / numBands,
+              histograms[band].data());
+  });
+
+  Histogram& histogram = histograms[0];
+  for (int band = 1; band < numBands; band++) {
+    for (size_t i = 0; i < histogram.size(); i++)
+      histogram[i] += histograms[band][i];
+  }
+
   /* Calculate median value of black areas for each component */
   /* Adjust the number of total pixels so it is the same as the median of each histogram */
   totalpixels /= 4*2;
 
   for (int i = 0 ; i < 4; i++) {
-    auto* localhist = &histogram[i * 65536UL];
+    auto* localhist = &histogram[i * numBins];
     int acc_pixels = localhist[0];
     int pixel_value = 0;
-    while (acc_pixels <= totalpixels && pixel_value < 65535) {
+    while (acc_pixels <= totalpixels && pixel_value < numBins - 1) {
       pixel_value++;
       acc_pixels += localhist[pixel_value];
     }
@@ -133,7 +550,7 @@ void RawImageDataU16::calculateBlackAreas() {
   }
 }
 
-void RawImageDataU16::scaleBlackWhite() {
+bool RawImageDataU16::setUpScaleBlackWhite() {
   const int skipBorder = 250;
   int gw = (dim.x - skipBorder) * cpp;
   if ((blackAreas.empty() && blackLevelSeparate[0] < 0 && blackLevel < 0) || whitePoint >= 65536) {  // Estimate
@@ -159,37 +576,50 @@ void RawImageDataU16::scaleBlackWhite() {
   if ((blackAreas.empty() && blackLevel == 0 && whitePoint == 65535 &&
        blackLevelSeparate[0] < 0) ||
       dim.area() <= 0)
-    return;
+    return false;
 
   /* If filter has not set separate blacklevel, compute or fetch it */
   if (blackLevelSeparate[0] < 0)
     calculateBlackAreas();
 
-  startWorker(RawImageWorker::SCALE_VALUES, true);
+  return true;
 }
 
 void RawImageDataU16::scaleValues(int start_y, int end_y) {
-#ifndef WITH_SSE2
-
-  return scaleValues_plain(start_y, end_y);
-
-#else
-
   int depth_values = whitePoint - blackLevelSeparate[0];
   float app_scale = 65535.0F / depth_values;
 
-  // Check SSE2
-  if (Cpuid::SSE2() && app_scale < 63) {
-    scaleValues_SSE2(start_y, end_y);
-  } else {
-    scaleValues_plain(start_y, end_y);
-  }
-
+  // The SIMD versions only work for the smaller scales. And they do the
+  // whole rows, including the padding, which a view does not own.
+  if (app_scale >= 63 || isView())
+    return scaleValues_plain(start_y, end_y);
+
+  // Pick the widest one that the CPU supports. The dithering is a serial
+  // chain from one block of 8 pixels to the next, which caps the speed of
+  // the wider ones, and AVX-512 ends up slower than AVX2 then.
+#ifdef WITH_AVX512
+  if (Cpuid::AVX512BW() && !mDitherScale)
+    return scaleValues_SIMD(start_y, end_y, scaleRow_AVX512);
+#endif
+#ifdef WITH_AVX2
+  if (Cpuid::AVX2())
+    return scaleValues_SIMD(start_y, end_y, scaleRow_AVX2);
+#endif
+#ifdef WITH_SSE2
+  if (Cpuid::SSE2())
+    return scaleValues_SIMD(start_y, end_y, scaleRow_SSE2);
 #endif
+#ifdef WITH_NEON
+  if (Cpuid::NEON())
+    return scaleValues_SIMD(start_y, end_y, scaleRow_NEON);
+#endif
+
+  scaleValues_plain(start_y, end_y);
 }
 
-#ifdef WITH_SSE2
-void RawImageDataU16::scaleValues_SSE2(int start_y, int end_y) {
+#if defined(WITH_SSE2) || defined(WITH_NEON)
+void RawImageDataU16::scaleValues_SIMD(int start_y, int end_y,
+                                       ScaleRowFunction scaleRow) {
   int depth_values = whitePoint - blackLevelSeparate[0];
   float app_scale = 65535.0F / depth_values;
 
@@ -198,133 +628,38 @@ void RawImageDataU16::scaleValues_SSE2(int start_y, int end_y) {
   // Half Scale in 18.14 fp
   auto half_scale_fp = static_cast<int>(app_scale * 4095.0F);
 
-  __m128i sseround;
-  __m128i ssesub2;
-  __m128i ssesign;
-  __m128i rand_mul;
-  __m128i rand_mask;
-  __m128i sse_full_scale_fp;
-  __m128i sse_half_scale_fp;
-
-  auto* sub_mul = alignedMallocArray<uint32, 16, __m128i>(4);
-  if (!sub_mul)
-    ThrowRDE("Out of memory, failed to allocate 128 bytes");
+  // The black level and the multiplier (10 bit fraction) of the two pixels
+  // of a pair, for the even and the odd lines.
+  std::array<uint32, 2> sub;
+  std::array<uint32, 2> mul;
+  for (int i = 0; i < 2; i++) {
+    const int first = 2 * i + (mOffset.x & 1);
+    const int second = 2 * i + ((mOffset.x + 1) & 1);
 
-  assert(sub_mul != nullptr);
-
-  uint32 gw = pitch / 16;
-  // 10 bit fraction
-  uint32 mul = static_cast<int>(
-      1024.0F * 65535.0F /
-      static_cast<float>(whitePoint - blackLevelSeparate[mOffset.x & 1]));
-  mul |= (static_cast<int>(
-             1024.0F * 65535.0F /
-             static_cast<float>(whitePoint -
-                                blackLevelSeparate[(mOffset.x + 1) & 1])))
-         << 16;
-  uint32 b = blackLevelSeparate[mOffset.x & 1] |
-             (blackLevelSeparate[(mOffset.x + 1) & 1] << 16);
-
-  for (int i = 0; i < 4; i++) {
-    sub_mul[i] = b;       // Subtract even lines
-    sub_mul[4 + i] = mul; // Multiply even lines
-  }
-
-  mul = static_cast<int>(
-      1024.0F * 65535.0F /
-      static_cast<float>(whitePoint - blackLevelSeparate[2 + (mOffset.x & 1)]));
-  mul |= (static_cast<int>(
-             1024.0F * 65535.0F /
-             static_cast<float>(whitePoint -
-                                blackLevelSeparate[2 + ((mOffset.x + 1) & 1)])))
-         << 16;
-  b = blackLevelSeparate[2 + (mOffset.x & 1)] |
-      (blackLevelSeparate[2 + ((mOffset.x + 1) & 1)] << 16);
-
-  for (int i = 0; i < 4; i++) {
-    sub_mul[8 + i] = b;    // Subtract odd lines
-    sub_mul[12 + i] = mul; // Multiply odd lines
+    mul[i] = static_cast<int>(
+        1024.0F * 65535.0F /
+        static_cast<float>(whitePoint - blackLevelSeparate[first]));
+    mul[i] |= (static_cast<int>(
+                  1024.0F * 65535.0F /
+                  static_cast<float>(whitePoint - blackLevelSeparate[second])))
+              << 16;
+    sub[i] = blackLevelSeparate[first] | (blackLevelSeparate[second] << 16);
   }
 
-  sseround = _mm_set_epi32(512, 512, 512, 512);
-  ssesub2 = _mm_set_epi32(32768, 32768, 32768, 32768);
-  ssesign = _mm_set_epi32(0x80008000, 0x80008000, 0x80008000, 0x80008000);
-  sse_full_scale_fp = _mm_set1_epi32(full_scale_fp | (full_scale_fp << 16));
-  sse_half_scale_fp = _mm_set1_epi32(half_scale_fp >> 4);
-
-  if (mDitherScale) {
-    rand_mul = _mm_set1_epi32(0x4d9f1d32);
-  } else {
-    rand_mul = _mm_set1_epi32(0);
-  }
-  rand_mask = _mm_set1_epi32(0x00ff00ff); // 8 random bits
+  uint32 gw = pitch / 16;
 
   for (int y = start_y; y < end_y; y++) {
-    __m128i sserandom;
-    if (mDitherScale) {
-      sserandom =
-          _mm_set_epi32(dim.x * 1676 + y * 18000, dim.x * 2342 + y * 34311,
-                        dim.x * 4272 + y * 12123, dim.x * 1234 + y * 23464);
-    } else {
-      sserandom = _mm_setzero_si128();
-    }
-    auto* pixel = reinterpret_cast<__m128i*>(&data[(mOffset.y + y) * pitch]);
-    __m128i ssescale;
-    __m128i ssesub;
-    if (((y + mOffset.y) & 1) == 0) {
-      ssesub = _mm_load_si128(reinterpret_cast<__m128i*>(&sub_mul[0]));
-      ssescale = _mm_load_si128(reinterpret_cast<__m128i*>(&sub_mul[4]));
-    } else {
-      ssesub = _mm_load_si128(reinterpret_cast<__m128i*>(&sub_mul[8]));
-      ssescale = _mm_load_si128(reinterpret_cast<__m128i*>(&sub_mul[12]));
-    }
-
-    for (uint32 x = 0; x < gw; x++) {
-      __m128i pix_high;
-      __m128i temp;
-      _mm_prefetch(reinterpret_cast<char*>(pixel + 1), _MM_HINT_T0);
-      __m128i pix_low = _mm_load_si128(pixel);
-      // Subtract black
-      pix_low = _mm_subs_epu16(pix_low, ssesub);
-      // Multiply the two unsigned shorts and combine it to 32 bit result
-      pix_high = _mm_mulhi_epu16(pix_low, ssescale);
-      temp = _mm_mullo_epi16(pix_low, ssescale);
-      pix_low = _mm_unpacklo_epi16(temp, pix_high);
-      pix_high = _mm_unpackhi_epi16(temp, pix_high);
-      // Add rounder
-      pix_low = _mm_add_epi32(pix_low, sseround);
-      pix_high = _mm_add_epi32(pix_high, sseround);
-
-      sserandom = _mm_xor_si128(_mm_mulhi_epi16(sserandom, rand_mul),
-                                _mm_mullo_epi16(sserandom, rand_mul));
-      __m128i rand_masked =
-          _mm_and_si128(sserandom, rand_mask); // Get 8 random bits
-      rand_masked = _mm_mullo_epi16(rand_masked, sse_full_scale_fp);
-
-      __m128i zero = _mm_setzero_si128();
-      __m128i rand_lo = _mm_sub_epi32(sse_half_scale_fp,
-                                      _mm_unpacklo_epi16(rand_masked, zero));
-      __m128i rand_hi = _mm_sub_epi32(sse_half_scale_fp,
-                                      _mm_unpackhi_epi16(rand_masked, zero));
-
-      pix_low = _mm_add_epi32(pix_low, rand_lo);
-      pix_high = _mm_add_epi32(pix_high, rand_hi);
-
-      // Shift down
-      pix_low = _mm_srai_epi32(pix_low, 10);
-      pix_high = _mm_srai_epi32(pix_high, 10);
-      // Subtract to avoid clipping
-      pix_low = _mm_sub_epi32(pix_low, ssesub2);
-      pix_high = _mm_sub_epi32(pix_high, ssesub2);
-      // Pack
-      pix_low = _mm_packs_epi32(pix_low, pix_high);
-      // Shift sign off
-      pix_low = _mm_xor_si128(pix_low, ssesign);
-      _mm_store_si128(pixel, pix_low);
-      pixel++;
-    }
+    const std::array<uint32, 4> random = {
+        {static_cast<uint32>(dim.x * 1234 + y * 23464),
+         static_cast<uint32>(dim.x * 4272 + y * 12123),
+         static_cast<uint32>(dim.x * 2342 + y * 34311),
+         static_cast<uint32>(dim.x * 1676 + y * 18000)}};
+    auto* pixel = reinterpret_cast<ushort16*>(
+        &data[static_cast<size_t>(mOffset.y + y) * pitch]);
+    const int parity = (y + mOffset.y) & 1;
+    scaleRow(pixel, gw, sub[parity], mul[parity],
+             mDitherScale ? &random : nullptr, full_scale_fp, half_scale_fp);
   }
-  alignedFree(sub_mul);
 }
 #endif
 
@@ -373,125 +708,89 @@ void RawImageDataU16::scaleValues_plain(int start_y, int end_y) {
   }
 }
 
-/* This performs a 4 way interpolated pixel */
-/* The value is interpolated from the 4 closest valid pixels in */
-/* the horizontal and vertical direction. Pixels found further away */
-/* are weighed less */
-
-void RawImageDataU16::fixBadPixel( uint32 x, uint32 y, int component )
-{
-  array<int, 4> values;
-  array<int, 4> dist;
-  array<int, 4> weight;
-
-  values.fill(-1);
-  dist.fill(0);
-  weight.fill(0);
-
-  uchar8* bad_line = &mBadPixelMap[y*mBadPixelMapPitch];
-  int step = isCFA ? 2 : 1;
-
-  // Find pixel to the left
-  int x_find = static_cast<int>(x) - step;
-  int curr = 0;
-  while (x_find >= 0 && values[curr] < 0) {
-    if (0 == ((bad_line[x_find>>3] >> (x_find&7)) & 1)) {
-      values[curr] =
-          (reinterpret_cast<ushort16*>(getDataUncropped(x_find, y)))[component];
-      dist[curr] = static_cast<int>(x) - x_find;
-    }
-    x_find -= step;
-  }
-  // Find pixel to the right
-  x_find = static_cast<int>(x) + step;
-  curr = 1;
-  while (x_find < uncropped_dim.x && values[curr] < 0) {
-    if (0 == ((bad_line[x_find>>3] >> (x_find&7)) & 1)) {
-      values[curr] =
-          (reinterpret_cast<ushort16*>(getDataUncropped(x_find, y)))[component];
-      dist[curr] = x_find - static_cast<int>(x);
-    }
-    x_find += step;
-  }
-
-  bad_line = &mBadPixelMap[x>>3];
-  // Find pixel upwards
-  int y_find = static_cast<int>(y) - step;
-  curr = 2;
-  while (y_find >= 0 && values[curr] < 0) {
-    if (0 == ((bad_line[y_find*mBadPixelMapPitch] >> (x&7)) & 1)) {
-      values[curr] =
-          (reinterpret_cast<ushort16*>(getDataUncropped(x, y_find)))[component];
-      dist[curr] = static_cast<int>(y) - y_find;
-    }
-    y_find -= step;
-  }
-  // Find pixel downwards
-  y_find = static_cast<int>(y) + step;
-  curr = 3;
-  while (y_find < uncropped_dim.y && values[curr] < 0) {
-    if (0 == ((bad_line[y_find*mBadPixelMapPitch] >> (x&7)) & 1)) {
-      values[curr] =
-          (reinterpret_cast<ushort16*>(getDataUncropped(x, y_find)))[component];
-      dist[curr] = y_find - static_cast<int>(y);
-    }
-    y_find += step;
+void RawImageDataU16::scaleToHalfFloat(const Array2DRef<ushort16>& out) {
+  if (!data)
+    ThrowRDE("Data not yet allocated.");
+  if (out.width != dim.x * static_cast<int>(cpp) || out.height != dim.y)
+    ThrowRDE("The output of %i x %i values is not of the image", out.width,
+             out.height);
+
+  // As in scaleValues_plain(), of the even and the odd rows, but normalized.
+  std::array<float, 4> mul;
+  std::array<float, 4> sub;
+  const bool scale = setUpScaleBlackWhite();
+  for (int i = 0; i < 4; i++) {
+    int v = i;
+    if ((mOffset.x & 1) != 0)
+      v ^= 1;
+    if ((mOffset.y & 1) != 0)
+      v ^= 2;
+    const int black = scale ? blackLevelSeparate[v] : 0;
+    const int white = scale ? whitePoint : 65535;
+    if (white <= black)
+      ThrowRDE("The white level %i is not above the black level %i", white,
+               black);
+    mul[i] = 1.0F / static_cast<float>(white - black);
+    sub[i] = static_cast<float>(black);
   }
 
-  // Find x weights
-  int total_dist_x = dist[0] + dist[1];
+  const HalfRowFunction halfRow = getHalfRowFunction();
+  parallelFor(0, dim.y, int64_t(dim.y) * pitch,
+              [this, &out, &sub, &mul, halfRow](int y) {
+                const auto* in = reinterpret_cast<const ushort16*>(
+                    getData(0, y));
+                halfRow(in, &out(0, y), out.width, &sub[2 * (y & 1)],
+                        &mul[2 * (y & 1)]);
+              });
+}
 
-  int total_shifts = 7;
-  if (total_dist_x) {
-    weight[0] = dist[0] ? (total_dist_x - dist[0]) * 256 / total_dist_x : 0;
-    weight[1] = 256 - weight[0];
-    total_shifts++;
+namespace {
+
+// How many rows the dithered lookup does side by side. More of them do not
+// help, they just run out of the registers.
+constexpr int DitherRows = 4;
+
+// The dithering is a serial chain along each row, of a multiply and an add
+// per pixel, and that is what limits the speed of the lookup. Each row still
+// has its own chain, seeded by its y, and so the result is the same however
+// the rows are split. But with several rows being done at once, their chains
+// overlap.
+template <int numRows>
+RAWSPEED_TARGET_CLONES void lookupDitheredRows(RawImageData* img,
+                                               const uint32* t, int y,
+                                               int width) {
+  std::array<ushort16*, numRows> rows;
+  std::array<uint32, numRows> random;
+  for (int r = 0; r < numRows; r++) {
+    rows[r] = reinterpret_cast<ushort16*>(img->getDataUncropped(0, y + r));
+    random[r] = (img->getUncroppedDim().x + (y + r) * 13) ^ 0x45694584;
   }
 
-  // Find y weights
-  int total_dist_y = dist[2] + dist[3];
-  if (total_dist_y) {
-    weight[2] = dist[2] ? (total_dist_y - dist[2]) * 256 / total_dist_y : 0;
-    weight[3] = 256-weight[2];
-    total_shifts++;
+  for (int x = 0; x < width; x++) {
+    for (int r = 0; r < numRows; r++) {
+      const uint32 lookup = t[rows[r][x]];
+      const uint32 base = lookup & 0xffff;
+      const uint32 delta = lookup >> 16;
+      random[r] = TableLookUp::nextRandom(random[r]);
+      const uint32 pix = base + ((delta * (random[r] & 2047) + 1024) >> 12);
+      rows[r][x] = clampBits(pix, 16);
+    }
   }
-
-  int total_pixel = 0;
-  for (int i = 0; i < 4; i++)
-    if (values[i] >= 0)
-      total_pixel += values[i] * weight[i];
-
-  total_pixel >>= total_shifts;
-  auto* pix = reinterpret_cast<ushort16*>(getDataUncropped(x, y));
-  pix[component] = clampBits(total_pixel, 16);
-
-  /* Process other pixels - could be done inline, since we have the weights */
-  if (cpp > 1 && component == 0)
-    for (int i = 1; i < static_cast<int>(cpp); i++)
-      fixBadPixel(x,y,i);
 }
 
-// TODO: Could be done with SSE2
+} // namespace
+
 void RawImageDataU16::doLookup( int start_y, int end_y )
 {
   if (table->ntables == 1) {
     if (table->dither) {
-      int gw = uncropped_dim.x * cpp;
-      auto* t = reinterpret_cast<uint32*>(table->getTable(0));
-      for (int y = start_y; y < end_y; y++) {
-        uint32 v = (uncropped_dim.x + y * 13) ^ 0x45694584;
-        auto* pixel = reinterpret_cast<ushort16*>(getDataUncropped(0, y));
-        for (int x = 0 ; x < gw; x++) {
-          ushort16 p = *pixel;
-          uint32 lookup = t[p];
-          uint32 base = lookup & 0xffff;
-          uint32 delta = lookup >> 16;
-          v = 15700 *(v & 65535) + (v >> 16);
-          uint32 pix = base + ((delta * (v & 2047) + 1024) >> 12);
-          *pixel = clampBits(pix, 16);
-          pixel++;
-        }
-      }
+      const int gw = uncropped_dim.x * cpp;
+      const auto* t = reinterpret_cast<const uint32*>(table->getTable(0));
+      int y = start_y;
+      for (; y + DitherRows <= end_y; y += DitherRows)
+        lookupDitheredRows<DitherRows>(this, t, y, gw);
+      for (; y < end_y; y++)
+        lookupDitheredRows<1>(this, t, y, gw);
       return;
     }
 
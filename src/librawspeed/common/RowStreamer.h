@@ -0,0 +1,98 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"                      // for uchar8, roundUp
+#include "common/DefaultInitAllocatorAdaptor.h" // for DefaultInitAllocat...
+#include "common/Memory.h"                      // for copyNonTemporal
+#include <algorithm>                            // for max, min
+#include <cassert>                              // for assert
+#include <cstddef>                              // for size_t
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+// Where a decompressor writes its output rows, which are written once, and
+// not read again until long after the decode. If all of them do not fit
+// into the last level cache, see useNonTemporalStores(), each few of them
+// are decoded into a small buffer, which stays in the L1/L2 cache, and are
+// then copied out to the image with the non-temporal stores, so that the
+// cache lines of the image are never read for ownership. Otherwise, they are
+// decoded straight into the image, as before.
+class RowStreamer final {
+  uchar8* const out;
+  const size_t outPitch;
+  const size_t rowBytes;
+  const size_t stagingBytes;
+  const bool streaming;
+
+public:
+  // The default size of the buffer of each of the bands.
+  static constexpr size_t StagingBytes = 64 * 1024;
+
+  // The rows, of rowBytes each, start at out, every outPitch bytes, and
+  // there are rows of them.
+  RowStreamer(uchar8* out_, size_t outPitch_, size_t rowBytes_, size_t rows,
+              size_t stagingBytes_ = StagingBytes)
+      : out(out_), outPitch(outPitch_), rowBytes(rowBytes_),
+        stagingBytes(stagingBytes_),
+        streaming(useNonTemporalStores(rowBytes * rows)) {}
+
+  bool isStreaming() const { return streaming; }
+
+  // Calls decode(dest, destPitch, first, last) for the rows [begin, end),
+  // where dest is where the row first is to be written, and the next ones
+  // every destPitch bytes. If streaming, in chunks of whole groups of
+  // rowsPerGroup rows, except for the last one, as many as fit into the
+  // buffer, but at least one group.
+  template <typename Decode>
+  void operator()(size_t begin, size_t end, size_t rowsPerGroup,
+                  const Decode& decode) const {
+    assert(rowsPerGroup > 0);
+    if (begin >= end)
+      return;
+
+    if (!streaming) {
+      decode(out + begin * outPitch, outPitch, begin, end);
+      return;
+    }
+
+    // The rows of the buffer start at the cache lines.
+    const size_t pitch = roundUp(rowBytes, 64);
+    const size_t groups = std::max<size_t>(
+        1, stagingBytes / (pitch * rowsPerGroup));
+    const size_t rowsPerChunk =
+        std::min(groups * rowsPerGroup, end - begin);
+
+    std::vector<uchar8, DefaultInitAllocatorAdaptor<uchar8>> staging(
+        pitch * rowsPerChunk);
+    for (size_t first = begin; first < end; first += rowsPerChunk) {
+      const size_t last = std::min(first + rowsPerChunk, end);
+      decode(staging.data(), pitch, first, last);
+      for (size_t row = first; row < last; row++) {
+        copyNonTemporal(out + row * outPitch, &staging[(row - first) * pitch],
+                        rowBytes);
+      }
+    }
+  }
+};
+
+} // namespace rawspeed
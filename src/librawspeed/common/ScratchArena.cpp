@@ -0,0 +1,118 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/ScratchArena.h"
+#include "common/Memory.h" // for alignedFree, alignedMalloc
+#include <algorithm>       // for max, min
+#include <memory>          // for make_unique
+#include <mutex>           // for lock_guard
+#include <new>             // for bad_alloc
+#include <utility>         // for swap
+
+namespace rawspeed {
+
+ScratchArena::ScratchArena(size_t chunkSize_)
+    : chunkSize(roundUp(std::max<size_t>(chunkSize_, alignment), alignment)) {}
+
+ScratchArena::~ScratchArena() { freeAll(); }
+
+void ScratchArena::freeAll() {
+  current.store(nullptr, std::memory_order_release);
+  for (const auto& c : chunks)
+    alignedFree(c->data);
+  chunks.clear();
+}
+
+uchar8* ScratchArena::allocateSlow(size_t size) {
+  std::lock_guard<std::mutex> guard(mutex);
+
+  // Another thread may have just added a chunk.
+  Chunk* c = current.load(std::memory_order_acquire);
+  if (c) {
+    const size_t offset = c->used.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size <= c->size)
+      return c->data + offset;
+  }
+
+  // The large ones do not take the rest of the current chunk with them.
+  const bool large = size > chunkSize / 4;
+  const size_t newSize = large ? size : chunkSize;
+  auto* data = alignedMalloc<uchar8, alignment>(newSize);
+  if (!data)
+    throw std::bad_alloc();
+
+  chunks.emplace_back(std::make_unique<Chunk>(data, newSize));
+  Chunk* n = chunks.back().get();
+  n->used.store(size, std::memory_order_relaxed);
+  if (large && c) {
+    // Keep the current one last.
+    std::swap(chunks.back(), chunks[chunks.size() - 2]);
+  } else {
+    current.store(n, std::memory_order_release);
+  }
+  return data;
+}
+
+void ScratchArena::reset() {
+  std::lock_guard<std::mutex> guard(mutex);
+
+  if (chunks.size() == 1) {
+    chunks.front()->used.store(0, std::memory_order_relaxed);
+    current.store(chunks.front().get(), std::memory_order_release);
+    return;
+  }
+
+  size_t total = 0;
+  for (const auto& c : chunks)
+    total += c->size;
+  freeAll();
+
+  if (!total)
+    return;
+
+  auto* data = alignedMalloc<uchar8, alignment>(total);
+  if (!data)
+    return; // The next allocation will try again.
+  chunks.emplace_back(std::make_unique<Chunk>(data, total));
+  current.store(chunks.back().get(), std::memory_order_release);
+}
+
+void ScratchArena::release() {
+  std::lock_guard<std::mutex> guard(mutex);
+  freeAll();
+}
+
+size_t ScratchArena::getUsedBytes() {
+  std::lock_guard<std::mutex> guard(mutex);
+  size_t used = 0;
+  for (const auto& c : chunks)
+    used += std::min(c->used.load(std::memory_order_relaxed), c->size);
+  return used;
+}
+
+size_t ScratchArena::getReservedBytes() {
+  std::lock_guard<std::mutex> guard(mutex);
+  size_t reserved = 0;
+  for (const auto& c : chunks)
+    reserved += c->size;
+  return reserved;
+}
+
+} // namespace rawspeed
@@ -0,0 +1,164 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"                      // for uchar8
+#include "common/DefaultInitAllocatorAdaptor.h" // for DefaultInitAllocat...
+#include <atomic>                               // for atomic
+#include <cstddef>                              // for size_t
+#include <memory>                               // for unique_ptr
+#include <mutex>                                // for mutex
+#include <new>                                  // for bad_alloc
+#include <type_traits>                          // for true_type
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+// The temporary buffers of a decode, e.g. the line buffers of the
+// decompressors, or the histograms of the black areas, come from here rather
+// than from the heap: each allocation is just an atomic increment within the
+// current chunk, and the deallocations do nothing. All of the memory is
+// given back at once by reset(), which keeps it for the next decode, so a
+// batch of the decodes of the same camera does not allocate at all after
+// the first one. See RawDecoder::scratchArena.
+//
+// Any number of threads may allocate at the same time. Each allocation is
+// aligned to, and padded to, a cache line, so those of the different
+// threads do not share one.
+class ScratchArena final {
+  struct Chunk final {
+    uchar8* data;
+    size_t size;
+    std::atomic<size_t> used{0};
+
+    Chunk(uchar8* data_, size_t size_) : data(data_), size(size_) {}
+  };
+
+  std::mutex mutex;
+  // All of them, the current one being the last one, unless it is one of the
+  // large allocations, which get a chunk of their own.
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  std::atomic<Chunk*> current{nullptr};
+  const size_t chunkSize;
+
+  uchar8* allocateSlow(size_t size);
+  void freeAll();
+
+public:
+  static constexpr size_t alignment = 64;
+
+  explicit ScratchArena(size_t chunkSize_ = 1UL << 20UL);
+
+  ScratchArena(const ScratchArena&) = delete;
+  ScratchArena(ScratchArena&&) = delete;
+  ScratchArena& operator=(const ScratchArena&) = delete;
+  ScratchArena& operator=(ScratchArena&&) = delete;
+
+  ~ScratchArena();
+
+  // Throws std::bad_alloc, as the heap would.
+  uchar8* allocate(size_t size) {
+    size = roundUp(size ? size : 1, alignment);
+    Chunk* c = current.load(std::memory_order_acquire);
+    if (c) {
+      const size_t offset = c->used.fetch_add(size, std::memory_order_relaxed);
+      if (offset + size <= c->size)
+        return c->data + offset;
+    }
+    return allocateSlow(size);
+  }
+
+  // Gives back all of the allocations. If there was more than one chunk,
+  // they are replaced by a single one of their total size, which then fits
+  // all of the next decode of the same kind. Must not be called while
+  // anything still uses the memory.
+  void reset();
+
+  // Same, but frees all of the memory.
+  void release();
+
+  // Of the allocations since the last reset(), and of the chunks.
+  size_t getUsedBytes();
+  size_t getReservedBytes();
+};
+
+// An allocator for the containers, e.g. std::vector, of the memory of an
+// arena, or of the heap if there is none.
+template <typename T> class ScratchAllocator {
+  ScratchArena* arena = nullptr;
+
+  template <typename U> friend class ScratchAllocator;
+
+public:
+  using value_type = T;
+
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ScratchAllocator() noexcept = default;
+
+  explicit ScratchAllocator(ScratchArena* arena_) noexcept : arena(arena_) {}
+
+  template <typename U>
+  ScratchAllocator(const ScratchAllocator<U>& other) noexcept // NOLINT
+      : arena(other.arena) {}
+
+  ScratchArena* getArena() const { return arena; }
+
+  T* allocate(size_t n, const void* /*hint*/ = nullptr) {
+    static_assert(alignof(T) <= ScratchArena::alignment, "too high alignment");
+    if (n > static_cast<size_t>(-1) / sizeof(T))
+      throw std::bad_alloc();
+    if (arena)
+      return reinterpret_cast<T*>(arena->allocate(n * sizeof(T)));
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    if (!arena)
+      std::allocator<T>().deallocate(p, n);
+  }
+};
+
+template <typename T0, typename T1>
+bool operator==(const ScratchAllocator<T0>& x,
+                const ScratchAllocator<T1>& y) noexcept {
+  return x.getArena() == y.getArena();
+}
+
+template <typename T0, typename T1>
+bool operator!=(const ScratchAllocator<T0>& x,
+                const ScratchAllocator<T1>& y) noexcept {
+  return !(x == y);
+}
+
+// The usual scratch buffer, the elements of which are not initialized.
+template <typename T>
+using ScratchVector =
+    std::vector<T, DefaultInitAllocatorAdaptor<T, ScratchAllocator<T>>>;
+
+template <typename T> ScratchVector<T> makeScratchVector(ScratchArena* arena) {
+  using Allocator = typename ScratchVector<T>::allocator_type;
+  return ScratchVector<T>(Allocator(ScratchAllocator<T>(arena)));
+}
+
+} // namespace rawspeed
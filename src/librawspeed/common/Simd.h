@@ -0,0 +1,137 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "rawspeedconfig.h"
+#include "common/Cpuid.h" // for Cpuid
+
+// The kernels that are written once, for all of the targets: the header of
+// a kernel is included once for each of the targets that are built, see
+// common/SimdForEachTarget.h, each time in a namespace of its own, e.g.
+// simd_avx2, in which the vectors and the operations on them, see
+// common/SimdOps.h, are those of the target, and in which everything is
+// compiled for the target, as if with the target attribute. Then
+// RAWSPEED_SIMD_DISPATCH() picks the variant of the best target that the
+// CPU has, and that is enabled, see Cpuid.
+
+// Those that are compiled with the target attribute need GCC or Clang.
+#if defined(WITH_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define RAWSPEED_SIMD_SSE41
+#include <smmintrin.h> // for _mm_packus_epi32, _mm_cvtepu16_epi32
+#endif
+#ifdef WITH_AVX2
+#define RAWSPEED_SIMD_AVX2
+#endif
+#ifdef WITH_AVX512
+#define RAWSPEED_SIMD_AVX512
+#endif
+#if defined(RAWSPEED_SIMD_AVX2) || defined(RAWSPEED_SIMD_AVX512)
+#include <immintrin.h> // for __m256i, __m512i
+#endif
+#ifdef WITH_NEON
+#define RAWSPEED_SIMD_NEON
+#include <arm_neon.h> // for uint16x8_t, int32x4_t, float32x4_t
+#endif
+
+// The values of RAWSPEED_SIMD_TARGET, as the preprocessor can only compare
+// the numbers.
+#define RAWSPEED_SIMD_TARGET_SCALAR 0
+#define RAWSPEED_SIMD_TARGET_SSE41 1
+#define RAWSPEED_SIMD_TARGET_AVX2 2
+#define RAWSPEED_SIMD_TARGET_AVX512 3
+#define RAWSPEED_SIMD_TARGET_NEON 4
+
+namespace rawspeed {
+
+enum class SimdTarget {
+  SCALAR,
+  SSE41,
+  AVX2,
+  AVX512, // with AVX512BW
+  NEON,
+};
+
+inline SimdTarget __attribute__((pure)) getSimdTarget() {
+#ifdef RAWSPEED_SIMD_AVX512
+  if (Cpuid::AVX512BW())
+    return SimdTarget::AVX512;
+#endif
+#ifdef RAWSPEED_SIMD_AVX2
+  if (Cpuid::AVX2())
+    return SimdTarget::AVX2;
+#endif
+#ifdef RAWSPEED_SIMD_SSE41
+  if (Cpuid::SSE41())
+    return SimdTarget::SSE41;
+#endif
+#ifdef RAWSPEED_SIMD_NEON
+  if (Cpuid::NEON())
+    return SimdTarget::NEON;
+#endif
+  return SimdTarget::SCALAR;
+}
+
+} // namespace rawspeed
+
+#ifdef RAWSPEED_SIMD_SSE41
+#define RAWSPEED_SIMD_CASE_SSE41(...)                                          \
+  case SimdTarget::SSE41:                                                      \
+    return &simd_sse41::__VA_ARGS__;
+#else
+#define RAWSPEED_SIMD_CASE_SSE41(...)
+#endif
+#ifdef RAWSPEED_SIMD_AVX2
+#define RAWSPEED_SIMD_CASE_AVX2(...)                                           \
+  case SimdTarget::AVX2:                                                       \
+    return &simd_avx2::__VA_ARGS__;
+#else
+#define RAWSPEED_SIMD_CASE_AVX2(...)
+#endif
+#ifdef RAWSPEED_SIMD_AVX512
+#define RAWSPEED_SIMD_CASE_AVX512(...)                                         \
+  case SimdTarget::AVX512:                                                     \
+    return &simd_avx512::__VA_ARGS__;
+#else
+#define RAWSPEED_SIMD_CASE_AVX512(...)
+#endif
+#ifdef RAWSPEED_SIMD_NEON
+#define RAWSPEED_SIMD_CASE_NEON(...)                                           \
+  case SimdTarget::NEON:                                                       \
+    return &simd_neon::__VA_ARGS__;
+#else
+#define RAWSPEED_SIMD_CASE_NEON(...)
+#endif
+
+// The pointer to the variant of the kernel for getSimdTarget(), e.g.
+// RAWSPEED_SIMD_DISPATCH(deltaRow<Scale>) is &simd_avx2::deltaRow<Scale> on
+// a CPU with AVX2, but without AVX-512. Where the kernels are.
+#define RAWSPEED_SIMD_DISPATCH(...)                                            \
+  [] {                                                                         \
+    switch (getSimdTarget()) {                                                 \
+      RAWSPEED_SIMD_CASE_AVX512(__VA_ARGS__)                                   \
+      RAWSPEED_SIMD_CASE_AVX2(__VA_ARGS__)                                     \
+      RAWSPEED_SIMD_CASE_SSE41(__VA_ARGS__)                                    \
+      RAWSPEED_SIMD_CASE_NEON(__VA_ARGS__)                                     \
+    default:                                                                   \
+      break;                                                                   \
+    }                                                                          \
+    return &simd_scalar::__VA_ARGS__;                                          \
+  }()
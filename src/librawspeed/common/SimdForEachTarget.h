@@ -0,0 +1,117 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// No include guard: see common/Simd.h. Includes RAWSPEED_SIMD_KERNELS, the
+// header of the kernels, once for each of the targets that are built, in
+// the namespace of it, e.g. simd_avx2, within the namespace that this is
+// included in, which is usually an anonymous one. E.g.
+//
+//   #define RAWSPEED_SIMD_KERNELS "common/DngOpcodesKernels.h"
+//   #include "common/SimdForEachTarget.h"
+
+#ifndef RAWSPEED_SIMD_KERNELS
+#error "RAWSPEED_SIMD_KERNELS must be the header of the kernels"
+#endif
+
+#define RAWSPEED_SIMD_TARGET RAWSPEED_SIMD_TARGET_SCALAR
+namespace simd_scalar {
+#include "common/SimdOps.h"
+#include RAWSPEED_SIMD_KERNELS
+} // namespace simd_scalar
+#undef RAWSPEED_SIMD_TARGET
+
+#ifdef RAWSPEED_SIMD_SSE41
+#define RAWSPEED_SIMD_TARGET RAWSPEED_SIMD_TARGET_SSE41
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("sse4.1"))),               \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+namespace simd_sse41 {
+#include "common/SimdOps.h"
+#include RAWSPEED_SIMD_KERNELS
+} // namespace simd_sse41
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#undef RAWSPEED_SIMD_TARGET
+#endif
+
+#ifdef RAWSPEED_SIMD_AVX2
+#define RAWSPEED_SIMD_TARGET RAWSPEED_SIMD_TARGET_AVX2
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("avx2"))),                 \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace simd_avx2 {
+#include "common/SimdOps.h"
+#include RAWSPEED_SIMD_KERNELS
+} // namespace simd_avx2
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#undef RAWSPEED_SIMD_TARGET
+#endif
+
+#ifdef RAWSPEED_SIMD_AVX512
+#define RAWSPEED_SIMD_TARGET RAWSPEED_SIMD_TARGET_AVX512
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw"))),     \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+// Of the _mm512_undefined_*() that the intrinsics start from, a false one.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+namespace simd_avx512 {
+#include "common/SimdOps.h"
+#include RAWSPEED_SIMD_KERNELS
+} // namespace simd_avx512
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+#undef RAWSPEED_SIMD_TARGET
+#endif
+
+// NEON is there on all of the targets that it is built for.
+#ifdef RAWSPEED_SIMD_NEON
+#define RAWSPEED_SIMD_TARGET RAWSPEED_SIMD_TARGET_NEON
+namespace simd_neon {
+#include "common/SimdOps.h"
+#include RAWSPEED_SIMD_KERNELS
+} // namespace simd_neon
+#undef RAWSPEED_SIMD_TARGET
+#endif
+
+#undef RAWSPEED_SIMD_KERNELS
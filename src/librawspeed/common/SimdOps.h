@@ -0,0 +1,336 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// No include guard: see common/Simd.h. Included in the namespace of each of
+// the targets, and defines, for RAWSPEED_SIMD_TARGET:
+//
+// Lanes, the number of the ushort16 in a VU16; VI32 and VF32 have half of
+// them, as int and float, e.g. the lower and the upper half of a VU16.
+//
+// VU16 loadU16(const ushort16*), storeU16(ushort16*, VU16), unaligned;
+// VI32 lowerI32(VU16), upperI32(VU16), the halves, zero-extended;
+// VU16 packU16(VI32 lower, VI32 upper), with the unsigned saturation;
+// VI32 setI32(int), loadI32(const int*), +, *, shiftRight<N>(), arithmetic;
+// VF32 setF32(float), loadF32(const float*), +, *, min(), max();
+// VF32 toF32(VI32), and VI32 truncI32(VF32), rounding towards zero.
+//
+// The results are the same on all of the targets, and the same as of the
+// scalar code that does the same, with the float arithmetic not contracted.
+
+#if RAWSPEED_SIMD_TARGET == RAWSPEED_SIMD_TARGET_SCALAR &&                     \
+    !defined(RAWSPEED_SIMD_OPS_SCALAR)
+#define RAWSPEED_SIMD_OPS_SCALAR
+
+// Of the width of SSE2, with the loops that the compiler vectorizes.
+constexpr int Lanes = 8;
+
+struct VU16 {
+  ushort16 v[Lanes];
+};
+struct VI32 {
+  int v[Lanes / 2];
+};
+struct VF32 {
+  float v[Lanes / 2];
+};
+
+template <typename V, typename F> inline V makeLanes(const F& f) {
+  V r;
+  for (int i = 0; i < Lanes / 2; i++)
+    r.v[i] = f(i);
+  return r;
+}
+
+inline VU16 loadU16(const ushort16* p) {
+  VU16 r;
+  for (int i = 0; i < Lanes; i++)
+    r.v[i] = p[i];
+  return r;
+}
+inline void storeU16(ushort16* p, const VU16& a) {
+  for (int i = 0; i < Lanes; i++)
+    p[i] = a.v[i];
+}
+inline VI32 lowerI32(const VU16& a) {
+  return makeLanes<VI32>([&a](int i) { return a.v[i]; });
+}
+inline VI32 upperI32(const VU16& a) {
+  return makeLanes<VI32>([&a](int i) { return a.v[Lanes / 2 + i]; });
+}
+inline VU16 packU16(const VI32& lower, const VI32& upper) {
+  VU16 r;
+  for (int i = 0; i < Lanes; i++) {
+    const int v = i < Lanes / 2 ? lower.v[i] : upper.v[i - Lanes / 2];
+    r.v[i] = v < 0 ? 0 : (v > 65535 ? 65535 : v);
+  }
+  return r;
+}
+
+inline VI32 setI32(int v) {
+  return makeLanes<VI32>([v](int) { return v; });
+}
+inline VI32 loadI32(const int* p) {
+  return makeLanes<VI32>([p](int i) { return p[i]; });
+}
+inline VI32 operator+(const VI32& a, const VI32& b) {
+  return makeLanes<VI32>([&a, &b](int i) { return a.v[i] + b.v[i]; });
+}
+inline VI32 operator*(const VI32& a, const VI32& b) {
+  return makeLanes<VI32>([&a, &b](int i) { return a.v[i] * b.v[i]; });
+}
+template <int N> inline VI32 shiftRight(const VI32& a) {
+  return makeLanes<VI32>([&a](int i) { return a.v[i] >> N; });
+}
+
+inline VF32 setF32(float v) {
+  return makeLanes<VF32>([v](int) { return v; });
+}
+inline VF32 loadF32(const float* p) {
+  return makeLanes<VF32>([p](int i) { return p[i]; });
+}
+inline VF32 operator+(const VF32& a, const VF32& b) {
+  return makeLanes<VF32>([&a, &b](int i) { return a.v[i] + b.v[i]; });
+}
+inline VF32 operator*(const VF32& a, const VF32& b) {
+  return makeLanes<VF32>([&a, &b](int i) { return a.v[i] * b.v[i]; });
+}
+inline VF32 min(const VF32& a, const VF32& b) {
+  return makeLanes<VF32>(
+      [&a, &b](int i) { return a.v[i] < b.v[i] ? a.v[i] : b.v[i]; });
+}
+inline VF32 max(const VF32& a, const VF32& b) {
+  return makeLanes<VF32>(
+      [&a, &b](int i) { return a.v[i] > b.v[i] ? a.v[i] : b.v[i]; });
+}
+inline VF32 toF32(const VI32& a) {
+  return makeLanes<VF32>([&a](int i) { return static_cast<float>(a.v[i]); });
+}
+inline VI32 truncI32(const VF32& a) {
+  return makeLanes<VI32>([&a](int i) { return static_cast<int>(a.v[i]); });
+}
+
+#elif RAWSPEED_SIMD_TARGET == RAWSPEED_SIMD_TARGET_SSE41 &&                   \
+    !defined(RAWSPEED_SIMD_OPS_SSE41)
+#define RAWSPEED_SIMD_OPS_SSE41
+
+constexpr int Lanes = 8;
+
+struct VU16 {
+  __m128i v;
+};
+struct VI32 {
+  __m128i v;
+};
+struct VF32 {
+  __m128 v;
+};
+
+inline VU16 loadU16(const ushort16* p) {
+  return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+}
+inline void storeU16(ushort16* p, VU16 a) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.v);
+}
+inline VI32 lowerI32(VU16 a) { return {_mm_cvtepu16_epi32(a.v)}; }
+inline VI32 upperI32(VU16 a) {
+  return {_mm_cvtepu16_epi32(_mm_srli_si128(a.v, 8))};
+}
+inline VU16 packU16(VI32 lower, VI32 upper) {
+  return {_mm_packus_epi32(lower.v, upper.v)};
+}
+
+inline VI32 setI32(int v) { return {_mm_set1_epi32(v)}; }
+inline VI32 loadI32(const int* p) {
+  return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+}
+inline VI32 operator+(VI32 a, VI32 b) { return {_mm_add_epi32(a.v, b.v)}; }
+inline VI32 operator*(VI32 a, VI32 b) { return {_mm_mullo_epi32(a.v, b.v)}; }
+template <int N> inline VI32 shiftRight(VI32 a) {
+  return {_mm_srai_epi32(a.v, N)};
+}
+
+inline VF32 setF32(float v) { return {_mm_set1_ps(v)}; }
+inline VF32 loadF32(const float* p) { return {_mm_loadu_ps(p)}; }
+inline VF32 operator+(VF32 a, VF32 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline VF32 operator*(VF32 a, VF32 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline VF32 min(VF32 a, VF32 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline VF32 max(VF32 a, VF32 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline VF32 toF32(VI32 a) { return {_mm_cvtepi32_ps(a.v)}; }
+inline VI32 truncI32(VF32 a) { return {_mm_cvttps_epi32(a.v)}; }
+
+#elif RAWSPEED_SIMD_TARGET == RAWSPEED_SIMD_TARGET_AVX2 &&                    \
+    !defined(RAWSPEED_SIMD_OPS_AVX2)
+#define RAWSPEED_SIMD_OPS_AVX2
+
+constexpr int Lanes = 16;
+
+struct VU16 {
+  __m256i v;
+};
+struct VI32 {
+  __m256i v;
+};
+struct VF32 {
+  __m256 v;
+};
+
+inline VU16 loadU16(const ushort16* p) {
+  return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))};
+}
+inline void storeU16(ushort16* p, VU16 a) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v);
+}
+inline VI32 lowerI32(VU16 a) {
+  return {_mm256_cvtepu16_epi32(_mm256_castsi256_si128(a.v))};
+}
+inline VI32 upperI32(VU16 a) {
+  return {_mm256_cvtepu16_epi32(_mm256_extracti128_si256(a.v, 1))};
+}
+// The packing is within each 128-bit lane.
+inline VU16 packU16(VI32 lower, VI32 upper) {
+  return {_mm256_permute4x64_epi64(_mm256_packus_epi32(lower.v, upper.v),
+                                   0xD8)};
+}
+
+inline VI32 setI32(int v) { return {_mm256_set1_epi32(v)}; }
+inline VI32 loadI32(const int* p) {
+  return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))};
+}
+inline VI32 operator+(VI32 a, VI32 b) { return {_mm256_add_epi32(a.v, b.v)}; }
+inline VI32 operator*(VI32 a, VI32 b) {
+  return {_mm256_mullo_epi32(a.v, b.v)};
+}
+template <int N> inline VI32 shiftRight(VI32 a) {
+  return {_mm256_srai_epi32(a.v, N)};
+}
+
+inline VF32 setF32(float v) { return {_mm256_set1_ps(v)}; }
+inline VF32 loadF32(const float* p) { return {_mm256_loadu_ps(p)}; }
+inline VF32 operator+(VF32 a, VF32 b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline VF32 operator*(VF32 a, VF32 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline VF32 min(VF32 a, VF32 b) { return {_mm256_min_ps(a.v, b.v)}; }
+inline VF32 max(VF32 a, VF32 b) { return {_mm256_max_ps(a.v, b.v)}; }
+inline VF32 toF32(VI32 a) { return {_mm256_cvtepi32_ps(a.v)}; }
+inline VI32 truncI32(VF32 a) { return {_mm256_cvttps_epi32(a.v)}; }
+
+#elif RAWSPEED_SIMD_TARGET == RAWSPEED_SIMD_TARGET_AVX512 &&                  \
+    !defined(RAWSPEED_SIMD_OPS_AVX512)
+#define RAWSPEED_SIMD_OPS_AVX512
+
+constexpr int Lanes = 32;
+
+struct VU16 {
+  __m512i v;
+};
+struct VI32 {
+  __m512i v;
+};
+struct VF32 {
+  __m512 v;
+};
+
+inline VU16 loadU16(const ushort16* p) {
+  return {_mm512_loadu_si512(p)};
+}
+inline void storeU16(ushort16* p, VU16 a) { _mm512_storeu_si512(p, a.v); }
+inline VI32 lowerI32(VU16 a) {
+  return {_mm512_cvtepu16_epi32(_mm512_castsi512_si256(a.v))};
+}
+inline VI32 upperI32(VU16 a) {
+  return {_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(a.v, 1))};
+}
+// The packing is within each 128-bit lane.
+inline VU16 packU16(VI32 lower, VI32 upper) {
+  return {_mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7),
+                                   _mm512_packus_epi32(lower.v, upper.v))};
+}
+
+inline VI32 setI32(int v) { return {_mm512_set1_epi32(v)}; }
+inline VI32 loadI32(const int* p) { return {_mm512_loadu_si512(p)}; }
+inline VI32 operator+(VI32 a, VI32 b) { return {_mm512_add_epi32(a.v, b.v)}; }
+inline VI32 operator*(VI32 a, VI32 b) {
+  return {_mm512_mullo_epi32(a.v, b.v)};
+}
+template <int N> inline VI32 shiftRight(VI32 a) {
+  return {_mm512_srai_epi32(a.v, N)};
+}
+
+// With the FMA of AVX-512F, the compiler would otherwise contract them.
+inline VF32 setF32(float v) { return {_mm512_set1_ps(v)}; }
+inline VF32 loadF32(const float* p) { return {_mm512_loadu_ps(p)}; }
+inline VF32 operator+(VF32 a, VF32 b) {
+  return {_mm512_add_round_ps(a.v, b.v,
+                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)};
+}
+inline VF32 operator*(VF32 a, VF32 b) {
+  return {_mm512_mul_round_ps(a.v, b.v,
+                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)};
+}
+inline VF32 min(VF32 a, VF32 b) { return {_mm512_min_ps(a.v, b.v)}; }
+inline VF32 max(VF32 a, VF32 b) { return {_mm512_max_ps(a.v, b.v)}; }
+inline VF32 toF32(VI32 a) { return {_mm512_cvtepi32_ps(a.v)}; }
+inline VI32 truncI32(VF32 a) { return {_mm512_cvttps_epi32(a.v)}; }
+
+#elif RAWSPEED_SIMD_TARGET == RAWSPEED_SIMD_TARGET_NEON &&                    \
+    !defined(RAWSPEED_SIMD_OPS_NEON)
+#define RAWSPEED_SIMD_OPS_NEON
+
+constexpr int Lanes = 8;
+
+struct VU16 {
+  uint16x8_t v;
+};
+struct VI32 {
+  int32x4_t v;
+};
+struct VF32 {
+  float32x4_t v;
+};
+
+inline VU16 loadU16(const ushort16* p) { return {vld1q_u16(p)}; }
+inline void storeU16(ushort16* p, VU16 a) { vst1q_u16(p, a.v); }
+inline VI32 lowerI32(VU16 a) {
+  return {vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(a.v)))};
+}
+inline VI32 upperI32(VU16 a) {
+  return {vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(a.v)))};
+}
+inline VU16 packU16(VI32 lower, VI32 upper) {
+  return {vcombine_u16(vqmovun_s32(lower.v), vqmovun_s32(upper.v))};
+}
+
+inline VI32 setI32(int v) { return {vdupq_n_s32(v)}; }
+inline VI32 loadI32(const int* p) { return {vld1q_s32(p)}; }
+inline VI32 operator+(VI32 a, VI32 b) { return {vaddq_s32(a.v, b.v)}; }
+inline VI32 operator*(VI32 a, VI32 b) { return {vmulq_s32(a.v, b.v)}; }
+template <int N> inline VI32 shiftRight(VI32 a) {
+  return {vshrq_n_s32(a.v, N)};
+}
+
+inline VF32 setF32(float v) { return {vdupq_n_f32(v)}; }
+inline VF32 loadF32(const float* p) { return {vld1q_f32(p)}; }
+inline VF32 operator+(VF32 a, VF32 b) { return {vaddq_f32(a.v, b.v)}; }
+inline VF32 operator*(VF32 a, VF32 b) { return {vmulq_f32(a.v, b.v)}; }
+inline VF32 min(VF32 a, VF32 b) { return {vminq_f32(a.v, b.v)}; }
+inline VF32 max(VF32 a, VF32 b) { return {vmaxq_f32(a.v, b.v)}; }
+inline VF32 toF32(VI32 a) { return {vcvtq_f32_s32(a.v)}; }
+inline VI32 truncI32(VF32 a) { return {vcvtq_s32_f32(a.v)}; }
+
+#endif
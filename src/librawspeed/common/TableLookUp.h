@@ -21,7 +21,7 @@
 
 #pragma once
 
-#include "common/Common.h" // for ushort16
+#include "common/Common.h" // for ushort16, uint32
 #include <vector>          // for vector
 
 namespace rawspeed {
@@ -32,6 +32,45 @@ public:
 
   void setTable(int ntable, const std::vector<ushort16>& table);
   ushort16* getTable(int n);
+
+  // The pseudo-random number generator of the dithering.
+  static uint32 nextRandom(uint32 r) {
+    return 15700 * (r & 65535) + (r >> 16);
+  }
+
+  // The initial state of the dithering for the pixel (x, y), so that it
+  // does not depend on what was decoded before, nor by whom. A counter-based
+  // hash (the finalizer of MurmurHash3), never 0, where the above would stay.
+  static uint32 seedRandom(uint32 x, uint32 y) {
+    uint32 h = (y << 16 | y >> 16) ^ x ^ 0x9e3779b9U;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h ? h : 1;
+  }
+
+  // The value of the first table, with the dithering, which advances the
+  // random state. As RawImageDataU16::setWithLookUp() does it.
+  ushort16 lookUpDithered(ushort16 value, uint32* random) const {
+    const auto* t = reinterpret_cast<const uint32*>(tables.data());
+    const uint32 lookup = t[value];
+    const uint32 base = lookup & 0xffff;
+    const uint32 delta = lookup >> 16;
+    const uint32 r = *random;
+
+    *random = nextRandom(r);
+    return base + ((delta * (r & 2047) + 1024) >> 12);
+  }
+
+  // Same, but with the state of seedRandom(x, y) for just this pixel, so
+  // that the pixels can be looked up in any order, e.g. by a vector kernel.
+  ushort16 lookUpDitheredAt(ushort16 value, uint32 x, uint32 y) const {
+    uint32 random = seedRandom(x, y);
+    return lookUpDithered(value, &random);
+  }
+
   const int ntables;
   std::vector<ushort16> tables;
   const bool dither;
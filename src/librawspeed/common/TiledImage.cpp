@@ -0,0 +1,107 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/TiledImage.h"
+#include "common/Executor.h"              // for parallelFor
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include <algorithm>                      // for min
+#include <cstdint>                        // for int64_t
+#include <cstring>                        // for memcpy
+
+namespace rawspeed {
+
+TiledImage::TiledImage(const RawImage& img, int tileSize_)
+    : dim(img->dim), cpp(img->getCpp()), dataType(img->getDataType()),
+      bpp(img->getBpp()), tileSize(tileSize_) {
+  if (tileSize < 8 || tileSize > 1024 || !isPowerOfTwo(tileSize))
+    ThrowRDE("Invalid tile size %i", tileSize);
+  if (!img->isAllocated())
+    ThrowRDE("The image has no pixels");
+
+  numTiles = {static_cast<int>(roundUpDivision(dim.x, tileSize)),
+              static_cast<int>(roundUpDivision(dim.y, tileSize))};
+  data.resize(static_cast<size_t>(numTiles.area()) * getTileBytes());
+
+  // A band of the tiles per task.
+  parallelFor(0, numTiles.y, int64_t(dim.y) * img->pitch,
+              [this, &img](int ty) {
+                const int yEnd = std::min(dim.y, (ty + 1) * tileSize);
+                for (int y = ty * tileSize; y < yEnd; y++) {
+                  const uchar8* in = img->getData(0, y);
+                  for (int tx = 0; tx < numTiles.x; tx++) {
+                    const int width =
+                        std::min(tileSize, dim.x - tx * tileSize);
+                    memcpy(getTileData(tx, ty) +
+                               static_cast<size_t>(y % tileSize) *
+                                   getTilePitch(),
+                           in + static_cast<size_t>(tx) * tileSize * bpp,
+                           static_cast<size_t>(width) * bpp);
+                  }
+                }
+              });
+}
+
+Array2DRef<const ushort16> TiledImage::getU16Tile(int tx, int ty) const {
+  if (dataType != TYPE_USHORT16)
+    ThrowRDE("Not a 16-bit image");
+  if (tx < 0 || ty < 0 || tx >= numTiles.x || ty >= numTiles.y)
+    ThrowRDE("No tile %i, %i", tx, ty);
+  return {reinterpret_cast<const ushort16*>(getData(tx * tileSize,
+                                                    ty * tileSize)),
+          tileSize * static_cast<int>(cpp), tileSize};
+}
+
+Array2DRef<const float> TiledImage::getF32Tile(int tx, int ty) const {
+  if (dataType != TYPE_FLOAT32)
+    ThrowRDE("Not a float image");
+  if (tx < 0 || ty < 0 || tx >= numTiles.x || ty >= numTiles.y)
+    ThrowRDE("No tile %i, %i", tx, ty);
+  return {reinterpret_cast<const float*>(getData(tx * tileSize,
+                                                 ty * tileSize)),
+          tileSize * static_cast<int>(cpp), tileSize};
+}
+
+void TiledImage::copyRows(int y, int rows, uchar8* out,
+                          uint32 outPitch) const {
+  if (y < 0 || rows < 0 || rows > dim.y - y)
+    ThrowRDE("The rows %i to %i are not in the image", y, y + rows);
+
+  for (int r = 0; r < rows; r++) {
+    uchar8* row = out + static_cast<size_t>(r) * outPitch;
+    for (int tx = 0; tx < numTiles.x; tx++) {
+      const int width = std::min(tileSize, dim.x - tx * tileSize);
+      memcpy(row + static_cast<size_t>(tx) * tileSize * bpp,
+             getData(tx * tileSize, y + r), static_cast<size_t>(width) * bpp);
+    }
+  }
+}
+
+RawImage TiledImage::untile() const {
+  RawImage img = RawImage::create(dim, dataType, cpp);
+  parallelFor(0, numTiles.y, int64_t(dim.y) * img->pitch,
+              [this, &img](int ty) {
+                const int y = ty * tileSize;
+                copyRows(y, std::min(tileSize, dim.y - y), img->getData(0, y),
+                         img->pitch);
+              });
+  return img;
+}
+
+} // namespace rawspeed
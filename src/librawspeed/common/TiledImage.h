@@ -0,0 +1,105 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Array2DRef.h" // for Array2DRef
+#include "common/Common.h"     // for uchar8, ushort16, uint32
+#include "common/Point.h"      // for iPoint2D
+#include "common/RawImage.h"   // for RawImage, RawImageType
+#include <cstddef>             // for size_t
+#include <vector>              // for vector
+
+namespace rawspeed {
+
+// The pixels of an image in square tiles, each of them contiguous in memory,
+// for the consumers that work on the 2D neighbourhoods, e.g. a demosaic or
+// a denoise that goes tile by tile, or the upload of the tiles as GPU
+// textures. Within a tile, the rows are of tileSize pixels, all cpp values
+// of each one. The tiles are in the row-major order, and all of them are of
+// the full size: the ones at the right and at the bottom edges are padded
+// with zeros.
+//
+// The decoders still write the row-major RawImageData, which all of the
+// decompressors and the post-processing address by the rows; this is a
+// copy of the result, made a band of tiles per task, so each task reads
+// whole rows and writes whole tiles. The tile size being a power of two,
+// and even, the CFA pattern of the crop is the same in all of the tiles.
+class TiledImage final {
+  iPoint2D dim;
+  uint32 cpp = 1;
+  RawImageType dataType = TYPE_USHORT16;
+  uint32 bpp = 2; // Of a pixel, all of its values.
+  int tileSize = 0;
+  iPoint2D numTiles;
+  std::vector<uchar8> data;
+
+  uchar8* getTileData(int tx, int ty) {
+    return &data[(static_cast<size_t>(ty) * numTiles.x + tx) * getTileBytes()];
+  }
+
+public:
+  TiledImage() = default;
+
+  // Of the cropped area of the image. The tileSize is a power of two, from
+  // 8 to 1024, e.g. 64, or 256 for the GPU textures.
+  explicit TiledImage(const RawImage& img, int tileSize = 64);
+
+  const iPoint2D& getDim() const { return dim; }
+  uint32 getCpp() const { return cpp; }
+  RawImageType getDataType() const { return dataType; }
+  int getTileSize() const { return tileSize; }
+  // Of the tiles, horizontally and vertically.
+  const iPoint2D& getNumTiles() const { return numTiles; }
+
+  // Of each of the tiles, and of the rows within them.
+  size_t getTileBytes() const {
+    return static_cast<size_t>(tileSize) * getTilePitch();
+  }
+  uint32 getTilePitch() const { return tileSize * bpp; }
+
+  // All of the tiles.
+  size_t getSize() const { return data.size(); }
+  const uchar8* getData() const { return data.data(); }
+
+  // The tile (tx, ty), as tileSize rows of tileSize * cpp values.
+  Array2DRef<const ushort16> getU16Tile(int tx, int ty) const;
+  Array2DRef<const float> getF32Tile(int tx, int ty) const;
+
+  // For the code that goes by the rows: the pixel (x, y) of the crop, as
+  // RawImageData::getData(), but only up to the end of its tile row.
+  const uchar8* getData(int x, int y) const {
+    const int tx = x / tileSize;
+    const int ty = y / tileSize;
+    return getData() +
+           (static_cast<size_t>(ty) * numTiles.x + tx) * getTileBytes() +
+           static_cast<size_t>(y % tileSize) * getTilePitch() +
+           static_cast<size_t>(x % tileSize) * bpp;
+  }
+
+  // Or the whole rows from y on, into out, rows of dim.x pixels each, the
+  // ones of out starting at every outPitch bytes.
+  void copyRows(int y, int rows, uchar8* out, uint32 outPitch) const;
+
+  // A new row-major image of all of the pixels.
+  RawImage untile() const;
+};
+
+} // namespace rawspeed
@@ -0,0 +1,100 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Trace.h"
+#include <atomic>  // for atomic
+#include <cstdio>  // for snprintf
+#include <mutex>   // for mutex, lock_guard
+#include <utility> // for move
+
+namespace rawspeed {
+
+namespace {
+
+std::mutex tracerMutex;
+std::shared_ptr<Tracer> tracerOwner;
+// What the scopes read, without the lock.
+std::atomic<Tracer*> currentTracer{nullptr};
+
+// The strings are the names of the functions and such, but still.
+void appendEscaped(std::string* out, const char* s) {
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      *out += '\\';
+    *out += *s;
+  }
+}
+
+} // namespace
+
+void setTracer(std::shared_ptr<Tracer> tracer) {
+  std::lock_guard<std::mutex> guard(tracerMutex);
+  currentTracer.store(tracer.get(), std::memory_order_release);
+  tracerOwner = std::move(tracer);
+}
+
+Tracer* getTracer() { return currentTracer.load(std::memory_order_acquire); }
+
+ChromeTraceWriter::ChromeTraceWriter()
+    : start(std::chrono::steady_clock::now()) {}
+
+void ChromeTraceWriter::add(const char* category, const char* name,
+                            char phase) {
+  const std::chrono::duration<double, std::micro> time =
+      std::chrono::steady_clock::now() - start;
+  const std::thread::id id = std::this_thread::get_id();
+
+  MutexLocker guard(&mutex);
+  const int thread =
+      threads.emplace(id, static_cast<int>(threads.size())).first->second;
+  events.push_back({category, name, phase, thread, time.count()});
+}
+
+void ChromeTraceWriter::begin(const char* category, const char* name) {
+  add(category, name, 'B');
+}
+
+void ChromeTraceWriter::end(const char* category, const char* name) {
+  add(category, name, 'E');
+}
+
+std::string ChromeTraceWriter::getJSON() {
+  MutexLocker guard(&mutex);
+
+  std::string out = "[";
+  for (const Event& e : events) {
+    if (out.size() > 1)
+      out += ",";
+    out += "\n{\"cat\":\"";
+    appendEscaped(&out, e.category);
+    out += "\",\"name\":\"";
+    appendEscaped(&out, e.name);
+
+    char rest[96];
+    snprintf(rest, sizeof(rest),
+             "\",\"ph\":\"%c\",\"pid\":0,\"tid\":%d,\"ts\":%.3f}", e.phase,
+             e.thread, e.time);
+    out += rest;
+  }
+  out += "\n]\n";
+  return out;
+}
+
+} // namespace rawspeed
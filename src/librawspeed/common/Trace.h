@@ -0,0 +1,117 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "rawspeedconfig.h"
+#include "ThreadSafetyAnalysis.h" // for GUARDED_BY, REQUIRES
+#include "common/Mutex.h"         // for Mutex
+#include <chrono>                 // for steady_clock
+#include <map>                    // for map
+#include <memory>                 // for shared_ptr
+#include <string>                 // for string
+#include <thread>                 // for thread::id
+#include <vector>                 // for vector
+
+namespace rawspeed {
+
+// Receives the scoped events of the decoding, e.g. to see the timelines of
+// the threads: how well a parallel stage scales, or what runs serially
+// after it. The events are only emitted if the library is built with
+// WITH_TRACING, and otherwise the RAWSPEED_TRACE_SCOPE()s compile to
+// nothing. It can be implemented on top of Perfetto or Intel ITT, or be the
+// ChromeTraceWriter.
+class Tracer {
+public:
+  virtual ~Tracer() = default;
+
+  // On the thread of the event, nested just as the scopes are, from any
+  // number of the threads at once. The strings are static, e.g. literals.
+  virtual void begin(const char* category, const char* name) = 0;
+  virtual void end(const char* category, const char* name) = 0;
+};
+
+// Of all the decodes. It must not be replaced while any is running.
+// Passing nullptr stops the tracing.
+void setTracer(std::shared_ptr<Tracer> tracer);
+Tracer* getTracer();
+
+// Collects the events, and writes them as the JSON of chrome://tracing,
+// which Perfetto can open too.
+class ChromeTraceWriter final : public Tracer {
+  struct Event {
+    const char* category;
+    const char* name;
+    char phase; // 'B'egin or 'E'nd.
+    int thread;
+    double time; // In microseconds since the construction.
+  };
+
+  const std::chrono::steady_clock::time_point start;
+  Mutex mutex;
+  std::vector<Event> events GUARDED_BY(mutex);
+  std::map<std::thread::id, int> threads GUARDED_BY(mutex);
+
+  void add(const char* category, const char* name, char phase)
+      REQUIRES(!mutex);
+
+public:
+  ChromeTraceWriter();
+
+  void begin(const char* category, const char* name) override
+      REQUIRES(!mutex);
+  void end(const char* category, const char* name) override REQUIRES(!mutex);
+
+  // All of them so far, as an array of the events.
+  std::string getJSON() REQUIRES(!mutex);
+};
+
+// Of the current tracer, if any.
+class TraceScope final {
+  Tracer* const tracer;
+  const char* const category;
+  const char* const name;
+
+public:
+  TraceScope(const char* category_, const char* name_)
+      : tracer(getTracer()), category(category_), name(name_) {
+    if (tracer)
+      tracer->begin(category, name);
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  ~TraceScope() {
+    if (tracer)
+      tracer->end(category, name);
+  }
+};
+
+} // namespace rawspeed
+
+#ifdef WITH_TRACING
+#define RAWSPEED_TRACE_CONCAT_(a, b) a##b
+#define RAWSPEED_TRACE_CONCAT(a, b) RAWSPEED_TRACE_CONCAT_(a, b)
+#define RAWSPEED_TRACE_SCOPE(category, name)                                  \
+  const rawspeed::TraceScope RAWSPEED_TRACE_CONCAT(traceScope, __LINE__)(      \
+      category, name)
+#else
+#define RAWSPEED_TRACE_SCOPE(category, name) static_cast<void>(0)
+#endif
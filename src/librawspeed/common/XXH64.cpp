@@ -0,0 +1,115 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/XXH64.h"
+#include <array>   // for array
+#include <cstdint> // for uint64_t, uint8_t, UINT64_C
+#include <cstdio>  // for snprintf
+#include <string>  // for string
+
+namespace rawspeed {
+
+namespace xxh64 {
+
+namespace {
+
+constexpr uint64_t Prime1 = UINT64_C(0x9E3779B185EBCA87);
+constexpr uint64_t Prime2 = UINT64_C(0xC2B2AE3D27D4EB4F);
+constexpr uint64_t Prime3 = UINT64_C(0x165667B19E3779F9);
+constexpr uint64_t Prime4 = UINT64_C(0x85EBCA77C2B2AE63);
+constexpr uint64_t Prime5 = UINT64_C(0x27D4EB2F165667C5);
+
+inline uint64_t rotl(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+// The input is little-endian, whatever the host is.
+inline uint64_t read64(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int k = 7; k >= 0; k--)
+    v = (v << 8) | p[k];
+  return v;
+}
+
+inline uint32_t read32(const uint8_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * Prime2;
+  acc = rotl(acc, 31);
+  return acc * Prime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+  acc ^= round(0, val);
+  return acc * Prime1 + Prime4;
+}
+
+} // namespace
+
+xxh64_state xxh64_hash(const uint8_t* message, size_t len, uint64_t seed) {
+  const uint8_t* p = message;
+  const uint8_t* const end = message + len;
+
+  uint64_t h;
+  if (len >= 32) {
+    // The four lanes are independent, so the stripes pipeline well.
+    std::array<uint64_t, 4> v = {
+        {seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1}};
+    for (; p + 32 <= end; p += 32) {
+      for (int i = 0; i < 4; i++)
+        v[i] = round(v[i], read64(p + 8 * i));
+    }
+
+    h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    for (uint64_t lane : v)
+      h = mergeRound(h, lane);
+  } else
+    h = seed + Prime5;
+
+  h += len;
+
+  for (; p + 8 <= end; p += 8)
+    h = rotl(h ^ round(0, read64(p)), 27) * Prime1 + Prime4;
+  if (p + 4 <= end) {
+    h = rotl(h ^ (read32(p) * Prime1), 23) * Prime2 + Prime3;
+    p += 4;
+  }
+  for (; p < end; p++)
+    h = rotl(h ^ (*p * Prime5), 11) * Prime1;
+
+  h ^= h >> 33;
+  h *= Prime2;
+  h ^= h >> 29;
+  h *= Prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+std::string hash_to_string(xxh64_state hash) {
+  std::array<char, 2 * sizeof(hash) + 1> res;
+  snprintf(res.data(), res.size(), "%016llx",
+           static_cast<unsigned long long>(hash));
+  return res.data();
+}
+
+} // namespace xxh64
+
+} // namespace rawspeed
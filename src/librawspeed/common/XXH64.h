@@ -0,0 +1,43 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <cstdint> // for uint64_t, uint8_t
+#include <cstdio>  // for size_t
+#include <string>  // for string
+
+namespace rawspeed {
+
+namespace xxh64 {
+
+// XXH64, the 64-bit variant of xxHash, as specified by its reference.
+// Several times faster than MD5, and good enough to tell the images apart.
+using xxh64_state = uint64_t;
+
+// computes hash of the buffer message with length len
+xxh64_state xxh64_hash(const uint8_t* message, size_t len, uint64_t seed = 0);
+
+// returns hash as string, the canonical (big-endian) representation
+std::string hash_to_string(xxh64_state hash);
+
+} // namespace xxh64
+
+} // namespace rawspeed
@@ -20,9 +20,13 @@
 
 #include "decoders/AbstractTiffDecoder.h"
 #include "common/Common.h"                // for uint32
+#include "common/Point.h"                 // for iPoint2D
+#include "common/RawspeedException.h"     // for RawspeedException
 #include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "io/Buffer.h"                    // for Buffer, DataBuffer
 #include "tiff/TiffEntry.h"               // for TiffEntry
 #include "tiff/TiffIFD.h"                 // for TiffIFD, TiffRootIFD, Tiff...
+#include <algorithm>                      // for any_of
 #include <vector>                         // for vector
 
 namespace rawspeed {
@@ -48,4 +52,96 @@ const TiffIFD* AbstractTiffDecoder::getIFDWithLargestImage(TiffTag filter) const
   return res;
 }
 
+std::vector<RawDecoder::EmbeddedPreview>
+AbstractTiffDecoder::getEmbeddedPreviews() const {
+  using Compression = EmbeddedPreview::Compression;
+
+  std::vector<EmbeddedPreview> previews;
+  // The offsets are within the TIFF of the entry, e.g. of the MakerNote.
+  const auto add = [this, &previews](const TiffEntry* offsetEntry,
+                                     uint32 offset, uint32 length,
+                                     Compression compression,
+                                     const iPoint2D& dim) {
+    const DataBuffer& tiff = offsetEntry->getRootIfdData();
+    if (!length || !tiff.isValid(offset, length))
+      return;
+
+    EmbeddedPreview preview;
+    preview.compression = compression;
+    preview.dim = dim;
+    preview.offset = tiff.getSubView(offset, length).getOffsetIn(*mFile);
+    preview.length = length;
+
+    // E.g. a DNG preview often has both.
+    if (std::any_of(previews.begin(), previews.end(),
+                    [&preview](const EmbeddedPreview& p) {
+                      return p.offset == preview.offset;
+                    }))
+      return;
+    previews.emplace_back(preview);
+  };
+
+  // A broken one is just left out, it does not make the others unusable.
+  for (const TiffIFD* ifd : mRootIFD->getIFDsWithTag(JPEGINTERCHANGEFORMAT)) {
+    try {
+      if (!ifd->hasEntry(JPEGINTERCHANGEFORMATLENGTH))
+        continue;
+      const TiffEntry* offset = ifd->getEntry(JPEGINTERCHANGEFORMAT);
+      add(offset, offset->getU32(),
+          ifd->getEntry(JPEGINTERCHANGEFORMATLENGTH)->getU32(),
+          Compression::JPEG, {});
+    } catch (const RawspeedException&) {
+      continue;
+    }
+  }
+
+  for (const TiffIFD* ifd : mRootIFD->getIFDsWithTag(NEWSUBFILETYPE)) {
+    try {
+      const TiffEntry* type = ifd->getEntry(NEWSUBFILETYPE);
+      if (type->count != 1 || !(type->getU32() & 1) ||
+          !ifd->hasEntry(STRIPOFFSETS) || !ifd->hasEntry(STRIPBYTECOUNTS) ||
+          !ifd->hasEntry(COMPRESSION) || !ifd->hasEntry(IMAGEWIDTH) ||
+          !ifd->hasEntry(IMAGELENGTH))
+        continue;
+
+      Compression compression;
+      switch (ifd->getEntry(COMPRESSION)->getU16()) {
+      case 1:
+        compression = Compression::Uncompressed;
+        break;
+      case 6:
+      case 7:
+        compression = Compression::JPEG;
+        break;
+      default:
+        continue;
+      }
+
+      const TiffEntry* offsets = ifd->getEntry(STRIPOFFSETS);
+      const TiffEntry* counts = ifd->getEntry(STRIPBYTECOUNTS);
+      if (!offsets->count || offsets->count != counts->count)
+        continue;
+      const auto offsetsView = offsets->getU32View(offsets->count);
+      const auto countsView = counts->getU32View(counts->count);
+      uint64 length = countsView[0];
+      bool contiguous = true;
+      for (uint32 i = 1; i < offsets->count && contiguous; i++) {
+        contiguous = offsetsView[i] == offsetsView[0] + length;
+        length += countsView[i];
+      }
+      if (!contiguous || length > 0xFFFFFFFFULL)
+        continue;
+
+      add(offsets, offsetsView[0], static_cast<uint32>(length),
+          compression,
+          {static_cast<int>(ifd->getEntry(IMAGEWIDTH)->getU32()),
+           static_cast<int>(ifd->getEntry(IMAGELENGTH)->getU32())});
+    } catch (const RawspeedException&) {
+      continue;
+    }
+  }
+
+  return previews;
+}
+
 } // namespace rawspeed
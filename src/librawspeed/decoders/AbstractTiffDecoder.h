@@ -23,7 +23,7 @@
 #include "decoders/RawDecoder.h" // for RawDecoder
 #include "tiff/TiffIFD.h"        // for TiffID, TiffRootIFD, TiffRootIFDOwner
 #include "tiff/TiffTag.h"        // for IMAGEWIDTH, TiffTag
-#include <memory>                // for unique_ptr
+#include <memory>                // for shared_ptr
 #include <string>                // for string
 #include <utility>               // for move
 
@@ -36,7 +36,8 @@ class Buffer;
 class AbstractTiffDecoder : public RawDecoder
 {
 protected:
-  TiffRootIFDOwner mRootIFD;
+  // Shared with the decoders of the other frames, see getFrameDecoder().
+  std::shared_ptr<TiffRootIFD> mRootIFD;
 public:
   AbstractTiffDecoder(TiffRootIFDOwner&& root, const Buffer* file)
       : RawDecoder(file), mRootIFD(std::move(root)) {}
@@ -65,6 +66,11 @@ public:
   }
 
   const TiffIFD* getIFDWithLargestImage(TiffTag filter = IMAGEWIDTH) const;
+
+  // The JPEGINTERCHANGEFORMAT ones of all of the IFDs, including the
+  // MakerNotes, and the reduced resolution images of a single strip, or of
+  // contiguous ones, that are uncompressed or JPEG.
+  std::vector<EmbeddedPreview> getEmbeddedPreviews() const override;
 };
 
 } // namespace rawspeed
@@ -35,8 +35,10 @@
 #include "tiff/TiffEntry.h"                         // for TiffEntry
 #include "tiff/TiffIFD.h"                           // for TiffRootIFD, Tif...
 #include "tiff/TiffTag.h"                           // for DNGPRIVATEDATA
+#include <algorithm>                                // for min
+#include <array>                                    // for array
 #include <cassert>                                  // for assert
-#include <cstring>                                  // for memcpy, size_t
+#include <cstring>                                  // for memcpy, memmove, size_t
 #include <memory>                                   // for unique_ptr
 #include <set>                                      // for set
 #include <string>                                   // for operator==, string
@@ -159,30 +161,7 @@ RawImage ArwDecoder::decodeRawInternal() {
   }
   uint32 width = raw->getEntry(IMAGEWIDTH)->getU32();
   uint32 height = raw->getEntry(IMAGELENGTH)->getU32();
-  uint32 bitPerPixel = raw->getEntry(BITSPERSAMPLE)->getU32();
-
-  switch (bitPerPixel) {
-  case 8:
-  case 12:
-  case 14:
-    break;
-  default:
-    ThrowRDE("Unexpected bits per pixel: %u", bitPerPixel);
-  }
-
-  // Sony E-550 marks compressed 8bpp ARW with 12 bit per pixel
-  // this makes the compression detect it as a ARW v1.
-  // This camera has however another MAKER entry, so we MAY be able
-  // to detect it this way in the future.
-  data = mRootIFD->getIFDsWithTag(MAKE);
-  if (data.size() > 1) {
-    for (auto &i : data) {
-      string make = i->getEntry(MAKE)->getString();
-      /* Check for maker "SONY" without spaces */
-      if (make == "SONY")
-        bitPerPixel = 8;
-    }
-  }
+  uint32 bitPerPixel = getBitPerPixel(raw);
 
   if (width == 0 || height == 0 || height % 2 != 0 || width > 8000 ||
       height > 5320)
@@ -231,6 +210,73 @@ RawImage ArwDecoder::decodeRawInternal() {
   return mRaw;
 }
 
+uint32 ArwDecoder::getBitPerPixel(const TiffIFD* raw) const {
+  uint32 bitPerPixel = raw->getEntry(BITSPERSAMPLE)->getU32();
+
+  switch (bitPerPixel) {
+  case 8:
+  case 12:
+  case 14:
+    break;
+  default:
+    ThrowRDE("Unexpected bits per pixel: %u", bitPerPixel);
+  }
+
+  // Sony E-550 marks compressed 8bpp ARW with 12 bit per pixel
+  // this makes the compression detect it as a ARW v1.
+  // This camera has however another MAKER entry, so we MAY be able
+  // to detect it this way in the future.
+  const vector<const TiffIFD*> data = mRootIFD->getIFDsWithTag(MAKE);
+  if (data.size() > 1) {
+    for (auto &i : data) {
+      string make = i->getEntry(MAKE)->getString();
+      /* Check for maker "SONY" without spaces */
+      if (make == "SONY")
+        bitPerPixel = 8;
+    }
+  }
+
+  return bitPerPixel;
+}
+
+void ArwDecoder::decodeHeaderInternal() {
+  const vector<const TiffIFD*> data = mRootIFD->getIFDsWithTag(STRIPOFFSETS);
+
+  if (data.empty()) {
+    TiffEntry *model = mRootIFD->getEntryRecursive(MODEL);
+
+    if (model && model->getString() == "DSLR-A100") {
+      mRaw->dim = iPoint2D(3881, 2608);
+      return;
+    }
+
+    if (hints.has("srf_format")) {
+      const TiffIFD* raw = mRootIFD->getIFDWithTag(IMAGEWIDTH);
+      mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                           raw->getEntry(IMAGELENGTH)->getU32());
+      return;
+    }
+
+    ThrowRDE("No image data found");
+  }
+
+  const TiffIFD* raw = data[0];
+  const uint32 width = raw->getEntry(IMAGEWIDTH)->getU32();
+  uint32 height = raw->getEntry(IMAGELENGTH)->getU32();
+
+  if (raw->getEntry(COMPRESSION)->getU32() != 1) {
+    // As decodeRawInternal() tells the ARW1 and the ARW2 apart.
+    const uint32 bitPerPixel = getBitPerPixel(raw);
+    const uint32 count = raw->getEntry(STRIPBYTECOUNTS)->getU32();
+    if (uint64(count) * 8 != width * height * bitPerPixel)
+      height += 8;
+    else if (bitPerPixel == 12)
+      mShiftDownScale = 2;
+  }
+
+  mRaw->dim = iPoint2D(width, height);
+}
+
 void ArwDecoder::DecodeUncompressed(const TiffIFD* raw) {
   uint32 width = raw->getEntry(IMAGEWIDTH)->getU32();
   uint32 height = raw->getEntry(IMAGELENGTH)->getU32();
@@ -262,6 +308,8 @@ void ArwDecoder::DecodeARW2(const ByteStream& input, uint32 w, uint32 h,
 
   if (bpp == 8) {
     SonyArw2Decompressor a2(mRaw, input);
+    mRaw->expectInput(input.getRemainSize(),
+                      SonyArw2Decompressor::MinBitsPerPixel);
     mRaw->createData();
     a2.decompress();
     return;
@@ -367,7 +415,12 @@ void ArwDecoder::SonyDecrypt(const uint32* ibuf, uint32* obuf, uint32 len,
   if (0 == len)
     return;
 
-  std::array<uint32, 128> pad;
+  // The pad is a linear sequence: each word is the XOR of the ones 127 and
+  // 63 words before it. So up to 63 words of it can be computed at once.
+  // It is generated a chunk at a time, after the 127 words of the state.
+  static constexpr uint32 state = 127;
+  static constexpr uint32 chunk = 256;
+  std::array<uint32, state + chunk> pad;
 
   // Initialize the decryption pad from the key
   for (int p=0; p < 4; p++)
@@ -378,24 +431,28 @@ void ArwDecoder::SonyDecrypt(const uint32* ibuf, uint32* obuf, uint32 len,
   for (int p=0; p < 127; p++)
     pad[p] = getU32BE(&pad[p]);
 
-  int p = 127;
-  // Decrypt the buffer in place using the pad
-  for (; len > 0; len--) {
-    pad[p & 127] = pad[(p+1) & 127] ^ pad[(p+1+64) & 127];
+  // Decrypt the buffer using the pad
+  while (len > 0) {
+    const uint32 n = std::min(len, chunk);
 
-    uint32 pv;
-    memcpy(&pv, &(pad[p & 127]), sizeof(uint32));
+    for (uint32 i = 0; i < n; i++)
+      pad[state + i] = pad[i] ^ pad[i + 64];
 
-    uint32 bv;
-    memcpy(&bv, ibuf, sizeof(uint32));
+    for (uint32 i = 0; i < n; i++) {
+      uint32 bv;
+      memcpy(&bv, &ibuf[i], sizeof(uint32));
 
-    bv ^= pv;
+      bv ^= pad[state + i];
+
+      memcpy(&obuf[i], &bv, sizeof(uint32));
+    }
 
-    memcpy(obuf, &bv, sizeof(uint32));
+    // The last 127 words are the state for the next chunk.
+    memmove(&pad[0], &pad[n], state * sizeof(uint32));
 
-    ibuf++;
-    obuf++;
-    p++;
+    ibuf += n;
+    obuf += n;
+    len -= n;
   }
 }
 
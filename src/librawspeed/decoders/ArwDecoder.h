@@ -44,6 +44,7 @@ public:
 
   RawImage decodeRawInternal() override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
 
 protected:
   void ParseA100WB();
@@ -54,6 +55,8 @@ protected:
   void DecodeUncompressed(const TiffIFD* raw);
   void SonyDecrypt(const uint32* ibuf, uint32* obuf, uint32 len, uint32 key);
   void GetWB();
+  // Of the compressed raw, with the fixup of the E-550.
+  uint32 getBitPerPixel(const TiffIFD* raw) const;
   ByteStream in;
   int mShiftDownScale = 0;
 };
@@ -0,0 +1,66 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/AsyncDecoder.h"
+#include "common/Executor.h"              // for getExecutor, Executor
+#include "decoders/RawDecoder.h"          // for RawDecoder
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "parsers/RawParser.h"            // for RawParser
+#include <exception>                      // for current_exception
+#include <utility>                        // for move
+
+namespace rawspeed {
+
+std::future<RawImage>
+decodeAsync(const Buffer* file, const CameraMetaData* meta,
+            std::shared_ptr<const Cancellation> cancellation,
+            std::function<void(RawDecoder* decoder)> configure) {
+  auto promise = std::make_shared<std::promise<RawImage>>();
+  std::future<RawImage> future = promise->get_future();
+
+  getExecutor()->post([promise, file, meta,
+                       cancellation = std::move(cancellation),
+                       configure = std::move(configure)]() {
+    try {
+      // It may have been a while in the queue.
+      if (cancellation && cancellation->isCancelled())
+        ThrowRDE("The decoding was cancelled.");
+
+      RawParser parser(file);
+      auto decoder = parser.getDecoder(meta);
+      decoder->cancellation = cancellation;
+
+      if (configure)
+        configure(decoder.get());
+
+      decoder->checkSupport(meta);
+      decoder->decodeRaw();
+      decoder->decodeMetaData(meta);
+
+      promise->set_value(decoder->mRaw);
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  });
+
+  return future;
+}
+
+} // namespace rawspeed
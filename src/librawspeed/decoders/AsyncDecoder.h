@@ -0,0 +1,50 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Cancellation.h" // for Cancellation
+#include "common/RawImage.h"     // for RawImage
+#include <functional>            // for function
+#include <future>                // for future
+#include <memory>                // for shared_ptr
+
+namespace rawspeed {
+
+class Buffer;
+
+class CameraMetaData;
+
+class RawDecoder;
+
+// Decodes the file as a task posted to the current Executor (see
+// Executor::post()), and returns right away, e.g. for an event loop that
+// cannot block for the whole decode. The future gets the image, as
+// RawDecoder::mRaw after decodeMetaData(), or the exception of the decoding.
+// The file and the meta must stay alive until the future is ready.
+// If set, configure is called for the decoder before the decoding, as with
+// BatchDecoder::configure. If the cancellation gets cancelled, the decoding
+// stops early, and the future gets a RawDecoderException.
+std::future<RawImage>
+decodeAsync(const Buffer* file, const CameraMetaData* meta,
+            std::shared_ptr<const Cancellation> cancellation = nullptr,
+            std::function<void(RawDecoder* decoder)> configure = nullptr);
+
+} // namespace rawspeed
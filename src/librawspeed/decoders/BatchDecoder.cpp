@@ -0,0 +1,190 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/BatchDecoder.h"
+#include "common/Executor.h"         // for getExecutor, Executor
+#include "decoders/DecoderSession.h" // for DecoderSession
+#include "io/Buffer.h"               // for Buffer
+#include "io/FileReader.h"           // for FileReader
+#include <algorithm>                 // for max, min
+#include <atomic>                    // for atomic
+#include <condition_variable>        // for condition_variable
+#include <deque>                     // for deque
+#include <memory>                    // for unique_ptr
+#include <mutex>                     // for mutex, unique_lock, lock_guard
+#include <thread>                    // for thread
+#include <utility>                   // for move
+#include <vector>                    // for vector
+
+namespace rawspeed {
+
+namespace {
+
+struct ReadFile final {
+  unsigned index;
+  std::unique_ptr<const Buffer> file;
+  std::exception_ptr exception;
+};
+
+// The bounded queue between the I/O thread and the decoding tasks.
+class ReadQueue final {
+  std::mutex mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::deque<ReadFile> files;
+  const unsigned capacity;
+  bool closed = false;
+  bool cancelled = false;
+
+public:
+  explicit ReadQueue(unsigned capacity_) : capacity(capacity_) {}
+
+  // Blocks while the queue is full. Returns false if the queue got cancelled.
+  bool push(ReadFile&& file) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock,
+                 [this]() { return cancelled || files.size() < capacity; });
+    if (cancelled)
+      return false;
+    files.emplace_back(std::move(file));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // Blocks while the queue is empty. Returns false once it is drained.
+  bool pop(ReadFile* file) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock,
+                  [this]() { return cancelled || closed || !files.empty(); });
+    if (cancelled || files.empty())
+      return false;
+    *file = std::move(files.front());
+    files.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  // No more files will be pushed.
+  void close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    closed = true;
+    notEmpty.notify_all();
+  }
+
+  // Both the producer and the consumers should stop.
+  void cancel() {
+    std::lock_guard<std::mutex> guard(mutex);
+    cancelled = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+};
+
+} // namespace
+
+void BatchDecoder::decode(const std::vector<std::string>& fileNames,
+                          const ResultFunction& onResult) const {
+  if (fileNames.empty())
+    return;
+
+  const auto executor = getExecutor();
+  const int numFiles = fileNames.size();
+  const int numWorkers =
+      std::max(1, std::min(numFiles, executor->getConcurrency()));
+
+  ReadQueue queue(readAhead ? readAhead : numWorkers);
+
+  // Reading is done by threads of their own, not by executor tasks,
+  // since they spend most of their time waiting for the I/O.
+  const unsigned numReaders =
+      std::max(1U, std::min<unsigned>(readThreads, numFiles));
+  std::atomic<unsigned> nextFile{0};
+  std::atomic<unsigned> activeReaders{numReaders};
+  auto reader = [&fileNames, &queue, &nextFile, &activeReaders]() {
+    for (unsigned i; (i = nextFile++) < fileNames.size();) {
+      ReadFile f;
+      f.index = i;
+      try {
+        f.file = FileReader(fileNames[i].c_str()).readFile();
+      } catch (...) {
+        f.exception = std::current_exception();
+      }
+      if (!queue.push(std::move(f)))
+        return;
+    }
+    if (--activeReaders == 0)
+      queue.close();
+  };
+
+  std::vector<std::thread> readers;
+  readers.reserve(numReaders);
+  for (unsigned i = 0; i < numReaders; ++i)
+    readers.emplace_back(reader);
+  const auto joinReaders = [&readers]() {
+    for (auto& r : readers)
+      r.join();
+  };
+
+  auto worker = [this, &fileNames, &onResult, &queue](int /*task*/) {
+    DecoderSession session(meta, /*maxPooledBytes=*/0);
+    session.configure = configure;
+    session.metaDataOnly = metaDataOnly;
+    ReadFile f;
+    while (queue.pop(&f)) {
+      BatchDecoderResult result;
+      result.index = f.index;
+      result.fileName = fileNames[f.index];
+      result.exception = f.exception;
+
+      if (!result.exception) {
+        try {
+          result.image = session.decode(f.file.get());
+          // A configure callback may have set aliasInput, and the pixels
+          // must not point into the file once it is released.
+          result.image->makeWritable();
+        } catch (...) {
+          result.exception = std::current_exception();
+        }
+      }
+
+      // The file is no longer needed, release it before the callback.
+      f.file.reset();
+
+      try {
+        onResult(std::move(result));
+      } catch (...) {
+        queue.cancel();
+        throw;
+      }
+    }
+  };
+
+  try {
+    runTasks(executor, numWorkers, worker);
+  } catch (...) {
+    queue.cancel();
+    joinReaders();
+    throw;
+  }
+
+  joinReaders();
+}
+
+} // namespace rawspeed
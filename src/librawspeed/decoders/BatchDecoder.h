@@ -0,0 +1,98 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/RawImage.h" // for RawImage
+#include <exception>         // for exception_ptr
+#include <functional>        // for function
+#include <memory>            // for shared_ptr
+#include <string>            // for string
+#include <vector>            // for vector
+
+namespace rawspeed {
+
+class CameraMetaData;
+
+class RawDecoder;
+
+// The outcome of decoding one file of the batch.
+struct BatchDecoderResult final {
+  // The position of the file in the list that was passed to decode().
+  unsigned index;
+
+  std::string fileName;
+
+  // The decoded image, as RawDecoder::mRaw after decodeMetaData().
+  // An empty image if the file could not be read or decoded, and one without
+  // the pixels if BatchDecoder::metaDataOnly was set.
+  RawImage image = RawImage::create();
+
+  // Set if the file could not be read or decoded.
+  std::exception_ptr exception;
+};
+
+// Decodes a whole list of files, which is a lot faster than doing them one
+// by one when there are many of them. The files are read ahead by separate
+// I/O threads, so the reading of the next files overlaps with the decoding of
+// the current ones. Several files are decoded at the same time, as tasks of
+// the current Executor, which matters when the decompressor of the format is
+// single-threaded (Nikon, Olympus, Cr2, ...). Each of the decoding tasks has
+// a DecoderSession, so the temporary buffers of the decoders are only
+// allocated for the first few files. The images are not pooled there, as
+// they are handed out; set a PooledImageAllocator for that.
+class BatchDecoder final {
+public:
+  using ConfigureFunction = std::function<void(RawDecoder* decoder)>;
+  using ResultFunction = std::function<void(BatchDecoderResult&& result)>;
+
+  explicit BatchDecoder(const CameraMetaData* meta_) : meta(meta_) {}
+
+  // If set, it is called for each decoder before the decoding,
+  // e.g. to set RawDecoder::failOnUnknown.
+  ConfigureFunction configure;
+
+  // How many files may have been read but not yet decoded. This is what
+  // bounds the memory usage. If zero, the concurrency of the executor is used.
+  unsigned readAhead = 0;
+
+  // How many files are being read at the same time, each by a thread of its
+  // own. A single read at a time can not keep up with the decoders on fast
+  // storage (NVMe), which only gets to its throughput with many requests in
+  // flight. Each of the threads may hold one more read file than readAhead.
+  unsigned readThreads = 1;
+
+  // If set, decodeRaw() is skipped, and decodeMetaData() gets all it can from
+  // the headers alone. That is for cataloguing, which is then mostly I/O.
+  bool metaDataOnly = false;
+
+  // Decodes all the files, and passes each result to onResult as soon as the
+  // file is done. onResult may be called concurrently from several threads,
+  // and not in the order of the files. Only returns once all the files have
+  // been processed. If onResult throws, the rest of the files is skipped
+  // and the exception is rethrown.
+  void decode(const std::vector<std::string>& fileNames,
+              const ResultFunction& onResult) const;
+
+private:
+  const CameraMetaData* meta;
+};
+
+} // namespace rawspeed
@@ -21,25 +21,26 @@
 */
 
 #include "decoders/Cr2Decoder.h"
-#include "common/Common.h"                     // for uint32, ushort16
-#include "common/Point.h"                      // for iPoint2D
-#include "common/RawspeedException.h"          // for RawspeedException
-#include "decoders/RawDecoderException.h"      // for ThrowRDE
-#include "decompressors/Cr2Decompressor.h"     // for Cr2Decompressor, Cr2S...
-#include "interpolators/Cr2sRawInterpolator.h" // for Cr2sRawInterpolator
-#include "io/Buffer.h"                         // for Buffer
-#include "io/ByteStream.h"                     // for ByteStream
-#include "io/Endianness.h"                     // for Endianness, Endiannes...
-#include "metadata/Camera.h"                   // for Hints
-#include "metadata/ColorFilterArray.h"         // for CFA_GREEN, CFA_BLUE
-#include "parsers/TiffParserException.h"       // for ThrowTPE
-#include "tiff/TiffEntry.h"                    // for TiffEntry, TIFF_SHORT
-#include "tiff/TiffTag.h"                      // for TiffTag, CANONCOLORDATA
-#include <array>                               // for array
-#include <cassert>                             // for assert
-#include <memory>                              // for unique_ptr, allocator...
-#include <string>                              // for operator==, string
-#include <vector>                              // for vector
+#include "common/Common.h"                           // for uint32, ushort16
+#include "common/Point.h"                            // for iPoint2D
+#include "common/RawspeedException.h"                // for RawspeedException
+#include "decoders/RawDecoderException.h"            // for ThrowRDE
+#include "decompressors/AbstractLJpegDecompressor.h" // for AbstractLJpegDec...
+#include "decompressors/Cr2Decompressor.h"           // for Cr2Decompressor, ...
+#include "interpolators/Cr2sRawInterpolator.h"       // for Cr2sRawInterpolator
+#include "io/Buffer.h"                               // for Buffer
+#include "io/ByteStream.h"                           // for ByteStream
+#include "io/Endianness.h"                           // for Endianness, Endia...
+#include "metadata/Camera.h"                         // for Hints
+#include "metadata/ColorFilterArray.h"               // for CFA_GREEN, CFA_BLUE
+#include "parsers/TiffParserException.h"             // for ThrowTPE
+#include "tiff/TiffEntry.h"                          // for TiffEntry, TIFF_S...
+#include "tiff/TiffTag.h"                            // for TiffTag, CANONCOL...
+#include <array>                                     // for array
+#include <cassert>                                   // for assert
+#include <memory>                                    // for unique_ptr, alloc...
+#include <string>                                    // for operator==, string
+#include <vector>                                    // for vector
 // IWYU pragma: no_include <ext/alloc_traits.h>
 
 using std::string;
@@ -58,19 +59,19 @@ bool Cr2Decoder::isAppropriateDecoder(const TiffRootIFD* rootIFD,
          (make == "Kodak" && (model == "DCS520C" || model == "DCS560C"));
 }
 
-RawImage Cr2Decoder::decodeOldFormat() {
-  uint32 offset = 0;
+uint32 Cr2Decoder::getOldFormatOffset() const {
   if (mRootIFD->getEntryRecursive(CANON_RAW_DATA_OFFSET))
-    offset = mRootIFD->getEntryRecursive(CANON_RAW_DATA_OFFSET)->getU32();
-  else {
-    // D2000 is oh so special...
-    auto ifd = mRootIFD->getIFDWithTag(CFAPATTERN);
-    if (! ifd->hasEntry(STRIPOFFSETS))
-      ThrowRDE("Couldn't find offset");
+    return mRootIFD->getEntryRecursive(CANON_RAW_DATA_OFFSET)->getU32();
 
-    offset = ifd->getEntry(STRIPOFFSETS)->getU32();
-  }
+  // D2000 is oh so special...
+  auto ifd = mRootIFD->getIFDWithTag(CFAPATTERN);
+  if (! ifd->hasEntry(STRIPOFFSETS))
+    ThrowRDE("Couldn't find offset");
+
+  return ifd->getEntry(STRIPOFFSETS)->getU32();
+}
 
+iPoint2D Cr2Decoder::getOldFormatDim(uint32 offset) const {
   ByteStream b(mFile, offset, Endianness::big);
   b.skipBytes(41);
   int height = b.getU16();
@@ -84,11 +85,19 @@ RawImage Cr2Decoder::decodeOldFormat() {
   }
   width *= 2; // components
 
-  mRaw->dim = {width, height};
+  return {width, height};
+}
+
+RawImage Cr2Decoder::decodeOldFormat() {
+  const uint32 offset = getOldFormatOffset();
+  mRaw->dim = getOldFormatDim(offset);
+  const int width = mRaw->dim.x;
 
   const ByteStream bs(mFile->getSubView(offset), 0);
 
   Cr2Decompressor l(bs, mRaw);
+  l.speculative = speculativeEntropyDecode;
+  mRaw->expectInput(bs.getRemainSize(), Cr2Decompressor::MinBitsPerPixel);
   mRaw->createData();
 
   Cr2Slicing slicing(/*numSlices=*/1, /*sliceWidth=don't care*/ 0,
@@ -102,8 +111,10 @@ RawImage Cr2Decoder::decodeOldFormat() {
     RawImageCurveGuard curveHandler(&mRaw, table, uncorrectedRawValues);
 
     // Apply table
-    if (!uncorrectedRawValues)
+    if (!uncorrectedRawValues) {
+      StageTimer timer(this, STAGE_POST_PROCESS);
       mRaw->sixteenBitLookup();
+    }
   }
 
   return mRaw;
@@ -111,7 +122,7 @@ RawImage Cr2Decoder::decodeOldFormat() {
 
 // for technical details about Cr2 mRAW/sRAW, see http://lclevy.free.fr/cr2/
 
-RawImage Cr2Decoder::decodeNewFormat() {
+TiffIFD* Cr2Decoder::decodeNewFormatHeader() {
   TiffEntry* sensorInfoE = mRootIFD->getEntryRecursive(CANON_SENSOR_INFO);
   if (!sensorInfoE)
     ThrowTPE("failed to get SensorInfo from MakerNote");
@@ -131,6 +142,12 @@ RawImage Cr2Decoder::decodeNewFormat() {
   mRaw->setCpp(componentsPerPixel);
   mRaw->isCFA = (mRaw->getCpp() == 1);
 
+  return raw;
+}
+
+RawImage Cr2Decoder::decodeNewFormat() {
+  TiffIFD* raw = decodeNewFormatHeader();
+
   Cr2Slicing slicing;
   // there are four cases:
   // * there is a tag with three components,
@@ -168,12 +185,34 @@ RawImage Cr2Decoder::decodeNewFormat() {
 
   const ByteStream bs(mFile->getSubView(offset, count), 0);
 
+  const auto isSubsampled = [this]() {
+    return mRaw->metadata.subsampling.x > 1 || mRaw->metadata.subsampling.y > 1;
+  };
+
+  // If the decode goes in order, the sRaw rows are interpolated as soon as
+  // they are decoded, while they are still in the cache.
+  std::unique_ptr<Cr2sRawInterpolator> interpolator;
+  int version = 0;
+
   Cr2Decompressor d(bs, mRaw);
+  d.speculative = speculativeEntropyDecode;
+  d.rowsDecoded = [this, &isSubsampled, &interpolator, &version](int rows) {
+    if (!isSubsampled())
+      return;
+    if (!interpolator)
+      interpolator = getSRawInterpolator(&version);
+    interpolator->rowsDecoded(version, rows);
+  };
+  mRaw->expectInput(bs.getRemainSize(), Cr2Decompressor::MinBitsPerPixel);
   mRaw->createData();
   d.decode(slicing);
 
-  if (mRaw->metadata.subsampling.x > 1 || mRaw->metadata.subsampling.y > 1)
-    sRawInterpolate();
+  if (isSubsampled()) {
+    if (interpolator)
+      interpolator->finishRows(version);
+    else
+      sRawInterpolate();
+  }
 
   return mRaw;
 }
@@ -185,6 +224,23 @@ RawImage Cr2Decoder::decodeRawInternal() {
     return decodeNewFormat();
 }
 
+void Cr2Decoder::decodeHeaderInternal() {
+  if (mRootIFD->getSubIFDs().size() < 4) {
+    mRaw->dim = getOldFormatDim(getOldFormatOffset());
+    return;
+  }
+
+  const TiffIFD* raw = decodeNewFormatHeader();
+  if (mRaw->isCFA)
+    return;
+
+  // The mode of the sRaw is told by the subsampling of the LJpeg.
+  const uint32 offset = raw->getEntry(STRIPOFFSETS)->getU32();
+  const uint32 count = raw->getEntry(STRIPBYTECOUNTS)->getU32();
+  mRaw->metadata.subsampling = AbstractLJpegDecompressor::getSubsampling(
+      ByteStream(mFile->getSubView(offset, count), 0));
+}
+
 void Cr2Decoder::checkSupportInternal(const CameraMetaData* meta) {
   auto id = mRootIFD->getID();
   // Check for sRaw mode
@@ -276,8 +332,10 @@ int Cr2Decoder::getHue() {
   return (mRaw->metadata.subsampling.y * mRaw->metadata.subsampling.x);
 }
 
-// Interpolate and convert sRaw data.
-void Cr2Decoder::sRawInterpolate() {
+std::unique_ptr<Cr2sRawInterpolator>
+Cr2Decoder::getSRawInterpolator(int* version) {
+  assert(version);
+
   TiffEntry* wb = mRootIFD->getEntryRecursive(CANONCOLORDATA);
   if (!wb)
     ThrowRDE("Unable to locate WB info.");
@@ -304,20 +362,23 @@ void Cr2Decoder::sRawInterpolate() {
   bool isOldSraw = hints.has("sraw_40d");
   bool isNewSraw = hints.has("sraw_new");
 
-  Cr2sRawInterpolator i(mRaw, sraw_coeffs, getHue());
-
-  int version;
   if (isOldSraw)
-    version = 0;
+    *version = 0;
   else {
     if (isNewSraw) {
-      version = 2;
+      *version = 2;
     } else {
-      version = 1;
+      *version = 1;
     }
   }
 
-  i.interpolate(version);
+  return std::make_unique<Cr2sRawInterpolator>(mRaw, sraw_coeffs, getHue());
+}
+
+// Interpolate and convert sRaw data.
+void Cr2Decoder::sRawInterpolate() {
+  int version;
+  getSRawInterpolator(&version)->interpolate(version);
 }
 
 } // namespace rawspeed
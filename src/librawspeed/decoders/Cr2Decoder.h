@@ -20,9 +20,12 @@
 
 #pragma once
 
+#include "common/Common.h"                // for uint32
+#include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage
 #include "decoders/AbstractTiffDecoder.h" // for AbstractTiffDecoder
 #include "tiff/TiffIFD.h"                 // for TiffRootIFDOwner
+#include <memory>                         // for unique_ptr
 #include <utility>                        // for move
 
 namespace rawspeed {
@@ -31,6 +34,8 @@ class CameraMetaData;
 
 class Buffer;
 
+class Cr2sRawInterpolator;
+
 class Cr2Decoder final : public AbstractTiffDecoder
 {
 public:
@@ -42,11 +47,17 @@ public:
   RawImage decodeRawInternal() override;
   void checkSupportInternal(const CameraMetaData* meta) override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
 
 protected:
   int getDecoderVersion() const override { return 9; }
+  uint32 getOldFormatOffset() const;
+  iPoint2D getOldFormatDim(uint32 offset) const;
   RawImage decodeOldFormat();
+  // Sets the dimensions and the cpp, and returns the IFD of the raw.
+  TiffIFD* decodeNewFormatHeader();
   RawImage decodeNewFormat();
+  std::unique_ptr<Cr2sRawInterpolator> getSRawInterpolator(int* version);
   void sRawInterpolate();
   int getHue();
 };
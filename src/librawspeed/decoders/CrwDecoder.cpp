@@ -27,6 +27,7 @@
 #include "decoders/RawDecoderException.h"  // for ThrowRDE
 #include "decompressors/CrwDecompressor.h" // for CrwDecompressor
 #include "io/Buffer.h"                     // for Buffer
+#include "io/ByteStream.h"                 // for ByteStream
 #include "metadata/Camera.h"               // for Hints
 #include "metadata/ColorFilterArray.h"     // for CFA_GREEN, CFA_BLUE, CFA_RED
 #include "tiff/CiffEntry.h"                // for CiffEntry, CIFF_SHORT
@@ -91,6 +92,25 @@ RawImage CrwDecoder::decodeRawInternal() {
   return mRaw;
 }
 
+vector<RawDecoder::EmbeddedPreview> CrwDecoder::getEmbeddedPreviews() const {
+  vector<EmbeddedPreview> previews;
+  for (CiffTag tag : {CIFF_JPEGIMAGE, CIFF_THUMBNAIL}) {
+    const CiffEntry* jpeg = mRootIFD->getEntryRecursive(tag);
+    if (!jpeg)
+      continue;
+
+    const ByteStream& bs = jpeg->getData();
+    if (!bs.getRemainSize())
+      continue;
+
+    EmbeddedPreview preview;
+    preview.offset = bs.getOffsetIn(*mFile) + bs.getPosition();
+    preview.length = bs.getRemainSize();
+    previews.emplace_back(preview);
+  }
+  return previews;
+}
+
 void CrwDecoder::checkSupportInternal(const CameraMetaData* meta) {
   vector<const CiffIFD*> data = mRootIFD->getIFDsWithTag(CIFF_MAKEMODEL);
   if (data.empty())
@@ -121,6 +141,15 @@ float __attribute__((const)) CrwDecoder::canonEv(const long in) {
   return copysignf((val + frac) / 32.0F, in);
 }
 
+void CrwDecoder::decodeHeaderInternal() {
+  const CiffEntry* sensorInfo = mRootIFD->getEntryRecursive(CIFF_SENSORINFO);
+  if (!sensorInfo || sensorInfo->count < 6 || sensorInfo->type != CIFF_SHORT)
+    ThrowRDE("Couldn't find image sensor info");
+
+  assert(sensorInfo != nullptr);
+  mRaw->dim = iPoint2D(sensorInfo->getU16(1), sensorInfo->getU16(2));
+}
+
 void CrwDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   int iso = 0;
   mRaw->cfa.setCFA(iPoint2D(2,2), CFA_RED, CFA_GREEN, CFA_GREEN, CFA_BLUE);
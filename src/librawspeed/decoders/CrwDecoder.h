@@ -25,6 +25,7 @@
 #include "decoders/RawDecoder.h" // for RawDecoder
 #include "tiff/CiffIFD.h"        // for CiffIFD
 #include <memory>                // for unique_ptr
+#include <vector>                // for vector
 
 namespace rawspeed {
 
@@ -40,8 +41,12 @@ public:
   RawImage decodeRawInternal() override;
   void checkSupportInternal(const CameraMetaData* meta) override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
   static bool isCRW(const Buffer* input);
 
+  // The JPEG image, and the thumbnail.
+  std::vector<EmbeddedPreview> getEmbeddedPreviews() const override;
+
 protected:
   int getDecoderVersion() const override { return 0; }
   static float canonEv(long in);
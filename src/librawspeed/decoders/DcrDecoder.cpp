@@ -51,7 +51,7 @@ void DcrDecoder::checkImageDimensions() {
 }
 
 RawImage DcrDecoder::decodeRawInternal() {
-  SimpleTiffDecoder::prepareForRawDecoding();
+  SimpleTiffDecoder::prepareForRawDecoding(KodakDecompressor::MinBitsPerPixel);
 
   ByteStream input(mFile, off);
 
@@ -80,20 +80,6 @@ RawImage DcrDecoder::decodeRawInternal() {
 
   RawImageCurveGuard curveHandler(&mRaw, linTable, uncorrectedRawValues);
 
-  // FIXME: dcraw does all sorts of crazy things besides this to fetch
-  //        WB from what appear to be presets and calculate it in weird ways
-  //        The only file I have only uses this method, if anybody careas look
-  //        in dcraw.c parse_kodak_ifd() for all that weirdness
-  TiffEntry* blob = kodakifd.getEntryRecursive(static_cast<TiffTag>(0x03fd));
-  if (blob && blob->count == 72) {
-    for (auto i = 0U; i < 3; i++) {
-      const auto mul = blob->getU16(20 + i);
-      if (0 == mul)
-        ThrowRDE("WB coeffient is zero!");
-      mRaw->metadata.wbCoeffs[i] = 2048.0F / mul;
-    }
-  }
-
   const int bps = [CurveSize = linearization->count]() -> int {
     switch (CurveSize) {
     case 1024:
@@ -112,6 +98,29 @@ RawImage DcrDecoder::decodeRawInternal() {
 
 void DcrDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   setMetaData(meta, "", 0);
+
+  TiffEntry* ifdoffset = mRootIFD->getEntryRecursive(KODAK_IFD);
+  if (!ifdoffset)
+    return;
+
+  NORangesSet<Buffer> ifds;
+
+  TiffRootIFD kodakifd(nullptr, &ifds, ifdoffset->getRootIfdData(),
+                       ifdoffset->getU32());
+
+  // FIXME: dcraw does all sorts of crazy things besides this to fetch
+  //        WB from what appear to be presets and calculate it in weird ways
+  //        The only file I have only uses this method, if anybody careas look
+  //        in dcraw.c parse_kodak_ifd() for all that weirdness
+  TiffEntry* blob = kodakifd.getEntryRecursive(static_cast<TiffTag>(0x03fd));
+  if (blob && blob->count == 72) {
+    for (auto i = 0U; i < 3; i++) {
+      const auto mul = blob->getU16(20 + i);
+      if (0 == mul)
+        ThrowRDE("WB coeffient is zero!");
+      mRaw->metadata.wbCoeffs[i] = 2048.0F / mul;
+    }
+  }
 }
 
 } // namespace rawspeed
@@ -0,0 +1,291 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/DecodePlan.h"
+#include "common/Executor.h"                       // for parallelForEach
+#include "decoders/RawDecoderException.h"          // for ThrowRDE
+#include "decompressors/AbstractDngDecompressor.h" // for AbstractDngDeco...
+#include "io/Buffer.h"                             // for Buffer, DataBuffer
+#include "io/ByteStream.h"                         // for ByteStream
+#include "io/IOException.h"                        // for IOException
+#include <algorithm>                               // for max, min
+#include <limits>                                  // for numeric_limits
+#include <utility>                                 // for move
+
+namespace rawspeed {
+
+namespace {
+
+// "RSDP", and the version of the layout of the plan.
+constexpr uint32 DecodePlanMagic = 0x50445352;
+constexpr uint32 DecodePlanFormat = 1;
+
+void put(std::vector<uchar8>* out, uint64 value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    out->emplace_back(static_cast<uchar8>(value >> (8 * i)));
+}
+
+uint64 getTileSize(const DecodePlan::Tile& tile) {
+  uint64 size = 0;
+  for (const auto& range : tile)
+    size += range.size;
+  return size;
+}
+
+} // namespace
+
+iRectangle2D DecodePlan::getTileArea(uint32 tile) const {
+  const uint32 tilesX = getTilesX();
+  const int x = tileW * (tile % tilesX);
+  const int y = tileH * (tile / tilesX);
+  return {x, y, std::min<int>(tileW, dim.x - x),
+          std::min<int>(tileH, dim.y - y)};
+}
+
+std::vector<uchar8> DecodePlan::getTileData(uint32 tile,
+                                            const Buffer& file) const {
+  if (tile >= tiles.size())
+    ThrowRDE("Tile %u requested, but there are %zu.", tile, tiles.size());
+
+  std::vector<uchar8> data;
+  data.reserve(getTileSize(tiles[tile]));
+  for (const auto& range : tiles[tile]) {
+    const uchar8* bytes = file.getData(range.offset, range.size);
+    data.insert(data.end(), bytes, bytes + range.size);
+  }
+  return data;
+}
+
+RawImage DecodePlan::decodeTile(uint32 tile, const Buffer& data) const {
+  if (tile >= tiles.size())
+    ThrowRDE("Tile %u requested, but there are %zu.", tile, tiles.size());
+  const Tile& t = tiles[tile];
+  if (data.getSize() != getTileSize(t))
+    ThrowRDE("Tile %u has %llu bytes, not %llu.", tile,
+             static_cast<unsigned long long>(data.getSize()),
+             static_cast<unsigned long long>(getTileSize(t)));
+
+  const iRectangle2D area = getTileArea(tile);
+  RawImage img = RawImage::create(area.dim, type, cpp);
+
+  try {
+    switch (format) {
+    case Format::DNG: {
+      img->whitePoint = whitePoint;
+      // The tile is the whole image, so it is the last one of its row and of
+      // its column, but has the pitch of the others.
+      AbstractDngDecompressor d(img, {img->dim, tileW, tileH}, compression,
+                                fixLjpeg, bps, predictor);
+      d.slices.emplace_back(d.dsc, 0, ByteStream(DataBuffer(data, byteOrder)));
+      d.decompress();
+      break;
+    }
+    case Format::IIQ: {
+      ByteStream bs(DataBuffer(data, Endianness::little));
+      std::vector<PhaseOneStrip> strips;
+      strips.reserve(t.size());
+      for (const auto& range : t)
+        strips.emplace_back(static_cast<int>(strips.size()),
+                            bs.getStream(range.size));
+
+      PhaseOneDecompressor p(img, std::move(strips));
+      if (haveQuadrantCurves) {
+        // The split, as a row of the band.
+        PhaseOneQuadrantCurves curves = quadrantCurves;
+        curves.split.y = std::min(
+            std::max(curves.split.y - area.pos.y, 0), area.dim.y);
+        p.setQuadrantCurves(std::move(curves));
+      }
+      p.decompress();
+      break;
+    }
+    }
+  } catch (IOException& e) {
+    ThrowRDE("%s", e.what());
+  }
+
+  return img;
+}
+
+std::vector<RawImage>
+DecodePlan::decodeTiles(const std::vector<uint32>& indexes,
+                        const std::vector<Buffer>& data) const {
+  if (indexes.size() != data.size())
+    ThrowRDE("%zu tiles, but the data of %zu.", indexes.size(), data.size());
+
+  std::vector<RawImage> images(indexes.size(), RawImage::create());
+  parallelForEach(0, static_cast<int>(indexes.size()),
+                  [this, &indexes, &data, &images](int i) {
+                    images[i] = decodeTile(indexes[i], data[i]);
+                  });
+  return images;
+}
+
+void DecodePlan::placeTiles(const RawImage& img,
+                            const std::vector<RawImage>& all) const {
+  if (all.size() != tiles.size())
+    ThrowRDE("%zu tiles given, but there are %zu.", all.size(), tiles.size());
+  if (img->getUncroppedDim() != dim || img->getDataType() != type ||
+      img->getCpp() != cpp)
+    ThrowRDE("The image is not the one of the plan.");
+
+  for (uint32 tile = 0; tile < all.size(); tile++) {
+    const RawImage& t = all[tile];
+    const iRectangle2D area = getTileArea(tile);
+    if (t->dim != area.dim || t->getDataType() != type || t->getCpp() != cpp)
+      ThrowRDE("Tile %u is not the one of the plan.", tile);
+    img->blitFrom(t, {0, 0}, area.dim, area.pos);
+  }
+}
+
+std::vector<uchar8> DecodePlan::serialize() const {
+  std::vector<uchar8> out;
+  put(&out, DecodePlanMagic, 4);
+  put(&out, DecodePlanFormat, 4);
+  put(&out, static_cast<uint32>(format), 4);
+  put(&out, type, 4);
+  put(&out, cpp, 4);
+  put(&out, dim.x, 4);
+  put(&out, dim.y, 4);
+  put(&out, tileW, 4);
+  put(&out, tileH, 4);
+  put(&out, compression, 4);
+  put(&out, bps, 4);
+  put(&out, predictor, 4);
+  put(&out, fixLjpeg, 1);
+  put(&out, byteOrder == Endianness::big, 1);
+  put(&out, whitePoint, 4);
+
+  put(&out, haveQuadrantCurves, 1);
+  if (haveQuadrantCurves) {
+    put(&out, quadrantCurves.split.x, 4);
+    put(&out, quadrantCurves.split.y, 4);
+    for (const auto& curve : quadrantCurves.curves) {
+      for (ushort16 v : curve)
+        put(&out, v, 2);
+    }
+  }
+
+  put(&out, tiles.size(), 4);
+  for (const auto& tile : tiles) {
+    put(&out, tile.size(), 4);
+    for (const auto& range : tile) {
+      put(&out, range.offset, 8);
+      put(&out, range.size, 4);
+    }
+  }
+  return out;
+}
+
+DecodePlan DecodePlan::deserialize(const Buffer& plan) {
+  try {
+    ByteStream bs(DataBuffer(plan, Endianness::little));
+    if (bs.getU32() != DecodePlanMagic)
+      ThrowRDE("Not a decode plan.");
+    if (bs.getU32() != DecodePlanFormat)
+      ThrowRDE("Unsupported version of the decode plan.");
+
+    DecodePlan p;
+    p.format = static_cast<Format>(bs.getU32());
+    if (p.format != Format::DNG && p.format != Format::IIQ)
+      ThrowRDE("Unknown format %u.", static_cast<uint32>(p.format));
+    const uint32 type = bs.getU32();
+    if (type != TYPE_USHORT16 && type != TYPE_FLOAT32)
+      ThrowRDE("Unknown data type %u.", type);
+    p.type = static_cast<RawImageType>(type);
+    p.cpp = bs.getU32();
+    if (p.cpp < 1 || p.cpp > 4)
+      ThrowRDE("Unsupported samples per pixel count: %u.", p.cpp);
+    p.dim.x = bs.getI32();
+    p.dim.y = bs.getI32();
+    if (!p.dim.hasPositiveArea())
+      ThrowRDE("Image has zero size");
+    p.tileW = bs.getU32();
+    p.tileH = bs.getU32();
+    if (p.tileW == 0 || p.tileH == 0 ||
+        p.tileW > static_cast<uint32>(std::numeric_limits<int>::max()) ||
+        p.tileH > static_cast<uint32>(std::numeric_limits<int>::max()))
+      ThrowRDE("Invalid tile size: (%u, %u)", p.tileW, p.tileH);
+    p.compression = bs.getI32();
+    p.bps = bs.getU32();
+    p.predictor = bs.getU32();
+    p.fixLjpeg = bs.getByte() != 0;
+    p.byteOrder = bs.getByte() != 0 ? Endianness::big : Endianness::little;
+    p.whitePoint = bs.getI32();
+
+    p.haveQuadrantCurves = bs.getByte() != 0;
+    if (p.haveQuadrantCurves) {
+      p.quadrantCurves.split.x = bs.getI32();
+      p.quadrantCurves.split.y = bs.getI32();
+      if (p.quadrantCurves.split.x < 0 || p.quadrantCurves.split.y < 0 ||
+          p.quadrantCurves.split.x > p.dim.x ||
+          p.quadrantCurves.split.y > p.dim.y)
+        ThrowRDE("Invalid sensor quadrant split values (%i, %i)",
+                 p.quadrantCurves.split.y, p.quadrantCurves.split.x);
+      for (auto& curve : p.quadrantCurves.curves) {
+        curve.resize(65536);
+        for (auto& v : curve)
+          v = bs.getU16();
+      }
+    }
+
+    if (p.format == Format::IIQ &&
+        (p.type != TYPE_USHORT16 || p.cpp != 1 ||
+         p.tileW != static_cast<uint32>(p.dim.x)))
+      ThrowRDE("The bands of an IIQ are single-component rows.");
+    if (p.format == Format::DNG && p.haveQuadrantCurves)
+      ThrowRDE("A DNG has no quadrant curves.");
+
+    const uint64 numTiles = uint64(p.getTilesX()) * p.getTilesY();
+    if (bs.getU32() != numTiles)
+      ThrowRDE("Not the %llu tiles of the grid.",
+               static_cast<unsigned long long>(numTiles));
+    // Each takes at least a count and a range.
+    bs.check(numTiles, 4 + 12);
+    p.tiles.resize(numTiles);
+    for (uint32 n = 0; n < numTiles; n++) {
+      // A DNG tile is one range, an IIQ band one for each of its rows.
+      const uint32 numRanges = bs.getU32();
+      const uint32 expected =
+          p.format == Format::DNG ? 1 : p.getTileArea(n).dim.y;
+      if (numRanges != expected)
+        ThrowRDE("Tile %u has %u byte ranges, not %u.", n, numRanges,
+                 expected);
+      bs.check(numRanges, 12);
+      Tile& tile = p.tiles[n];
+      tile.resize(numRanges);
+      for (auto& range : tile) {
+        range.offset = bs.get<uint64>();
+        range.size = bs.getU32();
+        if (range.size == 0)
+          ThrowRDE("Tile %u is empty", n);
+      }
+    }
+
+    if (bs.getRemainSize())
+      ThrowRDE("%u bytes of the decode plan left over.",
+               static_cast<uint32>(bs.getRemainSize()));
+    return p;
+  } catch (IOException& e) {
+    ThrowRDE("%s", e.what());
+  }
+}
+
+} // namespace rawspeed
@@ -0,0 +1,117 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"                      // for uint32, uint64, uchar8
+#include "common/Point.h"                       // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"                    // for RawImage, RawImageType
+#include "decompressors/PhaseOneDecompressor.h" // for PhaseOneQuadrantCurves
+#include "io/Endianness.h"                      // for Endianness
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+class Buffer;
+
+// Where the compressed pixels of a file are, as tiles that can each be
+// decoded from just their own bytes, and everything that is needed for
+// that, e.g. to spread a huge file over the nodes of a cluster.
+//
+// The coordinator, which has the whole file, gets the plan from
+// RawDecoder::getDecodePlan(), and sends it, serialize()d, to the workers,
+// along with the bytes of the tiles of each, see getTileData(). Each worker
+// decodes its tiles with decodeTiles(), into images of their own, and
+// sends those back. RawDecoder::decodeRaw(tiles) then places them into the
+// image, and does the rest of the decoding, e.g. the DNG opcodes, the crop
+// and the levels, as decodeRaw() would.
+struct DecodePlan final {
+  enum class Format : uint32 {
+    // The tiles, or the strips, of a DNG, see AbstractDngDecompressor.
+    DNG = 1,
+    // The bands of the rows of an IIQ, see PhaseOneDecompressor.
+    IIQ = 2,
+  };
+
+  // Where, within the file, some of the bytes of a tile are.
+  struct ByteRange final {
+    uint64 offset = 0;
+    uint32 size = 0;
+  };
+
+  // A tile of a DNG is just the one range, a band of an IIQ has one for
+  // each of its rows, in order.
+  using Tile = std::vector<ByteRange>;
+
+  Format format = Format::DNG;
+
+  // Of the whole image.
+  RawImageType type = TYPE_USHORT16;
+  uint32 cpp = 1;
+  iPoint2D dim;
+
+  // The tiles are on a grid of this size, in the order of the rows, the last
+  // ones of a row and of a column being cut off by the image.
+  uint32 tileW = 0;
+  uint32 tileH = 0;
+  std::vector<Tile> tiles;
+
+  // Of the DNG, as for AbstractDngDecompressor. Some of the decompressors,
+  // e.g. VC5, depend on the white point.
+  int compression = 1;
+  uint32 bps = 16;
+  uint32 predictor = ~0U;
+  bool fixLjpeg = false;
+  Endianness byteOrder = Endianness::little;
+  int whitePoint = 65536;
+
+  // Of the IIQ, the curves that the rows are mapped through, as they are
+  // decoded, if there are any.
+  bool haveQuadrantCurves = false;
+  PhaseOneQuadrantCurves quadrantCurves;
+
+  uint32 getTilesX() const { return roundUpDivision(dim.x, tileW); }
+  uint32 getTilesY() const { return roundUpDivision(dim.y, tileH); }
+
+  // Where the tile is within the image.
+  iRectangle2D getTileArea(uint32 tile) const;
+
+  // The bytes of the tile, out of the file, as decodeTile() takes them.
+  std::vector<uchar8> getTileData(uint32 tile, const Buffer& file) const;
+
+  // Decodes the tile, from the bytes of getTileData(), into an image of the
+  // size of the tile.
+  RawImage decodeTile(uint32 tile, const Buffer& data) const;
+
+  // Same, for each of the tiles, concurrently, in that order.
+  std::vector<RawImage> decodeTiles(const std::vector<uint32>& indexes,
+                                    const std::vector<Buffer>& data) const;
+
+  // Copies all of the tiles, as decodeTile() returned them, in the order of
+  // the tiles, into the image, which has the dimensions of the plan.
+  void placeTiles(const RawImage& img, const std::vector<RawImage>& all) const;
+
+  // Little-endian, as the decode index. deserialize() checks all of it, as
+  // it may come from elsewhere.
+  std::vector<uchar8> serialize() const;
+  static DecodePlan deserialize(const Buffer& plan);
+};
+
+} // namespace rawspeed
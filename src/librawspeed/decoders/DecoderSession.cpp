@@ -0,0 +1,94 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/DecoderSession.h"
+#include "common/ImageAllocator.h" // for PooledImageAllocator, BudgetImag...
+#include "common/ScratchArena.h"   // for ScratchArena
+#include "decoders/RawDecoder.h"   // for RawDecoder
+#include "parsers/RawParser.h"     // for RawParser
+#include <utility>                 // for move
+
+namespace rawspeed {
+
+DecoderSession::DecoderSession(const CameraMetaData* meta_,
+                               size_t maxPooledBytes,
+                               std::shared_ptr<ImageAllocator> upstream)
+    : meta(meta_), arena(std::make_shared<ScratchArena>()) {
+  if (!maxPooledBytes)
+    return;
+
+  counted = std::make_shared<BudgetImageAllocator>(
+      0, upstream ? std::move(upstream) : getImageAllocator());
+  pool = std::make_shared<PooledImageAllocator>(maxPooledBytes, counted);
+}
+
+// The images that are still alive keep the pool.
+DecoderSession::~DecoderSession() = default;
+
+RawImage DecoderSession::decodeOne(const Buffer* file) {
+  RawParser parser(file);
+  auto decoder = parser.getDecoder(meta);
+  decoder->imageAllocator = pool;
+  decoder->scratchArena = arena;
+
+  if (configure)
+    configure(decoder.get());
+
+  decoder->checkSupport(meta);
+  if (!metaDataOnly)
+    decoder->decodeRaw();
+  decoder->decodeMetaData(meta);
+
+  // The arena is reset for the next file.
+  decoder->mRaw->scratch.reset();
+  return decoder->mRaw;
+}
+
+RawImage DecoderSession::decode(const Buffer* file) {
+  // Only once the decoder, and so all of the users of the arena, are gone.
+  RawImage img = RawImage::create();
+  try {
+    img = decodeOne(file);
+  } catch (...) {
+    arena->reset();
+    throw;
+  }
+  arena->reset();
+
+  decodes++;
+  return img;
+}
+
+DecoderSession::Stats DecoderSession::getStats() const {
+  Stats stats;
+  stats.decodes = decodes;
+  if (counted)
+    stats.imageAllocations = counted->getNumAllocations();
+  stats.scratchBytes = arena->getReservedBytes();
+  return stats;
+}
+
+void DecoderSession::trim() {
+  if (pool)
+    pool->trim();
+  arena->release();
+}
+
+} // namespace rawspeed
@@ -0,0 +1,120 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"   // for uint64
+#include "common/RawImage.h" // for RawImage
+#include <cstddef>           // for size_t
+#include <functional>        // for function
+#include <memory>            // for shared_ptr
+
+namespace rawspeed {
+
+class BudgetImageAllocator;
+
+class Buffer;
+
+class CameraMetaData;
+
+class ImageAllocator;
+
+class PooledImageAllocator;
+
+class RawDecoder;
+
+class ScratchArena;
+
+// Decodes one file after the other, keeping what the decodes of the files
+// of the same camera can share, so that only the first one of them pays for
+// the setup:
+//  * the memory of the images, in a PooledImageAllocator, that the next
+//    image of the same dimensions and format gets once the previous one is
+//    released;
+//  * the temporary buffers of the decoders, in a ScratchArena, that is
+//    reset, but not freed, after each file.
+// The set up Huffman tables are cached by their codes for all of the
+// decoders anyway, see getSetUpHuffmanTable(), and so are the cameras of
+// the CameraMetaData, once they are looked up for the first time.
+//
+// One session is for one thread at a time, the decodes themselves still
+// use all of the executor. For many files at once, see BatchDecoder, which
+// has a session for each of its workers.
+class DecoderSession final {
+public:
+  using ConfigureFunction = std::function<void(RawDecoder* decoder)>;
+
+  // The images are pooled up to maxPooledBytes, of the memory of the
+  // released ones, or not at all if 0, then coming from the current
+  // getImageAllocator(). The pool gets the memory from upstream, or from
+  // the current getImageAllocator() if none.
+  explicit DecoderSession(const CameraMetaData* meta,
+                          size_t maxPooledBytes = 256UL << 20UL,
+                          std::shared_ptr<ImageAllocator> upstream = nullptr);
+
+  DecoderSession(const DecoderSession&) = delete;
+  DecoderSession(DecoderSession&&) = delete;
+  DecoderSession& operator=(const DecoderSession&) = delete;
+  DecoderSession& operator=(DecoderSession&&) = delete;
+
+  ~DecoderSession();
+
+  // If set, it is called for each decoder before the decoding,
+  // e.g. to set RawDecoder::failOnUnknown.
+  ConfigureFunction configure;
+
+  // As BatchDecoder::metaDataOnly.
+  bool metaDataOnly = false;
+
+  // Parses and decodes the file, as decodeRaw() and decodeMetaData() would,
+  // and returns the image. Throws if that fails.
+  RawImage decode(const Buffer* file);
+
+  struct Stats {
+    unsigned decodes = 0; // That succeeded.
+    // Of the images, that the pool could not serve, so 1 per decode if the
+    // images are kept, or if the dimensions keep changing, and 0 otherwise,
+    // after the first one. Only counted if there is a pool.
+    uint64 imageAllocations = 0;
+    // Kept by the ScratchArena for the next decode.
+    size_t scratchBytes = 0;
+  };
+  Stats getStats() const;
+
+  // Frees all of the memory that is kept for the next decodes.
+  void trim();
+
+  // Of the images, or nullptr if there is none, e.g. for
+  // PrewarmOptions::imageAllocator.
+  const std::shared_ptr<PooledImageAllocator>& getImagePool() const {
+    return pool;
+  }
+
+private:
+  const CameraMetaData* meta;
+  std::shared_ptr<BudgetImageAllocator> counted;
+  std::shared_ptr<PooledImageAllocator> pool;
+  const std::shared_ptr<ScratchArena> arena;
+  unsigned decodes = 0;
+
+  RawImage decodeOne(const Buffer* file);
+};
+
+} // namespace rawspeed
@@ -20,33 +20,35 @@
 
 #include "rawspeedconfig.h" // for HAVE_JPEG, HAVE_ZLIB
 #include "decoders/DngDecoder.h"
-#include "common/Common.h"                         // for uint32, roundUpDi...
-#include "common/DngOpcodes.h"                     // for DngOpcodes
-#include "common/NORangesSet.h"                    // for set
-#include "common/Point.h"                          // for iPoint2D, iRectan...
-#include "common/RawspeedException.h"              // for RawspeedException
-#include "decoders/RawDecoderException.h"          // for ThrowRDE, RawDeco...
-#include "decompressors/AbstractDngDecompressor.h" // for DngSliceElement
-#include "io/Buffer.h"                             // for Buffer, DataBuffer
-#include "io/ByteStream.h"                         // for ByteStream
-#include "metadata/BlackArea.h"                    // for BlackArea
-#include "metadata/Camera.h"                       // for Camera
-#include "metadata/CameraMetaData.h"               // for CameraMetaData
-#include "metadata/ColorFilterArray.h"             // for CFAColor, ColorFi...
-#include "parsers/TiffParserException.h"           // for ThrowTPE
-#include "tiff/TiffEntry.h"                        // for TiffEntry, TIFF_LONG
-#include "tiff/TiffIFD.h"                          // for TiffIFD, TiffRootIFD
-#include "tiff/TiffTag.h"                          // for ACTIVEAREA, TILEO...
-#include <algorithm>                               // for any_of
-#include <array>                                   // for array, array<>::v...
-#include <cassert>                                 // for assert
-#include <limits>                                  // for numeric_limits
-#include <map>                                     // for map
-#include <memory>                                  // for unique_ptr
-#include <stdexcept>                               // for out_of_range
-#include <string>                                  // for string, operator+
-#include <utility>                                 // for move, pair
-#include <vector>                                  // for vector, allocator
+#include "common/Common.h"                           // for uint32, roundUpDi...
+#include "common/DngOpcodes.h"                       // for DngOpcodes
+#include "common/NORangesSet.h"                      // for set
+#include "common/Point.h"                            // for iPoint2D, iRectan...
+#include "common/RawspeedException.h"                // for RawspeedException
+#include "decoders/DecodePlan.h"                      // for DecodePlan
+#include "decoders/RawDecoderException.h"            // for ThrowRDE, RawDeco...
+#include "decompressors/AbstractDngDecompressor.h"   // for DngSliceElement
+#include "decompressors/AbstractLJpegDecompressor.h" // for AbstractLJpegDe...
+#include "io/Buffer.h"                               // for Buffer, DataBuffer
+#include "io/ByteStream.h"                           // for ByteStream
+#include "metadata/BlackArea.h"                      // for BlackArea
+#include "metadata/Camera.h"                         // for Camera
+#include "metadata/CameraMetaData.h"                 // for CameraMetaData
+#include "metadata/ColorFilterArray.h"               // for CFAColor, ColorFi...
+#include "parsers/TiffParserException.h"             // for ThrowTPE
+#include "tiff/TiffEntry.h"                          // for TiffEntry, TIFF_LONG
+#include "tiff/TiffIFD.h"                            // for TiffIFD, TiffRootIFD
+#include "tiff/TiffTag.h"                            // for ACTIVEAREA, TILEO...
+#include <algorithm>                                 // for any_of
+#include <array>                                     // for array, array<>::v...
+#include <cassert>                                   // for assert
+#include <limits>                                    // for numeric_limits
+#include <map>                                       // for map
+#include <memory>                                    // for unique_ptr
+#include <stdexcept>                                 // for out_of_range
+#include <string>                                    // for string, operator+
+#include <utility>                                   // for move, pair
+#include <vector>                                    // for vector, allocator
 
 using std::vector;
 using std::map;
@@ -267,7 +269,8 @@ DngTilingDescription DngDecoder::getTilingDescription(const TiffIFD* raw) {
   return {mRaw->dim, static_cast<uint32>(mRaw->dim.x), yPerSlice};
 }
 
-void DngDecoder::decodeData(const TiffIFD* raw, uint32 sample_format) {
+DecodePlan DngDecoder::makeDecodePlan(const TiffIFD* raw,
+                                      uint32 sample_format) {
   if (compression == 8 && sample_format != 3) {
     ThrowRDE("Only float format is supported for "
              "deflate-compressed data.");
@@ -288,10 +291,22 @@ void DngDecoder::decodeData(const TiffIFD* raw, uint32 sample_format) {
       mRaw->whitePoint = whitelevel->getU32();
   }
 
-  AbstractDngDecompressor slices(mRaw, getTilingDescription(raw), compression,
-                                 mFixLjpeg, bps, predictor);
-
-  slices.slices.reserve(slices.dsc.numTiles);
+  const DngTilingDescription dsc = getTilingDescription(raw);
+
+  DecodePlan plan;
+  plan.format = DecodePlan::Format::DNG;
+  plan.type = mRaw->getDataType();
+  plan.cpp = mRaw->getCpp();
+  plan.dim = mRaw->dim;
+  plan.tileW = dsc.tileW;
+  plan.tileH = dsc.tileH;
+  plan.compression = compression;
+  plan.bps = bps;
+  plan.predictor = predictor;
+  plan.fixLjpeg = mFixLjpeg;
+  plan.byteOrder = mRootIFD->rootBuffer.getByteOrder();
+  plan.whitePoint = mRaw->whitePoint;
+  plan.tiles.reserve(dsc.numTiles);
 
   TiffEntry* offsets = nullptr;
   TiffEntry* counts = nullptr;
@@ -302,38 +317,76 @@ void DngDecoder::decodeData(const TiffIFD* raw, uint32 sample_format) {
     offsets = raw->getEntry(STRIPOFFSETS);
     counts = raw->getEntry(STRIPBYTECOUNTS);
   }
-  assert(slices.dsc.numTiles == offsets->count);
-  assert(slices.dsc.numTiles == counts->count);
+  assert(dsc.numTiles == offsets->count);
+  assert(dsc.numTiles == counts->count);
+
+  const auto offsetsView = offsets->getU32View(dsc.numTiles);
+  const auto countsView = counts->getU32View(dsc.numTiles);
 
   NORangesSet<Buffer> tilesLegality;
-  for (auto n = 0U; n < slices.dsc.numTiles; n++) {
-    const auto offset = offsets->getU32(n);
-    const auto count = counts->getU32(n);
+  tilesLegality.reserve(dsc.numTiles);
+  for (auto n = 0U; n < dsc.numTiles; n++) {
+    const auto offset = offsetsView[n];
+    const auto count = countsView[n];
 
     if (count < 1)
       ThrowRDE("Tile %u is empty", n);
 
-    ByteStream bs(mFile->getSubView(offset, count), 0,
-                  mRootIFD->rootBuffer.getByteOrder());
-
-    if (!tilesLegality.emplace(bs).second)
+    if (!tilesLegality.emplace(mFile->getSubView(offset, count)).second)
       ThrowTPE("Two tiles overlap. Raw corrupt!");
 
-    slices.slices.emplace_back(slices.dsc, n, bs);
+    plan.tiles.push_back({{offset, count}});
   }
 
-  assert(slices.slices.size() == slices.dsc.numTiles);
-  if (slices.slices.empty())
+  assert(plan.tiles.size() == dsc.numTiles);
+  if (plan.tiles.empty())
     ThrowRDE("No valid slices found.");
 
+  return plan;
+}
+
+DecodePlan DngDecoder::getDecodePlanInternal() {
+  const TiffIFD* raw = decodeFrameHeader();
+  return makeDecodePlan(raw, mRaw->getDataType() == TYPE_FLOAT32 ? 3 : 1);
+}
+
+void DngDecoder::decodeData(const TiffIFD* raw, uint32 sample_format) {
+  const DecodePlan plan = makeDecodePlan(raw, sample_format);
+
+  if (mPlanTiles) {
+    mRaw->createData();
+    plan.placeTiles(mRaw, *mPlanTiles);
+    return;
+  }
+
+  AbstractDngDecompressor slices(mRaw, {mRaw->dim, plan.tileW, plan.tileH},
+                                 compression, mFixLjpeg, bps, plan.predictor,
+                                 mROI);
+
+  slices.slices.reserve(slices.dsc.numTiles);
+
+  uint64 inputBytes = 0;
+  for (auto n = 0U; n < slices.dsc.numTiles; n++) {
+    const DecodePlan::ByteRange& range = plan.tiles[n].front();
+    ByteStream bs(mFile->getSubView(range.offset, range.size), 0,
+                  plan.byteOrder);
+    slices.slices.emplace_back(slices.dsc, n, bs);
+    inputBytes += range.size;
+  }
+
   // FIXME: should we sort the tiles, to linearize the input reading?
 
+  // The uncompressed tiles are all there, as their size is checked, and
+  // the Deflate and the lossy JPEG have no useful bound.
+  if (compression == 7)
+    mRaw->expectInput(inputBytes, AbstractLJpegDecompressor::MinBitsPerPixel);
   mRaw->createData();
 
+  slices.speculative = speculativeEntropyDecode;
   slices.decompress();
 }
 
-RawImage DngDecoder::decodeRawInternal() {
+vector<const TiffIFD*> DngDecoder::getFrameIFDs() const {
   vector<const TiffIFD*> data = mRootIFD->getIFDsWithTag(COMPRESSION);
 
   if (data.empty())
@@ -344,11 +397,32 @@ RawImage DngDecoder::decodeRawInternal() {
   if (data.empty())
     ThrowRDE("No RAW chunks found");
 
+  return data;
+}
+
+int DngDecoder::getNumFrames() const {
+  return static_cast<int>(getFrameIFDs().size());
+}
+
+std::unique_ptr<RawDecoder> DngDecoder::getFrameDecoder(int frame) const {
+  auto decoder = std::make_unique<DngDecoder>(*this);
+  decoder->mRaw = RawImage::create();
+  decoder->mFrame = frame;
+  return decoder;
+}
+
+const TiffIFD* DngDecoder::decodeFrameHeader() {
+  const vector<const TiffIFD*> data = getFrameIFDs();
+
+  if (mFrame >= static_cast<int>(data.size()))
+    ThrowRDE("Frame %i requested, but there are %zu.", mFrame, data.size());
+
   if (data.size() > 1) {
-    writeLog(DEBUG_PRIO_EXTRA, "Multiple RAW chunks found - using first only!");
+    writeLog(DEBUG_PRIO_EXTRA, "Multiple RAW chunks found - using frame %i!",
+             mFrame);
   }
 
-  const TiffIFD* raw = data[0];
+  const TiffIFD* raw = data[mFrame];
 
   bps = raw->getEntry(BITSPERSAMPLE)->getU32();
   if (bps < 1 || bps > 32)
@@ -360,6 +434,7 @@ RawImage DngDecoder::decodeRawInternal() {
 
   compression = raw->getEntry(COMPRESSION)->getU16();
 
+  const RawImage previous = mRaw;
   switch (sample_format) {
   case 1:
     mRaw = RawImage::create(TYPE_USHORT16);
@@ -372,6 +447,16 @@ RawImage DngDecoder::decodeRawInternal() {
              "format %u is not supported.",
              sample_format);
   }
+  // All that decodeRaw() has set up.
+  mRaw->areaReady = previous->areaReady;
+  mRaw->externalData = previous->externalData;
+  mRaw->allocator = previous->allocator;
+  mRaw->scratch = previous->scratch;
+  mRaw->maxPixels = previous->maxPixels;
+  mRaw->maxBytes = previous->maxBytes;
+  mRaw->cancellation = previous->cancellation;
+  mRaw->aliasInput = previous->aliasInput;
+  mRaw->decodeCounters = previous->decodeCounters;
 
   mRaw->isCFA = (raw->getEntry(PHOTOMETRICINTERPRETATION)->getU16() == 32803);
 
@@ -411,16 +496,31 @@ RawImage DngDecoder::decodeRawInternal() {
 
   mRaw->setCpp(cpp);
 
+  return raw;
+}
+
+RawImage DngDecoder::decodeRawInternal() {
+  const TiffIFD* raw = decodeFrameHeader();
+
   // Now load the image
-  decodeData(raw, sample_format);
+  decodeData(raw, mRaw->getDataType() == TYPE_FLOAT32 ? 3 : 1);
 
   handleMetadata(raw);
 
   return mRaw;
 }
 
-void DngDecoder::handleMetadata(const TiffIFD* raw) {
-  // Crop
+void DngDecoder::decodeHeaderInternal() {
+  const TiffIFD* raw = decodeFrameHeader();
+
+  // What handleMetadata() sets, without the passes over the pixels.
+  setCrop(raw);
+  setLevels(raw);
+  if (hasStage2DngOpcodes(raw))
+    clearLevels();
+}
+
+void DngDecoder::setCrop(const TiffIFD* raw) {
   if (raw->hasEntry(ACTIVEAREA)) {
     TiffEntry *active_area = raw->getEntry(ACTIVEAREA);
     if (active_area->count != 4)
@@ -487,6 +587,41 @@ void DngDecoder::handleMetadata(const TiffIFD* raw) {
   }
   if (mRaw->dim.area() <= 0)
     ThrowRDE("No image left after crop");
+}
+
+void DngDecoder::setLevels(const TiffIFD* raw) {
+  if (mRaw->getDataType() == TYPE_USHORT16) {
+    // Default white level is (2 ** BitsPerSample) - 1
+    mRaw->whitePoint = (1UL << bps) - 1UL;
+  } else if (mRaw->getDataType() == TYPE_FLOAT32) {
+    // Default white level is 1.0f. But we can't represent that here.
+    mRaw->whitePoint = 65535;
+  }
+
+  if (raw->hasEntry(WHITELEVEL)) {
+    TiffEntry *whitelevel = raw->getEntry(WHITELEVEL);
+    if (whitelevel->isInt())
+      mRaw->whitePoint = whitelevel->getU32();
+  }
+  // Set black
+  setBlack(raw);
+}
+
+bool DngDecoder::hasStage2DngOpcodes(const TiffIFD* raw) const {
+  return compression == 0x884c && !uncorrectedRawValues &&
+         raw->hasEntry(OPCODELIST2);
+}
+
+void DngDecoder::clearLevels() {
+  mRaw->blackAreas.clear();
+  mRaw->blackLevel = 0;
+  mRaw->blackLevelSeparate[0] = mRaw->blackLevelSeparate[1] =
+      mRaw->blackLevelSeparate[2] = mRaw->blackLevelSeparate[3] = 0;
+  mRaw->whitePoint = 65535;
+}
+
+void DngDecoder::handleMetadata(const TiffIFD* raw) {
+  setCrop(raw);
 
   // Apply stage 1 opcodes
   if (applyStage1DngOpcodes && raw->hasEntry(OPCODELIST1)) {
@@ -494,6 +629,7 @@ void DngDecoder::handleMetadata(const TiffIFD* raw) {
       TiffEntry* opcodes = raw->getEntry(OPCODELIST1);
       // The entry might exist, but it might be empty, which means no opcodes
       if (opcodes->count > 0) {
+        StageTimer timer(this, STAGE_POST_PROCESS);
         DngOpcodes codes(mRaw, opcodes);
         codes.applyOpCodes(mRaw);
       }
@@ -504,40 +640,39 @@ void DngDecoder::handleMetadata(const TiffIFD* raw) {
     }
   }
 
+  setLevels(raw);
+
+  const bool applyStage2DngOpcodes = hasStage2DngOpcodes(raw);
+
+  // The linearization is followed either by the black/white scaling, which
+  // the stage 2 opcodes need, or, if there are no such opcodes, by nothing
+  // but the fixing of the bad pixels, so those go in the same pass.
+  int stages = 0;
+  if (applyStage2DngOpcodes)
+    stages |= RawImageData::STAGE_SCALE_BLACK_WHITE;
+  else if (interpolateBadPixels)
+    stages |= RawImageData::STAGE_FIX_BAD_PIXELS;
+
   // Linearization
   if (raw->hasEntry(LINEARIZATIONTABLE) &&
       raw->getEntry(LINEARIZATIONTABLE)->count > 0) {
     TiffEntry *lintable = raw->getEntry(LINEARIZATIONTABLE);
     auto table = lintable->getU16Array(lintable->count);
     RawImageCurveGuard curveHandler(&mRaw, table, uncorrectedRawValues);
-    if (!uncorrectedRawValues)
-      mRaw->sixteenBitLookup();
-  }
-
-  if (mRaw->getDataType() == TYPE_USHORT16) {
-    // Default white level is (2 ** BitsPerSample) - 1
-    mRaw->whitePoint = (1UL << bps) - 1UL;
-  } else if (mRaw->getDataType() == TYPE_FLOAT32) {
-    // Default white level is 1.0f. But we can't represent that here.
-    mRaw->whitePoint = 65535;
-  }
-
-  if (raw->hasEntry(WHITELEVEL)) {
-    TiffEntry *whitelevel = raw->getEntry(WHITELEVEL);
-    if (whitelevel->isInt())
-      mRaw->whitePoint = whitelevel->getU32();
+    if (!uncorrectedRawValues) {
+      StageTimer timer(this, STAGE_POST_PROCESS);
+      mRaw->postProcess(stages | RawImageData::STAGE_LOOKUP);
+    }
+  } else if (applyStage2DngOpcodes) {
+    StageTimer timer(this, STAGE_POST_PROCESS);
+    mRaw->postProcess(stages);
   }
-  // Set black
-  setBlack(raw);
 
   // Apply opcodes to lossy DNG
-  if (compression == 0x884c && !uncorrectedRawValues &&
-      raw->hasEntry(OPCODELIST2)) {
-    // We must apply black/white scaling
-    mRaw->scaleBlackWhite();
-
+  if (applyStage2DngOpcodes) {
     // Apply stage 2 codes
     try {
+      StageTimer timer(this, STAGE_POST_PROCESS);
       DngOpcodes codes(mRaw, raw->getEntry(OPCODELIST2));
       codes.applyOpCodes(mRaw);
     } catch (RawDecoderException& e) {
@@ -545,11 +680,7 @@ void DngDecoder::handleMetadata(const TiffIFD* raw) {
       // be usable
       mRaw->setError(e.what());
     }
-    mRaw->blackAreas.clear();
-    mRaw->blackLevel = 0;
-    mRaw->blackLevelSeparate[0] = mRaw->blackLevelSeparate[1] =
-        mRaw->blackLevelSeparate[2] = mRaw->blackLevelSeparate[3] = 0;
-    mRaw->whitePoint = 65535;
+    clearLevels();
   }
 }
 
@@ -24,6 +24,7 @@
 #include "common/RawImage.h"              // for RawImage
 #include "decoders/AbstractTiffDecoder.h" // for AbstractTiffDecoder
 #include "tiff/TiffIFD.h"                 // for TiffIFD (ptr only), TiffRo...
+#include <memory>                         // for unique_ptr
 #include <vector>                         // for vector
 
 namespace rawspeed {
@@ -32,6 +33,8 @@ class CameraMetaData;
 
 class Buffer;
 
+struct DecodePlan;
+
 struct DngTilingDescription;
 
 class DngDecoder final : public AbstractTiffDecoder
@@ -43,21 +46,40 @@ public:
 
   RawImage decodeRawInternal() override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
   void checkSupportInternal(const CameraMetaData* meta) override;
 
+  // All of the supported raw IFDs, e.g. of a burst.
+  int getNumFrames() const override;
+
 protected:
   int getDecoderVersion() const override { return 0; }
   bool mFixLjpeg;
-  void dropUnsuportedChunks(std::vector<const TiffIFD*>* data);
+  static void dropUnsuportedChunks(std::vector<const TiffIFD*>* data);
+  std::vector<const TiffIFD*> getFrameIFDs() const;
+  std::unique_ptr<RawDecoder> getFrameDecoder(int frame) const override;
   void parseCFA(const TiffIFD* raw);
   DngTilingDescription getTilingDescription(const TiffIFD* raw);
+  // The tiles or the strips, as decodeData() decodes them. Also sets the
+  // white point, which some of the decompressors depend on.
+  DecodePlan makeDecodePlan(const TiffIFD* raw, uint32 sample_format);
+  DecodePlan getDecodePlanInternal() override;
+  // Picks the frame's IFD, and sets the type, dimensions, CFA and cpp.
+  const TiffIFD* decodeFrameHeader();
   void decodeData(const TiffIFD* raw, uint32 sample_format);
   void handleMetadata(const TiffIFD* raw);
+  void setCrop(const TiffIFD* raw);
+  void setLevels(const TiffIFD* raw);
+  bool hasStage2DngOpcodes(const TiffIFD* raw) const;
+  // After the stage 2 opcodes, the image is scaled to the full range.
+  void clearLevels();
   bool decodeMaskedAreas(const TiffIFD* raw);
   bool decodeBlackLevels(const TiffIFD* raw);
   void setBlack(const TiffIFD* raw);
 
 private:
+  // The one of getFrameIFDs() to decode.
+  int mFrame = 0;
   int bps = -1;
   int compression = -1;
 };
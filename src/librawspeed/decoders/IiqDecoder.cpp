@@ -24,6 +24,7 @@
 #include "common/Common.h"                      // for uint32, ushort16
 #include "common/Point.h"                       // for iPoint2D
 #include "common/Spline.h"                      // for Spline, Spline<>::va...
+#include "decoders/DecodePlan.h"                // for DecodePlan
 #include "decoders/RawDecoder.h"                // for RawDecoder::(anonymous)
 #include "decoders/RawDecoderException.h"       // for ThrowRDE
 #include "decompressors/PhaseOneDecompressor.h" // for PhaseOneStrip, Phase...
@@ -64,15 +65,12 @@ bool IiqDecoder::isAppropriateDecoder(const TiffRootIFD* rootIFD,
 }
 
 // FIXME: this is very close to SamsungV0Decompressor::computeStripes()
-std::vector<PhaseOneStrip>
-IiqDecoder::computeSripes(const Buffer& raw_data,
-                          std::vector<IiqOffset>&& offsets,
+std::vector<IiqDecoder::IiqStrip>
+IiqDecoder::computeSripes(uint64 rawSize, std::vector<IiqOffset>&& offsets,
                           uint32 height) const {
   assert(height > 0);
   assert(offsets.size() == (1 + height));
 
-  ByteStream bs(DataBuffer(raw_data, Endianness::little));
-
   // so... here's the thing. offsets are not guaranteed to be in
   // monotonically increasing order. so for each element of 'offsets',
   // we need to find element which specifies next larger offset.
@@ -85,30 +83,30 @@ IiqDecoder::computeSripes(const Buffer& raw_data,
               return a.offset < b.offset;
             });
 
-  std::vector<PhaseOneStrip> slices;
-  slices.reserve(height);
+  // Each of the rows, once, as all of the offsets differ.
+  std::vector<IiqStrip> slices(height);
 
   auto offset_iterator = std::begin(offsets);
-  bs.skipBytes(offset_iterator->offset);
-
   auto next_offset_iterator = std::next(offset_iterator);
   while (next_offset_iterator < std::end(offsets)) {
     assert(next_offset_iterator->offset > offset_iterator->offset);
     const auto size = next_offset_iterator->offset - offset_iterator->offset;
     assert(size > 0);
 
-    slices.emplace_back(offset_iterator->n, bs.getStream(size));
+    // The dummy one is the end of the raw data, so none of the others is
+    // after it.
+    if (offset_iterator->n == height || next_offset_iterator->offset > rawSize)
+      ThrowRDE("Strip offset past the end of the raw data.");
+    slices[offset_iterator->n] = {offset_iterator->offset, size};
 
     std::advance(offset_iterator, 1);
     std::advance(next_offset_iterator, 1);
   }
 
-  assert(slices.size() == height);
-
   return slices;
 }
 
-RawImage IiqDecoder::decodeRawInternal() {
+IiqDecoder::IiqHeader IiqDecoder::parseHeader() {
   const Buffer buf(mFile->getSubView(8));
   const DataBuffer db(buf, Endianness::little);
   ByteStream bs(db);
@@ -130,15 +128,7 @@ RawImage IiqDecoder::decodeRawInternal() {
 
   bs.setPosition(origPos);
 
-  uint32 width = 0;
-  uint32 height = 0;
-  uint32 split_row = 0;
-  uint32 split_col = 0;
-
-  Buffer raw_data;
-  ByteStream block_offsets;
-  ByteStream wb;
-  ByteStream correction_meta_data;
+  IiqHeader h;
 
   for (uint32 entry = 0; entry < entries_count; entry++) {
     const uint32 tag = es.getU32();
@@ -148,32 +138,33 @@ RawImage IiqDecoder::decodeRawInternal() {
 
     switch (tag) {
     case 0x107:
-      wb = bs.getSubStream(data, len);
+      h.wb = bs.getSubStream(data, len);
       break;
     case 0x108:
-      width = data;
+      h.width = data;
       break;
     case 0x109:
-      height = data;
+      h.height = data;
       break;
     case 0x10f:
-      raw_data = bs.getSubView(data, len);
+      h.raw_data = bs.getSubView(data, len);
+      h.raw_data_offset = 8 + uint64(data);
       break;
     case 0x110:
-      correction_meta_data = bs.getSubStream(data);
+      h.correction_meta_data = bs.getSubStream(data);
       break;
     case 0x21c:
       // they are not guaranteed to be sequential!
-      block_offsets = bs.getSubStream(data, len);
+      h.block_offsets = bs.getSubStream(data, len);
       break;
     case 0x21d:
       black_level = data >> 2;
       break;
     case 0x222:
-      split_col = data;
+      h.split_col = data;
       break;
     case 0x224:
-      split_row = data;
+      h.split_row = data;
       break;
     default:
       // FIXME: is there a "block_sizes" entry?
@@ -181,46 +172,111 @@ RawImage IiqDecoder::decodeRawInternal() {
     }
   }
 
+  return h;
+}
+
+std::vector<IiqDecoder::IiqStrip> IiqDecoder::getStrips(IiqHeader* h) const {
   // FIXME: could be wrong. max "active pixels" in "Sensor+" mode - "101 MP"
-  if (width == 0 || height == 0 || width > 11608 || height > 8708)
-    ThrowRDE("Unexpected image dimensions found: (%u; %u)", width, height);
+  if (h->width == 0 || h->height == 0 || h->width > 11608 ||
+      h->height > 8708)
+    ThrowRDE("Unexpected image dimensions found: (%u; %u)", h->width,
+             h->height);
 
-  if (split_col > width || split_row > height)
-    ThrowRDE("Invalid sensor quadrant split values (%u, %u)", split_row,
-             split_col);
+  if (h->split_col > h->width || h->split_row > h->height)
+    ThrowRDE("Invalid sensor quadrant split values (%u, %u)", h->split_row,
+             h->split_col);
 
-  block_offsets = block_offsets.getStream(height, sizeof(uint32));
+  h->block_offsets = h->block_offsets.getStream(h->height, sizeof(uint32));
 
   std::vector<IiqOffset> offsets;
-  offsets.reserve(1 + height);
+  offsets.reserve(1 + h->height);
 
-  for (uint32 row = 0; row < height; row++)
-    offsets.emplace_back(row, block_offsets.getU32());
+  for (uint32 row = 0; row < h->height; row++)
+    offsets.emplace_back(row, h->block_offsets.getU32());
 
   // to simplify slice size calculation, we insert a dummy offset,
   // which will be used much like end()
-  offsets.emplace_back(height, raw_data.getSize());
+  offsets.emplace_back(h->height, h->raw_data.getSize());
 
-  std::vector<PhaseOneStrip> strips(
-      computeSripes(raw_data, std::move(offsets), height));
+  return computeSripes(h->raw_data.getSize(), std::move(offsets), h->height);
+}
 
-  mRaw->dim = iPoint2D(width, height);
+bool IiqDecoder::getQuadrantCurves(const IiqHeader& h,
+                                   PhaseOneQuadrantCurves* curves) const {
+  return h.correction_meta_data.getSize() != 0 && iiq &&
+         getPhaseOneCCorrection(h.correction_meta_data, h.split_row,
+                                h.split_col, curves);
+}
 
-  PhaseOneDecompressor p(mRaw, std::move(strips));
-  mRaw->createData();
-  p.decompress();
+DecodePlan IiqDecoder::makeDecodePlan(const IiqHeader& h,
+                                      const std::vector<IiqStrip>& strips,
+                                      PhaseOneQuadrantCurves&& curves,
+                                      bool haveCurves) const {
+  DecodePlan plan;
+  plan.format = DecodePlan::Format::IIQ;
+  plan.dim = iPoint2D(h.width, h.height);
+  plan.tileW = h.width;
+  plan.tileH = IiqBandRows;
+  plan.haveQuadrantCurves = haveCurves;
+  if (haveCurves)
+    plan.quadrantCurves = std::move(curves);
+
+  const uint32 numBands = plan.getTilesY();
+  plan.tiles.resize(numBands);
+  for (uint32 band = 0; band < numBands; band++) {
+    const uint32 end = std::min(h.height, (band + 1) * IiqBandRows);
+    for (uint32 row = band * IiqBandRows; row < end; row++)
+      plan.tiles[band].push_back(
+          {h.raw_data_offset + strips[row].offset, strips[row].size});
+  }
+  return plan;
+}
 
-  if (correction_meta_data.getSize() != 0 && iiq)
-    CorrectPhaseOneC(correction_meta_data, split_row, split_col);
+DecodePlan IiqDecoder::getDecodePlanInternal() {
+  IiqHeader h = parseHeader();
+  const std::vector<IiqStrip> strips = getStrips(&h);
+  PhaseOneQuadrantCurves curves;
+  const bool haveCurves = getQuadrantCurves(h, &curves);
+  return makeDecodePlan(h, strips, std::move(curves), haveCurves);
+}
+
+RawImage IiqDecoder::decodeRawInternal() {
+  IiqHeader h = parseHeader();
+  const std::vector<IiqStrip> strips = getStrips(&h);
+
+  mRaw->dim = iPoint2D(h.width, h.height);
+
+  PhaseOneQuadrantCurves curves;
+  const bool haveCurves = getQuadrantCurves(h, &curves);
+
+  if (mPlanTiles) {
+    mRaw->createData();
+    makeDecodePlan(h, strips, std::move(curves), haveCurves)
+        .placeTiles(mRaw, *mPlanTiles);
+  } else {
+    const ByteStream bs(DataBuffer(h.raw_data, Endianness::little));
+    std::vector<PhaseOneStrip> rows;
+    rows.reserve(h.height);
+    for (uint32 row = 0; row < h.height; row++)
+      rows.emplace_back(row, bs.getSubStream(strips[row].offset,
+                                             strips[row].size));
+
+    PhaseOneDecompressor p(mRaw, std::move(rows));
+    if (haveCurves)
+      p.setQuadrantCurves(std::move(curves));
+    mRaw->createData();
+    p.decompress();
+  }
 
   for (int i = 0; i < 3; i++)
-    mRaw->metadata.wbCoeffs[i] = wb.getFloat();
+    mRaw->metadata.wbCoeffs[i] = h.wb.getFloat();
 
   return mRaw;
 }
 
-void IiqDecoder::CorrectPhaseOneC(ByteStream meta_data, uint32 split_row,
-                                  uint32 split_col) {
+bool IiqDecoder::getPhaseOneCCorrection(ByteStream meta_data, uint32 split_row,
+                                        uint32 split_col,
+                                        PhaseOneQuadrantCurves* curves) const {
   meta_data.skipBytes(8);
   const uint32 bytes_to_entries = meta_data.getU32();
   meta_data.setPosition(bytes_to_entries);
@@ -239,15 +295,17 @@ void IiqDecoder::CorrectPhaseOneC(ByteStream meta_data, uint32 split_row,
     switch (tag) {
     case 0x431:
       if (!iiq.quadrantMultipliers)
-        return;
+        return false;
 
-      CorrectQuadrantMultipliersCombined(meta_data.getSubStream(offset, len),
-                                         split_row, split_col);
-      return;
+      *curves = getQuadrantMultipliersCombined(
+          meta_data.getSubStream(offset, len), split_row, split_col);
+      return true;
     default:
       break;
     }
   }
+
+  return false;
 }
 
 // This method defines a correction that compensates for the fact that
@@ -258,9 +316,9 @@ void IiqDecoder::CorrectPhaseOneC(ByteStream meta_data, uint32 split_row,
 // together smoothly.  The correction factor is not a single
 // multiplier, but a curve defined by seven control points.  Each
 // curve's control points share the same seven X-coordinates.
-void IiqDecoder::CorrectQuadrantMultipliersCombined(ByteStream data,
-                                                    uint32 split_row,
-                                                    uint32 split_col) {
+PhaseOneQuadrantCurves
+IiqDecoder::getQuadrantMultipliersCombined(ByteStream data, uint32 split_row,
+                                           uint32 split_col) const {
   std::array<uint32, 9> shared_x_coords;
 
   // Read the middle seven points from the file
@@ -298,39 +356,46 @@ void IiqDecoder::CorrectQuadrantMultipliersCombined(ByteStream data,
     }
   }
 
+  PhaseOneQuadrantCurves curves;
+  curves.split = iPoint2D(split_col, split_row);
+
   for (int quadRow = 0; quadRow < 2; quadRow++) {
     for (int quadCol = 0; quadCol < 2; quadCol++) {
       const Spline<> s(control_points[quadRow][quadCol]);
       const std::vector<ushort16> curve = s.calculateCurve();
 
-      int row_start = quadRow == 0 ? 0 : split_row;
-      int row_end = quadRow == 0 ? split_row : mRaw->dim.y;
-      int col_start = quadCol == 0 ? 0 : split_col;
-      int col_end = quadCol == 0 ? split_col : mRaw->dim.x;
-
-      for (int row = row_start; row < row_end; row++) {
-        auto* pixel =
-            reinterpret_cast<ushort16*>(mRaw->getData(col_start, row));
-        for (int col = col_start; col < col_end; col++, pixel++) {
-          // This adjustment is expected to be made with the
-          // black-level already subtracted from the pixel values.
-          // Because this is kept as metadata and not subtracted at
-          // this point, to make the correction work we subtract the
-          // appropriate amount before indexing into the curve and
-          // then add it back so that subtracting the black level
-          // later will work as expected
-          const ushort16 diff = *pixel < black_level ? *pixel : black_level;
-          *pixel = curve[*pixel - diff] + diff;
-        }
+      // This adjustment is expected to be made with the black-level
+      // already subtracted from the pixel values. Because this is kept
+      // as metadata and not subtracted at this point, to make the
+      // correction work we subtract the appropriate amount before
+      // indexing into the curve and then add it back so that
+      // subtracting the black level later will work as expected.
+      // That is folded into the table, which maps the pixels directly.
+      std::vector<ushort16>& table = curves.curves[2 * quadRow + quadCol];
+      table.resize(curve.size());
+      for (uint32 v = 0; v < table.size(); v++) {
+        const uint32 diff = v < black_level ? v : black_level;
+        table[v] = curve[v - diff] + diff;
       }
     }
   }
+
+  return curves;
 }
 
 void IiqDecoder::checkSupportInternal(const CameraMetaData* meta) {
   checkCameraSupported(meta, mRootIFD->getID(), "");
 }
 
+void IiqDecoder::decodeHeaderInternal() {
+  IiqHeader h = parseHeader();
+
+  mRaw->dim = iPoint2D(h.width, h.height);
+
+  for (int i = 0; i < 3; i++)
+    mRaw->metadata.wbCoeffs[i] = h.wb.getFloat();
+}
+
 void IiqDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   setMetaData(meta, "", 0);
 
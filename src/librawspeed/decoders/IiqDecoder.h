@@ -24,16 +24,17 @@
 #include "common/Common.h"                // for uint32
 #include "common/RawImage.h"              // for RawImage
 #include "decoders/AbstractTiffDecoder.h" // for AbstractTiffDecoder
+#include "io/Buffer.h"                    // for Buffer
+#include "io/ByteStream.h"                // for ByteStream
 #include "tiff/TiffIFD.h"                 // for TiffRootIFD (ptr only)
 #include <utility>                        // for move
 #include <vector>                         // for vector
 
 namespace rawspeed {
 
-class Buffer;
-class ByteStream;
 class CameraMetaData;
-struct PhaseOneStrip;
+struct DecodePlan;
+struct PhaseOneQuadrantCurves;
 
 class IiqDecoder final : public AbstractTiffDecoder {
   struct IiqOffset {
@@ -44,9 +45,47 @@ class IiqDecoder final : public AbstractTiffDecoder {
     IiqOffset(uint32 block, uint32 offset_) : n(block), offset(offset_) {}
   };
 
-  std::vector<PhaseOneStrip> computeSripes(const Buffer& raw_data,
-                                           std::vector<IiqOffset>&& offsets,
-                                           uint32 height) const;
+  // What the entries of the Phase One directory say about the raw.
+  struct IiqHeader {
+    uint32 width = 0;
+    uint32 height = 0;
+    uint32 split_row = 0;
+    uint32 split_col = 0;
+
+    Buffer raw_data;
+    uint64 raw_data_offset = 0; // within the file
+    ByteStream block_offsets;
+    ByteStream wb;
+    ByteStream correction_meta_data;
+  };
+
+  // Also sets the black_level.
+  IiqHeader parseHeader();
+
+  // Where the bytes of a row are within the raw data.
+  struct IiqStrip {
+    uint32 offset = 0;
+    uint32 size = 0;
+  };
+
+  // Of each of the rows, in order.
+  std::vector<IiqStrip> computeSripes(uint64 rawSize,
+                                      std::vector<IiqOffset>&& offsets,
+                                      uint32 height) const;
+
+  // Checks the header, and reads the offsets of the rows.
+  std::vector<IiqStrip> getStrips(IiqHeader* h) const;
+
+  bool getQuadrantCurves(const IiqHeader& h,
+                         PhaseOneQuadrantCurves* curves) const;
+
+  // The rows of a band of the plan.
+  static constexpr uint32 IiqBandRows = 256;
+
+  DecodePlan makeDecodePlan(const IiqHeader& h,
+                            const std::vector<IiqStrip>& strips,
+                            PhaseOneQuadrantCurves&& curves,
+                            bool haveCurves) const;
 
 public:
   static bool isAppropriateDecoder(const Buffer* file);
@@ -59,14 +98,20 @@ public:
   RawImage decodeRawInternal() override;
   void checkSupportInternal(const CameraMetaData* meta) override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
 
 protected:
+  DecodePlan getDecodePlanInternal() override;
   int getDecoderVersion() const override { return 0; }
   uint32 black_level = 0;
-  void CorrectPhaseOneC(ByteStream meta_data, uint32 split_row,
-                        uint32 split_col);
-  void CorrectQuadrantMultipliersCombined(ByteStream data, uint32 split_row,
-                                          uint32 split_col);
+  // The corrections are applied by the PhaseOneDecompressor, as the curves
+  // of the quadrants. Returns false if there are none.
+  bool getPhaseOneCCorrection(ByteStream meta_data, uint32 split_row,
+                              uint32 split_col,
+                              PhaseOneQuadrantCurves* curves) const;
+  PhaseOneQuadrantCurves getQuadrantMultipliersCombined(ByteStream data,
+                                                        uint32 split_row,
+                                                        uint32 split_col) const;
 };
 
 } // namespace rawspeed
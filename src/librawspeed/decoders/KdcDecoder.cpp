@@ -56,25 +56,9 @@ RawImage KdcDecoder::decodeRawInternal() {
   if (7 != compression)
     ThrowRDE("Unsupported compression %d", compression);
 
-  TiffEntry* ifdoffset = mRootIFD->getEntryRecursive(KODAK_IFD2);
-  if (!ifdoffset)
-    ThrowRDE("Couldn't find the Kodak IFD offset");
-
-  NORangesSet<Buffer> ifds;
-
-  assert(ifdoffset != nullptr);
-  TiffRootIFD kodakifd(nullptr, &ifds, ifdoffset->getRootIfdData(),
-                       ifdoffset->getU32());
-
-  uint32 width = 0;
-  uint32 height = 0;
-  TiffEntry* ew = kodakifd.getEntryRecursive(KODAK_KDC_SENSOR_WIDTH);
-  TiffEntry* eh = kodakifd.getEntryRecursive(KODAK_KDC_SENSOR_HEIGHT);
-  if (ew && eh) {
-    width = ew->getU32();
-    height = eh->getU32();
-  } else
-    ThrowRDE("Unable to retrieve image size");
+  const iPoint2D dim = getSensorDim();
+  const uint32 width = dim.x;
+  const uint32 height = dim.y;
 
   TiffEntry *offset = mRootIFD->getEntryRecursive(KODAK_KDC_OFFSET);
   if (!offset || offset->count < 13)
@@ -90,7 +74,7 @@ RawImage KdcDecoder::decodeRawInternal() {
   if (off > mFile->getSize())
     ThrowRDE("offset is out of bounds");
 
-  mRaw->dim = iPoint2D(width, height);
+  mRaw->dim = dim;
   mRaw->createData();
 
   UncompressedDecompressor u(*mFile, off, mRaw);
@@ -100,6 +84,27 @@ RawImage KdcDecoder::decodeRawInternal() {
   return mRaw;
 }
 
+iPoint2D KdcDecoder::getSensorDim() const {
+  TiffEntry* ifdoffset = mRootIFD->getEntryRecursive(KODAK_IFD2);
+  if (!ifdoffset)
+    ThrowRDE("Couldn't find the Kodak IFD offset");
+
+  NORangesSet<Buffer> ifds;
+
+  assert(ifdoffset != nullptr);
+  TiffRootIFD kodakifd(nullptr, &ifds, ifdoffset->getRootIfdData(),
+                       ifdoffset->getU32());
+
+  TiffEntry* ew = kodakifd.getEntryRecursive(KODAK_KDC_SENSOR_WIDTH);
+  TiffEntry* eh = kodakifd.getEntryRecursive(KODAK_KDC_SENSOR_HEIGHT);
+  if (!ew || !eh)
+    ThrowRDE("Unable to retrieve image size");
+
+  return iPoint2D(ew->getU32(), eh->getU32());
+}
+
+void KdcDecoder::decodeHeaderInternal() { mRaw->dim = getSensorDim(); }
+
 void KdcDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   setMetaData(meta, "", 0);
 
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage
 #include "decoders/AbstractTiffDecoder.h" // for AbstractTiffDecoder
 #include "tiff/TiffIFD.h"                 // for TiffRootIFDOwner
@@ -42,9 +43,13 @@ public:
 
   RawImage decodeRawInternal() override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
 
 protected:
   int getDecoderVersion() const override { return 0; }
+
+  // From the Kodak IFD.
+  iPoint2D getSensorDim() const;
 };
 
 } // namespace rawspeed
@@ -35,8 +35,9 @@
 #include "tiff/TiffTag.h"                           // for TiffTag::TILEOFF...
 #include <cassert>                                  // for assert
 #include <cstring>                                  // for memchr
-#include <istream>                                  // for istringstream
+#include <istream>                                  // for istream
 #include <memory>                                   // for unique_ptr
+#include <sstream>                                  // for istringstream
 #include <string>                                   // for string, allocator
 #include <utility>                                  // for move
 
@@ -144,6 +145,14 @@ void MosDecoder::checkSupportInternal(const CameraMetaData* meta) {
   RawDecoder::checkCameraSupported(meta, make, model, "");
 }
 
+void MosDecoder::decodeHeaderInternal() {
+  const TiffIFD* raw = mRootIFD->hasEntryRecursive(TILEOFFSETS)
+                           ? mRootIFD->getIFDWithTag(TILEOFFSETS)
+                           : mRootIFD->getIFDWithTag(CFAPATTERN);
+  mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                       raw->getEntry(IMAGELENGTH)->getU32());
+}
+
 void MosDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   RawDecoder::setMetaData(meta, make, model, "", 0);
 
@@ -176,6 +176,10 @@ void MrwDecoder::checkSupportInternal(const CameraMetaData* meta) {
   this->checkCameraSupported(meta, id.make, id.model, "");
 }
 
+void MrwDecoder::decodeHeaderInternal() {
+  mRaw->dim = iPoint2D(raw_width, raw_height);
+}
+
 void MrwDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   //Default
   int iso = 0;
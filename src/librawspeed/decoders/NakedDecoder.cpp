@@ -102,6 +102,12 @@ void NakedDecoder::checkSupportInternal(const CameraMetaData* meta) {
   this->checkCameraSupported(meta, cam->make, cam->model, cam->mode);
 }
 
+void NakedDecoder::decodeHeaderInternal() {
+  parseHints();
+
+  mRaw->dim = iPoint2D(width, height);
+}
+
 void NakedDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   setMetaData(meta, cam->make, cam->model, cam->mode, 0);
 }
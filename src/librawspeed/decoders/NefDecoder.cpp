@@ -19,11 +19,16 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include "rawspeedconfig.h"
 #include "decoders/NefDecoder.h"
 #include "common/Common.h"                          // for uint32, uchar8
+#include "common/Cpuid.h"                           // for Cpuid
+#include "common/Executor.h"                        // for parallelFor
 #include "common/Point.h"                           // for iPoint2D
+#include "common/TableLookUp.h"                     // for TableLookUp
 #include "decoders/RawDecoderException.h"           // for ThrowRDE
 #include "decompressors/NikonDecompressor.h"        // for NikonDecompressor
+#include "decompressors/RowCheckpoint.h"            // for readCheckpoints, w...
 #include "decompressors/UncompressedDecompressor.h" // for UncompressedDeco...
 #include "io/BitPumpMSB.h"                          // for BitPumpMSB
 #include "io/Buffer.h"                              // for Buffer
@@ -42,9 +47,14 @@
 #include <memory>                                   // for unique_ptr, allo...
 #include <sstream>                                  // for operator<<, ostr...
 #include <string>                                   // for string, operator==
+#include <utility>                                  // for move
 #include <vector>                                   // for vector
 // IWYU pragma: no_include <ext/alloc_traits.h>
 
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128d, _mm_set_pd
+#endif
+
 using std::vector;
 using std::string;
 using std::min;
@@ -121,12 +131,67 @@ RawImage NefDecoder::decodeRawInternal() {
   ByteStream rawData(mFile, offsets->getU32(), counts->getU32());
 
   NikonDecompressor n(mRaw, meta->getData(), bitPerPixel);
+  n.pipelined = pipelined;
+  mRaw->expectInput(rawData.getRemainSize(),
+                    NikonDecompressor::MinBitsPerPixel);
   mRaw->createData();
-  n.decompress(rawData, uncorrectedRawValues);
+
+  if (!rowsPerCheckpoint && checkpoints.empty()) {
+    n.decompressRows(rawData, uncorrectedRawValues, getROIRows(mRaw->dim.y));
+    return mRaw;
+  }
+
+  if (checkpoints.empty())
+    checkpoints = n.scan(rawData, rowsPerCheckpoint);
+  // The checkpoints are of the whole image, so they can be reused.
+  n.decompress(rawData, uncorrectedRawValues, checkpoints,
+               getROIRows(mRaw->dim.y));
 
   return mRaw;
 }
 
+void NefDecoder::decodeHeaderInternal() {
+  // As decodeRawInternal() picks the layout.
+  auto raw = mRootIFD->getIFDWithTag(CFAPATTERN);
+  const int compression = raw->getEntry(COMPRESSION)->getU32();
+
+  if (mRootIFD->getEntryRecursive(MODEL)->getString() == "NIKON D100 ") {
+    const uint32 offset = raw->getEntry(STRIPOFFSETS)->getU32();
+    if (!mFile->isValid(offset))
+      ThrowRDE("Image data outside of file.");
+    if (!D100IsCompressed(offset)) {
+      // Hardcoded, as in DecodeD100Uncompressed().
+      mRaw->dim = iPoint2D(3040, 2024);
+      return;
+    }
+  }
+
+  const bool isUncompressed = compression == 1 ||
+                              hints.has("force_uncompressed") ||
+                              NEFIsUncompressed(raw);
+  const bool isSNef = !isUncompressed && NEFIsUncompressedRGB(raw);
+  if (isUncompressed || isSNef)
+    raw = getIFDWithLargestImage(CFAPATTERN);
+
+  mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                       raw->getEntry(IMAGELENGTH)->getU32());
+  if (isSNef) {
+    mRaw->setCpp(3);
+    mRaw->isCFA = false;
+  }
+}
+
+void NefDecoder::writeDecodeIndex(std::vector<uchar8>* index) const {
+  if (checkpoints.empty())
+    return;
+
+  writeCheckpoints(checkpoints, index);
+}
+
+void NefDecoder::readDecodeIndex(ByteStream* index) {
+  checkpoints = readCheckpoints(index);
+}
+
 /*
 Figure out if a NEF file is compressed.  These fancy heuristics
 are only needed for the D100, thanks to a bug in some cameras
@@ -576,10 +641,115 @@ void NefDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
 }
 
 
+namespace {
+
+// The 12-bit RGB of a pixel, in double as it always was, so that it does not
+// change with the rounding of the ever so slightly different arithmetic.
+inline void YCbCrToRGB(double y, double cb, double cr, ushort16* rgb) {
+  rgb[0] = clampBits(static_cast<int>(y + 1.370705 * cr), 12);
+  rgb[1] = clampBits(static_cast<int>(y - 0.337633 * cb - 0.698001 * cr), 12);
+  rgb[2] = clampBits(static_cast<int>(y + 1.732446 * cb), 12);
+}
+
+// The packed YCbCr of a row, 6 bytes for every two pixels, to the 12-bit RGB.
+// Returns the pixels that were done, always whole pairs of them.
+using YCbCrRowFunction = uint32 (*)(const uchar8* in, uint32 w, ushort16* out);
+
+// The chroma samples are aligned with the left pixel, so the right one gets
+// the average of them and of the next ones, except for the last pair.
+uint32 YCbCrRowToRGB_Scalar(const uchar8* in, uint32 w, ushort16* out) {
+  for (uint32 x = 0; x < w; x += 2, in += 6, out += 6) {
+    const int y1 = in[0] | ((in[1] & 0x0f) << 8);
+    const int y2 = (in[1] >> 4) | (in[2] << 4);
+    const int cb = in[3] | ((in[4] & 0x0f) << 8);
+    const int cr = (in[4] >> 4) | (in[5] << 4);
+
+    int cb2 = 2 * cb;
+    int cr2 = 2 * cr;
+    if (x + 2 < w) {
+      cb2 = cb + (in[9] | ((in[10] & 0x0f) << 8));
+      cr2 = cr + ((in[10] >> 4) | (in[11] << 4));
+    }
+
+    YCbCrToRGB(y1, cb - 2048, cr - 2048, out);
+    YCbCrToRGB(y2, cb2 * 0.5 - 2048, cr2 * 0.5 - 2048, out + 3);
+  }
+  return w;
+}
+
+#ifdef WITH_SSE2
+// Both pixels of a pair at once, one in each of the doubles. Up to the last
+// pair, which has no next chroma samples.
+uint32 YCbCrRowToRGB_SSE2(const uchar8* in, uint32 w, ushort16* out) {
+  const __m128d kRCr = _mm_set1_pd(1.370705);
+  const __m128d kGCb = _mm_set1_pd(0.337633);
+  const __m128d kGCr = _mm_set1_pd(0.698001);
+  const __m128d kBCb = _mm_set1_pd(1.732446);
+  const __m128d half = _mm_set_pd(0.5, 1.0);
+  const __m128d offset = _mm_set1_pd(2048);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi16((1 << 12) - 1);
+
+  uint32 x = 0;
+  for (; x + 2 < w; x += 2, in += 6, out += 6) {
+    const int cb = in[3] | ((in[4] & 0x0f) << 8);
+    const int cr = (in[4] >> 4) | (in[5] << 4);
+    const int cbNext = in[9] | ((in[10] & 0x0f) << 8);
+    const int crNext = (in[10] >> 4) | (in[11] << 4);
+
+    const __m128d y = _mm_set_pd((in[1] >> 4) | (in[2] << 4),
+                                 in[0] | ((in[1] & 0x0f) << 8));
+    const __m128d cbs = _mm_sub_pd(
+        _mm_mul_pd(_mm_set_pd(cb + cbNext, cb), half), offset);
+    const __m128d crs = _mm_sub_pd(
+        _mm_mul_pd(_mm_set_pd(cr + crNext, cr), half), offset);
+
+    const __m128i r =
+        _mm_cvttpd_epi32(_mm_add_pd(y, _mm_mul_pd(kRCr, crs)));
+    const __m128i g = _mm_cvttpd_epi32(_mm_sub_pd(
+        _mm_sub_pd(y, _mm_mul_pd(kGCb, cbs)), _mm_mul_pd(kGCr, crs)));
+    const __m128i b =
+        _mm_cvttpd_epi32(_mm_add_pd(y, _mm_mul_pd(kBCb, cbs)));
+
+    // R0 R1 G0 G1 B0 B1, well within 16 bits before the clamping.
+    __m128i rgb = _mm_packs_epi32(_mm_unpacklo_epi64(r, g), b);
+    rgb = _mm_min_epi16(_mm_max_epi16(rgb, zero), max);
+
+    out[0] = _mm_extract_epi16(rgb, 0);
+    out[1] = _mm_extract_epi16(rgb, 2);
+    out[2] = _mm_extract_epi16(rgb, 4);
+    out[3] = _mm_extract_epi16(rgb, 1);
+    out[4] = _mm_extract_epi16(rgb, 3);
+    out[5] = _mm_extract_epi16(rgb, 5);
+  }
+  return x;
+}
+#endif
+
+} // namespace
+
+const TableLookUp& NefDecoder::getSNefCurve() {
+  // It is a constant, and so is built only once, not for every file.
+  static const auto table = []() {
+    auto curve = gammaCurve(1 / 2.4, 12.92, 1, 4095);
+
+    // Scale output values to 16 bits.
+    for (int i = 0; i < 4096; i++) {
+      curve[i] = clampBits(static_cast<int>(curve[i]) << 2, 16);
+    }
+
+    curve.resize(4095);
+
+    auto t = std::make_unique<TableLookUp>(1, true);
+    t->setTable(0, curve);
+    return t;
+  }();
+  return *table;
+}
+
 // DecodeNikonYUY2 decodes 12 bit data in an YUY2-like pattern (2 Luma, 1 Chroma per 2 pixels).
 // We un-apply the whitebalance, so output matches lossless.
 // Note that values are scaled. See comment below on details.
-// OPTME: It would be trivial to run this multithreaded.
 void NefDecoder::DecodeNikonSNef(ByteStream* input, uint32 w, uint32 h) {
   if (w < 6)
     ThrowIOE("got a %u wide sNEF, aborting", w);
@@ -609,85 +779,44 @@ void NefDecoder::DecodeNikonSNef(ByteStream* input, uint32 w, uint32 h) {
   mRaw->metadata.wbCoeffs[1] = 1.0F;
   mRaw->metadata.wbCoeffs[2] = wb_b;
 
-  auto inv_wb_r = static_cast<int>(1024.0 / wb_r);
-  auto inv_wb_b = static_cast<int>(1024.0 / wb_b);
+  const auto inv_wb_r = static_cast<int>(1024.0 / wb_r);
+  const auto inv_wb_b = static_cast<int>(1024.0 / wb_b);
 
-  auto curve = gammaCurve(1 / 2.4, 12.92, 1, 4095);
+  const TableLookUp& curve = getSNefCurve();
 
-  // Scale output values to 16 bits.
-  for (int i = 0 ; i < 4096; i++) {
-    curve[i] = clampBits(static_cast<int>(curve[i]) << 2, 16);
-  }
-
-  curve.resize(4095);
-
-  RawImageCurveGuard curveHandler(&mRaw, curve, false);
-
-  ushort16 tmp;
-  auto* tmpch = reinterpret_cast<uchar8*>(&tmp);
+  YCbCrRowFunction convertRow = YCbCrRowToRGB_Scalar;
+#ifdef WITH_SSE2
+  if (Cpuid::SSE2())
+    convertRow = YCbCrRowToRGB_SSE2;
+#endif
 
   uchar8* data = mRaw->getData();
-  uint32 pitch = mRaw->pitch;
+  const uint32 pitch = mRaw->pitch;
   const uchar8* in = input->getData(w * h * 3);
 
-  for (uint32 y = 0; y < h; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
-    uint32 random = in[0] + (in[1] << 8) +  (in[2] << 16);
-    for (uint32 x = 0 ; x < w*3; x += 6) {
-      uint32 g1 = in[0];
-      uint32 g2 = in[1];
-      uint32 g3 = in[2];
-      uint32 g4 = in[3];
-      uint32 g5 = in[4];
-      uint32 g6 = in[5];
-
-      in+=6;
-      auto y1 = static_cast<float>(g1 | ((g2 & 0x0f) << 8));
-      auto y2 = static_cast<float>((g2 >> 4) | (g3 << 4));
-      auto cb = static_cast<float>(g4 | ((g5 & 0x0f) << 8));
-      auto cr = static_cast<float>((g5 >> 4) | (g6 << 4));
-
-      float cb2 = cb;
-      float cr2 = cr;
-      // Interpolate right pixel. We assume the sample is aligned with left pixel.
-      if ((x+6) < w*3) {
-        g4 = in[3];
-        g5 = in[4];
-        g6 = in[5];
-        cb2 = (static_cast<float>((g4 | ((g5 & 0x0f) << 8))) + cb) * 0.5F;
-        cr2 = (static_cast<float>(((g5 >> 4) | (g6 << 4))) + cr) * 0.5F;
-      }
-
-      cb -= 2048;
-      cr -= 2048;
-      cb2 -= 2048;
-      cr2 -= 2048;
+  // The dithering starts anew with every row, so they are independent.
+  parallelFor(0, h, [&](int y) {
+    if (mRaw->isCancelled())
+      return;
 
-      mRaw->setWithLookUp(clampBits(static_cast<int>(y1 + 1.370705 * cr), 12),
-                          tmpch, &random);
-      dest[x] = clampBits((inv_wb_r * tmp + (1<<9)) >> 10, 15);
-
-      mRaw->setWithLookUp(
-          clampBits(static_cast<int>(y1 - 0.337633 * cb - 0.698001 * cr), 12),
-          reinterpret_cast<uchar8*>(&dest[x + 1]), &random);
-
-      mRaw->setWithLookUp(clampBits(static_cast<int>(y1 + 1.732446 * cb), 12),
-                          tmpch, &random);
-      dest[x+2]   = clampBits((inv_wb_b * tmp + (1<<9)) >> 10, 15);
-
-      mRaw->setWithLookUp(clampBits(static_cast<int>(y2 + 1.370705 * cr2), 12),
-                          tmpch, &random);
-      dest[x+3] = clampBits((inv_wb_r * tmp + (1<<9)) >> 10, 15);
-
-      mRaw->setWithLookUp(
-          clampBits(static_cast<int>(y2 - 0.337633 * cb2 - 0.698001 * cr2), 12),
-          reinterpret_cast<uchar8*>(&dest[x + 4]), &random);
+    const uchar8* row = &in[y * w * 3];
+    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
 
-      mRaw->setWithLookUp(clampBits(static_cast<int>(y2 + 1.732446 * cb2), 12),
-                          tmpch, &random);
-      dest[x+5] = clampBits((inv_wb_b * tmp + (1<<9)) >> 10, 15);
+    // First the 12-bit RGB, right into the image.
+    const uint32 done = convertRow(row, w, dest);
+    YCbCrRowToRGB_Scalar(row + 3 * done, w - done, dest + 3 * done);
+
+    // And then the curve, and the whitebalance.
+    uint32 random = row[0] + (row[1] << 8) + (row[2] << 16);
+    for (uint32 x = 0; x < w * 3; x += 3) {
+      const int r = curve.lookUpDithered(dest[x], &random);
+      dest[x] = clampBits((inv_wb_r * r + (1 << 9)) >> 10, 15);
+      dest[x + 1] = curve.lookUpDithered(dest[x + 1], &random);
+      const int b = curve.lookUpDithered(dest[x + 2], &random);
+      dest[x + 2] = clampBits((inv_wb_b * b + (1 << 9)) >> 10, 15);
     }
-  }
+  });
+  mRaw->checkCancelled();
 }
 
 // From:  dcraw.c -- Dave Coffin's raw photo decoder
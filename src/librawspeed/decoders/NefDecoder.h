@@ -20,15 +20,16 @@
 
 #pragma once
 
-#include "common/Common.h"                // for uint32, ushort16
-#include "common/RawImage.h"              // for RawImage
-#include "decoders/AbstractTiffDecoder.h" // for AbstractTiffDecoder
-#include "decoders/RawDecoder.h"          // for RawDecoder::RawSlice
-#include "tiff/TiffIFD.h"                 // for TiffIFD (ptr only), TiffRo...
-#include <array>                          // for array
-#include <string>                         // for string
-#include <utility>                        // for move
-#include <vector>                         // for vector
+#include "common/Common.h"                   // for uint32, ushort16
+#include "common/RawImage.h"                 // for RawImage
+#include "decoders/AbstractTiffDecoder.h"    // for AbstractTiffDecoder
+#include "decoders/RawDecoder.h"             // for RawDecoder::RawSlice
+#include "decompressors/NikonDecompressor.h" // for NikonDecompressor::Chec...
+#include "tiff/TiffIFD.h"                    // for TiffIFD (ptr only), TiffR...
+#include <array>                             // for array
+#include <string>                            // for string
+#include <utility>                           // for move
+#include <vector>                            // for vector
 
 namespace rawspeed {
 
@@ -36,6 +37,7 @@ class ByteStream;
 class CameraMetaData;
 class iPoint2D;
 class Buffer;
+class TableLookUp;
 
 class NefDecoder final : public AbstractTiffDecoder
 {
@@ -45,13 +47,37 @@ public:
   NefDecoder(TiffRootIFDOwner&& root, const Buffer* file)
       : AbstractTiffDecoder(move(root), file) {}
 
+  // Builds the fixed curve of the sNEFs now, rather than for the first one,
+  // see prewarm().
+  static void prewarm() { getSNefCurve(); }
+
   RawImage decodeRawInternal() override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
   void checkSupportInternal(const CameraMetaData* meta) override;
 
+  // If non-zero, the compressed raws are decoded in two passes: a serial
+  // scan that records a checkpoint every rowsPerCheckpoint rows, and then
+  // the parallel decoding of the bands of rows in between the checkpoints.
+  int rowsPerCheckpoint = 0;
+
+  // Otherwise, if set, the Huffman decoding and the reconstruction of the
+  // pixels of the compressed raws overlap, on two threads, see
+  // NikonDecompressor::pipelined. There is no scan then, but it only keeps
+  // two of the cores busy.
+  bool pipelined = false;
+
+  // The checkpoints of the last two-pass decode. When decoding the same
+  // file again, they can be kept, and then the scan is skipped.
+  std::vector<NikonDecompressor::Checkpoint> checkpoints;
+
 protected:
   struct NefSlice final : RawSlice {};
 
+  // The checkpoints, so that the scan can be skipped in another process.
+  void writeDecodeIndex(std::vector<uchar8>* index) const override;
+  void readDecodeIndex(ByteStream* index) override;
+
 private:
   int getDecoderVersion() const override { return 5; }
   bool D100IsCompressed(uint32 offset);
@@ -65,7 +91,10 @@ private:
   void DecodeNikonSNef(ByteStream* input, uint32 w, uint32 h);
   std::string getMode();
   std::string getExtendedMode(const std::string &mode);
-  std::vector<ushort16> gammaCurve(double pwr, double ts, int mode, int imax);
+  static std::vector<ushort16> gammaCurve(double pwr, double ts, int mode,
+                                          int imax);
+  // The gamma curve of the sNEF, scaled to 16 bits, with the dithering.
+  static const TableLookUp& getSNefCurve();
 
   // We use this for the D50 and D2X whacky WB "encryption"
   static const std::array<uchar8, 256> serialmap;
@@ -125,7 +125,7 @@ RawImage OrfDecoder::decodeRawInternal() {
 
   OlympusDecompressor o(mRaw);
   mRaw->createData();
-  o.decompress(std::move(input));
+  o.decompress(std::move(input), getROIRows(mRaw->dim.y));
 
   return mRaw;
 }
@@ -210,6 +210,12 @@ void OrfDecoder::parseCFA() {
   }
 }
 
+void OrfDecoder::decodeHeaderInternal() {
+  auto raw = mRootIFD->getIFDWithTag(STRIPOFFSETS);
+  mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                       raw->getEntry(IMAGELENGTH)->getU32());
+}
+
 void OrfDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   int iso = 0;
 
@@ -21,6 +21,7 @@
 
 #include "decoders/PefDecoder.h"
 #include "common/Common.h"                    // for uint32, BitOrder_MSB
+#include "common/Executor.h"                  // for getExecutor, Executor
 #include "common/Point.h"                     // for iPoint2D
 #include "decoders/RawDecoderException.h"     // for ThrowRDE
 #include "decompressors/PentaxDecompressor.h" // for PentaxDecompressor
@@ -90,12 +91,25 @@ RawImage PefDecoder::decodeRawInternal() {
   }
 
   PentaxDecompressor p(mRaw, metaData);
+  mRaw->expectInput(bs.getRemainSize(), PentaxDecompressor::MinBitsPerPixel);
   mRaw->createData();
-  p.decompress(bs);
+
+  if (!rowsPerCheckpoint || getExecutor()->getConcurrency() < 2) {
+    p.decompress(bs);
+    return mRaw;
+  }
+
+  p.decompress(bs, p.scan(bs, rowsPerCheckpoint));
 
   return mRaw;
 }
 
+void PefDecoder::decodeHeaderInternal() {
+  auto raw = mRootIFD->getIFDWithTag(STRIPOFFSETS);
+  mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                       raw->getEntry(IMAGELENGTH)->getU32());
+}
+
 void PefDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   int iso = 0;
   mRaw->cfa.setCFA(iPoint2D(2,2), CFA_RED, CFA_GREEN, CFA_GREEN, CFA_BLUE);
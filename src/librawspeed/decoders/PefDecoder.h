@@ -40,6 +40,13 @@ public:
 
   RawImage decodeRawInternal() override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
+
+  // If non-zero, and there is more than one thread to decode with, the
+  // compressed raws are decoded in two passes: a serial scan that records
+  // a checkpoint every rowsPerCheckpoint rows, and then the parallel
+  // decoding of the bands of rows in between the checkpoints.
+  int rowsPerCheckpoint = 64;
 
 protected:
   int getDecoderVersion() const override { return 3; }
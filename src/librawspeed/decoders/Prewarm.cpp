@@ -0,0 +1,72 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/Prewarm.h"
+#include "common/Executor.h"                    // for getExecutor, Executor
+#include "common/Trace.h"                       // for RAWSPEED_TRACE_SCOPE
+#include "decoders/NefDecoder.h"                // for NefDecoder
+#include "decompressors/NikonDecompressor.h"    // for NikonDecompressor
+#include "decompressors/OlympusDecompressor.h"  // for OlympusDecompressor
+#include "decompressors/PentaxDecompressor.h"   // for PentaxDecompressor
+#include "decompressors/PhaseOneDecompressor.h" // for PhaseOneDecompressor
+#include "metadata/CameraMetaData.h"            // for CameraMetaData
+#include <cstring>                              // for memset
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+void prewarm(const PrewarmOptions& options) {
+  RAWSPEED_TRACE_SCOPE("prewarm", "prewarm");
+
+  if (options.executor) {
+    // The default one is created by the first call, and the threads of the
+    // OpenMP one by the first parallel region.
+    const auto executor = getExecutor();
+    executor->run(executor->getConcurrency(), [](int /*taskIndex*/) {});
+  }
+
+  if (options.tables) {
+    NefDecoder::prewarm();
+    NikonDecompressor::prewarm();
+    OlympusDecompressor::prewarm();
+    PentaxDecompressor::prewarm();
+    PhaseOneDecompressor::prewarm();
+  }
+
+  if (options.meta)
+    options.meta->materializeAll();
+
+  if (options.frames > 0) {
+    std::vector<RawImage> frames;
+    frames.reserve(options.frames);
+    for (int i = 0; i < options.frames; i++) {
+      RawImage img = RawImage::create(options.frameType);
+      img->dim = options.frameDim;
+      img->setCpp(options.frameCpp);
+      img->allocator = options.imageAllocator;
+      img->createData();
+      memset(img->getDataUncropped(0, 0), 0,
+             static_cast<size_t>(img->pitch) * img->getUncroppedDim().y);
+      frames.emplace_back(img);
+    }
+  }
+}
+
+} // namespace rawspeed
@@ -0,0 +1,65 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"   // for uint32
+#include "common/Point.h"    // for iPoint2D
+#include "common/RawImage.h" // for RawImageType, TYPE_USHORT16
+#include <memory>            // for shared_ptr
+
+namespace rawspeed {
+
+class CameraMetaData;
+
+class ImageAllocator;
+
+// What prewarm() gets ready.
+struct PrewarmOptions {
+  // Starts all of the threads of the current executor, see getExecutor().
+  bool executor = true;
+
+  // Builds the fixed tables of the decoders, e.g. the Huffman tables of the
+  // NEFs, that the first file of each kind would build otherwise.
+  bool tables = true;
+
+  // If set, all of its cameras are decoded, as their first lookups would
+  // otherwise, see CameraMetaData::materializeAll().
+  const CameraMetaData* meta = nullptr;
+
+  // If set, this many images of the frame dimensions are allocated from it,
+  // all at once, and written to, so that their pages are faulted in, and
+  // then released. It is meant to be a PooledImageAllocator, e.g. the one
+  // of a DecoderSession, large enough to keep all of them for the first
+  // decodes of the images of those dimensions.
+  std::shared_ptr<ImageAllocator> imageAllocator;
+  int frames = 0;
+  iPoint2D frameDim;
+  RawImageType frameType = TYPE_USHORT16;
+  uint32 frameCpp = 1;
+};
+
+// Does now what the first decode in the process would otherwise do lazily,
+// so that it runs at the speed of the later ones, e.g. when a service starts,
+// before it takes any requests. It may be called from any thread, and more
+// than once, e.g. with the frames of other dimensions.
+void prewarm(const PrewarmOptions& options = PrewarmOptions());
+
+} // namespace rawspeed
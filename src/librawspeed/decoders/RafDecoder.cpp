@@ -21,6 +21,7 @@
 
 #include "decoders/RafDecoder.h"
 #include "common/Common.h"                          // for uint32, ushort16
+#include "common/FujiRotation.h"                    // for FujiRotation
 #include "common/Point.h"                           // for iPoint2D, iRecta...
 #include "decoders/RawDecoderException.h"           // for ThrowRDE
 #include "decompressors/FujiDecompressor.h"         // for FujiDecompressor
@@ -188,6 +189,36 @@ void RafDecoder::checkSupportInternal(const CameraMetaData* meta) {
   }
 }
 
+void RafDecoder::decodeHeaderInternal() {
+  auto raw = mRootIFD->getIFDWithTag(FUJI_STRIPOFFSETS);
+  uint32 height = 0;
+  uint32 width = 0;
+
+  if (raw->hasEntry(FUJI_RAWIMAGEFULLHEIGHT)) {
+    height = raw->getEntry(FUJI_RAWIMAGEFULLHEIGHT)->getU32();
+    width = raw->getEntry(FUJI_RAWIMAGEFULLWIDTH)->getU32();
+  } else if (raw->hasEntry(IMAGEWIDTH)) {
+    TiffEntry *e = raw->getEntry(IMAGEWIDTH);
+    height = e->getU16(0);
+    width = e->getU16(1);
+  } else
+    ThrowRDE("Unable to locate image size");
+
+  if (raw->hasEntry(FUJI_LAYOUT)) {
+    TiffEntry *e = raw->getEntry(FUJI_LAYOUT);
+    alt_layout = !(e->getByte(0) >> 7);
+  }
+
+  if (isCompressed()) {
+    mRaw->metadata.mode = "compressed";
+    mRaw->dim = iPoint2D(width, height);
+    return;
+  }
+
+  const bool double_width = hints.has("double_width_unpacked");
+  mRaw->dim = iPoint2D(double_width ? 2U * width : width, height);
+}
+
 void RafDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   int iso = 0;
   if (mRootIFD->hasEntryRecursive(ISOSPEEDRATINGS))
@@ -222,49 +253,25 @@ void RafDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   bool rotate = hints.has("fuji_rotate");
   rotate = rotate && fujiRotate;
 
-  // Rotate 45 degrees - could be multithreaded.
+  // Rotate 45 degrees.
   if (rotate && !this->uncorrectedRawValues) {
-    // Calculate the 45 degree rotated size;
-    uint32 rotatedsize;
-    uint32 rotationPos;
-    if (alt_layout) {
-      rotatedsize = new_size.y+new_size.x/2;
-      rotationPos = new_size.x/2 - 1;
-    }
-    else {
-      rotatedsize = new_size.x+new_size.y/2;
-      rotationPos = new_size.x - 1;
-    }
+    const FujiRotation rotation(new_size, alt_layout);
 
-    iPoint2D final_size(rotatedsize, rotatedsize-1);
-    RawImage rotated = RawImage::create(final_size, TYPE_USHORT16, 1);
-    rotated->clearArea(iRectangle2D(iPoint2D(0,0), rotated->dim));
-    rotated->metadata = mRaw->metadata;
-    rotated->metadata.fujiRotationPos = rotationPos;
-
-    int dest_pitch = static_cast<int>(rotated->pitch) / 2;
-    auto* dst = reinterpret_cast<ushort16*>(rotated->getData(0, 0));
-
-    for (int y = 0; y < new_size.y; y++) {
-      auto* src = reinterpret_cast<ushort16*>(
-          mRaw->getData(crop_offset.x, crop_offset.y + y));
-      for (int x = 0; x < new_size.x; x++) {
-        int h;
-        int w;
-        if (alt_layout) { // Swapped x and y
-          h = rotatedsize - (new_size.y + 1 - y + (x >> 1));
-          w = ((x+1) >> 1) + y;
-        } else {
-          h = new_size.x - 1 - x + (y >> 1);
-          w = ((y+1) >> 1) + x;
-        }
-        if (h < rotated->dim.y && w < rotated->dim.x)
-          dst[w + h * dest_pitch] = src[x];
-        else
-          ThrowRDE("Trying to write out of bounds");
-      }
+    // Without the pixels, there is only the rotation to describe.
+    if (deferFujiRotation || !mRaw->isAllocated()) {
+      mRaw->subFrame(iRectangle2D(crop_offset, new_size));
+      mRaw->metadata.fujiRotationPos = rotation.rotationPos;
+      mRaw->metadata.fujiRotation = rotation;
+    } else {
+      RawImage rotated =
+          RawImage::create(rotation.rotatedSize, TYPE_USHORT16, 1);
+      rotated->metadata = mRaw->metadata;
+      rotated->metadata.fujiRotationPos = rotation.rotationPos;
+
+      // Every pixel is written, the ones outside of the image with 0.
+      rotation.rotate(mRaw, crop_offset, rotated);
+      mRaw = rotated;
     }
-    mRaw = rotated;
   } else if (applyCrop) {
     mRaw->subFrame(iRectangle2D(crop_offset, new_size));
   }
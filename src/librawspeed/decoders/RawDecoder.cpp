@@ -21,10 +21,17 @@
 
 #include "decoders/RawDecoder.h"
 #include "common/Common.h"                          // for uint32, roundUpD...
+#include "common/Executor.h"                        // for ExecutorScope, get...
+#include "common/ImageAllocator.h"                  // for BudgetImageAllocator
+#include "common/InternedString.h"                  // for InternedString
 #include "common/Point.h"                           // for iPoint2D, iRecta...
+#include "common/Trace.h"                           // for RAWSPEED_TRACE_SCOPE
+#include "decoders/DecodePlan.h"                    // for DecodePlan
 #include "decoders/RawDecoderException.h"           // for ThrowRDE
 #include "decompressors/UncompressedDecompressor.h" // for UncompressedDeco...
-#include "io/Buffer.h"                              // for Buffer
+#include "io/Buffer.h"                              // for Buffer, DataBuffer
+#include "io/ByteStream.h"                          // for ByteStream
+#include "io/Endianness.h"                          // for Endianness
 #include "io/FileIOException.h"                     // for FileIOException
 #include "io/IOException.h"                         // for IOException
 #include "metadata/BlackArea.h"                     // for BlackArea
@@ -36,9 +43,16 @@
 #include "tiff/TiffEntry.h"                         // for TiffEntry
 #include "tiff/TiffIFD.h"                           // for TiffIFD
 #include "tiff/TiffTag.h"                           // for BITSPERSAMPLE
+#include <algorithm>                                // for min
 #include <array>                                    // for array
 #include <cassert>                                  // for assert
+#include <cstdlib>                                  // for free
+#include <cstring>                                  // for memcpy
+#include <cxxabi.h>                                 // for __cxa_demangle
+#include <limits>                                   // for numeric_limits
+#include <memory>                                   // for unique_ptr
 #include <string>                                   // for string, basic_st...
+#include <typeinfo>                                 // for type_info
 #include <vector>                                   // for vector
 
 using std::vector;
@@ -127,9 +141,15 @@ void RawDecoder::decodeUncompressed(const TiffIFD *rawIFD, BitOrder order) {
 
   offY = 0;
   for (const RawSlice& slice : slices) {
-    UncompressedDecompressor u(*mFile, slice.offset, slice.count, mRaw);
     iPoint2D size(width, slice.h);
     iPoint2D pos(0, offY);
+    if (!isInROI({pos, size})) {
+      mRaw->clearArea({pos, size});
+      offY += slice.h;
+      continue;
+    }
+
+    UncompressedDecompressor u(*mFile, slice.offset, slice.count, mRaw);
     bitPerPixel = static_cast<int>(
         static_cast<uint64>(static_cast<uint64>(slice.count) * 8U) /
         (slice.h * width));
@@ -155,12 +175,23 @@ void RawDecoder::askForSamples(const CameraMetaData* meta, const string& make,
            make.c_str(), model.c_str(), mode.c_str());
 }
 
+namespace {
+
+// Usually the one of the Camera, which then is not looked up in the pool.
+InternedString internedAs(const InternedString& known, const string& str) {
+  return known == str ? known : InternedString(str);
+}
+
+} // namespace
+
 bool RawDecoder::checkCameraSupported(const CameraMetaData* meta,
                                       const string& make, const string& model,
                                       const string& mode) {
-  mRaw->metadata.make = make;
-  mRaw->metadata.model = model;
   const Camera* cam = meta->getCamera(make, model, mode);
+  mRaw->metadata.make =
+      cam ? internedAs(cam->make, make) : InternedString(make);
+  mRaw->metadata.model =
+      cam ? internedAs(cam->model, model) : InternedString(model);
   if (!cam) {
     askForSamples(meta, make, model, mode);
 
@@ -204,9 +235,9 @@ void RawDecoder::setMetaData(const CameraMetaData* meta, const string& make,
   mRaw->metadata.canonical_model = cam->canonical_model;
   mRaw->metadata.canonical_alias = cam->canonical_alias;
   mRaw->metadata.canonical_id = cam->canonical_id;
-  mRaw->metadata.make = make;
-  mRaw->metadata.model = model;
-  mRaw->metadata.mode = mode;
+  mRaw->metadata.make = internedAs(cam->make, make);
+  mRaw->metadata.model = internedAs(cam->model, model);
+  mRaw->metadata.mode = internedAs(cam->mode, mode);
 
   if (applyCrop) {
     iPoint2D new_size = cam->cropSize;
@@ -255,18 +286,104 @@ void RawDecoder::setMetaData(const CameraMetaData* meta, const string& make,
   }
 }
 
+namespace {
+
+// Of the decoder, or else of the calling thread.
+Priority getPriorityOf(const Optional<Priority>& priority) {
+  return priority.hasValue() ? priority.getValue() : getPriority();
+}
+
+// Of the most derived class, without the namespace.
+std::string getClassName(const RawDecoder& decoder) {
+  const char* const mangled = typeid(decoder).name();
+  int status = 0;
+  const std::unique_ptr<char, decltype(&free)> demangled(
+      abi::__cxa_demangle(mangled, nullptr, nullptr, &status), &free);
+  std::string name = status == 0 ? demangled.get() : mangled;
+
+  const std::string prefix = "rawspeed::";
+  if (name.compare(0, prefix.size(), prefix) == 0)
+    name.erase(0, prefix.size());
+  return name;
+}
+
+} // namespace
+
 rawspeed::RawImage RawDecoder::decodeRaw() {
+  if (decodedHeaderOnly)
+    ThrowRDE("The metadata was decoded without the raw, take a new decoder.");
+
   try {
+    RAWSPEED_TRACE_SCOPE("decoder", "decodeRaw");
+    const ExecutorScope executorScope(executor);
+    const PriorityScope priorityScope(getPriorityOf(priority));
+    StageTimer timer(this, STAGE_DECODE);
+
+    // Only while decoding, they are of this call.
+    RawImageData::DecodeCounters counters;
+    std::shared_ptr<BudgetImageAllocator> measured;
+    // The decoders may replace the mRaw.
+    struct CountersGuard final {
+      const RawImage original;
+      const RawImage* const current;
+      ~CountersGuard() {
+        original->decodeCounters = nullptr;
+        (*current)->decodeCounters = nullptr;
+      }
+    } countersGuard{mRaw, &mRaw};
+    if (stats) {
+      mRaw->decodeCounters = &counters;
+      measured = std::make_shared<BudgetImageAllocator>(
+          0, imageAllocator ? imageAllocator : getImageAllocator());
+    }
+
+    mRaw->areaReady = areaReady;
+    mRaw->externalData = externalData;
+    mRaw->allocator = measured ? measured : imageAllocator;
+    mRaw->scratch = scratchArena;
+    mRaw->maxPixels = maxPixels;
+    mRaw->maxBytes = maxImageBytes;
+    mRaw->cancellation = cancellation;
+    if (!uncorrectedRawValues)
+      mRaw->scaleOnWrite = scaleOnWrite;
+    mRaw->checkCancelled();
     RawImage raw = decodeRawInternal();
+    raw->checkCancelled();
     raw->checkMemIsInitialized();
+    raw->finishScaleOnWrite();
 
     raw->metadata.pixelAspectRatio =
         hints.get("pixel_aspect_ratio", raw->metadata.pixelAspectRatio);
-    if (interpolateBadPixels) {
-      raw->fixBadPixels();
+    if (interpolateBadPixels || contentStats || pyramid) {
+      RAWSPEED_TRACE_SCOPE("decoder", "fixBadPixels");
+      StageTimer postProcess(this, STAGE_POST_PROCESS);
+      struct ByProductsGuard final {
+        RawImageData* const img;
+        ~ByProductsGuard() {
+          img->contentStats = nullptr;
+          img->pyramid = nullptr;
+        }
+      } byProductsGuard{raw.get()};
+      raw->contentStats = contentStats;
+      raw->pyramid = pyramid;
+      raw->postProcess(interpolateBadPixels ? RawImageData::STAGE_FIX_BAD_PIXELS
+                                            : 0);
       raw->checkMemIsInitialized();
     }
 
+    if (stats) {
+      stats->decoder = getClassName(*this);
+      stats->fileBytes = mFile->getSize();
+      stats->imageBytes =
+          static_cast<uint64>(raw->getUncroppedDim().area()) * raw->getBpp();
+      stats->threads = getExecutor()->getConcurrency();
+      stats->areas = counters.areas;
+      stats->huffmanTables = counters.huffmanTables;
+      stats->huffmanTablesBuilt = counters.huffmanTablesBuilt;
+      stats->allocations = measured->getNumAllocations();
+      stats->peakAllocatedBytes = measured->getPeakBytes();
+    }
+
     return raw;
   } catch (TiffParserException &e) {
     ThrowRDE("%s", e.what());
@@ -277,9 +394,234 @@ rawspeed::RawImage RawDecoder::decodeRaw() {
   }
 }
 
+rawspeed::RawImage RawDecoder::decodeRaw(const iRectangle2D& roi) {
+  if (!roi.hasPositiveArea())
+    ThrowRDE("Empty region of interest (%i, %i, %i, %i).", roi.pos.x,
+             roi.pos.y, roi.dim.x, roi.dim.y);
+
+  mROI = roi;
+  try {
+    RawImage raw = decodeRaw();
+    mROI = {};
+    return raw;
+  } catch (...) {
+    mROI = {};
+    throw;
+  }
+}
+
+rawspeed::RawImage
+RawDecoder::decodeRaw(const std::vector<RawImage>& tiles) {
+  mPlanTiles = &tiles;
+  try {
+    RawImage raw = decodeRaw();
+    mPlanTiles = nullptr;
+    return raw;
+  } catch (...) {
+    mPlanTiles = nullptr;
+    throw;
+  }
+}
+
+DecodePlan RawDecoder::getDecodePlan() {
+  try {
+    RAWSPEED_TRACE_SCOPE("decoder", "getDecodePlan");
+    return getDecodePlanInternal();
+  } catch (TiffParserException& e) {
+    ThrowRDE("%s", e.what());
+  } catch (FileIOException& e) {
+    ThrowRDE("%s", e.what());
+  } catch (IOException& e) {
+    ThrowRDE("%s", e.what());
+  }
+}
+
+DecodePlan RawDecoder::getDecodePlanInternal() {
+  ThrowRDE("The format has no decode plan.");
+}
+
+rawspeed::RawImage RawDecoder::decodeRawRows(int rows) {
+  return decodeRaw({0, 0, std::numeric_limits<int>::max(), rows});
+}
+
+std::vector<RawImage> RawDecoder::decodeFrames(const std::vector<int>& frames,
+                                               const CameraMetaData* meta) {
+  const ExecutorScope executorScope(executor);
+  const PriorityScope priorityScope(getPriorityOf(priority));
+
+  // This also parses all of the MakerNotes, so the tree is only read from
+  // by the frames.
+  const int numFrames = getNumFrames();
+  for (int frame : frames) {
+    if (frame < 0 || frame >= numFrames)
+      ThrowRDE("Frame %i requested, but there are %i.", frame, numFrames);
+  }
+
+  if (numFrames == 1) {
+    if (frames.size() > 1)
+      ThrowRDE("A single frame can only be decoded once.");
+    std::vector<RawImage> images;
+    if (!frames.empty()) {
+      images.emplace_back(decodeRaw());
+      decodeMetaData(meta);
+    }
+    return images;
+  }
+
+  std::vector<std::unique_ptr<RawDecoder>> decoders;
+  for (int frame : frames) {
+    decoders.emplace_back(getFrameDecoder(frame));
+    decoders.back()->areaReady = nullptr;
+    decoders.back()->externalData = {};
+    decoders.back()->stageTimes = nullptr;
+    decoders.back()->stats = nullptr;
+  }
+
+  parallelForEach(0, static_cast<int>(decoders.size()),
+                  [&decoders, meta](int i) {
+                    decoders[i]->decodeRaw();
+                    decoders[i]->decodeMetaData(meta);
+                  });
+
+  std::vector<RawImage> images;
+  for (const auto& decoder : decoders)
+    images.emplace_back(decoder->mRaw);
+  return images;
+}
+
+std::unique_ptr<RawDecoder> RawDecoder::getFrameDecoder(int frame) const {
+  ThrowRDE("Frame %i requested, but the format only has one.", frame);
+}
+
+namespace {
+
+// "RSDI", and the version of the layout of the index itself.
+constexpr uint32 DecodeIndexMagic = 0x49445352;
+constexpr uint32 DecodeIndexFormat = 1;
+
+// The file is hashed in chunks of this size, in parallel, and then the
+// hashes of the chunks, in order. So it does not depend on the concurrency.
+constexpr Buffer::size_type HashChunkSize = 1U << 20U;
+
+uint64 hashBytes(const uchar8* data, Buffer::size_type size, uint64 seed) {
+  constexpr uint64 prime1 = 0x9E3779B185EBCA87ULL;
+  constexpr uint64 prime2 = 0xC2B2AE3D27D4EB4FULL;
+  uint64 h = seed ^ (size * prime1);
+  const auto round = [&h](uint64 v) {
+    h ^= v * prime2;
+    h = ((h << 31U) | (h >> 33U)) * prime1;
+  };
+
+  Buffer::size_type i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64 v;
+    memcpy(&v, data + i, sizeof(v));
+    round(v);
+  }
+  for (; i < size; i++)
+    round(data[i]);
+
+  // The finalizer of MurmurHash3.
+  h ^= h >> 33U;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33U;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33U;
+  return h;
+}
+
+uint64 hashFile(const Buffer& file) {
+  const Buffer::size_type size = file.getSize();
+  const auto numChunks =
+      static_cast<int>((size + HashChunkSize - 1) / HashChunkSize);
+  std::vector<uint64> hashes(numChunks);
+  parallelFor(0, numChunks, [&file, &hashes, size](int chunk) {
+    const Buffer::size_type offset = chunk * HashChunkSize;
+    const Buffer::size_type count = std::min(HashChunkSize, size - offset);
+    hashes[chunk] = hashBytes(file.getData(offset, count), count, chunk);
+  });
+  return hashBytes(reinterpret_cast<const uchar8*>(hashes.data()),
+                   hashes.size() * sizeof(uint64), size);
+}
+
+} // namespace
+
+std::vector<uchar8> RawDecoder::getDecodeIndex() {
+  std::vector<uchar8> payload;
+  writeDecodeIndex(&payload);
+  if (payload.empty())
+    return {};
+
+  std::vector<uchar8> index;
+  putDecodeIndexValue(&index, DecodeIndexMagic, 4);
+  putDecodeIndexValue(&index, DecodeIndexFormat, 4);
+  putDecodeIndexValue(&index, getDecoderVersion(), 4);
+  putDecodeIndexValue(&index, mFile->getSize(), 8);
+  putDecodeIndexValue(&index, hashFile(*mFile), 8);
+  putDecodeIndexValue(&index, hashBytes(payload.data(), payload.size(), 0), 8);
+  putDecodeIndexValue(&index, payload.size(), 4);
+  index.insert(index.end(), payload.begin(), payload.end());
+  return index;
+}
+
+bool RawDecoder::setDecodeIndex(const Buffer& index) {
+  try {
+    ByteStream bs(DataBuffer(index, Endianness::little));
+    if (bs.getU32() != DecodeIndexMagic)
+      ThrowRDE("Not a decode index.");
+    if (bs.getU32() != DecodeIndexFormat)
+      return false;
+    if (bs.getU32() != static_cast<uint32>(getDecoderVersion()))
+      return false;
+    if (bs.get<uint64>() != mFile->getSize())
+      return false;
+    const auto fileHash = bs.get<uint64>();
+    const auto payloadHash = bs.get<uint64>();
+    ByteStream payload = bs.getStream(bs.getU32());
+    if (bs.getRemainSize() ||
+        payloadHash != hashBytes(payload.peekData(payload.getRemainSize()),
+                                 payload.getRemainSize(), 0))
+      ThrowRDE("The decode index is corrupt.");
+    if (fileHash != hashFile(*mFile))
+      return false;
+
+    readDecodeIndex(&payload);
+    if (payload.getRemainSize())
+      ThrowRDE("%u bytes of the decode index left over.",
+               static_cast<uint32>(payload.getRemainSize()));
+    return true;
+  } catch (IOException& e) {
+    ThrowRDE("%s", e.what());
+  }
+}
+
+void RawDecoder::writeDecodeIndex(std::vector<uchar8>* index) const {}
+
+void RawDecoder::readDecodeIndex(ByteStream* index) {}
+
+void RawDecoder::putDecodeIndexValue(std::vector<uchar8>* index, uint64 value,
+                                     int bytes) {
+  for (int i = 0; i < bytes; i++)
+    index->emplace_back(static_cast<uchar8>(value >> (8 * i)));
+}
+
+Buffer
+RawDecoder::getEmbeddedPreviewData(const EmbeddedPreview& preview) const {
+  return mFile->getSubView(preview.offset, preview.length);
+}
+
 void RawDecoder::decodeMetaData(const CameraMetaData* meta) {
   try {
+    RAWSPEED_TRACE_SCOPE("decoder", "decodeMetaData");
+    const ExecutorScope executorScope(executor);
+    const PriorityScope priorityScope(getPriorityOf(priority));
+    StageTimer timer(this, STAGE_METADATA);
+    if (!mRaw->isAllocated()) {
+      decodeHeaderInternal();
+      decodedHeaderOnly = true;
+    }
     decodeMetaDataInternal(meta);
+    mRaw->finishScaleOnWrite();
   } catch (TiffParserException &e) {
     ThrowRDE("%s", e.what());
   } catch (FileIOException &e) {
@@ -291,6 +633,10 @@ void RawDecoder::decodeMetaData(const CameraMetaData* meta) {
 
 void RawDecoder::checkSupport(const CameraMetaData* meta) {
   try {
+    RAWSPEED_TRACE_SCOPE("decoder", "checkSupport");
+    const ExecutorScope executorScope(executor);
+    const PriorityScope priorityScope(getPriorityOf(priority));
+    StageTimer timer(this, STAGE_CHECK_SUPPORT);
     checkSupportInternal(meta);
   } catch (TiffParserException &e) {
     ThrowRDE("%s", e.what());
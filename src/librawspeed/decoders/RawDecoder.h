@@ -21,17 +21,37 @@
 
 #pragma once
 
-#include "common/Common.h"   // for uint32, BitOrder
+#include "common/Common.h"   // for uint32, uint64, uchar8, BitOrder
+#include "common/Optional.h" // for Optional
+#include "common/Point.h"    // for iRectangle2D
 #include "common/RawImage.h" // for RawImage
 #include "metadata/Camera.h" // for Hints
+#include <algorithm>         // for max, min
+#include <array>             // for array
+#include <chrono>            // for steady_clock
+#include <ctime>             // for clock, clock_t, CLOCKS_PER_SEC
+#include <memory>            // for shared_ptr, unique_ptr
 #include <string>            // for string
+#include <vector>            // for vector
 
 namespace rawspeed {
 
 class Buffer;
 
+class ByteStream;
+
 class CameraMetaData;
 
+struct DecodePlan;
+
+class Executor;
+
+class ImageAllocator;
+
+class ScratchArena;
+
+enum class Priority;
+
 class TiffIFD;
 
 class RawDecoder
@@ -56,6 +76,31 @@ public:
   /* and there will not be any data in the mRaw image. */
   RawImage decodeRaw();
 
+  /* Attempt to decode just the part of the image within roi, which is in */
+  /* the coordinates of the whole image, before any crop. The image has */
+  /* the usual dimensions, but the decoders that can skip the tiles or the */
+  /* strips outside of roi, leave them cleared instead. */
+  RawImage decodeRaw(const iRectangle2D& roi);
+
+  /* Same, for the rows [0, rows), e.g. for the previews of the top band. */
+  /* The stream formats also stop decoding after the bottom of roi. */
+  RawImage decodeRawRows(int rows);
+
+  /* The number of the frames, e.g. of a DNG burst, or of the full */
+  /* resolution ones of an enhanced DNG. decodeRaw() decodes the first. */
+  virtual int getNumFrames() const { return 1; }
+
+  /* Decodes the given frames, each as decodeRaw() and decodeMetaData() */
+  /* would, concurrently on the executor, and returns their images in that */
+  /* order. They share the parse tree, and this decoder, and its mRaw, are */
+  /* left as they are. checkSupport() must have been called already. */
+  /* The frames do not get the areaReady, externalData, stageTimes and */
+  /* stats, */
+  /* which are for one image. The formats of a single frame only decode */
+  /* that one, into mRaw, as decodeRaw() does. */
+  std::vector<RawImage> decodeFrames(const std::vector<int>& frames,
+                                     const CameraMetaData* meta);
+
   /* This will apply metadata information from the camera database, */
   /* such as crop, black+white level, etc. */
   /* This function is expected to use the protected "setMetaData" */
@@ -63,8 +108,59 @@ public:
   /* If meta-data is set during load, this function can be empty. */
   /* The image is expected to be cropped after this, but black/whitelevel */
   /* compensation is not expected to be applied to the image */
+  /* It can also be called without decodeRaw(), after checkSupport(), for */
+  /* just the metadata: mRaw then gets the dimensions, crop, CFA, levels */
+  /* and white balance that it would have, but no pixels are decoded or */
+  /* allocated. The image is then cropped already, so decodeRaw() takes a */
+  /* new decoder. */
   void decodeMetaData(const CameraMetaData* meta);
 
+  /* A preview that is embedded in the file, e.g. the JPEG of the camera. */
+  struct EmbeddedPreview {
+    enum class Compression {
+      Uncompressed, // 8-bit samples, as in the TIFF of the preview.
+      JPEG,
+    };
+    Compression compression = Compression::JPEG;
+    iPoint2D dim;      // Or 0x0, if only the JPEG itself tells.
+    uint64 offset = 0; // Within the file.
+    uint64 length = 0;
+  };
+
+  /* Lists the embedded previews, without decoding the raw. It only uses the */
+  /* metadata that the parser has already read, so with a lazily loaded */
+  /* file, none of the previews, nor the raw, are read for this. */
+  virtual std::vector<EmbeddedPreview> getEmbeddedPreviews() const {
+    return {};
+  }
+
+  /* The bytes of that preview, as a view of the file. With a lazily loaded */
+  /* file, only these are read, once they are accessed. */
+  Buffer getEmbeddedPreviewData(const EmbeddedPreview& preview) const;
+
+  /* An index of the file, that a later decode of the same file can use */
+  /* to skip some of the work, e.g. the serial scan of the Huffman stream */
+  /* of a NEF. It is meant to be kept next to the file, and is keyed by a */
+  /* hash of the whole file, and by getDecoderVersion(). Only valid after */
+  /* decodeRaw(), and empty if the decoder has nothing to keep. */
+  std::vector<uchar8> getDecodeIndex();
+
+  /* Uses an index from getDecodeIndex(), before decodeRaw(). Returns */
+  /* whether it was one of this very file and decoder version, the others */
+  /* are just not used. A broken one throws. */
+  bool setDecodeIndex(const Buffer& index);
+
+  /* Where the compressed pixels are, as tiles that can each be decoded */
+  /* from just their own bytes, e.g. on the other nodes of a cluster, see */
+  /* DecodePlan. Only after checkSupport(). Throws for the formats that */
+  /* have none, i.e. all but the DNG and the IIQ. */
+  DecodePlan getDecodePlan();
+
+  /* Decodes the image, as decodeRaw() would, but with the pixels of all */
+  /* of the tiles of getDecodePlan() as DecodePlan::decodeTile() returned */
+  /* them, in the order of the tiles, rather than decompressing them. */
+  RawImage decodeRaw(const std::vector<RawImage>& tiles);
+
   /* Allows access to the root IFD structure */
   /* If image isn't TIFF based NULL will be returned */
   virtual TiffIFD *getRootIFD() { return nullptr; }
@@ -100,6 +196,11 @@ public:
   /* Should Fuji images be rotated? */
   bool fujiRotate;
 
+  /* If they should, only describe the rotation, in */
+  /* ImageMetaData::fujiRotation, and leave the image unrotated, e.g. for */
+  /* the host application to rotate it on the GPU. */
+  bool deferFujiRotation = false;
+
   struct {
     /* Should Quadrant Multipliers be applied to the IIQ raws? */
     bool quadrantMultipliers = true;
@@ -108,6 +209,115 @@ public:
     explicit operator bool() const { return quadrantMultipliers /*|| ...*/; }
   } iiq;
 
+  /* The stages of the decoding, for stageTimes. */
+  enum Stage {
+    STAGE_CHECK_SUPPORT, // checkSupport()
+    STAGE_DECODE,        // decodeRaw(), the decompression itself
+    STAGE_POST_PROCESS,  // decodeRaw(), the passes over the decoded image:
+                         // the lookup, the scaling, the bad pixels, opcodes
+    STAGE_METADATA,      // decodeMetaData()
+    STAGE_COUNT
+  };
+  using StageTimes = std::array<double, STAGE_COUNT>;
+
+  /* If set, the wall time of each of the stages, in seconds, is added to */
+  /* it, e.g. for profiling. A stage does not include the ones within it, */
+  /* STAGE_DECODE is what is left of decodeRaw() after the post-processing. */
+  StageTimes* stageTimes = nullptr;
+
+  /* What the decoding did, e.g. to be exported to the metrics. */
+  struct DecodeStats {
+    std::string decoder; /* The class, e.g. "NefDecoder". */
+
+    uint64 fileBytes = 0;
+    uint64 imageBytes = 0; /* Of the decoded pixels, before any crop. */
+    /* Of the file to the pixels, e.g. 0.5 if it is a half of their size. */
+    double getCompressionRatio() const {
+      return imageBytes ? static_cast<double>(fileBytes) / imageBytes : 0;
+    }
+
+    /* As the stageTimes. The CPU time is the one of the whole process, */
+    /* i.e. of all of the threads, including any other decodes. */
+    StageTimes wallTimes{{}};
+    StageTimes cpuTimes{{}};
+
+    int threads = 0; /* The concurrency of the executor. */
+
+    /* See RawImageData::DecodeCounters. */
+    uint32 areas = 0;
+    uint32 huffmanTables = 0;
+    uint32 huffmanTablesBuilt = 0;
+
+    /* Of the image. Not if externalData is set. */
+    uint64 allocations = 0;
+    uint64 peakAllocatedBytes = 0;
+  };
+
+  /* If set, the times of the stages are added to it, as to stageTimes, */
+  /* and decodeRaw() sets the rest. */
+  DecodeStats* stats = nullptr;
+
+  /* If set, decodeRaw() computes it of the decoded image, as it fixes the */
+  /* bad pixels, see RawImageData::contentStats. Its histogramBits are */
+  /* to be set before. */
+  RawImageData::ContentStats* contentStats = nullptr;
+
+  /* If set, decodeRaw() builds it of the decoded image in the same pass, */
+  /* see RawImageData::pyramid. */
+  ImagePyramid* pyramid = nullptr;
+
+  /* If set, it is given to the image before the decoding, see */
+  /* RawImageData::areaReady. Not all of the decoders report the areas. */
+  RawImageData::AreaReadyCallback areaReady;
+
+  /* If set, the image is decoded into it, see RawImageData::externalData. */
+  RawImageData::ExternalData externalData;
+
+  /* If set, the image is allocated from it, see RawImageData::allocator, */
+  /* e.g. a BudgetImageAllocator, to cap the memory of this decode, or to */
+  /* measure its peak. */
+  std::shared_ptr<ImageAllocator> imageAllocator;
+
+  /* If set, the temporary buffers of this decode are allocated from it, */
+  /* see RawImageData::scratch. It is used by decodeRaw(), and by the */
+  /* decodeMetaData(), so it may only be reset() after that, e.g. between */
+  /* the files of a BatchDecoder worker. */
+  std::shared_ptr<ScratchArena> scratchArena;
+
+  /* If not zero, the decoding fails before it allocates an image of more */
+  /* pixels, or bytes, than that, however big the file says it is, see */
+  /* RawImageData::maxPixels. The decoders also check that the file has */
+  /* enough data for the dimensions, see RawImageData::expectInput(). */
+  uint64 maxPixels = 0;
+  uint64 maxImageBytes = 0;
+
+  /* If set, the levels of the camera, known before the decoding, that the */
+  /* decompressors which can apply as they store the pixels, see */
+  /* RawImageData::scaleOnWrite. Then the postProcess() does not scale */
+  /* them again, and the image has the levels of the scaled pixels. Not */
+  /* with uncorrectedRawValues. */
+  Optional<RawImageData::Levels> scaleOnWrite;
+
+  /* If set, it is given to the image before the decoding, see */
+  /* RawImageData::cancellation. */
+  std::shared_ptr<const Cancellation> cancellation;
+
+  /* If set, all of the parallel work of this decoder runs on it, instead */
+  /* of the one of getExecutor(), see ExecutorScope. E.g. a */
+  /* ThreadPoolExecutor with all of the cores for the decode the user waits */
+  /* for, and a SerialExecutor for the ones in the background. */
+  std::shared_ptr<Executor> executor;
+
+  /* If set, all of the parallel work of this decoder has that priority, */
+  /* see PriorityScope, e.g. Interactive for the decode the user waits */
+  /* for. Otherwise, it has the one of the calling thread. */
+  Optional<Priority> priority;
+
+  /* If set, the lossless JPEG scans that have no restart markers (CR2, */
+  /* 3FR, the DNGs of a single tile) are entropy-decoded in parallel, see */
+  /* AbstractLJpegDecompressor::speculative. Experimental. */
+  bool speculativeEntropyDecode = false;
+
   /* Retrieve the main RAW chunk */
   /* Returns NULL if unknown */
   virtual Buffer* getCompressedData() { return nullptr; }
@@ -121,6 +331,34 @@ protected:
   virtual void decodeMetaDataInternal(const CameraMetaData* meta) = 0;
   virtual void checkSupportInternal(const CameraMetaData* meta) = 0;
 
+  /* Sets, from the headers only, what decodeMetaDataInternal() needs of */
+  /* what decodeRawInternal() would have set: the dimensions the crop is */
+  /* relative to, the cpp, and the state of the decoder itself. Called by */
+  /* decodeMetaData() if there was no decodeRaw(). By default, nothing. */
+  virtual void decodeHeaderInternal() {}
+
+  /* A decoder of that frame, as a copy of this one, which can be used */
+  /* concurrently with the others. Only the formats of several frames */
+  /* need to provide it. */
+  virtual std::unique_ptr<RawDecoder> getFrameDecoder(int frame) const;
+
+  /* The plan of getDecodePlan(). By default, there is none. */
+  virtual DecodePlan getDecodePlanInternal();
+
+  /* If set, by decodeRaw(tiles), the pixels of the tiles of the plan, */
+  /* which the decoders then place, see DecodePlan::placeTiles(), rather */
+  /* than decompressing them. */
+  const std::vector<RawImage>* mPlanTiles = nullptr;
+
+  /* Appends the state that is worth keeping to the index, and reads it */
+  /* back from what is left of it. By default, there is none. */
+  virtual void writeDecodeIndex(std::vector<uchar8>* index) const;
+  virtual void readDecodeIndex(ByteStream* index);
+
+  /* Appends the value, little-endian, as ByteStream reads it back. */
+  static void putDecodeIndexValue(std::vector<uchar8>* index, uint64 value,
+                                  int bytes);
+
   /* Ask for sample submisson, if makes sense */
   void askForSamples(const CameraMetaData* meta, const std::string& make,
                      const std::string& model, const std::string& mode) const;
@@ -154,7 +392,78 @@ protected:
   /* Hints set for the camera after checkCameraSupported has been called from the implementation*/
   Hints hints;
 
+  /* Only the pixels within it need to be decoded, or all if it is empty. */
+  iRectangle2D mROI;
+
+  /* Whether any of the area needs to be decoded. */
+  bool isInROI(const iRectangle2D& area) const {
+    return !mROI.hasPositiveArea() || area.getOverlap(mROI).hasPositiveArea();
+  }
+
+  /* How many of the first rows of an image of that height need decoding. */
+  uint32 getROIRows(int height) const {
+    if (!mROI.hasPositiveArea())
+      return height;
+    return std::max(0, std::min(height, mROI.getBottom()));
+  }
+
   struct RawSlice;
+
+  /* Adds the time of its scope to the stage, and takes it from the one */
+  /* that it is nested within. Does nothing unless stageTimes or stats is */
+  /* set. */
+  class StageTimer;
+
+private:
+  /* The stage that is timed right now, or STAGE_COUNT if none. */
+  Stage currentStage = STAGE_COUNT;
+
+  /* Whether decodeMetaData() went by the headers alone. */
+  bool decodedHeaderOnly = false;
+};
+
+class RawDecoder::StageTimer final {
+  RawDecoder* const decoder;
+  const Stage stage;
+  const Stage outer;
+  const bool active;
+  std::chrono::steady_clock::time_point start;
+  std::clock_t cpuStart = 0;
+
+  void add(StageTimes* times, double seconds) const {
+    (*times)[stage] += seconds;
+    if (outer != STAGE_COUNT)
+      (*times)[outer] -= seconds;
+  }
+
+public:
+  StageTimer(RawDecoder* decoder_, Stage stage_)
+      : decoder(decoder_), stage(stage_), outer(decoder_->currentStage),
+        active(decoder_->stageTimes || decoder_->stats) {
+    if (!active)
+      return;
+    decoder->currentStage = stage;
+    start = std::chrono::steady_clock::now();
+    cpuStart = std::clock();
+  }
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+  ~StageTimer() {
+    if (!active)
+      return;
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    const double cpu =
+        static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    if (decoder->stageTimes)
+      add(decoder->stageTimes, elapsed.count());
+    if (decoder->stats) {
+      add(&decoder->stats->wallTimes, elapsed.count());
+      add(&decoder->stats->cpuTimes, cpu);
+    }
+    decoder->currentStage = outer;
+  }
 };
 
 struct RawDecoder::RawSlice {
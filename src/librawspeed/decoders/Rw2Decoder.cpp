@@ -147,6 +147,14 @@ void Rw2Decoder::checkSupportInternal(const CameraMetaData* meta) {
     checkCameraSupported(meta, id, "");
 }
 
+void Rw2Decoder::decodeHeaderInternal() {
+  const TiffIFD* raw = mRootIFD->hasEntryRecursive(PANASONIC_STRIPOFFSET)
+                           ? mRootIFD->getIFDWithTag(PANASONIC_STRIPOFFSET)
+                           : mRootIFD->getIFDWithTag(STRIPOFFSETS);
+  mRaw->dim = iPoint2D(raw->getEntry(static_cast<TiffTag>(2))->getU16(),
+                       raw->getEntry(static_cast<TiffTag>(3))->getU16());
+}
+
 void Rw2Decoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   mRaw->cfa.setCFA(iPoint2D(2,2), CFA_BLUE, CFA_GREEN, CFA_GREEN, CFA_RED);
 
@@ -229,7 +237,7 @@ void Rw2Decoder::decodeMetaDataInternal(const CameraMetaData* meta) {
 std::string Rw2Decoder::guessMode() {
   float ratio = 3.0F / 2.0F; // Default
 
-  if (!mRaw->isAllocated())
+  if (!mRaw->dim.hasPositiveArea())
     return "";
 
   ratio = static_cast<float>(mRaw->dim.x) / static_cast<float>(mRaw->dim.y);
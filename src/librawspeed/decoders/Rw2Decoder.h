@@ -42,6 +42,7 @@ public:
 
   RawImage decodeRawInternal() override;
   void decodeMetaDataInternal(const CameraMetaData* meta) override;
+  void decodeHeaderInternal() override;
   void checkSupportInternal(const CameraMetaData* meta) override;
 
 protected:
@@ -31,7 +31,7 @@
 
 namespace rawspeed {
 
-void SimpleTiffDecoder::prepareForRawDecoding() {
+void SimpleTiffDecoder::prepareForRawDecoding(uint32 minBitsPerPixel) {
   raw = getIFDWithLargestImage();
   width = raw->getEntry(IMAGEWIDTH)->getU32();
   height = raw->getEntry(IMAGELENGTH)->getU32();
@@ -50,7 +50,15 @@ void SimpleTiffDecoder::prepareForRawDecoding() {
   checkImageDimensions();
 
   mRaw->dim = iPoint2D(width, height);
+  mRaw->expectInput(mFile->getSize() - off, minBitsPerPixel);
   mRaw->createData();
 }
 
+void SimpleTiffDecoder::decodeHeaderInternal() {
+  raw = getIFDWithLargestImage();
+  width = raw->getEntry(IMAGEWIDTH)->getU32();
+  height = raw->getEntry(IMAGELENGTH)->getU32();
+  mRaw->dim = iPoint2D(width, height);
+}
+
 } // namespace rawspeed
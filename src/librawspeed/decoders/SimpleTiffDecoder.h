@@ -38,9 +38,14 @@ public:
   SimpleTiffDecoder(TiffRootIFDOwner&& root, const Buffer* file)
       : AbstractTiffDecoder(move(root), file) {}
 
-  void prepareForRawDecoding();
+  // With the MinBitsPerPixel of the decompressor, if it is a compressed one,
+  // for the data from the strip to the end of the file, which is what the
+  // decoders read, see RawImageData::expectInput().
+  void prepareForRawDecoding(uint32 minBitsPerPixel = 0);
 
 protected:
+  void decodeHeaderInternal() override;
+
   const TiffIFD* raw;
   uint32 width;
   uint32 height;
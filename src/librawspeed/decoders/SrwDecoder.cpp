@@ -126,7 +126,7 @@ RawImage SrwDecoder::decodeRawInternal() {
 
     mRaw->createData();
 
-    s2.decompress();
+    s2.decompress(getROIRows(mRaw->dim.y));
 
     return mRaw;
   }
@@ -152,6 +152,12 @@ void SrwDecoder::checkSupportInternal(const CameraMetaData* meta) {
     this->checkCameraSupported(meta, id, "");
 }
 
+void SrwDecoder::decodeHeaderInternal() {
+  auto raw = mRootIFD->getIFDWithTag(STRIPOFFSETS);
+  mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                       raw->getEntry(IMAGELENGTH)->getU32());
+}
+
 void SrwDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   int iso = 0;
   if (mRootIFD->hasEntryRecursive(ISOSPEEDRATINGS))
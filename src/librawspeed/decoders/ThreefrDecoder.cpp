@@ -60,6 +60,7 @@ RawImage ThreefrDecoder::decodeRawInternal() {
   mRaw->dim = iPoint2D(width, height);
 
   HasselbladDecompressor l(bs, mRaw);
+  l.speculative = speculativeEntropyDecode;
   mRaw->createData();
 
   int pixelBaseOffset = hints.get("pixelBaseOffset", 0);
@@ -68,6 +69,12 @@ RawImage ThreefrDecoder::decodeRawInternal() {
   return mRaw;
 }
 
+void ThreefrDecoder::decodeHeaderInternal() {
+  auto raw = mRootIFD->getIFDWithTag(STRIPOFFSETS, 1);
+  mRaw->dim = iPoint2D(raw->getEntry(IMAGEWIDTH)->getU32(),
+                       raw->getEntry(IMAGELENGTH)->getU32());
+}
+
 void ThreefrDecoder::decodeMetaDataInternal(const CameraMetaData* meta) {
   mRaw->cfa.setCFA(iPoint2D(2,2), CFA_RED, CFA_GREEN, CFA_GREEN, CFA_BLUE);
 
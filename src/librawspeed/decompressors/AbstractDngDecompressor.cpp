@@ -22,17 +22,21 @@
 #include "rawspeedconfig.h"
 #include "decompressors/AbstractDngDecompressor.h"
 #include "common/Common.h"                          // for BitOrder_LSB
+#include "common/Executor.h"                        // for DynamicSchedule
 #include "common/Point.h"                           // for iPoint2D
 #include "common/RawImage.h"                        // for RawImageData
+#include "common/Trace.h"                           // for RAWSPEED_TRACE_SCOPE
 #include "decoders/RawDecoderException.h"           // for RawDecoderException
 #include "decompressors/DeflateDecompressor.h"      // for DeflateDecompressor
 #include "decompressors/JpegDecompressor.h"         // for JpegDecompressor
 #include "decompressors/LJpegDecompressor.h"        // for LJpegDecompressor
+#include "decompressors/TileDecodeEngine.h"         // for getTileDecodeEngine
 #include "decompressors/UncompressedDecompressor.h" // for UncompressedDeco...
 #include "decompressors/VC5Decompressor.h"          // for VC5Decompressor
 #include "io/ByteStream.h"                          // for ByteStream
 #include "io/Endianness.h"                          // for Endianness, Endi...
 #include "io/IOException.h"                         // for IOException, Thr...
+#include <algorithm>                                // for min, stable_sort
 #include <cassert>                                  // for assert
 #include <cstdio>                                   // for size_t
 #include <limits>                                   // for numeric_limits
@@ -41,14 +45,15 @@
 
 namespace rawspeed {
 
-template <> void AbstractDngDecompressor::decompressThread<1>() const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto e = slices.cbegin(); e < slices.cend(); ++e) {
+template <>
+void AbstractDngDecompressor::decompressThread<1>(
+    const std::vector<int>& order, DynamicSchedule* schedule) const noexcept {
+  for (int i; !mRaw->isCancelled() && schedule->getNext(&i);) {
+    const DngSliceElement* e = &slices[order[i]];
+    RAWSPEED_TRACE_SCOPE("decompressor", "uncompressed tile");
     UncompressedDecompressor decompressor(e->bs, mRaw);
 
-    iPoint2D tileSize(e->width, e->height);
+    iPoint2D tileSize(e->width, getRows(*e));
     iPoint2D pos(e->offX, e->offY);
 
     bool big_endian = e->bs.getByteOrder() == Endianness::big;
@@ -79,6 +84,7 @@ template <> void AbstractDngDecompressor::decompressThread<1>() const noexcept {
       decompressor.readUncompressedRaw(tileSize, pos, inputPitch, mBps,
                                        big_endian ? BitOrder_MSB
                                                   : BitOrder_LSB);
+      tileDone(*e);
     } catch (RawDecoderException& err) {
       mRaw->setError(err.what());
     } catch (IOException& err) {
@@ -87,14 +93,17 @@ template <> void AbstractDngDecompressor::decompressThread<1>() const noexcept {
   }
 }
 
-template <> void AbstractDngDecompressor::decompressThread<7>() const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto e = slices.cbegin(); e < slices.cend(); ++e) {
+template <>
+void AbstractDngDecompressor::decompressThread<7>(
+    const std::vector<int>& order, DynamicSchedule* schedule) const noexcept {
+  for (int i; !mRaw->isCancelled() && schedule->getNext(&i);) {
+    const DngSliceElement* e = &slices[order[i]];
+    RAWSPEED_TRACE_SCOPE("decompressor", "LJpeg tile");
     try {
       LJpegDecompressor d(e->bs, mRaw);
-      d.decode(e->offX, e->offY, e->width, e->height, mFixLjpeg);
+      d.speculative = speculative && slices.size() == 1;
+      d.decode(e->offX, e->offY, e->width, getRows(*e), mFixLjpeg);
+      tileDone(*e);
     } catch (RawDecoderException& err) {
       mRaw->setError(err.what());
     } catch (IOException& err) {
@@ -104,17 +113,19 @@ template <> void AbstractDngDecompressor::decompressThread<7>() const noexcept {
 }
 
 #ifdef HAVE_ZLIB
-template <> void AbstractDngDecompressor::decompressThread<8>() const noexcept {
-  std::unique_ptr<unsigned char[]> uBuffer; // NOLINT
+template <>
+void AbstractDngDecompressor::decompressThread<8>(
+    const std::vector<int>& order, DynamicSchedule* schedule) const noexcept {
+  DeflateDecompressor::ThreadState state;
 
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto e = slices.cbegin(); e < slices.cend(); ++e) {
+  for (int i; !mRaw->isCancelled() && schedule->getNext(&i);) {
+    const DngSliceElement* e = &slices[order[i]];
+    RAWSPEED_TRACE_SCOPE("decompressor", "deflate tile");
     DeflateDecompressor z(e->bs, mRaw, mPredictor, mBps);
     try {
-      z.decode(&uBuffer, e->dsc.tileW, e->dsc.tileH, e->width, e->height,
+      z.decode(&state, e->dsc.tileW, e->dsc.tileH, e->width, e->height,
                e->offX, e->offY);
+      tileDone(*e);
     } catch (RawDecoderException& err) {
       mRaw->setError(err.what());
     } catch (IOException& err) {
@@ -124,14 +135,16 @@ template <> void AbstractDngDecompressor::decompressThread<8>() const noexcept {
 }
 #endif
 
-template <> void AbstractDngDecompressor::decompressThread<9>() const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto e = slices.cbegin(); e < slices.cend(); ++e) {
+template <>
+void AbstractDngDecompressor::decompressThread<9>(
+    const std::vector<int>& order, DynamicSchedule* schedule) const noexcept {
+  for (int i; !mRaw->isCancelled() && schedule->getNext(&i);) {
+    const DngSliceElement* e = &slices[order[i]];
+    RAWSPEED_TRACE_SCOPE("decompressor", "VC5 tile");
     try {
       VC5Decompressor d(e->bs, mRaw);
       d.decode(e->offX, e->offY, e->width, e->height);
+      tileDone(*e);
     } catch (RawDecoderException& err) {
       mRaw->setError(err.what());
     } catch (IOException& err) {
@@ -142,14 +155,17 @@ template <> void AbstractDngDecompressor::decompressThread<9>() const noexcept {
 
 #ifdef HAVE_JPEG
 template <>
-void AbstractDngDecompressor::decompressThread<0x884c>() const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto e = slices.cbegin(); e < slices.cend(); ++e) {
+void AbstractDngDecompressor::decompressThread<0x884c>(
+    const std::vector<int>& order, DynamicSchedule* schedule) const noexcept {
+  JpegDecompressor::Context context;
+
+  for (int i; !mRaw->isCancelled() && schedule->getNext(&i);) {
+    const DngSliceElement* e = &slices[order[i]];
+    RAWSPEED_TRACE_SCOPE("decompressor", "lossy JPEG tile");
     JpegDecompressor j(e->bs, mRaw);
     try {
-      j.decode(e->offX, e->offY);
+      j.decode(&context, e->offX, e->offY);
+      tileDone(*e);
     } catch (RawDecoderException& err) {
       mRaw->setError(err.what());
     } catch (IOException& err) {
@@ -159,7 +175,8 @@ void AbstractDngDecompressor::decompressThread<0x884c>() const noexcept {
 }
 #endif
 
-void AbstractDngDecompressor::decompressThread() const noexcept {
+void AbstractDngDecompressor::decompressThread(
+    const std::vector<int>& order, DynamicSchedule* schedule) const noexcept {
   assert(mRaw->dim.x > 0);
   assert(mRaw->dim.y > 0);
   assert(mRaw->getCpp() > 0 && mRaw->getCpp() <= 4);
@@ -167,14 +184,14 @@ void AbstractDngDecompressor::decompressThread() const noexcept {
 
   if (compression == 1) {
     /* Uncompressed */
-    decompressThread<1>();
+    decompressThread<1>(order, schedule);
   } else if (compression == 7) {
     /* Lossless JPEG */
-    decompressThread<7>();
+    decompressThread<7>(order, schedule);
   } else if (compression == 8) {
     /* Deflate compression */
 #ifdef HAVE_ZLIB
-    decompressThread<8>();
+    decompressThread<8>(order, schedule);
 #else
 #pragma message                                                                \
     "ZLIB is not present! Deflate compression will not be supported!"
@@ -182,11 +199,11 @@ void AbstractDngDecompressor::decompressThread() const noexcept {
 #endif
   } else if (compression == 9) {
     /* GOPRO VC-5 */
-    decompressThread<9>();
+    decompressThread<9>(order, schedule);
   } else if (compression == 0x884c) {
     /* Lossy DNG */
 #ifdef HAVE_JPEG
-    decompressThread<0x884c>();
+    decompressThread<0x884c>(order, schedule);
 #else
 #pragma message "JPEG is not present! Lossy JPEG DNG will not be supported!"
     mRaw->setError("jpeg support is disabled.");
@@ -195,12 +212,71 @@ void AbstractDngDecompressor::decompressThread() const noexcept {
     mRaw->setError("AbstractDngDecompressor: Unknown compression");
 }
 
+unsigned AbstractDngDecompressor::getRows(const DngSliceElement& e) const {
+  if (!roi.hasPositiveArea())
+    return e.height;
+
+  // The tile does overlap with the roi, so that is at least one row.
+  assert(roi.getBottom() > static_cast<int>(e.offY));
+  return std::min(e.height, roi.getBottom() - e.offY);
+}
+
+void AbstractDngDecompressor::tileDone(const DngSliceElement& e) const {
+  const iRectangle2D tile(e.offX, e.offY, e.width, e.height);
+  mRaw->notifyAreaReady(tile);
+  // Consumed, no need to keep it in memory. Unless it is the pixels now.
+  if (!mRaw->isReadOnly())
+    e.bs.adviseDone();
+}
+
 void AbstractDngDecompressor::decompress() const {
-#ifdef HAVE_OPENMP
-#pragma omp parallel default(none) num_threads(                                \
-    rawspeed_get_number_of_processor_cores()) if (slices.size() > 1)
-#endif
-  decompressThread();
+  // The cost of a tile is roughly proportional to its compressed size, and
+  // it varies a lot, e.g. between the edge tiles and the rest. So hand the
+  // tiles out dynamically, starting with the most expensive ones, so that the
+  // cheap ones can fill in the gaps at the end.
+  std::vector<int> order;
+  order.reserve(slices.size());
+  for (int i = 0; i < static_cast<int>(slices.size()); i++) {
+    const DngSliceElement& e = slices[i];
+    const iRectangle2D tile(e.offX, e.offY, e.width, e.height);
+    if (roi.hasPositiveArea() && !tile.getOverlap(roi).hasPositiveArea()) {
+      mRaw->clearArea(tile);
+      continue;
+    }
+
+    const int rows = isRowLimited() ? getRows(e) : e.height;
+    mRaw->clearArea({tile.getLeft(), tile.getTop() + rows, tile.getWidth(),
+                     tile.getHeight() - rows});
+    order.emplace_back(i);
+  }
+
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return slices[a].bs.getSize() > slices[b].bs.getSize();
+  });
+
+  // If the file is mapped, have all of the tiles read in the background, in
+  // the order they are decoded, instead of faulting them in one by one.
+  for (int i : order)
+    slices[i].bs.adviseWillNeed();
+
+  const auto engine = getTileDecodeEngine();
+  if (engine && engine->decompressDng(*this, order)) {
+    for (int i : order)
+      tileDone(slices[i]);
+  } else {
+    // A preview of a few tiles is not worth the threads.
+    int64_t input = 0;
+    int64_t output = 0;
+    for (int i : order) {
+      input += slices[i].bs.getSize();
+      output += int64_t(slices[i].width) * slices[i].height * mRaw->getBpp();
+    }
+    parallelForDynamic(0, order.size(), std::max(input, output),
+                       [this, &order](DynamicSchedule* schedule) {
+                         decompressThread(order, schedule);
+                       });
+  }
+  mRaw->checkCancelled();
 
   std::string firstErr;
   if (mRaw->isTooManyErrors(1, &firstErr)) {
@@ -22,7 +22,7 @@
 #pragma once
 
 #include "common/Common.h"                      // for uint32
-#include "common/Point.h"                       // for iPoint2D
+#include "common/Point.h"                       // for iPoint2D, iRectang...
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/ByteStream.h"                      // for ByteStream
@@ -32,6 +32,7 @@
 
 namespace rawspeed {
 
+class DynamicSchedule;
 class RawImage;
 
 struct DngTilingDescription final {
@@ -119,19 +120,31 @@ struct DngSliceElement final {
 class AbstractDngDecompressor final : public AbstractDecompressor {
   RawImage mRaw;
 
-  template <int compression> void decompressThread() const noexcept;
+  template <int compression>
+  void decompressThread(const std::vector<int>& order,
+                        DynamicSchedule* schedule) const noexcept;
 
-  void decompressThread() const noexcept;
+  void decompressThread(const std::vector<int>& order,
+                        DynamicSchedule* schedule) const noexcept;
+
+  // Reports the whole tile as ready, the rows after getRows() were cleared.
+  void tileDone(const DngSliceElement& e) const;
 
 public:
   AbstractDngDecompressor(const RawImage& img, DngTilingDescription dsc_,
                           int compression_, bool mFixLjpeg_, uint32 mBps_,
-                          uint32 mPredictor_)
+                          uint32 mPredictor_, iRectangle2D roi_ = {})
       : mRaw(img), dsc(dsc_), compression(compression_), mFixLjpeg(mFixLjpeg_),
-        mBps(mBps_), mPredictor(mPredictor_) {}
+        mBps(mBps_), mPredictor(mPredictor_), roi(roi_) {}
 
   void decompress() const;
 
+  // Whether the tiles of this compression can be decoded just up to a row.
+  bool isRowLimited() const { return compression == 1 || compression == 7; }
+
+  // How many of the first rows of the tile are to be decoded.
+  unsigned getRows(const DngSliceElement& e) const;
+
   const DngTilingDescription dsc;
 
   std::vector<DngSliceElement> slices;
@@ -140,6 +153,15 @@ public:
   const bool mFixLjpeg = false;
   const uint32 mBps;
   const uint32 mPredictor;
+
+  // If not empty, the tiles outside of it are not decompressed, but cleared,
+  // and so are the rows after its bottom, for the uncompressed and the
+  // LJpeg tiles.
+  const iRectangle2D roi;
+
+  // If set, and there is just the one LJpeg tile, it is entropy-decoded in
+  // parallel, see AbstractLJpegDecompressor::speculative.
+  bool speculative = false;
 };
 
 } // namespace rawspeed
@@ -145,6 +145,24 @@ protected:
   }
 
 public:
+  // The codes, in order, and the number of the difference bits that follow
+  // each one of them, for the lookups that are specific to some format.
+  std::vector<CodeSymbol> getCodeSymbols() const {
+    return generateCodeSymbols();
+  }
+  const std::vector<uchar8>& getCodeValues() const { return codeValues; }
+
+  // Identifies the tables that are set up the same. Tables with the same
+  // codes only ever differ in the data that they are used for.
+  std::vector<unsigned> getKey(bool fullDecode, bool fixDNGBug16) const {
+    std::vector<unsigned> key(nCodesPerLength);
+    key.emplace_back(~0U);
+    key.insert(key.end(), codeValues.begin(), codeValues.end());
+    key.emplace_back(fullDecode);
+    key.emplace_back(fixDNGBug16);
+    return key;
+  }
+
   bool operator==(const AbstractHuffmanTable& other) const {
     return nCodesPerLength == other.nCodesPerLength &&
            codeValues == other.codeValues;
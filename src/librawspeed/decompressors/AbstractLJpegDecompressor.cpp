@@ -26,11 +26,16 @@
 #include "decoders/RawDecoderException.h"       // for ThrowRDE
 #include "decompressors/AbstractHuffmanTable.h" // for AbstractHuffmanTable
 #include "decompressors/HuffmanTable.h"         // for HuffmanTable, Huffma...
+#include "decompressors/HuffmanTableCache.h"    // for getSetUpHuffmanTable
+#include "decompressors/SpeculativeDecoder.h"   // for decodeSpeculatively
+#include "io/BitPumpMSB.h"                      // for BitPumpMSB
 #include "io/ByteStream.h"                      // for ByteStream
 #include "io/Endianness.h"                      // for Endianness, Endianne...
+#include <algorithm>                            // for all_of
 #include <array>                                // for array
 #include <cassert>                              // for assert
-#include <memory>                               // for unique_ptr, make_unique
+#include <cstring>                              // for memchr
+#include <memory>                               // for shared_ptr
 #include <utility>                              // for move
 #include <vector>                               // for vector
 
@@ -70,6 +75,11 @@ void AbstractLJpegDecompressor::decode() {
     if (m == M_EOI)
       break;
 
+    // The restart markers are only found within the entropy-coded data,
+    // and they have no payload.
+    if (m >= M_RST0 && m <= M_RST7)
+      continue;
+
     ByteStream data(input.getStream(input.peekU16()));
     data.skipBytes(2); // headerLength
 
@@ -101,6 +111,11 @@ void AbstractLJpegDecompressor::decode() {
       parseSOS(data);
       FoundMarkers.SOS = true;
       break;
+    case M_DRI:
+      if (FoundMarkers.SOS)
+        ThrowRDE("Found DRI marker after SOS");
+      parseDRI(data);
+      break;
     case M_DQT:
       ThrowRDE("Not a valid RAW file.");
     default: // Just let it skip to next marker
@@ -210,6 +225,13 @@ void AbstractLJpegDecompressor::parseSOS(ByteStream sos) {
   decodeScan();
 }
 
+void AbstractLJpegDecompressor::parseDRI(ByteStream dri) {
+  if (dri.getRemainSize() != 2)
+    ThrowRDE("Invalid DRI header length.");
+
+  restartInterval = dri.getU16();
+}
+
 void AbstractLJpegDecompressor::parseDHT(ByteStream dht) {
   while (dht.getRemainSize() > 0) {
     uint32 b = dht.getByte();
@@ -235,28 +257,113 @@ void AbstractLJpegDecompressor::parseDHT(ByteStream dht) {
     // copy nCodes bytes from input stream to code values table
     ht_.setCodeValues(dht.getBuffer(nCodes));
 
-    // see if we already have a HuffmanTable with the same codes
-    for (const auto& i : huffmanTableStore)
-      if (*i == ht_)
-        huff[htIndex] = i.get();
-
-    if (!huff[htIndex]) {
-      // setup new ht_ and put it into the store
-      auto dHT = std::make_unique<HuffmanTable>(ht_);
-      dHT->setup(fullDecodeHT, fixDng16Bug);
-      huff[htIndex] = dHT.get();
-      huffmanTableStore.emplace_back(std::move(dHT));
+    // the tiles and the files usually repeat the same tables, so those are
+    // only set up once
+    bool built;
+    huffmanTableStore.emplace_back(
+        getSetUpHuffmanTable(ht_, fullDecodeHT, fixDng16Bug, &built));
+    huff[htIndex] = huffmanTableStore.back().get();
+    if (mRaw->decodeCounters) {
+      mRaw->decodeCounters->huffmanTables++;
+      mRaw->decodeCounters->huffmanTablesBuilt += built;
     }
   }
 }
 
+ByteStream::size_type
+AbstractLJpegDecompressor::findMarker(const uchar8* data,
+                                      ByteStream::size_type size,
+                                      ByteStream::size_type pos) {
+  while (pos + 1 < size) {
+    // Only an 0xFF that is followed by some byte can start a marker.
+    const auto* c = static_cast<const uchar8*>(
+        memchr(data + pos, 0xFF, size - 1 - pos));
+    if (!c)
+      break;
+    pos = c - data;
+    if (c[1] != 0 && c[1] != 0xFF)
+      return pos;
+    pos++;
+  }
+  return size;
+}
+
+bool AbstractLJpegDecompressor::decodeDiffsSpeculatively(
+    const std::vector<const HuffmanTable*>& tables, uint64 count,
+    Diffs* diffs) const {
+  assert(!tables.empty());
+
+  // Less than that is not split into chunks anyway.
+  if (restartInterval || !speculative ||
+      input.getRemainSize() < 2 * SpeculativeDecoderDetail::MinChunkBytes)
+    return false;
+
+  // The components that share a table need not be told apart.
+  unsigned period = tables.size();
+  if (std::all_of(tables.cbegin(), tables.cend(),
+                  [&tables](const HuffmanTable* ht) {
+                    return *ht == *tables.front();
+                  }))
+    period = 1;
+
+  const Buffer data = unstuffJPEG(input);
+  const ByteStream bs(DataBuffer(data, Endianness::big));
+
+  uint64 endBit;
+  return decodeSpeculatively<BitPumpMSB>(
+      bs, 1, count, period,
+      [&tables](BitPumpMSB* bits, unsigned phase) {
+        return static_cast<ushort16>(tables[phase]->decodeNext(*bits));
+      },
+      diffs, &endBit);
+}
+
+iPoint2D AbstractLJpegDecompressor::getSubsampling(ByteStream bs) {
+  bs.setByteOrder(Endianness::big);
+
+  if (bs.getByte() != 0xFF || bs.getByte() != M_SOI)
+    ThrowRDE("Image did not start with SOI. Probably not an LJPEG");
+
+  for (;;) {
+    const auto size = bs.getRemainSize();
+    const uchar8* data = bs.peekData(size);
+    const auto pos = findMarker(data, size, 0);
+    if (pos == size)
+      ThrowRDE("No marker found. Propably corrupt file.");
+    bs.skipBytes(pos + 2);
+
+    const auto m = static_cast<JpegMarker>(data[pos + 1]);
+    if (m == M_SOS || m == M_EOI)
+      ThrowRDE("Did not find SOF marker before SOS.");
+    if (m >= M_RST0 && m <= M_RST7)
+      continue;
+
+    ByteStream sof(bs.getStream(bs.peekU16()));
+    if (m != M_SOF3)
+      continue;
+
+    sof.skipBytes(2 + 1 + 2 + 2); // headerLength, precision, height, width
+    if (sof.getByte() < 1)
+      ThrowRDE("Only from 1 to 4 components are supported.");
+    sof.skipBytes(1); // componentId
+    const uint32 subs = sof.getByte();
+    return {static_cast<int>(subs >> 4), static_cast<int>(subs & 0xf)};
+  }
+}
+
 JpegMarker AbstractLJpegDecompressor::getNextMarker(bool allowskip) {
-  uchar8 c0;
-  uchar8 c1 = input.getByte();
-  do {
-    c0 = c1;
-    c1 = input.getByte();
-  } while (allowskip && !(c0 == 0xFF && c1 != 0 && c1 != 0xFF));
+  if (allowskip) {
+    const auto size = input.getRemainSize();
+    const uchar8* data = input.peekData(size);
+    const auto pos = findMarker(data, size, 0);
+    if (pos == size)
+      ThrowRDE("No marker found. Propably corrupt file.");
+    input.skipBytes(pos + 2);
+    return static_cast<JpegMarker>(data[pos + 1]);
+  }
+
+  const uchar8 c0 = input.getByte();
+  const uchar8 c1 = input.getByte();
 
   if (!(c0 == 0xFF && c1 != 0 && c1 != 0xFF))
     ThrowRDE("(Noskip) Expected marker not found. Propably corrupt file.");
@@ -22,13 +22,15 @@
 #pragma once
 
 #include "common/Common.h"                      // for uint32, ushort16
+#include "common/Point.h"                       // for iPoint2D
 #include "common/RawImage.h"                    // for RawImage
+#include "common/ScratchArena.h"                // for ScratchVector
 #include "decoders/RawDecoderException.h"       // for ThrowRDE
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "decompressors/HuffmanTable.h"         // for HuffmanTable
 #include "io/ByteStream.h"                      // for ByteStream
 #include <array>                                // for array
-#include <memory>                               // for unique_ptr
+#include <memory>                               // for shared_ptr
 #include <vector>                               // for vector
 
 /*
@@ -137,18 +139,41 @@ public:
 };
 
 class AbstractLJpegDecompressor : public AbstractDecompressor {
-  // std::vector of unique HTs, to not recreate HT, but cache them
-  std::vector<std::unique_ptr<HuffmanTable>> huffmanTableStore;
+  // The set up HTs, from the cache that is shared with the other streams
+  std::vector<std::shared_ptr<const HuffmanTable>> huffmanTableStore;
   HuffmanTable ht_;      // temporary table, used
 
   uint32 Pt = 0;
-  std::array<HuffmanTable*, 4> huff{{}}; // 4 pointers into the store
+  std::array<const HuffmanTable*, 4> huff{{}}; // 4 pointers into the store
 
 public:
   AbstractLJpegDecompressor(ByteStream bs, const RawImage& img);
 
+  // Of the input, see RawImageData::expectInput(). Each of the samples is a
+  // Huffman code of at least one bit, and there is at least one sample per
+  // pixel, even in the subsampled frames.
+  static constexpr uint32 MinBitsPerPixel = 1;
+
   virtual ~AbstractLJpegDecompressor() = default;
 
+  // If set, the scans without the restart markers are entropy-decoded in
+  // parallel, with decodeSpeculatively(), when there are the threads for
+  // it. The pixels are the same either way.
+  bool speculative = false;
+
+  // The position of the first marker at or after pos, i.e. of an 0xFF that
+  // is not followed by a stuffed 0x00 or by another 0xFF, or size if there
+  // is none. The 0xFF are looked for with memchr(), which goes much faster
+  // than a loop over the bytes, since they are rare in the entropy-coded
+  // data.
+  static ByteStream::size_type findMarker(const uchar8* data,
+                                          ByteStream::size_type size,
+                                          ByteStream::size_type pos);
+
+  // The sampling factors of the first component, as decode() would set the
+  // metadata.subsampling, from the SOF alone, without decoding anything.
+  static iPoint2D getSubsampling(ByteStream bs);
+
 protected:
   bool fixDng16Bug = false;  // DNG v1.0.x compatibility
   bool fullDecodeHT = true;  // FullDecode Huffman
@@ -157,11 +182,12 @@ protected:
   void parseSOF(ByteStream data, SOFInfo* i);
   void parseSOS(ByteStream data);
   void parseDHT(ByteStream data);
+  void parseDRI(ByteStream data);
   JpegMarker getNextMarker(bool allowskip);
 
   template <int N_COMP>
-  std::array<HuffmanTable*, N_COMP> getHuffmanTables() const {
-    std::array<HuffmanTable*, N_COMP> ht;
+  std::array<const HuffmanTable*, N_COMP> getHuffmanTables() const {
+    std::array<const HuffmanTable*, N_COMP> ht;
     for (int i = 0; i < N_COMP; ++i) {
       const unsigned dcTblNo = frame.compInfo[i].dcTblNo;
       const unsigned dcTbls = huff.size();
@@ -187,6 +213,14 @@ protected:
     return pred;
   }
 
+  using Diffs = ScratchVector<ushort16>;
+
+  // The first count differences of the scan, with decodeSpeculatively(),
+  // where the i'th one is decoded with the table tables[i % tables.size()].
+  // Returns false if they have to be decoded serially after all.
+  bool decodeDiffsSpeculatively(const std::vector<const HuffmanTable*>& tables,
+                                uint64 count, Diffs* diffs) const;
+
   virtual void decodeScan() = 0;
 
   ByteStream input;
@@ -194,6 +228,9 @@ protected:
 
   SOFInfo frame;
   uint32 predictorMode = 0;
+
+  // How many MCUs are there between the restart markers, if any.
+  uint32 restartInterval = 0;
 };
 
 } // namespace rawspeed
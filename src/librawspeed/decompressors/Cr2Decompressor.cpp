@@ -20,22 +20,25 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include "rawspeedconfig.h" // for RAWSPEED_TARGET_CLONES
 #include "decompressors/Cr2Decompressor.h"
 #include "common/Common.h"                // for unroll_loop, uint32, ushort16
+#include "common/Executor.h"              // for parallelFor
 #include "common/Point.h"                 // for iPoint2D, iPoint2D::area_type
 #include "common/RawImage.h"              // for RawImage, RawImageData
+#include "common/ScratchArena.h"          // for makeScratchVector
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/BitPumpJPEG.h"               // for BitPumpJPEG, BitStream<>::...
-#include <algorithm>                      // for copy_n
+#include "io/ByteStream.h"                // for ByteStream
+#include <algorithm>                      // for copy_n, min, upper_bound
 #include <cassert>                        // for assert
 #include <initializer_list>               // for initializer_list
+#include <vector>                         // for vector
 
 using std::copy_n;
 
 namespace rawspeed {
 
-class ByteStream;
-
 Cr2Decompressor::Cr2Decompressor(const ByteStream& bs, const RawImage& img)
     : AbstractLJpegDecompressor(bs, img) {
   if (mRaw->getDataType() != TYPE_USHORT16)
@@ -139,21 +142,8 @@ void Cr2Decompressor::decodeN_X_Y()
   // To understand the CR2 slice handling and sampling factor behavior, see
   // https://github.com/lclevy/libcraw2/blob/master/docs/cr2_lossless.pdf?raw=true
 
-  // inner loop decodes one group of pixels at a time
-  //  * for <N,1,1>: N  = N*1*1 (full raw)
-  //  * for <3,2,1>: 6  = 3*2*1
-  //  * for <3,2,2>: 12 = 3*2*2
-  // and advances x by N_COMP*X_S_F and y by Y_S_F
   constexpr int xStepSize = N_COMP * X_S_F;
-  constexpr int yStepSize = Y_S_F;
-
-  auto ht = getHuffmanTables<N_COMP>();
-  auto pred = getInitialPredictors<N_COMP>();
-  auto predNext = reinterpret_cast<ushort16*>(mRaw->getDataUncropped(0, 0));
 
-  BitPumpJPEG bitStream(input);
-
-  uint32 pixelPitch = mRaw->pitch / 2; // Pitch in pixel
   if (frame.cps != 3 && frame.w * frame.cps > 2 * frame.h) {
     // Fix Canon double height issue where Canon doubled the width and halfed
     // the height (e.g. with 5Ds), ask Canon. frame.w needs to stay as is here
@@ -183,28 +173,84 @@ void Cr2Decompressor::decodeN_X_Y()
       mRaw->getCpp() * mRaw->dim.area())
     ThrowRDE("Incorrrect slice height / slice widths! Less than image size.");
 
-  unsigned processedPixels = 0;
-  unsigned processedLineSlices = 0;
+  buildSpans<N_COMP, X_S_F, Y_S_F>();
+
+  if (!restartInterval) {
+    if (!decodeScanSpeculatively<N_COMP, X_S_F, Y_S_F>())
+      decodeGroups<N_COMP, X_S_F, Y_S_F>(input, 0, ~uint64(0), true);
+    return;
+  }
+
+  // The predictors are reset at the start of each restart interval. If each
+  // interval also starts at the start of a frame row, then no state at all is
+  // carried over from the previous interval, and they can be decoded in
+  // parallel.
+  const unsigned groupsPerRow = frame.w / X_S_F;
+  if (frame.w % X_S_F != 0 || restartInterval % groupsPerRow != 0) {
+    ThrowRDE("Unsupported restart interval (%u) for frame width (%u)",
+             restartInterval, frame.w);
+  }
+
+  uint64 totalGroups = 0;
+  for (auto sliceId = 0; sliceId < slicing.numSlices; sliceId++) {
+    totalGroups += uint64(frame.h / Y_S_F) *
+                   (slicing.widthOfSlice(sliceId) / xStepSize);
+  }
+
+  const std::vector<ByteStream> intervals = getRestartIntervals(
+      (totalGroups + restartInterval - 1) / restartInterval);
+
+  parallelFor(0, intervals.size(), [this, &intervals](int i) {
+    mRaw->checkCancelled();
+    decodeGroups<N_COMP, X_S_F, Y_S_F>(
+        intervals[i], uint64(i) * restartInterval, restartInterval, false);
+  });
+}
+
+template <int N_COMP, int X_S_F, int Y_S_F>
+void Cr2Decompressor::buildSpans() {
+  constexpr int xStepSize = N_COMP * X_S_F;
+  constexpr int yStepSize = Y_S_F;
+
+  // The predictor is updated after each frame.w pixels. If the frame width
+  // is not a whole number of groups, that never matches, so it never is.
+  const unsigned groupsPerRow = frame.w % X_S_F == 0 ? frame.w / X_S_F : 0;
+
+  assert(frame.h % yStepSize == 0);
+  const unsigned linesPerSlice = frame.h / yStepSize;
+
+  spans.clear();
+  spans.reserve(uint64(slicing.numSlices) * linesPerSlice);
+
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsUncroppedArray2DRef());
+
+  // The slices go from the left to the right, so a row is decoded once the
+  // line that reaches the right edge of the image is.
+  int rowsDecoded = 0;
+
+  uint64 group = 0;
   for (auto sliceId = 0; sliceId < slicing.numSlices; sliceId++) {
     const unsigned sliceWidth = slicing.widthOfSlice(sliceId);
+    assert(sliceWidth % xStepSize == 0);
+    const unsigned groupsPerLine = sliceWidth / xStepSize;
+
+    for (unsigned line = 0; line < linesPerSlice; line++) {
+      const uint64 processedLineSlices =
+          uint64(yStepSize) * (uint64(sliceId) * linesPerSlice + line);
 
-    assert(frame.h % yStepSize == 0);
-    for (unsigned y = 0; y < frame.h; y += yStepSize) {
       // Fix for Canon 80D mraw format.
       // In that format, `frame` is 4032x3402, while `mRaw` is 4536x3024.
       // Consequently, the slices in `frame` wrap around plus there are few
       // 'extra' sliced lines because sum(slicesW) * sliceH > mRaw->dim.area()
-      // Those would overflow, hence the break.
+      // Those would overflow, hence the return.
       // see FIX_CANON_FRAME_VS_IMAGE_SIZE_MISMATCH
-      unsigned destY = processedLineSlices % mRaw->dim.y;
-      unsigned destX = processedLineSlices / mRaw->dim.y *
-                       slicing.widthOfSlice(0) / mRaw->getCpp();
+      const uint64 destY = processedLineSlices % mRaw->dim.y;
+      const uint64 destX = processedLineSlices / mRaw->dim.y *
+                           slicing.widthOfSlice(0) / mRaw->getCpp();
       if (destX >= static_cast<unsigned>(mRaw->dim.x))
-        break;
-      auto dest =
-          reinterpret_cast<ushort16*>(mRaw->getDataUncropped(destX, destY));
+        return;
+      ushort16* dest = &out(destX * mRaw->getCpp(), destY);
 
-      assert(sliceWidth % xStepSize == 0);
       if (X_S_F == 1) {
         if (destX + sliceWidth > static_cast<unsigned>(mRaw->dim.x))
           ThrowRDE("Bad slice width / frame size / image size combination.");
@@ -214,38 +260,177 @@ void Cr2Decompressor::decodeN_X_Y()
       } else {
         // FIXME.
       }
-      for (unsigned x = 0; x < sliceWidth; x += xStepSize) {
-        // check if we processed one full raw row worth of pixels
-        if (processedPixels == frame.w) {
-          // if yes -> update predictor by going back exactly one row,
-          // no matter where we are right now.
-          // makes no sense from an image compression point of view, ask Canon.
-          copy_n(predNext, N_COMP, pred.data());
-          predNext = dest;
-          processedPixels = 0;
-        }
 
-        if (X_S_F == 1) { // will be optimized out
-          unroll_loop<N_COMP>([&](int i) {
-            dest[i] = pred[i] += ht[i]->decodeNext(bitStream);
-          });
-        } else {
-          unroll_loop<Y_S_F>([&](int i) {
-            dest[0 + i*pixelPitch] = pred[0] += ht[0]->decodeNext(bitStream);
-            dest[3 + i*pixelPitch] = pred[0] += ht[0]->decodeNext(bitStream);
-          });
-
-          dest[1] = pred[1] += ht[1]->decodeNext(bitStream);
-          dest[2] = pred[2] += ht[2]->decodeNext(bitStream);
+      // Split the line where the frame rows end.
+      for (unsigned x = 0; x < groupsPerLine;) {
+        unsigned len = groupsPerLine - x;
+        bool rowStart = false;
+        if (groupsPerRow) {
+          const auto inRow = static_cast<unsigned>(group % groupsPerRow);
+          rowStart = inRow == 0;
+          len = std::min(len, groupsPerRow - inRow);
         }
+        spans.push_back({dest + x * xStepSize, group, len, rowStart, 0});
+        x += len;
+        group += len;
+      }
 
-        dest += xStepSize;
-        processedPixels += X_S_F;
+      if (destX + sliceWidth / mRaw->getCpp() >=
+              static_cast<unsigned>(mRaw->dim.x) &&
+          destY == static_cast<unsigned>(rowsDecoded)) {
+        rowsDecoded = std::min<int>(destY + yStepSize, mRaw->dim.y);
+        spans.back().rowsDecoded = rowsDecoded;
       }
+    }
+  }
+}
+
+template <int N_COMP, int X_S_F, int Y_S_F, typename Next>
+inline void Cr2Decompressor::reconstructGroups(const Next& next,
+                                               uint64 firstGroup,
+                                               uint64 numGroups,
+                                               bool notify) const {
+  // inner loop decodes one group of pixels at a time
+  //  * for <N,1,1>: N  = N*1*1 (full raw)
+  //  * for <3,2,1>: 6  = 3*2*1
+  //  * for <3,2,2>: 12 = 3*2*2
+  // and advances x by N_COMP*X_S_F and y by Y_S_F
+  constexpr int xStepSize = N_COMP * X_S_F;
 
-      processedLineSlices += yStepSize;
+  auto pred = getInitialPredictors<N_COMP>();
+  ushort16* predNext = nullptr;
+
+  const int pixelPitch = mRaw->getU16DataAsUncroppedArray2DRef().getPitch();
+
+  // Find the span of the first group to decode.
+  auto span = std::upper_bound(
+      spans.cbegin(), spans.cend(), firstGroup,
+      [](uint64 g, const Span& s) { return g < s.firstGroup; });
+  if (span == spans.cbegin())
+    return;
+  --span;
+  if (firstGroup >= span->firstGroup + span->numGroups)
+    return;
+
+  auto skip = static_cast<unsigned>(firstGroup - span->firstGroup);
+  for (; span != spans.cend() && numGroups != 0; ++span, skip = 0) {
+    ushort16* dest = span->dest + skip * xStepSize;
+    const auto len = static_cast<unsigned>(
+        std::min<uint64>(span->numGroups - skip, numGroups));
+    numGroups -= len;
+
+    if (!predNext)
+      predNext = dest;
+    else if (span->rowStart && !skip) {
+      // we processed one full raw row worth of pixels, so update the
+      // predictor by going back exactly one row, no matter where we are
+      // right now.
+      // makes no sense from an image compression point of view, ask Canon.
+      copy_n(predNext, N_COMP, pred.data());
+      predNext = dest;
+    }
+
+    for (unsigned x = 0; x < len; x++) {
+      if (X_S_F == 1) { // will be optimized out
+        unroll_loop<N_COMP>([&](int i) {
+          dest[i] = pred[i] += next(i);
+        });
+      } else {
+        unroll_loop<Y_S_F>([&](int i) {
+          dest[0 + i*pixelPitch] = pred[0] += next(0);
+          dest[3 + i*pixelPitch] = pred[0] += next(0);
+        });
+
+        dest[1] = pred[1] += next(1);
+        dest[2] = pred[2] += next(2);
+      }
+
+      dest += xStepSize;
     }
+
+    if (notify && span->rowsDecoded && len == span->numGroups && rowsDecoded)
+      rowsDecoded(span->rowsDecoded);
   }
 }
 
+template <int N_COMP, int X_S_F, int Y_S_F>
+RAWSPEED_TARGET_CLONES void
+Cr2Decompressor::decodeGroups(ByteStream bs, uint64 firstGroup,
+                              uint64 numGroups, bool notify) const {
+  const auto ht = getHuffmanTables<N_COMP>();
+  BitPumpJPEG bitStream(bs);
+
+  reconstructGroups<N_COMP, X_S_F, Y_S_F>(
+      [&ht, &bitStream](int i) { return ht[i]->decodeNext(bitStream); },
+      firstGroup, numGroups, notify);
+}
+
+template <int N_COMP, int X_S_F, int Y_S_F>
+bool Cr2Decompressor::decodeScanSpeculatively() {
+  if (spans.empty())
+    return false;
+
+  // The tables of the differences of a group, in the order of the decode.
+  const auto ht = getHuffmanTables<N_COMP>();
+  std::vector<const HuffmanTable*> tables;
+  if (X_S_F == 1)
+    tables.assign(ht.cbegin(), ht.cend());
+  else {
+    tables.assign(2 * Y_S_F, ht[0]);
+    tables.emplace_back(ht[1]);
+    tables.emplace_back(ht[2]);
+  }
+
+  const uint64 groups = spans.back().firstGroup + spans.back().numGroups;
+
+  Diffs diffs = makeScratchVector<ushort16>(mRaw->scratch.get());
+  if (!decodeDiffsSpeculatively(tables, groups * tables.size(), &diffs))
+    return false;
+
+  // The predictors carry over from one span to the next, so the rest is
+  // serial, but there is not much left of the work.
+  const ushort16* diff = diffs.data();
+  reconstructGroups<N_COMP, X_S_F, Y_S_F>([&diff](int /*i*/) { return *diff++; },
+                                          0, groups, true);
+  return true;
+}
+
+std::vector<ByteStream>
+Cr2Decompressor::getRestartIntervals(uint64 maxIntervals) const {
+  std::vector<ByteStream> intervals;
+
+  const auto size = input.getRemainSize();
+  const uchar8* data = input.peekData(size);
+
+  auto isMarker = [data, size](ByteStream::size_type pos) {
+    // 0xFF00 is a stuffed 0xFF byte of the entropy-coded data.
+    return pos + 1 < size && data[pos] == 0xFF && data[pos + 1] != 0x00 &&
+           data[pos + 1] != 0xFF;
+  };
+
+  ByteStream::size_type begin = 0;
+  ByteStream::size_type pos = 0;
+  while (intervals.size() < maxIntervals) {
+    // Without one, the interval ends before the last byte, which can not
+    // start a marker.
+    const auto marker = findMarker(data, size, pos);
+    if (marker != size)
+      pos = marker;
+    else if (pos + 1 < size)
+      pos = size - 1;
+
+    intervals.emplace_back(
+        input.getSubStream(input.getPosition() + begin, pos - begin));
+
+    // Any other marker ends the entropy-coded data.
+    if (!isMarker(pos) || data[pos + 1] < M_RST0 || data[pos + 1] > M_RST7)
+      break;
+
+    pos += 2;
+    begin = pos;
+  }
+
+  return intervals;
+}
+
 } // namespace rawspeed
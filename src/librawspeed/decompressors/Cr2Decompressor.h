@@ -21,10 +21,12 @@
 
 #pragma once
 
-#include "common/Common.h"                           // for ushort16
+#include "common/Common.h"                           // for ushort16, uint64
 #include "decoders/RawDecoderException.h"            // for ThrowRDE
 #include "decompressors/AbstractLJpegDecompressor.h" // for AbstractLJpegDe...
 #include <cassert>                                   // for assert
+#include <functional>                                // for function
+#include <vector>                                    // for vector
 
 namespace rawspeed {
 
@@ -73,12 +75,56 @@ class Cr2Decompressor final : public AbstractLJpegDecompressor
 {
   Cr2Slicing slicing;
 
+  // A run of the pixel groups that are consecutive both in the frame and in
+  // the image: (a part of) one line of one slice, that does not cross a frame
+  // row, after which the predictor is reset.
+  struct Span {
+    ushort16* dest;
+    uint64 firstGroup;
+    unsigned numGroups;
+    // Whether the predictor is updated before the first group.
+    bool rowStart;
+    // If not 0, all of the image rows above this one are decoded after it.
+    int rowsDecoded;
+  };
+
+  // All of the spans of the frame, in the order of the groups.
+  std::vector<Span> spans;
+
   void decodeScan() override;
   template<int N_COMP, int X_S_F, int Y_S_F> void decodeN_X_Y();
+  template <int N_COMP, int X_S_F, int Y_S_F> void buildSpans();
+
+  // Decodes numGroups pixel groups, starting with the group firstGroup,
+  // from the entropy-coded segment bs, with freshly reset predictors. If
+  // notify, rowsDecoded is called as the rows get decoded.
+  template <int N_COMP, int X_S_F, int Y_S_F>
+  void decodeGroups(ByteStream bs, uint64 firstGroup, uint64 numGroups,
+                    bool notify) const;
+
+  // As decodeGroups(), but with the differences from next(i), where i is
+  // the component whose table the difference would have been decoded with.
+  template <int N_COMP, int X_S_F, int Y_S_F, typename Next>
+  void reconstructGroups(const Next& next, uint64 firstGroup,
+                         uint64 numGroups, bool notify) const;
+
+  // Decodes the whole scan, with decodeDiffsSpeculatively(), and then
+  // reconstructs the pixels from the differences. Returns false if it
+  // has to be decoded serially after all.
+  template <int N_COMP, int X_S_F, int Y_S_F> bool decodeScanSpeculatively();
+
+  // Splits the entropy-coded data at the restart markers.
+  std::vector<ByteStream> getRestartIntervals(uint64 maxIntervals) const;
 
 public:
   Cr2Decompressor(const ByteStream& bs, const RawImage& img);
   void decode(const Cr2Slicing& slicing);
+
+  // If set, the sequential decode calls it each time all of the image rows
+  // above the given one are decoded, in order, so that they can be processed
+  // further while still in the cache. The parallel decode of the restart
+  // intervals does not call it.
+  std::function<void(int rows)> rowsDecoded;
 };
 
 } // namespace rawspeed
@@ -20,25 +20,196 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include "rawspeedconfig.h"                     // for WITH_SSE2
 #include "decompressors/CrwDecompressor.h"
-#include "common/Common.h"                // for uint32, uchar8, ushort16
-#include "common/Point.h"                 // for iPoint2D
-#include "common/RawImage.h"              // for RawImage, RawImageData
-#include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "decompressors/HuffmanTable.h"   // for HuffmanTable
-#include "io/BitPumpJPEG.h"               // for BitPumpJPEG, BitStream<>::...
-#include "io/Buffer.h"                    // for Buffer
-#include "io/ByteStream.h"                // for ByteStream
-#include <array>                          // for array, array<>::value_type
-#include <cassert>                        // for assert
+#include "common/Array2DRef.h"                  // for Array2DRef
+#include "common/Common.h"                      // for uint32, uchar8, ushort16
+#include "common/Cpuid.h"                       // for Cpuid
+#include "common/Executor.h"                    // for parallelFor
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RawImage.h"                    // for RawImage, RawImageData
+#include "decoders/RawDecoderException.h"       // for ThrowRDE
+#include "decompressors/AbstractHuffmanTable.h" // for AbstractHuffmanTable
+#include "io/BitPumpJPEG.h"                     // for BitPumpJPEG, BitStre...
+#include "io/ByteStream.h"                      // for ByteStream
+#include <algorithm>                            // for min
+#include <array>                                // for array, array<>::valu...
+#include <cassert>                              // for assert
+#include <cstring>                              // for memcpy
+#include <utility>                              // for make_pair
+
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128i, _mm_loadu_si128
+#endif
 
 using std::array;
 
 namespace rawspeed {
 
+namespace {
+
+// LSB-packed: p3 << 6 | p2 << 4 | p1 << 2 | p0 << 0
+void mergeLowBitsRow_Scalar(const uchar8* in, ushort16* dest, int width,
+                            bool fix) {
+  for (int i = 0; i < width; i++) {
+    const ushort16 low = (in[i / 4] >> (2 * (i % 4))) & 0b11;
+    ushort16 val = (dest[i] << 2) | low;
+
+    if (fix && val < 512)
+      val += 2; // No idea why this is needed
+
+    dest[i] = val;
+  }
+}
+
+#ifdef WITH_SSE2
+// Each of the 4 bytes is spread over the 4 lanes of its pixels, and each lane
+// then shifts its pair down by multiplying it up to a fixed bit position.
+void mergeLowBitsRow_SSE2(const uchar8* in, ushort16* dest, int width,
+                          bool fix) {
+  const __m128i muls = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+  const __m128i fixup = fix ? _mm_set1_epi16(2) : _mm_setzero_si128();
+
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    uint32 bytes;
+    memcpy(&bytes, in + i / 4, sizeof(bytes));
+
+    __m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128());
+    c = _mm_unpacklo_epi16(c, c);
+
+    for (int half = 0; half < 2; half++) {
+      const __m128i b =
+          half ? _mm_unpackhi_epi32(c, c) : _mm_unpacklo_epi32(c, c);
+      const __m128i low = _mm_and_si128(
+          _mm_srli_epi16(_mm_mullo_epi16(b, muls), 6), _mm_set1_epi16(0b11));
+
+      auto* out = reinterpret_cast<__m128i*>(dest + i + 8 * half);
+      __m128i val = _mm_or_si128(_mm_slli_epi16(_mm_loadu_si128(out), 2), low);
+      val = _mm_add_epi16(
+          val, _mm_and_si128(_mm_cmplt_epi16(val, _mm_set1_epi16(512)), fixup));
+      _mm_storeu_si128(out, val);
+    }
+  }
+
+  mergeLowBitsRow_Scalar(in + i / 4, dest + i, width - i, fix);
+}
+#endif
+
+} // namespace
+
+CrwDecompressor::Tree::Tree(const uchar8* ncpl, const uchar8* len,
+                            const uchar8* index, bool hasEndOfBlock) {
+  assert(ncpl);
+  assert(len);
+  assert(index);
+
+  // Figure C.1 and C.2 of the JPEG spec, the codes of each length are
+  // consecutive, and end at maxCode of it.
+  maxCode.fill(-1);
+  codeOffset.fill(0);
+  int code = 0;
+  int count = 0;
+  for (int l = 1; l <= 16; l++) {
+    const int n = ncpl[l - 1];
+    if (n) {
+      codeOffset[l] = code - count;
+      code += n;
+      count += n;
+      maxCode[l] = code - 1;
+    }
+    code <<= 1;
+  }
+  assert(count > 0);
+
+  lens.resize(count);
+  skips.resize(count);
+  for (int s = 0; s < count; s++) {
+    if (len[s] == 0xf && index[s] == 0xf)
+      continue;
+
+    lens[s] = len[s];
+    skips[s] = index[s];
+    if (hasEndOfBlock && !lens[s] && !skips[s])
+      skips[s] = EndOfBlock;
+  }
+
+  // The code that is the prefix of the avail low bits of the bits, or
+  // {0, 0} if it is longer than that.
+  const auto match = [this](unsigned bits, unsigned avail) {
+    for (unsigned l = 1; l <= std::min(avail, 16U); l++) {
+      const int prefix = bits >> (avail - l);
+      if (maxCode[l] >= 0 && prefix <= maxCode[l])
+        return std::make_pair(l, prefix - codeOffset[l]);
+    }
+    return std::make_pair(0U, 0);
+  };
+
+  lookup.resize(1U << LookupDepth);
+  for (unsigned c = 0; c < lookup.size(); c++) {
+    Entry& e = lookup[c];
+    e = {};
+
+    const auto first = match(c, LookupDepth);
+    e.code_len = first.first;
+    e.symbol = first.second;
+
+    unsigned pos = 0;
+    for (;;) {
+      const unsigned avail = LookupDepth - pos;
+      const auto m = match(c & ((1U << avail) - 1U), avail);
+      if (!m.first)
+        break;
+
+      if (skips[m.second] == EndOfBlock) {
+        e.eob = true;
+        e.bits[e.count] = pos + m.first;
+        break;
+      }
+
+      const unsigned diff_l = lens[m.second];
+      if (e.count == MaxPairs || pos + m.first + diff_l > LookupDepth)
+        break;
+
+      pos += m.first + diff_l;
+      e.bits[e.count] = pos;
+      e.skips[e.count] = skips[m.second];
+      e.diffs[e.count] =
+          diff_l ? AbstractHuffmanTable::signExtended(
+                       (c >> (LookupDepth - pos)) & ((1U << diff_l) - 1U),
+                       diff_l)
+                 : 0;
+      e.count++;
+    }
+  }
+}
+
+inline int CrwDecompressor::Tree::decodeSymbol(BitPumpJPEG* pump) const {
+  // 16 bits of the code, and 15 of the difference.
+  pump->fill(32);
+
+  const Entry& e = lookup[pump->peekBitsNoFill(LookupDepth)];
+  if (e.code_len) {
+    pump->skipBitsNoFill(e.code_len);
+    return e.symbol;
+  }
+
+  int code_l = LookupDepth;
+  int code = pump->getBitsNoFill(LookupDepth);
+  while (code_l < 16 && (maxCode[code_l] < 0 || code > maxCode[code_l])) {
+    code = (code << 1) | pump->getBitsNoFill(1);
+    code_l++;
+  }
+
+  if (maxCode[code_l] < 0 || code > maxCode[code_l])
+    ThrowRDE("bad Huffman code: %u (len: %u)", code, code_l);
+
+  return code - codeOffset[code_l];
+}
+
 CrwDecompressor::CrwDecompressor(const RawImage& img, uint32 dec_table,
                                  bool lowbits_, ByteStream rawData)
-    : mRaw(img), lowbits(lowbits_) {
+    : mRaw(img), mHuff(getHuffTables(dec_table)), lowbits(lowbits_) {
   if (mRaw->getCpp() != 1 || mRaw->getDataType() != TYPE_USHORT16 ||
       mRaw->getBpp() != 2)
     ThrowRDE("Unexpected component count / data type");
@@ -63,25 +234,22 @@ CrwDecompressor::CrwDecompressor(const RawImage& img, uint32 dec_table,
 
   // Rest is the high bits.
   rawInput = rawData.getStream(rawData.getRemainSize());
-
-  mHuff = initHuffTables(dec_table);
 }
 
-HuffmanTable CrwDecompressor::makeDecoder(const uchar8* ncpl,
-                                          const uchar8* values) {
-  assert(ncpl);
+const CrwDecompressor::crw_hts& CrwDecompressor::getHuffTables(uint32 table) {
+  if (table > 2)
+    ThrowRDE("Wrong table number: %u", table);
 
-  HuffmanTable ht;
-  auto count = ht.setNCodesPerLength(Buffer(ncpl, 16));
-  ht.setCodeValues(Buffer(values, count));
-  ht.setup(false, false);
+  // The tables are fixed, so they are only set up once, the first time they
+  // are needed, and are then shared by all of the files.
+  static const std::array<crw_hts, 3> tables = {
+      {initHuffTables(0), initHuffTables(1), initHuffTables(2)}};
 
-  return ht;
+  return tables[table];
 }
 
 CrwDecompressor::crw_hts CrwDecompressor::initHuffTables(uint32 table) {
-  if (table > 2)
-    ThrowRDE("Wrong table number: %u", table);
+  assert(table <= 2);
 
   // NCodesPerLength
   static const std::array<std::array<uchar8, 16>, 3> first_tree_ncpl = {{
@@ -187,55 +355,66 @@ CrwDecompressor::crw_hts CrwDecompressor::initHuffTables(uint32 table) {
        0xf, 0xa, 0xc, 0xa, 0xc, 0xe, 0xa, 0xe, 0xf, 0xf},
   }};
 
-  array<array<HuffmanTable, 2>, 2> mHuff = {{
-      {{makeDecoder(first_tree_ncpl[table].data(),
-                    first_tree_len[table].data()),
-        makeDecoder(first_tree_ncpl[table].data(),
-                    first_tree_index[table].data())}},
-      {{makeDecoder(second_tree_ncpl[table].data(),
-                    second_tree_len[table].data()),
-        makeDecoder(second_tree_ncpl[table].data(),
-                    second_tree_index[table].data())}},
+  return {{
+      Tree(first_tree_ncpl[table].data(), first_tree_len[table].data(),
+           first_tree_index[table].data(), false),
+      Tree(second_tree_ncpl[table].data(), second_tree_len[table].data(),
+           second_tree_index[table].data(), true),
   }};
-
-  return mHuff;
 }
 
-// FIXME: this function is horrible.
 inline void CrwDecompressor::decodeBlock(std::array<int, 64>* diffBuf,
                                          const crw_hts& mHuff,
-                                         BitPumpJPEG* lPump,
-                                         BitPumpJPEG* iPump) {
+                                         BitPumpJPEG* pump) {
   assert(diffBuf);
-  assert(lPump);
-
-  // decode the block
-  for (int i = 0; i < 64; i++) {
-    const int len = mHuff[i > 0][0].decodeLength(*lPump);
-    const int index = mHuff[i > 0][1].decodeLength(*iPump);
-    assert(len >= 0 && index >= 0);
-
-    if (len == 0 && index == 0 && i)
-      break;
-
-    if (len == 0xf && index == 0xf)
-      continue;
-
-    i += index;
-
-    if (len == 0)
+  assert(pump);
+
+  // Each code skips some samples, and then gives the difference of the next
+  // one, which is only stored if it is still within the block.
+  int i = 0;
+
+  const auto decodeOne = [diffBuf, pump, &i](const Tree& t) {
+    const int s = t.decodeSymbol(pump);
+    if (t.skips[s] == Tree::EndOfBlock)
+      return false;
+
+    i += t.skips[s];
+    if (const int len = t.lens[s]) {
+      const int diff = pump->getBitsNoFill(len);
+      if (i < 64)
+        (*diffBuf)[i] = AbstractHuffmanTable::signExtended(diff, len);
+    }
+    i++;
+    return true;
+  };
+
+  // The first sample has a tree of its own, that can not end the block.
+  decodeOne(mHuff[0]);
+
+  const Tree& t = mHuff[1];
+  while (i < 64) {
+    pump->fill(32);
+    const Tree::Entry& e = t.lookup[pump->peekBitsNoFill(Tree::LookupDepth)];
+    if (!e.count && !e.eob) {
+      if (!decodeOne(t))
+        return;
       continue;
+    }
 
-    int diff = lPump->getBits(len);
-    iPump->fill(len);
-    iPump->skipBits(len);
-
-    if (i >= 64)
-      break;
-
-    diff = HuffmanTable::signExtended(diff, len);
+    for (int k = 0; k < e.count; k++) {
+      i += e.skips[k];
+      if (i < 64)
+        (*diffBuf)[i] = e.diffs[k];
+      i++;
+      if (i >= 64) {
+        pump->skipBitsNoFill(e.bits[k]);
+        return;
+      }
+    }
 
-    (*diffBuf)[i] = diff;
+    pump->skipBitsNoFill(e.bits[e.count + e.eob - 1]);
+    if (e.eob)
+      return;
   }
 }
 
@@ -255,8 +434,8 @@ void CrwDecompressor::decompress() {
     const unsigned hBlocks = height * width / 64;
     assert(hBlocks > 0);
 
-    BitPumpJPEG lPump(rawInput);
-    BitPumpJPEG iPump(rawInput);
+    BitPumpJPEG pump(rawInput);
+    const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
 
     int carry = 0;
     std::array<int, 2> base;
@@ -267,7 +446,7 @@ void CrwDecompressor::decompress() {
 
     for (unsigned block = 0; block < hBlocks; block++) {
       array<int, 64> diffBuf = {{}};
-      decodeBlock(&diffBuf, mHuff, &lPump, &iPump);
+      decodeBlock(&diffBuf, mHuff, &pump);
 
       // predict and output the block
 
@@ -279,7 +458,9 @@ void CrwDecompressor::decompress() {
           // new line. sadly, does not always happen when k == 0.
           i = 0;
 
-          dest = reinterpret_cast<ushort16*>(mRaw->getData(0, j));
+          mRaw->checkCancelled();
+
+          dest = out[j];
 
           j++;
           base[0] = base[1] = 512;
@@ -301,35 +482,30 @@ void CrwDecompressor::decompress() {
     assert(i == width);
   }
 
-  // Add the uncompressed 2 low bits to the decoded 8 high bits
-  if (lowbits) {
-    assert(width > 0);
-    assert(width % 4 == 0);
-    assert(height > 0);
+  // Add the uncompressed 2 low bits to the decoded 8 high bits. Each row
+  // has its own bytes of them.
+  if (lowbits)
+    parallelFor(0, height, [this](int row) { mergeLowBits(row); });
+}
 
-    for (uint32 j = 0; j < height; j++) {
-      auto* dest = reinterpret_cast<ushort16*>(mRaw->getData(0, j));
+void CrwDecompressor::mergeLowBits(int row) const {
+  const int width = mRaw->dim.x;
+  assert(width % 4 == 0);
 
-      assert(width % 4 == 0);
-      for (uint32 i = 0; i < width; /* NOTE: i += 4 */) {
-        const uchar8 c = lowbitInput.getByte();
-        // LSB-packed: p3 << 6 | p2 << 4 | p1 << 2 | p0 << 0
+  // Each block is 4 pairs of 2 bits, so we have 1 block per 4 pixels
+  ByteStream in = lowbitInput;
+  in.skipBytes(row * width / 4);
+  const uchar8* low = in.peekData(width / 4);
 
-        // We have read 8 bits, which is 4 pairs of 2 bits. So process 4 pixels.
-        for (uint32 p = 0; p < 4; p++) {
-          ushort16 low = (c >> (2 * p)) & 0b11;
-          ushort16 val = (*dest << 2) | low;
+  ushort16* dest = mRaw->getU16DataAsCroppedArray2DRef()[row];
+  const bool fix = width == 2672;
 
-          if (width == 2672 && val < 512)
-            val += 2; // No idea why this is needed
+#ifdef WITH_SSE2
+  if (Cpuid::SSE2())
+    return mergeLowBitsRow_SSE2(low, dest, width, fix);
+#endif
 
-          *dest = val;
-          i++;
-          dest++;
-        }
-      }
-    }
-  }
+  mergeLowBitsRow_Scalar(low, dest, width, fix);
 }
 
 } // namespace rawspeed
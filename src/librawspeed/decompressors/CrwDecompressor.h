@@ -25,18 +25,68 @@
 #include "common/Common.h"                      // for uchar8, uint32
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
-#include "decompressors/HuffmanTable.h"         // for HuffmanTable
 #include "io/BitPumpJPEG.h"                     // for BitPumpJPEG
 #include "io/ByteStream.h"                      // for ByteStream
 #include <array>                                // for array
+#include <vector>                               // for vector
 
 namespace rawspeed {
 
 class CrwDecompressor final : public AbstractDecompressor {
-  using crw_hts = std::array<std::array<HuffmanTable, 2>, 2>;
+  // One of the two code trees of a table. Each code stands for two values:
+  // the length of the difference bits that follow it, and the number of
+  // the samples to skip before that difference.
+  class Tree final {
+  public:
+    static constexpr unsigned LookupDepth = 11;
+    static constexpr unsigned MaxPairs = 3;
+
+    // The skip of the code that ends the block.
+    static constexpr uchar8 EndOfBlock = 0xff;
+
+    struct Entry final {
+      // The first code of the LookupDepth bits, and its symbol. code_len is 0
+      // if it is longer than that.
+      uchar8 code_len;
+      uchar8 symbol;
+
+      // How many whole (code + difference) pairs fit into the LookupDepth
+      // bits, and whether they are followed by the end of the block.
+      uchar8 count;
+      bool eob;
+
+      // bits[i] is the number of bits used by the first i+1 pairs, or by the
+      // end of the block that follows the last one.
+      std::array<uchar8, MaxPairs + 1> bits;
+      std::array<uchar8, MaxPairs> skips;
+      std::array<short16, MaxPairs> diffs;
+    };
+
+    // Per symbol. The code that is 0xf for both of them is a 0 for both.
+    std::vector<uchar8> lens;
+    std::vector<uchar8> skips;
+
+    // The codes that are longer than LookupDepth are decoded bit by bit.
+    // Both are indexed by the code length.
+    std::array<int, 17> maxCode;
+    std::array<int, 17> codeOffset;
+
+    std::vector<Entry> lookup;
+
+    // The code that is 0 for both ends the block, unless this is the tree
+    // of the first sample.
+    Tree(const uchar8* ncpl, const uchar8* len, const uchar8* index,
+         bool hasEndOfBlock);
+
+    // The symbol of the next code. The pump is then still filled for the
+    // difference bits.
+    inline int decodeSymbol(BitPumpJPEG* pump) const;
+  };
+
+  using crw_hts = std::array<Tree, 2>;
 
   RawImage mRaw;
-  crw_hts mHuff;
+  const crw_hts& mHuff;
   const bool lowbits;
 
   ByteStream lowbitInput;
@@ -49,12 +99,13 @@ public:
   void decompress();
 
 private:
-  static HuffmanTable makeDecoder(const uchar8* ncpl, const uchar8* values);
   static crw_hts initHuffTables(uint32 table);
+  static const crw_hts& getHuffTables(uint32 table);
 
   inline static void decodeBlock(std::array<int, 64>* diffBuf,
-                                 const crw_hts& mHuff, BitPumpJPEG* lPump,
-                                 BitPumpJPEG* iPump);
+                                 const crw_hts& mHuff, BitPumpJPEG* pump);
+
+  void mergeLowBits(int row) const;
 };
 
 } // namespace rawspeed
@@ -23,49 +23,88 @@
 #ifdef HAVE_ZLIB
 
 #include "decompressors/DeflateDecompressor.h"
+#include "common/Array2DRef.h"            // for Array2DRef
 #include "common/Common.h"                // for uint32, ushort16
+#include "common/Cpuid.h"                 // for Cpuid
 #include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "io/Endianness.h"                // for getHostEndianness, Endiann...
+#include <algorithm>                      // for max
+#include <array>                          // for array
 #include <cassert>                        // for assert
 #include <cstdio>                         // for size_t
+#include <memory>                         // for unique_ptr, make_unique
 #include <zlib.h>
 
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128i, _mm_add_epi8
+#include <tmmintrin.h> // for _mm_shuffle_epi8
+#endif
+
+#ifdef WITH_AVX2
+#include <immintrin.h> // for __m256i, _mm256_cvtph_ps
+#endif
+
+#ifdef WITH_NEON
+#include <arm_neon.h> // for uint8x16x4_t, vst4q_u8
+#endif
+
 namespace rawspeed {
 
 // decodeFPDeltaRow(): MIT License, copyright 2014 Javier Celaya
 // <jcelaya@gmail.com>
-static inline void decodeFPDeltaRow(unsigned char* src, unsigned char* dst,
-                                    size_t tileWidth, size_t realTileWidth,
-                                    unsigned int bytesps, int factor) {
-  // DecodeDeltaBytes
-  for (size_t col = factor; col < realTileWidth * bytesps; ++col) {
-    // Yes, this is correct, and is symmetrical with EncodeDeltaBytes in
-    // hdrmerge, and they both combined are lossless.
-    // This is indeed working in modulo-2^n arighmetics.
+// The delta decoding is split out of it, the bytes are reordered and expanded
+// in decodeFPRow() below.
+template <int factor>
+static inline void decodeDeltaBytes(unsigned char* src, size_t begin,
+                                    size_t size) {
+  // Yes, this is correct, and is symmetrical with EncodeDeltaBytes in
+  // hdrmerge, and they both combined are lossless.
+  // This is indeed working in modulo-2^n arighmetics.
+  for (size_t col = std::max<size_t>(begin, factor); col < size; ++col)
     src[col] = static_cast<unsigned char>(src[col] + src[col - factor]);
+}
+
+#ifdef WITH_SSE2
+// The deltas are the prefix sums of the factor interleaved byte sequences.
+// Within a vector, they take log2(16 / factor) shifted adds, and then the
+// last sums of the previous vector are added to all of it.
+template <int factor>
+static __attribute__((target("ssse3"))) void
+decodeDeltaBytes_SSSE3(unsigned char* src, size_t size) {
+  static_assert(factor == 1 || factor == 2 || factor == 4, "bad factor");
+
+  std::array<char, 16> last;
+  for (int i = 0; i < 16; i++)
+    last[i] = static_cast<char>(16 - factor + i % factor);
+  const __m128i lastSums =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(last.data()));
+
+  __m128i carry = _mm_setzero_si128();
+  size_t col = 0;
+  for (; col + 16 <= size; col += 16) {
+    auto* p = reinterpret_cast<__m128i*>(src + col);
+    __m128i x = _mm_loadu_si128(p);
+    if (factor == 1)
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+    if (factor <= 2)
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi8(x, carry);
+    _mm_storeu_si128(p, x);
+    carry = _mm_shuffle_epi8(x, lastSums);
   }
-  // Reorder bytes into the image
-  // 16 and 32-bit versions depend on local architecture, 24-bit does not
-  if (bytesps == 3) {
-    for (size_t col = 0; col < tileWidth; ++col) {
-      dst[col * 3] = src[col];
-      dst[col * 3 + 1] = src[col + realTileWidth];
-      dst[col * 3 + 2] = src[col + realTileWidth * 2];
-    }
-  } else {
-    if (getHostEndianness() == Endianness::little) {
-      for (size_t col = 0; col < tileWidth; ++col) {
-        for (size_t byte = 0; byte < bytesps; ++byte)
-          dst[col * bytesps + byte] =
-              src[col + realTileWidth * (bytesps - byte - 1)];
-      }
-    } else {
-      for (size_t col = 0; col < tileWidth; ++col) {
-        for (size_t byte = 0; byte < bytesps; ++byte)
-          dst[col * bytesps + byte] = src[col + realTileWidth * byte];
-      }
-    }
-  }
+
+  decodeDeltaBytes<factor>(src, col, size);
+}
+#endif
+
+template <int factor>
+static void decodeDeltaRow(unsigned char* src, size_t size) {
+#ifdef WITH_SSE2
+  if (Cpuid::SSSE3())
+    return decodeDeltaBytes_SSSE3<factor>(src, size);
+#endif
+  decodeDeltaBytes<factor>(src, 0, size);
 }
 
 static inline uint32 __attribute__((const)) fp16ToFloat(ushort16 fp16) {
@@ -186,23 +225,369 @@ static inline void expandFP24(unsigned char* dst, int width) {
   }
 }
 
-void DeflateDecompressor::decode(
-    std::unique_ptr<unsigned char[]>* uBuffer, // NOLINT
-    int tileWidthMax, int tileHeightMax, int width, int height, uint32 offX,
-    uint32 offY) {
-  uLongf dstLen = sizeof(float) * tileWidthMax * tileHeightMax;
+template <int bytesps> static inline uint32 expandFP(uint32 v) {
+  switch (bytesps) {
+  case 2:
+    return fp16ToFloat(v);
+  case 3:
+    return fp24ToFloat(v);
+  default:
+    return v;
+  }
+}
+
+// The delta-decoded row holds the bytes of the values as planes, the most
+// significant one first. They are gathered and expanded straight into the
+// image, in one pass. The kernels all produce the same result, and return
+// the number of the columns they have done, the rest is left to the plain
+// loop.
+using FPRowFunction = size_t (*)(const unsigned char* src, uint32* dst,
+                                 size_t tileWidth, size_t realTileWidth);
+
+template <int bytesps>
+static size_t decodeFPRow_plain(const unsigned char* src, uint32* dst,
+                                size_t tileWidth, size_t realTileWidth) {
+  for (size_t col = 0; col < tileWidth; ++col) {
+    uint32 v = 0;
+    for (int byte = 0; byte < bytesps; ++byte)
+      v = (v << 8) | src[col + realTileWidth * byte];
+    dst[col] = expandFP<bytesps>(v);
+  }
+  return tileWidth;
+}
+
+// The vector kernels rebias the normal numbers only. Any vector with a zero,
+// subnormal, infinity or NaN in it is expanded by the scalar code instead.
+template <int bytesps> struct FPFormat {
+  static constexpr int Bits = 8 * bytesps;
+  static constexpr int FractionBits = bytesps == 2 ? 10 : 16;
+  static constexpr uint32 ExponentMask = (1U << (Bits - 1)) - 1U -
+                                         ((1U << FractionBits) - 1U);
+  static constexpr int Rebias = bytesps == 2 ? 127 - 15 : 127 - 63;
+};
+
+template <int bytesps> static inline void expandFPScalar(uint32* dst, int n) {
+  for (int i = 0; i < n; i++)
+    dst[i] = expandFP<bytesps>(dst[i]);
+}
+
+#ifdef WITH_SSE2
+template <int bytesps>
+static inline bool __attribute__((target("sse2")))
+expandFP_SSE2(__m128i v, __m128i* out) {
+  using F = FPFormat<bytesps>;
+  const __m128i expMask = _mm_set1_epi32(F::ExponentMask);
+  const __m128i exp = _mm_and_si128(v, expMask);
+  const __m128i special =
+      _mm_or_si128(_mm_cmpeq_epi32(exp, _mm_setzero_si128()),
+                   _mm_cmpeq_epi32(exp, expMask));
+  if (_mm_movemask_epi8(special))
+    return false;
+
+  // The exponent and the fraction are shifted into place together.
+  const __m128i sign = _mm_slli_epi32(_mm_srli_epi32(v, F::Bits - 1), 31);
+  const __m128i magnitude =
+      _mm_and_si128(v, _mm_set1_epi32((1U << (F::Bits - 1)) - 1U));
+  *out = _mm_or_si128(
+      sign, _mm_add_epi32(_mm_slli_epi32(magnitude, 23 - F::FractionBits),
+                          _mm_set1_epi32(F::Rebias << 23)));
+  return true;
+}
+
+// 16 pixels at a time. The planes are interleaved, the least significant
+// one first, filling the missing ones with zeros.
+template <int bytesps>
+static size_t __attribute__((target("sse2")))
+decodeFPRow_SSE2(const unsigned char* src, uint32* dst, size_t tileWidth,
+                 size_t realTileWidth) {
+  const auto plane = [src, realTileWidth](int byte, size_t col) {
+    if (byte < 0)
+      return _mm_setzero_si128();
+    return _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(src + col + realTileWidth * byte));
+  };
+
+  size_t col = 0;
+  for (; col + 16 <= tileWidth; col += 16) {
+    const __m128i b0 = plane(bytesps - 1, col);
+    const __m128i b1 = plane(bytesps - 2, col);
+    const __m128i b2 = plane(bytesps - 3, col);
+    const __m128i b3 = plane(bytesps - 4, col);
+
+    const __m128i lo01 = _mm_unpacklo_epi8(b0, b1);
+    const __m128i hi01 = _mm_unpackhi_epi8(b0, b1);
+    const __m128i lo23 = _mm_unpacklo_epi8(b2, b3);
+    const __m128i hi23 = _mm_unpackhi_epi8(b2, b3);
+    const __m128i v[4] = {
+        _mm_unpacklo_epi16(lo01, lo23), _mm_unpackhi_epi16(lo01, lo23),
+        _mm_unpacklo_epi16(hi01, hi23), _mm_unpackhi_epi16(hi01, hi23)};
+
+    for (int i = 0; i < 4; i++) {
+      auto* out = reinterpret_cast<__m128i*>(dst + col + 4 * i);
+      __m128i f = v[i];
+      if (bytesps == 4 || expandFP_SSE2<bytesps>(v[i], &f)) {
+        _mm_storeu_si128(out, f);
+        continue;
+      }
+      _mm_storeu_si128(out, v[i]);
+      expandFPScalar<bytesps>(dst + col + 4 * i, 4);
+    }
+  }
+  return col;
+}
+#endif
 
-  if (!uBuffer->get())
-    *uBuffer =
-        std::unique_ptr<unsigned char[]>(new unsigned char[dstLen]); // NOLINT
+#ifdef WITH_AVX2
+template <int bytesps>
+static inline bool __attribute__((target("avx2")))
+expandFP_AVX2(__m256i v, __m256i* out) {
+  using F = FPFormat<bytesps>;
+  const __m256i expMask = _mm256_set1_epi32(F::ExponentMask);
+  const __m256i exp = _mm256_and_si256(v, expMask);
+  const __m256i special =
+      _mm256_or_si256(_mm256_cmpeq_epi32(exp, _mm256_setzero_si256()),
+                      _mm256_cmpeq_epi32(exp, expMask));
+  if (_mm256_movemask_epi8(special))
+    return false;
+
+  const __m256i sign =
+      _mm256_slli_epi32(_mm256_srli_epi32(v, F::Bits - 1), 31);
+  const __m256i magnitude =
+      _mm256_and_si256(v, _mm256_set1_epi32((1U << (F::Bits - 1)) - 1U));
+  *out = _mm256_or_si256(
+      sign,
+      _mm256_add_epi32(_mm256_slli_epi32(magnitude, 23 - F::FractionBits),
+                       _mm256_set1_epi32(F::Rebias << 23)));
+  return true;
+}
+
+// Not a lambda, which would not get the target of the function around it.
+static inline __m256i __attribute__((target("avx2")))
+loadPlane_AVX2(const unsigned char* src, size_t realTileWidth, int byte,
+               size_t col) {
+  if (byte < 0)
+    return _mm256_setzero_si256();
+  return _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(src + col + realTileWidth * byte));
+}
+
+// 32 pixels at a time. The unpacking works within the 128-bit lanes, so the
+// second half of the pixels ends up in the upper lanes, and is permuted back
+// into place. The half floats are converted by F16C, which handles all of
+// them exactly.
+template <int bytesps>
+static size_t __attribute__((target("avx2,f16c")))
+decodeFPRow_AVX2(const unsigned char* src, uint32* dst, size_t tileWidth,
+                 size_t realTileWidth) {
+  size_t col = 0;
+  for (; col + 32 <= tileWidth; col += 32) {
+    const __m256i b0 = loadPlane_AVX2(src, realTileWidth, bytesps - 1, col);
+    const __m256i b1 = loadPlane_AVX2(src, realTileWidth, bytesps - 2, col);
+    const __m256i lo01 = _mm256_unpacklo_epi8(b0, b1);
+    const __m256i hi01 = _mm256_unpackhi_epi8(b0, b1);
+
+    auto* out = reinterpret_cast<__m256i*>(dst + col);
+    if (bytesps == 2) {
+      // Pixels 0..7 | 16..23, and 8..15 | 24..31.
+      _mm256_storeu_si256(out, _mm256_castps_si256(_mm256_cvtph_ps(
+                                   _mm256_castsi256_si128(lo01))));
+      _mm256_storeu_si256(out + 1, _mm256_castps_si256(_mm256_cvtph_ps(
+                                       _mm256_castsi256_si128(hi01))));
+      _mm256_storeu_si256(out + 2, _mm256_castps_si256(_mm256_cvtph_ps(
+                                       _mm256_extracti128_si256(lo01, 1))));
+      _mm256_storeu_si256(out + 3, _mm256_castps_si256(_mm256_cvtph_ps(
+                                       _mm256_extracti128_si256(hi01, 1))));
+      continue;
+    }
+
+    const __m256i b2 = loadPlane_AVX2(src, realTileWidth, bytesps - 3, col);
+    const __m256i b3 = loadPlane_AVX2(src, realTileWidth, bytesps - 4, col);
+    const __m256i lo23 = _mm256_unpacklo_epi8(b2, b3);
+    const __m256i hi23 = _mm256_unpackhi_epi8(b2, b3);
+    const __m256i v0 = _mm256_unpacklo_epi16(lo01, lo23);
+    const __m256i v1 = _mm256_unpackhi_epi16(lo01, lo23);
+    const __m256i v2 = _mm256_unpacklo_epi16(hi01, hi23);
+    const __m256i v3 = _mm256_unpackhi_epi16(hi01, hi23);
+    const __m256i v[4] = {_mm256_permute2x128_si256(v0, v1, 0x20),
+                          _mm256_permute2x128_si256(v2, v3, 0x20),
+                          _mm256_permute2x128_si256(v0, v1, 0x31),
+                          _mm256_permute2x128_si256(v2, v3, 0x31)};
+
+    for (int i = 0; i < 4; i++) {
+      __m256i f = v[i];
+      if (bytesps == 4 || expandFP_AVX2<bytesps>(v[i], &f)) {
+        _mm256_storeu_si256(out + i, f);
+        continue;
+      }
+      _mm256_storeu_si256(out + i, v[i]);
+      expandFPScalar<bytesps>(dst + col + 8 * i, 8);
+    }
+  }
+  return col;
+}
+#endif
+
+#ifdef WITH_NEON
+// 16 pixels at a time. The interleaving store puts the planes into place,
+// the least significant one first.
+template <int bytesps>
+static size_t decodeFPRow_NEON(const unsigned char* src, uint32* dst,
+                               size_t tileWidth, size_t realTileWidth) {
+  using F = FPFormat<bytesps>;
+  const uint32x4_t expMask = vdupq_n_u32(F::ExponentMask);
+  const uint32x4_t magnitudeMask = vdupq_n_u32((1U << (F::Bits - 1)) - 1U);
+  const uint32x4_t rebias = vdupq_n_u32(F::Rebias << 23);
+
+  size_t col = 0;
+  for (; col + 16 <= tileWidth; col += 16) {
+    uint8x16x4_t b;
+    for (int byte = 0; byte < 4; byte++) {
+      const int p = bytesps - 1 - byte;
+      b.val[byte] =
+          p < 0 ? vdupq_n_u8(0) : vld1q_u8(src + col + realTileWidth * p);
+    }
+    vst4q_u8(reinterpret_cast<uint8_t*>(dst + col), b);
+    if (bytesps == 4)
+      continue;
+
+    for (int i = 0; i < 4; i++) {
+      uint32* out = dst + col + 4 * i;
+      const uint32x4_t v = vld1q_u32(out);
+      const uint32x4_t exp = vandq_u32(v, expMask);
+      const uint32x4_t special =
+          vorrq_u32(vceqq_u32(exp, vdupq_n_u32(0)), vceqq_u32(exp, expMask));
+      const uint64x2_t any = vreinterpretq_u64_u32(special);
+      if (vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) {
+        expandFPScalar<bytesps>(out, 4);
+        continue;
+      }
+
+      const uint32x4_t sign = vshlq_n_u32(vshrq_n_u32(v, F::Bits - 1), 31);
+      const uint32x4_t magnitude = vshlq_n_u32(vandq_u32(v, magnitudeMask),
+                                               23 - F::FractionBits);
+      vst1q_u32(out, vorrq_u32(sign, vaddq_u32(magnitude, rebias)));
+    }
+  }
+  return col;
+}
+#endif
+
+template <int bytesps> static FPRowFunction getFPRowFunction() {
+#ifdef WITH_AVX2
+  if (Cpuid::AVX2() && Cpuid::F16C())
+    return decodeFPRow_AVX2<bytesps>;
+#endif
+#ifdef WITH_SSE2
+  if (Cpuid::SSE2())
+    return decodeFPRow_SSE2<bytesps>;
+#endif
+#ifdef WITH_NEON
+  if (Cpuid::NEON())
+    return decodeFPRow_NEON<bytesps>;
+#endif
+  return decodeFPRow_plain<bytesps>;
+}
+
+static FPRowFunction getFPRowFunction(int bytesps) {
+  switch (bytesps) {
+  case 2:
+    return getFPRowFunction<2>();
+  case 3:
+    return getFPRowFunction<3>();
+  case 4:
+    return getFPRowFunction<4>();
+  default:
+    __builtin_unreachable();
+  }
+}
+
+template <int bytesps>
+static void decodeFPRowTail(const unsigned char* src, uint32* dst, size_t col,
+                            size_t tileWidth, size_t realTileWidth) {
+  decodeFPRow_plain<bytesps>(src + col, dst + col, tileWidth - col,
+                             realTileWidth);
+}
+
+template <int factor>
+static void decodeFPDeltaRow(unsigned char* src, uint32* dst, size_t tileWidth,
+                             size_t realTileWidth, int bytesps,
+                             FPRowFunction decodeFPRow) {
+  decodeDeltaRow<factor>(src, realTileWidth * bytesps);
+
+  const size_t col = decodeFPRow(src, dst, tileWidth, realTileWidth);
+  switch (bytesps) {
+  case 2:
+    decodeFPRowTail<2>(src, dst, col, tileWidth, realTileWidth);
+    break;
+  case 3:
+    decodeFPRowTail<3>(src, dst, col, tileWidth, realTileWidth);
+    break;
+  case 4:
+    decodeFPRowTail<4>(src, dst, col, tileWidth, realTileWidth);
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
+
+// Set up on the first tile, and only reset for the following ones.
+struct DeflateDecompressor::ThreadState::Inflater final : z_stream {
+  Inflater() : z_stream() {
+    const int err = inflateInit(this);
+    if (err != Z_OK)
+      ThrowRDE("failed to uncompress tile: %d (%s)", err, zError(err));
+  }
+  Inflater(const Inflater&) = delete;
+  Inflater& operator=(const Inflater&) = delete;
+  ~Inflater() { inflateEnd(this); }
+
+  // A new stream, which starts at in.
+  void reset(const unsigned char* in, uInt size) {
+    const int err = inflateReset(this);
+    if (err != Z_OK)
+      ThrowRDE("failed to uncompress tile: %d (%s)", err, zError(err));
+    next_in = const_cast<Bytef*>(in); // NOLINT zlib does not write to it
+    avail_in = size;
+  }
+
+  // Fills the whole of out, or throws.
+  void read(unsigned char* out, uInt size) {
+    next_out = out;
+    avail_out = size;
+    while (avail_out != 0) {
+      const int err = inflate(this, Z_NO_FLUSH);
+      if (err == Z_STREAM_END && avail_out != 0)
+        ThrowRDE("failed to uncompress tile: the data ends too early");
+      if (err != Z_OK && err != Z_STREAM_END)
+        ThrowRDE("failed to uncompress tile: %d (%s)", err, zError(err));
+    }
+  }
+};
+
+DeflateDecompressor::ThreadState::ThreadState() = default;
+
+DeflateDecompressor::ThreadState::~ThreadState() = default;
+
+void DeflateDecompressor::decode(ThreadState* state, int tileWidthMax,
+                                 int tileHeightMax, int width, int height,
+                                 uint32 offX, uint32 offY) {
+  // The tile is inflated one row at a time, into a buffer that fits into the
+  // cache, and each row is decoded into the image right away.
+  const uInt rowLen = sizeof(float) * tileWidthMax;
+
+  if (state->rowSize < rowLen) {
+    state->row =
+        std::unique_ptr<unsigned char[]>(new unsigned char[rowLen]); // NOLINT
+    state->rowSize = rowLen;
+  }
 
   const auto cSize = input.getRemainSize();
   const unsigned char* cBuffer = input.getData(cSize);
 
-  int err = uncompress(uBuffer->get(), &dstLen, cBuffer, cSize);
-  if (err != Z_OK) {
-    ThrowRDE("failed to uncompress tile: %d (%s)", err, zError(err));
-  }
+  if (!state->inflater)
+    state->inflater = std::make_unique<ThreadState::Inflater>();
+  ThreadState::Inflater& strm = *state->inflater;
+  strm.reset(cBuffer, cSize);
 
   int predFactor = 0;
   switch (predictor) {
@@ -221,17 +606,37 @@ void DeflateDecompressor::decode(
   }
 
   int bytesps = bps / 8;
+  assert(bytesps >= 2 && bytesps <= 4);
 
-  for (auto row = 0; row < height; ++row) {
-    unsigned char* src = uBuffer->get() + row * tileWidthMax * bytesps;
-    unsigned char* dst =
-        static_cast<unsigned char*>(mRaw->getData()) +
-        ((offY + row) * mRaw->pitch + offX * sizeof(float) * mRaw->getCpp());
+  const FPRowFunction decodeFPRow = getFPRowFunction(bytesps);
+  const Array2DRef<float> out(mRaw->getF32DataAsCroppedArray2DRef());
 
-    if (predFactor)
-      decodeFPDeltaRow(src, dst, width, tileWidthMax, bytesps, predFactor);
+  for (auto row = 0; row < height; ++row) {
+    mRaw->checkCancelled();
+    unsigned char* src = state->row.get();
+    strm.read(src, tileWidthMax * bytesps);
+
+    float* dstF = &out(offX * mRaw->getCpp(), offY + row);
+    unsigned char* dst = reinterpret_cast<unsigned char*>(dstF);
+    auto* dst32 = reinterpret_cast<uint32*>(dstF);
+
+    switch (predFactor) {
+    case 1:
+      decodeFPDeltaRow<1>(src, dst32, width, tileWidthMax, bytesps,
+                          decodeFPRow);
+      continue;
+    case 2:
+      decodeFPDeltaRow<2>(src, dst32, width, tileWidthMax, bytesps,
+                          decodeFPRow);
+      continue;
+    case 4:
+      decodeFPDeltaRow<4>(src, dst32, width, tileWidthMax, bytesps,
+                          decodeFPRow);
+      continue;
+    default:
+      break;
+    }
 
-    assert(bytesps >= 2 && bytesps <= 4);
     switch (bytesps) {
     case 2:
       expandFP16(dst, width);
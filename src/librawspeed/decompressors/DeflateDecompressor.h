@@ -40,13 +40,31 @@ class DeflateDecompressor final : public AbstractDecompressor {
   int bps;
 
 public:
+  // What a thread keeps from one tile to the next: the buffer of a row, and
+  // the inflate state, which then only has to be reset for the next tile,
+  // instead of being set up again, with its 32 KiB window, for each one.
+  class ThreadState final {
+    struct Inflater;
+
+    std::unique_ptr<unsigned char[]> row; // NOLINT
+    uint32 rowSize = 0;
+    std::unique_ptr<Inflater> inflater;
+
+    friend class DeflateDecompressor;
+
+  public:
+    ThreadState();
+    ThreadState(const ThreadState&) = delete;
+    ThreadState& operator=(const ThreadState&) = delete;
+    ~ThreadState();
+  };
+
   DeflateDecompressor(ByteStream bs, const RawImage& img, int predictor_,
                       int bps_)
       : input(std::move(bs)), mRaw(img), predictor(predictor_), bps(bps_) {}
 
-  void decode(std::unique_ptr<unsigned char[]>* uBuffer, // NOLINT
-              int tileWidthMax, int tileHeightMax, int width, int height,
-              uint32 offX, uint32 offY);
+  void decode(ThreadState* state, int tileWidthMax, int tileHeightMax,
+              int width, int height, uint32 offX, uint32 offY);
 };
 
 } // namespace rawspeed
@@ -23,16 +23,25 @@
 
 #include "rawspeedconfig.h"
 #include "decompressors/FujiDecompressor.h"
+#include "common/Array2DRef.h"            // for Array2DRef
 #include "common/Common.h"                // for ushort16
+#include "common/Executor.h"              // for parallelForDynamic, Dynam...
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage
+#include "common/Trace.h"                 // for RAWSPEED_TRACE_SCOPE
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/Endianness.h"                // for Endianness
 #include "metadata/ColorFilterArray.h"    // for CFA_BLUE
-#include <algorithm>                      // for fill, min
+#include <algorithm>                      // for fill, min, stable_sort
+#include <cassert>                        // for assert
 #include <cmath>                          // for abs
 #include <cstdlib>                        // for abs, size_t
 #include <cstring>                        // for memcpy
+#include <map>                            // for map
+#include <memory>                         // for shared_ptr, make_shared
+#include <mutex>                          // for mutex, lock_guard
+#include <numeric>                        // for iota
+#include <vector>                         // for vector
 
 namespace rawspeed {
 
@@ -74,34 +83,23 @@ FujiDecompressor::FujiDecompressor(const RawImage& img, ByteStream input_)
   fuji_compressed_load_raw();
 }
 
-FujiDecompressor::fuji_compressed_params::fuji_compressed_params(
-    const FujiDecompressor& d) {
-  int cur_val;
-  char* qt;
-
-  if ((d.header.block_size % 3 && d.header.raw_type == 16) ||
-      (d.header.block_size & 1 && d.header.raw_type == 0)) {
-    ThrowRDE("fuji_block_checks");
-  }
-
-  q_table.resize(32768);
-
-  if (d.header.raw_type == 16) {
-    line_width = (d.header.block_size * 2) / 3;
-  } else {
-    line_width = d.header.block_size >> 1;
-  }
+// The table only depends on the q_point, i.e. on the raw_bits, so it is
+// built once per process for each of them.
+static std::shared_ptr<const std::vector<char>>
+getQuantTable(const std::array<int, 5>& q_point) {
+  static std::mutex mutex;
+  static std::map<int, std::shared_ptr<const std::vector<char>>> tables;
 
-  q_point[0] = 0;
-  q_point[1] = 0x12;
-  q_point[2] = 0x43;
-  q_point[3] = 0x114;
-  q_point[4] = (1 << d.header.raw_bits) - 1;
-  min_value = 0x40;
+  std::lock_guard<std::mutex> guard(mutex);
+  auto& table = tables[q_point[4]];
+  if (table)
+    return table;
 
-  cur_val = -q_point[4];
+  auto q_table = std::make_shared<std::vector<char>>(32768);
+  assert(2 * q_point[4] + 1 <= static_cast<int>(q_table->size()));
 
-  for (qt = &q_table[0]; cur_val <= q_point[4]; ++qt, ++cur_val) {
+  int cur_val = -q_point[4];
+  for (char* qt = &(*q_table)[0]; cur_val <= q_point[4]; ++qt, ++cur_val) {
     if (cur_val <= -q_point[3]) {
       *qt = -4;
     } else if (cur_val <= -q_point[2]) {
@@ -123,6 +121,30 @@ FujiDecompressor::fuji_compressed_params::fuji_compressed_params(
     }
   }
 
+  table = std::move(q_table);
+  return table;
+}
+
+FujiDecompressor::fuji_compressed_params::fuji_compressed_params(
+    const FujiDecompressor& d) {
+  if ((d.header.block_size % 3 && d.header.raw_type == 16) ||
+      (d.header.block_size & 1 && d.header.raw_type == 0)) {
+    ThrowRDE("fuji_block_checks");
+  }
+
+  if (d.header.raw_type == 16) {
+    line_width = (d.header.block_size * 2) / 3;
+  } else {
+    line_width = d.header.block_size >> 1;
+  }
+
+  q_point[0] = 0;
+  q_point[1] = 0x12;
+  q_point[2] = 0x43;
+  q_point[3] = 0x114;
+  q_point[4] = (1 << d.header.raw_bits) - 1;
+  min_value = 0x40;
+
   // populting gradients
   if (q_point[4] == 0x3FFF) {
     total_values = 0x4000;
@@ -142,6 +164,8 @@ FujiDecompressor::fuji_compressed_params::fuji_compressed_params(
   } else {
     ThrowRDE("FUJI q_point");
   }
+
+  q_table = getQuantTable(q_point);
 }
 
 void FujiDecompressor::fuji_compressed_block::reset(
@@ -169,7 +193,7 @@ void FujiDecompressor::fuji_compressed_block::reset(
   }
 }
 
-template <typename T>
+template <int Step, typename T>
 void FujiDecompressor::copy_line(fuji_compressed_block* info,
                                  const FujiStrip& strip, int cur_line,
                                  T&& idx) const {
@@ -186,14 +210,25 @@ void FujiDecompressor::copy_line(fuji_compressed_block* info,
     lineBufG[i] = info->linebuf[_G2 + i] + 1;
   }
 
+  // Both the CFA and the index repeat every 6 pixels, with the index
+  // advancing by Step each time, so the source of each of the 6 pixels of the
+  // group is only looked up once per row.
+  static constexpr int groupWidth = 6;
+  assert(idx(groupWidth) == Step);
+
+  const int groups = strip.width() / groupWidth;
+  const int tail = strip.width() % groupWidth;
+
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
   for (int row_count = 0; row_count < FujiStrip::lineHeight(); row_count++) {
-    auto* const raw_block_data = reinterpret_cast<ushort16*>(
-        mRaw->getData(strip.offsetX(), strip.offsetY(cur_line) + row_count));
+    ushort16* raw_block_data =
+        &out(strip.offsetX(), strip.offsetY(cur_line) + row_count);
 
-    for (int pixel_count = 0; pixel_count < strip.width(); pixel_count++) {
-      ushort16* line_buf = nullptr;
+    std::array<const ushort16*, groupWidth> src;
+    for (int pixel_count = 0; pixel_count < groupWidth; pixel_count++) {
+      const ushort16* line_buf = nullptr;
 
-      switch (CFA[row_count][pixel_count % 6]) {
+      switch (CFA[row_count][pixel_count]) {
       case CFA_RED: // red
         line_buf = lineBufR[row_count >> 1];
         break;
@@ -210,8 +245,16 @@ void FujiDecompressor::copy_line(fuji_compressed_block* info,
         __builtin_unreachable();
       }
 
-      raw_block_data[pixel_count] = line_buf[idx(pixel_count)];
+      src[pixel_count] = line_buf + idx(pixel_count);
+    }
+
+    for (int group = 0; group < groups; group++) {
+      for (int i = 0; i < groupWidth; i++)
+        raw_block_data[i] = src[i][Step * group];
+      raw_block_data += groupWidth;
     }
+    for (int i = 0; i < tail; i++)
+      raw_block_data[i] = src[i][Step * groups];
   }
 }
 
@@ -223,7 +266,7 @@ void FujiDecompressor::copy_line_to_xtrans(fuji_compressed_block* info,
            ((pixel_count % 3) >> 1);
   };
 
-  copy_line(info, strip, cur_line, index);
+  copy_line<4>(info, strip, cur_line, index);
 }
 
 void FujiDecompressor::copy_line_to_bayer(fuji_compressed_block* info,
@@ -231,7 +274,7 @@ void FujiDecompressor::copy_line_to_bayer(fuji_compressed_block* info,
                                           int cur_line) const {
   auto index = [](int pixel_count) { return pixel_count >> 1; };
 
-  copy_line(info, strip, cur_line, index);
+  copy_line<3>(info, strip, cur_line, index);
 }
 
 inline void FujiDecompressor::fuji_zerobits(BitPumpMSB* pump,
@@ -329,7 +372,8 @@ void FujiDecompressor::fuji_decode_sample(
 }
 
 #define fuji_quant_gradient(v1, v2)                                            \
-  (9 * ci.q_table[ci.q_point[4] + (v1)] + ci.q_table[ci.q_point[4] + (v2)])
+  (9 * (*ci.q_table)[ci.q_point[4] + (v1)] +                                   \
+   (*ci.q_table)[ci.q_point[4] + (v2)])
 
 void FujiDecompressor::fuji_decode_sample_even(
     fuji_compressed_block* info, BitPumpMSB* pump, ushort16* line_buf, int* pos,
@@ -738,8 +782,7 @@ void FujiDecompressor::fuji_compressed_load_raw() {
   // read block sizes
   std::vector<uint32> block_sizes;
   block_sizes.resize(header.blocks_in_row);
-  for (auto& block_size : block_sizes)
-    block_size = input.getU32();
+  input.getArray(block_sizes.data(), block_sizes.size());
 
   // some padding?
   const uint64 raw_offset = sizeof(uint32) * header.blocks_in_row;
@@ -758,29 +801,48 @@ void FujiDecompressor::fuji_compressed_load_raw() {
   }
 }
 
-void FujiDecompressor::decompressThread() const noexcept {
-  fuji_compressed_block block_info;
+void FujiDecompressor::decompressThread(const std::vector<int>& order,
+                                        DynamicSchedule* schedule) const
+    noexcept {
+  // One set of the line buffers per thread, only reset between the strips.
+  fuji_compressed_block block_info(mRaw->scratch.get());
 
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto strip = strips.cbegin(); strip < strips.cend(); ++strip) {
+  int i;
+  while (!mRaw->isCancelled() && schedule->getNext(&i)) {
+    RAWSPEED_TRACE_SCOPE("decompressor", "Fuji strip");
     block_info.reset(&common_info);
     try {
-      fuji_decode_strip(&block_info, *strip);
+      fuji_decode_strip(&block_info, strips[order[i]]);
+      strips[order[i]].bs.adviseDone();
     } catch (RawspeedException& err) {
-      // Propagate the exception out of OpenMP magic.
+      // Propagate the exception out of the executor.
       mRaw->setError(err.what());
     }
   }
 }
 
 void FujiDecompressor::decompress() const {
-#ifdef HAVE_OPENMP
-#pragma omp parallel default(none)                                             \
-    num_threads(rawspeed_get_number_of_processor_cores())
-#endif
-  decompressThread();
+  // Each strip is one serial bit stream, with the gradients and the lines of
+  // each line group predicted from the previous one, so the strips are the
+  // smallest units of work. The busiest ones go first, so that the threads
+  // finish at about the same time.
+  std::vector<int> order(strips.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return strips[a].bs.getSize() > strips[b].bs.getSize();
+  });
+
+  // If the file is mapped, have the strips read in ahead of the threads.
+  for (int i : order)
+    strips[i].bs.adviseWillNeed();
+
+  const int64_t work =
+      int64_t(mRaw->getUncroppedDim().area()) * mRaw->getBpp();
+  parallelForDynamic(0, order.size(), work,
+                     [this, &order](DynamicSchedule* schedule) {
+                       decompressThread(order, schedule);
+                     });
+  mRaw->checkCancelled();
 
   std::string firstErr;
   if (mRaw->isTooManyErrors(1, &firstErr)) {
@@ -790,16 +852,18 @@ void FujiDecompressor::decompress() const {
 }
 
 FujiDecompressor::FujiHeader::FujiHeader(ByteStream* bs) {
-  signature = bs->getU16();
-  version = bs->getByte();
-  raw_type = bs->getByte();
-  raw_bits = bs->getByte();
-  raw_height = bs->getU16();
-  raw_rounded_width = bs->getU16();
-  raw_width = bs->getU16();
-  block_size = bs->getU16();
-  blocks_in_row = bs->getByte();
-  total_lines = bs->getU16();
+  ByteStreamCursor in = bs->reserve(16);
+  signature = in.getU16();
+  version = in.getByte();
+  raw_type = in.getByte();
+  raw_bits = in.getByte();
+  raw_height = in.getU16();
+  raw_rounded_width = in.getU16();
+  raw_width = in.getU16();
+  block_size = in.getU16();
+  blocks_in_row = in.getByte();
+  total_lines = in.getU16();
+  assert(in.getRemainSize() == 0);
 }
 
 FujiDecompressor::FujiHeader::operator bool() const {
@@ -23,23 +23,28 @@
 
 #include "common/Common.h"                      // for ushort16
 #include "common/RawImage.h"                    // for RawImage
+#include "common/ScratchArena.h"                // for ScratchAllocator, Scra...
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/BitPumpMSB.h"                      // for BitPumpMSB
 #include "io/ByteStream.h"                      // for ByteStream
 #include "metadata/ColorFilterArray.h"          // for CFAColor
 #include <array>                                // for array
 #include <cassert>                              // for assert
+#include <memory>                               // for shared_ptr
 #include <utility>                              // for move
 #include <vector>                               // for vector
 
 namespace rawspeed {
 
+class DynamicSchedule;
 class RawImage;
 
 class FujiDecompressor final : public AbstractDecompressor {
   RawImage mRaw;
 
-  void decompressThread() const noexcept;
+  // Decodes the strips of the given order, as handed out by the schedule.
+  void decompressThread(const std::vector<int>& order,
+                        DynamicSchedule* schedule) const noexcept;
 
 public:
   struct FujiHeader {
@@ -117,7 +122,8 @@ protected:
 
     explicit fuji_compressed_params(const FujiDecompressor& d);
 
-    std::vector<char> q_table; /* quantization table */
+    // quantization table, shared by all the decoders with these q_point
+    std::shared_ptr<const std::vector<char>> q_table;
     std::array<int, 5> q_point; /* quantization points */
     int max_bits;
     int min_value;
@@ -157,7 +163,8 @@ protected:
   };
 
   struct fuji_compressed_block {
-    fuji_compressed_block() = default;
+    explicit fuji_compressed_block(ScratchArena* arena)
+        : linealloc(ScratchAllocator<ushort16>(arena)) {}
 
     void reset(const fuji_compressed_params* params);
 
@@ -165,7 +172,7 @@ protected:
     std::array<std::array<int_pair, 41>, 3> grad_even;
     std::array<std::array<int_pair, 41>, 3> grad_odd;
 
-    std::vector<ushort16> linealloc;
+    std::vector<ushort16, ScratchAllocator<ushort16>> linealloc;
     std::array<ushort16*, _ltotal> linebuf;
   };
 
@@ -179,7 +186,7 @@ private:
   void fuji_decode_strip(fuji_compressed_block* info_block,
                          const FujiStrip& strip) const;
 
-  template <typename T>
+  template <int Step, typename T>
   void copy_line(fuji_compressed_block* info, const FujiStrip& strip,
                  int cur_line, T&& idx) const;
 
@@ -20,15 +20,20 @@
 */
 
 #include "decompressors/HasselbladDecompressor.h"
-#include "common/Common.h"                // for uint32, ushort16
-#include "common/Point.h"                 // for iPoint2D
-#include "common/RawImage.h"              // for RawImage, RawImageData
-#include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "decompressors/HuffmanTable.h"   // for HuffmanTable
-#include "io/BitPumpMSB32.h"              // for BitPumpMSB32, BitStream<>::f...
-#include "io/ByteStream.h"                // for ByteStream
-#include <array>                          // for array
-#include <cassert>                        // for assert
+#include "common/Array2DRef.h"                // for Array2DRef
+#include "common/Common.h"                    // for uint32, ushort16, uint64
+#include "common/Executor.h"                  // for getExecutor, parallelFor
+#include "common/Point.h"                     // for iPoint2D
+#include "common/RawImage.h"                  // for RawImage, RawImageData
+#include "decoders/RawDecoderException.h"     // for ThrowRDE
+#include "decompressors/HuffmanTable.h"       // for HuffmanTable
+#include "decompressors/SpeculativeDecoder.h" // for decodeSpeculatively
+#include "io/BitPumpMSB32.h"                  // for BitPumpMSB32, BitStream<>...
+#include "io/ByteStream.h"                    // for ByteStream
+#include <algorithm>                          // for fill
+#include <array>                              // for array
+#include <cassert>                            // for assert
+#include <vector>                             // for vector
 
 namespace rawspeed {
 
@@ -47,16 +52,91 @@ HasselbladDecompressor::HasselbladDecompressor(const ByteStream& bs,
   }
 }
 
-// Returns len bits as a signed value.
+// Decodes the lengths of the differences of both of the pixels of a pair
+// with one lookup, whenever both of the codes fit into LookupDepth bits.
+class HasselbladDecompressor::LengthPairLookup final {
+  static constexpr unsigned LookupDepth = 12;
+
+  struct Entry final {
+    uchar8 codeBits; // of both of the codes, or 0 if they do not fit
+    uchar8 len1;
+    uchar8 len2;
+  };
+
+  const HuffmanTable& ht;
+  std::vector<Entry> table;
+
+public:
+  explicit LengthPairLookup(const HuffmanTable& ht_)
+      : ht(ht_), table(1U << LookupDepth) {
+    const auto symbols = ht.getCodeSymbols();
+    const auto& values = ht.getCodeValues();
+
+    // The index of the symbol whose code is the prefix of the LookupDepth
+    // bits, or -1 if none of the codes that are short enough match.
+    std::vector<int> firstSymbol(1U << LookupDepth, -1);
+    for (size_t i = 0; i < symbols.size(); i++) {
+      const unsigned code_l = symbols[i].code_len;
+      if (code_l > LookupDepth)
+        break;
+
+      const unsigned ll = symbols[i].code << (LookupDepth - code_l);
+      const unsigned ul = ll | ((1U << (LookupDepth - code_l)) - 1U);
+      std::fill(&firstSymbol[ll], &firstSymbol[ul] + 1, i);
+    }
+
+    for (unsigned c = 0; c < table.size(); c++) {
+      Entry& e = table[c];
+      e = {0, 0, 0};
+
+      const int s1 = firstSymbol[c];
+      if (s1 < 0)
+        continue;
+      const unsigned code1_l = symbols[s1].code_len;
+
+      // The remaining bits, shifted to the top.
+      const int s2 = firstSymbol[(c << code1_l) & ((1U << LookupDepth) - 1U)];
+      if (s2 < 0 || code1_l + symbols[s2].code_len > LookupDepth)
+        continue;
+
+      e.codeBits = code1_l + symbols[s2].code_len;
+      e.len1 = values[s1];
+      e.len2 = values[s2];
+    }
+  }
+
+  inline void decode(BitPumpMSB32* bs, int* len1, int* len2) const {
+    bs->fill(LookupDepth);
+    const Entry& e = table[bs->peekBitsNoFill(LookupDepth)];
+    if (e.codeBits) {
+      bs->skipBitsNoFill(e.codeBits);
+      *len1 = e.len1;
+      *len2 = e.len2;
+      return;
+    }
+
+    *len1 = ht.decodeLength(*bs);
+    *len2 = ht.decodeLength(*bs);
+  }
+};
+
+constexpr unsigned HasselbladDecompressor::LengthPairLookup::LookupDepth;
+
+// The len bits as a signed value.
 // Highest bit is a sign bit
-inline int HasselbladDecompressor::getBits(BitPumpMSB32* bs, int len) {
-  int diff = bs->getBits(len);
-  diff = len > 0 ? HuffmanTable::signExtended(diff, len) : diff;
+static inline int getDiff(uint32 bits, int len) {
+  const int diff = len > 0 ? HuffmanTable::signExtended(bits, len) : 0;
   if (diff == 65535)
     return -32768;
   return diff;
 }
 
+// Returns len bits as a signed value.
+// Highest bit is a sign bit
+inline int HasselbladDecompressor::getBits(BitPumpMSB32* bs, int len) {
+  return getDiff(bs->getBits(len), len);
+}
+
 void HasselbladDecompressor::decodeScan() {
   if (frame.w != static_cast<unsigned>(mRaw->dim.x) ||
       frame.h != static_cast<unsigned>(mRaw->dim.y)) {
@@ -69,26 +149,131 @@ void HasselbladDecompressor::decodeScan() {
   assert(frame.w % 2 == 0);
 
   const auto ht = getHuffmanTables<1>();
+  const LengthPairLookup lengths(*ht[0]);
+
+  if (getExecutor()->getConcurrency() <= 1) {
+    BitPumpMSB32 bitStream(input);
+    for (uint32 y = 0; y < frame.h; y++) {
+      mRaw->checkCancelled();
+      decodeRow(&bitStream, lengths, y);
+    }
+    input.skipBytes(bitStream.getBufferPosition());
+    return;
+  }
+
+  if (speculative && decodeRowsSpeculatively(lengths))
+    return;
+
+  // There are no restart markers, but each row starts from the same
+  // predictors, so only the position within the bitstream carries over.
+  // One pass that only skips over the codes finds where the rows start,
+  // and then they can be decoded in parallel.
+  const std::vector<uint64> rows = findRows(lengths);
+
+  parallelFor(0, frame.h, [this, &lengths, &rows](int y) {
+    if (mRaw->isCancelled())
+      return;
+    BitPumpMSB32 bitStream(
+        input.getSubStream(input.getPosition() + rows[y] / 32 * 4));
+    bitStream.fill();
+    bitStream.skipBitsNoFill(rows[y] % 32);
+    decodeRow(&bitStream, lengths, y);
+  });
+  mRaw->checkCancelled();
+
+  input.skipBytes(roundUpDivision(rows.back(), 8));
+}
+
+std::vector<uint64>
+HasselbladDecompressor::findRows(const LengthPairLookup& lengths) const {
+  std::vector<uint64> rows;
+  rows.reserve(frame.h + 1);
 
   BitPumpMSB32 bitStream(input);
-  // Pixels are packed two at a time, not like LJPEG:
-  // [p1_length_as_huffman][p2_length_as_huffman][p0_diff_with_length][p1_diff_with_length]|NEXT PIXELS
   for (uint32 y = 0; y < frame.h; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
-    int p1 = 0x8000 + pixelBaseOffset;
-    int p2 = 0x8000 + pixelBaseOffset;
+    mRaw->checkCancelled();
+    rows.emplace_back(8 * uint64(bitStream.getPosition()) -
+                      bitStream.getFillLevel());
     for (uint32 x = 0; x < frame.w; x += 2) {
-      int len1 = ht[0]->decodeLength(bitStream);
-      int len2 = ht[0]->decodeLength(bitStream);
-      p1 += getBits(&bitStream, len1);
-      p2 += getBits(&bitStream, len2);
-      // NOTE: this is rather unusual and weird, but appears to be correct.
-      // clampBits(p, 16) results in completely garbled images.
-      dest[x] = ushort16(p1);
-      dest[x + 1] = ushort16(p2);
+      int len1;
+      int len2;
+      lengths.decode(&bitStream, &len1, &len2);
+      bitStream.fill(len1 + len2);
+      bitStream.skipBitsNoFill(len1 + len2);
+    }
+  }
+  rows.emplace_back(8 * uint64(bitStream.getPosition()) -
+                    bitStream.getFillLevel());
+
+  return rows;
+}
+
+bool HasselbladDecompressor::decodeRowsSpeculatively(
+    const LengthPairLookup& lengths) {
+  // The differences of both of the pixels of a pair, as the low and the high
+  // half.
+  std::vector<uint32, DefaultInitAllocatorAdaptor<uint32>> pairs;
+  uint64 endBit;
+  if (!decodeSpeculatively<BitPumpMSB32>(
+          input, 4, uint64(frame.w / 2) * frame.h, 1,
+          [&lengths](BitPumpMSB32* bits, unsigned /*phase*/) {
+            int len1;
+            int len2;
+            lengths.decode(bits, &len1, &len2);
+            const int diff1 = getBits(bits, len1);
+            const int diff2 = getBits(bits, len2);
+            return uint32(ushort16(diff1)) | uint32(ushort16(diff2)) << 16;
+          },
+          &pairs, &endBit))
+    return false;
+
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+  parallelFor(0, frame.h, [this, &pairs, out](int y) {
+    if (mRaw->isCancelled())
+      return;
+    ushort16* dest = out[y];
+    const uint32* pair = &pairs[uint64(frame.w / 2) * y];
+    ushort16 p1 = 0x8000 + pixelBaseOffset;
+    ushort16 p2 = 0x8000 + pixelBaseOffset;
+    for (uint32 x = 0; x < frame.w; x += 2, ++pair) {
+      dest[x] = p1 += ushort16(*pair);
+      dest[x + 1] = p2 += ushort16(*pair >> 16);
+    }
+    mRaw->notifyAreaReady({0, y, mRaw->dim.x, 1});
+  });
+  mRaw->checkCancelled();
+
+  input.skipBytes(roundUpDivision(endBit, 8));
+  return true;
+}
+
+void HasselbladDecompressor::decodeRow(BitPumpMSB32* bs,
+                                       const LengthPairLookup& lengths,
+                                       uint32 y) const {
+  ushort16* dest = mRaw->getU16DataAsCroppedArray2DRef()[y];
+  int p1 = 0x8000 + pixelBaseOffset;
+  int p2 = 0x8000 + pixelBaseOffset;
+  // Pixels are packed two at a time, not like LJPEG:
+  // [p1_length_as_huffman][p2_length_as_huffman][p0_diff_with_length][p1_diff_with_length]|NEXT PIXELS
+  for (uint32 x = 0; x < frame.w; x += 2) {
+    int len1;
+    int len2;
+    lengths.decode(bs, &len1, &len2);
+    if (len1 + len2 < 32) {
+      // Both of the differences at once.
+      const uint32 bits = bs->getBits(len1 + len2);
+      p1 += getDiff(bits >> len2, len1);
+      p2 += getDiff(bits & ((1U << len2) - 1U), len2);
+    } else {
+      p1 += getBits(bs, len1);
+      p2 += getBits(bs, len2);
     }
+    // NOTE: this is rather unusual and weird, but appears to be correct.
+    // clampBits(p, 16) results in completely garbled images.
+    dest[x] = ushort16(p1);
+    dest[x + 1] = ushort16(p2);
   }
-  input.skipBytes(bitStream.getBufferPosition());
+  mRaw->notifyAreaReady({0, static_cast<int>(y), mRaw->dim.x, 1});
 }
 
 void HasselbladDecompressor::decode(int pixelBaseOffset_)
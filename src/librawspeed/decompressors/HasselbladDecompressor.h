@@ -21,8 +21,10 @@
 
 #pragma once
 
+#include "common/Common.h"                           // for uint32, uint64
 #include "decompressors/AbstractLJpegDecompressor.h" // for AbstractLJpegDe...
 #include "io/BitPumpMSB32.h"                         // for BitPumpMSB32
+#include <vector>                                    // for vector
 
 namespace rawspeed {
 
@@ -31,10 +33,22 @@ class RawImage;
 
 class HasselbladDecompressor final : public AbstractLJpegDecompressor
 {
+  class LengthPairLookup;
+
   int pixelBaseOffset = 0;
 
   void decodeScan() override;
 
+  // Returns the bit position of the start of each row, and of the end.
+  std::vector<uint64> findRows(const LengthPairLookup& lengths) const;
+
+  void decodeRow(BitPumpMSB32* bs, const LengthPairLookup& lengths,
+                 uint32 y) const;
+
+  // With decodeSpeculatively(), instead of the pass of findRows(). Returns
+  // false if the rows have to be found that way after all.
+  bool decodeRowsSpeculatively(const LengthPairLookup& lengths);
+
 public:
   HasselbladDecompressor(const ByteStream& bs, const RawImage& img);
 
@@ -24,6 +24,7 @@
 
 #include "decompressors/HuffmanTableLUT.h" // for HuffmanTableLUT
 // #include "decompressors/HuffmanTableLookup.h" // for HuffmanTableLookup
+// #include "decompressors/HuffmanTableMultiLUT.h" // for HuffmanTableMultiLUT
 // #include "decompressors/HuffmanTableTree.h" // for HuffmanTableTree
 // #include "decompressors/HuffmanTableVector.h" // for HuffmanTableVector
 
@@ -33,6 +34,7 @@ namespace rawspeed {
 
 using HuffmanTable = HuffmanTableLUT;
 // using HuffmanTable = HuffmanTableLookup;
+// using HuffmanTable = HuffmanTableMultiLUT;
 // using HuffmanTable = HuffmanTableTree;
 // using HuffmanTable = HuffmanTableVector;
 
@@ -0,0 +1,73 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/HuffmanTableCache.h"
+#include "decompressors/HuffmanTable.h" // for HuffmanTable
+#include <map>                          // for map
+#include <memory>                       // for shared_ptr, make_shared
+#include <mutex>                        // for mutex, lock_guard
+#include <utility>                      // for move
+#include <vector>                       // for vector
+
+namespace rawspeed {
+
+namespace {
+
+// Only a few distinct tables are ever seen in the real files. This keeps
+// the memory of the cache in check if there are many more, e.g. fuzzed ones.
+constexpr size_t MaxCachedTables = 64;
+
+} // namespace
+
+std::shared_ptr<const HuffmanTable>
+getSetUpHuffmanTable(const HuffmanTable& table, bool fullDecode,
+                     bool fixDNGBug16, bool* built) {
+  static std::mutex mutex;
+  static std::map<std::vector<unsigned>, std::shared_ptr<const HuffmanTable>>
+      tables;
+
+  auto key = table.getKey(fullDecode, fixDNGBug16);
+
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    const auto it = tables.find(key);
+    if (it != tables.end()) {
+      if (built)
+        *built = false;
+      return it->second;
+    }
+  }
+
+  if (built)
+    *built = true;
+
+  // The setup is done without holding the lock, so that the other decoders
+  // are not held up by it. If two of them set up the same table at once,
+  // the first one to finish wins.
+  auto ht = std::make_shared<HuffmanTable>(table);
+  ht->setup(fullDecode, fixDNGBug16);
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (tables.size() >= MaxCachedTables)
+    tables.clear();
+  return tables.emplace(std::move(key), std::move(ht)).first->second;
+}
+
+} // namespace rawspeed
@@ -0,0 +1,36 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "decompressors/HuffmanTable.h" // for HuffmanTable
+#include <memory>                       // for shared_ptr
+
+namespace rawspeed {
+
+// A set up copy of the table, as by setup(fullDecode, fixDNGBug16). The
+// tables are cached by their codes, so that the decoders of the streams with
+// the same DHT share one, e.g. all of the tiles of a DNG, and the files from
+// the same camera. If given, built is set to whether it was not cached.
+std::shared_ptr<const HuffmanTable>
+getSetUpHuffmanTable(const HuffmanTable& table, bool fullDecode,
+                     bool fixDNGBug16, bool* built = nullptr);
+
+} // namespace rawspeed
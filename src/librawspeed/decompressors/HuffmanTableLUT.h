@@ -64,7 +64,13 @@
 
 namespace rawspeed {
 
-class HuffmanTableLUT final : public AbstractHuffmanTable {
+// LookupDepth is the number of bits looked up at once. What is the fastest
+// depends on the CPU, so several ones are instantiated, see HuffmanTableTuner.
+template <unsigned LookupDepth_>
+class BasicHuffmanTableLUT final : public AbstractHuffmanTable {
+  static_assert(LookupDepth_ > 0 && LookupDepth_ <= 15,
+                "the lookup table is indexed with ushort16");
+
   // private fields calculated from codesPerBits and codeValues
   // they are index '1' based, so we can directly lookup the value
   // for code length l without decrementing
@@ -80,11 +86,10 @@ class HuffmanTableLUT final : public AbstractHuffmanTable {
   // The payload may be the fully decoded diff or the length of the diff.
   // The len field contains the number of bits, this lookup consumed.
   // A lookup value of 0 means the code was too big to fit into the table.
-  // The optimal LookupDepth is also likely to depend on the CPU architecture.
   static constexpr unsigned PayloadShift = 16;
   static constexpr unsigned FlagMask = 0x100;
   static constexpr unsigned LenMask = 0xff;
-  static constexpr unsigned LookupDepth = 11;
+  static constexpr unsigned LookupDepth = LookupDepth_;
   std::vector<int32> decodeLookup;
 #else
   // lookup table containing 2 fields: payload:4|len:4
@@ -254,4 +259,6 @@ public:
   }
 };
 
+using HuffmanTableLUT = BasicHuffmanTableLUT<11>;
+
 } // namespace rawspeed
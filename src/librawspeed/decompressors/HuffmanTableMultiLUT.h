@@ -0,0 +1,184 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"                      // for uchar8, short16
+#include "decompressors/AbstractHuffmanTable.h" // for AbstractHuffmanTable
+#include "decompressors/HuffmanTableLUT.h"      // for HuffmanTableLUT
+#include "io/BitStream.h"                       // for BitStreamTraits
+#include <algorithm>                            // for min
+#include <array>                                // for array
+#include <cassert>                              // for assert
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+// A HuffmanTableLUT, plus a second lookup table in which each entry holds
+// all the symbols (code + diff) that fit in LookupDepth bits, up to
+// MaxSymbols of them. With the short codes that are common in the raws,
+// decodeDifferences() then decodes several differences per lookup.
+// Everything else is delegated to the HuffmanTableLUT, so this is a drop-in
+// replacement for it.
+class HuffmanTableMultiLUT final : public AbstractHuffmanTable {
+public:
+  static constexpr unsigned LookupDepth = 11;
+  static constexpr unsigned MaxSymbols = 3;
+
+private:
+  struct Entry final {
+    // How many symbols are fully decoded. 0 if not even the first one fits,
+    // then it has to be decoded by the HuffmanTableLUT.
+    uchar8 count;
+
+    // lens[i] is the number of bits used by the first i+1 symbols.
+    std::array<uchar8, MaxSymbols> lens;
+
+    std::array<short16, MaxSymbols> diffs;
+  };
+
+  HuffmanTableLUT single;
+  std::vector<Entry> multiLookup;
+
+  bool fullDecode = true;
+
+  void setupMultiLookup() {
+    const auto symbols = generateCodeSymbols();
+
+    // The index of the symbol whose code is the prefix of the LookupDepth
+    // bits, or -1 if none of the codes that are short enough match.
+    std::vector<int> firstSymbol(1U << LookupDepth, -1);
+    for (size_t i = 0; i < symbols.size(); i++) {
+      const unsigned code_l = symbols[i].code_len;
+      if (code_l > LookupDepth)
+        break;
+
+      const unsigned ll = symbols[i].code << (LookupDepth - code_l);
+      const unsigned ul = ll | ((1U << (LookupDepth - code_l)) - 1U);
+      for (unsigned c = ll; c <= ul; c++)
+        firstSymbol[c] = i;
+    }
+
+    multiLookup.resize(1U << LookupDepth);
+    for (unsigned c = 0; c < multiLookup.size(); c++) {
+      Entry& e = multiLookup[c];
+      e.count = 0;
+      e.lens.fill(0);
+      e.diffs.fill(0);
+
+      unsigned pos = 0;
+      while (e.count < MaxSymbols) {
+        // The remaining bits, shifted to the top.
+        const unsigned rest = (c << pos) & ((1U << LookupDepth) - 1U);
+        const int s = firstSymbol[rest];
+        if (s < 0)
+          break;
+
+        const unsigned code_l = symbols[s].code_len;
+        const unsigned diff_l = codeValues[s];
+
+        // The special case of 16 is left to the HuffmanTableLUT.
+        if (diff_l == 16 || pos + code_l + diff_l > LookupDepth)
+          break;
+
+        int diff = 0;
+        if (diff_l) {
+          const unsigned shift = LookupDepth - pos - code_l - diff_l;
+          diff = signExtended((c >> shift) & ((1U << diff_l) - 1U), diff_l);
+        }
+
+        pos += code_l + diff_l;
+        e.lens[e.count] = pos;
+        e.diffs[e.count] = diff;
+        e.count++;
+      }
+    }
+  }
+
+public:
+  void setup(bool fullDecode_, bool fixDNGBug16_) {
+    fullDecode = fullDecode_;
+
+    static_cast<AbstractHuffmanTable&>(single) = *this;
+    single.setup(fullDecode_, fixDNGBug16_);
+
+    // Only the fully decoded differences can be batched.
+    if (fullDecode)
+      setupMultiLookup();
+  }
+
+  template <typename BIT_STREAM> inline int decodeLength(BIT_STREAM& bs) const {
+    return single.decodeLength(bs);
+  }
+
+  template <typename BIT_STREAM> inline int decodeNext(BIT_STREAM& bs) const {
+    return single.decodeNext(bs);
+  }
+
+  template <typename BIT_STREAM, bool FULL_DECODE>
+  inline int decode(BIT_STREAM& bs) const {
+    return single.decode<BIT_STREAM, FULL_DECODE>(bs);
+  }
+
+  // Same as calling decodeNext() n times.
+  template <typename BIT_STREAM>
+  inline void decodeDifferences(BIT_STREAM& bs, int* diffs, int n) const {
+    static_assert(BitStreamTraits<BIT_STREAM>::canUseWithHuffmanTable,
+                  "This BitStream specialization is not marked as usable here");
+    assert(fullDecode);
+
+    int i = 0;
+
+    // While there is room for MaxSymbols more differences, all of them are
+    // stored, and the ones past the count get overwritten later on.
+    for (; i + static_cast<int>(MaxSymbols) <= n;) {
+      bs.fill(LookupDepth);
+      const Entry& e = multiLookup[bs.peekBitsNoFill(LookupDepth)];
+
+      if (!e.count) {
+        diffs[i++] = single.decodeNext(bs);
+        continue;
+      }
+
+      for (unsigned j = 0; j < MaxSymbols; j++)
+        diffs[i + j] = e.diffs[j];
+      bs.skipBitsNoFill(e.lens[e.count - 1]);
+      i += e.count;
+    }
+
+    for (; i < n;) {
+      bs.fill(LookupDepth);
+      const Entry& e = multiLookup[bs.peekBitsNoFill(LookupDepth)];
+
+      if (!e.count) {
+        diffs[i++] = single.decodeNext(bs);
+        continue;
+      }
+
+      const int count = std::min<int>(e.count, n - i);
+      for (int j = 0; j < count; j++)
+        diffs[i + j] = e.diffs[j];
+      bs.skipBitsNoFill(e.lens[count - 1]);
+      i += count;
+    }
+  }
+};
+
+} // namespace rawspeed
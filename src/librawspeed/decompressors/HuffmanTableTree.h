@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include "common/Common.h"                      // for uchar8, ushort16
 #include "decoders/RawDecoderException.h"       // for ThrowRDE
 #include "decompressors/AbstractHuffmanTable.h" // for AbstractHuffmanTable...
 #include "decompressors/BinaryHuffmanTree.h"    // IWYU pragma: export
@@ -37,11 +38,66 @@ namespace rawspeed {
 class HuffmanTableTree final : public AbstractHuffmanTable {
   using ValueType = decltype(codeValues)::value_type;
 
-  BinaryHuffmanTree<ValueType> tree;
+  using Tree = BinaryHuffmanTree<ValueType>;
+
+  // The tree is only built in setup(), and is then flattened into tables of
+  // 2^StrideBits slots, one per each StrideBits-bit path below a branch, so a
+  // code is walked StrideBits bits at a time, and the tables are contiguous.
+  static constexpr int StrideBits = 4;
+
+  struct Slot {
+    enum class Kind : uchar8 { Invalid, Leaf, Branch };
+
+    Kind kind = Kind::Invalid;
+    // Leaf: the length of the rest of the code, Invalid: how many of the
+    // bits were read until there was nothing in that direction.
+    uchar8 len = 0;
+    // Branch: the index of the table of the node StrideBits bits below.
+    ushort16 next = 0;
+    ValueType value = 0;
+  };
+
+  std::vector<Slot> slots;
 
   bool fullDecode = true;
   bool fixDNGBug16 = false;
 
+  // Appends the table of the branch, and those of the branches under it.
+  ushort16 flatten(const typename Tree::Branch& top) {
+    const auto table = slots.size();
+    assert(table % (1U << StrideBits) == 0);
+    assert(table >> StrideBits <= 0xFFFF);
+    slots.resize(table + (1U << StrideBits));
+
+    for (unsigned path = 0; path < 1U << StrideBits; path++) {
+      const auto* b = &top;
+      Slot slot;
+      for (int len = 1; len <= StrideBits; len++) {
+        const bool bit = (path >> (StrideBits - len)) & 1U;
+        // NOTE: The order *IS* important! Left to right, zero to one!
+        const auto& n = !bit ? b->zero : b->one;
+        slot.len = len;
+        if (!n)
+          break;
+        if (static_cast<typename Tree::Node::Type>(*n) ==
+            Tree::Node::Type::Leaf) {
+          slot.kind = Slot::Kind::Leaf;
+          slot.value = n->getAsLeaf().value;
+          break;
+        }
+        b = &(n->getAsBranch());
+        if (len == StrideBits) {
+          slot.kind = Slot::Kind::Branch;
+          // The recursion appends, so the slot is only stored afterwards.
+          slot.next = flatten(*b);
+        }
+      }
+      slots[table + path] = slot;
+    }
+
+    return table >> StrideBits;
+  }
+
 protected:
   template <typename BIT_STREAM>
   inline ValueType getValue(BIT_STREAM& bs) const {
@@ -49,37 +105,34 @@ protected:
                   "This BitStream specialization is not marked as usable here");
     CodeSymbol partial;
 
-    const auto* top = &(tree.root->getAsBranch());
+    unsigned table = 0;
 
     // Read bits until either find the code or detect the uncorrect code
-    for (partial.code = 0, partial.code_len = 1;; ++partial.code_len) {
-      assert(partial.code_len <= 16);
+    for (partial.code = 0, partial.code_len = 0;;) {
+      assert(partial.code_len < 16);
 
-      // Read one more bit
-      const bool bit = bs.getBits(1);
+      const auto path = bs.peekBits(StrideBits);
+      const Slot& slot = slots[(table << StrideBits) + path];
 
-      partial.code <<= 1;
-      partial.code |= bit;
-
-      // What is the last bit, which we have just read?
-
-      // NOTE: The order *IS* important! Left to right, zero to one!
-      const auto& newNode = !bit ? top->zero : top->one;
-
-      if (!newNode) {
+      switch (slot.kind) {
+      case Slot::Kind::Leaf:
+        // Ok, great, hit a Leaf. This is it.
+        bs.skipBitsNoFill(slot.len);
+        return slot.value;
+      case Slot::Kind::Branch:
+        bs.skipBitsNoFill(StrideBits);
+        partial.code = (partial.code << StrideBits) | path;
+        partial.code_len += StrideBits;
+        table = slot.next;
+        break;
+      case Slot::Kind::Invalid:
         // Got nothing in this direction.
+        partial.code = (partial.code << slot.len) |
+                       (path >> (StrideBits - slot.len));
+        partial.code_len += slot.len;
         ThrowRDE("bad Huffman code: %u (len: %u)", partial.code,
                  partial.code_len);
       }
-
-      if (static_cast<decltype(tree)::Node::Type>(*newNode) ==
-          decltype(tree)::Node::Type::Leaf) {
-        // Ok, great, hit a Leaf. This is it.
-        return newNode->getAsLeaf().value;
-      }
-
-      // Else, this is a branch, continue looking.
-      top = &(newNode->getAsBranch());
     }
 
     // We have either returned the found symbol, or thrown on uncorrect symbol.
@@ -95,6 +148,7 @@ public:
     assert(maxCodesCount() > 0);
     assert(codeValues.size() == maxCodesCount());
 
+    Tree tree;
     auto currValue = codeValues.cbegin();
     for (auto codeLen = 1UL; codeLen < nCodesPerLength.size(); codeLen++) {
       const auto nCodesForCurrLen = nCodesPerLength[codeLen];
@@ -109,7 +163,7 @@ public:
       std::for_each(nodes.cbegin(), std::next(nodes.cbegin(), nCodesForCurrLen),
                     [&currValue](auto* node) {
                       *node =
-                          std::make_unique<decltype(tree)::Leaf>(*currValue);
+                          std::make_unique<typename Tree::Leaf>(*currValue);
                       std::advance(currValue, 1);
                     });
     }
@@ -119,6 +173,12 @@ public:
     // And get rid of all the branches that do not lead to Leafs.
     // It is crucial to detect degenerate codes at the earliest.
     tree.pruneLeaflessBranches();
+
+    slots.clear();
+    if (tree.root)
+      flatten(tree.root->getAsBranch());
+    else
+      slots.resize(1U << StrideBits); // Nothing decodes.
   }
 
   template <typename BIT_STREAM> inline int decodeLength(BIT_STREAM& bs) const {
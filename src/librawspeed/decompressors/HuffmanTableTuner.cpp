@@ -0,0 +1,215 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/HuffmanTableTuner.h"
+#include "common/Common.h"                      // for uchar8, uint32, uint64
+#include "decompressors/AbstractHuffmanTable.h" // for AbstractHuffmanTable
+#include "io/BitPumpMSB.h"                      // for BitPumpMSB
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, Endianne...
+#include <algorithm>                            // for min
+#include <atomic>                               // for atomic
+#include <chrono>                               // for steady_clock, durat...
+#include <cstddef>                              // for size_t
+#include <map>                                  // for map
+#include <mutex>                                // for mutex, lock_guard
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+namespace {
+
+// How many symbols are decoded per measurement, and how many times each
+// backend is measured. Only the fastest of the runs counts, which filters
+// out most of the noise (interrupts, other threads, ...).
+constexpr int NumSymbols = 1 << 13;
+constexpr int NumRuns = 5;
+
+const HuffmanTableBackend candidates[] = {
+    HuffmanTableBackend::LUT9,   HuffmanTableBackend::LUT11,
+    HuffmanTableBackend::LUT13,  HuffmanTableBackend::Lookup,
+    HuffmanTableBackend::Tree,   HuffmanTableBackend::Vector,
+};
+
+// Needs to be a subclass to get to the codes of the table.
+class TableShape final : public AbstractHuffmanTable {
+public:
+  explicit TableShape(const AbstractHuffmanTable& table)
+      : AbstractHuffmanTable(table) {}
+
+  // A valid stream of symbols for this table. The distribution of the codes
+  // is the one for which the table is optimal, i.e. the probability of a code
+  // of length l is 2^-l, as it would be in the real data.
+  std::vector<uchar8> generateData(bool fullDecode, bool fixDNGBug16) const {
+    const auto symbols = generateCodeSymbols();
+
+    std::vector<uchar8> data;
+    uint64 cache = 0;
+    unsigned fillLevel = 0;
+    auto put = [&data, &cache, &fillLevel](uint32 bits, unsigned len) {
+      cache = (cache << len) | bits;
+      fillLevel += len;
+      for (; fillLevel >= 8; fillLevel -= 8)
+        data.emplace_back(cache >> (fillLevel - 8));
+    };
+
+    uint32 random = 1;
+    auto nextRandom = [&random]() {
+      random = random * 1103515245U + 12345U;
+      return (random >> 8) & 0xFFFFU;
+    };
+
+    for (int n = 0; n < NumSymbols;) {
+      // The symbol whose code is the prefix of the random 16 bits, if any.
+      const uint32 bits = nextRandom();
+      for (size_t i = 0; i < symbols.size(); i++) {
+        const auto& s = symbols[i];
+        if ((bits >> (16 - s.code_len)) != s.code)
+          continue;
+
+        put(s.code, s.code_len);
+
+        const unsigned diff_l = codeValues[i];
+        if (fullDecode && (diff_l != 16 || fixDNGBug16))
+          put(nextRandom() & ((1U << diff_l) - 1U), diff_l);
+
+        n++;
+        break;
+      }
+    }
+
+    // Flush, and leave enough of the padding for the bit pump to be happy.
+    put(0, 8 - fillLevel % 8);
+    data.resize(data.size() + 64, 0);
+
+    return data;
+  }
+};
+
+template <typename Huffman>
+std::chrono::steady_clock::duration
+measure(const AbstractHuffmanTable& table, bool fullDecode, bool fixDNGBug16,
+        const std::vector<uchar8>& data) {
+  Huffman ht;
+  static_cast<AbstractHuffmanTable&>(ht) = table;
+  ht.setup(fullDecode, fixDNGBug16);
+
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+
+  auto best = std::chrono::steady_clock::duration::max();
+  for (int run = 0; run < NumRuns; run++) {
+    const auto start = std::chrono::steady_clock::now();
+
+    BitPumpMSB bits(bs);
+    int sum = 0;
+    for (int i = 0; i < NumSymbols; i++)
+      sum += fullDecode ? ht.decodeNext(bits) : ht.decodeLength(bits);
+
+    // Keeps the loop from being optimized out.
+    volatile int sink = sum;
+    (void)sink;
+
+    best = std::min(best, std::chrono::steady_clock::now() - start);
+  }
+
+  return best;
+}
+
+HuffmanTableBackend tune(const AbstractHuffmanTable& table, bool fullDecode,
+                         bool fixDNGBug16) {
+  const auto data =
+      TableShape(table).generateData(fullDecode, fixDNGBug16);
+
+  auto best = std::chrono::steady_clock::duration::max();
+  HuffmanTableBackend bestBackend = HuffmanTableBackend::LUT11;
+  for (const auto backend : candidates) {
+    // The bit pumps are the same for all of the backends, thus BitPumpMSB
+    // is representative of the others too.
+    dispatchHuffmanTable(backend, [&](auto type) {
+      using Huffman = typename decltype(type)::type;
+      const auto time =
+          measure<Huffman>(table, fullDecode, fixDNGBug16, data);
+      if (time < best) {
+        best = time;
+        bestBackend = backend;
+      }
+    });
+  }
+
+  return bestBackend;
+}
+
+std::atomic<HuffmanTableBackend> forcedBackend(HuffmanTableBackend::Auto);
+
+} // namespace
+
+const char* getHuffmanTableBackendName(HuffmanTableBackend backend) {
+  switch (backend) {
+  case HuffmanTableBackend::Auto:
+    return "Auto";
+  case HuffmanTableBackend::LUT9:
+    return "LUT9";
+  case HuffmanTableBackend::LUT11:
+    return "LUT11";
+  case HuffmanTableBackend::LUT13:
+    return "LUT13";
+  case HuffmanTableBackend::Lookup:
+    return "Lookup";
+  case HuffmanTableBackend::Tree:
+    return "Tree";
+  case HuffmanTableBackend::Vector:
+    return "Vector";
+  }
+  ThrowRDE("Unexpected Huffman table backend %i", static_cast<int>(backend));
+}
+
+void setHuffmanTableBackend(HuffmanTableBackend backend) {
+  forcedBackend = backend;
+}
+
+HuffmanTableBackend getHuffmanTableBackend() { return forcedBackend; }
+
+HuffmanTableBackend selectHuffmanTableBackend(const AbstractHuffmanTable& table,
+                                              bool fullDecode,
+                                              bool fixDNGBug16) {
+  const HuffmanTableBackend forced = forcedBackend;
+  if (forced != HuffmanTableBackend::Auto)
+    return forced;
+
+  static std::mutex mutex;
+  static std::map<std::vector<unsigned>, HuffmanTableBackend> tunings;
+
+  const auto key = table.getKey(fullDecode, fixDNGBug16);
+
+  // The tuning is done while holding the lock, so that the concurrent
+  // decoders do not disturb each other's measurements of the same table.
+  std::lock_guard<std::mutex> guard(mutex);
+  const auto it = tunings.find(key);
+  if (it != tunings.end())
+    return it->second;
+
+  const auto backend = tune(table, fullDecode, fixDNGBug16);
+  tunings.emplace(key, backend);
+  return backend;
+}
+
+} // namespace rawspeed
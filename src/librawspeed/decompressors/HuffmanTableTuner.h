@@ -0,0 +1,95 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "decoders/RawDecoderException.h"     // for ThrowRDE
+#include "decompressors/HuffmanTableLUT.h"    // for BasicHuffmanTableLUT
+#include "decompressors/HuffmanTableLookup.h" // for HuffmanTableLookup
+#include "decompressors/HuffmanTableTree.h"   // for HuffmanTableTree
+#include "decompressors/HuffmanTableVector.h" // for HuffmanTableVector
+
+namespace rawspeed {
+
+class AbstractHuffmanTable;
+
+// The implementations of the Huffman table that can be selected at runtime.
+// Which one is the fastest depends on the CPU (the relative cost of the
+// arithmetic vs the memory accesses), and on the shape of the table.
+enum class HuffmanTableBackend {
+  Auto, // benchmark the others, and use the fastest one
+  LUT9,
+  LUT11,
+  LUT13,
+  Lookup,
+  Tree,
+  Vector,
+};
+
+const char* getHuffmanTableBackendName(HuffmanTableBackend backend);
+
+// By default (Auto), each table shape is benchmarked the first time it is
+// seen. This forces one specific backend for all of the tables instead.
+void setHuffmanTableBackend(HuffmanTableBackend backend);
+HuffmanTableBackend getHuffmanTableBackend();
+
+// The backend to use for this table, never Auto. The result of the
+// benchmarking is remembered, so this is cheap after the first call.
+HuffmanTableBackend selectHuffmanTableBackend(const AbstractHuffmanTable& table,
+                                              bool fullDecode,
+                                              bool fixDNGBug16);
+
+template <typename T> struct HuffmanTableType final { using type = T; };
+
+// Calls f(HuffmanTableType<T>()), where T is the implementation of the
+// backend. The whole decoding loop should be inside of f, so that it gets
+// instantiated for each backend, and the table lookups are inlined into it:
+//
+//   dispatchHuffmanTable(backend, [&](auto type) {
+//     using Huffman = typename decltype(type)::type;
+//     ...
+//   });
+template <typename F> void dispatchHuffmanTable(HuffmanTableBackend backend,
+                                                F&& f) {
+  switch (backend) {
+  case HuffmanTableBackend::LUT9:
+    f(HuffmanTableType<BasicHuffmanTableLUT<9>>());
+    break;
+  case HuffmanTableBackend::LUT11:
+    f(HuffmanTableType<BasicHuffmanTableLUT<11>>());
+    break;
+  case HuffmanTableBackend::LUT13:
+    f(HuffmanTableType<BasicHuffmanTableLUT<13>>());
+    break;
+  case HuffmanTableBackend::Lookup:
+    f(HuffmanTableType<HuffmanTableLookup>());
+    break;
+  case HuffmanTableBackend::Tree:
+    f(HuffmanTableType<HuffmanTableTree>());
+    break;
+  case HuffmanTableBackend::Vector:
+    f(HuffmanTableType<HuffmanTableVector>());
+    break;
+  default:
+    ThrowRDE("Unexpected Huffman table backend %i", static_cast<int>(backend));
+  }
+}
+
+} // namespace rawspeed
@@ -25,15 +25,16 @@
 
 #include "decompressors/JpegDecompressor.h"
 
+#include "common/Array2DRef.h"            // for Array2DRef
 #include "common/Common.h"                // for uchar8, uint32, ushort16
-#include "common/Memory.h"                // for alignedFree, alignedMalloc...
 #include "common/Point.h"                 // for iPoint2D
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/ByteStream.h"                // for ByteStream
 #include <algorithm>                      // for min
+#include <array>                          // for array
 #include <cstdio>                         // for size_t
 #include <jpeglib.h>                      // for jpeg
-#include <memory>                         // for unique_ptr
+#include <memory>                         // for make_unique, unique_ptr
 #include <vector>                         // for vector
 
 #ifndef HAVE_JPEG_MEM_SRC
@@ -41,7 +42,6 @@
 #endif
 
 using std::vector;
-using std::unique_ptr;
 using std::min;
 
 namespace rawspeed {
@@ -113,11 +113,22 @@ struct JpegDecompressor::JpegDecompressStruct : jpeg_decompress_struct {
   ~JpegDecompressStruct() { jpeg_destroy_decompress(this); }
 };
 
-void JpegDecompressor::decode(uint32 offX,
+JpegDecompressor::Context::Context()
+    : dinfo(std::make_unique<JpegDecompressStruct>()) {}
+
+JpegDecompressor::Context::~Context() = default;
+
+void JpegDecompressor::decode(uint32 offX, uint32 offY) {
+  Context context;
+  decode(&context, offX, offY);
+}
+
+void JpegDecompressor::decode(Context* context, uint32 offX,
                               uint32 offY) { /* Each slice is a JPEG image */
-  struct JpegDecompressStruct dinfo;
+  JpegDecompressStruct& dinfo = *context->dinfo;
 
-  vector<JSAMPROW> buffer(1);
+  // If the previous tile has failed, the state is still somewhere in it.
+  jpeg_abort_decompress(&dinfo);
 
   const auto size = input.getRemainSize();
 
@@ -129,36 +140,40 @@ void JpegDecompressor::decode(uint32 offX,
   jpeg_start_decompress(&dinfo);
   if (dinfo.output_components != static_cast<int>(mRaw->getCpp()))
     ThrowRDE("Component count doesn't match");
-  int row_stride = dinfo.output_width * dinfo.output_components;
-
-  unique_ptr<uchar8[], // NOLINT
-             decltype(&alignedFree)>
-      complete_buffer(
-          alignedMallocArray<uchar8, 16>(dinfo.output_height, row_stride),
-          &alignedFree);
-  while (dinfo.output_scanline < dinfo.output_height) {
-    buffer[0] = static_cast<JSAMPROW>(
-        &complete_buffer[static_cast<size_t>(dinfo.output_scanline) *
-                         row_stride]);
-    if (0 == jpeg_read_scanlines(&dinfo, &buffer[0], 1))
+  const int row_stride = dinfo.output_width * dinfo.output_components;
+
+  // libjpeg hands out up to rec_outbuf_height rows at once, and they are
+  // widened into the image while they are still in the cache. The rows past
+  // the end of the image are not decoded at all.
+  const int batch = dinfo.rec_outbuf_height;
+  context->rows.resize(static_cast<size_t>(batch) * row_stride);
+  vector<JSAMPROW> buffer(batch);
+  for (int i = 0; i < batch; i++)
+    buffer[i] = &context->rows[static_cast<size_t>(i) * row_stride];
+
+  const int copy_w = min(mRaw->dim.x - offX, dinfo.output_width);
+  const int copy_h = min(mRaw->dim.y - offY, dinfo.output_height);
+  const int copy_n = copy_w * dinfo.output_components;
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+  while (static_cast<int>(dinfo.output_scanline) < copy_h) {
+    mRaw->checkCancelled();
+    const uint32 y = dinfo.output_scanline;
+    const auto lines = jpeg_read_scanlines(&dinfo, &buffer[0], batch);
+    if (0 == lines)
       ThrowRDE("JPEG Error while decompressing image.");
-  }
-  jpeg_finish_decompress(&dinfo);
-
-  // Now the image is decoded, and we copy the image data
-  int copy_w = min(mRaw->dim.x - offX, dinfo.output_width);
-  int copy_h = min(mRaw->dim.y - offY, dinfo.output_height);
-  for (int y = 0; y < copy_h; y++) {
-    uchar8* src = &complete_buffer[static_cast<size_t>(row_stride) * y];
-    auto* dst = reinterpret_cast<ushort16*>(mRaw->getData(offX, y + offY));
-    for (int x = 0; x < copy_w; x++) {
-      for (int c = 0; c < dinfo.output_components; c++) {
-        *dst = *src;
-        src++;
-        dst++;
-      }
+
+    for (uint32 i = 0; i < lines && static_cast<int>(y + i) < copy_h; i++) {
+      const uchar8* src = buffer[i];
+      ushort16* dst = &out(offX * mRaw->getCpp(), offY + y + i);
+      for (int x = 0; x < copy_n; x++)
+        dst[x] = src[x];
     }
   }
+
+  if (dinfo.output_scanline < dinfo.output_height)
+    jpeg_abort_decompress(&dinfo);
+  else
+    jpeg_finish_decompress(&dinfo);
 }
 
 } // namespace rawspeed
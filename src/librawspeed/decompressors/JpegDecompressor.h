@@ -29,7 +29,9 @@
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/ByteStream.h"                      // for ByteStream
 #include "io/Endianness.h"                      // for Endianness, Endianne...
+#include <memory>                               // for unique_ptr
 #include <utility>                              // for move
+#include <vector>                               // for vector
 
 namespace rawspeed {
 
@@ -39,12 +41,26 @@ class JpegDecompressor final : public AbstractDecompressor {
   RawImage mRaw;
 
 public:
+  // The libjpeg state, and the row buffer. Setting them up costs about as
+  // much as decoding a small tile, so one thread reuses them for all of its
+  // tiles.
+  class Context final {
+    friend class JpegDecompressor;
+    std::unique_ptr<JpegDecompressStruct> dinfo;
+    std::vector<uchar8> rows;
+
+  public:
+    Context();
+    ~Context();
+  };
+
   JpegDecompressor(ByteStream bs, const RawImage& img)
       : input(std::move(bs)), mRaw(img) {
     input.setByteOrder(Endianness::big);
   }
 
   void decode(uint32 offsetX, uint32 offsetY);
+  void decode(Context* context, uint32 offsetX, uint32 offsetY);
 };
 
 } // namespace rawspeed
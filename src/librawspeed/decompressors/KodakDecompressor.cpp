@@ -21,15 +21,19 @@
 */
 
 #include "decompressors/KodakDecompressor.h"
+#include "common/Executor.h"              // for parallelFor
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
+#include "common/TableLookUp.h"           // for TableLookUp
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "decompressors/HuffmanTable.h"   // for HuffmanTable
 #include "io/ByteStream.h"                // for ByteStream
+#include "io/Endianness.h"                // for getU16BE
 #include <algorithm>                      // for min
 #include <array>                          // for array
 #include <cassert>                        // for assert
 #include <utility>                        // for move
+#include <vector>                         // for vector
 
 namespace rawspeed {
 
@@ -56,8 +60,33 @@ KodakDecompressor::KodakDecompressor(const RawImage& img, ByteStream bs,
   input.check(mRaw->dim.area() / 2ULL);
 }
 
+// How many bytes decodeSegment() will consume, from the lengths alone.
+uint32 KodakDecompressor::getSegmentSize(const ByteStream& bs,
+                                         const uint32 bsize) {
+  assert(bsize > 0);
+  assert(bsize % 4 == 0);
+  assert(bsize <= segment_size);
+
+  const uchar8* blen = bs.peekData(bsize / 2);
+  uint32 size = bsize / 2;
+  uint32 bits = 0;
+  if ((bsize & 7) == 4) {
+    size += 2;
+    bits = 16;
+  }
+  for (uint32 i = 0; i < bsize; i++) {
+    const uint32 len = i & 1 ? blen[i / 2] >> 4 : blen[i / 2] & 15;
+    if (bits < len) {
+      size += 4;
+      bits += 32;
+    }
+    bits -= len;
+  }
+  return size;
+}
+
 KodakDecompressor::segment
-KodakDecompressor::decodeSegment(const uint32 bsize) {
+KodakDecompressor::decodeSegment(ByteStreamCursor* bs, const uint32 bsize) {
   assert(bsize > 0);
   assert(bsize % 4 == 0);
   assert(bsize <= segment_size);
@@ -71,29 +100,24 @@ KodakDecompressor::decodeSegment(const uint32 bsize) {
                                             out.begin() + bsize);
 #endif
 
-  std::array<uchar8, 2 * segment_size> blen;
+  // One byte per two pixels
+  const uchar8* blen = bs->getData(bsize / 2);
   uint64 bitbuf = 0;
   uint32 bits = 0;
 
-  for (uint32 i = 0; i < bsize; i += 2) {
-    // One byte per two pixels
-    blen[i] = input.peekByte() & 15;
-    blen[i + 1] = input.getByte() >> 4;
-  }
   if ((bsize & 7) == 4) {
-    bitbuf = (static_cast<uint64>(input.getByte())) << 8UL;
-    bitbuf += (static_cast<int>(input.getByte()));
+    bitbuf = getU16BE(bs->getData(2));
     bits = 16;
   }
   for (uint32 i = 0; i < bsize; i++) {
-    uint32 len = blen[i];
+    const uint32 len = i & 1 ? blen[i / 2] >> 4 : blen[i / 2] & 15;
     assert(len < 16);
 
     if (bits < len) {
-      for (uint32 j = 0; j < 32; j += 8) {
-        bitbuf += static_cast<long long>(static_cast<int>(input.getByte()))
-                  << (bits + (j ^ 8));
-      }
+      // Two big-endian 16-bit words, the first one being the lower one.
+      const uchar8* in = bs->getData(4);
+      bitbuf += static_cast<uint64>(getU16BE(in)) << bits;
+      bitbuf += static_cast<uint64>(getU16BE(in + 2)) << (bits + 16);
       bits += 32;
     }
 
@@ -107,37 +131,57 @@ KodakDecompressor::decodeSegment(const uint32 bsize) {
   return out;
 }
 
-void KodakDecompressor::decompress() {
-  uchar8* data = mRaw->getData();
-  uint32 pitch = mRaw->pitch;
+void KodakDecompressor::decompressRow(ByteStream bs, int row) const {
+  ushort16* dest = mRaw->getU16DataAsCroppedArray2DRef()[row];
+  uint32 random = TableLookUp::seedRandom(0, row);
+  const PixelStore store = mRaw->getPixelStore();
 
-  uint32 random = 0;
-  for (auto y = 0; y < mRaw->dim.y; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
+  // The row was sized by getSegmentSize(), which decodeSegment() matches.
+  ByteStreamCursor in = bs.reserve(bs.getRemainSize());
 
-    for (auto x = 0; x < mRaw->dim.x; x += segment_size) {
-      const uint32 len = std::min(segment_size, mRaw->dim.x - x);
+  for (auto x = 0; x < mRaw->dim.x; x += segment_size) {
+    const uint32 len = std::min(segment_size, mRaw->dim.x - x);
 
-      const segment buf = decodeSegment(len);
+    const segment buf = decodeSegment(&in, len);
 
-      std::array<int, 2> pred;
-      pred.fill(0);
+    std::array<int, 2> pred;
+    pred.fill(0);
 
-      for (uint32 i = 0; i < len; i++) {
-        pred[i & 1] += buf[i];
+    for (uint32 i = 0; i < len; i++) {
+      pred[i & 1] += buf[i];
 
-        int value = pred[i & 1];
-        if (unsigned(value) >= (1U << bps))
-          ThrowRDE("Value out of bounds %d (bps = %i)", value, bps);
+      int value = pred[i & 1];
+      if (unsigned(value) >= (1U << bps))
+        ThrowRDE("Value out of bounds %d (bps = %i)", value, bps);
 
-        if (uncorrectedRawValues)
-          dest[x + i] = value;
-        else
-          mRaw->setWithLookUp(value, reinterpret_cast<uchar8*>(&dest[x + i]),
-                              &random);
-      }
+      if (uncorrectedRawValues)
+        dest[x + i] = value;
+      else
+        dest[x + i] = store.get(x + i, row, value, &random);
     }
   }
 }
 
+void KodakDecompressor::decompress() {
+  // The rows are not byte-aligned in any other way, so first find where each
+  // of them begins. That only needs the lengths, which are half a byte per
+  // pixel, and then the rows can be decoded independently.
+  std::vector<ByteStream> rows;
+  rows.reserve(mRaw->dim.y);
+  for (auto y = 0; y < mRaw->dim.y; y++) {
+    const auto begin = input.getPosition();
+    for (auto x = 0; x < mRaw->dim.x; x += segment_size) {
+      const uint32 len = std::min(segment_size, mRaw->dim.x - x);
+      input.skipBytes(getSegmentSize(input, len));
+    }
+    rows.emplace_back(
+        input.getSubStream(begin, input.getPosition() - begin));
+  }
+
+  parallelFor(0, mRaw->dim.y, [this, &rows](int y) {
+    mRaw->checkCancelled();
+    decompressRow(rows[y], y);
+  });
+}
+
 } // namespace rawspeed
@@ -27,6 +27,7 @@
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/ByteStream.h"                      // for ByteStream
 #include <array>                                // for array
+#include <vector>                               // for vector
 
 namespace rawspeed {
 
@@ -39,9 +40,16 @@ class KodakDecompressor final : public AbstractDecompressor {
   static constexpr int segment_size = 256; // pixels
   using segment = std::array<short16, segment_size>;
 
-  segment decodeSegment(uint32 bsize);
+  static uint32 getSegmentSize(const ByteStream& bs, uint32 bsize);
+  static segment decodeSegment(ByteStreamCursor* bs, uint32 bsize);
+
+  void decompressRow(ByteStream bs, int row) const;
 
 public:
+  // Of the input, see RawImageData::expectInput(): the length of each pixel
+  // is half a byte, and then there are its bits, if any.
+  static constexpr uint32 MinBitsPerPixel = 4;
+
   KodakDecompressor(const RawImage& img, ByteStream bs, int bps,
                     bool uncorrectedRawValues_);
 
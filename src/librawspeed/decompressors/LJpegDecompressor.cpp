@@ -19,14 +19,20 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include "rawspeedconfig.h" // for RAWSPEED_TARGET_CLONES
 #include "decompressors/LJpegDecompressor.h"
+#include "common/Array2DRef.h"            // for Array2DRef
 #include "common/Common.h"                // for unroll_loop, uint32, ushort16
+#include "common/Executor.h"              // for parallelFor
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
+#include "common/ScratchArena.h"          // for makeScratchVector
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/BitPumpJPEG.h"               // for BitPumpJPEG, BitStream<>::...
 #include <algorithm>                      // for copy_n
+#include <array>                          // for array
 #include <cassert>                        // for assert
+#include <vector>                         // for vector
 
 using std::copy_n;
 
@@ -148,9 +154,25 @@ void LJpegDecompressor::decodeScan()
   }
 }
 
+// The predictor 1 reconstruction of a row: each sample is the previous
+// sample of the same component plus the difference, with the first ones
+// predicted by pred. The arithmetic is modulo 2^16, as with ushort16 pred.
+template <int N_COMP>
+static void reconstructRow(const ushort16* pred, const ushort16* diffs,
+                           ushort16* dest, unsigned blocks) {
+  std::array<ushort16, N_COMP> p;
+  copy_n(pred, N_COMP, p.data());
+  for (unsigned x = 0; x < blocks; ++x) {
+    unroll_loop<N_COMP>([&](int i) {
+      *dest++ = p[i] += diffs[N_COMP * x + i];
+    });
+  }
+}
+
 // N_COMP == number of components (2, 3 or 4)
 
-template <int N_COMP, bool WeirdWidth> void LJpegDecompressor::decodeN() {
+template <int N_COMP, bool WeirdWidth>
+RAWSPEED_TARGET_CLONES void LJpegDecompressor::decodeN() {
   assert(mRaw->getCpp() > 0);
   assert(N_COMP > 0);
   assert(N_COMP >= mRaw->getCpp());
@@ -159,12 +181,17 @@ template <int N_COMP, bool WeirdWidth> void LJpegDecompressor::decodeN() {
   assert(mRaw->dim.x >= N_COMP);
   assert((mRaw->getCpp() * (mRaw->dim.x - offX)) >= N_COMP);
 
+  if (fullBlocks != 0 && decodeNSpeculatively<N_COMP, WeirdWidth>())
+    return;
+
   auto ht = getHuffmanTables<N_COMP>();
   auto pred = getInitialPredictors<N_COMP>();
   auto predNext = pred.data();
 
   BitPumpJPEG bitStream(input);
 
+  std::vector<ushort16> diffs(N_COMP * fullBlocks);
+
   // A recoded DNG might be split up into tiles of self contained LJpeg blobs.
   // The tiles at the bottom and the right may extend beyond the dimension of
   // the raw image buffer. The excessive content has to be ignored.
@@ -175,25 +202,34 @@ template <int N_COMP, bool WeirdWidth> void LJpegDecompressor::decodeN() {
   assert(offY + h <= static_cast<unsigned>(mRaw->dim.y));
   assert(offX + w <= static_cast<unsigned>(mRaw->dim.x));
 
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsUncroppedArray2DRef());
+
   // For y, we can simply stop decoding when we reached the border.
   for (unsigned y = 0; y < h; ++y) {
-    auto destY = offY + y;
-    auto dest =
-        reinterpret_cast<ushort16*>(mRaw->getDataUncropped(offX, destY));
+    mRaw->checkCancelled();
+    ushort16* dest = &out(offX * mRaw->getCpp(), offY + y);
 
     copy_n(predNext, N_COMP, pred.data());
     // the predictor for the next line is the start of this line
     predNext = dest;
 
+    // For x, we first process all full pixel blocks within the image buffer.
+    // Only the differences are decoded here, so that the entropy decoding
+    // loop has nothing else in it ...
     unsigned x = 0;
-
-    // For x, we first process all full pixel blocks within the image buffer ...
     for (; x < fullBlocks; ++x) {
       unroll_loop<N_COMP>([&](int i) {
-        *dest++ = pred[i] += ht[i]->decodeNext(bitStream);
+        diffs[N_COMP * x + i] = ht[i]->decodeNext(bitStream);
       });
     }
 
+    // ... and then they are all accumulated at once.
+    if (fullBlocks != 0) {
+      reconstructRow<N_COMP>(pred.data(), diffs.data(), dest, fullBlocks);
+      copy_n(dest + N_COMP * (fullBlocks - 1), N_COMP, pred.data());
+      dest += N_COMP * fullBlocks;
+    }
+
     // Sometimes we also need to consume one more block, and produce part of it.
     if /*constexpr*/ (WeirdWidth) {
       // FIXME: evaluate i-cache implications due to this being compile-time.
@@ -224,4 +260,50 @@ template <int N_COMP, bool WeirdWidth> void LJpegDecompressor::decodeN() {
   }
 }
 
+// As decodeN(), but with all of the differences decoded at once, in
+// parallel, by decodeDiffsSpeculatively(). Then the predictors of the rows
+// are known after a pass over their first pixels, and the rows are
+// reconstructed in parallel too.
+template <int N_COMP, bool WeirdWidth>
+bool LJpegDecompressor::decodeNSpeculatively() {
+  assert(fullBlocks != 0);
+
+  const auto ht = getHuffmanTables<N_COMP>();
+  const uint64 rowLength = uint64(N_COMP) * frame.w;
+
+  Diffs diffs = makeScratchVector<ushort16>(mRaw->scratch.get());
+  if (!decodeDiffsSpeculatively({ht.cbegin(), ht.cend()}, rowLength * h,
+                                &diffs))
+    return false;
+
+  // The predictors of a row are the first pixels of the one above.
+  std::vector<std::array<ushort16, N_COMP>> preds(h);
+  preds[0] = getInitialPredictors<N_COMP>();
+  for (unsigned y = 1; y < h; ++y) {
+    unroll_loop<N_COMP>([&](int i) {
+      preds[y][i] = preds[y - 1][i] + diffs[rowLength * (y - 1) + i];
+    });
+  }
+
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsUncroppedArray2DRef());
+  parallelFor(0, h, uint64(h) * mRaw->getCpp() * w * sizeof(ushort16),
+              [this, &diffs, &preds, rowLength, out](int y) {
+                if (mRaw->isCancelled())
+                  return;
+                ushort16* dest = &out(offX * mRaw->getCpp(), offY + y);
+                const ushort16* rowDiffs = &diffs[rowLength * y];
+                reconstructRow<N_COMP>(preds[y].data(), rowDiffs, dest,
+                                       fullBlocks);
+                if (WeirdWidth) {
+                  dest += N_COMP * fullBlocks;
+                  rowDiffs += N_COMP * fullBlocks;
+                  for (unsigned c = 0; c < trailingPixels; ++c)
+                    dest[c] = dest[int(c) - N_COMP] + rowDiffs[c];
+                }
+              });
+  mRaw->checkCancelled();
+
+  return true;
+}
+
 } // namespace rawspeed
@@ -34,6 +34,7 @@ class LJpegDecompressor final : public AbstractLJpegDecompressor
 {
   void decodeScan() override;
   template <int N_COMP, bool WeirdWidth = false> void decodeN();
+  template <int N_COMP, bool WeirdWidth> bool decodeNSpeculatively();
 
   uint32 offX = 0;
   uint32 offY = 0;
@@ -19,17 +19,27 @@
 */
 
 #include "decompressors/NikonDecompressor.h"
-#include "common/Common.h"                // for uint32, clampBits, ushort16
-#include "common/Point.h"                 // for iPoint2D
-#include "common/RawImage.h"              // for RawImage, RawImageData
-#include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "decompressors/HuffmanTable.h"   // for HuffmanTable
-#include "io/BitPumpMSB.h"                // for BitPumpMSB, BitStream<>::f...
-#include "io/Buffer.h"                    // for Buffer
-#include "io/ByteStream.h"                // for ByteStream
-#include <cassert>                        // for assert
-#include <cstdio>                         // for size_t
-#include <vector>                         // for vector
+#include "common/Array2DRef.h"               // for Array2DRef
+#include "common/Common.h"                   // for uint32, clampBits, ushort16
+#include "common/Executor.h"                 // for getExecutor, Executor
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "common/TableLookUp.h"              // for TableLookUp
+#include "common/Trace.h"                    // for RAWSPEED_TRACE_SCOPE
+#include "decoders/RawDecoderException.h"    // for ThrowRDE
+#include "decompressors/HuffmanTable.h"      // for HuffmanTable
+#include "decompressors/HuffmanTableTuner.h" // for dispatchHuffmanTable, sel...
+#include "decompressors/RowCheckpoint.h"     // for RowCheckpointRecorder
+#include "decompressors/RowPipeline.h"       // for pipelineRows
+#include "io/BitPumpMSB.h"                   // for BitPumpMSB, BitStream<>::...
+#include "io/Buffer.h"                       // for Buffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include <algorithm>                         // for max, min
+#include <array>                             // for tuple_size
+#include <cassert>                           // for assert
+#include <cstdio>                            // for size_t
+#include <functional>                        // for function
+#include <vector>                            // for vector
 
 namespace rawspeed {
 
@@ -302,7 +312,7 @@ public:
    *
    *--------------------------------------------------------------
    */
-  int decodeNext(BitPumpMSB& bits) { // NOLINT: google-runtime-references
+  int decodeNext(BitPumpMSB& bits) const { // NOLINT: google-runtime-references
     int rv;
     int l;
     int temp;
@@ -410,9 +420,7 @@ std::vector<ushort16> NikonDecompressor::createCurve(ByteStream* metadata,
     curve.resize(csize + 1UL);
     assert(curve.size() > 1);
 
-    for (uint32 i = 0; i < csize; i++) {
-      curve[i] = metadata->getU16();
-    }
+    metadata->getArray(curve.data(), csize);
   }
 
   // and drop the last value
@@ -432,6 +440,53 @@ Huffman NikonDecompressor::createHuffmanTable(uint32 huffSelect) {
   return ht;
 }
 
+// The trees are fixed, so each table is only set up once, the first time it
+// is needed, and is then shared by all of the threads and files. Not all of
+// the trees are valid for all of the implementations, so they are separate.
+template <typename Huffman, uint32 huffSelect>
+const Huffman& NikonDecompressor::getHuffmanTable() {
+  static const Huffman ht = createHuffmanTable<Huffman>(huffSelect);
+  return ht;
+}
+
+template <typename Huffman>
+const Huffman& NikonDecompressor::getHuffmanTable(uint32 huffSelect) {
+  static_assert(std::tuple_size<decltype(nikon_tree)>::value == 6,
+                "one case per tree");
+
+  switch (huffSelect) {
+  case 0:
+    return getHuffmanTable<Huffman, 0>();
+  case 1:
+    return getHuffmanTable<Huffman, 1>();
+  case 2:
+    return getHuffmanTable<Huffman, 2>();
+  case 3:
+    return getHuffmanTable<Huffman, 3>();
+  case 4:
+    return getHuffmanTable<Huffman, 4>();
+  case 5:
+    return getHuffmanTable<Huffman, 5>();
+  default:
+    ThrowRDE("Invalid Huffman table: %u", huffSelect);
+  }
+}
+
+void NikonDecompressor::prewarm() {
+  // Those of the constructor, of the 12 and the 14 bit files, and of the rows
+  // after the split. This also picks the backend of each table, which is
+  // benchmarked the first time, see selectHuffmanTableBackend().
+  for (uint32 huffSelect : {0U, 2U, 3U, 5U}) {
+    const auto backend = selectHuffmanTableBackend(
+        getHuffmanTable<HuffmanTable>(huffSelect), true, false);
+    dispatchHuffmanTable(backend, [huffSelect](auto type) {
+      getHuffmanTable<typename decltype(type)::type>(huffSelect);
+    });
+    if (huffSelect + 1 < nikon_tree.size())
+      getHuffmanTable<NikonLASDecompressor>(huffSelect + 1);
+  }
+}
+
 NikonDecompressor::NikonDecompressor(const RawImage& raw, ByteStream metadata,
                                      uint32 bitsPS_)
     : mRaw(raw), bitsPS(bitsPS_) {
@@ -475,36 +530,45 @@ NikonDecompressor::NikonDecompressor(const RawImage& raw, ByteStream metadata,
   // If the 'split' happens outside of the image, it does not actually happen.
   if (split >= static_cast<unsigned>(mRaw->dim.y))
     split = 0;
+
+  huffmanBackend = selectHuffmanTableBackend(
+      getHuffmanTable<HuffmanTable>(huffSelect), true, false);
+}
+
+NikonDecompressor::Checkpoint
+NikonDecompressor::getInitialState() const {
+  Checkpoint state;
+  state.pUp1 = pUp1;
+  state.pUp2 = pUp2;
+  return state;
 }
 
 template <typename Huffman>
-void NikonDecompressor::decompress(BitPumpMSB* bits, int start_y, int end_y) {
-  Huffman ht = createHuffmanTable<Huffman>(huffSelect);
+void NikonDecompressor::decompress(BitPumpMSB* bits, int start_y, int end_y,
+                                   uint32 huffSel, Checkpoint* state) {
+  const Huffman& ht = getHuffmanTable<Huffman>(huffSel);
 
-  uchar8* draw = mRaw->getData();
-  uint32 pitch = mRaw->pitch;
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
 
   int pLeft1 = 0;
   int pLeft2 = 0;
 
-  // allow gcc to devirtualize the calls below
-  auto* rawdata = reinterpret_cast<RawImageDataU16*>(mRaw.get());
+  const PixelStore store = mRaw->getPixelStore();
 
   const iPoint2D& size = mRaw->dim;
   assert(size.x % 2 == 0);
   assert(size.x >= 2);
   for (uint32 y = start_y; y < static_cast<uint32>(end_y); y++) {
-    auto* dest =
-        reinterpret_cast<ushort16*>(&draw[y * pitch]); // Adjust destination
-    pUp1[y & 1] += ht.decodeNext(*bits);
-    pUp2[y & 1] += ht.decodeNext(*bits);
-    pLeft1 = pUp1[y & 1];
-    pLeft2 = pUp2[y & 1];
-
-    rawdata->setWithLookUp(clampBits(pLeft1, 15),
-                           reinterpret_cast<uchar8*>(dest + 0), &random);
-    rawdata->setWithLookUp(clampBits(pLeft2, 15),
-                           reinterpret_cast<uchar8*>(dest + 1), &random);
+    mRaw->checkCancelled();
+    ushort16* dest = out[y];
+    uint32 random = TableLookUp::seedRandom(0, y);
+    state->pUp1[y & 1] += ht.decodeNext(*bits);
+    state->pUp2[y & 1] += ht.decodeNext(*bits);
+    pLeft1 = state->pUp1[y & 1];
+    pLeft2 = state->pUp2[y & 1];
+
+    dest[0] = store.get(0, y, clampBits(pLeft1, 15), &random);
+    dest[1] = store.get(1, y, clampBits(pLeft2, 15), &random);
 
     dest += 2;
 
@@ -512,33 +576,178 @@ void NikonDecompressor::decompress(BitPumpMSB* bits, int start_y, int end_y) {
       pLeft1 += ht.decodeNext(*bits);
       pLeft2 += ht.decodeNext(*bits);
 
-      rawdata->setWithLookUp(clampBits(pLeft1, 15),
-                             reinterpret_cast<uchar8*>(dest + 0), &random);
-      rawdata->setWithLookUp(clampBits(pLeft2, 15),
-                             reinterpret_cast<uchar8*>(dest + 1), &random);
+      dest[0] = store.get(x, y, clampBits(pLeft1, 15), &random);
+      dest[1] = store.get(x + 1, y, clampBits(pLeft2, 15), &random);
 
       dest += 2;
     }
   }
 }
 
+template <typename Huffman>
+void NikonDecompressor::scan(
+    BitPumpMSB* bits, int start_y, int end_y, uint32 huffSel, Checkpoint* state,
+    RowCheckpointRecorder<BitPumpMSB>* recorder) const {
+  const Huffman& ht = getHuffmanTable<Huffman>(huffSel);
+
+  const iPoint2D& size = mRaw->dim;
+  for (uint32 y = start_y; y < static_cast<uint32>(end_y); y++) {
+    if (recorder->atRow(y, *bits, state))
+      mRaw->checkCancelled();
+
+    // Only the vertical predictors are carried over from row to row.
+    state->pUp1[y & 1] += ht.decodeNext(*bits);
+    state->pUp2[y & 1] += ht.decodeNext(*bits);
+    for (uint32 x = 2; x < static_cast<uint32>(size.x); x += 2) {
+      ht.decodeNext(*bits);
+      ht.decodeNext(*bits);
+    }
+  }
+}
+
+void NikonDecompressor::decompressBand(const ByteStream& data,
+                                       Checkpoint state, uint32 end_y) {
+  RAWSPEED_TRACE_SCOPE("decompressor", "Nikon band");
+  auto bits = getBitPumpAt<BitPumpMSB>(data, state.bitPosition);
+
+  const uint32 splitRow = split ? split : mRaw->dim.y;
+
+  if (state.row < splitRow) {
+    dispatchHuffmanTable(huffmanBackend, [&](auto type) {
+      decompress<typename decltype(type)::type>(
+          &bits, state.row, std::min(end_y, splitRow), huffSelect, &state);
+    });
+  }
+  if (end_y > splitRow) {
+    decompress<NikonLASDecompressor>(&bits, std::max(state.row, splitRow),
+                                     end_y, huffSelect + 1, &state);
+  }
+}
+
+template <typename Huffman>
+void NikonDecompressor::decodeRow(const Huffman& ht, BitPumpMSB* bits,
+                                  uint32 y, Checkpoint* state, int* diffs,
+                                  uint32 width) {
+  state->pUp1[y & 1] += ht.decodeNext(*bits);
+  state->pUp2[y & 1] += ht.decodeNext(*bits);
+  diffs[0] = state->pUp1[y & 1];
+  diffs[1] = state->pUp2[y & 1];
+  for (uint32 x = 2; x < width; x++)
+    diffs[x] = ht.decodeNext(*bits);
+}
+
+void NikonDecompressor::reconstructRow(const PixelStore& store, uint32 y,
+                                       const int* diffs) const {
+  ushort16* dest = mRaw->getU16DataAsCroppedArray2DRef()[y];
+  uint32 random = TableLookUp::seedRandom(0, y);
+  int pLeft1 = diffs[0];
+  int pLeft2 = diffs[1];
+  dest[0] = store.get(0, y, clampBits(pLeft1, 15), &random);
+  dest[1] = store.get(1, y, clampBits(pLeft2, 15), &random);
+
+  for (uint32 x = 2; x < static_cast<uint32>(mRaw->dim.x); x += 2) {
+    pLeft1 += diffs[x];
+    pLeft2 += diffs[x + 1];
+    dest[x] = store.get(x, y, clampBits(pLeft1, 15), &random);
+    dest[x + 1] = store.get(x + 1, y, clampBits(pLeft2, 15), &random);
+  }
+}
+
+void NikonDecompressor::decompressPipelined(const ByteStream& data,
+                                            uint32 rows) {
+  RAWSPEED_TRACE_SCOPE("decompressor", "Nikon pipelined");
+  // Enough for the reconstruction to not wait for every row.
+  static constexpr int numSlots = 16;
+
+  const uint32 width = mRaw->dim.x;
+  const uint32 splitRow = split ? split : mRaw->dim.y;
+  const PixelStore store = mRaw->getPixelStore();
+
+  Checkpoint state = getInitialState();
+  BitPumpMSB bits(data);
+  std::vector<int> slots(static_cast<size_t>(numSlots) * width);
+
+  const auto& las = getHuffmanTable<NikonLASDecompressor>(huffSelect + 1);
+  dispatchHuffmanTable(huffmanBackend, [&](auto type) {
+    using Huffman = typename decltype(type)::type;
+    const Huffman& ht = getHuffmanTable<Huffman>(huffSelect);
+
+    pipelineRows(
+        rows, numSlots,
+        [&](int y, int slot) {
+          mRaw->checkCancelled();
+          int* diffs = &slots[slot * width];
+          if (static_cast<uint32>(y) < splitRow)
+            decodeRow(ht, &bits, y, &state, diffs, width);
+          else
+            decodeRow(las, &bits, y, &state, diffs, width);
+        },
+        [&](int y, int slot) {
+          reconstructRow(store, y, &slots[slot * width]);
+        });
+  });
+}
+
+void NikonDecompressor::clearRowsAfter(uint32* rows) {
+  *rows = std::min(*rows, static_cast<uint32>(mRaw->dim.y));
+  mRaw->clearArea({0, static_cast<int>(*rows), mRaw->dim.x,
+                   mRaw->dim.y - static_cast<int>(*rows)});
+}
+
 void NikonDecompressor::decompress(const ByteStream& data,
                                    bool uncorrectedRawValues) {
+  decompressRows(data, uncorrectedRawValues, mRaw->dim.y);
+}
+
+void NikonDecompressor::decompressRows(const ByteStream& data,
+                                       bool uncorrectedRawValues, uint32 rows) {
   RawImageCurveGuard curveHandler(&mRaw, curve, uncorrectedRawValues);
 
-  BitPumpMSB bits(data);
+  assert(split == 0 || split < static_cast<unsigned>(mRaw->dim.y));
 
-  random = bits.peekBits(24);
+  clearRowsAfter(&rows);
+  if (rows == 0)
+    return;
 
-  assert(split == 0 || split < static_cast<unsigned>(mRaw->dim.y));
+  if (pipelined && getExecutor()->getConcurrency() > 1)
+    decompressPipelined(data, rows);
+  else
+    decompressBand(data, getInitialState(), rows);
+}
+
+std::vector<NikonDecompressor::Checkpoint>
+NikonDecompressor::scan(const ByteStream& data, int rowsPerCheckpoint) const {
+  RowCheckpointRecorder<BitPumpMSB> recorder(rowsPerCheckpoint, mRaw->dim.y);
+
+  Checkpoint state = getInitialState();
+  BitPumpMSB bits(data);
+
+  const uint32 splitRow = split ? split : mRaw->dim.y;
 
-  if (!split) {
-    decompress<HuffmanTable>(&bits, 0, mRaw->dim.y);
-  } else {
-    decompress<HuffmanTable>(&bits, 0, split);
-    huffSelect += 1;
-    decompress<NikonLASDecompressor>(&bits, split, mRaw->dim.y);
+  dispatchHuffmanTable(huffmanBackend, [&](auto type) {
+    scan<typename decltype(type)::type>(&bits, 0, splitRow, huffSelect, &state,
+                                        &recorder);
+  });
+  if (splitRow < static_cast<unsigned>(mRaw->dim.y)) {
+    scan<NikonLASDecompressor>(&bits, splitRow, mRaw->dim.y, huffSelect + 1,
+                               &state, &recorder);
   }
+
+  return recorder.release();
+}
+
+void NikonDecompressor::decompress(const ByteStream& data,
+                                   bool uncorrectedRawValues,
+                                   const std::vector<Checkpoint>& checkpoints,
+                                   uint32 rows) {
+  RawImageCurveGuard curveHandler(&mRaw, curve, uncorrectedRawValues);
+
+  clearRowsAfter(&rows);
+
+  decodeBands(checkpoints, mRaw->dim.y, rows,
+              [this, &data](const Checkpoint& state, uint32 end_y) {
+                decompressBand(data, state, end_y);
+              });
 }
 
 } // namespace rawspeed
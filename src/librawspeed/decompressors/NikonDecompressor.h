@@ -20,10 +20,14 @@
 
 #pragma once
 
-#include "common/Common.h"                      // for uint32, ushort16
+#include "common/Common.h"                      // for uint32, ushort16, uint64
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
+#include "decompressors/HuffmanTableTuner.h"    // for HuffmanTableBackend
+#include "decompressors/RowCheckpoint.h"        // for RowCheckpoint
 #include "io/BitPumpMSB.h"                      // for BitPumpMSB
+#include <array>                                // for array
+#include <limits>                               // for numeric_limits
 #include <vector>                               // for vector
 
 namespace rawspeed {
@@ -37,28 +41,90 @@ class NikonDecompressor final : public AbstractDecompressor {
   uint32 huffSelect = 0;
   uint32 split = 0;
 
+  // Of the rows before the split, the rest always uses NikonLASDecompressor.
+  HuffmanTableBackend huffmanBackend;
+
   std::array<int, 2> pUp1;
   std::array<int, 2> pUp2;
 
   std::vector<ushort16> curve;
 
-  uint32 random;
-
 public:
+  using Checkpoint = RowCheckpoint;
+
+  // Of the input, see RawImageData::expectInput(): a Huffman code per pixel.
+  static constexpr uint32 MinBitsPerPixel = 1;
+
+  // If set, and there are the threads for it, decompressRows() decodes the
+  // Huffman codes of the rows on one of them, and the pixels are
+  // reconstructed from those on another, see pipelineRows(). The pixels are
+  // the same either way.
+  bool pipelined = false;
+
   NikonDecompressor(const RawImage& raw, ByteStream metadata, uint32 bitsPS);
 
+  // Sets up the fixed Huffman tables now, rather than for the first file
+  // that uses each of them, see prewarm().
+  static void prewarm();
+
   void decompress(const ByteStream& data, bool uncorrectedRawValues);
 
+  // Only decodes the first rows rows, and clears the rest.
+  void decompressRows(const ByteStream& data, bool uncorrectedRawValues,
+                      uint32 rows);
+
+  // The first pass: only decodes the Huffman codes, and returns a checkpoint
+  // for every rowsPerCheckpoint'th row.
+  std::vector<Checkpoint> scan(const ByteStream& data,
+                               int rowsPerCheckpoint) const;
+
+  // The second pass: decodes the bands of rows in between the checkpoints
+  // in parallel. The checkpoints must have been returned by scan().
+  // As with decompressRows(), only the first rows rows are decoded.
+  void decompress(const ByteStream& data, bool uncorrectedRawValues,
+                  const std::vector<Checkpoint>& checkpoints,
+                  uint32 rows = std::numeric_limits<uint32>::max());
+
 private:
   static const std::array<std::array<std::array<uchar8, 16>, 2>, 6> nikon_tree;
   static std::vector<ushort16> createCurve(ByteStream* metadata, uint32 bitsPS,
                                            uint32 v0, uint32 v1, uint32* split);
 
+  Checkpoint getInitialState() const;
+
+  // Clamps the rows to the height, and clears the ones after them.
+  void clearRowsAfter(uint32* rows);
+
+  void decompressBand(const ByteStream& data, Checkpoint state, uint32 end_y);
+
+  // The first rows rows, with pipelineRows(), as decompressBand() would.
+  void decompressPipelined(const ByteStream& data, uint32 rows);
+
+  // The stages of decompressPipelined(). The first two of the diffs of a row
+  // are the predictions of its first two pixels, the rest the differences.
+  template <typename Huffman>
+  static void decodeRow(const Huffman& ht, BitPumpMSB* bits, uint32 y,
+                        Checkpoint* state, int* diffs, uint32 width);
+  void reconstructRow(const PixelStore& store, uint32 y,
+                      const int* diffs) const;
+
   template <typename Huffman>
-  void decompress(BitPumpMSB* bits, int start_y, int end_y);
+  void decompress(BitPumpMSB* bits, int start_y, int end_y, uint32 huffSel,
+                  Checkpoint* state);
+
+  template <typename Huffman>
+  void scan(BitPumpMSB* bits, int start_y, int end_y, uint32 huffSel,
+            Checkpoint* state,
+            RowCheckpointRecorder<BitPumpMSB>* recorder) const;
 
   template <typename Huffman>
   static Huffman createHuffmanTable(uint32 huffSelect);
+
+  template <typename Huffman, uint32 huffSelect>
+  static const Huffman& getHuffmanTable();
+
+  template <typename Huffman>
+  static const Huffman& getHuffmanTable(uint32 huffSelect);
 };
 
 } // namespace rawspeed
@@ -21,6 +21,7 @@
 */
 
 #include "decompressors/OlympusDecompressor.h"
+#include "common/Array2DRef.h"            // for Array2DRef
 #include "common/Common.h"                // for uint32, ushort16, uchar8
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
@@ -32,8 +33,8 @@
 #include <cassert>                        // for assert
 #include <cmath>                          // for abs
 #include <cstdlib>                        // for abs
-#include <memory>                         // for unique_ptr
 #include <type_traits>                    // for enable_if_t, is_integral
+#include <vector>                         // for vector
 
 namespace {
 
@@ -64,178 +65,158 @@ OlympusDecompressor::OlympusDecompressor(const RawImage& img) : mRaw(img) {
 }
 
 /* This is probably the slowest decoder of them all.
- * I cannot see any way to effectively speed up the prediction
- * phase, which is by far the slowest part of this algorithm.
- * Also there is no way to multithread this code, since prediction
- * is based on the output of all previous pixel (bar the first four)
+ * Each row is predicted from the decoded row above it, so there is no way
+ * to multithread this code. The only state carried between the rows is the
+ * position in the bit stream, but finding it requires decoding all the
+ * previous rows anyway.
+ * So the row is first entropy-decoded into the residuals, and then they are
+ * predicted, with the borders handled outside of the main loop. That way
+ * neither of the loops needs to branch on the position within the image.
  */
 
-void OlympusDecompressor::decompress(ByteStream input) const {
+namespace {
+
+// For each 12 bits of the stream, the number of the leading zero bits.
+const std::array<char, 4096>& getBitTable() {
+  static const std::array<char, 4096> bittable = []() {
+    std::array<char, 4096> t;
+    for (int i = 0; i < 4096; i++) {
+      int high;
+      for (high = 0; high < 12; high++)
+        if ((i >> (11 - high)) & 1)
+          break;
+      t[i] = std::min(12, high);
+    }
+    return t;
+  }();
+  return bittable;
+}
+
+// Decodes the next residual, of the pixel with the given carry.
+inline int decodeResidual(BitPumpMSB* bits,
+                          const std::array<char, 4096>& bittable,
+                          std::array<int, 3>* carry) {
+  bits->fill();
+  const int i = 2 * ((*carry)[2] < 3);
+  int nbits;
+  for (nbits = 2 + i; static_cast<ushort16>((*carry)[0]) >> (nbits + i);
+       nbits++)
+    ;
+
+  const int b = bits->peekBitsNoFill(15);
+  const int sign = (b >> 14) * -1;
+  const int low = (b >> 12) & 3;
+  int high = bittable[b & 4095];
+
+  // Skip bytes used above or read bits
+  if (high == 12) {
+    bits->skipBitsNoFill(15);
+    high = bits->getBits(16 - nbits) >> 1;
+  } else
+    bits->skipBitsNoFill(high + 1 + 3);
+
+  (*carry)[0] = (high << nbits) | bits->getBits(nbits);
+  const int diff = ((*carry)[0] ^ sign) + (*carry)[1];
+  (*carry)[1] = (diff * 3 + (*carry)[1]) >> 5;
+  (*carry)[2] = (*carry)[0] > 16 ? 0 : (*carry)[2] + 1;
+
+  return (diff * 4) | low;
+}
+
+void decodeResiduals(BitPumpMSB* bits, const std::array<char, 4096>& bittable,
+                     int* residuals, int width) {
+  std::array<int, 3> evenCarry{{}};
+  std::array<int, 3> oddCarry{{}};
+
+  for (int x = 0; x < width; x += 2) {
+    residuals[x] = decodeResidual(bits, bittable, &evenCarry);
+    residuals[x + 1] = decodeResidual(bits, bittable, &oddCarry);
+  }
+}
+
+// The first two rows are only predicted from the left.
+void predictTopRow(const int* residuals, ushort16* dest, int width) {
+  std::array<int, 2> left{{residuals[0], residuals[1]}};
+  dest[0] = left[0];
+  dest[1] = left[1];
+
+  for (int x = 2; x < width; x += 2) {
+    for (int c = 0; c < 2; c++) {
+      left[c] += residuals[x + c];
+      dest[x + c] = left[c];
+    }
+  }
+}
+
+void predictRow(const int* residuals, const ushort16* up, ushort16* dest,
+                int width) {
+  std::array<int, 2> left;
+  std::array<int, 2> nw;
+  for (int c = 0; c < 2; c++) {
+    nw[c] = up[c];
+    left[c] = up[c] + residuals[c];
+    dest[c] = left[c];
+  }
+
+  for (int x = 2; x < width; x += 2) {
+    for (int c = 0; c < 2; c++) {
+      const int u = up[x + c];
+      const int leftMinusNw = left[c] - nw[c];
+      const int upMinusNw = u - nw[c];
+
+      int pred;
+      // Check if sign is different, and they are both not zero
+      if ((SignBit(leftMinusNw) ^ SignBit(upMinusNw)) &&
+          (leftMinusNw != 0 && upMinusNw != 0)) {
+        if (std::abs(leftMinusNw) > 32 || std::abs(upMinusNw) > 32)
+          pred = left[c] + upMinusNw;
+        else
+          pred = (left[c] + u) >> 1;
+      } else
+        pred = std::abs(leftMinusNw) > std::abs(upMinusNw) ? left[c] : u;
+
+      // Set predictors
+      left[c] = pred + residuals[x + c];
+      nw[c] = u;
+      // Set the pixel
+      dest[x + c] = left[c];
+    }
+  }
+}
+
+} // namespace
+
+void OlympusDecompressor::prewarm() { getBitTable(); }
+
+void OlympusDecompressor::decompress(ByteStream input, uint32 rows) const {
   assert(mRaw->dim.y > 0);
   assert(mRaw->dim.x > 0);
   assert(mRaw->dim.x % 2 == 0);
 
-  int nbits;
-  int sign;
-  int low;
-  int high;
-  int i;
-  std::array<int, 2> left{{}};
-  std::array<int, 2> nw{{}};
-  int pred;
-  int diff;
-
-  uchar8* data = mRaw->getData();
-  int pitch = mRaw->pitch;
-
-  /* Build a table to quickly look up "high" value */
-  std::unique_ptr<char[]> bittable(new char[4096]); // NOLINT
-
-  for (i = 0; i < 4096; i++) {
-    int b = i;
-    for (high = 0; high < 12; high++)
-      if ((b >> (11 - high)) & 1)
-        break;
-    bittable[i] = std::min(12, high);
-  }
+  const int width = mRaw->dim.x;
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+
+  /* A table to quickly look up "high" value */
+  const std::array<char, 4096>& bittable = getBitTable();
 
   input.skipBytes(7);
   BitPumpMSB bits(input);
 
-  for (uint32 y = 0; y < static_cast<uint32>(mRaw->dim.y); y++) {
-    std::array<std::array<int, 3>, 2> acarry{{}};
-
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
-    bool y_border = y < 2;
-    bool border = true;
-    for (uint32 x = 0; x < static_cast<uint32>(mRaw->dim.x); x++) {
-      int c = 0;
-
-      bits.fill();
-      i = 2 * (acarry[c][2] < 3);
-      for (nbits = 2 + i; static_cast<ushort16>(acarry[c][0]) >> (nbits + i);
-           nbits++)
-        ;
-
-      int b = bits.peekBitsNoFill(15);
-      sign = (b >> 14) * -1;
-      low = (b >> 12) & 3;
-      high = bittable[b & 4095];
-
-      // Skip bytes used above or read bits
-      if (high == 12) {
-        bits.skipBitsNoFill(15);
-        high = bits.getBits(16 - nbits) >> 1;
-      } else
-        bits.skipBitsNoFill(high + 1 + 3);
-
-      acarry[c][0] = (high << nbits) | bits.getBits(nbits);
-      diff = (acarry[c][0] ^ sign) + acarry[c][1];
-      acarry[c][1] = (diff * 3 + acarry[c][1]) >> 5;
-      acarry[c][2] = acarry[c][0] > 16 ? 0 : acarry[c][2] + 1;
-
-      if (border) {
-        if (y_border && x < 2)
-          pred = 0;
-        else {
-          if (y_border)
-            pred = left[c];
-          else {
-            pred = dest[-pitch + (static_cast<int>(x))];
-            nw[c] = pred;
-          }
-        }
-        // Set predictor
-        left[c] = pred + ((diff * 4) | low);
-        // Set the pixel
-        dest[x] = left[c];
-      } else {
-        // Have local variables for values used several tiles
-        // (having a "ushort16 *dst_up" that caches dest[-pitch+((int)x)] is
-        // actually slower, probably stack spill or aliasing)
-        int up = dest[-pitch + (static_cast<int>(x))];
-        int leftMinusNw = left[c] - nw[c];
-        int upMinusNw = up - nw[c];
-        // Check if sign is different, and they are both not zero
-        if ((SignBit(leftMinusNw) ^ SignBit(upMinusNw)) &&
-            (leftMinusNw != 0 && upMinusNw != 0)) {
-          if (std::abs(leftMinusNw) > 32 || std::abs(upMinusNw) > 32)
-            pred = left[c] + upMinusNw;
-          else
-            pred = (left[c] + up) >> 1;
-        } else
-          pred = std::abs(leftMinusNw) > std::abs(upMinusNw) ? left[c] : up;
-
-        // Set predictors
-        left[c] = pred + ((diff * 4) | low);
-        nw[c] = up;
-        // Set the pixel
-        dest[x] = left[c];
-      }
-
-      // ODD PIXELS
-      x += 1;
-      c = 1;
-      bits.fill();
-      i = 2 * (acarry[c][2] < 3);
-      for (nbits = 2 + i; static_cast<ushort16>(acarry[c][0]) >> (nbits + i);
-           nbits++)
-        ;
-      b = bits.peekBitsNoFill(15);
-      sign = (b >> 14) * -1;
-      low = (b >> 12) & 3;
-      high = bittable[b & 4095];
-
-      // Skip bytes used above or read bits
-      if (high == 12) {
-        bits.skipBitsNoFill(15);
-        high = bits.getBits(16 - nbits) >> 1;
-      } else
-        bits.skipBitsNoFill(high + 1 + 3);
-
-      acarry[c][0] = (high << nbits) | bits.getBits(nbits);
-      diff = (acarry[c][0] ^ sign) + acarry[c][1];
-      acarry[c][1] = (diff * 3 + acarry[c][1]) >> 5;
-      acarry[c][2] = acarry[c][0] > 16 ? 0 : acarry[c][2] + 1;
-
-      if (border) {
-        if (y_border && x < 2)
-          pred = 0;
-        else {
-          if (y_border)
-            pred = left[c];
-          else {
-            pred = dest[-pitch + (static_cast<int>(x))];
-            nw[c] = pred;
-          }
-        }
-        // Set predictor
-        left[c] = pred + ((diff * 4) | low);
-        // Set the pixel
-        dest[x] = left[c];
-      } else {
-        int up = dest[-pitch + (static_cast<int>(x))];
-        int leftMinusNw = left[c] - nw[c];
-        int upMinusNw = up - nw[c];
-
-        // Check if sign is different, and they are both not zero
-        if ((SignBit(leftMinusNw) ^ SignBit(upMinusNw)) &&
-            (leftMinusNw != 0 && upMinusNw != 0)) {
-          if (std::abs(leftMinusNw) > 32 || std::abs(upMinusNw) > 32)
-            pred = left[c] + upMinusNw;
-          else
-            pred = (left[c] + up) >> 1;
-        } else
-          pred = std::abs(leftMinusNw) > std::abs(upMinusNw) ? left[c] : up;
-
-        // Set predictors
-        left[c] = pred + ((diff * 4) | low);
-        nw[c] = up;
-        // Set the pixel
-        dest[x] = left[c];
-      }
-      border = y_border;
-    }
+  rows = std::min(rows, static_cast<uint32>(mRaw->dim.y));
+  mRaw->clearArea({0, static_cast<int>(rows), mRaw->dim.x,
+                   mRaw->dim.y - static_cast<int>(rows)});
+
+  std::vector<int> residuals(width);
+  for (uint32 y = 0; y < rows; y++) {
+    mRaw->checkCancelled();
+    decodeResiduals(&bits, bittable, residuals.data(), width);
+
+    ushort16* dest = out[y];
+    if (y < 2)
+      predictTopRow(residuals.data(), dest, width);
+    else
+      predictRow(residuals.data(), out[y - 2], dest, width);
+    mRaw->notifyAreaReady({0, static_cast<int>(y), width, 1});
   }
 }
 
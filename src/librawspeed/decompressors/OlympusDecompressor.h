@@ -20,8 +20,10 @@
 
 #pragma once
 
+#include "common/Common.h"                      // for uint32
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
+#include <limits>                               // for numeric_limits
 
 namespace rawspeed {
 
@@ -32,7 +34,13 @@ class OlympusDecompressor final : public AbstractDecompressor {
 
 public:
   explicit OlympusDecompressor(const RawImage& img);
-  void decompress(ByteStream input) const;
+
+  // Builds the fixed lookup table now, rather than for the first file, see
+  // prewarm().
+  static void prewarm();
+  // Only decodes the first rows rows, and clears the rest.
+  void decompress(ByteStream input,
+                  uint32 rows = std::numeric_limits<uint32>::max()) const;
 };
 
 } // namespace rawspeed
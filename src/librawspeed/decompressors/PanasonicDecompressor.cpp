@@ -22,11 +22,13 @@
 
 #include "rawspeedconfig.h"
 #include "decompressors/PanasonicDecompressor.h"
-#include "common/Mutex.h"                 // for MutexLocker
+#include "common/Array2DRef.h"            // for Array2DRef
+#include "common/Executor.h"              // for parallelForRange
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/Buffer.h"                    // for Buffer, Buffer::size_type
+#include "io/Endianness.h"                // for getLE
 #include <algorithm>                      // for generate_n, min
 #include <array>                          // for array
 #include <cassert>                        // for assert
@@ -96,7 +98,8 @@ void PanasonicDecompressor::chopInputIntoBlocks() {
                   [input = &input, &currPixel, pixelToCoordinate]() -> Block {
                     assert(input->getRemainSize() != 0);
                     const auto blockSize =
-                        std::min(input->getRemainSize(), BlockSize);
+                        std::min<ByteStream::size_type>(
+                            input->getRemainSize(), BlockSize);
                     assert(blockSize > 0);
                     assert(blockSize % BytesPerPacket == 0);
                     const auto packets = blockSize / BytesPerPacket;
@@ -119,53 +122,103 @@ void PanasonicDecompressor::chopInputIntoBlocks() {
   blocks.back().endCoord.y -= 1;
 }
 
+// The bits of a block are read from the top of its 16-byte groups down, one
+// group after the other. If a read goes past the bottom of a group, it is
+// from the top of the next one, with the first byte of the one after that
+// above it (this is how the format is defined, the bits that are left of the
+// group are skipped). The second section of the block goes first, so the
+// group at their seam is the only one that is not contiguous in memory.
 class PanasonicDecompressor::ProxyStream {
-  ByteStream block;
-  const uint32 section_split_offset;
-  std::vector<uchar8> buf;
+  static constexpr int GroupSize = 16;
+  static constexpr int GroupBits = 8 * GroupSize;
+
+  // The order in which they are read.
+  std::array<const uchar8*, 2> sections;
+  std::array<uint32, 2> sectionSizes;
+
+  // The current group, with the byte after it.
+  const uchar8* group = nullptr;
+  std::array<uchar8, GroupSize + 1> seam;
+  uint32 nextGroup = 0;
+
+  // How many bits of the group are left.
+  int pos = 0;
+
+  // The bits of the group from cacheBase up.
+  uint64 cache = 0;
+  int cacheBase = GroupBits;
+
+  uchar8 at(uint32 i) const {
+    for (int s = 0; s < 2; s++) {
+      if (i < sectionSizes[s])
+        return sections[s][i];
+      i -= sectionSizes[s];
+    }
+    return 0;
+  }
+
+  void loadGroup() noexcept {
+    const uint32 begin = nextGroup;
+    nextGroup = (nextGroup + GroupSize) % BlockSize;
+
+    // The group is just a pointer, unless it is split by the seam, or it is
+    // the last one, which has a zero after it.
+    uint32 i = begin;
+    for (int s = 0; s < 2; s++) {
+      if (i + GroupSize < sectionSizes[s]) {
+        group = sections[s] + i;
+        return;
+      }
+      if (i < sectionSizes[s])
+        break;
+      i -= sectionSizes[s];
+    }
+    for (int j = 0; j < GroupSize + 1; j++)
+      seam[j] = at(begin + j);
+    group = seam.data();
+  }
 
-  int vbits = 0;
+  void fillCache() noexcept {
+    // The bits to be read are all within pos .. pos + 8.
+    const int byte = pos >= 48 ? (pos - 48) >> 3 : 0;
+    cache = getLE<uint64>(group + byte);
+    cacheBase = 8 * byte;
+  }
 
-  void parseBlock() {
-    assert(buf.empty());
+public:
+  ProxyStream(const ByteStream& block, uint32 section_split_offset) {
     assert(block.getRemainSize() <= BlockSize);
     assert(section_split_offset <= BlockSize);
 
-    Buffer FirstSection = block.getBuffer(section_split_offset);
-    Buffer SecondSection = block.getBuffer(block.getRemainSize());
-
-    // get one more byte, so the return statement of getBits does not have
-    // to special case for accessing the last byte
-    buf.reserve(BlockSize + 1UL);
-
-    // First copy the second section. This makes it the first section.
-    buf.insert(buf.end(), SecondSection.begin(), SecondSection.end());
-    // Now append the original 1'st section right after the new 1'st section.
-    buf.insert(buf.end(), FirstSection.begin(), FirstSection.end());
+    ByteStream bs = block;
+    const Buffer FirstSection = bs.getBuffer(section_split_offset);
+    const Buffer SecondSection = bs.getBuffer(bs.getRemainSize());
+    assert(bs.getRemainSize() == 0);
 
-    assert(block.getRemainSize() == 0);
-
-    // get one more byte, so the return statement of getBits does not have
-    // to special case for accessing the last byte
-    buf.emplace_back(0);
-  }
-
-public:
-  ProxyStream(ByteStream block_, int section_split_offset_)
-      : block(std::move(block_)), section_split_offset(section_split_offset_) {
-    parseBlock();
+    sections[0] = SecondSection.begin();
+    sectionSizes[0] = SecondSection.getSize();
+    sections[1] = FirstSection.begin();
+    sectionSizes[1] = FirstSection.getSize();
   }
 
   uint32 getBits(int nbits) noexcept {
-    vbits = (vbits - nbits) & 0x1ffff;
-    int byte = vbits >> 3 ^ 0x3ff0;
-    return (buf[byte] | buf[byte + 1UL] << 8) >> (vbits & 7) & ~(-(1 << nbits));
+    assert(nbits > 0 && nbits <= 8);
+    pos -= nbits;
+    if (pos < 0) {
+      // The first group, or a read past the bottom of this one.
+      loadGroup();
+      pos += GroupBits;
+      cacheBase = GroupBits;
+    }
+    if (pos < cacheBase)
+      fillCache();
+    return (cache >> (pos - cacheBase)) & ((1U << nbits) - 1U);
   }
 };
 
 void PanasonicDecompressor::processPixelPacket(
     ProxyStream* bits, int y, ushort16* dest, int xbegin,
-    std::vector<uint32>* zero_pos) const noexcept {
+    std::vector<BadPixelPosition>* zero_pos) const noexcept {
   int sh = 0;
 
   std::array<int, 2> pred;
@@ -201,17 +254,18 @@ void PanasonicDecompressor::processPixelPacket(
     *dest = pred[c];
 
     if (zero_is_bad && 0 == pred[c])
-      zero_pos->push_back((y << 16) | (xbegin + p));
+      zero_pos->push_back(getBadPixelPosition(xbegin + p, y));
 
     u++;
     dest++;
   }
 }
 
-void PanasonicDecompressor::processBlock(const Block& block,
-                                         std::vector<uint32>* zero_pos) const
+void PanasonicDecompressor::processBlock(
+    const Block& block, std::vector<BadPixelPosition>* zero_pos) const
     noexcept {
   ProxyStream bits(block.bs, section_split_offset);
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
 
   for (int y = block.beginCoord.y; y <= block.endCoord.y; y++) {
     int x = 0;
@@ -224,7 +278,7 @@ void PanasonicDecompressor::processBlock(const Block& block,
     if (block.endCoord.y == y)
       endx = block.endCoord.x;
 
-    auto* dest = reinterpret_cast<ushort16*>(mRaw->getData(x, y));
+    ushort16* dest = out[y] + x;
 
     assert(x % PixelsPerPacket == 0);
     assert(endx % PixelsPerPacket == 0);
@@ -238,31 +292,24 @@ void PanasonicDecompressor::processBlock(const Block& block,
   }
 }
 
-void PanasonicDecompressor::decompressThread() const noexcept {
-  std::vector<uint32> zero_pos;
-
-  assert(!blocks.empty());
+void PanasonicDecompressor::decompressThread(int beginBlock, int endBlock) const
+    noexcept {
+  std::vector<BadPixelPosition> zero_pos;
 
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto block = blocks.cbegin(); block < blocks.cend(); ++block)
+  for (auto block = blocks.cbegin() + beginBlock;
+       block < blocks.cbegin() + endBlock && !mRaw->isCancelled(); ++block)
     processBlock(*block, &zero_pos);
 
-  if (zero_is_bad && !zero_pos.empty()) {
-    MutexLocker guard(&mRaw->mBadPixelMutex);
-    mRaw->mBadPixelPositions.insert(mRaw->mBadPixelPositions.end(),
-                                    zero_pos.begin(), zero_pos.end());
-  }
+  if (zero_is_bad)
+    mRaw->addBadPixels(zero_pos);
 }
 
-void PanasonicDecompressor::decompress() const noexcept {
+void PanasonicDecompressor::decompress() const {
   assert(!blocks.empty());
-#ifdef HAVE_OPENMP
-#pragma omp parallel default(none)                                             \
-    num_threads(rawspeed_get_number_of_processor_cores())
-#endif
-  decompressThread();
+  parallelForRange(0, blocks.size(), [this](int beginBlock, int endBlock) {
+    decompressThread(beginBlock, endBlock);
+  });
+  mRaw->checkCancelled();
 }
 
 } // namespace rawspeed
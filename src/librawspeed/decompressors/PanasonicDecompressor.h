@@ -20,9 +20,9 @@
 
 #pragma once
 
-#include "common/Common.h"                      // for uint32
+#include "common/Common.h"                      // for uchar8, uint32
 #include "common/Point.h"                       // for iPoint2D
-#include "common/RawImage.h"                    // for RawImage
+#include "common/RawImage.h"                    // for RawImage, BadPixelPosi...
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/ByteStream.h"                      // for ByteStream
 #include <utility>                              // for move
@@ -74,18 +74,21 @@ class PanasonicDecompressor final : public AbstractDecompressor {
   void chopInputIntoBlocks();
 
   void processPixelPacket(ProxyStream* bits, int y, ushort16* dest, int xbegin,
-                          std::vector<uint32>* zero_pos) const noexcept;
-
-  void processBlock(const Block& block, std::vector<uint32>* zero_pos) const
+                          std::vector<BadPixelPosition>* zero_pos) const
       noexcept;
 
-  void decompressThread() const noexcept;
+  void processBlock(const Block& block,
+                    std::vector<BadPixelPosition>* zero_pos) const noexcept;
+
+  // The blocks are independent, each thread decodes a contiguous range of
+  // them, with its own list of the zero pixels.
+  void decompressThread(int beginBlock, int endBlock) const noexcept;
 
 public:
   PanasonicDecompressor(const RawImage& img, const ByteStream& input_,
                         bool zero_is_not_bad, uint32 section_split_offset_);
 
-  void decompress() const noexcept;
+  void decompress() const;
 };
 
 } // namespace rawspeed
@@ -22,20 +22,136 @@
 
 #include "rawspeedconfig.h"
 #include "decompressors/PanasonicDecompressorV5.h"
+#include "common/Array2DRef.h"            // for Array2DRef
+#include "common/Common.h"                // for uchar8, ushort16, uint64
+#include "common/Cpuid.h"                 // for Cpuid
+#include "common/Executor.h"              // for parallelFor
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
 #include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "io/BitPumpLSB.h"                // for BitPumpLSB
 #include "io/Buffer.h"                    // for Buffer, DataBuffer
+#include "io/Endianness.h"                // for getLE
 #include <algorithm>                      // for generate_n
+#include <array>                          // for array
 #include <cassert>                        // for assert
 #include <iterator>                       // for back_insert_iterator, back...
 #include <memory>                         // for allocator_traits<>::value_...
 #include <utility>                        // for move
 #include <vector>                         // for vector
 
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128i, _mm_loadu_si128
+#include <tmmintrin.h> // for _mm_shuffle_epi8
+#endif
+
 namespace rawspeed {
 
+namespace {
+
+// Each packet is a 128-bit little-endian number, and its pixels are the
+// consecutive bps-bit fields of it, from the LSB up. The bits that are left
+// over at the top are the padding.
+template <int bps> constexpr int pixelsPerPacket() { return 128 / bps; }
+
+using UnpackPackets = void (*)(const uchar8* in, int packets, ushort16* out);
+
+template <int bps>
+void unpackPackets_Scalar(const uchar8* in, int packets, ushort16* out) {
+  for (int packet = 0; packet < packets; packet++) {
+    const auto lo = getLE<uint64>(in);
+    const auto hi = getLE<uint64>(in + 8);
+
+    for (int i = 0; i < pixelsPerPacket<bps>(); i++) {
+      const int b = bps * i;
+      uint64 bits;
+      if (b >= 64)
+        bits = hi >> (b - 64);
+      else if (b + bps > 64)
+        bits = (lo >> b) | (hi << (64 - b));
+      else
+        bits = lo >> b;
+      out[i] = bits & ((1U << bps) - 1U);
+    }
+
+    in += 16;
+    out += pixelsPerPacket<bps>();
+  }
+}
+
+#ifdef WITH_SSE2
+// Each pixel gathers the byte it starts in, and the two bytes after that.
+// The bits of that first byte are shifted down, and the other ones up, into
+// place, both by multiplying them by 1 << (8 - s), with s being where the
+// pixel starts within its byte.
+template <int bps> class PacketLanes final {
+  static_assert(pixelsPerPacket<bps>() > 8 && pixelsPerPacket<bps>() <= 16,
+                "the packet should take two overlapping vectors");
+
+public:
+  // For the pixels first to first + 7.
+  __m128i first;
+  __m128i next;
+  __m128i mul;
+
+  explicit PacketLanes(int firstPixel) {
+    alignas(16) std::array<uchar8, 16> f;
+    alignas(16) std::array<uchar8, 16> n;
+    alignas(16) std::array<ushort16, 8> m;
+    for (int lane = 0; lane < 8; lane++) {
+      const int b = bps * (firstPixel + lane);
+      f[2 * lane] = b / 8;
+      f[2 * lane + 1] = 0x80;
+      // Past the end of the packet, it wraps around, but those bits are
+      // shifted out anyway.
+      n[2 * lane] = (b / 8 + 1) % 16;
+      n[2 * lane + 1] = (b / 8 + 2) % 16;
+      m[lane] = 1U << (8 - b % 8);
+    }
+    first = _mm_load_si128(reinterpret_cast<const __m128i*>(f.data()));
+    next = _mm_load_si128(reinterpret_cast<const __m128i*>(n.data()));
+    mul = _mm_load_si128(reinterpret_cast<const __m128i*>(m.data()));
+  }
+
+  __attribute__((target("ssse3"))) __m128i
+  unpack(__m128i packet) const {
+    const __m128i low = _mm_srli_epi16(
+        _mm_mullo_epi16(_mm_shuffle_epi8(packet, first), mul), 8);
+    const __m128i high = _mm_mullo_epi16(_mm_shuffle_epi8(packet, next), mul);
+    return _mm_and_si128(_mm_or_si128(low, high),
+                         _mm_set1_epi16((1 << bps) - 1));
+  }
+};
+
+// The first 8 pixels, and then the last 8 ones, overlapping with those.
+template <int bps>
+__attribute__((target("ssse3"))) void
+unpackPackets_SSSE3(const uchar8* in, int packets, ushort16* out) {
+  constexpr int lastPixels = pixelsPerPacket<bps>() - 8;
+  const PacketLanes<bps> head(0);
+  const PacketLanes<bps> tail(lastPixels);
+
+  for (int packet = 0; packet < packets; packet++) {
+    const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), head.unpack(p));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + lastPixels),
+                     tail.unpack(p));
+
+    in += 16;
+    out += pixelsPerPacket<bps>();
+  }
+}
+#endif
+
+template <int bps> UnpackPackets getUnpackPackets() {
+#ifdef WITH_SSE2
+  if (Cpuid::SSSE3())
+    return unpackPackets_SSSE3<bps>;
+#endif
+  return unpackPackets_Scalar<bps>;
+}
+
+} // namespace
+
 struct PanasonicDecompressorV5::PacketDsc {
   int bps;
   int pixelsPerPacket;
@@ -172,33 +288,16 @@ public:
   }
 };
 
-template <const PanasonicDecompressorV5::PacketDsc& dsc>
-void PanasonicDecompressorV5::processPixelPacket(BitPumpLSB* bs,
-                                                 ushort16* dest) const {
-  static_assert(dsc.pixelsPerPacket > 0, "dsc should be compile-time const");
-  static_assert(dsc.bps > 0 && dsc.bps <= 16, "");
-
-  assert(bs->getFillLevel() == 0);
-
-  const ushort16* const endDest = dest + dsc.pixelsPerPacket;
-  for (; dest != endDest;) {
-    bs->fill();
-    for (; bs->getFillLevel() >= dsc.bps; dest++) {
-      assert(dest != endDest);
-
-      *dest = bs->getBitsNoFill(dsc.bps);
-    }
-  }
-  bs->skipBitsNoFill(bs->getFillLevel()); // get rid of padding.
-}
-
 template <const PanasonicDecompressorV5::PacketDsc& dsc>
 void PanasonicDecompressorV5::processBlock(const Block& block) const {
   static_assert(dsc.pixelsPerPacket > 0, "dsc should be compile-time const");
   static_assert(BlockSize % bytesPerPacket == 0, "");
 
+  const UnpackPackets unpack = getUnpackPackets<dsc.bps>();
+
   ProxyStream proxy(block.bs);
-  BitPumpLSB bs(proxy.getStream());
+  ByteStream& bs = proxy.getStream();
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
 
   for (int y = block.beginCoord.y; y <= block.endCoord.y; y++) {
     int x = 0;
@@ -211,31 +310,25 @@ void PanasonicDecompressorV5::processBlock(const Block& block) const {
     if (block.endCoord.y == y)
       endx = block.endCoord.x;
 
-    auto* dest = reinterpret_cast<ushort16*>(mRaw->getData(x, y));
+    ushort16* dest = out[y] + x;
 
     assert(x % dsc.pixelsPerPacket == 0);
     assert(endx % dsc.pixelsPerPacket == 0);
 
-    for (; x < endx;) {
-      processPixelPacket<dsc>(&bs, dest);
-
-      x += dsc.pixelsPerPacket;
-      dest += dsc.pixelsPerPacket;
-    }
+    const int packets = (endx - x) / dsc.pixelsPerPacket;
+    unpack(bs.getData(packets * bytesPerPacket), packets, dest);
   }
 }
 
 template <const PanasonicDecompressorV5::PacketDsc& dsc>
 void PanasonicDecompressorV5::decompressInternal() const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp parallel for num_threads(rawspeed_get_number_of_processor_cores()) \
-    schedule(static) default(none)
-#endif
-  for (auto block = blocks.cbegin(); block < blocks.cend(); ++block)
-    processBlock<dsc>(*block);
+  parallelFor(0, blocks.size(), [this](int block) {
+    if (!mRaw->isCancelled())
+      processBlock<dsc>(blocks[block]);
+  });
 }
 
-void PanasonicDecompressorV5::decompress() const noexcept {
+void PanasonicDecompressorV5::decompress() const {
   switch (bps) {
   case 12:
     decompressInternal<TwelveBitPacket>();
@@ -246,6 +339,8 @@ void PanasonicDecompressorV5::decompress() const noexcept {
   default:
     __builtin_unreachable();
   }
+
+  mRaw->checkCancelled();
 }
 
 } // namespace rawspeed
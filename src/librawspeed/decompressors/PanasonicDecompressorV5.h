@@ -25,7 +25,6 @@
 #include "common/Point.h"                       // for iPoint2D
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
-#include "io/BitPumpLSB.h"                      // for BitPumpLSB
 #include "io/ByteStream.h"                      // for ByteStream
 #include <cstddef>                              // for size_t
 #include <utility>                              // for move
@@ -90,9 +89,6 @@ class PanasonicDecompressorV5 final : public AbstractDecompressor {
 
   void chopInputIntoBlocks(const PacketDsc& dsc);
 
-  template <const PacketDsc& dsc>
-  void processPixelPacket(BitPumpLSB* bs, ushort16* dest) const;
-
   template <const PacketDsc& dsc> void processBlock(const Block& block) const;
 
   template <const PacketDsc& dsc> void decompressInternal() const noexcept;
@@ -101,7 +97,7 @@ public:
   PanasonicDecompressorV5(const RawImage& img, const ByteStream& input_,
                           uint32 bps_);
 
-  void decompress() const noexcept;
+  void decompress() const;
 };
 
 } // namespace rawspeed
@@ -19,15 +19,19 @@
 */
 
 #include "decompressors/PentaxDecompressor.h"
+#include "common/Array2DRef.h"            // for Array2DRef
 #include "common/Common.h"                // for uint32, uchar8, ushort16
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "decompressors/HuffmanTable.h"   // for HuffmanTable
+#include "decompressors/RowCheckpoint.h"  // for RowCheckpointRecorder
 #include "io/BitPumpMSB.h"                // for BitPumpMSB, BitStream<>::f...
 #include "io/Buffer.h"                    // for Buffer
 #include "io/ByteStream.h"                // for ByteStream
 #include <cassert>                        // for assert
+#include <memory>                         // for make_shared, shared_ptr
+#include <utility>                        // for move
 #include <vector>                         // for vector
 
 namespace rawspeed {
@@ -123,42 +127,49 @@ HuffmanTable PentaxDecompressor::SetupHuffmanTable_Modern(ByteStream stream) {
   return ht;
 }
 
-HuffmanTable PentaxDecompressor::SetupHuffmanTable(ByteStream* metaData) {
-  HuffmanTable ht;
+std::shared_ptr<const HuffmanTable>
+PentaxDecompressor::SetupHuffmanTable(ByteStream* metaData) {
+  const auto setup = [](HuffmanTable ht) {
+    ht.setup(true, false);
+    return std::make_shared<const HuffmanTable>(std::move(ht));
+  };
 
   if (metaData)
-    ht = SetupHuffmanTable_Modern(*metaData);
-  else
-    ht = SetupHuffmanTable_Legacy();
-
-  ht.setup(true, false);
+    return setup(SetupHuffmanTable_Modern(*metaData));
 
-  return ht;
+  // The legacy table is fixed, so it is only set up once, and is then shared
+  // by all of the files.
+  static const auto legacy = setup(SetupHuffmanTable_Legacy());
+  return legacy;
 }
 
-void PentaxDecompressor::decompress(const ByteStream& data) const {
-  BitPumpMSB bs(data);
-  uchar8* draw = mRaw->getData();
+void PentaxDecompressor::prewarm() { SetupHuffmanTable(nullptr); }
+
+void PentaxDecompressor::decompressBand(const ByteStream& data,
+                                        Checkpoint state, int end_y) const {
+  auto bs = getBitPumpAt<BitPumpMSB>(data, state.bitPosition);
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
 
   assert(mRaw->dim.y > 0);
   assert(mRaw->dim.x > 0);
   assert(mRaw->dim.x % 2 == 0);
 
-  std::array<int, 2> pUp1 = {{}};
-  std::array<int, 2> pUp2 = {{}};
+  auto& pUp1 = state.pUp1;
+  auto& pUp2 = state.pUp2;
 
-  for (int y = 0; y < mRaw->dim.y && mRaw->dim.x >= 2; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(&draw[y * mRaw->pitch]);
+  for (int y = state.row; y < end_y && mRaw->dim.x >= 2; y++) {
+    mRaw->checkCancelled();
+    ushort16* dest = out[y];
 
-    pUp1[y & 1] += ht.decodeNext(bs);
-    pUp2[y & 1] += ht.decodeNext(bs);
+    pUp1[y & 1] += ht->decodeNext(bs);
+    pUp2[y & 1] += ht->decodeNext(bs);
 
     int pLeft1 = dest[0] = pUp1[y & 1];
     int pLeft2 = dest[1] = pUp2[y & 1];
 
     for (int x = 2; x < mRaw->dim.x; x += 2) {
-      pLeft1 += ht.decodeNext(bs);
-      pLeft2 += ht.decodeNext(bs);
+      pLeft1 += ht->decodeNext(bs);
+      pLeft2 += ht->decodeNext(bs);
 
       dest[x] = pLeft1;
       dest[x + 1] = pLeft2;
@@ -168,7 +179,45 @@ void PentaxDecompressor::decompress(const ByteStream& data) const {
       if (pLeft2 < 0 || pLeft2 > 65535)
         ThrowRDE("decoded value out of bounds at %d:%d", x, y);
     }
+    mRaw->notifyAreaReady({0, y, mRaw->dim.x, 1});
   }
 }
 
+void PentaxDecompressor::decompress(const ByteStream& data) const {
+  decompressBand(data, Checkpoint(), mRaw->dim.y);
+}
+
+std::vector<PentaxDecompressor::Checkpoint>
+PentaxDecompressor::scan(const ByteStream& data, int rowsPerCheckpoint) const {
+  RowCheckpointRecorder<BitPumpMSB> recorder(rowsPerCheckpoint, mRaw->dim.y);
+
+  Checkpoint state;
+  BitPumpMSB bs(data);
+
+  for (int y = 0; y < mRaw->dim.y; y++) {
+    if (recorder.atRow(y, bs, &state))
+      mRaw->checkCancelled();
+
+    // Only the vertical predictors are carried over from row to row. The
+    // table is set up for the full decode, where the lookup already covers
+    // the difference bits, so just skipping the codes would not be cheaper.
+    state.pUp1[y & 1] += ht->decodeNext(bs);
+    state.pUp2[y & 1] += ht->decodeNext(bs);
+    for (int x = 2; x < mRaw->dim.x; x += 2) {
+      ht->decodeNext(bs);
+      ht->decodeNext(bs);
+    }
+  }
+
+  return recorder.release();
+}
+
+void PentaxDecompressor::decompress(
+    const ByteStream& data, const std::vector<Checkpoint>& checkpoints) const {
+  decodeBands(checkpoints, mRaw->dim.y, mRaw->dim.y,
+              [this, &data](const Checkpoint& state, uint32 end_y) {
+                decompressBand(data, state, end_y);
+              });
+}
+
 } // namespace rawspeed
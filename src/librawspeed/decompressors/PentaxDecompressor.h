@@ -25,6 +25,9 @@
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "decompressors/HuffmanTable.h"         // for HuffmanTable
+#include "decompressors/RowCheckpoint.h"        // for RowCheckpoint
+#include <memory>                               // for shared_ptr
+#include <vector>                               // for vector
 
 namespace rawspeed {
 
@@ -32,17 +35,40 @@ class ByteStream;
 
 class PentaxDecompressor final : public AbstractDecompressor {
   RawImage mRaw;
-  const HuffmanTable ht;
+  const std::shared_ptr<const HuffmanTable> ht;
 
 public:
+  using Checkpoint = RowCheckpoint;
+
+  // Of the input, see RawImageData::expectInput(): a Huffman code per pixel.
+  static constexpr uint32 MinBitsPerPixel = 1;
+
   PentaxDecompressor(const RawImage& img, ByteStream* metaData);
 
+  // Builds the fixed legacy Huffman table now, rather than for the first file, see
+  // prewarm().
+  static void prewarm();
+
   void decompress(const ByteStream& data) const;
 
+  // The first pass: only decodes the Huffman codes, and returns a checkpoint
+  // for every rowsPerCheckpoint'th row.
+  std::vector<Checkpoint> scan(const ByteStream& data,
+                               int rowsPerCheckpoint) const;
+
+  // The second pass: decodes the bands of rows in between the checkpoints
+  // in parallel. The checkpoints must have been returned by scan().
+  void decompress(const ByteStream& data,
+                  const std::vector<Checkpoint>& checkpoints) const;
+
 private:
+  void decompressBand(const ByteStream& data, Checkpoint state,
+                      int end_y) const;
+
   static HuffmanTable SetupHuffmanTable_Legacy();
   static HuffmanTable SetupHuffmanTable_Modern(ByteStream stream);
-  static HuffmanTable SetupHuffmanTable(ByteStream* metaData);
+  static std::shared_ptr<const HuffmanTable>
+  SetupHuffmanTable(ByteStream* metaData);
 
   static const std::array<std::array<std::array<uchar8, 16>, 2>, 1> pentax_tree;
 };
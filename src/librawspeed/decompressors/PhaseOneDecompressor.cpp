@@ -23,14 +23,16 @@
 #include "rawspeedconfig.h"
 #include "decompressors/PhaseOneDecompressor.h"
 #include "common/Common.h"                // for int32, uint32, ushort16
+#include "common/Executor.h"              // for parallelForDynamic, Dyna...
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/BitPumpMSB32.h"              // for BitPumpMSB32
-#include <algorithm>                      // for for_each
+#include <algorithm>                      // for for_each, stable_sort
 #include <array>                          // for array
 #include <cassert>                        // for assert
 #include <cstddef>                        // for size_t
+#include <numeric>                        // for iota
 #include <utility>                        // for move
 #include <vector>                         // for vector, vector<>::size_type
 
@@ -52,6 +54,14 @@ PhaseOneDecompressor::PhaseOneDecompressor(const RawImage& img,
   }
 
   validateStrips();
+
+  // The strips are handed out to the threads one at a time, the largest
+  // ones first, so that the threads finish at about the same time.
+  order.resize(strips.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return strips[a].bs.getSize() > strips[b].bs.getSize();
+  });
 }
 
 void PhaseOneDecompressor::validateStrips() const {
@@ -96,74 +106,147 @@ void PhaseOneDecompressor::validateStrips() const {
          "We should only get here if all the rows/bins got filled.");
 }
 
+void PhaseOneDecompressor::setQuadrantCurves(PhaseOneQuadrantCurves curves) {
+  if (curves.split.x < 0 || curves.split.y < 0 ||
+      curves.split.x > mRaw->dim.x || curves.split.y > mRaw->dim.y) {
+    ThrowRDE("Invalid sensor quadrant split values (%i, %i)", curves.split.y,
+             curves.split.x);
+  }
+
+  for (const auto& curve : curves.curves) {
+    if (curve.size() != 65536)
+      ThrowRDE("Unexpected quadrant curve size %zu", curve.size());
+  }
+
+  quadrantCurves = std::move(curves);
+  haveQuadrantCurves = true;
+}
+
+void PhaseOneDecompressor::applyQuadrantCurves(ushort16* img, int row) const {
+  const int quadRow = row < quadrantCurves.split.y ? 0 : 1;
+  const ushort16* left = quadrantCurves.curves[2 * quadRow].data();
+  const ushort16* right = quadrantCurves.curves[2 * quadRow + 1].data();
+
+  int col = 0;
+  for (; col < quadrantCurves.split.x; col++)
+    img[col] = left[img[col]];
+  for (; col < mRaw->dim.x; col++)
+    img[col] = right[img[col]];
+}
+
+namespace {
+
+// The code of the lengths of the differences of the next 8 pixels of one
+// color: j zeros, then a one and a bit that select the length, except that
+// there is no one after 5 zeros. A single one keeps the previous length.
+struct LengthCode final {
+  uchar8 bits; // of the code
+  uchar8 len;  // or 0, to keep the previous one
+};
+
+// Of each of the prefixes of 6 bits, which is as long as the codes get.
+const std::array<LengthCode, 64>& getLengthCodes() {
+  static const std::array<LengthCode, 64> codes = [] {
+    static constexpr std::array<const int, 10> length = {8,  7, 6,  9,  11,
+                                                         10, 5, 12, 14, 13};
+    std::array<LengthCode, 64> c;
+    for (uint32 prefix = 0; prefix < c.size(); prefix++) {
+      int j = 0;
+      while (j < 5 && (prefix & (0x20U >> j)) == 0)
+        j++;
+
+      if (j == 0)
+        c[prefix] = {1, 0};
+      else if (j < 5)
+        c[prefix] = {uchar8(j + 2),
+                     uchar8(length[2 * (j - 1) + ((prefix >> (4 - j)) & 1)])};
+      else
+        c[prefix] = {6, uchar8(length[8 + (prefix & 1)])};
+    }
+    return c;
+  }();
+  return codes;
+}
+
+} // namespace
+
+void PhaseOneDecompressor::prewarm() { getLengthCodes(); }
+
 void PhaseOneDecompressor::decompressStrip(const PhaseOneStrip& strip) const {
   uint32 width = mRaw->dim.x;
   assert(width % 2 == 0);
 
-  static constexpr std::array<const int, 10> length = {8,  7, 6,  9,  11,
-                                                       10, 5, 12, 14, 13};
+  const std::array<LengthCode, 64>& lengthCodes = getLengthCodes();
 
   BitPumpMSB32 pump(strip.bs);
 
   std::array<int32, 2> pred;
   pred.fill(0);
   std::array<int, 2> len;
-  auto* img = reinterpret_cast<ushort16*>(mRaw->getData(0, strip.n));
-  for (uint32 col = 0; col < width; col++) {
-    if (col >= (width & ~7U)) // last 'width % 8' pixels.
-      len[0] = len[1] = 14;
-    else if ((col & 7) == 0) {
-      for (int& i : len) {
-        int j = 0;
-
-        for (; j < 5; j++) {
-          if (pump.getBits(1) != 0) {
-            if (col == 0)
-              ThrowRDE("Can not initialize lengths. Data is corrupt.");
-
-            // else, we have previously initialized lengths, so we are fine
-            break;
-          }
-        }
-
-        assert((col == 0 && j > 0) || col != 0);
-        if (j > 0)
-          i = length[2 * (j - 1) + pump.getBits(1)];
+  len.fill(14);
+  ushort16* img = mRaw->getU16DataAsCroppedArray2DRef()[strip.n];
+
+  // The two pixels of the both colors, which take 32 bits at most.
+  const auto decodePair = [&pump, &pred, &len, img](uint32 col) {
+    pump.fill(32);
+    for (int c = 0; c < 2; c++) {
+      const int i = len[c];
+      if (i == 14)
+        img[col + c] = pred[c] = pump.getBitsNoFill(16);
+      else {
+        pred[c] +=
+            static_cast<signed>(pump.getBitsNoFill(i)) + 1 - (1 << (i - 1));
+        // FIXME: is the truncation the right solution here?
+        img[col + c] = ushort16(pred[c]);
       }
     }
+  };
 
-    int i = len[col & 1];
-    if (i == 14)
-      img[col] = pred[col & 1] = pump.getBits(16);
-    else {
-      pred[col & 1] +=
-          static_cast<signed>(pump.getBits(i)) + 1 - (1 << (i - 1));
-      // FIXME: is the truncation the right solution here?
-      img[col] = ushort16(pred[col & 1]);
+  // The groups of 8 pixels, each starting with the lengths of its
+  // differences.
+  const uint32 groupsEnd = width & ~7U;
+  uint32 col = 0;
+  for (; col < groupsEnd; col += 8) {
+    for (int& i : len) {
+      const LengthCode& code = lengthCodes[pump.peekBits(6)];
+      // The first group can not keep the lengths, it needs all 5 zeros.
+      if (col == 0 && code.bits != 6)
+        ThrowRDE("Can not initialize lengths. Data is corrupt.");
+      pump.skipBitsNoFill(code.bits);
+      if (code.len != 0)
+        i = code.len;
     }
+
+    for (uint32 g = 0; g < 8; g += 2)
+      decodePair(col + g);
   }
+
+  // The last 'width % 8' pixels.
+  len[0] = len[1] = 14;
+  for (; col < width; col += 2)
+    decodePair(col);
+
+  if (haveQuadrantCurves)
+    applyQuadrantCurves(img, strip.n);
 }
 
-void PhaseOneDecompressor::decompressThread() const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (auto strip = strips.cbegin(); strip < strips.cend(); ++strip) {
+void PhaseOneDecompressor::decompressThread(DynamicSchedule* schedule) const
+    noexcept {
+  for (int i; !mRaw->isCancelled() && schedule->getNext(&i);) {
     try {
-      decompressStrip(*strip);
+      decompressStrip(strips[order[i]]);
     } catch (RawspeedException& err) {
-      // Propagate the exception out of OpenMP magic.
+      // Propagate the exception out of the executor.
       mRaw->setError(err.what());
     }
   }
 }
 
 void PhaseOneDecompressor::decompress() const {
-#ifdef HAVE_OPENMP
-#pragma omp parallel default(none)                                             \
-    num_threads(rawspeed_get_number_of_processor_cores())
-#endif
-  decompressThread();
+  parallelForDynamic(0, order.size(), [this](DynamicSchedule* schedule) {
+    decompressThread(schedule);
+  });
+  mRaw->checkCancelled();
 
   std::string firstErr;
   if (mRaw->isTooManyErrors(1, &firstErr)) {
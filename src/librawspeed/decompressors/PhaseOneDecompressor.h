@@ -22,14 +22,18 @@
 
 #pragma once
 
+#include "common/Common.h"                      // for ushort16
+#include "common/Point.h"                       // for iPoint2D
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/ByteStream.h"                      // for ByteStream
+#include <array>                                // for array
 #include <utility>                              // for move
 #include <vector>                               // for vector
 
 namespace rawspeed {
 
+class DynamicSchedule;
 class RawImage;
 
 struct PhaseOneStrip {
@@ -39,14 +43,30 @@ struct PhaseOneStrip {
   PhaseOneStrip(int block, ByteStream bs_) : n(block), bs(std::move(bs_)) {}
 };
 
+// The curves of the quadrants of the sensor, which meet at split (the
+// column, the row): the top left, top right, bottom left and bottom right
+// ones, of 65536 entries each.
+struct PhaseOneQuadrantCurves {
+  iPoint2D split;
+  std::array<std::vector<ushort16>, 4> curves;
+};
+
 class PhaseOneDecompressor final : public AbstractDecompressor {
   RawImage mRaw;
 
   std::vector<PhaseOneStrip> strips;
 
+  // The indexes of the strips, in the order they are decoded in.
+  std::vector<int> order;
+
+  bool haveQuadrantCurves = false;
+  PhaseOneQuadrantCurves quadrantCurves;
+
   void decompressStrip(const PhaseOneStrip& strip) const;
 
-  void decompressThread() const noexcept;
+  void applyQuadrantCurves(ushort16* img, int row) const;
+
+  void decompressThread(DynamicSchedule* schedule) const noexcept;
 
   void validateStrips() const;
 
@@ -54,6 +74,14 @@ public:
   PhaseOneDecompressor(const RawImage& img,
                        std::vector<PhaseOneStrip>&& strips_);
 
+  // Builds the fixed lookup table of the length codes now, rather than for the first file, see
+  // prewarm().
+  static void prewarm();
+
+  // Each row is mapped through the curves right after it is decoded, while
+  // it is still in the cache.
+  void setQuadrantCurves(PhaseOneQuadrantCurves curves);
+
   void decompress() const;
 };
 
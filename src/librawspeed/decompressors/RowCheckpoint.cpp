@@ -0,0 +1,131 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "decompressors/RowCheckpoint.h"
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "io/Buffer.h"                    // for Buffer
+#include <algorithm>                      // for min
+#include <cstring>                        // for memchr
+
+namespace rawspeed {
+
+namespace {
+
+// Walks from the byte, until the end byte, or until the end data byte.
+void walkJPEG(const uchar8* data, uint64 end, uint64 endDataBytes,
+              uint64* byte, uint64* dataBytes) {
+  while (*byte < end && *dataBytes < endDataBytes) {
+    const auto* ff = static_cast<const uchar8*>(
+        memchr(data + *byte, 0xFF, end - *byte));
+    const uint64 plain = ff ? ff - (data + *byte) : end - *byte;
+    const uint64 n = std::min(plain, endDataBytes - *dataBytes);
+    *byte += n;
+    *dataBytes += n;
+    if (n < plain || !ff || *dataBytes == endDataBytes)
+      return;
+
+    // The 0xFF is a data byte, the zero byte after it is not.
+    (*byte)++;
+    (*dataBytes)++;
+    if (*byte < end && data[*byte] == 0)
+      (*byte)++;
+  }
+}
+
+} // namespace
+
+uint64 BitPositionTracker<BitPumpJPEG>::get(const BitPumpJPEG& bits) {
+  const uint64 end = std::min(bits.getPosition(), bits.getSize());
+  const uchar8* data = static_cast<const Buffer&>(bits).getData(0, end);
+
+  // The number of the data bytes that were read into the cache.
+  uint64 b = byte;
+  uint64 readDataBytes = dataBytes;
+  walkJPEG(data, end, ~uint64(0), &b, &readDataBytes);
+
+  // Past the end, the pump reads zeros.
+  readDataBytes += bits.getPosition() - end;
+
+  const uint64 dataBits = readDataBytes * 8 - bits.getFillLevel();
+  walkJPEG(data, end, dataBits / 8, &byte, &dataBytes);
+  const uint64 tail = dataBits / 8 - dataBytes;
+  return (byte + tail) * 8 + dataBits % 8;
+}
+
+void checkCheckpoints(const std::vector<RowCheckpoint>& checkpoints,
+                      uint32 height) {
+  if (checkpoints.empty() || checkpoints.front().row != 0)
+    ThrowRDE("Checkpoints do not start at the first row");
+
+  for (auto i = 1U; i < checkpoints.size(); i++) {
+    if (checkpoints[i].row <= checkpoints[i - 1].row ||
+        checkpoints[i].row >= height)
+      ThrowRDE("Checkpoint %u is at an invalid row (%u)", i,
+               checkpoints[i].row);
+  }
+}
+
+void writeCheckpoints(const std::vector<RowCheckpoint>& checkpoints,
+                      std::vector<uchar8>* out) {
+  const auto put = [out](uint64 value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+      out->emplace_back(static_cast<uchar8>(value >> (8 * i)));
+  };
+
+  put(checkpoints.size(), 4);
+  for (const auto& c : checkpoints) {
+    put(c.row, 4);
+    put(c.bitPosition, 8);
+    for (const auto& p : {c.pUp1, c.pUp2}) {
+      put(static_cast<uint32>(p[0]), 4);
+      put(static_cast<uint32>(p[1]), 4);
+    }
+  }
+}
+
+std::vector<RowCheckpoint> readCheckpoints(ByteStream* in) {
+  const uint32 count = in->getU32();
+  // That bounds the allocation.
+  if (count == 0 || in->getRemainSize() / RowCheckpointSize < count)
+    ThrowRDE("Invalid number of checkpoints: %u", count);
+
+  std::vector<RowCheckpoint> checkpoints(count);
+  for (auto& c : checkpoints) {
+    c.row = in->getU32();
+    c.bitPosition = in->get<uint64>();
+    for (auto* p : {&c.pUp1, &c.pUp2}) {
+      (*p)[0] = in->getI32();
+      (*p)[1] = in->getI32();
+    }
+  }
+
+  if (checkpoints.front().row != 0)
+    ThrowRDE("Checkpoints do not start at the first row");
+  for (auto i = 1U; i < checkpoints.size(); i++) {
+    if (checkpoints[i].row <= checkpoints[i - 1].row)
+      ThrowRDE("Checkpoint %u is at an invalid row (%u)", i,
+               checkpoints[i].row);
+  }
+
+  return checkpoints;
+}
+
+} // namespace rawspeed
@@ -0,0 +1,148 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#pragma once
+
+#include "common/Common.h"                // for uint32, uint64, uchar8
+#include "common/Executor.h"              // for parallelForEach
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "io/BitPumpJPEG.h"               // for BitPumpJPEG
+#include "io/ByteStream.h"                // for ByteStream
+#include <array>                          // for array
+#include <utility>                        // for move
+#include <vector>                         // for vector
+
+namespace rawspeed {
+
+// The state, at the start of a row, of the decoders that predict each pixel
+// from the one two columns to the left, and the first two pixels of a row
+// from the ones two rows up. The Huffman stream has no sync points, so these
+// are recorded by a first pass over the data, after which the decoding can be
+// restarted at any of these rows.
+struct RowCheckpoint final {
+  uint32 row = 0;
+
+  // The offset into the data, from which getBitPumpAt() restarts.
+  uint64 bitPosition = 0;
+
+  std::array<int, 2> pUp1{{}};
+  std::array<int, 2> pUp2{{}};
+};
+
+// Where the next bit of a pump is, as a bit offset into its data.
+template <typename Pump> class BitPositionTracker final {
+public:
+  uint64 get(const Pump& bits) const {
+    return uint64(bits.getPosition()) * 8 - bits.getFillLevel();
+  }
+};
+
+// The stuffed zero byte after each 0xFF never gets into the cache, so the
+// ones in between the bits that are in the cache and the ones that are not
+// have to be counted. The positions have to be asked for in increasing
+// order, so that the data is only walked over once. Only valid up to the
+// first marker.
+template <> class BitPositionTracker<BitPumpJPEG> final {
+  // Of the last position: the offset of the byte, and the number of the data
+  // bytes (i.e. without the stuffed ones) before it.
+  uint64 byte = 0;
+  uint64 dataBytes = 0;
+
+public:
+  uint64 get(const BitPumpJPEG& bits);
+};
+
+// A pump over the data, that starts at the bit position.
+template <typename Pump>
+Pump getBitPumpAt(const ByteStream& data, uint64 bitPosition) {
+  ByteStream input(data);
+  input.skipBytes(bitPosition / 8);
+
+  Pump bits(input);
+  bits.fill();
+  bits.skipBits(bitPosition % 8);
+  return bits;
+}
+
+// The first pass: atRow() is called at the start of each row, and records
+// the state at every rowsPerCheckpoint'th one.
+template <typename Pump> class RowCheckpointRecorder final {
+  const int rowsPerCheckpoint;
+  BitPositionTracker<Pump> tracker;
+  std::vector<RowCheckpoint> checkpoints;
+
+public:
+  RowCheckpointRecorder(int rowsPerCheckpoint_, uint32 height)
+      : rowsPerCheckpoint(rowsPerCheckpoint_) {
+    if (rowsPerCheckpoint < 1)
+      ThrowRDE("Invalid checkpoint interval: %i", rowsPerCheckpoint);
+    checkpoints.reserve(height / rowsPerCheckpoint + 1);
+  }
+
+  // Returns whether the state of the row got recorded.
+  bool atRow(uint32 row, const Pump& bits, RowCheckpoint* state) {
+    if (row % rowsPerCheckpoint != 0)
+      return false;
+
+    state->row = row;
+    state->bitPosition = tracker.get(bits);
+    checkpoints.emplace_back(*state);
+    return true;
+  }
+
+  std::vector<RowCheckpoint> release() { return std::move(checkpoints); }
+};
+
+// Checks that the checkpoints start at the first row, and then are at
+// increasing rows of the height rows of the image.
+void checkCheckpoints(const std::vector<RowCheckpoint>& checkpoints,
+                      uint32 height);
+
+// The second pass: checks the checkpoints, and then calls
+// band(checkpoint, band_end_y) for each of the bands in between them that
+// start before the row end_y, in parallel.
+template <typename Band>
+void decodeBands(const std::vector<RowCheckpoint>& checkpoints, uint32 height,
+                 uint32 end_y, const Band& band) {
+  checkCheckpoints(checkpoints, height);
+
+  int numBands = 0;
+  while (numBands < static_cast<int>(checkpoints.size()) &&
+         checkpoints[numBands].row < end_y)
+    numBands++;
+
+  parallelForEach(0, numBands, [&checkpoints, &band, numBands, end_y](int i) {
+    band(checkpoints[i], i + 1 < numBands ? checkpoints[i + 1].row : end_y);
+  });
+}
+
+// Each checkpoint takes this many bytes when serialized.
+constexpr uint32 RowCheckpointSize = 28;
+
+// Little-endian, as the decode index.
+void writeCheckpoints(const std::vector<RowCheckpoint>& checkpoints,
+                      std::vector<uchar8>* out);
+
+// Only checks the rows against each other, the rest is checked against the
+// image by decodeBands().
+std::vector<RowCheckpoint> readCheckpoints(ByteStream* in);
+
+} // namespace rawspeed
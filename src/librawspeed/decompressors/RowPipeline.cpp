@@ -0,0 +1,167 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/RowPipeline.h"
+#include "common/Executor.h"  // for getExecutor, runTasks, Executor
+#include <condition_variable> // for condition_variable
+#include <mutex>              // for mutex, unique_lock, lock_guard
+
+namespace rawspeed {
+
+namespace {
+
+class Pipeline final {
+  const int rows;
+  const int numSlots;
+  const std::function<void(int, int)>& decode;
+  const std::function<void(int, int)>& reconstruct;
+
+  std::mutex mutex;
+  std::condition_variable progress;
+  int decoded = 0;
+  int reconstructed = 0;
+  // Whether a task has taken the stage. The decoding is taken first, so a
+  // reconstructing task always has one to wait for.
+  bool decoding = false;
+  bool reconstructing = false;
+  bool failed = false;
+
+  // Calls f, and if it throws, makes the other stage stop too.
+  template <typename F> void guarded(const F& f) {
+    try {
+      f();
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+      }
+      progress.notify_all();
+      throw;
+    }
+  }
+
+  void reconstructRow(int row) {
+    guarded([this, row]() { reconstruct(row, row % numSlots); });
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      reconstructed = row + 1;
+    }
+    progress.notify_all();
+  }
+
+  // Of the decoding task, once it has taken the reconstruction too: the rows
+  // that it has decoded so far.
+  void reconstructDecoded() {
+    for (int row = reconstructed; row < decoded; row++)
+      reconstructRow(row);
+  }
+
+  void runDecode() {
+    bool alone = false;
+    for (int row = 0; row < rows; row++) {
+      if (!alone) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (row - reconstructed >= numSlots && !failed) {
+          if (!reconstructing) {
+            reconstructing = alone = true;
+            break;
+          }
+          progress.wait(lock);
+        }
+        if (failed)
+          return;
+      }
+      if (alone)
+        reconstructDecoded();
+
+      guarded([this, row]() { decode(row, row % numSlots); });
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded = row + 1;
+      }
+      progress.notify_all();
+    }
+
+    if (!alone) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (reconstructing)
+        return;
+      reconstructing = true;
+    }
+    reconstructDecoded();
+  }
+
+  void runReconstruct() {
+    for (int row = 0; row < rows; row++) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        progress.wait(lock, [this, row]() { return decoded > row || failed; });
+        if (failed)
+          return;
+      }
+      reconstructRow(row);
+    }
+  }
+
+public:
+  Pipeline(int rows_, int numSlots_, const std::function<void(int, int)>& d,
+           const std::function<void(int, int)>& r)
+      : rows(rows_), numSlots(numSlots_), decode(d), reconstruct(r) {}
+
+  void runTask() {
+    bool decodes = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!decoding)
+        decoding = decodes = true;
+      else if (!reconstructing)
+        reconstructing = true;
+      else
+        return;
+    }
+    if (decodes)
+      runDecode();
+    else
+      runReconstruct();
+  }
+};
+
+} // namespace
+
+void pipelineRows(int rows, int numSlots,
+                  const std::function<void(int row, int slot)>& decode,
+                  const std::function<void(int row, int slot)>& reconstruct) {
+  if (rows <= 0)
+    return;
+
+  const auto executor = getExecutor();
+  if (numSlots < 2 || executor->getConcurrency() < 2) {
+    for (int row = 0; row < rows; row++) {
+      decode(row, 0);
+      reconstruct(row, 0);
+    }
+    return;
+  }
+
+  Pipeline pipeline(rows, numSlots, decode, reconstruct);
+  runTasks(executor, 2, [&pipeline](int /*taskIndex*/) { pipeline.runTask(); });
+}
+
+} // namespace rawspeed
@@ -0,0 +1,44 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <functional> // for function
+
+namespace rawspeed {
+
+// The decoding of a serial stream of rows, split into two stages, so that
+// they overlap: decode(row, slot) only does the entropy decoding of the row,
+// e.g. into the differences, in one of the numSlots buffers of the caller,
+// and reconstruct(row, slot) then turns those into the pixels of the row,
+// e.g. with the prediction, the curve and the store. Both are called for the
+// rows in order, each stage from one thread at a time, and the slot of a row
+// is only decoded into again once the row it held has been reconstructed.
+//
+// The stages run as two tasks of the executor, with up to numSlots rows in
+// between them. If there is just the one thread, or the second task does not
+// get to run until the first has filled all of the slots, the decoding task
+// also reconstructs the rows itself. If a stage throws, both stop, and the
+// exception is rethrown.
+void pipelineRows(int rows, int numSlots,
+                  const std::function<void(int row, int slot)>& decode,
+                  const std::function<void(int row, int slot)>& reconstruct);
+
+} // namespace rawspeed
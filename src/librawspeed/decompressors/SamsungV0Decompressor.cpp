@@ -22,12 +22,13 @@
 
 #include "decompressors/SamsungV0Decompressor.h"
 #include "common/Common.h"                // for uint32, ushort16, int32
+#include "common/Executor.h"              // for parallelFor
 #include "common/Point.h"                 // for iPoint2D
 #include "common/RawImage.h"              // for RawImage, RawImageData
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/BitPumpMSB32.h"              // for BitPumpMSB32
 #include "io/ByteStream.h"                // for ByteStream
-#include <algorithm>                      // for max
+#include <algorithm>                      // for any_of, max
 #include <cassert>                        // for assert
 #include <iterator>                       // for advance, begin, end, next
 #include <vector>                         // for vector
@@ -84,13 +85,38 @@ void SamsungV0Decompressor::computeStripes(ByteStream bso, ByteStream bsr) {
 }
 
 void SamsungV0Decompressor::decompress() const {
-  for (int y = 0; y < mRaw->dim.y; y++)
-    decompressStrip(y, stripes[y]);
+  const int blocksPerRow = roundUpDivision(mRaw->dim.x, 16);
+  std::vector<uchar8> upward(static_cast<size_t>(mRaw->dim.y) * blocksPerRow);
+
+  // Only the rows with some upward prediction can not be finished right away.
+  std::vector<uchar8> deferred(mRaw->dim.y);
+
+  // Each row has its own stripe, which can be decoded independently, but the
+  // upward prediction then needs the two rows above. So the differences are
+  // decoded in parallel, along with the predictions of the rows that only
+  // predict from the left, and the other ones are finished row after row.
+  parallelFor(0, mRaw->dim.y, [this, &upward, &deferred, blocksPerRow](int y) {
+    if (mRaw->isCancelled())
+      return;
+    uchar8* rowUpward = &upward[static_cast<size_t>(y) * blocksPerRow];
+    decodeStrip(y, stripes[y], rowUpward);
+    deferred[y] = std::any_of(rowUpward, rowUpward + blocksPerRow,
+                              [](uchar8 dir) { return dir != 0; });
+    if (!deferred[y])
+      predictStrip(y, rowUpward);
+  });
+  mRaw->checkCancelled();
+
+  for (int y = 0; y < mRaw->dim.y; y++) {
+    if (deferred[y])
+      predictStrip(y, &upward[static_cast<size_t>(y) * blocksPerRow]);
+  }
 
   // Swap red and blue pixels to get the final CFA pattern
-  for (int y = 0; y < mRaw->dim.y - 1; y += 2) {
-    auto* topline = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
-    auto* bottomline = reinterpret_cast<ushort16*>(mRaw->getData(0, y + 1));
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+  parallelFor(0, mRaw->dim.y / 2, [this, out](int pair) {
+    ushort16* topline = out[2 * pair];
+    ushort16* bottomline = out[2 * pair + 1];
 
     for (int x = 0; x < mRaw->dim.x - 1; x += 2) {
       ushort16 temp = topline[1];
@@ -100,7 +126,7 @@ void SamsungV0Decompressor::decompress() const {
       topline += 2;
       bottomline += 2;
     }
-  }
+  });
 }
 
 int32 SamsungV0Decompressor::calcAdj(BitPumpMSB32* bits, int b) {
@@ -110,8 +136,8 @@ int32 SamsungV0Decompressor::calcAdj(BitPumpMSB32* bits, int b) {
   return adj;
 }
 
-void SamsungV0Decompressor::decompressStrip(uint32 y,
-                                            const ByteStream& bs) const {
+void SamsungV0Decompressor::decodeStrip(uint32 y, const ByteStream& bs,
+                                        uchar8* upward) const {
   const uint32 width = mRaw->dim.x;
   assert(width > 0);
 
@@ -121,13 +147,9 @@ void SamsungV0Decompressor::decompressStrip(uint32 y,
   for (int& i : len)
     i = y < 2 ? 7 : 4;
 
-  auto* img = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
-  const auto* const past_last =
-      reinterpret_cast<ushort16*>(mRaw->getData(width - 1, y) + mRaw->getBpp());
-  ushort16* img_up = reinterpret_cast<ushort16*>(
-      mRaw->getData(0, std::max(0, static_cast<int>(y) - 1)));
-  ushort16* img_up2 = reinterpret_cast<ushort16*>(
-      mRaw->getData(0, std::max(0, static_cast<int>(y) - 2)));
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+  ushort16* img = out[y];
+  const ushort16* const past_last = img + out.width;
 
   // Image is arranged in groups of 16 pixels horizontally
   for (uint32 x = 0; x < width; x += 16) {
@@ -170,45 +192,60 @@ void SamsungV0Decompressor::decompressStrip(uint32 y,
 
       if (x + 16 >= width)
         ThrowRDE("Upward prediction for the last block of pixels. Raw corrupt");
+    }
+    *upward++ = dir;
 
-      // First we decode even pixels
-      for (int c = 0; c < 16; c += 2) {
-        int b = len[c >> 3];
-        int32 adj = calcAdj(&bits, b);
+    // The differences are stored as they are, the prediction only gets added
+    // later on. That wraps around just the same.
 
-        img[c] = adj + img_up[c];
-      }
+    // First we decode even pixels
+    for (int c = 0; c < 16; c += 2) {
+      int b = len[c >> 3];
+      int32 adj = calcAdj(&bits, b);
+
+      if (img + c < past_last)
+        img[c] = adj;
+    }
+
+    // Now we decode odd pixels
+    for (int c = 1; c < 16; c += 2) {
+      int b = len[2 | (c >> 3)];
+      int32 adj = calcAdj(&bits, b);
+
+      if (img + c < past_last)
+        img[c] = adj;
+    }
+
+    img += 16;
+  }
+}
+
+void SamsungV0Decompressor::predictStrip(uint32 y,
+                                         const uchar8* upward) const {
+  const uint32 width = mRaw->dim.x;
+
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+  ushort16* img = out[y];
+  const ushort16* const past_last = img + out.width;
+  const ushort16* img_up = out[std::max(0, static_cast<int>(y) - 1)];
+  const ushort16* img_up2 = out[std::max(0, static_cast<int>(y) - 2)];
+
+  for (uint32 x = 0; x < width; x += 16) {
+    if (*upward++) {
+      // Upward prediction, for which the whole block is within the row.
+      for (int c = 0; c < 16; c += 2)
+        img[c] += img_up[c];
 
-      // Now we decode odd pixels
       // Why on earth upward prediction only looks up 1 line above
       // is beyond me, it will hurt compression a deal.
-      for (int c = 1; c < 16; c += 2) {
-        int b = len[2 | (c >> 3)];
-        int32 adj = calcAdj(&bits, b);
-
-        img[c] = adj + img_up2[c];
-      }
+      for (int c = 1; c < 16; c += 2)
+        img[c] += img_up2[c];
     } else {
       // Left to right prediction
-      // First we decode even pixels
-      int pred_left = x != 0 ? img[-2] : 128;
-      for (int c = 0; c < 16; c += 2) {
-        int b = len[c >> 3];
-        int32 adj = calcAdj(&bits, b);
-
-        if (img + c < past_last)
-          img[c] = adj + pred_left;
-      }
-
-      // Now we decode odd pixels
-      pred_left = x != 0 ? img[-1] : 128;
-      for (int c = 1; c < 16; c += 2) {
-        int b = len[2 | (c >> 3)];
-        int32 adj = calcAdj(&bits, b);
-
-        if (img + c < past_last)
-          img[c] = adj + pred_left;
-      }
+      const int pred_left_even = x != 0 ? img[-2] : 128;
+      const int pred_left_odd = x != 0 ? img[-1] : 128;
+      for (int c = 0; c < 16 && img + c < past_last; c++)
+        img[c] += (c & 1) ? pred_left_odd : pred_left_even;
     }
 
     img += 16;
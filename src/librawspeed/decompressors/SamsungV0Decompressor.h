@@ -20,7 +20,7 @@
 
 #pragma once
 
-#include "common/Common.h"                             // for int32, uint32
+#include "common/Common.h"                             // for uchar8, int32, u...
 #include "decompressors/AbstractSamsungDecompressor.h" // for AbstractSamsu...
 #include "io/BitPumpMSB32.h"                           // for BitPumpMSB32
 #include "io/ByteStream.h"                             // for ByteStream
@@ -36,7 +36,12 @@ class SamsungV0Decompressor final : public AbstractSamsungDecompressor {
 
   void computeStripes(ByteStream bso, ByteStream bsr);
 
-  void decompressStrip(uint32 y, const ByteStream& bs) const;
+  // Only decodes the differences of the row, and whether each of its blocks
+  // is predicted from the rows above, so that the rows are independent.
+  void decodeStrip(uint32 y, const ByteStream& bs, uchar8* upward) const;
+
+  // Adds the predictions to the differences, so needs the rows above.
+  void predictStrip(uint32 y, const uchar8* upward) const;
 
   static int32 calcAdj(BitPumpMSB32* bits, int b);
 
@@ -119,8 +119,10 @@ void SamsungV1Decompressor::decompress() {
   }
 
   BitPumpMSB pump(*bs);
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
   for (uint32 y = 0; y < height; y++) {
-    auto* img = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+    mRaw->checkCancelled();
+    ushort16* img = out[y];
     for (uint32 x = 0; x < width; x++) {
       int32 diff = samsungDiff(&pump, tbl);
       if (x < 2)
@@ -131,6 +133,7 @@ void SamsungV1Decompressor::decompress() {
       if (img[x] >> bits)
         ThrowRDE("decoded value out of bounds at %d:%d", x, y);
     }
+    mRaw->notifyAreaReady({0, static_cast<int>(y), static_cast<int>(width), 1});
   }
 }
 
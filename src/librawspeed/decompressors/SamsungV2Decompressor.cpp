@@ -27,7 +27,7 @@
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "io/BitPumpMSB32.h"              // for BitPumpMSB32
 #include "io/ByteStream.h"                // for ByteStream
-#include <algorithm>                      // for max
+#include <algorithm>                      // for max, min
 #include <cassert>                        // for assert
 #include <type_traits>                    // for underlying_type, underlyin...
 
@@ -129,43 +129,47 @@ SamsungV2Decompressor::SamsungV2Decompressor(const RawImage& image,
   data = startpump.getStream(startpump.getRemainSize());
 }
 
-void SamsungV2Decompressor::decompress() {
+void SamsungV2Decompressor::decompress(uint32 rows) {
+  rows = std::min(rows, height);
+  mRaw->clearArea({0, static_cast<int>(rows), mRaw->dim.x,
+                   mRaw->dim.y - static_cast<int>(rows)});
+
   switch (_flags) {
   case OptFlags::NONE:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::NONE>(row);
     break;
   case OptFlags::ALL:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::ALL>(row);
     break;
 
   case OptFlags::SKIP:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::SKIP>(row);
     break;
   case OptFlags::MV:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::MV>(row);
     break;
   case OptFlags::QP:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::QP>(row);
     break;
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wswitch"
   case OptFlags::SKIP | OptFlags::MV:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::SKIP | OptFlags::MV>(row);
     break;
   case OptFlags::SKIP | OptFlags::QP:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::SKIP | OptFlags::QP>(row);
     break;
 
   case OptFlags::MV | OptFlags::QP:
-    for (uint32 row = 0; row < height; row++)
+    for (uint32 row = 0; row < rows; row++)
       decompressRow<OptFlags::MV | OptFlags::QP>(row);
     break;
 #pragma GCC diagnostic pop
@@ -184,6 +188,8 @@ void SamsungV2Decompressor::decompress() {
 
 template <SamsungV2Decompressor::OptFlags optflags>
 void SamsungV2Decompressor::decompressRow(uint32 row) {
+  mRaw->checkCancelled();
+
   // Align pump to 16byte boundary
   const auto line_offset = data.getPosition();
   if ((line_offset & 0xf) != 0)
@@ -191,11 +197,10 @@ void SamsungV2Decompressor::decompressRow(uint32 row) {
 
   BitPumpMSB32 pump(data);
 
-  auto* img = reinterpret_cast<ushort16*>(mRaw->getData(0, row));
-  ushort16* img_up = reinterpret_cast<ushort16*>(
-      mRaw->getData(0, std::max(0, static_cast<int>(row) - 1)));
-  ushort16* img_up2 = reinterpret_cast<ushort16*>(
-      mRaw->getData(0, std::max(0, static_cast<int>(row) - 2)));
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+  ushort16* img = out[row];
+  ushort16* img_up = out[std::max(0, static_cast<int>(row) - 1)];
+  ushort16* img_up2 = out[std::max(0, static_cast<int>(row) - 2)];
 
   // Initialize the motion and diff modes at the start of the line
   uint32 motion = 7;
@@ -23,6 +23,7 @@
 #include "common/Common.h"                             // for uint32
 #include "decompressors/AbstractSamsungDecompressor.h" // for AbstractSamsu...
 #include "io/ByteStream.h"                             // for ByteStream
+#include <limits>                                      // for numeric_limits
 
 namespace rawspeed {
 
@@ -49,7 +50,8 @@ protected:
 public:
   SamsungV2Decompressor(const RawImage& image, const ByteStream& bs, int bit);
 
-  void decompress();
+  // Only decodes the first rows rows, and clears the rest.
+  void decompress(uint32 rows = std::numeric_limits<uint32>::max());
 };
 
 } // namespace rawspeed
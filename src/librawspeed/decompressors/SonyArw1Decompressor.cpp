@@ -27,7 +27,11 @@
 #include "decoders/RawDecoderException.h" // for ThrowRDE
 #include "decompressors/HuffmanTable.h"   // for HuffmanTable
 #include "io/BitPumpMSB.h"                // for BitPumpMSB
+#include <algorithm>                      // for max
 #include <cassert>                        // for assert
+#include <cstddef>                        // for size_t
+#include <cstring>                        // for memcpy
+#include <vector>                         // for vector
 
 namespace rawspeed {
 
@@ -52,35 +56,52 @@ void SonyArw1Decompressor::decompress(const ByteStream& input) const {
   assert(h % 2 == 0);
 
   BitPumpMSB bits(input);
-  uchar8* data = mRaw->getData();
-  auto* dest = reinterpret_cast<ushort16*>(&data[0]);
-  uint32 pitch = mRaw->pitch / sizeof(ushort16);
+  const Array2DRef<ushort16> out(mRaw->getU16DataAsCroppedArray2DRef());
+
+  // The image is coded column by column, from the right. Rather than writing
+  // it that way, which touches a different cache line with each pixel, a
+  // batch of the columns is decoded into a buffer that fits into the cache,
+  // and then copied out row by row.
+  static constexpr int columnsPerBatch = 32;
+  std::vector<ushort16> batch(static_cast<size_t>(columnsPerBatch) * h);
+
   int sum = 0;
-  for (int64 x = w - 1; x >= 0; x--) {
-    for (uint32 y = 0; y < h + 1; y += 2) {
-      bits.fill();
+  for (int64 batchEnd = w; batchEnd > 0; batchEnd -= columnsPerBatch) {
+    mRaw->checkCancelled();
+    const int64 batchBegin = std::max<int64>(batchEnd - columnsPerBatch, 0);
+
+    for (int64 x = batchEnd - 1; x >= batchBegin; x--) {
+      ushort16* column = &batch[x - batchBegin];
+      for (uint32 y = 0; y < h + 1; y += 2) {
+        bits.fill();
 
-      if (y == h)
-        y = 1;
+        if (y == h)
+          y = 1;
 
-      uint32 len = 4 - bits.getBitsNoFill(2);
+        uint32 len = 4 - bits.getBitsNoFill(2);
 
-      if (len == 3 && bits.getBitsNoFill(1))
-        len = 0;
+        if (len == 3 && bits.getBitsNoFill(1))
+          len = 0;
 
-      if (len == 4)
-        while (len < 17 && !bits.getBitsNoFill(1))
-          len++;
+        if (len == 4)
+          while (len < 17 && !bits.getBitsNoFill(1))
+            len++;
 
-      int diff = bits.getBits(len);
-      diff = len != 0 ? HuffmanTable::signExtended(diff, len) : diff;
-      sum += diff;
+        int diff = bits.getBits(len);
+        diff = len != 0 ? HuffmanTable::signExtended(diff, len) : diff;
+        sum += diff;
 
-      if (sum < 0 || (sum >> 12) > 0)
-        ThrowRDE("Error decompressing");
+        if (sum < 0 || (sum >> 12) > 0)
+          ThrowRDE("Error decompressing");
+
+        if (y < h)
+          column[y * columnsPerBatch] = sum;
+      }
+    }
 
-      if (y < h)
-        dest[x + y * pitch] = sum;
+    for (uint32 y = 0; y < h; y++) {
+      memcpy(&out(batchBegin, y), &batch[y * columnsPerBatch],
+             sizeof(ushort16) * (batchEnd - batchBegin));
     }
   }
 }
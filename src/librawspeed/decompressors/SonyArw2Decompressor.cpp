@@ -22,15 +22,161 @@
 
 #include "rawspeedconfig.h"
 #include "decompressors/SonyArw2Decompressor.h"
-#include "common/Common.h"                // for uint32
+#include "common/Common.h"                // for uint32, ushort16, uchar8
+#include "common/Cpuid.h"                 // for Cpuid
+#include "common/Executor.h"              // for parallelForRange
 #include "common/Point.h"                 // for iPoint2D
-#include "common/RawImage.h"              // for RawImage
+#include "common/RawImage.h"              // for RawImage, RawImageDataU16
+#include "common/RowStreamer.h"           // for RowStreamer
 #include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "io/BitPumpLSB.h"                // for BitPumpLSB
+#include "io/Endianness.h"                // for getLE
+#include <algorithm>                      // for min
+#include <array>                          // for array
 #include <cassert>                        // for assert
 
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128i, _mm_loadu_si128
+#include <tmmintrin.h> // for _mm_shuffle_epi8
+#endif
+
 namespace rawspeed {
 
+namespace {
+
+// Each packet is 128 bits, in the LSB order: the 11-bit maximum and minimum,
+// the 4-bit indexes of the two pixels that are those, and then the 7-bit
+// deltas of the other 14 pixels.
+constexpr int PixelsPerPacket = 16;
+constexpr int BytesPerPacket = 16;
+constexpr int DeltaBits = 7;
+constexpr int FirstDeltaBit = 30;
+
+struct PacketHeader {
+  int max;
+  int min;
+  int imax;
+  int imin;
+  int sh;
+
+  explicit PacketHeader(const uchar8* in) {
+    const auto v = getLE<uint32>(in);
+    max = v & 0x7ff;
+    min = (v >> 11) & 0x7ff;
+    imax = (v >> 22) & 0xf;
+    imin = (v >> 26) & 0xf;
+
+    // 128-30 = 98 bits remaining, still need to decode 16 pixels...
+    // Each full pixel consumes 7 bits, thus we can only have 14 full pixels.
+    // So we lack 2 pixels. That is where imin and imax come into play,
+    // values of those pixels were already specified in min and max.
+    // But what that means is, imin and imax must not be equal!
+    if (imax == imin)
+      ThrowRDE("ARW2 invariant failed, same pixel is both min and max");
+
+    sh = 0;
+    while ((sh < 4) && ((0x80 << sh) <= (max - min)))
+      sh++;
+  }
+};
+
+// The pixels of the packet, times two, as setWithLookUp() wants them.
+using DecodePacket = void (*)(const uchar8* in, const PacketHeader& h,
+                              ushort16* out);
+
+void decodePacket_Scalar(const uchar8* in, const PacketHeader& h,
+                         ushort16* out) {
+  const auto lo = getLE<uint64>(in);
+  const auto hi = getLE<uint64>(in + 8);
+
+  int delta = 0;
+  for (int i = 0; i < PixelsPerPacket; i++) {
+    int p;
+    if (i == h.imax)
+      p = h.max;
+    else if (i == h.imin)
+      p = h.min;
+    else {
+      const int b = FirstDeltaBit + DeltaBits * delta++;
+      uint64 bits;
+      if (b >= 64)
+        bits = hi >> (b - 64);
+      else if (b + DeltaBits > 64)
+        bits = (lo >> b) | (hi << (64 - b));
+      else
+        bits = lo >> b;
+      const int d = bits & ((1U << DeltaBits) - 1U);
+      p = std::min((d << h.sh) + h.min, 0x7ff);
+    }
+    out[i] = p << 1;
+  }
+}
+
+#ifdef WITH_SSE2
+// Each pixel of the packet works out the index of its delta (skipping the
+// maximum and the minimum), gathers the two bytes that delta is in, and
+// shifts it down by multiplying it up to a fixed bit position.
+__attribute__((target("ssse3"))) void
+decodePacket_SSSE3(const uchar8* in, const PacketHeader& h, ushort16* out) {
+  const __m128i packet = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+
+  const __m128i imax = _mm_set1_epi16(h.imax);
+  const __m128i imin = _mm_set1_epi16(h.imin);
+  const __m128i max = _mm_set1_epi16(h.max);
+  const __m128i min = _mm_set1_epi16(h.min);
+  const __m128i sh = _mm_cvtsi32_si128(h.sh);
+
+  // 1 << (7 - s), by the bit position s of the delta within its byte.
+  const __m128i muls = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0,
+                                     0, 0, 0, 0);
+
+  for (int half = 0; half < 2; half++) {
+    const __m128i i = _mm_add_epi16(_mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7),
+                                    _mm_set1_epi16(8 * half));
+
+    // The lanes after the maximum and the minimum each are one delta back.
+    __m128i delta = _mm_add_epi16(i, _mm_cmpgt_epi16(i, imax));
+    delta = _mm_add_epi16(delta, _mm_cmpgt_epi16(i, imin));
+
+    const __m128i b =
+        _mm_add_epi16(_mm_set1_epi16(FirstDeltaBit),
+                      _mm_mullo_epi16(delta, _mm_set1_epi16(DeltaBits)));
+    const __m128i byte = _mm_srli_epi16(b, 3);
+    const __m128i bit = _mm_and_si128(b, _mm_set1_epi16(7));
+
+    // The byte of the delta and the next one. A delta in the last byte fits
+    // into it, so where the next one wraps around does not matter.
+    const __m128i gather = _mm_add_epi16(
+        _mm_mullo_epi16(byte, _mm_set1_epi16(0x0101)), _mm_set1_epi16(0x0100));
+    const __m128i window = _mm_shuffle_epi8(packet, gather);
+    const __m128i mul = _mm_shuffle_epi8(
+        muls, _mm_or_si128(bit, _mm_set1_epi16(static_cast<short>(0x8000))));
+
+    __m128i p = _mm_srli_epi16(_mm_mullo_epi16(window, mul), 7);
+    p = _mm_and_si128(p, _mm_set1_epi16((1 << DeltaBits) - 1));
+    p = _mm_min_epi16(_mm_add_epi16(_mm_sll_epi16(p, sh), min),
+                      _mm_set1_epi16(0x7ff));
+
+    const __m128i isMax = _mm_cmpeq_epi16(i, imax);
+    const __m128i isMin = _mm_cmpeq_epi16(i, imin);
+    p = _mm_or_si128(_mm_and_si128(isMax, max), _mm_andnot_si128(isMax, p));
+    p = _mm_or_si128(_mm_and_si128(isMin, min), _mm_andnot_si128(isMin, p));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8 * half),
+                     _mm_slli_epi16(p, 1));
+  }
+}
+#endif
+
+DecodePacket getDecodePacket() {
+#ifdef WITH_SSE2
+  if (Cpuid::SSSE3())
+    return decodePacket_SSSE3;
+#endif
+  return decodePacket_Scalar;
+}
+
+} // namespace
+
 SonyArw2Decompressor::SonyArw2Decompressor(const RawImage& img,
                                            const ByteStream& input_)
     : mRaw(img) {
@@ -48,91 +194,69 @@ SonyArw2Decompressor::SonyArw2Decompressor(const RawImage& img,
   input = input_.peekStream(mRaw->dim.x * mRaw->dim.y);
 }
 
-void SonyArw2Decompressor::decompressRow(int row) const {
-  uchar8* data = mRaw->getData();
-  uint32 pitch = mRaw->pitch;
+void SonyArw2Decompressor::decompressRow(int row, ushort16* dest) const {
   int32 w = mRaw->dim.x;
 
   assert(mRaw->dim.x > 0);
   assert(mRaw->dim.x % 32 == 0);
 
-  auto* dest = reinterpret_cast<ushort16*>(&data[row * pitch]);
-
   ByteStream rowBs = input;
   rowBs.skipBytes(row * mRaw->dim.x);
-  rowBs = rowBs.peekStream(mRaw->dim.x);
+  const uchar8* in = rowBs.peekData(mRaw->dim.x);
 
-  BitPumpLSB bits(rowBs);
+  const PixelStore store = mRaw->getPixelStore();
 
-  uint32 random = bits.peekBits(24);
+  // The first 24 bits of the row.
+  uint32 random = getLE<uint32>(in) & 0xffffff;
 
-  // Each loop iteration processes 16 pixels, consuming 128 bits of input.
-  for (int32 x = 0; x < w;) {
-    // 30 bits.
-    int _max = bits.getBits(11);
-    int _min = bits.getBits(11);
-    int _imax = bits.getBits(4);
-    int _imin = bits.getBits(4);
+  const DecodePacket decodePacket = getDecodePacket();
+  std::array<ushort16, PixelsPerPacket> pixels;
 
-    // 128-30 = 98 bits remaining, still need to decode 16 pixels...
-    // Each full pixel consumes 7 bits, thus we can only have 14 full pixels.
-    // So we lack 2 pixels. That is where _imin and _imax come into play,
-    // values of those pixels were already specified in _min and _max.
-    // But what that means is, _imin and _imax must not be equal!
-    if (_imax == _imin)
-      ThrowRDE("ARW2 invariant failed, same pixel is both min and max");
+  // Each packet is 16 pixels, every other one of 32. The dithering goes
+  // through them in that order.
+  for (int32 x = 0; x < w; in += BytesPerPacket) {
+    const PacketHeader h(in);
+    decodePacket(in, h, pixels.data());
 
-    int sh = 0;
-    while ((sh < 4) && ((0x80 << sh) <= (_max - _min)))
-      sh++;
-
-    for (int i = 0; i < 16; i++) {
-      int p;
-      if (i == _imax)
-        p = _max;
-      else {
-        if (i == _imin)
-          p = _min;
-        else {
-          p = (bits.getBits(7) << sh) + _min;
-          if (p > 0x7ff)
-            p = 0x7ff;
-        }
-      }
-      mRaw->setWithLookUp(p << 1, reinterpret_cast<uchar8*>(&dest[x + i * 2]),
-                          &random);
-    }
+    for (int i = 0; i < PixelsPerPacket; i++)
+      dest[x + i * 2] = store.get(x + i * 2, row, pixels[i], &random);
     x += ((x & 1) != 0) ? 31 : 1; // Skip to next 32 pixels
   }
 }
 
-void SonyArw2Decompressor::decompressThread() const noexcept {
-  assert(mRaw->dim.x > 0);
-  assert(mRaw->dim.x % 32 == 0);
-  assert(mRaw->dim.y > 0);
-
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (int y = 0; y < mRaw->dim.y; y++) {
+void SonyArw2Decompressor::decompressThread(int beginRow, int endRow,
+                                            uchar8* out, size_t pitch) const
+    noexcept {
+  for (int y = beginRow; y < endRow && !mRaw->isCancelled(); y++) {
     try {
-      decompressRow(y);
+      decompressRow(
+          y, reinterpret_cast<ushort16*>(out + (y - beginRow) * pitch));
     } catch (RawspeedException& err) {
-      // Propagate the exception out of OpenMP magic.
+      // Propagate the exception out of the executor.
       mRaw->setError(err.what());
-#ifdef HAVE_OPENMP
-#pragma omp cancel for
-#endif
+      // No point in decoding the rest of this chunk.
+      break;
     }
   }
 }
 
 void SonyArw2Decompressor::decompress() const {
-#ifdef HAVE_OPENMP
-#pragma omp parallel default(none)                                             \
-    num_threads(rawspeed_get_number_of_processor_cores())
-#endif
-  decompressThread();
+  assert(mRaw->dim.x > 0);
+  assert(mRaw->dim.x % 32 == 0);
+  assert(mRaw->dim.y > 0);
+
+  // Every other pixel of each 32 is written at a time, so with the streaming
+  // stores, the whole rows are put together in the cache first.
+  const RowStreamer streamer(mRaw->getData(), mRaw->pitch,
+                             sizeof(ushort16) * mRaw->dim.x, mRaw->dim.y);
+  parallelForRange(0, mRaw->dim.y, [this, &streamer](int beginRow,
+                                                     int endRow) {
+    streamer(beginRow, endRow, 1,
+             [this](uchar8* out, size_t pitch, size_t first, size_t last) {
+               decompressThread(first, last, out, pitch);
+             });
+  });
+  mRaw->checkCancelled();
 
   std::string firstErr;
   if (mRaw->isTooManyErrors(1, &firstErr)) {
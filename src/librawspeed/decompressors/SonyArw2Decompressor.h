@@ -20,22 +20,30 @@
 
 #pragma once
 
+#include "common/Common.h"                      // for uchar8, ushort16
 #include "common/RawImage.h"                    // for RawImage
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/ByteStream.h"                      // for ByteStream
+#include <cstddef>                              // for size_t
 
 namespace rawspeed {
 
 class RawImage;
 
 class SonyArw2Decompressor final : public AbstractDecompressor {
-  void decompressRow(int row) const;
-  void decompressThread() const noexcept;
+  void decompressRow(int row, ushort16* dest) const;
+  // The rows [beginRow, endRow), of which the first one is at out, and the
+  // next ones every pitch bytes.
+  void decompressThread(int beginRow, int endRow, uchar8* out,
+                        size_t pitch) const noexcept;
 
   RawImage mRaw;
   ByteStream input;
 
 public:
+  // Of the input, see RawImageData::expectInput(): 16 pixels in 16 bytes.
+  static constexpr uint32 MinBitsPerPixel = 8;
+
   SonyArw2Decompressor(const RawImage& img, const ByteStream& input);
   void decompress() const;
 };
@@ -0,0 +1,55 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/SpeculativeDecoder.h"
+#include <cstring> // for memchr, memcpy
+#include <utility> // for move
+
+namespace rawspeed {
+
+Buffer unstuffJPEG(const ByteStream& input) {
+  const auto size = input.getRemainSize();
+  const uchar8* data = input.peekData(size);
+
+  auto storage = Buffer::Create(size);
+  uchar8* out = storage.get();
+
+  // As for the BitPumpJPEG, the data ends with the first 0xFF that is not
+  // followed by a zero byte, which it is the first byte of the marker of.
+  Buffer::size_type pos = 0;
+  Buffer::size_type n = 0;
+  while (pos < size) {
+    const auto* ff =
+        static_cast<const uchar8*>(memchr(data + pos, 0xFF, size - pos));
+    const Buffer::size_type plain = ff ? ff - (data + pos) : size - pos;
+    memcpy(out + n, data + pos, plain);
+    n += plain;
+    pos += plain;
+    if (!ff || pos + 1 >= size || data[pos + 1] != 0)
+      break;
+
+    out[n++] = 0xFF;
+    pos += 2;
+  }
+
+  return Buffer(std::move(storage), n);
+}
+
+} // namespace rawspeed
@@ -0,0 +1,265 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"                      // for uint64, uchar8
+#include "common/DefaultInitAllocatorAdaptor.h" // for DefaultInitAllocat...
+#include "common/Executor.h"                    // for getExecutor, paral...
+#include "common/RawspeedException.h"           // for RawspeedException
+#include "io/Buffer.h"                          // for Buffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include <algorithm>                            // for copy_n, lower_bound
+#include <memory>                               // for unique_ptr, make_u...
+#include <vector>                               // for vector
+
+namespace rawspeed {
+
+// The entropy-coded data of a JPEG scan, up to the first marker, without the
+// stuffed zero bytes, i.e. as a BitPumpMSB reads it just as a BitPumpJPEG
+// reads the original. Past the end, both read zeros.
+Buffer unstuffJPEG(const ByteStream& input);
+
+namespace SpeculativeDecoderDetail {
+
+// The chunks are at least this big, so that they resynchronise long before
+// they end, and the serial part of the sync is a small one of the work.
+constexpr uint64 MinChunkBytes = 64 * 1024;
+
+// Of the symbols of a chunk, the starts of this many are kept for the sync.
+constexpr unsigned SyncWindow = 4096;
+
+// And of every this many one, to find the end of the last symbol, if it is
+// in the middle of a chunk.
+constexpr unsigned MarkInterval = 256;
+
+// A chunk that fails to decode from its first bit is retried from up to this
+// many of the following ones.
+constexpr uint64 MaxRetryBits = 256;
+
+template <typename Pump> class Cursor final {
+  uint64 base; // the byte of the data at which the pump starts
+
+public:
+  Pump bits;
+
+  Cursor(const ByteStream& data, unsigned alignment, uint64 bit)
+      : base(bit / 8 / alignment * alignment),
+        bits(data.getSubStream(data.getPosition() + base)) {
+    bits.fill();
+    bits.skipBitsNoFill(bit - 8 * base);
+  }
+
+  uint64 position() const {
+    return 8 * base + bits.getBitPosition();
+  }
+};
+
+template <typename T> struct Chunk final {
+  // The bits [begin, end). The chunk ends with the first symbol that ends at
+  // or after the end.
+  uint64 begin = 0;
+  uint64 end = 0;
+
+  // As decoded from begin, and where each of the first of them start.
+  std::vector<T, DefaultInitAllocatorAdaptor<T>> symbols;
+  std::vector<uint64> starts;
+  std::vector<uint64> marks;
+  uint64 stop = 0; // where the last one ends
+
+  // Once synced, symbols[first, first + n) are the ones at out[index].
+  uint64 first = 0;
+  uint64 n = 0;
+  uint64 index = 0;
+};
+
+} // namespace SpeculativeDecoderDetail
+
+// Decodes the count symbols of an entropy-coded stream that has nothing to
+// resynchronise on, e.g. a lossless JPEG scan without the restart markers,
+// in parallel. The prefix codes tend to resynchronise within a few symbols
+// of a wrong start, so each of the chunks of the data is decoded from its
+// first bit, as if a symbol started there. Then the chunks are walked in
+// order, and the true decode, which ends where the previous chunk does, is
+// continued from there serially only until it reaches one of the symbol
+// starts of the speculative decode. From there on, both are the same. If it
+// does not within the first SyncWindow symbols, the chunk is decoded
+// serially.
+//
+// decodeSymbol(Pump*, phase) decodes one symbol, with phase being its index
+// modulo period, e.g. to pick the Huffman table of a component. The chunks
+// start at multiples of alignment bytes, as the pump reads them. The
+// symbols are stored to *out, and *endBit is where the last one ends.
+//
+// Returns false, having done nothing useful, if there are not the threads or
+// the data for it to be worth it, or if the data is corrupt. Then the
+// caller should decode the data serially, as it would have otherwise, which
+// then also reports the errors as usual.
+template <typename Pump, typename T, typename Allocator, typename DecodeSymbol>
+bool decodeSpeculatively(const ByteStream& data, unsigned alignment,
+                         uint64 count, unsigned period,
+                         const DecodeSymbol& decodeSymbol,
+                         std::vector<T, Allocator>* out, uint64* endBit) {
+  using SpeculativeDecoderDetail::MarkInterval;
+  using SpeculativeDecoderDetail::MaxRetryBits;
+  using SpeculativeDecoderDetail::MinChunkBytes;
+  using SpeculativeDecoderDetail::SyncWindow;
+  using Cursor = SpeculativeDecoderDetail::Cursor<Pump>;
+  using Chunk = SpeculativeDecoderDetail::Chunk<T>;
+
+  const uint64 size = data.getRemainSize();
+  const uint64 dataBits = 8 * size;
+
+  // As for the other regions, the work is what it writes, or reads, if that
+  // is more.
+  const int numChunks = getNumTasks(
+      static_cast<int>(std::min<uint64>(getExecutor()->getConcurrency(),
+                                        size / MinChunkBytes)),
+      std::max(size, count * sizeof(T)));
+  if (numChunks < 2 || count == 0)
+    return false;
+
+  std::vector<Chunk> chunks(numChunks);
+  for (int i = 0; i < numChunks; i++) {
+    chunks[i].begin = 8 * (size * i / numChunks / alignment * alignment);
+    if (i > 0)
+      chunks[i - 1].end = chunks[i].begin;
+  }
+  chunks.back().end = dataBits;
+
+  parallelForEach(0, numChunks, [&](int i) {
+    Chunk& c = chunks[i];
+    c.symbols.reserve(std::min(count, count * (c.end - c.begin) / dataBits +
+                                          count / 64 + 16));
+
+    // A wrong start may well run into a code that is not in the table soon
+    // after, in which case it is retried a bit later, as long as that is
+    // before the serial decode could have synced on it.
+    uint64 pos = c.begin;
+    for (uint64 from = c.begin; from < c.end && from < c.begin + MaxRetryBits;
+         from++) {
+      c.symbols.clear();
+      c.starts.clear();
+      c.marks.clear();
+      pos = from;
+      try {
+        Cursor cursor(data, alignment, pos);
+        while (pos < c.end && c.symbols.size() < count) {
+          if (c.starts.size() < SyncWindow)
+            c.starts.emplace_back(pos);
+          if (c.symbols.size() % MarkInterval == 0)
+            c.marks.emplace_back(pos);
+          c.symbols.emplace_back(
+              decodeSymbol(&cursor.bits, c.symbols.size() % period));
+          pos = cursor.position();
+        }
+        break;
+      } catch (const RawspeedException&) {
+        // It did not start at a symbol, or the data is corrupt. In the
+        // latter case, the symbols decoded so far are as good as any.
+        if (c.starts.size() == SyncWindow)
+          break;
+      }
+    }
+    c.stop = pos;
+  });
+
+  out->resize(count);
+
+  // Where the k'th symbol of the chunk, which is synced at the j'th one,
+  // starts.
+  const auto locate = [&](const Chunk& c, uint64 j, uint64 k) {
+    uint64 m = k / MarkInterval * MarkInterval;
+    uint64 pos = m >= j ? c.marks[m / MarkInterval] : c.starts[j];
+    m = std::max(m, j);
+    Cursor cursor(data, alignment, pos);
+    for (; m < k; m++)
+      decodeSymbol(&cursor.bits, m % period);
+    return cursor.position();
+  };
+
+  uint64 index = 0;
+  uint64 pos = 0;
+  try {
+    for (Chunk& c : chunks) {
+      if (index == count)
+        break;
+
+      // The true decode, from where the previous chunk ended, until it
+      // reaches one of the symbols of this one, in the same phase.
+      std::unique_ptr<Cursor> cursor;
+      auto start = c.starts.cbegin();
+      bool synced = false;
+      while (index < count && pos < c.end) {
+        start = std::lower_bound(start, c.starts.cend(), pos);
+        if (start == c.starts.cend())
+          break;
+        const uint64 j = start - c.starts.cbegin();
+        if (*start == pos && j % period == index % period &&
+            j < c.symbols.size()) {
+          synced = true;
+          break;
+        }
+        if (!cursor)
+          cursor = std::make_unique<Cursor>(data, alignment, pos);
+        (*out)[index] = decodeSymbol(&cursor->bits, index % period);
+        index++;
+        pos = cursor->position();
+      }
+
+      if (synced) {
+        c.first = start - c.starts.cbegin();
+        c.n = std::min(c.symbols.size() - c.first, count - index);
+        c.index = index;
+        index += c.n;
+        pos = c.first + c.n == c.symbols.size()
+                  ? c.stop
+                  : locate(c, c.first, c.first + c.n);
+        cursor.reset();
+      }
+
+      // The rest of the chunk, after where the speculative decode stopped,
+      // or all of it, if it never got in sync.
+      while (index < count && pos < c.end) {
+        if (!cursor)
+          cursor = std::make_unique<Cursor>(data, alignment, pos);
+        (*out)[index] = decodeSymbol(&cursor->bits, index % period);
+        index++;
+        pos = cursor->position();
+      }
+    }
+  } catch (const RawspeedException&) {
+    return false;
+  }
+
+  // It ran out of the data.
+  if (index != count || pos > dataBits)
+    return false;
+
+  parallelForEach(0, numChunks, count * sizeof(T), [&chunks, out](int i) {
+    const Chunk& c = chunks[i];
+    std::copy_n(c.symbols.cbegin() + c.first, c.n, out->begin() + c.index);
+  });
+
+  *endBit = pos;
+  return true;
+}
+
+} // namespace rawspeed
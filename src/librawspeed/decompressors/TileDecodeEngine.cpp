@@ -0,0 +1,44 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/TileDecodeEngine.h"
+#include <atomic>  // for atomic_load, atomic_store
+#include <utility> // for move
+
+namespace rawspeed {
+
+namespace {
+
+std::shared_ptr<TileDecodeEngine>& getCurrentTileDecodeEngine() {
+  static std::shared_ptr<TileDecodeEngine> engine;
+  return engine;
+}
+
+} // namespace
+
+std::shared_ptr<TileDecodeEngine> getTileDecodeEngine() {
+  return std::atomic_load(&getCurrentTileDecodeEngine());
+}
+
+void setTileDecodeEngine(std::shared_ptr<TileDecodeEngine> engine) {
+  std::atomic_store(&getCurrentTileDecodeEngine(), std::move(engine));
+}
+
+} // namespace rawspeed
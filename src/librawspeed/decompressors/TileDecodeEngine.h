@@ -0,0 +1,58 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <memory> // for shared_ptr
+#include <vector> // for vector
+
+namespace rawspeed {
+
+class AbstractDngDecompressor;
+class ByteStream;
+class RawImage;
+
+// Decodes the many independent entropy-coded streams of the tiled formats
+// elsewhere, e.g. on a GPU, one stream per warp. It is implemented by the
+// host application and selected at run time by setTileDecodeEngine(). It
+// must produce exactly the pixels of the CPU path, which is what it falls
+// back to for whatever it declines; so rstest, with the engine selected,
+// validates it against the same hashes.
+class TileDecodeEngine {
+public:
+  virtual ~TileDecodeEngine() = default;
+
+  // The tiles of the slices that are listed in the order, of any of the
+  // compressions, the others being already cleared. Each of them up to its
+  // getRows() if that isRowLimited(), the rows after that being cleared too.
+  // Returns false to leave them all to the CPU, without having changed the
+  // image. Otherwise they are all done, the errors set with setError().
+  virtual bool decompressDng(const AbstractDngDecompressor& d,
+                             const std::vector<int>& order) = 0;
+
+  // The whole image of the VC5 stream, as VC5Decompressor::decode().
+  virtual bool decompressVC5(const ByteStream& bs, const RawImage& img) = 0;
+};
+
+// Or nullptr, which is the default, for the CPU.
+std::shared_ptr<TileDecodeEngine> getTileDecodeEngine();
+void setTileDecodeEngine(std::shared_ptr<TileDecodeEngine> engine);
+
+} // namespace rawspeed
@@ -20,24 +20,248 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include "rawspeedconfig.h" // for RAWSPEED_TARGET_CLONES
 #include "decompressors/UncompressedDecompressor.h"
-#include "common/Common.h"                // for uint32, uchar8, ushort16
-#include "common/Point.h"                 // for iPoint2D
-#include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "io/BitPumpLSB.h"                // for BitPumpLSB
-#include "io/BitPumpMSB.h"                // for BitPumpMSB
-#include "io/BitPumpMSB16.h"              // for BitPumpMSB16
-#include "io/BitPumpMSB32.h"              // for BitPumpMSB32
-#include "io/ByteStream.h"                // for ByteStream
-#include "io/Endianness.h"                // for getHostEndianness, Endiann...
-#include "io/IOException.h"               // for ThrowIOE
-#include <algorithm>                      // for min
-#include <cassert>                        // for assert
+#include "common/Common.h"                      // for uint32, uchar8, ushort16
+#include "common/Cpuid.h"                       // for Cpuid
+#include "common/Executor.h"                    // for parallelForRange
+#include "common/Memory.h"                      // for copyNonTemporal
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RowStreamer.h"                 // for RowStreamer
+#include "common/TableLookUp.h"                 // for TableLookUp
+#include "decoders/RawDecoderException.h"       // for ThrowRDE
+#include "decompressors/UncompressedUnpacker.h" // for unpackPackedRows
+#include "io/BitPumpLSB.h"                      // for BitPumpLSB
+#include "io/BitPumpMSB.h"                      // for BitPumpMSB
+#include "io/BitPumpMSB16.h"                    // for BitPumpMSB16
+#include "io/BitPumpMSB32.h"                    // for BitPumpMSB32
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for getHostEndianness, End...
+#include "io/IOException.h"                     // for ThrowIOE
+#include <algorithm>                            // for min
+#include <cassert>                              // for assert
+
+#ifdef WITH_AVX512
+// GCC 12 warns about the _mm512_undefined_epi32() inside of the intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h> // for __m512i, _mm512_permutex2var_epi16
+#pragma GCC diagnostic pop
+#endif
 
 using std::min;
 
 namespace rawspeed {
 
+namespace {
+
+// Calls body(begin, end) for the bands of [0, rows), in parallel. Each band
+// consists of whole groups of rowsPerGroup rows, except for the last one.
+// Unless the image gets cancelled, then the rest of the bands is skipped.
+template <typename Body>
+void forEachRowBand(const RawImage& mRaw, uint32 rows, uint32 rowsPerGroup,
+                    const Body& body) {
+  assert(rowsPerGroup > 0);
+  // Small enough to be checked for the cancellation every now and then.
+  constexpr uint32 groupsPerBand = 64;
+  const uint32 groups = (rows + rowsPerGroup - 1) / rowsPerGroup;
+  const uint32 bands = (groups + groupsPerBand - 1) / groupsPerBand;
+  parallelForRange(0, bands, [&mRaw, rows, rowsPerGroup, &body](int begin,
+                                                                 int end) {
+    for (int band = begin; band < end; band++) {
+      mRaw->checkCancelled();
+      body(band * groupsPerBand * rowsPerGroup,
+           min<uint32>((band + 1) * groupsPerBand * rowsPerGroup, rows));
+    }
+  });
+}
+
+// Reads the rows of the band with one bit pump. If the rows are padded, each
+// of them gets a pump of its own instead, so the padding is never read.
+// With the bits known at compile time, or 0 for the bitPerPixel.
+template <typename Pump, int bits>
+RAWSPEED_TARGET_CLONES void
+readRows(const ByteStream& band, uchar8* out, uint32 outPitch, uint32 width,
+         uint32 rows, uint32 inputPitch, int bitPerPixel, bool padded) {
+  assert(bits == 0 || bits == bitPerPixel);
+  const int n = bits != 0 ? bits : bitPerPixel;
+  auto readRow = [out, outPitch, width, n](Pump* pump, uint32 row) {
+    auto* dest = reinterpret_cast<ushort16*>(out + row * outPitch);
+    for (uint32 x = 0; x < width; x++)
+      dest[x] = pump->getBits(n);
+  };
+
+  if (!padded) {
+    Pump pump(band);
+    for (uint32 row = 0; row < rows; row++)
+      readRow(&pump, row);
+    return;
+  }
+
+  for (uint32 row = 0; row < rows; row++) {
+    Pump pump(band.getSubStream(row * inputPitch, inputPitch));
+    readRow(&pump, row);
+  }
+}
+
+// The 8-bit values of row y, w of them, through the first 256 entries of the
+// table. If it is dithered, each pixel has the state of its own position, see
+// TableLookUp::lookUpDitheredAt().
+using ExpandRow = void (*)(const uchar8* in, ushort16* out, uint32 w, uint32 y,
+                           const TableLookUp& table);
+
+void expandRow_Scalar(const uchar8* in, ushort16* out, uint32 w, uint32 y,
+                      const TableLookUp& table) {
+  if (!table.dither) {
+    for (uint32 x = 0; x < w; x++)
+      out[x] = table.tables[in[x]];
+    return;
+  }
+  for (uint32 x = 0; x < w; x++)
+    out[x] = table.lookUpDitheredAt(in[x], x, y);
+}
+
+#ifdef WITH_AVX512
+// The entries of the 16-bit indices, which are below 256, of the table in 8
+// registers of 32 of them each. Each pair of the registers is looked up by
+// the low 6 bits, then the upper 2 pick the pair.
+__attribute__((target("avx512f,avx512bw"))) inline __m512i
+lookUp_AVX512(const __m512i* t, __m512i idx) {
+  const __mmask32 bit6 = _mm512_test_epi16_mask(idx, _mm512_set1_epi16(0x40));
+  const __mmask32 bit7 = _mm512_test_epi16_mask(idx, _mm512_set1_epi16(0x80));
+  const __m512i lo =
+      _mm512_mask_blend_epi16(bit6, _mm512_permutex2var_epi16(t[0], idx, t[1]),
+                              _mm512_permutex2var_epi16(t[2], idx, t[3]));
+  const __m512i hi =
+      _mm512_mask_blend_epi16(bit6, _mm512_permutex2var_epi16(t[4], idx, t[5]),
+                              _mm512_permutex2var_epi16(t[6], idx, t[7]));
+  return _mm512_mask_blend_epi16(bit7, lo, hi);
+}
+
+// 16 of the pixels from x on, as TableLookUp::lookUpDitheredAt() does it.
+__attribute__((target("avx512f,avx512bw"))) inline __m256i
+dither_AVX512(__m256i base, __m256i delta, uint32 x, __m512i seed) {
+  const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6,
+                                         5, 4, 3, 2, 1, 0);
+  // TableLookUp::seedRandom().
+  __m512i h = _mm512_xor_si512(
+      seed, _mm512_add_epi32(_mm512_set1_epi32(x), lanes));
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+  h = _mm512_mullo_epi32(h, _mm512_set1_epi32(static_cast<int>(0x85ebca6bU)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+  h = _mm512_mullo_epi32(h, _mm512_set1_epi32(static_cast<int>(0xc2b2ae35U)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+  const __m512i r = _mm512_and_si512(h, _mm512_set1_epi32(2047));
+  // A state of 0 is 1 there.
+  const __m512i r1 = _mm512_mask_mov_epi32(
+      r, _mm512_cmpeq_epi32_mask(h, _mm512_setzero_si512()),
+      _mm512_set1_epi32(1));
+
+  const __m512i d = _mm512_cvtepu16_epi32(delta);
+  const __m512i v = _mm512_add_epi32(
+      _mm512_cvtepu16_epi32(base),
+      _mm512_srli_epi32(_mm512_add_epi32(_mm512_mullo_epi32(d, r1),
+                                         _mm512_set1_epi32(1024)),
+                        12));
+  return _mm512_cvtepi32_epi16(v);
+}
+
+// Same as expandRow_Scalar(), 32 pixels at a time, the table being in the
+// registers.
+__attribute__((target("avx512f,avx512bw"))) void
+expandRow_AVX512(const uchar8* in, ushort16* out, uint32 w, uint32 y,
+                 const TableLookUp& table) {
+  const ushort16* t = table.tables.data();
+  __m512i values[8];
+  __m512i deltas[8];
+  if (!table.dither) {
+    for (int i = 0; i < 8; i++)
+      values[i] = _mm512_loadu_si512(t + 32 * i);
+  } else {
+    // The entries are pairs of the base and the delta, split them up.
+    const __m512i even = _mm512_set_epi16(
+        62, 60, 58, 56, 54, 52, 50, 48, 46, 44, 42, 40, 38, 36, 34, 32, 30,
+        28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i odd = _mm512_add_epi16(even, _mm512_set1_epi16(1));
+    for (int i = 0; i < 8; i++) {
+      const __m512i a = _mm512_loadu_si512(t + 64 * i);
+      const __m512i b = _mm512_loadu_si512(t + 64 * i + 32);
+      values[i] = _mm512_permutex2var_epi16(a, even, b);
+      deltas[i] = _mm512_permutex2var_epi16(a, odd, b);
+    }
+  }
+  const __m512i seed =
+      _mm512_set1_epi32(static_cast<int>((y << 16 | y >> 16) ^ 0x9e3779b9U));
+
+  uint32 x = 0;
+  for (; x + 32 <= w; x += 32) {
+    const __m512i idx = _mm512_cvtepu8_epi16(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + x)));
+    const __m512i v = lookUp_AVX512(values, idx);
+    if (!table.dither) {
+      _mm512_storeu_si512(out + x, v);
+      continue;
+    }
+    const __m512i d = lookUp_AVX512(deltas, idx);
+    for (int half = 0; half < 2; half++) {
+      const __m256i vh = half ? _mm512_extracti64x4_epi64(v, 1)
+                              : _mm512_castsi512_si256(v);
+      const __m256i dh = half ? _mm512_extracti64x4_epi64(d, 1)
+                              : _mm512_castsi512_si256(d);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x + 16 * half),
+                          dither_AVX512(vh, dh, x + 16 * half, seed));
+    }
+  }
+
+  for (; x < w; x++) {
+    out[x] = table.dither ? table.lookUpDitheredAt(in[x], x, y)
+                          : table.tables[in[x]];
+  }
+}
+#endif
+
+ExpandRow getExpandRow() {
+#ifdef WITH_AVX512
+  if (Cpuid::AVX512BW())
+    return expandRow_AVX512;
+#endif
+  return expandRow_Scalar;
+}
+
+// The readRows() of the common bit depths, so that there is no variable
+// shift in the loop, and of any other.
+template <typename Pump>
+void readRows(const ByteStream& band, uchar8* out, uint32 outPitch,
+              uint32 width, uint32 rows, uint32 inputPitch, int bitPerPixel,
+              bool padded) {
+  using ReadRows = void (*)(const ByteStream&, uchar8*, uint32, uint32, uint32,
+                            uint32, int, bool);
+  ReadRows read = &readRows<Pump, 0>;
+  switch (bitPerPixel) {
+  case 8:
+    read = &readRows<Pump, 8>;
+    break;
+  case 10:
+    read = &readRows<Pump, 10>;
+    break;
+  case 12:
+    read = &readRows<Pump, 12>;
+    break;
+  case 14:
+    read = &readRows<Pump, 14>;
+    break;
+  case 16:
+    read = &readRows<Pump, 16>;
+    break;
+  default:
+    break;
+  }
+  read(band, out, outPitch, width, rows, inputPitch, bitPerPixel, padded);
+}
+
+} // namespace
+
 void UncompressedDecompressor::sanityCheck(const uint32* h, int bpl) {
   assert(h != nullptr);
   assert(*h > 0);
@@ -55,7 +279,7 @@ void UncompressedDecompressor::sanityCheck(const uint32* h, int bpl) {
   if (fullRows == 0)
     ThrowIOE("Not enough data to decode a single line. Image file truncated.");
 
-  ThrowIOE("Image truncated, only %u of %u lines found", fullRows, *h);
+  ThrowIOE("Image truncated, only %llu of %u lines found", fullRows, *h);
 
   // FIXME: need to come up with some common variable to allow proceeding here
   // *h = min_h;
@@ -122,84 +346,113 @@ void UncompressedDecompressor::readUncompressedRaw(const iPoint2D& size,
 
   const int outPixelBytes = outPixelBits / 8;
 
-  uint32 skipBits = inputPitch - outPixelBytes; // Skip per line
+  if (inputPitch < outPixelBytes) {
+    ThrowRDE("Input pitch (%i) is smaller than the row (%i bytes)", inputPitch,
+             outPixelBytes);
+  }
+
   if (oy > static_cast<uint64>(mRaw->dim.y))
     ThrowRDE("Invalid y offset");
   if (ox + size.x > static_cast<uint64>(mRaw->dim.x))
     ThrowRDE("Invalid x offset");
 
-  uint64 y = oy;
   h = min(h + oy, static_cast<uint64>(mRaw->dim.y));
+  const uint32 rows = h - oy;
+
+  if (mRaw->getDataType() == TYPE_FLOAT32 && bitPerPixel != 32)
+    ThrowRDE("Only 32 bit float point supported");
+
+  // Row y of the input starts at y * inputPitch, so the rows can be decoded
+  // in parallel, in bands.
+  const uchar8* in = input.peekData(static_cast<uint64>(inputPitch) * rows);
+  uchar8* out = &data[ox * mRaw->getBpp() + oy * outPitch];
+  const bool padded = inputPitch != outPixelBytes;
+  const RowStreamer streamer(out, outPitch,
+                             static_cast<size_t>(w) * mRaw->getBpp(), rows);
+  w *= cpp;
+
+  if (mRaw->getDataType() == TYPE_FLOAT32 ||
+      (BitOrder_LSB == order && bitPerPixel == 16 &&
+       getHostEndianness() == Endianness::little)) {
+    // If that is all of the image, it may be the input itself.
+    if (ox == 0 && oy == 0 && rows == static_cast<uint32>(mRaw->dim.y) &&
+        outPixelBytes == mRaw->dim.x * static_cast<int>(mRaw->getBpp()) &&
+        mRaw->aliasData(in, inputPitch))
+      return;
+    // A plain copy does not need the staging of the rows.
+    forEachRowBand(mRaw, rows, 1, [&](uint32 begin, uint32 end) {
+      if (!streamer.isStreaming()) {
+        copyPixels(out + begin * outPitch, outPitch, in + begin * inputPitch,
+                   inputPitch, outPixelBytes, end - begin);
+        return;
+      }
+      for (uint32 row = begin; row < end; row++) {
+        copyNonTemporal(out + row * outPitch, in + row * inputPitch,
+                        outPixelBytes);
+      }
+    });
+    return;
+  }
 
-  if (mRaw->getDataType() == TYPE_FLOAT32) {
-    if (bitPerPixel != 32)
-      ThrowRDE("Only 32 bit float point supported");
-    copyPixels(&data[offset.x * sizeof(float) * cpp + y * outPitch], outPitch,
-               input.getData(inputPitch * (h - y)), inputPitch,
-               w * mRaw->getBpp(), h - y);
+  if ((BitOrder_MSB == order || BitOrder_LSB == order) &&
+      (bitPerPixel == 10 || bitPerPixel == 12 || bitPerPixel == 14)) {
+    // The unpacker reads past the rows, as far as the input allows.
+    const auto inSize = input.getRemainSize();
+    forEachRowBand(mRaw, rows, 1, [&](uint32 begin, uint32 end) {
+      streamer(begin, end, 1,
+               [&](uchar8* dest, size_t destPitch, size_t first, size_t last) {
+                 unpackPackedRows(in + first * inputPitch,
+                                  inSize - first * inputPitch, inputPitch,
+                                  reinterpret_cast<ushort16*>(dest), destPitch,
+                                  w, last - first, bitPerPixel, order);
+               });
+    });
     return;
   }
 
-  if (BitOrder_MSB == order) {
-    BitPumpMSB bits(input);
-    w *= cpp;
-    for (; y < h; y++) {
-      auto* dest = reinterpret_cast<ushort16*>(
-          &data[offset.x * sizeof(ushort16) * cpp + y * outPitch]);
-      for (uint32 x = 0; x < w; x++) {
-        uint32 b = bits.getBits(bitPerPixel);
-        dest[x] = b;
-      }
-      bits.skipBits(skipBits);
-    }
-  } else if (BitOrder_MSB16 == order) {
-    BitPumpMSB16 bits(input);
-    w *= cpp;
-    for (; y < h; y++) {
-      auto* dest = reinterpret_cast<ushort16*>(
-          &data[offset.x * sizeof(ushort16) * cpp + y * outPitch]);
-      for (uint32 x = 0; x < w; x++) {
-        uint32 b = bits.getBits(bitPerPixel);
-        dest[x] = b;
-      }
-      bits.skipBits(skipBits);
-    }
-  } else if (BitOrder_MSB32 == order) {
-    BitPumpMSB32 bits(input);
-    w *= cpp;
-    for (; y < h; y++) {
-      auto* dest = reinterpret_cast<ushort16*>(
-          &data[offset.x * sizeof(ushort16) * cpp + y * outPitch]);
-      for (uint32 x = 0; x < w; x++) {
-        uint32 b = bits.getBits(bitPerPixel);
-        dest[x] = b;
-      }
-      bits.skipBits(skipBits);
-    }
-  } else {
-    if (bitPerPixel == 16 && getHostEndianness() == Endianness::little) {
-      copyPixels(&data[offset.x * sizeof(ushort16) * cpp + y * outPitch],
-                 outPitch, input.getData(inputPitch * (h - y)), inputPitch,
-                 w * mRaw->getBpp(), h - y);
-      return;
-    }
-    if (bitPerPixel == 12 && static_cast<int>(w) == inputPitch * 8 / 12 &&
-        getHostEndianness() == Endianness::little) {
-      decode12BitRaw<Endianness::little>(w, h);
-      return;
-    }
-    BitPumpLSB bits(input);
-    w *= cpp;
-    for (; y < h; y++) {
-      auto* dest = reinterpret_cast<ushort16*>(
-          &data[offset.x * sizeof(ushort16) + y * outPitch]);
-      for (uint32 x = 0; x < w; x++) {
-        uint32 b = bits.getBits(bitPerPixel);
-        dest[x] = b;
-      }
-      bits.skipBits(skipBits);
-    }
+  // The MSB16 and MSB32 pumps read 2 and 4 bytes at once. Unless the rows
+  // are padded, in which case each one is read by a pump of its own, the
+  // bands have to start at such a word, i.e. consist of whole groups of rows.
+  uint32 wordSize = 1;
+  if (BitOrder_MSB16 == order)
+    wordSize = 2;
+  else if (BitOrder_MSB32 == order)
+    wordSize = 4;
+
+  uint32 rowsPerGroup = 1;
+  if (!padded) {
+    while ((rowsPerGroup * inputPitch) % wordSize != 0)
+      rowsPerGroup++;
   }
+
+  forEachRowBand(mRaw, rows, rowsPerGroup, [&](uint32 begin, uint32 end) {
+    streamer(begin, end, rowsPerGroup, [&](uchar8* dest, size_t destPitch,
+                                           size_t first, size_t last) {
+      const ByteStream band =
+          input.getSubStream(input.getPosition() + first * inputPitch,
+                             (last - first) * inputPitch);
+      const uint32 n = last - first;
+
+      switch (order) {
+      case BitOrder_MSB:
+        readRows<BitPumpMSB>(band, dest, destPitch, w, n, inputPitch,
+                             bitPerPixel, padded);
+        break;
+      case BitOrder_MSB16:
+        readRows<BitPumpMSB16>(band, dest, destPitch, w, n, inputPitch,
+                               bitPerPixel, padded);
+        break;
+      case BitOrder_MSB32:
+        readRows<BitPumpMSB32>(band, dest, destPitch, w, n, inputPitch,
+                               bitPerPixel, padded);
+        break;
+      default:
+        readRows<BitPumpLSB>(band, dest, destPitch, w, n, inputPitch,
+                             bitPerPixel, padded);
+        break;
+      }
+    });
+  });
 }
 
 template <bool uncorrectedRawValues>
@@ -209,17 +462,40 @@ void UncompressedDecompressor::decode8BitRaw(uint32 w, uint32 h) {
   uchar8* data = mRaw->getData();
   uint32 pitch = mRaw->pitch;
   const uchar8* in = input.getData(w * h);
-  uint32 random = 0;
-  for (uint32 y = 0; y < h; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
-    for (uint32 x = 0; x < w; x++) {
-      if (uncorrectedRawValues)
-        dest[x] = *in;
-      else
-        mRaw->setWithLookUp(*in, reinterpret_cast<uchar8*>(&dest[x]), &random);
-      in++;
-    }
+  const PixelStore store = mRaw->getPixelStore();
+
+  const RowStreamer streamer(data, pitch, sizeof(ushort16) * w, h);
+
+  // Just the curve, which is a lookup of a table of 256 entries.
+  const TableLookUp* table = mRaw->getTable();
+  if (!uncorrectedRawValues && table && !store.isScaled()) {
+    const ExpandRow expandRow = getExpandRow();
+    streamer(0, h, 1,
+             [&](uchar8* dest, size_t destPitch, size_t first, size_t last) {
+               for (uint32 y = first; y < last; y++) {
+                 expandRow(in + y * w,
+                           reinterpret_cast<ushort16*>(
+                               &dest[(y - first) * destPitch]),
+                           w, y, *table);
+               }
+             });
+    return;
   }
+
+  streamer(0, h, 1, [&](uchar8* out, size_t destPitch, size_t first,
+                        size_t last) {
+    for (uint32 y = first; y < last; y++) {
+      auto* dest = reinterpret_cast<ushort16*>(&out[(y - first) * destPitch]);
+      const uchar8* rowIn = in + y * w;
+      uint32 random = TableLookUp::seedRandom(0, y);
+      for (uint32 x = 0; x < w; x++) {
+        if (uncorrectedRawValues)
+          dest[x] = rowIn[x];
+        else
+          dest[x] = store.get(x, y, rowIn[x], &random);
+      }
+    }
+  });
 }
 
 template void UncompressedDecompressor::decode8BitRaw<false>(uint32 w, uint32 h);
@@ -249,39 +525,89 @@ void UncompressedDecompressor::decode12BitRaw(uint32 w, uint32 h) {
 
   // FIXME: maybe check size of interlaced data?
   const uchar8* in = input.peekData(perline * h);
-  uint32 half = (h + 1) >> 1;
-  for (uint32 row = 0; row < h; row++) {
-    uint32 y = !interlaced ? row : row % half * 2 + row / half;
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
-
-    if (interlaced && y == 1) {
-      // The second field starts at a 2048 byte aligment
-      const uint32 offset = ((half * w * 3 / 2 >> 11) + 1) << 11;
-      input.skipBytes(offset);
-      in = input.peekData(perline * (h - row));
+  const size_t inSize = input.getRemainSize();
+  const uint32 half = interlaced ? (h + 1) >> 1 : h;
+
+  const uchar8* secondIn = nullptr;
+  size_t secondInSize = 0;
+  if (h > half) {
+    // The second field starts at a 2048 byte aligment
+    const uint32 offset = ((half * w * 3 / 2 >> 11) + 1) << 11;
+    input.skipBytes(offset);
+    secondIn = input.peekData(perline * (h - half));
+    secondInSize = input.getRemainSize();
+  }
+
+  // With the skips, the control byte is only ever after the pixels 8 and 9
+  // of each 10, so it is not there at the end of a row of 10n + 8 pixels.
+  const uint32 inPitch = skips ? w * 3 / 2 + (w + 1) / 10 : perline;
+  const uint32 outPitch = interlaced ? 2 * pitch : pitch;
+
+  static constexpr BitOrder order =
+      e == Endianness::little ? BitOrder_LSB : BitOrder_MSB;
+
+  auto unpackRows = [w, inPitch](const uchar8* rowsIn, size_t rowsInSize,
+                                 uchar8* out, size_t outPitch, uint32 rows) {
+    if (!skips) {
+      unpackPackedRows(rowsIn, rowsInSize, inPitch,
+                       reinterpret_cast<ushort16*>(out), outPitch, w, rows,
+                       bits, order);
+      return;
     }
 
-    for (uint32 x = 0; x < w; x += 2, in += 3) {
-      uint32 g1 = in[0];
-      uint32 g2 = in[1];
+    for (uint32 row = 0; row < rows; row++) {
+      auto* dest = reinterpret_cast<ushort16*>(out + row * outPitch);
+      const uchar8* rowIn = rowsIn + row * inPitch;
 
-      auto process = [dest](uint32 i, bool invert, uint32 p1, uint32 p2) {
-        if (!(invert ^ (e == Endianness::little)))
-          dest[i] = (p1 << pack) | (p2 >> pack);
-        else
-          dest[i] = ((p2 & mask) << 8) | p1;
-      };
+      for (uint32 x = 0; x < w; x += 2, rowIn += 3) {
+        uint32 g1 = rowIn[0];
+        uint32 g2 = rowIn[1];
+
+        auto process = [dest](uint32 i, bool invert, uint32 p1, uint32 p2) {
+          if (!(invert ^ (e == Endianness::little)))
+            dest[i] = (p1 << pack) | (p2 >> pack);
+          else
+            dest[i] = ((p2 & mask) << 8) | p1;
+        };
 
-      process(x, false, g1, g2);
+        process(x, false, g1, g2);
 
-      g1 = in[2];
+        g1 = rowIn[2];
 
-      process(x + 1, true, g1, g2);
+        process(x + 1, true, g1, g2);
 
-      if (skips && ((x % 10) == 8))
-        in++;
+        if ((x % 10) == 8)
+          rowIn++;
+      }
     }
-  }
+  };
+
+  const size_t rowBytes = sizeof(ushort16) * w;
+  const RowStreamer fields[2] = {
+      RowStreamer(data, outPitch, rowBytes, half),
+      RowStreamer(data + pitch, outPitch, rowBytes, h - half)};
+
+  // Both of the fields at once, with the rows of the second one numbered
+  // after the ones of the first one.
+  forEachRowBand(mRaw, h, 1, [&](uint32 begin, uint32 end) {
+    for (uint32 row = begin; row < end;) {
+      const bool second = row >= half;
+      const uint32 fieldRow = second ? row - half : row;
+      const uint32 rows = (second ? end : min(end, half)) - row;
+      const uchar8* fieldIn = second ? secondIn : in;
+      const size_t fieldInSize = second ? secondInSize : inSize;
+
+      fields[second](fieldRow, fieldRow + rows, 1,
+                     [&](uchar8* dest, size_t destPitch, size_t first,
+                         size_t last) {
+                       unpackRows(fieldIn + first * inPitch,
+                                  fieldInSize - first * inPitch, dest,
+                                  destPitch, last - first);
+                     });
+      row += rows;
+    }
+  });
+
   input.skipBytes(input.getRemainSize());
 }
 
@@ -312,16 +638,24 @@ void UncompressedDecompressor::decode12BitRawUnpackedLeftAligned(uint32 w,
   uint32 pitch = mRaw->pitch;
   const uchar8* in = input.getData(w * h * 2);
 
-  for (uint32 y = 0; y < h; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
-    for (uint32 x = 0; x < w; x += 1, in += 2) {
-      uint32 g1 = in[0];
-      uint32 g2 = in[1];
-
-      if (e == Endianness::big)
-        dest[x] = (((g1 << 8) | (g2 & 0xf0)) >> 4);
-    }
-  }
+  const RowStreamer streamer(data, pitch, sizeof(ushort16) * w, h);
+  forEachRowBand(mRaw, h, 1, [&](uint32 begin, uint32 end) {
+    streamer(begin, end, 1, [&](uchar8* out, size_t destPitch, size_t first,
+                                size_t last) {
+      for (uint32 y = first; y < last; y++) {
+        auto* dest =
+            reinterpret_cast<ushort16*>(&out[(y - first) * destPitch]);
+        const uchar8* rowIn = in + 2 * y * w;
+        for (uint32 x = 0; x < w; x += 1, rowIn += 2) {
+          uint32 g1 = rowIn[0];
+          uint32 g2 = rowIn[1];
+
+          if (e == Endianness::big)
+            dest[x] = (((g1 << 8) | (g2 & 0xf0)) >> 4);
+        }
+      }
+    });
+  });
 }
 
 template void
@@ -343,22 +677,27 @@ void UncompressedDecompressor::decodeRawUnpacked(uint32 w, uint32 h) {
 
   sanityCheck(w, &h, 2);
 
-  uchar8* data = mRaw->getData();
-  uint32 pitch = mRaw->pitch;
   const uchar8* in = input.getData(w * h * 2);
 
-  for (uint32 y = 0; y < h; y++) {
-    auto* dest = reinterpret_cast<ushort16*>(&data[y * pitch]);
-    for (uint32 x = 0; x < w; x += 1, in += 2) {
-      uint32 g1 = in[0];
-      uint32 g2 = in[1];
+  // In the byte order of the host, the rows of all of the image may be the
+  // input itself.
+  if (bits == 16 && e == getHostEndianness() &&
+      h == static_cast<uint32>(mRaw->dim.y) &&
+      2 * w == mRaw->dim.x * mRaw->getBpp() && mRaw->aliasData(in, 2 * w))
+    return;
 
-      if (e == Endianness::little)
-        dest[x] = ((g2 << 8) | g1) >> shift;
-      else
-        dest[x] = ((g1 & mask) << 8) | g2;
-    }
-  }
+  uchar8* data = mRaw->getData();
+  uint32 pitch = mRaw->pitch;
+
+  const RowStreamer streamer(data, pitch, sizeof(ushort16) * w, h);
+  forEachRowBand(mRaw, h, 1, [&](uint32 begin, uint32 end) {
+    streamer(begin, end, 1,
+             [&](uchar8* dest, size_t destPitch, size_t first, size_t last) {
+               unpackUnpackedRows(in + 2 * first * w,
+                                  reinterpret_cast<ushort16*>(dest), destPitch,
+                                  w, last - first, bits, e);
+             });
+  });
 }
 
 template void
@@ -0,0 +1,548 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h" // for WITH_SSE2, WITH_AVX2, WITH_NEON
+#include "decompressors/UncompressedUnpacker.h"
+#include "common/Common.h"                // for uchar8, ushort16, uint32
+#include "common/Cpuid.h"                 // for Cpuid
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "io/Endianness.h"                // for Endianness, getHostEndian...
+#include <algorithm>                      // for min
+#include <array>                          // for array
+#include <atomic>                         // for atomic
+#include <cassert>                        // for assert
+#include <cstddef>                        // for size_t
+#include <initializer_list>               // for initializer_list
+#include <utility>                        // for index_sequence
+
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128i, _mm_loadu_si128
+#include <tmmintrin.h> // for _mm_shuffle_epi8
+#endif
+
+#ifdef WITH_AVX2
+#include <immintrin.h> // for __m256i, _mm256_shuffle_epi8
+#endif
+
+#if defined(WITH_NEON) && defined(__aarch64__)
+#include <arm_neon.h> // for uint8x16_t, vqtbl1q_u8
+#endif
+
+namespace rawspeed {
+
+namespace {
+
+// The pixel of the given bits that starts at the bit pos of in. Only reads
+// the bytes of that pixel.
+inline ushort16 unpackPixel(const uchar8* in, uint32 pos, int bits, bool msb) {
+  in += pos / 8;
+  const uint32 skip = pos % 8;
+  const uint32 bytes = (skip + bits + 7) / 8;
+
+  uint32 v = 0;
+  for (uint32 i = 0; i < bytes; i++) {
+    if (msb)
+      v = (v << 8) | in[i];
+    else
+      v |= static_cast<uint32>(in[i]) << (8 * i);
+  }
+
+  v >>= msb ? 8 * bytes - skip - bits : skip;
+  return v & ((1U << bits) - 1U);
+}
+
+// Where the pixels of a group of 8 are, in the bits bytes of the group.
+// A pixel starts in byte k, at the bit s of it, so it is in bytes k and k+1
+// (A), and in byte k+2 (C) if s + bits > 16. The SSE kernels shift each of
+// A and C by the multiplication with a power of two, with the mulhi for the
+// right shifts; the NEON ones have the variable shifts.
+struct PackedLayout final {
+  int bits;
+
+  std::array<uchar8, 16> shuffleA;
+  std::array<uchar8, 16> shuffleC;
+
+  std::array<ushort16, 8> mulHiA;
+  std::array<ushort16, 8> mulLoA;
+  std::array<ushort16, 8> mulHiC;
+  std::array<ushort16, 8> mulLoC;
+
+  // Negative ones are to the right.
+  std::array<short16, 8> shiftA;
+  std::array<short16, 8> shiftC;
+
+  PackedLayout(int bits_, bool msb) : bits(bits_) {
+    // Out of range, i.e. a zero byte.
+    constexpr uchar8 zero = 0x80;
+
+    for (int i = 0; i < 8; i++) {
+      const int k = i * bits / 8;
+      const int s = i * bits % 8;
+      const bool spansC = s + bits > 16;
+
+      shuffleA[2 * i] = msb ? k + 1 : k;
+      shuffleA[2 * i + 1] = msb ? k : k + 1;
+      shuffleC[2 * i] = spansC ? k + 2 : zero;
+      shuffleC[2 * i + 1] = zero;
+
+      if (msb) {
+        // (A << s) >> (16 - bits) | C >> (24 - s - bits)
+        mulHiA[i] = 0;
+        mulLoA[i] = 1U << s;
+        mulHiC[i] = spansC ? 1U << (s + bits - 8) : 0;
+        mulLoC[i] = 0;
+        shiftA[i] = s;
+        shiftC[i] = spansC ? -(24 - s - bits) : 0;
+      } else {
+        // ((A >> s) | C << (16 - s)) & mask
+        mulHiA[i] = s ? 1U << (16 - s) : 0;
+        mulLoA[i] = s ? 0 : 1;
+        mulHiC[i] = 0;
+        mulLoC[i] = spansC ? 1U << (16 - s) : 0;
+        shiftA[i] = -s;
+        shiftC[i] = spansC ? 16 - s : 0;
+      }
+    }
+  }
+};
+
+// Unpacks numGroups groups of 8 pixels. The SIMD ones read 16 bytes for each
+// group, which are bits bytes apart.
+using PackedGroupsFunction = void (*)(const uchar8* in, ushort16* out,
+                                      uint32 numGroups,
+                                      const PackedLayout& layout);
+
+template <int bits, bool msb, size_t... i>
+inline void unpackGroup_Scalar(const uchar8* in, ushort16* out,
+                               std::index_sequence<i...> /*unused*/) {
+  // The positions are known, so each one becomes a few shifts and ors.
+  (void)std::initializer_list<int>{
+      (out[i] = unpackPixel(in, i * bits, bits, msb), 0)...};
+}
+
+template <int bits, bool msb>
+void unpackPackedGroups_Scalar(const uchar8* in, ushort16* out,
+                               uint32 numGroups,
+                               const PackedLayout& /*layout*/) {
+  for (uint32 g = 0; g < numGroups; g++, in += bits, out += 8)
+    unpackGroup_Scalar<bits, msb>(in, out, std::make_index_sequence<8>());
+}
+
+#ifdef WITH_SSE2
+template <bool msb>
+__attribute__((target("ssse3"))) void
+unpackPackedGroups_SSSE3(const uchar8* in, ushort16* out, uint32 numGroups,
+                         const PackedLayout& layout) {
+  auto load = [](const void* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  };
+
+  const __m128i shuffleA = load(layout.shuffleA.data());
+  const __m128i shuffleC = load(layout.shuffleC.data());
+  const __m128i mulHiA = load(layout.mulHiA.data());
+  const __m128i mulLoA = load(layout.mulLoA.data());
+  const __m128i mulHiC = load(layout.mulHiC.data());
+  const __m128i mulLoC = load(layout.mulLoC.data());
+  const __m128i shift = _mm_cvtsi32_si128(16 - layout.bits);
+  const __m128i mask = _mm_set1_epi16((1 << layout.bits) - 1);
+
+  for (uint32 g = 0; g < numGroups; g++, in += layout.bits, out += 8) {
+    const __m128i v = load(in);
+    const __m128i a = _mm_shuffle_epi8(v, shuffleA);
+    const __m128i c = _mm_shuffle_epi8(v, shuffleC);
+
+    __m128i pix;
+    if (msb) {
+      pix = _mm_or_si128(_mm_srl_epi16(_mm_mullo_epi16(a, mulLoA), shift),
+                         _mm_mulhi_epu16(c, mulHiC));
+    } else {
+      pix = _mm_or_si128(_mm_mulhi_epu16(a, mulHiA),
+                         _mm_mullo_epi16(a, mulLoA));
+      pix = _mm_and_si128(_mm_or_si128(pix, _mm_mullo_epi16(c, mulLoC)), mask);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pix);
+  }
+}
+#endif
+
+#ifdef WITH_AVX2
+// The same 16 bytes in both of the lanes.
+__attribute__((target("avx2"))) inline __m256i broadcast_AVX2(const void* p) {
+  return _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+// The same as unpackPackedGroups_SSSE3(), two groups at once.
+template <bool msb>
+__attribute__((target("avx2"))) void
+unpackPackedGroups_AVX2(const uchar8* in, ushort16* out, uint32 numGroups,
+                        const PackedLayout& layout) {
+  const __m256i shuffleA = broadcast_AVX2(layout.shuffleA.data());
+  const __m256i shuffleC = broadcast_AVX2(layout.shuffleC.data());
+  const __m256i mulHiA = broadcast_AVX2(layout.mulHiA.data());
+  const __m256i mulLoA = broadcast_AVX2(layout.mulLoA.data());
+  const __m256i mulHiC = broadcast_AVX2(layout.mulHiC.data());
+  const __m256i mulLoC = broadcast_AVX2(layout.mulLoC.data());
+  const __m128i shift = _mm_cvtsi32_si128(16 - layout.bits);
+  const __m256i mask = _mm256_set1_epi16((1 << layout.bits) - 1);
+
+  uint32 g = 0;
+  for (; g + 2 <= numGroups; g += 2, in += 2 * layout.bits, out += 16) {
+    const __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + layout.bits)),
+        1);
+    const __m256i a = _mm256_shuffle_epi8(v, shuffleA);
+    const __m256i c = _mm256_shuffle_epi8(v, shuffleC);
+
+    __m256i pix;
+    if (msb) {
+      pix = _mm256_or_si256(
+          _mm256_srl_epi16(_mm256_mullo_epi16(a, mulLoA), shift),
+          _mm256_mulhi_epu16(c, mulHiC));
+    } else {
+      pix = _mm256_or_si256(_mm256_mulhi_epu16(a, mulHiA),
+                            _mm256_mullo_epi16(a, mulLoA));
+      pix = _mm256_and_si256(
+          _mm256_or_si256(pix, _mm256_mullo_epi16(c, mulLoC)), mask);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pix);
+  }
+
+  if (g < numGroups)
+    unpackPackedGroups_SSSE3<msb>(in, out, numGroups - g, layout);
+}
+#endif
+
+#if defined(WITH_NEON) && defined(__aarch64__)
+template <bool msb>
+void unpackPackedGroups_NEON(const uchar8* in, ushort16* out, uint32 numGroups,
+                             const PackedLayout& layout) {
+  const uint8x16_t shuffleA = vld1q_u8(layout.shuffleA.data());
+  const uint8x16_t shuffleC = vld1q_u8(layout.shuffleC.data());
+  const int16x8_t shiftA = vld1q_s16(layout.shiftA.data());
+  const int16x8_t shiftC = vld1q_s16(layout.shiftC.data());
+  const int16x8_t shift = vdupq_n_s16(-(16 - layout.bits));
+  const uint16x8_t mask = vdupq_n_u16((1U << layout.bits) - 1U);
+
+  for (uint32 g = 0; g < numGroups; g++, in += layout.bits, out += 8) {
+    const uint8x16_t v = vld1q_u8(in);
+    const uint16x8_t a = vreinterpretq_u16_u8(vqtbl1q_u8(v, shuffleA));
+    const uint16x8_t c = vreinterpretq_u16_u8(vqtbl1q_u8(v, shuffleC));
+
+    uint16x8_t pix;
+    if (msb) {
+      pix = vorrq_u16(vshlq_u16(vshlq_u16(a, shiftA), shift),
+                      vshlq_u16(c, shiftC));
+    } else {
+      pix = vandq_u16(vorrq_u16(vshlq_u16(a, shiftA), vshlq_u16(c, shiftC)),
+                      mask);
+    }
+
+    vst1q_u16(out, pix);
+  }
+}
+#endif
+
+template <bool msb>
+PackedGroupsFunction getPackedGroupsFunction_Scalar(int bits) {
+  switch (bits) {
+  case 10:
+    return &unpackPackedGroups_Scalar<10, msb>;
+  case 12:
+    return &unpackPackedGroups_Scalar<12, msb>;
+  case 14:
+    return &unpackPackedGroups_Scalar<14, msb>;
+  default:
+    ThrowRDE("Unsupported bit depth %i", bits);
+  }
+}
+
+template <bool msb>
+PackedGroupsFunction getPackedGroupsFunction(UnpackKernel kernel, int bits) {
+  switch (kernel) {
+#ifdef WITH_AVX2
+  case UnpackKernel::AVX2:
+    return &unpackPackedGroups_AVX2<msb>;
+#endif
+#ifdef WITH_SSE2
+  case UnpackKernel::SSSE3:
+    return &unpackPackedGroups_SSSE3<msb>;
+#endif
+#if defined(WITH_NEON) && defined(__aarch64__)
+  case UnpackKernel::NEON:
+    return &unpackPackedGroups_NEON<msb>;
+#endif
+  default:
+    return getPackedGroupsFunction_Scalar<msb>(bits);
+  }
+}
+
+// Unpacks numBlocks blocks of 8 pixels, of 16 bytes each.
+using UnpackedBlocksFunction = void (*)(const uchar8* in, ushort16* out,
+                                        uint32 numBlocks, int bits);
+
+template <Endianness e>
+inline ushort16 unpackUnpackedPixel(const uchar8* in, int bits) {
+  const uint32 g1 = in[0];
+  const uint32 g2 = in[1];
+
+  if (e == Endianness::little)
+    return ((g2 << 8) | g1) >> (16 - bits);
+  return ((g1 & ((1U << (bits - 8)) - 1U)) << 8) | g2;
+}
+
+template <Endianness e>
+void unpackUnpackedBlocks_Scalar(const uchar8* in, ushort16* out,
+                                 uint32 numBlocks, int bits) {
+  for (uint32 x = 0; x < 8 * numBlocks; x++, in += 2)
+    out[x] = unpackUnpackedPixel<e>(in, bits);
+}
+
+#ifdef WITH_SSE2
+template <Endianness e>
+void unpackUnpackedBlocks_SSE2(const uchar8* in, ushort16* out,
+                               uint32 numBlocks, int bits) {
+  const __m128i shift = _mm_cvtsi32_si128(16 - bits);
+  const __m128i mask = _mm_set1_epi16((1 << bits) - 1);
+
+  for (uint32 b = 0; b < numBlocks; b++, in += 16, out += 8) {
+    __m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    if (e == Endianness::little) {
+      pix = _mm_srl_epi16(pix, shift);
+    } else {
+      pix = _mm_or_si128(_mm_slli_epi16(pix, 8), _mm_srli_epi16(pix, 8));
+      pix = _mm_and_si128(pix, mask);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pix);
+  }
+}
+#endif
+
+#ifdef WITH_AVX2
+template <Endianness e>
+__attribute__((target("avx2"))) void
+unpackUnpackedBlocks_AVX2(const uchar8* in, ushort16* out, uint32 numBlocks,
+                          int bits) {
+  const __m128i shift = _mm_cvtsi32_si128(16 - bits);
+  const __m256i mask = _mm256_set1_epi16((1 << bits) - 1);
+
+  uint32 b = 0;
+  for (; b + 2 <= numBlocks; b += 2, in += 32, out += 16) {
+    __m256i pix = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+    if (e == Endianness::little) {
+      pix = _mm256_srl_epi16(pix, shift);
+    } else {
+      pix = _mm256_or_si256(_mm256_slli_epi16(pix, 8),
+                            _mm256_srli_epi16(pix, 8));
+      pix = _mm256_and_si256(pix, mask);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pix);
+  }
+
+  if (b < numBlocks)
+    unpackUnpackedBlocks_SSE2<e>(in, out, numBlocks - b, bits);
+}
+#endif
+
+#if defined(WITH_NEON) && defined(__aarch64__)
+template <Endianness e>
+void unpackUnpackedBlocks_NEON(const uchar8* in, ushort16* out,
+                               uint32 numBlocks, int bits) {
+  const int16x8_t shift = vdupq_n_s16(-(16 - bits));
+  const uint16x8_t mask = vdupq_n_u16((1U << bits) - 1U);
+
+  for (uint32 b = 0; b < numBlocks; b++, in += 16, out += 8) {
+    uint8x16_t v = vld1q_u8(in);
+    if (e == Endianness::little) {
+      vst1q_u16(out, vshlq_u16(vreinterpretq_u16_u8(v), shift));
+    } else {
+      v = vrev16q_u8(v);
+      vst1q_u16(out, vandq_u16(vreinterpretq_u16_u8(v), mask));
+    }
+  }
+}
+#endif
+
+template <Endianness e>
+UnpackedBlocksFunction getUnpackedBlocksFunction(UnpackKernel kernel) {
+  switch (kernel) {
+#ifdef WITH_AVX2
+  case UnpackKernel::AVX2:
+    return &unpackUnpackedBlocks_AVX2<e>;
+#endif
+#ifdef WITH_SSE2
+  case UnpackKernel::SSSE3:
+    return &unpackUnpackedBlocks_SSE2<e>;
+#endif
+#if defined(WITH_NEON) && defined(__aarch64__)
+  case UnpackKernel::NEON:
+    return &unpackUnpackedBlocks_NEON<e>;
+#endif
+  default:
+    return &unpackUnpackedBlocks_Scalar<e>;
+  }
+}
+
+std::atomic<UnpackKernel> forcedKernel(UnpackKernel::Auto);
+
+// The kernel to use now, never Auto. Not cached, the enabled CPU features
+// can change, see Cpuid::setEnabled().
+UnpackKernel selectKernel() {
+  const UnpackKernel forced = forcedKernel;
+  if (forced != UnpackKernel::Auto)
+    return forced;
+
+  for (const auto kernel :
+       {UnpackKernel::AVX2, UnpackKernel::SSSE3, UnpackKernel::NEON}) {
+    if (isUnpackKernelSupported(kernel))
+      return kernel;
+  }
+  return UnpackKernel::Scalar;
+}
+
+} // namespace
+
+const char* getUnpackKernelName(UnpackKernel kernel) {
+  switch (kernel) {
+  case UnpackKernel::Auto:
+    return "Auto";
+  case UnpackKernel::Scalar:
+    return "Scalar";
+  case UnpackKernel::SSSE3:
+    return "SSSE3";
+  case UnpackKernel::AVX2:
+    return "AVX2";
+  case UnpackKernel::NEON:
+    return "NEON";
+  }
+  ThrowRDE("Unexpected unpack kernel %i", static_cast<int>(kernel));
+}
+
+bool isUnpackKernelSupported(UnpackKernel kernel) {
+  switch (kernel) {
+  case UnpackKernel::Auto:
+  case UnpackKernel::Scalar:
+    return true;
+  case UnpackKernel::SSSE3:
+#ifdef WITH_SSE2
+    return Cpuid::SSSE3();
+#else
+    return false;
+#endif
+  case UnpackKernel::AVX2:
+#ifdef WITH_AVX2
+    return Cpuid::AVX2();
+#else
+    return false;
+#endif
+  case UnpackKernel::NEON:
+#if defined(WITH_NEON) && defined(__aarch64__)
+    // The shuffles assume that the lanes are little-endian.
+    return Cpuid::NEON() && getHostEndianness() == Endianness::little;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+void setUnpackKernel(UnpackKernel kernel) {
+  if (!isUnpackKernelSupported(kernel))
+    ThrowRDE("Unpack kernel %s is not supported", getUnpackKernelName(kernel));
+  forcedKernel = kernel;
+}
+
+UnpackKernel getUnpackKernel() { return forcedKernel; }
+
+void unpackPackedRows(const uchar8* in, size_t inSize, uint32 inPitch,
+                      ushort16* out, uint32 outPitch, uint32 width,
+                      uint32 height, int bits, BitOrder order) {
+  if (bits != 10 && bits != 12 && bits != 14)
+    ThrowRDE("Unsupported bit depth %i", bits);
+  if (order != BitOrder_LSB && order != BitOrder_MSB)
+    ThrowRDE("Unsupported bit order %i", order);
+
+  assert(static_cast<uint64>(inPitch) * 8 >= static_cast<uint64>(width) * bits);
+  assert(height == 0 || inSize >= static_cast<size_t>(height - 1) * inPitch +
+                                      (static_cast<size_t>(width) * bits + 7) /
+                                          8);
+
+  const bool msb = order == BitOrder_MSB;
+  const PackedLayout layout(bits, msb);
+
+  const UnpackKernel kernel = selectKernel();
+  const PackedGroupsFunction groups =
+      msb ? getPackedGroupsFunction<true>(kernel, bits)
+          : getPackedGroupsFunction<false>(kernel, bits);
+
+  for (uint32 y = 0; y < height; y++) {
+    const uchar8* rowIn = in + static_cast<size_t>(y) * inPitch;
+    const size_t rowInSize = inSize - static_cast<size_t>(y) * inPitch;
+    auto* rowOut = reinterpret_cast<ushort16*>(
+        reinterpret_cast<uchar8*>(out) + static_cast<size_t>(y) * outPitch);
+
+    // The scalar kernel only reads the bytes of the groups, the SIMD ones
+    // read 16 bytes for each group.
+    size_t numGroups = width / 8;
+    if (kernel != UnpackKernel::Scalar)
+      numGroups = std::min<size_t>(
+          numGroups, rowInSize < 16 ? 0 : (rowInSize - 16) / bits + 1);
+
+    groups(rowIn, rowOut, static_cast<uint32>(numGroups), layout);
+
+    for (uint32 x = 8 * numGroups; x < width; x++)
+      rowOut[x] = unpackPixel(rowIn, x * bits, bits, msb);
+  }
+}
+
+void unpackUnpackedRows(const uchar8* in, ushort16* out, uint32 outPitch,
+                        uint32 width, uint32 height, int bits, Endianness e) {
+  if (bits != 12 && bits != 14 && bits != 16)
+    ThrowRDE("Unsupported bit depth %i", bits);
+  if (e != Endianness::little && e != Endianness::big)
+    ThrowRDE("Unsupported endianness %i", static_cast<int>(e));
+
+  const UnpackKernel kernel = selectKernel();
+  const bool little = e == Endianness::little;
+  const UnpackedBlocksFunction blocks =
+      little ? getUnpackedBlocksFunction<Endianness::little>(kernel)
+             : getUnpackedBlocksFunction<Endianness::big>(kernel);
+
+  for (uint32 y = 0; y < height; y++) {
+    const uchar8* rowIn = in + 2 * static_cast<size_t>(y) * width;
+    auto* rowOut = reinterpret_cast<ushort16*>(
+        reinterpret_cast<uchar8*>(out) + static_cast<size_t>(y) * outPitch);
+
+    const uint32 numBlocks = width / 8;
+    blocks(rowIn, rowOut, numBlocks, bits);
+
+    for (uint32 x = 8 * numBlocks; x < width; x++) {
+      const uchar8* pix = rowIn + 2 * x;
+      rowOut[x] = little ? unpackUnpackedPixel<Endianness::little>(pix, bits)
+                         : unpackUnpackedPixel<Endianness::big>(pix, bits);
+    }
+  }
+}
+
+} // namespace rawspeed
@@ -0,0 +1,65 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uchar8, ushort16, uint32, BitOrder
+#include "io/Endianness.h" // for Endianness
+#include <cstddef>         // for size_t
+
+namespace rawspeed {
+
+// The implementations of the unpacking of the uncompressed rows.
+enum class UnpackKernel {
+  Auto, // the fastest one that is supported
+  Scalar,
+  SSSE3,
+  AVX2,
+  NEON,
+};
+
+const char* getUnpackKernelName(UnpackKernel kernel);
+
+// Whether the kernel was built, and the CPU can run it. Auto always is.
+bool isUnpackKernelSupported(UnpackKernel kernel);
+
+// By default (Auto), the fastest supported kernel is used. This forces one
+// specific kernel instead, e.g. for the benchmarks. Throws if not supported.
+void setUnpackKernel(UnpackKernel kernel);
+UnpackKernel getUnpackKernel();
+
+// Unpacks height rows of width pixels, each one with 10, 12 or 14 bits, and
+// packed without any padding, in BitOrder_LSB or BitOrder_MSB order.
+// The input rows are inPitch bytes apart, the output rows outPitch bytes.
+// There must be inSize bytes readable at in, and the kernels do read past
+// the end of the rows, as far as the inSize allows, so it should be the whole
+// rest of the buffer, not just the size of the rows.
+void unpackPackedRows(const uchar8* in, size_t inSize, uint32 inPitch,
+                      ushort16* out, uint32 outPitch, uint32 width,
+                      uint32 height, int bits, BitOrder order);
+
+// Same as UncompressedDecompressor::decodeRawUnpacked(): the pixels are in
+// 16 bits each, and the rows are not padded. The little-endian ones are left
+// aligned (the low 16 - bits bits are dropped), the big-endian ones are right
+// aligned (the high 16 - bits bits are dropped). 12, 14 or 16 bits.
+void unpackUnpackedRows(const uchar8* in, ushort16* out, uint32 outPitch,
+                        uint32 width, uint32 height, int bits, Endianness e);
+
+} // namespace rawspeed
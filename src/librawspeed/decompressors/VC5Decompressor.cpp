@@ -29,19 +29,29 @@
 
 #include "rawspeedconfig.h"
 #include "decompressors/VC5Decompressor.h"
-#include "common/Array2DRef.h"            // for Array2DRef
-#include "common/Optional.h"              // for Optional
-#include "common/Point.h"                 // for iPoint2D
-#include "common/RawspeedException.h"     // for RawspeedException
-#include "common/SimpleLUT.h"             // for SimpleLUT, SimpleLUT<>::va...
-#include "decoders/RawDecoderException.h" // for ThrowRDE
-#include "io/Endianness.h"                // for Endianness, Endianness::big
-#include <cassert>                        // for assert
-#include <cmath>                          // for pow
-#include <initializer_list>               // for initializer_list
-#include <limits>                         // for numeric_limits
-#include <string>                         // for string
-#include <utility>                        // for move
+#include "common/Array2DRef.h"              // for Array2DRef
+#include "common/Cpuid.h"                   // for Cpuid
+#include "common/Executor.h"                // for parallelFor, parallelForEach
+#include "common/Optional.h"                // for Optional
+#include "common/Point.h"                   // for iPoint2D
+#include "common/RawspeedException.h"       // for RawspeedException
+#include "common/SimpleLUT.h"               // for SimpleLUT, SimpleLUT<>::va...
+#include "decoders/RawDecoderException.h"   // for ThrowRDE
+#include "decompressors/TileDecodeEngine.h" // for getTileDecodeEngine
+#include "io/Endianness.h"                  // for Endianness, Endianness::big
+#include <algorithm>                        // for max, min, copy, fill_n
+#include <atomic>                           // for atomic
+#include <cassert>                          // for assert
+#include <cmath>                            // for pow
+#include <initializer_list>                 // for initializer_list
+#include <limits>                           // for numeric_limits
+#include <string>                           // for string
+#include <utility>                          // for move
+#include <vector>                           // for vector
+
+#ifdef WITH_SSE2
+#include <emmintrin.h> // for __m128i, _mm_loadu_si128
+#endif
 
 namespace {
 
@@ -92,6 +102,90 @@ const std::array<RLV, table17.length> decompandedTable17 = []() {
   return d;
 }();
 
+// decompandedTable17, precompiled into a multi-level direct lookup table.
+// Each level is indexed by the next few bits of the stream. Its entry is
+// either the decoded run, with the sign bit of the value already applied if
+// it also fits into the index, or a link to the next level, for the codes that
+// are longer than the index.
+class RLVLookup final {
+public:
+  enum class Kind : uint8_t { None, Run, RunThenSign, NextLevel };
+
+  struct Entry {
+    Kind kind;
+    uint8_t bits;   // The bits that this lookup consumes.
+    uint16_t count; // The run length, or the offset of the next level.
+    int16_t value;  // The run value, or the index width of the next level.
+  };
+
+  static constexpr int RootBits = 12;
+  static constexpr int NextBits = 8;
+
+  std::vector<Entry> table;
+
+  RLVLookup() { addLevel(0, 0, RootBits); }
+
+private:
+  // Appends the level of the codes that start with the `prefixLen` bits of
+  // `prefix`, indexed by the `width` bits that follow them.
+  void addLevel(uint32_t prefix, int prefixLen, int width) {
+    const auto offset = table.size();
+    const auto size = 1U << width;
+    table.resize(offset + size, {Kind::None, 0, 0, 0});
+    const int end = prefixLen + width;
+
+    // The longest code of each of the entries that need a next level.
+    std::vector<int> longest(size, 0);
+
+    for (const RLV& rlv : decompandedTable17) {
+      if (rlv.size <= prefixLen ||
+          (rlv.bits >> (rlv.size - prefixLen)) != prefix)
+        continue;
+
+      if (rlv.size > end) {
+        int& l = longest[(rlv.bits >> (rlv.size - end)) & (size - 1)];
+        l = std::max<int>(l, rlv.size);
+        continue;
+      }
+
+      const int len = rlv.size - prefixLen;
+      const uint32_t code = rlv.bits & ((1U << len) - 1U);
+      const auto value = static_cast<int16_t>(rlv.value);
+      const bool hasSign = value != 0;
+      const bool withSign = hasSign && rlv.size < end;
+
+      for (int sign = 0; sign <= int(withSign); sign++) {
+        const int used = len + int(withSign);
+        const uint32_t bits = withSign ? (code << 1U) | sign : code;
+        const Entry e = {hasSign && !withSign ? Kind::RunThenSign : Kind::Run,
+                         static_cast<uint8_t>(used), rlv.count,
+                         static_cast<int16_t>(sign ? -value : value)};
+        for (uint32_t rest = 0; rest < (1U << (width - used)); rest++) {
+          Entry& dst = table[offset + ((bits << (width - used)) | rest)];
+          assert(dst.kind == Kind::None && "the codebook is a prefix code");
+          dst = e;
+        }
+      }
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+      if (!longest[i])
+        continue;
+      const int nextWidth = std::min(longest[i] - end, NextBits);
+      assert(table.size() <= std::numeric_limits<uint16_t>::max());
+      table[offset + i] = {Kind::NextLevel, static_cast<uint8_t>(width),
+                           static_cast<uint16_t>(table.size()),
+                           static_cast<int16_t>(nextWidth)};
+      addLevel((prefix << width) | i, end, nextWidth);
+    }
+  }
+};
+
+constexpr int RLVLookup::RootBits;
+constexpr int RLVLookup::NextBits;
+
+const RLVLookup rlvLookup;
+
 } // namespace
 
 #define PRECISION_MIN 8
@@ -175,145 +269,191 @@ constexpr std::array<int, 4> ConvolutionParams::Last::mul_odd;
 
 } // namespace
 
-void VC5Decompressor::Wavelet::reconstructPass(
-    const Array2DRef<int16_t> dst, const Array2DRef<const int16_t> high,
-    const Array2DRef<const int16_t> low) const noexcept {
-  auto process = [low, high, dst](auto segment, int x, int y) {
-    auto lowGetter = [&x, &y, low](int delta) {
-      return low(x, y + decltype(segment)::coord_shift + delta);
-    };
-    auto convolution = [&x, &y, high, lowGetter](std::array<int, 4> muls) {
-      return convolute(x, y, muls, high, lowGetter, /*DescaleShift*/ 0);
-    };
-
-    int even = convolution(decltype(segment)::mul_even);
-    int odd = convolution(decltype(segment)::mul_odd);
-
-    dst(x, 2 * y) = static_cast<int16_t>(even);
-    dst(x, 2 * y + 1) = static_cast<int16_t>(odd);
-  };
+namespace {
 
-  // Vertical reconstruction
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (int y = 0; y < height; ++y) {
-    if (y == 0) {
-      // 1st row
-      for (int x = 0; x < width; ++x)
-        process(ConvolutionParams::First, x, y);
-    } else if (y + 1 < height) {
-      // middle rows
-      for (int x = 0; x < width; ++x)
-        process(ConvolutionParams::Middle, x, y);
-    } else {
-      // last row
-      for (int x = 0; x < width; ++x)
-        process(ConvolutionParams::Last, x, y);
-    }
+// A row of the vertical reconstruction, of the x from xBegin on, from its
+// row of the high band and the three rows of the low band that it uses.
+template <typename Segment>
+void reconstructRow_Scalar(Segment /*segment*/, int16_t* even, int16_t* odd,
+                           const Array2DRef<const int16_t> high,
+                           const Array2DRef<const int16_t> lows, int xBegin) {
+  for (int x = xBegin; x < high.width; ++x) {
+    auto lowGetter = [x, lows](int delta) { return lows(x, delta); };
+    even[x] = static_cast<int16_t>(
+        convolute(x, 0, Segment::mul_even, high, lowGetter, 0));
+    odd[x] = static_cast<int16_t>(
+        convolute(x, 0, Segment::mul_odd, high, lowGetter, 0));
   }
 }
 
-void VC5Decompressor::Wavelet::combineLowHighPass(
-    const Array2DRef<int16_t> dst, const Array2DRef<const int16_t> low,
-    const Array2DRef<const int16_t> high, int descaleShift,
-    bool clampUint = false) const noexcept {
-  auto process = [low, high, descaleShift, clampUint, dst](auto segment, int x,
-                                                           int y) {
-    auto lowGetter = [&x, &y, low](int delta) {
-      return low(x + decltype(segment)::coord_shift + delta, y);
-    };
-    auto convolution = [&x, &y, high, lowGetter,
-                        descaleShift](std::array<int, 4> muls) {
-      return convolute(x, y, muls, high, lowGetter, descaleShift);
-    };
-
-    int even = convolution(decltype(segment)::mul_even);
-    int odd = convolution(decltype(segment)::mul_odd);
-
-    if (clampUint) {
-      even = clampBits(even, 14);
-      odd = clampBits(odd, 14);
-    }
-    dst(2 * x, y) = static_cast<int16_t>(even);
-    dst(2 * x + 1, y) = static_cast<int16_t>(odd);
+// The column x of the horizontal reconstruction of a row, into the columns
+// 2 * x and 2 * x + 1 of dst.
+template <typename Segment>
+void combineColumn_Scalar(Segment /*segment*/, int16_t* dst,
+                          const Array2DRef<const int16_t> low,
+                          const Array2DRef<const int16_t> high, int x,
+                          int descaleShift, bool clampUint) {
+  auto lowGetter = [x, low](int delta) {
+    return low(x + Segment::coord_shift + delta, 0);
   };
+  int even = convolute(x, 0, Segment::mul_even, high, lowGetter, descaleShift);
+  int odd = convolute(x, 0, Segment::mul_odd, high, lowGetter, descaleShift);
 
-  // Horizontal reconstruction
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static)
-#endif
-  for (int y = 0; y < dst.height; ++y) {
-    // First col
-    int x = 0;
-    process(ConvolutionParams::First, x, y);
-    // middle cols
-    for (x = 1; x + 1 < width; ++x) {
-      process(ConvolutionParams::Middle, x, y);
-    }
-    // last col
-    process(ConvolutionParams::Last, x, y);
+  if (clampUint) {
+    even = clampBits(even, 14);
+    odd = clampBits(odd, 14);
   }
+  dst[2 * x] = static_cast<int16_t>(even);
+  dst[2 * x + 1] = static_cast<int16_t>(odd);
 }
 
-void VC5Decompressor::Wavelet::ReconstructableBand::processLow(
-    const Wavelet& wavelet) noexcept {
-  Array2DRef<int16_t> lowpass;
-#ifdef HAVE_OPENMP
-#pragma omp single copyprivate(lowpass)
-#endif
-  lowpass = Array2DRef<int16_t>::create(&lowpass_storage, wavelet.width,
-                                        2 * wavelet.height);
+#ifdef WITH_SSE2
+// The middle segment of 8 pixels at once, in 32 bits, just as convolute().
+// With its multipliers, the lows are 8 * l0 + (lm - lp) for the even ones,
+// and 8 * l0 - (lm - lp) for the odd ones.
+void convoluteMiddle_SSE2(const int16_t* h, const int16_t* lm,
+                          const int16_t* l0, const int16_t* lp,
+                          __m128i descaleShift, bool clampUint, __m128i* even,
+                          __m128i* odd) {
+  __m128i e[2]; // NOLINT
+  __m128i o[2]; // NOLINT
+
+  const __m128i v[4] = {// NOLINT
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(h)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(lm)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(l0)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(lp))};
+
+  for (int half = 0; half < 2; half++) {
+    // Sign-extended to 32 bits.
+    __m128i w[4]; // NOLINT
+    for (int i = 0; i < 4; i++) {
+      w[i] = _mm_srai_epi32(half ? _mm_unpackhi_epi16(v[i], v[i])
+                                 : _mm_unpacklo_epi16(v[i], v[i]),
+                            16);
+    }
 
-  const Array2DRef<const int16_t> highlow = wavelet.bandAsArray2DRef(2);
-  const Array2DRef<const int16_t> lowlow = wavelet.bandAsArray2DRef(0);
+    const __m128i c = _mm_add_epi32(_mm_slli_epi32(w[2], 3), _mm_set1_epi32(4));
+    const __m128i d = _mm_sub_epi32(w[1], w[3]);
 
-  // Reconstruct the "immediates", the actual low pass ...
-  wavelet.reconstructPass(lowpass, highlow, lowlow);
-}
+    const __m128i lowsEven = _mm_srai_epi32(_mm_add_epi32(c, d), 3);
+    const __m128i lowsOdd = _mm_srai_epi32(_mm_sub_epi32(c, d), 3);
 
-void VC5Decompressor::Wavelet::ReconstructableBand::processHigh(
-    const Wavelet& wavelet) noexcept {
-  Array2DRef<int16_t> highpass;
-#ifdef HAVE_OPENMP
-#pragma omp single copyprivate(highpass)
-#endif
-  highpass = Array2DRef<int16_t>::create(&highpass_storage, wavelet.width,
-                                         2 * wavelet.height);
+    e[half] = _mm_srai_epi32(
+        _mm_sll_epi32(_mm_add_epi32(w[0], lowsEven), descaleShift), 1);
+    o[half] = _mm_srai_epi32(
+        _mm_sll_epi32(_mm_sub_epi32(lowsOdd, w[0]), descaleShift), 1);
+  }
 
-  const Array2DRef<const int16_t> highhigh = wavelet.bandAsArray2DRef(3);
-  const Array2DRef<const int16_t> lowhigh = wavelet.bandAsArray2DRef(1);
+  if (clampUint) {
+    // Saturating to 16 bits first does not change the clamped values.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16((1 << 14) - 1);
+    *even = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(e[0], e[1]), zero), max);
+    *odd = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(o[0], o[1]), zero), max);
+    return;
+  }
 
-  wavelet.reconstructPass(highpass, highhigh, lowhigh);
+  // Truncated to 16 bits, as by the static_cast.
+  const auto pack = [](__m128i lo, __m128i hi) {
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16),
+                           _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+  };
+  *even = pack(e[0], e[1]);
+  *odd = pack(o[0], o[1]);
 }
 
-void VC5Decompressor::Wavelet::ReconstructableBand::combine(
-    const Wavelet& wavelet) noexcept {
-  int16_t descaleShift = (wavelet.prescale == 2 ? 2 : 0);
+// Returns the first x that was not done.
+int reconstructMiddleRow_SSE2(int16_t* even, int16_t* odd,
+                              const Array2DRef<const int16_t> high,
+                              const Array2DRef<const int16_t> lows) {
+  int x = 0;
+  for (; x + 8 <= high.width; x += 8) {
+    __m128i e;
+    __m128i o;
+    convoluteMiddle_SSE2(&high(x, 0), &lows(x, 0), &lows(x, 1), &lows(x, 2),
+                         _mm_setzero_si128(), false, &e, &o);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(even + x), e);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(odd + x), o);
+  }
+  return x;
+}
 
-  Array2DRef<int16_t> dest;
-#ifdef HAVE_OPENMP
-#pragma omp single copyprivate(dest)
+// Of the middle columns, starting with the column 1.
+// Returns the first x that was not done.
+int combineMiddleColumns_SSE2(int16_t* dst,
+                              const Array2DRef<const int16_t> low,
+                              const Array2DRef<const int16_t> high,
+                              int descaleShift, bool clampUint) {
+  const __m128i shift = _mm_cvtsi32_si128(descaleShift);
+
+  int x = 1;
+  for (; x + 8 < high.width; x += 8) {
+    __m128i e;
+    __m128i o;
+    convoluteMiddle_SSE2(&high(x, 0), &low(x - 1, 0), &low(x, 0),
+                         &low(x + 1, 0), shift, clampUint, &e, &o);
+    auto* out = reinterpret_cast<__m128i*>(dst + 2 * x);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(e, o));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(e, o));
+  }
+  return x;
+}
 #endif
-  dest =
-      Array2DRef<int16_t>::create(&data, 2 * wavelet.width, 2 * wavelet.height);
 
-  const Array2DRef<int16_t> lowpass(lowpass_storage.data(), wavelet.width,
-                                    2 * wavelet.height);
-  const Array2DRef<int16_t> highpass(highpass_storage.data(), wavelet.width,
-                                     2 * wavelet.height);
+} // namespace
 
-  // And finally, combine the low pass, and high pass.
-  wavelet.combineLowHighPass(dest, lowpass, highpass, descaleShift, clampUint);
+int VC5Decompressor::Wavelet::getFirstLowRow(int y) const {
+  if (y == 0)
+    return y + ConvolutionParams::First::coord_shift;
+  if (y + 1 < height)
+    return y + ConvolutionParams::Middle::coord_shift;
+  return y + ConvolutionParams::Last::coord_shift;
 }
 
-void VC5Decompressor::Wavelet::ReconstructableBand::decode(
-    const Wavelet& wavelet) noexcept {
-  assert(wavelet.allBandsValid());
-  assert(data.empty());
-  processLow(wavelet);
-  processHigh(wavelet);
-  combine(wavelet);
+void VC5Decompressor::Wavelet::reconstructRow(
+    const Array2DRef<int16_t> dst, const int16_t* highRow,
+    const Array2DRef<const int16_t> lows, int y) const noexcept {
+  int16_t* even = &dst(0, 0);
+  int16_t* odd = &dst(0, 1);
+  const Array2DRef<const int16_t> high(highRow, width, 1);
+
+  if (y == 0) {
+    reconstructRow_Scalar(ConvolutionParams::First, even, odd, high, lows, 0);
+  } else if (y + 1 < height) {
+    int x = 0;
+#ifdef WITH_SSE2
+    if (Cpuid::SSE2())
+      x = reconstructMiddleRow_SSE2(even, odd, high, lows);
+#endif
+    reconstructRow_Scalar(ConvolutionParams::Middle, even, odd, high, lows, x);
+  } else {
+    reconstructRow_Scalar(ConvolutionParams::Last, even, odd, high, lows, 0);
+  }
+}
+
+void VC5Decompressor::Wavelet::combineRow(int16_t* dst,
+                                          const Array2DRef<const int16_t> low,
+                                          const Array2DRef<const int16_t> high,
+                                          int descaleShift,
+                                          bool clampUint) const noexcept {
+  // First col
+  int x = 0;
+  combineColumn_Scalar(ConvolutionParams::First, dst, low, high, x,
+                       descaleShift, clampUint);
+  // middle cols
+  x = 1;
+#ifdef WITH_SSE2
+  if (Cpuid::SSE2())
+    x = combineMiddleColumns_SSE2(dst, low, high, descaleShift, clampUint);
+#endif
+  for (; x + 1 < width; ++x) {
+    combineColumn_Scalar(ConvolutionParams::Middle, dst, low, high, x,
+                         descaleShift, clampUint);
+  }
+  // last col
+  combineColumn_Scalar(ConvolutionParams::Last, dst, low, high, x,
+                       descaleShift, clampUint);
 }
 
 VC5Decompressor::VC5Decompressor(ByteStream bs, const RawImage& img)
@@ -550,12 +690,11 @@ void VC5Decompressor::Wavelet::HighPassBand::decode(const Wavelet& wavelet) {
   int nPixels = wavelet.width * wavelet.height;
   for (int iPixel = 0; iPixel < nPixels;) {
     getRLV(&bits, &pixelValue, &count);
-    for (; count > 0; --count) {
-      if (iPixel >= nPixels)
-        ThrowRDE("Buffer overflow");
-      data[iPixel] = dequantize(pixelValue);
-      ++iPixel;
-    }
+    if (count > static_cast<unsigned>(nPixels - iPixel))
+      ThrowRDE("Buffer overflow");
+    // Most of the runs are long runs of zeros.
+    std::fill_n(&data[iPixel], count, dequantize(pixelValue));
+    iPixel += count;
   }
   getRLV(&bits, &pixelValue, &count);
   static_assert(decompand(MARKER_BAND_END) == MARKER_BAND_END, "passthrought");
@@ -635,12 +774,13 @@ void VC5Decompressor::parseLargeCodeblock(const ByteStream& bs) {
   mVC5.iSubband.reset();
 }
 
-void VC5Decompressor::prepareBandDecodingPlan() {
+void VC5Decompressor::prepareDecodingPlan(const int level) {
   assert(allDecodeableBands.empty());
   allDecodeableBands.reserve(numSubbandsTotal);
-  // All the high-pass bands for all wavelets,
+  // All the high-pass bands for all wavelets we need,
   // in this specific order of decreasing worksize.
-  for (int waveletLevel = 0; waveletLevel < numWaveletLevels; waveletLevel++) {
+  for (int waveletLevel = level; waveletLevel < numWaveletLevels;
+       waveletLevel++) {
     for (auto channelId = 0; channelId < numChannels; channelId++) {
       for (int bandId = 1; bandId <= numHighPassBands; bandId++) {
         auto& channel = channels[channelId];
@@ -661,49 +801,19 @@ void VC5Decompressor::prepareBandDecodingPlan() {
         dynamic_cast<Wavelet::LowPassBand*>(smallestWavelet.bands[0].get());
     allDecodeableBands.emplace_back(decodeableLowPassBand, smallestWavelet);
   }
-  assert(allDecodeableBands.size() == numSubbandsTotal);
+  assert(level != 0 || allDecodeableBands.size() == numSubbandsTotal);
 }
 
-void VC5Decompressor::prepareBandReconstruction() {
-  assert(reconstructionSteps.empty());
-  reconstructionSteps.reserve(numLowPassBandsTotal);
-  // For every channel, recursively reconstruct the low-pass bands.
-  for (auto& channel : channels) {
-    // Reconstruct the intermediate lowpass bands.
-    for (int waveletLevel = numWaveletLevels - 1; waveletLevel > 0;
-         waveletLevel--) {
-      Wavelet* wavelet = &(channel.wavelets[waveletLevel]);
-      Wavelet& nextWavelet = channel.wavelets[waveletLevel - 1];
-
-      auto* band = dynamic_cast<Wavelet::ReconstructableBand*>(
-          nextWavelet.bands[0].get());
-      reconstructionSteps.emplace_back(wavelet, band);
-    }
-    // Finally, reconstruct the final lowpass band.
-    Wavelet* wavelet = &(channel.wavelets.front());
-    reconstructionSteps.emplace_back(wavelet, &(channel.band));
+void VC5Decompressor::checkErrors(
+    const std::atomic<bool>& exceptionThrown) const {
+  std::string firstErr;
+  if (mRaw->isTooManyErrors(1, &firstErr)) {
+    assert(exceptionThrown);
+    ThrowRDE("Too many errors encountered. Giving up. First Error:\n%s",
+             firstErr.c_str());
+  } else {
+    assert(!exceptionThrown);
   }
-  assert(reconstructionSteps.size() == numLowPassBandsTotal);
-}
-
-void VC5Decompressor::prepareDecodingPlan() {
-  prepareBandDecodingPlan();
-  prepareBandReconstruction();
-}
-
-void VC5Decompressor::decodeThread(bool* exceptionThrown) const noexcept {
-  // Decode all the existing bands. May fail.
-  decodeBands(exceptionThrown);
-
-  // Proceed only if decoding did not fail.
-  if (*exceptionThrown)
-    return;
-
-  // And now, reconstruct the low-pass bands.
-  reconstructLowpassBands();
-
-  // And finally!
-  combineFinalLowpassBands();
 }
 
 void VC5Decompressor::decode(unsigned int offsetX, unsigned int offsetY,
@@ -711,127 +821,275 @@ void VC5Decompressor::decode(unsigned int offsetX, unsigned int offsetY,
   if (offsetX || offsetY || mRaw->dim != iPoint2D(width, height))
     ThrowRDE("VC5Decompressor expects to fill the whole image, not some tile.");
 
+  // The whole of the stream, the header was already parsed from it.
+  if (const auto engine = getTileDecodeEngine()) {
+    if (engine->decompressVC5(ByteStream(static_cast<const DataBuffer&>(mBs)),
+                              mRaw))
+      return;
+  }
+
   initVC5LogTable();
 
   prepareDecodingPlan();
 
-  bool exceptionThrown = false;
-#ifdef HAVE_OPENMP
-#pragma omp parallel default(none) shared(exceptionThrown)                     \
-    num_threads(rawspeed_get_number_of_processor_cores())
-#endif
-  decodeThread(&exceptionThrown);
+  std::atomic<bool> exceptionThrown(false);
+  decodeBands(&exceptionThrown);
+  mRaw->checkCancelled();
+  checkErrors(exceptionThrown);
 
-  std::string firstErr;
-  if (mRaw->isTooManyErrors(1, &firstErr)) {
-    assert(exceptionThrown);
-    ThrowRDE("Too many errors encountered. Giving up. First Error:\n%s",
-             firstErr.c_str());
-  } else {
-    assert(!exceptionThrown);
+  // And finally! The final low-pass bands are already clamped.
+  reconstructAndCombine(0, mRaw, [](int /*channel*/, int v) { return v; });
+  mRaw->checkCancelled();
+}
+
+iPoint2D VC5Decompressor::getPreviewDim(const int level) const {
+  if (level < 1 || level > maxPreviewLevel)
+    ThrowRDE("Bad preview level %i", level);
+
+  // The low-pass band of the smaller wavelet, in the 2x2 pattern.
+  const Wavelet& wavelet = channels[0].wavelets[level - 1];
+  return {mVC5.patternWidth * wavelet.width,
+          mVC5.patternHeight * wavelet.height};
+}
+
+void VC5Decompressor::decodePreview(const int level,
+                                    const RawImage& preview) {
+  const iPoint2D dim = getPreviewDim(level);
+  if (preview->getDataType() != TYPE_USHORT16 || preview->getCpp() != 1)
+    ThrowRDE("The preview is not a 16-bit single component image.");
+  if (preview->dim != dim) {
+    ThrowRDE("The preview is %i x %i, expected %i x %i", preview->dim.x,
+             preview->dim.y, dim.x, dim.y);
   }
+
+  initVC5LogTable();
+
+  prepareDecodingPlan(level);
+
+  std::atomic<bool> exceptionThrown(false);
+  decodeBands(&exceptionThrown);
+  mRaw->checkCancelled();
+  checkErrors(exceptionThrown);
+
+  // Each of the skipped reconstructions would have halved the band in both
+  // directions, and then scaled it back up by its descale shift.
+  std::array<int, numChannels> shifts;
+  for (int c = 0; c < numChannels; c++) {
+    shifts[c] = 0;
+    for (int waveletLevel = 0; waveletLevel < level; waveletLevel++) {
+      shifts[c] +=
+          2 - (channels[c].wavelets[waveletLevel].prescale == 2 ? 2 : 0);
+    }
+  }
+
+  reconstructAndCombine(level, preview, [&shifts](int channel, int v) {
+    const int shift = shifts[channel];
+    const int round = shift > 0 ? 1 << (shift - 1) : 0;
+    return clampBits((v + round) >> shift, 14);
+  });
+  mRaw->checkCancelled();
 }
 
-void VC5Decompressor::decodeBands(bool* exceptionThrown) const noexcept {
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(dynamic, 1)
-#endif
-  for (auto decodeableBand = allDecodeableBands.begin();
-       decodeableBand < allDecodeableBands.end(); ++decodeableBand) {
+void VC5Decompressor::decodeBands(std::atomic<bool>* exceptionThrown) const
+    noexcept {
+  // The bands are of very different sizes, so each one is a separate task.
+  const int64_t work =
+      int64_t(mRaw->getUncroppedDim().area()) * mRaw->getBpp();
+  const auto decodeBand = [this, exceptionThrown](int i) {
+    // Once one band failed, there is no point in decoding the other ones.
+    if (*exceptionThrown || mRaw->isCancelled())
+      return;
+
+    const DecodeableBand& decodeableBand = allDecodeableBands[i];
     try {
-      decodeableBand->band->decode(decodeableBand->wavelet);
+      decodeableBand.band->decode(decodeableBand.wavelet);
     } catch (RawspeedException& err) {
-      // Propagate the exception out of OpenMP magic.
+      // Propagate the exception out of the executor.
       mRaw->setError(err.what());
-#ifdef HAVE_OPENMP
-#pragma omp atomic write
-#endif
       *exceptionThrown = true;
-#ifdef HAVE_OPENMP
-#pragma omp cancel for
-#endif
     }
-  }
+  };
+  parallelForEach(0, allDecodeableBands.size(), work, decodeBand);
 }
 
-void VC5Decompressor::reconstructLowpassBands() const noexcept {
-  for (const ReconstructionStep& step : reconstructionSteps) {
-    step.band.decode(step.wavelet);
+void VC5Decompressor::reconstructBandRows(const Channel& channel,
+                                          const int level, const int begin,
+                                          const int end,
+                                          ChannelRows* rows) const noexcept {
+  const Wavelet& wavelet = channel.wavelets[level];
+  assert(wavelet.allBandsValid());
+  BandRows& out = (*rows)[level];
+
+  // Each row of the wavelet gives two rows of the band.
+  const int width = 2 * wavelet.width;
+  const int first = begin & ~1;
+  const int last = roundUp(end, 2);
+
+  // The strips go down, so only the few last rows may still be needed.
+  if (out.begin <= first && first < out.end) {
+    const auto storage = out.storage.begin();
+    if (first != out.begin) {
+      std::copy(storage + (first - out.begin) * width,
+                storage + (out.end - out.begin) * width, storage);
+    }
+    out.begin = first;
+  } else {
+    out.begin = out.end = first;
+  }
+  if (out.end >= last)
+    return;
+
+  out.storage.resize(width * (last - out.begin));
+  out.passes.resize(4 * wavelet.width);
 
-#ifdef HAVE_OPENMP
-#pragma omp single nowait
-#endif
-    step.wavelet.clear(); // we no longer need it.
+  const int rowBegin = out.end / 2;
+  const int rowEnd = last / 2;
+
+  const Array2DRef<const int16_t> lowhigh = wavelet.bandAsArray2DRef(1);
+  const Array2DRef<const int16_t> highlow = wavelet.bandAsArray2DRef(2);
+  const Array2DRef<const int16_t> highhigh = wavelet.bandAsArray2DRef(3);
+
+  const Array2DRef<int16_t> lowpass(out.passes.data(), wavelet.width, 2);
+  const Array2DRef<int16_t> highpass(&out.passes[2 * wavelet.width],
+                                     wavelet.width, 2);
+
+  const int16_t descaleShift = (wavelet.prescale == 2 ? 2 : 0);
+  // Only the final band is clamped.
+  const bool clampUint = level == 0;
+
+  for (int y = rowBegin; y < rowEnd; y++) {
+    // The three rows of the low bands that this row uses. The ones of the
+    // low-pass band are reconstructed from the smaller wavelet, as needed.
+    const int lowRow = wavelet.getFirstLowRow(y);
+    const Array2DRef<const int16_t> lowlows =
+        getLowpassRows(channel, level + 1, lowRow, lowRow + 3, rows);
+    const Array2DRef<const int16_t> lowhighs(&lowhigh(0, lowRow),
+                                             wavelet.width, 3);
+
+    // Each row of the wavelet gives two rows of the "immediates", the actual
+    // low pass and the high pass, and they give the same two rows of the band.
+    wavelet.reconstructRow(lowpass, &highlow(0, y), lowlows, y);
+    wavelet.reconstructRow(highpass, &highhigh(0, y), lowhighs, y);
+
+    // And finally, combine the low pass, and high pass.
+    for (int i = 0; i < 2; i++) {
+      const Array2DRef<const int16_t> low(&lowpass(0, i), wavelet.width, 1);
+      const Array2DRef<const int16_t> high(&highpass(0, i), wavelet.width, 1);
+      wavelet.combineRow(&out.storage[(2 * y + i - out.begin) * width], low,
+                         high, descaleShift, clampUint);
+    }
   }
+  out.end = last;
 }
 
-void VC5Decompressor::combineFinalLowpassBands() const noexcept {
-  const Array2DRef<uint16_t> out(reinterpret_cast<uint16_t*>(mRaw->getData()),
-                                 mRaw->dim.x, mRaw->dim.y,
-                                 mRaw->pitch / sizeof(uint16_t));
+Array2DRef<const int16_t>
+VC5Decompressor::getLowpassRows(const Channel& channel, const int level,
+                                const int begin, const int end,
+                                ChannelRows* rows) const noexcept {
+  assert(begin >= 0 && begin < end);
+
+  // The smallest wavelet has its low-pass band decoded.
+  if (level == numWaveletLevels) {
+    const Wavelet& wavelet = channel.wavelets.back();
+    return {&wavelet.bandAsArray2DRef(0)(0, begin), wavelet.width,
+            end - begin};
+  }
 
-  const int width = out.width / 2;
-  const int height = out.height / 2;
+  // Otherwise the band of the larger wavelet may be smaller, but the rows
+  // still are as wide as they were reconstructed.
+  reconstructBandRows(channel, level, begin, end, rows);
+  const BandRows& band = (*rows)[level];
+  const int pitch = 2 * channel.wavelets[level].width;
+  const int width =
+      level == 0 ? channel.width : channel.wavelets[level - 1].width;
+  return {&band.storage[(begin - band.begin) * pitch], width, end - begin,
+          pitch};
+}
 
-  const Array2DRef<const int16_t> lowbands0 = Array2DRef<const int16_t>(
-      channels[0].band.data.data(), channels[0].width, channels[0].height);
-  const Array2DRef<const int16_t> lowbands1 = Array2DRef<const int16_t>(
-      channels[1].band.data.data(), channels[1].width, channels[1].height);
-  const Array2DRef<const int16_t> lowbands2 = Array2DRef<const int16_t>(
-      channels[2].band.data.data(), channels[2].width, channels[2].height);
-  const Array2DRef<const int16_t> lowbands3 = Array2DRef<const int16_t>(
-      channels[3].band.data.data(), channels[3].width, channels[3].height);
+template <typename Descale>
+void VC5Decompressor::combineLowpassRows(
+    const RawImage& img,
+    const std::array<Array2DRef<const int16_t>, numChannels>& lowbands,
+    const int row, Descale descale) const noexcept {
+  const Array2DRef<uint16_t> out(reinterpret_cast<uint16_t*>(img->getData()),
+                                 img->dim.x, img->dim.y,
+                                 img->pitch / sizeof(uint16_t));
+
+  const int width = out.width / 2;
 
   // Convert to RGGB output
-#ifdef HAVE_OPENMP
-#pragma omp for schedule(static) collapse(2)
-#endif
-  for (int row = 0; row < height; ++row) {
+  for (int y = 0; y < lowbands[0].height; ++y) {
+    const int outRow = 2 * (row + y);
     for (int col = 0; col < width; ++col) {
       const int mid = 2048;
 
-      int gs = lowbands0(col, row);
-      int rg = lowbands1(col, row) - mid;
-      int bg = lowbands2(col, row) - mid;
-      int gd = lowbands3(col, row) - mid;
+      int gs = descale(0, lowbands[0](col, y));
+      int rg = descale(1, lowbands[1](col, y)) - mid;
+      int bg = descale(2, lowbands[2](col, y)) - mid;
+      int gd = descale(3, lowbands[3](col, y)) - mid;
 
       int r = gs + 2 * rg;
       int b = gs + 2 * bg;
       int g1 = gs + gd;
       int g2 = gs - gd;
 
-      out(2 * col + 0, 2 * row + 0) = static_cast<uint16_t>(mVC5LogTable[r]);
-      out(2 * col + 1, 2 * row + 0) = static_cast<uint16_t>(mVC5LogTable[g1]);
-      out(2 * col + 0, 2 * row + 1) = static_cast<uint16_t>(mVC5LogTable[g2]);
-      out(2 * col + 1, 2 * row + 1) = static_cast<uint16_t>(mVC5LogTable[b]);
+      out(2 * col + 0, outRow + 0) = static_cast<uint16_t>(mVC5LogTable[r]);
+      out(2 * col + 1, outRow + 0) = static_cast<uint16_t>(mVC5LogTable[g1]);
+      out(2 * col + 0, outRow + 1) = static_cast<uint16_t>(mVC5LogTable[g2]);
+      out(2 * col + 1, outRow + 1) = static_cast<uint16_t>(mVC5LogTable[b]);
     }
   }
 }
 
+template <typename Descale>
+void VC5Decompressor::reconstructAndCombine(const int level,
+                                            const RawImage& img,
+                                            Descale descale) const noexcept {
+  // Instead of the whole bands, one after another, each thread only keeps a
+  // few rows of each of them, as it goes down the strips of the image.
+  const int64_t work = int64_t(img->dim.area()) * img->getBpp();
+  parallelForRange(0, img->dim.y / 2, work, [&](int begin, int end) {
+    std::array<ChannelRows, numChannels> rows;
+
+    for (int strip = begin; strip < end; strip += stripHeight) {
+      if (mRaw->isCancelled())
+        return;
+
+      const int stripEnd = std::min(strip + stripHeight, end);
+      std::array<Array2DRef<const int16_t>, numChannels> lowbands;
+      for (int c = 0; c < numChannels; c++) {
+        lowbands[c] =
+            getLowpassRows(channels[c], level, strip, stripEnd, &rows[c]);
+      }
+      combineLowpassRows(img, lowbands, strip, descale);
+    }
+  });
+}
+
 inline void VC5Decompressor::getRLV(BitPumpMSB* bits, int* value,
                                     unsigned int* count) {
-  unsigned int iTab;
-
   static constexpr auto maxBits = 1 + table17.entries[table17.length - 1].size;
 
   // Ensure the maximum number of bits are cached to make peekBits() as fast as
   // possible.
   bits->fill(maxBits);
-  for (iTab = 0; iTab < table17.length; ++iTab) {
-    if (decompandedTable17[iTab].bits ==
-        bits->peekBitsNoFill(decompandedTable17[iTab].size))
-      break;
+
+  // The short codes are found in the first lookup, all the codes of up to
+  // RootBits + NextBits bits in at most two.
+  const RLVLookup::Entry* e =
+      &rlvLookup.table[bits->peekBitsNoFill(RLVLookup::RootBits)];
+  while (e->kind == RLVLookup::Kind::NextLevel) {
+    bits->skipBitsNoFill(e->bits);
+    e = &rlvLookup.table[e->count + bits->peekBitsNoFill(e->value)];
   }
-  if (iTab >= table17.length)
+  if (e->kind == RLVLookup::Kind::None)
     ThrowRDE("Code not found in codebook");
 
-  bits->skipBitsNoFill(decompandedTable17[iTab].size);
-  *value = decompandedTable17[iTab].value;
-  *count = decompandedTable17[iTab].count;
-  if (*value != 0) {
-    if (bits->getBitsNoFill(1))
-      *value = -(*value);
-  }
+  bits->skipBitsNoFill(e->bits);
+  *value = e->value;
+  *count = e->count;
+  if (e->kind == RLVLookup::Kind::RunThenSign && bits->getBitsNoFill(1))
+    *value = -(*value);
 }
 
 } // namespace rawspeed
@@ -25,12 +25,14 @@
 #include "common/Common.h"                      // for ushort16, short16
 #include "common/DefaultInitAllocatorAdaptor.h" // for DefaultInitAllocatorA...
 #include "common/Optional.h"                    // for Optional
+#include "common/Point.h"                       // for iPoint2D
 #include "common/RawImage.h"                    // for RawImage
 #include "common/SimpleLUT.h"                   // for SimpleLUT, SimpleLUT...
 #include "decompressors/AbstractDecompressor.h" // for AbstractDecompressor
 #include "io/BitPumpMSB.h"                      // for BitPumpMSB
 #include "io/ByteStream.h"                      // for ByteStream
 #include <array>                                // for array
+#include <atomic>                               // for atomic
 #include <cstdint>                              // for int16_t, uint16_t
 #include <memory>                               // for unique_ptr
 #include <type_traits>                          // for underlying_type, und...
@@ -123,24 +125,13 @@ class VC5Decompressor final : public AbstractDecompressor {
     struct AbstractBand {
       std::vector<int16_t, DefaultInitAllocatorAdaptor<int16_t>> data;
       virtual ~AbstractBand() = default;
-      virtual void decode(const Wavelet& wavelet) = 0;
-    };
-    struct ReconstructableBand final : AbstractBand {
-      bool clampUint;
-      std::vector<int16_t, DefaultInitAllocatorAdaptor<int16_t>>
-          lowpass_storage;
-      std::vector<int16_t, DefaultInitAllocatorAdaptor<int16_t>>
-          highpass_storage;
-      explicit ReconstructableBand(bool clampUint_ = false)
-          : clampUint(clampUint_) {}
-      void processLow(const Wavelet& wavelet) noexcept;
-      void processHigh(const Wavelet& wavelet) noexcept;
-      void combine(const Wavelet& wavelet) noexcept;
-      void decode(const Wavelet& wavelet) noexcept final;
     };
+    // Never stored, its rows are reconstructed as they are needed.
+    struct ReconstructableBand final : AbstractBand {};
     struct AbstractDecodeableBand : AbstractBand {
       ByteStream bs;
       explicit AbstractDecodeableBand(ByteStream bs_) : bs(std::move(bs_)) {}
+      virtual void decode(const Wavelet& wavelet) = 0;
     };
     struct LowPassBand final : AbstractDecodeableBand {
       ushort16 lowpassPrecision;
@@ -168,14 +159,19 @@ class VC5Decompressor final : public AbstractDecompressor {
     uint32_t getValidBandMask() const { return mDecodedBandMask; }
     bool allBandsValid() const;
 
-    void reconstructPass(Array2DRef<int16_t> dst,
-                         Array2DRef<const int16_t> high,
-                         Array2DRef<const int16_t> low) const noexcept;
+    // The rows of the low band that the vertical reconstruction of the row y
+    // uses, three starting with this one.
+    int getFirstLowRow(int y) const;
 
-    void combineLowHighPass(Array2DRef<int16_t> dst,
-                            Array2DRef<const int16_t> low,
-                            Array2DRef<const int16_t> high, int descaleShift,
-                            bool clampUint /*= false*/) const noexcept;
+    // The vertical reconstruction of the row y, into the rows 0 and 1 of dst,
+    // from the rows of the low band starting with getFirstLowRow(y).
+    void reconstructRow(Array2DRef<int16_t> dst, const int16_t* high,
+                        Array2DRef<const int16_t> lows, int y) const noexcept;
+
+    // The horizontal one of a row, of twice the width, from the rows 0.
+    void combineRow(int16_t* dst, Array2DRef<const int16_t> low,
+                    Array2DRef<const int16_t> high, int descaleShift,
+                    bool clampUint) const noexcept;
 
     Array2DRef<const int16_t> bandAsArray2DRef(unsigned int iBand) const;
 
@@ -186,14 +182,12 @@ class VC5Decompressor final : public AbstractDecompressor {
   struct Channel {
     std::array<Wavelet, numWaveletLevels> wavelets;
 
-    Wavelet::ReconstructableBand band{/*clampUint*/ true};
     // the final lowband.
     int width, height;
   };
 
   static constexpr int numChannels = 4;
   static constexpr int numSubbandsTotal = numSubbands * numChannels;
-  static constexpr int numLowPassBandsTotal = numWaveletLevels * numChannels;
   std::array<Channel, numChannels> channels;
 
   struct DecodeableBand {
@@ -205,29 +199,58 @@ class VC5Decompressor final : public AbstractDecompressor {
   };
   std::vector<DecodeableBand> allDecodeableBands;
 
-  struct ReconstructionStep {
-    Wavelet& wavelet;
-    Wavelet::ReconstructableBand& band;
-    ReconstructionStep(Wavelet* wavelet_, Wavelet::ReconstructableBand* band_)
-        : wavelet(*wavelet_), band(*band_) {}
+  // The consecutive rows [begin, end) of the band that a wavelet
+  // reconstructs, which is twice as large as the wavelet. They are kept for
+  // as long as the next rows of the larger wavelet may need them.
+  struct BandRows {
+    std::vector<int16_t, DefaultInitAllocatorAdaptor<int16_t>> storage;
+    // The intermediate low pass and high pass of a row of the wavelet.
+    std::vector<int16_t, DefaultInitAllocatorAdaptor<int16_t>> passes;
+    int begin = 0;
+    int end = 0;
   };
-  std::vector<ReconstructionStep> reconstructionSteps;
+  using ChannelRows = std::array<BandRows, numWaveletLevels>;
+
+  // The final band is reconstructed, through all of the wavelets, and
+  // combined into the image in strips of this many rows.
+  static constexpr int stripHeight = 8;
 
   static inline void getRLV(BitPumpMSB* bits, int* value, unsigned int* count);
 
   void parseLargeCodeblock(const ByteStream& bs);
 
-  void prepareBandDecodingPlan();
-  void prepareBandReconstruction();
-  void prepareDecodingPlan();
+  // The wavelets below this level are not decoded, 0 being the full image.
+  void prepareDecodingPlan(int level = 0);
 
-  void decodeBands(bool* exceptionThrown) const noexcept;
+  void decodeBands(std::atomic<bool>* exceptionThrown) const noexcept;
 
-  void reconstructLowpassBands() const noexcept;
+  // Makes sure that rows[level] has the rows [begin, end) of the band that
+  // the wavelet of this level reconstructs. Only the rows that it does not
+  // already have are reconstructed, and the ones of the smaller wavelets that
+  // they need, recursively.
+  void reconstructBandRows(const Channel& channel, int level, int begin,
+                           int end, ChannelRows* rows) const noexcept;
 
-  void combineFinalLowpassBands() const noexcept;
+  // The rows [begin, end) of the low-pass band of the wavelet below this
+  // level, or of the final band for the level 0.
+  Array2DRef<const int16_t> getLowpassRows(const Channel& channel, int level,
+                                           int begin, int end,
+                                           ChannelRows* rows) const noexcept;
 
-  void decodeThread(bool* exceptionThrown) const noexcept;
+  // The rows of the bands, starting with the given one, into the image rows.
+  template <typename Descale>
+  void combineLowpassRows(
+      const RawImage& img,
+      const std::array<Array2DRef<const int16_t>, numChannels>& lowbands,
+      int row, Descale descale) const noexcept;
+
+  // Reconstructs the low-pass bands of the wavelets below this level and
+  // combines them into the image, strip by strip.
+  template <typename Descale>
+  void reconstructAndCombine(int level, const RawImage& img,
+                             Descale descale) const noexcept;
+
+  void checkErrors(const std::atomic<bool>& exceptionThrown) const;
 
   void parseVC5();
 
@@ -236,6 +259,17 @@ public:
 
   void decode(unsigned int offsetX, unsigned int offsetY, unsigned int width,
               unsigned int height);
+
+  // The preview levels are 1 to 3, for 1/2, 1/4 and 1/8 of the resolution.
+  static constexpr int maxPreviewLevel = numWaveletLevels;
+
+  iPoint2D getPreviewDim(int level) const;
+
+  // Stops at the low-pass band of the given wavelet level, without decoding
+  // the high-pass bands of the larger wavelets at all. The preview must be
+  // of getPreviewDim(level), and is in the same CFA layout as the full image.
+  // Either this, or decode(), may be called, and only once.
+  void decodePreview(int level, const RawImage& preview);
 };
 
 } // namespace rawspeed
@@ -0,0 +1,423 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h" // for HAVE_ZLIB
+#include "encoders/DngWriter.h"
+#include "common/Array2DRef.h"            // for Array2DRef
+#include "common/Common.h"                // for uint32, ushort16, roundUp...
+#include "common/Executor.h"              // for parallelForEach
+#include "common/Point.h"                 // for iPoint2D, iRectangle2D
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include "encoders/LJpegEncoder.h"        // for LJpegEncoder
+#include "io/FileWriter.h"                // for FileWriter
+#include "metadata/ColorFilterArray.h"    // for ColorFilterArray, CFAColor
+#include "tiff/TiffEntry.h"               // for TiffDataType, TIFF_SHORT
+#include "tiff/TiffTag.h"                 // for TiffTag, TILEOFFSETS
+#include <algorithm>                      // for min, sort
+#include <cassert>                        // for assert
+#include <cstring>                        // for memcpy
+#include <string>                         // for string
+#include <utility>                        // for move
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace rawspeed {
+
+namespace {
+
+// The entries of the one IFD of a little-endian TIFF, and their values.
+class TiffWriter final {
+  struct Entry final {
+    TiffTag tag;
+    TiffDataType type;
+    uint32 count;
+    std::vector<uchar8> data;
+  };
+
+  std::vector<Entry> entries;
+
+  static void putLE(std::vector<uchar8>* out, uint32 v, int bytes) {
+    for (int i = 0; i < bytes; i++)
+      out->emplace_back(static_cast<uchar8>(v >> (8 * i)));
+  }
+
+  Entry* add(TiffTag tag, TiffDataType type, uint32 count) {
+    entries.push_back({tag, type, count, {}});
+    return &entries.back();
+  }
+
+public:
+  void addBytes(TiffTag tag, const std::vector<uchar8>& values) {
+    add(tag, TIFF_BYTE, values.size())->data = values;
+  }
+
+  void addAscii(TiffTag tag, const std::string& value) {
+    Entry* e = add(tag, TIFF_ASCII, value.size() + 1);
+    e->data.assign(value.cbegin(), value.cend());
+    e->data.emplace_back(0);
+  }
+
+  void addShorts(TiffTag tag, const std::vector<uint32>& values) {
+    Entry* e = add(tag, TIFF_SHORT, values.size());
+    for (uint32 v : values)
+      putLE(&e->data, v, 2);
+  }
+
+  void addLongs(TiffTag tag, const std::vector<uint32>& values) {
+    Entry* e = add(tag, TIFF_LONG, values.size());
+    for (uint32 v : values)
+      putLE(&e->data, v, 4);
+  }
+
+  // The header, the IFD, and the values that do not fit into their entries.
+  // The tiles, or the strips, are then to follow, from the returned size on.
+  // Their offsets are the offsetsTag entry, which is added here, once they
+  // are known.
+  std::vector<uchar8>
+  write(TiffTag offsetsTag, const std::vector<std::vector<uchar8>>& tiles) {
+    addLongs(offsetsTag, std::vector<uint32>(tiles.size()));
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.tag < b.tag; });
+
+    const uint32 ifdSize = 2 + 12 * entries.size() + 4;
+    uint32 size = 8 + ifdSize;
+    for (const Entry& e : entries) {
+      if (e.data.size() > 4)
+        size += roundUp(e.data.size(), 2);
+    }
+
+    // Now that it is known where the tiles go.
+    for (Entry& e : entries) {
+      if (e.tag != offsetsTag)
+        continue;
+      e.data.clear();
+      uint32 offset = roundUp(size, 4);
+      for (const auto& tile : tiles) {
+        putLE(&e.data, offset, 4);
+        offset += tile.size();
+      }
+    }
+
+    std::vector<uchar8> out;
+    out.reserve(size);
+    out.emplace_back('I');
+    out.emplace_back('I');
+    putLE(&out, 42, 2);
+    putLE(&out, 8, 4); // the IFD
+
+    std::vector<uchar8> values;
+    putLE(&out, entries.size(), 2);
+    for (const Entry& e : entries) {
+      putLE(&out, e.tag, 2);
+      putLE(&out, e.type, 2);
+      putLE(&out, e.count, 4);
+      if (e.data.size() <= 4) {
+        out.insert(out.end(), e.data.cbegin(), e.data.cend());
+        out.insert(out.end(), 4 - e.data.size(), 0);
+        continue;
+      }
+      putLE(&out, 8 + ifdSize + values.size(), 4);
+      values.insert(values.end(), e.data.cbegin(), e.data.cend());
+      values.resize(roundUp(values.size(), 2));
+    }
+    putLE(&out, 0, 4); // no next IFD
+
+    out.insert(out.end(), values.cbegin(), values.cend());
+    assert(out.size() == size);
+    out.resize(roundUp(size, 4));
+    return out;
+  }
+};
+
+} // namespace
+
+DngWriter::DngWriter(const RawImage& img, int tileSize_)
+    : mRaw(img), tileSize(tileSize_) {
+  if (tileSize <= 0 || tileSize % 16 != 0)
+    ThrowRDE("Tile size %i is not a multiple of 16", tileSize);
+
+  const uint32 cpp = mRaw->getCpp();
+  switch (mRaw->getDataType()) {
+  case TYPE_USHORT16:
+    // As the LJpegDecompressor takes them.
+    if (cpp != 1 && cpp != 3)
+      ThrowRDE("Unsupported component count (%u)", cpp);
+    compression = 7;
+    break;
+  case TYPE_FLOAT32:
+#ifdef HAVE_ZLIB
+    // As the DeflateDecompressor takes them.
+    if (cpp != 1)
+      ThrowRDE("Unsupported component count (%u)", cpp);
+    compression = 8;
+    break;
+#else
+    ThrowRDE("Float images can only be written with the zlib");
+#endif
+  default:
+    ThrowRDE("Unsupported data type (%u)", mRaw->getDataType());
+  }
+
+  if (mRaw->isCFA && cpp != 1)
+    ThrowRDE("CFA image with %u components per pixel", cpp);
+
+  const iPoint2D dim = mRaw->getUncroppedDim();
+  if (!dim.hasPositiveArea())
+    ThrowRDE("Image has zero size");
+}
+
+std::vector<iRectangle2D> DngWriter::getSlices() const {
+  const iPoint2D dim = mRaw->getUncroppedDim();
+  std::vector<iRectangle2D> slices;
+
+  if (strips) {
+    // The LJpeg frames are of the two columns per sample of a CFA.
+    const int width = uncompressed ? dim.x : roundUp(dim.x, 2);
+    for (int y = 0; y < dim.y; y += tileSize)
+      slices.emplace_back(0, y, width, std::min(tileSize, dim.y - y));
+    return slices;
+  }
+
+  for (int y = 0; y < dim.y; y += tileSize) {
+    for (int x = 0; x < dim.x; x += tileSize)
+      slices.emplace_back(x, y, tileSize, tileSize);
+  }
+  return slices;
+}
+
+// The slice is cut out of the image, with the pixels past the edges of it
+// being those at the edges, which tends to cost the least bits.
+std::vector<uchar8>
+DngWriter::encodeLJpegSlice(const iRectangle2D& area) const {
+  const Array2DRef<const ushort16> img =
+      mRaw->getU16DataAsUncroppedArray2DRef();
+  const int cpp = mRaw->getCpp();
+  const iPoint2D dim = mRaw->getUncroppedDim();
+
+  std::vector<ushort16> storage;
+  const Array2DRef<ushort16> slice =
+      Array2DRef<ushort16>::create(&storage, area.dim.x * cpp, area.dim.y);
+  for (int y = 0; y < area.dim.y; y++) {
+    const int srcY = std::min(area.pos.y + y, dim.y - 1);
+    for (int x = 0; x < area.dim.x; x++) {
+      const int srcX = std::min(area.pos.x + x, dim.x - 1);
+      for (int c = 0; c < cpp; c++)
+        slice(cpp * x + c, y) = img(cpp * srcX + c, srcY);
+    }
+  }
+
+  // As the DNG does: two components, for the two columns of the CFA.
+  const int cps = cpp == 1 ? 2 : cpp;
+
+  std::vector<uchar8> out;
+  LJpegEncoder(slice, cps).encode(&out);
+  return out;
+}
+
+// The inverse of the DeflateDecompressor with the predictor 3: the bytes of
+// each row, the most significant ones of all of the pixels first, delta
+// encoded, and the slice deflated.
+std::vector<uchar8>
+DngWriter::encodeDeflateSlice(const iRectangle2D& area) const {
+#ifdef HAVE_ZLIB
+  const Array2DRef<const float> img = mRaw->getF32DataAsUncroppedArray2DRef();
+  const iPoint2D dim = mRaw->getUncroppedDim();
+  const int width = area.dim.x;
+
+  const size_t rowBytes = sizeof(float) * width;
+  std::vector<uchar8> planes(rowBytes * area.dim.y);
+  for (int y = 0; y < area.dim.y; y++) {
+    const int srcY = std::min(area.pos.y + y, dim.y - 1);
+    uchar8* dst = &planes[rowBytes * y];
+    for (int x = 0; x < width; x++) {
+      const int srcX = std::min(area.pos.x + x, dim.x - 1);
+      uint32 v;
+      memcpy(&v, &img(srcX, srcY), sizeof(v));
+      for (int byte = 0; byte < 4; byte++)
+        dst[x + width * byte] = static_cast<uchar8>(v >> (24 - 8 * byte));
+    }
+    for (size_t i = rowBytes - 1; i > 0; i--)
+      dst[i] = static_cast<uchar8>(dst[i] - dst[i - 1]);
+  }
+
+  uLongf size = compressBound(planes.size());
+  std::vector<uchar8> out(size);
+  if (compress(out.data(), &size, planes.data(), planes.size()) != Z_OK) {
+    ThrowRDE("Failed to deflate the slice at (%i, %i)", area.pos.x,
+             area.pos.y);
+  }
+  out.resize(size);
+  return out;
+#else
+  __builtin_unreachable();
+#endif
+}
+
+// Little-endian, as is the file.
+std::vector<uchar8>
+DngWriter::encodeUncompressedSlice(const iRectangle2D& area) const {
+  const Array2DRef<const ushort16> img =
+      mRaw->getU16DataAsUncroppedArray2DRef();
+  const int cpp = mRaw->getCpp();
+  const iPoint2D dim = mRaw->getUncroppedDim();
+
+  std::vector<uchar8> out;
+  out.reserve(sizeof(ushort16) * cpp * area.dim.area());
+  for (int y = 0; y < area.dim.y; y++) {
+    const int srcY = std::min(area.pos.y + y, dim.y - 1);
+    for (int x = 0; x < area.dim.x; x++) {
+      const int srcX = std::min(area.pos.x + x, dim.x - 1);
+      for (int c = 0; c < cpp; c++) {
+        const ushort16 v = img(cpp * srcX + c, srcY);
+        out.emplace_back(static_cast<uchar8>(v));
+        out.emplace_back(static_cast<uchar8>(v >> 8));
+      }
+    }
+  }
+  return out;
+}
+
+std::vector<uchar8> DngWriter::encodeSlice(const iRectangle2D& area,
+                                           int comp) const {
+  switch (comp) {
+  case 1:
+    return encodeUncompressedSlice(area);
+  case 7:
+    return encodeLJpegSlice(area);
+  default:
+    return encodeDeflateSlice(area);
+  }
+}
+
+Buffer DngWriter::write() const {
+  const iPoint2D dim = mRaw->getUncroppedDim();
+  const int cpp = mRaw->getCpp();
+  const bool isFloat = mRaw->getDataType() == TYPE_FLOAT32;
+
+  if (uncompressed && isFloat)
+    ThrowRDE("Float images can only be written compressed");
+  const int comp = uncompressed ? 1 : compression;
+
+  const std::vector<iRectangle2D> slices = getSlices();
+  std::vector<std::vector<uchar8>> tiles(slices.size());
+  parallelForEach(0, static_cast<int>(slices.size()),
+                  static_cast<int64_t>(mRaw->pitch) * dim.y,
+                  [&](int i) { tiles[i] = encodeSlice(slices[i], comp); });
+
+  TiffWriter ifd;
+  ifd.addLongs(NEWSUBFILETYPE, {0});
+  ifd.addLongs(IMAGEWIDTH, {static_cast<uint32>(dim.x)});
+  ifd.addLongs(IMAGELENGTH, {static_cast<uint32>(dim.y)});
+  ifd.addShorts(BITSPERSAMPLE, std::vector<uint32>(cpp, isFloat ? 32 : 16));
+  ifd.addShorts(COMPRESSION, {static_cast<uint32>(comp)});
+  ifd.addShorts(PHOTOMETRICINTERPRETATION, {mRaw->isCFA ? 32803U : 34892U});
+  ifd.addShorts(SAMPLESPERPIXEL, {static_cast<uint32>(cpp)});
+  ifd.addShorts(PLANARCONFIGURATION, {1});
+  if (isFloat)
+    ifd.addShorts(PREDICTOR, {3});
+  std::vector<uint32> counts;
+  for (const auto& tile : tiles)
+    counts.emplace_back(tile.size());
+  if (strips) {
+    ifd.addLongs(ROWSPERSTRIP, {static_cast<uint32>(slices[0].dim.y)});
+    ifd.addLongs(STRIPBYTECOUNTS, counts);
+  } else {
+    ifd.addLongs(TILEWIDTH, {static_cast<uint32>(tileSize)});
+    ifd.addLongs(TILELENGTH, {static_cast<uint32>(tileSize)});
+    ifd.addLongs(TILEBYTECOUNTS, counts);
+  }
+  ifd.addShorts(SAMPLEFORMAT, std::vector<uint32>(cpp, isFloat ? 3 : 1));
+
+  const auto& meta = mRaw->metadata;
+  if (!meta.make.empty())
+    ifd.addAscii(MAKE, meta.make);
+  if (!meta.model.empty())
+    ifd.addAscii(MODEL, meta.model);
+  ifd.addAscii(UNIQUECAMERAMODEL, meta.make.get() + " " + meta.model.get());
+
+  // The Deflate is new in the DNG 1.4.
+  ifd.addBytes(DNGVERSION, {1, 4, 0, 0});
+  ifd.addBytes(DNGBACKWARDVERSION, {1, static_cast<uchar8>(isFloat ? 4 : 1),
+                                    0, 0});
+
+  // The CFA, and the levels, are those of the crop, which is what the
+  // ActiveArea is.
+  if (mRaw->isCFA) {
+    const iPoint2D size = mRaw->cfa.getSize();
+    std::vector<uchar8> pattern;
+    for (int y = 0; y < size.y; y++) {
+      for (int x = 0; x < size.x; x++) {
+        const CFAColor c = mRaw->cfa.getColorAt(x, y);
+        if (c > CFA_WHITE)
+          ThrowRDE("Unsupported CFA Color: %u", c);
+        pattern.emplace_back(c);
+      }
+    }
+    ifd.addShorts(CFAREPEATPATTERNDIM, {static_cast<uint32>(size.y),
+                                        static_cast<uint32>(size.x)});
+    ifd.addBytes(CFAPATTERN, pattern);
+  }
+
+  const iPoint2D crop = mRaw->getCropOffset();
+  if (crop != iPoint2D(0, 0) || mRaw->dim != dim) {
+    const iPoint2D end = crop + mRaw->dim;
+    ifd.addLongs(ACTIVEAREA,
+                 {static_cast<uint32>(crop.y), static_cast<uint32>(crop.x),
+                  static_cast<uint32>(end.y), static_cast<uint32>(end.x)});
+  }
+
+  if (cpp == 1 && mRaw->blackLevelSeparate[0] >= 0) {
+    ifd.addShorts(BLACKLEVELREPEATDIM, {2, 2});
+    std::vector<uint32> black(mRaw->blackLevelSeparate.cbegin(),
+                              mRaw->blackLevelSeparate.cend());
+    ifd.addLongs(BLACKLEVEL, black);
+  } else if (mRaw->blackLevel >= 0) {
+    ifd.addLongs(BLACKLEVEL, {static_cast<uint32>(mRaw->blackLevel)});
+  }
+  if (!isFloat && mRaw->whitePoint >= 0 && mRaw->whitePoint <= 65535)
+    ifd.addLongs(WHITELEVEL, {static_cast<uint32>(mRaw->whitePoint)});
+
+  const std::vector<uchar8> header =
+      ifd.write(strips ? STRIPOFFSETS : TILEOFFSETS, tiles);
+
+  Buffer::size_type size = header.size();
+  for (const auto& tile : tiles)
+    size += tile.size();
+
+  auto storage = Buffer::Create(size);
+  uchar8* out = storage.get();
+  memcpy(out, header.data(), header.size());
+  out += header.size();
+  for (const auto& tile : tiles) {
+    memcpy(out, tile.data(), tile.size());
+    out += tile.size();
+  }
+
+  return Buffer(std::move(storage), size);
+}
+
+void DngWriter::writeFile(const char* filename) const {
+  Buffer file = write();
+  FileWriter(filename).writeFile(&file);
+}
+
+} // namespace rawspeed
@@ -0,0 +1,75 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h"   // for uchar8
+#include "common/Point.h"    // for iRectangle2D
+#include "common/RawImage.h" // for RawImage
+#include "io/Buffer.h"       // for Buffer
+#include <vector>            // for vector
+
+namespace rawspeed {
+
+// Writes a decoded image, with the levels and the CFA, as a tiled DNG, which
+// the DngDecoder then decodes one tile per task, however serial the format
+// that it was first decoded from. The pixels are those of the whole
+// allocation, with the crop as the ActiveArea, so the DngDecoder gives back
+// the very same image.
+//
+// The 16-bit images are compressed as the lossless JPEG, unless they are to
+// be uncompressed, and the float ones, with a single component, with the
+// Deflate and the floating point predictor, if there is the zlib. Those are
+// the only ones the DngDecoder reads. The DNG opcodes of the original, if any, are not carried over, so
+// it should be written before they are applied.
+class DngWriter final {
+  RawImage mRaw;
+  int tileSize;
+  int compression;
+
+  // Of the tiles, or the strips, in the order of the file. Those at the
+  // edges may reach past the image.
+  std::vector<iRectangle2D> getSlices() const;
+
+  std::vector<uchar8> encodeSlice(const iRectangle2D& area, int comp) const;
+  std::vector<uchar8> encodeLJpegSlice(const iRectangle2D& area) const;
+  std::vector<uchar8> encodeDeflateSlice(const iRectangle2D& area) const;
+  std::vector<uchar8> encodeUncompressedSlice(const iRectangle2D& area) const;
+
+public:
+  // The tiles are square, and their size is a multiple of 16, as TIFF wants.
+  static constexpr int DefaultTileSize = 256;
+
+  // Rather than in the tiles, the pixels are in the strips of the whole
+  // width, and of tileSize rows each.
+  bool strips = false;
+
+  // The 16-bit pixels are stored as they are, rather than compressed.
+  bool uncompressed = false;
+
+  explicit DngWriter(const RawImage& img, int tileSize_ = DefaultTileSize);
+
+  // The whole file, its tiles, or strips, being compressed in parallel.
+  Buffer write() const;
+
+  void writeFile(const char* filename) const;
+};
+
+} // namespace rawspeed
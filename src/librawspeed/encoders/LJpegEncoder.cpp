@@ -0,0 +1,264 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "encoders/LJpegEncoder.h"
+#include "common/Common.h"                // for uint64, short16
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include <algorithm>                      // for fill
+#include <cassert>                        // for assert
+#include <cstdlib>                        // for abs
+
+namespace rawspeed {
+
+namespace {
+
+// The categories are 0 to 16, and the 17th symbol is the one that takes the
+// code of all ones, which must not be used, see below.
+constexpr int NumSymbols = 18;
+constexpr int Reserved = 17;
+
+inline int category(int diff) {
+  const auto magnitude = static_cast<unsigned>(std::abs(diff));
+  return magnitude == 0 ? 0 : 32 - __builtin_clz(magnitude);
+}
+
+class BitWriter final {
+  std::vector<uchar8>* out;
+  uint64 cache = 0;
+  int fill = 0;
+
+public:
+  explicit BitWriter(std::vector<uchar8>* out_) : out(out_) {}
+
+  // At most 32 bits at a time.
+  void put(unsigned v, int n) {
+    assert(n <= 32);
+    cache = (cache << n) | v;
+    fill += n;
+    while (fill >= 8) {
+      fill -= 8;
+      const auto byte = static_cast<uchar8>(cache >> fill);
+      out->emplace_back(byte);
+      if (byte == 0xFF)
+        out->emplace_back(0x00); // byte stuffing
+    }
+  }
+
+  // The last byte is padded with the ones.
+  void flush() {
+    if (fill > 0)
+      put((1U << (8 - fill)) - 1U, 8 - fill);
+  }
+};
+
+void put16(std::vector<uchar8>* out, int v) {
+  out->emplace_back(static_cast<uchar8>(v >> 8));
+  out->emplace_back(static_cast<uchar8>(v & 0xFF));
+}
+
+} // namespace
+
+LJpegEncoder::LJpegEncoder(Array2DRef<const ushort16> samples_, int cps_,
+                           int prec_)
+    : samples(samples_), cps(cps_), prec(prec_) {
+  if (cps < 1 || cps > 4)
+    ThrowRDE("Unsupported number of components: %i", cps);
+  if (prec < 2 || prec > 16)
+    ThrowRDE("Invalid precision (%i).", prec);
+  if (samples.width <= 0 || samples.height <= 0 || samples.width % cps != 0 ||
+      samples.width / cps > 65535 || samples.height > 65535) {
+    ThrowRDE("Unexpected frame size (%i, %i)", samples.width, samples.height);
+  }
+}
+
+// Calls body(diff) for each of the samples, in the order of the scan, with
+// the difference to its prediction, modulo 2^16, as the decoder adds it.
+template <typename Body> void LJpegEncoder::forEachDiff(const Body& body) const {
+  for (int row = 0; row < samples.height; row++) {
+    for (int c = 0; c < cps; c++) {
+      const int pred = row == 0 ? 1 << (prec - 1) : samples(c, row - 1);
+      body(static_cast<short16>(samples(c, row) - pred));
+    }
+    for (int x = cps; x < samples.width; x++)
+      body(static_cast<short16>(samples(x, row) - samples(x - cps, row)));
+  }
+}
+
+// As jpeg_gen_optimal_table() of the IJG libjpeg: the Huffman code of the
+// histogram of the categories, with the lengths then limited to 16 bits.
+// The reserved symbol, with the count of one, makes sure that no category
+// gets the code of all ones, which would be confused with the padding.
+void LJpegEncoder::buildHuffmanTable() {
+  std::array<uint64, NumSymbols> freq;
+  freq.fill(0);
+  forEachDiff([&freq](int diff) { freq[category(diff)]++; });
+  freq[Reserved] = 1;
+
+  std::array<int, NumSymbols> codesize;
+  std::array<int, NumSymbols> others;
+  codesize.fill(0);
+  others.fill(-1);
+
+  while (true) {
+    // The two least frequent ones, the higher symbols winning the ties.
+    int c1 = -1;
+    int c2 = -1;
+    for (int i = 0; i < NumSymbols; i++) {
+      if (freq[i] && (c1 < 0 || freq[i] <= freq[c1]))
+        c1 = i;
+    }
+    for (int i = 0; i < NumSymbols; i++) {
+      if (freq[i] && i != c1 && (c2 < 0 || freq[i] <= freq[c2]))
+        c2 = i;
+    }
+    if (c2 < 0)
+      break;
+
+    freq[c1] += freq[c2];
+    freq[c2] = 0;
+
+    codesize[c1]++;
+    while (others[c1] >= 0) {
+      c1 = others[c1];
+      codesize[c1]++;
+    }
+    others[c1] = c2;
+
+    codesize[c2]++;
+    while (others[c2] >= 0) {
+      c2 = others[c2];
+      codesize[c2]++;
+    }
+  }
+
+  // With this few symbols, no code is longer than NumSymbols - 1 bits.
+  std::array<int, NumSymbols> count;
+  count.fill(0);
+  for (int i = 0; i < NumSymbols; i++) {
+    if (codesize[i])
+      count[codesize[i]]++;
+  }
+
+  // Each code that is too long is paired with a shorter one, which then
+  // both are one bit longer than it was.
+  for (int i = NumSymbols - 1; i > 16; i--) {
+    while (count[i] > 0) {
+      int j = i - 2;
+      while (count[j] == 0)
+        j--;
+      count[i] -= 2;
+      count[i - 1]++;
+      count[j + 1] += 2;
+      count[j]--;
+    }
+  }
+
+  // The reserved symbol has one of the longest codes, which is dropped.
+  int longest = 16;
+  while (count[longest] == 0)
+    longest--;
+  count[longest]--;
+
+  for (int i = 1; i <= 16; i++)
+    bits[i - 1] = static_cast<uchar8>(count[i]);
+
+  // The categories, by the length of their codes, which is what they then
+  // get from the limited lengths, in the same order.
+  huffval.clear();
+  for (int len = 1; len < NumSymbols; len++) {
+    for (int i = 0; i < Reserved; i++) {
+      if (codesize[i] == len)
+        huffval.emplace_back(static_cast<uchar8>(i));
+    }
+  }
+
+  codeLengths.fill(0);
+  unsigned code = 0;
+  auto value = huffval.cbegin();
+  for (int len = 1; len <= 16; len++) {
+    for (int n = 0; n < bits[len - 1]; n++, value++) {
+      codes[*value] = code++;
+      codeLengths[*value] = len;
+    }
+    code <<= 1;
+  }
+  assert(value == huffval.cend());
+}
+
+void LJpegEncoder::writeHeaders(std::vector<uchar8>* out) const {
+  put16(out, 0xFFD8); // SOI
+
+  put16(out, 0xFFC4); // DHT
+  put16(out, 2 + 1 + 16 + static_cast<int>(huffval.size()));
+  out->emplace_back(0x00); // the DC table 0
+  out->insert(out->end(), bits.cbegin(), bits.cend());
+  out->insert(out->end(), huffval.cbegin(), huffval.cend());
+
+  put16(out, 0xFFC3); // SOF3
+  put16(out, 8 + 3 * cps);
+  out->emplace_back(static_cast<uchar8>(prec));
+  put16(out, samples.height);
+  put16(out, samples.width / cps);
+  out->emplace_back(static_cast<uchar8>(cps));
+  for (int c = 0; c < cps; c++) {
+    out->emplace_back(static_cast<uchar8>(c + 1));
+    out->emplace_back(0x11); // no subsampling
+    out->emplace_back(0x00);
+  }
+
+  put16(out, 0xFFDA); // SOS
+  put16(out, 6 + 2 * cps);
+  out->emplace_back(static_cast<uchar8>(cps));
+  for (int c = 0; c < cps; c++) {
+    out->emplace_back(static_cast<uchar8>(c + 1));
+    out->emplace_back(0x00); // the table 0
+  }
+  out->emplace_back(1); // predictor
+  out->emplace_back(0);
+  out->emplace_back(0); // point transform
+}
+
+void LJpegEncoder::writeScan(std::vector<uchar8>* out) const {
+  BitWriter bits_(out);
+  forEachDiff([this, &bits_](int diff) {
+    const int cat = category(diff);
+    // The difference of 32768, or -32768, has no additional bits.
+    if (cat == 0 || cat == 16) {
+      bits_.put(codes[cat], codeLengths[cat]);
+      return;
+    }
+    const unsigned extra = diff < 0 ? diff + (1 << cat) - 1 : diff;
+    bits_.put((codes[cat] << cat) | extra, codeLengths[cat] + cat);
+  });
+  bits_.flush();
+}
+
+void LJpegEncoder::encode(std::vector<uchar8>* out) {
+  buildHuffmanTable();
+
+  // Roughly, at most the samples themselves.
+  out->reserve(out->size() + 2 * samples.width * samples.height + 1024);
+
+  writeHeaders(out);
+  writeScan(out);
+  put16(out, 0xFFD9); // EOI
+}
+
+} // namespace rawspeed
@@ -0,0 +1,64 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Array2DRef.h" // for Array2DRef
+#include "common/Common.h"     // for ushort16, uchar8
+#include <array>               // for array
+#include <vector>              // for vector
+
+namespace rawspeed {
+
+// The inverse of the LJpegDecompressor: encodes the samples as a lossless
+// JPEG, with the predictor 1, and one Huffman table, shared by all of the
+// components, that is built for the differences of these very samples.
+//
+// Each row of the samples is a row of the frame, and its width, in samples,
+// is a multiple of the components per sample, cps. E.g. for the DNG tile of
+// a CFA image that is W pixels wide, cps is 2, and the frame is W / 2 wide.
+class LJpegEncoder final {
+  Array2DRef<const ushort16> samples;
+  int cps;
+  int prec;
+
+  // The counts of the codes of each of the lengths, 1 to 16, and the
+  // categories, in the order of their codes, as in the DHT segment.
+  std::array<uchar8, 16> bits;
+  std::vector<uchar8> huffval;
+
+  // Per category, the code, and its length.
+  std::array<unsigned, 17> codes;
+  std::array<int, 17> codeLengths;
+
+  template <typename Body> void forEachDiff(const Body& body) const;
+
+  void buildHuffmanTable();
+  void writeHeaders(std::vector<uchar8>* out) const;
+  void writeScan(std::vector<uchar8>* out) const;
+
+public:
+  LJpegEncoder(Array2DRef<const ushort16> samples_, int cps_, int prec_ = 16);
+
+  // Appends the whole stream, from the SOI to the EOI, to out.
+  void encode(std::vector<uchar8>* out);
+};
+
+} // namespace rawspeed
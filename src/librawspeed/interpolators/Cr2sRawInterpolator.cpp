@@ -21,15 +21,20 @@
 
 #include "interpolators/Cr2sRawInterpolator.h"
 #include "common/Common.h"                 // for ushort16, clampBits
+#include "common/Executor.h"               // for getExecutor, parallelFor
 #include "common/Point.h"                  // for iPoint2D
 #include "common/RawImage.h"               // for RawImage, RawImageData
 #include "decoders/RawDecoderException.h"  // for RawDecoderException (ptr o...
+#include <algorithm>                       // for min
 #include <array>                           // for array
 #include <cassert>                         // for assert
+#include <cstdint>                         // for int64_t
 #include <type_traits>                     // for is_pod
+#include <vector>                          // for vector
 
 using std::is_pod;
 using std::array;
+using std::vector;
 
 namespace rawspeed {
 
@@ -108,6 +113,60 @@ struct Cr2sRawInterpolator::YCbCr final {
   }
 };
 
+// Converts the pixels of a row to RGB, in the order they come in. They are
+// buffered, and converted a block at a time, one plane after the other,
+// which the compiler can vectorize, unlike the interleaved pixels.
+// The rows are converted in place, but the output only ever trails behind
+// the pixels that are still to be read, so buffering them changes nothing.
+template <int version> class Cr2sRawInterpolator::RowConverter final {
+  static constexpr int BlockSize = 64;
+
+  const Cr2sRawInterpolator& interpolator;
+  ushort16* out;
+
+  int size = 0;
+  array<int, BlockSize> Y;
+  array<int, BlockSize> Cb;
+  array<int, BlockSize> Cr;
+
+public:
+  RowConverter(const Cr2sRawInterpolator& interpolator_, ushort16* out_)
+      : interpolator(interpolator_), out(out_) {
+    assert(out);
+  }
+
+  inline void push(const YCbCr& p) {
+    assert(size < BlockSize);
+
+    Y[size] = p.Y;
+    Cb[size] = p.Cb;
+    Cr[size] = p.Cr;
+    if (++size == BlockSize)
+      flush();
+  }
+
+  inline void flush() {
+    array<ushort16, BlockSize> r;
+    array<ushort16, BlockSize> g;
+    array<ushort16, BlockSize> b;
+    for (int i = 0; i < size; i++) {
+      YCbCr p;
+      p.Y = Y[i];
+      p.Cb = Cb[i];
+      p.Cr = Cr[i];
+      interpolator.YUV_TO_RGB<version>(p, &r[i], &g[i], &b[i]);
+    }
+
+    for (int i = 0; i < size; i++) {
+      out[0] = r[i];
+      out[1] = g[i];
+      out[2] = b[i];
+      out += 3;
+    }
+    size = 0;
+  }
+};
+
 // NOTE: Thread safe.
 template <int version>
 inline void Cr2sRawInterpolator::interpolate_422_row(ushort16* data, int w) {
@@ -124,6 +183,8 @@ inline void Cr2sRawInterpolator::interpolate_422_row(ushort16* data, int w) {
   // for last (odd) pixel of the line,  just keep Cb/Cr from previous pixel
   // see http://lclevy.free.fr/cr2/#sraw
 
+  RowConverter<version> out(*this, data);
+
   int x;
   for (x = 0; x < w - 2; x += 2) {
     assert(x + 4 <= w);
@@ -132,7 +193,7 @@ inline void Cr2sRawInterpolator::interpolate_422_row(ushort16* data, int w) {
     // load, process and output first pixel, which is full
     YCbCr p0(data);
     p0.process(hue);
-    YUV_TO_RGB<version>(p0, data);
+    out.push(p0);
     data += 3;
 
     // load Y from second pixel, Cb/Cr need to be interpolated
@@ -145,7 +206,7 @@ inline void Cr2sRawInterpolator::interpolate_422_row(ushort16* data, int w) {
 
     // and finally, interpolate and output the middle pixel
     p.interpolate(p0, p1);
-    YUV_TO_RGB<version>(p, data);
+    out.push(p);
     data += 3;
   }
 
@@ -159,13 +220,15 @@ inline void Cr2sRawInterpolator::interpolate_422_row(ushort16* data, int w) {
   // load, process and output first pixel, which is full
   YCbCr p(data);
   p.process(hue);
-  YUV_TO_RGB<version>(p, data);
+  out.push(p);
   data += 3;
 
   // load Y from second pixel, keep Cb/Cr from previous pixel, and output
   YCbCr::LoadY(&p, data);
-  YUV_TO_RGB<version>(p, data);
+  out.push(p);
   data += 3;
+
+  out.flush();
 }
 
 template <int version>
@@ -173,14 +236,14 @@ inline void Cr2sRawInterpolator::interpolate_422(int w, int h) {
   assert(w > 0);
   assert(h > 0);
 
-  for (int y = 0; y < h; y++) {
+  parallelFor(0, h, [this, w](int y) {
     auto data = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
 
     interpolate_422_row<version>(data, w);
-  }
+  });
 }
 
-// NOTE: Not thread safe, since it writes inplace.
+// NOTE: Not thread safe, since it writes inplace, and reads the third line.
 template <int version>
 inline void
 Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
@@ -219,6 +282,9 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
   //           .. .   .       .. .   .       .. .   .
   // see http://lclevy.free.fr/cr2/#sraw
 
+  RowConverter<version> out0(*this, line[0]);
+  RowConverter<version> out1(*this, line[1]);
+
   int x;
   for (x = 0; x < w - 2; x += 2) {
     assert(x + 4 <= w);
@@ -227,7 +293,7 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
     // load, process and output first pixel of first row, which is full
     YCbCr p0(line[0]);
     p0.process(hue);
-    YUV_TO_RGB<version>(p0, line[0]);
+    out0.push(p0);
     line[0] += 3;
 
     // load Y from second pixel of first row
@@ -241,7 +307,7 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
 
     // and finally, interpolate and output the middle pixel of first row
     ph.interpolate(p0, p1);
-    YUV_TO_RGB<version>(ph, line[0]);
+    out0.push(ph);
     line[0] += 3;
 
     // load Y from first pixel of second row
@@ -255,7 +321,7 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
 
     // and finally, interpolate and output the first pixel of second row
     pv.interpolate(p0, p2);
-    YUV_TO_RGB<version>(pv, line[1]);
+    out1.push(pv);
     line[1] += 3;
     line[2] += 6;
 
@@ -272,7 +338,7 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
     // NOTE: we interpolate 4 full pixels here, located on diagonals
     // dcraw interpolates from already interpolated pixels
     p.interpolate(p0, p1, p2, p3);
-    YUV_TO_RGB<version>(p, line[1]);
+    out1.push(p);
     line[1] += 3;
   }
 
@@ -290,13 +356,13 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
   // load, process and output first pixel of first row, which is full
   YCbCr p0(line[0]);
   p0.process(hue);
-  YUV_TO_RGB<version>(p0, line[0]);
+  out0.push(p0);
   line[0] += 3;
 
   // keep Cb/Cr from first pixel of first row
   // load Y from second pixel of first row, output
   YCbCr::LoadY(&p0, line[0]);
-  YUV_TO_RGB<version>(p0, line[0]);
+  out0.push(p0);
   line[0] += 3;
 
   // load Y from first pixel of second row
@@ -310,17 +376,19 @@ Cr2sRawInterpolator::interpolate_420_row(std::array<ushort16*, 3> line, int w) {
 
   // and finally, interpolate and output the first pixel of second row
   pv.interpolate(p0, p2);
-  YUV_TO_RGB<version>(pv, line[1]);
+  out1.push(pv);
   line[1] += 3;
 
   // keep Cb/Cr from first pixel of second row
   // load Y from second pixel of second row, output
   YCbCr::LoadY(&pv, line[1]);
-  YUV_TO_RGB<version>(pv, line[1]);
+  out1.push(pv);
   line[1] += 3;
+
+  out0.flush();
+  out1.flush();
 }
 
-// NOTE: Not thread safe, since it writes inplace.
 template <int version>
 inline void Cr2sRawInterpolator::interpolate_420(int w, int h) {
   assert(w >= 2);
@@ -329,23 +397,59 @@ inline void Cr2sRawInterpolator::interpolate_420(int w, int h) {
   assert(h >= 2);
   assert(h % 2 == 0);
 
-  array<ushort16*, 3> line;
+  // All but the last pair of rows are split into bands, one per task.
+  // The last pair of rows of a band also needs the chroma of the first row
+  // of the next band, as it was before that band was converted, so these
+  // rows are copied beforehand.
+  const int numPairs = h / 2 - 1;
+  const auto executor = getExecutor();
+  const int numBands = std::min(numPairs, executor->getConcurrency());
+  const auto bandBegin = [numPairs, numBands](int band) {
+    return int(int64_t(numPairs) * band / numBands);
+  };
+
+  const int rowSize = 3 * w;
+  vector<ushort16> nextRows;
+  for (int band = 1; band < numBands; band++) {
+    const auto* row = reinterpret_cast<const ushort16*>(
+        mRaw->getData(0, 2 * bandBegin(band)));
+    nextRows.insert(nextRows.end(), row, row + rowSize);
+  }
 
-  int y;
-  for (y = 0; y < h - 2; y += 2) {
-    assert(y + 4 <= h);
-    assert(y % 2 == 0);
+  const auto interpolateBand = [this, w, numBands, &bandBegin, rowSize,
+                                &nextRows](int band) {
+    const int end = bandBegin(band + 1);
+    for (int pair = bandBegin(band); pair < end; pair++) {
+      const int y = 2 * pair;
+      assert(y + 4 <= mRaw->dim.y);
+
+      array<ushort16*, 3> line;
+      line[0] = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+      line[1] = reinterpret_cast<ushort16*>(mRaw->getData(0, y + 1));
+      if (pair + 1 == end && band + 1 < numBands)
+        line[2] = &nextRows[band * rowSize];
+      else
+        line[2] = reinterpret_cast<ushort16*>(mRaw->getData(0, y + 2));
+
+      interpolate_420_row<version>(line, w);
+    }
+  };
 
-    line[0] = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
-    line[1] = reinterpret_cast<ushort16*>(mRaw->getData(0, y + 1));
-    line[2] = reinterpret_cast<ushort16*>(mRaw->getData(0, y + 2));
+  if (numBands > 1)
+    runTasks(executor, numBands, interpolateBand);
+  else if (numBands == 1)
+    interpolateBand(0);
 
-    interpolate_420_row<version>(line, w);
-  }
+  // NOTE: Not thread safe, it needs the third row of the previous pair as
+  // it was before. Thus it is only done once all of the bands are done.
+  interpolate_420_last_rows<version>(w, h);
+}
 
-  assert(y + 2 == h);
-  assert(y % 2 == 0);
+template <int version>
+inline void Cr2sRawInterpolator::interpolate_420_last_rows(int w, int h) {
+  const int y = h - 2;
 
+  array<ushort16*, 3> line;
   line[0] = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
   line[1] = reinterpret_cast<ushort16*>(mRaw->getData(0, y + 1));
   line[2] = nullptr;
@@ -360,6 +464,9 @@ inline void Cr2sRawInterpolator::interpolate_420(int w, int h) {
   //  row 0: [ Y1 Cb  Cr  ] [ Y2 ... ... ] [ Y1 Cb  Cr  ] [ Y2 ... ... ] ...
   //  row 1: [ Y3 ... ... ] [ Y4 ... ... ] [ Y3 ... ... ] [ Y4 ... ... ] ...
 
+  RowConverter<version> out0(*this, line[0]);
+  RowConverter<version> out1(*this, line[1]);
+
   int x;
   for (x = 0; x < w - 2; x += 2) {
     assert(x + 4 <= w);
@@ -368,7 +475,7 @@ inline void Cr2sRawInterpolator::interpolate_420(int w, int h) {
     // load, process and output first pixel of first row, which is full
     YCbCr p0(line[0]);
     p0.process(hue);
-    YUV_TO_RGB<version>(p0, line[0]);
+    out0.push(p0);
     line[0] += 3;
 
     // load Y from second pixel of first row
@@ -382,19 +489,19 @@ inline void Cr2sRawInterpolator::interpolate_420(int w, int h) {
 
     // and finally, interpolate and output the middle pixel of first row
     ph.interpolate(p0, p1);
-    YUV_TO_RGB<version>(ph, line[0]);
+    out0.push(ph);
     line[0] += 3;
 
     // keep Cb/Cr from first pixel of first row
     // load Y from first pixel of second row; and output
     YCbCr::LoadY(&p0, line[1]);
-    YUV_TO_RGB<version>(p0, line[1]);
+    out1.push(p0);
     line[1] += 3;
 
     // keep Cb/Cr from second pixel of first row
     // load Y from second pixel of second row; and output
     YCbCr::LoadY(&ph, line[1]);
-    YUV_TO_RGB<version>(ph, line[1]);
+    out1.push(ph);
     line[1] += 3;
   }
 
@@ -417,65 +524,126 @@ inline void Cr2sRawInterpolator::interpolate_420(int w, int h) {
   // load, process and output first pixel of first row, which is full
   YCbCr p(line[0]);
   p.process(hue);
-  YUV_TO_RGB<version>(p, line[0]);
+  out0.push(p);
   line[0] += 3;
 
   // rest keeps Cb/Cr from this original pixel, because rest only have Y
 
   // load Y from second pixel of first row, and output
   YCbCr::LoadY(&p, line[0]);
-  YUV_TO_RGB<version>(p, line[0]);
+  out0.push(p);
   line[0] += 3;
 
   // load Y from first pixel of second row, and output
   YCbCr::LoadY(&p, line[1]);
-  YUV_TO_RGB<version>(p, line[1]);
+  out1.push(p);
   line[1] += 3;
 
   // load Y from second pixel of second row, and output
   YCbCr::LoadY(&p, line[1]);
-  YUV_TO_RGB<version>(p, line[1]);
+  out1.push(p);
   line[1] += 3;
-}
 
-inline void Cr2sRawInterpolator::STORE_RGB(ushort16* X, int r, int g, int b) {
-  assert(X);
+  out0.flush();
+  out1.flush();
+}
 
-  X[0] = clampBits(r >> 8, 16);
-  X[1] = clampBits(g >> 8, 16);
-  X[2] = clampBits(b >> 8, 16);
+inline void Cr2sRawInterpolator::STORE_RGB(ushort16* r, ushort16* g,
+                                           ushort16* b, int R, int G, int B) {
+  *r = clampBits(R >> 8, 16);
+  *g = clampBits(G >> 8, 16);
+  *b = clampBits(B >> 8, 16);
 }
 
 template </* int version */>
 /* Algorithm found in EOS 40D */
-inline void Cr2sRawInterpolator::YUV_TO_RGB<0>(const YCbCr& p, ushort16* X) {
-  assert(X);
-
-  int r = sraw_coeffs[0] * (p.Y + p.Cr - 512);
-  int g = sraw_coeffs[1] * (p.Y + ((-778 * p.Cb - (p.Cr * 2048)) >> 12) - 512);
-  int b = sraw_coeffs[2] * (p.Y + (p.Cb - 512));
-  STORE_RGB(X, r, g, b);
+inline void Cr2sRawInterpolator::YUV_TO_RGB<0>(const YCbCr& p, ushort16* r,
+                                                ushort16* g,
+                                                ushort16* b) const {
+  int R = sraw_coeffs[0] * (p.Y + p.Cr - 512);
+  int G = sraw_coeffs[1] * (p.Y + ((-778 * p.Cb - (p.Cr * 2048)) >> 12) - 512);
+  int B = sraw_coeffs[2] * (p.Y + (p.Cb - 512));
+  STORE_RGB(r, g, b, R, G, B);
 }
 
 template </* int version */>
-inline void Cr2sRawInterpolator::YUV_TO_RGB<1>(const YCbCr& p, ushort16* X) {
-  assert(X);
-
-  int r = sraw_coeffs[0] * (p.Y + ((50 * p.Cb + 22929 * p.Cr) >> 12));
-  int g = sraw_coeffs[1] * (p.Y + ((-5640 * p.Cb - 11751 * p.Cr) >> 12));
-  int b = sraw_coeffs[2] * (p.Y + ((29040 * p.Cb - 101 * p.Cr) >> 12));
-  STORE_RGB(X, r, g, b);
+inline void Cr2sRawInterpolator::YUV_TO_RGB<1>(const YCbCr& p, ushort16* r,
+                                                ushort16* g,
+                                                ushort16* b) const {
+  int R = sraw_coeffs[0] * (p.Y + ((50 * p.Cb + 22929 * p.Cr) >> 12));
+  int G = sraw_coeffs[1] * (p.Y + ((-5640 * p.Cb - 11751 * p.Cr) >> 12));
+  int B = sraw_coeffs[2] * (p.Y + ((29040 * p.Cb - 101 * p.Cr) >> 12));
+  STORE_RGB(r, g, b, R, G, B);
 }
 
 template </* int version */>
 /* Algorithm found in EOS 5d Mk III */
-inline void Cr2sRawInterpolator::YUV_TO_RGB<2>(const YCbCr& p, ushort16* X) {
-  assert(X);
+inline void Cr2sRawInterpolator::YUV_TO_RGB<2>(const YCbCr& p, ushort16* r,
+                                                ushort16* g,
+                                                ushort16* b) const {
+  int R = sraw_coeffs[0] * (p.Y + p.Cr);
+  int G = sraw_coeffs[1] * (p.Y + ((-778 * p.Cb - (p.Cr * 2048)) >> 12));
+  int B = sraw_coeffs[2] * (p.Y + p.Cb);
+  STORE_RGB(r, g, b, R, G, B);
+}
+
+template <int version>
+void Cr2sRawInterpolator::convertDecodedRows(int decoded, bool all) {
+  const int w = mRaw->dim.x;
+  const int h = mRaw->dim.y;
+  assert(decoded <= h);
+
+  const auto& subSampling = mRaw->metadata.subsampling;
+  if (subSampling.y == 1 && subSampling.x == 2) {
+    for (; rowsConverted < decoded; rowsConverted++) {
+      auto data = reinterpret_cast<ushort16*>(mRaw->getData(0, rowsConverted));
+      interpolate_422_row<version>(data, w);
+    }
+  } else if (subSampling.y == 2 && subSampling.x == 2) {
+    // A pair of rows also needs the chroma of the row after it, so it is
+    // only converted once that one is decoded, and before it is converted.
+    for (; rowsConverted + 2 < h && rowsConverted + 2 < decoded;
+         rowsConverted += 2) {
+      array<ushort16*, 3> line;
+      for (int i = 0; i < 3; i++) {
+        line[i] =
+            reinterpret_cast<ushort16*>(mRaw->getData(0, rowsConverted + i));
+      }
+      interpolate_420_row<version>(line, w);
+    }
+    if (all && rowsConverted + 2 == h) {
+      interpolate_420_last_rows<version>(w, h);
+      rowsConverted = h;
+    }
+  } else
+    ThrowRDE("Unknown subsampling: (%i; %i)", subSampling.x, subSampling.y);
+}
+
+void Cr2sRawInterpolator::convertDecodedRows(int version, int decoded,
+                                             bool all) {
+  assert(version >= 0 && version <= 2);
+
+  switch (version) {
+  case 0:
+    convertDecodedRows<0>(decoded, all);
+    break;
+  case 1:
+    convertDecodedRows<1>(decoded, all);
+    break;
+  case 2:
+    convertDecodedRows<2>(decoded, all);
+    break;
+  default:
+    __builtin_unreachable();
+  }
+}
+
+void Cr2sRawInterpolator::rowsDecoded(int version, int decoded) {
+  convertDecodedRows(version, decoded, /*all=*/false);
+}
 
-  int r = sraw_coeffs[0] * (p.Y + p.Cr);
-  int g = sraw_coeffs[1] * (p.Y + ((-778 * p.Cb - (p.Cr * 2048)) >> 12));
-  int b = sraw_coeffs[2] * (p.Y + p.Cb);
-  STORE_RGB(X, r, g, b);
+void Cr2sRawInterpolator::finishRows(int version) {
+  convertDecodedRows(version, mRaw->dim.y, /*all=*/true);
 }
 
 // Interpolate and convert sRaw data.
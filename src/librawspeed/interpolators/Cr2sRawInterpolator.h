@@ -32,7 +32,11 @@ class Cr2sRawInterpolator final {
   std::array<int, 3> sraw_coeffs;
   int hue;
 
+  // Of the rowsDecoded() / finishRows() conversion.
+  int rowsConverted = 0;
+
   struct YCbCr;
+  template <int version> class RowConverter;
 
 public:
   Cr2sRawInterpolator(const RawImage& mRaw_, std::array<int, 3> sraw_coeffs_,
@@ -41,10 +45,21 @@ public:
 
   void interpolate(int version);
 
+  // The same, but while the image is being decoded, in order, so the rows
+  // are converted while they are still in the cache: rowsDecoded() is told
+  // that all of the rows above the given one are decoded, and converts as
+  // many of them as it can, and finishRows() converts the rest once the
+  // decode is done. Not thread safe, and the rows are done in one thread.
+  void rowsDecoded(int version, int decoded);
+  void finishRows(int version);
+
 protected:
-  template <int version> inline void YUV_TO_RGB(const YCbCr& p, ushort16* X);
+  template <int version>
+  inline void YUV_TO_RGB(const YCbCr& p, ushort16* r, ushort16* g,
+                         ushort16* b) const;
 
-  inline void STORE_RGB(ushort16* X, int r, int g, int b);
+  static inline void STORE_RGB(ushort16* r, ushort16* g, ushort16* b, int R,
+                               int G, int B);
 
   template <int version> inline void interpolate_422_row(ushort16* data, int w);
   template <int version> inline void interpolate_422(int w, int h);
@@ -52,6 +67,11 @@ protected:
   template <int version>
   inline void interpolate_420_row(std::array<ushort16*, 3> line, int w);
   template <int version> inline void interpolate_420(int w, int h);
+  template <int version>
+  inline void interpolate_420_last_rows(int w, int h);
+
+  template <int version> void convertDecodedRows(int decoded, bool all);
+  void convertDecodedRows(int version, int decoded, bool all);
 };
 
 } // namespace rawspeed
@@ -0,0 +1,237 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/ArchiveReader.h"
+#include "common/Common.h"  // for uchar8, uint32, uint64, ushort16, roundUp
+#include "io/Buffer.h"      // for Buffer, DataBuffer
+#include "io/ByteStream.h"  // for ByteStream
+#include "io/Endianness.h"  // for Endianness, getLE
+#include "io/IOException.h" // for ThrowIOE
+#include <algorithm>        // for find_if
+#include <cstring>          // for memcmp, strnlen
+#include <string>           // for string
+#include <utility>          // for move
+
+namespace rawspeed {
+
+namespace {
+
+constexpr uint32 zipLocalHeader = 0x04034b50;
+constexpr uint32 zipCentralHeader = 0x02014b50;
+constexpr uint32 zipEnd = 0x06054b50;
+constexpr uint32 zip64EndLocator = 0x07064b50;
+constexpr uint32 zip64End = 0x06064b50;
+
+constexpr Buffer::size_type zipEndSize = 22;
+constexpr Buffer::size_type zipLocalHeaderSize = 30;
+constexpr Buffer::size_type tarBlockSize = 512;
+
+bool isTar(const Buffer& b) {
+  return b.getSize() >= tarBlockSize &&
+         memcmp(b.getData(257, 5), "ustar", 5) == 0;
+}
+
+bool isZip(const Buffer& b) {
+  return b.getSize() >= zipEndSize && b[0] == 'P' && b[1] == 'K';
+}
+
+// Octal, or for the large ones, the base-256 of GNU tar.
+uint64 getTarNumber(const uchar8* field, int size) {
+  uint64 value = 0;
+  if (field[0] & 0x80U) {
+    value = field[0] & 0x7FU;
+    for (int i = 1; i < size; i++) {
+      if (value >> 56U)
+        ThrowIOE("Tar member is too large");
+      value = (value << 8U) | field[i];
+    }
+    return value;
+  }
+  int i = 0;
+  while (i < size && field[i] == ' ')
+    i++;
+  for (; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+    value = (value << 3U) | (field[i] - '0');
+  return value;
+}
+
+std::string getTarString(const uchar8* field, size_t size) {
+  const auto* str = reinterpret_cast<const char*>(field);
+  return std::string(str, strnlen(str, size));
+}
+
+} // namespace
+
+ArchiveReader::ArchiveReader(const Buffer& archive_) : archive(archive_) {
+  if (isTar(archive))
+    parseTar();
+  else if (isZip(archive))
+    parseZip();
+  else
+    ThrowIOE("Not a zip or a tar archive");
+}
+
+// Of the central directory at the end, which, in a lazily read archive, is
+// usually all that is read of it up front.
+void ArchiveReader::parseZip() {
+  zip = true;
+  const DataBuffer b(archive, Endianness::little);
+  const size_type size = b.getSize();
+
+  // The end of the central directory, which is followed by a comment of up
+  // to 64 KiB.
+  const size_type searchBegin =
+      size > zipEndSize + 0xFFFF ? size - zipEndSize - 0xFFFF : 0;
+  const uchar8* tail = b.getData(searchBegin, size - searchBegin);
+  size_type end = size - zipEndSize;
+  while (getLE<uint32>(tail + (end - searchBegin)) != zipEnd) {
+    if (end == searchBegin)
+      ThrowIOE("Zip end of central directory not found");
+    end--;
+  }
+
+  uint64 entries = b.get<ushort16>(end + 10);
+  uint64 directorySize = b.get<uint32>(end + 12);
+  uint64 directoryOffset = b.get<uint32>(end + 16);
+  if ((entries == 0xFFFF || directorySize == 0xFFFFFFFF ||
+       directoryOffset == 0xFFFFFFFF) &&
+      end >= 20 && b.get<uint32>(end - 20) == zip64EndLocator) {
+    const uint64 end64 = b.get<uint64>(end - 20 + 8);
+    if (b.get<uint32>(end64) != zip64End)
+      ThrowIOE("Corrupt zip64 end of central directory");
+    entries = b.get<uint64>(end64 + 32);
+    directorySize = b.get<uint64>(end64 + 40);
+    directoryOffset = b.get<uint64>(end64 + 48);
+  }
+
+  ByteStream directory(DataBuffer(
+      archive.getSubView(directoryOffset, directorySize), Endianness::little));
+  for (uint64 i = 0; i < entries; i++) {
+    if (directory.get<uint32>() != zipCentralHeader)
+      ThrowIOE("Corrupt zip central directory");
+    directory.skipBytes(4); // the versions
+    const ushort16 flags = directory.get<ushort16>();
+    const ushort16 method = directory.get<ushort16>();
+    directory.skipBytes(8); // the time, the date and the CRC
+    uint64 compressedSize = directory.get<uint32>();
+    uint64 uncompressedSize = directory.get<uint32>();
+    const ushort16 nameLength = directory.get<ushort16>();
+    const ushort16 extraLength = directory.get<ushort16>();
+    const ushort16 commentLength = directory.get<ushort16>();
+    directory.skipBytes(8); // the disk, and the attributes
+    uint64 headerOffset = directory.get<uint32>();
+    const auto* name =
+        reinterpret_cast<const char*>(directory.getData(nameLength));
+    ByteStream extra = directory.getStream(extraLength);
+    directory.skipBytes(commentLength);
+
+    // Those of the sizes and the offset that do not fit are in the zip64
+    // extended information, in this order.
+    while (extra.getRemainSize() >= 4) {
+      const ushort16 id = extra.get<ushort16>();
+      ByteStream field = extra.getStream(extra.get<ushort16>());
+      if (id != 0x0001)
+        continue;
+      for (uint64* v : {&uncompressedSize, &compressedSize, &headerOffset}) {
+        if (*v == 0xFFFFFFFF)
+          *v = field.get<uint64>();
+      }
+    }
+
+    // Not the compressed, nor the encrypted ones, nor the directories.
+    if (method != 0 || (flags & 1U) || !nameLength ||
+        name[nameLength - 1] == '/')
+      continue;
+    if (compressedSize != uncompressedSize)
+      ThrowIOE("Corrupt zip member: '%.*s'", nameLength, name);
+
+    members.push_back({std::string(name, nameLength), headerOffset,
+                       compressedSize});
+  }
+}
+
+// Tar has no directory, so each header is read, one after another.
+void ArchiveReader::parseTar() {
+  zip = false;
+  const size_type size = archive.getSize();
+  std::string longName;
+  for (size_type pos = 0; pos + tarBlockSize <= size;) {
+    const uchar8* header = archive.getData(pos, tarBlockSize);
+    // The end is marked by the blocks of zeros.
+    if (!header[0])
+      break;
+    if (memcmp(header + 257, "ustar", 5) != 0)
+      ThrowIOE("Corrupt tar header at %llu", static_cast<uint64>(pos));
+
+    const uint64 memberSize = getTarNumber(header + 124, 12);
+    if (memberSize > size - pos - tarBlockSize)
+      ThrowIOE("Tar member is truncated");
+    const char type = header[156];
+
+    if (type == 'L') {
+      // The GNU long name, of the next member.
+      longName = getTarString(archive.getData(pos + tarBlockSize, memberSize),
+                             memberSize);
+    } else {
+      if (type == '0' || type == '\0') {
+        std::string name = longName;
+        if (name.empty()) {
+          name = getTarString(header, 100);
+          const std::string prefix = getTarString(header + 345, 155);
+          if (!prefix.empty())
+            name = prefix + "/" + name;
+        }
+        members.push_back({std::move(name), pos, memberSize});
+      }
+      longName.clear();
+    }
+
+    pos += tarBlockSize + roundUp(memberSize, tarBlockSize);
+  }
+}
+
+const ArchiveReader::Member*
+ArchiveReader::find(const std::string& name) const {
+  const auto it =
+      std::find_if(members.begin(), members.end(),
+                   [&name](const Member& m) { return m.name == name; });
+  return it == members.end() ? nullptr : &*it;
+}
+
+// The data follows the header, the zip local one of which has the name and
+// the extra field again, which are not necessarily those of the directory.
+// It is only read now, so that listing the members of a lazily read zip
+// does not read the headers of all of them.
+Buffer ArchiveReader::getMember(const Member& member) const {
+  size_type offset = member.headerOffset;
+  if (zip) {
+    const DataBuffer header(archive.getSubView(offset, zipLocalHeaderSize),
+                            Endianness::little);
+    if (header.get<uint32>(0) != zipLocalHeader)
+      ThrowIOE("Corrupt zip local header of '%s'", member.name.c_str());
+    offset += zipLocalHeaderSize + header.get<ushort16>(26) +
+              header.get<ushort16>(28);
+  } else {
+    offset += tarBlockSize;
+  }
+  return archive.getSubView(offset, member.size);
+}
+
+} // namespace rawspeed
@@ -0,0 +1,69 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "io/Buffer.h" // for Buffer, Buffer::size_type
+#include <string>      // for string
+#include <vector>      // for vector
+
+namespace rawspeed {
+
+// The members of a zip or a tar archive, as the sub-views of the Buffer of
+// the archive, so nothing is copied, or extracted: if the archive is mapped,
+// the members are too, and if it is read lazily, e.g. by a BufferLoader of
+// ranged requests to the object storage, only the parts of the members that
+// are accessed, and the directory of the archive, are ever read.
+//
+// Only the stored zip members can be such a view, the compressed ones are
+// not listed. Of tar, the regular files, with the GNU long names.
+// The Buffer of the archive must outlive the ArchiveReader, and the members.
+class ArchiveReader final {
+public:
+  using size_type = Buffer::size_type;
+
+  struct Member final {
+    std::string name;
+    // Of the header of the member, which the data follows.
+    size_type headerOffset;
+    size_type size;
+  };
+
+private:
+  Buffer archive;
+  bool zip = false;
+  std::vector<Member> members;
+
+  void parseZip();
+  void parseTar();
+
+public:
+  explicit ArchiveReader(const Buffer& archive_);
+
+  const std::vector<Member>& getMembers() const { return members; }
+
+  // nullptr if there is no such member.
+  const Member* find(const std::string& name) const;
+
+  // The data of the member, as a sub-view of the archive.
+  Buffer getMember(const Member& member) const;
+};
+
+} // namespace rawspeed
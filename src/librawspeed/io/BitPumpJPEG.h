@@ -23,7 +23,7 @@
 #include "common/Common.h" // for uchar8, uint32
 #include "io/BitStream.h"  // for BitStreamCacheRightInLeftOut, BitStream
 #include "io/Buffer.h"     // for Buffer::size_type
-#include "io/Endianness.h" // for getBE
+#include "io/Endianness.h" // for getBE, getLE
 
 namespace rawspeed {
 
@@ -44,11 +44,10 @@ inline BitPumpJPEG::size_type BitPumpJPEG::fillCache(const uchar8* input)
 
   // short-cut path for the most common case (no FF marker in the next 4 bytes)
   // this is slightly faster than the else-case alone.
-  // TODO: investigate applicability of vector intrinsics to speed up if-cascade
-  if (input[0] != 0xFF &&
-      input[1] != 0xFF &&
-      input[2] != 0xFF &&
-      input[3] != 0xFF ) {
+  // All four bytes are checked at once: a 0xFF byte is a zero byte of the
+  // inverted word, which is what the usual has-a-zero-byte test finds.
+  const uint32 inverted = ~getLE<uint32>(input);
+  if (((inverted - 0x01010101U) & ~inverted & 0x80808080U) == 0) {
     cache.push(getBE<uint32>(input), 32);
     return 4;
   }
@@ -21,7 +21,7 @@
 #pragma once
 
 #include "common/Common.h" // for uint32, uchar8
-#include "io/BitStream.h"  // for BitStream, BitStreamCacheLeftInRightOut
+#include "io/BitStream.h"  // for BitStream, BitStreamCacheLeftInRightOut...
 #include "io/Buffer.h"     // for Buffer::size_type
 #include "io/Endianness.h" // for getLE
 
@@ -48,4 +48,21 @@ template <> inline void BitPumpLSB::setBufferPosition(size_type newPos) {
   cache.cache = 0;
 }
 
+#ifdef __SIZEOF_INT128__
+// Same bits, only refilled 64 of them at a time. But each skip shifts the
+// whole 128-bit cache, so this is usually slower than the narrow one.
+using BitPumpLSBWide =
+    BitStream<LSBBitPumpTag, BitStreamCacheLeftInRightOutWide>;
+
+template <>
+inline BitPumpLSBWide::size_type BitPumpLSBWide::fillCache(const uchar8* input)
+{
+  static_assert(BitStreamCacheBase::MaxProcessBytes >= 8,
+                "check implementation");
+
+  cache.push(getLE<uint64>(input), 64);
+  return 8;
+}
+#endif
+
 } // namespace rawspeed
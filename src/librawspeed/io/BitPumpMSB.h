@@ -21,7 +21,7 @@
 #pragma once
 
 #include "common/Common.h" // for uint32, uchar8
-#include "io/BitStream.h"  // for BitStream, BitStreamCacheRightInLeftOut
+#include "io/BitStream.h"  // for BitStream, BitStreamCacheRightInLeftOut...
 #include "io/Endianness.h" // for getBE
 
 namespace rawspeed {
@@ -46,4 +46,24 @@ inline BitPumpMSB::size_type BitPumpMSB::fillCache(const uchar8* input)
   return 4;
 }
 
+#ifdef __SIZEOF_INT128__
+// Same bits, only refilled 64 of them at a time.
+using BitPumpMSBWide =
+    BitStream<MSBBitPumpTag, BitStreamCacheRightInLeftOutWide>;
+
+template <> struct BitStreamTraits<BitPumpMSBWide> final {
+  static constexpr bool canUseWithHuffmanTable = true;
+};
+
+template <>
+inline BitPumpMSBWide::size_type BitPumpMSBWide::fillCache(const uchar8* input)
+{
+  static_assert(BitStreamCacheBase::MaxProcessBytes >= 8,
+                "check implementation");
+
+  cache.push(getBE<uint64>(input), 64);
+  return 8;
+}
+#endif
+
 } // namespace rawspeed
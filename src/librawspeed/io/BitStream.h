@@ -22,8 +22,8 @@
 
 #pragma once
 
-#include "common/Common.h" // for uint32, uchar8, uint64
-#include "io/Buffer.h"     // for Buffer::size_type, BUFFER_PADDING
+#include "common/Common.h" // for uint32, uchar8, uint64, ushort16
+#include "io/Buffer.h"     // for Buffer::size_type
 #include "io/ByteStream.h"  // for ByteStream
 #include "io/IOException.h" // for IOException (ptr only), ThrowIOE
 #include <cassert>          // for assert
@@ -36,56 +36,76 @@ namespace rawspeed {
 //  * L->R: new bits are pushed in on the left and pulled out on the right
 //  * L<-R: new bits are pushed in on the right and pulled out on the left
 // Each BitStream specialization uses one of the two.
+// Where available, there is also a 128-bit wide cache. The same number of bits
+// can be requested at once, but each refill may push twice as many of them,
+// so there are half as many refills.
 
-struct BitStreamCacheBase
-{
-  uint64 cache = 0; // the actual bits stored in the cache
+template <typename T> struct BitStreamCacheBaseImpl {
+  T cache = 0; // the actual bits stored in the cache
   unsigned int fillLevel = 0; // bits left in cache
   static constexpr unsigned Size = sizeof(cache)*8;
 
   // how many bits could be requested to be filled
-  static constexpr unsigned MaxGetBits = Size/2;
+  static constexpr unsigned MaxGetBits = 32;
 
   // maximal number of bytes the implementation may read.
   // NOTE: this is not the same as MaxGetBits/8 !!!
   static constexpr unsigned MaxProcessBytes = 8;
 };
 
-struct BitStreamCacheLeftInRightOut : BitStreamCacheBase
-{
+template <typename T>
+struct BitStreamCacheLeftInRightOutImpl : BitStreamCacheBaseImpl<T> {
+  using Base = BitStreamCacheBaseImpl<T>;
+
   inline void push(uint64 bits, uint32 count) noexcept {
-    assert(count + fillLevel <= Size);
-    cache |= bits << fillLevel;
-    fillLevel += count;
+    assert(count + Base::fillLevel <= Base::Size);
+    Base::cache |= static_cast<T>(bits) << Base::fillLevel;
+    Base::fillLevel += count;
   }
 
   inline uint32 peek(uint32 count) const noexcept {
-    return cache & ((1U << count) - 1U);
+    return static_cast<uint32>(Base::cache) & ((1U << count) - 1U);
   }
 
   inline void skip(uint32 count) noexcept {
-    cache >>= count;
-    fillLevel -= count;
+    Base::cache >>= count;
+    Base::fillLevel -= count;
   }
 };
 
-struct BitStreamCacheRightInLeftOut : BitStreamCacheBase
-{
+template <typename T>
+struct BitStreamCacheRightInLeftOutImpl : BitStreamCacheBaseImpl<T> {
+  using Base = BitStreamCacheBaseImpl<T>;
+
   inline void push(uint64 bits, uint32 count) noexcept {
-    assert(count + fillLevel <= Size);
-    cache = cache << count | bits;
-    fillLevel += count;
+    assert(count + Base::fillLevel <= Base::Size);
+    Base::cache = Base::cache << count | bits;
+    Base::fillLevel += count;
   }
 
   inline uint32 peek(uint32 count) const noexcept {
-    return (cache >> (fillLevel - count)) & ((1U << count) - 1U);
+    return static_cast<uint32>(Base::cache >> (Base::fillLevel - count)) &
+           ((1U << count) - 1U);
   }
 
   inline void skip(uint32 count) noexcept {
-    fillLevel -= count;
+    Base::fillLevel -= count;
   }
 };
 
+using BitStreamCacheBase = BitStreamCacheBaseImpl<uint64>;
+using BitStreamCacheLeftInRightOut = BitStreamCacheLeftInRightOutImpl<uint64>;
+using BitStreamCacheRightInLeftOut = BitStreamCacheRightInLeftOutImpl<uint64>;
+
+#ifdef __SIZEOF_INT128__
+__extension__ using uint128 = unsigned __int128;
+
+using BitStreamCacheLeftInRightOutWide =
+    BitStreamCacheLeftInRightOutImpl<uint128>;
+using BitStreamCacheRightInLeftOutWide =
+    BitStreamCacheRightInLeftOutImpl<uint128>;
+#endif
+
 template <typename BIT_STREAM> struct BitStreamTraits final {
   static constexpr bool canUseWithHuffmanTable = false;
 };
@@ -102,12 +122,17 @@ class BitStream final : public ByteStream {
 public:
   BitStream() = default;
 
+  // NOTE: fill() accesses the memory directly, so the whole stream is loaded.
   explicit BitStream(const ByteStream& s)
-      : ByteStream(s.getSubStream(s.getPosition(), s.getRemainSize())) {}
+      : ByteStream(s.getSubStream(s.getPosition(), s.getRemainSize())) {
+    ensureLoaded(0, size);
+  }
 
   // deprecated:
   BitStream(const Buffer* f, size_type offset)
-      : ByteStream(DataBuffer(f->getSubView(offset))) {}
+      : ByteStream(DataBuffer(f->getSubView(offset))) {
+    ensureLoaded(0, size);
+  }
 
 private:
   inline void fillSafe() {
@@ -147,14 +172,10 @@ public:
 #if defined(DEBUG)
       // really slow, but best way to check all the assumptions.
       fillSafe();
-#elif BUFFER_PADDING >= 8
-      static_assert(BitStreamCacheBase::MaxProcessBytes == 8,
-                    "update these too");
-      // FIXME: this looks very wrong. We don't check pos at all here.
-      // I suspect this should be:  if (pos <= size)
-      pos += fillCache(data + pos);
 #else
-      // disabling this run-time bounds check saves about 1% on intel x86-64
+      // Even with the BUFFER_PADDING, the bytes past the end are not known to
+      // be zeros (e.g. for a sub-stream, they are the rest of the parent), so
+      // this check has to stay. It is rarely mispredicted, so it is cheap.
       if (pos + BitStreamCacheBase::MaxProcessBytes <= size)
         pos += fillCache(data + pos);
       else
@@ -170,6 +191,12 @@ public:
 
   inline size_type getFillLevel() const { return cache.fillLevel; }
 
+  // The offset of the next bit into the bytes that were read, which may be
+  // past the end, where the zeros are. Unlike getPosition(), it never throws.
+  inline uint64 getBitPosition() const {
+    return 8 * uint64(pos) - cache.fillLevel;
+  }
+
   // rewinds to the beginning of the buffer.
   void resetBufferPosition() {
     pos = 0;
@@ -212,6 +239,22 @@ public:
       ThrowIOE("skipBits overflow");
     cache.skip(nbits);
   }
+
+  // Reads count fields of nbits bits each. The cache is refilled once for as
+  // many of them as fit into it, so the loop over those can be unrolled.
+  template <int nbits> inline void getBitsBulk(ushort16* out, size_type count) {
+    static_assert(nbits > 0 && nbits <= 16, "unsupported field width");
+    static constexpr size_type perFill = Cache::MaxGetBits / nbits;
+
+    size_type i = 0;
+    for (; count - i >= perFill; i += perFill) {
+      fill(perFill * nbits);
+      for (size_type j = 0; j < perFill; j++)
+        out[i + j] = getBitsNoFill(nbits);
+    }
+    for (; i < count; i++)
+      out[i] = getBits(nbits);
+  }
 };
 
 } // namespace rawspeed
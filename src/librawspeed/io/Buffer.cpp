@@ -22,9 +22,12 @@
 #include "io/Buffer.h"
 #include "AddressSanitizer.h" // for ASan
 #include "common/Common.h"    // for uchar8, roundUp
-#include "common/Memory.h"    // for alignedFree, alignedFreeConstPtr, alig...
+#include "common/Memory.h"    // for alignedFree, adviseHugePages, advise...
+#include "io/BufferLoader.h"  // for BufferLoader
 #include "io/IOException.h"   // for ThrowIOE
 #include <cassert>            // for assert
+#include <cstddef>            // for size_t
+#include <limits>             // for numeric_limits
 #include <memory>             // for unique_ptr
 
 using std::unique_ptr;
@@ -35,11 +38,18 @@ unique_ptr<uchar8, decltype(&alignedFree)> Buffer::Create(size_type size) {
   if (!size)
     ThrowIOE("Trying to allocate 0 bytes sized buffer.");
 
+  // the allocation size must be representable, e.g. on 32-bit platforms.
+  if (size > std::numeric_limits<size_t>::max() - BUFFER_PADDING - 16)
+    ThrowIOE("Trying to allocate too big buffer (%llu bytes).", size);
+
   unique_ptr<uchar8, decltype(&alignedFree)> data(
       alignedMalloc<uchar8, 16>(roundUp(size + BUFFER_PADDING, 16)),
       &alignedFree);
   if (!data)
-    ThrowIOE("Failed to allocate %uz bytes memory buffer.", size);
+    ThrowIOE("Failed to allocate %llu bytes memory buffer.", size);
+
+  if (getHugePagesForBuffers())
+    adviseHugePages(data.get(), size);
 
   assert(!ASan::RegionIsPoisoned(data.get(), size));
 
@@ -64,9 +74,45 @@ Buffer::Buffer(unique_ptr<uchar8, decltype(&alignedFree)> data_,
   isOwner = true;
 }
 
+Buffer::Buffer(const uchar8* data_, size_type size_, Deleter deleter_,
+               bool mapped_)
+    : data(data_), size(size_), deleter(deleter_), mapped(mapped_) {
+  if (!size)
+    ThrowIOE("Buffer has zero size?");
+
+  if (!data)
+    ThrowIOE("Memory buffer is nonexistent");
+
+  if (!deleter)
+    ThrowIOE("No deleter specified");
+
+  assert(!ASan::RegionIsPoisoned(data, size));
+
+  isOwner = true;
+}
+
+void Buffer::freeAligned(const uchar8* data_, size_type /*size_*/) {
+  alignedFreeConstPtr(data_);
+}
+
+void Buffer::adviseWillNeed() const {
+  if (mapped)
+    rawspeed::adviseWillNeed(data, size);
+}
+
+void Buffer::adviseDone() const {
+  if (mapped)
+    rawspeed::adviseDontNeed(data, size);
+}
+
+void Buffer::loadRange(const uchar8* begin_, size_type count) const {
+  assert(loader);
+  loader->load(begin_, count);
+}
+
 Buffer::~Buffer() {
   if (isOwner) {
-    alignedFreeConstPtr(data);
+    deleter(data, size);
   }
 }
 
@@ -77,11 +123,14 @@ Buffer& Buffer::operator=(Buffer&& rhs) noexcept {
   }
 
   if (isOwner)
-    alignedFreeConstPtr(data);
+    deleter(data, size);
 
   data = rhs.data;
   size = rhs.size;
   isOwner = rhs.isOwner;
+  deleter = rhs.deleter;
+  loader = rhs.loader;
+  mapped = rhs.mapped;
 
   assert(!ASan::RegionIsPoisoned(data, size));
 
@@ -97,6 +146,8 @@ Buffer& Buffer::operator=(const Buffer& rhs) {
   }
 
   Buffer unOwningTmp(rhs.data, rhs.size);
+  unOwningTmp.loader = rhs.loader;
+  unOwningTmp.mapped = rhs.mapped;
   *this = std::move(unOwningTmp);
   assert(!isOwner);
   assert(!ASan::RegionIsPoisoned(data, size));
@@ -32,19 +32,16 @@
 
 namespace rawspeed {
 
+class BufferLoader;
+
 // This allows to specify the nuber of bytes that each Buffer needs to
-// allocate additionally to be able to remove one runtime bounds check
-// in BitStream::fill. There are two sane choices:
+// allocate additionally, past its end. There are two sane choices:
 // 0 : allocate exactly as much data as required, or
 // set it to the value of  BitStreamCacheBase::MaxProcessBytes
+// NOTE: BitStream::fill keeps its bounds check either way, since the bytes
+// past the end of a sub-buffer are not the padding, but the rest of the data.
 #define BUFFER_PADDING 0UL
 
-// if the padding is >= 4, bounds checking in BitStream::fill are not compiled,
-// which supposedly saves about 1% on modern CPUs
-// WARNING: if the padding is >= 4, do *NOT* create Buffer from
-// passed unowning pointer and size. Or, subtract BUFFER_PADDING from size.
-// else bound checks will malfunction => bad things can happen !!!
-
 /*************************************************************************
  * This is the buffer abstaction.
  *
@@ -57,12 +54,38 @@ namespace rawspeed {
 class Buffer
 {
 public:
-  using size_type = uint32;
+  using size_type = uint64;
+
+  // releases the owned memory. is passed the same data pointer and size that
+  // the owning Buffer was constructed with.
+  using Deleter = void (*)(const uchar8* data, size_type size);
 
 protected:
   const uchar8* data = nullptr;
   size_type size = 0;
   bool isOwner = false;
+  Deleter deleter = &freeAligned;
+
+  // if set, the memory is populated lazily, and must be loaded before it is
+  // accessed. propagated to all the copies and sub-views of the buffer.
+  BufferLoader* loader = nullptr;
+
+  // if set, the memory is a mapping of the file, so the kernel can be told
+  // which parts will be read next, and which ones are done with.
+  // propagated to all the copies and sub-views of the buffer.
+  bool mapped = false;
+
+  static void freeAligned(const uchar8* data_, size_type size_);
+
+  // makes sure that the memory range has been loaded by the loader.
+  void __attribute__((noinline))
+  loadRange(const uchar8* begin_, size_type count) const;
+  inline void ensureLoaded(size_type offset, size_type count) const {
+    if (loader)
+      loadRange(data + offset, count);
+  }
+
+  friend class BufferLoader;
 
 public:
   // allocates the databuffer, and returns owning non-const pointer.
@@ -80,6 +103,11 @@ public:
   Buffer(std::unique_ptr<uchar8, decltype(&alignedFree)> data_,
          size_type size_);
 
+  // creates buffer that owns the memory, which is released via the deleter.
+  // NOTE: BUFFER_PADDING bytes past the end must be readable!
+  Buffer(const uchar8* data_, size_type size_, Deleter deleter_,
+         bool mapped_ = false);
+
   // Data already allocated
   explicit Buffer(const uchar8* data_, size_type size_)
       : data(data_), size(size_) {
@@ -90,13 +118,16 @@ public:
   }
 
   // creates a (non-owning) copy / view of rhs
-  Buffer(const Buffer& rhs) : data(rhs.data), size(rhs.size) {
+  Buffer(const Buffer& rhs)
+      : data(rhs.data), size(rhs.size), loader(rhs.loader),
+        mapped(rhs.mapped) {
     assert(!ASan::RegionIsPoisoned(data, size));
   }
 
   // Move data and ownership from rhs to this
   Buffer(Buffer&& rhs) noexcept
-      : data(rhs.data), size(rhs.size), isOwner(rhs.isOwner) {
+      : data(rhs.data), size(rhs.size), isOwner(rhs.isOwner),
+        deleter(rhs.deleter), loader(rhs.loader), mapped(rhs.mapped) {
     assert(!ASan::RegionIsPoisoned(data, size));
     rhs.isOwner = false;
   }
@@ -111,7 +142,17 @@ public:
     if (!isValid(0, offset))
       ThrowIOE("Buffer overflow: image file may be truncated");
 
-    return Buffer(getData(offset, size_), size_);
+    if (!isValid(offset, size_))
+      ThrowIOE("Buffer overflow: image file may be truncated");
+
+    assert(data);
+    assert(!ASan::RegionIsPoisoned(data + offset, size_));
+
+    // NOTE: the view is not loaded here, only once it is actually accessed.
+    Buffer view(data + offset, size_);
+    view.loader = loader;
+    view.mapped = mapped;
+    return view;
   }
 
   Buffer getSubView(size_type offset) const {
@@ -127,12 +168,22 @@ public:
     if (!isValid(offset, count))
       ThrowIOE("Buffer overflow: image file may be truncated");
 
+    ensureLoaded(offset, count);
+
     assert(data);
     assert(!ASan::RegionIsPoisoned(data + offset, count));
 
     return data + offset;
   }
 
+  // hints that the whole buffer is about to be read, so that a mapped file can
+  // be read in ahead of the decompression. a no-op if not mapped.
+  void adviseWillNeed() const;
+
+  // hints that the buffer has been consumed, so that the pages of a mapped
+  // file are dropped instead of filling up the memory. a no-op if not mapped.
+  void adviseDone() const;
+
   // convenience getter for single bytes
   uchar8 operator[](size_type offset) const {
     return *getData(offset, 1);
@@ -140,11 +191,13 @@ public:
 
   // std begin/end iterators to allow for range loop
   const uchar8* begin() const {
+    ensureLoaded(0, size);
     assert(data);
     assert(!ASan::RegionIsPoisoned(data, 0));
     return data;
   }
   const uchar8* end() const {
+    ensureLoaded(0, size);
     assert(data);
     assert(!ASan::RegionIsPoisoned(data, size));
     return data + size;
@@ -163,9 +216,18 @@ public:
     return size;
   }
 
+  // The offset of this view within outer, of which it must be a view.
+  // Neither of them is loaded for this.
+  size_type getOffsetIn(const Buffer& outer) const {
+    if (data < outer.data || data + size > outer.data + outer.size)
+      ThrowIOE("Not a view of that buffer");
+    return static_cast<size_type>(data - outer.data);
+  }
+
   inline bool isValid(size_type offset, size_type count = 1) const {
-    return static_cast<uint64>(offset) + count <=
-           static_cast<uint64>(size) + BUFFER_PADDING;
+    // NOTE: size_type is 64-bit, so we can not just compute offset + count
+    const size_type end = size + BUFFER_PADDING;
+    return offset <= end && count <= end - offset;
   }
 
 //  Buffer* clone();
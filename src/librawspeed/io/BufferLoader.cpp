@@ -0,0 +1,103 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/BufferLoader.h"
+#include "common/Common.h"  // for uchar8, roundUpDivision
+#include "io/Buffer.h"      // for Buffer, Buffer::size_type
+#include "io/IOException.h" // for ThrowIOE
+#include <algorithm>        // for min, fill
+#include <cassert>          // for assert
+#include <utility>          // for move
+
+namespace rawspeed {
+
+constexpr BufferLoader::size_type BufferLoader::ChunkSize;
+
+BufferLoader::BufferLoader(size_type size, ReadFunction read_,
+                           size_type readAhead)
+    : read(std::move(read_)),
+      readAheadChunks(roundUpDivision(readAhead, ChunkSize)) {
+  if (!read)
+    ThrowIOE("No read function specified");
+
+  auto mem = Buffer::Create(size);
+  storage = mem.get();
+  buffer = Buffer(std::move(mem), size);
+  buffer.loader = this;
+
+  MutexLocker guard(&mutex);
+  loadedChunks.resize(roundUpDivision(size, ChunkSize), false);
+}
+
+void BufferLoader::load(const uchar8* begin, size_type count) {
+  if (!count)
+    return;
+
+  assert(begin >= storage);
+  const auto size = buffer.getSize();
+  const auto offset = static_cast<size_type>(begin - storage);
+
+  // do not load the padding, and let the caller deal with the overflow.
+  if (offset >= size)
+    return;
+  const size_type end = std::min<uint64>(uint64(offset) + count, size);
+
+  const size_type firstChunk = offset / ChunkSize;
+  const size_type lastChunk = (end - 1) / ChunkSize;
+
+  MutexLocker guard(&mutex);
+
+  if (loadedSize == size)
+    return;
+
+  for (size_type chunk = firstChunk; chunk <= lastChunk;) {
+    if (loadedChunks[chunk]) {
+      chunk++;
+      continue;
+    }
+
+    // coalesce the run of not-yet-loaded chunks into a single read, and
+    // the ones to read ahead, if the run goes on up to the last chunk.
+    const size_type readEnd = std::min<uint64>(
+        uint64(lastChunk) + 1 + readAheadChunks, loadedChunks.size());
+    size_type runEnd = chunk + 1;
+    while (runEnd < readEnd && !loadedChunks[runEnd])
+      runEnd++;
+
+    const size_type runBegin = chunk * ChunkSize;
+    const size_type runSize =
+        std::min<uint64>(uint64(runEnd) * ChunkSize, size) - runBegin;
+
+    read(storage + runBegin, runBegin, runSize);
+
+    std::fill(loadedChunks.begin() + chunk, loadedChunks.begin() + runEnd,
+              true);
+    loadedSize += runSize;
+
+    chunk = runEnd;
+  }
+}
+
+BufferLoader::size_type BufferLoader::getLoadedSize() {
+  MutexLocker guard(&mutex);
+  return loadedSize;
+}
+
+} // namespace rawspeed
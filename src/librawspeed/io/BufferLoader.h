@@ -0,0 +1,79 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "ThreadSafetyAnalysis.h" // for GUARDED_BY, REQUIRES
+#include "common/Common.h"        // for uchar8
+#include "common/Mutex.h"         // for Mutex
+#include "io/Buffer.h"            // for Buffer, Buffer::size_type
+#include <functional>             // for function
+#include <vector>                 // for vector
+
+namespace rawspeed {
+
+// Provides a Buffer whose memory is only read from the underlying source once
+// it is actually accessed, with a granularity of ChunkSize bytes.
+// E.g. when only the metadata is needed, only the chunks containing the
+// headers will ever be read, not the strip/tile payload.
+// The BufferLoader must outlive the Buffer, and all the copies/views of it.
+class BufferLoader final {
+public:
+  using size_type = Buffer::size_type;
+
+  // must read exactly 'count' bytes from 'offset' of the source into 'dest',
+  // or throw an exception.
+  using ReadFunction =
+      std::function<void(uchar8* dest, size_type offset, size_type count)>;
+
+  static constexpr size_type ChunkSize = 64 * 1024;
+
+private:
+  uchar8* storage;
+  Buffer buffer;
+  ReadFunction read;
+  const size_type readAheadChunks;
+
+  Mutex mutex;
+  std::vector<bool> loadedChunks GUARDED_BY(mutex);
+  size_type loadedSize GUARDED_BY(mutex) = 0;
+
+public:
+  // Each read continues for up to readAhead bytes past what was accessed,
+  // as long as those are not loaded yet, for the sources of which each read
+  // is costly, e.g. a ranged request to the object storage: the IFDs, or the
+  // rows of the strips, that follow are then usually already there.
+  BufferLoader(size_type size, ReadFunction read_, size_type readAhead = 0);
+
+  BufferLoader(const BufferLoader&) = delete;
+  BufferLoader(BufferLoader&&) = delete;
+  BufferLoader& operator=(const BufferLoader&) = delete;
+  BufferLoader& operator=(BufferLoader&&) = delete;
+
+  const Buffer& getBuffer() const { return buffer; }
+
+  // makes sure that the given range of the buffer has been read.
+  void load(const uchar8* begin, size_type count) REQUIRES(!mutex);
+
+  // how many bytes have been read from the source so far.
+  size_type getLoadedSize() REQUIRES(!mutex);
+};
+
+} // namespace rawspeed
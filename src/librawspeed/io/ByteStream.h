@@ -25,7 +25,7 @@
 #include "common/Common.h"    // for uchar8, int32, uint32, ushort16, roundUp
 #include "common/Memory.h"    // for alignedMalloc
 #include "io/Buffer.h"        // for Buffer::size_type, Buffer, DataBuffer
-#include "io/Endianness.h"    // for Endianness, Endianness::little
+#include "io/Endianness.h"    // for Endianness, getByteSwapped, getHostEnd...
 #include "io/IOException.h"   // for IOException (ptr only), ThrowIOE
 #include <cassert>            // for assert
 #include <cstring>            // for memcmp, memcpy
@@ -33,6 +33,48 @@
 
 namespace rawspeed {
 
+/*
+ * The next bytes of a ByteStream, as taken by ByteStream::reserve(). The
+ * bounds are checked once, when they are reserved, so each read is just a
+ * load, swapped if the stream is not in the byte order of the host. Reading
+ * past the reserved bytes is a bug in the caller, it is only asserted.
+ */
+class ByteStreamCursor final {
+  using size_type = Buffer::size_type;
+
+  const uchar8* data = nullptr;
+  size_type size = 0;
+  size_type pos = 0;
+  bool bswap = false;
+
+public:
+  ByteStreamCursor() = default;
+  ByteStreamCursor(const uchar8* data_, size_type size_, bool bswap_)
+      : data(data_), size(size_), bswap(bswap_) {}
+
+  size_type getRemainSize() const { return size - pos; }
+
+  const uchar8* getData(size_type count) {
+    assert(count <= getRemainSize());
+    const uchar8* ret = data + pos;
+    pos += count;
+    return ret;
+  }
+
+  void skipBytes(size_type count) { getData(count); }
+
+  uchar8 getByte() { return *getData(1); }
+
+  template <typename T> T get() {
+    return getByteSwapped<T>(getData(sizeof(T)), bswap);
+  }
+
+  ushort16 getU16() { return get<ushort16>(); }
+  uint32 getU32() { return get<uint32>(); }
+  float getFloat() { return get<float>(); }
+  double getDouble() { return get<double>(); }
+};
+
 class ByteStream : public DataBuffer
 {
 protected:
@@ -71,7 +113,7 @@ public:
   }
 
   inline size_type check(size_type bytes) const {
-    if (static_cast<uint64>(pos) + bytes > size)
+    if (pos > size || bytes > size - pos)
       ThrowIOE("Out of bounds access in ByteStream");
     assert(!ASan::RegionIsPoisoned(data + pos, bytes));
     return bytes;
@@ -132,6 +174,7 @@ public:
   inline uchar8 peekByte(size_type i = 0) const {
     assert(data);
     check(i+1);
+    ensureLoaded(pos + i, 1);
     return data[pos+i];
   }
 
@@ -145,6 +188,7 @@ public:
     assert(data);
     if (!isValid(pos + relPos, size_))
       return false;
+    ensureLoaded(pos + relPos, size_);
     return memcmp(&data[pos + relPos], pattern, size_) == 0;
   }
 
@@ -162,6 +206,7 @@ public:
   inline uchar8 getByte() {
     assert(data);
     check(1);
+    ensureLoaded(pos, 1);
     return data[pos++];
   }
 
@@ -182,6 +227,30 @@ public:
   inline uint32 getU32() { return get<uint32>(); }
   inline float getFloat() { return get<float>(); }
 
+  // The next count bytes, checked once, for the loops that read them one small
+  // value after the other. The stream moves past them.
+  inline ByteStreamCursor reserve(size_type count) {
+    const bool bswap = getHostEndianness() != getByteOrder();
+    return {getData(count), count, bswap};
+  }
+  inline ByteStreamCursor reserve(size_type nmemb, size_type size_) {
+    return reserve(check(nmemb, size_));
+  }
+
+  // Reads count values at once, with a single bounds check. If the byte order
+  // is not the host one, they are all swapped in one simple loop afterwards,
+  // which the compiler can vectorize.
+  template <typename T> inline void getArray(T* out, size_type count) {
+    const uchar8* in = getData(check(count, sizeof(T)));
+    memcpy(out, in, count * sizeof(T));
+
+    if (getHostEndianness() == getByteOrder())
+      return;
+
+    for (size_type i = 0; i < count; i++)
+      out[i] = getByteSwapped(out[i]);
+  }
+
   const char* peekString() const {
     assert(data);
     if (memchr(peekData(getRemainSize()), 0, getRemainSize()) == nullptr)
@@ -197,6 +266,7 @@ public:
     bool isNullTerminator = false;
     do {
       check(1);
+      ensureLoaded(pos, 1);
       isNullTerminator = (data[pos] == '\0');
       pos++;
     } while (!isNullTerminator);
@@ -20,15 +20,22 @@
 */
 
 #include "io/FileReader.h"
+#include "common/Common.h"      // for uchar8, uint64, roundUp
 #include "io/Buffer.h"          // for Buffer, Buffer::size_type
+#include "io/BufferLoader.h"    // for BufferLoader
 #include "io/FileIOException.h" // for ThrowFIE
 #include <cstdio>               // for fseek, fclose, feof, ferror, fopen
-#include <fcntl.h>              // for SEEK_END, SEEK_SET
+#include <algorithm>            // for min
+#include <fcntl.h>              // for SEEK_END, SEEK_SET, open, O_RDONLY
 #include <limits>               // for numeric_limits
 #include <memory>               // for unique_ptr, make_unique, operator==
 #include <utility>              // for move
 
-#if !(defined(__unix__) || defined(__APPLE__))
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> // for mmap, munmap, MAP_FAILED, PROT_READ
+#include <sys/stat.h> // for fstat, stat
+#include <unistd.h>   // for close, pread, sysconf, _SC_PAGESIZE
+#else
 #ifndef NOMINMAX
 #define NOMINMAX // do not want the min()/max() macros!
 #endif
@@ -41,6 +48,47 @@
 
 namespace rawspeed {
 
+namespace {
+
+#if defined(__unix__) || defined(__APPLE__)
+
+size_t getFileSize(int fd, const char* fileName) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    ThrowFIE("Could not stat file \"%s\".", fileName);
+
+  if (st.st_size <= 0)
+    ThrowFIE("File is 0 bytes.");
+
+  // e.g. on 32-bit platforms, the file may not fit into the address space.
+  if (static_cast<uint64>(st.st_size) > std::numeric_limits<size_t>::max())
+    ThrowFIE("File is too big (%llu bytes).",
+             static_cast<uint64>(st.st_size));
+
+  return st.st_size;
+}
+
+#else // __unix__
+
+size_t getFileSize(HANDLE file) {
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size))
+    ThrowFIE("Could not get file size.");
+
+  if (size.QuadPart <= 0)
+    ThrowFIE("File is 0 bytes.");
+
+  // e.g. on 32-bit platforms, the file may not fit into the address space.
+  if (static_cast<uint64>(size.QuadPart) > std::numeric_limits<size_t>::max())
+    ThrowFIE("File is too big.");
+
+  return size.QuadPart;
+}
+
+#endif // __unix__
+
+} // namespace
+
 std::unique_ptr<const Buffer> FileReader::readFile() {
   size_t fileSize = 0;
 
@@ -59,9 +107,6 @@ std::unique_ptr<const Buffer> FileReader::readFile() {
 
   fileSize = size;
 
-  if (fileSize > std::numeric_limits<Buffer::size_type>::max())
-    ThrowFIE("File is too big (%zu bytes).", fileSize);
-
   fseek(file.get(), 0, SEEK_SET);
 
   auto dest = Buffer::Create(fileSize);
@@ -88,33 +133,191 @@ std::unique_ptr<const Buffer> FileReader::readFile() {
   if (file.get() == INVALID_HANDLE_VALUE)
     ThrowFIE("Could not open file \"%s\".", fileName);
 
-  LARGE_INTEGER size;
-  GetFileSizeEx(file.get(), &size);
-
-  static_assert(
-      std::numeric_limits<Buffer::size_type>::max() ==
-          std::numeric_limits<decltype(size.LowPart)>::max(),
-      "once Buffer migrates to 64-bit index, this needs to be updated.");
+  fileSize = getFileSize(file.get());
 
-  if (size.HighPart > 0)
-    ThrowFIE("File is too big.");
-  if (size.LowPart <= 0)
-    ThrowFIE("File is 0 bytes.");
+  auto dest = Buffer::Create(fileSize);
 
-  auto dest = Buffer::Create(size.LowPart);
+  // ReadFile() can read at most 4 GiB at once.
+  for (size_t done = 0; done < fileSize;) {
+    const DWORD count = std::min<size_t>(fileSize - done,
+                                         std::numeric_limits<DWORD>::max());
 
-  DWORD bytes_read;
-  if (!ReadFile(file.get(), dest.get(), size.LowPart, &bytes_read, nullptr))
-    ThrowFIE("Could not read file.");
+    DWORD bytes_read;
+    if (!ReadFile(file.get(), dest.get() + done, count, &bytes_read, nullptr))
+      ThrowFIE("Could not read file.");
 
-  if (size.LowPart != bytes_read)
-    ThrowFIE("Could not read file.");
+    if (count != bytes_read)
+      ThrowFIE("Could not read file.");
 
-  fileSize = size.LowPart;
+    done += count;
+  }
 
 #endif // __unix__
 
   return std::make_unique<Buffer>(move(dest), fileSize);
 }
 
+namespace {
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// The mapping covers the file, and the BUFFER_PADDING after it.
+size_t getMappingSize(size_t fileSize) {
+  const auto pageSize = sysconf(_SC_PAGESIZE);
+  return roundUp(fileSize + BUFFER_PADDING, pageSize);
+}
+
+void unmapFile(const uchar8* data, Buffer::size_type size) {
+  munmap(const_cast<uchar8*>(data), getMappingSize(size));
+}
+
+#else // __unix__
+
+void unmapFile(const uchar8* data, Buffer::size_type /*size*/) {
+  UnmapViewOfFile(data);
+}
+
+#endif // __unix__
+
+} // namespace
+
+std::unique_ptr<const Buffer> FileReader::mapFile() {
+#if defined(__unix__) || defined(__APPLE__)
+  using fd_ptr = std::unique_ptr<int, void (*)(const int*)>;
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    ThrowFIE("Could not open file \"%s\".", fileName);
+  fd_ptr fdGuard(&fd, [](const int* f) { close(*f); });
+
+  const size_t fileSize = getFileSize(fd, fileName);
+
+  // Reserve the whole region, including the padding, as zero-filled anonymous
+  // memory first, and then place the file over its beginning. That way the
+  // padding is readable even if the file ends exactly on a page boundary.
+  const size_t mappingSize = getMappingSize(fileSize);
+  void* region = mmap(nullptr, mappingSize, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+    return readFile();
+
+  void* file =
+      mmap(region, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  if (file == MAP_FAILED) {
+    munmap(region, mappingSize);
+    return readFile();
+  }
+
+  return std::make_unique<Buffer>(static_cast<const uchar8*>(file), fileSize,
+                                  &unmapFile, /*mapped=*/true);
+
+#else // __unix__
+
+  auto wFileName = widenFileName(fileName);
+
+  using handle_ptr = std::unique_ptr<std::remove_pointer<HANDLE>::type,
+                                     decltype(&CloseHandle)>;
+  handle_ptr file(CreateFileW(wFileName.data(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr),
+                  &CloseHandle);
+
+  if (file.get() == INVALID_HANDLE_VALUE)
+    ThrowFIE("Could not open file \"%s\".", fileName);
+
+  const size_t fileSize = getFileSize(file.get());
+
+  // The view can not extend past the end of the file, so the padding has to
+  // fit into the unused tail of the last page.
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  if (roundUp(fileSize, si.dwPageSize) - fileSize < BUFFER_PADDING)
+    return readFile();
+
+  handle_ptr mapping(
+      CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr),
+      &CloseHandle);
+  if (!mapping)
+    return readFile();
+
+  // The view keeps the mapping alive, so both handles can be closed now.
+  const void* view = MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0);
+  if (!view)
+    return readFile();
+
+  return std::make_unique<Buffer>(static_cast<const uchar8*>(view), fileSize,
+                                  &unmapFile);
+
+#endif // __unix__
+}
+
+std::unique_ptr<BufferLoader> FileReader::readFileLazily() {
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    ThrowFIE("Could not open file \"%s\".", fileName);
+  std::shared_ptr<const int> file(new int(fd), [](const int* f) {
+    close(*f);
+    delete f;
+  });
+
+  const size_t fileSize = getFileSize(fd, fileName);
+
+  auto read = [file](uchar8* dest, Buffer::size_type offset,
+                     Buffer::size_type count) {
+    while (count > 0) {
+      const auto bytes_read = pread(*file, dest, count, offset);
+      if (bytes_read <= 0)
+        ThrowFIE("Could not read file, %s.",
+                 bytes_read == 0 ? "reached end-of-file" : "file reading error");
+      dest += bytes_read;
+      offset += bytes_read;
+      count -= bytes_read;
+    }
+  };
+
+  return std::make_unique<BufferLoader>(fileSize, read);
+
+#else // __unix__
+
+  auto wFileName = widenFileName(fileName);
+
+  std::shared_ptr<std::remove_pointer<HANDLE>::type> file(
+      CreateFileW(wFileName.data(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                  OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr),
+      &CloseHandle);
+
+  if (file.get() == INVALID_HANDLE_VALUE)
+    ThrowFIE("Could not open file \"%s\".", fileName);
+
+  const size_t fileSize = getFileSize(file.get());
+
+  auto read = [file](uchar8* dest, Buffer::size_type offset,
+                     Buffer::size_type count) {
+    // ReadFile() can read at most 4 GiB at once.
+    while (count > 0) {
+      const DWORD chunk = std::min<Buffer::size_type>(
+          count, std::numeric_limits<DWORD>::max());
+
+      OVERLAPPED ov = {};
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(offset >> 32U);
+
+      DWORD bytes_read;
+      if (!ReadFile(file.get(), dest, chunk, &bytes_read, &ov))
+        ThrowFIE("Could not read file.");
+
+      if (chunk != bytes_read)
+        ThrowFIE("Could not read file.");
+
+      dest += chunk;
+      offset += chunk;
+      count -= chunk;
+    }
+  };
+
+  return std::make_unique<BufferLoader>(fileSize, read);
+
+#endif // __unix__
+}
+
 } // namespace rawspeed
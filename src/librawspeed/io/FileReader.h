@@ -26,6 +26,8 @@ namespace rawspeed {
 
 class Buffer;
 
+class BufferLoader;
+
 class FileReader
 {
   const char* fileName;
@@ -33,7 +35,17 @@ class FileReader
 public:
   explicit FileReader(const char* fileName_) : fileName(fileName_) {}
 
+  // reads the whole file into a newly allocated Buffer.
   std::unique_ptr<const Buffer> readFile();
+
+  // maps the file into memory instead of copying it. The returned Buffer owns
+  // the mapping, and unmaps it when destroyed. Falls back to readFile() if the
+  // file can not be mapped. NOTE: the file must not be truncated while mapped.
+  std::unique_ptr<const Buffer> mapFile();
+
+  // only reads the parts of the file that are actually accessed, on demand.
+  // The file is kept open for the lifetime of the returned BufferLoader.
+  std::unique_ptr<BufferLoader> readFileLazily();
 };
 
 } // namespace rawspeed
@@ -40,7 +40,8 @@ namespace rawspeed {
 FileWriter::FileWriter(const char *_filename) : mFilename(_filename) {}
 
 void FileWriter::writeFile(Buffer* filemap, uint32 size) {
-  if (size > filemap->getSize())
+  // The default, 0, is the whole buffer.
+  if (size == 0 || size > filemap->getSize())
     size = filemap->getSize();
 #if defined(__unix__) || defined(__APPLE__)
   size_t bytes_written = 0;
@@ -51,7 +52,7 @@ void FileWriter::writeFile(Buffer* filemap, uint32 size) {
     ThrowFIE("Could not open file.");
 
   const auto src = filemap->getData(0, filemap->getSize());
-  bytes_written = fwrite(src, 1, size != 0 ? size : filemap->getSize(), file);
+  bytes_written = fwrite(src, 1, size, file);
   fclose(file);
   if (size != bytes_written) {
     ThrowFIE("Could not write file.");
@@ -69,7 +70,7 @@ void FileWriter::writeFile(Buffer* filemap, uint32 size) {
 
   DWORD bytes_written;
   if (!WriteFile(file_h, filemap->getData(0, filemap->getSize()),
-                 size ? size : filemap->getSize(), &bytes_written, nullptr)) {
+                 size, &bytes_written, nullptr)) {
     CloseHandle(file_h);
     ThrowFIE("Could not read file.");
   }
@@ -22,12 +22,20 @@
 #include "metadata/Camera.h"
 #include "common/Common.h"                    // for split_string, uint32
 #include "common/Point.h"                     // for iPoint2D
+#include "io/ByteStream.h"                    // for ByteStream
+#include "metadata/CameraDatabase.h"          // for Writer, getString
 #include "metadata/CameraMetadataException.h" // for ThrowCME
+#include <algorithm>                          // for sort, unique, upper_...
 #include <cctype>                             // for tolower
 #include <cstdio>                             // for size_t
+#include <iterator>                           // for prev
+#include <limits>                             // for numeric_limits
+#include <locale>                             // for locale
 #include <map>                                // for map
+#include <sstream>                            // for istringstream
 #include <stdexcept>                          // for out_of_range
 #include <string>                             // for string, allocator, ope...
+#include <utility>                            // for move
 #include <vector>                             // for vector
 
 #ifdef HAVE_PUGIXML
@@ -41,6 +49,20 @@ using std::map;
 
 namespace rawspeed {
 
+template <typename T> static T parseLeading(const string& str) {
+  std::istringstream iss(str);
+  iss.imbue(std::locale::classic());
+  T v = 0;
+  if (!(iss >> v))
+    v = 0;
+  return v;
+}
+
+Hints::Value::Value(string str_)
+    : str(std::move(str_)), integer(parseLeading<long long>(str)),
+      real(parseLeading<double>(str)), realF(parseLeading<float>(str)),
+      isTrue(str == "true") {}
+
 #ifdef HAVE_PUGIXML
 Camera::Camera(const pugi::xml_node& camera) : cfa(iPoint2D(0, 0)) {
   make = canonical_make = camera.attribute("make").as_string();
@@ -52,7 +74,7 @@ Camera::Camera(const pugi::xml_node& camera) : cfa(iPoint2D(0, 0)) {
   if (!camera.attribute("model")) // (model.empty())
     ThrowCME(R"("model" attribute not found.)");
 
-  canonical_id = make + " " + model;
+  canonical_id = make.get() + " " + model.get();
 
   supported = camera.attribute("supported").as_string("yes") == string("yes");
   mode = camera.attribute("mode").as_string("");
@@ -61,6 +83,8 @@ Camera::Camera(const pugi::xml_node& camera) : cfa(iPoint2D(0, 0)) {
   for (xml_node c : camera.children()) {
     parseCameraChild(c);
   }
+
+  indexSensorInfo();
 }
 #endif
 
@@ -76,6 +100,130 @@ Camera::Camera(const Camera* camera, uint32 alias_num) : cfa(iPoint2D(0,0))
   canonical_aliases.clear();
 }
 
+Camera::Camera(ByteStream* record) : cfa(iPoint2D(0, 0)) {
+  using CameraDatabase::getString;
+
+  const auto getInt = [record]() { return static_cast<int>(record->getU32()); };
+  const auto getStrings = [record]() {
+    vector<string> strings(record->getU32());
+    for (auto& str : strings)
+      str = getString(record);
+    return strings;
+  };
+
+  make = getString(record);
+  model = getString(record);
+  mode = getString(record);
+  canonical_make = getString(record);
+  canonical_model = getString(record);
+  canonical_alias = getString(record);
+  canonical_id = getString(record);
+  aliases = getStrings();
+  canonical_aliases = getStrings();
+  if (aliases.size() != canonical_aliases.size())
+    ThrowCME("Camera %s %s: aliases do not match", make.c_str(), model.c_str());
+
+  const int cfaWidth = getInt();
+  const int cfaHeight = getInt();
+  if (cfaWidth < 0 || cfaHeight < 0 || cfaWidth > 64 || cfaHeight > 64)
+    ThrowCME("Camera %s %s: bad CFA size", make.c_str(), model.c_str());
+  cfa.setSize(iPoint2D(cfaWidth, cfaHeight));
+  for (int y = 0; y < cfaHeight; y++) {
+    for (int x = 0; x < cfaWidth; x++) {
+      const auto c = static_cast<CFAColor>(record->getByte());
+      if (c >= CFA_END && c != CFA_UNKNOWN)
+        ThrowCME("Camera %s %s: bad CFA color", make.c_str(), model.c_str());
+      cfa.setColorAt(iPoint2D(x, y), c);
+    }
+  }
+
+  supported = record->getU32() != 0;
+  cropSize.x = getInt();
+  cropSize.y = getInt();
+  cropPos.x = getInt();
+  cropPos.y = getInt();
+
+  for (uint32 i = record->getU32(); i > 0; i--) {
+    const int offset = getInt();
+    const int size = getInt();
+    blackAreas.emplace_back(offset, size, record->getU32() != 0);
+  }
+
+  for (uint32 i = record->getU32(); i > 0; i--) {
+    const int black = getInt();
+    const int white = getInt();
+    const int minIso = getInt();
+    const int maxIso = getInt();
+    vector<int> blackColors(record->getU32());
+    for (int& b : blackColors)
+      b = getInt();
+    sensorInfo.emplace_back(black, white, minIso, maxIso, blackColors);
+  }
+
+  indexSensorInfo();
+
+  decoderVersion = getInt();
+
+  for (uint32 i = record->getU32(); i > 0; i--) {
+    const string key = getString(record);
+    hints.add(key, getString(record));
+  }
+}
+
+void Camera::serialize(CameraDatabase::Writer* out) const {
+  const auto putStrings = [out](const vector<string>& strings) {
+    out->putU32(strings.size());
+    for (const auto& str : strings)
+      out->putString(str);
+  };
+
+  for (const InternedString* str :
+       {&make, &model, &mode, &canonical_make, &canonical_model,
+        &canonical_alias, &canonical_id})
+    out->putString(*str);
+  putStrings(aliases);
+  putStrings(canonical_aliases);
+
+  const iPoint2D cfaSize = cfa.getSize();
+  out->putU32(cfaSize.x);
+  out->putU32(cfaSize.y);
+  vector<uchar8> colors;
+  for (int y = 0; y < cfaSize.y; y++) {
+    for (int x = 0; x < cfaSize.x; x++)
+      colors.emplace_back(cfa.getColorAt(x, y));
+  }
+  out->putBytes(colors);
+
+  out->putU32(supported);
+  for (int v : {cropSize.x, cropSize.y, cropPos.x, cropPos.y})
+    out->putU32(v);
+
+  out->putU32(blackAreas.size());
+  for (const auto& area : blackAreas) {
+    out->putU32(area.offset);
+    out->putU32(area.size);
+    out->putU32(area.isVertical);
+  }
+
+  out->putU32(sensorInfo.size());
+  for (const auto& info : sensorInfo) {
+    for (int v : {info.mBlackLevel, info.mWhiteLevel, info.mMinIso,
+                  info.mMaxIso})
+      out->putU32(v);
+    out->putU32(info.mBlackLevelSeparate.size());
+    for (int b : info.mBlackLevelSeparate)
+      out->putU32(b);
+  }
+
+  out->putU32(decoderVersion);
+
+  out->putU32(hints.getAll().size());
+  for (const auto& hint : hints.getAll()) {
+    out->putString(hint.first);
+    out->putString(hint.second.str);
+  }
+}
+
 #ifdef HAVE_PUGIXML
 static string name(const xml_node &a) {
   return string(a.name());
@@ -304,6 +452,48 @@ void Camera::parseCameraChild(const xml_node &cur) {
 }
 #endif
 
+int Camera::findSensorInfo(int iso) const {
+  vector<int> candidates;
+  for (auto i = 0UL; i < sensorInfo.size(); i++) {
+    if (sensorInfo[i].isIsoWithin(iso))
+      candidates.push_back(i);
+  }
+
+  if (candidates.empty())
+    return -1;
+
+  if (candidates.size() == 1)
+    return candidates.front();
+
+  for (int i : candidates) {
+    if (!sensorInfo[i].isDefault())
+      return i;
+  }
+
+  // Several defaults??? Just return first
+  return candidates.front();
+}
+
+void Camera::indexSensorInfo() {
+  // The choice can only change where some entry starts, or right after one
+  // ends, so it is made once for each of these ranges of the ISO.
+  vector<int> starts = {std::numeric_limits<int>::min()};
+  for (const auto& info : sensorInfo) {
+    starts.push_back(info.mMinIso);
+    if (info.mMaxIso != 0 && info.mMaxIso < std::numeric_limits<int>::max())
+      starts.push_back(info.mMaxIso + 1);
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+  sensorIndex.clear();
+  for (int iso : starts) {
+    const int i = findSensorInfo(iso);
+    if (sensorIndex.empty() || sensorIndex.back().second != i)
+      sensorIndex.emplace_back(iso, i);
+  }
+}
+
 const CameraSensorInfo* Camera::getSensorInfo(int iso) const {
   if (sensorInfo.empty()) {
     ThrowCME("Camera '%s' '%s', mode '%s' has no <Sensor> entries.",
@@ -314,22 +504,17 @@ const CameraSensorInfo* Camera::getSensorInfo(int iso) const {
   if (sensorInfo.size() == 1)
     return &sensorInfo.front();
 
-  vector<const CameraSensorInfo*> candidates;
-  for (auto& i : sensorInfo) {
-    if (i.isIsoWithin(iso))
-      candidates.push_back(&i);
-  }
-
-  if (candidates.size() == 1)
-    return candidates.front();
-
-  for (auto i : candidates) {
-    if (!i->isDefault())
-      return i;
+  // The last range that starts at, or before, this ISO. The first one starts
+  // at the lowest int, so there always is one.
+  auto range = std::upper_bound(
+      sensorIndex.cbegin(), sensorIndex.cend(), iso,
+      [](int v, const std::pair<int, int>& r) { return v < r.first; });
+  if (range == sensorIndex.cbegin() || std::prev(range)->second < 0) {
+    ThrowCME("Camera '%s' '%s', mode '%s' has no <Sensor> entry for ISO %i.",
+             make.c_str(), model.c_str(), mode.c_str(), iso);
   }
 
-  // Several defaults??? Just return first
-  return candidates.front();
+  return &sensorInfo[std::prev(range)->second];
 }
 
 } // namespace rawspeed
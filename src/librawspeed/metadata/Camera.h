@@ -22,13 +22,17 @@
 
 #include "rawspeedconfig.h"
 #include "common/Common.h"             // for uint32
+#include "common/InternedString.h"     // for InternedString
 #include "common/Point.h"              // for iPoint2D
 #include "metadata/BlackArea.h"        // for BlackArea
 #include "metadata/CameraSensorInfo.h" // for CameraSensorInfo
 #include "metadata/ColorFilterArray.h" // for ColorFilterArray
+#include <algorithm>                   // for max
+#include <functional>                  // for less
+#include <limits>                      // for numeric_limits
 #include <map>                         // for map, _Rb_tree_const_iterator
-#include <sstream>                     // for istringstream, basic_istream
-#include <string>                      // for string, basic_string, operator>>
+#include <string>                      // for string, basic_string
+#include <type_traits>                 // for enable_if_t, is_integral
 #include <utility>                     // for pair
 #include <vector>                      // for vector
 
@@ -42,36 +46,90 @@ class xml_node;
 
 namespace rawspeed {
 
+class ByteStream;
+
+namespace CameraDatabase {
+class Writer;
+} // namespace CameraDatabase
+
 class Hints
 {
-  std::map<std::string, std::string> data;
 public:
-  void add(const std::string& key, const std::string& value)
-  {
-    data.insert({key, value});
+  // The value of a hint, parsed once when it is added, so that the lookups
+  // neither allocate nor depend on the locale.
+  struct Value {
+    explicit Value(std::string str_);
+
+    std::string str;
+    // As the numbers at the start of the string, with the "C" locale, or 0.
+    long long integer;
+    double real;
+    float realF;
+    bool isTrue;
+  };
+
+private:
+  // The transparent comparator allows looking the literal keys up without
+  // constructing strings from them.
+  std::map<std::string, Value, std::less<>> data;
+
+  static void convert(const Value& value, std::string* out) {
+    *out = value.str;
   }
+  static void convert(const Value& value, float* out) { *out = value.realF; }
+  static void convert(const Value& value, double* out) { *out = value.real; }
 
-  bool has(const std::string& key) const
-  {
-    return data.find(key) != data.end();
+  // Saturated to the range of the type.
+  template <typename T>
+  static std::enable_if_t<std::is_integral<T>::value>
+  convert(const Value& value, T* out) {
+    using limits = std::numeric_limits<T>;
+    const long long v = value.integer;
+    if (v < 0)
+      *out = std::is_signed<T>::value
+                 ? static_cast<T>(std::max<long long>(v, limits::min()))
+                 : 0;
+    else
+      *out = static_cast<unsigned long long>(v) >
+                     static_cast<unsigned long long>(limits::max())
+                 ? limits::max()
+                 : static_cast<T>(v);
   }
 
-  template <typename T>
-  T get(const std::string& key, T defaultValue) const
+public:
+  void add(const std::string& key, const std::string& value)
   {
+    data.emplace(key, Value(value));
+  }
+
+  bool has(const char* key) const { return data.find(key) != data.end(); }
+  bool has(const std::string& key) const { return has(key.c_str()); }
+
+  template <typename T> T get(const char* key, T defaultValue) const {
     auto hint = data.find(key);
-    if (hint != data.end() && !hint->second.empty()) {
-      std::istringstream iss(hint->second);
-      iss >> defaultValue;
-    }
+    if (hint != data.end() && !hint->second.str.empty())
+      convert(hint->second, &defaultValue);
     return defaultValue;
   }
 
-  bool get(const std::string& key, bool defaultValue) const {
+  template <typename T>
+  T get(const std::string& key, T defaultValue) const {
+    return get(key.c_str(), defaultValue);
+  }
+
+  bool get(const char* key, bool defaultValue) const {
     auto hint = data.find(key);
     if (hint == data.end())
       return defaultValue;
-    return "true" == hint->second;
+    return hint->second.isTrue;
+  }
+
+  bool get(const std::string& key, bool defaultValue) const {
+    return get(key.c_str(), defaultValue);
+  }
+
+  const std::map<std::string, Value, std::less<>>& getAll() const {
+    return data;
   }
 };
 
@@ -83,14 +141,19 @@ public:
 #endif
 
   Camera(const Camera* camera, uint32 alias_num);
+
+  // From, and to, the record of the binary camera database.
+  explicit Camera(ByteStream* record);
+  void serialize(CameraDatabase::Writer* out) const;
+
   const CameraSensorInfo* getSensorInfo(int iso) const;
-  std::string make;
-  std::string model;
-  std::string mode;
-  std::string canonical_make;
-  std::string canonical_model;
-  std::string canonical_alias;
-  std::string canonical_id;
+  InternedString make;
+  InternedString model;
+  InternedString mode;
+  InternedString canonical_make;
+  InternedString canonical_model;
+  InternedString canonical_alias;
+  InternedString canonical_id;
   std::vector<std::string> aliases;
   std::vector<std::string> canonical_aliases;
   ColorFilterArray cfa;
@@ -105,6 +168,13 @@ protected:
   static const std::map<char, CFAColor> char2enum;
   static const std::map<std::string, CFAColor> str2enum;
 
+  // The sensor info as the function of the ISO: from the ISO of each entry,
+  // up to the next one, the index into sensorInfo, or -1 if there is none.
+  std::vector<std::pair<int, int>> sensorIndex;
+
+  int __attribute__((pure)) findSensorInfo(int iso) const;
+  void indexSensorInfo();
+
 #ifdef HAVE_PUGIXML
   void parseCFA(const pugi::xml_node &node);
   void parseCrop(const pugi::xml_node &node);
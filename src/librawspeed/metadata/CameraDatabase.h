@@ -0,0 +1,78 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uchar8, uint32
+#include "io/ByteStream.h" // for ByteStream
+#include <string>          // for string
+#include <utility>         // for move
+#include <vector>          // for vector
+
+namespace rawspeed {
+
+// The binary form of cameras.xml, which can be loaded without pugixml,
+// straight from memory. It is produced from the parsed cameras.xml by
+// CameraMetaData::serialize(), e.g. by the rs-camdb utility at build time.
+//
+// All the numbers are little-endian uint32, except for the CFA colors, which
+// are one byte each, and the strings are prefixed by their length. The file
+// is:
+//   the magic, the version, the number of cameras, and then for each camera,
+//   its make, model and mode, the size of its record, and the record itself,
+//   as written by Camera::serialize().
+// The keys come before each record, so that the cameras can be indexed
+// without decoding the records, and only be materialized when looked up.
+namespace CameraDatabase {
+
+constexpr uint32 Magic = 0x44435352; // "RSCD"
+constexpr uint32 Version = 1;
+
+class Writer final {
+  std::vector<uchar8> out;
+
+public:
+  void putU32(uint32 v) {
+    for (int i = 0; i < 4; i++)
+      out.emplace_back(v >> (8 * i));
+  }
+
+  void putString(const std::string& s) {
+    putU32(s.size());
+    out.insert(out.end(), s.begin(), s.end());
+  }
+
+  void putBytes(const std::vector<uchar8>& bytes) {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+  }
+
+  const std::vector<uchar8>& data() const { return out; }
+  std::vector<uchar8> release() { return std::move(out); }
+};
+
+inline std::string getString(ByteStream* bs) {
+  const uint32 size = bs->getU32();
+  const auto* s = reinterpret_cast<const char*>(bs->getData(size));
+  return std::string(s, size);
+}
+
+} // namespace CameraDatabase
+
+} // namespace rawspeed
@@ -0,0 +1,167 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "metadata/CameraIndex.h"
+#include "common/Common.h"  // for uint32, uint64
+#include <algorithm>        // for equal, max
+#include <cassert>          // for assert
+#include <initializer_list> // for initializer_list
+#include <utility>          // for move
+
+using std::string;
+
+namespace rawspeed {
+
+namespace {
+
+// A view of the string without the surrounding spaces, as trimSpaces() would
+// return it.
+struct Trimmed {
+  const char* data;
+  size_t size;
+
+  explicit Trimmed(const string& str) : data(str.data()), size(0) {
+    const size_t startpos = str.find_first_not_of(" \t");
+    const size_t endpos = str.find_last_not_of(" \t");
+    if (startpos == string::npos || endpos == string::npos)
+      return;
+    data += startpos;
+    size = endpos - startpos + 1;
+  }
+
+  bool operator==(const string& rhs) const {
+    return size == rhs.size() && std::equal(data, data + size, rhs.data());
+  }
+};
+
+// FNV-1a, of the fields separated by a zero byte.
+size_t hashOf(std::initializer_list<Trimmed> fields) {
+  uint64 hash = 0xcbf29ce484222325ULL;
+  for (const Trimmed& field : fields) {
+    for (size_t i = 0; i < field.size; i++) {
+      hash ^= static_cast<unsigned char>(field.data[i]);
+      hash *= 0x100000001b3ULL;
+    }
+    hash *= 0x100000001b3ULL;
+  }
+  return static_cast<size_t>(hash);
+}
+
+template <typename Slot> void place(std::vector<Slot>* slots, Slot slot) {
+  const size_t mask = slots->size() - 1;
+  size_t i = slot.hash & mask;
+  while ((*slots)[i].entry != 0)
+    i = (i + 1) & mask;
+  (*slots)[i] = slot;
+}
+
+} // namespace
+
+void CameraIndex::insert(const CameraId& id, const Camera* camera) {
+  assert(!find(id.make, id.model, id.mode));
+
+  if (2 * (entries.size() + 1) > slots.size())
+    rehash(std::max<size_t>(16, 2 * slots.size()));
+
+  Hashed e;
+  e.id = id;
+  e.camera = camera;
+  e.hash = hashOf({Trimmed(id.make), Trimmed(id.model), Trimmed(id.mode)});
+  e.modelHash = hashOf({Trimmed(id.make), Trimmed(id.model)});
+  entries.emplace_back(std::move(e));
+
+  const auto entry = static_cast<uint32>(entries.size() - 1);
+  place(&slots, {entries.back().hash, entry + 1});
+  insertModel(entry);
+}
+
+void CameraIndex::rehash(size_t size) {
+  slots.assign(size, {0, 0});
+  modelSlots.assign(size, {0, 0});
+
+  for (uint32 entry = 0; entry < entries.size(); entry++) {
+    place(&slots, {entries[entry].hash, entry + 1});
+    insertModel(entry);
+  }
+}
+
+void CameraIndex::insertModel(uint32 entry) {
+  const Hashed& e = entries[entry];
+  const size_t mask = modelSlots.size() - 1;
+  for (size_t i = e.modelHash & mask;; i = (i + 1) & mask) {
+    Slot& slot = modelSlots[i];
+    if (slot.entry == 0) {
+      slot = {e.modelHash, entry + 1};
+      return;
+    }
+
+    const Hashed& other = entries[slot.entry - 1];
+    if (slot.hash != e.modelHash || other.id.make != e.id.make ||
+        other.id.model != e.id.model)
+      continue;
+
+    if (e.id.mode < other.id.mode)
+      slot.entry = entry + 1;
+    return;
+  }
+}
+
+CameraIndex::Entry* CameraIndex::find(const string& make, const string& model,
+                                      const string& mode) {
+  if (slots.empty())
+    return nullptr;
+
+  const Trimmed k0(make);
+  const Trimmed k1(model);
+  const Trimmed k2(mode);
+  const size_t hash = hashOf({k0, k1, k2});
+
+  const size_t mask = slots.size() - 1;
+  for (size_t i = hash & mask; slots[i].entry != 0; i = (i + 1) & mask) {
+    if (slots[i].hash != hash)
+      continue;
+    Hashed& e = entries[slots[i].entry - 1];
+    if (k0 == e.id.make && k1 == e.id.model && k2 == e.id.mode)
+      return &e;
+  }
+  return nullptr;
+}
+
+CameraIndex::Entry* CameraIndex::find(const string& make,
+                                      const string& model) {
+  if (modelSlots.empty())
+    return nullptr;
+
+  const Trimmed k0(make);
+  const Trimmed k1(model);
+  const size_t hash = hashOf({k0, k1});
+
+  const size_t mask = modelSlots.size() - 1;
+  for (size_t i = hash & mask; modelSlots[i].entry != 0; i = (i + 1) & mask) {
+    if (modelSlots[i].hash != hash)
+      continue;
+    Hashed& e = entries[modelSlots[i].entry - 1];
+    if (k0 == e.id.make && k1 == e.id.model)
+      return &e;
+  }
+  return nullptr;
+}
+
+} // namespace rawspeed
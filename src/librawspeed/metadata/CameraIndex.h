@@ -0,0 +1,88 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uint32
+#include <cstddef>         // for size_t
+#include <string>          // for string
+#include <tuple>           // for tie
+#include <vector>          // for vector
+
+namespace rawspeed {
+
+class Camera;
+
+struct CameraId {
+  std::string make;
+  std::string model;
+  std::string mode;
+
+  bool operator<(const CameraId& rhs) const {
+    return std::tie(make, model, mode) <
+           std::tie(rhs.make, rhs.model, rhs.mode);
+  }
+};
+
+// The open-addressed hash index of the cameras, by their make, model and
+// mode, and by just their make and model. The keys are looked up as they
+// come from the files, with the surrounding spaces, but they are trimmed
+// while hashing and comparing, so the lookups do not allocate.
+class CameraIndex final {
+public:
+  struct Entry {
+    CameraId id;
+    // Until the camera is decoded from the binary database, nullptr.
+    const Camera* camera;
+  };
+
+  // The id must already be trimmed, and must not be in the index yet.
+  void insert(const CameraId& id, const Camera* camera);
+
+  Entry* find(const std::string& make, const std::string& model,
+              const std::string& mode);
+
+  // The camera with the lowest mode, as the std::map of them would give.
+  Entry* find(const std::string& make, const std::string& model);
+
+  size_t size() const { return entries.size(); }
+
+private:
+  struct Slot {
+    size_t hash;
+    // The index of the entry, plus one. 0 if the slot is free.
+    uint32 entry;
+  };
+
+  struct Hashed : Entry {
+    size_t hash;
+    size_t modelHash;
+  };
+
+  std::vector<Hashed> entries;
+  // The sizes are powers of two, at least twice the number of the entries.
+  std::vector<Slot> slots;
+  std::vector<Slot> modelSlots;
+
+  void rehash(size_t size);
+  void insertModel(uint32 entry);
+};
+
+} // namespace rawspeed
@@ -20,9 +20,11 @@
 
 #include "metadata/CameraMetaData.h"
 #include "common/Common.h"                    // for uint32, trimSpaces
+#include "common/Mutex.h"                     // for MutexLocker
+#include "io/IOException.h"                   // for IOException
 #include "metadata/Camera.h"                  // for Camera
+#include "metadata/CameraDatabase.h"          // for Magic, Version, Writer
 #include "metadata/CameraMetadataException.h" // for ThrowCME
-#include <algorithm>                          // for find_if
 #include <map>                                // for _Rb_tree_iterator, map
 #include <string>                             // for string, operator==
 #include <utility>                            // for pair
@@ -41,6 +43,8 @@ namespace rawspeed {
 
 #ifdef HAVE_PUGIXML
 CameraMetaData::CameraMetaData(const char *docname) {
+  MutexLocker guard(&mutex);
+
   xml_document doc;
 
 #if defined(__unix__) || defined(__APPLE__)
@@ -69,6 +73,99 @@ CameraMetaData::CameraMetaData(const char *docname) {
 }
 #endif
 
+CameraMetaData::CameraMetaData(Buffer database_)
+    : database(std::move(database_)) {
+  using CameraDatabase::getString;
+
+  MutexLocker guard(&mutex);
+
+  try {
+    ByteStream bs(DataBuffer(database, Endianness::little));
+    if (bs.getU32() != CameraDatabase::Magic)
+      ThrowCME("Not a camera database");
+    if (bs.getU32() != CameraDatabase::Version)
+      ThrowCME("Unsupported camera database version");
+
+    for (uint32 i = bs.getU32(); i > 0; i--) {
+      CameraId id;
+      id.make = getString(&bs);
+      id.model = getString(&bs);
+      id.mode = getString(&bs);
+      const uint32 size = bs.getU32();
+      ByteStream record = bs.getStream(size);
+
+      // The CHDK cameras are looked up by the file size hint, so they are
+      // all needed right away. There are only a few of them.
+      if (string::npos != id.mode.find("chdk")) {
+        addCamera(std::make_unique<Camera>(&record));
+        continue;
+      }
+
+      if (!pending.emplace(id, record).second)
+        ThrowCME("Duplicate camera in the database");
+      index.insert(id, nullptr);
+    }
+  } catch (IOException& e) {
+    ThrowCME("Camera database is truncated: %s", e.what());
+  }
+}
+
+std::vector<uchar8> CameraMetaData::serialize() const {
+  MutexLocker guard(&mutex);
+
+  for (auto it = pending.cbegin(); it != pending.cend();)
+    materialize((it++)->first);
+
+  CameraDatabase::Writer out;
+  out.putU32(CameraDatabase::Magic);
+  out.putU32(CameraDatabase::Version);
+  out.putU32(cameras.size());
+  for (const auto& cam : cameras) {
+    CameraDatabase::Writer record;
+    cam.second->serialize(&record);
+
+    out.putString(cam.first.make);
+    out.putString(cam.first.model);
+    out.putString(cam.first.mode);
+    out.putU32(record.data().size());
+    out.putBytes(record.data());
+  }
+  return out.release();
+}
+
+void CameraMetaData::materialize(const CameraId& id) const {
+  auto it = pending.find(id);
+  if (it == pending.end())
+    return;
+
+  try {
+    ByteStream record = it->second;
+    auto& cam = cameras[id];
+    cam = std::make_unique<Camera>(&record);
+    index.find(id.make, id.model, id.mode)->camera = cam.get();
+  } catch (IOException& e) {
+    ThrowCME("Camera database is truncated: %s", e.what());
+  }
+  pending.erase(it);
+}
+
+void CameraMetaData::materialize(const string& make,
+                                 const string* model) const {
+  for (auto it = pending.cbegin(); it != pending.cend();) {
+    const CameraId& id = (it++)->first;
+    if (id.make == make && (!model || id.model == *model))
+      materialize(id);
+  }
+}
+
+void CameraMetaData::materializeAll() const {
+  MutexLocker guard(&mutex);
+  while (!pending.empty()) {
+    const CameraId id = pending.begin()->first;
+    materialize(id);
+  }
+}
+
 static inline CameraId getId(const string& make, const string& model,
                              const string& mode) {
   CameraId id;
@@ -81,25 +178,28 @@ static inline CameraId getId(const string& make, const string& model,
 
 const Camera* CameraMetaData::getCamera(const string& make, const string& model,
                                         const string& mode) const {
-  auto camera = cameras.find(getId(make, model, mode));
-  return camera == cameras.end() ? nullptr : camera->second.get();
+  MutexLocker guard(&mutex);
+
+  auto* entry = index.find(make, model, mode);
+  if (!entry)
+    return nullptr;
+
+  if (!entry->camera)
+    materialize(entry->id);
+  return entry->camera;
 }
 
 const Camera* CameraMetaData::getCamera(const string& make,
                                         const string& model) const {
-  auto id = getId(make, model, "");
-
-  auto iter = find_if(cameras.cbegin(), cameras.cend(),
-                      [&id](decltype(*cameras.cbegin())& i) -> bool {
-                        const auto& cid = i.first;
-                        return tie(id.make, id.model) ==
-                               tie(cid.make, cid.model);
-                      });
+  MutexLocker guard(&mutex);
 
-  if (iter == cameras.end())
+  auto* entry = index.find(make, model);
+  if (!entry)
     return nullptr;
 
-  return iter->second.get();
+  if (!entry->camera)
+    materialize(entry->id);
+  return entry->camera;
 }
 
 bool CameraMetaData::hasCamera(const string& make, const string& model,
@@ -128,8 +228,9 @@ const Camera* CameraMetaData::addCamera(std::unique_ptr<Camera> cam) {
     return nullptr;
   }
   cameras[id] = std::move(cam);
+  index.insert(id, cameras[id].get());
 
-  if (string::npos != cameras[id]->mode.find("chdk")) {
+  if (string::npos != cameras[id]->mode.get().find("chdk")) {
     auto filesize_hint = cameras[id]->hints.get("filesize", string());
     if (filesize_hint.empty()) {
       writeLog(DEBUG_PRIO_WARNING,
@@ -145,6 +246,9 @@ const Camera* CameraMetaData::addCamera(std::unique_ptr<Camera> cam) {
 }
 
 void CameraMetaData::disableMake(const string &make) {
+  MutexLocker guard(&mutex);
+  materialize(make, nullptr);
+
   for (const auto& cam : cameras) {
     if (cam.second->make == make)
       cam.second->supported = false;
@@ -152,6 +256,9 @@ void CameraMetaData::disableMake(const string &make) {
 }
 
 void CameraMetaData::disableCamera(const string &make, const string &model) {
+  MutexLocker guard(&mutex);
+  materialize(make, &model);
+
   for (const auto& cam : cameras) {
     if (cam.second->make == make && cam.second->model == model)
       cam.second->supported = false;
@@ -21,28 +21,25 @@
 #pragma once
 
 #include "rawspeedconfig.h"
-#include "common/Common.h"   // for uint32
-#include "metadata/Camera.h" // for Camera
-#include <map>               // for map
-#include <memory>            // for unique_ptr
-#include <string>            // for string
-#include <tuple>             // for tuple
+#include "common/Common.h"        // for uint32, uchar8
+#include "common/Mutex.h"         // for Mutex
+#include "io/Buffer.h"            // for Buffer
+#include "io/ByteStream.h"        // for ByteStream
+#include "metadata/Camera.h"      // for Camera
+#include "metadata/CameraIndex.h" // for CameraId, CameraIndex
+#include <map>                    // for map
+#include <memory>                 // for unique_ptr
+#include <string>                 // for string
+#include <vector>                 // for vector
 
 namespace rawspeed {
 
 class Camera;
 
-struct CameraId {
-  std::string make;
-  std::string model;
-  std::string mode;
-
-  bool operator<(const CameraId& rhs) const {
-    return std::tie(make, model, mode) <
-           std::tie(rhs.make, rhs.model, rhs.mode);
-  }
-};
-
+// The const lookups are safe to call from several threads at once. The
+// non-const members, e.g. disableMake() and disableCamera(), are not, and
+// are meant for setting it up, before it is shared; see CameraMetaDataStore
+// for replacing the whole database while it is in use.
 class CameraMetaData final {
 public:
   CameraMetaData() = default;
@@ -51,7 +48,17 @@ public:
   explicit CameraMetaData(const char* docname);
 #endif
 
-  std::map<CameraId, std::unique_ptr<Camera>> cameras;
+  // From the binary database, see CameraDatabase.h. Only its index is read
+  // here, the cameras are decoded when they are first looked up. If the
+  // database does not own its memory, e.g. when it is memory-mapped or linked
+  // in, that memory must outlive this.
+  explicit CameraMetaData(Buffer database);
+
+  // The binary database of all of the cameras.
+  std::vector<uchar8> serialize() const;
+
+  // With a binary database, only the cameras that were looked up so far.
+  mutable std::map<CameraId, std::unique_ptr<Camera>> cameras;
   std::map<uint32,Camera*> chdkCameras;
 
   // searches for camera with given make + model + mode
@@ -66,11 +73,29 @@ public:
                  const std::string& mode) const;
   const Camera* __attribute__((pure)) getChdkCamera(uint32 filesize) const;
   bool __attribute__((pure)) hasChdkCamera(uint32 filesize) const;
+  // With a binary database, decodes all of the cameras now, rather than
+  // each of them when it is first looked up, see prewarm().
+  void materializeAll() const;
+
   void disableMake(const std::string &make);
   void disableCamera(const std::string &make, const std::string &model);
 
 protected:
-  const Camera* addCamera(std::unique_ptr<Camera> cam);
+  const Camera* addCamera(std::unique_ptr<Camera> cam) REQUIRES(mutex);
+
+  // The not yet decoded records of the binary database.
+  Buffer database;
+  mutable Mutex mutex;
+  mutable std::map<CameraId, ByteStream> pending GUARDED_BY(mutex);
+
+  // Of all the cameras, including the pending ones.
+  mutable CameraIndex index GUARDED_BY(mutex);
+
+  // Decodes the pending camera with this id, if there is one.
+  void materialize(const CameraId& id) const REQUIRES(mutex);
+  // Decodes all the pending cameras of this make, and model, if given.
+  void materialize(const std::string& make, const std::string* model) const
+      REQUIRES(mutex);
 };
 
 } // namespace rawspeed
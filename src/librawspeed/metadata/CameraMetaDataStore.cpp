@@ -0,0 +1,41 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "metadata/CameraMetaDataStore.h"
+#include "metadata/CameraMetaData.h" // IWYU pragma: keep
+#include <atomic>                    // for atomic_load, atomic_store
+#include <utility>                   // for move
+
+namespace rawspeed {
+
+CameraMetaDataStore::CameraMetaDataStore(
+    std::shared_ptr<const CameraMetaData> meta)
+    : current(std::move(meta)), version(current ? 1 : 0) {}
+
+std::shared_ptr<const CameraMetaData> CameraMetaDataStore::get() const {
+  return std::atomic_load(&current);
+}
+
+void CameraMetaDataStore::publish(std::shared_ptr<const CameraMetaData> meta) {
+  std::atomic_store(&current, std::move(meta));
+  version++;
+}
+
+} // namespace rawspeed
@@ -0,0 +1,64 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uint64
+#include <atomic>          // for atomic
+#include <memory>          // for shared_ptr
+
+namespace rawspeed {
+
+class CameraMetaData;
+
+// Holds the current version of the camera database for a long-running
+// service, so that it can be replaced while files are being decoded.
+//
+// A decode takes a snapshot via get(), and passes the snapshot's pointer to
+// the decoders; the snapshot stays valid for as long as it is held, even if
+// publish() replaces the database meanwhile. The old version is freed when
+// its last snapshot is released.
+//
+// The published database must be fully set up (e.g. disableMake() and
+// disableCamera() must already be applied), because it is shared as const:
+// its lookups may run concurrently with each other, but nothing may mutate
+// it anymore.
+class CameraMetaDataStore final {
+  std::shared_ptr<const CameraMetaData> current;
+  std::atomic<uint64> version{0};
+
+public:
+  CameraMetaDataStore() = default;
+  explicit CameraMetaDataStore(std::shared_ptr<const CameraMetaData> meta);
+
+  CameraMetaDataStore(const CameraMetaDataStore&) = delete;
+  CameraMetaDataStore& operator=(const CameraMetaDataStore&) = delete;
+
+  // The current database, or nullptr if none was published yet.
+  std::shared_ptr<const CameraMetaData> get() const;
+
+  // Replaces the database for the subsequent get()s.
+  void publish(std::shared_ptr<const CameraMetaData> meta);
+
+  // How many times the database was published, e.g. for logging.
+  uint64 getVersion() const { return version.load(); }
+};
+
+} // namespace rawspeed
@@ -22,7 +22,7 @@
 #include "common/Common.h"                // for writeLog, uint32, DEBUG_PR...
 #include "common/Point.h"                 // for iPoint2D, iPoint2D::value_...
 #include "decoders/RawDecoderException.h" // for ThrowRDE
-#include <algorithm>                      // for fill
+#include <algorithm>                      // for fill, rotate
 #include <cmath>                          // for abs
 #include <cstdarg>                        // for va_arg, va_end, va_list
 #include <cstdlib>                        // for size_t, abs
@@ -89,17 +89,13 @@ void ColorFilterArray::shiftLeft(int n) {
     ThrowRDE("No CFA size set (or set to zero)");
 
   writeLog(DEBUG_PRIO_EXTRA, "Shift left:%d", n);
-  n %= size.x;
+  n = (n % size.x + size.x) % size.x;
   if (n == 0)
     return;
 
-  vector<CFAColor> tmp(size.area());
-  for (int y = 0; y < size.y; ++y) {
-    for (int x = 0; x < size.x; ++x) {
-      tmp[x + static_cast<size_t>(y) * size.x] = getColorAt(x + n, y);
-    }
-  }
-  cfa = tmp;
+  // Each row, in place.
+  for (auto row = cfa.begin(); row != cfa.end(); row += size.x)
+    std::rotate(row, row + n, row + size.x);
 }
 
 void ColorFilterArray::shiftDown(int n) {
@@ -107,16 +103,13 @@ void ColorFilterArray::shiftDown(int n) {
     ThrowRDE("No CFA size set (or set to zero)");
 
   writeLog(DEBUG_PRIO_EXTRA, "Shift down:%d", n);
-  n %= size.y;
+  n = (n % size.y + size.y) % size.y;
   if (n == 0)
     return;
-  vector<CFAColor> tmp(size.area());
-  for (int y = 0; y < size.y; ++y) {
-    for (int x = 0; x < size.x; ++x) {
-      tmp[x + static_cast<size_t>(y) * size.x] = getColorAt(x, y + n);
-    }
-  }
-  cfa = tmp;
+
+  // The rows, in place.
+  std::rotate(cfa.begin(), cfa.begin() + static_cast<size_t>(n) * size.x,
+              cfa.end());
 }
 
 string ColorFilterArray::asString() const {
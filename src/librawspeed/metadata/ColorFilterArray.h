@@ -20,11 +20,13 @@
 
 #pragma once
 
-#include "common/Common.h" // for uint32
-#include "common/Point.h"  // for iPoint2D
-#include <map>             // for map
-#include <string>          // for string
-#include <vector>          // for vector
+#include "common/Common.h"                // for uint32
+#include "common/Point.h"                 // for iPoint2D
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include <array>                          // for array
+#include <map>                            // for map
+#include <string>                         // for string
+#include <vector>                         // for vector
 
 namespace rawspeed {
 
@@ -71,6 +73,42 @@ protected:
   static const std::map<CFAColor, std::string> color2String;
 };
 
+// The CFA of a known size, for the per-pixel loops: set up once, from the
+// ColorFilterArray, and then looked up without the size checks, and with the
+// constant divisors, i.e. with masks for the Bayer one.
+template <int W, int H> class CFAPattern final {
+  static_assert(W > 0 && H > 0, "the pattern can not be empty");
+
+  std::array<CFAColor, W * H> colors;
+
+  template <int N> static int positiveModulo(int v) {
+    if ((N & (N - 1)) == 0)
+      return v & (N - 1);
+    v %= N;
+    return v < 0 ? v + N : v;
+  }
+
+public:
+  explicit CFAPattern(const ColorFilterArray& cfa) {
+    if (cfa.getSize() != iPoint2D(W, H)) {
+      ThrowRDE("Expected a %ix%i CFA, got: %s", W, H,
+               cfa.asString().c_str());
+    }
+
+    for (int y = 0; y < H; y++) {
+      for (int x = 0; x < W; x++)
+        colors[x + y * W] = cfa.getColorAt(x, y);
+    }
+  }
+
+  CFAColor getColorAt(int x, int y) const {
+    return colors[positiveModulo<W>(x) + positiveModulo<H>(y) * W];
+  }
+};
+
+using BayerPattern = CFAPattern<2, 2>;
+using XTransPattern = CFAPattern<6, 6>;
+
 // FC macro from dcraw outputs, given the filters definition, the dcraw color
 // number for that given position in the CFA pattern
 // #define FC(filters,row,col) ((filters) >> ((((row) << 1 & 14) + ((col) & 1)) << 1) & 3)
@@ -76,11 +76,11 @@ void FiffParser::parseData() {
         ThrowFPE("Fiff is corrupted: second IFD is not after the first IFD");
 
       uint32 rawOffset = second_ifd - first_ifd;
-      subIFD->add(std::make_unique<TiffEntry>(
+      subIFD->add(TiffEntry(
           subIFD.get(), FUJI_STRIPOFFSETS, TIFF_OFFSET, 1,
           ByteStream::createCopy(&rawOffset, 4)));
       uint32 max_size = mInput->getSize() - second_ifd;
-      subIFD->add(std::make_unique<TiffEntry>(
+      subIFD->add(TiffEntry(
           subIFD.get(), FUJI_STRIPBYTECOUNTS, TIFF_LONG, 1,
           ByteStream::createCopy(&max_size, 4)));
     }
@@ -108,7 +108,7 @@ void FiffParser::parseData() {
         type = TIFF_SHORT;
 
       uint32 count = type == TIFF_SHORT ? length / 2 : length;
-      subIFD->add(std::make_unique<TiffEntry>(
+      subIFD->add(TiffEntry(
           subIFD.get(), static_cast<TiffTag>(tag), type, count,
           bytes.getSubStream(bytes.getPosition(), length)));
 
@@ -20,12 +20,16 @@
 */
 
 #include "parsers/RawParser.h"
+#include "common/Common.h"                // for uchar8, ushort16
+#include "common/Trace.h"                 // for RAWSPEED_TRACE_SCOPE
+#include "decoders/CrwDecoder.h"          // for CrwDecoder
 #include "decoders/MrwDecoder.h"          // for MrwDecoder
 #include "decoders/NakedDecoder.h"        // for NakedDecoder
 #include "decoders/RafDecoder.h"          // for RafDecoder
 #include "decoders/RawDecoder.h"          // for RawDecoder
 #include "decoders/RawDecoderException.h" // for RawDecoderException, ThrowRDE
 #include "io/Buffer.h"                    // for Buffer
+#include "io/Endianness.h"                // for getLE, getBE
 #include "metadata/CameraMetaData.h"      // for CameraMetaData
 #include "parsers/CiffParser.h"           // for CiffParser
 #include "parsers/CiffParserException.h"  // for CiffParserException
@@ -33,48 +37,120 @@
 #include "parsers/FiffParserException.h"  // for FiffParserException
 #include "parsers/TiffParser.h"           // for TiffParser
 #include "parsers/TiffParserException.h"  // for TiffParserException
+#include <array>                          // for array
+#include <cassert>                        // for assert
+#include <memory>                         // for unique_ptr, make_unique
 
 namespace rawspeed {
 
 class Camera;
 
-std::unique_ptr<RawDecoder> RawParser::getDecoder(const CameraMetaData* meta) {
-  // We need some data.
-  // For now it is 104 bytes for RAF/FUJIFIM images.
-  // FIXME: each decoder/parser should check it on their own.
-  if (mInput->getSize() <=  104)
-    ThrowRDE("File too small");
+namespace {
+
+// Whether TiffParser::parse() would accept the header.
+bool isTIFF(const Buffer* input) {
+  const uchar8* data = input->getData(0, 4);
+  ushort16 magic;
+  if (data[0] == 'I' && data[1] == 'I')
+    magic = getLE<ushort16>(data + 2);
+  else if (data[0] == 'M' && data[1] == 'M')
+    magic = getBE<ushort16>(data + 2);
+  else
+    return false;
+
+  // ORF has 0x4f52/0x5352, RW2 0x55
+  return magic == 42 || magic == 0x4f52 || magic == 0x5352 || magic == 0x55;
+}
 
-  // MRW images are easy to check for, let's try that first
-  if (MrwDecoder::isMRW(mInput)) {
-    try {
-      return std::make_unique<MrwDecoder>(mInput);
-    } catch (RawDecoderException &) {
-    }
-  }
+// Whether CiffParser::parseData() would accept the header.
+bool isCIFF(const Buffer* input) {
+  const uchar8* data = input->getData(0, 2);
+  return data[0] == 'I' && data[1] == 'I' && CrwDecoder::isCRW(input);
+}
 
-  // FUJI has pointers to IFD's at fixed byte offsets
-  // So if camera is FUJI, we cannot use ordinary TIFF parser
-  if (RafDecoder::isRAF(mInput)) {
-    try {
-      FiffParser p(mInput);
-      return p.getDecoder(meta);
-    } catch (FiffParserException&) {
-    }
-  }
+bool isMRW(const Buffer* input) { return MrwDecoder::isMRW(input); }
 
-  // Ordinary TIFF images
+// If the parser can not handle the file after all, nullptr, and then it may
+// still be a CHDK one. Any other exception is passed on.
+template <typename Parser, typename Exception>
+std::unique_ptr<RawDecoder> parse(const Buffer* input,
+                                  const CameraMetaData* meta) {
   try {
-    TiffParser p(mInput);
+    Parser p(input);
     return p.getDecoder(meta);
-  } catch (TiffParserException &) {
+  } catch (Exception&) {
+    return nullptr;
   }
+}
 
-  // CIFF images
+std::unique_ptr<RawDecoder> parseMRW(const Buffer* input,
+                                     const CameraMetaData* /*meta*/) {
   try {
-    CiffParser p(mInput);
-    return p.getDecoder(meta);
-  } catch (CiffParserException &) {
+    return std::make_unique<MrwDecoder>(input);
+  } catch (RawDecoderException&) {
+    return nullptr;
+  }
+}
+
+struct Parser {
+  RawParser::Format format;
+  bool (*isFormat)(const Buffer* input);
+  std::unique_ptr<RawDecoder> (*parse)(const Buffer* input,
+                                       const CameraMetaData* meta);
+};
+
+// At most one of these matches the first bytes of a file, so only its
+// parser is constructed. The others do not get to throw on it.
+const std::array<Parser, 4> parsers = {{
+    {RawParser::Format::MRW, &isMRW, &parseMRW},
+    // FUJI has pointers to IFD's at fixed byte offsets
+    // So if camera is FUJI, we cannot use ordinary TIFF parser
+    {RawParser::Format::RAF, &RafDecoder::isRAF,
+     &parse<FiffParser, FiffParserException>},
+    {RawParser::Format::TIFF, &isTIFF,
+     &parse<TiffParser, TiffParserException>},
+    {RawParser::Format::CIFF, &isCIFF,
+     &parse<CiffParser, CiffParserException>},
+}};
+
+// We need some data.
+// For now it is 104 bytes for RAF/FUJIFIM images.
+// FIXME: each decoder/parser should check it on their own.
+bool isTooSmall(const Buffer* input) { return input->getSize() <= 104; }
+
+const Parser* findParser(const Buffer* input) {
+  assert(!isTooSmall(input));
+  for (const Parser& parser : parsers) {
+    if (parser.isFormat(input))
+      return &parser;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+RawParser::Format RawParser::probe(const Buffer& input,
+                                   const CameraMetaData* meta) {
+  if (isTooSmall(&input))
+    return Format::Unsupported;
+
+  if (const Parser* parser = findParser(&input))
+    return parser->format;
+
+  if (meta != nullptr && meta->hasChdkCamera(input.getSize()))
+    return Format::CHDK;
+
+  return Format::Unsupported;
+}
+
+std::unique_ptr<RawDecoder> RawParser::getDecoder(const CameraMetaData* meta) {
+  RAWSPEED_TRACE_SCOPE("parser", "getDecoder");
+  if (isTooSmall(mInput))
+    ThrowRDE("File too small");
+
+  if (const Parser* parser = findParser(mInput)) {
+    if (auto decoder = parser->parse(mInput, meta))
+      return decoder;
   }
 
   // Detect camera on filesize (CHDK).
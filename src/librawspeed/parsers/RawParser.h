@@ -32,9 +32,26 @@ class RawDecoder;
 
 class RawParser {
 public:
+  // The container formats that getDecoder() can handle.
+  enum class Format {
+    Unsupported,
+    MRW,
+    RAF,
+    TIFF, // Including ORF and RW2.
+    CIFF,
+    CHDK, // Only known by its file size.
+  };
+
   explicit RawParser(const Buffer* inputData) : mInput(inputData) {}
   virtual ~RawParser() = default;
 
+  // Tells the format from the first bytes of the file, and its size. It does
+  // not parse any further, e.g. a TIFF may still turn out to be no raw, but
+  // it does not throw either, so the files that are not raws at all can be
+  // rejected cheaply. Pass the meta data to recognize the CHDK ones.
+  static Format probe(const Buffer& input,
+                      const CameraMetaData* meta = nullptr);
+
   virtual std::unique_ptr<RawDecoder>
   getDecoder(const CameraMetaData* meta = nullptr);
 
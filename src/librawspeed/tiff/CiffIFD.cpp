@@ -25,9 +25,9 @@
 #include "common/NORangesSet.h"          // for set
 #include "io/ByteStream.h"               // for ByteStream
 #include "parsers/CiffParserException.h" // for ThrowCPE
+#include <algorithm>                     // for lower_bound
 #include <cassert>                       // for assert
 #include <initializer_list>              // for initializer_list
-#include <map>                           // for map, _Rb_tree_const_iterator
 #include <memory>                        // for unique_ptr, make_unique
 #include <string>                        // for operator==, string
 #include <utility>                       // for move, pair
@@ -50,20 +50,21 @@ void CiffIFD::parseIFDEntry(NORangesSet<Buffer>* valueDatas,
 
   ByteStream dirEntry = dirEntries->getStream(10); // Entry is 10 bytes.
 
-  auto t = std::make_unique<CiffEntry>(valueDatas, valueData, dirEntry);
+  // Even if it is not kept, it is still checked to not overlap the others.
+  CiffEntry t(valueDatas, valueData, dirEntry);
 
-  switch (t->type) {
+  switch (t.type) {
   case CIFF_SUB1:
   case CIFF_SUB2: {
-    add(std::make_unique<CiffIFD>(this, t->data));
+    add(std::make_unique<CiffIFD>(this, t.data));
     break;
   }
 
   default:
     // Will we ever look for this entry?
-    if (!isIn(t->tag, CiffTagsWeCareAbout))
+    if (!isIn(t.tag, CiffTagsWeCareAbout))
       return;
-    add(move(t));
+    add(std::move(t));
   }
 }
 
@@ -160,12 +161,34 @@ void CiffIFD::add(std::unique_ptr<CiffIFD> subIFD) {
   mSubIFD.push_back(move(subIFD));
 }
 
-void CiffIFD::add(std::unique_ptr<CiffEntry> entry) {
-  assert(isIn(entry->tag, CiffTagsWeCareAbout));
-  mEntry[entry->tag] = move(entry);
+void CiffIFD::add(CiffEntry entry) {
+  assert(isIn(entry.tag, CiffTagsWeCareAbout));
+
+  // There are only ever a few of them, so the first one reserves for all.
+  if (mEntry.empty())
+    mEntry.reserve(CiffTagsWeCareAbout.size());
+
+  // As with the other entries of the same tag, a later one replaces it.
+  auto e = std::lower_bound(
+      mEntry.begin(), mEntry.end(), entry.tag,
+      [](const CiffEntry& other, CiffTag t) { return other.tag < t; });
+  if (e != mEntry.end() && e->tag == entry.tag)
+    *e = std::move(entry);
+  else
+    mEntry.insert(e, std::move(entry));
+
   assert(mEntry.size() <= CiffTagsWeCareAbout.size());
 }
 
+const CiffEntry* CiffIFD::findEntry(CiffTag tag) const {
+  auto e = std::lower_bound(
+      mEntry.cbegin(), mEntry.cend(), tag,
+      [](const CiffEntry& entry, CiffTag t) { return entry.tag < t; });
+  if (e == mEntry.cend() || e->tag != tag)
+    return nullptr;
+  return &*e;
+}
+
 template <typename Lambda>
 std::vector<const CiffIFD*> CiffIFD::getIFDsWithTagIf(CiffTag tag,
                                                       const Lambda& f) const {
@@ -173,12 +196,9 @@ std::vector<const CiffIFD*> CiffIFD::getIFDsWithTagIf(CiffTag tag,
 
   std::vector<const CiffIFD*> matchingIFDs;
 
-  const auto found = mEntry.find(tag);
-  if (found != mEntry.end()) {
-    const auto entry = found->second.get();
-    if (f(entry))
-      matchingIFDs.push_back(this);
-  }
+  const CiffEntry* entry = findEntry(tag);
+  if (entry && f(entry))
+    matchingIFDs.push_back(this);
 
   for (const auto& i : mSubIFD) {
     const auto t = i->getIFDsWithTagIf(tag, f);
@@ -193,15 +213,12 @@ const CiffEntry* CiffIFD::getEntryRecursiveIf(CiffTag tag,
                                               const Lambda& f) const {
   assert(isIn(tag, CiffTagsWeCareAbout));
 
-  const auto found = mEntry.find(tag);
-  if (found != mEntry.end()) {
-    const auto entry = found->second.get();
-    if (f(entry))
-      return entry;
-  }
+  const CiffEntry* entry = findEntry(tag);
+  if (entry && f(entry))
+    return entry;
 
   for (const auto& i : mSubIFD) {
-    const CiffEntry* entry = i->getEntryRecursiveIf(tag, f);
+    entry = i->getEntryRecursiveIf(tag, f);
     if (entry)
       return entry;
   }
@@ -233,13 +250,13 @@ CiffIFD::getIFDsWithTagWhere(CiffTag tag, const string& isValue) const {
 bool __attribute__((pure)) CiffIFD::hasEntry(CiffTag tag) const {
   assert(isIn(tag, CiffTagsWeCareAbout));
 
-  return mEntry.count(tag) > 0;
+  return findEntry(tag) != nullptr;
 }
 
 bool __attribute__((pure)) CiffIFD::hasEntryRecursive(CiffTag tag) const {
   assert(isIn(tag, CiffTagsWeCareAbout));
 
-  if (mEntry.count(tag) > 0)
+  if (findEntry(tag))
     return true;
 
   for (const auto& i : mSubIFD) {
@@ -253,9 +270,8 @@ bool __attribute__((pure)) CiffIFD::hasEntryRecursive(CiffTag tag) const {
 const CiffEntry* CiffIFD::getEntry(CiffTag tag) const {
   assert(isIn(tag, CiffTagsWeCareAbout));
 
-  const auto found = mEntry.find(tag);
-  if (found != mEntry.end())
-    return found->second.get();
+  if (const CiffEntry* entry = findEntry(tag))
+    return entry;
 
   ThrowCPE("Entry 0x%x not found.", tag);
 }
@@ -26,7 +26,6 @@
 #include "common/NORangesSet.h" // for set
 #include "tiff/CiffEntry.h"     // IWYU pragma: keep
 #include "tiff/CiffTag.h"       // for CiffTag
-#include <map>                  // for map
 #include <memory>               // for unique_ptr
 #include <string>               // for string
 #include <vector>               // for vector
@@ -40,7 +39,11 @@ class CiffIFD final {
   CiffIFD* const parent;
 
   std::vector<std::unique_ptr<const CiffIFD>> mSubIFD;
-  std::map<CiffTag, std::unique_ptr<const CiffEntry>> mEntry;
+
+  // Only those of CiffTagsWeCareAbout, sorted by their tags, in place. So an
+  // IFD costs at most a single allocation for all of its entries, and none
+  // if it has none of them.
+  std::vector<CiffEntry> mEntry;
 
   int subIFDCount = 0;
   int subIFDCountRecursive = 0;
@@ -72,7 +75,9 @@ class CiffIFD final {
   };
 
   void add(std::unique_ptr<CiffIFD> subIFD);
-  void add(std::unique_ptr<CiffEntry> entry);
+  void add(CiffEntry entry);
+
+  const CiffEntry* __attribute__((pure)) findEntry(CiffTag tag) const;
 
   void parseIFDEntry(NORangesSet<Buffer>* valueDatas,
                      const ByteStream* valueData, ByteStream* dirEntries);
@@ -34,16 +34,20 @@ enum CiffTag {
   CIFF_IMAGEINFO    = 0x1810,
   CIFF_DECODERTABLE = 0x1835,
   CIFF_RAWDATA      = 0x2005,
+  CIFF_JPEGIMAGE    = 0x2007,
+  CIFF_THUMBNAIL    = 0x2008,
   CIFF_SUBIFD       = 0x300a,
   CIFF_EXIF         = 0x300b,
 };
 
 static constexpr std::initializer_list<CiffTag> CiffTagsWeCareAbout = {
     CIFF_DECODERTABLE,
+    CIFF_JPEGIMAGE,
     CIFF_MAKEMODEL,
     CIFF_RAWDATA,
     CIFF_SENSORINFO,
     CIFF_SHOTINFO,
+    CIFF_THUMBNAIL,
     CIFF_WHITEBALANCE,
     static_cast<CiffTag>(0x0032), // ???
     static_cast<CiffTag>(0x102c), // ???
@@ -22,6 +22,8 @@
 
 #include "tiff/TiffEntry.h"
 #include "common/Common.h"               // for uint32, short16, ushort16
+#include "io/ByteStream.h"               // for ByteStream
+#include "io/Endianness.h"               // for getHostEndianness
 #include "parsers/TiffParserException.h" // for ThrowTPE
 #include "tiff/TiffIFD.h"                // for TiffIFD, TiffRootIFD
 #include "tiff/TiffTag.h"                // for TiffTag, DNGPRIVATEDATA
@@ -166,6 +168,50 @@ uint32 TiffEntry::getU32(uint32 index) const {
   return data.peek<uint32>(index);
 }
 
+template <typename T, typename S>
+static TiffEntryView<T> makeView(const ByteStream& data, uint32 count) {
+  const uchar8* p = data.peekData(data.check(count, sizeof(S)));
+  return {p, count, sizeof(S) < sizeof(T),
+          data.getByteOrder() != getHostEndianness()};
+}
+
+TiffEntryView<ushort16> TiffEntry::getU16View(uint32 count_) const {
+  if (type != TIFF_SHORT && type != TIFF_UNDEFINED)
+    ThrowTPE("Wrong type %u encountered. Expected Short or Undefined on 0x%x",
+             type, tag);
+
+  return makeView<ushort16, ushort16>(data, count_);
+}
+
+TiffEntryView<uint32> TiffEntry::getU32View(uint32 count_) const {
+  if (type == TIFF_SHORT)
+    return makeView<uint32, ushort16>(data, count_);
+
+  switch (type) {
+  case TIFF_LONG:
+  case TIFF_OFFSET:
+  case TIFF_BYTE:
+  case TIFF_UNDEFINED:
+  case TIFF_RATIONAL:
+  case TIFF_SRATIONAL:
+    break;
+  default:
+    ThrowTPE("Wrong type %u encountered. Expected Long, Offset, Rational or "
+             "Undefined on 0x%x",
+             type, tag);
+  }
+
+  return makeView<uint32, uint32>(data, count_);
+}
+
+std::vector<float> TiffEntry::getFloatArray(uint32 count_) const {
+  // The others have to be converted one by one.
+  if (type == TIFF_FLOAT)
+    return makeView<float, float>(data, count_).toVector();
+
+  return getArray<float, &TiffEntry::getFloat>(count_);
+}
+
 int32 TiffEntry::getI32(uint32 index) const {
   if (type == TIFF_SSHORT)
     return getI16(index);
@@ -24,7 +24,10 @@
 
 #include "common/Common.h" // for uint32, uchar8, ushort16, int32, short16
 #include "io/ByteStream.h" // for ByteStream
+#include "io/Endianness.h" // for getByteSwapped
 #include "tiff/TiffTag.h"  // for TiffTag
+#include <cassert>         // for assert
+#include <cstring>         // for memcpy
 #include <string>          // for string
 #include <vector>          // for vector
 
@@ -56,6 +59,55 @@ enum TiffDataType {
   TIFF_OFFSET    = 13, /* 32-bit unsigned offset used for IFD and other offsets */
 };
 
+/*
+ * The first values of an entry, read in place. The bounds and the type are
+ * checked once, when the view is made, so an access is just a load, swapped
+ * if the entry is not in the byte order of the host. The values may be
+ * stored narrower than T (the SHORTs as read by getU32()).
+ */
+template <typename T> class TiffEntryView {
+  const uchar8* data = nullptr;
+  uint32 num = 0;
+  bool narrow = false;
+  bool bswap = false;
+
+  template <typename S> void copy(T* out) const {
+    const auto* in = data;
+    for (uint32 i = 0; i < num; ++i, in += sizeof(S))
+      out[i] = getByteSwapped<S>(in, bswap);
+  }
+
+public:
+  TiffEntryView() = default;
+  TiffEntryView(const uchar8* data_, uint32 num_, bool narrow_, bool bswap_)
+      : data(data_), num(num_), narrow(narrow_), bswap(bswap_) {}
+
+  uint32 size() const { return num; }
+
+  T operator[](uint32 i) const {
+    assert(i < num);
+    if (narrow)
+      return getByteSwapped<ushort16>(data + i * sizeof(ushort16), bswap);
+    return getByteSwapped<T>(data + i * sizeof(T), bswap);
+  }
+
+  // All of the values, in one pass.
+  void copyTo(T* out) const {
+    if (narrow)
+      copy<ushort16>(out);
+    else if (!bswap)
+      memcpy(out, data, sizeof(T) * num);
+    else
+      copy<T>(out);
+  }
+
+  std::vector<T> toVector() const {
+    std::vector<T> res(num);
+    copyTo(res.data());
+    return res;
+  }
+};
+
 class TiffEntry
 {
   TiffIFD* parent;
@@ -91,20 +143,22 @@ public:
   float getFloat(uint32 index = 0) const;
   std::string getString() const;
 
+  // The first count_ values, as getU16() / getU32() / getFloat() would read
+  // them, but without the per-value checks.
+  TiffEntryView<ushort16> getU16View(uint32 count_) const;
+  TiffEntryView<uint32> getU32View(uint32 count_) const;
+
   inline std::vector<ushort16> getU16Array(uint32 count_) const
   {
-    return getArray<ushort16, &TiffEntry::getU16>(count_);
+    return getU16View(count_).toVector();
   }
 
   inline std::vector<uint32> getU32Array(uint32 count_) const
   {
-    return getArray<uint32, &TiffEntry::getU32>(count_);
+    return getU32View(count_).toVector();
   }
 
-  inline std::vector<float> getFloatArray(uint32 count_) const
-  {
-    return getArray<float, &TiffEntry::getFloat>(count_);
-  }
+  std::vector<float> getFloatArray(uint32 count_) const;
 
   ByteStream& getData() { return data; }
   const uchar8* getData(uint32 size) { return data.getData(size); }
@@ -28,9 +28,10 @@
 #include "io/IOException.h"           // for IOException
 #include "tiff/TiffEntry.h"           // for TiffEntry
 #include "tiff/TiffTag.h"             // for TiffTag, MAKE, DNGPRIVATEDATA
+#include <algorithm>                  // for lower_bound, stable_sort
 #include <cassert>                    // for assert
 #include <cstdint>                    // for UINT32_MAX
-#include <map>                        // for map, _Rb_tree_const_iterator
+#include <iterator>                   // for next
 #include <memory>                     // for unique_ptr, make_unique
 #include <string>                     // for string, operator==
 #include <utility>                    // for move, pair
@@ -44,12 +45,12 @@ namespace rawspeed {
 void TiffIFD::parseIFDEntry(NORangesSet<Buffer>* ifds, ByteStream* bs) {
   assert(ifds);
 
-  TiffEntryOwner t;
-
   auto origPos = bs->getPosition();
 
+  // Straight into the entries, it is either kept there, or replaced by the
+  // IFD(s) it points to.
   try {
-    t = std::make_unique<TiffEntry>(this, bs);
+    entries.emplace_back(this, bs);
   } catch (IOException&) { // Ignore unparsable entry
     // fix probably broken position due to interruption by exception
     // i.e. setting it to the next entry.
@@ -57,6 +58,8 @@ void TiffIFD::parseIFDEntry(NORangesSet<Buffer>* ifds, ByteStream* bs) {
     return;
   }
 
+  TiffEntry* t = &entries.back();
+
   try {
     switch (t->tag) {
     case DNGPRIVATEDATA:
@@ -64,31 +67,66 @@ void TiffIFD::parseIFDEntry(NORangesSet<Buffer>* ifds, ByteStream* bs) {
       // implemented right now, that could trigger UB (pointer arithmetics,
       // creating pointer to unowned memory, etc). And since this is not even
       // used anywhere right now, let's not
-      //   add(parseDngPrivateData(ifds, t.get()));
+      //   add(parseDngPrivateData(ifds, t));
       // but just add them as entries. (e.g. ArwDecoder uses WB from them)
-      add(move(t));
       break;
 
     case MAKERNOTE:
     case MAKERNOTE_ALT:
-      add(parseMakerNote(ifds, t.get()));
+      // Kept as an entry, whether or not it will turn out to be parsable.
+      pendingMakerNotes.emplace_back(t->tag, subIFDs.size());
       break;
 
     case FUJI_RAW_IFD:
     case SUBIFDS:
-    case EXIFIFDPOINTER:
-      for (uint32 j = 0; j < t->count; j++)
-        add(std::make_unique<TiffIFD>(this, ifds, *bs, t->getU32(j)));
+    case EXIFIFDPOINTER: {
+      // All of them, or none, like if they were added at the end.
+      std::vector<TiffIFDOwner> ifdsOfEntry;
+      for (uint32 j = 0; j < t->count; j++) {
+        ifdsOfEntry.emplace_back(
+            std::make_unique<TiffIFD>(this, ifds, *bs, t->getU32(j)));
+      }
+      for (auto& ifd : ifdsOfEntry)
+        add(std::move(ifd));
+      entries.pop_back();
       break;
+    }
 
     default:
-      add(move(t));
+      break;
     }
   } catch (RawspeedException&) { // Unparsable private data are added as entries
-    add(move(t));
   }
 }
 
+// The entries are parsed in the order of the file, which should already be
+// the order of their tags, and a later one replaces an earlier one.
+void TiffIFD::sortEntries() {
+  std::stable_sort(
+      entries.begin(), entries.end(),
+      [](const TiffEntry& a, const TiffEntry& b) { return a.tag < b.tag; });
+
+  auto out = entries.begin();
+  for (auto e = entries.begin(); e != entries.end(); ++e) {
+    if (std::next(e) != entries.end() && std::next(e)->tag == e->tag)
+      continue;
+    if (out != e)
+      *out = std::move(*e);
+    ++out;
+  }
+  entries.erase(out, entries.end());
+}
+
+TiffEntry* TiffIFD::findEntry(TiffTag tag) const {
+  auto e = std::lower_bound(
+      entries.cbegin(), entries.cend(), tag,
+      [](const TiffEntry& entry, TiffTag t) { return entry.tag < t; });
+  if (e == entries.cend() || e->tag != tag)
+    return nullptr;
+  // The entries are only ever modified via the IFD that owns them.
+  return const_cast<TiffEntry*>(&*e);
+}
+
 TiffIFD::TiffIFD(TiffIFD* parent_) : parent(parent_) {
   recursivelyCheckSubIFDs(1);
   // If we are good (can add this IFD without violating the limits),
@@ -117,12 +155,14 @@ TiffIFD::TiffIFD(TiffIFD* parent_, NORangesSet<Buffer>* ifds,
   // each entry is 12 bytes
   // 4-byte offset to the next IFD at the end
   const auto IFDFullSize = 2 + 4 + 12 * numEntries;
-  const Buffer IFDBuf(data.getSubView(offset, IFDFullSize));
-  if (!ifds->emplace(IFDBuf).second)
+  range = data.getSubView(offset, IFDFullSize);
+  if (!ifds->emplace(range).second)
     ThrowTPE("Two IFD's overlap. Raw corrupt!");
 
+  entries.reserve(numEntries);
   for (uint32 i = 0; i < numEntries; i++)
     parseIFDEntry(ifds, &bs);
+  sortEntries();
 
   nextIFD = bs.getU32();
 }
@@ -183,7 +223,7 @@ TiffRootIFDOwner TiffIFD::parseMakerNote(NORangesSet<Buffer>* ifds,
   TiffIFD* p = this;
   TiffEntry* makeEntry;
   do {
-    makeEntry = p->getEntryRecursive(MAKE);
+    makeEntry = p->findEntryRecursive(MAKE);
     p = p->parent;
   } while (!makeEntry && p);
   string make = makeEntry != nullptr ? trimSpaces(makeEntry->getString()) : "";
@@ -247,9 +287,49 @@ TiffRootIFDOwner TiffIFD::parseMakerNote(NORangesSet<Buffer>* ifds,
   return std::make_unique<TiffRootIFD>(this, ifds, bs, bs.getPosition());
 }
 
+void TiffIFD::parsePendingMakerNotes() const {
+  if (pendingMakerNotes.empty())
+    return;
+
+  // The IFDs are only ever created non-const, and this does not change their
+  // observable contents, only when they are parsed.
+  auto* self = const_cast<TiffIFD*>(this);
+  const auto pending = std::move(self->pendingMakerNotes);
+  self->pendingMakerNotes.clear();
+
+  // They must not overlap any IFD of the whole tree, parsed so far.
+  const TiffIFD* top = this;
+  while (top->parent)
+    top = top->parent;
+  NORangesSet<Buffer> ifds;
+  top->collectRanges(&ifds);
+
+  size_t added = 0;
+  for (const auto& makerNote : pending) {
+    try {
+      TiffIFDOwner ifd =
+          self->parseMakerNote(&ifds, findEntry(makerNote.first));
+      ifd->recursivelyCheckSubIFDs(0);
+      self->subIFDs.insert(self->subIFDs.begin() + makerNote.second + added,
+                           std::move(ifd));
+      added++;
+    } catch (RawspeedException&) { // Unparsable MakerNotes stay just entries
+    }
+  }
+}
+
+void TiffIFD::collectRanges(NORangesSet<Buffer>* ifds) const {
+  if (range.getSize() != 0)
+    ifds->emplace(range);
+  for (const auto& ifd : subIFDs)
+    ifd->collectRanges(ifds);
+}
+
 std::vector<const TiffIFD*> TiffIFD::getIFDsWithTag(TiffTag tag) const {
+  parsePendingMakerNotes();
+
   vector<const TiffIFD*> matchingIFDs;
-  if (entries.find(tag) != entries.end()) {
+  if (hasEntry(tag)) {
     matchingIFDs.push_back(this);
   }
   for (auto& i : subIFDs) {
@@ -267,11 +347,10 @@ const TiffIFD* TiffIFD::getIFDWithTag(TiffTag tag, uint32 index) const
   return ifds[index];
 }
 
-TiffEntry* __attribute__((pure)) TiffIFD::getEntryRecursive(TiffTag tag) const {
-  auto i = entries.find(tag);
-  if (i != entries.end()) {
-    return i->second.get();
-  }
+TiffEntry* TiffIFD::getEntryRecursive(TiffTag tag) const {
+  if (TiffEntry* entry = findEntry(tag))
+    return entry;
+  parsePendingMakerNotes();
   for (auto &j : subIFDs) {
     TiffEntry *entry = j->getEntryRecursive(tag);
     if (entry)
@@ -280,6 +359,18 @@ TiffEntry* __attribute__((pure)) TiffIFD::getEntryRecursive(TiffTag tag) const {
   return nullptr;
 }
 
+// Only what is already parsed, for the MakerNotes themselves.
+TiffEntry* __attribute__((pure))
+TiffIFD::findEntryRecursive(TiffTag tag) const {
+  if (TiffEntry* entry = findEntry(tag))
+    return entry;
+  for (auto& j : subIFDs) {
+    if (TiffEntry* entry = j->findEntryRecursive(tag))
+      return entry;
+  }
+  return nullptr;
+}
+
 void TiffIFD::recursivelyIncrementSubIFDCount() {
   TiffIFD* p = this->parent;
   if (!p)
@@ -330,16 +421,23 @@ void TiffIFD::add(TiffIFDOwner subIFD) {
   subIFDs.push_back(move(subIFD));
 }
 
-void TiffIFD::add(TiffEntryOwner entry) {
-  entry->parent = this;
-  entries[entry->tag] = move(entry);
+void TiffIFD::add(TiffEntry entry) {
+  entry.parent = this;
+
+  auto e = std::lower_bound(
+      entries.begin(), entries.end(), entry.tag,
+      [](const TiffEntry& other, TiffTag t) { return other.tag < t; });
+  if (e != entries.end() && e->tag == entry.tag)
+    *e = std::move(entry);
+  else
+    entries.insert(e, std::move(entry));
 }
 
 TiffEntry* TiffIFD::getEntry(TiffTag tag) const {
-  auto i = entries.find(tag);
-  if (i == entries.end())
+  TiffEntry* entry = findEntry(tag);
+  if (!entry)
     ThrowTPE("Entry 0x%x not found.", tag);
-  return i->second.get();
+  return entry;
 }
 
 TiffID TiffRootIFD::getID() const
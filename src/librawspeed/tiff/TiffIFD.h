@@ -30,9 +30,9 @@
 #include "parsers/TiffParserException.h" // for ThrowTPE
 #include "tiff/TiffEntry.h"              // IWYU pragma: keep
 #include "tiff/TiffTag.h"                // for TiffTag
-#include <map>                           // for map, _Rb_tree_const_iterator
 #include <memory>                        // for unique_ptr
 #include <string>                        // for string
+#include <utility>                       // for pair
 #include <vector>                        // for vector
 
 namespace rawspeed {
@@ -43,7 +43,6 @@ class TiffRootIFD;
 
 using TiffIFDOwner = std::unique_ptr<TiffIFD>;
 using TiffRootIFDOwner = std::unique_ptr<TiffRootIFD>;
-using TiffEntryOwner = std::unique_ptr<TiffEntry>;
 
 class TiffIFD
 {
@@ -56,7 +55,19 @@ class TiffIFD
   int subIFDCount = 0;
   int subIFDCountRecursive = 0;
 
-  std::map<TiffTag, TiffEntryOwner> entries;
+  // Sorted by their tags. They are stored in place, so an IFD costs a single
+  // allocation for all of its entries, and they are binary-searched.
+  std::vector<TiffEntry> entries;
+
+  // Where this IFD is in the file, to be checked against the MakerNotes.
+  Buffer range;
+
+  // The MakerNotes are only parsed once a lookup goes past this IFD, which
+  // most decoders never do. They are the tag of the entry, and the position
+  // in the subIFDs at which they would have been added.
+  // NOTE: that parsing happens within the const methods, so the tree is not
+  // to be queried concurrently.
+  std::vector<std::pair<TiffTag, size_t>> pendingMakerNotes;
 
   friend class TiffEntry;
   friend class FiffParser;
@@ -67,10 +78,15 @@ class TiffIFD
   void recursivelyCheckSubIFDs(int headroom) const;
 
   void add(TiffIFDOwner subIFD);
-  void add(TiffEntryOwner entry);
+  void add(TiffEntry entry);
+  void sortEntries();
+  TiffEntry* __attribute__((pure)) findEntry(TiffTag tag) const;
   TiffRootIFDOwner parseDngPrivateData(NORangesSet<Buffer>* ifds, TiffEntry* t);
   TiffRootIFDOwner parseMakerNote(NORangesSet<Buffer>* ifds, TiffEntry* t);
   void parseIFDEntry(NORangesSet<Buffer>* ifds, ByteStream* bs);
+  void parsePendingMakerNotes() const;
+  void collectRanges(NORangesSet<Buffer>* ifds) const;
+  TiffEntry* __attribute__((pure)) findEntryRecursive(TiffTag tag) const;
 
   // TIFF IFD are tree-like structure, with branches.
   // A branch (IFD) can have branches (IFDs) of it's own.
@@ -111,13 +127,16 @@ public:
   std::vector<const TiffIFD*> getIFDsWithTag(TiffTag tag) const;
   const TiffIFD* getIFDWithTag(TiffTag tag, uint32 index = 0) const;
   TiffEntry* getEntry(TiffTag tag) const;
-  TiffEntry* __attribute__((pure)) getEntryRecursive(TiffTag tag) const;
+  TiffEntry* getEntryRecursive(TiffTag tag) const;
   bool __attribute__((pure)) hasEntry(TiffTag tag) const {
-    return entries.find(tag) != entries.end();
+    return findEntry(tag) != nullptr;
   }
   bool hasEntryRecursive(TiffTag tag) const { return getEntryRecursive(tag) != nullptr; }
 
-  const std::vector<TiffIFDOwner>& getSubIFDs() const { return subIFDs; }
+  const std::vector<TiffIFDOwner>& getSubIFDs() const {
+    parsePendingMakerNotes();
+    return subIFDs;
+  }
 //  const std::map<TiffTag, TiffEntry*>& getEntries() const { return entries; }
 };
 
@@ -0,0 +1,73 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "RawSpeed-API.h" // for CameraMetaData, RawspeedException
+
+#include <cstdio>  // for fprintf, fopen, fwrite, fclose, stderr
+#include <vector>  // for vector
+
+// define this function, it is only declared in rawspeed:
+extern "C" int __attribute__((const)) rawspeed_get_number_of_processor_cores() {
+  return 1;
+}
+
+using rawspeed::CameraMetaData;
+using rawspeed::RawspeedException;
+using rawspeed::uchar8;
+
+// Parses cameras.xml, and writes it out as the binary camera database,
+// which can then be loaded via CameraMetaData(Buffer) without pugixml.
+int main(int argc, char* argv[]) { // NOLINT
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <cameras.xml> <cameras.bin>\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<uchar8> database;
+  try {
+    const CameraMetaData meta(argv[1]);
+    database = meta.serialize();
+
+    // Make sure that it loads back.
+    const std::vector<uchar8> copy = CameraMetaData(
+        rawspeed::Buffer(database.data(), database.size())).serialize();
+    if (copy != database) {
+      fprintf(stderr, "ERROR: The database does not round-trip\n");
+      return 1;
+    }
+  } catch (RawspeedException& e) {
+    fprintf(stderr, "ERROR: %s\n", e.what());
+    return 1;
+  }
+
+  FILE* f = fopen(argv[2], "wb");
+  if (!f) {
+    fprintf(stderr, "ERROR: Could not open '%s' for writing\n", argv[2]);
+    return 1;
+  }
+  const bool ok = fwrite(database.data(), 1, database.size(), f) ==
+                  database.size();
+  if (fclose(f) != 0 || !ok) {
+    fprintf(stderr, "ERROR: Could not write '%s'\n", argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
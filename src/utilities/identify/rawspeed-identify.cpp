@@ -20,10 +20,16 @@
 #include "RawSpeed-API.h" // for RawImage, RawImageData, iPoint2D, ImageMet...
 
 #include <array>      // for array
+#include <cmath>      // for isfinite
 #include <cstddef>    // for size_t
 #include <cstdint>    // for uint16_t
 #include <cstdio>     // for fprintf, stdout, stderr
+#include <cstring>    // for strcmp
+#include <exception>  // for rethrow_exception
+#include <fstream>    // for ifstream
+#include <iostream>   // for cin, istream
 #include <memory>     // for unique_ptr, make_unique
+#include <mutex>      // for mutex, lock_guard
 #include <string>     // for string, operator+, basic_string
 #include <sys/stat.h> // for stat
 #include <vector>     // for vector
@@ -122,6 +128,128 @@ std::string find_cameras_xml(const char *argv0) {
   return found_camfile;
 }
 
+static std::string jsonString(const std::string& s) {
+  std::string out = "\"";
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      std::array<char, 8> esc;
+      snprintf(esc.data(), esc.size(), "\\u%04x", c);
+      out += esc.data();
+    } else
+      out += c;
+  }
+  return out + "\"";
+}
+
+// JSON has no NaN, the coefficients that are not known are null.
+static std::string jsonNumber(double v) {
+  if (!std::isfinite(v))
+    return "null";
+  std::array<char, 32> buf;
+  snprintf(buf.data(), buf.size(), "%f", v);
+  return buf.data();
+}
+
+// The metadata of one file, as a line of JSON.
+static std::string jsonLine(const BatchDecoderResult& res, bool decoded) {
+  std::string line = "{\"file\": " + jsonString(res.fileName);
+
+  if (res.exception) {
+    std::string what = "unknown error";
+    try {
+      std::rethrow_exception(res.exception);
+    } catch (const std::exception& e) {
+      what = e.what();
+    } catch (...) {
+    }
+    return line + ", \"error\": " + jsonString(what) + "}";
+  }
+
+  const RawImage& r = res.image;
+  const ImageMetaData& m = r->metadata;
+  std::array<char, 512> buf;
+  snprintf(buf.data(), buf.size(),
+           ", \"blackLevel\": %d, \"whitePoint\": %d"
+           ", \"blackLevelSeparate\": [%d, %d, %d, %d]"
+           ", \"isCFA\": %d, \"filters\": %u, \"cpp\": %u"
+           ", \"dataType\": %d, \"dimCropped\": [%d, %d]"
+           ", \"cropOffset\": [%d, %d], \"fuji_rotation_pos\": %u"
+           ", \"pixel_aspect_ratio\": %f",
+           r->blackLevel, r->whitePoint, r->blackLevelSeparate[0],
+           r->blackLevelSeparate[1], r->blackLevelSeparate[2],
+           r->blackLevelSeparate[3], r->isCFA, r->cfa.getDcrawFilter(),
+           r->getCpp(), r->getDataType(), r->dim.x, r->dim.y,
+           r->getCropOffset().x, r->getCropOffset().y, m.fujiRotationPos,
+           m.pixelAspectRatio);
+
+  line += ", \"make\": " + jsonString(m.make) +
+          ", \"model\": " + jsonString(m.model) +
+          ", \"canonical_make\": " + jsonString(m.canonical_make) +
+          ", \"canonical_model\": " + jsonString(m.canonical_model) +
+          ", \"canonical_alias\": " + jsonString(m.canonical_alias) +
+          buf.data() + ", \"wbCoeffs\": [" + jsonNumber(m.wbCoeffs[0]) +
+          ", " + jsonNumber(m.wbCoeffs[1]) + ", " + jsonNumber(m.wbCoeffs[2]) +
+          ", " + jsonNumber(m.wbCoeffs[3]) + "]";
+
+  // Only the decode has the buffer, and with it the bpp.
+  if (decoded) {
+    const iPoint2D dimUncropped = r->getUncroppedDim();
+    snprintf(buf.data(), buf.size(),
+             ", \"bpp\": %u, \"dimUncropped\": [%d, %d]", r->getBpp(),
+             dimUncropped.x, dimUncropped.y);
+    line += buf.data();
+  }
+
+  return line + "}";
+}
+
+// The files of the list (one per line, "-" for stdin) are done concurrently,
+// from the headers alone unless decode is set, and each one is written out
+// as a line of JSON, in the order they get done.
+static int identifyBatch(const CameraMetaData* meta, const char* listName,
+                         bool decode) {
+  std::ifstream listFile;
+  if (strcmp(listName, "-") != 0) {
+    listFile.open(listName);
+    if (!listFile) {
+      fprintf(stderr, "ERROR: Couldn't open '%s'\n", listName);
+      return 2;
+    }
+  }
+  std::istream& list = listFile.is_open() ? listFile : std::cin;
+
+  std::vector<std::string> fileNames;
+  for (std::string fileName; std::getline(list, fileName);) {
+    if (!fileName.empty())
+      fileNames.emplace_back(fileName);
+  }
+
+  BatchDecoder d(meta);
+  d.metaDataOnly = !decode;
+  // The headers are small, the time goes into the latency of the reads.
+  d.readThreads = 16;
+  d.configure = [](RawDecoder* decoder) {
+    decoder->applyCrop = false;
+    decoder->failOnUnknown = true;
+  };
+
+  std::mutex mutex;
+  int failed = 0;
+  d.decode(fileNames, [&mutex, &failed, decode](BatchDecoderResult&& res) {
+    const std::string line = jsonLine(res, decode);
+
+    std::lock_guard<std::mutex> guard(mutex);
+    fprintf(stdout, "%s\n", line.c_str());
+    if (res.exception)
+      failed++;
+  });
+
+  return failed ? 2 : 0;
+}
+
 } // namespace identify
 
 } // namespace rawspeed
@@ -137,11 +265,16 @@ using rawspeed::TYPE_USHORT16;
 using rawspeed::TYPE_FLOAT32;
 using rawspeed::RawspeedException;
 using rawspeed::identify::find_cameras_xml;
+using rawspeed::identify::identifyBatch;
 
 int main(int argc, char* argv[]) { // NOLINT
 
-  if (argc != 2) {
-    fprintf(stderr, "Usage: darktable-rs-identify <file>\n");
+  const bool batch = argc >= 3 && !strcmp(argv[1], "-b");
+  const bool batchDecode = batch && argc == 4 && !strcmp(argv[2], "-d");
+
+  if (batch ? argc != 3 && !batchDecode : argc != 2) {
+    fprintf(stderr, "Usage: darktable-rs-identify <file>\n"
+                    "       darktable-rs-identify -b [-d] <list of files>\n");
     return 0;
   }
 
@@ -166,6 +299,9 @@ int main(int argc, char* argv[]) { // NOLINT
       return 2;
     }
 
+    if (batch)
+      return identifyBatch(meta.get(), argv[argc - 1], batchDecode);
+
 #ifndef _WIN32
     char* imageFileName = argv[1];
 #else
@@ -215,6 +351,11 @@ int main(int argc, char* argv[]) { // NOLINT
     fprintf(stdout, "canonical_alias: %s\n",
             r->metadata.canonical_alias.c_str());
 
+    // That was from the headers alone, the decode takes a new decoder.
+    d = t.getDecoder(meta.get());
+    d->applyCrop = false;
+    d->failOnUnknown = true;
+
     d->checkSupport(meta.get());
     d->decodeRaw();
     d->decodeMetaData(meta.get());
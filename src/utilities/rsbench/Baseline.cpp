@@ -0,0 +1,214 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "Baseline.h"
+#include <algorithm> // for sort, nth_element
+#include <cmath>     // for erfc, fabs, sqrt
+#include <cstdio>    // for fprintf, fopen, fclose
+#include <fstream>   // for ifstream
+#include <sstream>   // for istringstream
+#include <utility>   // for pair
+
+namespace rsbench {
+
+namespace {
+
+constexpr const char* header = "rsbench-baseline 1";
+
+double median(std::vector<double> v) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  const size_t n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+} // namespace
+
+void Measurement::addRun(long iterations, const std::vector<double>& runSamples,
+                         const std::map<std::string, double>& runStages) {
+  if (iterations < iterationsPerRun)
+    return;
+  if (iterations > iterationsPerRun) {
+    samples.clear();
+    stages.clear();
+    iterationsPerRun = iterations;
+  }
+
+  // The stages, as the mean over all of the kept runs.
+  const double runs = samples.size() / static_cast<double>(iterations);
+  for (const auto& stage : runStages) {
+    double& mean = stages[stage.first];
+    mean = (mean * runs + stage.second) / (runs + 1);
+  }
+  samples.insert(samples.end(), runSamples.begin(), runSamples.end());
+}
+
+double Measurement::getMedian() const { return median(samples); }
+
+double Measurement::getMAD() const {
+  const double m = getMedian();
+  std::vector<double> deviations;
+  deviations.reserve(samples.size());
+  for (double s : samples)
+    deviations.emplace_back(std::fabs(s - m));
+  return median(deviations);
+}
+
+// Each line is the name, the iterations per run, the median and the MAD,
+// which are only for the reader, the stages, and the samples, separated by
+// the tabs, the names being those of Google Benchmark, which have none. The
+// stages, e.g. "Decode,s=0.01", and the samples are separated by the spaces.
+bool Baseline::write(const char* fileName) const {
+  FILE* f = fopen(fileName, "w");
+  if (!f)
+    return false;
+
+  fprintf(f, "%s\n", header);
+  for (const auto& m : measurements) {
+    fprintf(f, "%s\t%ld\t%.9g\t%.9g\t", m.first.c_str(),
+            m.second.iterationsPerRun, m.second.getMedian(),
+            m.second.getMAD());
+    const char* sep = "";
+    for (const auto& stage : m.second.stages) {
+      fprintf(f, "%s%s=%.9g", sep, stage.first.c_str(), stage.second);
+      sep = " ";
+    }
+    fprintf(f, "\t");
+    sep = "";
+    for (double s : m.second.samples) {
+      fprintf(f, "%s%.9g", sep, s);
+      sep = " ";
+    }
+    fprintf(f, "\n");
+  }
+
+  return fclose(f) == 0;
+}
+
+bool Baseline::read(const char* fileName) {
+  std::ifstream in(fileName);
+  std::string line;
+  if (!std::getline(in, line) || line != header)
+    return false;
+
+  measurements.clear();
+  while (std::getline(in, line)) {
+    std::vector<std::string> fields;
+    std::istringstream fieldStream(line);
+    for (std::string field; std::getline(fieldStream, field, '\t');)
+      fields.emplace_back(field);
+    if (fields.size() < 5)
+      return false;
+
+    Measurement& m = measurements[fields[0]];
+    m.iterationsPerRun = std::stol(fields[1]);
+
+    std::istringstream stageStream(fields[4]);
+    for (std::string stage; stageStream >> stage;) {
+      const auto eq = stage.find('=');
+      if (eq == std::string::npos)
+        return false;
+      m.stages[stage.substr(0, eq)] = std::stod(stage.substr(eq + 1));
+    }
+
+    if (fields.size() > 5) {
+      std::istringstream sampleStream(fields[5]);
+      for (double s; sampleStream >> s;)
+        m.samples.emplace_back(s);
+    }
+  }
+
+  return true;
+}
+
+double mannWhitneyU(const std::vector<double>& a,
+                    const std::vector<double>& b) {
+  const size_t n1 = a.size();
+  const size_t n2 = b.size();
+  if (n1 < 3 || n2 < 3)
+    return 1;
+
+  // The ranks of the pooled samples, the ties getting their mean rank.
+  std::vector<std::pair<double, bool>> pooled;
+  pooled.reserve(n1 + n2);
+  for (double v : a)
+    pooled.emplace_back(v, true);
+  for (double v : b)
+    pooled.emplace_back(v, false);
+  std::sort(pooled.begin(), pooled.end());
+
+  const size_t n = pooled.size();
+  double rankSumA = 0;
+  double ties = 0; // The sum of t^3 - t over the groups of t tied ones.
+  for (size_t i = 0; i < n;) {
+    size_t j = i;
+    while (j < n && pooled[j].first == pooled[i].first)
+      j++;
+    const double rank = (i + 1 + j) / 2.0;
+    for (size_t k = i; k < j; k++) {
+      if (pooled[k].second)
+        rankSumA += rank;
+    }
+    const double t = j - i;
+    ties += t * t * t - t;
+    i = j;
+  }
+
+  const double u = rankSumA - n1 * (n1 + 1) / 2.0;
+  const double mean = n1 * n2 / 2.0;
+  const double variance =
+      n1 * n2 / 12.0 * ((n + 1) - ties / (static_cast<double>(n) * (n - 1)));
+  if (variance <= 0)
+    return 1;
+
+  // With the continuity correction.
+  const double z = std::max(std::fabs(u - mean) - 0.5, 0.0) /
+                   std::sqrt(variance);
+  return std::erfc(z / std::sqrt(2.0));
+}
+
+std::vector<Comparison> compare(const Baseline& baseline,
+                                const Baseline& current, double alpha,
+                                double threshold) {
+  std::vector<Comparison> comparisons;
+  for (const auto& m : current.measurements) {
+    const auto before = baseline.measurements.find(m.first);
+    if (before == baseline.measurements.end())
+      continue;
+
+    Comparison c;
+    c.name = m.first;
+    c.baselineMedian = before->second.getMedian();
+    c.median = m.second.getMedian();
+    c.change =
+        c.baselineMedian > 0 ? c.median / c.baselineMedian - 1 : 0;
+    c.pValue = mannWhitneyU(before->second.samples, m.second.samples);
+    c.verdict = Comparison::UNCHANGED;
+    if (c.pValue < alpha && c.change > threshold)
+      c.verdict = Comparison::SLOWER;
+    else if (c.pValue < alpha && c.change < -threshold)
+      c.verdict = Comparison::FASTER;
+    comparisons.emplace_back(c);
+  }
+  return comparisons;
+}
+
+} // namespace rsbench
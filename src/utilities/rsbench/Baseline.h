@@ -0,0 +1,88 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <map>    // for map
+#include <string> // for string
+#include <vector> // for vector
+
+namespace rsbench {
+
+// The wall times of the iterations of one benchmark, e.g. of a file at some
+// number of threads, in seconds, and the per-iteration means of the stages
+// of the decoding, as the counters of the benchmark, e.g. "Decode,s".
+struct Measurement final {
+  std::vector<double> samples;
+  std::map<std::string, double> stages;
+  // The iterations of the run that the samples are of. Google Benchmark
+  // first runs each benchmark with the fewer iterations, to estimate how
+  // many it needs, so only the samples of the longest runs are kept, and
+  // those of all of the repetitions of such a run.
+  long iterationsPerRun = 0;
+
+  void addRun(long iterations, const std::vector<double>& runSamples,
+              const std::map<std::string, double>& runStages);
+
+  double getMedian() const;
+  // The median absolute deviation from the median, unscaled.
+  double getMAD() const;
+};
+
+// The measurements of a run of rsbench, by the name of the benchmark. It is
+// written as the text, one benchmark per line, with all of the samples, so
+// that a later run can be compared with it.
+class Baseline final {
+public:
+  std::map<std::string, Measurement> measurements;
+
+  // Both return whether that worked.
+  bool write(const char* fileName) const;
+  bool read(const char* fileName);
+};
+
+// Of one benchmark that is in both of the runs.
+struct Comparison final {
+  std::string name;
+  double baselineMedian;
+  double median;
+  // Of the median, relative to the baseline, e.g. 0.05 if 5% slower.
+  double change;
+  // Of the two-sided Mann-Whitney U test of the samples.
+  double pValue;
+  enum Verdict { UNCHANGED, FASTER, SLOWER } verdict;
+};
+
+// The two-sided p-value of whether the samples come from the same
+// distribution, the normal approximation of the Mann-Whitney U test, with
+// the correction for the ties. It makes no assumptions about the shape of
+// the distributions, which, for the timings, are skewed, and have outliers.
+// With less than 3 samples on either side, it is 1, as nothing can be told.
+double mannWhitneyU(const std::vector<double>& a, const std::vector<double>& b);
+
+// A change is significant if its p-value is below alpha, and then it is
+// only reported as faster or slower if the median changed by more than the
+// threshold, e.g. 0.05, as the small but consistent changes, e.g. because of
+// the layout of the code, are not worth the attention.
+std::vector<Comparison> compare(const Baseline& baseline,
+                                const Baseline& current, double alpha,
+                                double threshold);
+
+} // namespace rsbench
@@ -0,0 +1,107 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "PerfCounters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h> // for perf_event_attr, PERF_COUNT_HW_CPU_C...
+#include <sys/syscall.h>      // for SYS_perf_event_open
+#include <unistd.h>           // for close, read, syscall, getpid
+#endif
+
+namespace rsbench {
+
+const char* PerfCounters::getName(Event event) {
+  switch (event) {
+  case CYCLES:
+    return "Cycles";
+  case INSTRUCTIONS:
+    return "Instructions";
+  case BRANCH_MISSES:
+    return "BranchMisses";
+  case LLC_MISSES:
+    return "LLCMisses";
+  case DTLB_MISSES:
+    return "dTLBMisses";
+  default:
+    return "";
+  }
+}
+
+#if defined(__linux__)
+
+PerfCounters::PerfCounters() {
+  struct Config {
+    rawspeed::uint32 type;
+    rawspeed::uint64 config;
+  };
+  static constexpr std::array<Config, EVENT_COUNT> configs = {{
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HW_CACHE,
+       PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8U) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16U)},
+  }};
+
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = configs[i].type;
+    attr.config = configs[i].config;
+    // Of the threads that are started later too, and only of the user space.
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Of this process, on any of the CPUs.
+    fds[i] = static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, getpid(), -1, -1, 0));
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (const int fd : fds) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+PerfCounters::Values PerfCounters::read() const {
+  Values values{};
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    rawspeed::uint64 value;
+    if (fds[i] >= 0 && ::read(fds[i], &value, sizeof(value)) == sizeof(value))
+      values[i] = value;
+  }
+  return values;
+}
+
+#else
+
+PerfCounters::PerfCounters() { fds.fill(-1); }
+
+PerfCounters::~PerfCounters() = default;
+
+PerfCounters::Values PerfCounters::read() const { return {}; }
+
+#endif
+
+} // namespace rsbench
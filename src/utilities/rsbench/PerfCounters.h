@@ -0,0 +1,61 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uint64
+#include <array>           // for array
+
+namespace rsbench {
+
+// The hardware counters of the whole process, of all of its threads, via
+// perf_event_open(2). The threads must all be started after the counters
+// are, e.g. it has to be constructed before the first decode. Only on Linux,
+// elsewhere, or if the kernel does not allow it, e.g. because of the
+// perf_event_paranoid, none of them are available.
+class PerfCounters final {
+public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    LLC_MISSES,
+    DTLB_MISSES,
+    EVENT_COUNT
+  };
+  using Values = std::array<rawspeed::uint64, EVENT_COUNT>;
+
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  static const char* getName(Event event);
+
+  bool isAvailable(Event event) const { return fds[event] >= 0; }
+
+  // Since the construction. The unavailable ones are 0.
+  Values read() const;
+
+private:
+  std::array<int, EVENT_COUNT> fds;
+};
+
+} // namespace rsbench
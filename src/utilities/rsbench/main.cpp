@@ -18,17 +18,34 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include "Baseline.h"            // for Baseline, Measurement, compare
+#include "PerfCounters.h"        // for PerfCounters
 #include "RawSpeed-API.h"        // for RawDecoder, FileReader, RawImage
 #include "common/ChecksumFile.h" // for ChecksumFileEntry, ReadChecksumFile
+#include "common/Cpuid.h"        // for Cpuid
+#include "common/Memory.h"       // for alignedMalloc, alignedFree
+#include <algorithm>             // for sort, max
+#include <atomic>                // for atomic
 #include <benchmark/benchmark.h> // for State, DoNotOptimize, Initialize
 #include <chrono>                // for duration, high_resolution_clock
+#include <cmath>                 // for ceil
+#include <cstdio>                // for fprintf, stderr, fopen, fputs
+#include <cstdlib>               // for atoi, atoll, atof
 #include <ctime>                 // for clock, clock_t
-#include <memory>                // for unique_ptr
+#include <map>                   // for map
+#include <memory>                // for unique_ptr, make_shared
 #include <ratio>                 // for ratio
 #include <string>                // for string, operator!=, to_string
 #include <sys/time.h>            // for CLOCKS_PER_SEC
+#include <thread>                // for thread
 #include <vector>                // for vector
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>    // for open, posix_fadvise, O_RDONLY, O_DIRECT
+#include <sys/stat.h> // for fstat, stat
+#include <unistd.h>   // for close, pread
+#endif
+
 #ifdef HAVE_OPENMP
 #include <omp.h>
 #endif
@@ -36,9 +53,14 @@
 #define HAVE_STEADY_CLOCK
 
 using rawspeed::CameraMetaData;
+using rawspeed::Buffer;
+using rawspeed::Executor;
 using rawspeed::FileReader;
+using rawspeed::RawDecoder;
 using rawspeed::RawImage;
 using rawspeed::RawParser;
+using rawspeed::RawspeedException;
+using rawspeed::ThreadPoolExecutor;
 
 namespace {
 
@@ -87,50 +109,259 @@ template <typename Clock, typename period = std::ratio<1, 1>> struct Timer {
   }
 };
 
+// How the file gets into the memory.
+enum class IOMode {
+  Read,   // FileReader::readFile()
+  Map,    // FileReader::mapFile()
+  Direct, // read with O_DIRECT, bypassing the page cache
+};
+
+struct IOOptions {
+  IOMode mode = IOMode::Read;
+  // Whether the loading of the file is a part of the timed loop.
+  bool timed = false;
+  // Whether the file is dropped from the page cache before each iteration.
+  bool cold = false;
+};
+
+const char* getIOModeName(IOMode mode) {
+  switch (mode) {
+  case IOMode::Map:
+    return "mmap";
+  case IOMode::Direct:
+    return "direct";
+  default:
+    return "read";
+  }
+}
+
+// Returns nullptr if the file system does not support O_DIRECT.
+std::unique_ptr<const Buffer> readFileDirect(const char* fileName) {
+#if defined(O_DIRECT)
+  int fd = open(fileName, O_RDONLY | O_DIRECT);
+  if (fd < 0)
+    return nullptr;
+  std::unique_ptr<int, void (*)(const int*)> fdGuard(
+      &fd, [](const int* f) { close(*f); });
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    return nullptr;
+  const size_t fileSize = st.st_size;
+
+  // Both the buffer and the size of the reads must be aligned to the blocks.
+  constexpr size_t alignment = 4096;
+  const size_t allocSize = rawspeed::roundUp(fileSize + BUFFER_PADDING,
+                                             alignment);
+  std::unique_ptr<rawspeed::uchar8, decltype(&rawspeed::alignedFree)> data(
+      rawspeed::alignedMalloc<rawspeed::uchar8, alignment>(allocSize),
+      &rawspeed::alignedFree);
+  if (!data)
+    return nullptr;
+
+  for (size_t done = 0; done < fileSize;) {
+    const auto bytes = pread(fd, data.get() + done, allocSize - done, done);
+    if (bytes <= 0)
+      return nullptr;
+    done += bytes;
+  }
+
+  return std::make_unique<Buffer>(std::move(data), fileSize);
+#else
+  (void)fileName;
+  return nullptr;
+#endif
+}
+
+std::unique_ptr<const Buffer> loadFile(const char* fileName, IOMode mode) {
+  FileReader reader(fileName);
+  switch (mode) {
+  case IOMode::Map:
+    return reader.mapFile();
+  case IOMode::Direct:
+    return readFileDirect(fileName);
+  default:
+    return reader.readFile();
+  }
+}
+
+// Evicts the (clean) pages of the file from the page cache.
+void dropFromPageCache(const char* fileName) {
+#if defined(POSIX_FADV_DONTNEED)
+  const int fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+#else
+  (void)fileName;
+#endif
+}
+
 } // namespace
 
-static int currThreadCount;
+static IOOptions ioOptions;
+// If set, only checkSupport() and decodeMetaData(), without decodeRaw().
+static bool metaDataOnly = false;
+// If set, the hardware counters are reported too.
+static std::unique_ptr<rsbench::PerfCounters> perfCounters;
+// Of all of the benchmarks of this run, for -B and -C.
+static rsbench::Baseline measured;
 
+// Only for the default executor, the decoders are given their own ones.
 extern "C" int __attribute__((pure)) rawspeed_get_number_of_processor_cores() {
-  return currThreadCount;
+  return std::thread::hardware_concurrency();
 }
 
-static inline void BM_RawSpeed(benchmark::State& state, const char* fileName,
-                               int threads) {
-  currThreadCount = threads;
-
+static const CameraMetaData& getMetaData() {
 #ifdef HAVE_PUGIXML
   static const CameraMetaData metadata(CMAKE_SOURCE_DIR "/data/cameras.xml");
 #else
   static const CameraMetaData metadata{};
 #endif
+  return metadata;
+}
 
-  FileReader reader(fileName);
-  const auto map(reader.readFile());
+static rsbench::PerfCounters::Values
+operator-(const rsbench::PerfCounters::Values& a,
+          const rsbench::PerfCounters::Values& b) {
+  rsbench::PerfCounters::Values d;
+  for (size_t i = 0; i < d.size(); i++)
+    d[i] = a[i] - b[i];
+  return d;
+}
+
+static rsbench::PerfCounters::Values&
+operator+=(rsbench::PerfCounters::Values& a,
+           const rsbench::PerfCounters::Values& b) {
+  for (size_t i = 0; i < a.size(); i++)
+    a[i] += b[i];
+  return a;
+}
+
+// Of the whole process, so these are only meaningful if nothing else runs.
+static rsbench::PerfCounters::Values readPerfCounters() {
+  return perfCounters ? perfCounters->read() : rsbench::PerfCounters::Values{};
+}
+
+// The counters that are available, per iteration, and the instructions per
+// cycle.
+static void addPerfCounters(benchmark::State& state,
+                            const rsbench::PerfCounters::Values& total) {
+  if (!perfCounters)
+    return;
+
+  using rsbench::PerfCounters;
+  for (int i = 0; i < PerfCounters::EVENT_COUNT; i++) {
+    const auto event = static_cast<PerfCounters::Event>(i);
+    if (perfCounters->isAvailable(event)) {
+      state.counters[PerfCounters::getName(event)] =
+          static_cast<double>(total[i]) / state.iterations();
+    }
+  }
+  if (total[PerfCounters::CYCLES] != 0) {
+    state.counters["IPC"] =
+        static_cast<double>(total[PerfCounters::INSTRUCTIONS]) /
+        total[PerfCounters::CYCLES];
+  }
+  if (total[PerfCounters::INSTRUCTIONS] != 0) {
+    state.counters["BranchMisses/KiloInstructions"] =
+        1000.0 * total[PerfCounters::BRANCH_MISSES] /
+        total[PerfCounters::INSTRUCTIONS];
+  }
+}
+
+static inline void BM_RawSpeed(benchmark::State& state, const char* fileName,
+                               int threads, const std::string& name) {
+  const std::shared_ptr<Executor> executor =
+      std::make_shared<ThreadPoolExecutor>(threads);
+
+  const CameraMetaData& metadata = getMetaData();
+
+  std::string label = getIOModeName(ioOptions.mode);
+  if (ioOptions.timed)
+    label += ioOptions.cold ? ",cold" : ",hot";
+  if (metaDataOnly)
+    label += ",metadata";
+  state.SetLabel(label);
+
+  // Unless it is timed, the file is only loaded once.
+  std::unique_ptr<const Buffer> map;
+  if (!ioOptions.timed) {
+    map = loadFile(fileName, ioOptions.mode);
+    if (!map) {
+      state.SkipWithError("Can not read the file with O_DIRECT");
+      return;
+    }
+  }
 
   Timer<ChooseClockType::type> WT;
   Timer<CPUClock> TT;
 
+  // The time it took to drop the file from the cache, which is not counted.
+  double DropWallTime = 0;
+  double DropCPUTime = 0;
+
+  // The wall time of the parsing, and of each of the stages of the decoder.
+  double ParseTime = 0;
+  RawDecoder::StageTimes stageTimes{};
+
+  // Only of the decoding, as the wall time of the stages.
+  rsbench::PerfCounters::Values perfTotal{};
+
+  // The wall time of each of the iterations.
+  std::vector<double> samples;
+  samples.reserve(state.max_iterations);
+
   unsigned pixels = 0;
   for (auto _ : state) {
+    Timer<ChooseClockType::type> IT;
+    if (ioOptions.timed) {
+      if (ioOptions.cold) {
+        state.PauseTiming();
+        Timer<ChooseClockType::type> DWT;
+        Timer<CPUClock> DTT;
+        map.reset();
+        dropFromPageCache(fileName);
+        DropWallTime += DWT().count();
+        DropCPUTime += DTT().count();
+        state.ResumeTiming();
+        IT();
+      }
+
+      map = loadFile(fileName, ioOptions.mode);
+      if (!map) {
+        state.SkipWithError("Can not read the file with O_DIRECT");
+        return;
+      }
+    }
+
+    const auto perfStart = readPerfCounters();
+    Timer<ChooseClockType::type> PT;
     RawParser parser(map.get());
     auto decoder(parser.getDecoder(&metadata));
+    ParseTime += PT().count();
 
+    decoder->executor = executor;
+    decoder->stageTimes = &stageTimes;
     decoder->failOnUnknown = false;
     decoder->checkSupport(&metadata);
 
-    decoder->decodeRaw();
+    if (!metaDataOnly)
+      decoder->decodeRaw();
     decoder->decodeMetaData(&metadata);
     RawImage raw = decoder->mRaw;
 
     benchmark::DoNotOptimize(raw);
+    perfTotal += readPerfCounters() - perfStart;
 
     pixels = raw->getUncroppedDim().area();
+    samples.emplace_back(IT().count());
   }
 
   // These are total over all the `state.iterations()` iterations.
-  const double CPUTime = TT().count();
-  const double WallTime = WT().count();
+  const double CPUTime = TT().count() - DropCPUTime;
+  const double WallTime = WT().count() - DropWallTime;
 
   // For each iteration:
   state.counters.insert({
@@ -144,15 +375,196 @@ static inline void BM_RawSpeed(benchmark::State& state, const char* fileName,
       {"Raws/CPUTime", state.iterations() / CPUTime},
       {"Raws/WallTime", state.iterations() / WallTime},
   });
+
+  // And where the wall time went.
+  const auto perIteration = [&state](double t) {
+    return t / state.iterations();
+  };
+  const std::map<std::string, double> stages = {
+      {"Parse,s", perIteration(ParseTime)},
+      {"CheckSupport,s",
+       perIteration(stageTimes[RawDecoder::STAGE_CHECK_SUPPORT])},
+      {"Decode,s", perIteration(stageTimes[RawDecoder::STAGE_DECODE])},
+      {"PostProcess,s",
+       perIteration(stageTimes[RawDecoder::STAGE_POST_PROCESS])},
+      {"MetaData,s", perIteration(stageTimes[RawDecoder::STAGE_METADATA])},
+  };
+  state.counters.insert(stages.begin(), stages.end());
+  addPerfCounters(state, perfTotal);
+  measured.measurements[name].addRun(state.iterations(), samples, stages);
   // Could also have counters wrt. the filesize,
   // but i'm not sure they are interesting.
 }
 
+// Decodes all of the files, by decoders decoders at once, each one of them
+// using the threads threads within the file. The files are loaded once.
+static void BM_Throughput(benchmark::State& state,
+                          const std::vector<std::string>* fileNames,
+                          int decoders, int threads, const std::string& name) {
+  // Each of the decoders has threads threads of its own.
+  std::vector<std::shared_ptr<Executor>> executors;
+  for (int worker = 0; worker < decoders; worker++)
+    executors.emplace_back(std::make_shared<ThreadPoolExecutor>(threads));
+
+  const CameraMetaData& metadata = getMetaData();
+
+  state.SetLabel(getIOModeName(ioOptions.mode));
+
+  std::vector<std::unique_ptr<const Buffer>> maps;
+  for (const auto& fileName : *fileNames) {
+    maps.emplace_back(loadFile(fileName.c_str(), ioOptions.mode));
+    if (!maps.back()) {
+      state.SkipWithError("Can not read the file with O_DIRECT");
+      return;
+    }
+  }
+
+  // The wall time of each of the decodes, over all the iterations.
+  std::vector<double> latencies;
+  double pixels = 0;
+  std::string error;
+  // And of each of the iterations, over all of the files.
+  std::vector<double> samples;
+
+  Timer<ChooseClockType::type> WT;
+  Timer<CPUClock> TT;
+  const auto perfStart = readPerfCounters();
+
+  for (auto _ : state) {
+    Timer<ChooseClockType::type> IT;
+    std::atomic<size_t> next{0};
+    std::vector<std::vector<double>> workerLatencies(decoders);
+    std::vector<double> workerPixels(decoders);
+    std::vector<std::string> workerErrors(decoders);
+
+    const auto work = [&](int worker) {
+      try {
+        for (size_t i; (i = next++) < maps.size();) {
+          Timer<ChooseClockType::type> LT;
+          RawParser parser(maps[i].get());
+          auto decoder(parser.getDecoder(&metadata));
+          decoder->executor = executors[worker];
+          decoder->failOnUnknown = false;
+          decoder->checkSupport(&metadata);
+          decoder->decodeRaw();
+          decoder->decodeMetaData(&metadata);
+          RawImage raw = decoder->mRaw;
+          benchmark::DoNotOptimize(raw);
+
+          workerLatencies[worker].emplace_back(LT().count());
+          workerPixels[worker] += raw->getUncroppedDim().area();
+        }
+      } catch (RawspeedException& e) {
+        workerErrors[worker] = e.what();
+        next = maps.size();
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (int worker = 1; worker < decoders; worker++)
+      workers.emplace_back(work, worker);
+    work(0);
+    for (auto& worker : workers)
+      worker.join();
+
+    for (int worker = 0; worker < decoders; worker++) {
+      latencies.insert(latencies.end(), workerLatencies[worker].begin(),
+                       workerLatencies[worker].end());
+      pixels += workerPixels[worker];
+      if (error.empty())
+        error = workerErrors[worker];
+    }
+    if (!error.empty()) {
+      state.SkipWithError(error.c_str());
+      return;
+    }
+    samples.emplace_back(IT().count());
+  }
+
+  const double CPUTime = TT().count();
+  const double WallTime = WT().count();
+  const auto perfTotal = readPerfCounters() - perfStart;
+
+  std::sort(latencies.begin(), latencies.end());
+  // The nearest-rank percentile.
+  const auto percentile = [&latencies](double p) {
+    if (latencies.empty())
+      return 0.0;
+    const auto rank = static_cast<size_t>(std::ceil(p * latencies.size()));
+    return latencies[std::max<size_t>(rank, 1) - 1];
+  };
+
+  state.counters.insert({
+      {"CPUTime/WallTime", CPUTime / WallTime},
+      {"Pixels/WallTime", pixels / WallTime},
+      {"Raws/WallTime", latencies.size() / WallTime},
+      {"Latency,p50,s", percentile(0.50)},
+      {"Latency,p99,s", percentile(0.99)},
+  });
+  addPerfCounters(state, perfTotal);
+  measured.measurements[name].addRun(state.iterations(), samples, {});
+}
+
+// Writes the measurements of this run as the baseline, and/or compares them
+// with the given one. Returns the exit code of rsbench, which is 1 if any of
+// the benchmarks got slower than that by more than the threshold.
+static int finishBaseline(const char* writeTo, const char* compareWith,
+                          double threshold) {
+  if (writeTo && !measured.write(writeTo)) {
+    fprintf(stderr, "Can not write the baseline to %s\n", writeTo);
+    return 1;
+  }
+  if (!compareWith)
+    return 0;
+
+  rsbench::Baseline baseline;
+  if (!baseline.read(compareWith)) {
+    fprintf(stderr, "Can not read the baseline from %s\n", compareWith);
+    return 1;
+  }
+
+  static constexpr double alpha = 0.05;
+  const auto comparisons =
+      rsbench::compare(baseline, measured, alpha, threshold);
+
+  int slower = 0;
+  printf("\nCompared with %s (p < %.2f, threshold %.1f%%):\n", compareWith,
+         alpha, 100.0 * threshold);
+  for (const auto& c : comparisons) {
+    const char* verdict = "";
+    if (c.verdict == rsbench::Comparison::FASTER)
+      verdict = "FASTER";
+    else if (c.verdict == rsbench::Comparison::SLOWER)
+      verdict = "SLOWER";
+    printf("%-7s %-50s %10.3f ms -> %10.3f ms %+7.1f%% p=%.4f", verdict,
+           c.name.c_str(), 1e3 * c.baselineMedian, 1e3 * c.median,
+           100.0 * c.change, c.pValue);
+
+    // Which of the stages that is in.
+    if (c.verdict != rsbench::Comparison::UNCHANGED) {
+      const auto& before = baseline.measurements.at(c.name).stages;
+      for (const auto& stage : measured.measurements.at(c.name).stages) {
+        const auto b = before.find(stage.first);
+        if (b != before.end() && b->second > 0)
+          printf("  %s %+.1f%%", stage.first.c_str(),
+                 100.0 * (stage.second / b->second - 1));
+      }
+    }
+    printf("\n");
+
+    slower += c.verdict == rsbench::Comparison::SLOWER;
+  }
+  if (comparisons.empty())
+    printf("None of the benchmarks are in the baseline\n");
+
+  return slower ? 1 : 0;
+}
+
 static void addBench(const char* fName, std::string tName, int threads) {
   tName += std::to_string(threads);
 
-  auto* b =
-      benchmark::RegisterBenchmark(tName.c_str(), &BM_RawSpeed, fName, threads);
+  auto* b = benchmark::RegisterBenchmark(tName.c_str(), &BM_RawSpeed, fName,
+                                         threads, tName);
   b->Unit(benchmark::kMillisecond);
   b->UseRealTime();
 }
@@ -173,6 +585,136 @@ int main(int argc, char** argv) {
 
   bool threading = hasFlag("-t");
 
+  // -k K decodes all of the files, by K decoders at once, instead.
+  int decoders = 0;
+  if (int k = hasFlag("-k")) {
+    if (k + 1 < argc && argv[k + 1]) {
+      decoders = std::atoi(argv[k + 1]);
+      argv[k + 1] = nullptr;
+    }
+    if (decoders <= 0) {
+      fprintf(stderr, "-k needs a positive number of decoders\n");
+      return 1;
+    }
+  }
+
+  // -T FILE writes the events of the tracing into the FILE, to be opened in
+  // chrome://tracing. There are only some if built WITH_TRACING.
+  std::shared_ptr<rawspeed::ChromeTraceWriter> traceWriter;
+  const char* traceFile = nullptr;
+  if (int t = hasFlag("-T")) {
+    if (t + 1 < argc && argv[t + 1]) {
+      traceFile = argv[t + 1];
+      argv[t + 1] = nullptr;
+    }
+    if (!traceFile) {
+      fprintf(stderr, "-T needs a file name\n");
+      return 1;
+    }
+    traceWriter = std::make_shared<rawspeed::ChromeTraceWriter>();
+    rawspeed::setTracer(traceWriter);
+  }
+  const auto writeTrace = [&traceWriter, traceFile]() {
+    if (!traceWriter)
+      return;
+    rawspeed::setTracer(nullptr);
+    FILE* f = fopen(traceFile, "w");
+    if (!f) {
+      fprintf(stderr, "Can not write the trace to %s\n", traceFile);
+      return;
+    }
+    fputs(traceWriter->getJSON().c_str(), f);
+    fclose(f);
+  };
+
+  // -p also reports the hardware counters, see PerfCounters. They are set up
+  // before any of the threads are started, so that those are counted too.
+  if (hasFlag("-p")) {
+    perfCounters = std::make_unique<rsbench::PerfCounters>();
+    if (!perfCounters->isAvailable(rsbench::PerfCounters::CYCLES))
+      fprintf(stderr, "The hardware counters are not available\n");
+  }
+
+  // -x FEATURES disables these CPU features too, as RAWSPEED_CPU_DISABLE
+  // does, e.g. "-x avx2,avx512bw", or "-x all" for the scalar kernels. So
+  // that the variants of the kernels can be compared on the same machine.
+  if (int x = hasFlag("-x")) {
+    const char* features = nullptr;
+    if (x + 1 < argc && argv[x + 1]) {
+      features = argv[x + 1];
+      argv[x + 1] = nullptr;
+    }
+    if (!features) {
+      fprintf(stderr, "-x needs a list of the CPU features\n");
+      return 1;
+    }
+    using rawspeed::Cpuid;
+    Cpuid::setEnabled(Cpuid::getEnabled() & ~Cpuid::parse(features));
+  }
+  {
+    using rawspeed::Cpuid;
+    std::string features;
+    for (unsigned bit = 1; bit & Cpuid::FEATURE_ALL; bit <<= 1) {
+      if (Cpuid::getEnabled() & bit) {
+        features += features.empty() ? "" : ",";
+        features += Cpuid::getName(static_cast<Cpuid::Feature>(bit));
+      }
+    }
+    fprintf(stderr, "CPU features: %s\n",
+            features.empty() ? "none" : features.c_str());
+  }
+
+  // The cost model of the parallel regions, see rawspeed::getMinTaskWork():
+  // -w BYTES sets it, or else it is calibrated on this machine.
+  if (int w = hasFlag("-w")) {
+    if (w + 1 >= argc || !argv[w + 1]) {
+      fprintf(stderr, "-w needs the bytes of work per task\n");
+      return 1;
+    }
+    rawspeed::setMinTaskWork(std::atoll(argv[w + 1]));
+    argv[w + 1] = nullptr;
+  } else {
+    rawspeed::calibrateMinTaskWork(rawspeed::getExecutor());
+  }
+  fprintf(stderr, "Minimal work per task: %lld bytes\n",
+          static_cast<long long>(rawspeed::getMinTaskWork()));
+
+  // The I/O: -m maps the file, -d reads it with O_DIRECT. -i includes the
+  // loading of the file into the timed loop, -c also drops it from the page
+  // cache before each iteration.
+  if (hasFlag("-m"))
+    ioOptions.mode = IOMode::Map;
+  if (hasFlag("-d"))
+    ioOptions.mode = IOMode::Direct;
+  const bool timed = hasFlag("-i");
+  ioOptions.cold = hasFlag("-c");
+  ioOptions.timed = timed || ioOptions.cold;
+
+  // -M times the metadata alone, from the headers, as for a file browser.
+  metaDataOnly = hasFlag("-M");
+
+  // -B FILE writes the measurements as the baseline, see Baseline. -C FILE
+  // compares them with that one, and then rsbench fails if any benchmark got
+  // slower by more than -R PERCENT, 5 by default. Use the repetitions, e.g.
+  // --benchmark_repetitions=5, for the enough samples of the slow files.
+  const auto flagValue = [argc, argv, &hasFlag](const char* flag) {
+    const char* value = nullptr;
+    if (int f = hasFlag(flag)) {
+      if (f + 1 < argc && argv[f + 1]) {
+        value = argv[f + 1];
+        argv[f + 1] = nullptr;
+      }
+      if (!value)
+        fprintf(stderr, "%s needs a value\n", flag);
+    }
+    return value;
+  };
+  const char* baselineOut = flagValue("-B");
+  const char* baselineIn = flagValue("-C");
+  double threshold = 0.05;
+  if (const char* r = flagValue("-R"))
+    threshold = std::atof(r) / 100.0;
+
 #ifdef HAVE_OPENMP
   const auto threadsMax = omp_get_max_threads();
 #else
@@ -205,6 +747,27 @@ int main(int argc, char** argv) {
     ChecksumFileEntries.emplace_back(Entry);
   }
 
+  if (decoders) {
+    static std::vector<std::string> fileNames;
+    for (const auto& Entry : ChecksumFileEntries)
+      fileNames.emplace_back(Entry.FullFileName);
+
+    for (auto threads = threadsMin; threads <= threadsMax; threads++) {
+      const std::string tName = "throughput/decoders:" +
+                                std::to_string(decoders) +
+                                "/threads:" + std::to_string(threads);
+      auto* b = benchmark::RegisterBenchmark(tName.c_str(), &BM_Throughput,
+                                             &fileNames, decoders, threads,
+                                             tName);
+      b->Unit(benchmark::kMillisecond);
+      b->UseRealTime();
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    writeTrace();
+    return finishBaseline(baselineOut, baselineIn, threshold);
+  }
+
   // And finally, actually add the raws to be benchmarked.
   for (const auto& Entry : ChecksumFileEntries) {
     const char* fName = Entry.RelFileName.c_str();
@@ -216,4 +779,6 @@ int main(int argc, char** argv) {
   }
 
   benchmark::RunSpecifiedBenchmarks();
+  writeTrace();
+  return finishBaseline(baselineOut, baselineIn, threshold);
 }
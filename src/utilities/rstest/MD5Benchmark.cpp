@@ -18,11 +18,12 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
-#include "md5.h"                     // for md5_hash, md5_state
-#include <benchmark/benchmark.h>     // for State, Benchmark, BENCHMARK
-#include <cstdint>                   // for uint8_t
-#include <cstdlib>                   // for free, malloc, size_t
-#include <memory>                    // for unique_ptr
+#include "md5.h"                 // for md5_hash, md5_state
+#include "common/XXH64.h"        // for xxh64_hash
+#include <benchmark/benchmark.h> // for State, Benchmark, BENCHMARK
+#include <cstdint>               // for uint8_t
+#include <cstdlib>               // for free, malloc, size_t
+#include <memory>                // for unique_ptr
 
 static inline void BM_MD5(benchmark::State& state) {
   const size_t bufsize = state.range(0) * sizeof(char);
@@ -38,6 +39,21 @@ static inline void BM_MD5(benchmark::State& state) {
   state.SetBytesProcessed(1UL * sizeof(char) * state.items_processed());
 }
 
+// What rstest -x uses instead.
+static inline void BM_XXH64(benchmark::State& state) {
+  const size_t bufsize = state.range(0) * sizeof(char);
+  std::unique_ptr<char, decltype(&free)> buf((char*)malloc(bufsize), &free);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        rawspeed::xxh64::xxh64_hash((uint8_t*)buf.get(), bufsize));
+  }
+
+  state.SetComplexityN(state.range(0));
+  state.SetItemsProcessed(state.complexity_length_n() * state.iterations());
+  state.SetBytesProcessed(1UL * sizeof(char) * state.items_processed());
+}
+
 static inline void CustomArguments(benchmark::internal::Benchmark* b) {
   b->RangeMultiplier(2);
 #if 1
@@ -49,5 +65,6 @@ static inline void CustomArguments(benchmark::internal::Benchmark* b) {
 }
 
 BENCHMARK(BM_MD5)->Apply(CustomArguments);
+BENCHMARK(BM_XXH64)->Apply(CustomArguments);
 
 BENCHMARK_MAIN();
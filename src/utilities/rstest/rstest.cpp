@@ -20,22 +20,23 @@
 
 #include "RawSpeed-API.h"
 
-#include "md5.h"       // for md5_state, md5_hash, hash_to_string, md5_init
-#include <array>       // for array
-#include <cassert>     // for assert
-#include <chrono>      // for milliseconds, steady_clock, duration_cast
-#include <cstdarg>     // for va_end, va_list, va_start
-#include <cstdint>     // for uint8_t
-#include <cstdio>      // for fprintf, fclose, size_t, fopen, ftell, fwrite
-#include <cstdlib>     // for system
-#include <fstream>     // IWYU pragma: keep
-#include <iostream>    // for cout, left, cerr, internal
-#include <map>         // for map
-#include <memory>      // for allocator, unique_ptr
-#include <sstream>     // IWYU pragma: keep
-#include <string>      // for string, operator+, operator<<, char_traits
-#include <utility>     // for pair
-#include <vector>      // for vector
+#include "md5.h"          // for md5_state, md5_hash, hash_to_string, md5_init
+#include "common/XXH64.h" // for xxh64_state, xxh64_hash, hash_to_string
+#include <array>          // for array
+#include <cassert>        // for assert
+#include <chrono>         // for milliseconds, steady_clock, duration_cast
+#include <cstdarg>        // for va_end, va_list, va_start
+#include <cstdint>        // for uint8_t
+#include <cstdio>         // for fprintf, fclose, size_t, fopen, ftell, fwrite
+#include <cstdlib>        // for system
+#include <fstream>        // IWYU pragma: keep
+#include <iostream>       // for cout, left, cerr, internal
+#include <map>            // for map
+#include <memory>         // for allocator, unique_ptr
+#include <sstream>        // IWYU pragma: keep
+#include <string>         // for string, operator+, operator<<, char_traits
+#include <utility>        // for pair
+#include <vector>         // for vector
 // IWYU pragma: no_include <ext/alloc_traits.h>
 
 #if !defined(__has_feature) || !__has_feature(thread_sanitizer)
@@ -92,12 +93,16 @@ namespace rawspeed {
 
 namespace rstest {
 
-std::string img_hash(const rawspeed::RawImage& r);
+// The hash of the image data. MD5 is what the existing .hash files have.
+enum class HashType { MD5, XXH64 };
+
+std::string img_hash(const rawspeed::RawImage& r, HashType type);
 
 void writePPM(const rawspeed::RawImage& raw, const std::string& fn);
 void writePFM(const rawspeed::RawImage& raw, const std::string& fn);
 
 md5::md5_state imgDataHash(const rawspeed::RawImage& raw);
+xxh64::xxh64_state imgDataHashXXH64(const rawspeed::RawImage& raw);
 
 void writeImage(const rawspeed::RawImage& raw, const std::string& fn);
 
@@ -105,8 +110,27 @@ struct options {
   bool create;
   bool force;
   bool dump;
+  HashType hash; // of the new .hash files
+
+  // Only the files of the shard'th of the shards parts are processed.
+  uint32 shard;
+  uint32 shards;
 };
 
+// Parses "i/N", with i < N.
+bool parseShard(const std::string& arg, options* o);
+
+// Whether the file belongs to the shard. It only depends on the path,
+// so all the machines agree on it.
+bool inShard(const std::string& filename, const options& o);
+
+// Whether the file is skipped, because its hash exists or is missing.
+bool skipFile(const std::string& filename, const options& o);
+
+// One line of the machine-readable results, a JSON object.
+std::string jsonResult(const std::string& filename, const char* status,
+                       size_t time, const std::string& message);
+
 size_t process(const std::string& filename,
                const rawspeed::CameraMetaData* metadata, const options& o);
 
@@ -142,10 +166,11 @@ md5::md5_state imgDataHash(const RawImage& raw) {
   vector<md5::md5_state> line_hashes;
   line_hashes.resize(dimUncropped.y, md5::md5_init);
 
-  for (int j = 0; j < dimUncropped.y; j++) {
+  // The lines are hashed independently, so they can be hashed in parallel.
+  parallelFor(0, dimUncropped.y, [&raw, &line_hashes](int j) {
     auto* d = raw->getDataUncropped(0, j);
     md5::md5_hash(d, raw->pitch - raw->padding, &line_hashes[j]);
-  }
+  });
 
   md5::md5_hash(reinterpret_cast<const uint8_t*>(&line_hashes[0]),
                 sizeof(line_hashes[0]) * line_hashes.size(), &ret);
@@ -153,6 +178,22 @@ md5::md5_state imgDataHash(const RawImage& raw) {
   return ret;
 }
 
+// The same, but with XXH64, and the line hashes are serialized little-endian.
+xxh64::xxh64_state imgDataHashXXH64(const RawImage& raw) {
+  const iPoint2D dimUncropped = raw->getUncroppedDim();
+
+  vector<uint8_t> line_hashes(sizeof(xxh64::xxh64_state) * dimUncropped.y);
+
+  parallelFor(0, dimUncropped.y, [&raw, &line_hashes](int j) {
+    auto* d = raw->getDataUncropped(0, j);
+    xxh64::xxh64_state h = xxh64::xxh64_hash(d, raw->pitch - raw->padding);
+    for (size_t k = 0; k < sizeof(h); k++, h >>= 8)
+      line_hashes[sizeof(h) * j + k] = h & 0xFF;
+  });
+
+  return xxh64::xxh64_hash(line_hashes.data(), line_hashes.size());
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpragmas"
 #pragma GCC diagnostic ignored "-Wunknown-warning-option"
@@ -172,7 +213,7 @@ APPEND(ostringstream* oss, const char* format, ...) {
   *oss << line.data();
 }
 
-string img_hash(const RawImage& r) {
+string img_hash(const RawImage& r, HashType type) {
   ostringstream oss;
 
   APPEND(&oss, "make: %s\n", r->metadata.make.c_str());
@@ -226,15 +267,23 @@ string img_hash(const RawImage& r) {
   APPEND(&oss, "badPixelPositions: ");
   {
     MutexLocker guard(&r->mBadPixelMutex);
-    for (uint32 p : r->mBadPixelPositions)
-      APPEND(&oss, "%d, ", p);
+    // In the x | (y << 16) form that they used to be stored in.
+    for (const auto p : r->mBadPixelPositions) {
+      const auto y = static_cast<unsigned long long>(rawspeed::getBadPixelY(p));
+      APPEND(&oss, "%llu, ", y << 16 | rawspeed::getBadPixelX(p));
+    }
   }
 
   APPEND(&oss, "\n");
 
-  rawspeed::md5::md5_state hash_of_line_hashes = imgDataHash(r);
-  APPEND(&oss, "md5sum of per-line md5sums: %s\n",
-         rawspeed::md5::hash_to_string(hash_of_line_hashes).c_str());
+  if (type == HashType::XXH64) {
+    APPEND(&oss, "xxh64 of per-line xxh64s: %s\n",
+           rawspeed::xxh64::hash_to_string(imgDataHashXXH64(r)).c_str());
+  } else {
+    rawspeed::md5::md5_state hash_of_line_hashes = imgDataHash(r);
+    APPEND(&oss, "md5sum of per-line md5sums: %s\n",
+           rawspeed::md5::hash_to_string(hash_of_line_hashes).c_str());
+  }
 
   const auto errors = r->getErrors();
   for (const string& e : errors)
@@ -335,25 +384,80 @@ void writeImage(const RawImage& raw, const string& fn) {
   }
 }
 
-size_t process(const string& filename, const CameraMetaData* metadata,
-               const options& o) {
+bool parseShard(const string& arg, options* o) {
+  unsigned shard;
+  unsigned shards;
+  char tail;
+  if (sscanf(arg.c_str(), "%u/%u%c", &shard, &shards, &tail) != 2 ||
+      shard >= shards)
+    return false;
+
+  o->shard = shard;
+  o->shards = shards;
+  return true;
+}
 
-  const string hashfile(filename + ".hash");
+bool inShard(const string& filename, const options& o) {
+  const auto h = xxh64::xxh64_hash(
+      reinterpret_cast<const uint8_t*>(filename.data()), filename.size());
+  return h % o.shards == o.shard;
+}
 
+bool skipFile(const string& filename, const options& o) {
   // if creating hash and hash exists -> skip current file
   // if not creating and hash is missing -> skip as well
   // unless in force mode
-  ifstream hf(hashfile);
-  if (hf.good() == o.create && !o.force) {
+  ifstream hf(filename + ".hash");
+  if (hf.good() != o.create || o.force)
+    return false;
+
 #if !defined(__has_feature) || !__has_feature(thread_sanitizer)
 #ifdef HAVE_OPENMP
 #pragma omp critical(io)
 #endif
-    cout << left << setw(55) << filename << ": hash "
-         << (o.create ? "exists" : "missing") << ", skipping" << endl;
+  cout << left << setw(55) << filename << ": hash "
+       << (o.create ? "exists" : "missing") << ", skipping" << endl;
 #endif
-    return 0;
+  return true;
+}
+
+static void appendJSONString(string* out, const string& str) {
+  *out += '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      *out += '\\';
+      *out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      std::array<char, 7> esc;
+      snprintf(esc.data(), esc.size(), "\\u%04x", c);
+      *out += esc.data();
+    } else
+      *out += c;
   }
+  *out += '"';
+}
+
+string jsonResult(const string& filename, const char* status, size_t time,
+                  const string& message) {
+  string out = R"({"file": )";
+  appendJSONString(&out, filename);
+  out += R"(, "status": ")";
+  out += status;
+  out += R"(", "time_ms": )";
+  out += std::to_string(time);
+  if (!message.empty()) {
+    out += R"(, "message": )";
+    appendJSONString(&out, message);
+  }
+  out += "}";
+  return out;
+}
+
+size_t process(const string& filename, const CameraMetaData* metadata,
+               const options& o) {
+
+  const string hashfile(filename + ".hash");
+  ifstream hf(hashfile);
 
 // to narrow down the list of files that could have causes the crash
 #if !defined(__has_feature) || !__has_feature(thread_sanitizer)
@@ -395,19 +499,24 @@ size_t process(const string& filename, const CameraMetaData* metadata,
   if (o.create) {
     // write the hash. if force is set, then we are potentially overwriting here
     ofstream f(hashfile);
-    f << img_hash(raw);
+    f << img_hash(raw, o.hash);
     if (o.dump)
       writeImage(raw, filename);
   } else {
-    // do generate the hash string regardless.
-    string h = img_hash(raw);
+    string truth((istreambuf_iterator<char>(hf)), istreambuf_iterator<char>());
+
+    // do generate the hash string regardless, the same kind as the old one.
+    const HashType type = truth.find("xxh64 of per-line xxh64s: ") !=
+                                  string::npos
+                              ? HashType::XXH64
+                              : HashType::MD5;
+    string h = img_hash(raw, type);
 
     // normally, here we would compare the old hash with the new one
     // but if the force is set, and the hash does not exist, do nothing.
     if (!hf.good() && o.force)
       return time;
 
-    string truth((istreambuf_iterator<char>(hf)), istreambuf_iterator<char>());
     if (h != truth) {
       ofstream f(filename + ".hash.failed");
       f << h;
@@ -477,6 +586,15 @@ static int usage(const char* progname) {
        If -c is not set, and the hash does not exist, then just decode,
        but do not write the hash!
   [-d] store decoded image as PPM
+  [--shard i/N] only work on the i'th of N parts of the files, 0 <= i < N.
+       The files are partitioned by the hash of their path, so the same
+       file list split over N machines covers every file exactly once.
+  [--json FILE] also write the result of each file to FILE, one JSON
+       object per line, so that the results of the shards can be merged
+       by concatenating the files.
+  [-x] if -c is set, hash the image data with XXH64 rather than MD5.
+       The existing hashes are always checked with the hash they were
+       created with.
   <FILE[S]> the file[s] to work on.
 
   With no options given, each raw with an accompanying hash will be decoded
@@ -502,6 +620,10 @@ using rawspeed::rstest::usage;
 using rawspeed::rstest::options;
 using rawspeed::rstest::process;
 using rawspeed::rstest::results;
+using rawspeed::rstest::parseShard;
+using rawspeed::rstest::inShard;
+using rawspeed::rstest::skipFile;
+using rawspeed::rstest::jsonResult;
 
 int main(int argc, char **argv) {
   int remaining_argc = argc;
@@ -517,6 +639,18 @@ int main(int argc, char **argv) {
     }
     return found;
   };
+  // The option, and its value, which is empty if the option is not given.
+  auto getOption = [argc, &remaining_argc, argv](string option) {
+    string value;
+    for (int i = 1; i + 1 < argc; ++i) {
+      if (!argv[i] || argv[i] != option || !argv[i + 1])
+        continue;
+      value = argv[i + 1];
+      argv[i] = argv[i + 1] = nullptr;
+      remaining_argc -= 2;
+    }
+    return value;
+  };
 
   if (1 == argc || hasFlag("-h"))
     return usage(argv[0]);
@@ -525,6 +659,34 @@ int main(int argc, char **argv) {
   o.create = hasFlag("-c");
   o.force = hasFlag("-f");
   o.dump = hasFlag("-d");
+  o.hash = hasFlag("-x") ? rawspeed::rstest::HashType::XXH64
+                         : rawspeed::rstest::HashType::MD5;
+
+  o.shard = 0;
+  o.shards = 1;
+  const string shard = getOption("--shard");
+  if (!shard.empty() && !parseShard(shard, &o)) {
+    cerr << "Bad shard '" << shard << "', expected i/N with i < N" << endl;
+    return 1;
+  }
+
+  const string jsonFile = getOption("--json");
+  std::unique_ptr<ofstream> json;
+  if (!jsonFile.empty()) {
+    json = std::make_unique<ofstream>(jsonFile);
+    if (!json->good()) {
+      cerr << "Can not open '" << jsonFile << "'" << endl;
+      return 1;
+    }
+  }
+  const auto writeJSON = [&json](const string& line) {
+    if (!json)
+      return;
+#ifdef HAVE_OPENMP
+#pragma omp critical(json)
+#endif
+    *json << line << endl;
+  };
 
 #ifdef HAVE_PUGIXML
   const CameraMetaData metadata(CMAKE_SOURCE_DIR "/data/cameras.xml");
@@ -539,14 +701,25 @@ int main(int argc, char **argv) {
   reduction(+ : time) if(remaining_argc > 2)
 #endif
   for (int i = 1; i < argc; ++i) {
-    if (!argv[i])
+    if (!argv[i] || !inShard(argv[i], o))
+      continue;
+
+    if (skipFile(argv[i], o)) {
+      writeJSON(jsonResult(argv[i], "skipped", 0, ""));
       continue;
+    }
 
     try {
       try {
-        time += process(argv[i], &metadata, o);
+        const size_t t = process(argv[i], &metadata, o);
+        time += t;
+        writeJSON(jsonResult(argv[i], "ok", t, ""));
       } catch (rawspeed::rstest::RstestHashMismatch& e) {
         time += e.time;
+        writeJSON(jsonResult(argv[i], "mismatch", e.time, e.what()));
+        throw;
+      } catch (RawspeedException& e) {
+        writeJSON(jsonResult(argv[i], "failed", 0, e.what()));
         throw;
       }
     } catch (RawspeedException& e) {
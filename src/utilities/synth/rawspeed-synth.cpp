@@ -0,0 +1,191 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "RawSpeed-API.h" // for DngWriter, RawImage, parallelFor, iPoint2D
+
+#include <algorithm> // for min, max
+#include <cstdint>   // for uint64_t
+#include <cstdio>    // for fprintf, stderr
+#include <cstdlib>   // for atoi, strtoull
+#include <cstring>   // for strcmp
+#include <memory>    // for make_shared
+#include <string>    // for string
+#include <thread>    // for thread
+
+// define this function, it is only declared in rawspeed:
+extern "C" int __attribute__((const)) rawspeed_get_number_of_processor_cores() {
+  return 1;
+}
+
+// Writes the synthetic raw files, of any size, for the benchmarks, e.g. of
+// rs-bench, to run end to end where there are no camera samples. The same
+// arguments always give the very same file.
+//
+// The pixels are a smooth gradient, per CFA color, with the given number of
+// the random low bits on top, which is about what each of them then costs
+// to encode. The files are DNGs, in each of the layouts the DngDecoder has
+// a separate path for, as written by the DngWriter.
+
+namespace {
+
+using rawspeed::DngWriter;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::ushort16;
+
+struct Options final {
+  iPoint2D dim{6000, 4000};
+  int entropy = 6;
+  std::string kind = "dng";
+  int tileSize = DngWriter::DefaultTileSize;
+  uint64_t seed = 1;
+};
+
+constexpr int bitsPerSample = 14;
+constexpr int black = 512;
+constexpr int white = (1 << bitsPerSample) - 1;
+
+// Of each pixel on its own, so that the rows can be in any order.
+uint64_t noise(uint64_t seed, int x, int y) {
+  uint64_t z = seed ^ (static_cast<uint64_t>(y) << 32U) ^
+               static_cast<uint64_t>(x) ^ 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27U)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31U);
+}
+
+// In [0, 1) of the range above the black level, without the noise.
+double gradient(const iPoint2D& dim, int x, int y, int c) {
+  static const double level[3] = {0.30, 0.55, 0.20};
+  const double fx = static_cast<double>(x) / dim.x;
+  const double fy = static_cast<double>(y) / dim.y;
+  return level[c] * (0.5 + 0.5 * fx) * (0.75 + 0.25 * fy);
+}
+
+RawImage synthesize(const Options& o, bool isFloat, int cpp) {
+  RawImage img = RawImage::create(
+      o.dim, isFloat ? rawspeed::TYPE_FLOAT32 : rawspeed::TYPE_USHORT16, cpp);
+
+  const int range = white - black - (1 << o.entropy);
+  const unsigned mask = (1U << o.entropy) - 1U;
+  rawspeed::parallelFor(0, o.dim.y, [&](int y) {
+    for (int x = 0; x < o.dim.x; x++) {
+      for (int i = 0; i < cpp; i++) {
+        // RGGB, or the three components.
+        const int c = cpp == 3 ? i : (x & 1) + (y & 1);
+        const int v = black + static_cast<int>(gradient(o.dim, x, y, c) *
+                                               range) +
+                      static_cast<int>(noise(o.seed, cpp * x + i, y) & mask);
+        if (isFloat) {
+          reinterpret_cast<float*>(img->getDataUncropped(0, y))[cpp * x + i] =
+              static_cast<float>(v) / white;
+        } else {
+          reinterpret_cast<ushort16*>(
+              img->getDataUncropped(0, y))[cpp * x + i] =
+              static_cast<ushort16>(std::min(v, white));
+        }
+      }
+    }
+  });
+
+  if (cpp == 1) {
+    img->isCFA = true;
+    img->cfa.setCFA(iPoint2D(2, 2), rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                    rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+  }
+  if (!isFloat) {
+    img->blackLevel = black;
+    img->whitePoint = white;
+  }
+  img->metadata.make = "RawSpeed";
+  img->metadata.model = "Synthetic";
+  return img;
+}
+
+int usage(const char* progname) {
+  fprintf(stderr,
+          "Usage: %s [-w width] [-h height] [-e entropy bits] [-k kind] "
+          "[-t tile size] [-s seed] <output>\n"
+          "The kinds:\n"
+          "  dng               CFA, tiled, lossless JPEG (the default)\n"
+          "  dng-strips        CFA, striped, lossless JPEG\n"
+          "  dng-uncompressed  CFA, striped, uncompressed\n"
+          "  dng-linear        RGB, tiled, lossless JPEG\n"
+          "  dng-float         CFA, float, tiled, Deflate\n"
+          "The entropy is the number of the random low bits of each pixel, "
+          "of the %i, at most %i.\n",
+          progname, bitsPerSample, bitsPerSample - 2);
+  return 2;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) { // NOLINT
+  Options o;
+  const char* output = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "-w") && hasValue) {
+      o.dim.x = std::atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-h") && hasValue) {
+      o.dim.y = std::atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-e") && hasValue) {
+      o.entropy = std::atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-k") && hasValue) {
+      o.kind = argv[++i];
+    } else if (!strcmp(argv[i], "-t") && hasValue) {
+      o.tileSize = std::atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-s") && hasValue) {
+      o.seed = std::strtoull(argv[++i], nullptr, 0);
+    } else if (argv[i][0] != '-' && !output) {
+      output = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  if (!output || !o.dim.hasPositiveArea() || o.entropy < 0 ||
+      o.entropy > bitsPerSample - 2)
+    return usage(argv[0]);
+
+  if (o.kind != "dng" && o.kind != "dng-strips" &&
+      o.kind != "dng-uncompressed" && o.kind != "dng-linear" &&
+      o.kind != "dng-float")
+    return usage(argv[0]);
+  const bool isFloat = o.kind == "dng-float";
+  const int cpp = o.kind == "dng-linear" ? 3 : 1;
+
+  rawspeed::setExecutor(std::make_shared<rawspeed::ThreadPoolExecutor>(
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()))));
+
+  try {
+    const RawImage img = synthesize(o, isFloat, cpp);
+    DngWriter writer(img, o.tileSize);
+    writer.strips = o.kind == "dng-strips" || o.kind == "dng-uncompressed";
+    writer.uncompressed = o.kind == "dng-uncompressed";
+    writer.writeFile(output);
+  } catch (rawspeed::RawspeedException& e) {
+    fprintf(stderr, "ERROR: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
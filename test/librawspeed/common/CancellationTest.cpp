@@ -0,0 +1,67 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Cancellation.h"          // for Cancellation
+#include "common/RawImage.h"              // for RawImage, RawImageData
+#include "decoders/RawDecoderException.h" // for RawDecoderException
+#include <chrono>                         // for steady_clock, hours
+#include <gtest/gtest.h>                  // for Message, TestPartResult, ...
+#include <memory>                         // for make_shared
+
+using rawspeed::Cancellation;
+using rawspeed::RawDecoderException;
+using rawspeed::RawImage;
+
+namespace rawspeed_test {
+
+TEST(CancellationTest, Cancel) {
+  Cancellation c;
+  ASSERT_FALSE(c.isCancelled());
+  c.cancel();
+  ASSERT_TRUE(c.isCancelled());
+}
+
+TEST(CancellationTest, Deadline) {
+  using Clock = std::chrono::steady_clock;
+
+  Cancellation c;
+  c.setDeadline(Clock::now() + std::chrono::hours(1));
+  ASSERT_FALSE(c.isCancelled());
+  c.setTimeout(std::chrono::hours(-1));
+  ASSERT_TRUE(c.isCancelled());
+  c.setTimeout(Clock::duration::zero());
+  ASSERT_TRUE(c.isCancelled());
+}
+
+TEST(CancellationTest, Image) {
+  RawImage img = RawImage::create({4, 4});
+  ASSERT_FALSE(img->isCancelled());
+  ASSERT_NO_THROW(img->checkCancelled());
+
+  auto c = std::make_shared<Cancellation>();
+  img->cancellation = c;
+  ASSERT_NO_THROW(img->checkCancelled());
+
+  c->cancel();
+  ASSERT_TRUE(img->isCancelled());
+  ASSERT_THROW(img->checkCancelled(), RawDecoderException);
+}
+
+} // namespace rawspeed_test
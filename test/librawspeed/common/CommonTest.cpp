@@ -21,6 +21,7 @@
 #include "common/Common.h"  // for uchar8, clampBits, roundUp, isIn, isPowe...
 #include <algorithm>        // for fill, min, equal, generate_n
 #include <cassert>          // for assert
+#include <cmath>            // for ldexp, nextafter, INFINITY, NAN
 #include <cstddef>          // for size_t
 #include <gtest/gtest.h>    // for make_tuple, get, ParamIteratorInterface
 #include <initializer_list> // for initializer_list
@@ -33,6 +34,7 @@
 
 using rawspeed::clampBits;
 using rawspeed::copyPixels;
+using rawspeed::floatToHalf;
 using rawspeed::isAligned;
 using rawspeed::isIn;
 using rawspeed::isPowerOfTwo;
@@ -479,4 +481,41 @@ TEST_P(CopyPixelsTest, CopyPixelsTest) {
   compare();
 }
 
+// The exact float of a finite half.
+static float halfToFloat(ushort16 h) {
+  const int exp = (h >> 10) & 0x1F;
+  const int mantissa = h & 0x3FF;
+  const float magnitude =
+      exp ? std::ldexp(static_cast<float>(mantissa | 0x400), exp - 25)
+          : std::ldexp(static_cast<float>(mantissa), -24);
+  return (h & 0x8000) ? -magnitude : magnitude;
+}
+
+TEST(FloatToHalfTest, AllOfTheHalves) {
+  for (unsigned h = 0; h < 0x10000; h++) {
+    if (((h >> 10) & 0x1F) == 0x1F)
+      continue;
+    const float f = halfToFloat(h);
+    ASSERT_EQ(floatToHalf(f), h) << f;
+
+    // Halfway to the next one, the even one of the two; and beyond, the next.
+    if ((h & 0x7FFF) == 0x7BFF)
+      continue;
+    const float next = halfToFloat(h + 1);
+    const float mid = (f + next) / 2;
+    ASSERT_EQ(floatToHalf(mid), (h & 1) ? h + 1 : h) << mid;
+    ASSERT_EQ(floatToHalf(std::nextafter(mid, next)), h + 1) << mid;
+    ASSERT_EQ(floatToHalf(std::nextafter(mid, f)), h) << mid;
+  }
+}
+
+TEST(FloatToHalfTest, Special) {
+  ASSERT_EQ(floatToHalf(65520.0F), 0x7C00);
+  ASSERT_EQ(floatToHalf(-1e10F), 0xFC00);
+  ASSERT_EQ(floatToHalf(INFINITY), 0x7C00);
+  ASSERT_EQ(floatToHalf(NAN) & 0x7E00, 0x7E00);
+  ASSERT_EQ(floatToHalf(1e-10F), 0);
+  ASSERT_EQ(floatToHalf(-0.0F), 0x8000);
+}
+
 } // namespace rawspeed_test
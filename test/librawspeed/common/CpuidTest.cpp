@@ -27,23 +27,86 @@ using rawspeed::Cpuid;
 
 namespace rawspeed_test {
 
-// do not care about WITH_SSE2 here.
+// do not care about WITH_SSE2 here, nor about RAWSPEED_CPU_DISABLE.
 TEST(CpuidDeathTest, SSE2Test) {
 #if defined(__SSE2__)
   ASSERT_EXIT(
       {
-        ASSERT_TRUE(Cpuid::SSE2());
+        ASSERT_TRUE(Cpuid::getDetected() & Cpuid::FEATURE_SSE2);
         exit(0);
       },
       ::testing::ExitedWithCode(0), "");
 #else
   ASSERT_EXIT(
       {
-        ASSERT_FALSE(Cpuid::SSE2());
+        ASSERT_FALSE(Cpuid::getDetected() & Cpuid::FEATURE_SSE2);
         exit(0);
       },
       ::testing::ExitedWithCode(0), "");
 #endif
 }
 
+TEST(CpuidDeathTest, NEONTest) {
+  ASSERT_EXIT(
+      {
+#if defined(__ARM_NEON)
+        ASSERT_TRUE(Cpuid::getDetected() & Cpuid::FEATURE_NEON);
+#else
+        ASSERT_FALSE(Cpuid::getDetected() & Cpuid::FEATURE_NEON);
+#endif
+        exit(0);
+      },
+      ::testing::ExitedWithCode(0), "");
+}
+
+// Each of these extensions implies the older ones.
+TEST(CpuidDeathTest, ImpliedExtensionsTest) {
+  ASSERT_EXIT(
+      {
+        if (Cpuid::AVX512BW()) {
+          ASSERT_TRUE(Cpuid::AVX2());
+        }
+        if (Cpuid::AVX2()) {
+          ASSERT_TRUE(Cpuid::SSSE3());
+        }
+        if (Cpuid::F16C()) {
+          ASSERT_TRUE(Cpuid::getDetected() & Cpuid::FEATURE_SSE2);
+        }
+        if (Cpuid::SSSE3()) {
+          ASSERT_TRUE(Cpuid::getDetected() & Cpuid::FEATURE_SSE2);
+        }
+        exit(0);
+      },
+      ::testing::ExitedWithCode(0), "");
+}
+
+TEST(CpuidTest, Parse) {
+  ASSERT_EQ(Cpuid::parse(""), 0U);
+  ASSERT_EQ(Cpuid::parse("avx2"), Cpuid::FEATURE_AVX2);
+  ASSERT_EQ(Cpuid::parse("avx512bw,sse4.1,bogus"),
+            Cpuid::FEATURE_AVX512BW | Cpuid::FEATURE_SSE41);
+  ASSERT_EQ(Cpuid::parse("all"), Cpuid::FEATURE_ALL);
+
+  for (unsigned bit = 1; bit & Cpuid::FEATURE_ALL; bit <<= 1) {
+    const auto feature = static_cast<Cpuid::Feature>(bit);
+    ASSERT_EQ(Cpuid::parse(Cpuid::getName(feature)), bit);
+  }
+}
+
+// Only the detected ones can be enabled.
+TEST(CpuidTest, SetEnabled) {
+  const unsigned enabled = Cpuid::getEnabled();
+
+  Cpuid::setEnabled(0);
+  ASSERT_FALSE(Cpuid::SSE2());
+  ASSERT_FALSE(Cpuid::AVX2());
+  ASSERT_FALSE(Cpuid::NEON());
+
+  Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+  ASSERT_EQ(Cpuid::getEnabled(), Cpuid::getDetected());
+  ASSERT_EQ(Cpuid::SSE2(), (Cpuid::getDetected() & Cpuid::FEATURE_SSE2) != 0);
+
+  Cpuid::setEnabled(enabled);
+}
+
 } // namespace rawspeed_test
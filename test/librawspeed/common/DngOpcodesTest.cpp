@@ -0,0 +1,344 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/DngOpcodes.h" // for DngOpcodes
+#include "common/Common.h"     // for uchar8, ushort16, uint32, clampBits
+#include "common/Cpuid.h"      // for Cpuid
+#include "common/Executor.h"   // for setExecutor, ThreadPoolExecutor
+#include "common/Mutex.h"      // for MutexLocker
+#include "common/Point.h"      // for iPoint2D
+#include "common/RawImage.h"   // for RawImage, RawImageData
+#include "io/Buffer.h"         // for Buffer, DataBuffer
+#include "io/ByteStream.h"     // for ByteStream
+#include "io/Endianness.h"     // for Endianness
+#include "tiff/TiffEntry.h"    // for TiffEntry, TIFF_UNDEFINED
+#include "tiff/TiffTag.h"      // for OPCODELIST2
+#include <algorithm>           // for min, max
+#include <cstring>             // for memcpy
+#include <gtest/gtest.h>       // for Message, TestPartResult, ParamIterato...
+#include <memory>              // for make_shared
+#include <tuple>               // for get, tuple
+#include <vector>              // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::clampBits;
+using rawspeed::Cpuid;
+using rawspeed::DataBuffer;
+using rawspeed::DngOpcodes;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::MutexLocker;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::TiffEntry;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The opcodes are always big-endian.
+static void putU32(std::vector<uchar8>* data, uint32 v) {
+  for (int i = 3; i >= 0; i--)
+    data->emplace_back(v >> (8 * i));
+}
+
+static void putFloat(std::vector<uchar8>* data, float f) {
+  uint32 v;
+  memcpy(&v, &f, sizeof(v));
+  putU32(data, v);
+}
+
+// Each of the SIMD targets of the kernels, see common/Simd.h, that the CPU
+// has, and the scalar one.
+static const auto simdFeatures = ::testing::Values(
+    unsigned(Cpuid::FEATURE_ALL),
+    unsigned(Cpuid::FEATURE_ALL & ~Cpuid::FEATURE_AVX512BW),
+    unsigned(Cpuid::FEATURE_SSE2 | Cpuid::FEATURE_SSSE3 |
+             Cpuid::FEATURE_SSE41),
+    0U);
+
+enum Opcode {
+  DeltaPerRow = 10,
+  DeltaPerColumn = 11,
+  ScalePerRow = 12,
+  ScalePerColumn = 13,
+};
+
+using DeltaOpcodeType = std::tuple<int, Opcode, int, unsigned>;
+class DeltaOpcodeTest : public ::testing::TestWithParam<DeltaOpcodeType> {
+protected:
+  DeltaOpcodeTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    code = std::get<1>(GetParam());
+    colPitch = std::get<2>(GetParam());
+    Cpuid::setEnabled(std::get<3>(GetParam()));
+  }
+  virtual void TearDown() {
+    setExecutor(nullptr);
+    Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+  }
+
+  Opcode code;
+  int colPitch;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Opcodes, DeltaOpcodeTest,
+    ::testing::Combine(::testing::Values(1, 3),
+                       ::testing::Values(DeltaPerRow, DeltaPerColumn,
+                                         ScalePerRow, ScalePerColumn),
+                       ::testing::Values(1, 2), simdFeatures));
+
+TEST_P(DeltaOpcodeTest, SameAsPerPixel) {
+  const iPoint2D dim(120, 50);
+  // Not a whole number of the SIMD blocks wide, and every other row.
+  const uint32 top = 3;
+  const uint32 left = 5;
+  const uint32 bottom = 45;
+  const uint32 right = 108;
+  const uint32 rowPitch = 2;
+
+  const bool perColumn = code == DeltaPerColumn || code == ScalePerColumn;
+  const bool scale = code == ScalePerRow || code == ScalePerColumn;
+
+  std::vector<float> deltas(perColumn ? right : bottom);
+  uint32 random = 1;
+  for (auto& f : deltas) {
+    random = random * 1103515245U + 12345U;
+    const float r = static_cast<float>(random >> 16) / 65536.0F;
+    f = scale ? 4.0F * r : r - 0.5F;
+  }
+
+  std::vector<uchar8> data;
+  putU32(&data, 1); // the number of opcodes
+  putU32(&data, code);
+  putU32(&data, 0); // version
+  putU32(&data, 0); // flags
+  putU32(&data, 4 * (9 + deltas.size()));
+  for (uint32 v : {top, left, bottom, right, 0U, 1U, rowPitch})
+    putU32(&data, v);
+  putU32(&data, colPitch);
+  putU32(&data, deltas.size());
+  for (float f : deltas)
+    putFloat(&data, f);
+
+  TiffEntry entry(
+      nullptr, rawspeed::OPCODELIST2, rawspeed::TIFF_UNDEFINED, data.size(),
+      ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                            Endianness::little)));
+
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  std::vector<ushort16> expected(dim.area());
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+    for (int x = 0; x < dim.x; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = random >> 16;
+
+      ushort16& e = expected[y * dim.x + x];
+      e = row[x];
+      if (y < static_cast<int>(top) || y >= static_cast<int>(bottom) ||
+          (y - top) % rowPitch != 0 || x < static_cast<int>(left) ||
+          x >= static_cast<int>(right) || (x - left) % colPitch != 0)
+        continue;
+
+      const float f = deltas[perColumn ? x : y];
+      if (scale)
+        e = clampBits((static_cast<int>(1024.0F * f) * e + 512) >> 10, 16);
+      else
+        e = clampBits(static_cast<int>(65535.0F * f) + e, 16);
+    }
+  }
+
+  DngOpcodes codes(img, &entry);
+  codes.applyOpCodes(img);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+// The rows are searched in parallel, but the order is as if serially.
+TEST(FixBadPixelsConstantTest, InTheOrderOfTheRows) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(3));
+
+  std::vector<uchar8> data;
+  putU32(&data, 1); // the number of opcodes
+  putU32(&data, 4); // FixBadPixelsConstant
+  putU32(&data, 0); // version
+  putU32(&data, 0); // flags
+  putU32(&data, 8);
+  putU32(&data, 7); // the constant
+  putU32(&data, 0); // Bayer phase
+
+  TiffEntry entry(
+      nullptr, rawspeed::OPCODELIST2, rawspeed::TIFF_UNDEFINED, data.size(),
+      ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                            Endianness::little)));
+
+  const iPoint2D dim(20, 17);
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  std::vector<rawspeed::BadPixelPosition> expected;
+  uint32 random = 1;
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+    for (int x = 0; x < dim.x; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = (random >> 16) % 10;
+      if (row[x] == 7)
+        expected.emplace_back(rawspeed::getBadPixelPosition(x, y));
+    }
+  }
+
+  DngOpcodes codes(img, &entry);
+  codes.applyOpCodes(img);
+
+  MutexLocker guard(&img->mBadPixelMutex);
+  ASSERT_EQ(img->mBadPixelPositions, expected);
+  setExecutor(nullptr);
+}
+
+static void putDouble(std::vector<uchar8>* data, double d) {
+  rawspeed::uint64 v;
+  memcpy(&v, &d, sizeof(v));
+  putU32(data, v >> 32);
+  putU32(data, v);
+}
+
+using GainMapType = std::tuple<int, int, unsigned>;
+class GainMapTest : public ::testing::TestWithParam<GainMapType> {
+protected:
+  GainMapTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    colPitch = std::get<1>(GetParam());
+    Cpuid::setEnabled(std::get<2>(GetParam()));
+  }
+  virtual void TearDown() {
+    setExecutor(nullptr);
+    Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+  }
+
+  int colPitch;
+};
+
+INSTANTIATE_TEST_CASE_P(Pitches, GainMapTest,
+                        ::testing::Combine(::testing::Values(1, 3),
+                                           ::testing::Values(1, 2),
+                                           simdFeatures));
+
+// Against the plain bilinear interpolation, in double precision.
+TEST_P(GainMapTest, Bilinear) {
+  const iPoint2D dim(150, 60);
+  const uint32 top = 2;
+  const uint32 left = 3;
+  const uint32 bottom = 58;
+  const uint32 right = 141;
+
+  // The map starts a bit inside of the image, and ends before its end.
+  const uint32 pointsV = 5;
+  const uint32 pointsH = 7;
+  const double spacingV = 0.2;
+  const double spacingH = 0.13;
+  const double originV = 0.05;
+  const double originH = 0.1;
+
+  std::vector<float> map(pointsV * pointsH);
+  uint32 random = 1;
+  for (auto& g : map) {
+    random = random * 1103515245U + 12345U;
+    g = 0.5F + 2.0F * static_cast<float>(random >> 16) / 65536.0F;
+  }
+
+  std::vector<uchar8> data;
+  putU32(&data, 1); // the number of opcodes
+  putU32(&data, 9); // GainMap
+  putU32(&data, 0); // version
+  putU32(&data, 0); // flags
+  putU32(&data, 4 * (8 + 3 + map.size()) + 8 * 4);
+  for (uint32 v : {top, left, bottom, right, 0U, 1U, 1U})
+    putU32(&data, v);
+  putU32(&data, colPitch);
+  putU32(&data, pointsV);
+  putU32(&data, pointsH);
+  for (double d : {spacingV, spacingH, originV, originH})
+    putDouble(&data, d);
+  putU32(&data, 1); // map planes
+  for (float g : map)
+    putFloat(&data, g);
+
+  TiffEntry entry(
+      nullptr, rawspeed::OPCODELIST2, rawspeed::TIFF_UNDEFINED, data.size(),
+      ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                            Endianness::little)));
+
+  const auto position = [](double pos, uint32 points) {
+    return std::min(std::max(pos, 0.0), points - 1.0);
+  };
+
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  std::vector<int> expected(dim.area());
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+    for (int x = 0; x < dim.x; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = random >> 16;
+
+      int& e = expected[y * dim.x + x];
+      e = row[x];
+      if (y < static_cast<int>(top) || y >= static_cast<int>(bottom) ||
+          x < static_cast<int>(left) || x >= static_cast<int>(right) ||
+          (x - left) % colPitch != 0)
+        continue;
+
+      const double r = position((1.0 * y / dim.y - originV) / spacingV, pointsV);
+      const double c = position((1.0 * x / dim.x - originH) / spacingH, pointsH);
+      const auto r0 = std::min(static_cast<uint32>(r), pointsV - 2);
+      const auto c0 = std::min(static_cast<uint32>(c), pointsH - 2);
+      const double fr = r - r0;
+      const double fc = c - c0;
+      const auto g = [&map, pointsH](uint32 i, uint32 j) {
+        return static_cast<double>(map[i * pointsH + j]);
+      };
+      const double gain =
+          (1 - fr) * ((1 - fc) * g(r0, c0) + fc * g(r0, c0 + 1)) +
+          fr * ((1 - fc) * g(r0 + 1, c0) + fc * g(r0 + 1, c0 + 1));
+      e = std::min(static_cast<int>(e * gain + 0.5), 65535);
+    }
+  }
+
+  DngOpcodes codes(img, &entry);
+  codes.applyOpCodes(img);
+
+  // The gains are interpolated in single precision.
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_NEAR(row[x], expected[y * dim.x + x], 1) << x << " " << y;
+  }
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,70 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/ErrorLog.h" // for ErrorLog
+#include "common/Executor.h" // for setExecutor, ThreadPoolExecutor, para...
+#include <gtest/gtest.h>     // for Message, TestPartResult, TestInfo
+#include <memory>            // for make_shared
+#include <string>            // for string, to_string
+#include <vector>            // for vector
+
+using rawspeed::ErrorLog;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+
+namespace rawspeed_test {
+
+TEST(ErrorLogTest, FirstError) {
+  ErrorLog log;
+  std::string first;
+  ASSERT_FALSE(log.isTooManyErrors(1, &first));
+
+  log.setError("a");
+  log.setError("b");
+  ASSERT_TRUE(log.isTooManyErrors(2, &first));
+  ASSERT_EQ(first, "a");
+  ASSERT_FALSE(log.isTooManyErrors(3));
+
+  ASSERT_EQ(log.getErrors(), std::vector<std::string>({"a", "b"}));
+  ASSERT_FALSE(log.isTooManyErrors(1));
+  ASSERT_TRUE(log.getErrors().empty());
+}
+
+TEST(ErrorLogTest, OnlyTheFirstOnesAreKept) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(3));
+  ErrorLog log;
+  const int num = 1000;
+  rawspeed::parallelFor(0, num, [&log](int i) {
+    log.setError("error " + std::to_string(i));
+  });
+  ASSERT_TRUE(log.isTooManyErrors(num));
+  ASSERT_FALSE(log.isTooManyErrors(num + 1));
+
+  const auto errors = log.getErrors();
+  ASSERT_EQ(errors.size(), ErrorLog::maxErrors + 1);
+  for (unsigned i = 0; i < ErrorLog::maxErrors; i++)
+    ASSERT_EQ(errors[i].compare(0, 6, "error "), 0);
+  ASSERT_EQ(errors.back(),
+            "... and " + std::to_string(num - ErrorLog::maxErrors) +
+                " more errors");
+  setExecutor(nullptr);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,400 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Executor.h" // for ThreadPoolExecutor, parallelFor, ...
+#include <atomic>            // for atomic
+#include <chrono>            // for milliseconds, microseconds, steady_clock
+#include <future>            // for promise, future
+#include <gtest/gtest.h>     // for ParamIteratorInterface, Message, Tes...
+#include <memory>            // for make_shared, shared_ptr
+#include <stdexcept>         // for runtime_error
+#include <thread>            // for this_thread
+#include <vector>            // for vector
+
+using rawspeed::DynamicSchedule;
+using rawspeed::Executor;
+using rawspeed::ExecutorScope;
+using rawspeed::calibrateMinTaskWork;
+using rawspeed::getExecutor;
+using rawspeed::getMinTaskWork;
+using rawspeed::getNumTasks;
+using rawspeed::getPriority;
+using rawspeed::parallelFor;
+using rawspeed::parallelForDynamic;
+using rawspeed::parallelForEach;
+using rawspeed::parallelForRange;
+using rawspeed::Priority;
+using rawspeed::PriorityScope;
+using rawspeed::SerialExecutor;
+using rawspeed::setExecutor;
+using rawspeed::setMinTaskWork;
+using rawspeed::ThreadPoolExecutor;
+
+namespace rawspeed_test {
+
+TEST(SerialExecutorTest, RunsInOrder) {
+  SerialExecutor e;
+  ASSERT_EQ(e.getConcurrency(), 1);
+
+  std::vector<int> order;
+  e.run(5, [&order](int i) { order.emplace_back(i); });
+  ASSERT_EQ(order, std::vector<int>({0, 1, 2, 3, 4}));
+}
+
+TEST(SerialExecutorTest, PostRunsRightAway) {
+  SerialExecutor e;
+  int done = 0;
+  e.post([&done]() { done++; });
+  ASSERT_EQ(done, 1);
+  ASSERT_NO_THROW(e.post([]() { throw std::runtime_error("ignored"); }));
+}
+
+class ThreadPoolExecutorTest : public ::testing::TestWithParam<int> {
+protected:
+  ThreadPoolExecutorTest() = default;
+  virtual void SetUp() { threads = GetParam(); }
+
+  int threads;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, ThreadPoolExecutorTest,
+                        ::testing::Values(1, 2, 3, 8));
+
+TEST_P(ThreadPoolExecutorTest, Concurrency) {
+  ThreadPoolExecutor e(threads);
+  ASSERT_EQ(e.getConcurrency(), threads);
+}
+
+TEST_P(ThreadPoolExecutorTest, RunsEachTaskOnce) {
+  ThreadPoolExecutor e(threads);
+
+  for (int numTasks : {0, 1, 2, 7, 100}) {
+    std::vector<std::atomic<int>> counts(numTasks);
+    for (auto& c : counts)
+      c = 0;
+
+    e.run(numTasks, [&counts](int i) { counts[i]++; });
+
+    for (const auto& c : counts)
+      ASSERT_EQ(c, 1);
+  }
+}
+
+TEST_P(ThreadPoolExecutorTest, PropagatesException) {
+  ThreadPoolExecutor e(threads);
+
+  std::atomic<int> done(0);
+  ASSERT_THROW(e.run(16,
+                     [&done](int i) {
+                       done++;
+                       if (i == 3)
+                         throw std::runtime_error("task failed");
+                     }),
+               std::runtime_error);
+  // the other tasks still have been run.
+  ASSERT_EQ(done, 16);
+
+  // and the executor is still usable afterwards.
+  ASSERT_NO_THROW(e.run(4, [](int /*i*/) {}));
+}
+
+TEST_P(ThreadPoolExecutorTest, Nested) {
+  ThreadPoolExecutor e(threads);
+
+  std::atomic<int> done(0);
+  e.run(8, [&e, &done](int /*i*/) {
+    e.run(8, [&e, &done](int /*j*/) {
+      e.run(2, [&done](int /*k*/) { done++; });
+    });
+  });
+  ASSERT_EQ(done, 8 * 8 * 2);
+}
+
+TEST_P(ThreadPoolExecutorTest, Post) {
+  ThreadPoolExecutor e(threads);
+
+  std::vector<std::promise<std::thread::id>> started(4);
+  std::vector<std::future<std::thread::id>> futures;
+  for (auto& p : started)
+    futures.emplace_back(p.get_future());
+
+  std::atomic<int> done(0);
+  for (auto& p : started) {
+    e.post([&e, &p, &done]() {
+      p.set_value(std::this_thread::get_id());
+      // The posted work can run its own tasks, too.
+      e.run(4, [&done](int /*i*/) { done++; });
+      throw std::runtime_error("ignored");
+    });
+  }
+
+  for (auto& f : futures)
+    ASSERT_NE(f.get(), std::this_thread::get_id());
+  while (done != 4 * 4)
+    std::this_thread::yield();
+}
+
+TEST_P(ThreadPoolExecutorTest, PostedWorkFinishesBeforeDestruction) {
+  // Without the workers, it is run by the threads of Executor::post().
+  if (threads == 1)
+    return;
+
+  std::atomic<int> done(0);
+  {
+    ThreadPoolExecutor e(threads);
+    for (int i = 0; i < 16; i++)
+      e.post([&done]() { done++; });
+  }
+  ASSERT_EQ(done, 16);
+}
+
+TEST_P(ThreadPoolExecutorTest, ParallelFor) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(threads));
+
+  for (int size : {0, 1, 2, 5, 1000}) {
+    std::vector<std::atomic<int>> counts(size);
+    for (auto& c : counts)
+      c = 0;
+
+    parallelFor(0, size, [&counts](int i) { counts[i]++; });
+    for (const auto& c : counts)
+      ASSERT_EQ(c, 1);
+
+    parallelForEach(0, size, [&counts](int i) { counts[i]++; });
+    for (const auto& c : counts)
+      ASSERT_EQ(c, 2);
+  }
+
+  setExecutor(nullptr);
+}
+
+TEST_P(ThreadPoolExecutorTest, ParallelForRange) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(threads));
+
+  for (int size : {1, 2, 5, 1000}) {
+    std::atomic<int> chunks(0);
+    std::atomic<int> iterations(0);
+    parallelForRange(10, 10 + size, [&](int chunkBegin, int chunkEnd) {
+      ASSERT_GE(chunkBegin, 10);
+      ASSERT_LT(chunkBegin, chunkEnd);
+      ASSERT_LE(chunkEnd, 10 + size);
+      chunks++;
+      iterations += chunkEnd - chunkBegin;
+    });
+    ASSERT_LE(chunks, threads);
+    ASSERT_EQ(iterations, size);
+  }
+
+  setExecutor(nullptr);
+}
+
+TEST_P(ThreadPoolExecutorTest, ParallelForDynamic) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(threads));
+
+  for (int size : {0, 1, 2, 5, 1000}) {
+    std::vector<std::atomic<int>> counts(size);
+    for (auto& c : counts)
+      c = 0;
+
+    std::atomic<int> tasks(0);
+    parallelForDynamic(0, size, [&](DynamicSchedule* schedule) {
+      tasks++;
+      for (int i; schedule->getNext(&i);)
+        counts[i]++;
+    });
+    ASSERT_LE(tasks, threads);
+    for (const auto& c : counts)
+      ASSERT_EQ(c, 1);
+  }
+
+  setExecutor(nullptr);
+}
+
+TEST(ExecutorTest, SetExecutor) {
+  const auto defaultExecutor = getExecutor();
+  ASSERT_TRUE(defaultExecutor);
+
+  const auto serial = std::make_shared<SerialExecutor>();
+  setExecutor(serial);
+  ASSERT_EQ(getExecutor(), serial);
+
+  setExecutor(nullptr);
+  ASSERT_EQ(getExecutor(), defaultExecutor);
+}
+
+TEST(ExecutorTest, ExecutorScope) {
+  const std::shared_ptr<Executor> global =
+      std::make_shared<ThreadPoolExecutor>(2);
+  setExecutor(global);
+
+  const std::shared_ptr<Executor> scoped =
+      std::make_shared<ThreadPoolExecutor>(3);
+  {
+    const ExecutorScope scope(scoped);
+    ASSERT_EQ(getExecutor(), scoped);
+
+    // Even in the tasks that are run by the workers, and nested in them.
+    std::atomic<int> seen(0);
+    parallelForEach(0, 6, [&](int /*i*/) {
+      parallelForEach(0, 2, [&](int /*j*/) {
+        if (getExecutor() == scoped)
+          seen++;
+      });
+    });
+    ASSERT_EQ(seen, 12);
+
+    // The other threads still use the global one.
+    std::thread other([&global]() { ASSERT_EQ(getExecutor(), global); });
+    other.join();
+
+    {
+      const ExecutorScope none(nullptr);
+      ASSERT_EQ(getExecutor(), scoped);
+    }
+  }
+  ASSERT_EQ(getExecutor(), global);
+
+  setExecutor(nullptr);
+}
+
+TEST(ExecutorTest, PriorityScope) {
+  const std::shared_ptr<Executor> pool =
+      std::make_shared<ThreadPoolExecutor>(3);
+  const ExecutorScope scope(pool);
+  ASSERT_EQ(getPriority(), Priority::Normal);
+  {
+    const PriorityScope interactive(Priority::Interactive);
+    ASSERT_EQ(getPriority(), Priority::Interactive);
+
+    // Even in the tasks that are run by the workers, and nested in them.
+    std::atomic<int> seen(0);
+    parallelForEach(0, 6, [&seen](int /*i*/) {
+      parallelForEach(0, 2, [&seen](int /*j*/) {
+        if (getPriority() == Priority::Interactive)
+          seen++;
+      });
+    });
+    ASSERT_EQ(seen, 12);
+
+    // The other threads have their own.
+    std::thread other([]() { ASSERT_EQ(getPriority(), Priority::Normal); });
+    other.join();
+  }
+  ASSERT_EQ(getPriority(), Priority::Normal);
+}
+
+// The threads that are busy with the tasks of a long Batch job run the
+// Interactive one as soon as they get to the next iteration.
+TEST(ExecutorTest, HigherPriorityGoesFirst) {
+  const std::shared_ptr<Executor> pool =
+      std::make_shared<ThreadPoolExecutor>(2);
+  constexpr int batchIterations = 2000;
+  std::atomic<int> batchDone(0);
+
+  std::thread batch([&pool, &batchDone]() {
+    const ExecutorScope scope(pool);
+    const PriorityScope priority(Priority::Batch);
+    parallelForDynamic(0, batchIterations,
+                       [&batchDone](DynamicSchedule* schedule) {
+                         for (int i; schedule->getNext(&i);) {
+                           std::this_thread::sleep_for(
+                               std::chrono::microseconds(500));
+                           batchDone++;
+                         }
+                       });
+  });
+  while (batchDone < 10)
+    std::this_thread::yield();
+
+  // Each of the tasks waits for the other one to start, so this only
+  // finishes if the other thread of the pool yields to it.
+  {
+    const PriorityScope priority(Priority::Interactive);
+    std::atomic<int> started(0);
+    std::atomic<int> interactive(0);
+    pool->run(2, [&started, &interactive](int /*task*/) {
+      if (getPriority() == Priority::Interactive)
+        interactive++;
+      started++;
+      const auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (started < 2 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+    });
+    ASSERT_EQ(started, 2);
+    ASSERT_EQ(interactive, 2);
+  }
+  ASSERT_LT(batchDone, batchIterations);
+
+  batch.join();
+  ASSERT_EQ(batchDone, batchIterations);
+}
+
+TEST(ExecutorTest, NumTasks) {
+  const auto previous = getMinTaskWork();
+  setMinTaskWork(1000);
+
+  ASSERT_EQ(getNumTasks(8, -1), 8);
+  ASSERT_EQ(getNumTasks(8, 0), 1);
+  ASSERT_EQ(getNumTasks(8, 2999), 2);
+  ASSERT_EQ(getNumTasks(8, 1000000), 8);
+
+  setMinTaskWork(0);
+  ASSERT_EQ(getNumTasks(8, 1), 8);
+
+  setMinTaskWork(previous);
+}
+
+TEST(ExecutorTest, LittleWork) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  const auto previous = getMinTaskWork();
+  setMinTaskWork(1000);
+
+  std::atomic<int> tasks(0);
+  parallelForRange(0, 100, 2500, [&tasks](int /*begin*/, int /*end*/) {
+    tasks++;
+  });
+  ASSERT_EQ(tasks, 2);
+
+  // Each of the iterations still runs once, by fewer tasks.
+  std::vector<std::atomic<int>> counts(10);
+  for (auto& c : counts)
+    c = 0;
+  parallelForEach(0, 10, 10, [&counts](int i) { counts[i]++; });
+  for (const auto& c : counts)
+    ASSERT_EQ(c, 1);
+
+  setMinTaskWork(previous);
+  setExecutor(nullptr);
+}
+
+TEST(ExecutorTest, CalibrateMinTaskWork) {
+  const auto previous = getMinTaskWork();
+
+  const auto work =
+      calibrateMinTaskWork(std::make_shared<ThreadPoolExecutor>(2));
+  ASSERT_EQ(work, getMinTaskWork());
+  ASSERT_GE(work, 4 << 10);
+  ASSERT_LE(work, 64 << 20);
+
+  setMinTaskWork(previous);
+}
+
+} // namespace rawspeed_test
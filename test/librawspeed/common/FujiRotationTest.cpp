@@ -0,0 +1,141 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/FujiRotation.h"          // for FujiRotation
+#include "common/Common.h"                // for ushort16
+#include "common/Executor.h"              // for setExecutor, ThreadPoo...
+#include "common/Point.h"                 // for iPoint2D
+#include "common/RawImage.h"              // for RawImage, RawImageData
+#include "decoders/RawDecoderException.h" // for RawDecoderException
+#include <gtest/gtest.h>                  // for Message, TestPartResult, ...
+#include <memory>                         // for make_shared
+#include <tuple>                          // for get, tuple
+#include <vector>                         // for vector
+
+using rawspeed::FujiRotation;
+using rawspeed::iPoint2D;
+using rawspeed::RawDecoderException;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class FujiRotationTest
+    : public ::testing::TestWithParam<std::tuple<int, int, bool>> {
+protected:
+  FujiRotationTest() = default;
+  virtual void SetUp() {
+    size = {std::get<0>(GetParam()), std::get<1>(GetParam())};
+    altLayout = std::get<2>(GetParam());
+  }
+
+  // Where the pixel went, as it was written by the RafDecoder, one by one.
+  iPoint2D getRotatedPos(int x, int y) const {
+    const int rotatedsize =
+        altLayout ? size.y + size.x / 2 : size.x + size.y / 2;
+    if (altLayout)
+      return {((x + 1) >> 1) + y, rotatedsize - (size.y + 1 - y + (x >> 1))};
+    return {((y + 1) >> 1) + x, size.x - 1 - x + (y >> 1)};
+  }
+
+  bool fits() const {
+    const int rotatedsize =
+        altLayout ? size.y + size.x / 2 : size.x + size.y / 2;
+    for (int y = 0; y < size.y; y++) {
+      for (int x = 0; x < size.x; x++) {
+        const iPoint2D pos = getRotatedPos(x, y);
+        if (pos.x < 0 || pos.y < 0 || pos.x >= rotatedsize ||
+            pos.y >= rotatedsize - 1)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  iPoint2D size;
+  bool altLayout;
+};
+
+INSTANTIATE_TEST_CASE_P(SizesAndLayouts, FujiRotationTest,
+                        ::testing::Combine(::testing::Values(1, 2, 7, 130),
+                                           ::testing::Values(1, 2, 5, 96),
+                                           ::testing::Bool()));
+
+TEST_P(FujiRotationTest, Positions) {
+  if (!fits()) {
+    ASSERT_THROW(FujiRotation(size, altLayout), RawDecoderException);
+    return;
+  }
+
+  const FujiRotation rotation(size, altLayout);
+  for (int y = 0; y < size.y; y++) {
+    for (int x = 0; x < size.x; x++) {
+      const iPoint2D pos = rotation.getRotatedPos({x, y});
+      ASSERT_EQ(pos, getRotatedPos(x, y));
+      ASSERT_EQ(rotation.getUnrotatedPos(pos), iPoint2D(x, y));
+    }
+  }
+}
+
+TEST_P(FujiRotationTest, Rotate) {
+  if (!fits())
+    return;
+
+  const FujiRotation rotation(size, altLayout);
+  const iPoint2D offset(3, 2);
+
+  RawImage src = RawImage::create(size + offset + iPoint2D(1, 1),
+                                  rawspeed::TYPE_USHORT16, 1);
+  for (int y = 0; y < src->dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(src->getData(0, y));
+    for (int x = 0; x < src->dim.x; x++)
+      row[x] = 1 + y * src->dim.x + x;
+  }
+
+  std::vector<ushort16> expected(rotation.rotatedSize.area(), 0);
+  for (int y = 0; y < size.y; y++) {
+    for (int x = 0; x < size.x; x++) {
+      const iPoint2D pos = getRotatedPos(x, y);
+      expected[pos.y * rotation.rotatedSize.x + pos.x] =
+          1 + (offset.y + y) * src->dim.x + offset.x + x;
+    }
+  }
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(3));
+  // Not cleared, so every pixel has to be written.
+  RawImage dst = RawImage::create(rotation.rotatedSize, rawspeed::TYPE_USHORT16,
+                                  1);
+  dst->clearArea({{0, 0}, dst->dim}, 0xAB);
+  rotation.rotate(src, offset, dst);
+  setExecutor(nullptr);
+
+  for (int y = 0; y < dst->dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(dst->getData(0, y));
+    for (int x = 0; x < dst->dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dst->dim.x + x]) << x << " " << y;
+  }
+
+  ASSERT_THROW(rotation.rotate(src, offset + iPoint2D(2, 0), dst),
+               RawDecoderException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,220 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/ImageAllocator.h"    // for PooledImageAllocator, Numa...
+#include "common/Common.h"            // for uchar8, isAligned
+#include "common/Memory.h"            // for hugePageSize
+#include "common/Point.h"             // for iPoint2D
+#include "common/RawImage.h"          // for RawImage, RawImageData, TYPE...
+#include "common/RawspeedException.h" // for RawspeedException
+#include <gtest/gtest.h>              // for Message, TestPartResult, Test...
+#include <memory>                     // for make_shared, shared_ptr
+
+using rawspeed::BudgetImageAllocator;
+using rawspeed::HugePageImageAllocator;
+using rawspeed::hugePageSize;
+using rawspeed::ImageAllocator;
+using rawspeed::iPoint2D;
+using rawspeed::isAligned;
+using rawspeed::NumaInterleaveImageAllocator;
+using rawspeed::PooledImageAllocator;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setImageAllocator;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+class PooledImageAllocatorTest : public ::testing::Test {
+protected:
+  PooledImageAllocatorTest() = default;
+  virtual void SetUp() {
+    pool = std::make_shared<PooledImageAllocator>(1 << 20);
+    setImageAllocator(pool);
+  }
+  virtual void TearDown() { setImageAllocator(nullptr); }
+
+  std::shared_ptr<PooledImageAllocator> pool;
+};
+
+TEST_F(PooledImageAllocatorTest, ReusesTheSameLayout) {
+  const iPoint2D dim(100, 50);
+
+  const uchar8* first;
+  {
+    RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    first = img->getData(0, 0);
+    ASSERT_EQ(pool->getCachedBytes(), 0);
+  }
+  const size_t size = pool->getCachedBytes();
+  ASSERT_GE(size, dim.area() * 2);
+
+  // Not for the other sizes.
+  RawImage other = RawImage::create({50, 50}, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_NE(other->getData(0, 0), first);
+  ASSERT_EQ(pool->getCachedBytes(), size);
+
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_EQ(img->getData(0, 0), first);
+  ASSERT_EQ(pool->getCachedBytes(), 0);
+}
+
+TEST_F(PooledImageAllocatorTest, EvictsTheOldest) {
+  const size_t size = 300 << 10;
+  uchar8* a = pool->allocate(size);
+  uchar8* b = pool->allocate(size);
+  uchar8* c = pool->allocate(size);
+  uchar8* d = pool->allocate(size);
+  ASSERT_NE(a, nullptr);
+
+  pool->deallocate(a, size);
+  pool->deallocate(b, size);
+  pool->deallocate(c, size);
+  ASSERT_EQ(pool->getCachedBytes(), 3 * size);
+  pool->deallocate(d, size);
+  ASSERT_EQ(pool->getCachedBytes(), 3 * size);
+
+  // Too large to be cached at all.
+  pool->deallocate(pool->allocate(2 << 20), 2 << 20);
+  ASSERT_EQ(pool->getCachedBytes(), 3 * size);
+
+  // The most recent first, and the oldest one is gone.
+  ASSERT_EQ(pool->allocate(size), d);
+  ASSERT_EQ(pool->allocate(size), c);
+  ASSERT_EQ(pool->allocate(size), b);
+  ASSERT_EQ(pool->getCachedBytes(), 0);
+  pool->deallocate(b, size);
+  pool->deallocate(c, size);
+  pool->deallocate(d, size);
+
+  pool->trim();
+  ASSERT_EQ(pool->getCachedBytes(), 0);
+}
+
+TEST_F(PooledImageAllocatorTest, BackToTheOwnAllocator) {
+  RawImage img = RawImage::create({64, 64}, rawspeed::TYPE_USHORT16, 1);
+  setImageAllocator(nullptr);
+  img = RawImage::create();
+  ASSERT_GT(pool->getCachedBytes(), 0);
+}
+
+class HugePageImageAllocatorTest : public ::testing::TestWithParam<bool> {};
+
+INSTANTIATE_TEST_CASE_P(HugeTLB, HugePageImageAllocatorTest,
+                        ::testing::Bool());
+
+TEST_P(HugePageImageAllocatorTest, AllocatesWritableMemory) {
+  HugePageImageAllocator allocator(GetParam());
+
+  for (size_t size : {size_t(16), size_t(4096), hugePageSize - 16,
+                      hugePageSize, 3 * hugePageSize + 4096}) {
+    uchar8* ptr = allocator.allocate(size);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_TRUE(isAligned(ptr, ImageAllocator::alignment));
+#ifdef __linux__
+    if (size >= hugePageSize) {
+      ASSERT_TRUE(isAligned(ptr, hugePageSize));
+    }
+#endif
+    for (size_t i = 0; i < size; i += 1024)
+      ptr[i] = i >> 10;
+    ptr[size - 1] = 42;
+    ASSERT_EQ(ptr[size - 1], 42);
+    allocator.deallocate(ptr, size);
+  }
+}
+
+// Whether or not there are several nodes here.
+TEST(NumaInterleaveImageAllocatorTest, AllocatesWritableMemory) {
+  NumaInterleaveImageAllocator allocator;
+  ASSERT_NE(allocator.getNumNodes(), 1);
+
+  for (size_t size : {size_t(16), hugePageSize, 3 * hugePageSize + 4096}) {
+    uchar8* ptr = allocator.allocate(size);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_TRUE(isAligned(ptr, ImageAllocator::alignment));
+    for (size_t i = 0; i < size; i += 1024)
+      ptr[i] = i >> 10;
+    ptr[size - 1] = 42;
+    ASSERT_EQ(ptr[size - 1], 42);
+    allocator.deallocate(ptr, size);
+  }
+}
+
+TEST(BudgetImageAllocatorTest, WithinTheBudget) {
+  BudgetImageAllocator budget(1000);
+
+  uchar8* a = budget.allocate(600);
+  ASSERT_NE(a, nullptr);
+  ASSERT_EQ(budget.allocate(401), nullptr);
+  uchar8* b = budget.allocate(400);
+  ASSERT_NE(b, nullptr);
+  ASSERT_EQ(budget.getUsedBytes(), 1000);
+
+  budget.deallocate(a, 600);
+  ASSERT_EQ(budget.getUsedBytes(), 400);
+  ASSERT_EQ(budget.getPeakBytes(), 1000);
+  budget.resetPeak();
+  ASSERT_EQ(budget.getPeakBytes(), 400);
+
+  budget.deallocate(b, 400);
+  ASSERT_EQ(budget.getUsedBytes(), 0);
+}
+
+// Of one image, instead of the one of the library.
+TEST(BudgetImageAllocatorTest, OfTheImage) {
+  const auto budget = std::make_shared<BudgetImageAllocator>(100 << 10);
+  {
+    RawImage img = RawImage::create();
+    img->dim = {100, 100};
+    img->allocator = budget;
+    img->createData();
+    ASSERT_GE(budget->getUsedBytes(), 100 * 100 * 2);
+  }
+  ASSERT_EQ(budget->getUsedBytes(), 0);
+
+  RawImage img = RawImage::create();
+  img->dim = {1000, 1000};
+  img->allocator = budget;
+  ASSERT_THROW(img->createData(), RawspeedException);
+  ASSERT_LT(budget->getPeakBytes(), 100 << 10);
+}
+
+// The pool, of the huge pages.
+TEST(PooledHugePageImageAllocatorTest, ReusesTheSameLayout) {
+  auto pool = std::make_shared<PooledImageAllocator>(
+      64 << 20, std::make_shared<HugePageImageAllocator>());
+  setImageAllocator(pool);
+
+  const iPoint2D dim(2000, 1000);
+  const uchar8* first;
+  {
+    RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    first = img->getData(0, 0);
+    img->clearArea({{0, 0}, dim}, 7);
+  }
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_EQ(img->getData(0, 0), first);
+
+  img = RawImage::create();
+  setImageAllocator(nullptr);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,78 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/InternedString.h" // for InternedString, operator==
+#include "common/Executor.h"       // for parallelFor, setExecutor, Thread...
+#include <gtest/gtest.h>           // for Message, TestPartResult, Test...
+#include <memory>                  // for make_shared
+#include <string>                  // for string, to_string
+#include <vector>                  // for vector
+
+using rawspeed::InternedString;
+using rawspeed::parallelFor;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+
+namespace rawspeed_test {
+
+TEST(InternedStringTest, EqualAreTheSame) {
+  const InternedString a(std::string("Canon"));
+  const InternedString b("Canon");
+  const InternedString c("Nikon");
+  ASSERT_EQ(&a.get(), &b.get());
+  ASSERT_NE(&a.get(), &c.get());
+  ASSERT_TRUE(a == b);
+  ASSERT_TRUE(a != c);
+  ASSERT_TRUE(a == "Canon");
+  ASSERT_TRUE(std::string("Canon") == a);
+  ASSERT_TRUE(a != std::string("Nikon"));
+  ASSERT_STREQ(a.c_str(), "Canon");
+  ASSERT_EQ(a.size(), 5);
+
+  // Whether it was interned on its own or copied.
+  InternedString d;
+  d = c;
+  ASSERT_EQ(&d.get(), &c.get());
+}
+
+TEST(InternedStringTest, Empty) {
+  const InternedString a;
+  const InternedString b("");
+  ASSERT_TRUE(a.empty());
+  ASSERT_TRUE(a == b);
+  ASSERT_TRUE(a == std::string());
+  ASSERT_FALSE(InternedString("x").empty());
+}
+
+TEST(InternedStringTest, Concurrent) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  std::vector<const std::string*> strings(1000);
+  parallelFor(0, 1000, [&strings](int i) {
+    strings[i] = &InternedString(std::to_string(i % 10)).get();
+  });
+  setExecutor(nullptr);
+
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(strings[i], strings[i % 10]);
+    ASSERT_EQ(*strings[i], std::to_string(i % 10));
+  }
+}
+
+} // namespace rawspeed_test
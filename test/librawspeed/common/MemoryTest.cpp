@@ -23,14 +23,18 @@
 #include <cstddef>         // for size_t
 #include <cstdint>         // for SIZE_MAX, uintptr_t
 #include <cstdlib>         // for exit
+#include <cstring>         // for memcpy, memset
 #include <gtest/gtest.h>   // for Message, TestPartResult, TestPartResult::...
 #include <memory>          // for unique_ptr
+#include <vector>          // for vector
 
 using rawspeed::alignedFree;
 using rawspeed::alignedFreeConstPtr;
 using rawspeed::alignedMalloc;
 using rawspeed::alignedMallocArray;
 using rawspeed::char8;
+using rawspeed::copyNonTemporal;
+using rawspeed::fillNonTemporal;
 using rawspeed::int32;
 using rawspeed::int64;
 using rawspeed::short16;
@@ -273,4 +277,25 @@ TYPED_TEST(AlignedMallocTest, TemplateArraySizeRoundUpTest) {
   });
 }
 
+// At each of the alignments, and with the sizes around the vector one.
+TEST(NonTemporalTest, SameAsMemcpyAndMemset) {
+  std::vector<uchar8> src(256);
+  for (size_t i = 0; i < src.size(); i++)
+    src[i] = i * 7 + 1;
+
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 100, 200}) {
+      std::vector<uchar8> out(src.size(), 0xAA);
+      std::vector<uchar8> expected(out);
+      copyNonTemporal(&out[offset], &src[1], size);
+      memcpy(&expected[offset], &src[1], size);
+      ASSERT_EQ(out, expected) << offset << " " << size;
+
+      fillNonTemporal(&out[offset], 0x5B, size);
+      memset(&expected[offset], 0x5B, size);
+      ASSERT_EQ(out, expected) << offset << " " << size;
+    }
+  }
+}
+
 } // namespace rawspeed_test
@@ -82,4 +82,23 @@ TEST_P(TwoRangesTest, NORangesSetDataTest) {
   }
 }
 
+// More of them than are stored inline.
+TEST(NORangesSetTest, ManyRanges) {
+  NORangesSet<Range<int>> s;
+  // Every other one of the [10 * i, 10 * i + 5), in a shuffled order.
+  for (int i = 0; i < 100; i += 2) {
+    const int k = (i * 37) % 100;
+    ASSERT_TRUE(s.emplace(Range<int>(10 * k, 5U)).second) << k;
+  }
+  ASSERT_EQ(s.size(), 50);
+
+  for (int i = 0; i < 100; i++) {
+    // The other half, and the gaps, are free.
+    ASSERT_EQ(s.emplace(Range<int>(10 * i, 5U)).second, i % 2 != 0) << i;
+    ASSERT_FALSE(s.emplace(Range<int>(10 * i + 4, 1U)).second) << i;
+    ASSERT_TRUE(s.emplace(Range<int>(10 * i + 5, 5U)).second) << i;
+  }
+  ASSERT_EQ(s.size(), 200);
+}
+
 } // namespace rawspeed_test
@@ -0,0 +1,131 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "common/PackedImage.h"       // for PackedImage
+#include "common/Array2DRef.h"        // for Array2DRef
+#include "common/Common.h"            // for ushort16, uint32
+#include "common/Executor.h"          // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"             // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"          // for RawImage, RawImageData, TYPE_...
+#include "common/RawspeedException.h" // for RawspeedException
+#include <gtest/gtest.h>              // for ParamIteratorInterface, Message
+#include <memory>                     // for make_shared
+#include <tuple>                      // for get, tuple
+#include <vector>                     // for vector
+
+using rawspeed::Array2DRef;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::PackedImage;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// Of the full bits, with the extremes, and cropped to an odd width.
+static RawImage createImage(uint32 cpp, int bits) {
+  RawImage img = RawImage::create({103, 20}, rawspeed::TYPE_USHORT16, cpp);
+  uint32 random = 1;
+  for (int y = 0; y < 20; y++) {
+    auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+    for (uint32 x = 0; x < 103 * cpp; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = random >> (32 - bits);
+    }
+    row[0] = 0;
+    row[1] = (1U << bits) - 1U;
+  }
+  img->subFrame({{2, 1}, {99, 18}});
+  return img;
+}
+
+using PackedImageType = std::tuple<int, uint32, int>;
+class PackedImageTest : public ::testing::TestWithParam<PackedImageType> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    cpp = std::get<1>(GetParam());
+    bits = std::get<2>(GetParam());
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  uint32 cpp;
+  int bits;
+};
+
+INSTANTIATE_TEST_CASE_P(BitsAndThreads, PackedImageTest,
+                        ::testing::Combine(::testing::Values(1, 3),
+                                           ::testing::Values(1, 3),
+                                           ::testing::Values(1, 10, 12, 14,
+                                                             16)));
+
+TEST_P(PackedImageTest, UnpacksTheCrop) {
+  const RawImage img = createImage(cpp, bits);
+  const PackedImage packed(img, bits);
+  ASSERT_EQ(packed.getDim(), img->dim);
+  ASSERT_EQ(packed.getPitch(), (99 * cpp * bits + 7) / 8);
+  ASSERT_EQ(packed.getSize(), 18 * packed.getPitch());
+
+  const RawImage unpacked = packed.unpack();
+  ASSERT_EQ(unpacked->dim, img->dim);
+  ASSERT_EQ(unpacked->getCpp(), cpp);
+  for (int y = 0; y < img->dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+    const auto* out =
+        reinterpret_cast<const ushort16*>(unpacked->getData(0, y));
+    for (uint32 x = 0; x < 99 * cpp; x++)
+      ASSERT_EQ(out[x], row[x]) << x << " " << y;
+  }
+}
+
+TEST_P(PackedImageTest, UnpacksSomeRows) {
+  const RawImage img = createImage(cpp, bits);
+  const PackedImage packed(img, bits);
+
+  const int width = 99 * cpp;
+  std::vector<ushort16> storage;
+  const auto rows = Array2DRef<ushort16>::create(&storage, width, 5);
+  packed.unpackRows(13, rows);
+  for (int y = 0; y < 5; y++) {
+    const auto* row =
+        reinterpret_cast<const ushort16*>(img->getData(0, 13 + y));
+    for (int x = 0; x < width; x++)
+      ASSERT_EQ(rows(x, y), row[x]) << x << " " << y;
+  }
+
+  ASSERT_THROW(packed.unpackRows(14, rows), RawspeedException);
+  ASSERT_THROW(packed.unpackRows(0, Array2DRef<ushort16>(storage.data(),
+                                                         width - 1, 1)),
+               RawspeedException);
+}
+
+TEST(PackedImageBadTest, TooWideThrows) {
+  const RawImage img = createImage(1, 13);
+  ASSERT_THROW(PackedImage(img, 12), RawspeedException);
+  ASSERT_THROW(PackedImage(img, 0), RawspeedException);
+  ASSERT_THROW(PackedImage(img, 17), RawspeedException);
+}
+
+} // namespace rawspeed_test
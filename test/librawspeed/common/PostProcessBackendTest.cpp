@@ -0,0 +1,130 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/PostProcessBackend.h" // for PostProcessBackend, DeviceImage
+#include "common/Common.h"             // for ushort16, uint32
+#include "common/Point.h"              // for iPoint2D
+#include "common/RawImage.h"           // for RawImageData, RawImage, TYPE_U...
+#include <gtest/gtest.h>               // for Message, TestPartResult, Test...
+#include <memory>                      // for make_shared, shared_ptr
+#include <vector>                      // for vector
+
+using rawspeed::DeviceImage;
+using rawspeed::iPoint2D;
+using rawspeed::PostProcessBackend;
+using rawspeed::RawImage;
+using rawspeed::RawImageData;
+using rawspeed::setPostProcessBackend;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class FakeBackend final : public PostProcessBackend {
+public:
+  explicit FakeBackend(bool accept_) : accept(accept_) {}
+
+  bool postProcess(RawImageData* img, int stages) override {
+    calls.push_back(stages);
+    black = img->blackLevelSeparate[0];
+    hasTable = img->getTable() != nullptr;
+    if (accept)
+      img->deviceImage = std::make_shared<DeviceImage>();
+    return accept;
+  }
+
+  bool accept;
+  std::vector<int> calls;
+  int black = 0;
+  bool hasTable = false;
+};
+
+class PostProcessBackendTest : public ::testing::Test {
+protected:
+  void TearDown() override { setPostProcessBackend(nullptr); }
+
+  static RawImage createImage() {
+    RawImage img = RawImage::create({64, 8}, rawspeed::TYPE_USHORT16, 1);
+    for (int y = 0; y < 8; y++) {
+      auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+      for (int x = 0; x < 64; x++)
+        row[x] = 100 + x * 50;
+    }
+    std::vector<ushort16> table(4096);
+    for (uint32 i = 0; i < table.size(); i++)
+      table[i] = i / 2;
+    img->setTable(table, false);
+    img->blackLevelSeparate = {{100, 100, 100, 100}};
+    img->whitePoint = 4000;
+    return img;
+  }
+
+  static const int stages =
+      RawImageData::STAGE_LOOKUP | RawImageData::STAGE_SCALE_BLACK_WHITE;
+};
+
+TEST_F(PostProcessBackendTest, Delegates) {
+  auto backend = std::make_shared<FakeBackend>(true);
+  setPostProcessBackend(backend);
+
+  RawImage img = createImage();
+  img->postProcess(stages | RawImageData::STAGE_FIX_BAD_PIXELS);
+
+  // There are no bad pixels to fix, and the levels are set up by then.
+  ASSERT_EQ(backend->calls, std::vector<int>{stages});
+  ASSERT_EQ(backend->black, 100);
+  ASSERT_TRUE(backend->hasTable);
+  ASSERT_TRUE(img->deviceImage);
+
+  // The pixels are left as decoded.
+  const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, 3));
+  ASSERT_EQ(row[10], 600);
+}
+
+TEST_F(PostProcessBackendTest, DeclinedRunsOnTheCPU) {
+  RawImage expected = createImage();
+  expected->postProcess(stages);
+
+  auto backend = std::make_shared<FakeBackend>(false);
+  setPostProcessBackend(backend);
+
+  RawImage img = createImage();
+  img->postProcess(stages);
+
+  ASSERT_EQ(backend->calls, std::vector<int>{stages});
+  ASSERT_FALSE(img->deviceImage);
+  for (int y = 0; y < 8; y++) {
+    const auto* a = reinterpret_cast<const ushort16*>(img->getData(0, y));
+    const auto* b = reinterpret_cast<const ushort16*>(expected->getData(0, y));
+    for (int x = 0; x < 64; x++)
+      ASSERT_EQ(a[x], b[x]) << x << " " << y;
+  }
+}
+
+TEST_F(PostProcessBackendTest, NothingToDo) {
+  auto backend = std::make_shared<FakeBackend>(true);
+  setPostProcessBackend(backend);
+
+  RawImage img = createImage();
+  img->postProcess(RawImageData::STAGE_FIX_BAD_PIXELS);
+  ASSERT_TRUE(backend->calls.empty());
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,167 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/RawImageCache.h"      // for loadRawImage, storeRawImage
+#include "common/Common.h"             // for uchar8, ushort16, uint32
+#include "common/Executor.h"           // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"              // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"           // for RawImage, RawImageData, TYPE_...
+#include "common/RawspeedException.h"  // for RawspeedException
+#include "io/Buffer.h"                 // for Buffer
+#include "metadata/ColorFilterArray.h" // for CFA_GREEN, CFA_RED, CFA_BLUE
+#include <cmath>                       // for NAN
+#include <gtest/gtest.h>               // for ParamIteratorInterface, Message
+#include <memory>                      // for make_shared
+#include <vector>                      // for vector
+
+using rawspeed::Buffer;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::loadRawImage;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::storeRawImage;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class RawImageCacheTest : public ::testing::TestWithParam<int> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  // Of 12 bits, as from a sensor, with a few of the extremes.
+  static RawImage createU16() {
+    RawImage img = RawImage::create({101, 20}, rawspeed::TYPE_USHORT16);
+    uint32 random = 1;
+    for (int y = 0; y < 20; y++) {
+      auto* row = reinterpret_cast<ushort16*>(img->getDataUncropped(0, y));
+      for (int x = 0; x < 101; x++) {
+        random = random * 1103515245U + 12345U;
+        row[x] = 1000 * (1 + (x & 1)) + x + ((random >> 16U) & 63U);
+      }
+    }
+    auto* row = reinterpret_cast<ushort16*>(img->getDataUncropped(0, 7));
+    row[0] = 65535;
+    row[5] = 0;
+    row[7] = 65535;
+
+    img->cfa.setCFA({2, 2}, rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                    rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+    img->subFrame(iRectangle2D(1, 2, 90, 16));
+    img->blackLevel = 128;
+    img->blackLevelSeparate = {{127, 128, 129, 130}};
+    img->whitePoint = 4095;
+    img->blackAreas.emplace_back(0, 1, true);
+    img->metadata.make = "Make";
+    img->metadata.canonical_model = "Model";
+    img->metadata.wbCoeffs = {{2.0F, 1.0F, 1.5F, NAN}};
+    img->metadata.isoSpeed = 200;
+    img->addBadPixels({rawspeed::getBadPixelPosition(3, 4)});
+    return img;
+  }
+
+  static RawImage roundTrip(const RawImage& img) {
+    const std::vector<uchar8> stored = storeRawImage(img);
+    return loadRawImage(Buffer(stored.data(), stored.size()));
+  }
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, RawImageCacheTest, ::testing::Values(1, 3));
+
+TEST_P(RawImageCacheTest, U16) {
+  const RawImage img = createU16();
+  const RawImage loaded = roundTrip(img);
+
+  ASSERT_EQ(loaded->getDataType(), rawspeed::TYPE_USHORT16);
+  ASSERT_EQ(loaded->getUncroppedDim(), img->getUncroppedDim());
+  ASSERT_EQ(loaded->getCropOffset(), img->getCropOffset());
+  ASSERT_EQ(loaded->dim, img->dim);
+  for (int y = 0; y < 20; y++) {
+    const auto* expected =
+        reinterpret_cast<const ushort16*>(img->getDataUncropped(0, y));
+    const auto* row =
+        reinterpret_cast<const ushort16*>(loaded->getDataUncropped(0, y));
+    for (int x = 0; x < 101; x++)
+      ASSERT_EQ(row[x], expected[x]) << x << " " << y;
+  }
+
+  ASSERT_TRUE(loaded->isCFA);
+  ASSERT_EQ(loaded->cfa.asString(), img->cfa.asString());
+  ASSERT_EQ(loaded->blackLevel, 128);
+  ASSERT_EQ(loaded->blackLevelSeparate, img->blackLevelSeparate);
+  ASSERT_EQ(loaded->whitePoint, 4095);
+  ASSERT_EQ(loaded->blackAreas.size(), 1);
+  ASSERT_TRUE(loaded->blackAreas[0].isVertical);
+  ASSERT_EQ(loaded->metadata.make, "Make");
+  ASSERT_EQ(loaded->metadata.canonical_model, "Model");
+  ASSERT_EQ(loaded->metadata.wbCoeffs[2], 1.5F);
+  ASSERT_NE(loaded->metadata.wbCoeffs[3], loaded->metadata.wbCoeffs[3]);
+  ASSERT_EQ(loaded->metadata.isoSpeed, 200);
+  ASSERT_EQ(loaded->mBadPixelPositions, img->mBadPixelPositions);
+}
+
+TEST_P(RawImageCacheTest, U16IsSmaller) {
+  const RawImage img = createU16();
+  const std::vector<uchar8> stored = storeRawImage(img);
+  // The residuals are of about 8 bits, and then there is the metadata.
+  ASSERT_LT(stored.size(), 101 * 20 * 2 * 3 / 4);
+}
+
+TEST_P(RawImageCacheTest, F32) {
+  const RawImage img = RawImage::create({9, 5}, rawspeed::TYPE_FLOAT32, 3);
+  for (int y = 0; y < 5; y++) {
+    auto* row = reinterpret_cast<float*>(img->getDataUncropped(0, y));
+    for (int x = 0; x < 27; x++)
+      row[x] = 0.25F * x - y;
+  }
+  const RawImage loaded = roundTrip(img);
+
+  ASSERT_EQ(loaded->getDataType(), rawspeed::TYPE_FLOAT32);
+  ASSERT_EQ(loaded->getCpp(), 3);
+  ASSERT_FALSE(loaded->isCFA);
+  for (int y = 0; y < 5; y++) {
+    const auto* row =
+        reinterpret_cast<const float*>(loaded->getDataUncropped(0, y));
+    for (int x = 0; x < 27; x++)
+      ASSERT_EQ(row[x], 0.25F * x - y) << x << " " << y;
+  }
+}
+
+TEST_P(RawImageCacheTest, Corrupt) {
+  std::vector<uchar8> stored = storeRawImage(createU16());
+
+  stored[0] ^= 1;
+  ASSERT_THROW(loadRawImage(Buffer(stored.data(), stored.size())),
+               RawspeedException);
+  stored[0] ^= 1;
+
+  stored.pop_back();
+  ASSERT_THROW(loadRawImage(Buffer(stored.data(), stored.size())),
+               RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,1217 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/RawImage.h"           // for RawImage, RawImageData, TYPE_U...
+#include "common/Array2DRef.h"         // for Array2DRef
+#include "common/Common.h"             // for ushort16, uint32, floatToHalf
+#include "common/Cpuid.h"              // for Cpuid
+#include "common/Executor.h"           // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"              // for iPoint2D, iRectangle2D
+#include "common/RawspeedException.h"  // for RawspeedException
+#include "common/XXH64.h"              // for xxh64_hash
+#include "metadata/ColorFilterArray.h" // for CFAColor, ColorFilterArray
+#include <algorithm>                   // for max, min
+#include <array>                       // for array
+#include <gtest/gtest.h>               // for Message, TestPartResult, Param...
+#include <memory>                      // for make_shared
+#include <tuple>                       // for get, tuple
+#include <utility>                     // for make_pair, pair
+#include <vector>                      // for vector
+
+using rawspeed::Array2DRef;
+using rawspeed::BadPixelPosition;
+using rawspeed::Cpuid;
+using rawspeed::floatToHalf;
+using rawspeed::getBadPixelPosition;
+using rawspeed::getBadPixelX;
+using rawspeed::getBadPixelY;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::RawImage;
+using rawspeed::RawImageData;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::uint64;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+static RawImage createImage(const iPoint2D& dim, uint32 cpp, int bits = 16) {
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, cpp);
+  uint32 random = 1;
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+    for (uint32 x = 0; x < dim.x * cpp; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = random >> (32 - bits);
+    }
+  }
+  return img;
+}
+
+static void expectSameImage(const RawImage& img, const RawImage& expected) {
+  const iPoint2D dim = img->getUncroppedDim();
+  const uint32 cpp = img->getCpp();
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row =
+        reinterpret_cast<const ushort16*>(img->getDataUncropped(0, y));
+    const auto* expectedRow =
+        reinterpret_cast<const ushort16*>(expected->getDataUncropped(0, y));
+    for (uint32 x = 0; x < dim.x * cpp; x++)
+      ASSERT_EQ(row[x], expectedRow[x]) << x << " " << y;
+  }
+}
+
+static void addBadPixels(const RawImage& img,
+                         const std::vector<BadPixelPosition>& positions) {
+  img->addBadPixels(positions);
+}
+
+// Every n'th pixel, in the order they are added in, which is not sorted.
+static std::vector<BadPixelPosition> everyNthPixel(const iPoint2D& dim,
+                                                   int n) {
+  std::vector<BadPixelPosition> positions;
+  for (int i = dim.area() - 1; i >= 0; i -= n)
+    positions.emplace_back(getBadPixelPosition(i % dim.x, i / dim.x));
+  return positions;
+}
+
+using FixBadPixelsType = std::tuple<uint32, int>;
+class FixBadPixelsTest : public ::testing::TestWithParam<FixBadPixelsType> {
+protected:
+  FixBadPixelsTest() = default;
+  virtual void SetUp() {
+    cpp = std::get<0>(GetParam());
+    n = std::get<1>(GetParam());
+  }
+
+  const iPoint2D dim{200, 100};
+  uint32 cpp;
+  int n;
+};
+
+INSTANTIATE_TEST_CASE_P(Sparsity, FixBadPixelsTest,
+                        ::testing::Combine(::testing::Values(1U, 3U),
+                                           ::testing::Values(7, 101, 4999)));
+
+// Whichever way they end up being stored, the result is the same as with the
+// full bad pixel map.
+TEST_P(FixBadPixelsTest, SameAsWithMap) {
+  const auto positions = everyNthPixel(dim, n);
+
+  RawImage expected = createImage(dim, cpp);
+  expected->createBadPixelMap();
+  addBadPixels(expected, positions);
+  expected->fixBadPixels();
+
+  RawImage img = createImage(dim, cpp);
+  addBadPixels(img, positions);
+  // Again, the duplicates must not matter.
+  addBadPixels(img, positions);
+  img->fixBadPixels();
+
+  // A few hundred of them are not worth a map, thousands are.
+  if (n > 100) {
+    ASSERT_EQ(img->mBadPixelMap, nullptr);
+  } else {
+    ASSERT_NE(img->mBadPixelMap, nullptr);
+    ASSERT_TRUE(img->mBadPixelList.empty());
+  }
+
+  expectSameImage(img, expected);
+}
+
+using ContentStatsType = std::tuple<uint32, int>;
+class ContentStatsTest : public ::testing::TestWithParam<ContentStatsType> {
+protected:
+  ContentStatsTest() = default;
+  virtual void SetUp() {
+    cpp = std::get<0>(GetParam());
+    n = std::get<1>(GetParam());
+    setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // Of the fixed image, the slow way.
+  static RawImageData::ContentStats expectedStats(const RawImage& img,
+                                                  int bits) {
+    const iPoint2D dim = img->getUncroppedDim();
+    const int channels = img->getCpp() == 1 ? 4 : img->getCpp();
+    RawImageData::ContentStats stats;
+    stats.channels.resize(channels);
+    for (auto& c : stats.channels) {
+      c.min = 65535;
+      c.histogram.resize(1U << bits);
+    }
+    std::vector<uchar8> lineHashes;
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(img->getDataUncropped(0, y));
+      for (int x = 0; x < dim.x * static_cast<int>(img->getCpp()); x++) {
+        const int ch = img->getCpp() == 1 ? (y % 2) * 2 + x % 2 : x % channels;
+        auto& c = stats.channels[ch];
+        c.min = std::min<double>(c.min, row[x]);
+        c.max = std::max<double>(c.max, row[x]);
+        c.sum += row[x];
+        c.count++;
+        c.histogram[row[x] >> (16 - bits)]++;
+      }
+      uint64 h = rawspeed::xxh64::xxh64_hash(
+          reinterpret_cast<const uchar8*>(row), dim.x * img->getBpp());
+      for (int k = 0; k < 8; k++, h >>= 8U)
+        lineHashes.push_back(h & 0xFFU);
+    }
+    stats.hash =
+        rawspeed::xxh64::xxh64_hash(lineHashes.data(), lineHashes.size());
+    return stats;
+  }
+
+  // Of several bands for each of the threads.
+  const iPoint2D dim{300, 2000};
+  uint32 cpp;
+  int n;
+};
+
+INSTANTIATE_TEST_CASE_P(BadPixels, ContentStatsTest,
+                        ::testing::Combine(::testing::Values(1U, 3U),
+                                           ::testing::Values(0, 7, 4999)));
+
+// Of the pixels after the bad ones are fixed, whether they are done in the
+// same pass, after it, or by some other thread.
+TEST_P(ContentStatsTest, SameAsOfFixedImage) {
+  const auto positions = n ? everyNthPixel(dim, n)
+                           : std::vector<BadPixelPosition>();
+
+  RawImage expected = createImage(dim, cpp);
+  addBadPixels(expected, positions);
+  expected->fixBadPixels();
+
+  RawImage img = createImage(dim, cpp);
+  addBadPixels(img, positions);
+  RawImageData::ContentStats stats;
+  stats.histogramBits = 8;
+  img->contentStats = &stats;
+  img->fixBadPixels();
+  img->contentStats = nullptr;
+
+  expectSameImage(img, expected);
+
+  const auto expectedStats = this->expectedStats(expected, 8);
+  ASSERT_EQ(stats.hash, expectedStats.hash);
+  ASSERT_EQ(stats.lineHashes.size(), dim.y);
+  ASSERT_EQ(stats.channels.size(), expectedStats.channels.size());
+  for (size_t i = 0; i < stats.channels.size(); i++) {
+    const auto& c = stats.channels[i];
+    const auto& e = expectedStats.channels[i];
+    ASSERT_EQ(c.count, e.count);
+    ASSERT_EQ(c.min, e.min);
+    ASSERT_EQ(c.max, e.max);
+    ASSERT_EQ(c.sum, e.sum);
+    ASSERT_EQ(c.getMean(), e.getMean());
+    ASSERT_EQ(c.histogram, e.histogram);
+  }
+}
+
+// With nothing else to do, they are still computed, in a pass of their own.
+TEST(ContentStatsOnlyTest, Float) {
+  RawImage img = RawImage::create({5, 3}, rawspeed::TYPE_FLOAT32, 1);
+  for (int y = 0; y < 3; y++) {
+    for (int x = 0; x < 5; x++)
+      reinterpret_cast<float*>(img->getData(0, y))[x] = (x + 5 * y) / 10.0F;
+  }
+  RawImageData::ContentStats stats;
+  stats.histogramBits = 1;
+  img->contentStats = &stats;
+  img->postProcess(0);
+  img->contentStats = nullptr;
+
+  ASSERT_EQ(stats.channels.size(), 4);
+  // Of the values 0, 0.2, 0.4, 1.0, 1.2, 1.4.
+  ASSERT_EQ(stats.channels[0].count, 6);
+  ASSERT_FLOAT_EQ(stats.channels[0].min, 0);
+  ASSERT_FLOAT_EQ(stats.channels[0].max, 1.4);
+  ASSERT_FLOAT_EQ(stats.channels[0].getMean(), 0.7);
+  ASSERT_EQ(stats.channels[0].histogram, std::vector<uint64>({3, 3}));
+  // Of the values 0.5, 0.7, 0.9.
+  ASSERT_EQ(stats.channels[2].count, 3);
+  ASSERT_EQ(stats.channels[2].histogram, std::vector<uint64>({0, 3}));
+  ASSERT_NE(stats.hash, 0);
+
+  stats.histogramBits = 17;
+  img->contentStats = &stats;
+  ASSERT_THROW(img->postProcess(0), RawspeedException);
+}
+
+// The runs of them share the searches for the good pixels, which are the
+// same for all of a run, e.g. of a dead column. Were any of them a bad one,
+// it would show.
+using PyramidType = std::tuple<uint32, int>;
+class PyramidTest : public ::testing::TestWithParam<PyramidType> {
+protected:
+  PyramidTest() = default;
+  virtual void SetUp() {
+    cpp = std::get<0>(GetParam());
+    n = std::get<1>(GetParam());
+    setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // Of the pixels of the same color of each 2x2 block of the CFA, the slow
+  // way. Those of the partial blocks at the edges are counted twice.
+  static std::vector<int> bin(const std::vector<int>& in, const iPoint2D& dim,
+                              int cpp, const iPoint2D& s, iPoint2D* outDim) {
+    const auto binnedSize = [](int size, int cfa) {
+      int out = 0;
+      for (int i = 0; i < size; i++)
+        out += (i / cfa) % 2 == 0;
+      return out;
+    };
+    *outDim = {binnedSize(dim.x, s.x), binnedSize(dim.y, s.y)};
+    std::vector<int> out;
+    for (int y = 0; y < outDim->y; y++) {
+      const int y0 = 2 * s.y * (y / s.y) + y % s.y;
+      const int y1 = y0 + s.y < dim.y ? y0 + s.y : y0;
+      for (int x = 0; x < outDim->x; x++) {
+        const int x0 = 2 * s.x * (x / s.x) + x % s.x;
+        const int x1 = x0 + s.x < dim.x ? x0 + s.x : x0;
+        for (int i = 0; i < cpp; i++) {
+          const auto at = [&in, &dim, cpp, i](int px, int py) {
+            return in[(py * dim.x + px) * cpp + i];
+          };
+          out.push_back(
+              (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1) + 2) >> 2);
+        }
+      }
+    }
+    return out;
+  }
+
+  static std::vector<int> pixelsOf(const RawImage& img) {
+    const iPoint2D dim = img->getUncroppedDim();
+    std::vector<int> pixels;
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(img->getDataUncropped(0, y));
+      for (int x = 0; x < dim.x * static_cast<int>(img->getCpp()); x++)
+        pixels.push_back(row[x]);
+    }
+    return pixels;
+  }
+
+  // Odd, and of several bands for each of the threads.
+  const iPoint2D dim{301, 1999};
+  uint32 cpp;
+  int n;
+};
+
+INSTANTIATE_TEST_CASE_P(BadPixels, PyramidTest,
+                        ::testing::Combine(::testing::Values(1U, 3U),
+                                           ::testing::Values(0, 7, 4999)));
+
+// Each level of the one above, that of the pixels after the bad ones are
+// fixed, whether they are done in the same pass, after it, or by some other
+// thread.
+TEST_P(PyramidTest, SameAsBinningOfFixedImage) {
+  const auto positions = n ? everyNthPixel(dim, n)
+                           : std::vector<BadPixelPosition>();
+
+  RawImage expected = createImage(dim, cpp);
+  addBadPixels(expected, positions);
+  expected->fixBadPixels();
+
+  RawImage img = createImage(dim, cpp);
+  img->isCFA = cpp == 1;
+  addBadPixels(img, positions);
+  rawspeed::ImagePyramid pyramid;
+  img->pyramid = &pyramid;
+  if (n)
+    img->fixBadPixels();
+  else
+    img->postProcess(0);
+  img->pyramid = nullptr;
+
+  expectSameImage(img, expected);
+
+  const iPoint2D s = cpp == 1 ? iPoint2D(2, 2) : iPoint2D(1, 1);
+  ASSERT_EQ(pyramid.images.size(), pyramid.levels);
+  std::vector<int> level = pixelsOf(expected);
+  iPoint2D levelDim = dim;
+  for (const RawImage& out : pyramid.images) {
+    iPoint2D binnedDim;
+    level = bin(level, levelDim, cpp, s, &binnedDim);
+    levelDim = binnedDim;
+    ASSERT_EQ(out->getUncroppedDim(), levelDim);
+    ASSERT_EQ(out->getCpp(), cpp);
+    ASSERT_EQ(out->isCFA, cpp == 1);
+    ASSERT_EQ(pixelsOf(out), level);
+  }
+}
+
+TEST(PyramidOnlyTest, Float) {
+  const iPoint2D dim(5, 3);
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_FLOAT32, 1);
+  for (int y = 0; y < dim.y; y++) {
+    for (int x = 0; x < dim.x; x++)
+      reinterpret_cast<float*>(img->getData(0, y))[x] = y * dim.x + x;
+  }
+
+  rawspeed::ImagePyramid pyramid;
+  pyramid.levels = 1;
+  pyramid.cfaSize = {1, 1};
+  img->pyramid = &pyramid;
+  img->postProcess(0);
+  img->pyramid = nullptr;
+
+  ASSERT_EQ(pyramid.images.size(), 1);
+  const RawImage& out = pyramid.images.front();
+  ASSERT_EQ(out->getUncroppedDim(), iPoint2D(3, 2));
+  const std::array<std::array<float, 3>, 2> expected{
+      {{3.0F, 5.0F, 6.5F}, {10.5F, 12.5F, 14.0F}}};
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < 3; x++)
+      ASSERT_EQ(reinterpret_cast<float*>(out->getData(0, y))[x],
+                expected[y][x]);
+  }
+}
+
+TEST(FixBadPixelsRunsTest, DeadColumnsAndRows) {
+  for (bool isCFA : {false, true}) {
+    const iPoint2D dim(12, 10);
+    RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    img->isCFA = isCFA;
+    for (int y = 0; y < dim.y; y++) {
+      for (int x = 0; x < dim.x; x++)
+        reinterpret_cast<ushort16*>(img->getData(0, y))[x] = 1000;
+    }
+
+    // Two columns next to each other, and a row, but not where they cross.
+    // Not up to the right and the bottom edge, where the good pixel to the
+    // left, or up, of a bad one with none on the other side gets no weight.
+    std::vector<BadPixelPosition> positions;
+    for (int y = 0; y < dim.y - 2; y++) {
+      if (y != 6) {
+        positions.emplace_back(getBadPixelPosition(4, y));
+        positions.emplace_back(getBadPixelPosition(5, y));
+      }
+    }
+    for (int x = 0; x < dim.x - 2; x++) {
+      if (x != 4 && x != 5)
+        positions.emplace_back(getBadPixelPosition(x, 6));
+    }
+    for (BadPixelPosition pos : positions) {
+      reinterpret_cast<ushort16*>(
+          img->getData(0, getBadPixelY(pos)))[getBadPixelX(pos)] = 0;
+    }
+    addBadPixels(img, positions);
+    img->fixBadPixels();
+
+    for (int y = 0; y < dim.y; y++) {
+      for (int x = 0; x < dim.x; x++)
+        ASSERT_EQ(reinterpret_cast<ushort16*>(img->getData(0, y))[x], 1000)
+            << x << " " << y;
+    }
+  }
+}
+
+TEST(FixBadPixelsListTest, SortedAndUnique) {
+  const iPoint2D dim(64, 64);
+  RawImage img = createImage(dim, 1);
+  addBadPixels(img, {getBadPixelPosition(5, 9), getBadPixelPosition(3, 1),
+                     getBadPixelPosition(5, 9), getBadPixelPosition(7, 0)});
+  img->transferBadPixelsToMap();
+
+  ASSERT_EQ(img->mBadPixelMap, nullptr);
+  ASSERT_EQ(img->mBadPixelList, std::vector<BadPixelPosition>(
+                                    {getBadPixelPosition(7, 0),
+                                     getBadPixelPosition(3, 1),
+                                     getBadPixelPosition(5, 9)}));
+
+  ASSERT_TRUE(img->isBadPixel(5, 9));
+  ASSERT_TRUE(img->isBadPixel(3, 1));
+  ASSERT_FALSE(img->isBadPixel(9, 5));
+
+  // And the map, once there is one, has them all.
+  img->createBadPixelMap();
+  ASSERT_TRUE(img->mBadPixelList.empty());
+  ASSERT_TRUE(img->isBadPixel(5, 9));
+  ASSERT_TRUE(img->isBadPixel(7, 0));
+  ASSERT_FALSE(img->isBadPixel(9, 5));
+}
+
+// Neither the dimensions nor the positions of the bad pixels are 16-bit.
+TEST(FixBadPixelsListTest, LargerThan16Bits) {
+  for (const iPoint2D dim : {iPoint2D(70000, 6), iPoint2D(6, 70000)}) {
+    RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    img->clearArea({{0, 0}, dim}, 0);
+    const iPoint2D bad = dim - iPoint2D(3, 3);
+    *reinterpret_cast<ushort16*>(img->getData(bad.x - 2, bad.y)) = 100;
+    *reinterpret_cast<ushort16*>(img->getData(bad.x + 2, bad.y)) = 100;
+    *reinterpret_cast<ushort16*>(img->getData(bad.x, bad.y - 2)) = 100;
+    *reinterpret_cast<ushort16*>(img->getData(bad.x, bad.y + 2)) = 100;
+
+    addBadPixels(img, {getBadPixelPosition(bad.x, bad.y)});
+    img->transferBadPixelsToMap();
+    ASSERT_TRUE(img->isBadPixel(bad.x, bad.y));
+    ASSERT_FALSE(img->isBadPixel(bad.x & 0xffff, bad.y & 0xffff));
+
+    img->fixBadPixels();
+    ASSERT_NE(*reinterpret_cast<ushort16*>(img->getData(bad.x, bad.y)), 0);
+  }
+}
+
+class BlackAreasTest : public ::testing::TestWithParam<int> {
+protected:
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, BlackAreasTest, ::testing::Values(1, 3));
+
+// The median of each of the 2x2 CFA positions, of all the pixels of the
+// areas, the odd rows and columns of the areas being left out.
+TEST_P(BlackAreasTest, MedianOfEachComponent) {
+  RawImage img = createImage({64, 40}, 1, 12);
+  img->subFrame({{6, 4}, {56, 34}});
+  img->whitePoint = 4095;
+  img->blackAreas = {{0, 5, false}, {0, 6, true}, {60, 2, true}};
+
+  std::array<std::vector<ushort16>, 4> values;
+  const auto add = [&img, &values](int x, int y) {
+    values[2 * (y & 1) + (x & 1)].emplace_back(
+        *reinterpret_cast<ushort16*>(img->getDataUncropped(x, y)));
+  };
+  for (int y = 0; y < 4; y++)
+    for (int x = 6; x < 62; x++)
+      add(x, y);
+  for (int y = 4; y < 38; y++) {
+    for (int x = 0; x < 6; x++)
+      add(x, y);
+    for (int x = 60; x < 62; x++)
+      add(x, y);
+  }
+
+  img->calculateBlackAreas();
+
+  const size_t total = 4 * 56 + 6 * 34 + 2 * 34;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(values[i].size(), total / 4);
+    std::sort(values[i].begin(), values[i].end());
+    ASSERT_EQ(img->blackLevelSeparate[i], values[i][total / 8]) << i;
+  }
+}
+
+using PostProcessType = std::tuple<int, bool, int>;
+class PostProcessTest : public ::testing::TestWithParam<PostProcessType> {
+protected:
+  PostProcessTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    dither = std::get<1>(GetParam());
+    stages = std::get<2>(GetParam());
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  RawImage createImage() const {
+    // Wide enough for a few bands of rows, cropped on all the sides.
+    RawImage img = rawspeed_test::createImage({4000, 100}, 1, 12);
+    img->subFrame({{3, 5}, {3990, 92}});
+
+    std::vector<ushort16> table(4096);
+    for (uint32 i = 0; i < table.size(); i++)
+      table[i] = 200 + i * 3;
+    img->setTable(table, dither);
+
+    img->blackLevelSeparate = {{200, 210, 220, 230}};
+    img->whitePoint = 12500;
+    img->mDitherScale = dither;
+
+    // Some of them even stretch across the bands and the threads, and so
+    // do the pixels that are read to fix them.
+    std::vector<BadPixelPosition> positions = {
+        getBadPixelPosition(0, 0), getBadPixelPosition(3999, 0),
+        getBadPixelPosition(0, 99), getBadPixelPosition(3999, 99)};
+    for (uint32 y = 0; y < 100; y++) {
+      positions.emplace_back(getBadPixelPosition(1000, y));
+      if (y % 3 != 0)
+        positions.emplace_back(getBadPixelPosition(2002, y));
+    }
+    for (uint32 x = 0; x < 4000; x += 37)
+      positions.emplace_back(getBadPixelPosition(x, (x * 7) % 100));
+    addBadPixels(img, positions);
+
+    return img;
+  }
+
+  bool dither;
+  int stages;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Stages, PostProcessTest,
+    ::testing::Combine(
+        ::testing::Values(1, 3, 8), ::testing::Bool(),
+        ::testing::Values(RawImageData::STAGE_LOOKUP |
+                              RawImageData::STAGE_SCALE_BLACK_WHITE,
+                          RawImageData::STAGE_LOOKUP |
+                              RawImageData::STAGE_FIX_BAD_PIXELS,
+                          RawImageData::STAGE_SCALE_BLACK_WHITE |
+                              RawImageData::STAGE_FIX_BAD_PIXELS,
+                          RawImageData::STAGE_LOOKUP |
+                              RawImageData::STAGE_SCALE_BLACK_WHITE |
+                              RawImageData::STAGE_FIX_BAD_PIXELS)));
+
+TEST_P(PostProcessTest, SameAsOneByOne) {
+  RawImage expected = createImage();
+  if (stages & RawImageData::STAGE_LOOKUP)
+    expected->sixteenBitLookup();
+  if (stages & RawImageData::STAGE_SCALE_BLACK_WHITE)
+    expected->scaleBlackWhite();
+  if (stages & RawImageData::STAGE_FIX_BAD_PIXELS)
+    expected->fixBadPixels();
+
+  RawImage img = createImage();
+  img->postProcess(stages);
+  expectSameImage(img, expected);
+
+  if (!(stages & RawImageData::STAGE_FIX_BAD_PIXELS))
+    return;
+
+  // They are not fixed again, unless there are new ones.
+  auto* pixel = reinterpret_cast<ushort16*>(img->getDataUncropped(1000, 50));
+  *pixel = 12345;
+  img->fixBadPixels();
+  ASSERT_EQ(*pixel, 12345);
+  addBadPixels(img, {getBadPixelPosition(1000, 50)});
+  img->fixBadPixels();
+  ASSERT_NE(*pixel, 12345);
+}
+
+using LookupType = std::tuple<int, uint32>;
+class LookupTest : public ::testing::TestWithParam<LookupType> {
+protected:
+  LookupTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    cpp = std::get<1>(GetParam());
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  uint32 cpp;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, LookupTest,
+                        ::testing::Combine(::testing::Values(1, 3, 8),
+                                           ::testing::Values(1U, 3U)));
+
+// Each row is dithered by its own generator, seeded by its y.
+TEST_P(LookupTest, DitheredSameAsRowByRow) {
+  // Not a whole number of the rows that are done at once, and cropped.
+  const iPoint2D dim(101, 37);
+  RawImage img = createImage(dim, cpp, 12);
+  img->subFrame({{1, 2}, {97, 33}});
+  const RawImage orig = createImage(dim, cpp, 12);
+
+  std::vector<ushort16> table(4096);
+  for (uint32 i = 0; i < table.size(); i++)
+    table[i] = 100 + i * 5 + (i * i) / 512;
+  img->setTable(table, true);
+  img->sixteenBitLookup();
+
+  // See TableLookUp::setTable(), the curve is increasing.
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row =
+        reinterpret_cast<const ushort16*>(img->getDataUncropped(0, y));
+    const auto* origRow =
+        reinterpret_cast<const ushort16*>(orig->getDataUncropped(0, y));
+
+    uint32 v = (dim.x + y * 13) ^ 0x45694584;
+    for (uint32 x = 0; x < dim.x * cpp; x++) {
+      const int i = origRow[x];
+      const int center = table[i];
+      const int prev = i > 0 ? table[i - 1] : center;
+      const int next = i + 1 < static_cast<int>(table.size()) ? table[i + 1]
+                                                              : center;
+      const int delta = next - prev;
+      const int base = i == 0 ? delta : center - (delta + 2) / 4;
+      v = 15700 * (v & 65535) + (v >> 16);
+      const int expected = base + ((delta * (v & 2047) + 1024) >> 12);
+      ASSERT_EQ(row[x], std::min(expected, 65535)) << x << " " << y;
+    }
+  }
+}
+
+static RawImage createFloatImage(const iPoint2D& dim, uint32 cpp) {
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_FLOAT32, cpp);
+  uint32 random = 1;
+  for (int y = 0; y < dim.y; y++) {
+    auto* row = reinterpret_cast<float*>(img->getData(0, y));
+    for (uint32 x = 0; x < dim.x * cpp; x++) {
+      random = random * 1103515245U + 12345U;
+      row[x] = static_cast<float>(random >> 16);
+    }
+  }
+  return img;
+}
+
+class FloatImageTest : public ::testing::TestWithParam<int> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+  }
+  void TearDown() override { setExecutor(nullptr); }
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, FloatImageTest, ::testing::Values(1, 3));
+
+// With a crop that leaves the rows unaligned, and a width that is not a
+// whole number of the vectors.
+TEST_P(FloatImageTest, ScaleSameAsScalar) {
+  RawImage img = createFloatImage({64, 9}, 1);
+  img->subFrame({{3, 1}, {53, 7}});
+  RawImage before = createFloatImage({64, 9}, 1);
+  before->subFrame({{3, 1}, {53, 7}});
+
+  img->blackLevelSeparate = {{100, 200, 300, 400}};
+  img->whitePoint = 60000;
+  img->scaleBlackWhite();
+
+  for (int y = 0; y < 7; y++) {
+    const auto* row = reinterpret_cast<const float*>(img->getData(0, y));
+    const auto* orig = reinterpret_cast<const float*>(before->getData(0, y));
+    for (int x = 0; x < 53; x++) {
+      // The CFA position in the uncropped image.
+      const int v = ((x + 3) & 1) | (((y + 1) & 1) << 1);
+      const float sub = static_cast<float>(img->blackLevelSeparate[v]);
+      const float mul = 65535.0F / static_cast<float>(60000 - sub);
+      ASSERT_EQ(row[x], (orig[x] - sub) * mul) << x << " " << y;
+    }
+  }
+}
+
+TEST_P(FloatImageTest, HalfFloat) {
+  RawImage img = createFloatImage({64, 9}, 1);
+  img->subFrame({{3, 1}, {53, 7}});
+  img->blackLevelSeparate = {{100, 200, 300, 400}};
+  img->whitePoint = 60000;
+
+  std::vector<ushort16> storage;
+  const auto out = Array2DRef<ushort16>::create(&storage, 53, 7);
+  img->scaleToHalfFloat(out);
+
+  for (int y = 0; y < 7; y++) {
+    const auto* row = reinterpret_cast<const float*>(img->getData(0, y));
+    for (int x = 0; x < 53; x++) {
+      const int v = ((x + 3) & 1) | (((y + 1) & 1) << 1);
+      const float sub = static_cast<float>(img->blackLevelSeparate[v]);
+      const float e = (row[x] - sub) * (1.0F / (60000 - sub));
+      ASSERT_EQ(out(x, y), floatToHalf(std::min(std::max(e, 0.0F), 1.0F)))
+          << x << " " << y;
+    }
+  }
+}
+
+// All of the components get the weights of the closest valid pixels, and
+// one without a pair in its direction gets all of the weight of it.
+TEST_P(FloatImageTest, FixBadPixelsOfEachComponent) {
+  const iPoint2D dim(48, 40);
+  RawImage img = createFloatImage(dim, 3);
+  img->isCFA = false;
+
+  std::vector<BadPixelPosition> positions;
+  for (int y = 0; y < dim.y; y += 3)
+    for (int x = (y % 2) * 7; x < dim.x; x += 11)
+      positions.emplace_back(getBadPixelPosition(x, y));
+  // And a run of them at the left border.
+  for (int x = 0; x < 4; x++)
+    positions.emplace_back(getBadPixelPosition(x, 20));
+  addBadPixels(img, positions);
+
+  const RawImage orig = createFloatImage(dim, 3);
+  img->fixBadPixels();
+
+  const auto closest = [&img, &dim](int x, int y, int dx, int dy) {
+    for (int d = 1;; d++) {
+      const int xx = x + dx * d;
+      const int yy = y + dy * d;
+      if (xx < 0 || xx >= dim.x || yy < 0 || yy >= dim.y)
+        return std::make_pair(iPoint2D(), 0);
+      if (!img->isBadPixel(xx, yy))
+        return std::make_pair(iPoint2D(xx, yy), d);
+    }
+  };
+
+  for (BadPixelPosition pos : positions) {
+    const int x = getBadPixelX(pos);
+    const int y = getBadPixelY(pos);
+    const std::array<std::pair<iPoint2D, int>, 4> found = {
+        {closest(x, y, -1, 0), closest(x, y, 1, 0), closest(x, y, 0, -1),
+         closest(x, y, 0, 1)}};
+    const auto* pix =
+        reinterpret_cast<const float*>(img->getDataUncropped(x, y));
+    for (int c = 0; c < 3; c++) {
+      double total = 0;
+      int directions = 0;
+      for (int i = 0; i < 4; i += 2) {
+        const int d0 = found[i].second;
+        const int d1 = found[i + 1].second;
+        if (!d0 && !d1)
+          continue;
+        directions++;
+        for (int j : {i, i + 1}) {
+          if (!found[j].second)
+            continue;
+          const int other = found[j ^ 1].second;
+          const double w =
+              other ? static_cast<double>(other) / (d0 + d1) : 1.0;
+          total += w * reinterpret_cast<const float*>(orig->getDataUncropped(
+                           found[j].first.x, found[j].first.y))[c];
+        }
+      }
+      ASSERT_NEAR(pix[c], total / directions, 0.05) << x << " " << y;
+    }
+  }
+}
+
+TEST(RawImageViewTest, SharesThePixels) {
+  RawImage parent = createImage({40, 30}, 3);
+  parent->subFrame({{1, 2}, {35, 25}});
+  parent->blackLevel = 123;
+
+  RawImage view = RawImage::createView(parent, {{4, 3}, {20, 10}});
+  ASSERT_TRUE(view->isView());
+  ASSERT_EQ(view->dim, iPoint2D(20, 10));
+  ASSERT_EQ(view->getUncroppedDim(), iPoint2D(20, 10));
+  ASSERT_EQ(view->getCpp(), 3);
+  ASSERT_EQ(view->blackLevel, 123);
+  ASSERT_EQ(view->getData(0, 0), parent->getData(4, 3));
+  ASSERT_EQ(view->getData(19, 9), parent->getData(23, 12));
+
+  // Both ways.
+  *reinterpret_cast<ushort16*>(view->getData(2, 1)) = 4321;
+  ASSERT_EQ(*reinterpret_cast<ushort16*>(parent->getData(6, 4)), 4321);
+
+  const auto a = view->getU16DataAsCroppedArray2DRef();
+  ASSERT_EQ(a.width, 20 * 3);
+  ASSERT_EQ(a.height, 10);
+  ASSERT_EQ(&a(3 * 2, 1), reinterpret_cast<ushort16*>(parent->getData(6, 4)));
+  ASSERT_THROW(view->getF32DataAsCroppedArray2DRef(), RawspeedException);
+
+  // The view keeps the pixels alive.
+  const ushort16 expected = *reinterpret_cast<ushort16*>(view->getData(7, 8));
+  parent = RawImage::create();
+  ASSERT_EQ(*reinterpret_cast<ushort16*>(view->getData(7, 8)), expected);
+}
+
+TEST(RawImageViewTest, ShiftsTheCFA) {
+  RawImage parent = createImage({16, 16}, 1);
+  parent->isCFA = true;
+  parent->cfa.setCFA({2, 2}, rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                     rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+
+  RawImage view = RawImage::createView(parent, {{1, 1}, {8, 8}});
+  ASSERT_TRUE(view->isCFA);
+  ASSERT_EQ(view->cfa.getColorAt(0, 0), rawspeed::CFA_BLUE);
+  ASSERT_EQ(view->cfa.getColorAt(1, 1), rawspeed::CFA_RED);
+}
+
+TEST(RawImageViewTest, OutsideThrows) {
+  RawImage parent = createImage({16, 16}, 1);
+  parent->subFrame({{2, 2}, {12, 12}});
+
+  ASSERT_NO_THROW(RawImage::createView(parent, {{0, 0}, {12, 12}}));
+  ASSERT_THROW(RawImage::createView(parent, {{1, 0}, {12, 12}}),
+               RawspeedException);
+  ASSERT_THROW(RawImage::createView(parent, {{-1, 0}, {4, 4}}),
+               RawspeedException);
+  ASSERT_THROW(RawImage::createView(parent, {{0, 0}, {0, 4}}),
+               RawspeedException);
+  ASSERT_THROW(RawImage::createView(RawImage::create(), {{0, 0}, {1, 1}}),
+               RawspeedException);
+}
+
+// On a view, the rows do not own their padding.
+TEST(RawImageViewTest, ScaleBlackWhite) {
+  RawImage parent = createImage({64, 8}, 1, 12);
+  RawImage before = createImage({64, 8}, 1, 12);
+
+  RawImage view = RawImage::createView(parent, {{3, 2}, {37, 4}});
+  view->blackLevelSeparate = {{100, 100, 100, 100}};
+  view->whitePoint = 4000;
+  view->scaleBlackWhite();
+
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 64; x++) {
+      const auto v = *reinterpret_cast<ushort16*>(parent->getData(x, y));
+      const auto b = *reinterpret_cast<ushort16*>(before->getData(x, y));
+      if (x >= 3 && x < 40 && y >= 2 && y < 6)
+        continue;
+      ASSERT_EQ(v, b) << x << " " << y;
+    }
+  }
+}
+
+// The handles are copied, and the views created and destroyed, concurrently.
+TEST(RawImageHandleTest, ConcurrentCopies) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  RawImage img = createImage({16, 8}, 1);
+  const ushort16 first = *reinterpret_cast<ushort16*>(img->getData(0, 0));
+  {
+    RawImage shared = img;
+    rawspeed::parallelForEach(0, 64, [&shared](int i) {
+      for (int j = 0; j < 100; j++) {
+        RawImage copy = shared;
+        RawImage view = RawImage::createView(copy, {{i % 8, 0}, {8, 8}});
+        copy = view;
+      }
+    });
+  }
+  ASSERT_EQ(*reinterpret_cast<ushort16*>(img->getData(0, 0)), first);
+  setExecutor(nullptr);
+}
+
+TEST(RawImageExternalDataTest, UsesThePitch) {
+  alignas(16) std::array<uchar8, 96 * 10> buffer;
+  buffer.fill(0xAB);
+
+  {
+    RawImage img = RawImage::create({30, 10}, rawspeed::TYPE_USHORT16, 1,
+                                    {buffer.data(), buffer.size(), 96});
+    ASSERT_EQ(img->pitch, 96);
+    ASSERT_EQ(img->padding, 96 - 30 * 2);
+    ASSERT_EQ(img->getData(0, 0), buffer.data());
+    ASSERT_EQ(img->getData(5, 3), &buffer[3 * 96 + 5 * 2]);
+    img->clearArea({{0, 0}, {30, 10}});
+  }
+
+  // Still there, and the padding is untouched.
+  for (int y = 0; y < 10; y++) {
+    for (int x = 0; x < 96; x++)
+      ASSERT_EQ(buffer[y * 96 + x], x < 60 ? 0 : 0xAB) << x << " " << y;
+  }
+}
+
+TEST(RawImageExternalDataTest, DefaultPitch) {
+  alignas(16) std::array<uchar8, 3520> buffer;
+  RawImage img = RawImage::create(rawspeed::TYPE_USHORT16);
+  img->externalData = {buffer.data(), buffer.size()};
+  img->dim = {30, 10};
+  img->createData();
+  ASSERT_EQ(img->getData(0, 0), buffer.data());
+  ASSERT_EQ(img->pitch % 16, 0);
+  ASSERT_GE(img->pitch, 60);
+}
+
+TEST(RawImageExternalDataTest, BadThrows) {
+  alignas(16) std::array<uchar8, 96 * 10 + 16> buffer;
+  const auto create = [](const RawImageData::ExternalData& e) {
+    RawImage::create({30, 10}, rawspeed::TYPE_USHORT16, 1, e);
+  };
+  ASSERT_NO_THROW(create({buffer.data(), 96 * 10, 96}));
+  // Too small.
+  ASSERT_THROW(create({buffer.data(), 96 * 10 - 1, 96}), RawspeedException);
+  // The pitch is too small, or not aligned.
+  ASSERT_THROW(create({buffer.data(), buffer.size(), 48}), RawspeedException);
+  ASSERT_THROW(create({buffer.data(), buffer.size(), 88}), RawspeedException);
+  // Not aligned.
+  ASSERT_THROW(create({buffer.data() + 2, 96 * 10, 96}), RawspeedException);
+}
+
+// The same as the scaled pixels, averaged per color, give or take rounding.
+TEST(BinHalfSizeTest, SameAsScaledAndAveraged) {
+  const iPoint2D dim(41, 30);
+  // With an odd crop, to have the black levels of the other positions.
+  const iRectangle2D crop({1, 1}, {39, 27});
+  const std::array<int, 4> black = {{100, 110, 120, 130}};
+  const int white = 4000;
+
+  RawImage img = createImage(dim, 1, 12);
+  img->cfa.setCFA({2, 2}, rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                  rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+  img->subFrame(crop);
+  img->blackLevelSeparate = black;
+  img->whitePoint = white;
+
+  RawImage binned = img->binHalfSize();
+  ASSERT_EQ(binned->dim, iPoint2D(19, 13));
+  ASSERT_EQ(binned->getCpp(), 3);
+  ASSERT_FALSE(binned->isCFA);
+  ASSERT_EQ(binned->whitePoint, 65535);
+
+  for (int y = 0; y < binned->dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(binned->getData(0, y));
+    for (int x = 0; x < binned->dim.x; x++) {
+      std::array<double, 3> sum = {{0, 0, 0}};
+      std::array<int, 3> count = {{0, 0, 0}};
+      for (int i = 0; i < 4; i++) {
+        const int col = 2 * x + (i & 1);
+        const int r = 2 * y + (i >> 1);
+        const int c = img->cfa.getColorAt(col, r);
+        // The black levels are of the positions in the uncropped image.
+        const int b = black[((crop.pos.x + col) & 1) |
+                            (((crop.pos.y + r) & 1) << 1)];
+        const int v = *reinterpret_cast<ushort16*>(img->getData(col, r));
+        sum[c] += (v - b) * 65535.0 / (white - b);
+        count[c]++;
+      }
+      for (int c = 0; c < 3; c++) {
+        const double e = std::min(std::max(sum[c] / count[c], 0.0), 65535.0);
+        ASSERT_NEAR(row[3 * x + c], e, 1) << x << " " << y << " " << c;
+      }
+    }
+  }
+}
+
+TEST(BinHalfSizeTest, NotRGBThrows) {
+  RawImage img = createImage({8, 8}, 1);
+  img->whitePoint = 65535;
+  img->blackLevel = 0;
+  // No CFA at all, then without blue.
+  ASSERT_THROW(img->binHalfSize(), RawspeedException);
+  img->cfa.setCFA({2, 2}, rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                  rawspeed::CFA_GREEN, rawspeed::CFA_RED);
+  ASSERT_THROW(img->binHalfSize(), RawspeedException);
+  ASSERT_THROW(createImage({8, 8}, 3)->binHalfSize(), RawspeedException);
+}
+
+class SplitCFAPlanesTest : public ::testing::TestWithParam<bool> {};
+
+INSTANTIATE_TEST_CASE_P(Scale, SplitCFAPlanesTest, ::testing::Bool());
+
+TEST_P(SplitCFAPlanesTest, SameAsThePixelsOfEachColor) {
+  const bool scale = GetParam();
+  const iRectangle2D crop({1, 1}, {39, 27});
+  const std::array<int, 4> black = {{100, 110, 120, 130}};
+  const int white = 4000;
+
+  RawImage img = createImage({41, 30}, 1, 12);
+  // Not in the order of the planes, so they have to be sorted.
+  img->cfa.setCFA({2, 2}, rawspeed::CFA_GREEN, rawspeed::CFA_BLUE,
+                  rawspeed::CFA_RED, rawspeed::CFA_GREEN);
+  img->subFrame(crop);
+  img->blackLevelSeparate = black;
+  img->whitePoint = white;
+
+  RawImage planes = img->splitCFAPlanes(scale);
+  ASSERT_EQ(planes->dim, iPoint2D(19, 4 * 13));
+  ASSERT_EQ(planes->getCpp(), 1);
+  ASSERT_FALSE(planes->isCFA);
+  ASSERT_EQ(planes->whitePoint, scale ? 65535 : white);
+
+  // R, G1, G2, B, as the positions in the quad of the crop, with the greens
+  // as they come.
+  std::array<iPoint2D, 4> quad;
+  int greens = 0;
+  for (int i = 0; i < 4; i++) {
+    const iPoint2D pos(i & 1, i >> 1);
+    switch (img->cfa.getColorAt(pos.x, pos.y)) {
+    case rawspeed::CFA_RED:
+      quad[0] = pos;
+      break;
+    case rawspeed::CFA_GREEN:
+      quad[1 + greens++] = pos;
+      break;
+    default:
+      quad[3] = pos;
+      break;
+    }
+  }
+  ASSERT_EQ(greens, 2);
+  for (int p = 0; p < 4; p++) {
+    // The black levels are of the positions in the uncropped image.
+    const int b = black[((crop.pos.x + quad[p].x) & 1) |
+                        (((crop.pos.y + quad[p].y) & 1) << 1)];
+    if (!scale) {
+      ASSERT_EQ(planes->blackLevelSeparate[p], b);
+    }
+    for (int y = 0; y < 13; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(planes->getData(0, p * 13 + y));
+      for (int x = 0; x < 19; x++) {
+        const int v = *reinterpret_cast<ushort16*>(
+            img->getData(2 * x + quad[p].x, 2 * y + quad[p].y));
+        if (!scale) {
+          ASSERT_EQ(row[x], v) << x << " " << y << " " << p;
+          continue;
+        }
+        const double e =
+            std::min(std::max((v - b) * 65535.0 / (white - b), 0.0), 65535.0);
+        ASSERT_NEAR(row[x], e, 1) << x << " " << y << " " << p;
+      }
+    }
+  }
+}
+
+class HalfFloatTest : public ::testing::TestWithParam<int> {
+protected:
+  HalfFloatTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+  }
+  virtual void TearDown() {
+    setExecutor(nullptr);
+    Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+  }
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, HalfFloatTest, ::testing::Values(1, 3));
+
+TEST_P(HalfFloatTest, SameAsScalar) {
+  // With an odd crop, to have the black levels of the other positions, and
+  // some of the pixels below the black and above the white level.
+  const iRectangle2D crop({1, 1}, {99, 27});
+  const std::array<int, 4> black = {{100, 110, 120, 130}};
+  const int white = 4000;
+
+  RawImage img = createImage({101, 30}, 1, 12);
+  img->subFrame(crop);
+  img->blackLevelSeparate = black;
+  img->whitePoint = white;
+
+  std::vector<ushort16> storage;
+  const auto out = Array2DRef<ushort16>::create(&storage, 99, 27);
+  // The SIMD versions, if any, and then the scalar one.
+  for (const unsigned features : {unsigned(Cpuid::FEATURE_ALL), 0U}) {
+    Cpuid::setEnabled(features);
+    img->scaleToHalfFloat(out);
+    for (int y = 0; y < out.height; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+      for (int x = 0; x < out.width; x++) {
+        const int b = black[((crop.pos.x + x) & 1) |
+                            (((crop.pos.y + y) & 1) << 1)];
+        const float v = (static_cast<float>(row[x]) - static_cast<float>(b)) *
+                        (1.0F / static_cast<float>(white - b));
+        ASSERT_EQ(out(x, y), floatToHalf(std::min(std::max(v, 0.0F), 1.0F)))
+            << x << " " << y << " " << features;
+      }
+    }
+  }
+
+  // The image is as it was.
+  const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, 0));
+  ASSERT_EQ(row[0], reinterpret_cast<ushort16*>(
+                        createImage({101, 30}, 1, 12)->getData(1, 1))[0]);
+
+  ASSERT_THROW(img->scaleToHalfFloat(Array2DRef<ushort16>(storage.data(), 98,
+                                                          27)),
+               RawspeedException);
+}
+
+TEST(SplitCFAPlanesTest, NotRGGBThrows) {
+  RawImage img = createImage({8, 8}, 1);
+  img->whitePoint = 65535;
+  img->blackLevel = 0;
+  // No CFA at all, then with just one green.
+  ASSERT_THROW(img->splitCFAPlanes(), RawspeedException);
+  img->cfa.setCFA({2, 2}, rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                  rawspeed::CFA_BLUE, rawspeed::CFA_BLUE);
+  ASSERT_THROW(img->splitCFAPlanes(), RawspeedException);
+  ASSERT_THROW(createImage({8, 8}, 3)->splitCFAPlanes(), RawspeedException);
+}
+
+class ImageOpsTest : public ::testing::TestWithParam<int> {
+protected:
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, ImageOpsTest, ::testing::Values(1, 3));
+
+TEST_P(ImageOpsTest, BlitFromAndClearArea) {
+  const RawImage src = createImage({90, 70}, 2);
+  RawImage img = createImage({100, 80}, 2);
+  RawImage expected = createImage({100, 80}, 2);
+
+  // Clipped to both of the images.
+  img->blitFrom(src, {5, 3}, {100, 100}, {20, 30});
+  img->clearArea({{-5, 70}, {30, 30}}, 0x12);
+  for (int y = 0; y < 80; y++) {
+    auto* row = reinterpret_cast<ushort16*>(expected->getData(0, y));
+    for (int x = 0; x < 100; x++) {
+      for (int c = 0; c < 2; c++) {
+        if (y >= 70 && x < 25)
+          row[2 * x + c] = 0x1212;
+        else if (x >= 20 && y >= 30)
+          row[2 * x + c] = reinterpret_cast<const ushort16*>(
+              src->getData(x - 20 + 5, y - 30 + 3))[c];
+      }
+    }
+  }
+  expectSameImage(img, expected);
+}
+
+TEST_P(ImageOpsTest, ExpandBorder) {
+  const iRectangle2D valid({3, 4}, {10, 5});
+  RawImage img = createImage({20, 12}, 1);
+  RawImage expected = createImage({20, 12}, 1);
+
+  img->expandBorder(valid);
+  for (int y = 0; y < 12; y++) {
+    const int srcY =
+        std::min(std::max(y, valid.getTop()), valid.getBottom() - 1);
+    for (int x = 0; x < 20; x++) {
+      const int srcX =
+          std::min(std::max(x, valid.getLeft()), valid.getRight() - 1);
+      *reinterpret_cast<ushort16*>(expected->getData(x, y)) =
+          *reinterpret_cast<const ushort16*>(img->getData(srcX, srcY));
+    }
+  }
+  expectSameImage(img, expected);
+}
+
+TEST(RawImageLimitsTest, MaxPixelsAndBytes) {
+  RawImage img = RawImage::create();
+  img->dim = iPoint2D(100, 50);
+  img->maxPixels = 100 * 50 - 1;
+  ASSERT_THROW(img->createData(), RawspeedException);
+
+  img->maxPixels = 100 * 50;
+  img->maxBytes = 2 * 100 * 50 - 1;
+  ASSERT_THROW(img->createData(), RawspeedException);
+
+  img->maxBytes = 2 * 100 * 50;
+  ASSERT_NO_THROW(img->createData());
+}
+
+TEST(RawImageLimitsTest, ExpectInput) {
+  RawImage img = RawImage::create();
+  img->dim = iPoint2D(4000, 3000);
+  // A few bytes for the 12 megapixels, of at least one bit each.
+  img->expectInput(100, 1);
+  ASSERT_THROW(img->createData(), RawspeedException);
+
+  img->expectInput(4000 * 3000 / 8, 1);
+  ASSERT_NO_THROW(img->createData());
+}
+
+TEST(RawImageLimitsTest, ExpectInputOfUnknownCost) {
+  RawImage img = RawImage::create();
+  img->dim = iPoint2D(64, 64);
+  img->expectInput(1, 0);
+  ASSERT_NO_THROW(img->createData());
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,89 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/RowStreamer.h" // for RowStreamer
+#include "common/Common.h"      // for uchar8
+#include "common/Memory.h"      // for setNonTemporalStores, NonTemporalS...
+#include <cstddef>              // for size_t
+#include <gtest/gtest.h>        // for Test, ASSERT_EQ
+#include <utility>              // for pair
+#include <vector>               // for vector
+
+using rawspeed::NonTemporalStores;
+using rawspeed::RowStreamer;
+using rawspeed::setNonTemporalStores;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+// Each byte of a row is its row, and the padding is left alone.
+static void check(NonTemporalStores mode, size_t stagingBytes,
+                  size_t rowsPerGroup,
+                  const std::vector<std::pair<size_t, size_t>>& expected) {
+  constexpr size_t rows = 20;
+  constexpr size_t rowBytes = 30;
+  constexpr size_t pitch = 37;
+  std::vector<uchar8> image(rows * pitch, 0xFF);
+
+  setNonTemporalStores(mode);
+  const RowStreamer streamer(image.data(), pitch, rowBytes, rows,
+                             stagingBytes);
+  setNonTemporalStores(NonTemporalStores::Auto);
+  ASSERT_EQ(streamer.isStreaming(), mode == NonTemporalStores::Always);
+
+  std::vector<std::pair<size_t, size_t>> chunks;
+  streamer(3, rows, rowsPerGroup,
+           [&chunks](uchar8* dest, size_t destPitch, size_t first,
+                     size_t last) {
+             chunks.emplace_back(first, last);
+             for (size_t row = first; row < last; row++) {
+               for (size_t x = 0; x < rowBytes; x++)
+                 dest[(row - first) * destPitch + x] = row;
+             }
+           });
+  ASSERT_EQ(chunks, expected);
+
+  for (size_t row = 0; row < rows; row++) {
+    for (size_t x = 0; x < pitch; x++) {
+      const bool written = row >= 3 && x < rowBytes;
+      ASSERT_EQ(image[row * pitch + x], written ? row : 0xFF)
+          << x << " " << row;
+    }
+  }
+}
+
+TEST(RowStreamerTest, StraightIntoTheImage) {
+  check(NonTemporalStores::Never, 64 * 5, 1, {{3, 20}});
+}
+
+// The rows are staged at a pitch of 64 bytes, so 5 of them fit.
+TEST(RowStreamerTest, InChunks) {
+  check(NonTemporalStores::Always, 64 * 5, 1,
+        {{3, 8}, {8, 13}, {13, 18}, {18, 20}});
+}
+
+TEST(RowStreamerTest, InWholeGroups) {
+  check(NonTemporalStores::Always, 64 * 5, 2,
+        {{3, 7}, {7, 11}, {11, 15}, {15, 19}, {19, 20}});
+  // At least one group, even if it does not fit.
+  check(NonTemporalStores::Always, 64 * 5, 8, {{3, 11}, {11, 19}, {19, 20}});
+}
+
+} // namespace rawspeed_test
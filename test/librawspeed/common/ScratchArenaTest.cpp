@@ -0,0 +1,109 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/ScratchArena.h" // for ScratchArena, ScratchVector, make...
+#include "common/Common.h"       // for uchar8, isAligned
+#include "common/Executor.h"     // for parallelFor, setExecutor, ThreadP...
+#include <algorithm>             // for sort, unique
+#include <gtest/gtest.h>         // for Message, TestPartResult, Test...
+#include <memory>                // for make_shared
+#include <vector>                // for vector
+
+using rawspeed::isAligned;
+using rawspeed::makeScratchVector;
+using rawspeed::parallelFor;
+using rawspeed::ScratchArena;
+using rawspeed::ScratchVector;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+TEST(ScratchArenaTest, AllocatesAlignedAndApart) {
+  ScratchArena arena(4096);
+  std::vector<uchar8*> ptrs;
+  for (int i = 0; i < 100; i++) {
+    uchar8* p = arena.allocate(1 + i % 7);
+    ASSERT_TRUE(isAligned(reinterpret_cast<uintptr_t>(p),
+                          ScratchArena::alignment));
+    ptrs.push_back(p);
+  }
+  std::sort(ptrs.begin(), ptrs.end());
+  ASSERT_EQ(std::unique(ptrs.begin(), ptrs.end()), ptrs.end());
+  ASSERT_EQ(arena.getUsedBytes(), 100 * ScratchArena::alignment);
+}
+
+TEST(ScratchArenaTest, ResetKeepsOneChunkForAll) {
+  ScratchArena arena(4096);
+  for (int i = 0; i < 10; i++)
+    arena.allocate(1000);
+  arena.allocate(100000); // a chunk of its own
+  const size_t reserved = arena.getReservedBytes();
+  ASSERT_GE(reserved, 10 * 1024 + 100000);
+
+  arena.reset();
+  ASSERT_EQ(arena.getUsedBytes(), 0);
+  ASSERT_EQ(arena.getReservedBytes(), reserved);
+
+  // The same again now fits without any new chunk.
+  for (int i = 0; i < 10; i++)
+    arena.allocate(1000);
+  arena.allocate(100000);
+  ASSERT_EQ(arena.getReservedBytes(), reserved);
+
+  arena.release();
+  ASSERT_EQ(arena.getReservedBytes(), 0);
+}
+
+TEST(ScratchArenaTest, ConcurrentAllocations) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  ScratchArena arena(1 << 16);
+  std::vector<uchar8*> ptrs(1000);
+  parallelFor(0, 1000, [&arena, &ptrs](int i) {
+    ptrs[i] = arena.allocate(100);
+    std::fill(ptrs[i], ptrs[i] + 100, static_cast<uchar8>(i));
+  });
+  setExecutor(nullptr);
+
+  for (int i = 0; i < 1000; i++) {
+    for (int j = 0; j < 100; j++)
+      ASSERT_EQ(ptrs[i][j], static_cast<uchar8>(i));
+  }
+}
+
+TEST(ScratchArenaTest, Vector) {
+  ScratchArena arena;
+  auto v = makeScratchVector<int>(&arena);
+  v.resize(1000);
+  for (int i = 0; i < 1000; i++)
+    v[i] = i;
+  v.resize(5000);
+  for (int i = 0; i < 1000; i++)
+    ASSERT_EQ(v[i], i);
+  ASSERT_GE(arena.getUsedBytes(), 6000 * sizeof(int));
+
+  // Without an arena, from the heap.
+  ScratchVector<int> heap = makeScratchVector<int>(nullptr);
+  heap.assign(100, 1);
+  ASSERT_EQ(heap.get_allocator().get_allocator().getArena(), nullptr);
+}
+
+} // namespace rawspeed_test
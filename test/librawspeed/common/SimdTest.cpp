@@ -0,0 +1,75 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Simd.h"  // for getSimdTarget, SimdTarget
+#include "common/Cpuid.h" // for Cpuid
+#include <gtest/gtest.h>  // for Message, TestPartResult, Test...
+
+using rawspeed::Cpuid;
+using rawspeed::getSimdTarget;
+using rawspeed::SimdTarget;
+
+namespace rawspeed_test {
+
+class SimdTest : public ::testing::Test {
+protected:
+  virtual void TearDown() { Cpuid::setEnabled(Cpuid::FEATURE_ALL); }
+};
+
+TEST_F(SimdTest, NoneEnabled) {
+  Cpuid::setEnabled(0);
+  ASSERT_EQ(getSimdTarget(), SimdTarget::SCALAR);
+}
+
+// The best one, of those that are built, and that the CPU has.
+TEST_F(SimdTest, FollowsCpuid) {
+  Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+  SimdTarget expected = SimdTarget::SCALAR;
+#ifdef RAWSPEED_SIMD_NEON
+  if (Cpuid::NEON())
+    expected = SimdTarget::NEON;
+#endif
+#ifdef RAWSPEED_SIMD_SSE41
+  if (Cpuid::SSE41())
+    expected = SimdTarget::SSE41;
+#endif
+#ifdef RAWSPEED_SIMD_AVX2
+  if (Cpuid::AVX2())
+    expected = SimdTarget::AVX2;
+#endif
+#ifdef RAWSPEED_SIMD_AVX512
+  if (Cpuid::AVX512BW())
+    expected = SimdTarget::AVX512;
+#endif
+  ASSERT_EQ(getSimdTarget(), expected);
+
+  // Without that one, the next best.
+  if (expected == SimdTarget::AVX512) {
+    Cpuid::setEnabled(Cpuid::FEATURE_ALL & ~Cpuid::FEATURE_AVX512BW);
+    ASSERT_EQ(getSimdTarget(), SimdTarget::AVX2);
+  }
+  if (expected == SimdTarget::AVX512 || expected == SimdTarget::AVX2) {
+    Cpuid::setEnabled(Cpuid::FEATURE_SSE2 | Cpuid::FEATURE_SSSE3 |
+                      Cpuid::FEATURE_SSE41);
+    ASSERT_EQ(getSimdTarget(), SimdTarget::SSE41);
+  }
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,164 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/TiledImage.h"        // for TiledImage
+#include "common/Array2DRef.h"        // for Array2DRef
+#include "common/Common.h"            // for ushort16, uint32, uchar8
+#include "common/Executor.h"          // for setExecutor, ThreadPoolExecutor
+#include "common/Point.h"             // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"          // for RawImage, RawImageData, TYPE_...
+#include "common/RawspeedException.h" // for RawspeedException
+#include <cstring>                    // for memcmp
+#include <gtest/gtest.h>              // for ParamIteratorInterface, Message
+#include <memory>                     // for make_shared
+#include <tuple>                      // for get, tuple
+#include <vector>                     // for vector
+
+using rawspeed::Array2DRef;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::TiledImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+static ushort16 valueAt(int x, int y, uint32 c) {
+  return 1 + 7 * x + 1000 * y + 100 * c;
+}
+
+// Cropped to the odd dimensions, which are not a multiple of the tiles.
+static RawImage createImage(uint32 cpp) {
+  RawImage img = RawImage::create({203, 150}, rawspeed::TYPE_USHORT16, cpp);
+  img->subFrame({{3, 5}, {197, 141}});
+  for (int y = 0; y < img->dim.y; y++) {
+    auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+    for (int x = 0; x < img->dim.x; x++) {
+      for (uint32 c = 0; c < cpp; c++)
+        row[x * cpp + c] = valueAt(x, y, c);
+    }
+  }
+  return img;
+}
+
+using TiledImageType = std::tuple<int, uint32, int>;
+class TiledImageTest : public ::testing::TestWithParam<TiledImageType> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    cpp = std::get<1>(GetParam());
+    tileSize = std::get<2>(GetParam());
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  uint32 cpp;
+  int tileSize;
+};
+
+INSTANTIATE_TEST_CASE_P(TilesAndThreads, TiledImageTest,
+                        ::testing::Combine(::testing::Values(1, 3),
+                                           ::testing::Values(1, 3),
+                                           ::testing::Values(8, 64, 256)));
+
+TEST_P(TiledImageTest, Tiles) {
+  const RawImage img = createImage(cpp);
+  const TiledImage tiled(img, tileSize);
+
+  ASSERT_EQ(tiled.getDim(), img->dim);
+  ASSERT_EQ(tiled.getCpp(), cpp);
+  const iPoint2D numTiles = tiled.getNumTiles();
+  ASSERT_EQ(numTiles.x, (img->dim.x + tileSize - 1) / tileSize);
+  ASSERT_EQ(numTiles.y, (img->dim.y + tileSize - 1) / tileSize);
+  ASSERT_EQ(tiled.getSize(), numTiles.area() * tiled.getTileBytes());
+
+  for (int ty = 0; ty < numTiles.y; ty++) {
+    for (int tx = 0; tx < numTiles.x; tx++) {
+      const Array2DRef<const ushort16> tile = tiled.getU16Tile(tx, ty);
+      ASSERT_EQ(tile.width, tileSize * static_cast<int>(cpp));
+      ASSERT_EQ(tile.height, tileSize);
+      for (int y = 0; y < tileSize; y++) {
+        for (int x = 0; x < tileSize; x++) {
+          const int ix = tx * tileSize + x;
+          const int iy = ty * tileSize + y;
+          const bool inside = ix < img->dim.x && iy < img->dim.y;
+          for (uint32 c = 0; c < cpp; c++) {
+            ASSERT_EQ(tile(x * cpp + c, y), inside ? valueAt(ix, iy, c) : 0)
+                << ix << " " << iy;
+          }
+        }
+      }
+    }
+  }
+  ASSERT_THROW(tiled.getU16Tile(numTiles.x, 0), RawspeedException);
+  ASSERT_THROW(tiled.getF32Tile(0, 0), RawspeedException);
+}
+
+TEST_P(TiledImageTest, Rows) {
+  const RawImage img = createImage(cpp);
+  const TiledImage tiled(img, tileSize);
+
+  const auto* pixel =
+      reinterpret_cast<const ushort16*>(tiled.getData(100, 77));
+  ASSERT_EQ(pixel[0], valueAt(100, 77, 0));
+
+  const uint32 rowBytes = img->dim.x * cpp * 2;
+  std::vector<uchar8> rows(3 * rowBytes);
+  tiled.copyRows(60, 3, rows.data(), rowBytes);
+  for (int r = 0; r < 3; r++) {
+    ASSERT_EQ(memcmp(&rows[r * rowBytes], img->getData(0, 60 + r), rowBytes),
+              0);
+  }
+  ASSERT_THROW(tiled.copyRows(img->dim.y - 2, 3, rows.data(), rowBytes),
+               RawspeedException);
+
+  const RawImage out = tiled.untile();
+  ASSERT_EQ(out->dim, img->dim);
+  for (int y = 0; y < img->dim.y; y++)
+    ASSERT_EQ(memcmp(out->getData(0, y), img->getData(0, y), rowBytes), 0);
+}
+
+TEST(TiledImageFloatTest, Float) {
+  RawImage img = RawImage::create({70, 40}, rawspeed::TYPE_FLOAT32, 1);
+  for (int y = 0; y < 40; y++) {
+    for (int x = 0; x < 70; x++)
+      reinterpret_cast<float*>(img->getData(0, y))[x] = x + y / 64.0F;
+  }
+  const TiledImage tiled(img, 32);
+  ASSERT_EQ(tiled.getF32Tile(2, 1)(3, 4), 67 + 36 / 64.0F);
+  ASSERT_EQ(tiled.getF32Tile(2, 1)(6, 4), 0);
+  ASSERT_THROW(tiled.getU16Tile(0, 0), RawspeedException);
+
+  const RawImage out = tiled.untile();
+  for (int y = 0; y < 40; y++)
+    ASSERT_EQ(memcmp(out->getData(0, y), img->getData(0, y), 70 * 4), 0);
+}
+
+TEST(TiledImageSizeTest, InvalidTileSizes) {
+  const RawImage img = RawImage::create({16, 16}, rawspeed::TYPE_USHORT16, 1);
+  for (int size : {0, 4, 48, 2048})
+    ASSERT_THROW(TiledImage(img, size), RawspeedException) << size;
+  ASSERT_NO_THROW(TiledImage(img, 8));
+}
+
+} // namespace rawspeed_test
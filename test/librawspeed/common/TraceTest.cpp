@@ -0,0 +1,100 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h"
+#include "common/Trace.h" // for ChromeTraceWriter, TraceScope, Tracer
+#include <gtest/gtest.h>  // for Message, TestPartResult, TestInfo (ptr o...
+#include <memory>         // for make_shared, shared_ptr
+#include <string>         // for string
+#include <thread>         // for thread
+#include <utility>        // for pair
+#include <vector>         // for vector
+
+using rawspeed::ChromeTraceWriter;
+using rawspeed::getTracer;
+using rawspeed::setTracer;
+using rawspeed::Tracer;
+using rawspeed::TraceScope;
+
+namespace rawspeed_test {
+
+class RecordingTracer final : public Tracer {
+public:
+  std::vector<std::pair<char, std::string>> events;
+
+  void begin(const char* /*category*/, const char* name) override {
+    events.emplace_back('B', name);
+  }
+  void end(const char* /*category*/, const char* name) override {
+    events.emplace_back('E', name);
+  }
+};
+
+class TraceTest : public ::testing::Test {
+protected:
+  void TearDown() override { setTracer(nullptr); }
+};
+
+TEST_F(TraceTest, NoTracer) {
+  ASSERT_EQ(getTracer(), nullptr);
+  TraceScope scope("test", "nothing");
+}
+
+TEST_F(TraceTest, ScopesAreNested) {
+  auto tracer = std::make_shared<RecordingTracer>();
+  setTracer(tracer);
+  ASSERT_EQ(getTracer(), tracer.get());
+  {
+    TraceScope outer("test", "outer");
+    TraceScope inner("test", "inner");
+  }
+  const std::vector<std::pair<char, std::string>> expected = {
+      {'B', "outer"}, {'B', "inner"}, {'E', "inner"}, {'E', "outer"}};
+  ASSERT_EQ(tracer->events, expected);
+}
+
+TEST_F(TraceTest, MacroOnlyWithTracing) {
+  auto tracer = std::make_shared<RecordingTracer>();
+  setTracer(tracer);
+  { RAWSPEED_TRACE_SCOPE("test", "macro"); }
+#ifdef WITH_TRACING
+  ASSERT_EQ(tracer->events.size(), 2);
+#else
+  ASSERT_TRUE(tracer->events.empty());
+#endif
+}
+
+TEST_F(TraceTest, ChromeTraceJSON) {
+  auto writer = std::make_shared<ChromeTraceWriter>();
+  setTracer(writer);
+  { TraceScope scope("test", "main \"thread\""); }
+  std::thread([]() { TraceScope scope("test", "other"); }).join();
+
+  const std::string json = writer->getJSON();
+  ASSERT_EQ(json.front(), '[');
+  ASSERT_EQ(json.compare(json.size() - 3, 3, "\n]\n"), 0);
+  ASSERT_NE(json.find(R"("cat":"test","name":"main \"thread\"","ph":"B",)"
+                      R"("pid":0,"tid":0,"ts":)"),
+            std::string::npos);
+  ASSERT_NE(json.find(R"("name":"other","ph":"E","pid":0,"tid":1,)"),
+            std::string::npos);
+}
+
+} // namespace rawspeed_test
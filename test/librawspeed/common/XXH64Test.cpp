@@ -0,0 +1,66 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/XXH64.h" // for xxh64_hash, hash_to_string, xxh64_state
+#include <cstdint>         // for UINT64_C, uint8_t
+#include <cstring>         // for strlen
+#include <gtest/gtest.h>   // for AssertionResult, ParamIteratorInterface
+#include <utility>         // for pair, make_pair
+
+namespace rawspeed_test {
+
+using XXH64Testcase = std::pair<rawspeed::xxh64::xxh64_state, const char*>;
+class XXH64Test : public ::testing::TestWithParam<XXH64Testcase> {
+protected:
+  XXH64Test() = default;
+  virtual void SetUp() override {
+    auto p = GetParam();
+
+    answer = p.first;
+    message = p.second;
+  }
+
+  rawspeed::xxh64::xxh64_state answer;
+  const char* message = nullptr;
+};
+
+// The reference values, with the seed 0.
+static XXH64Testcase testCases[] = {
+    {UINT64_C(0xEF46DB3751D8E999), ""},
+    {UINT64_C(0xD24EC4F1A98C6E5B), "a"},
+    {UINT64_C(0x44BC2CF5AD770999), "abc"},
+    {UINT64_C(0xFBCEA83C8A378BF1), "Nobody inspects the spammish repetition"},
+};
+
+INSTANTIATE_TEST_CASE_P(XXH64Test, XXH64Test, ::testing::ValuesIn(testCases));
+TEST_P(XXH64Test, CheckTestCaseSet) {
+  const auto hash = rawspeed::xxh64::xxh64_hash(
+      reinterpret_cast<const uint8_t*>(message), strlen(message));
+  ASSERT_EQ(hash, answer);
+}
+
+TEST(XXH64Test, HashToString) {
+  ASSERT_EQ(rawspeed::xxh64::hash_to_string(UINT64_C(0x0123456789ABCDEF)),
+            "0123456789abcdef");
+  ASSERT_EQ(rawspeed::xxh64::hash_to_string(UINT64_C(0xEF46DB3751D8E999)),
+            "ef46db3751d8e999");
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,80 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/AsyncDecoder.h"        // for decodeAsync
+#include "common/Cancellation.h"          // for Cancellation
+#include "common/Common.h"                // for uchar8
+#include "common/Executor.h"              // for setExecutor, ThreadPoolExec...
+#include "common/RawspeedException.h"     // for RawspeedException
+#include "decoders/RawDecoderException.h" // for RawDecoderException
+#include "io/Buffer.h"                    // for Buffer
+#include "metadata/CameraMetaData.h"      // for CameraMetaData
+#include <array>                          // for array
+#include <gtest/gtest.h>                  // for ParamIteratorInterface, Mes...
+#include <memory>                         // for make_shared
+
+using rawspeed::Buffer;
+using rawspeed::CameraMetaData;
+using rawspeed::Cancellation;
+using rawspeed::decodeAsync;
+using rawspeed::RawDecoderException;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+class AsyncDecoderTest : public ::testing::TestWithParam<int> {
+protected:
+  AsyncDecoderTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+    garbage.fill(0xAB);
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  const CameraMetaData meta{};
+  std::array<uchar8, 64> garbage;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, AsyncDecoderTest, ::testing::Values(1, 3));
+
+TEST_P(AsyncDecoderTest, ExceptionIsInTheFuture) {
+  const Buffer file(garbage.data(), garbage.size());
+  auto f = decodeAsync(&file, &meta);
+  ASSERT_THROW(f.get(), RawspeedException);
+}
+
+TEST_P(AsyncDecoderTest, Cancelled) {
+  const Buffer file(garbage.data(), garbage.size());
+  auto cancellation = std::make_shared<Cancellation>();
+  cancellation->cancel();
+
+  int configured = 0;
+  auto f = decodeAsync(&file, &meta, cancellation,
+                       [&configured](rawspeed::RawDecoder* /*decoder*/) {
+                         configured++;
+                       });
+  ASSERT_THROW(f.get(), RawDecoderException);
+  ASSERT_EQ(configured, 0);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,192 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/BatchDecoder.h"      // for BatchDecoder, BatchDecoder...
+#include "common/Common.h"              // for uchar8, ushort16
+#include "common/Executor.h"            // for setExecutor, ThreadPoolExec...
+#include "common/RawImage.h"            // for RawImage, RawImageData
+#include "common/RawspeedException.h"   // for RawspeedException
+#include "decoders/DngTest.h"           // for createDng, frameDim
+#include "decoders/RawDecoder.h"        // for RawDecoder
+#include "io/Buffer.h"                  // for Buffer
+#include "io/FileIOException.h"         // for FileIOException
+#include "io/FileWriter.h"              // for FileWriter
+#include "metadata/CameraMetaData.h"    // for CameraMetaData
+#include <array>                        // for array
+#include <cstdio>                       // for remove
+#include <exception>                    // for rethrow_exception
+#include <gtest/gtest.h>                // for ParamIteratorInterface, Mes...
+#include <memory>                       // for make_shared
+#include <mutex>                        // for mutex, lock_guard
+#include <stdexcept>                    // for runtime_error
+#include <string>                       // for string, to_string
+#include <vector>                       // for vector
+
+using rawspeed::BatchDecoder;
+using rawspeed::BatchDecoderResult;
+using rawspeed::Buffer;
+using rawspeed::CameraMetaData;
+using rawspeed::FileIOException;
+using rawspeed::FileWriter;
+using rawspeed::RawDecoder;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class BatchDecoderTest : public ::testing::TestWithParam<int> {
+protected:
+  BatchDecoderTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    // Every other file does exist, but is not a raw.
+    std::array<uchar8, 64> garbage;
+    garbage.fill(0xAB);
+    Buffer garbageBuf(garbage.data(), garbage.size());
+    for (int i = 0; i < 16; i++) {
+      fileNames.emplace_back("BatchDecoderTest." + std::to_string(i) + ".tmp");
+      if (i % 2 == 0)
+        FileWriter(fileNames.back().c_str())
+            .writeFile(&garbageBuf, garbageBuf.getSize());
+    }
+  }
+  virtual void TearDown() {
+    for (const auto& fileName : fileNames)
+      std::remove(fileName.c_str());
+    setExecutor(nullptr);
+  }
+
+  const CameraMetaData meta{};
+  std::vector<std::string> fileNames;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, BatchDecoderTest, ::testing::Values(1, 2, 5));
+
+TEST_P(BatchDecoderTest, ResultForEachFile) {
+  for (unsigned readAhead : {0U, 1U, 3U}) {
+    for (unsigned readThreads : {0U, 1U, 4U, 32U}) {
+      BatchDecoder d(&meta);
+      d.readAhead = readAhead;
+      d.readThreads = readThreads;
+
+      std::mutex mutex;
+      std::vector<int> seen(fileNames.size(), 0);
+
+      d.decode(fileNames, [&](BatchDecoderResult&& r) {
+        std::lock_guard<std::mutex> guard(mutex);
+
+        ASSERT_LT(r.index, fileNames.size());
+        ASSERT_EQ(r.fileName, fileNames[r.index]);
+        seen[r.index]++;
+
+        ASSERT_TRUE(r.exception);
+        if (r.index % 2 == 0)
+          ASSERT_THROW(std::rethrow_exception(r.exception), RawspeedException);
+        else
+          ASSERT_THROW(std::rethrow_exception(r.exception), FileIOException);
+      });
+
+      for (int s : seen)
+        ASSERT_EQ(s, 1);
+    }
+  }
+}
+
+TEST_P(BatchDecoderTest, CallbackExceptionIsPropagated) {
+  BatchDecoder d(&meta);
+  d.readAhead = 1;
+  d.readThreads = 3;
+
+  ASSERT_THROW(d.decode(fileNames,
+                        [](BatchDecoderResult&& /*r*/) {
+                          throw std::runtime_error("stop");
+                        }),
+               std::runtime_error);
+}
+
+TEST_P(BatchDecoderTest, MetaDataOnly) {
+  const auto dng = createDng(1);
+  Buffer dngBuf(dng.data(), dng.size());
+  const std::vector<std::string> dngs(3, "BatchDecoderTest.dng.tmp");
+  FileWriter(dngs[0].c_str()).writeFile(&dngBuf, dngBuf.getSize());
+
+  for (bool metaDataOnly : {false, true}) {
+    BatchDecoder d(&meta);
+    d.metaDataOnly = metaDataOnly;
+
+    std::mutex mutex;
+    int done = 0;
+    d.decode(dngs, [&](BatchDecoderResult&& r) {
+      std::lock_guard<std::mutex> guard(mutex);
+      done++;
+
+      ASSERT_FALSE(r.exception);
+      ASSERT_EQ(r.image->dim, frameDim);
+      ASSERT_EQ(r.image->isAllocated(), !metaDataOnly);
+    });
+    ASSERT_EQ(done, dngs.size());
+  }
+
+  std::remove(dngs[0].c_str());
+}
+
+// The pixels of the strip could be those of the file, but the file is
+// released before the callback.
+TEST_P(BatchDecoderTest, AliasedInputIsCopied) {
+  // The strip at 144, aligned as the rows of the image are.
+  const auto dng = createDng(1, 10);
+  Buffer dngBuf(dng.data(), dng.size());
+  const std::vector<std::string> dngs(2, "BatchDecoderTest.dng.tmp");
+  FileWriter(dngs[0].c_str()).writeFile(&dngBuf, dngBuf.getSize());
+
+  BatchDecoder d(&meta);
+  d.configure = [](RawDecoder* decoder) { decoder->mRaw->aliasInput = true; };
+
+  std::mutex mutex;
+  int done = 0;
+  d.decode(dngs, [&](BatchDecoderResult&& r) {
+    std::lock_guard<std::mutex> guard(mutex);
+    done++;
+
+    ASSERT_FALSE(r.exception);
+    ASSERT_FALSE(r.image->isReadOnly());
+    for (int y = 0; y < frameDim.y; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(r.image->getData(0, y));
+      for (int x = 0; x < frameDim.x; x++)
+        ASSERT_EQ(row[x], pixelAt(0, x, y));
+    }
+  });
+  ASSERT_EQ(done, dngs.size());
+
+  std::remove(dngs[0].c_str());
+}
+
+TEST(BatchDecoderNoFilesTest, NoFiles) {
+  const CameraMetaData meta{};
+  BatchDecoder d(&meta);
+  ASSERT_NO_THROW(d.decode({}, [](BatchDecoderResult&& /*r*/) { FAIL(); }));
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,148 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/RawDecoder.h"      // for RawDecoder
+#include "common/Common.h"            // for uchar8, uint32
+#include "common/Executor.h"          // for setExecutor, ThreadPoolExecutor
+#include "common/RawImage.h"          // for RawImage
+#include "common/RawspeedException.h" // for RawspeedException
+#include "io/Buffer.h"                // for Buffer
+#include "io/ByteStream.h"            // for ByteStream
+#include <gtest/gtest.h>              // for ParamIteratorInterface, Message
+#include <memory>                     // for make_shared
+#include <vector>                     // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::CameraMetaData;
+using rawspeed::RawDecoder;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace rawspeed_test {
+
+// Only has the state of a pre-scan, a number.
+class IndexedDecoder final : public RawDecoder {
+public:
+  explicit IndexedDecoder(const Buffer* file) : RawDecoder(file) {}
+
+  uint32 scanned = 0;
+
+protected:
+  RawImage decodeRawInternal() override { return mRaw; }
+  void decodeMetaDataInternal(const CameraMetaData* /*meta*/) override {}
+  void checkSupportInternal(const CameraMetaData* /*meta*/) override {}
+  int getDecoderVersion() const override { return 0; }
+
+  void writeDecodeIndex(std::vector<uchar8>* index) const override {
+    if (scanned)
+      putDecodeIndexValue(index, scanned, 4);
+  }
+  void readDecodeIndex(ByteStream* index) override {
+    scanned = index->getU32();
+  }
+};
+
+class DecodeIndexTest : public ::testing::TestWithParam<int> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+    // A few of the chunks that are hashed in parallel, and a partial one.
+    file.resize((3U << 20U) + 13);
+    uint32 random = 1;
+    for (auto& b : file) {
+      random = random * 1103515245U + 12345U;
+      b = random >> 16U;
+    }
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  std::vector<uchar8> getIndex() const {
+    const Buffer buffer(file.data(), file.size());
+    IndexedDecoder d(&buffer);
+    d.scanned = 42;
+    return d.getDecodeIndex();
+  }
+
+  std::vector<uchar8> file;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, DecodeIndexTest, ::testing::Values(1, 3));
+
+TEST_P(DecodeIndexTest, NothingToIndex) {
+  const Buffer buffer(file.data(), file.size());
+  IndexedDecoder d(&buffer);
+  ASSERT_TRUE(d.getDecodeIndex().empty());
+}
+
+TEST_P(DecodeIndexTest, SameFile) {
+  const auto index = getIndex();
+
+  // With any number of threads.
+  setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam() + 1));
+  const Buffer buffer(file.data(), file.size());
+  IndexedDecoder d(&buffer);
+  ASSERT_TRUE(d.setDecodeIndex(Buffer(index.data(), index.size())));
+  ASSERT_EQ(d.scanned, 42);
+}
+
+TEST_P(DecodeIndexTest, ModifiedFile) {
+  const auto index = getIndex();
+
+  for (const auto pos : {size_t(0), file.size() / 2, file.size() - 1}) {
+    file[pos] ^= 1;
+    const Buffer buffer(file.data(), file.size());
+    IndexedDecoder d(&buffer);
+    ASSERT_FALSE(d.setDecodeIndex(Buffer(index.data(), index.size()))) << pos;
+    ASSERT_EQ(d.scanned, 0);
+    file[pos] ^= 1;
+  }
+
+  file.pop_back();
+  const Buffer buffer(file.data(), file.size());
+  IndexedDecoder d(&buffer);
+  ASSERT_FALSE(d.setDecodeIndex(Buffer(index.data(), index.size())));
+}
+
+TEST_P(DecodeIndexTest, CorruptIndex) {
+  const Buffer buffer(file.data(), file.size());
+  auto index = getIndex();
+
+  // The magic, and then the payload.
+  for (const auto pos : {size_t(0), index.size() - 1}) {
+    index[pos] ^= 1;
+    IndexedDecoder d(&buffer);
+    ASSERT_THROW(d.setDecodeIndex(Buffer(index.data(), index.size())),
+                 RawspeedException)
+        << pos;
+    index[pos] ^= 1;
+  }
+
+  index.pop_back();
+  IndexedDecoder d(&buffer);
+  ASSERT_THROW(d.setDecodeIndex(Buffer(index.data(), index.size())),
+               RawspeedException);
+}
+
+} // namespace rawspeed_test
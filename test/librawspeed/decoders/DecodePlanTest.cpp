@@ -0,0 +1,182 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/DecodePlan.h"
+#include "common/Common.h"                // for ushort16, uchar8, uint32
+#include "common/Executor.h"              // for setExecutor, ThreadPoolExe...
+#include "common/Point.h"                 // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"              // for RawImage, RawImageData
+#include "decoders/DngDecoder.h"          // for DngDecoder
+#include "decoders/RawDecoderException.h" // for RawDecoderException
+#include "encoders/DngWriter.h"           // for DngWriter
+#include "io/Buffer.h"                    // for Buffer
+#include "parsers/TiffParser.h"           // for TiffParser
+#include <gtest/gtest.h>                  // for ParamIteratorInterface, Me...
+#include <memory>                         // for make_shared
+#include <tuple>                          // for get, tuple
+#include <vector>                         // for vector
+
+using rawspeed::Buffer;
+using rawspeed::DecodePlan;
+using rawspeed::DngDecoder;
+using rawspeed::DngWriter;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::RawDecoderException;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::TiffParser;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The tile size, and whether it is uncompressed strips of that many rows.
+using DecodePlanType = std::tuple<int, bool>;
+class DecodePlanTest : public ::testing::TestWithParam<DecodePlanType> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(3));
+
+    // Not a whole number of the tiles, either way.
+    const iPoint2D dim(301, 200);
+    RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    img->isCFA = true;
+    img->cfa.setCFA(iPoint2D(2, 2), rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                    rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+    uint32 random = 1;
+    for (int y = 0; y < dim.y; y++) {
+      auto* row = reinterpret_cast<ushort16*>(img->getData(0, y));
+      for (int x = 0; x < dim.x; x++) {
+        random = random * 1103515245U + 12345U;
+        row[x] = 2000 + x + y + (random >> 16) % 64;
+      }
+    }
+
+    DngWriter w(img, std::get<0>(GetParam()));
+    w.strips = std::get<1>(GetParam());
+    w.uncompressed = std::get<1>(GetParam());
+    file = w.write();
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  std::unique_ptr<DngDecoder> getDecoder() const {
+    return std::make_unique<DngDecoder>(TiffParser::parse(nullptr, file),
+                                        &file);
+  }
+
+  static void expectSamePixels(const RawImage& a, const RawImage& b,
+                               const iRectangle2D& area) {
+    ASSERT_EQ(b->dim, area.dim);
+    for (int y = 0; y < area.dim.y; y++) {
+      const auto* rowA = reinterpret_cast<const ushort16*>(
+          a->getData(area.pos.x, area.pos.y + y));
+      const auto* rowB = reinterpret_cast<const ushort16*>(b->getData(0, y));
+      for (int x = 0; x < area.dim.x; x++)
+        ASSERT_EQ(rowA[x], rowB[x]) << x << " " << y;
+    }
+  }
+
+  Buffer file;
+};
+
+INSTANTIATE_TEST_CASE_P(Layouts, DecodePlanTest,
+                        ::testing::Values(DecodePlanType(64, false),
+                                          DecodePlanType(48, true)));
+
+// As the coordinator and the workers would, through the serialized plan.
+TEST_P(DecodePlanTest, SameAsDecodeRaw) {
+  const RawImage expected = getDecoder()->decodeRaw();
+
+  auto coordinator = getDecoder();
+  const std::vector<uchar8> serialized =
+      coordinator->getDecodePlan().serialize();
+
+  const DecodePlan plan = DecodePlan::deserialize(
+      Buffer(serialized.data(), serialized.size()));
+  ASSERT_EQ(plan.format, DecodePlan::Format::DNG);
+  ASSERT_EQ(plan.dim, expected->dim);
+  ASSERT_GT(plan.tiles.size(), 1);
+  ASSERT_EQ(plan.tiles.size(), plan.getTilesX() * plan.getTilesY());
+
+  // The bytes of each, as they would be sent.
+  std::vector<std::vector<uchar8>> data;
+  std::vector<Buffer> buffers;
+  std::vector<uint32> indexes;
+  for (uint32 tile = 0; tile < plan.tiles.size(); tile++) {
+    data.emplace_back(plan.getTileData(tile, file));
+    indexes.emplace_back(tile);
+  }
+  for (const auto& d : data)
+    buffers.emplace_back(d.data(), d.size());
+
+  const std::vector<RawImage> tiles = plan.decodeTiles(indexes, buffers);
+  ASSERT_EQ(tiles.size(), plan.tiles.size());
+  for (uint32 tile = 0; tile < tiles.size(); tile++)
+    expectSamePixels(expected, tiles[tile], plan.getTileArea(tile));
+
+  const RawImage out = coordinator->decodeRaw(tiles);
+  expectSamePixels(expected, out, {{0, 0}, expected->dim});
+}
+
+TEST_P(DecodePlanTest, NotTheTilesOfThePlan) {
+  const DecodePlan plan = getDecoder()->getDecodePlan();
+  const std::vector<uchar8> data = plan.getTileData(0, file);
+
+  // One byte short, and of a tile that is not there.
+  ASSERT_THROW(plan.decodeTile(0, Buffer(data.data(), data.size() - 1)),
+               RawDecoderException);
+  ASSERT_THROW(plan.decodeTile(plan.tiles.size(),
+                               Buffer(data.data(), data.size())),
+               RawDecoderException);
+
+  std::vector<RawImage> tiles(plan.tiles.size(),
+                              plan.decodeTile(0, Buffer(data.data(),
+                                                        data.size())));
+  ASSERT_THROW(getDecoder()->decodeRaw({tiles[0]}), RawDecoderException);
+  // The last ones are not of the size of the first one.
+  ASSERT_THROW(getDecoder()->decodeRaw(tiles), RawDecoderException);
+}
+
+TEST_P(DecodePlanTest, BrokenPlan) {
+  std::vector<uchar8> serialized = getDecoder()->getDecodePlan().serialize();
+  const auto deserialize = [&serialized](size_t size) {
+    return DecodePlan::deserialize(Buffer(serialized.data(), size));
+  };
+  ASSERT_NO_THROW(deserialize(serialized.size()));
+
+  ASSERT_THROW(deserialize(serialized.size() - 1), RawDecoderException);
+  serialized.emplace_back(0);
+  ASSERT_THROW(deserialize(serialized.size()), RawDecoderException);
+  serialized.pop_back();
+
+  // The magic.
+  serialized[0] ^= 1;
+  ASSERT_THROW(deserialize(serialized.size()), RawDecoderException);
+  serialized[0] ^= 1;
+
+  // The width, so that the grid has a different number of tiles.
+  serialized[20] ^= 0x80;
+  ASSERT_THROW(deserialize(serialized.size()), RawDecoderException);
+}
+
+} // namespace rawspeed_test
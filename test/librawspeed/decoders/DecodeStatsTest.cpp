@@ -0,0 +1,88 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Common.h"           // for uchar8
+#include "common/Executor.h"         // for setExecutor, ThreadPoolExecutor
+#include "decoders/DngTest.h"        // for createDng, frameDim
+#include "decoders/RawDecoder.h"     // for RawDecoder
+#include "io/Buffer.h"               // for Buffer
+#include "metadata/CameraMetaData.h" // for CameraMetaData
+#include "parsers/RawParser.h"       // for RawParser
+#include <gtest/gtest.h>             // for ParamIteratorInterface, Message
+#include <memory>                    // for make_shared, unique_ptr
+#include <vector>                    // for vector
+
+using rawspeed::Buffer;
+using rawspeed::CameraMetaData;
+using rawspeed::RawDecoder;
+using rawspeed::RawParser;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+class DecodeStatsTest : public ::testing::TestWithParam<int> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+    file = createDng(1);
+    buffer = Buffer(file.data(), file.size());
+    decoder = RawParser(&buffer).getDecoder();
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  const CameraMetaData meta{};
+  std::vector<uchar8> file;
+  Buffer buffer;
+  std::unique_ptr<RawDecoder> decoder;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, DecodeStatsTest, ::testing::Values(1, 3));
+
+TEST_P(DecodeStatsTest, OfTheDecode) {
+  RawDecoder::DecodeStats stats;
+  decoder->stats = &stats;
+  decoder->checkSupport(&meta);
+  decoder->decodeRaw();
+  decoder->decodeMetaData(&meta);
+
+  ASSERT_EQ(stats.decoder, "DngDecoder");
+  ASSERT_EQ(stats.fileBytes, file.size());
+  ASSERT_EQ(stats.imageBytes, frameDim.area() * 2);
+  ASSERT_EQ(stats.getCompressionRatio(),
+            static_cast<double>(file.size()) / (frameDim.area() * 2));
+  ASSERT_EQ(stats.threads, GetParam());
+  ASSERT_EQ(stats.allocations, 1);
+  ASSERT_GE(stats.peakAllocatedBytes, stats.imageBytes);
+  ASSERT_EQ(stats.huffmanTables, 0);
+  for (int stage = 0; stage < RawDecoder::STAGE_COUNT; stage++) {
+    ASSERT_GE(stats.wallTimes[stage], 0) << stage;
+    ASSERT_GE(stats.cpuTimes[stage], 0) << stage;
+  }
+}
+
+TEST_P(DecodeStatsTest, NotSet) {
+  decoder->checkSupport(&meta);
+  const auto img = decoder->decodeRaw();
+  ASSERT_EQ(img->decodeCounters, nullptr);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,134 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/DecoderSession.h"  // for DecoderSession
+#include "common/Common.h"            // for uchar8, ushort16
+#include "common/Executor.h"          // for setExecutor, ThreadPoolExecutor
+#include "common/RawImage.h"          // for RawImage, RawImageData
+#include "common/RawspeedException.h" // for RawspeedException
+#include "decoders/DngTest.h"         // for createDng, frameDim, pixelAt
+#include "decoders/RawDecoder.h"      // for RawDecoder
+#include "io/Buffer.h"                // for Buffer
+#include "metadata/CameraMetaData.h"  // for CameraMetaData
+#include <array>                      // for array
+#include <gtest/gtest.h>              // for Message, TestPartResult, Test...
+#include <memory>                     // for make_shared
+#include <vector>                     // for vector
+
+using rawspeed::Buffer;
+using rawspeed::CameraMetaData;
+using rawspeed::DecoderSession;
+using rawspeed::RawDecoder;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class DecoderSessionTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(2));
+    file = createDng(1);
+    buffer = Buffer(file.data(), file.size());
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  static void expectPixels(const RawImage& img) {
+    ASSERT_EQ(img->dim, frameDim);
+    for (int y = 0; y < frameDim.y; y++) {
+      for (int x = 0; x < frameDim.x; x++) {
+        ASSERT_EQ(reinterpret_cast<const ushort16*>(img->getData(0, y))[x],
+                  pixelAt(0, x, y));
+      }
+    }
+  }
+
+  const CameraMetaData meta{};
+  std::vector<uchar8> file;
+  Buffer buffer;
+};
+
+TEST_F(DecoderSessionTest, ReusesTheReleasedImages) {
+  DecoderSession session(&meta);
+  for (int i = 0; i < 5; i++)
+    expectPixels(session.decode(&buffer));
+
+  auto stats = session.getStats();
+  ASSERT_EQ(stats.decodes, 5);
+  ASSERT_EQ(stats.imageAllocations, 1);
+
+  // The kept ones can not be reused.
+  std::vector<RawImage> kept;
+  for (int i = 0; i < 3; i++)
+    kept.emplace_back(session.decode(&buffer));
+  for (const auto& img : kept)
+    expectPixels(img);
+  stats = session.getStats();
+  ASSERT_EQ(stats.decodes, 8);
+  ASSERT_EQ(stats.imageAllocations, 3);
+
+  kept.clear();
+  session.trim();
+  ASSERT_EQ(session.getStats().scratchBytes, 0);
+  expectPixels(session.decode(&buffer));
+  ASSERT_EQ(session.getStats().imageAllocations, 4);
+}
+
+TEST_F(DecoderSessionTest, WithoutPool) {
+  DecoderSession session(&meta, 0);
+  for (int i = 0; i < 3; i++)
+    expectPixels(session.decode(&buffer));
+  ASSERT_EQ(session.getStats().decodes, 3);
+  ASSERT_EQ(session.getStats().imageAllocations, 0);
+}
+
+TEST_F(DecoderSessionTest, ConfigureAndMetaDataOnly) {
+  DecoderSession session(&meta);
+  int configured = 0;
+  session.configure = [&configured](RawDecoder* decoder) {
+    ASSERT_NE(decoder, nullptr);
+    configured++;
+  };
+  session.metaDataOnly = true;
+
+  const RawImage img = session.decode(&buffer);
+  ASSERT_EQ(configured, 1);
+  ASSERT_EQ(img->dim, frameDim);
+  ASSERT_FALSE(img->isAllocated());
+  ASSERT_EQ(session.getStats().imageAllocations, 0);
+}
+
+TEST_F(DecoderSessionTest, GoesOnAfterAFailure) {
+  DecoderSession session(&meta);
+  std::array<uchar8, 64> garbage;
+  garbage.fill(0xAB);
+  const Buffer garbageBuf(garbage.data(), garbage.size());
+
+  ASSERT_THROW(session.decode(&garbageBuf), RawspeedException);
+  ASSERT_EQ(session.getStats().decodes, 0);
+  expectPixels(session.decode(&buffer));
+  ASSERT_EQ(session.getStats().decodes, 1);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,93 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Common.h"            // for uchar8, ushort16
+#include "common/Executor.h"          // for setExecutor, ThreadPoolExecutor
+#include "common/RawImage.h"          // for RawImage, RawImageData
+#include "common/RawspeedException.h" // for RawspeedException
+#include "decoders/DngTest.h"         // for createDng, frameDim, pixelAt
+#include "decoders/RawDecoder.h"      // for RawDecoder
+#include "io/Buffer.h"                // for Buffer
+#include "metadata/CameraMetaData.h"  // for CameraMetaData
+#include "parsers/RawParser.h"        // for RawParser
+#include <gtest/gtest.h>              // for ParamIteratorInterface, Message
+#include <memory>                     // for make_shared, unique_ptr
+#include <vector>                     // for vector
+
+using rawspeed::Buffer;
+using rawspeed::CameraMetaData;
+using rawspeed::RawDecoder;
+using rawspeed::RawImage;
+using rawspeed::RawParser;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class DngFramesTest : public ::testing::TestWithParam<int> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+    file = createDng(3);
+    buffer = Buffer(file.data(), file.size());
+    decoder = RawParser(&buffer).getDecoder();
+    decoder->checkSupport(&meta);
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  static void checkFrame(const RawImage& img, int frame) {
+    ASSERT_EQ(img->dim, frameDim);
+    for (int y = 0; y < frameDim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+      for (int x = 0; x < frameDim.x; x++)
+        ASSERT_EQ(row[x], pixelAt(frame, x, y)) << x << " " << y;
+    }
+  }
+
+  const CameraMetaData meta{};
+  std::vector<uchar8> file;
+  Buffer buffer;
+  std::unique_ptr<RawDecoder> decoder;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, DngFramesTest, ::testing::Values(1, 3));
+
+TEST_P(DngFramesTest, EachFrameInTheGivenOrder) {
+  ASSERT_EQ(decoder->getNumFrames(), 3);
+
+  const std::vector<RawImage> images = decoder->decodeFrames({2, 0, 1}, &meta);
+  ASSERT_EQ(images.size(), 3);
+  checkFrame(images[0], 2);
+  checkFrame(images[1], 0);
+  checkFrame(images[2], 1);
+
+  // And its own one is still the first.
+  checkFrame(decoder->decodeRaw(), 0);
+}
+
+TEST_P(DngFramesTest, NotAFrameThrows) {
+  ASSERT_THROW(decoder->decodeFrames({0, 3}, &meta), RawspeedException);
+  ASSERT_THROW(decoder->decodeFrames({-1}, &meta), RawspeedException);
+}
+
+} // namespace rawspeed_test
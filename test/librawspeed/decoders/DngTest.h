@@ -0,0 +1,97 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include "common/Common.h" // for uchar8, uint32, ushort16
+#include "common/Point.h"  // for iPoint2D
+#include "tiff/TiffTag.h"  // for TiffTag, COMPRESSION, DNGVERSION
+#include <vector>          // for vector
+
+namespace rawspeed_test {
+
+static const rawspeed::iPoint2D frameDim(8, 4);
+
+inline rawspeed::ushort16 pixelAt(int frame, int x, int y) {
+  return 1000 * frame + 10 * y + x;
+}
+
+// A little-endian DNG of the given number of uncompressed LinearRaw frames,
+// each in its own IFD of the chain, and its strip that many bytes after it.
+inline std::vector<rawspeed::uchar8> createDng(int numFrames,
+                                               rawspeed::uint32 padding = 0) {
+  std::vector<rawspeed::uchar8> file;
+  const auto put16 = [&file](rawspeed::uint32 v) {
+    file.emplace_back(v & 0xFF);
+    file.emplace_back(v >> 8);
+  };
+  const auto put32 = [&put16](rawspeed::uint32 v) {
+    put16(v & 0xFFFF);
+    put16(v >> 16);
+  };
+
+  struct Entry {
+    rawspeed::TiffTag tag;
+    rawspeed::ushort16 type;
+    rawspeed::uint32 value;
+  };
+  const rawspeed::uint32 ifdSize = 2 + 10 * 12 + 4;
+  const rawspeed::uint32 stripSize = 2 * frameDim.x * frameDim.y;
+  const rawspeed::uint32 frameSize = ifdSize + padding + stripSize;
+
+  put16('I' | 'I' << 8);
+  put16(42);
+  put32(8);
+  for (int frame = 0; frame < numFrames; frame++) {
+    const rawspeed::uint32 ifd = 8 + frame * frameSize;
+    const std::vector<Entry> entries = {
+        {rawspeed::NEWSUBFILETYPE, 4, 0},
+        {rawspeed::IMAGEWIDTH, 4, static_cast<rawspeed::uint32>(frameDim.x)},
+        {rawspeed::IMAGELENGTH, 4, static_cast<rawspeed::uint32>(frameDim.y)},
+        {rawspeed::BITSPERSAMPLE, 3, 16},
+        {rawspeed::COMPRESSION, 3, 1},
+        {rawspeed::PHOTOMETRICINTERPRETATION, 3, 34892},
+        {rawspeed::STRIPOFFSETS, 4, ifd + ifdSize + padding},
+        {rawspeed::SAMPLESPERPIXEL, 3, 1},
+        {rawspeed::STRIPBYTECOUNTS, 4, stripSize},
+        {rawspeed::DNGVERSION, 1, 1 | 4 << 8},
+    };
+    put16(entries.size());
+    for (const Entry& e : entries) {
+      put16(e.tag);
+      put16(e.type);
+      put32(e.type == 1 ? 4 : 1);
+      if (e.type == 3) {
+        put16(e.value);
+        put16(0);
+      } else
+        put32(e.value);
+    }
+    put32(frame + 1 < numFrames ? ifd + frameSize : 0);
+    file.resize(file.size() + padding);
+
+    for (int y = 0; y < frameDim.y; y++)
+      for (int x = 0; x < frameDim.x; x++)
+        put16(pixelAt(frame, x, y));
+  }
+  return file;
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,175 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Common.h"       // for uchar8, uint32, ushort16
+#include "common/Point.h"        // for iPoint2D
+#include "decoders/RawDecoder.h" // for RawDecoder, RawDecoder::EmbeddedPre...
+#include "io/Buffer.h"           // for Buffer
+#include "io/BufferLoader.h"     // for BufferLoader
+#include "parsers/RawParser.h"   // for RawParser
+#include "tiff/TiffTag.h"        // for TiffTag, COMPRESSION, DNGVERSION
+#include <gtest/gtest.h>         // for Message, TestPartResult, TestInfo
+#include <memory>                // for unique_ptr
+#include <vector>                // for vector
+
+using rawspeed::Buffer;
+using rawspeed::BufferLoader;
+using rawspeed::iPoint2D;
+using rawspeed::RawDecoder;
+using rawspeed::RawParser;
+using rawspeed::TiffTag;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+using Compression = RawDecoder::EmbeddedPreview::Compression;
+
+static constexpr auto Chunk = BufferLoader::ChunkSize;
+
+// A little-endian DNG of a single IFD, that has the previews far past the
+// first chunk of the file.
+class EmbeddedPreviewTest : public ::testing::Test {
+protected:
+  struct Entry {
+    TiffTag tag;
+    ushort16 type;
+    std::vector<uint32> values;
+  };
+
+  static uchar8 byteAt(Buffer::size_type i) { return uchar8(i ^ (i >> 8U)); }
+
+  void put16(Buffer::size_type pos, uint32 v) {
+    file[pos] = v & 0xFF;
+    file[pos + 1] = (v >> 8) & 0xFF;
+  }
+  void put32(Buffer::size_type pos, uint32 v) {
+    put16(pos, v & 0xFFFF);
+    put16(pos + 2, v >> 16);
+  }
+
+  // The entries must be sorted by their tags. The arrays of LONGs go after
+  // the IFD.
+  void createFile(const std::vector<Entry>& entries) {
+    file.resize(4 * Chunk);
+    for (Buffer::size_type i = 0; i < file.size(); i++)
+      file[i] = byteAt(i);
+
+    file[0] = 'I';
+    file[1] = 'I';
+    put16(2, 42);
+    put32(4, 8);
+    put16(8, entries.size());
+    Buffer::size_type pos = 10;
+    Buffer::size_type extra = 10 + entries.size() * 12 + 4;
+    for (const Entry& e : entries) {
+      put16(pos, e.tag);
+      put16(pos + 2, e.type);
+      put32(pos + 4, e.values.size());
+      if (e.type == 1) { // BYTE, at most 4 of them
+        for (size_t i = 0; i < e.values.size(); i++)
+          file[pos + 8 + i] = e.values[i];
+      } else if (e.type == 3) { // SHORT, only one
+        put16(pos + 8, e.values[0]);
+      } else if (e.values.size() == 1) { // LONG
+        put32(pos + 8, e.values[0]);
+      } else {
+        put32(pos + 8, extra);
+        for (uint32 v : e.values) {
+          put32(extra, v);
+          extra += 4;
+        }
+      }
+      pos += 12;
+    }
+    put32(pos, 0);
+
+    loader.reset(new BufferLoader(
+        file.size(), [this](uchar8* dest, Buffer::size_type offset,
+                            Buffer::size_type count) {
+          for (Buffer::size_type i = 0; i < count; i++)
+            dest[i] = file[offset + i];
+        }));
+  }
+
+  std::vector<uchar8> file;
+  std::unique_ptr<BufferLoader> loader;
+};
+
+TEST_F(EmbeddedPreviewTest, ListedWithoutReadingThem) {
+  createFile({
+      {rawspeed::NEWSUBFILETYPE, 4, {1}},
+      {rawspeed::IMAGEWIDTH, 4, {4}},
+      {rawspeed::IMAGELENGTH, 4, {2}},
+      {rawspeed::COMPRESSION, 3, {1}},
+      {rawspeed::STRIPOFFSETS, 4, {2 * Chunk + 5, 2 * Chunk + 17}},
+      {rawspeed::STRIPBYTECOUNTS, 4, {12, 12}},
+      {rawspeed::JPEGINTERCHANGEFORMAT, 4, {3 * Chunk + 7}},
+      {rawspeed::JPEGINTERCHANGEFORMATLENGTH, 4, {100}},
+      {rawspeed::DNGVERSION, 1, {1, 4, 0, 0}},
+  });
+
+  RawParser parser(&loader->getBuffer());
+  const std::unique_ptr<RawDecoder> decoder = parser.getDecoder();
+  const auto previews = decoder->getEmbeddedPreviews();
+
+  ASSERT_EQ(previews.size(), 2);
+  ASSERT_EQ(previews[0].compression, Compression::JPEG);
+  ASSERT_EQ(previews[0].dim, iPoint2D());
+  ASSERT_EQ(previews[0].offset, 3 * Chunk + 7);
+  ASSERT_EQ(previews[0].length, 100);
+  ASSERT_EQ(previews[1].compression, Compression::Uncompressed);
+  ASSERT_EQ(previews[1].dim, iPoint2D(4, 2));
+  ASSERT_EQ(previews[1].offset, 2 * Chunk + 5);
+  ASSERT_EQ(previews[1].length, 24);
+
+  // Only the header has been read.
+  ASSERT_EQ(loader->getLoadedSize(), Chunk);
+
+  const Buffer jpeg = decoder->getEmbeddedPreviewData(previews[0]);
+  ASSERT_EQ(loader->getLoadedSize(), Chunk);
+  ASSERT_EQ(jpeg.getSize(), 100);
+  for (Buffer::size_type i = 0; i < jpeg.getSize(); i++)
+    ASSERT_EQ(jpeg[i], byteAt(3 * Chunk + 7 + i)) << i;
+  ASSERT_EQ(loader->getLoadedSize(), 2 * Chunk);
+}
+
+// Those are left out, instead of failing the others.
+TEST_F(EmbeddedPreviewTest, UnusableOnesAreLeftOut) {
+  createFile({
+      {rawspeed::NEWSUBFILETYPE, 4, {1}},
+      {rawspeed::IMAGEWIDTH, 4, {4}},
+      {rawspeed::IMAGELENGTH, 4, {2}},
+      {rawspeed::COMPRESSION, 3, {1}},
+      // Not contiguous.
+      {rawspeed::STRIPOFFSETS, 4, {2 * Chunk, 2 * Chunk + 20}},
+      {rawspeed::STRIPBYTECOUNTS, 4, {12, 12}},
+      // Past the end of the file.
+      {rawspeed::JPEGINTERCHANGEFORMAT, 4, {4 * Chunk - 50}},
+      {rawspeed::JPEGINTERCHANGEFORMATLENGTH, 4, {100}},
+      {rawspeed::DNGVERSION, 1, {1, 4, 0, 0}},
+  });
+
+  RawParser parser(&loader->getBuffer());
+  ASSERT_TRUE(parser.getDecoder()->getEmbeddedPreviews().empty());
+}
+
+} // namespace rawspeed_test
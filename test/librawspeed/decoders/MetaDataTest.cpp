@@ -0,0 +1,242 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common/Common.h"            // for uchar8
+#include "common/Executor.h"          // for setExecutor, ThreadPoolExecutor
+#include "common/RawImage.h"          // for RawImage, RawImageData
+#include "common/RawspeedException.h" // for RawspeedException
+#include "decoders/DngTest.h"         // for createDng, frameDim
+#include "common/Point.h"            // for iPoint2D
+#include "decoders/RawDecoder.h"      // for RawDecoder
+#include "io/Buffer.h"                // for Buffer
+#include "metadata/CameraDatabase.h"  // for Writer, Magic, Version
+#include "metadata/CameraMetaData.h"  // for CameraMetaData
+#include "parsers/RawParser.h"        // for RawParser
+#include "tiff/TiffTag.h"             // for TiffTag, IMAGEWIDTH, MAKE
+#include <gtest/gtest.h>              // for ParamIteratorInterface, Message
+#include <memory>                     // for make_shared, unique_ptr
+#include <string>                     // for string
+#include <utility>                    // for pair
+#include <vector>                     // for vector
+
+using rawspeed::Buffer;
+using rawspeed::CameraDatabase::Writer;
+using rawspeed::CameraMetaData;
+using rawspeed::iPoint2D;
+using rawspeed::RawDecoder;
+using rawspeed::RawImage;
+using rawspeed::RawParser;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace rawspeed_test {
+
+// Decodes the metadata of the file without the raw, and compares it with
+// the metadata decoded after the raw.
+static void checkWithoutTheRaw(const Buffer& buffer, const CameraMetaData& meta,
+                               const iPoint2D& dim) {
+  auto getDecoder = [&buffer, &meta]() {
+    auto decoder = RawParser(&buffer).getDecoder(&meta);
+    decoder->checkSupport(&meta);
+    return decoder;
+  };
+
+  auto decoder = getDecoder();
+  decoder->decodeMetaData(&meta);
+  const RawImage img = decoder->mRaw;
+  ASSERT_FALSE(img->isAllocated());
+
+  auto full = getDecoder();
+  full->decodeRaw();
+  full->decodeMetaData(&meta);
+  const RawImage ref = full->mRaw;
+  ASSERT_TRUE(ref->isAllocated());
+
+  ASSERT_EQ(img->dim, dim);
+  ASSERT_EQ(img->dim, ref->dim);
+  ASSERT_EQ(img->getCropOffset(), ref->getCropOffset());
+  ASSERT_EQ(img->getCpp(), ref->getCpp());
+  ASSERT_EQ(img->getDataType(), ref->getDataType());
+  ASSERT_EQ(img->isCFA, ref->isCFA);
+  ASSERT_EQ(img->whitePoint, ref->whitePoint);
+  ASSERT_EQ(img->blackLevel, ref->blackLevel);
+  for (int i = 0; i < 4; i++)
+    ASSERT_EQ(img->blackLevelSeparate[i], ref->blackLevelSeparate[i]) << i;
+}
+
+class MetaDataTest : public ::testing::TestWithParam<int> {
+protected:
+  void SetUp() override {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+    file = createDng(1);
+    buffer = Buffer(file.data(), file.size());
+  }
+  void TearDown() override { setExecutor(nullptr); }
+
+  std::unique_ptr<RawDecoder> getDecoder() {
+    auto decoder = RawParser(&buffer).getDecoder();
+    decoder->checkSupport(&meta);
+    return decoder;
+  }
+
+  const CameraMetaData meta{};
+  std::vector<uchar8> file;
+  Buffer buffer;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, MetaDataTest, ::testing::Values(1, 3));
+
+TEST_P(MetaDataTest, WithoutTheRaw) {
+  checkWithoutTheRaw(buffer, meta, frameDim);
+}
+
+TEST_P(MetaDataTest, NoRawAfterwards) {
+  auto decoder = getDecoder();
+  decoder->decodeMetaData(&meta);
+  ASSERT_THROW(decoder->decodeRaw(), RawspeedException);
+}
+
+// The other formats need their camera, for the crop and the CHDK hints.
+static const iPoint2D imageDim(64, 32);
+static const iPoint2D cropPos(2, 1);
+static const iPoint2D cropSize(60, 30);
+static const uint32 nakedSize = imageDim.area() * 12 / 8;
+
+static void
+putCamera(Writer* db, const std::string& make, const std::string& model,
+          const std::string& mode,
+          const std::vector<std::pair<std::string, std::string>>& hints) {
+  Writer record;
+  for (const auto& str : {make, model, mode, make, model, model, make + model})
+    record.putString(str);
+  record.putU32(0); // aliases
+  record.putU32(0); // canonical aliases
+  record.putU32(2); // the CFA
+  record.putU32(2);
+  record.putBytes({0, 1, 1, 2});
+  record.putU32(1); // supported
+  for (int v : {cropSize.x, cropSize.y, cropPos.x, cropPos.y})
+    record.putU32(v);
+  record.putU32(0); // black areas
+  record.putU32(1); // sensor info
+  for (int v : {64, 4095, 0, 0})
+    record.putU32(v);
+  record.putU32(0);
+  record.putU32(0); // decoder version
+  record.putU32(hints.size());
+  for (const auto& hint : hints) {
+    record.putString(hint.first);
+    record.putString(hint.second);
+  }
+
+  db->putString(make);
+  db->putString(model);
+  db->putString(mode);
+  db->putU32(record.data().size());
+  db->putBytes(record.data());
+}
+
+static std::vector<uchar8> createDatabase() {
+  Writer db;
+  db.putU32(rawspeed::CameraDatabase::Magic);
+  db.putU32(rawspeed::CameraDatabase::Version);
+  db.putU32(2);
+  putCamera(&db, "Canon", "PowerShot N", "chdk",
+            {{"filesize", std::to_string(nakedSize)},
+             {"full_width", std::to_string(imageDim.x)},
+             {"full_height", std::to_string(imageDim.y)}});
+  putCamera(&db, "SEIKO EPSON CORP.", "R-D1", "", {});
+  return db.release();
+}
+
+// A little-endian TIFF of an Epson camera, with a zeroed 12-bit strip.
+static std::vector<uchar8> createErf() {
+  std::vector<uchar8> file;
+  const auto put16 = [&file](uint32 v) {
+    file.emplace_back(v & 0xFF);
+    file.emplace_back(v >> 8);
+  };
+  const auto put32 = [&put16](uint32 v) {
+    put16(v & 0xFFFF);
+    put16(v >> 16);
+  };
+
+  const std::string make("SEIKO EPSON CORP.");
+  const std::string model("R-D1");
+  const uint32 ifdSize = 2 + 6 * 12 + 4;
+  const uint32 makeOffset = 8 + ifdSize;
+  const uint32 modelOffset = makeOffset + make.size() + 1;
+  const uint32 stripOffset = 128;
+  const uint32 stripSize = 4096;
+
+  struct Entry {
+    rawspeed::TiffTag tag;
+    rawspeed::ushort16 type;
+    uint32 count;
+    uint32 value;
+  };
+  const std::vector<Entry> entries = {
+      {rawspeed::IMAGEWIDTH, 4, 1, static_cast<uint32>(imageDim.x)},
+      {rawspeed::IMAGELENGTH, 4, 1, static_cast<uint32>(imageDim.y)},
+      {rawspeed::MAKE, 2, static_cast<uint32>(make.size() + 1), makeOffset},
+      {rawspeed::MODEL, 2, static_cast<uint32>(model.size() + 1), modelOffset},
+      {rawspeed::STRIPOFFSETS, 4, 1, stripOffset},
+      {rawspeed::STRIPBYTECOUNTS, 4, 1, stripSize},
+  };
+
+  put16('I' | 'I' << 8);
+  put16(42);
+  put32(8);
+  put16(entries.size());
+  for (const Entry& e : entries) {
+    put16(e.tag);
+    put16(e.type);
+    put32(e.count);
+    put32(e.value);
+  }
+  put32(0);
+  for (const std::string& str : {make, model}) {
+    file.insert(file.end(), str.begin(), str.end());
+    file.emplace_back(0);
+  }
+  file.resize(stripOffset + stripSize);
+  return file;
+}
+
+class MetaDataFormatTest : public ::testing::Test {
+protected:
+  const std::vector<uchar8> database = createDatabase();
+  const CameraMetaData meta{Buffer(database.data(), database.size())};
+};
+
+TEST_F(MetaDataFormatTest, Tiff) {
+  const std::vector<uchar8> file = createErf();
+  checkWithoutTheRaw(Buffer(file.data(), file.size()), meta, cropSize);
+}
+
+TEST_F(MetaDataFormatTest, Naked) {
+  const std::vector<uchar8> file(nakedSize);
+  checkWithoutTheRaw(Buffer(file.data(), file.size()), meta, cropSize);
+}
+
+} // namespace rawspeed_test
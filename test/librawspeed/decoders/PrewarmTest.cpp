@@ -0,0 +1,76 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decoders/Prewarm.h"
+#include "common/Executor.h"         // for setExecutor, ThreadPoolExecutor
+#include "common/ImageAllocator.h"   // for PooledImageAllocator
+#include "common/RawImage.h"         // for RawImage
+#include "decoders/DecoderSession.h" // for DecoderSession
+#include "decoders/DngTest.h"        // for createDng, frameDim
+#include "io/Buffer.h"               // for Buffer
+#include "metadata/CameraMetaData.h" // for CameraMetaData
+#include <gtest/gtest.h>             // for Message, TestPartResult, Test...
+#include <memory>                    // for make_shared
+#include <vector>                    // for vector
+
+using rawspeed::Buffer;
+using rawspeed::CameraMetaData;
+using rawspeed::DecoderSession;
+using rawspeed::prewarm;
+using rawspeed::PrewarmOptions;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+TEST(PrewarmTest, Defaults) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  ASSERT_NO_THROW(prewarm());
+  // Again, it is still fine.
+  ASSERT_NO_THROW(prewarm());
+  setExecutor(nullptr);
+}
+
+// The first decodes get the frames, and do not allocate.
+TEST(PrewarmTest, FramesOfASession) {
+  const CameraMetaData meta{};
+  DecoderSession session(&meta);
+
+  PrewarmOptions options;
+  options.imageAllocator = session.getImagePool();
+  options.frames = 2;
+  options.frameDim = frameDim;
+  prewarm(options);
+  ASSERT_EQ(session.getStats().imageAllocations, 2);
+
+  const std::vector<uchar8> file = createDng(1);
+  const Buffer buffer(file.data(), file.size());
+  std::vector<RawImage> kept;
+  for (int i = 0; i < 2; i++)
+    kept.emplace_back(session.decode(&buffer));
+  ASSERT_EQ(session.getStats().imageAllocations, 2);
+
+  kept.emplace_back(session.decode(&buffer));
+  ASSERT_EQ(session.getStats().imageAllocations, 3);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,259 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/AbstractDngDecompressor.h" // for AbstractDngDecom...
+#include "common/Cancellation.h"                   // for Cancellation
+#include "common/Common.h"                         // for uchar8, ushort16
+#include "common/Point.h"                          // for iPoint2D, iRecta...
+#include "common/RawImage.h"                       // for RawImage, RawIma...
+#include "common/RawspeedException.h"              // for RawspeedException
+#include "decompressors/TileDecodeEngine.h"        // for TileDecodeEngine
+#include "io/Buffer.h"                             // for Buffer, DataBuffer
+#include "io/ByteStream.h"                         // for ByteStream
+#include "io/Endianness.h"                         // for Endianness
+#include <algorithm>                               // for fill_n, sort
+#include <gtest/gtest.h>                           // for Message, TestPar...
+#include <memory>                                  // for make_shared
+#include <mutex>                                   // for mutex, lock_guard
+#include <tuple>                                   // for tie
+#include <utility>                                 // for move
+#include <vector>                                  // for vector
+
+using rawspeed::AbstractDngDecompressor;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::Cancellation;
+using rawspeed::DataBuffer;
+using rawspeed::DngTilingDescription;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setTileDecodeEngine;
+using rawspeed::TileDecodeEngine;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// Uncompressed 16-bit tiles, each of their pixels being its tile number + 1.
+// The rows after the bottom of the roi are not decoded either.
+TEST(AbstractDngDecompressorTest, SkipsTheTilesOutsideOfROI) {
+  const iPoint2D dim(70, 50);
+  const int tileW = 16;
+  const int tileH = 16;
+
+  for (const iRectangle2D& roi :
+       {iRectangle2D(), iRectangle2D(20, 17, 5, 1),
+        iRectangle2D(60, 40, 30, 30), iRectangle2D(15, 0, 2, 50)}) {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    mRaw->clearArea({{0, 0}, dim}, 0xFF);
+
+    AbstractDngDecompressor slices(
+        mRaw, DngTilingDescription(dim, tileW, tileH), 1, false, 16, 0, roi);
+
+    std::vector<std::vector<uchar8>> tiles(slices.dsc.numTiles);
+    for (unsigned n = 0; n < slices.dsc.numTiles; n++) {
+      for (int i = 0; i < tileW * tileH; i++) {
+        tiles[n].emplace_back(n + 1);
+        tiles[n].emplace_back(0);
+      }
+      slices.slices.emplace_back(
+          slices.dsc, n,
+          ByteStream(DataBuffer(Buffer(tiles[n].data(), tiles[n].size()),
+                                Endianness::little)));
+    }
+
+    slices.decompress();
+
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++) {
+        const iRectangle2D tile((x / tileW) * tileW, (y / tileH) * tileH, tileW,
+                                tileH);
+        const bool decoded =
+            !roi.hasPositiveArea() || (tile.getOverlap(roi).hasPositiveArea() &&
+                                       y < roi.getBottom());
+        const int n = (y / tileH) * slices.dsc.tilesX + x / tileW;
+        ASSERT_EQ(row[x], decoded ? n + 1 : 0) << x << " " << y;
+      }
+    }
+  }
+}
+
+// Each decoded tile is reported once, with its final pixels.
+TEST(AbstractDngDecompressorTest, ReportsTheDecodedTiles) {
+  const iPoint2D dim(70, 50);
+  const int tileW = 16;
+  const int tileH = 16;
+  const iRectangle2D roi(20, 17, 30, 1);
+
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+  std::mutex m;
+  std::vector<iRectangle2D> reported;
+  mRaw->areaReady = [&](const iRectangle2D& area) {
+    for (int y = area.getTop(); y < area.getBottom(); y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      const int n = (area.getTop() / tileH) * 5 + area.getLeft() / tileW;
+      for (int x = area.getLeft(); x < area.getRight(); x++)
+        EXPECT_EQ(row[x], y < roi.getBottom() ? n + 1 : 0) << x << " " << y;
+    }
+    std::lock_guard<std::mutex> guard(m);
+    reported.emplace_back(area);
+  };
+
+  AbstractDngDecompressor slices(
+      mRaw, DngTilingDescription(dim, tileW, tileH), 1, false, 16, 0, roi);
+  ASSERT_EQ(slices.dsc.tilesX, 5U);
+
+  std::vector<std::vector<uchar8>> tiles(slices.dsc.numTiles);
+  for (unsigned n = 0; n < slices.dsc.numTiles; n++) {
+    tiles[n].assign(2 * tileW * tileH, 0);
+    for (int i = 0; i < tileW * tileH; i++)
+      tiles[n][2 * i] = n + 1;
+    slices.slices.emplace_back(
+        slices.dsc, n,
+        ByteStream(DataBuffer(Buffer(tiles[n].data(), tiles[n].size()),
+                              Endianness::little)));
+  }
+
+  slices.decompress();
+
+  std::sort(reported.begin(), reported.end(),
+            [](const iRectangle2D& a, const iRectangle2D& b) {
+              return std::tie(a.pos.y, a.pos.x) < std::tie(b.pos.y, b.pos.x);
+            });
+  ASSERT_EQ(reported.size(), 3U);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(reported[i].pos, iPoint2D(tileW * (i + 1), tileH));
+    EXPECT_EQ(reported[i].dim, iPoint2D(tileW, tileH));
+  }
+}
+
+TEST(AbstractDngDecompressorTest, Cancelled) {
+  const iPoint2D dim(32, 32);
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  auto cancellation = std::make_shared<Cancellation>();
+  mRaw->cancellation = cancellation;
+  int reported = 0;
+  mRaw->areaReady = [&reported](const iRectangle2D& /*area*/) { reported++; };
+
+  AbstractDngDecompressor slices(mRaw, DngTilingDescription(dim, 16, 16), 1,
+                                 false, 16, 0);
+  std::vector<uchar8> tile(2 * 16 * 16);
+  for (unsigned n = 0; n < slices.dsc.numTiles; n++) {
+    slices.slices.emplace_back(
+        slices.dsc, n,
+        ByteStream(DataBuffer(Buffer(tile.data(), tile.size()),
+                              Endianness::little)));
+  }
+
+  cancellation->cancel();
+  ASSERT_THROW(slices.decompress(), RawspeedException);
+  ASSERT_EQ(reported, 0);
+}
+
+// Fills the tiles with their tile number + 100.
+class FakeTileDecodeEngine final : public TileDecodeEngine {
+public:
+  FakeTileDecodeEngine(RawImage mRaw_, bool accept_)
+      : mRaw(std::move(mRaw_)), accept(accept_) {}
+
+  bool decompressDng(const AbstractDngDecompressor& d,
+                     const std::vector<int>& order) override {
+    calls++;
+    if (!accept)
+      return false;
+    for (int i : order) {
+      const auto& e = d.slices[i];
+      const unsigned rows = d.isRowLimited() ? d.getRows(e) : e.height;
+      for (unsigned y = e.offY; y < e.offY + rows; y++) {
+        auto* row = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+        std::fill_n(row + e.offX, e.width, e.n + 100);
+      }
+    }
+    return true;
+  }
+
+  bool decompressVC5(const ByteStream& /*bs*/,
+                     const RawImage& /*img*/) override {
+    return false;
+  }
+
+  RawImage mRaw;
+  bool accept;
+  int calls = 0;
+};
+
+// The listed tiles are left to the engine, which is offered them at once,
+// and if it declines, they are decoded on the CPU.
+TEST(AbstractDngDecompressorTest, TileDecodeEngine) {
+  const iPoint2D dim(70, 50);
+  const int tileW = 16;
+  const int tileH = 16;
+  const iRectangle2D roi(20, 17, 30, 1);
+
+  for (bool accept : {false, true}) {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    mRaw->clearArea({{0, 0}, dim}, 0xFF);
+    int reported = 0;
+    mRaw->areaReady = [&reported](const iRectangle2D& /*area*/) {
+      reported++;
+    };
+
+    auto engine = std::make_shared<FakeTileDecodeEngine>(mRaw, accept);
+    setTileDecodeEngine(engine);
+
+    AbstractDngDecompressor slices(
+        mRaw, DngTilingDescription(dim, tileW, tileH), 1, false, 16, 0, roi);
+    std::vector<std::vector<uchar8>> tiles(slices.dsc.numTiles);
+    for (unsigned n = 0; n < slices.dsc.numTiles; n++) {
+      tiles[n].assign(2 * tileW * tileH, 0);
+      for (int i = 0; i < tileW * tileH; i++)
+        tiles[n][2 * i] = n + 1;
+      slices.slices.emplace_back(
+          slices.dsc, n,
+          ByteStream(DataBuffer(Buffer(tiles[n].data(), tiles[n].size()),
+                                Endianness::little)));
+    }
+
+    slices.decompress();
+    setTileDecodeEngine(nullptr);
+
+    ASSERT_EQ(engine->calls, 1);
+    ASSERT_EQ(reported, 3);
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++) {
+        const iRectangle2D tile((x / tileW) * tileW, (y / tileH) * tileH, tileW,
+                                tileH);
+        const bool decoded =
+            tile.getOverlap(roi).hasPositiveArea() && y < roi.getBottom();
+        const int n = (y / tileH) * slices.dsc.tilesX + x / tileW;
+        ASSERT_EQ(row[x], !decoded ? 0 : (accept ? n + 100 : n + 1))
+            << x << " " << y;
+      }
+    }
+  }
+}
+
+} // namespace rawspeed_test
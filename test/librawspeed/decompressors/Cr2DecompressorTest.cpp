@@ -0,0 +1,287 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/Cr2Decompressor.h" // for Cr2Decompressor, Cr2Slicing
+#include "common/Common.h"                 // for uchar8, ushort16
+#include "common/Executor.h"               // for setExecutor, ThreadPoolEx...
+#include "common/Point.h"                  // for iPoint2D
+#include "common/RawImage.h"               // for RawImage, RawImageData
+#include "common/RawspeedException.h"      // for RawspeedException
+#include "io/Buffer.h"                     // for Buffer, DataBuffer
+#include "io/ByteStream.h"                 // for ByteStream
+#include "io/Endianness.h"                 // for Endianness, Endianness::big
+#include <array>                           // for array
+#include <cstdlib>                         // for abs
+#include <gtest/gtest.h>                   // for ParamIteratorInterface, M...
+#include <memory>                          // for make_shared
+#include <numeric>                         // for iota
+#include <vector>                          // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::Cr2Decompressor;
+using rawspeed::Cr2Slicing;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// A minimal LJpeg encoder, producing the 2-component (CFA) CR2 layout:
+// a single slice, each frame row is one image row.
+class LJpegWriter final {
+  std::vector<uchar8> out;
+  unsigned bits = 0;
+  int fillLevel = 0;
+
+  void put8(int v) { out.emplace_back(v); }
+  void put16(int v) {
+    put8(v >> 8);
+    put8(v & 0xFF);
+  }
+
+  void putBits(unsigned v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+      bits = (bits << 1) | ((v >> i) & 1);
+      if (++fillLevel != 8)
+        continue;
+      put8(bits);
+      if (bits == 0xFF)
+        put8(0x00); // byte stuffing
+      bits = 0;
+      fillLevel = 0;
+    }
+  }
+
+  void flushBits() {
+    while (fillLevel != 0)
+      putBits(1, 1);
+  }
+
+  // Every category gets a 4-bit code, equal to the category.
+  void putDiff(int diff) {
+    int cat = 0;
+    while ((std::abs(diff) >> cat) != 0)
+      cat++;
+    putBits(cat, 4);
+    if (cat)
+      putBits(diff < 0 ? diff + (1 << cat) - 1 : diff, cat);
+  }
+
+public:
+  static constexpr int prec = 14;
+
+  std::vector<uchar8> write(const std::vector<ushort16>& image, int width,
+                            int height, int restartInterval) {
+    const int frameW = width / 2;
+
+    put16(0xFFD8); // SOI
+
+    put16(0xFFC4); // DHT
+    put16(2 + 1 + 16 + 9);
+    put8(0x00);
+    for (int i = 0; i < 16; i++)
+      put8(i == 3 ? 9 : 0);
+    for (int i = 0; i < 9; i++)
+      put8(i);
+
+    put16(0xFFC3); // SOF3
+    put16(8 + 3 * 2);
+    put8(prec);
+    put16(height);
+    put16(frameW);
+    put8(2);
+    for (int c = 0; c < 2; c++) {
+      put8(c + 1);
+      put8(0x11);
+      put8(0);
+    }
+
+    if (restartInterval) {
+      put16(0xFFDD); // DRI
+      put16(4);
+      put16(restartInterval);
+    }
+
+    put16(0xFFDA); // SOS
+    put16(6 + 2 * 2);
+    put8(2);
+    for (int c = 0; c < 2; c++) {
+      put8(c + 1);
+      put8(0x00);
+    }
+    put8(1); // predictor
+    put8(0);
+    put8(0); // point transform
+
+    std::array<int, 2> pred{};
+    int groups = 0;
+    int numRestarts = 0;
+    for (int row = 0; row < height; row++) {
+      for (int g = 0; g < frameW; g++) {
+        if (restartInterval && groups && groups % restartInterval == 0) {
+          flushBits();
+          put8(0xFF);
+          put8(0xD0 + numRestarts++ % 8);
+        }
+        const bool reset = !restartInterval ? (groups == 0)
+                                            : (groups % restartInterval == 0);
+        for (int c = 0; c < 2; c++) {
+          if (reset)
+            pred[c] = 1 << (prec - 1);
+          else if (g == 0)
+            pred[c] = image[(row - 1) * width + c];
+          const int v = image[row * width + 2 * g + c];
+          putDiff(v - pred[c]);
+          pred[c] = v;
+        }
+        groups++;
+      }
+    }
+    flushBits();
+
+    put16(0xFFD9); // EOI
+    return out;
+  }
+};
+
+constexpr int LJpegWriter::prec;
+
+class Cr2DecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  Cr2DecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    image.resize(width * height);
+    unsigned state = 1;
+    for (auto& v : image) {
+      state = state * 1103515245U + 12345U;
+      // The differences stay below 256, within the categories of the table.
+      v = (1 << (LJpegWriter::prec - 1)) - 100 + (state >> 16) % 200;
+    }
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  std::vector<ushort16> decode(const std::vector<uchar8>& data,
+                               int numSlices = 1,
+                               std::vector<int>* rowsDecoded = nullptr) const {
+    RawImage mRaw = RawImage::create(iPoint2D(width, height));
+    const Buffer b(data.data(), data.size());
+    const DataBuffer db(b, Endianness::big);
+    Cr2Decompressor d(ByteStream(db), mRaw);
+    if (rowsDecoded)
+      d.rowsDecoded = [rowsDecoded](int rows) { rowsDecoded->push_back(rows); };
+    d.decode(Cr2Slicing(numSlices, width / numSlices, width / numSlices));
+
+    std::vector<ushort16> decoded;
+    for (int row = 0; row < height; row++) {
+      const auto* line =
+          reinterpret_cast<const ushort16*>(mRaw->getDataUncropped(0, row));
+      decoded.insert(decoded.end(), line, line + width);
+    }
+    return decoded;
+  }
+
+  static constexpr int width = 16;
+  static constexpr int height = 12;
+  std::vector<ushort16> image;
+};
+
+constexpr int Cr2DecompressorTest::width;
+constexpr int Cr2DecompressorTest::height;
+
+INSTANTIATE_TEST_CASE_P(Threads, Cr2DecompressorTest,
+                        ::testing::Values(1, 2, 5));
+
+TEST_P(Cr2DecompressorTest, NoRestartInterval) {
+  const auto data = LJpegWriter().write(image, width, height, 0);
+  ASSERT_EQ(decode(data), image);
+}
+
+TEST_P(Cr2DecompressorTest, RestartIntervals) {
+  const int groupsPerRow = width / 2;
+  for (int rows : {1, 2, 5, height, 2 * height}) {
+    const auto data =
+        LJpegWriter().write(image, width, height, rows * groupsPerRow);
+    ASSERT_EQ(decode(data), image);
+  }
+}
+
+// The frame is the image, cut into vertical slices, which are stacked one
+// after the other. Each frame row then spans several lines of a slice.
+TEST_P(Cr2DecompressorTest, Slices) {
+  for (int numSlices : {2, 4}) {
+    const int sliceWidth = width / numSlices;
+    std::vector<ushort16> frame;
+    for (int slice = 0; slice < numSlices; slice++) {
+      for (int row = 0; row < height; row++) {
+        const auto* line = &image[row * width + slice * sliceWidth];
+        frame.insert(frame.end(), line, line + sliceWidth);
+      }
+    }
+
+    const int groupsPerRow = width / 2;
+    for (int rows : {0, 1, 3}) {
+      const auto data =
+          LJpegWriter().write(frame, width, height, rows * groupsPerRow);
+      ASSERT_EQ(decode(data, numSlices), image) << numSlices << " " << rows;
+    }
+  }
+}
+
+// Only once the last slice gets to them, one at a time.
+TEST_P(Cr2DecompressorTest, RowsDecoded) {
+  for (int numSlices : {1, 2}) {
+    const int sliceWidth = width / numSlices;
+    std::vector<ushort16> frame;
+    for (int slice = 0; slice < numSlices; slice++) {
+      for (int row = 0; row < height; row++) {
+        const auto* line = &image[row * width + slice * sliceWidth];
+        frame.insert(frame.end(), line, line + sliceWidth);
+      }
+    }
+
+    std::vector<int> rows;
+    decode(LJpegWriter().write(frame, width, height, 0), numSlices, &rows);
+    std::vector<int> expected(height);
+    std::iota(expected.begin(), expected.end(), 1);
+    ASSERT_EQ(rows, expected);
+
+    // Not for the restart intervals, which are decoded in any order.
+    rows.clear();
+    decode(LJpegWriter().write(frame, width, height, width / 2), numSlices,
+           &rows);
+    ASSERT_TRUE(rows.empty());
+  }
+}
+
+TEST_P(Cr2DecompressorTest, RestartIntervalNotOnRowBoundary) {
+  const auto data = LJpegWriter().write(image, width, height, 3);
+  ASSERT_THROW(decode(data), RawspeedException);
+}
+
+} // namespace rawspeed_test
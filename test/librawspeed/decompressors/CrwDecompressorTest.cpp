@@ -0,0 +1,296 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2018 Roman Lebedev
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/CrwDecompressor.h" // for CrwDecompressor
+#include "common/Cancellation.h"            // for Cancellation
+#include "common/Common.h"                  // for uchar8, ushort16, uint32
+#include "common/Executor.h"                // for setExecutor, ThreadPoo...
+#include "common/Point.h"                   // for iPoint2D
+#include "common/RawImage.h"                // for RawImage, RawImageData
+#include "common/RawspeedException.h"       // for RawspeedException
+#include "io/Buffer.h"                      // for Buffer, DataBuffer
+#include "io/ByteStream.h"                  // for ByteStream
+#include "io/Endianness.h"                  // for Endianness
+#include <algorithm>                        // for max, min
+#include <array>                            // for array
+#include <cstdlib>                          // for abs
+#include <gtest/gtest.h>                    // for ParamIteratorInterface
+#include <memory>                           // for make_shared
+#include <tuple>                            // for get, tuple
+#include <utility>                          // for pair
+#include <vector>                           // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::Cancellation;
+using rawspeed::CrwDecompressor;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The canonical code of the symbol, from the number of codes per length.
+static std::pair<uint32, int> getCode(const std::array<uchar8, 16>& ncpl,
+                                      int symbol) {
+  uint32 code = 0;
+  for (int l = 1; l <= 16; l++) {
+    if (symbol < ncpl[l - 1])
+      return {code + symbol, l};
+    symbol -= ncpl[l - 1];
+    code = (code + ncpl[l - 1]) << 1;
+  }
+  return {0, 0};
+}
+
+// MSB first, with the 0xFF bytes escaped as in JPEG.
+class BitWriterJPEG {
+  std::vector<uchar8>* out;
+  uint32 cache = 0;
+  int fill = 0;
+
+public:
+  explicit BitWriterJPEG(std::vector<uchar8>* out_) : out(out_) {}
+
+  void put(uint32 bits, int len) {
+    for (int i = len - 1; i >= 0; i--) {
+      cache = (cache << 1) | ((bits >> i) & 1U);
+      if (++fill == 8) {
+        out->emplace_back(cache);
+        if (cache == 0xFF)
+          out->emplace_back(0);
+        cache = 0;
+        fill = 0;
+      }
+    }
+  }
+
+  ~BitWriterJPEG() {
+    if (fill)
+      put(0, 8 - fill);
+    // The pump reads ahead.
+    for (int i = 0; i < 8; i++)
+      out->emplace_back(0);
+  }
+};
+
+// Table 0. Only some of the symbols are used, the ones of the second tree
+// with their {length of the difference, skip}.
+static const std::array<uchar8, 16> firstNcpl = {
+    {0, 1, 4, 2, 3, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+// The symbols of the first tree for the differences of 0 to 4 bits.
+static const std::array<int, 5> firstSymbols = {{9, 6, 4, 1, 0}};
+static const std::array<uchar8, 16> secondNcpl = {
+    {0, 2, 2, 2, 1, 4, 2, 1, 2, 5, 1, 1, 0, 0, 0, 139}};
+static const int secondEndOfBlock = 15;
+struct SecondSymbol {
+  int symbol;
+  int len;
+  int skip;
+};
+static const std::array<SecondSymbol, 12> secondSymbols = {{
+    {0, 3, 0},
+    {1, 4, 0},
+    {2, 2, 0},
+    {4, 1, 0},
+    {8, 2, 1},
+    {9, 3, 1},
+    {10, 1, 1},
+    {11, 4, 1},
+    {14, 2, 2},
+    {16, 1, 2},
+    {19, 0, 15}, // a code of 10 bits
+    {22, 4, 2},  // a code of 12 bits, longer than the lookup
+}};
+
+class CrwDecompressorTest
+    : public ::testing::TestWithParam<std::tuple<int, int>> {
+protected:
+  CrwDecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    dim = {std::get<1>(GetParam()), 8};
+
+    BitWriterJPEG w(&high);
+
+    uint32 random = 1;
+    const auto next = [&random](int n) {
+      random = random * 1103515245U + 12345U;
+      return static_cast<int>((random >> 8) % n);
+    };
+
+    std::array<int, 2> base{{}};
+    int carry = 0;
+    int x = 0;
+    for (unsigned block = 0; block < dim.area() / 64; block++) {
+      // Until one that does not overflow.
+      std::array<int, 64> diffBuf;
+      std::vector<std::pair<uint32, int>> bits;
+      std::array<int, 2> newBase;
+      std::array<ushort16, 64> values;
+      for (;;) {
+        diffBuf.fill(0);
+        bits.clear();
+
+        const auto putDiff = [&bits, &diffBuf, &next](int i, int len) {
+          if (!len)
+            return;
+          const int v = next(1 << len);
+          if (i < 64)
+            diffBuf[i] = v >> (len - 1) ? v : v - (1 << len) + 1;
+          bits.emplace_back(v, len);
+        };
+
+        // The first difference is added to all of the following ones, so it
+        // keeps close to 0. It takes at most 4 bits.
+        const int d0 = std::min(std::max(next(7) - 3 - carry, -15), 15);
+        int len0 = 0;
+        while ((std::abs(d0) >> len0) != 0)
+          len0++;
+        const int s0 = firstSymbols[len0];
+        bits.emplace_back(getCode(firstNcpl, s0));
+        if (len0)
+          bits.emplace_back(d0 >= 0 ? d0 : d0 + (1 << len0) - 1, len0);
+        diffBuf[0] = d0;
+
+        int i = 1;
+        while (i < 64) {
+          if (next(40) == 0) {
+            bits.emplace_back(getCode(secondNcpl, secondEndOfBlock));
+            break;
+          }
+          const auto& s = secondSymbols[next(secondSymbols.size())];
+          bits.emplace_back(getCode(secondNcpl, s.symbol));
+          i += s.skip;
+          putDiff(i, s.len);
+          i++;
+        }
+
+        diffBuf[0] += carry;
+
+        bool ok = true;
+        newBase = base;
+        for (int k = 0, p = x; k < 64; k++, p++) {
+          if (p % dim.x == 0)
+            newBase = {{512, 512}};
+          newBase[k & 1] += diffBuf[k];
+          ok &= newBase[k & 1] >= 0 && newBase[k & 1] < 1024;
+          values[k] = newBase[k & 1];
+        }
+        if (ok)
+          break;
+      }
+
+      carry = diffBuf[0];
+      base = newBase;
+      for (const auto& b : bits)
+        w.put(b.first, b.second);
+
+      expected.insert(expected.end(), values.begin(), values.end());
+      x += 64;
+    }
+
+    for (unsigned i = 0; i < dim.area() / 4; i++)
+      low.emplace_back(next(256));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  std::vector<uchar8> getInput(bool lowbits) const {
+    std::vector<uchar8> input;
+    if (lowbits)
+      input = low;
+    input.resize(input.size() + 514);
+    input.insert(input.end(), high.begin(), high.end());
+    return input;
+  }
+
+  void decode(RawImage mRaw, const std::vector<uchar8>& input,
+              bool lowbits) const {
+    CrwDecompressor c(mRaw, 0, lowbits,
+                      ByteStream(DataBuffer(Buffer(input.data(), input.size()),
+                                            Endianness::little)));
+    c.decompress();
+  }
+
+  iPoint2D dim;
+  std::vector<uchar8> high;
+  std::vector<uchar8> low;
+  std::vector<ushort16> expected;
+};
+
+// A width that is not a whole number of the 16 pixels of the SIMD merge,
+// and the one that gets the fixup of the low bits.
+INSTANTIATE_TEST_CASE_P(ThreadsAndWidths, CrwDecompressorTest,
+                        ::testing::Combine(::testing::Values(1, 3),
+                                           ::testing::Values(40, 2672)));
+
+TEST_P(CrwDecompressorTest, Decode) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  decode(mRaw, getInput(false), false);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+TEST_P(CrwDecompressorTest, LowBits) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  decode(mRaw, getInput(true), true);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++) {
+      const int p = y * dim.x + x;
+      int val = expected[p] << 2 | ((low[p / 4] >> (2 * (p % 4))) & 0b11);
+      if (dim.x == 2672 && val < 512)
+        val += 2;
+      ASSERT_EQ(row[x], val) << x << " " << y;
+    }
+  }
+}
+
+TEST_P(CrwDecompressorTest, Cancelled) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  auto cancellation = std::make_shared<Cancellation>();
+  cancellation->cancel();
+  mRaw->cancellation = cancellation;
+  ASSERT_THROW(decode(mRaw, getInput(true), true), RawspeedException);
+}
+
+TEST_P(CrwDecompressorTest, BadTable) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  const auto input = getInput(false);
+  ASSERT_THROW(
+      CrwDecompressor(mRaw, 3, false,
+                      ByteStream(DataBuffer(Buffer(input.data(), input.size()),
+                                            Endianness::little))),
+      RawspeedException);
+}
+
+} // namespace rawspeed_test
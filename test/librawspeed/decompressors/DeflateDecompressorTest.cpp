@@ -0,0 +1,224 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h" // for HAVE_ZLIB
+
+#ifdef HAVE_ZLIB
+
+#include "decompressors/DeflateDecompressor.h" // for DeflateDecompressor
+#include "common/Common.h"                     // for uchar8, uint32
+#include "common/Point.h"                      // for iPoint2D
+#include "common/RawImage.h"                   // for RawImage, RawImageData
+#include "common/RawspeedException.h"          // for RawspeedException
+#include "io/Buffer.h"                         // for Buffer, DataBuffer
+#include "io/ByteStream.h"                     // for ByteStream
+#include "io/Endianness.h"                     // for Endianness
+#include <cmath>                               // for ldexp
+#include <cstring>                             // for memcpy
+#include <gtest/gtest.h>                       // for ParamIteratorInterface
+#include <memory>                              // for unique_ptr
+#include <tuple>                               // for get, tuple
+#include <vector>                              // for vector
+#include <zlib.h>                              // for compress, compressBound
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::DeflateDecompressor;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+
+namespace rawspeed_test {
+
+// A random number, as the bytes of the value, and as the bits of the float.
+// Most of them are normal, the rest are the zeros and subnormals, and the
+// infinities and the quiet NaNs.
+static uint32 randomValue(uint32* random, int bytesps, uint32* expected) {
+  *random = *random * 1103515245U + 12345U;
+  const uint32 r = *random;
+  const bool sign = r & 1U;
+
+  int expBits;
+  int mantissaBits;
+  switch (bytesps) {
+  case 2:
+    expBits = 5;
+    mantissaBits = 10;
+    break;
+  case 3:
+    expBits = 7;
+    mantissaBits = 16;
+    break;
+  default:
+    expBits = 8;
+    mantissaBits = 23;
+    break;
+  }
+  const int bias = (1 << (expBits - 1)) - 1;
+  const int maxExp = (1 << expBits) - 1;
+
+  int exp;
+  switch ((r >> 28) % 8) {
+  case 0:
+    exp = 0;
+    break;
+  case 1:
+    exp = maxExp;
+    break;
+  default:
+    exp = 1 + (r >> 1) % (maxExp - 1);
+    break;
+  }
+  uint32 mantissa = (r >> 8) & ((1U << mantissaBits) - 1U);
+  if (exp == maxExp && mantissa != 0)
+    mantissa |= 1U << (mantissaBits - 1);
+
+  uint32 bits;
+  if (exp == maxExp) {
+    bits = (0xFFU << 23) | (mantissa << (23 - mantissaBits));
+  } else {
+    const float f = exp == 0
+                        ? std::ldexp(static_cast<float>(mantissa),
+                                     1 - bias - mantissaBits)
+                        : std::ldexp(1.0F + std::ldexp(static_cast<float>(
+                                                           mantissa),
+                                                       -mantissaBits),
+                                     exp - bias);
+    memcpy(&bits, &f, sizeof(bits));
+  }
+  *expected = (static_cast<uint32>(sign) << 31) | bits;
+
+  return (static_cast<uint32>(sign) << (8 * bytesps - 1)) |
+         (static_cast<uint32>(exp) << mantissaBits) | mantissa;
+}
+
+using DeflateType = std::tuple<int, int>;
+class DeflateDecompressorTest : public ::testing::TestWithParam<DeflateType> {
+protected:
+  DeflateDecompressorTest() = default;
+  virtual void SetUp() {
+    bps = std::get<0>(GetParam());
+    predictor = std::get<1>(GetParam());
+  }
+
+  // The tile, as the planes of the value bytes with the deltas, compressed.
+  std::vector<uchar8> encode(const std::vector<uint32>& values,
+                             int tileWidth) const {
+    const int bytesps = bps / 8;
+    const int factor = predictor == 3 ? 1 : predictor == 34894 ? 2 : 4;
+    const int rowSize = tileWidth * bytesps;
+    const int height = values.size() / tileWidth;
+
+    std::vector<uchar8> planes(rowSize * height);
+    for (int y = 0; y < height; y++) {
+      uchar8* row = &planes[y * rowSize];
+      for (int x = 0; x < tileWidth; x++) {
+        for (int b = 0; b < bytesps; b++) {
+          row[x + tileWidth * b] =
+              values[y * tileWidth + x] >> (8 * (bytesps - 1 - b));
+        }
+      }
+      for (int col = rowSize - 1; col >= factor; col--)
+        row[col] = row[col] - row[col - factor];
+    }
+
+    uLongf size = compressBound(planes.size());
+    std::vector<uchar8> compressed(size);
+    EXPECT_EQ(compress(compressed.data(), &size, planes.data(), planes.size()),
+              Z_OK);
+    compressed.resize(size);
+    return compressed;
+  }
+
+  int bps;
+  int predictor;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Predictors, DeflateDecompressorTest,
+    ::testing::Combine(::testing::Values(16, 24, 32),
+                       ::testing::Values(3, 34894, 34895)));
+
+TEST_P(DeflateDecompressorTest, Decode) {
+  // The image is cropped in the tile, and the rows are not a whole number of
+  // the SIMD vectors long.
+  const int tileWidth = 75;
+  const int tileHeight = 6;
+  const iPoint2D dim(71, 5);
+  const iPoint2D offset(2, 1);
+
+  std::vector<uint32> values(tileWidth * tileHeight);
+  std::vector<uint32> expected(values.size());
+  uint32 random = 1;
+  for (size_t i = 0; i < values.size(); i++)
+    values[i] = randomValue(&random, bps / 8, &expected[i]);
+
+  const auto compressed = encode(values, tileWidth);
+  const ByteStream bs(DataBuffer(Buffer(compressed.data(), compressed.size()),
+                                 Endianness::little));
+
+  RawImage mRaw = RawImage::create({dim.x + offset.x, dim.y + offset.y},
+                                   rawspeed::TYPE_FLOAT32, 1);
+  // The state of the thread is reused for the following tiles.
+  DeflateDecompressor::ThreadState state;
+  for (int tile = 0; tile < 3; tile++) {
+    mRaw->clearArea({{0, 0}, mRaw->dim});
+    DeflateDecompressor d(bs, mRaw, predictor, bps);
+    d.decode(&state, tileWidth, tileHeight, dim.x, dim.y, offset.x, offset.y);
+
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const uint32*>(
+          mRaw->getData(offset.x, offset.y + y));
+      for (int x = 0; x < dim.x; x++)
+        ASSERT_EQ(row[x], expected[y * tileWidth + x]) << x << " " << y;
+    }
+  }
+}
+
+TEST_P(DeflateDecompressorTest, Truncated) {
+  const int tileWidth = 16;
+  const int tileHeight = 4;
+
+  std::vector<uint32> values(tileWidth * (tileHeight - 1));
+  std::vector<uint32> unused(values.size());
+  uint32 random = 1;
+  for (size_t i = 0; i < values.size(); i++)
+    values[i] = randomValue(&random, bps / 8, &unused[i]);
+
+  const auto compressed = encode(values, tileWidth);
+  const ByteStream bs(DataBuffer(Buffer(compressed.data(), compressed.size()),
+                                 Endianness::little));
+
+  RawImage mRaw =
+      RawImage::create({tileWidth, tileHeight}, rawspeed::TYPE_FLOAT32, 1);
+  DeflateDecompressor d(bs, mRaw, predictor, bps);
+  DeflateDecompressor::ThreadState state;
+  ASSERT_THROW(
+      d.decode(&state, tileWidth, tileHeight, tileWidth, tileHeight, 0, 0),
+      RawspeedException);
+}
+
+} // namespace rawspeed_test
+
+#endif
@@ -0,0 +1,219 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/HasselbladDecompressor.h" // for HasselbladDecomp...
+#include "common/Common.h"                        // for uchar8, ushort16
+#include "common/Executor.h"                      // for setExecutor, Th...
+#include "common/Point.h"                         // for iPoint2D
+#include "common/RawImage.h"                      // for RawImage, RawIm...
+#include "common/RawspeedException.h"             // for RawspeedException
+#include "io/Buffer.h"                            // for Buffer, DataBuffer
+#include "io/ByteStream.h"                        // for ByteStream
+#include "io/Endianness.h"                        // for Endianness
+#include <array>                                  // for array
+#include <gtest/gtest.h>                          // for ParamIteratorIn...
+#include <memory>                                 // for make_shared
+#include <utility>                                // for pair
+#include <vector>                                 // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::HasselbladDecompressor;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// MSB first, in little-endian 32-bit words, the way BitPumpMSB32 reads them.
+class BitWriterMSB32 {
+  std::vector<uchar8>* out;
+  uint32 cache = 0;
+  int fill = 0;
+
+public:
+  explicit BitWriterMSB32(std::vector<uchar8>* out_) : out(out_) {}
+
+  void put(uint32 bits, int len) {
+    for (int i = len - 1; i >= 0; i--) {
+      cache = (cache << 1) | ((bits >> i) & 1U);
+      if (++fill == 32) {
+        for (int b = 0; b < 32; b += 8)
+          out->emplace_back(cache >> b);
+        cache = 0;
+        fill = 0;
+      }
+    }
+  }
+
+  ~BitWriterMSB32() {
+    if (fill)
+      put(0, 32 - fill);
+  }
+};
+
+// The number of codes per length. The lengths 0 to 16 of the differences,
+// in order, with the ones of 14 bits and more having the codes longer than
+// the 12 bits that the pairs of codes are looked up with.
+static const std::array<uchar8, 16> ncpl = {
+    {0, 2, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0}};
+
+// The canonical code of the symbol, from the number of codes per length.
+static std::pair<uint32, int> getCode(int symbol) {
+  uint32 code = 0;
+  for (int l = 1; l <= 16; l++) {
+    if (symbol < ncpl[l - 1])
+      return {code + symbol, l};
+    symbol -= ncpl[l - 1];
+    code = (code + ncpl[l - 1]) << 1;
+  }
+  return {0, 0};
+}
+
+class HasselbladDecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  HasselbladDecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    const auto put8 = [this](int v) { input.emplace_back(v); };
+    const auto put16 = [&put8](int v) {
+      put8(v >> 8);
+      put8(v & 0xFF);
+    };
+
+    put16(0xFFD8); // SOI
+
+    put16(0xFFC4); // DHT
+    put16(2 + 1 + 16 + 17);
+    put8(0x00);
+    for (const auto n : ncpl)
+      put8(n);
+    for (int i = 0; i <= 16; i++)
+      put8(i);
+
+    put16(0xFFC3); // SOF3
+    put16(8 + 3);
+    put8(16);
+    put16(dim.y);
+    put16(dim.x);
+    put8(1);
+    put8(1);
+    put8(0x11);
+    put8(0);
+
+    put16(0xFFDA); // SOS
+    put16(6 + 2);
+    put8(1);
+    put8(1);
+    put8(0x00);
+    put8(1); // predictor
+    put8(0);
+    put8(0); // point transform
+
+    {
+      BitWriterMSB32 w(&input);
+      uint32 random = 1;
+      const auto next = [&random](int n) {
+        random = random * 1103515245U + 12345U;
+        return static_cast<int>((random >> 8) % n);
+      };
+
+      for (int y = 0; y < dim.y; y++) {
+        std::array<int, 2> pred = {
+            {0x8000 + pixelBaseOffset, 0x8000 + pixelBaseOffset}};
+        for (int x = 0; x < dim.x; x += 2) {
+          // Mostly the short codes, which get looked up as pairs.
+          std::array<int, 2> lens;
+          std::array<uint32, 2> bits;
+          for (int i = 0; i < 2; i++) {
+            lens[i] = next(4) ? next(5) : next(17);
+            bits[i] = next(1 << lens[i]);
+            const auto code = getCode(lens[i]);
+            w.put(code.first, code.second);
+          }
+          for (int i = 0; i < 2; i++) {
+            const int l = lens[i];
+            w.put(bits[i], l);
+            int diff = 0;
+            if (l)
+              diff = bits[i] >> (l - 1) ? bits[i] : bits[i] - (1 << l) + 1;
+            if (diff == 65535)
+              diff = -32768;
+            pred[i] += diff;
+            expected.emplace_back(pred[i]);
+          }
+        }
+      }
+    }
+
+    put16(0xFFD9); // EOI
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  void decode(RawImage mRaw) const {
+    HasselbladDecompressor h(
+        ByteStream(DataBuffer(Buffer(input.data(), input.size()),
+                              Endianness::big)),
+        mRaw);
+    h.decode(pixelBaseOffset);
+  }
+
+  static constexpr iPoint2D dim = {38, 7};
+  static constexpr int pixelBaseOffset = -3;
+  std::vector<uchar8> input;
+  std::vector<ushort16> expected;
+};
+
+constexpr iPoint2D HasselbladDecompressorTest::dim;
+constexpr int HasselbladDecompressorTest::pixelBaseOffset;
+
+// Serially and with the rows found up front.
+INSTANTIATE_TEST_CASE_P(Threads, HasselbladDecompressorTest,
+                        ::testing::Values(1, 3));
+
+TEST_P(HasselbladDecompressorTest, Decode) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  decode(mRaw);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+TEST_P(HasselbladDecompressorTest, BadCode) {
+  // Past the DHT, SOF3 and SOS, the first 32 bits of the scan are all ones,
+  // which is not a code.
+  for (int i = 0; i < 4; i++)
+    input[2 + 38 + 13 + 10 + i] = 0xFF;
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_THROW(decode(mRaw), RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,80 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/HuffmanTableCache.h" // for getSetUpHuffmanTable
+#include "common/Common.h"                   // for uchar8
+#include "decompressors/HuffmanTable.h"      // for HuffmanTable
+#include "io/BitPumpMSB.h"                   // for BitPumpMSB
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness
+#include <array>                             // for array
+#include <gtest/gtest.h>                     // for Message, TestPartResult
+#include <memory>                            // for shared_ptr
+
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::getSetUpHuffmanTable;
+using rawspeed::HuffmanTable;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+// Codes 0, 10, 110, 111 for the differences of 0, 1, 2 and 3 bits.
+static HuffmanTable getTable(uchar8 lastValue = 3) {
+  static const std::array<uchar8, 16> ncpl{{1, 1, 2}};
+  const std::array<uchar8, 4> values{{0, 1, 2, lastValue}};
+
+  HuffmanTable ht;
+  ht.setNCodesPerLength(Buffer(ncpl.data(), ncpl.size()));
+  ht.setCodeValues(Buffer(values.data(), values.size()));
+  return ht;
+}
+
+TEST(HuffmanTableCacheTest, SameCodesShareTheTable) {
+  const auto a = getSetUpHuffmanTable(getTable(), true, false);
+  const auto b = getSetUpHuffmanTable(getTable(), true, false);
+  ASSERT_EQ(a, b);
+}
+
+TEST(HuffmanTableCacheTest, DifferentCodesOrSetup) {
+  const auto a = getSetUpHuffmanTable(getTable(), true, false);
+  ASSERT_NE(a, getSetUpHuffmanTable(getTable(4), true, false));
+  ASSERT_NE(a, getSetUpHuffmanTable(getTable(), false, false));
+  ASSERT_NE(a, getSetUpHuffmanTable(getTable(), true, true));
+}
+
+TEST(HuffmanTableCacheTest, IsSetUp) {
+  // 110 11, 0, 10 1, 111 010
+  static const std::array<uchar8, 8> data{{0b11011010, 0b11110100}};
+  BitPumpMSB bits(ByteStream(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little)));
+
+  const auto ht = getSetUpHuffmanTable(getTable(), true, false);
+  ASSERT_EQ(ht->decodeNext(bits), 3);
+  ASSERT_EQ(ht->decodeNext(bits), 0);
+  ASSERT_EQ(ht->decodeNext(bits), 1);
+  ASSERT_EQ(ht->decodeNext(bits), -5);
+}
+
+} // namespace rawspeed_test
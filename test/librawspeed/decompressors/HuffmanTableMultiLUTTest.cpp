@@ -0,0 +1,133 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/HuffmanTableMultiLUT.h" // for HuffmanTableMultiLUT
+#include "common/Common.h"                      // for uchar8, uint64
+#include "decompressors/HuffmanTableLUT.h"      // for HuffmanTableLUT
+#include "io/BitPumpMSB.h"                      // for BitPumpMSB
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, Endianne...
+#include <gtest/gtest.h>                        // for ParamIteratorInterface
+#include <ostream>                              // for operator<<, ostream
+#include <tuple>                                // for get, tuple
+#include <vector>                               // for vector
+
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::HuffmanTableLUT;
+using rawspeed::HuffmanTableMultiLUT;
+using rawspeed::uchar8;
+using rawspeed::uint64;
+
+namespace rawspeed_test {
+
+struct Table final {
+  std::vector<uchar8> nCodesPerLength;
+  std::vector<uchar8> codeValues;
+};
+
+::std::ostream& operator<<(::std::ostream& os, const Table& t) {
+  return os << "(" << t.codeValues.size() << " codes)";
+}
+
+// All of these are complete, so any data decodes without errors.
+static const Table tables[] = {
+    // The JPEG luminance DC table, with one more code of length 9 for 16.
+    {{0, 1, 5, 1, 1, 1, 1, 1, 2}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 16}},
+    // Only short codes and diffs, so a lookup usually has MaxSymbols of them.
+    {{0, 4}, {0, 1, 2, 3}},
+    // The Nikon 12-bit lossless table, which is not complete. Its missing
+    // 12-bit code is replaced by one of length 11.
+    {{0, 1, 5, 1, 1, 1, 1, 1, 1, 2},
+     {5, 4, 3, 6, 2, 7, 1, 0, 8, 9, 11, 10, 12}},
+};
+
+static uint64 getBitPosition(const BitPumpMSB& bits) {
+  return 8 * bits.getBufferPosition() - bits.getFillLevel() % 8;
+}
+
+class HuffmanTableMultiLUTTest
+    : public ::testing::TestWithParam<std::tuple<Table, int>> {
+protected:
+  HuffmanTableMultiLUTTest() = default;
+  virtual void SetUp() {
+    const Table& t = std::get<0>(GetParam());
+    n = std::get<1>(GetParam());
+
+    for (auto* ht : {static_cast<rawspeed::AbstractHuffmanTable*>(&single),
+                     static_cast<rawspeed::AbstractHuffmanTable*>(&multi)}) {
+      std::vector<uchar8> nCodesPerLength(t.nCodesPerLength);
+      nCodesPerLength.resize(16);
+      ht->setNCodesPerLength(Buffer(nCodesPerLength.data(), 16));
+      ht->setCodeValues(Buffer(t.codeValues.data(), t.codeValues.size()));
+    }
+    single.setup(true, false);
+    multi.setup(true, false);
+
+    unsigned random = 1;
+    data.resize(4096);
+    for (auto& d : data) {
+      random = random * 1103515245U + 12345U;
+      d = random >> 16;
+    }
+  }
+
+  HuffmanTableLUT single;
+  HuffmanTableMultiLUT multi;
+  std::vector<uchar8> data;
+  int n;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Tables, HuffmanTableMultiLUTTest,
+    ::testing::Combine(::testing::ValuesIn(tables),
+                       ::testing::Values(1, 2, 3, 4, 7, 64)));
+
+TEST_P(HuffmanTableMultiLUTTest, SameAsDecodeNext) {
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+  BitPumpMSB expected(bs);
+  BitPumpMSB actual(bs);
+
+  // With at most 25 bits per difference, this stays within the data.
+  std::vector<int> diffs(n);
+  for (int i = 0; i + n <= 1024; i += n) {
+    multi.decodeDifferences(actual, diffs.data(), n);
+    for (int diff : diffs)
+      ASSERT_EQ(diff, single.decodeNext(expected));
+    ASSERT_EQ(getBitPosition(actual), getBitPosition(expected));
+  }
+}
+
+TEST_P(HuffmanTableMultiLUTTest, DecodeNext) {
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+  BitPumpMSB expected(bs);
+  BitPumpMSB actual(bs);
+
+  for (int i = 0; i < 1024; i++)
+    ASSERT_EQ(multi.decodeNext(actual), single.decodeNext(expected));
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,126 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "decompressors/HuffmanTableTree.h" // for HuffmanTableTree
+#include "common/Common.h"                  // for uchar8, uint64
+#include "common/RawspeedException.h"       // for RawspeedException
+#include "decompressors/HuffmanTableLUT.h"  // for HuffmanTableLUT
+#include "io/BitPumpMSB.h"                  // for BitPumpMSB
+#include "io/Buffer.h"                      // for Buffer, DataBuffer
+#include "io/ByteStream.h"                  // for ByteStream
+#include "io/Endianness.h"                  // for Endianness, Endianness::...
+#include <gtest/gtest.h>                    // for ParamIteratorInterface
+#include <ostream>                          // for operator<<, ostream
+#include <vector>                           // for vector
+
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::HuffmanTableLUT;
+using rawspeed::HuffmanTableTree;
+using rawspeed::RawspeedException;
+using rawspeed::uchar8;
+using rawspeed::uint64;
+
+namespace rawspeed_test {
+
+struct Table final {
+  std::vector<uchar8> nCodesPerLength;
+  std::vector<uchar8> codeValues;
+};
+
+::std::ostream& operator<<(::std::ostream& os, const Table& t) {
+  return os << "(" << t.codeValues.size() << " codes)";
+}
+
+// All of these are complete, so any data decodes without errors.
+static const Table tables[] = {
+    // The JPEG luminance DC table, with one more code of length 9 for 16.
+    {{0, 1, 5, 1, 1, 1, 1, 1, 2}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 16}},
+    // Codes of one bit only.
+    {{2}, {0, 1}},
+    // One code of each length, so there are tables down to the 16th bit.
+    {{1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2},
+     {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16}},
+};
+
+static uint64 getBitPosition(const BitPumpMSB& bits) {
+  return 8 * bits.getBufferPosition() - bits.getFillLevel() % 8;
+}
+
+template <typename T> static void setup(T* ht, const Table& t) {
+  std::vector<uchar8> nCodesPerLength(t.nCodesPerLength);
+  nCodesPerLength.resize(16);
+  ht->setNCodesPerLength(Buffer(nCodesPerLength.data(), 16));
+  ht->setCodeValues(Buffer(t.codeValues.data(), t.codeValues.size()));
+  ht->setup(true, false);
+}
+
+class HuffmanTableTreeTest : public ::testing::TestWithParam<Table> {
+protected:
+  HuffmanTableTreeTest() = default;
+  virtual void SetUp() {
+    setup(&lut, GetParam());
+    setup(&tree, GetParam());
+
+    unsigned random = 1;
+    data.resize(4096);
+    for (auto& d : data) {
+      random = random * 1103515245U + 12345U;
+      d = random >> 16;
+    }
+  }
+
+  HuffmanTableLUT lut;
+  HuffmanTableTree tree;
+  std::vector<uchar8> data;
+};
+
+INSTANTIATE_TEST_CASE_P(Tables, HuffmanTableTreeTest,
+                        ::testing::ValuesIn(tables));
+
+TEST_P(HuffmanTableTreeTest, SameAsLUT) {
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+  BitPumpMSB expected(bs);
+  BitPumpMSB actual(bs);
+
+  // With at most 32 bits per difference, this stays within the data.
+  for (int i = 0; i < 1024; i++) {
+    ASSERT_EQ(tree.decodeNext(actual), lut.decodeNext(expected));
+    ASSERT_EQ(getBitPosition(actual), getBitPosition(expected));
+  }
+}
+
+TEST(HuffmanTableTreeBadCodeTest, Throws) {
+  // Only the code 0, of one bit.
+  HuffmanTableTree ht;
+  setup(&ht, {{1}, {0}});
+
+  const std::vector<uchar8> data(8, 0xFF);
+  BitPumpMSB bits(ByteStream(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little)));
+  ASSERT_THROW(ht.decodeNext(bits), RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,124 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/HuffmanTableTuner.h" // for HuffmanTableBackend
+#include "common/Common.h"                   // for uchar8
+#include "common/RawspeedException.h"        // for RawspeedException
+#include "decompressors/HuffmanTable.h"      // for HuffmanTable
+#include "io/Buffer.h"                       // for Buffer
+#include <array>                             // for array
+#include <cstring>                           // for strcmp
+#include <gtest/gtest.h>                     // for Message, TestPartResult
+#include <type_traits>                       // for is_same
+
+using rawspeed::BasicHuffmanTableLUT;
+using rawspeed::Buffer;
+using rawspeed::dispatchHuffmanTable;
+using rawspeed::getHuffmanTableBackend;
+using rawspeed::getHuffmanTableBackendName;
+using rawspeed::HuffmanTable;
+using rawspeed::HuffmanTableBackend;
+using rawspeed::HuffmanTableLookup;
+using rawspeed::HuffmanTableTree;
+using rawspeed::HuffmanTableVector;
+using rawspeed::RawspeedException;
+using rawspeed::selectHuffmanTableBackend;
+using rawspeed::setHuffmanTableBackend;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+template <typename T>
+static void checkDispatch(HuffmanTableBackend backend) {
+  int calls = 0;
+  dispatchHuffmanTable(backend, [&calls](auto type) {
+    calls++;
+    ASSERT_TRUE((std::is_same<typename decltype(type)::type, T>::value));
+  });
+  ASSERT_EQ(calls, 1);
+}
+
+TEST(HuffmanTableTunerTest, Dispatch) {
+  checkDispatch<BasicHuffmanTableLUT<9>>(HuffmanTableBackend::LUT9);
+  checkDispatch<BasicHuffmanTableLUT<11>>(HuffmanTableBackend::LUT11);
+  checkDispatch<BasicHuffmanTableLUT<13>>(HuffmanTableBackend::LUT13);
+  checkDispatch<HuffmanTableLookup>(HuffmanTableBackend::Lookup);
+  checkDispatch<HuffmanTableTree>(HuffmanTableBackend::Tree);
+  checkDispatch<HuffmanTableVector>(HuffmanTableBackend::Vector);
+
+  ASSERT_THROW(dispatchHuffmanTable(HuffmanTableBackend::Auto,
+                                    [](auto /*type*/) { FAIL(); }),
+               RawspeedException);
+}
+
+TEST(HuffmanTableTunerTest, Names) {
+  ASSERT_STREQ(getHuffmanTableBackendName(HuffmanTableBackend::Auto), "Auto");
+  ASSERT_STREQ(getHuffmanTableBackendName(HuffmanTableBackend::LUT11),
+               "LUT11");
+  ASSERT_STREQ(getHuffmanTableBackendName(HuffmanTableBackend::Vector),
+               "Vector");
+}
+
+class HuffmanTableTunerSelectTest : public ::testing::TestWithParam<bool> {
+protected:
+  HuffmanTableTunerSelectTest() = default;
+  virtual void SetUp() {
+    fullDecode = GetParam();
+
+    // The JPEG luminance DC table, which is not complete.
+    static const std::array<uchar8, 16> nCodesPerLength = {
+        {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0}};
+    static const std::array<uchar8, 12> codeValues = {
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}};
+
+    const auto count =
+        ht.setNCodesPerLength(Buffer(nCodesPerLength.data(), 16));
+    ht.setCodeValues(Buffer(codeValues.data(), count));
+  }
+  virtual void TearDown() { setHuffmanTableBackend(HuffmanTableBackend::Auto); }
+
+  HuffmanTable ht;
+  bool fullDecode;
+};
+
+INSTANTIATE_TEST_CASE_P(FullDecode, HuffmanTableTunerSelectTest,
+                        ::testing::Bool());
+
+TEST_P(HuffmanTableTunerSelectTest, AutoIsTunedOnce) {
+  ASSERT_EQ(getHuffmanTableBackend(), HuffmanTableBackend::Auto);
+
+  const auto backend = selectHuffmanTableBackend(ht, fullDecode, false);
+  ASSERT_NE(backend, HuffmanTableBackend::Auto);
+
+  // The result is remembered, the timings are not redone.
+  for (int i = 0; i < 3; i++)
+    ASSERT_EQ(selectHuffmanTableBackend(ht, fullDecode, false), backend);
+}
+
+TEST_P(HuffmanTableTunerSelectTest, Forced) {
+  for (auto backend : {HuffmanTableBackend::LUT9, HuffmanTableBackend::Tree,
+                       HuffmanTableBackend::Vector}) {
+    setHuffmanTableBackend(backend);
+    ASSERT_EQ(getHuffmanTableBackend(), backend);
+    ASSERT_EQ(selectHuffmanTableBackend(ht, fullDecode, false), backend);
+  }
+}
+
+} // namespace rawspeed_test
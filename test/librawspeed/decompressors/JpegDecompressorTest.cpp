@@ -0,0 +1,153 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h" // for HAVE_JPEG, HAVE_JPEG_MEM_SRC
+
+#if defined(HAVE_JPEG) && defined(HAVE_JPEG_MEM_SRC)
+
+#include "decompressors/JpegDecompressor.h" // for JpegDecompressor
+#include "common/Common.h"                  // for uchar8, ushort16
+#include "common/Point.h"                   // for iPoint2D
+#include "common/RawImage.h"                // for RawImage, RawImageData
+#include "common/RawspeedException.h"       // for RawspeedException
+#include "io/Buffer.h"                      // for Buffer, DataBuffer
+#include "io/ByteStream.h"                  // for ByteStream
+#include "io/Endianness.h"                  // for Endianness
+#include <cstdio>                           // for size_t
+#include <cstdlib>                          // for free
+#include <gtest/gtest.h>                    // for TestWithParam, ASSERT_EQ
+#include <jpeglib.h>                        // for jpeg_compress_struct
+#include <vector>                           // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::JpegDecompressor;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// A smooth image, as one lossy JPEG.
+static std::vector<uchar8> encode(const iPoint2D& dim, int cpp, int seed) {
+  std::vector<uchar8> pixels(dim.area() * cpp);
+  for (int y = 0; y < dim.y; y++) {
+    for (int x = 0; x < dim.x * cpp; x++)
+      pixels[(y * dim.x * cpp) + x] = (x + y + seed) / 2;
+  }
+
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+
+  unsigned char* out = nullptr;
+  unsigned long outSize = 0;
+  jpeg_mem_dest(&cinfo, &out, &outSize);
+
+  cinfo.image_width = dim.x;
+  cinfo.image_height = dim.y;
+  cinfo.input_components = cpp;
+  cinfo.in_color_space = cpp == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 100, static_cast<boolean>(true));
+  jpeg_start_compress(&cinfo, static_cast<boolean>(true));
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = &pixels[static_cast<size_t>(cinfo.next_scanline) * dim.x *
+                           cpp];
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  std::vector<uchar8> data(out, out + outSize);
+  free(out); // NOLINT
+  return data;
+}
+
+class JpegDecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  JpegDecompressorTest() = default;
+  virtual void SetUp() { cpp = GetParam(); }
+
+  int cpp;
+};
+
+INSTANTIATE_TEST_CASE_P(Components, JpegDecompressorTest,
+                        ::testing::Values(1, 3));
+
+// With the one context for all of the tiles, also after a broken one, and
+// with the last tile cut off by the image edges.
+TEST_P(JpegDecompressorTest, ReusedContext) {
+  const iPoint2D tile(48, 40);
+  const iPoint2D dim(tile.x + 21, tile.y + 13);
+
+  std::vector<std::vector<uchar8>> tiles;
+  for (int seed : {0, 100, 200})
+    tiles.emplace_back(encode(tile, cpp, seed));
+  std::vector<uchar8> broken(tiles[0].begin(),
+                             tiles[0].begin() + tiles[0].size() / 3);
+
+  const auto stream = [](const std::vector<uchar8>& data) {
+    return ByteStream(
+        DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+  };
+
+  // Each tile on its own.
+  RawImage expected = RawImage::create(dim, rawspeed::TYPE_USHORT16, cpp);
+  JpegDecompressor(stream(tiles[0]), expected).decode(0, 0);
+  JpegDecompressor(stream(tiles[1]), expected).decode(tile.x, 0);
+  JpegDecompressor(stream(tiles[2]), expected).decode(tile.x, tile.y);
+
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, cpp);
+  JpegDecompressor::Context context;
+  JpegDecompressor(stream(tiles[0]), mRaw).decode(&context, 0, 0);
+  ASSERT_THROW(JpegDecompressor(stream(broken), mRaw).decode(&context, 0, 0),
+               RawspeedException);
+  JpegDecompressor(stream(tiles[0]), mRaw).decode(&context, 0, 0);
+  JpegDecompressor(stream(tiles[1]), mRaw).decode(&context, tile.x, 0);
+  JpegDecompressor(stream(tiles[2]), mRaw).decode(&context, tile.x, tile.y);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    const auto* exp =
+        reinterpret_cast<const ushort16*>(expected->getData(0, y));
+    for (int x = 0; x < dim.x * cpp; x++) {
+      if (y >= tile.y && x < tile.x * cpp)
+        continue; // the bottom left tile is not there
+      ASSERT_EQ(row[x], exp[x]) << x << " " << y;
+    }
+  }
+
+  // And the decoded values are close to the original ones.
+  for (int y = 0; y < tile.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < tile.x * cpp; x++)
+      ASSERT_NEAR(row[x], (x + y) / 2, 8) << x << " " << y;
+  }
+}
+
+} // namespace rawspeed_test
+
+#endif
@@ -0,0 +1,176 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/KodakDecompressor.h" // for KodakDecompressor
+#include "common/Common.h"                   // for uchar8, ushort16, uint32
+#include "common/Executor.h"                 // for setExecutor, ThreadPoo...
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "common/RawspeedException.h"        // for RawspeedException
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness
+#include <algorithm>                         // for min
+#include <array>                             // for array
+#include <cstdlib>                           // for abs
+#include <gtest/gtest.h>                     // for ParamIteratorInterface
+#include <memory>                            // for make_shared
+#include <vector>                            // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::KodakDecompressor;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::uint64;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The bits of the differences, least significant first, in the chunks of
+// either one or two big-endian 16-bit words, the way the decoder reads them.
+class KodakSegmentWriter {
+  std::vector<uchar8>* out;
+  uint64 chunk = 0;
+  int size = 0; // of the chunk, in bits
+  int pos = 0;  // within the chunk
+
+  void flush() {
+    for (int i = 0; i < size; i += 16) {
+      out->emplace_back(chunk >> (i + 8));
+      out->emplace_back(chunk >> i);
+    }
+    chunk = 0;
+  }
+
+public:
+  KodakSegmentWriter(std::vector<uchar8>* out_, int pixels) : out(out_) {
+    if ((pixels & 7) == 4)
+      size = 16;
+  }
+  ~KodakSegmentWriter() { flush(); }
+
+  void put(uint32 value, int len) {
+    if (size - pos < len) {
+      const int r = size - pos;
+      chunk |= static_cast<uint64>(value & ((1U << r) - 1U)) << pos;
+      flush();
+      value >>= r;
+      len -= r;
+      size = 32;
+      pos = 0;
+    }
+    chunk |= static_cast<uint64>(value) << pos;
+    pos += len;
+  }
+};
+
+class KodakDecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  KodakDecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    // Random values, each coded as the difference to the previous one of
+    // the same parity within the segment.
+    uint32 random = 1;
+    for (int y = 0; y < dim.y; y++) {
+      for (int x = 0; x < dim.x; x += 256) {
+        const int n = std::min(256, dim.x - x);
+        std::array<int, 2> pred{{}};
+        std::vector<uint32> codes;
+        std::vector<int> lens;
+        for (int i = 0; i < n; i++) {
+          random = random * 1103515245U + 12345U;
+          // Mostly small differences, with some larger ones.
+          int value = (random >> 16) % (1 << bps);
+          if (i % 5 != 0) {
+            value = pred[i & 1] + (int(random >> 8) & 63) - 32;
+            value = std::min(std::max(value, 0), (1 << bps) - 1);
+          }
+          expected.emplace_back(value);
+
+          const int diff = value - pred[i & 1];
+          pred[i & 1] = value;
+          int len = 0;
+          while ((std::abs(diff) >> len) != 0)
+            len++;
+          lens.emplace_back(len);
+          codes.emplace_back(diff >= 0 ? diff : diff + (1 << len) - 1);
+        }
+
+        for (int i = 0; i < n; i += 2)
+          input.emplace_back(lens[i] | lens[i + 1] << 4);
+        KodakSegmentWriter w(&input, n);
+        for (int i = 0; i < n; i++)
+          w.put(codes[i], lens[i]);
+      }
+    }
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  void decode(RawImage mRaw) const {
+    KodakDecompressor k(mRaw,
+                        ByteStream(DataBuffer(
+                            Buffer(input.data(), input.size()),
+                            Endianness::little)),
+                        bps, true);
+    k.decompress();
+  }
+
+  // Not a whole number of the segments of 256 pixels, with the last one
+  // starting with the 16-bit chunk.
+  static constexpr iPoint2D dim = {556, 9};
+  static constexpr int bps = 12;
+  std::vector<uchar8> input;
+  std::vector<ushort16> expected;
+};
+
+constexpr iPoint2D KodakDecompressorTest::dim;
+constexpr int KodakDecompressorTest::bps;
+
+INSTANTIATE_TEST_CASE_P(Threads, KodakDecompressorTest,
+                        ::testing::Values(1, 3));
+
+TEST_P(KodakDecompressorTest, Decode) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  decode(mRaw);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+TEST_P(KodakDecompressorTest, Truncated) {
+  input.resize(input.size() - 1);
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_THROW(decode(mRaw), RawspeedException);
+}
+
+} // namespace rawspeed_test
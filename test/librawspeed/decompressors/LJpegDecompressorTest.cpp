@@ -0,0 +1,279 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/LJpegDecompressor.h" // for LJpegDecompressor
+#include "common/Common.h"                   // for uchar8, ushort16
+#include "common/Executor.h"                 // for setExecutor, ThreadPoo...
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness, Endianness::big
+#include <cstdlib>                           // for abs
+#include <gtest/gtest.h>                     // for ParamIteratorInterface, M...
+#include <cstdint>                           // for int64_t
+#include <memory>                            // for make_shared
+#include <tuple>                             // for get, tuple
+#include <vector>                            // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::LJpegDecompressor;
+using rawspeed::getMinTaskWork;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::setMinTaskWork;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// A minimal LJpeg encoder, producing the DNG layout: one frame row of cps
+// components per image row, with the predictor 1.
+class LJpegWriter final {
+  std::vector<uchar8> out;
+  unsigned bits = 0;
+  int fillLevel = 0;
+
+  void put8(int v) { out.emplace_back(v); }
+  void put16(int v) {
+    put8(v >> 8);
+    put8(v & 0xFF);
+  }
+
+  void putBits(unsigned v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+      bits = (bits << 1) | ((v >> i) & 1);
+      if (++fillLevel != 8)
+        continue;
+      put8(bits);
+      if (bits == 0xFF)
+        put8(0x00); // byte stuffing
+      bits = 0;
+      fillLevel = 0;
+    }
+  }
+
+  // Every category gets a 4-bit code, equal to the category.
+  void putDiff(int diff) {
+    int cat = 0;
+    while ((std::abs(diff) >> cat) != 0)
+      cat++;
+    putBits(cat, 4);
+    if (cat)
+      putBits(diff < 0 ? diff + (1 << cat) - 1 : diff, cat);
+  }
+
+public:
+  static constexpr int prec = 14;
+
+  // The samples are frameW * cps per row.
+  std::vector<uchar8> write(const std::vector<ushort16>& samples, int cps,
+                            int frameW, int height) {
+    const int pitch = frameW * cps;
+
+    put16(0xFFD8); // SOI
+
+    put16(0xFFC4); // DHT
+    put16(2 + 1 + 16 + 9);
+    put8(0x00);
+    for (int i = 0; i < 16; i++)
+      put8(i == 3 ? 9 : 0);
+    for (int i = 0; i < 9; i++)
+      put8(i);
+
+    put16(0xFFC3); // SOF3
+    put16(8 + 3 * cps);
+    put8(prec);
+    put16(height);
+    put16(frameW);
+    put8(cps);
+    for (int c = 0; c < cps; c++) {
+      put8(c + 1);
+      put8(0x11);
+      put8(0);
+    }
+
+    put16(0xFFDA); // SOS
+    put16(6 + 2 * cps);
+    put8(cps);
+    for (int c = 0; c < cps; c++) {
+      put8(c + 1);
+      put8(0x00);
+    }
+    put8(1); // predictor
+    put8(0);
+    put8(0); // point transform
+
+    std::vector<int> pred(cps, 1 << (prec - 1));
+    for (int row = 0; row < height; row++) {
+      for (int g = 0; g < frameW; g++) {
+        for (int c = 0; c < cps; c++) {
+          if (row > 0 && g == 0)
+            pred[c] = samples[(row - 1) * pitch + c];
+          const int v = samples[row * pitch + cps * g + c];
+          putDiff(v - pred[c]);
+          pred[c] = v;
+        }
+      }
+    }
+    while (fillLevel != 0)
+      putBits(1, 1);
+
+    put16(0xFFD9); // EOI
+    return out;
+  }
+};
+
+constexpr int LJpegWriter::prec;
+
+// The components per sample of the frame, the ones of the image, and the
+// tile width, in pixels.
+using LJpegType = std::tuple<int, int, int>;
+class LJpegDecompressorTest : public ::testing::TestWithParam<LJpegType> {
+protected:
+  LJpegDecompressorTest() = default;
+  virtual void SetUp() {
+    cps = std::get<0>(GetParam());
+    cpp = std::get<1>(GetParam());
+    width = std::get<2>(GetParam());
+  }
+
+  int cps;
+  int cpp;
+  int width;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Components, LJpegDecompressorTest,
+    ::testing::Values(LJpegType(1, 1, 37), LJpegType(2, 1, 40),
+                      LJpegType(2, 1, 21), LJpegType(3, 1, 30),
+                      LJpegType(3, 1, 31), LJpegType(4, 1, 64),
+                      LJpegType(4, 1, 35), LJpegType(3, 3, 13),
+                      LJpegType(4, 3, 11), LJpegType(2, 1, 1)));
+
+// The frame is wider than the tile, and the tile in a larger image.
+TEST_P(LJpegDecompressorTest, Decode) {
+  const int height = 7;
+  const int samplesW = cpp * width;
+  const int frameW = (samplesW + cps - 1) / cps + 2;
+  const int pitch = cps * frameW;
+
+  std::vector<ushort16> samples(pitch * height);
+  unsigned state = 1;
+  for (auto& v : samples) {
+    state = state * 1103515245U + 12345U;
+    // The differences stay below 256, within the categories of the table.
+    v = (1 << (LJpegWriter::prec - 1)) - 100 + (state >> 16) % 200;
+  }
+  const auto data = LJpegWriter().write(samples, cps, frameW, height);
+
+  const iPoint2D offset(2, 3);
+  RawImage mRaw = RawImage::create({width + offset.x + 3, height + offset.y},
+                                   rawspeed::TYPE_USHORT16, cpp);
+  LJpegDecompressor d(ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                                            Endianness::big)),
+                      mRaw);
+  d.decode(offset.x, offset.y, width, height, false);
+
+  for (int y = 0; y < height; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(
+        mRaw->getData(offset.x, offset.y + y));
+    for (int x = 0; x < samplesW; x++)
+      ASSERT_EQ(row[x], samples[y * pitch + x]) << x << " " << y;
+  }
+}
+
+class LJpegSpeculativeTest : public ::testing::TestWithParam<int> {
+protected:
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+    minTaskWork = getMinTaskWork();
+    setMinTaskWork(0);
+  }
+  virtual void TearDown() {
+    setMinTaskWork(minTaskWork);
+    setExecutor(nullptr);
+  }
+
+  int64_t minTaskWork;
+};
+
+INSTANTIATE_TEST_CASE_P(Components, LJpegSpeculativeTest,
+                        ::testing::Values(1, 2, 3, 4));
+
+// Several chunks of the data, that all have to get in sync, and the same
+// pixels as the serial decode.
+TEST_P(LJpegSpeculativeTest, SameAsSerial) {
+  const int cps = GetParam();
+  const int width = 780;
+  const int height = 501;
+  const int frameW = (width + cps - 1) / cps;
+  const int pitch = cps * frameW;
+
+  std::vector<ushort16> samples(pitch * height);
+  unsigned state = 1;
+  for (auto& v : samples) {
+    state = state * 1103515245U + 12345U;
+    v = (1 << (LJpegWriter::prec - 1)) - 100 + (state >> 16) % 200;
+  }
+  const auto data = LJpegWriter().write(samples, cps, frameW, height);
+  ASSERT_GT(data.size(), 256 * 1024);
+
+  for (bool speculative : {false, true}) {
+    RawImage mRaw =
+        RawImage::create({width, height}, rawspeed::TYPE_USHORT16, 1);
+    LJpegDecompressor d(
+        ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                              Endianness::big)),
+        mRaw);
+    d.speculative = speculative;
+    d.decode(0, 0, width, height, false);
+
+    for (int y = 0; y < height; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < width; x++)
+        ASSERT_EQ(row[x], samples[y * pitch + x]) << x << " " << y;
+    }
+  }
+}
+
+TEST(LJpegDecompressorMarkerTest, FindMarker) {
+  // Stuffed, fill, and a marker that is cut off at the end.
+  const std::vector<uchar8> data = {0x12, 0xFF, 0x00, 0xFF, 0xFF, 0xD3,
+                                    0x34, 0xFF, 0x00, 0xFF, 0xD9, 0xFF};
+  const auto find = [&data](unsigned pos) {
+    return LJpegDecompressor::findMarker(data.data(), data.size(), pos);
+  };
+
+  ASSERT_EQ(find(0), 4);
+  ASSERT_EQ(find(4), 4);
+  ASSERT_EQ(find(5), 9);
+  ASSERT_EQ(find(10), data.size());
+  ASSERT_EQ(find(data.size()), data.size());
+  ASSERT_EQ(LJpegDecompressor::findMarker(data.data(), 3, 0), 3);
+}
+
+} // namespace rawspeed_test
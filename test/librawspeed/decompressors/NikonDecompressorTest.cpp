@@ -0,0 +1,228 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/NikonDecompressor.h" // for NikonDecompressor
+#include "common/Common.h"                   // for uchar8, ushort16
+#include "common/Executor.h"                 // for setExecutor, ThreadPool...
+#include "common/Point.h"                    // for iPoint2D
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "common/RawspeedException.h"        // for RawspeedException
+#include "decompressors/HuffmanTableTuner.h" // for HuffmanTableBackend, set...
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness, Endianness:...
+#include <gtest/gtest.h>                     // for ParamIteratorInterface
+#include <memory>                            // for make_shared
+#include <vector>                            // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::HuffmanTableBackend;
+using rawspeed::iPoint2D;
+using rawspeed::NikonDecompressor;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::setHuffmanTableBackend;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class NikonDecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  NikonDecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    // All the used Huffman codes are complete, so any data decodes.
+    unsigned state = 1;
+    data.resize(32 * 1024);
+    for (auto& b : data) {
+      state = state * 1103515245U + 12345U;
+      b = state >> 24;
+    }
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  void put16(int v) {
+    metadata.emplace_back(v >> 8);
+    metadata.emplace_back(v & 0xFF);
+  }
+
+  // 12-bit lossless, no split.
+  void makeLosslessMetadata() {
+    metadata = {70, 0};
+    for (int i = 0; i < 4; i++)
+      put16(2048);
+    put16(0); // curve size
+  }
+
+  // 12-bit lossy, with a curve, and the Huffman table switch at row 'split'.
+  void makeLossyMetadata(int split) {
+    metadata = {68, 32};
+    for (int i = 0; i < 4; i++)
+      put16(2048);
+    put16(3); // curve size
+    for (int v : {0, 2000, 4000})
+      put16(v);
+    metadata.resize(562);
+    put16(split);
+  }
+
+  RawImage decode(int rowsPerCheckpoint, bool uncorrectedRawValues,
+                  int rows = height, bool pipelined = false) const {
+    RawImage mRaw = RawImage::create(iPoint2D(width, height));
+    mRaw->clearArea({{0, 0}, {width, height}}, 0xFF);
+
+    const Buffer m(metadata.data(), metadata.size());
+    NikonDecompressor n(mRaw, ByteStream(DataBuffer(m, Endianness::big)), 12);
+    n.pipelined = pipelined;
+
+    const Buffer b(data.data(), data.size());
+    const ByteStream bs(DataBuffer(b, Endianness::big));
+    if (!rowsPerCheckpoint)
+      n.decompressRows(bs, uncorrectedRawValues, rows);
+    else
+      n.decompress(bs, uncorrectedRawValues, n.scan(bs, rowsPerCheckpoint),
+                   rows);
+
+    return mRaw;
+  }
+
+  static std::vector<ushort16> pixels(const RawImage& mRaw) {
+    std::vector<ushort16> v;
+    for (int row = 0; row < height; row++) {
+      const auto* line =
+          reinterpret_cast<const ushort16*>(mRaw->getDataUncropped(0, row));
+      v.insert(v.end(), line, line + width);
+    }
+    return v;
+  }
+
+  void checkTwoPassMatchesSerial() const {
+    for (bool uncorrectedRawValues : {false, true}) {
+      const auto serial = pixels(decode(0, uncorrectedRawValues));
+      for (int rowsPerCheckpoint : {1, 3, 7, 16, 2 * height})
+        ASSERT_EQ(pixels(decode(rowsPerCheckpoint, uncorrectedRawValues)),
+                  serial);
+    }
+  }
+
+  static constexpr int width = 64;
+  static constexpr int height = 40;
+  std::vector<uchar8> metadata;
+  std::vector<uchar8> data;
+};
+
+constexpr int NikonDecompressorTest::width;
+constexpr int NikonDecompressorTest::height;
+
+INSTANTIATE_TEST_CASE_P(Threads, NikonDecompressorTest,
+                        ::testing::Values(1, 2, 5));
+
+TEST_P(NikonDecompressorTest, TwoPassLossless) {
+  makeLosslessMetadata();
+  checkTwoPassMatchesSerial();
+}
+
+TEST_P(NikonDecompressorTest, TwoPassLossyWithSplit) {
+  for (int split : {0, 1, 13, height - 1}) {
+    makeLossyMetadata(split);
+    checkTwoPassMatchesSerial();
+  }
+}
+
+TEST_P(NikonDecompressorTest, AllHuffmanTableBackendsMatch) {
+  makeLossyMetadata(13);
+
+  setHuffmanTableBackend(HuffmanTableBackend::LUT11);
+  const auto expected = pixels(decode(0, true));
+
+  for (auto backend :
+       {HuffmanTableBackend::LUT9, HuffmanTableBackend::LUT13,
+        HuffmanTableBackend::Lookup, HuffmanTableBackend::Tree,
+        HuffmanTableBackend::Vector}) {
+    setHuffmanTableBackend(backend);
+    ASSERT_EQ(pixels(decode(0, true)), expected);
+    ASSERT_EQ(pixels(decode(7, true)), expected);
+  }
+
+  setHuffmanTableBackend(HuffmanTableBackend::Auto);
+  ASSERT_EQ(pixels(decode(0, true)), expected);
+}
+
+// With the Huffman decoding and the reconstruction on threads of their own,
+// and on one.
+TEST_P(NikonDecompressorTest, PipelinedMatchesSerial) {
+  for (int split : {0, 13}) {
+    makeLossyMetadata(split);
+    for (bool uncorrectedRawValues : {false, true}) {
+      for (int rows : {1, 14, height}) {
+        ASSERT_EQ(pixels(decode(0, uncorrectedRawValues, rows, true)),
+                  pixels(decode(0, uncorrectedRawValues, rows, false)));
+      }
+    }
+  }
+}
+
+// The rows before are as when decoding the whole image, the rest are cleared.
+TEST_P(NikonDecompressorTest, JustTheFirstRows) {
+  makeLossyMetadata(13);
+  const auto expected = pixels(decode(0, true));
+
+  for (int rows : {0, 1, 13, 14, 30, height}) {
+    for (int rowsPerCheckpoint : {0, 1, 7}) {
+      const auto v = pixels(decode(rowsPerCheckpoint, true, rows));
+      for (int i = 0; i < width * height; i++)
+        ASSERT_EQ(v[i], i < width * rows ? expected[i] : 0) << rows << " " << i;
+    }
+  }
+}
+
+TEST_P(NikonDecompressorTest, ScanRecordsEveryKthRow) {
+  makeLosslessMetadata();
+
+  RawImage mRaw = RawImage::create(iPoint2D(width, height));
+  const Buffer m(metadata.data(), metadata.size());
+  NikonDecompressor n(mRaw, ByteStream(DataBuffer(m, Endianness::big)), 12);
+
+  const Buffer b(data.data(), data.size());
+  const ByteStream bs(DataBuffer(b, Endianness::big));
+  const auto checkpoints = n.scan(bs, 16);
+
+  ASSERT_EQ(checkpoints.size(), 3);
+  for (unsigned i = 0; i < checkpoints.size(); i++)
+    ASSERT_EQ(checkpoints[i].row, 16 * i);
+  ASSERT_EQ(checkpoints[0].bitPosition, 0);
+  ASSERT_LT(checkpoints[1].bitPosition, checkpoints[2].bitPosition);
+
+  ASSERT_THROW(n.scan(bs, 0), RawspeedException);
+
+  auto bad = checkpoints;
+  bad[1].row = 0;
+  ASSERT_THROW(n.decompress(bs, true, bad), RawspeedException);
+  ASSERT_THROW(n.decompress(bs, true, {}), RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,143 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/OlympusDecompressor.h" // for OlympusDecompressor
+#include "common/Common.h"                     // for uchar8, ushort16
+#include "common/Point.h"                      // for iPoint2D
+#include "common/RawImage.h"                   // for RawImage, RawImageData
+#include "io/BitPumpMSB.h"                     // for BitPumpMSB
+#include "io/Buffer.h"                         // for Buffer, DataBuffer
+#include "io/ByteStream.h"                     // for ByteStream
+#include "io/Endianness.h"                     // for Endianness
+#include <algorithm>                           // for min
+#include <array>                               // for array
+#include <cstdlib>                             // for abs
+#include <gtest/gtest.h>                       // for Message, TestPartResult
+#include <vector>                              // for vector
+
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::OlympusDecompressor;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The decoder, one pixel at a time, with the borders handled in place.
+static std::vector<ushort16> decodePerPixel(const std::vector<uchar8>& data,
+                                            const iPoint2D& dim) {
+  ByteStream input(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+  input.skipBytes(7);
+  BitPumpMSB bits(input);
+
+  std::vector<ushort16> out(dim.area());
+  for (int y = 0; y < dim.y; y++) {
+    std::array<std::array<int, 3>, 2> acarry{{}};
+    std::array<int, 2> left{{}};
+    std::array<int, 2> nw{{}};
+    for (int x = 0; x < dim.x; x++) {
+      const int c = x & 1;
+      bits.fill();
+      const int i = 2 * (acarry[c][2] < 3);
+      int nbits;
+      for (nbits = 2 + i; static_cast<ushort16>(acarry[c][0]) >> (nbits + i);
+           nbits++)
+        ;
+
+      const int b = bits.peekBitsNoFill(15);
+      const int sign = (b >> 14) * -1;
+      const int low = (b >> 12) & 3;
+      int high = 0;
+      while (high < 12 && !((b >> (11 - high)) & 1))
+        high++;
+
+      if (high == 12) {
+        bits.skipBitsNoFill(15);
+        high = bits.getBits(16 - nbits) >> 1;
+      } else
+        bits.skipBitsNoFill(high + 1 + 3);
+
+      acarry[c][0] = (high << nbits) | bits.getBits(nbits);
+      const int diff = (acarry[c][0] ^ sign) + acarry[c][1];
+      acarry[c][1] = (diff * 3 + acarry[c][1]) >> 5;
+      acarry[c][2] = acarry[c][0] > 16 ? 0 : acarry[c][2] + 1;
+
+      int pred;
+      const int up = y < 2 ? 0 : out[(y - 2) * dim.x + x];
+      if (y < 2 || x < 2) {
+        pred = y >= 2 ? up : x < 2 ? 0 : left[c];
+        nw[c] = up;
+      } else {
+        const int l = left[c] - nw[c];
+        const int u = up - nw[c];
+        if ((l < 0) != (u < 0) && l != 0 && u != 0)
+          pred = std::abs(l) > 32 || std::abs(u) > 32 ? left[c] + u
+                                                      : (left[c] + up) >> 1;
+        else
+          pred = std::abs(l) > std::abs(u) ? left[c] : up;
+        nw[c] = up;
+      }
+      left[c] = pred + ((diff * 4) | low);
+      out[y * dim.x + x] = left[c];
+    }
+  }
+  return out;
+}
+
+TEST(OlympusDecompressorTest, SameAsPerPixel) {
+  const iPoint2D dim(46, 9);
+
+  // Any data is a valid stream. With mostly zero bits, the long codes appear.
+  std::vector<uchar8> data(4 * dim.area() + 7);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+    if ((random >> 28) < 4)
+      b &= 0x0F;
+  }
+  const auto expected = decodePerPixel(data, dim);
+
+  for (uint32 rows : {static_cast<uint32>(dim.y), 5U}) {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    OlympusDecompressor o(mRaw);
+    o.decompress(ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                                       Endianness::little)),
+                 rows);
+
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++) {
+        const ushort16 e =
+            y < static_cast<int>(rows) ? expected[y * dim.x + x] : 0;
+        ASSERT_EQ(row[x], e) << x << " " << y;
+      }
+    }
+  }
+}
+
+} // namespace rawspeed_test
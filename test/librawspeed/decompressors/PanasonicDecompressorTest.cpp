@@ -0,0 +1,167 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/PanasonicDecompressor.h" // for PanasonicDecompressor
+#include "common/Common.h"                       // for uchar8, ushort16
+#include "common/Executor.h"                     // for setExecutor, Thread...
+#include "common/Mutex.h"                        // for MutexLocker
+#include "common/Point.h"                        // for iPoint2D
+#include "common/RawImage.h"                     // for RawImage, RawImageData
+#include "io/Buffer.h"                           // for Buffer, DataBuffer
+#include "io/ByteStream.h"                       // for ByteStream
+#include "io/Endianness.h"                       // for Endianness
+#include <algorithm>                             // for sort, min
+#include <array>                                 // for array
+#include <gtest/gtest.h>                         // for Message, TestPartRe...
+#include <memory>                                // for make_shared
+#include <vector>                                // for vector
+
+using rawspeed::BadPixelPosition;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::MutexLocker;
+using rawspeed::PanasonicDecompressor;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class PanasonicDecompressorTest : public ::testing::TestWithParam<uint32> {
+protected:
+  PanasonicDecompressorTest() = default;
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // The pixels, and the sorted positions of the zero ones.
+  static std::vector<ushort16> decode(const ByteStream& bs, const iPoint2D& dim,
+                                      uint32 split,
+                                      std::vector<BadPixelPosition>* zeros) {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    PanasonicDecompressor p(mRaw, bs, false, split);
+    p.decompress();
+
+    std::vector<ushort16> pixels;
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      pixels.insert(pixels.end(), row, row + dim.x);
+    }
+
+    MutexLocker guard(&mRaw->mBadPixelMutex);
+    *zeros = mRaw->mBadPixelPositions;
+    std::sort(zeros->begin(), zeros->end());
+    return pixels;
+  }
+};
+
+// As dcraw does it, with each block copied with its two sections swapped,
+// and the bits read by the index of the byte.
+static std::vector<ushort16> referenceDecode(const std::vector<uchar8>& data,
+                                             const iPoint2D& dim,
+                                             uint32 split) {
+  std::vector<ushort16> pixels;
+  std::vector<uchar8> buf;
+  int vbits = 0;
+  const auto getBits = [&buf, &vbits](int nbits) -> uint32 {
+    vbits = (vbits - nbits) & 0x1ffff;
+    const int byte = vbits >> 3 ^ 0x3ff0;
+    return (buf[byte] | buf[byte + 1] << 8) >> (vbits & 7) & ~(-(1 << nbits));
+  };
+
+  const uint32 bytes = 16 * (dim.area() / 14);
+  for (uint32 pos = 0; pixels.size() < unsigned(dim.area());) {
+    if (pos % 0x4000 == 0) {
+      const uint32 size = std::min<uint32>(
+          0x4000, split ? 0x4000 : bytes - pos);
+      buf.assign(0x4000 + 1, 0);
+      std::copy(data.begin() + pos + split, data.begin() + pos + size,
+                buf.begin());
+      std::copy(data.begin() + pos, data.begin() + pos + split,
+                buf.begin() + size - split);
+      vbits = 0;
+    }
+    pos += 16;
+
+    std::array<int, 2> pred{{}};
+    std::array<int, 2> nonz{{}};
+    int sh = 0;
+    for (int p = 0, u = 0; p < 14; p++, u++) {
+      const int c = p & 1;
+      if (u == 2) {
+        sh = 4 >> (3 - getBits(2));
+        u = -1;
+      }
+      if (nonz[c]) {
+        const int j = getBits(8);
+        if (j) {
+          pred[c] -= 0x80 << sh;
+          if (pred[c] < 0 || sh == 4)
+            pred[c] &= ~(-(1 << sh));
+          pred[c] += j << sh;
+        }
+      } else {
+        nonz[c] = getBits(8);
+        if (nonz[c] || p > 11)
+          pred[c] = nonz[c] << 4 | getBits(4);
+      }
+      pixels.emplace_back(pred[c]);
+    }
+  }
+  return pixels;
+}
+
+// 0x1FF8 is what the cameras use, with the seam of the sections in the middle
+// of a 16-byte group.
+INSTANTIATE_TEST_CASE_P(SplitOffsets, PanasonicDecompressorTest,
+                        ::testing::Values(0U, 0x1FF0U, 0x1FF8U));
+
+// The blocks are decoded by the threads independently of each other.
+TEST_P(PanasonicDecompressorTest, SameWithThreads) {
+  // A bit more than 7 blocks.
+  const iPoint2D dim(14 * 20, 401);
+
+  std::vector<uchar8> data(16 * (dim.area() / 14) + 0x4000);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(1));
+  std::vector<BadPixelPosition> zeros;
+  const auto expected = decode(bs, dim, GetParam(), &zeros);
+  ASSERT_FALSE(zeros.empty());
+  ASSERT_EQ(expected, referenceDecode(data, dim, GetParam()));
+
+  setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  std::vector<BadPixelPosition> threadedZeros;
+  const auto pixels = decode(bs, dim, GetParam(), &threadedZeros);
+  ASSERT_EQ(pixels, expected);
+  ASSERT_EQ(threadedZeros, zeros);
+}
+
+} // namespace rawspeed_test
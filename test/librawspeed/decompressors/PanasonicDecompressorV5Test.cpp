@@ -0,0 +1,128 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/PanasonicDecompressorV5.h" // for PanasonicDecompr...
+#include "common/Common.h"                         // for uchar8, ushort16
+#include "common/Executor.h"                       // for setExecutor, T...
+#include "common/Point.h"                          // for iPoint2D
+#include "common/RawImage.h"                       // for RawImage, RawI...
+#include "io/Buffer.h"                             // for Buffer, DataBuffer
+#include "io/ByteStream.h"                         // for ByteStream
+#include "io/Endianness.h"                         // for Endianness
+#include <algorithm>                               // for copy
+#include <gtest/gtest.h>                           // for ParamIteratorI...
+#include <memory>                                  // for make_shared
+#include <tuple>                                   // for get, tuple
+#include <vector>                                  // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::PanasonicDecompressorV5;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class PanasonicDecompressorV5Test
+    : public ::testing::TestWithParam<std::tuple<int, int>> {
+protected:
+  PanasonicDecompressorV5Test() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    bps = std::get<1>(GetParam());
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  static constexpr int blockSize = 0x4000;
+  static constexpr int sectionSplitOffset = 0x1FF8;
+
+  // The random pixels, packed into the padded 16-byte packets, LSB first,
+  // with each block split and swapped.
+  std::vector<uchar8> encode(const iPoint2D& dim) {
+    const int pixelsPerPacket = 128 / bps;
+    const int pixelsPerBlock = pixelsPerPacket * blockSize / 16;
+    const int pixels = dim.area();
+    const int blocks = (pixels + pixelsPerBlock - 1) / pixelsPerBlock;
+
+    uint32 random = 1;
+    std::vector<uchar8> packets(blocks * blockSize);
+    for (int i = 0; i < pixels; i++) {
+      random = random * 1103515245U + 12345U;
+      const int pixel = (random >> 8) & ((1U << bps) - 1U);
+      expected.emplace_back(pixel);
+
+      const int bit = 128 * (i / pixelsPerPacket) + bps * (i % pixelsPerPacket);
+      for (int b = 0; b < bps; b++) {
+        if ((pixel >> b) & 1)
+          packets[(bit + b) / 8] |= 1U << ((bit + b) % 8);
+      }
+    }
+
+    std::vector<uchar8> input(packets.size());
+    const int secondSize = blockSize - sectionSplitOffset;
+    for (int block = 0; block < blocks; block++) {
+      const uchar8* in = &packets[block * blockSize];
+      uchar8* out = &input[block * blockSize];
+      std::copy(in, in + secondSize, out + sectionSplitOffset);
+      std::copy(in + secondSize, in + blockSize, out);
+    }
+    return input;
+  }
+
+  int bps;
+  std::vector<ushort16> expected;
+};
+
+constexpr int PanasonicDecompressorV5Test::blockSize;
+constexpr int PanasonicDecompressorV5Test::sectionSplitOffset;
+
+INSTANTIATE_TEST_CASE_P(ThreadsAndBps, PanasonicDecompressorV5Test,
+                        ::testing::Combine(::testing::Values(1, 3),
+                                           ::testing::Values(12, 14)));
+
+// Two blocks, with one of the rows spanning both of them, and the last one
+// only partially used.
+TEST_P(PanasonicDecompressorV5Test, Decode) {
+  const iPoint2D dim(90, 120);
+  const auto input = encode(dim);
+
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  PanasonicDecompressorV5 p(
+      mRaw,
+      ByteStream(DataBuffer(Buffer(input.data(), input.size()),
+                            Endianness::little)),
+      bps);
+  p.decompress();
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,194 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "decompressors/PentaxDecompressor.h" // for PentaxDecompressor
+#include "common/Common.h"                    // for uchar8, ushort16, uint32
+#include "common/Executor.h"                  // for setExecutor, ThreadPoo...
+#include "common/Point.h"                     // for iPoint2D
+#include "common/RawImage.h"                  // for RawImage, RawImageData
+#include "common/RawspeedException.h"         // for RawspeedException
+#include "io/Buffer.h"                        // for Buffer, DataBuffer
+#include "io/ByteStream.h"                    // for ByteStream
+#include "io/Endianness.h"                    // for Endianness
+#include <array>                              // for array
+#include <cstdlib>                            // for abs
+#include <gtest/gtest.h>                      // for ParamIteratorInterface
+#include <memory>                             // for make_shared
+#include <utility>                            // for pair
+#include <vector>                             // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::PentaxDecompressor;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The legacy table, as in PentaxDecompressor.
+static const std::array<uchar8, 16> ncpl = {
+    {0, 2, 3, 1, 1, 1, 1, 1, 1, 2, 0, 0, 0, 0, 0, 0}};
+static const std::array<int, 13> codeValues = {
+    {3, 4, 2, 5, 1, 6, 0, 7, 8, 9, 10, 11, 12}};
+
+// The canonical code of the difference length, and the length of that code.
+static std::pair<uint32, int> getCode(int diffLen) {
+  int symbol = 0;
+  while (codeValues[symbol] != diffLen)
+    symbol++;
+  uint32 code = 0;
+  for (int l = 1; l <= 16; l++) {
+    if (symbol < ncpl[l - 1])
+      return {code + symbol, l};
+    symbol -= ncpl[l - 1];
+    code = (code + ncpl[l - 1]) << 1;
+  }
+  return {0, 0};
+}
+
+class BitWriterMSB {
+  std::vector<uchar8>* out;
+  uint32 cache = 0;
+  int fill = 0;
+
+public:
+  explicit BitWriterMSB(std::vector<uchar8>* out_) : out(out_) {}
+
+  void put(uint32 bits, int len) {
+    for (int i = len - 1; i >= 0; i--) {
+      cache = (cache << 1) | ((bits >> i) & 1U);
+      if (++fill == 8) {
+        out->emplace_back(cache);
+        cache = 0;
+        fill = 0;
+      }
+    }
+  }
+
+  void putDiff(int diff) {
+    int len = 0;
+    while ((std::abs(diff) >> len) != 0)
+      len++;
+    const auto code = getCode(len);
+    put(code.first, code.second);
+    if (len)
+      put(diff >= 0 ? diff : diff + (1 << len) - 1, len);
+  }
+
+  ~BitWriterMSB() {
+    if (fill)
+      put(0, 8 - fill);
+    // The pump reads ahead.
+    for (int i = 0; i < 8; i++)
+      out->emplace_back(0);
+  }
+};
+
+class PentaxDecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  PentaxDecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    uint32 random = 1;
+    expected.resize(dim.area());
+    for (auto& v : expected) {
+      random = random * 1103515245U + 12345U;
+      v = (random >> 8) % 4096;
+    }
+
+    BitWriterMSB w(&data);
+    std::array<int, 2> pUp1{{}};
+    std::array<int, 2> pUp2{{}};
+    for (int y = 0; y < dim.y; y++) {
+      const ushort16* row = &expected[y * dim.x];
+      w.putDiff(row[0] - pUp1[y & 1]);
+      w.putDiff(row[1] - pUp2[y & 1]);
+      pUp1[y & 1] = row[0];
+      pUp2[y & 1] = row[1];
+      for (int x = 2; x < dim.x; x++)
+        w.putDiff(row[x] - row[x - 2]);
+    }
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // With rowsPerCheckpoint of 0, in one pass.
+  RawImage decode(int rowsPerCheckpoint) const {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+
+    const ByteStream bs(
+        DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+    PentaxDecompressor p(mRaw, nullptr);
+    if (!rowsPerCheckpoint)
+      p.decompress(bs);
+    else
+      p.decompress(bs, p.scan(bs, rowsPerCheckpoint));
+    return mRaw;
+  }
+
+  void check(const RawImage& mRaw) const {
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++)
+        ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+    }
+  }
+
+  const iPoint2D dim{10, 9};
+  std::vector<uchar8> data;
+  std::vector<ushort16> expected;
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, PentaxDecompressorTest,
+                        ::testing::Values(1, 3));
+
+TEST_P(PentaxDecompressorTest, Decode) { check(decode(0)); }
+
+TEST_P(PentaxDecompressorTest, Checkpoints) {
+  for (int rowsPerCheckpoint : {1, 2, 4, 64})
+    check(decode(rowsPerCheckpoint));
+}
+
+TEST_P(PentaxDecompressorTest, BadCheckpoints) {
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+  PentaxDecompressor p(mRaw, nullptr);
+
+  ASSERT_THROW(p.scan(bs, 0), RawspeedException);
+
+  auto checkpoints = p.scan(bs, 4);
+  ASSERT_EQ(checkpoints.size(), 3);
+  checkpoints[2].row = dim.y;
+  ASSERT_THROW(p.decompress(bs, checkpoints), RawspeedException);
+  checkpoints.erase(checkpoints.begin());
+  ASSERT_THROW(p.decompress(bs, checkpoints), RawspeedException);
+}
+
+} // namespace rawspeed_test
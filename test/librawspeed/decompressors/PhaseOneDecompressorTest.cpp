@@ -0,0 +1,216 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/PhaseOneDecompressor.h" // for PhaseOneDecompressor
+#include "common/Common.h"                      // for uchar8, ushort16
+#include "common/Executor.h"                    // for setExecutor, Threa...
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RawImage.h"                    // for RawImage, RawImage...
+#include "common/RawspeedException.h"           // for RawspeedException
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness
+#include <array>                                // for array
+#include <gtest/gtest.h>                        // for ParamIteratorInter...
+#include <memory>                               // for make_shared
+#include <vector>                               // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::PhaseOneDecompressor;
+using rawspeed::PhaseOneQuadrantCurves;
+using rawspeed::PhaseOneStrip;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The bits, most significant first, of the little-endian 32-bit words.
+class BitWriterMSB32 {
+public:
+  void put(uint32 value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+      if (pos % 32 == 0)
+        data.insert(data.end(), 4, 0);
+      const int byte = data.size() - 4 + 3 - (pos % 32) / 8;
+      data[byte] |= ((value >> i) & 1) << (7 - pos % 8);
+      pos++;
+    }
+  }
+
+  std::vector<uchar8> data;
+
+private:
+  int pos = 0;
+};
+
+class PhaseOneDecompressorTest : public ::testing::TestWithParam<int> {
+protected:
+  PhaseOneDecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+
+    // All the length codes, and the lengths, with the differences of
+    // random bits. The first group has to set the lengths with 5 zeros.
+    static constexpr std::array<int, 10> length = {8,  7, 6,  9,  11,
+                                                   10, 5, 12, 14, 13};
+    uint32 random = 1;
+    const auto next = [&random]() {
+      random = random * 1103515245U + 12345U;
+      return random;
+    };
+    for (int row = 0; row < dim.y; row++) {
+      BitWriterMSB32 bits;
+      std::array<int, 2> pred{{}};
+      std::array<int, 2> len{{}};
+      for (int col = 0; col < dim.x; col++) {
+        if (col >= (dim.x & ~7)) // last 'width % 8' pixels.
+          len.fill(14);
+        else if (col % 8 == 0) {
+          for (int& l : len) {
+            const int j = col == 0 ? 5 : (next() >> 16) % 6;
+            const int b = next() >> 31;
+            if (j == 0) {
+              bits.put(1, 1);
+              continue;
+            }
+            bits.put(0, j);
+            if (j < 5)
+              bits.put(1, 1);
+            bits.put(b, 1);
+            l = length[2 * (j - 1) + b];
+          }
+        }
+
+        const int l = len[col & 1];
+        const uint32 v = next() >> (32 - (l == 14 ? 16 : l));
+        bits.put(v, l == 14 ? 16 : l);
+        if (l == 14)
+          pred[col & 1] = v;
+        else
+          pred[col & 1] += static_cast<int>(v) + 1 - (1 << (l - 1));
+        expected.emplace_back(pred[col & 1]);
+      }
+      // Some slack for the bit pump.
+      bits.data.resize(bits.data.size() + 8);
+      rows.emplace_back(std::move(bits.data));
+    }
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // Not in the order of the rows.
+  std::vector<PhaseOneStrip> getStrips() const {
+    std::vector<PhaseOneStrip> strips;
+    for (int row = dim.y - 1; row >= 0; row--) {
+      strips.emplace_back(row, ByteStream(DataBuffer(
+                                   Buffer(rows[row].data(), rows[row].size()),
+                                   Endianness::little)));
+    }
+    return strips;
+  }
+
+  RawImage decode(const PhaseOneQuadrantCurves* curves) const {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    PhaseOneDecompressor p(mRaw, getStrips());
+    if (curves)
+      p.setQuadrantCurves(*curves);
+    p.decompress();
+    return mRaw;
+  }
+
+  // Not a whole number of the groups of 8 pixels.
+  static constexpr iPoint2D dim = {46, 10};
+  std::vector<std::vector<uchar8>> rows;
+  std::vector<ushort16> expected;
+};
+
+constexpr iPoint2D PhaseOneDecompressorTest::dim;
+
+INSTANTIATE_TEST_CASE_P(Threads, PhaseOneDecompressorTest,
+                        ::testing::Values(1, 3));
+
+TEST_P(PhaseOneDecompressorTest, Decode) {
+  const RawImage mRaw = decode(nullptr);
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+TEST_P(PhaseOneDecompressorTest, BadFirstLengths) {
+  // Some of the 5 zeros are missing.
+  rows[3][3] |= 0x10;
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  PhaseOneDecompressor p(mRaw, getStrips());
+  ASSERT_THROW(p.decompress(), RawspeedException);
+}
+
+// Each pixel is mapped through the curve of its quadrant.
+TEST_P(PhaseOneDecompressorTest, QuadrantCurves) {
+  PhaseOneQuadrantCurves curves;
+  for (int q = 0; q < 4; q++) {
+    curves.curves[q].resize(65536);
+    for (uint32 v = 0; v < 65536; v++)
+      curves.curves[q][v] = v * (q + 3) / 4 + 100 * q;
+  }
+
+  for (const iPoint2D& split : {iPoint2D(20, 3), iPoint2D(0, 0), dim}) {
+    curves.split = split;
+    const RawImage mRaw = decode(&curves);
+
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++) {
+        const int q = 2 * (y < split.y ? 0 : 1) + (x < split.x ? 0 : 1);
+        ASSERT_EQ(row[x], curves.curves[q][expected[y * dim.x + x]])
+            << x << " " << y;
+      }
+    }
+  }
+}
+
+TEST_P(PhaseOneDecompressorTest, BadQuadrantCurves) {
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  PhaseOneQuadrantCurves curves;
+  for (auto& curve : curves.curves)
+    curve.resize(65536);
+
+  PhaseOneDecompressor p(mRaw, getStrips());
+  for (const iPoint2D& split :
+       {iPoint2D(dim.x + 1, 0), iPoint2D(0, dim.y + 1), iPoint2D(-1, 0)}) {
+    curves.split = split;
+    ASSERT_THROW(p.setQuadrantCurves(curves), RawspeedException);
+  }
+
+  curves.split = {0, 0};
+  curves.curves[2].resize(256);
+  ASSERT_THROW(p.setQuadrantCurves(curves), RawspeedException);
+}
+
+} // namespace rawspeed_test
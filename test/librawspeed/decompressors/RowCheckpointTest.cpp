@@ -0,0 +1,182 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "decompressors/RowCheckpoint.h" // for RowCheckpoint, RowCheckpoi...
+#include "common/Common.h"               // for uchar8, uint32, uint64
+#include "common/Executor.h"             // for setExecutor, ThreadPoolExe...
+#include "common/RawspeedException.h"    // for RawspeedException
+#include "io/BitPumpJPEG.h"              // for BitPumpJPEG
+#include "io/BitPumpLSB.h"               // for BitPumpLSB
+#include "io/BitPumpMSB.h"               // for BitPumpMSB
+#include "io/Buffer.h"                   // for Buffer, DataBuffer
+#include "io/ByteStream.h"               // for ByteStream
+#include "io/Endianness.h"               // for Endianness
+#include <algorithm>                     // for sort
+#include <gtest/gtest.h>                 // for Test, AssertionResult
+#include <memory>                        // for make_shared
+#include <mutex>                         // for mutex, lock_guard
+#include <utility>                       // for pair
+#include <vector>                        // for vector
+
+using rawspeed::BitPumpJPEG;
+using rawspeed::BitPumpLSB;
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::decodeBands;
+using rawspeed::Endianness;
+using rawspeed::readCheckpoints;
+using rawspeed::RowCheckpoint;
+using rawspeed::RowCheckpointRecorder;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::writeCheckpoints;
+
+namespace rawspeed_test {
+
+template <typename Pump> class RowCheckpointPumpTest : public ::testing::Test {
+protected:
+  RowCheckpointPumpTest() {
+    // Many 0xFF, each followed by the stuffed zero byte.
+    uint32 random = 1;
+    while (data.size() < 4096) {
+      random = random * 1103515245U + 12345U;
+      const uchar8 b = (random >> 24) % 4 == 0 ? 0xFF : random >> 16;
+      data.emplace_back(b);
+      if (b == 0xFF)
+        data.emplace_back(0);
+    }
+    data.resize(data.size() + 64);
+  }
+
+  std::vector<uchar8> data;
+};
+
+using Pumps = ::testing::Types<BitPumpMSB, BitPumpLSB, BitPumpJPEG>;
+TYPED_TEST_CASE(RowCheckpointPumpTest, Pumps);
+
+// A pump restarted at a "row" continues with the same bits.
+TYPED_TEST(RowCheckpointPumpTest, Restart) {
+  const ByteStream bs(DataBuffer(Buffer(this->data.data(), this->data.size()),
+                                 Endianness::little));
+
+  std::vector<std::pair<uint32, uint32>> reads;
+  TypeParam bits(bs);
+  RowCheckpointRecorder<TypeParam> recorder(3, 1000);
+  RowCheckpoint state;
+  for (uint32 row = 0; row < 1000; row++) {
+    recorder.atRow(row, bits, &state);
+    const uint32 n = 1 + row % 17;
+    reads.emplace_back(n, bits.getBits(n));
+  }
+
+  const auto checkpoints = recorder.release();
+  ASSERT_EQ(checkpoints.size(), 334);
+  for (const auto& c : checkpoints) {
+    auto restarted = rawspeed::getBitPumpAt<TypeParam>(bs, c.bitPosition);
+    for (uint32 row = c.row; row < c.row + 3 && row < 1000; row++)
+      ASSERT_EQ(restarted.getBits(reads[row].first), reads[row].second) << row;
+  }
+}
+
+TEST(RowCheckpointTest, BadInterval) {
+  ASSERT_THROW(RowCheckpointRecorder<BitPumpMSB>(0, 10), RawspeedException);
+}
+
+static std::vector<RowCheckpoint> getCheckpoints() {
+  std::vector<RowCheckpoint> checkpoints(3);
+  for (int i = 0; i < 3; i++) {
+    checkpoints[i].row = 4 * i;
+    checkpoints[i].bitPosition = (rawspeed::uint64(1) << 40) + i;
+    checkpoints[i].pUp1 = {{-i, i}};
+    checkpoints[i].pUp2 = {{1 << 20, -(1 << 20)}};
+  }
+  return checkpoints;
+}
+
+TEST(RowCheckpointTest, Serialize) {
+  std::vector<uchar8> out;
+  writeCheckpoints(getCheckpoints(), &out);
+  ASSERT_EQ(out.size(), 4 + 3 * rawspeed::RowCheckpointSize);
+
+  ByteStream in(DataBuffer(Buffer(out.data(), out.size()), Endianness::little));
+  const auto read = readCheckpoints(&in);
+  ASSERT_EQ(in.getRemainSize(), 0);
+  ASSERT_EQ(read.size(), 3);
+  for (int i = 0; i < 3; i++) {
+    const auto expected = getCheckpoints()[i];
+    ASSERT_EQ(read[i].row, expected.row);
+    ASSERT_EQ(read[i].bitPosition, expected.bitPosition);
+    ASSERT_EQ(read[i].pUp1, expected.pUp1);
+    ASSERT_EQ(read[i].pUp2, expected.pUp2);
+  }
+}
+
+TEST(RowCheckpointTest, BadSerialized) {
+  auto checkpoints = getCheckpoints();
+  checkpoints[2].row = 3;
+  std::vector<uchar8> out;
+  writeCheckpoints(checkpoints, &out);
+
+  ByteStream in(DataBuffer(Buffer(out.data(), out.size()), Endianness::little));
+  ASSERT_THROW(readCheckpoints(&in), RawspeedException);
+
+  // Truncated.
+  out.clear();
+  writeCheckpoints(getCheckpoints(), &out);
+  out.pop_back();
+  ByteStream truncated(
+      DataBuffer(Buffer(out.data(), out.size()), Endianness::little));
+  ASSERT_THROW(readCheckpoints(&truncated), RawspeedException);
+}
+
+TEST(RowCheckpointTest, DecodeBands) {
+  setExecutor(std::make_shared<ThreadPoolExecutor>(3));
+
+  std::mutex mutex;
+  std::vector<std::pair<uint32, uint32>> bands;
+  const auto band = [&mutex, &bands](const RowCheckpoint& c, uint32 end_y) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bands.emplace_back(c.row, end_y);
+  };
+
+  // Only the bands that start before the row 5.
+  decodeBands(getCheckpoints(), 10, 5, band);
+  std::sort(bands.begin(), bands.end());
+  ASSERT_EQ(bands, (std::vector<std::pair<uint32, uint32>>{{0, 4}, {4, 5}}));
+
+  bands.clear();
+  decodeBands(getCheckpoints(), 10, 10, band);
+  std::sort(bands.begin(), bands.end());
+  ASSERT_EQ(bands, (std::vector<std::pair<uint32, uint32>>{
+                       {0, 4}, {4, 8}, {8, 10}}));
+
+  // A checkpoint past the image.
+  ASSERT_THROW(decodeBands(getCheckpoints(), 8, 8, band), RawspeedException);
+
+  setExecutor(nullptr);
+}
+
+} // namespace rawspeed_test
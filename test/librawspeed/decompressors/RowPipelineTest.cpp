@@ -0,0 +1,109 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "decompressors/RowPipeline.h"   // for pipelineRows
+#include "common/Executor.h"              // for setExecutor, ThreadPoolExec...
+#include "common/RawspeedException.h"     // for RawspeedException
+#include "decoders/RawDecoderException.h" // for ThrowRDE
+#include <atomic>                         // for atomic
+#include <gtest/gtest.h>                  // for Test, AssertionResult
+#include <memory>                         // for make_shared
+#include <vector>                         // for vector
+
+using rawspeed::pipelineRows;
+using rawspeed::RawspeedException;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+
+namespace rawspeed_test {
+
+class RowPipelineTest : public ::testing::TestWithParam<int> {
+protected:
+  RowPipelineTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(GetParam()));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+};
+
+INSTANTIATE_TEST_CASE_P(Threads, RowPipelineTest, ::testing::Values(1, 2, 5));
+
+// Each stage sees the rows in order, and a slot is not decoded into again
+// before its row is reconstructed.
+TEST_P(RowPipelineTest, RowsInOrder) {
+  for (int numSlots : {1, 2, 3, 16}) {
+    for (int rows : {0, 1, 5, 100}) {
+      std::vector<int> slots(numSlots, -1);
+      std::vector<int> decoded;
+      std::vector<int> reconstructed;
+      std::atomic<int> numReconstructed{0};
+
+      pipelineRows(
+          rows, numSlots,
+          [&](int row, int slot) {
+            ASSERT_LT(slot, numSlots);
+            ASSERT_LT(row - numReconstructed.load(), numSlots);
+            decoded.emplace_back(row);
+            slots[slot] = row;
+          },
+          [&](int row, int slot) {
+            ASSERT_EQ(slots[slot], row);
+            reconstructed.emplace_back(row);
+            numReconstructed.store(row + 1);
+          });
+
+      std::vector<int> expected;
+      for (int row = 0; row < rows; row++)
+        expected.emplace_back(row);
+      ASSERT_EQ(decoded, expected) << numSlots;
+      ASSERT_EQ(reconstructed, expected) << numSlots;
+    }
+  }
+}
+
+TEST_P(RowPipelineTest, DecodeThrows) {
+  std::atomic<int> last{-1};
+  ASSERT_THROW(pipelineRows(
+                   100, 4,
+                   [](int row, int /*slot*/) {
+                     if (row == 7)
+                       ThrowRDE("Bad row %i", row);
+                   },
+                   [&last](int row, int /*slot*/) { last.store(row); }),
+               RawspeedException);
+  ASSERT_LT(last.load(), 7);
+}
+
+TEST_P(RowPipelineTest, ReconstructThrows) {
+  std::atomic<int> last{-1};
+  ASSERT_THROW(pipelineRows(
+                   100, 4,
+                   [&last](int row, int /*slot*/) { last.store(row); },
+                   [](int row, int /*slot*/) {
+                     if (row == 3)
+                       ThrowRDE("Bad row %i", row);
+                   }),
+               RawspeedException);
+  // Not all of the rows were decoded.
+  ASSERT_LT(last.load(), 99);
+}
+
+} // namespace rawspeed_test
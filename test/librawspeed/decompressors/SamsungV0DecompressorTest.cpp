@@ -0,0 +1,196 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/SamsungV0Decompressor.h" // for SamsungV0Decompressor
+#include "common/Common.h"                       // for uchar8, ushort16
+#include "common/Executor.h"                     // for setExecutor, Thr...
+#include "common/Point.h"                        // for iPoint2D
+#include "common/RawImage.h"                     // for RawImage, RawIma...
+#include "common/RawspeedException.h"            // for RawspeedException
+#include "io/Buffer.h"                           // for Buffer, DataBuffer
+#include "io/ByteStream.h"                       // for ByteStream
+#include "io/Endianness.h"                       // for Endianness
+#include <algorithm>                             // for swap
+#include <array>                                 // for array
+#include <gtest/gtest.h>                         // for ParamIteratorInt...
+#include <memory>                                // for make_shared
+#include <tuple>                                 // for get, tuple
+#include <vector>                                // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::SamsungV0Decompressor;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// MSB first, in little-endian 32-bit words, the way BitPumpMSB32 reads them.
+class BitWriterMSB32 {
+  std::vector<uchar8>* out;
+  uint32 cache = 0;
+  int fill = 0;
+
+public:
+  explicit BitWriterMSB32(std::vector<uchar8>* out_) : out(out_) {}
+
+  void put(uint32 bits, int len) {
+    for (int i = len - 1; i >= 0; i--) {
+      cache = (cache << 1) | ((bits >> i) & 1U);
+      if (++fill == 32) {
+        for (int b = 0; b < 32; b += 8)
+          out->emplace_back(cache >> b);
+        cache = 0;
+        fill = 0;
+      }
+    }
+  }
+
+  ~BitWriterMSB32() {
+    if (fill)
+      put(0, 32 - fill);
+  }
+};
+
+class SamsungV0DecompressorTest
+    : public ::testing::TestWithParam<std::tuple<int, int>> {
+protected:
+  SamsungV0DecompressorTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    dim = {std::get<1>(GetParam()), 7};
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // Random blocks, with the upward prediction wherever it is allowed, except
+  // for every third row, or for one block of the first row too, if badUpward.
+  void encode(bool badUpward) {
+    expected.assign(dim.area(), 0);
+    offsets.clear();
+    data.clear();
+
+    uint32 random = 1;
+    const auto next = [&random](int n) {
+      random = random * 1103515245U + 12345U;
+      return static_cast<int>((random >> 8) % n);
+    };
+
+    for (int y = 0; y < dim.y; y++) {
+      for (int b = 0; b < 4; b++)
+        offsets.emplace_back(data.size() >> (8 * b));
+      BitWriterMSB32 w(&data);
+
+      std::array<int, 4> len;
+      len.fill(y < 2 ? 7 : 4);
+      ushort16* img = &expected[y * dim.x];
+      for (int x = 0; x < dim.x; x += 16) {
+        const bool canUp = y >= 2 && y % 3 != 0 && x + 16 < dim.x;
+        const bool dir = (canUp && next(2)) || (badUpward && y == 0 && x == 16);
+        w.put(dir, 1);
+
+        std::array<int, 4> op;
+        for (int i = 0; i < 4; i++) {
+          do
+            op[i] = next(4);
+          while ((op[i] == 1 && len[i] == 16) || (op[i] == 2 && len[i] == 0));
+          w.put(op[i], 2);
+        }
+        for (int i = 0; i < 4; i++) {
+          if (op[i] == 3) {
+            len[i] = next(16);
+            w.put(len[i], 4);
+          } else
+            len[i] += op[i] == 1 ? 1 : op[i] == 2 ? -1 : 0;
+        }
+
+        for (int parity = 0; parity < 2; parity++) {
+          const ushort16 left =
+              x != 0 ? img[x - 2 + parity] : static_cast<ushort16>(128);
+          for (int c = parity; c < 16; c += 2) {
+            const int l = len[2 * parity | (c >> 3)];
+            const uint32 bits = l ? next(1 << l) : 0;
+            w.put(bits, l);
+            if (x + c >= dim.x)
+              continue;
+            const int adj =
+                l && (bits >> (l - 1)) ? int(bits) - (1 << l) : int(bits);
+            ushort16 pred = left;
+            if (dir)
+              pred = (c & 1 ? img - 2 * dim.x : img - dim.x)[x + c];
+            img[x + c] = pred + adj;
+          }
+        }
+      }
+    }
+
+    // Swap red and blue pixels to get the final CFA pattern
+    for (int y = 0; y + 1 < dim.y; y += 2)
+      for (int x = 0; x + 1 < dim.x; x += 2)
+        std::swap(expected[y * dim.x + x + 1], expected[(y + 1) * dim.x + x]);
+  }
+
+  void decode(RawImage mRaw) const {
+    const Buffer o(offsets.data(), offsets.size());
+    const Buffer d(data.data(), data.size());
+    SamsungV0Decompressor s(mRaw,
+                            ByteStream(DataBuffer(o, Endianness::little)),
+                            ByteStream(DataBuffer(d, Endianness::little)));
+    s.decompress();
+  }
+
+  iPoint2D dim;
+  std::vector<uchar8> offsets;
+  std::vector<uchar8> data;
+  std::vector<ushort16> expected;
+};
+
+// A width that is not a whole number of the blocks of 16 pixels, and one that
+// is, with an odd number of rows.
+INSTANTIATE_TEST_CASE_P(ThreadsAndWidths, SamsungV0DecompressorTest,
+                        ::testing::Combine(::testing::Values(1, 3),
+                                           ::testing::Values(40, 64)));
+
+TEST_P(SamsungV0DecompressorTest, Decode) {
+  encode(false);
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  decode(mRaw);
+
+  for (int y = 0; y < dim.y; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+TEST_P(SamsungV0DecompressorTest, UpwardOnFirstRow) {
+  encode(true);
+  const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_THROW(decode(mRaw), RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,122 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/SonyArw1Decompressor.h" // for SonyArw1Decompressor
+#include "common/Common.h"                      // for uchar8, ushort16
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RawImage.h"                    // for RawImage, RawImageData
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness
+#include <gtest/gtest.h>                        // for Message, TestPartRes...
+#include <vector>                               // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class BitWriterMSB {
+public:
+  void put(uint32 value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+      if (pos % 8 == 0)
+        data.emplace_back(0);
+      data.back() |= ((value >> i) & 1) << (7 - pos % 8);
+      pos++;
+    }
+  }
+
+  std::vector<uchar8> data;
+
+private:
+  int pos = 0;
+};
+
+// The length of the difference, as a prefix code, then the difference.
+static void encodeDiff(BitWriterMSB* bits, int diff) {
+  int len = 0;
+  for (int a = diff < 0 ? -diff : diff; a != 0; a >>= 1)
+    len++;
+
+  if (len == 0)
+    bits->put(0b011, 3);
+  else if (len <= 3)
+    bits->put(len == 3 ? 0b010 : (4 - len), len == 3 ? 3 : 2);
+  else {
+    bits->put(0, 2);
+    bits->put(1, len - 4 + 1);
+  }
+
+  if (len != 0)
+    bits->put(diff > 0 ? diff : diff + (1 << len) - 1, len);
+}
+
+// A random walk, in the order of the stream: the columns from the right, the
+// even rows of each one first.
+TEST(SonyArw1DecompressorTest, RandomWalk) {
+  // Not a whole number of the batches of columns.
+  for (const iPoint2D& dim : {iPoint2D(70, 24), iPoint2D(32, 2)}) {
+    std::vector<ushort16> expected(dim.area());
+    BitWriterMSB bits;
+    uint32 random = 1;
+    int sum = 0;
+    for (int x = dim.x - 1; x >= 0; x--) {
+      for (int y : {0, 1}) {
+        for (; y < dim.y; y += 2) {
+          random = random * 1103515245U + 12345U;
+          int diff = static_cast<int>((random >> 16) % 1001) - 500;
+          // Sometimes a large one, sometimes none.
+          if ((random >> 28) == 0)
+            diff *= 3;
+          else if ((random >> 28) == 1)
+            diff = 0;
+          if (sum + diff < 0 || sum + diff > 4095)
+            diff = -diff;
+          sum += diff;
+          encodeDiff(&bits, diff);
+          expected[y * dim.x + x] = sum;
+        }
+      }
+    }
+    // Some slack for the bit pump.
+    bits.data.resize(bits.data.size() + 8);
+
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    rawspeed::SonyArw1Decompressor a(mRaw);
+    a.decompress(ByteStream(DataBuffer(
+        Buffer(bits.data.data(), bits.data.size()), Endianness::little)));
+
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++)
+        ASSERT_EQ(row[x], expected[y * dim.x + x]) << x << " " << y;
+    }
+  }
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,157 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/SonyArw2Decompressor.h" // for SonyArw2Decompressor
+#include "common/Common.h"                      // for uchar8, ushort16
+#include "common/Memory.h"                      // for setNonTemporalStores
+#include "common/Point.h"                       // for iPoint2D
+#include "common/RawImage.h"                    // for RawImage, RawImageData
+#include "common/RawspeedException.h"           // for RawspeedException
+#include "io/BitPumpLSB.h"                      // for BitPumpLSB
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, getLE
+#include <algorithm>                             // for min
+#include <gtest/gtest.h>                        // for Message, TestPartRes...
+#include <vector>                               // for vector
+
+using rawspeed::BitPumpLSB;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::NonTemporalStores;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setNonTemporalStores;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The packets, bit by bit.
+static void decodeReference(const ByteStream& input, const RawImage& mRaw) {
+  for (int row = 0; row < mRaw->dim.y; row++) {
+    auto* dest = reinterpret_cast<ushort16*>(mRaw->getData(0, row));
+    BitPumpLSB bits(input.getSubStream(row * mRaw->dim.x, mRaw->dim.x));
+    uint32 random = bits.peekBits(24);
+
+    for (int x = 0; x < mRaw->dim.x;) {
+      const int max = bits.getBits(11);
+      const int min = bits.getBits(11);
+      const int imax = bits.getBits(4);
+      const int imin = bits.getBits(4);
+
+      int sh = 0;
+      while ((sh < 4) && ((0x80 << sh) <= (max - min)))
+        sh++;
+
+      for (int i = 0; i < 16; i++) {
+        int p;
+        if (i == imax)
+          p = max;
+        else if (i == imin)
+          p = min;
+        else
+          p = std::min(static_cast<int>(bits.getBits(7) << sh) + min, 0x7ff);
+        mRaw->setWithLookUp(p << 1, reinterpret_cast<uchar8*>(&dest[x + 2 * i]),
+                            &random);
+      }
+      x += ((x & 1) != 0) ? 31 : 1;
+    }
+  }
+}
+
+// Random packets, of all the shifts, with the maximum and the minimum
+// in different places.
+static std::vector<uchar8> createInput(const iPoint2D& dim) {
+  std::vector<uchar8> data(dim.area());
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  for (size_t i = 0; i < data.size(); i += 16) {
+    uint32 v = rawspeed::getLE<uint32>(&data[i]);
+    const uint32 imax = (v >> 22) & 0xf;
+    const uint32 imin = (imax + 1 + (v >> 26) % 15) & 0xf;
+    v = (v & ~(0xfU << 26)) | (imin << 26);
+    for (int b = 0; b < 4; b++)
+      data[i + b] = v >> (8 * b);
+  }
+  return data;
+}
+
+class SonyArw2DecompressorTest : public ::testing::TestWithParam<bool> {};
+
+INSTANTIATE_TEST_CASE_P(Dither, SonyArw2DecompressorTest, ::testing::Bool());
+
+TEST_P(SonyArw2DecompressorTest, SameAsBitPump) {
+  const iPoint2D dim(320, 7);
+  const auto data = createInput(dim);
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+
+  // A curve that is not the identity, with or without the dithering.
+  std::vector<ushort16> curve(0x1000);
+  for (size_t i = 0; i < curve.size(); i++)
+    curve[i] = i + i * i / 512;
+
+  RawImage expected = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  expected->setTable(curve, GetParam());
+  decodeReference(bs, expected);
+
+  // Straight into the image, and through the staging of the rows.
+  for (auto mode : {NonTemporalStores::Never, NonTemporalStores::Always}) {
+    setNonTemporalStores(mode);
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    mRaw->setTable(curve, GetParam());
+    rawspeed::SonyArw2Decompressor a(mRaw, bs);
+    a.decompress();
+    setNonTemporalStores(NonTemporalStores::Auto);
+
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      const auto* e =
+          reinterpret_cast<const ushort16*>(expected->getData(0, y));
+      for (int x = 0; x < dim.x; x++)
+        ASSERT_EQ(row[x], e[x]) << x << " " << y;
+    }
+  }
+}
+
+TEST(SonyArw2DecompressorTest, SameIndexThrows) {
+  const iPoint2D dim(32, 2);
+  auto data = createInput(dim);
+  // Of the last packet, the minimum at where the maximum is.
+  const size_t last = data.size() - 16;
+  data[last + 3] = (data[last + 3] & 0xc3) | ((data[last + 2] >> 6) << 2) |
+                   ((data[last + 3] & 0x3) << 4);
+  const ByteStream bs(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  rawspeed::SonyArw2Decompressor a(mRaw, bs);
+  ASSERT_THROW(a.decompress(), RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,561 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/UncompressedDecompressor.h" // for UncompressedDeco...
+#include "common/Cancellation.h"                    // for Cancellation
+#include "common/Common.h"                          // for uchar8, ushort16
+#include "common/Cpuid.h"                           // for Cpuid
+#include "common/Executor.h"                        // for setExecutor, Thr...
+#include "common/Memory.h"                          // for setNonTemporalSt...
+#include "common/Point.h"                           // for iPoint2D, iRectan...
+#include "common/RawImage.h"                        // for RawImage, RawIma...
+#include "common/TableLookUp.h"                     // for TableLookUp
+#include "decoders/RawDecoderException.h"           // for RawDecoderExcept...
+#include "io/BitPumpLSB.h"                          // for BitPumpLSB
+#include "io/BitPumpMSB.h"                          // for BitPumpMSB
+#include "io/BitPumpMSB16.h"                        // for BitPumpMSB16
+#include "io/BitPumpMSB32.h"                        // for BitPumpMSB32
+#include "io/Buffer.h"                              // for Buffer, DataBuffer
+#include "io/ByteStream.h"                          // for ByteStream
+#include "io/Endianness.h"                          // for Endianness, Endi...
+#include <array>                                    // for array
+#include <chrono>                                   // for steady_clock
+#include <gtest/gtest.h>                            // for ParamIteratorInt...
+#include <memory>                                   // for make_shared
+#include <tuple>                                    // for get, tuple
+#include <vector>                                   // for vector
+
+using rawspeed::BitOrder;
+using rawspeed::BitOrder_LSB;
+using rawspeed::BitOrder_MSB;
+using rawspeed::BitOrder_MSB16;
+using rawspeed::BitOrder_MSB32;
+using rawspeed::BitPumpLSB;
+using rawspeed::BitPumpMSB;
+using rawspeed::BitPumpMSB16;
+using rawspeed::BitPumpMSB32;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::Cancellation;
+using rawspeed::Cpuid;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::getHostEndianness;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::NonTemporalStores;
+using rawspeed::RawDecoderException;
+using rawspeed::RawImage;
+using rawspeed::RawImageData;
+using rawspeed::setExecutor;
+using rawspeed::setNonTemporalStores;
+using rawspeed::TableLookUp;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::UncompressedDecompressor;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The rows are read by one bit pump, unless they are padded, then each of
+// them gets its own one.
+template <typename Pump>
+static std::vector<ushort16> decodeWithPump(const ByteStream& bs, int width,
+                                            int height, int pitch, int bits,
+                                            bool padded) {
+  std::vector<ushort16> pixels;
+  Pump whole(bs);
+  for (int y = 0; y < height; y++) {
+    Pump row(bs.getSubStream(y * pitch, pitch));
+    for (int x = 0; x < width; x++)
+      pixels.emplace_back(padded ? row.getBits(bits) : whole.getBits(bits));
+  }
+  return pixels;
+}
+
+using ReadUncompressedRawType = std::tuple<int, BitOrder, int>;
+class ReadUncompressedRawTest
+    : public ::testing::TestWithParam<ReadUncompressedRawType> {
+protected:
+  ReadUncompressedRawTest() = default;
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(std::get<0>(GetParam())));
+    order = std::get<1>(GetParam());
+    bits = std::get<2>(GetParam());
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  void check(int padding) {
+    // Which makes the rows of all the bit depths a whole number of bytes,
+    // and not one of 4 bytes for most of them.
+    const int width = 36;
+    const int height = 37;
+    const int pitch = width * bits / 8 + padding;
+
+    std::vector<uchar8> data(pitch * height);
+    uint32 random = 1;
+    for (auto& b : data) {
+      random = random * 1103515245U + 12345U;
+      b = random >> 16;
+    }
+    const ByteStream bs(
+        DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+
+    std::vector<ushort16> expected;
+    const bool padded = padding != 0;
+    switch (order) {
+    case BitOrder_MSB:
+      expected = decodeWithPump<BitPumpMSB>(bs, width, height, pitch, bits,
+                                            padded);
+      break;
+    case BitOrder_MSB16:
+      expected = decodeWithPump<BitPumpMSB16>(bs, width, height, pitch, bits,
+                                              padded);
+      break;
+    case BitOrder_MSB32:
+      expected = decodeWithPump<BitPumpMSB32>(bs, width, height, pitch, bits,
+                                              padded);
+      break;
+    default:
+      expected = decodeWithPump<BitPumpLSB>(bs, width, height, pitch, bits,
+                                            padded);
+      break;
+    }
+
+    // With an offset, into a larger image.
+    const iPoint2D offset(3, 2);
+    RawImage mRaw = RawImage::create(
+        {width + offset.x + 1, height + offset.y}, rawspeed::TYPE_USHORT16, 1);
+    UncompressedDecompressor u(bs, mRaw);
+    u.readUncompressedRaw({width, height}, offset, pitch, bits, order);
+
+    for (int y = 0; y < height; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(
+          mRaw->getData(offset.x, offset.y + y));
+      for (int x = 0; x < width; x++)
+        ASSERT_EQ(row[x], expected[y * width + x]) << x << " " << y;
+    }
+  }
+
+  BitOrder order;
+  int bits;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Bands, ReadUncompressedRawTest,
+    ::testing::Combine(::testing::Values(1, 3, 8),
+                       ::testing::Values(BitOrder_LSB, BitOrder_MSB,
+                                         BitOrder_MSB16, BitOrder_MSB32),
+                       ::testing::Values(6, 8, 10, 12, 14, 16)));
+
+TEST_P(ReadUncompressedRawTest, Contiguous) { check(0); }
+
+TEST_P(ReadUncompressedRawTest, Padded) { check(5); }
+
+// Through the staging of the rows, which is done in the chunks of the bands.
+TEST_P(ReadUncompressedRawTest, Streaming) {
+  setNonTemporalStores(NonTemporalStores::Always);
+  check(0);
+  check(5);
+  setNonTemporalStores(NonTemporalStores::Auto);
+}
+
+// The dithering of a row only depends on where it is, so the rows decode the
+// same, whatever comes before them.
+TEST(Decode8BitRawTest, DitheredRowsAreIndependent) {
+  const int width = 37;
+  const int height = 9;
+
+  std::vector<ushort16> table(256);
+  for (uint32 i = 0; i < table.size(); i++)
+    table[i] = 100 + i * 97 + (i * i) / 16;
+
+  std::vector<uchar8> data(width * height);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  // The same rows, except for the first ones.
+  std::vector<uchar8> other(data);
+  for (int i = 0; i < 3 * width; i++)
+    other[i] ^= 0x5a;
+
+  const auto decode = [&](const std::vector<uchar8>& in) {
+    RawImage mRaw = RawImage::create({width, height}, rawspeed::TYPE_USHORT16,
+                                     1);
+    mRaw->setTable(table, true);
+    UncompressedDecompressor u(
+        ByteStream(DataBuffer(Buffer(in.data(), in.size()),
+                              Endianness::little)),
+        mRaw);
+    u.decode8BitRaw<false>(width, height);
+    return mRaw;
+  };
+  const RawImage a = decode(data);
+  const RawImage b = decode(other);
+
+  for (int y = 3; y < height; y++) {
+    const auto* rowA = reinterpret_cast<const ushort16*>(a->getData(0, y));
+    const auto* rowB = reinterpret_cast<const ushort16*>(b->getData(0, y));
+    for (int x = 0; x < width; x++)
+      ASSERT_EQ(rowA[x], rowB[x]) << x << " " << y;
+  }
+}
+
+// The curve alone is looked up by the vector kernels, if any, with the same
+// result as the scalar one, also of the dithering, which only depends on the
+// position of each pixel.
+TEST(Decode8BitRawTest, CurveSameAsScalar) {
+  // Some whole blocks of the kernels, and the rest.
+  const int width = 101;
+  const int height = 5;
+
+  std::vector<ushort16> curve(256);
+  for (uint32 i = 0; i < curve.size(); i++)
+    curve[i] = 100 + i * 97 + (i * i) / 16;
+
+  std::vector<uchar8> data(width * height);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+
+  for (const bool dither : {false, true}) {
+    TableLookUp table(1, dither);
+    table.setTable(0, curve);
+
+    for (const unsigned features : {unsigned(Cpuid::FEATURE_ALL), 0U}) {
+      Cpuid::setEnabled(features);
+      RawImage mRaw = RawImage::create({width, height},
+                                       rawspeed::TYPE_USHORT16, 1);
+      mRaw->setTable(curve, dither);
+      UncompressedDecompressor u(
+          ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                                Endianness::little)),
+          mRaw);
+      u.decode8BitRaw<false>(width, height);
+
+      for (int y = 0; y < height; y++) {
+        const auto* row =
+            reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+        for (int x = 0; x < width; x++) {
+          const uchar8 v = data[y * width + x];
+          ASSERT_EQ(row[x], dither ? table.lookUpDitheredAt(v, x, y)
+                                   : curve[v])
+              << x << " " << y << " " << dither << " " << features;
+        }
+      }
+    }
+    Cpuid::setEnabled(Cpuid::FEATURE_ALL);
+  }
+}
+
+// With the levels applied as the pixels are stored, they are as if they had
+// been scaled afterwards, and they are not scaled again.
+TEST(Decode8BitRawTest, ScaleOnWrite) {
+  const int width = 37;
+  const int height = 9;
+  const RawImageData::Levels levels = {{{10, 12, 14, 16}}, 1000};
+
+  std::vector<ushort16> table(256);
+  for (uint32 i = 0; i < table.size(); i++)
+    table[i] = 5 + i * 4;
+
+  std::vector<uchar8> data(width * height);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+
+  const auto decode = [&](bool onWrite) {
+    RawImage mRaw = RawImage::create({width, height}, rawspeed::TYPE_USHORT16,
+                                     1);
+    mRaw->setTable(table, false);
+    mRaw->mDitherScale = false;
+    if (onWrite)
+      mRaw->scaleOnWrite = levels;
+    UncompressedDecompressor u(
+        ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                              Endianness::little)),
+        mRaw);
+    u.decode8BitRaw<false>(width, height);
+    mRaw->setTable(nullptr);
+    mRaw->finishScaleOnWrite();
+    mRaw->blackLevelSeparate = levels.black;
+    mRaw->whitePoint = levels.white;
+    // As the metadata of the decoder would do.
+    mRaw->finishScaleOnWrite();
+    return mRaw;
+  };
+
+  const RawImage expected = decode(false);
+  ASSERT_FALSE(expected->isScaledOnWrite());
+  expected->scaleBlackWhite();
+
+  const RawImage img = decode(true);
+  ASSERT_TRUE(img->isScaledOnWrite());
+  ASSERT_EQ(img->whitePoint, 65535);
+  ASSERT_EQ(img->blackLevelSeparate[3], 0);
+  img->scaleBlackWhite();
+
+  for (int y = 0; y < height; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+    const auto* e = reinterpret_cast<const ushort16*>(expected->getData(0, y));
+    for (int x = 0; x < width; x++)
+      ASSERT_NEAR(row[x], e[x], 1) << x << " " << y;
+  }
+}
+
+// The pixels of a 12-bit packed row, as pairs of 3 bytes, with a control
+// byte after each of the pixels 8 and 9 of 10, with the skips.
+static std::vector<ushort16> unpack12BitRow(const uchar8* in, int width,
+                                            bool big, bool skips) {
+  std::vector<ushort16> row;
+  for (int x = 0; x < width; x += 2, in += 3) {
+    if (big) {
+      row.emplace_back(in[0] << 4 | in[1] >> 4);
+      row.emplace_back((in[1] & 0xf) << 8 | in[2]);
+    } else {
+      row.emplace_back((in[1] & 0xf) << 8 | in[0]);
+      row.emplace_back(in[2] << 4 | in[1] >> 4);
+    }
+    if (skips && x % 10 == 8)
+      in++;
+  }
+  return row;
+}
+
+class Decode12BitRawTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(3));
+    data.resize(8192);
+    uint32 random = 1;
+    for (auto& b : data) {
+      random = random * 1103515245U + 12345U;
+      b = random >> 16;
+    }
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  template <Endianness e, bool interlaced, bool skips>
+  void check(int width, int height) {
+    RawImage mRaw =
+        RawImage::create({width, height}, rawspeed::TYPE_USHORT16, 1);
+    UncompressedDecompressor u(
+        ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                              Endianness::little)),
+        mRaw);
+    u.decode12BitRaw<e, interlaced, skips>(width, height);
+
+    const int inPitch = width * 3 / 2 + (skips ? (width + 1) / 10 : 0);
+    for (int y = 0; y < height; y++) {
+      // The second field starts at the next 2048 bytes.
+      const bool second = interlaced && y % 2;
+      const int fieldRow = interlaced ? y / 2 : y;
+      const uchar8* in = &data[(second ? 2048 : 0) + fieldRow * inPitch];
+      const auto expected =
+          unpack12BitRow(in, width, e == Endianness::big, skips);
+
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < width; x++)
+        ASSERT_EQ(row[x], expected[x]) << x << " " << y;
+    }
+  }
+
+  std::vector<uchar8> data;
+};
+
+TEST_F(Decode12BitRawTest, Little) {
+  check<Endianness::little, false, false>(20, 150);
+}
+
+TEST_F(Decode12BitRawTest, Big) {
+  check<Endianness::big, false, false>(20, 150);
+}
+
+// More rows than one band of each field.
+TEST_F(Decode12BitRawTest, Interlaced) {
+  check<Endianness::big, true, false>(6, 151);
+}
+
+TEST_F(Decode12BitRawTest, Streaming) {
+  setNonTemporalStores(NonTemporalStores::Always);
+  check<Endianness::big, true, false>(6, 151);
+  check<Endianness::little, false, true>(20, 70);
+  setNonTemporalStores(NonTemporalStores::Auto);
+}
+
+// With and without the control byte at the end of the row.
+TEST_F(Decode12BitRawTest, Skips) {
+  check<Endianness::little, false, true>(20, 70);
+  check<Endianness::little, false, true>(18, 70);
+  check<Endianness::big, false, true>(20, 70);
+}
+
+TEST(ReadUncompressedRawCancelledTest, PastTheDeadline) {
+  const iPoint2D dim(16, 300);
+  std::vector<uchar8> data(2 * dim.area());
+  RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  auto cancellation = std::make_shared<Cancellation>();
+  cancellation->setDeadline(std::chrono::steady_clock::now());
+  mRaw->cancellation = cancellation;
+
+  UncompressedDecompressor u(
+      ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                            Endianness::little)),
+      mRaw);
+  ASSERT_THROW(u.readUncompressedRaw(dim, {0, 0}, 2 * dim.x, 16, BitOrder_LSB),
+               RawDecoderException);
+}
+
+// The pixels of the input, aligned, of 16 by 4 pixels and 16 more bytes.
+class AliasInputTest : public ::testing::Test {
+protected:
+  static constexpr int Width = 16;
+  static constexpr int Height = 4;
+
+  void SetUp() override {
+    if (getHostEndianness() != Endianness::little)
+      return;
+    for (int i = 0; i < size; i++)
+      data[i] = i;
+  }
+
+  ByteStream getInput() const {
+    return ByteStream(DataBuffer(
+        Buffer(reinterpret_cast<const uchar8*>(data.data()), 2 * size),
+        Endianness::little));
+  }
+
+  RawImage getImage() const {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    mRaw->aliasInput = true;
+    return mRaw;
+  }
+
+  void checkPixels(const RawImage& mRaw, int pitch) const {
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < dim.x; x++)
+        ASSERT_EQ(row[x], data[y * pitch / 2 + x]) << x << " " << y;
+    }
+  }
+
+  const iPoint2D dim{Width, Height};
+  static constexpr int size = Width * Height + 8;
+  alignas(16) std::array<ushort16, size> data;
+};
+
+TEST_F(AliasInputTest, ReadUncompressedRaw) {
+  if (getHostEndianness() != Endianness::little)
+    return;
+  const RawImage mRaw = getImage();
+  UncompressedDecompressor u(getInput(), mRaw);
+  u.readUncompressedRaw(dim, {0, 0}, 2 * dim.x, 16, BitOrder_LSB);
+
+  ASSERT_TRUE(mRaw->isReadOnly());
+  ASSERT_EQ(mRaw->getData(), reinterpret_cast<const uchar8*>(data.data()));
+  checkPixels(mRaw, 2 * dim.x);
+}
+
+TEST_F(AliasInputTest, DecodeRawUnpacked) {
+  if (getHostEndianness() != Endianness::little)
+    return;
+  const RawImage mRaw = getImage();
+  UncompressedDecompressor u(getInput(), mRaw);
+  u.decodeRawUnpacked<16, Endianness::little>(dim.x, dim.y);
+
+  ASSERT_TRUE(mRaw->isReadOnly());
+  checkPixels(mRaw, 2 * dim.x);
+}
+
+TEST_F(AliasInputTest, CopiedOnWrite) {
+  if (getHostEndianness() != Endianness::little)
+    return;
+  const RawImage mRaw = getImage();
+  UncompressedDecompressor u(getInput(), mRaw);
+  u.readUncompressedRaw(dim, {0, 0}, 2 * dim.x, 16, BitOrder_LSB);
+  ASSERT_TRUE(mRaw->isReadOnly());
+
+  mRaw->clearArea(iRectangle2D(0, 0, dim.x, 1));
+  ASSERT_FALSE(mRaw->isReadOnly());
+  ASSERT_NE(mRaw->getData(), reinterpret_cast<const uchar8*>(data.data()));
+  // The input is untouched.
+  for (int x = 0; x < dim.x; x++)
+    ASSERT_EQ(data[x], x);
+
+  const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, 0));
+  for (int x = 0; x < dim.x; x++)
+    ASSERT_EQ(row[x], 0);
+  for (int y = 1; y < dim.y; y++) {
+    row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < dim.x; x++)
+      ASSERT_EQ(row[x], data[y * dim.x + x]) << x << " " << y;
+  }
+}
+
+TEST_F(AliasInputTest, NotAliased) {
+  if (getHostEndianness() != Endianness::little)
+    return;
+  // Not aligned.
+  {
+    const RawImage mRaw = getImage();
+    UncompressedDecompressor u(
+        ByteStream(DataBuffer(
+            Buffer(reinterpret_cast<const uchar8*>(data.data()) + 2,
+                   2 * size - 2),
+            Endianness::little)),
+        mRaw);
+    u.readUncompressedRaw(dim, {0, 0}, 2 * dim.x, 16, BitOrder_LSB);
+    ASSERT_FALSE(mRaw->isReadOnly());
+  }
+  // A pitch that is not a multiple of the alignment.
+  {
+    const RawImage mRaw = getImage();
+    UncompressedDecompressor u(getInput(), mRaw);
+    u.readUncompressedRaw(dim, {0, 0}, 2 * dim.x + 2, 16, BitOrder_LSB);
+    ASSERT_FALSE(mRaw->isReadOnly());
+    checkPixels(mRaw, 2 * dim.x + 2);
+  }
+  // Not all of the image.
+  {
+    const RawImage mRaw = getImage();
+    UncompressedDecompressor u(getInput(), mRaw);
+    u.readUncompressedRaw({dim.x, dim.y - 1}, {0, 1}, 2 * dim.x, 16,
+                          BitOrder_LSB);
+    ASSERT_FALSE(mRaw->isReadOnly());
+  }
+  // Not asked for.
+  {
+    const RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+    UncompressedDecompressor u(getInput(), mRaw);
+    u.readUncompressedRaw(dim, {0, 0}, 2 * dim.x, 16, BitOrder_LSB);
+    ASSERT_FALSE(mRaw->isReadOnly());
+    checkPixels(mRaw, 2 * dim.x);
+  }
+}
+
+} // namespace rawspeed_test
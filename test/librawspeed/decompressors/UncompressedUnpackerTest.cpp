@@ -0,0 +1,252 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/UncompressedUnpacker.h" // for UnpackKernel, unpac...
+#include "common/Common.h"                      // for uchar8, ushort16
+#include "common/Cpuid.h"                       // for Cpuid
+#include "common/RawspeedException.h"           // for RawspeedException
+#include "io/BitPumpLSB.h"                      // for BitPumpLSB
+#include "io/BitPumpMSB.h"                      // for BitPumpMSB
+#include "io/Buffer.h"                          // for Buffer, DataBuffer
+#include "io/ByteStream.h"                      // for ByteStream
+#include "io/Endianness.h"                      // for Endianness, Endianne...
+#include <gtest/gtest.h>                        // for ParamIteratorInterface
+#include <tuple>                                // for make_tuple, get, tuple
+#include <vector>                               // for vector
+
+using rawspeed::BitOrder;
+using rawspeed::BitOrder_LSB;
+using rawspeed::BitOrder_MSB;
+using rawspeed::BitPumpLSB;
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::Cpuid;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::getUnpackKernel;
+using rawspeed::getUnpackKernelName;
+using rawspeed::isUnpackKernelSupported;
+using rawspeed::RawspeedException;
+using rawspeed::setUnpackKernel;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::UnpackKernel;
+using rawspeed::unpackPackedRows;
+using rawspeed::unpackUnpackedRows;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+static std::vector<uchar8> randomData(size_t size) {
+  std::vector<uchar8> data(size);
+  uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+  return data;
+}
+
+// The whole image, as one bit stream.
+template <typename Pump>
+static std::vector<ushort16> decodeWithPump(const std::vector<uchar8>& data,
+                                            size_t numPixels, int bits) {
+  const ByteStream bs(DataBuffer(Buffer(data.data(), data.size()),
+                                 Endianness::little));
+  Pump pump(bs);
+
+  std::vector<ushort16> pixels(numPixels);
+  for (auto& p : pixels)
+    p = pump.getBits(bits);
+  return pixels;
+}
+
+using UnpackPackedType = std::tuple<UnpackKernel, int, BitOrder>;
+class UnpackPackedTest : public ::testing::TestWithParam<UnpackPackedType> {
+protected:
+  UnpackPackedTest() = default;
+  virtual void SetUp() {
+    kernel = std::get<0>(GetParam());
+    bits = std::get<1>(GetParam());
+    order = std::get<2>(GetParam());
+
+    if (!isUnpackKernelSupported(kernel))
+      return;
+    setUnpackKernel(kernel);
+  }
+  virtual void TearDown() { setUnpackKernel(UnpackKernel::Auto); }
+
+  UnpackKernel kernel;
+  int bits;
+  BitOrder order;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Kernels, UnpackPackedTest,
+    ::testing::Combine(::testing::Values(UnpackKernel::Scalar,
+                                         UnpackKernel::SSSE3,
+                                         UnpackKernel::AVX2,
+                                         UnpackKernel::NEON),
+                       ::testing::Values(10, 12, 14),
+                       ::testing::Values(BitOrder_LSB, BitOrder_MSB)));
+
+TEST_P(UnpackPackedTest, SameAsBitPump) {
+  if (!isUnpackKernelSupported(kernel))
+    return;
+
+  // Various numbers of the groups of 8 pixels, and of the remaining pixels.
+  for (uint32 width : {4U, 8U, 12U, 16U, 20U, 36U, 64U, 100U, 1004U}) {
+    const uint32 height = 3;
+    const uint32 inPitch = width * bits / 8;
+
+    // No slack at the end, the kernels must not read past it.
+    const auto data = randomData(inPitch * height);
+
+    const auto expected =
+        order == BitOrder_MSB
+            ? decodeWithPump<BitPumpMSB>(data, width * height, bits)
+            : decodeWithPump<BitPumpLSB>(data, width * height, bits);
+
+    // The output rows are padded, and the padding must stay untouched.
+    const uint32 outWidth = width + 5;
+    std::vector<ushort16> out(outWidth * height, 0xDEAD);
+    unpackPackedRows(data.data(), data.size(), inPitch, out.data(),
+                     outWidth * sizeof(ushort16), width, height, bits, order);
+
+    for (uint32 y = 0; y < height; y++) {
+      for (uint32 x = 0; x < outWidth; x++) {
+        const ushort16 pix = out[y * outWidth + x];
+        if (x < width)
+          ASSERT_EQ(pix, expected[y * width + x]) << width << " " << x;
+        else
+          ASSERT_EQ(pix, 0xDEAD);
+      }
+    }
+  }
+}
+
+using UnpackUnpackedType = std::tuple<UnpackKernel, int, Endianness>;
+class UnpackUnpackedTest
+    : public ::testing::TestWithParam<UnpackUnpackedType> {
+protected:
+  UnpackUnpackedTest() = default;
+  virtual void SetUp() {
+    kernel = std::get<0>(GetParam());
+    bits = std::get<1>(GetParam());
+    e = std::get<2>(GetParam());
+
+    if (!isUnpackKernelSupported(kernel))
+      return;
+    setUnpackKernel(kernel);
+  }
+  virtual void TearDown() { setUnpackKernel(UnpackKernel::Auto); }
+
+  UnpackKernel kernel;
+  int bits;
+  Endianness e;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Kernels, UnpackUnpackedTest,
+    ::testing::Combine(::testing::Values(UnpackKernel::Scalar,
+                                         UnpackKernel::SSSE3,
+                                         UnpackKernel::AVX2,
+                                         UnpackKernel::NEON),
+                       ::testing::Values(12, 14, 16),
+                       ::testing::Values(Endianness::little,
+                                         Endianness::big)));
+
+TEST_P(UnpackUnpackedTest, SameAsScalar) {
+  if (!isUnpackKernelSupported(kernel))
+    return;
+
+  for (uint32 width : {1U, 7U, 8U, 15U, 16U, 33U, 1001U}) {
+    const uint32 height = 3;
+    const auto data = randomData(2 * width * height);
+
+    std::vector<ushort16> out(width * height);
+    unpackUnpackedRows(data.data(), out.data(), width * sizeof(ushort16),
+                       width, height, bits, e);
+
+    for (uint32 i = 0; i < width * height; i++) {
+      const uint32 g1 = data[2 * i];
+      const uint32 g2 = data[2 * i + 1];
+      const uint32 expected =
+          e == Endianness::little
+              ? ((g2 << 8) | g1) >> (16 - bits)
+              : ((g1 << 8) | g2) & ((1U << bits) - 1U);
+      ASSERT_EQ(out[i], expected) << width << " " << i;
+    }
+  }
+}
+
+TEST(UncompressedUnpackerTest, Kernels) {
+  ASSERT_TRUE(isUnpackKernelSupported(UnpackKernel::Auto));
+  ASSERT_TRUE(isUnpackKernelSupported(UnpackKernel::Scalar));
+
+  ASSERT_STREQ(getUnpackKernelName(UnpackKernel::Auto), "Auto");
+  ASSERT_STREQ(getUnpackKernelName(UnpackKernel::SSSE3), "SSSE3");
+
+  ASSERT_EQ(getUnpackKernel(), UnpackKernel::Auto);
+  setUnpackKernel(UnpackKernel::Scalar);
+  ASSERT_EQ(getUnpackKernel(), UnpackKernel::Scalar);
+  setUnpackKernel(UnpackKernel::Auto);
+
+  for (auto kernel :
+       {UnpackKernel::SSSE3, UnpackKernel::AVX2, UnpackKernel::NEON}) {
+    if (!isUnpackKernelSupported(kernel)) {
+      ASSERT_THROW(setUnpackKernel(kernel), RawspeedException);
+    }
+  }
+}
+
+// Without the CPU features, only the scalar kernel is supported.
+TEST(UncompressedUnpackerTest, FollowsTheCpuFeatures) {
+  const unsigned enabled = Cpuid::getEnabled();
+  Cpuid::setEnabled(0);
+  for (auto kernel :
+       {UnpackKernel::SSSE3, UnpackKernel::AVX2, UnpackKernel::NEON})
+    EXPECT_FALSE(isUnpackKernelSupported(kernel));
+  ASSERT_TRUE(isUnpackKernelSupported(UnpackKernel::Scalar));
+  Cpuid::setEnabled(enabled);
+
+  if (Cpuid::getDetected() & Cpuid::FEATURE_SSSE3) {
+    ASSERT_EQ(isUnpackKernelSupported(UnpackKernel::SSSE3),
+              (enabled & Cpuid::FEATURE_SSSE3) != 0);
+  }
+}
+
+TEST(UncompressedUnpackerTest, BadParameters) {
+  const std::vector<uchar8> data(64);
+  std::vector<ushort16> out(32);
+
+  ASSERT_THROW(unpackPackedRows(data.data(), data.size(), 16, out.data(), 64,
+                                8, 1, 16, BitOrder_MSB),
+               RawspeedException);
+  ASSERT_THROW(unpackPackedRows(data.data(), data.size(), 16, out.data(), 64,
+                                8, 1, 12, rawspeed::BitOrder_MSB16),
+               RawspeedException);
+  ASSERT_THROW(unpackUnpackedRows(data.data(), out.data(), 64, 8, 1, 10,
+                                  Endianness::little),
+               RawspeedException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,288 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "decompressors/VC5Decompressor.h"  // for VC5Decompressor
+#include "common/Common.h"                  // for uchar8, ushort16, uint32
+#include "common/Executor.h"                // for setExecutor, ThreadPoo...
+#include "common/Point.h"                   // for iPoint2D
+#include "common/RawImage.h"                // for RawImage, RawImageData
+#include "common/RawspeedException.h"       // for RawspeedException
+#include "decompressors/TileDecodeEngine.h" // for TileDecodeEngine, setTil...
+#include "io/Buffer.h"                      // for Buffer, DataBuffer
+#include "io/ByteStream.h"                  // for ByteStream
+#include "io/Endianness.h"                  // for Endianness
+#include <array>                            // for array
+#include <gtest/gtest.h>                    // for Message, TestPartResult
+#include <memory>                           // for make_shared
+#include <vector>                           // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::RawspeedException;
+using rawspeed::setTileDecodeEngine;
+using rawspeed::TileDecodeEngine;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+using rawspeed::VC5Decompressor;
+
+namespace rawspeed_test {
+
+// A VC-5 stream of a flat image: every channel is just its low-pass value,
+// and all the high-pass bands are zero. Unless there is the noise, of the
+// values from -2 to 2 in the high-pass bands.
+class FlatVC5Stream {
+public:
+  FlatVC5Stream(const iPoint2D& dim, const std::array<ushort16, 4>& lowpass,
+                bool noise = false) {
+    for (uchar8 b : {0x56, 0x43, 0x2d, 0x35})
+      data.emplace_back(b);
+
+    // The smallest wavelet, and the number of pixels of all of them.
+    iPoint2D waveletDim(dim.x / 2, dim.y / 2);
+    std::array<int, 3> areas;
+    for (int& area : areas) {
+      waveletDim = {(waveletDim.x + 1) / 2, (waveletDim.y + 1) / 2};
+      area = waveletDim.area();
+    }
+
+    for (int c = 0; c < 4; c++) {
+      tag(0x003e, c); // ChannelNumber
+      // No descaling of the largest wavelet, the others undo their halving.
+      tag(0x006d, 0x2800); // PrescaleShift
+
+      tag(0x0030, 0);  // SubbandNumber
+      tag(0x0023, 16); // LowpassPrecision
+      std::vector<uchar8> band;
+      for (int i = 0; i < areas.back(); i++) {
+        band.emplace_back(lowpass[c] >> 8);
+        band.emplace_back(lowpass[c]);
+      }
+      codeblock(band);
+
+      // The subbands go from the smallest wavelet to the largest one.
+      for (int subband = 1; subband < 10; subband++) {
+        tag(0x0030, subband);
+        tag(0x0035, 1); // Quantization
+        codeblock(highPassBand(areas[2 - (subband - 1) / 3], noise));
+      }
+    }
+  }
+
+  ByteStream getByteStream() const {
+    return ByteStream(
+        DataBuffer(Buffer(data.data(), data.size()), Endianness::big));
+  }
+
+private:
+  void put16(ushort16 v) {
+    data.emplace_back(v >> 8);
+    data.emplace_back(v);
+  }
+
+  void tag(ushort16 t, ushort16 v) {
+    put16(t);
+    put16(v);
+  }
+
+  // The size of the chunk is in the 4-byte units.
+  void codeblock(std::vector<uchar8> band) {
+    band.resize((band.size() + 3) / 4 * 4);
+    const uint32 size = band.size() / 4;
+    tag(0x6000 | (size >> 16), size & 0xffff);
+    data.insert(data.end(), band.begin(), band.end());
+  }
+
+  void put(std::vector<bool>* bits, uint32 code, int len) {
+    for (int i = len - 1; i >= 0; i--)
+      bits->emplace_back((code >> i) & 1U);
+  }
+
+  // Each zero is a single 0 bit, followed by the band end marker.
+  std::vector<uchar8> highPassBand(int pixels, bool noise) {
+    std::vector<bool> bits;
+    for (int i = 0; i < pixels; i++) {
+      random = random * 1103515245U + 12345U;
+      switch (noise ? (random >> 16) % 5 : 0) {
+      case 0:
+        put(&bits, 0b0, 1);
+        break;
+      case 1:
+      case 2:
+        // 1, and its sign.
+        put(&bits, 0b10, 2);
+        put(&bits, (random >> 8) & 1U, 1);
+        break;
+      default:
+        // 2, which is decompanded to 2 too.
+        put(&bits, 0b111, 3);
+        put(&bits, (random >> 8) & 1U, 1);
+        break;
+      }
+    }
+    // The band end marker, and its sign.
+    put(&bits, 0x03114BA3U, 26);
+    put(&bits, 0, 1);
+
+    // And some slack for the bit pump.
+    std::vector<uchar8> band((bits.size() + 7) / 8 + 8);
+    for (size_t i = 0; i < bits.size(); i++)
+      band[i / 8] |= bits[i] << (7 - i % 8);
+    return band;
+  }
+
+  std::vector<uchar8> data;
+  uint32 random = 1;
+};
+
+static RawImage createImage(const iPoint2D& dim) {
+  RawImage img = RawImage::create(dim, rawspeed::TYPE_USHORT16, 1);
+  img->whitePoint = 65535;
+  return img;
+}
+
+// Without the high-pass bands, the previews of the flat image are flat too,
+// and the same as the full decode.
+TEST(VC5DecompressorTest, PreviewOfFlatImage) {
+  const iPoint2D dim(64, 48);
+  const FlatVC5Stream stream(dim, {{4 * 1000, 4 * 2148, 4 * 1998, 4 * 2068}});
+
+  RawImage full = createImage(dim);
+  {
+    VC5Decompressor v(stream.getByteStream(), full);
+    v.decode(0, 0, dim.x, dim.y);
+  }
+
+  for (int level = 1; level <= VC5Decompressor::maxPreviewLevel; level++) {
+    RawImage mRaw = createImage(dim);
+    VC5Decompressor v(stream.getByteStream(), mRaw);
+
+    const iPoint2D previewDim = v.getPreviewDim(level);
+    ASSERT_EQ(previewDim, iPoint2D(dim.x >> level, dim.y >> level));
+
+    RawImage preview = createImage(previewDim);
+    v.decodePreview(level, preview);
+
+    for (int y = 0; y < previewDim.y; y++) {
+      const auto* row =
+          reinterpret_cast<const ushort16*>(preview->getData(0, y));
+      const auto* expected =
+          reinterpret_cast<const ushort16*>(full->getData(0, y % 2));
+      for (int x = 0; x < previewDim.x; x++)
+        ASSERT_EQ(row[x], expected[x % 2]) << level << " " << x << " " << y;
+    }
+  }
+}
+
+// The rows of the bands are reconstructed in strips, which each thread
+// starts at a different row.
+TEST(VC5DecompressorTest, SameWithAnyNumberOfThreads) {
+  const iPoint2D dim(176, 200);
+  const FlatVC5Stream stream(dim, {{4 * 1000, 4 * 2148, 4 * 1998, 4 * 2068}},
+                             /*noise=*/true);
+
+  std::vector<RawImage> images;
+  for (int threads : {1, 3, 7}) {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(threads));
+    images.emplace_back(createImage(dim));
+    VC5Decompressor v(stream.getByteStream(), images.back());
+    v.decode(0, 0, dim.x, dim.y);
+  }
+  setExecutor(nullptr);
+
+  bool flat = true;
+  for (int y = 0; y < dim.y; y++) {
+    const auto* expected =
+        reinterpret_cast<const ushort16*>(images[0]->getData(0, y));
+    for (const RawImage& img : images) {
+      const auto* row = reinterpret_cast<const ushort16*>(img->getData(0, y));
+      for (int x = 0; x < dim.x; x++) {
+        ASSERT_EQ(row[x], expected[x]) << x << " " << y;
+        flat &= expected[x] == expected[x % 2];
+      }
+    }
+  }
+  // Or it would not be much of a test.
+  ASSERT_FALSE(flat);
+}
+
+TEST(VC5DecompressorTest, BadPreview) {
+  const iPoint2D dim(64, 48);
+  const FlatVC5Stream stream(dim, {{4000, 8192, 8192, 8192}});
+
+  RawImage mRaw = createImage(dim);
+  VC5Decompressor v(stream.getByteStream(), mRaw);
+
+  for (int level : {0, VC5Decompressor::maxPreviewLevel + 1})
+    ASSERT_THROW(v.getPreviewDim(level), RawspeedException);
+
+  RawImage preview = createImage({dim.x / 2, dim.y / 4});
+  ASSERT_THROW(v.decodePreview(1, preview), RawspeedException);
+}
+
+// Leaves the image as it is, the stream being all it gets.
+class FakeTileDecodeEngine final : public TileDecodeEngine {
+public:
+  explicit FakeTileDecodeEngine(bool accept_) : accept(accept_) {}
+
+  bool decompressDng(const rawspeed::AbstractDngDecompressor& /*d*/,
+                     const std::vector<int>& /*order*/) override {
+    return false;
+  }
+
+  bool decompressVC5(const ByteStream& bs, const RawImage& img) override {
+    size = bs.getRemainSize();
+    dim = img->dim;
+    return accept;
+  }
+
+  bool accept;
+  uint32 size = 0;
+  iPoint2D dim;
+};
+
+TEST(VC5DecompressorTest, TileDecodeEngine) {
+  const iPoint2D dim(64, 48);
+  const FlatVC5Stream stream(dim, {{4 * 1000, 4 * 2148, 4 * 1998, 4 * 2068}});
+
+  for (bool accept : {false, true}) {
+    auto engine = std::make_shared<FakeTileDecodeEngine>(accept);
+    setTileDecodeEngine(engine);
+
+    RawImage mRaw = createImage(dim);
+    mRaw->clearArea({{0, 0}, dim}, 0xFF);
+    VC5Decompressor v(stream.getByteStream(), mRaw);
+    v.decode(0, 0, dim.x, dim.y);
+    setTileDecodeEngine(nullptr);
+
+    ASSERT_EQ(engine->size, stream.getByteStream().getRemainSize());
+    ASSERT_EQ(engine->dim, dim);
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, 0));
+    ASSERT_EQ(row[0] == 0xFFFF, accept);
+  }
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,178 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "rawspeedconfig.h" // for HAVE_ZLIB
+#include "encoders/DngWriter.h"
+#include "common/Common.h"                // for ushort16
+#include "common/Executor.h"              // for setExecutor, ThreadPoo...
+#include "common/Point.h"                 // for iPoint2D, iRectangle2D
+#include "common/RawImage.h"              // for RawImage, RawImageData
+#include "decoders/DngDecoder.h"          // for DngDecoder
+#include "decoders/RawDecoderException.h" // for RawDecoderException
+#include "io/Buffer.h"                    // for Buffer
+#include "metadata/ColorFilterArray.h"    // for CFAColor, CFA_RED, CFA_...
+#include "parsers/TiffParser.h"           // for TiffParser
+#include <gtest/gtest.h>                  // for Test, ASSERT_EQ
+#include <memory>                         // for make_shared
+
+using rawspeed::Buffer;
+using rawspeed::DngDecoder;
+using rawspeed::DngWriter;
+using rawspeed::iPoint2D;
+using rawspeed::iRectangle2D;
+using rawspeed::RawImage;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::TiffParser;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class DngWriterTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    setExecutor(std::make_shared<ThreadPoolExecutor>(4));
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // Writes it, and decodes that, as a file.
+  static RawImage roundTrip(const RawImage& img, int tileSize,
+                            bool strips = false, bool uncompressed = false) {
+    DngWriter w(img, tileSize);
+    w.strips = strips;
+    w.uncompressed = uncompressed;
+    const Buffer file = w.write();
+    DngDecoder d(TiffParser::parse(nullptr, file), &file);
+    return d.decodeRaw();
+  }
+
+  static RawImage makeImage(const iPoint2D& dim, rawspeed::RawImageType type,
+                            int cpp) {
+    RawImage img = RawImage::create(dim, type, cpp);
+    unsigned state = 1;
+    for (int y = 0; y < dim.y; y++) {
+      for (int x = 0; x < cpp * dim.x; x++) {
+        state = state * 1103515245U + 12345U;
+        const int v = 2000 + x + y + (state >> 16) % 64;
+        if (type == rawspeed::TYPE_FLOAT32) {
+          reinterpret_cast<float*>(img->getData(0, y))[x] = v / 4096.0F;
+        } else {
+          reinterpret_cast<ushort16*>(img->getData(0, y))[x] = v;
+        }
+      }
+    }
+    return img;
+  }
+
+  template <typename T>
+  static void expectSamePixels(const RawImage& a, const RawImage& b) {
+    ASSERT_EQ(a->getUncroppedDim(), b->getUncroppedDim());
+    ASSERT_EQ(a->getCropOffset(), b->getCropOffset());
+    ASSERT_EQ(a->dim, b->dim);
+    ASSERT_EQ(a->getCpp(), b->getCpp());
+    const iPoint2D dim = a->getUncroppedDim();
+    for (int y = 0; y < dim.y; y++) {
+      const auto* rowA =
+          reinterpret_cast<const T*>(a->getDataUncropped(0, y));
+      const auto* rowB =
+          reinterpret_cast<const T*>(b->getDataUncropped(0, y));
+      for (int x = 0; x < static_cast<int>(a->getCpp()) * dim.x; x++)
+        ASSERT_EQ(rowA[x], rowB[x]) << x << " " << y;
+    }
+  }
+};
+
+// With the edge tiles only partly in the image, the crop, the CFA, which
+// it shifts, and the levels.
+TEST_F(DngWriterTest, CFA) {
+  RawImage img = makeImage({300, 200}, rawspeed::TYPE_USHORT16, 1);
+  img->isCFA = true;
+  img->cfa.setCFA(iPoint2D(2, 2), rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                  rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+  img->subFrame(iRectangle2D(3, 6, 280, 180));
+  img->blackLevelSeparate = {{500, 501, 502, 503}};
+  img->whitePoint = 16000;
+  img->metadata.make = "Make";
+  img->metadata.model = "Model";
+
+  const RawImage out = roundTrip(img, 64);
+
+  expectSamePixels<ushort16>(img, out);
+  ASSERT_TRUE(out->isCFA);
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < 2; x++)
+      ASSERT_EQ(img->cfa.getColorAt(x, y), out->cfa.getColorAt(x, y));
+  }
+  ASSERT_EQ(img->blackLevelSeparate, out->blackLevelSeparate);
+  ASSERT_EQ(img->whitePoint, out->whitePoint);
+}
+
+TEST_F(DngWriterTest, LinearRaw) {
+  RawImage img = makeImage({70, 33}, rawspeed::TYPE_USHORT16, 3);
+
+  const RawImage out = roundTrip(img, 32);
+
+  expectSamePixels<ushort16>(img, out);
+  ASSERT_FALSE(out->isCFA);
+}
+
+// With the odd width, and the last strip being shorter.
+TEST_F(DngWriterTest, Strips) {
+  RawImage img = makeImage({301, 200}, rawspeed::TYPE_USHORT16, 1);
+  img->isCFA = true;
+  img->cfa.setCFA(iPoint2D(2, 2), rawspeed::CFA_RED, rawspeed::CFA_GREEN,
+                  rawspeed::CFA_GREEN, rawspeed::CFA_BLUE);
+
+  expectSamePixels<ushort16>(img, roundTrip(img, 48, /*strips=*/true));
+  expectSamePixels<ushort16>(
+      img, roundTrip(img, 48, /*strips=*/true, /*uncompressed=*/true));
+}
+
+TEST_F(DngWriterTest, UncompressedTiles) {
+  RawImage img = makeImage({70, 33}, rawspeed::TYPE_USHORT16, 3);
+
+  expectSamePixels<ushort16>(
+      img, roundTrip(img, 32, /*strips=*/false, /*uncompressed=*/true));
+}
+
+#ifdef HAVE_ZLIB
+TEST_F(DngWriterTest, Float) {
+  RawImage img = makeImage({100, 50}, rawspeed::TYPE_FLOAT32, 1);
+
+  const RawImage out = roundTrip(img, 48);
+
+  expectSamePixels<float>(img, out);
+  expectSamePixels<float>(img, roundTrip(img, 48, /*strips=*/true));
+
+  DngWriter w(img);
+  w.uncompressed = true;
+  ASSERT_THROW(w.write(), rawspeed::RawDecoderException);
+}
+#endif
+
+TEST_F(DngWriterTest, Unsupported) {
+  const RawImage img = RawImage::create({16, 16}, rawspeed::TYPE_USHORT16, 2);
+  ASSERT_THROW(DngWriter w(img), rawspeed::RawDecoderException);
+
+  const RawImage ok = RawImage::create({16, 16}, rawspeed::TYPE_USHORT16, 1);
+  ASSERT_THROW(DngWriter w(ok, 24), rawspeed::RawDecoderException);
+}
+
+} // namespace rawspeed_test
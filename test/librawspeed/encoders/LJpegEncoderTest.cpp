@@ -0,0 +1,128 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "encoders/LJpegEncoder.h"           // for LJpegEncoder
+#include "common/Array2DRef.h"               // for Array2DRef
+#include "common/Common.h"                   // for uchar8, ushort16
+#include "common/RawImage.h"                 // for RawImage, RawImageData
+#include "decompressors/LJpegDecompressor.h" // for LJpegDecompressor
+#include "io/Buffer.h"                       // for Buffer, DataBuffer
+#include "io/ByteStream.h"                   // for ByteStream
+#include "io/Endianness.h"                   // for Endianness, Endianness::big
+#include <gtest/gtest.h>                     // for ParamIteratorInterface, M...
+#include <tuple>                             // for get, tuple
+#include <vector>                            // for vector
+
+using rawspeed::Array2DRef;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::LJpegDecompressor;
+using rawspeed::LJpegEncoder;
+using rawspeed::RawImage;
+using rawspeed::uchar8;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The components per sample of the frame, the ones of the image, and the
+// largest difference of the neighbouring samples.
+using LJpegEncoderType = std::tuple<int, int, int>;
+class LJpegEncoderTest : public ::testing::TestWithParam<LJpegEncoderType> {
+protected:
+  LJpegEncoderTest() = default;
+  virtual void SetUp() {
+    cps = std::get<0>(GetParam());
+    cpp = std::get<1>(GetParam());
+    spread = std::get<2>(GetParam());
+  }
+
+  int cps;
+  int cpp;
+  int spread;
+};
+
+// From the constant image, with the one category, to the noise of all of
+// the 16 bits, with all of them, including the 16th one.
+INSTANTIATE_TEST_CASE_P(
+    Components, LJpegEncoderTest,
+    ::testing::Values(LJpegEncoderType(1, 1, 0), LJpegEncoderType(2, 1, 0),
+                      LJpegEncoderType(1, 1, 200), LJpegEncoderType(2, 1, 200),
+                      LJpegEncoderType(3, 1, 200), LJpegEncoderType(4, 1, 200),
+                      LJpegEncoderType(3, 3, 200), LJpegEncoderType(2, 1, 65536),
+                      LJpegEncoderType(4, 1, 65536),
+                      LJpegEncoderType(3, 3, 65536)));
+
+TEST_P(LJpegEncoderTest, RoundTrip) {
+  const int width = 12 * cps / cpp;
+  const int height = 9;
+
+  std::vector<ushort16> samples(cpp * width * height);
+  unsigned state = 1;
+  for (auto& v : samples) {
+    state = state * 1103515245U + 12345U;
+    v = spread == 0 ? 4242 : 30000 + (state >> 8) % spread;
+  }
+
+  std::vector<uchar8> data;
+  LJpegEncoder(Array2DRef<const ushort16>(samples.data(), cpp * width, height),
+               cps)
+      .encode(&data);
+
+  RawImage mRaw =
+      RawImage::create({width, height}, rawspeed::TYPE_USHORT16, cpp);
+  LJpegDecompressor d(ByteStream(DataBuffer(Buffer(data.data(), data.size()),
+                                            Endianness::big)),
+                      mRaw);
+  d.decode(0, 0, width, height, false);
+
+  for (int y = 0; y < height; y++) {
+    const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+    for (int x = 0; x < cpp * width; x++)
+      ASSERT_EQ(row[x], samples[y * cpp * width + x]) << x << " " << y;
+  }
+}
+
+// The smooth data takes fewer bits than the noise, as the table is built
+// for it.
+TEST(LJpegEncoderSizeTest, TableFitsTheData) {
+  const int width = 64;
+  const int height = 64;
+  std::vector<ushort16> smooth(width * height);
+  std::vector<ushort16> noise(width * height);
+  unsigned state = 1;
+  for (int i = 0; i < width * height; i++) {
+    state = state * 1103515245U + 12345U;
+    smooth[i] = 1000 + (state >> 16) % 4;
+    noise[i] = state >> 16;
+  }
+
+  std::vector<uchar8> smoothData;
+  std::vector<uchar8> noiseData;
+  LJpegEncoder({smooth.data(), width, height}, 2).encode(&smoothData);
+  LJpegEncoder({noise.data(), width, height}, 2).encode(&noiseData);
+
+  // About 2 bits per sample, and all of the 16 of them.
+  ASSERT_LT(smoothData.size(), width * height / 2);
+  ASSERT_GT(noiseData.size(), 2 * width * height);
+}
+
+} // namespace rawspeed_test
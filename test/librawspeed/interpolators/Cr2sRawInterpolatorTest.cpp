@@ -0,0 +1,121 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "interpolators/Cr2sRawInterpolator.h" // for Cr2sRawInterpolator
+#include "common/Common.h"                     // for ushort16, uint32
+#include "common/Executor.h"                   // for setExecutor, Serial...
+#include "common/Point.h"                      // for iPoint2D
+#include "common/RawImage.h"                   // for RawImage, RawImageData
+#include <array>                               // for array
+#include <gtest/gtest.h>                       // for ParamIteratorInterface
+#include <memory>                              // for make_shared
+#include <tuple>                               // for get, make_tuple, tuple
+#include <vector>                              // for vector
+
+using rawspeed::Cr2sRawInterpolator;
+using rawspeed::iPoint2D;
+using rawspeed::RawImage;
+using rawspeed::SerialExecutor;
+using rawspeed::setExecutor;
+using rawspeed::ThreadPoolExecutor;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+// The subsampling in y, and the version.
+using InterpolateType = std::tuple<int, int>;
+class Cr2sRawInterpolatorTest
+    : public ::testing::TestWithParam<InterpolateType> {
+protected:
+  Cr2sRawInterpolatorTest() = default;
+  virtual void SetUp() {
+    subsampling = {2, std::get<0>(GetParam())};
+    version = std::get<1>(GetParam());
+  }
+  virtual void TearDown() { setExecutor(nullptr); }
+
+  // If step, the rows are converted as if they were decoded step at a time.
+  std::vector<ushort16> interpolate(const iPoint2D& dim, int step = 0) const {
+    RawImage mRaw = RawImage::create(dim, rawspeed::TYPE_USHORT16, 3);
+    mRaw->metadata.subsampling = subsampling;
+
+    uint32 random = 1;
+    for (int y = 0; y < dim.y; y++) {
+      auto* row = reinterpret_cast<ushort16*>(mRaw->getData(0, y));
+      for (int x = 0; x < 3 * dim.x; x++) {
+        random = random * 1103515245U + 12345U;
+        // Around the middle of the range, where the chroma is centered.
+        row[x] = 12288 + ((random >> 16) & 8191);
+      }
+    }
+
+    Cr2sRawInterpolator i(mRaw, {{999, 1000, 1001}}, 1269);
+    if (step) {
+      for (int rows = step; rows < dim.y; rows += step)
+        i.rowsDecoded(version, rows);
+      i.finishRows(version);
+    } else
+      i.interpolate(version);
+
+    std::vector<ushort16> pixels;
+    for (int y = 0; y < dim.y; y++) {
+      const auto* row = reinterpret_cast<const ushort16*>(mRaw->getData(0, y));
+      pixels.insert(pixels.end(), row, row + 3 * dim.x);
+    }
+    return pixels;
+  }
+
+  iPoint2D subsampling;
+  int version;
+};
+
+INSTANTIATE_TEST_CASE_P(
+    Versions, Cr2sRawInterpolatorTest,
+    ::testing::Values(std::make_tuple(1, 0), std::make_tuple(1, 1),
+                      std::make_tuple(1, 2), std::make_tuple(2, 1),
+                      std::make_tuple(2, 2)));
+
+// Each thread gets its own band of the rows, however many there are.
+TEST_P(Cr2sRawInterpolatorTest, SameAsSerial) {
+  for (const iPoint2D dim : {iPoint2D(2, 2), iPoint2D(6, 4), iPoint2D(70, 14),
+                             iPoint2D(250, 38)}) {
+    setExecutor(std::make_shared<SerialExecutor>());
+    const auto expected = interpolate(dim);
+
+    for (int threads : {2, 3, 8}) {
+      setExecutor(std::make_shared<ThreadPoolExecutor>(threads));
+      ASSERT_EQ(interpolate(dim), expected) << dim.x << " " << threads;
+    }
+  }
+}
+
+// Converted while they are decoded, a few rows at a time.
+TEST_P(Cr2sRawInterpolatorTest, SameAsDecoded) {
+  setExecutor(std::make_shared<SerialExecutor>());
+  for (const iPoint2D dim :
+       {iPoint2D(2, 2), iPoint2D(6, 4), iPoint2D(70, 14)}) {
+    const auto expected = interpolate(dim);
+    for (int step : {1, 2, 3, 100})
+      ASSERT_EQ(interpolate(dim, step), expected) << dim.x << " " << step;
+  }
+}
+
+} // namespace rawspeed_test
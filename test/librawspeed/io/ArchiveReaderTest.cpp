@@ -0,0 +1,231 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/ArchiveReader.h" // for ArchiveReader, ArchiveReader::Member
+#include "common/Common.h"    // for uchar8, uint32, uint64
+#include "io/Buffer.h"        // for Buffer, Buffer::size_type
+#include "io/BufferLoader.h"  // for BufferLoader
+#include "io/IOException.h"   // for IOException
+#include <algorithm>          // for copy, fill
+#include <cstdio>             // for snprintf
+#include <gtest/gtest.h>      // for Message, TestPartResult, Test...
+#include <string>             // for string
+#include <vector>             // for vector
+
+using rawspeed::ArchiveReader;
+using rawspeed::Buffer;
+using rawspeed::BufferLoader;
+using rawspeed::IOException;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::uint64;
+
+namespace rawspeed_test {
+
+class ArchiveReaderTest : public ::testing::Test {
+protected:
+  std::vector<uchar8> data;
+
+  void put(uint64 value, int bytes) {
+    for (int i = 0; i < bytes; i++, value >>= 8U)
+      data.push_back(value & 0xFFU);
+  }
+  void put(const std::string& str) {
+    data.insert(data.end(), str.begin(), str.end());
+  }
+
+  static std::string contents(const std::string& name, size_t size) {
+    std::string str;
+    while (str.size() < size)
+      str += name;
+    return str.substr(0, size);
+  }
+
+  // The name, the method, the data, and the offset of its local header.
+  struct ZipMember final {
+    std::string name;
+    int method;
+    std::string data;
+    uint64 offset = 0;
+  };
+
+  // With a comment, and with an extra field in the local headers only.
+  void makeZip(std::vector<ZipMember>* zipMembers) {
+    for (auto& m : *zipMembers) {
+      m.offset = data.size();
+      put(0x04034b50, 4);
+      put(20, 2);
+      put(0, 2);
+      put(m.method, 2);
+      put(0, 8);
+      put(m.data.size(), 4);
+      put(m.data.size(), 4);
+      put(m.name.size(), 2);
+      put(5, 2);
+      put(m.name);
+      put(0xCAFE, 2);
+      put(1, 2);
+      put(0, 1);
+      put(m.data);
+    }
+    const uint64 directoryOffset = data.size();
+    for (const auto& m : *zipMembers) {
+      put(0x02014b50, 4);
+      put(20, 2);
+      put(20, 2);
+      put(0, 2);
+      put(m.method, 2);
+      put(0, 8);
+      put(m.data.size(), 4);
+      put(m.data.size(), 4);
+      put(m.name.size(), 2);
+      put(0, 2);
+      put(0, 2);
+      put(0, 8);
+      put(m.offset, 4);
+      put(m.name);
+    }
+    const uint64 directorySize = data.size() - directoryOffset;
+    put(0x06054b50, 4);
+    put(0, 4);
+    put(zipMembers->size(), 2);
+    put(zipMembers->size(), 2);
+    put(directorySize, 4);
+    put(directoryOffset, 4);
+    const std::string comment = "a comment";
+    put(comment.size(), 2);
+    put(comment);
+  }
+
+  void putTarHeader(const std::string& name, uint64 size, char type) {
+    std::vector<uchar8> header(512, 0);
+    std::copy(name.begin(), name.begin() + std::min<size_t>(name.size(), 100),
+              header.begin());
+    char number[13];
+    snprintf(number, sizeof(number), "%011llo",
+             static_cast<unsigned long long>(size));
+    std::copy(number, number + 11, header.begin() + 124);
+    header[156] = type;
+    std::copy("ustar", "ustar" + 5, header.begin() + 257);
+    data.insert(data.end(), header.begin(), header.end());
+  }
+
+  void putTarData(const std::string& str) {
+    put(str);
+    data.resize(rawspeed::roundUp(data.size(), 512), 0);
+  }
+
+  std::string getMember(const ArchiveReader& reader, const std::string& name) {
+    const ArchiveReader::Member* m = reader.find(name);
+    if (!m)
+      return "(none)";
+    const Buffer b = reader.getMember(*m);
+    const auto* begin =
+        reinterpret_cast<const char*>(b.getData(0, b.getSize()));
+    return std::string(begin, b.getSize());
+  }
+};
+
+TEST_F(ArchiveReaderTest, ZipStoredMembers) {
+  std::vector<ZipMember> zipMembers = {
+      {"a.nef", 0, contents("a", 1000)},
+      {"dir/", 0, ""},
+      {"b.cr2", 8, contents("b", 100)},
+      {"dir/c.dng", 0, contents("c", 3000)}};
+  makeZip(&zipMembers);
+  const Buffer archive(data.data(), data.size());
+
+  const ArchiveReader reader(archive);
+  ASSERT_EQ(reader.getMembers().size(), 2);
+  ASSERT_EQ(getMember(reader, "a.nef"), zipMembers[0].data);
+  ASSERT_EQ(getMember(reader, "dir/c.dng"), zipMembers[3].data);
+  ASSERT_EQ(getMember(reader, "b.cr2"), "(none)");
+  ASSERT_EQ(reader.find("dir/"), nullptr);
+
+  // Not a copy.
+  const Buffer a = reader.getMember(*reader.find("a.nef"));
+  ASSERT_EQ(a.getOffsetIn(archive), zipMembers[0].offset + 30 + 5 + 5);
+}
+
+TEST_F(ArchiveReaderTest, Tar) {
+  const std::string longName(150, 'x');
+  putTarHeader("dir", 0, '5');
+  putTarHeader("a.nef", 1000, '0');
+  putTarData(contents("a", 1000));
+  putTarHeader("././@LongLink", longName.size() + 1, 'L');
+  putTarData(longName + '\0');
+  putTarHeader(longName.substr(0, 100), 512, '0');
+  putTarData(contents("b", 512));
+  data.resize(data.size() + 1024, 0);
+  const Buffer archive(data.data(), data.size());
+
+  const ArchiveReader reader(archive);
+  ASSERT_EQ(reader.getMembers().size(), 2);
+  ASSERT_EQ(getMember(reader, "a.nef"), contents("a", 1000));
+  ASSERT_EQ(getMember(reader, longName), contents("b", 512));
+}
+
+// Of a large zip, only the directory at the end, and the member that is
+// accessed, are read.
+TEST_F(ArchiveReaderTest, LazilyRead) {
+  const auto chunk = BufferLoader::ChunkSize;
+  std::vector<ZipMember> zipMembers = {{"a.nef", 0, contents("a", 5 * chunk)},
+                                       {"b.nef", 0, contents("b", 5 * chunk)}};
+  makeZip(&zipMembers);
+
+  std::vector<Buffer::size_type> readChunks;
+  BufferLoader loader(data.size(), [this, &readChunks](
+                                       uchar8* dest, Buffer::size_type offset,
+                                       Buffer::size_type count) {
+    for (auto c = offset / chunk; c < (offset + count + chunk - 1) / chunk; c++)
+      readChunks.push_back(c);
+    std::copy(data.begin() + offset, data.begin() + offset + count, dest);
+  });
+
+  // The beginning, for the format, and the last 64 KiB, where the directory
+  // is.
+  const ArchiveReader reader(loader.getBuffer());
+  ASSERT_EQ(reader.getMembers().size(), 2);
+  const auto lastChunk = (data.size() - 1) / chunk;
+  ASSERT_EQ(readChunks, std::vector<Buffer::size_type>(
+                            {0, lastChunk - 1, lastChunk}));
+
+  // Then the local header, and the data.
+  const Buffer b = reader.getMember(*reader.find("b.nef"));
+  ASSERT_EQ(readChunks.size(), 4);
+  ASSERT_EQ(readChunks.back(), zipMembers[1].offset / chunk);
+  ASSERT_EQ(b[2 * chunk], 'b');
+  ASSERT_EQ(readChunks.size(), 5);
+  ASSERT_EQ(readChunks.back(),
+            (b.getOffsetIn(loader.getBuffer()) + 2 * chunk) / chunk);
+}
+
+TEST_F(ArchiveReaderTest, NotAnArchive) {
+  data.assign(1024, 0);
+  ASSERT_THROW(ArchiveReader(Buffer(data.data(), data.size())), IOException);
+
+  // The end of the central directory is missing.
+  put("PK");
+  data.erase(data.begin(), data.end() - 2);
+  data.resize(100, 0);
+  ASSERT_THROW(ArchiveReader(Buffer(data.data(), data.size())), IOException);
+}
+
+} // namespace rawspeed_test
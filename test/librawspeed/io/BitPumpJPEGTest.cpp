@@ -27,6 +27,7 @@
 #include <array>            // for array
 #include <gtest/gtest.h>    // for Test, Message, TestInfo (ptr only), ASSE...
 #include <initializer_list> // for initializer_list
+#include <vector>           // for vector
 
 using rawspeed::BitPumpJPEG;
 using rawspeed::Buffer;
@@ -87,6 +88,27 @@ TEST(BitPumpJPEGTest, 0xFF0x00Is0xFFTest) {
   }
 }
 
+TEST(BitPumpJPEGTest, 0xFFAtAnyPositionTest) {
+  // The bytes next to 0xFF, which must not be mistaken for it.
+  static const std::array<rawspeed::uchar8, 8> bytes{
+      {0xFE, 0x00, 0x7F, 0x80, 0x01, 0xFE, 0xEF, 0xF7}};
+
+  for (int at = 0; at < 8; at++) {
+    std::vector<rawspeed::uchar8> data(bytes.begin(), bytes.end());
+    data[at] = 0xFF;
+    data.insert(data.begin() + at + 1, 0x00);
+
+    const Buffer b(data.data(), data.size());
+    const DataBuffer db(b, Endianness::little);
+    const ByteStream bs(db);
+
+    BitPumpJPEG p(bs);
+
+    for (int i = 0; i < 8; i++)
+      ASSERT_EQ(p.getBits(8), i == at ? 0xFF : bytes[i]) << at << " " << i;
+  }
+}
+
 TEST(BitPumpJPEGTest, 0xFF0xXXIsTheEndTest) {
   // If 0xFF0xXX byte sequence is found, where XX != 0, then it is the end.
   for (rawspeed::uchar8 end = 0x01; end < 0xFF; end++) {
@@ -18,13 +18,24 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
-#include "io/BitPumpMSB.h"  // for BitPumpMSB
+#include "io/BitPumpMSB.h"  // for BitPumpMSB, BitPumpMSBWide
 #include "common/Common.h"  // for uchar8, uint32
 #include "io/BitPumpTest.h" // for Pattern, (anonymous), GenOnesBE, BitPump...
+#include "io/Buffer.h"      // for Buffer, DataBuffer
+#include "io/ByteStream.h"  // for ByteStream
+#include "io/Endianness.h"  // for Endianness, Endianness::little
 #include <array>            // for array
 #include <gtest/gtest.h>    // for INSTANTIATE_TYPED_TEST_CASE_P, Types
+#include <vector>           // for vector
 
 using rawspeed::BitPumpMSB;
+#ifdef __SIZEOF_INT128__
+using rawspeed::BitPumpMSBWide;
+#endif
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
 
 namespace rawspeed_test {
 
@@ -51,4 +62,27 @@ template <> rawspeed::uint32 Pattern<BitPumpMSB, InvOnesTag>::data(int index) {
 
 INSTANTIATE_TYPED_TEST_CASE_P(MSB, BitPumpTest, Patterns<BitPumpMSB>);
 
+#ifdef __SIZEOF_INT128__
+TEST(BitPumpMSBWideTest, SameAsNarrow) {
+  std::vector<rawspeed::uchar8> data(1024);
+  rawspeed::uint32 random = 1;
+  for (auto& b : data) {
+    random = random * 1103515245U + 12345U;
+    b = random >> 16;
+  }
+
+  const Buffer b(data.data(), data.size());
+  const DataBuffer db(b, Endianness::little);
+  const ByteStream bs(db);
+
+  BitPumpMSB narrow(bs);
+  BitPumpMSBWide wide(bs);
+  // All the lengths, in an order that does not repeat with the refills.
+  for (int i = 0; i < 400; i++) {
+    const int len = 1 + (i * 7) % 32;
+    ASSERT_EQ(wide.getBits(len), narrow.getBits(len)) << i;
+  }
+}
+#endif
+
 } // namespace rawspeed_test
@@ -0,0 +1,100 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/BitStream.h"    // for BitStream
+#include "common/Common.h"   // for uchar8, ushort16, uint32
+#include "io/BitPumpJPEG.h"  // for BitPumpJPEG
+#include "io/BitPumpLSB.h"   // for BitPumpLSB
+#include "io/BitPumpMSB.h"   // for BitPumpMSB
+#include "io/BitPumpMSB16.h" // for BitPumpMSB16
+#include "io/BitPumpMSB32.h" // for BitPumpMSB32
+#include "io/Buffer.h"       // for Buffer, DataBuffer
+#include "io/ByteStream.h"   // for ByteStream
+#include "io/Endianness.h"   // for Endianness, Endianness::little
+#include <gtest/gtest.h>     // for TYPED_TEST, Types
+#include <vector>            // for vector
+
+using rawspeed::BitPumpJPEG;
+using rawspeed::BitPumpLSB;
+using rawspeed::BitPumpMSB;
+using rawspeed::BitPumpMSB16;
+using rawspeed::BitPumpMSB32;
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+template <typename Pump> class BitStreamBulkTest : public ::testing::Test {
+protected:
+  BitStreamBulkTest() {
+    uint32 random = 1;
+    for (auto& b : data) {
+      random = random * 1103515245U + 12345U;
+      b = random >> 16;
+      // No JPEG markers. Past one, how many bits are still read before the
+      // zeros depends on when the cache was refilled.
+      if (b == 0xFF)
+        b = 0xFE;
+    }
+  }
+
+  // Then a few single fields, to check that the bulk read left the pump at
+  // the right position.
+  template <int nbits> void check() {
+    const ByteStream bs(
+        DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+
+    for (uint32 count : {0U, 1U, 5U, 31U, 100U}) {
+      Pump bulk(bs);
+      Pump single(bs);
+
+      std::vector<ushort16> out(count);
+      bulk.template getBitsBulk<nbits>(out.data(), count);
+      for (uint32 i = 0; i < count; i++)
+        ASSERT_EQ(out[i], single.getBits(nbits)) << nbits << " " << i;
+
+      for (int i = 0; i < 3; i++)
+        ASSERT_EQ(bulk.getBits(5), single.getBits(5));
+    }
+  }
+
+  std::vector<uchar8> data = std::vector<uchar8>(512);
+};
+
+using Pumps = ::testing::Types<BitPumpLSB, BitPumpMSB, BitPumpMSB16,
+                               BitPumpMSB32, BitPumpJPEG>;
+TYPED_TEST_CASE(BitStreamBulkTest, Pumps);
+
+TYPED_TEST(BitStreamBulkTest, SameAsGetBits) {
+  this->template check<1>();
+  this->template check<3>();
+  this->template check<7>();
+  this->template check<10>();
+  this->template check<12>();
+  this->template check<14>();
+  this->template check<16>();
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,160 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/BufferLoader.h" // for BufferLoader
+#include "common/Common.h"   // for uchar8
+#include "io/BitPumpMSB.h"   // for BitPumpMSB
+#include "io/Buffer.h"       // for Buffer
+#include "io/ByteStream.h"   // for ByteStream
+#include "io/IOException.h"  // for IOException
+#include <gtest/gtest.h>     // for Message, TestPartResult, TestInfo (...
+#include <utility>           // for pair
+#include <vector>            // for vector
+
+using rawspeed::BitPumpMSB;
+using rawspeed::Buffer;
+using rawspeed::BufferLoader;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::IOException;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+static constexpr auto Chunk = BufferLoader::ChunkSize;
+static constexpr Buffer::size_type Size = 4 * Chunk + 123;
+
+class BufferLoaderTest : public ::testing::Test {
+protected:
+  static uchar8 byteAt(Buffer::size_type i) { return uchar8(i ^ (i >> 8U)); }
+
+  BufferLoaderTest()
+      : loader(Size, [this](uchar8* dest, Buffer::size_type offset,
+                            Buffer::size_type count) {
+          reads.emplace_back(offset, count);
+          for (Buffer::size_type i = 0; i < count; i++)
+            dest[i] = byteAt(offset + i);
+        }) {}
+
+  std::vector<std::pair<Buffer::size_type, Buffer::size_type>> reads;
+  BufferLoader loader;
+};
+
+TEST_F(BufferLoaderTest, NothingIsReadUpFront) {
+  ASSERT_EQ(loader.getBuffer().getSize(), Size);
+  ASSERT_TRUE(reads.empty());
+  ASSERT_EQ(loader.getLoadedSize(), 0);
+}
+
+TEST_F(BufferLoaderTest, SubViewIsLazy) {
+  const Buffer view = loader.getBuffer().getSubView(Chunk, 2 * Chunk);
+  ASSERT_TRUE(reads.empty());
+
+  ASSERT_EQ(view[0], byteAt(Chunk));
+  ASSERT_EQ(reads.size(), 1);
+  ASSERT_EQ(reads[0].first, Chunk);
+  ASSERT_EQ(reads[0].second, Chunk);
+}
+
+TEST_F(BufferLoaderTest, ReadsAreCoalescedAndNotRepeated) {
+  const Buffer& b = loader.getBuffer();
+  ASSERT_EQ(b[2 * Chunk], byteAt(2 * Chunk));
+  ASSERT_EQ(reads.size(), 1);
+
+  // chunks 0 and 1 are read together, and chunk 2 is not read again.
+  b.getData(0, Size);
+  ASSERT_EQ(reads.size(), 3);
+  ASSERT_EQ(reads[1].first, 0);
+  ASSERT_EQ(reads[1].second, 2 * Chunk);
+  ASSERT_EQ(reads[2].first, 3 * Chunk);
+  ASSERT_EQ(reads[2].second, Size - 3 * Chunk);
+  ASSERT_EQ(loader.getLoadedSize(), Size);
+
+  b.getData(0, Size);
+  ASSERT_EQ(reads.size(), 3);
+
+  for (Buffer::size_type i = 0; i < Size; i++)
+    ASSERT_EQ(b[i], byteAt(i));
+}
+
+TEST_F(BufferLoaderTest, ByteStream) {
+  ByteStream bs(DataBuffer(loader.getBuffer()));
+  bs.setPosition(Size - 4);
+  ASSERT_TRUE(reads.empty());
+
+  ASSERT_EQ(bs.getByte(), byteAt(Size - 4));
+  ASSERT_EQ(reads.size(), 1);
+  ASSERT_EQ(reads[0].first, 4 * Chunk);
+
+  ByteStream sub = bs.getSubStream(0, 1);
+  ASSERT_EQ(reads.size(), 1);
+  ASSERT_EQ(sub.getByte(), byteAt(0));
+  ASSERT_EQ(reads.size(), 2);
+}
+
+TEST_F(BufferLoaderTest, BitStreamLoadsEverything) {
+  ByteStream bs(DataBuffer(loader.getBuffer()));
+  bs.skipBytes(3 * Chunk);
+  BitPumpMSB pump(bs);
+  ASSERT_EQ(loader.getLoadedSize(), Size - 3 * Chunk);
+  ASSERT_EQ(pump.getBits(8), byteAt(3 * Chunk));
+}
+
+TEST_F(BufferLoaderTest, OutOfBounds) {
+  ASSERT_THROW(loader.getBuffer().getData(Size - 1, 2), IOException);
+  ASSERT_TRUE(reads.empty());
+}
+
+// Up to the end, and not what is already loaded.
+TEST(BufferLoaderReadAheadTest, ReadsTheNextChunksToo) {
+  std::vector<std::pair<Buffer::size_type, Buffer::size_type>> reads;
+  BufferLoader loader(
+      Size,
+      [&reads](uchar8*, Buffer::size_type offset, Buffer::size_type count) {
+        reads.emplace_back(offset, count);
+      },
+      Chunk + 1);
+  const Buffer& b = loader.getBuffer();
+
+  b[3 * Chunk];
+  ASSERT_EQ(reads.size(), 1);
+  ASSERT_EQ(reads[0].first, 3 * Chunk);
+  ASSERT_EQ(reads[0].second, Size - 3 * Chunk);
+
+  b[Chunk];
+  ASSERT_EQ(reads.size(), 2);
+  ASSERT_EQ(reads[1].first, Chunk);
+  ASSERT_EQ(reads[1].second, 2 * Chunk);
+
+  b[0];
+  ASSERT_EQ(reads.size(), 3);
+  ASSERT_EQ(reads[2].first, 0);
+  ASSERT_EQ(reads[2].second, Chunk);
+  ASSERT_EQ(loader.getLoadedSize(), Size);
+}
+
+TEST(BufferLoaderReadErrorTest, Propagates) {
+  BufferLoader loader(16, [](uchar8*, Buffer::size_type, Buffer::size_type) {
+    ThrowIOE("read failed");
+  });
+  ASSERT_THROW(loader.getBuffer()[0], IOException);
+}
+
+} // namespace rawspeed_test
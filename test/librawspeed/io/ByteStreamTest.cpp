@@ -0,0 +1,109 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/ByteStream.h"  // for ByteStream
+#include "common/Common.h"  // for uchar8, ushort16, uint32
+#include "io/Buffer.h"      // for Buffer, DataBuffer
+#include "io/Endianness.h"  // for Endianness, Endianness::big, Endianne...
+#include "io/IOException.h" // for IOException
+#include <array>            // for array
+#include <gtest/gtest.h>    // for Message, TestPartResult, ASSERT_EQ
+#include <vector>           // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::ByteStreamCursor;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::IOException;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+static const std::array<uchar8, 10> data{
+    {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A}};
+
+template <typename T> static void checkSameAsGet(Endianness e, uint32 count) {
+  const Buffer b(data.data(), data.size());
+  ByteStream array(DataBuffer(b, e));
+  ByteStream single(DataBuffer(b, e));
+  array.skipBytes(1);
+  single.skipBytes(1);
+
+  std::vector<T> out(count);
+  array.getArray(out.data(), count);
+  for (uint32 i = 0; i < count; i++)
+    ASSERT_EQ(out[i], single.get<T>()) << i;
+  ASSERT_EQ(array.getPosition(), single.getPosition());
+}
+
+TEST(ByteStreamTest, GetArraySameAsGet) {
+  for (auto e : {Endianness::little, Endianness::big}) {
+    for (uint32 count : {0U, 1U, 4U})
+      checkSameAsGet<ushort16>(e, count);
+    for (uint32 count : {0U, 1U, 2U})
+      checkSameAsGet<uint32>(e, count);
+  }
+}
+
+TEST(ByteStreamTest, GetArrayOutOfBounds) {
+  const Buffer b(data.data(), data.size());
+  ByteStream bs(DataBuffer(b, Endianness::little));
+  bs.skipBytes(1);
+
+  std::vector<ushort16> out(5);
+  ASSERT_THROW(bs.getArray(out.data(), out.size()), IOException);
+  // Nothing was consumed.
+  ASSERT_EQ(bs.getPosition(), 1);
+  ASSERT_NO_THROW(bs.getArray(out.data(), out.size() - 1));
+}
+
+TEST(ByteStreamTest, ReserveSameAsGet) {
+  for (auto e : {Endianness::little, Endianness::big}) {
+    const Buffer b(data.data(), data.size());
+    ByteStream bs(DataBuffer(b, e));
+    ByteStream single(DataBuffer(b, e));
+    bs.skipBytes(1);
+    single.skipBytes(1);
+
+    ByteStreamCursor in = bs.reserve(3, 2);
+    ASSERT_EQ(bs.getPosition(), 7);
+    ASSERT_EQ(in.getByte(), single.getByte());
+    ASSERT_EQ(in.getU32(), single.getU32());
+    in.skipBytes(1);
+    ASSERT_EQ(in.getRemainSize(), 0);
+  }
+}
+
+TEST(ByteStreamTest, ReserveOutOfBounds) {
+  const Buffer b(data.data(), data.size());
+  ByteStream bs(DataBuffer(b, Endianness::little));
+  bs.skipBytes(1);
+
+  ASSERT_THROW(bs.reserve(10), IOException);
+  ASSERT_THROW(bs.reserve(5, 2), IOException);
+  // Nothing was consumed.
+  ASSERT_EQ(bs.getPosition(), 1);
+  ASSERT_NO_THROW(bs.reserve(9));
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,112 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "io/FileReader.h"      // for FileReader
+#include "common/Common.h"      // for uchar8
+#include "io/Buffer.h"          // for Buffer
+#include "io/FileIOException.h" // for FileIOException
+#include "io/FileWriter.h"      // for FileWriter
+#include <algorithm>            // for equal
+#include <cstdio>               // for remove
+#include <gtest/gtest.h>        // for ParamIteratorInterface, Message, Tes...
+#include <memory>               // for unique_ptr
+#include <utility>              // for move
+
+using rawspeed::Buffer;
+using rawspeed::FileIOException;
+using rawspeed::FileReader;
+using rawspeed::FileWriter;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+static const char* const fileName = "FileReaderTest.tmp";
+
+class FileReaderTest : public ::testing::TestWithParam<Buffer::size_type> {
+protected:
+  FileReaderTest() = default;
+  virtual void SetUp() {
+    size = GetParam();
+
+    auto data = Buffer::Create(size);
+    for (Buffer::size_type i = 0; i < size; i++)
+      data.get()[i] = uchar8(i * 7U + (i >> 8U));
+    buf = std::make_unique<Buffer>(std::move(data), size);
+
+    FileWriter(fileName).writeFile(buf.get(), size);
+  }
+  virtual void TearDown() { std::remove(fileName); }
+
+  void check(const Buffer& b) const {
+    ASSERT_EQ(b.getSize(), size);
+    ASSERT_TRUE(std::equal(b.begin(), b.end(), buf->begin()));
+  }
+
+  Buffer::size_type size;
+  std::unique_ptr<Buffer> buf;
+};
+
+// around the typical page size, so that the padded tail is exercised.
+INSTANTIATE_TEST_CASE_P(Sizes, FileReaderTest,
+                        ::testing::Values(1, 15, 4095, 4096, 4097, 8192,
+                                          65536 + 7));
+
+TEST_P(FileReaderTest, ReadFile) {
+  FileReader f(fileName);
+  const auto b = f.readFile();
+  check(*b);
+}
+
+TEST_P(FileReaderTest, MapFile) {
+  FileReader f(fileName);
+  const auto b = f.mapFile();
+  check(*b);
+}
+
+TEST_P(FileReaderTest, MapFileOutlivesReader) {
+  std::unique_ptr<const Buffer> b;
+  {
+    FileReader f(fileName);
+    b = f.mapFile();
+  }
+  std::remove(fileName);
+  check(*b);
+}
+
+// The pages that are dropped are read from the file again.
+TEST_P(FileReaderTest, Advice) {
+  FileReader f(fileName);
+  for (const auto& b : {f.readFile(), f.mapFile()}) {
+    b->adviseWillNeed();
+    check(*b);
+    b->getSubView(size / 3).adviseDone();
+    check(*b);
+    b->adviseDone();
+    check(*b);
+  }
+}
+
+TEST(FileReaderTest, NonexistentFile) {
+  FileReader f("nonexistent file");
+  ASSERT_THROW(f.readFile(), FileIOException);
+  ASSERT_THROW(f.mapFile(), FileIOException);
+}
+
+} // namespace rawspeed_test
@@ -0,0 +1,83 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "metadata/CameraIndex.h" // for CameraIndex, CameraId
+#include <gtest/gtest.h>          // for Test, ASSERT_EQ, ASSERT_NE
+#include <string>                 // for string, to_string
+
+using rawspeed::CameraId;
+using rawspeed::CameraIndex;
+
+namespace rawspeed_test {
+
+TEST(CameraIndexTest, Empty) {
+  CameraIndex index;
+  ASSERT_EQ(index.find("NIKON", "D3", ""), nullptr);
+  ASSERT_EQ(index.find("NIKON", "D3"), nullptr);
+}
+
+TEST(CameraIndexTest, Find) {
+  CameraIndex index;
+  // Enough of them for the index to grow a few times.
+  for (int i = 0; i < 1000; i++) {
+    for (const char* mode : {"14bit", "", "12bit"})
+      index.insert({"Make", "Model " + std::to_string(i), mode}, nullptr);
+  }
+  ASSERT_EQ(index.size(), 3000);
+
+  for (int i = 0; i < 1000; i++) {
+    const std::string model = "Model " + std::to_string(i);
+    for (const char* mode : {"14bit", "", "12bit"}) {
+      const auto* entry = index.find("Make", model, mode);
+      ASSERT_NE(entry, nullptr);
+      ASSERT_EQ(entry->id.model, model);
+      ASSERT_EQ(entry->id.mode, mode);
+    }
+    ASSERT_EQ(index.find("Make", model, "16bit"), nullptr);
+    ASSERT_EQ(index.find("Make ", model + "x", ""), nullptr);
+
+    // The lowest mode, as in the std::map of the cameras.
+    const auto* entry = index.find("Make", model);
+    ASSERT_NE(entry, nullptr);
+    ASSERT_EQ(entry->id.model, model);
+    ASSERT_EQ(entry->id.mode, "");
+  }
+}
+
+TEST(CameraIndexTest, Trimmed) {
+  CameraIndex index;
+  index.insert({"NIKON", "D3", "12bit"}, nullptr);
+  index.insert({"NIKON", "D3", "14bit"}, nullptr);
+
+  const auto* entry = index.find(" NIKON\t", "  D3 ", "14bit ");
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->id.mode, "14bit");
+
+  entry = index.find("NIKON ", " D3");
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->id.mode, "12bit");
+
+  // Only the spaces around the strings.
+  ASSERT_EQ(index.find("NIK ON", "D3"), nullptr);
+  ASSERT_EQ(index.find("nikon", "D3"), nullptr);
+  ASSERT_EQ(index.find(" ", "D3"), nullptr);
+}
+
+} // namespace rawspeed_test
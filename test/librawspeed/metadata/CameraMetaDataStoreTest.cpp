@@ -0,0 +1,83 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "metadata/CameraMetaDataStore.h" // for CameraMetaDataStore
+#include "metadata/CameraMetaData.h"      // for CameraMetaData
+#include <atomic>                         // for atomic
+#include <gtest/gtest.h>                  // for Test, ASSERT_EQ, ASSERT_NE
+#include <memory>                         // for make_shared, shared_ptr
+#include <thread>                         // for thread
+#include <vector>                         // for vector
+
+using rawspeed::CameraMetaData;
+using rawspeed::CameraMetaDataStore;
+
+namespace rawspeed_test {
+
+TEST(CameraMetaDataStoreTest, Empty) {
+  const CameraMetaDataStore store;
+  ASSERT_EQ(store.get(), nullptr);
+  ASSERT_EQ(store.getVersion(), 0);
+}
+
+TEST(CameraMetaDataStoreTest, SnapshotOutlivesPublish) {
+  auto first = std::make_shared<const CameraMetaData>();
+  CameraMetaDataStore store(first);
+  ASSERT_EQ(store.getVersion(), 1);
+
+  const auto snapshot = store.get();
+  ASSERT_EQ(snapshot, first);
+  first.reset();
+
+  auto second = std::make_shared<const CameraMetaData>();
+  store.publish(second);
+  ASSERT_EQ(store.getVersion(), 2);
+  ASSERT_EQ(store.get(), second);
+
+  // Only the snapshot holds the old version now.
+  ASSERT_EQ(snapshot.use_count(), 1);
+  ASSERT_EQ(snapshot->getCamera("NIKON", "D3"), nullptr);
+}
+
+TEST(CameraMetaDataStoreTest, ConcurrentPublish) {
+  CameraMetaDataStore store(std::make_shared<const CameraMetaData>());
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&store, &done]() {
+      while (!done) {
+        const auto meta = store.get();
+        ASSERT_NE(meta, nullptr);
+        ASSERT_EQ(meta->getCamera("NIKON", "D3", ""), nullptr);
+      }
+    });
+  }
+
+  for (int i = 0; i < 1000; i++)
+    store.publish(std::make_shared<const CameraMetaData>());
+  done = true;
+
+  for (auto& reader : readers)
+    reader.join();
+  ASSERT_EQ(store.getVersion(), 1001);
+}
+
+} // namespace rawspeed_test
@@ -21,17 +21,133 @@
 
 #include "rawspeedconfig.h" // for CMAKE_SOURCE_DIR
 
-#include "metadata/Camera.h"         // for Camera
-#include "metadata/CameraMetaData.h" // for CameraMetaData
-#include <gtest/gtest.h>             // for Test, ASSERT_NO_THROW, GetTestTypeId
-#include <memory>                    // for unique_ptr
-#include <string>                    // for string
-
+#include "common/Common.h"                    // for uchar8
+#include "io/Buffer.h"                        // for Buffer
+#include "metadata/Camera.h"                  // for Camera
+#include "metadata/CameraDatabase.h"          // for Writer, Magic, Version
+#include "metadata/CameraMetaData.h"          // for CameraMetaData
+#include "metadata/CameraMetadataException.h" // for CameraMetadataException
+#include <gtest/gtest.h> // for Test, ASSERT_NO_THROW, GetTestTypeId
+#include <memory>        // for unique_ptr
+#include <string>        // for string
+#include <vector>        // for vector
+
+using rawspeed::Buffer;
 using rawspeed::CameraMetaData;
+using rawspeed::CameraMetadataException;
+using rawspeed::uchar8;
+using rawspeed::CameraDatabase::Writer;
 using std::unique_ptr;
 
 namespace rawspeed_test {
 
+static void putCamera(Writer* db, const std::string& make,
+                      const std::string& model, const std::string& mode,
+                      const std::string& filesize = "") {
+  Writer record;
+  for (const auto& str : {make, model, mode, make, model, model, make + model})
+    record.putString(str);
+  record.putU32(0); // aliases
+  record.putU32(0); // canonical aliases
+  record.putU32(2); // the CFA
+  record.putU32(2);
+  record.putBytes({0, 1, 1, 2});
+  record.putU32(1); // supported
+  for (int v : {4000, 3000, 8, 4})
+    record.putU32(v);
+  record.putU32(0); // black areas
+  record.putU32(1); // sensor info
+  for (int v : {64, 4095, 0, 0})
+    record.putU32(v);
+  record.putU32(0);
+  record.putU32(0); // decoder version
+  record.putU32(filesize.empty() ? 0 : 1);
+  if (!filesize.empty()) {
+    record.putString("filesize");
+    record.putString(filesize);
+  }
+
+  db->putString(make);
+  db->putString(model);
+  db->putString(mode);
+  db->putU32(record.data().size());
+  db->putBytes(record.data());
+}
+
+// In the order of the cameras, so that it serializes back to the same bytes.
+static std::vector<uchar8> createDatabase() {
+  Writer db;
+  db.putU32(rawspeed::CameraDatabase::Magic);
+  db.putU32(rawspeed::CameraDatabase::Version);
+  db.putU32(4);
+  putCamera(&db, "Canon", "PowerShot A", "chdk", "123456");
+  putCamera(&db, "Canon", "PowerShot B", "");
+  putCamera(&db, "NIKON", "D3", "12bit");
+  putCamera(&db, "NIKON", "D3", "14bit");
+  return db.release();
+}
+
+TEST(CameraMetaDataTest, Database) {
+  const auto database = createDatabase();
+  CameraMetaData data(Buffer(database.data(), database.size()));
+
+  // Only the CHDK camera is decoded, the rest are looked up lazily.
+  ASSERT_EQ(data.cameras.size(), 1);
+  ASSERT_TRUE(data.hasChdkCamera(123456));
+  ASSERT_EQ(data.getChdkCamera(123456)->model, "PowerShot A");
+
+  const auto* d3 = data.getCamera("NIKON", "D3", "14bit");
+  ASSERT_NE(d3, nullptr);
+  ASSERT_EQ(d3->mode, "14bit");
+  ASSERT_EQ(d3->cropSize.x, 4000);
+  ASSERT_EQ(d3->sensorInfo.size(), 1);
+  ASSERT_EQ(data.cameras.size(), 2);
+
+  ASSERT_EQ(data.getCamera("NIKON", "D3", "16bit"), nullptr);
+  ASSERT_EQ(data.getCamera("NIKON", "D4"), nullptr);
+  ASSERT_NE(data.getCamera(" NIKON ", "D3 "), nullptr);
+  ASSERT_EQ(data.cameras.size(), 3);
+
+  data.disableMake("Canon");
+  ASSERT_EQ(data.cameras.size(), 4);
+  ASSERT_FALSE(data.getCamera("Canon", "PowerShot B", "")->supported);
+  ASSERT_TRUE(d3->supported);
+}
+
+TEST(CameraMetaDataTest, MaterializeAll) {
+  const auto database = createDatabase();
+  const CameraMetaData data(Buffer(database.data(), database.size()));
+  ASSERT_EQ(data.cameras.size(), 1);
+
+  data.materializeAll();
+  ASSERT_EQ(data.cameras.size(), 4);
+  ASSERT_NE(data.getCamera("NIKON", "D3", "12bit"), nullptr);
+  ASSERT_EQ(data.cameras.size(), 4);
+}
+
+TEST(CameraMetaDataTest, DatabaseRoundTrip) {
+  const auto database = createDatabase();
+  const CameraMetaData data(Buffer(database.data(), database.size()));
+  ASSERT_EQ(data.serialize(), database);
+}
+
+TEST(CameraMetaDataTest, BadDatabase) {
+  auto database = createDatabase();
+  database[0] ^= 1;
+  ASSERT_THROW(CameraMetaData(Buffer(database.data(), database.size())),
+               CameraMetadataException);
+  database[0] ^= 1;
+
+  database[4] ^= 1;
+  ASSERT_THROW(CameraMetaData(Buffer(database.data(), database.size())),
+               CameraMetadataException);
+  database[4] ^= 1;
+
+  // Even when the truncated record is not looked up.
+  ASSERT_THROW(CameraMetaData(Buffer(database.data(), database.size() - 1)),
+               CameraMetadataException);
+}
+
 #ifdef HAVE_PUGIXML
 
 static const std::string camfile(CMAKE_SOURCE_DIR "/data/cameras.xml");
@@ -44,6 +160,19 @@ TEST(CameraMetaDataTest, CamerasXml) {
   });
 }
 
+TEST(CameraMetaDataTest, CamerasXmlRoundTrip) {
+  const CameraMetaData xml(camfile.c_str());
+  const auto database = xml.serialize();
+
+  const CameraMetaData bin(Buffer(database.data(), database.size()));
+  ASSERT_EQ(bin.serialize(), database);
+
+  const auto* d3 =
+      bin.getCamera("NIKON CORPORATION", "NIKON D3", "14bit-compressed");
+  ASSERT_NE(nullptr, d3);
+  ASSERT_EQ("D3", d3->canonical_model);
+}
+
 TEST(CameraMetaDataTest, PrefixSearch) {
   ASSERT_NO_THROW({
     CameraMetaData Data(camfile.c_str());
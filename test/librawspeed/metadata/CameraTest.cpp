@@ -18,10 +18,25 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
-#include "metadata/Camera.h" // for Hints
-#include <gtest/gtest.h>     // for AssertionResult, GetBoolAssertionFailur...
-#include <string>            // for basic_string, string
+#include "metadata/Camera.h"                  // for Hints, Camera
+#include "io/Buffer.h"                        // for Buffer, DataBuffer
+#include "io/ByteStream.h"                    // for ByteStream
+#include "io/Endianness.h"                    // for Endianness
+#include "metadata/CameraDatabase.h"          // for Writer
+#include "metadata/CameraMetadataException.h" // for CameraMetadataException
+#include "metadata/CameraSensorInfo.h"        // for CameraSensorInfo
+#include <gtest/gtest.h> // for AssertionResult, GetBoolAssertionFailur...
+#include <limits>        // for numeric_limits
+#include <string>        // for basic_string, string
+#include <vector>        // for vector
 
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::Camera;
+using rawspeed::CameraMetadataException;
+using rawspeed::CameraSensorInfo;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
 using rawspeed::Hints;
 using std::string;
 using std::to_string;
@@ -126,6 +141,29 @@ TEST(CameraTest, HintsDouble) {
   ASSERT_EQ(hints.get(key, 0.0), val);
 }
 
+TEST(CameraTest, HintsNumbers) {
+  Hints hints;
+  hints.add("leading", "12.5px");
+  hints.add("large", "99999999999");
+  hints.add("negative", "-3");
+  hints.add("nan", "abc");
+
+  ASSERT_EQ(hints.get("leading", 0), 12);
+  ASSERT_EQ(hints.get("leading", 0.0), 12.5);
+  ASSERT_EQ(hints.get("leading", 0.0F), 12.5F);
+  ASSERT_EQ(hints.get("leading", string()), "12.5px");
+
+  // Saturated to the range of the type.
+  ASSERT_EQ(hints.get("large", 0), std::numeric_limits<int>::max());
+  ASSERT_EQ(hints.get("large", 0LL), 99999999999LL);
+  ASSERT_EQ(hints.get("negative", 0), -3);
+  ASSERT_EQ(hints.get("negative", 7U), 0U);
+
+  // Like std::istream, if it is not a number.
+  ASSERT_EQ(hints.get("nan", 42), 0);
+  ASSERT_EQ(hints.get("nan", 2.71), 0.0);
+}
+
 TEST(BoolHintTest, HintsBoolTrue) {
   Hints hints;
 
@@ -154,4 +192,85 @@ TEST_P(BoolHintTest, HintsBool) {
   ASSERT_FALSE(hints.get(key, true));
 }
 
+// The record of the binary camera database, with only these sensors set.
+static std::vector<rawspeed::uchar8>
+createRecord(const std::vector<CameraSensorInfo>& sensors) {
+  rawspeed::CameraDatabase::Writer record;
+  for (int i = 0; i < 7; i++)
+    record.putString("x");
+  record.putU32(0); // aliases
+  record.putU32(0); // canonical aliases
+  record.putU32(0); // the CFA
+  record.putU32(0);
+  record.putU32(1); // supported
+  for (int i = 0; i < 4; i++)
+    record.putU32(0);
+  record.putU32(0); // black areas
+  record.putU32(sensors.size());
+  for (const auto& info : sensors) {
+    for (int v : {info.mBlackLevel, info.mWhiteLevel, info.mMinIso,
+                  info.mMaxIso})
+      record.putU32(v);
+    record.putU32(0);
+  }
+  record.putU32(0); // decoder version
+  record.putU32(0); // hints
+  return record.release();
+}
+
+static Camera createCamera(const std::vector<rawspeed::uchar8>& record) {
+  ByteStream bs(DataBuffer(Buffer(record.data(), record.size()),
+                           Endianness::little));
+  return Camera(&bs);
+}
+
+TEST(CameraTest, SensorInfo) {
+  // The black level is the index, to tell them apart.
+  const std::vector<CameraSensorInfo> sensors = {
+      {0, 0, 100, 400, {}},    {1, 0, 0, 0, {}},        {2, 0, 200, 200, {}},
+      {3, 0, 800, 0, {}},      {4, 0, 1600, 3200, {}},  {5, 0, 0, 0, {}},
+      {6, 0, 6400, 6400, {}},
+  };
+  const auto record = createRecord(sensors);
+  const Camera cam = createCamera(record);
+
+  // The defaults only start at 0.
+  ASSERT_THROW(cam.getSensorInfo(-1), CameraMetadataException);
+
+  // As the linear search over all of them would find it.
+  for (int iso = 0; iso < 10000; iso++) {
+    std::vector<int> candidates;
+    for (auto i = 0UL; i < sensors.size(); i++) {
+      if (sensors[i].isIsoWithin(iso))
+        candidates.push_back(i);
+    }
+    int expected = candidates.front();
+    for (int i : candidates) {
+      if (!sensors[i].isDefault()) {
+        expected = i;
+        break;
+      }
+    }
+
+    ASSERT_EQ(cam.getSensorInfo(iso)->mBlackLevel, expected) << iso;
+  }
+}
+
+TEST(CameraTest, SensorInfoNone) {
+  const auto none = createRecord({});
+  ASSERT_THROW(createCamera(none).getSensorInfo(100), CameraMetadataException);
+
+  // A single one is used for any ISO.
+  const auto one = createRecord({{7, 0, 100, 200, {}}});
+  ASSERT_EQ(createCamera(one).getSensorInfo(1000)->mBlackLevel, 7);
+
+  const auto ranges =
+      createRecord({{0, 0, 100, 200, {}}, {1, 0, 400, 800, {}}});
+  const Camera cam = createCamera(ranges);
+  ASSERT_EQ(cam.getSensorInfo(150)->mBlackLevel, 0);
+  ASSERT_EQ(cam.getSensorInfo(800)->mBlackLevel, 1);
+  ASSERT_THROW(cam.getSensorInfo(300), CameraMetadataException);
+  ASSERT_THROW(cam.getSensorInfo(50), CameraMetadataException);
+}
+
 } // namespace rawspeed_test
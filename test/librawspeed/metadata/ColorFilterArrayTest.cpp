@@ -306,4 +306,57 @@ TEST_P(ColorFilterArrayShiftTest, shiftEqualityTest) {
   });
 }
 
+template <int W, int H> static void checkPattern(const ColorFilterArray& cfa) {
+  const rawspeed::CFAPattern<W, H> pattern(cfa);
+  for (int y = -13; y < 13; y++) {
+    for (int x = -13; x < 13; x++)
+      ASSERT_EQ(pattern.getColorAt(x, y), cfa.getColorAt(x, y)) << x << y;
+  }
+}
+
+TEST(ColorFilterArrayTestBasic, Pattern) {
+  ColorFilterArray bayer;
+  bayer.setCFA(square, CFA_RED, CFA_GREEN, CFA_GREEN, CFA_BLUE);
+  checkPattern<2, 2>(bayer);
+
+  ColorFilterArray xtrans(iPoint2D(6, 6));
+  for (int y = 0; y < 6; y++) {
+    for (int x = 0; x < 6; x++)
+      xtrans.setColorAt({x, y}, static_cast<CFAColor>((x * 5 + y * 3) % 3));
+  }
+  checkPattern<6, 6>(xtrans);
+
+  // Neither of the two.
+  ColorFilterArray other(iPoint2D(2, 3));
+  for (int y = 0; y < 3; y++) {
+    for (int x = 0; x < 2; x++)
+      other.setColorAt({x, y}, static_cast<CFAColor>(x + y));
+  }
+  checkPattern<2, 3>(other);
+
+  ASSERT_ANY_THROW(rawspeed::BayerPattern{xtrans});
+  ASSERT_ANY_THROW(rawspeed::XTransPattern{bayer});
+}
+
+TEST(ColorFilterArrayTestBasic, ShiftXTrans) {
+  ColorFilterArray xtrans(iPoint2D(6, 6));
+  for (int y = 0; y < 6; y++) {
+    for (int x = 0; x < 6; x++)
+      xtrans.setColorAt({x, y}, static_cast<CFAColor>((x + 2 * y) % 7));
+  }
+
+  for (int n : {-7, -1, 1, 2, 5, 13}) {
+    ColorFilterArray left = xtrans;
+    left.shiftLeft(n);
+    ColorFilterArray down = xtrans;
+    down.shiftDown(n);
+    for (int y = 0; y < 6; y++) {
+      for (int x = 0; x < 6; x++) {
+        ASSERT_EQ(left.getColorAt(x, y), xtrans.getColorAt(x + n, y));
+        ASSERT_EQ(down.getColorAt(x, y), xtrans.getColorAt(x, y + n));
+      }
+    }
+  }
+}
+
 } // namespace rawspeed_test
@@ -0,0 +1,101 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "parsers/RawParser.h"            // for RawParser
+#include "common/Common.h"                // for uchar8
+#include "decoders/RawDecoder.h"          // for RawDecoder
+#include "common/RawspeedException.h"     // for RawspeedException
+#include "decoders/RawDecoderException.h" // for RawDecoderException
+#include "io/Buffer.h"                    // for Buffer
+#include <cstring>                        // for memcpy
+#include <gtest/gtest.h>                  // for Test, ASSERT_THROW
+#include <string>                         // for string
+#include <vector>                         // for vector
+
+using rawspeed::Buffer;
+using rawspeed::RawDecoderException;
+using rawspeed::RawParser;
+using rawspeed::uchar8;
+
+namespace rawspeed_test {
+
+// A file of the given size, starting with these bytes, and then garbage.
+static std::vector<uchar8> createFile(const std::string& header,
+                                      size_t size = 4096) {
+  std::vector<uchar8> data(size, 0xA5);
+  memcpy(data.data(), header.data(), header.size());
+  return data;
+}
+
+template <typename Exception = RawDecoderException>
+static void checkNoDecoder(const std::vector<uchar8>& data) {
+  const Buffer buf(data.data(), data.size());
+  RawParser parser(&buf);
+  ASSERT_THROW(parser.getDecoder(), Exception);
+}
+
+static RawParser::Format probe(const std::vector<uchar8>& data) {
+  return RawParser::probe(Buffer(data.data(), data.size()));
+}
+
+TEST(RawParserTest, TooSmall) {
+  checkNoDecoder(createFile("II*", 104));
+  ASSERT_EQ(probe(createFile(std::string("II*\0", 4), 104)),
+            RawParser::Format::Unsupported);
+}
+
+TEST(RawParserTest, Probe) {
+  using Format = RawParser::Format;
+  ASSERT_EQ(probe(createFile(std::string("II*\0", 4))), Format::TIFF);
+  ASSERT_EQ(probe(createFile(std::string("MM\0*", 4))), Format::TIFF);
+  ASSERT_EQ(probe(createFile(std::string("IIRO", 4))), Format::TIFF);
+  ASSERT_EQ(probe(createFile(std::string("IIU\0", 4))), Format::TIFF);
+  ASSERT_EQ(probe(createFile(std::string("II\x1A\0\0\0HEAPCCDR", 14))),
+            Format::CIFF);
+  ASSERT_EQ(probe(createFile(std::string("\0MRM", 4))), Format::MRW);
+  ASSERT_EQ(probe(createFile("FUJIFILMCCD-RAW ")), Format::RAF);
+
+  ASSERT_EQ(probe(createFile("\xFF\xD8\xFF\xE0")), Format::Unsupported);
+  ASSERT_EQ(probe(createFile(std::string("\0\0\0\x18" "ftypheic", 12))),
+            Format::Unsupported);
+  ASSERT_EQ(probe(createFile("II")), Format::Unsupported);
+}
+
+// Not even of the right format.
+TEST(RawParserTest, NotRaw) {
+  checkNoDecoder(createFile(std::string(8, '\0')));
+  checkNoDecoder(createFile("\xFF\xD8\xFF\xE0"));    // JPEG
+  checkNoDecoder(createFile("\x89PNG\r\n\x1A\n"));   // PNG
+  checkNoDecoder(createFile("II"));                  // not TIFF, nor CIFF
+  checkNoDecoder(createFile(std::string("MM\0\x2B", 4)));
+}
+
+// Looks like the format, but it is broken further in. The parser of the
+// format may then throw e.g. an IOException, as it always did.
+TEST(RawParserTest, Broken) {
+  for (const auto& header :
+       {std::string("II*\0", 4), std::string("MM\0*", 4),
+        std::string("IIRO", 4), std::string("IIU\0", 4), // ORF, RW2
+        std::string("II\x1A\0\0\0HEAPCCDR", 14), std::string("\0MRM", 4),
+        std::string("FUJIFILMCCD-RAW ")})
+    checkNoDecoder<rawspeed::RawspeedException>(createFile(header));
+}
+
+} // namespace rawspeed_test
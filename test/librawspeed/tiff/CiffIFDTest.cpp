@@ -0,0 +1,118 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "tiff/CiffIFD.h"                // for CiffIFD
+#include "common/Common.h"               // for uchar8, uint32, ushort16
+#include "io/Buffer.h"                   // for Buffer, DataBuffer
+#include "io/ByteStream.h"               // for ByteStream
+#include "io/Endianness.h"               // for Endianness, Endianness::little
+#include "parsers/CiffParserException.h" // for CiffParserException
+#include "tiff/CiffEntry.h"              // for CiffEntry
+#include "tiff/CiffTag.h"                // for CiffTag, CIFF_SENSORINFO
+#include <gtest/gtest.h>                 // for Test, ASSERT_EQ
+#include <utility>                       // for pair
+#include <vector>                        // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::CiffIFD;
+using rawspeed::CiffParserException;
+using rawspeed::CiffTag;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+static void putU16(std::vector<uchar8>* data, ushort16 v) {
+  data->emplace_back(v);
+  data->emplace_back(v >> 8);
+}
+
+static void putU32(std::vector<uchar8>* data, uint32 v) {
+  putU16(data, v);
+  putU16(data, v >> 16);
+}
+
+// A directory, with the given value data, and the entries, which are either
+// stored in the entry itself, or are the size and the offset of their value.
+static std::vector<uchar8>
+createDirectory(const std::vector<uchar8>& valueData,
+                const std::vector<std::pair<ushort16, uint32>>& entries) {
+  std::vector<uchar8> data(valueData);
+  putU16(&data, entries.size());
+  for (const auto& e : entries) {
+    putU16(&data, e.first);
+    if (e.first & 0x4000) {
+      putU32(&data, e.second);
+      putU32(&data, 0);
+    } else {
+      putU32(&data, valueData.size());
+      putU32(&data, 0);
+    }
+  }
+  putU32(&data, valueData.size());
+  return data;
+}
+
+static ByteStream getStream(const std::vector<uchar8>& data) {
+  return ByteStream(
+      DataBuffer(Buffer(data.data(), data.size()), Endianness::little));
+}
+
+TEST(CiffIFDTest, Entries) {
+  const auto sub =
+      createDirectory({}, {{0x4000 | rawspeed::CIFF_DECODERTABLE, 2}});
+
+  // Not in the order of the tags, with a duplicate, one we do not care
+  // about, and a sub-IFD.
+  const auto data = createDirectory(
+      sub, {{0x4000 | rawspeed::CIFF_SENSORINFO, 1},
+            {0x4000 | 0x1123, 5},
+            {rawspeed::CIFF_SUBIFD, 0},
+            {0x4000 | rawspeed::CIFF_SHOTINFO, 3},
+            {0x4000 | rawspeed::CIFF_SENSORINFO, 4}});
+
+  const CiffIFD root(nullptr, getStream(data));
+
+  // The later of the two entries wins.
+  ASSERT_EQ(root.getEntry(rawspeed::CIFF_SENSORINFO)->getU16(), 4);
+  ASSERT_EQ(root.getEntry(rawspeed::CIFF_SHOTINFO)->getU16(), 3);
+  ASSERT_FALSE(root.hasEntry(rawspeed::CIFF_DECODERTABLE));
+
+  ASSERT_TRUE(root.hasEntryRecursive(rawspeed::CIFF_DECODERTABLE));
+  ASSERT_EQ(root.getEntryRecursive(rawspeed::CIFF_DECODERTABLE)->getU32(), 2);
+  ASSERT_EQ(root.getEntryRecursive(rawspeed::CIFF_RAWDATA), nullptr);
+  ASSERT_EQ(root.getIFDsWithTag(rawspeed::CIFF_DECODERTABLE).size(), 1);
+  ASSERT_EQ(root.getIFDsWithTagWhere(rawspeed::CIFF_SENSORINFO, 4U).size(), 1);
+  ASSERT_TRUE(root.getIFDsWithTagWhere(rawspeed::CIFF_SENSORINFO, 1U).empty());
+}
+
+TEST(CiffIFDTest, OverlappingValueData) {
+  const std::vector<uchar8> value(8);
+  const auto data = createDirectory(value, {{rawspeed::CIFF_SHOTINFO, 0},
+                                            {rawspeed::CIFF_WHITEBALANCE, 0}});
+
+  ASSERT_THROW(CiffIFD(nullptr, getStream(data)), CiffParserException);
+}
+
+} // namespace rawspeed_test
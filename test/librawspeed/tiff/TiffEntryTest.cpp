@@ -0,0 +1,121 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "tiff/TiffEntry.h"              // for TiffEntry, TiffEntryView
+#include "common/Common.h"               // for uchar8, uint32, ushort16
+#include "io/Buffer.h"                   // for Buffer, DataBuffer
+#include "io/ByteStream.h"               // for ByteStream
+#include "io/Endianness.h"               // for Endianness, Endianness::big
+#include "parsers/TiffParserException.h" // for TiffParserException
+#include "tiff/TiffTag.h"                // for TiffTag, STRIPOFFSETS
+#include <cstring>                       // for memcmp
+#include <gtest/gtest.h>                 // for ParamIteratorInterface
+#include <vector>                        // for vector
+
+using rawspeed::Buffer;
+using rawspeed::ByteStream;
+using rawspeed::DataBuffer;
+using rawspeed::Endianness;
+using rawspeed::TiffDataType;
+using rawspeed::TiffEntry;
+using rawspeed::TiffParserException;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+class TiffEntryViewTest : public ::testing::TestWithParam<Endianness> {
+protected:
+  TiffEntryViewTest() {
+    for (int i = 0; i < 64; i++)
+      data.emplace_back(i * 37 + 11);
+  }
+
+  TiffEntry make(TiffDataType type, uint32 count, uint32 size) const {
+    return TiffEntry(nullptr, rawspeed::STRIPOFFSETS, type, count,
+                     ByteStream(DataBuffer(Buffer(data.data(), size),
+                                           GetParam())));
+  }
+
+  std::vector<uchar8> data;
+};
+
+INSTANTIATE_TEST_CASE_P(ByteOrders, TiffEntryViewTest,
+                        ::testing::Values(Endianness::little,
+                                          Endianness::big));
+
+TEST_P(TiffEntryViewTest, Short) {
+  const TiffEntry e = make(rawspeed::TIFF_SHORT, 32, 64);
+
+  const auto u16 = e.getU16View(32);
+  const auto u32 = e.getU32View(32);
+  ASSERT_EQ(u16.size(), 32);
+  ASSERT_EQ(u32.size(), 32);
+  const auto u16s = e.getU16Array(32);
+  const auto u32s = e.getU32Array(32);
+  for (uint32 i = 0; i < 32; i++) {
+    ASSERT_EQ(u16[i], e.getU16(i));
+    ASSERT_EQ(u32[i], e.getU32(i));
+    ASSERT_EQ(u16s[i], e.getU16(i));
+    ASSERT_EQ(u32s[i], e.getU32(i));
+  }
+}
+
+TEST_P(TiffEntryViewTest, Long) {
+  const TiffEntry e = make(rawspeed::TIFF_LONG, 16, 64);
+
+  const auto u32 = e.getU32View(16);
+  const auto u32s = e.getU32Array(16);
+  for (uint32 i = 0; i < 16; i++) {
+    ASSERT_EQ(u32[i], e.getU32(i));
+    ASSERT_EQ(u32s[i], e.getU32(i));
+  }
+  ASSERT_THROW(e.getU16View(16), TiffParserException);
+}
+
+TEST_P(TiffEntryViewTest, Float) {
+  const TiffEntry e = make(rawspeed::TIFF_FLOAT, 16, 64);
+
+  const auto f = e.getFloatArray(16);
+  for (uint32 i = 0; i < 16; i++) {
+    const float expected = e.getFloat(i);
+    // Compare the bits, some of these are NaN.
+    ASSERT_EQ(memcmp(&f[i], &expected, sizeof(float)), 0) << i;
+  }
+}
+
+TEST_P(TiffEntryViewTest, OutOfBounds) {
+  const TiffEntry e = make(rawspeed::TIFF_SHORT, 8, 16);
+
+  ASSERT_NO_THROW(e.getU32View(8));
+  ASSERT_ANY_THROW(e.getU16View(9));
+  ASSERT_ANY_THROW(e.getU32Array(9));
+}
+
+TEST_P(TiffEntryViewTest, WrongType) {
+  const TiffEntry e = make(rawspeed::TIFF_SSHORT, 8, 16);
+
+  ASSERT_THROW(e.getU16View(8), TiffParserException);
+  ASSERT_THROW(e.getU32View(8), TiffParserException);
+}
+
+} // namespace rawspeed_test
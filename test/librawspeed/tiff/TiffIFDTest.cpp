@@ -0,0 +1,149 @@
+/*
+    RawSpeed - RAW file decoder.
+
+    Copyright (C) 2019 RawSpeed contributors
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "tiff/TiffIFD.h"                // for TiffIFD, TiffRootIFD
+#include "common/Common.h"               // for uchar8, uint32, ushort16
+#include "io/Buffer.h"                   // for Buffer
+#include "parsers/TiffParser.h"          // for TiffParser
+#include "parsers/TiffParserException.h" // for TiffParserException
+#include "tiff/TiffEntry.h"              // for TiffDataType, TIFF_SHORT
+#include "tiff/TiffTag.h"                // for TiffTag, ORIENTATION
+#include <gtest/gtest.h>                 // for Test, ASSERT_EQ
+#include <vector>                        // for vector
+
+using rawspeed::Buffer;
+using rawspeed::TiffParser;
+using rawspeed::TiffParserException;
+using rawspeed::TiffTag;
+using rawspeed::uchar8;
+using rawspeed::uint32;
+using rawspeed::ushort16;
+
+namespace rawspeed_test {
+
+static void putU16(std::vector<uchar8>* data, ushort16 v) {
+  data->emplace_back(v);
+  data->emplace_back(v >> 8);
+}
+
+static void putU32(std::vector<uchar8>* data, uint32 v) {
+  putU16(data, v);
+  putU16(data, v >> 16);
+}
+
+struct Entry {
+  ushort16 tag;
+  uint32 value;
+  rawspeed::TiffDataType type = rawspeed::TIFF_SHORT;
+  uint32 count = 1;
+};
+
+// One IFD, the values of the SHORT and LONG entries are stored inline.
+static void putIFD(std::vector<uchar8>* data, const std::vector<Entry>& entries,
+                   uint32 nextIFD = 0) {
+  putU16(data, entries.size());
+  for (const auto& e : entries) {
+    putU16(data, e.tag);
+    putU16(data, e.type);
+    putU32(data, e.count);
+    putU32(data, e.value);
+  }
+  putU32(data, nextIFD);
+}
+
+TEST(TiffIFDTest, Entries) {
+  std::vector<uchar8> data = {'I', 'I', 42, 0};
+  putU32(&data, 8);
+
+  // Not in the order of the tags, with a duplicate, and an EXIF IFD.
+  const uint32 exif = 8 + 2 + 12 * 5 + 4;
+  putIFD(&data, {{0x0300, 3},
+                 {rawspeed::ORIENTATION, 1},
+                 {rawspeed::EXIFIFDPOINTER, exif, rawspeed::TIFF_LONG},
+                 {0x0100, 2},
+                 {rawspeed::ORIENTATION, 6}});
+  putIFD(&data, {{rawspeed::ISOSPEEDRATINGS, 100}, {0x0101, 4}});
+
+  const auto root =
+      TiffParser::parse(nullptr, Buffer(data.data(), data.size()));
+  ASSERT_EQ(root->getSubIFDs().size(), 1);
+  const auto* ifd = root->getSubIFDs()[0].get();
+
+  // The later of the two entries wins.
+  ASSERT_EQ(ifd->getEntry(rawspeed::ORIENTATION)->getU16(), 6);
+  ASSERT_EQ(ifd->getEntry(static_cast<TiffTag>(0x0100))->getU16(), 2);
+  ASSERT_EQ(ifd->getEntry(static_cast<TiffTag>(0x0300))->getU16(), 3);
+
+  // The pointer is replaced by the IFD it points to.
+  ASSERT_FALSE(ifd->hasEntry(rawspeed::EXIFIFDPOINTER));
+  ASSERT_FALSE(ifd->hasEntry(rawspeed::ISOSPEEDRATINGS));
+  ASSERT_FALSE(ifd->hasEntry(static_cast<TiffTag>(0x0200)));
+  ASSERT_THROW(ifd->getEntry(static_cast<TiffTag>(0x0200)),
+               TiffParserException);
+  ASSERT_THROW(ifd->getEntry(static_cast<TiffTag>(0x0400)),
+               TiffParserException);
+
+  ASSERT_EQ(root->getEntryRecursive(rawspeed::ISOSPEEDRATINGS)->getU16(), 100);
+  ASSERT_EQ(root->getEntryRecursive(static_cast<TiffTag>(0x0101))->getU16(), 4);
+  ASSERT_EQ(root->getIFDsWithTag(rawspeed::ORIENTATION).size(), 1);
+  ASSERT_EQ(root->getIFDsWithTag(rawspeed::ISOSPEEDRATINGS).size(), 1);
+  ASSERT_TRUE(root->getIFDsWithTag(static_cast<TiffTag>(0x0200)).empty());
+}
+
+// The IFD0, and then a MakerNote at the given offset.
+static std::vector<uchar8> createMakerNoteFile(uint32 makerNote) {
+  std::vector<uchar8> data = {'I', 'I', 42, 0};
+  putU32(&data, 8);
+  putIFD(&data, {{rawspeed::ORIENTATION, 1},
+                 {rawspeed::MAKERNOTE, makerNote, rawspeed::TIFF_UNDEFINED,
+                  2 + 12 + 4}});
+  putIFD(&data, {{0x0001, 42}});
+  return data;
+}
+
+TEST(TiffIFDTest, MakerNote) {
+  const auto data = createMakerNoteFile(8 + 2 + 12 * 2 + 4);
+  const auto root =
+      TiffParser::parse(nullptr, Buffer(data.data(), data.size()));
+  const auto* ifd = root->getSubIFDs()[0].get();
+
+  // Not needed to find what is in the IFD0.
+  ASSERT_EQ(root->getEntryRecursive(rawspeed::ORIENTATION)->getU16(), 1);
+  ASSERT_TRUE(ifd->hasEntry(rawspeed::MAKERNOTE));
+
+  ASSERT_EQ(root->getEntryRecursive(static_cast<TiffTag>(0x0001))->getU16(),
+            42);
+  ASSERT_EQ(ifd->getSubIFDs().size(), 1);
+  ASSERT_EQ(root->getIFDsWithTag(static_cast<TiffTag>(0x0001)).size(), 1);
+}
+
+TEST(TiffIFDTest, OverlappingMakerNote) {
+  // It is the IFD0 itself.
+  const auto data = createMakerNoteFile(8);
+  const auto root =
+      TiffParser::parse(nullptr, Buffer(data.data(), data.size()));
+  const auto* ifd = root->getSubIFDs()[0].get();
+
+  ASSERT_EQ(root->getEntryRecursive(static_cast<TiffTag>(0x0001)), nullptr);
+  ASSERT_TRUE(ifd->getSubIFDs().empty());
+  ASSERT_TRUE(ifd->hasEntry(rawspeed::MAKERNOTE));
+}
+
+} // namespace rawspeed_test